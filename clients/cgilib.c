@@ -24,6 +24,36 @@
 
 #include "cgilib.h"
 #include "parseconf.h"
+#include "upsclient.h"
+
+/* how long a refresh of the status cache may take before another
+ * process takes over */
+#define CACHE_REFRESH_MAX	10
+
+/* the values of the variables of a UPS, from one LIST VAR or from the
+ * status cache, so pages need neither a GET per variable nor (while the
+ * cache is fresh) a connection to upsd at all */
+typedef struct cgi_snap_s {
+	char	*sys;	/* as in hosts.conf: upsname[@hostname[:port]] */
+	int	ok;	/* 1 if its values could be had */
+	size_t	count;
+	char	**names, **values;
+	struct cgi_snap_s	*next;
+} cgi_snap_t;
+
+static	cgi_snap_t	*snaphead = NULL;
+
+/* STATUSCACHE <directory> <seconds> in hosts.conf */
+static	char	*cachedir = NULL;
+static	time_t	cachettl = 0;
+
+/* kept open for the next UPS if it is on the same upsd */
+static	UPSCONN_t	conn;
+static	int	connected = 0;
+static	char	*connhost = NULL;
+static	uint16_t	connport = 0;
+
+static	char	cgi_errbuf[SMALLBUF] = "";
 
 static char *unescape(char *buf)
 {
@@ -84,7 +114,10 @@ void extractcgiargs(void)
 	while (ptr) {
 		varname = ptr;
 		eq = strchr(varname, '=');
-		if (!eq) {
+		amp = strchr(varname, '&');
+
+		/* no value: "treemode&host=..." */
+		if (!eq || (amp && amp < eq)) {
 			ptr = strchr(varname, '&');
 			if (ptr)
 				*ptr++ = '\0';
@@ -154,6 +187,341 @@ void extractpostargs(void)
 	}
 }
 
+static void snap_add(cgi_snap_t *snap, const char *name, const char *value)
+{
+	snap->names = xrealloc(snap->names, (snap->count + 1) * sizeof(char *));
+	snap->values = xrealloc(snap->values, (snap->count + 1) * sizeof(char *));
+	snap->names[snap->count] = xstrdup(name);
+	snap->values[snap->count] = xstrdup(value);
+	snap->count++;
+}
+
+static void snap_clear(cgi_snap_t *snap)
+{
+	size_t	i;
+
+	for (i = 0; i < snap->count; i++) {
+		free(snap->names[i]);
+		free(snap->values[i]);
+	}
+
+	free(snap->names);
+	free(snap->values);
+	snap->names = snap->values = NULL;
+	snap->count = 0;
+}
+
+/* get the values of the UPS from its upsd with one LIST VAR */
+static int snap_fetch(cgi_snap_t *snap)
+{
+	char	*upsname = NULL, *hostname = NULL, **answer;
+	const	char	*query[2];
+	uint16_t	port;
+	size_t	numa;
+	int	ret;
+
+	if (upscli_splitname(snap->sys, &upsname, &hostname, &port) != 0) {
+		snprintf(cgi_errbuf, sizeof(cgi_errbuf),
+			"Unusable UPS definition [%s]", snap->sys);
+		return -1;
+	}
+
+	/* not the same upsd, so disconnect */
+	if (connected && (strcmp(connhost, hostname) || connport != port)) {
+		upscli_disconnect(&conn);
+		connected = 0;
+	}
+
+	if (!connected) {
+		if (upscli_connect(&conn, hostname, port, 0) < 0) {
+			snprintf(cgi_errbuf, sizeof(cgi_errbuf), "%s",
+				upscli_strerror(&conn));
+			fprintf(stderr, "UPS [%s]: can't connect to server: %s\n",
+				snap->sys, cgi_errbuf);
+			upscli_disconnect(&conn);
+			free(upsname);
+			free(hostname);
+			return -1;
+		}
+
+		connected = 1;
+		free(connhost);
+		connhost = xstrdup(hostname);
+		connport = port;
+	}
+
+	query[0] = "VAR";
+	query[1] = upsname;
+
+	if (upscli_list_start(&conn, 2, query) < 0) {
+		ret = -1;
+	} else {
+		while ((ret = upscli_list_next(&conn, 2, query, &numa, &answer)) == 1) {
+			/* VAR <upsname> <varname> <val> */
+			if (numa >= 4)
+				snap_add(snap, answer[2], answer[3]);
+		}
+	}
+
+	if (ret < 0) {
+		snprintf(cgi_errbuf, sizeof(cgi_errbuf), "%s",
+			upscli_strerror(&conn));
+		snap_clear(snap);
+
+		if (upscli_fd(&conn) < 0) {
+			upscli_disconnect(&conn);
+			connected = 0;
+		}
+	}
+
+	free(upsname);
+	free(hostname);
+
+	return (ret < 0) ? -1 : 0;
+}
+
+/* the cache file of a UPS, with the characters which could mean
+ * something else in a path encoded as in URLs */
+static void cache_path(const char *sys, const char *suffix, char *buf, size_t buflen)
+{
+	const	char	*p;
+
+	snprintf(buf, buflen, "%s/", cachedir);
+
+	for (p = sys; *p; p++) {
+		if (isalnum((unsigned char)*p) || *p == '.' || *p == '-' || *p == '_')
+			snprintfcat(buf, buflen, "%c", *p);
+		else
+			snprintfcat(buf, buflen, "%%%02X", (unsigned int)(unsigned char)*p);
+	}
+
+	snprintfcat(buf, buflen, "%s", suffix);
+}
+
+static void cache_err(const char *errmsg)
+{
+	NUT_UNUSED_VARIABLE(errmsg);
+}
+
+/* load the cached values of the UPS if they are younger than maxage */
+static int cache_read(cgi_snap_t *snap, time_t maxage)
+{
+	char	fn[LARGEBUF];
+	struct	stat	st;
+	PCONF_CTX_t	ctx;
+	time_t	now;
+	int	ok = 1;
+
+	cache_path(snap->sys, "", fn, sizeof(fn));
+
+	time(&now);
+	if (stat(fn, &st) != 0 || now - st.st_mtime >= maxage || st.st_mtime > now)
+		return 0;
+
+	pconf_init(&ctx, cache_err);
+
+	if (!pconf_file_begin(&ctx, fn)) {
+		pconf_finish(&ctx);
+		return 0;
+	}
+
+	/* <varname> "<value>" */
+	while (pconf_file_next(&ctx)) {
+		if (pconf_parse_error(&ctx) || ctx.numargs < 2) {
+			ok = 0;
+			break;
+		}
+
+		snap_add(snap, ctx.arglist[0], ctx.arglist[1]);
+	}
+
+	pconf_finish(&ctx);
+
+	if (!ok)
+		snap_clear(snap);
+
+	return ok;
+}
+
+/* replace the cache file of the UPS with the values just fetched, which
+ * the other processes then see all at once */
+static void cache_write(cgi_snap_t *snap, int fd, const char *tmpfn)
+{
+	char	fn[LARGEBUF], enc[LARGEBUF];
+	FILE	*f;
+	size_t	i;
+	int	ok;
+
+	cache_path(snap->sys, "", fn, sizeof(fn));
+
+	if ((f = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmpfn);
+		return;
+	}
+
+	for (i = 0; i < snap->count; i++)
+		fprintf(f, "%s \"%s\"\n", snap->names[i],
+			pconf_encode(snap->values[i], enc, sizeof(enc)));
+
+	ok = (fclose(f) == 0);
+
+#ifdef WIN32
+	/* rename() does not replace files there */
+	if (ok)
+		unlink(fn);
+#endif
+
+	if (!ok || rename(tmpfn, fn) != 0) {
+		fprintf(stderr, "Can't update status cache %s: %s\n",
+			fn, strerror(errno));
+		unlink(tmpfn);
+	}
+}
+
+/* the values of the UPS: from this process, the cache or upsd */
+static cgi_snap_t *snap_get(const char *sys)
+{
+	cgi_snap_t	*snap;
+	char	tmpfn[LARGEBUF];
+	struct	stat	st;
+	int	fd = -1;
+
+	for (snap = snaphead; snap; snap = snap->next)
+		if (!strcmp(snap->sys, sys))
+			return snap;
+
+	snap = xcalloc(1, sizeof(*snap));
+	snap->sys = xstrdup(sys);
+	snap->next = snaphead;
+	snaphead = snap;
+
+	if (!cachedir) {
+		snap->ok = (snap_fetch(snap) == 0);
+		return snap;
+	}
+
+	if (cache_read(snap, cachettl)) {
+		snap->ok = 1;
+		return snap;
+	}
+
+	/* only one process refreshes it, the others make do with the
+	 * previous values a little longer rather than all asking upsd */
+	cache_path(sys, ".new", tmpfn, sizeof(tmpfn));
+	fd = open(tmpfn, O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+	if (fd < 0 && errno == EEXIST) {
+		if (stat(tmpfn, &st) == 0 && time(NULL) - st.st_mtime > CACHE_REFRESH_MAX) {
+			/* left over by a process which did not make it */
+			unlink(tmpfn);
+			fd = open(tmpfn, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		} else if (cache_read(snap, cachettl + CACHE_REFRESH_MAX)) {
+			snap->ok = 1;
+			return snap;
+		}
+	}
+
+	snap->ok = (snap_fetch(snap) == 0);
+
+	if (fd >= 0) {
+		if (snap->ok) {
+			cache_write(snap, fd, tmpfn);
+		} else {
+			close(fd);
+			unlink(tmpfn);
+		}
+	}
+
+	return snap;
+}
+
+int cgi_checkups(const char *sys)
+{
+	if (!sys)
+		return 0;
+
+	return snap_get(sys)->ok;
+}
+
+int cgi_getvar(const char *sys, const char *var, char *buf, size_t buflen)
+{
+	cgi_snap_t	*snap;
+	size_t	i;
+
+	if (!sys) {
+		snprintf(cgi_errbuf, sizeof(cgi_errbuf), "No UPS specified");
+		return -1;
+	}
+
+	snap = snap_get(sys);
+
+	if (!snap->ok)
+		return -1;
+
+	for (i = 0; i < snap->count; i++) {
+		if (!strcmp(snap->names[i], var)) {
+			snprintf(buf, buflen, "%s", snap->values[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int cgi_listvars(const char *sys,
+	void (*fn)(void *arg, const char *name, const char *value), void *arg)
+{
+	cgi_snap_t	*snap;
+	size_t	i;
+
+	if (!sys)
+		return -1;
+
+	snap = snap_get(sys);
+
+	if (!snap->ok)
+		return -1;
+
+	for (i = 0; i < snap->count; i++)
+		fn(arg, snap->names[i], snap->values[i]);
+
+	return 0;
+}
+
+const char *cgi_strerror(void)
+{
+	return cgi_errbuf;
+}
+
+void cgi_statuscache(const char *dir, const char *ttl)
+{
+	long	sec = strtol(ttl, NULL, 10);
+
+	free(cachedir);
+	cachedir = NULL;
+
+	/* 0 turns it off */
+	if (sec <= 0 || !dir || !*dir)
+		return;
+
+	cachedir = xstrdup(dir);
+	cachettl = (time_t)sec;
+}
+
+const char *cgi_cachedir(void)
+{
+	return cachedir;
+}
+
+void cgi_disconnect(void)
+{
+	if (connected)
+		upscli_disconnect(&conn);
+
+	connected = 0;
+}
+
 /* called for fatal errors in parseconf like malloc failures */
 static void cgilib_err(const char *errmsg)
 {
@@ -164,6 +532,7 @@ int checkhost(const char *host, char **desc)
 {
 	char	fn[SMALLBUF];
 	PCONF_CTX_t	ctx;
+	int	found = 0;
 
 	if (!host)
 		return 0;		/* deny null hostnames */
@@ -187,22 +556,27 @@ int checkhost(const char *host, char **desc)
 		}
 
 		/* MONITOR <host> <description> */
+		/* STATUSCACHE <directory> <seconds> */
 		if (ctx.numargs < 3)
 			continue;
 
+		if (!strcmp(ctx.arglist[0], "STATUSCACHE")) {
+			cgi_statuscache(ctx.arglist[1], ctx.arglist[2]);
+			continue;
+		}
+
 		if (strcmp(ctx.arglist[0], "MONITOR") != 0)
 			continue;
 
-		if (!strcmp(ctx.arglist[1], host)) {
+		if (!found && !strcmp(ctx.arglist[1], host)) {
 			if (desc)
 				*desc = xstrdup(ctx.arglist[2]);
 
-			pconf_finish(&ctx);
-			return 1;	/* found: allow access */
+			found = 1;	/* allow access */
 		}
 	}
 
 	pconf_finish(&ctx);
 
-	return 0;	/* not found: access denied */
+	return found;	/* not found: access denied */
 }
@@ -35,9 +35,36 @@ void extractcgiargs(void);
 /* like extractcgiargs, but this one is for POSTed values */
 void extractpostargs(void);
 
-/* see if a host is allowed per the hosts.conf */
+/* see if a host is allowed per the hosts.conf (and pick up its
+ * STATUSCACHE setting, if any) */
 int checkhost(const char *host, char **desc);
 
+/* the values of a UPS ("upsname[@hostname[:port]]") come from one
+ * LIST VAR, or from the status cache shared by the CGI processes when
+ * hosts.conf has a STATUSCACHE line: */
+
+/* 1 if the values of the UPS can be had */
+int cgi_checkups(const char *sys);
+
+/* 1 with the value of var in buf, 0 if the UPS does not have it, or -1
+ * if the values of the UPS can't be had (see cgi_strerror()) */
+int cgi_getvar(const char *sys, const char *var, char *buf, size_t buflen);
+
+/* call fn for each variable of the UPS; 0, or -1 as above */
+int cgi_listvars(const char *sys,
+	void (*fn)(void *arg, const char *name, const char *value), void *arg);
+
+const char *cgi_strerror(void);
+
+/* STATUSCACHE <directory> <seconds> */
+void cgi_statuscache(const char *dir, const char *ttl);
+
+/* its directory, or NULL when there is no status cache */
+const char *cgi_cachedir(void);
+
+/* close the connection to upsd, if one was needed */
+void cgi_disconnect(void);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
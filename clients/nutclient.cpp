@@ -27,7 +27,14 @@
  * class instance */
 #include <iostream>	/* std::cerr debugging */
 #include <cstdint>
+#include <climits>
+#include <utility>	/* std::move */
+#include <deque>
+#include <memory>
+#include <iterator>
+#include <algorithm>
 #include <cstdlib>
+#include <cctype>
 #include <stdlib.h>
 
 #ifndef WIN32
@@ -84,6 +91,7 @@ static inline int sktclose(int fh)
 #  include <unistd.h> /* close */
 #  include <netdb.h> /* gethostbyname */
 #  include <fcntl.h>
+#  include <poll.h>
 #  ifndef INVALID_SOCKET
 #    define INVALID_SOCKET -1
 #  endif
@@ -121,6 +129,21 @@ static inline int sktclose(int fh)
 #endif /* WIN32 */
 /* End of Windows/Linux Socket compatibility layer */
 
+#ifdef WITH_OPENSSL
+#  include <openssl/ssl.h>
+#  include <openssl/err.h>
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+#  include <nss.h>
+#  include <cert.h>
+#  include <prerror.h>
+#  include <ssl.h>
+#  include <private/pprio.h>
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+#ifdef WITH_ZLIB
+#  include <zlib.h>
+#endif /* WITH_ZLIB */
+
 
 /* Include nut common utility functions or define simple ones if not */
 #ifdef HAVE_NUTCOMMON
@@ -146,6 +169,10 @@ static inline char *xstrdup(const char *string){return strdup(string);}
 
 #include "nut_stdint.h" /* PRIuMAX etc. */
 
+#ifdef HAVE_NUTCOMMON
+#include "nutstatus.h" /* to check StatusFlags against */
+#endif
+
 /* To stay in line with modern C++, we use nullptr (not numeric NULL
  * or shim __null on some systems) which was defined after C++98.
  * The NUT C++ interface is intended for C++11 and newer, so we
@@ -231,18 +258,130 @@ public:
 	std::string read();
 	void write(const std::string& str);
 
+	/* With binary framing on, read() returns a value record as its
+	 * "VAR <dev> <var>" line, and the value apart (see hasValue()) */
+	void setBinary(bool binary);
+	bool isBinary()const{return _binary;}
+	bool hasValue()const{return _hasValue;}
+	const std::string& value()const{return _value;}
+
+	/* Requests of AsyncTcpClient: sent and replied to in order, each
+	 * reply line going to the handler in front until it returns true
+	 * (reply complete); fail() is called instead if disconnected */
+	struct Reply
+	{
+		std::function<bool(const std::string& line)> line;
+		std::function<void(std::exception_ptr error)> fail;
+	};
+	void queue(const std::string& req, const Reply& reply);
+	/* Send and read what can be without waiting, return replies left */
+	size_t process();
+	/* Wait for all replies (before a synchronous request) */
+	void finish();
+	size_t pending()const{return _replies.size();}
+	bool wantWrite()const{return _sent < _output.size();}
+	SOCKET fd()const{return _sock;}
+
+	/* Go on with TLS (after "STARTTLS" was accepted), resuming the
+	 * session of an earlier connection to the server if possible */
+	void startTLS(const std::string& host, uint16_t port, bool verify, const std::string& certPath);
+	bool isTLS()const;
+
+	/* Go on with deflate both ways (after "COMPRESS DEFLATE" was
+	 * accepted), on top of TLS if on */
+	void startCompression();
+	bool isCompressed()const;
 
 private:
+	bool ready(bool forWrite, bool wait = true);
+	/* Whether TLS has received data buffered, so not to wait for */
+	bool tlsPending()const;
+	ssize_t rawRead(void* buf, size_t sz);
+	ssize_t rawWrite(const void* buf, size_t sz);
+	/* Whether compressed data was received, so not to wait for */
+	bool zipPending()const;
+	void zipClose();
+	ssize_t tlsRead(void* buf, size_t sz);
+	ssize_t tlsWrite(const void* buf, size_t sz);
+	void tlsClose();
+	bool hasLine()const;
+	void answer(const std::string& line);
+	void more();
+	void fill(size_t sz);
+	std::string readRecord();
+
 	SOCKET _sock;
 	bool _debugConnect;
 	struct timeval	_tv;
-	std::string _buffer; /* Received buffer, string because data should be text only. */
+	/* Received data, text unless binary framing is on: unread from
+	 * _begin to _end, so lines are cut out without moving the rest */
+	std::vector<char> _buffer;
+	size_t _begin, _end;
+
+	bool _binary;
+	bool _hasValue;
+	std::string _value;
+	std::vector<std::string> _names; /* "VAR <dev> <var>" by id - 1 */
+
+	std::string _output; /* Queued requests, sent up to _sent */
+	size_t _sent;
+	std::deque<Reply> _replies;
+
+#ifdef WITH_OPENSSL
+	SSL* _ssl;
+	std::string _sslKey; /* Of the session to keep for resuming */
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	PRFileDesc* _ssl; /* Owns _sock once imported */
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+#ifdef WITH_ZLIB
+	bool _zip;
+	z_stream _zout;
+	z_stream _zin;
+	std::vector<unsigned char> _zinbuf; /* Read, not inflated yet */
+	bool _zmore; /* The last inflate() filled the buffer it had */
+#endif /* WITH_ZLIB */
 };
 
+/* Record types and sizes of binary framing, see include/binframe.h */
+static const unsigned char BINFRAME_BEGIN = 0x01, BINFRAME_END = 0x02,
+	BINFRAME_NAME = 0x03, BINFRAME_STR = 0x04, BINFRAME_NUM = 0x05,
+	BINFRAME_RESET = 0x06, BINFRAME_TYPE_MAX = 0x20;
+static const size_t BINFRAME_HEADER_LEN = 3, BINFRAME_ID_LEN = 4,
+	BINFRAME_NUM_LEN = BINFRAME_ID_LEN + 1 + 8, BINFRAME_NUM_DIGITS = 18;
+
+/* Initial size of the receive buffer, which grows for longer lines */
+static const size_t SOCKET_BUFLEN = 16384;
+/* Most written at once by process(), once poll() found room for it,
+ * or over TLS (then a whole record, rather than many small ones) */
+static const size_t SOCKET_SENDLEN = 1024;
+static const size_t SOCKET_TLS_SENDLEN = 16384;
+#ifdef WITH_ZLIB
+/* Compressed data read at once; the requests are short, so a small
+ * window and hash tables do to compress them */
+static const size_t SOCKET_ZIP_READLEN = 4096;
+static const int SOCKET_ZIP_WINDOW_BITS = 10, SOCKET_ZIP_MEM_LEVEL = 4;
+#endif /* WITH_ZLIB */
+
 Socket::Socket():
 _sock(INVALID_SOCKET),
 _debugConnect(false),
-_tv()
+_tv(),
+_buffer(SOCKET_BUFLEN),
+_begin(0),
+_end(0),
+_binary(false),
+_hasValue(false),
+_sent(0)
+#if defined(WITH_OPENSSL) || defined(WITH_NSS)
+,_ssl(nullptr)
+#endif
+#ifdef WITH_ZLIB
+,_zip(false)
+,_zout()
+,_zin()
+,_zmore(false)
+#endif
 {
 	_tv.tv_sec = -1;
 	_tv.tv_usec = 0;
@@ -559,12 +698,30 @@ void Socket::connect(const std::string& host, uint16_t port)
 
 void Socket::disconnect()
 {
+	zipClose();
+	tlsClose();
 	if(_sock != INVALID_SOCKET)
 	{
 		::closesocket(_sock);
 		_sock = INVALID_SOCKET;
 	}
-	_buffer.clear();
+	_begin = _end = 0;
+	setBinary(false);
+
+	_output.clear();
+	_sent = 0;
+	if(!_replies.empty())
+	{
+		// Handlers may queue requests again (which fails now)
+		std::deque<Reply> replies;
+		replies.swap(_replies);
+		std::exception_ptr error = std::make_exception_ptr(
+			nut::IOException("Connection closed"));
+		for(std::deque<Reply>::iterator it=replies.begin(); it!=replies.end(); ++it)
+		{
+			it->fail(error);
+		}
+	}
 }
 
 bool Socket::isConnected()const
@@ -572,874 +729,3016 @@ bool Socket::isConnected()const
 	return _sock!=INVALID_SOCKET;
 }
 
-size_t Socket::read(void* buf, size_t sz)
+/* Wait up to the timeout (or not at all) for the socket to be
+ * readable (or writable) */
+bool Socket::ready(bool forWrite, bool wait)
+{
+#ifndef WIN32
+	struct pollfd pfd;
+	pfd.fd = _sock;
+	pfd.events = forWrite ? POLLOUT : POLLIN;
+	pfd.revents = 0;
+
+	int ms = -1;
+	if(!wait)
+	{
+		ms = 0;
+	}
+	else if(_tv.tv_sec < INT_MAX / 1000)
+	{
+		ms = static_cast<int>(_tv.tv_sec * 1000 + _tv.tv_usec / 1000);
+	}
+	return poll(&pfd, 1, ms) > 0;
+#else
+	/* select() may update its timeout with the time left */
+	struct timeval tv = _tv;
+	if(!wait)
+	{
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+	}
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(_sock, &fds);
+	return select(_sock+1, forWrite ? nullptr : &fds,
+		forWrite ? &fds : nullptr, nullptr, &tv) > 0;
+#endif
+}
+
+/* What came on the wire (through TLS if on), with the timeout */
+ssize_t Socket::rawRead(void* buf, size_t sz)
 {
 	if(!isConnected())
 	{
 		throw nut::NotConnectedException();
 	}
 
-	if(_tv.tv_sec>=0)
+	if(_tv.tv_sec>=0 && !tlsPending() && !ready(false))
 	{
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, &fds, nullptr, nullptr, &_tv);
-		if (ret < 1) {
-			throw nut::TimeoutException();
-		}
+		throw nut::TimeoutException();
 	}
 
-	ssize_t res = sktread(_sock, buf, sz);
+	ssize_t res = isTLS() ? tlsRead(buf, sz) : sktread(_sock, buf, sz);
 	if(res==-1)
 	{
 		disconnect();
 		throw nut::IOException("Error while reading on socket");
 	}
-	return static_cast<size_t>(res);
+	return res;
 }
 
-size_t Socket::write(const void* buf, size_t sz)
+ssize_t Socket::rawWrite(const void* buf, size_t sz)
 {
 	if(!isConnected())
 	{
 		throw nut::NotConnectedException();
 	}
 
-	if(_tv.tv_sec>=0)
+	if(_tv.tv_sec>=0 && !ready(true))
 	{
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, nullptr, &fds, nullptr, &_tv);
-		if (ret < 1) {
-			throw nut::TimeoutException();
-		}
+		throw nut::TimeoutException();
 	}
 
-	ssize_t res = sktwrite(_sock, buf, sz);
+	ssize_t res = isTLS() ? tlsWrite(buf, sz) : sktwrite(_sock, buf, sz);
 	if(res==-1)
 	{
 		disconnect();
 		throw nut::IOException("Error while writing on socket");
 	}
-	return static_cast<size_t>(res);
+	return res;
 }
 
-std::string Socket::read()
+#ifdef WITH_ZLIB
+
+size_t Socket::read(void* buf, size_t sz)
 {
-	std::string res;
-	char buff[256];
+	if(!_zip)
+	{
+		return static_cast<size_t>(rawRead(buf, sz));
+	}
 
 	while(true)
 	{
-		// Look at already read data in _buffer
-		if(!_buffer.empty())
-		{
-			size_t idx = _buffer.find('\n');
-			if(idx!=std::string::npos)
-			{
-				res += _buffer.substr(0, idx);
-				_buffer.erase(0, idx+1);
-				return res;
-			}
-			res += _buffer;
-		}
+		_zin.next_out = static_cast<Bytef*>(buf);
+		_zin.avail_out = static_cast<uInt>(sz);
 
-		// Read new buffer
-		size_t sz = read(&buff, 256);
-		if(sz==0)
+		int ret = inflate(&_zin, Z_SYNC_FLUSH);
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
 		{
 			disconnect();
-			throw nut::IOException("Server closed connection unexpectedly");
+			throw nut::IOException("Bad compressed data from the server");
 		}
-		_buffer.assign(buff, sz);
-	}
-}
-
-void Socket::write(const std::string& str)
-{
-//	write(str.c_str(), str.size());
-//	write("\n", 1);
-	std::string buff = str + "\n";
-	write(buff.c_str(), buff.size());
-}
-
-}/* namespace internal */
-
-
-/*
- *
- * Client implementation
- *
- */
-
-/* Pedantic builds complain about the static variable below...
- * It is assumed safe to ignore since it is a std::string with
- * no complex teardown at program exit.
- */
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
-#pragma GCC diagnostic push
-# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS
-#  pragma GCC diagnostic ignored "-Wglobal-constructors"
-# endif
-# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS
-#  pragma GCC diagnostic ignored "-Wexit-time-destructors"
-# endif
-#endif
-const Feature Client::TRACKING = "TRACKING";
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
-#pragma GCC diagnostic pop
-#endif
-
-Client::Client()
-{
-}
-
-Client::~Client()
-{
-}
 
-bool Client::hasDevice(const std::string& dev)
-{
-	std::set<std::string> devs = getDeviceNames();
-	return devs.find(dev) != devs.end();
-}
+		_zmore = (_zin.avail_out == 0);
+		if(_zin.avail_out < sz)
+		{
+			return sz - _zin.avail_out;
+		}
 
-Device Client::getDevice(const std::string& name)
-{
-	if(hasDevice(name))
-		return Device(this, name);
-	else
-		return Device(nullptr, "");
+		// All of it was inflated, and did not end a block yet
+		_zinbuf.resize(SOCKET_ZIP_READLEN);
+		ssize_t len = rawRead(_zinbuf.data(), _zinbuf.size());
+		if(len<=0)
+		{
+			return 0;
+		}
+		_zin.next_in = _zinbuf.data();
+		_zin.avail_in = static_cast<uInt>(len);
+	}
 }
 
-std::set<Device> Client::getDevices()
+/* All of it goes out, as the stream is flushed at the end of each write */
+size_t Socket::write(const void* buf, size_t sz)
 {
-	std::set<Device> res;
-
-	std::set<std::string> devs = getDeviceNames();
-	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	if(!_zip)
 	{
-		res.insert(Device(this, *it));
+		return static_cast<size_t>(rawWrite(buf, sz));
 	}
 
-	return res;
-}
+	unsigned char out[SOCKET_TLS_SENDLEN];
+	_zout.next_in = static_cast<Bytef*>(const_cast<void*>(buf));
+	_zout.avail_in = static_cast<uInt>(sz);
 
-bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)
-{
-	std::set<std::string> names = getDeviceVariableNames(dev);
-	return names.find(name) != names.end();
-}
+	do
+	{
+		_zout.next_out = out;
+		_zout.avail_out = sizeof(out);
 
-std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)
-{
-	std::map<std::string,std::vector<std::string> > res;
+		if(deflate(&_zout, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+		{
+			disconnect();
+			throw nut::IOException("Error while compressing");
+		}
 
-	std::set<std::string> names = getDeviceVariableNames(dev);
-	for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
-	{
-		const std::string& name = *it;
-		res[name] = getDeviceVariableValue(dev, name);
+		size_t len = sizeof(out) - _zout.avail_out;
+		for(size_t sent = 0; sent < len; )
+		{
+			sent += static_cast<size_t>(rawWrite(out + sent, len - sent));
+		}
 	}
+	while(_zout.avail_out == 0);
 
-	return res;
+	return sz;
 }
 
-std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::set<std::string>& devs)
+void Socket::startCompression()
 {
-	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
-
-	for(std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	if(_zip)
 	{
-		res[*it] = getDeviceVariableValues(*it);
+		return;
 	}
 
-	return res;
-}
-
-bool Client::hasDeviceCommand(const std::string& dev, const std::string& name)
-{
-	std::set<std::string> names = getDeviceCommandNames(dev);
-	return names.find(name) != names.end();
-}
-
-bool Client::hasFeature(const Feature& feature)
-{
-	try
+	if(deflateInit2(&_zout, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			-SOCKET_ZIP_WINDOW_BITS, SOCKET_ZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
 	{
-		// If feature is known, querying it won't throw an exception.
-		isFeatureEnabled(feature);
-		return true;
+		throw nut::NutException("Cannot set up compression");
 	}
-	catch(...)
+	if(inflateInit2(&_zin, -MAX_WBITS) != Z_OK)
 	{
-		return false;
+		deflateEnd(&_zout);
+		throw nut::NutException("Cannot set up compression");
 	}
-}
-
-/*
- *
- * TCP Client implementation
- *
- */
 
-TcpClient::TcpClient():
-Client(),
-_host("localhost"),
-_port(3493),
-_timeout(0),
-_socket(new internal::Socket)
-{
-	// Do not connect now
+	// What came right behind the OK is compressed already
+	_zinbuf.assign(_buffer.begin() + static_cast<std::ptrdiff_t>(_begin),
+		_buffer.begin() + static_cast<std::ptrdiff_t>(_end));
+	_zin.next_in = _zinbuf.data();
+	_zin.avail_in = static_cast<uInt>(_zinbuf.size());
+	_begin = _end = 0;
+	_zmore = false;
+	_zip = true;
 }
 
-TcpClient::TcpClient(const std::string& host, uint16_t port):
-Client(),
-_timeout(0),
-_socket(new internal::Socket)
+bool Socket::isCompressed()const
 {
-	connect(host, port);
+	return _zip;
 }
 
-TcpClient::~TcpClient()
+bool Socket::zipPending()const
 {
-	delete _socket;
+	return _zip && (_zin.avail_in > 0 || _zmore);
 }
 
-void TcpClient::connect(const std::string& host, uint16_t port)
+void Socket::zipClose()
 {
-	_host = host;
-	_port = port;
-	connect();
+	if(_zip)
+	{
+		deflateEnd(&_zout);
+		inflateEnd(&_zin);
+		_zout = z_stream();
+		_zin = z_stream();
+		_zinbuf.clear();
+		_zip = false;
+	}
 }
 
-void TcpClient::connect()
-{
-	_socket->connect(_host, _port);
-}
+#else /* not WITH_ZLIB */
 
-void TcpClient::setDebugConnect(bool d)
+size_t Socket::read(void* buf, size_t sz)
 {
-	_socket->setDebugConnect(d);
+	return static_cast<size_t>(rawRead(buf, sz));
 }
 
-std::string TcpClient::getHost()const
+size_t Socket::write(const void* buf, size_t sz)
 {
-	return _host;
+	return static_cast<size_t>(rawWrite(buf, sz));
 }
 
-uint16_t TcpClient::getPort()const
+void Socket::startCompression()
 {
-	return _port;
+	throw nut::NutException("Compression is not supported");
 }
 
-bool TcpClient::isConnected()const
+bool Socket::isCompressed()const
 {
-	return _socket->isConnected();
+	return false;
 }
 
-void TcpClient::disconnect()
+bool Socket::zipPending()const
 {
-	_socket->disconnect();
+	return false;
 }
 
-void TcpClient::setTimeout(time_t timeout)
+void Socket::zipClose()
 {
-	_timeout = timeout;
 }
 
-time_t TcpClient::getTimeout()const
-{
-	return _timeout;
-}
+#endif /* WITH_ZLIB */
 
-void TcpClient::authenticate(const std::string& user, const std::string& passwd)
+std::string Socket::read()
 {
-	detectError(sendQuery("USERNAME " + user));
-	detectError(sendQuery("PASSWORD " + passwd));
+	_hasValue = false;
+	if(_binary)
+	{
+		fill(1);
+		if(static_cast<unsigned char>(_buffer[_begin]) < BINFRAME_TYPE_MAX)
+		{
+			return readRecord();
+		}
+		// Not a record: ERR ..., or any reply which is not framed
+	}
+
+	// Unread data already looked at for the end of the line
+	size_t seen = 0;
+	while(true)
+	{
+		const char* start = _buffer.data() + _begin;
+		const char* eol = static_cast<const char*>(
+			memchr(start + seen, '\n', _end - _begin - seen));
+		if(eol)
+		{
+			size_t len = static_cast<size_t>(eol - start);
+			_begin += len + 1;
+			return std::string(start, len);
+		}
+
+		seen = _end - _begin;
+		more();
+	}
 }
 
-void TcpClient::logout()
+void Socket::setBinary(bool binary)
 {
-	detectError(sendQuery("LOGOUT"));
-	_socket->disconnect();
+	_binary = binary;
+	_hasValue = false;
+	_value.clear();
+	_names.clear();
 }
 
-Device TcpClient::getDevice(const std::string& name)
+/* Read what comes next after the unread data, moving that to the
+ * start of the buffer (or growing it, when full) to make room */
+void Socket::more()
 {
-	try
+	if(_begin > 0)
 	{
-		get("UPSDESC", name);
+		memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+		_end -= _begin;
+		_begin = 0;
 	}
-	catch(NutException& ex)
+
+	if(_end == _buffer.size())
 	{
-		if(ex.str()=="UNKNOWN-UPS")
-			return Device(nullptr, "");
-		else
-			throw;
+		_buffer.resize(2 * _buffer.size());
 	}
-	return Device(this, name);
+
+	size_t len = read(_buffer.data() + _end, _buffer.size() - _end);
+	if(len==0)
+	{
+		disconnect();
+		throw nut::IOException("Server closed connection unexpectedly");
+	}
+	_end += len;
 }
 
-std::set<std::string> TcpClient::getDeviceNames()
+void Socket::fill(size_t sz)
 {
-	std::set<std::string> res;
-
-	std::vector<std::vector<std::string> > devs = list("UPS");
-	for(std::vector<std::vector<std::string> >::iterator it=devs.begin();
-		it!=devs.end(); ++it)
+	while(_end - _begin < sz)
 	{
-		std::string id = (*it)[0];
-		if(!id.empty())
-			res.insert(id);
+		more();
 	}
-
-	return res;
 }
 
-std::string TcpClient::getDeviceDescription(const std::string& name)
+static uint32_t binframe_get_u32(const std::string& buf, size_t pos)
 {
-	return get("UPSDESC", name)[0];
+	uint32_t res = 0;
+	for(size_t i=0; i<4; ++i)
+	{
+		res = (res << 8) | static_cast<unsigned char>(buf[pos + i]);
+	}
+	return res;
 }
 
-std::set<std::string> TcpClient::getDeviceVariableNames(const std::string& dev)
+std::string Socket::readRecord()
 {
-	std::set<std::string> set;
-
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	while(true)
 	{
-		set.insert(res[n][0]);
-	}
+		fill(BINFRAME_HEADER_LEN);
+		unsigned char type = static_cast<unsigned char>(_buffer[_begin]);
+		size_t len = (static_cast<size_t>(static_cast<unsigned char>(_buffer[_begin + 1])) << 8)
+			| static_cast<unsigned char>(_buffer[_begin + 2]);
+		fill(BINFRAME_HEADER_LEN + len);
+		std::string rec(_buffer.data() + _begin + BINFRAME_HEADER_LEN, len);
+		_begin += BINFRAME_HEADER_LEN + len;
+
+		if(type == BINFRAME_BEGIN)
+		{
+			return "BEGIN LIST " + rec;
+		}
+		if(type == BINFRAME_END)
+		{
+			return "END LIST " + rec;
+		}
+		if(type == BINFRAME_RESET)
+		{
+			_names.clear();
+			continue;
+		}
+		if(type != BINFRAME_NAME && type != BINFRAME_STR && type != BINFRAME_NUM)
+		{
+			// A newer kind of record: skip it
+			continue;
+		}
 
-	return set;
-}
+		if(len < BINFRAME_ID_LEN)
+		{
+			throw nut::NutException("Invalid response");
+		}
+		uint32_t id = binframe_get_u32(rec, 0);
 
-std::set<std::string> TcpClient::getDeviceRWVariableNames(const std::string& dev)
-{
-	std::set<std::string> set;
+		if(type == BINFRAME_NAME)
+		{
+			// Ids are handed out in order, starting at 1
+			if(id != _names.size() + 1)
+			{
+				throw nut::NutException("Invalid response");
+			}
+			_names.push_back("VAR " + rec.substr(BINFRAME_ID_LEN));
+			continue;
+		}
 
-	std::vector<std::vector<std::string> > res = list("RW", dev);
-	for(size_t n=0; n<res.size(); ++n)
-	{
-		set.insert(res[n][0]);
-	}
+		if(id < 1 || id > _names.size())
+		{
+			throw nut::NutException("Invalid response");
+		}
 
-	return set;
+		if(type == BINFRAME_STR)
+		{
+			_value = rec.substr(BINFRAME_ID_LEN);
+		}
+		else
+		{
+			// mantissa / 10^decimals, written as upsd had it
+			unsigned int decimals = static_cast<unsigned char>(rec[BINFRAME_ID_LEN]);
+			if(len != BINFRAME_NUM_LEN || decimals > BINFRAME_NUM_DIGITS)
+			{
+				throw nut::NutException("Invalid response");
+			}
+			uint64_t u = (static_cast<uint64_t>(binframe_get_u32(rec, BINFRAME_ID_LEN + 1)) << 32)
+				| binframe_get_u32(rec, BINFRAME_ID_LEN + 5);
+			bool neg = (u >> 63) != 0;
+			if(neg)
+			{
+				u = ~u + 1;
+			}
+			std::string digits = std::to_string(u);
+			if(decimals > 0)
+			{
+				if(digits.size() <= decimals)
+				{
+					digits.insert(0, decimals + 1 - digits.size(), '0');
+				}
+				digits.insert(digits.size() - decimals, 1, '.');
+			}
+			_value = neg ? "-" + digits : digits;
+		}
+
+		_hasValue = true;
+		return _names[id - 1];
+	}
 }
 
-std::string TcpClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)
+void Socket::write(const std::string& str)
 {
-	return get("DESC", dev + " " + name)[0];
+	// Replies to queued requests come first
+	if(!_replies.empty() || wantWrite())
+	{
+		finish();
+	}
+
+//	write(str.c_str(), str.size());
+//	write("\n", 1);
+	std::string buff = str + "\n";
+	write(buff.c_str(), buff.size());
 }
 
-std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
+bool Socket::hasLine()const
 {
-	return get("VAR", dev + " " + name);
+	return memchr(_buffer.data() + _begin, '\n', _end - _begin) != nullptr;
 }
 
-std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
+void Socket::queue(const std::string& req, const Reply& reply)
 {
-
-	std::map<std::string,std::vector<std::string> >  map;
-
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	if(!isConnected())
 	{
-		std::vector<std::string>& vals = res[n];
-		std::string var = vals[0];
-		vals.erase(vals.begin());
-		map[var] = vals;
+		throw nut::NotConnectedException();
 	}
-
-	return map;
+	if(_binary)
+	{
+		throw nut::NutException("Binary framing is not supported by asynchronous requests");
+	}
+	_output += req;
+	_output += '\n';
+	_replies.push_back(reply);
 }
 
-std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
+void Socket::answer(const std::string& line)
 {
-	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
-
-	if (devs.empty())
+	bool done = true;
+	try
 	{
-		// This request might come from processing the empty valid
-		// response of an upsd server which was allowed to start
-		// with no device sections in its ups.conf
-		return map;
+		done = _replies.front().line(line);
 	}
-
-	std::vector<std::string> queries;
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	catch(...)
 	{
-		queries.push_back("LIST VAR " + *it);
+		_replies.pop_front();
+		throw;
 	}
-	sendAsyncQueries(queries);
+	if(done)
+	{
+		_replies.pop_front();
+	}
+}
 
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+size_t Socket::process()
+{
+	try
 	{
-		try
+		// The socket stays blocking (for synchronous requests), so
+		// only do what poll() says will not wait
+		while(wantWrite() && ready(true, false))
 		{
-			std::map<std::string,std::vector<std::string> > map2;
-			std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
-			for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
-			{
-				std::vector<std::string>& vals = *it2;
-				std::string var = vals[0];
-				vals.erase(vals.begin());
-				map2[var] = vals;
-			}
-			map[*it] = map2;
+			_sent += write(_output.data() + _sent, std::min(_output.size() - _sent,
+				isTLS() ? SOCKET_TLS_SENDLEN : SOCKET_SENDLEN));
 		}
-		catch (NutException&)
+		if(!wantWrite())
 		{
-			// We sent a bunch of queries, we need to process them all to clear up the backlog.
+			_output.clear();
+			_sent = 0;
+		}
+
+		while(!_replies.empty())
+		{
+			if(hasLine())
+			{
+				answer(read());
+			}
+			else if(tlsPending() || zipPending() || ready(false, false))
+			{
+				more();
+			}
+			else
+			{
+				break;
+			}
 		}
 	}
+	catch(nut::IOException&)
+	{
+		// Disconnected: the handlers were told
+	}
+	return _replies.size();
+}
 
-	if (map.empty())
+void Socket::finish()
+{
+	while(wantWrite())
 	{
-		// We may fail on some devices, but not on ALL devices.
-		throw NutException("Invalid device");
+		_sent += write(_output.data() + _sent, _output.size() - _sent);
 	}
+	_output.clear();
+	_sent = 0;
 
-	return map;
+	while(!_replies.empty())
+	{
+		answer(read());
+	}
 }
 
-TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+#ifdef WITH_OPENSSL
+
+/* Contexts by verification settings, and sessions to resume by server,
+ * shared by all connections, as clients may be made for each poll.
+ * Never freed, as they may be needed up to the exit */
+static std::mutex& ssl_mutex()
 {
-	std::string query = "SET VAR " + dev + " " + name + " " + escape(value);
-	return sendTrackingQuery(query);
+	static std::mutex* mutex = new std::mutex;
+	return *mutex;
 }
 
-TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+static std::map<std::string, SSL_CTX*>& ssl_contexts()
 {
-	std::string query = "SET VAR " + dev + " " + name;
-	for(size_t n=0; n<values.size(); ++n)
-	{
-		query += " " + escape(values[n]);
-	}
-	return sendTrackingQuery(query);
+	static std::map<std::string, SSL_CTX*>* contexts = new std::map<std::string, SSL_CTX*>;
+	return *contexts;
 }
 
-std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
+static std::map<std::string, SSL_SESSION*>& ssl_sessions()
 {
-	std::set<std::string> cmds;
+	static std::map<std::string, SSL_SESSION*>* sessions = new std::map<std::string, SSL_SESSION*>;
+	return *sessions;
+}
 
-	std::vector<std::vector<std::string> > res = list("CMD", dev);
-	for(size_t n=0; n<res.size(); ++n)
+/* Index of the session key of a Socket in SSL ex_data */
+static int ssl_key_index = -1;
+
+static std::string ssl_errors()
+{
+	std::string res;
+	unsigned long e;
+	char errmsg[256];
+	while((e = ERR_get_error()) != 0)
 	{
-		cmds.insert(res[n][0]);
+		ERR_error_string_n(e, errmsg, sizeof(errmsg));
+		res += std::string(res.empty() ? ": " : "; ") + errmsg;
 	}
-
-	return cmds;
+	return res;
 }
 
-std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)
+/* Called with each session (with TLSv1.3, each ticket) the server
+ * sends, which replaces the one kept to resume with */
+static int ssl_new_session(SSL* ssl, SSL_SESSION* session)
 {
-	return get("CMDDESC", dev + " " + name)[0];
-}
+	const std::string* key = static_cast<const std::string*>(SSL_get_ex_data(ssl, ssl_key_index));
+	if(!key)
+	{
+		return 0;
+	}
 
-TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
-{
-	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+	std::lock_guard<std::mutex> lock(ssl_mutex());
+	SSL_SESSION*& kept = ssl_sessions()[*key];
+	if(kept)
+	{
+		SSL_SESSION_free(kept);
+	}
+	kept = session;
+	return 1;
 }
 
-std::map<std::string, std::set<std::string>> TcpClient::listDeviceClients(void)
+static SSL_CTX* ssl_context(const std::string& key, bool verify, const std::string& certPath)
 {
-	/* Lists all clients of all devices (which have at least one client) */
-	std::map<std::string, std::set<std::string>> deviceClientsMap;
+	/* Called with ssl_mutex() held */
+	std::map<std::string, SSL_CTX*>::iterator it = ssl_contexts().find(key);
+	if(it != ssl_contexts().end())
+	{
+		return it->second;
+	}
 
-	std::set<std::string> devs = getDeviceNames();
-	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	if(ssl_key_index < 0)
 	{
-		std::string dev = *it;
-		std::set<std::string> deviceClients = deviceGetClients(dev);
-		if (!deviceClients.empty()) {
-			deviceClientsMap[dev] = deviceClients;
-		}
+		SSL_load_error_strings();
+		SSL_library_init();
+	}
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+#else
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+#endif
+	if(!ctx)
+	{
+		throw nut::IOException("Can not initialize SSL context" + ssl_errors());
 	}
 
-	return deviceClientsMap;
-}
+	if(ssl_key_index < 0)
+	{
+		ssl_key_index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	}
 
-std::set<std::string> TcpClient::deviceGetClients(const std::string& dev)
-{
-	/* Who did a deviceLogin() to this dev? */
-	std::set<std::string> clients;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	/* set minimum protocol TLSv1 */
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+#else
+	SSL_CTX_set_min_proto_version(ctx, TLS1_VERSION);
+#endif
 
-	std::vector<std::vector<std::string> > res = list("CLIENT", dev);
-	for(size_t n=0; n<res.size(); ++n)
+	if(!certPath.empty())
 	{
-		clients.insert(res[n][0]);
+		if(SSL_CTX_load_verify_locations(ctx, nullptr, certPath.c_str()) != 1)
+		{
+			SSL_CTX_free(ctx);
+			throw nut::IOException("Failed to load certificates from " + certPath + ssl_errors());
+		}
+	}
+	else if(verify)
+	{
+		SSL_CTX_set_default_verify_paths(ctx);
 	}
+	SSL_CTX_set_verify(ctx, verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
 
-	return clients;
-}
+	/* Sessions are kept by server in ssl_sessions() */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, ssl_new_session);
 
-void TcpClient::deviceLogin(const std::string& dev)
-{
-	/* Requires that current session is already logged in with
-	 * an account which has one of "upsmon" roles in `upsd.users` */
-	detectError(sendQuery("LOGIN " + dev));
+	ssl_contexts()[key] = ctx;
+	return ctx;
 }
 
-/* NOTE: "master" is deprecated since NUT v2.8.0 in favor of "primary".
- * For the sake of old/new server/client interoperability,
- * practical implementations should try to use one and fall
- * back to the other, and only fail if both return "ERR".
- */
-void TcpClient::deviceMaster(const std::string& dev)
+void Socket::startTLS(const std::string& host, uint16_t port, bool verify, const std::string& certPath)
 {
-	try {
-		detectError(sendQuery("MASTER " + dev));
-	} catch (NutException &exOrig) {
-		try {
-			detectError(sendQuery("PRIMARY " + dev));
-		} catch (NutException &exRetry) {
-			NUT_UNUSED_VARIABLE(exRetry);
-			throw exOrig;
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+	std::string settings = (verify ? "1:" : "0:") + certPath;
+	_sslKey = settings + "@" + host + ":" + std::to_string(port);
+	{
+		std::lock_guard<std::mutex> lock(ssl_mutex());
+		_ssl = SSL_new(ssl_context(settings, verify, certPath));
+		if(!_ssl)
+		{
+			throw nut::IOException("Can not create SSL socket" + ssl_errors());
+		}
+
+		std::map<std::string, SSL_SESSION*>::iterator it = ssl_sessions().find(_sslKey);
+		if(it != ssl_sessions().end())
+		{
+			SSL_set_session(_ssl, it->second);
 		}
 	}
-}
+	SSL_set_ex_data(_ssl, ssl_key_index, &_sslKey);
 
-void TcpClient::devicePrimary(const std::string& dev)
-{
-	try {
-		detectError(sendQuery("PRIMARY " + dev));
-	} catch (NutException &exOrig) {
-		try {
-			detectError(sendQuery("MASTER " + dev));
-		} catch (NutException &exRetry) {
-			NUT_UNUSED_VARIABLE(exRetry);
-			throw exOrig;
+	if(SSL_set_fd(_ssl, static_cast<int>(_sock)) != 1)
+	{
+		std::string err = ssl_errors();
+		disconnect();
+		throw nut::IOException("Can not bind file descriptor to SSL socket" + err);
+	}
+
+	int res = SSL_connect(_ssl);
+	if(res != 1)
+	{
+		std::string err = ssl_errors();
+		{
+			// Do not try it again
+			std::lock_guard<std::mutex> lock(ssl_mutex());
+			std::map<std::string, SSL_SESSION*>::iterator it = ssl_sessions().find(_sslKey);
+			if(it != ssl_sessions().end())
+			{
+				SSL_SESSION_free(it->second);
+				ssl_sessions().erase(it);
+			}
 		}
+		disconnect();
+		throw nut::IOException("SSL handshake failed" + err);
 	}
+
+	if(_debugConnect) std::cerr <<
+		"[D2] Socket::startTLS(): " <<
+		SSL_get_version(_ssl) <<
+		(SSL_session_reused(_ssl) ? " session resumed" : " new session") <<
+		std::endl << std::flush;
 }
 
-void TcpClient::deviceForcedShutdown(const std::string& dev)
+bool Socket::isTLS()const
 {
-	detectError(sendQuery("FSD " + dev));
+	return _ssl != nullptr;
 }
 
-int TcpClient::deviceGetNumLogins(const std::string& dev)
+bool Socket::tlsPending()const
 {
-	std::string num = get("NUMLOGINS", dev)[0];
-	return atoi(num.c_str());
+	return _ssl && SSL_pending(_ssl) > 0;
 }
 
-TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
+ssize_t Socket::tlsRead(void* buf, size_t sz)
 {
-	if (id.empty())
+	int res = SSL_read(_ssl, buf, static_cast<int>(std::min(sz, static_cast<size_t>(INT_MAX))));
+	if(res > 0)
 	{
-		return TrackingResult::SUCCESS;
+		return res;
 	}
-
-	std::string result = sendQuery("GET TRACKING " + id);
-
-	if (result == "PENDING")
+	switch(SSL_get_error(_ssl, res))
 	{
-		return TrackingResult::PENDING;
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;
+	case SSL_ERROR_SYSCALL:
+		if(ERR_peek_error() == 0 && errno == 0)
+		{
+			return 0;
+		}
+		return -1;
+	default:
+		ERR_clear_error();
+		return -1;
 	}
-	else if (result == "SUCCESS")
-	{
+}
+
+ssize_t Socket::tlsWrite(const void* buf, size_t sz)
+{
+	int res = SSL_write(_ssl, buf, static_cast<int>(std::min(sz, static_cast<size_t>(INT_MAX))));
+	if(res <= 0)
+	{
+		ERR_clear_error();
+		return -1;
+	}
+	return res;
+}
+
+void Socket::tlsClose()
+{
+	if(_ssl)
+	{
+		// Sessions not shut down are not to be resumed
+		if(SSL_is_init_finished(_ssl))
+		{
+			SSL_shutdown(_ssl);
+		}
+		SSL_free(_ssl);
+		_ssl = nullptr;
+		ERR_clear_error();
+	}
+}
+
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+
+static SECStatus nss_dont_verify(void* arg, PRFileDesc* fd, PRBool checksig, PRBool isServer)
+{
+	NUT_UNUSED_VARIABLE(arg);
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(checksig);
+	NUT_UNUSED_VARIABLE(isServer);
+	return SECSuccess;
+}
+
+static std::string nss_error(const char* funcname)
+{
+	return std::string(funcname) + " failed, NSS error " + std::to_string(PR_GetError());
+}
+
+void Socket::startTLS(const std::string& host, uint16_t port, bool verify, const std::string& certPath)
+{
+	NUT_UNUSED_VARIABLE(port);
+
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+	// Unless the program (e.g. with libupsclient) did it already
+	if(!NSS_IsInitialized())
+	{
+		SECStatus status = certPath.empty() ? NSS_NoDB_Init(nullptr) : NSS_Init(certPath.c_str());
+		if(status != SECSuccess || NSS_SetDomesticPolicy() != SECSuccess)
+		{
+			throw nut::IOException("Can not initialize SSL context: " + nss_error("NSS_Init"));
+		}
+	}
+
+	PRFileDesc* socket = PR_ImportTCPSocket(_sock);
+	if(!socket)
+	{
+		std::string err = nss_error("PR_ImportTCPSocket");
+		disconnect();
+		throw nut::IOException(err);
+	}
+	_ssl = SSL_ImportFD(nullptr, socket);
+	if(!_ssl)
+	{
+		std::string err = nss_error("SSL_ImportFD");
+		_ssl = socket;
+		disconnect();
+		throw nut::IOException(err);
+	}
+
+	// NSS keeps sessions by server (and URL) to resume them by itself
+	if((!verify && SSL_AuthCertificateHook(_ssl, nss_dont_verify, nullptr) != SECSuccess)
+	|| SSL_SetURL(_ssl, host.c_str()) != SECSuccess
+	|| SSL_ResetHandshake(_ssl, PR_FALSE) != SECSuccess
+	|| SSL_ForceHandshake(_ssl) != SECSuccess)
+	{
+		std::string err = nss_error("SSL handshake");
+		disconnect();
+		throw nut::IOException(err);
+	}
+
+	if(_debugConnect)
+	{
+		PRBool resumed = PR_FALSE;
+		SSLChannelInfo info;
+		if(SSL_GetChannelInfo(_ssl, &info, sizeof(info)) == SECSuccess)
+		{
+			resumed = info.resumed;
+		}
+		std::cerr << "[D2] Socket::startTLS(): " <<
+			(resumed ? "session resumed" : "new session") <<
+			std::endl << std::flush;
+	}
+}
+
+bool Socket::isTLS()const
+{
+	return _ssl != nullptr;
+}
+
+bool Socket::tlsPending()const
+{
+	return _ssl && SSL_DataPending(_ssl) > 0;
+}
+
+ssize_t Socket::tlsRead(void* buf, size_t sz)
+{
+	return PR_Read(_ssl, buf, static_cast<PRInt32>(std::min(sz, static_cast<size_t>(INT_MAX))));
+}
+
+ssize_t Socket::tlsWrite(const void* buf, size_t sz)
+{
+	return PR_Write(_ssl, buf, static_cast<PRInt32>(std::min(sz, static_cast<size_t>(INT_MAX))));
+}
+
+void Socket::tlsClose()
+{
+	if(_ssl)
+	{
+		// This closes the imported socket too
+		PR_Close(_ssl);
+		_ssl = nullptr;
+		_sock = INVALID_SOCKET;
+	}
+}
+
+#else /* not WITH_SSL */
+
+void Socket::startTLS(const std::string& host, uint16_t port, bool verify, const std::string& certPath)
+{
+	NUT_UNUSED_VARIABLE(host);
+	NUT_UNUSED_VARIABLE(port);
+	NUT_UNUSED_VARIABLE(verify);
+	NUT_UNUSED_VARIABLE(certPath);
+	throw nut::NutException("SSL support not compiled in");
+}
+
+bool Socket::isTLS()const
+{
+	return false;
+}
+
+bool Socket::tlsPending()const
+{
+	return false;
+}
+
+ssize_t Socket::tlsRead(void* buf, size_t sz)
+{
+	NUT_UNUSED_VARIABLE(buf);
+	NUT_UNUSED_VARIABLE(sz);
+	return -1;
+}
+
+ssize_t Socket::tlsWrite(const void* buf, size_t sz)
+{
+	NUT_UNUSED_VARIABLE(buf);
+	NUT_UNUSED_VARIABLE(sz);
+	return -1;
+}
+
+void Socket::tlsClose()
+{
+}
+
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+}/* namespace internal */
+
+
+/*
+ *
+ * Client implementation
+ *
+ */
+
+/* Pedantic builds complain about the static variable below...
+ * It is assumed safe to ignore since it is a std::string with
+ * no complex teardown at program exit.
+ */
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic push
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS
+#  pragma GCC diagnostic ignored "-Wglobal-constructors"
+# endif
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS
+#  pragma GCC diagnostic ignored "-Wexit-time-destructors"
+# endif
+#endif
+const Feature Client::TRACKING = "TRACKING";
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic pop
+#endif
+
+Client::Client()
+{
+}
+
+Client::~Client()
+{
+}
+
+bool Client::hasDevice(const std::string& dev)
+{
+	std::set<std::string> devs = getDeviceNames();
+	return devs.find(dev) != devs.end();
+}
+
+Device Client::getDevice(const std::string& name)
+{
+	if(hasDevice(name))
+		return Device(this, name);
+	else
+		return Device(nullptr, "");
+}
+
+std::set<Device> Client::getDevices()
+{
+	std::set<Device> res;
+
+	std::set<std::string> devs = getDeviceNames();
+	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	{
+		res.insert(Device(this, *it));
+	}
+
+	return res;
+}
+
+bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)
+{
+	std::set<std::string> names = getDeviceVariableNames(dev);
+	return names.find(name) != names.end();
+}
+
+std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)
+{
+	std::map<std::string,std::vector<std::string> > res;
+
+	std::set<std::string> names = getDeviceVariableNames(dev);
+	for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+	{
+		const std::string& name = *it;
+		res[name] = getDeviceVariableValue(dev, name);
+	}
+
+	return res;
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::set<std::string>& devs)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+
+	for(std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		res[*it] = getDeviceVariableValues(*it);
+	}
+
+	return res;
+}
+
+bool Client::hasDeviceCommand(const std::string& dev, const std::string& name)
+{
+	std::set<std::string> names = getDeviceCommandNames(dev);
+	return names.find(name) != names.end();
+}
+
+bool Client::hasFeature(const Feature& feature)
+{
+	try
+	{
+		// If feature is known, querying it won't throw an exception.
+		isFeatureEnabled(feature);
+		return true;
+	}
+	catch(...)
+	{
+		return false;
+	}
+}
+
+/*
+ *
+ * TCP Client implementation
+ *
+ */
+
+TcpClient::TcpClient():
+Client(),
+_host("localhost"),
+_port(3493),
+_timeout(0),
+_socket(new internal::Socket)
+{
+	// Do not connect now
+}
+
+TcpClient::TcpClient(const std::string& host, uint16_t port):
+Client(),
+_timeout(0),
+_socket(new internal::Socket)
+{
+	connect(host, port);
+}
+
+TcpClient::~TcpClient()
+{
+	delete _socket;
+}
+
+void TcpClient::connect(const std::string& host, uint16_t port)
+{
+	_host = host;
+	_port = port;
+	connect();
+}
+
+void TcpClient::connect()
+{
+	_socket->connect(_host, _port);
+}
+
+void TcpClient::setDebugConnect(bool d)
+{
+	_socket->setDebugConnect(d);
+}
+
+std::string TcpClient::getHost()const
+{
+	return _host;
+}
+
+uint16_t TcpClient::getPort()const
+{
+	return _port;
+}
+
+bool TcpClient::isConnected()const
+{
+	return _socket->isConnected();
+}
+
+void TcpClient::disconnect()
+{
+	_socket->disconnect();
+}
+
+void TcpClient::setTimeout(time_t timeout)
+{
+	_timeout = timeout;
+}
+
+time_t TcpClient::getTimeout()const
+{
+	return _timeout;
+}
+
+void TcpClient::authenticate(const std::string& user, const std::string& passwd)
+{
+	detectError(sendQuery("USERNAME " + user));
+	detectError(sendQuery("PASSWORD " + passwd));
+}
+
+void TcpClient::logout()
+{
+	detectError(sendQuery("LOGOUT"));
+	_socket->disconnect();
+}
+
+Device TcpClient::getDevice(const std::string& name)
+{
+	try
+	{
+		get("UPSDESC", name);
+	}
+	catch(NutException& ex)
+	{
+		if(ex.str()=="UNKNOWN-UPS")
+			return Device(nullptr, "");
+		else
+			throw;
+	}
+	return Device(this, name);
+}
+
+std::set<std::string> TcpClient::getDeviceNames()
+{
+	std::set<std::string> res;
+
+	std::vector<std::vector<std::string> > devs = list("UPS");
+	for(std::vector<std::vector<std::string> >::iterator it=devs.begin();
+		it!=devs.end(); ++it)
+	{
+		std::string id = (*it)[0];
+		if(!id.empty())
+			res.insert(id);
+	}
+
+	return res;
+}
+
+std::string TcpClient::getDeviceDescription(const std::string& name)
+{
+	return get("UPSDESC", name)[0];
+}
+
+std::set<std::string> TcpClient::getDeviceVariableNames(const std::string& dev)
+{
+	std::set<std::string> set;
+
+	std::vector<std::vector<std::string> > res = list("VAR", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		set.insert(res[n][0]);
+	}
+
+	return set;
+}
+
+std::set<std::string> TcpClient::getDeviceRWVariableNames(const std::string& dev)
+{
+	std::set<std::string> set;
+
+	std::vector<std::vector<std::string> > res = list("RW", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		set.insert(res[n][0]);
+	}
+
+	return set;
+}
+
+std::string TcpClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)
+{
+	return get("DESC", dev + " " + name)[0];
+}
+
+std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
+{
+	return get("VAR", dev + " " + name);
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
+{
+
+	std::map<std::string,std::vector<std::string> >  map;
+
+	std::vector<std::vector<std::string> > res = list("VAR", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		std::vector<std::string>& vals = res[n];
+		std::string var = std::move(vals[0]);
+		vals.erase(vals.begin());
+		map[var] = std::move(vals);
+	}
+
+	return map;
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValuesSince(const std::string& dev, std::string& token, bool& full)
+{
+	std::map<std::string,std::vector<std::string> >  map;
+	std::string req = "VAR " + dev, since = " SINCE " + (token.empty() ? std::string("0") : token);
+	std::vector<std::string> query;
+
+	query.push_back("LIST " + req + since);
+	sendAsyncQueries(query);
+
+	std::string res = _socket->read();
+	detectError(res);
+	if(res != ("BEGIN LIST " + req + since))
+	{
+		throw NutException("Invalid response");
+	}
+
+	const std::string end = "END LIST " + req + " SINCE ";
+	while(true)
+	{
+		res = _socket->read();
+		detectError(res);
+
+		if(res.compare(0, end.size(), end) == 0)
+		{
+			// <newtoken> [FULL]
+			std::vector<std::string> vals = explode(res, end.size());
+			if(vals.empty())
+			{
+				throw NutException("Invalid response");
+			}
+			token = vals[0];
+			full = (vals.size() > 1 && vals[1] == "FULL");
+			return map;
+		}
+
+		if(res.compare(0, req.size(), req) == 0)
+		{
+			std::vector<std::string> vals = explodeReply(res, req.size());
+			if(vals.empty())
+			{
+				throw NutException("Invalid response");
+			}
+			std::string var = std::move(vals[0]);
+			vals.erase(vals.begin());
+			map[var] = std::move(vals);
+		}
+		else
+		{
+			throw NutException("Invalid response");
+		}
+	}
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValuesWithPrefix(const std::string& dev, const std::string& prefix)
+{
+	std::map<std::string,std::vector<std::string> >  map;
+	std::string req = "VAR " + dev, filter = " PREFIX " + prefix;
+	std::vector<std::string> query;
+
+	query.push_back("LIST " + req + filter);
+	sendAsyncQueries(query);
+
+	std::string res = _socket->read();
+	detectError(res);
+	if(res != ("BEGIN LIST " + req + filter))
+	{
+		throw NutException("Invalid response");
+	}
+
+	const std::string end = "END LIST " + req + filter;
+	while(true)
+	{
+		res = _socket->read();
+		detectError(res);
+
+		if(res == end)
+		{
+			return map;
+		}
+
+		if(res.compare(0, req.size(), req) == 0)
+		{
+			std::vector<std::string> vals = explodeReply(res, req.size());
+			if(vals.empty())
+			{
+				throw NutException("Invalid response");
+			}
+			std::string var = std::move(vals[0]);
+			vals.erase(vals.begin());
+			map[var] = std::move(vals);
+		}
+		else
+		{
+			throw NutException("Invalid response");
+		}
+	}
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
+
+	if (devs.empty())
+	{
+		// This request might come from processing the empty valid
+		// response of an upsd server which was allowed to start
+		// with no device sections in its ups.conf
+		return map;
+	}
+
+	visitDevicesVariableValues(devs,
+		[&map](const std::string& dev, const std::string& name, std::vector<std::string>& values)
+		{
+			map[dev][name] = std::move(values);
+		});
+
+	return map;
+}
+
+void TcpClient::visitDevicesVariableValues(const std::set<std::string>& devs, const VariableVisitor& visit)
+{
+	if (devs.empty())
+	{
+		return;
+	}
+
+	// Ask for several devices per "LIST VAR <dev1> <dev2> ..." (protocol
+	// 1.4), as many as upsd parses arguments of one line (see
+	// PCONF_DEFAULT_ARG_LIMIT) and short enough for any client buffer.
+	static const size_t maxDevs = 30, maxLen = 400;
+	std::vector<std::vector<std::string> > batches;
+	std::vector<std::string> queries;
+	std::string req;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		if (batches.empty() || batches.back().size() >= maxDevs
+		 || req.size() + it->size() >= maxLen)
+		{
+			if (!batches.empty())
+			{
+				queries.push_back("LIST " + req);
+			}
+			batches.push_back(std::vector<std::string>());
+			req = "VAR";
+		}
+		batches.back().push_back(*it);
+		req += " " + *it;
+	}
+	queries.push_back("LIST " + req);
+	sendAsyncQueries(queries);
+
+	// Devices to ask for one by one: those of a batch which failed
+	// (e.g. one unknown device), or which an older upsd did not list
+	std::vector<std::string> retry;
+	size_t listed = 0;
+	for (size_t n=0; n<batches.size(); ++n)
+	{
+		const std::vector<std::string>& batch = batches[n];
+		std::string names;
+		for (size_t i=0; i<batch.size(); ++i)
+		{
+			names += (i ? " " : "") + batch[i];
+		}
+
+		try
+		{
+			std::string res = _socket->read();
+			detectError(res);
+
+			const std::string begin = "BEGIN LIST VAR ";
+			if (res.compare(0, begin.size(), begin) != 0)
+			{
+				throw NutException("Invalid response");
+			}
+
+			// An older upsd only lists the first device
+			std::string devices = res.substr(begin.size());
+			if (devices != names)
+			{
+				retry.insert(retry.end(), batch.begin() + 1, batch.end());
+			}
+
+			readVariableList("END LIST VAR " + devices, visit);
+			listed++;
+		}
+		catch (NutException&)
+		{
+			// We sent a bunch of queries, we need to process them all to clear up the backlog.
+			if (batch.size() > 1)
+			{
+				retry.insert(retry.end(), batch.begin(), batch.end());
+			}
+		}
+	}
+
+	if (!retry.empty())
+	{
+		queries.clear();
+		for (std::vector<std::string>::const_iterator it=retry.cbegin(); it!=retry.cend(); ++it)
+		{
+			queries.push_back("LIST VAR " + *it);
+		}
+		sendAsyncQueries(queries);
+
+		for (std::vector<std::string>::const_iterator it=retry.cbegin(); it!=retry.cend(); ++it)
+		{
+			try
+			{
+				std::string res = _socket->read();
+				detectError(res);
+				if (res != ("BEGIN LIST VAR " + *it))
+				{
+					throw NutException("Invalid response");
+				}
+
+				readVariableList("END LIST VAR " + *it, visit);
+				listed++;
+			}
+			catch (NutException&)
+			{
+				// Same as above, skip this device
+			}
+		}
+	}
+
+	if (listed == 0)
+	{
+		// We may fail on some devices, but not on ALL devices.
+		throw NutException("Invalid device");
+	}
+}
+
+void TcpClient::readVariableList(const std::string& end, const VariableVisitor& visit)
+{
+	// Reused from line to line, with the strings they hold
+	std::vector<std::string> fields, values;
+
+	while (true)
+	{
+		std::string res = _socket->read();
+		detectError(res);
+		if (res == end)
+		{
+			return;
+		}
+		if (res.compare(0, 4, "VAR ") != 0)
+		{
+			throw NutException("Invalid response");
+		}
+
+		// <dev> <var> <values...>
+		explodeReply(res, 4, fields);
+		if (fields.size() < 2)
+		{
+			throw NutException("Invalid response");
+		}
+
+		values.resize(fields.size() - 2);
+		for (size_t i=0; i<values.size(); ++i)
+		{
+			values[i].swap(fields[i + 2]);
+		}
+		visit(fields[0], fields[1], values);
+	}
+}
+
+TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+{
+	std::string query = "SET VAR " + dev + " " + name + " " + escape(value);
+	return sendTrackingQuery(query);
+}
+
+TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+{
+	std::string query = "SET VAR " + dev + " " + name;
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query += " " + escape(values[n]);
+	}
+	return sendTrackingQuery(query);
+}
+
+std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
+{
+	std::set<std::string> cmds;
+
+	std::vector<std::vector<std::string> > res = list("CMD", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		cmds.insert(res[n][0]);
+	}
+
+	return cmds;
+}
+
+std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)
+{
+	return get("CMDDESC", dev + " " + name)[0];
+}
+
+TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
+{
+	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+}
+
+std::map<std::string,TrackingID> TcpClient::setDeviceVariables(const std::string& dev, const std::map<std::string,std::string>& values, std::map<std::string,std::string>* errors)
+{
+	std::vector<std::string> queries;
+	for(std::map<std::string,std::string>::const_iterator it=values.begin(); it!=values.end(); ++it)
+	{
+		queries.push_back("SET VAR " + dev + " " + it->first + " " + escape(it->second));
+	}
+	std::vector<std::string> replies = sendQueries(queries);
+
+	std::map<std::string,TrackingID> ids;
+	std::string failed;
+	size_t n = 0;
+	for(std::map<std::string,std::string>::const_iterator it=values.begin(); it!=values.end(); ++it, ++n)
+	{
+		try
+		{
+			ids[it->first] = parseTrackingID(replies[n]);
+		}
+		catch(NutException& ex)
+		{
+			if(errors)
+			{
+				(*errors)[it->first] = ex.str();
+			}
+			failed += (failed.empty() ? "" : ", ") + it->first + ": " + ex.str();
+		}
+	}
+
+	if(!errors && !failed.empty())
+	{
+		throw NutException(failed);
+	}
+	return ids;
+}
+
+std::vector<TrackingID> TcpClient::executeDeviceCommands(const std::string& dev, const std::vector<std::string>& names, const std::vector<std::string>& params, std::vector<std::string>* errors)
+{
+	std::vector<std::string> queries;
+	for(size_t n=0; n<names.size(); ++n)
+	{
+		queries.push_back("INSTCMD " + dev + " " + names[n] + " " + (n < params.size() ? params[n] : ""));
+	}
+	std::vector<std::string> replies = sendQueries(queries);
+
+	std::vector<TrackingID> ids(names.size());
+	std::string failed;
+	if(errors)
+	{
+		errors->assign(names.size(), "");
+	}
+	for(size_t n=0; n<names.size(); ++n)
+	{
+		try
+		{
+			ids[n] = parseTrackingID(replies[n]);
+		}
+		catch(NutException& ex)
+		{
+			if(errors)
+			{
+				(*errors)[n] = ex.str();
+			}
+			failed += (failed.empty() ? "" : ", ") + names[n] + ": " + ex.str();
+		}
+	}
+
+	if(!errors && !failed.empty())
+	{
+		throw NutException(failed);
+	}
+	return ids;
+}
+
+std::map<std::string, std::set<std::string>> TcpClient::listDeviceClients(void)
+{
+	/* Lists all clients of all devices (which have at least one client) */
+	std::map<std::string, std::set<std::string>> deviceClientsMap;
+
+	std::set<std::string> devs = getDeviceNames();
+	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	{
+		std::string dev = *it;
+		std::set<std::string> deviceClients = deviceGetClients(dev);
+		if (!deviceClients.empty()) {
+			deviceClientsMap[dev] = deviceClients;
+		}
+	}
+
+	return deviceClientsMap;
+}
+
+std::set<std::string> TcpClient::deviceGetClients(const std::string& dev)
+{
+	/* Who did a deviceLogin() to this dev? */
+	std::set<std::string> clients;
+
+	std::vector<std::vector<std::string> > res = list("CLIENT", dev);
+	for(size_t n=0; n<res.size(); ++n)
+	{
+		clients.insert(res[n][0]);
+	}
+
+	return clients;
+}
+
+void TcpClient::deviceLogin(const std::string& dev)
+{
+	/* Requires that current session is already logged in with
+	 * an account which has one of "upsmon" roles in `upsd.users` */
+	detectError(sendQuery("LOGIN " + dev));
+}
+
+/* NOTE: "master" is deprecated since NUT v2.8.0 in favor of "primary".
+ * For the sake of old/new server/client interoperability,
+ * practical implementations should try to use one and fall
+ * back to the other, and only fail if both return "ERR".
+ */
+void TcpClient::deviceMaster(const std::string& dev)
+{
+	try {
+		detectError(sendQuery("MASTER " + dev));
+	} catch (NutException &exOrig) {
+		try {
+			detectError(sendQuery("PRIMARY " + dev));
+		} catch (NutException &exRetry) {
+			NUT_UNUSED_VARIABLE(exRetry);
+			throw exOrig;
+		}
+	}
+}
+
+void TcpClient::devicePrimary(const std::string& dev)
+{
+	try {
+		detectError(sendQuery("PRIMARY " + dev));
+	} catch (NutException &exOrig) {
+		try {
+			detectError(sendQuery("MASTER " + dev));
+		} catch (NutException &exRetry) {
+			NUT_UNUSED_VARIABLE(exRetry);
+			throw exOrig;
+		}
+	}
+}
+
+void TcpClient::deviceForcedShutdown(const std::string& dev)
+{
+	detectError(sendQuery("FSD " + dev));
+}
+
+int TcpClient::deviceGetNumLogins(const std::string& dev)
+{
+	std::string num = get("NUMLOGINS", dev)[0];
+	return atoi(num.c_str());
+}
+
+TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
+{
+	if (id.empty())
+	{
+		return TrackingResult::SUCCESS;
+	}
+
+	return parseTrackingResult(sendQuery("GET TRACKING " + id));
+}
+
+/* Most ids asked for at once: with the longest status, this keeps the
+ * reply line within what libupsclient reads */
+static const size_t TRACKING_IDS_MAX = 16;
+
+std::vector<TrackingResult> TcpClient::getTrackingResults(const std::vector<TrackingID>& ids)
+{
+	std::vector<TrackingResult> res(ids.size(), TrackingResult::SUCCESS);
+	std::vector<size_t> tracked;
+	for(size_t n=0; n<ids.size(); ++n)
+	{
+		if(!ids[n].empty())
+		{
+			tracked.push_back(n);
+		}
+	}
+
+	size_t done = 0;
+	if(tracked.size() > 1)
+	{
+		for(; done<tracked.size(); done+=TRACKING_IDS_MAX)
+		{
+			size_t count = std::min(tracked.size() - done, TRACKING_IDS_MAX);
+			std::string query = "GET TRACKING";
+			for(size_t n=done; n<done+count; ++n)
+			{
+				query += " " + ids[tracked[n]];
+			}
+
+			std::string reply = sendQuery(query);
+			std::vector<std::string> status = explode(reply);
+			if(count == 1 || status.size() != count + 1 || status[0] != "TRACKING")
+			{
+				// An older server (or one id): it answered for the first
+				res[tracked[done]] = parseTrackingResult(reply);
+				++done;
+				break;
+			}
+			for(size_t n=0; n<count; ++n)
+			{
+				const std::string& word = status[n + 1];
+				res[tracked[done + n]] = parseTrackingResult(
+					(word == "PENDING" || word == "SUCCESS") ? word : "ERR " + word);
+			}
+		}
+	}
+
+	// The others (or all) one by one, but pipelined
+	std::vector<std::string> queries;
+	for(size_t n=done; n<tracked.size(); ++n)
+	{
+		queries.push_back("GET TRACKING " + ids[tracked[n]]);
+	}
+	std::vector<std::string> replies = sendQueries(queries);
+	for(size_t n=0; n<replies.size(); ++n)
+	{
+		res[tracked[done + n]] = parseTrackingResult(replies[n]);
+	}
+
+	return res;
+}
+
+TrackingResult TcpClient::parseTrackingResult(const std::string& result)
+{
+	if (result == "PENDING")
+	{
+		return TrackingResult::PENDING;
+	}
+	else if (result == "SUCCESS")
+	{
 		return TrackingResult::SUCCESS;
 	}
-	else if (result == "ERR UNKNOWN")
+	else if (result == "ERR UNKNOWN")
+	{
+		return TrackingResult::UNKNOWN;
+	}
+	else if (result == "ERR INVALID-ARGUMENT")
+	{
+		return TrackingResult::INVALID_ARGUMENT;
+	}
+	else
+	{
+		return TrackingResult::FAILURE;
+	}
+}
+
+bool TcpClient::isFeatureEnabled(const Feature& feature)
+{
+	std::string result = sendQuery("GET " + feature);
+	detectError(result);
+
+	if (result == "ON")
+	{
+		return true;
+	}
+	else if (result == "OFF")
+	{
+		return false;
+	}
+	else
+	{
+		throw NutException("Unknown feature result " + result);
+	}
+}
+void TcpClient::setFeature(const Feature& feature, bool status)
+{
+	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
+	detectError(result);
+}
+
+bool TcpClient::setBinaryFraming(bool enable)
+{
+	std::string result = sendQuery(std::string("FRAMING ") + (enable ? "BINARY" : "TEXT"));
+	if (result != "OK")
+	{
+		// An older upsd does not know the command: nothing changed
+		return _socket->isBinary();
+	}
+	_socket->setBinary(enable);
+	return enable;
+}
+
+void TcpClient::startTLS(bool verify, const std::string& certPath)
+{
+	std::string result = sendQuery("STARTTLS");
+	if (result.compare(0, 11, "OK STARTTLS") != 0)
+	{
+		detectError(result);
+		throw NutException("Invalid response");
+	}
+	_socket->startTLS(_host, _port, verify, certPath);
+}
+
+bool TcpClient::isTLS()const
+{
+	return _socket->isTLS();
+}
+
+bool TcpClient::startCompression()
+{
+#ifdef WITH_ZLIB
+	if (_socket->isCompressed())
+	{
+		return true;
+	}
+	std::string result = sendQuery("COMPRESS DEFLATE");
+	if (result.compare(0, 11, "OK COMPRESS") != 0)
+	{
+		// An older upsd, or one without zlib: nothing changed
+		return false;
+	}
+	_socket->startCompression();
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool TcpClient::isCompressed()const
+{
+	return _socket->isCompressed();
+}
+
+std::vector<std::string> TcpClient::get
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::string res = sendQuery("GET " + req);
+	detectError(res);
+	if(res.compare(0, req.size(), req) != 0)
+	{
+		throw NutException("Invalid response");
+	}
+
+	return explodeReply(res, req.size());
+}
+
+std::vector<std::vector<std::string> > TcpClient::list
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	std::vector<std::string> query;
+	query.push_back("LIST " + req);
+	sendAsyncQueries(query);
+	return parseList(req);
+}
+
+std::vector<std::vector<std::string> > TcpClient::parseList
+	(const std::string& req)
+{
+	std::string res = _socket->read();
+	detectError(res);
+	if(res != ("BEGIN LIST " + req))
+	{
+		throw NutException("Invalid response");
+	}
+
+	const std::string end = "END LIST " + req;
+	std::vector<std::vector<std::string> > arr;
+	while(true)
+	{
+		res = _socket->read();
+		detectError(res);
+		if(res == end)
+		{
+			return arr;
+		}
+		if(res.compare(0, req.size(), req) == 0)
+		{
+			arr.push_back(explodeReply(res, req.size()));
+		}
+		else
+		{
+			throw NutException("Invalid response");
+		}
+	}
+}
+
+std::string TcpClient::sendQuery(const std::string& req)
+{
+	_socket->write(req);
+	return _socket->read();
+}
+
+void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
+{
+	if (req.empty())
+	{
+		return;
+	}
+
+	// One write (so over TLS, as few records as can be) for them all
+	std::string buff = req[0];
+	for (std::vector<std::string>::const_iterator it = req.cbegin() + 1; it != req.cend(); ++it)
+	{
+		buff += '\n';
+		buff += *it;
+	}
+	_socket->write(buff);
+}
+
+/* How many queries are written before their replies are read, so that
+ * neither side sits on a full socket buffer waiting for the other */
+static const size_t PIPELINE_MAX = 32;
+
+std::vector<std::string> TcpClient::sendQueries(const std::vector<std::string>& req)
+{
+	std::vector<std::string> res;
+	res.reserve(req.size());
+	for(size_t first=0; first<req.size(); first+=PIPELINE_MAX)
+	{
+		std::vector<std::string> batch(req.begin() + static_cast<std::ptrdiff_t>(first),
+			req.begin() + static_cast<std::ptrdiff_t>(std::min(req.size(), first + PIPELINE_MAX)));
+		sendAsyncQueries(batch);
+		for(size_t n=0; n<batch.size(); ++n)
+		{
+			res.push_back(_socket->read());
+		}
+	}
+	return res;
+}
+
+std::vector<std::string> TcpClient::explodeReply(const std::string& str, size_t begin)
+{
+	std::vector<std::string> res;
+	explodeReply(str, begin, res);
+	return res;
+}
+
+void TcpClient::explodeReply(const std::string& str, size_t begin, std::vector<std::string>& res)
+{
+	explode(str, begin, res);
+	if (_socket->hasValue())
+	{
+		res.push_back(_socket->value());
+	}
+}
+
+void TcpClient::detectError(const std::string& req)
+{
+	if(req.compare(0, 3, "ERR")==0)
+	{
+		throw NutException(req.substr(4));
+	}
+}
+
+std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+{
+	std::vector<std::string> res;
+	explode(str, begin, res);
+	return res;
+}
+
+void TcpClient::explode(const std::string& str, size_t begin, std::vector<std::string>& res)
+{
+	// Fields are written in place, over those of an earlier call (so
+	// a caller reusing res saves their allocations)
+	size_t count = 0;
+	bool open = false;
+	std::string* temp = nullptr;
+
+	enum STATE {
+		INIT,
+		SIMPLE_STRING,
+		QUOTED_STRING,
+		SIMPLE_ESCAPE,
+		QUOTED_ESCAPE
+	} state = INIT;
+
+	for(size_t idx=begin; idx<str.size(); ++idx)
+	{
+		char c = str[idx];
+		switch(state)
+		{
+		case INIT:
+			if(c==' ' /* || c=='\t' */)
+			{ /* Do nothing */ }
+			else if(c=='"')
+			{
+				temp = &field(res, count, open);
+				state = QUOTED_STRING;
+			}
+			else if(c=='\\')
+			{
+				temp = &field(res, count, open);
+				state = SIMPLE_ESCAPE;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				temp = &field(res, count, open);
+				*temp += c;
+				state = SIMPLE_STRING;
+			}
+			break;
+		case SIMPLE_STRING:
+			if(c==' ' /* || c=='\t' */)
+			{
+				/* if(!temp.empty()) : Must not occur */
+					count++;
+				open = false;
+				state = INIT;
+			}
+			else if(c=='\\')
+			{
+				state = SIMPLE_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				/* if(!temp.empty()) : Must not occur */
+					count++;
+				temp = &field(res, count, open);
+				state = QUOTED_STRING;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				*temp += c;
+			}
+			break;
+		case QUOTED_STRING:
+			if(c=='\\')
+			{
+				state = QUOTED_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				count++;
+				open = false;
+				state = INIT;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				// Copy up to the next escape or quote at once
+				size_t stop = str.find_first_of("\\\"", idx);
+				if(stop==std::string::npos)
+				{
+					stop = str.size();
+				}
+				temp->append(str, idx, stop - idx);
+				idx = stop - 1;
+			}
+			break;
+		case SIMPLE_ESCAPE:
+			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
+			{
+				*temp += c;
+			}
+			else
+			{
+				*temp += '\\' + c; // Really do this ?
+			}
+			state = SIMPLE_STRING;
+			break;
+		case QUOTED_ESCAPE:
+			if(c=='\\' || c=='"')
+			{
+				*temp += c;
+			}
+			else
+			{
+				*temp += '\\' + c; // Really do this ?
+			}
+			state = QUOTED_STRING;
+			break;
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+# pragma clang diagnostic push
+# pragma clang diagnostic ignored "-Wunreachable-code"
+# pragma clang diagnostic ignored "-Wcovered-switch-default"
+#endif
+		default:
+			/* Must not occur. */
+			break;
+#ifdef __clang__
+# pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
+		}
+	}
+
+	if(open && !temp->empty())
+	{
+		count++;
+	}
+
+	res.resize(count);
+}
+
+/* Field count of res, to be (re)written from scratch */
+std::string& TcpClient::field(std::vector<std::string>& res, size_t count, bool& open)
+{
+	if(count < res.size())
+	{
+		res[count].clear();
+	}
+	else
+	{
+		res.push_back(std::string());
+	}
+	open = true;
+	return res[count];
+}
+
+std::string TcpClient::escape(const std::string& str)
+{
+	std::string res = "\"";
+
+	for(size_t n=0; n<str.size(); n++)
+	{
+		char c = str[n];
+		if(c=='"')
+			res += "\\\"";
+		else if(c=='\\')
+			res += "\\\\";
+		else
+			res += c;
+	}
+
+	res += '"';
+	return res;
+}
+
+TrackingID TcpClient::sendTrackingQuery(const std::string& req)
+{
+	return parseTrackingID(sendQuery(req));
+}
+
+TrackingID TcpClient::parseTrackingID(const std::string& reply)
+{
+	detectError(reply);
+	std::vector<std::string> res = explode(reply);
+
+	if (res.size() == 1 && res[0] == "OK")
+	{
+		return TrackingID("");
+	}
+	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
+	{
+		return TrackingID(res[2]);
+	}
+	else
+	{
+		throw NutException("Unknown query result");
+	}
+}
+
+/*
+ *
+ * Asynchronous TCP Client implementation
+ *
+ */
+
+AsyncTcpClient::AsyncTcpClient():
+TcpClient()
+{
+}
+
+AsyncTcpClient::AsyncTcpClient(const std::string& host, uint16_t port):
+TcpClient(host, port)
+{
+}
+
+AsyncTcpClient::~AsyncTcpClient()
+{
+	// Fail pending requests while their handlers can still use us
+	disconnect();
+}
+
+int AsyncTcpClient::getFd()const
+{
+	return _socket->isConnected() ? static_cast<int>(_socket->fd()) : -1;
+}
+
+bool AsyncTcpClient::wantWrite()const
+{
+	return _socket->wantWrite();
+}
+
+size_t AsyncTcpClient::getPending()const
+{
+	return _socket->pending();
+}
+
+size_t AsyncTcpClient::process()
+{
+	return _socket->process();
+}
+
+std::exception_ptr AsyncTcpClient::replyError(const std::string& reply)
+{
+	try
+	{
+		detectError(reply);
+	}
+	catch(NutException&)
+	{
+		return std::current_exception();
+	}
+	return nullptr;
+}
+
+void AsyncTcpClient::queryAsync(const std::string& req, const Handler<std::string>& done)
+{
+	internal::Socket::Reply reply;
+	reply.line = [done](const std::string& line)
+	{
+		std::string res(line);
+		done(nullptr, res);
+		return true;
+	};
+	reply.fail = [done](std::exception_ptr error)
+	{
+		std::string none;
+		done(error, none);
+	};
+	_socket->queue(req, reply);
+}
+
+void AsyncTcpClient::getAsync(const std::string& subcmd, const std::string& params, const Handler<std::vector<std::string> >& done)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	queryAsync("GET " + req, [req, done](std::exception_ptr error, std::string& res)
+	{
+		std::vector<std::string> values;
+		if(!error)
+		{
+			error = replyError(res);
+		}
+		if(!error)
+		{
+			if(res.compare(0, req.size(), req) != 0)
+			{
+				error = std::make_exception_ptr(NutException("Invalid response"));
+			}
+			else
+			{
+				explode(res, req.size(), values);
+			}
+		}
+		done(error, values);
+	});
+}
+
+void AsyncTcpClient::listAsync(const std::string& subcmd, const std::string& params, const Handler<std::vector<std::vector<std::string> > >& done)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+
+	struct List
+	{
+		bool begun;
+		std::exception_ptr error;
+		std::vector<std::vector<std::string> > items;
+	};
+	std::shared_ptr<List> list = std::make_shared<List>();
+	list->begun = false;
+
+	internal::Socket::Reply reply;
+	reply.line = [req, done, list](const std::string& line)
+	{
+		std::exception_ptr error = replyError(line);
+		if(error)
+		{
+			list->error = error;
+		}
+		else if(!list->begun)
+		{
+			if(line.compare(0, 11, "BEGIN LIST ") == 0 && line.compare(11, std::string::npos, req) == 0)
+			{
+				list->begun = true;
+				return false;
+			}
+			list->error = std::make_exception_ptr(NutException("Invalid response"));
+		}
+		else if(line.compare(0, 9, "END LIST ") != 0 || line.compare(9, std::string::npos, req) != 0)
+		{
+			// Read the items up to the end, even past an invalid one
+			if(line.compare(0, req.size(), req) == 0)
+			{
+				list->items.push_back(explode(line, req.size()));
+			}
+			else if(!list->error)
+			{
+				list->error = std::make_exception_ptr(NutException("Invalid response"));
+			}
+			return false;
+		}
+
+		if(list->error)
+		{
+			list->items.clear();
+		}
+		done(list->error, list->items);
+		return true;
+	};
+	reply.fail = [done](std::exception_ptr error)
+	{
+		std::vector<std::vector<std::string> > none;
+		done(error, none);
+	};
+	_socket->queue("LIST " + req, reply);
+}
+
+void AsyncTcpClient::trackingQueryAsync(const std::string& req, const Handler<TrackingID>& done)
+{
+	queryAsync(req, [done](std::exception_ptr error, std::string& res)
+	{
+		TrackingID id;
+		if(!error)
+		{
+			try
+			{
+				id = parseTrackingID(res);
+			}
+			catch(NutException&)
+			{
+				error = std::current_exception();
+			}
+		}
+		done(error, id);
+	});
+}
+
+void AsyncTcpClient::authenticateAsync(const std::string& user, const std::string& passwd, const DoneHandler& done)
+{
+	std::shared_ptr<std::exception_ptr> first = std::make_shared<std::exception_ptr>();
+	queryAsync("USERNAME " + user, [first](std::exception_ptr error, std::string& res)
+	{
+		*first = error ? error : replyError(res);
+	});
+	queryAsync("PASSWORD " + passwd, [first, done](std::exception_ptr error, std::string& res)
+	{
+		if(*first)
+		{
+			error = *first;
+		}
+		else if(!error)
+		{
+			error = replyError(res);
+		}
+		done(error);
+	});
+}
+
+void AsyncTcpClient::getDeviceNamesAsync(const Handler<std::set<std::string> >& done)
+{
+	listAsync("UPS", "", [done](std::exception_ptr error, std::vector<std::vector<std::string> >& devs)
+	{
+		std::set<std::string> res;
+		for(size_t n=0; n<devs.size(); ++n)
+		{
+			if(!devs[n].empty() && !devs[n][0].empty())
+			{
+				res.insert(devs[n][0]);
+			}
+		}
+		done(error, res);
+	});
+}
+
+void AsyncTcpClient::getDevicesAsync(const Handler<std::set<Device> >& done)
+{
+	getDeviceNamesAsync([this, done](std::exception_ptr error, std::set<std::string>& names)
+	{
+		std::set<Device> res;
+		for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+		{
+			res.insert(Device(this, *it));
+		}
+		done(error, res);
+	});
+}
+
+void AsyncTcpClient::getDeviceVariableValueAsync(const std::string& dev, const std::string& name, const Handler<std::vector<std::string> >& done)
+{
+	getAsync("VAR", dev + " " + name, done);
+}
+
+void AsyncTcpClient::getDeviceVariableValuesAsync(const std::string& dev, const Handler<std::map<std::string,std::vector<std::string> > >& done)
+{
+	listAsync("VAR", dev, [done](std::exception_ptr error, std::vector<std::vector<std::string> >& vars)
+	{
+		std::map<std::string,std::vector<std::string> > map;
+		for(size_t n=0; n<vars.size(); ++n)
+		{
+			std::vector<std::string>& var = vars[n];
+			if(!var.empty())
+			{
+				map[var[0]].assign(std::make_move_iterator(var.begin() + 1),
+					std::make_move_iterator(var.end()));
+			}
+		}
+		done(error, map);
+	});
+}
+
+void AsyncTcpClient::setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::string& value, const Handler<TrackingID>& done)
+{
+	trackingQueryAsync("SET VAR " + dev + " " + name + " " + escape(value), done);
+}
+
+void AsyncTcpClient::executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param, const Handler<TrackingID>& done)
+{
+	trackingQueryAsync("INSTCMD " + dev + " " + name + " " + param, done);
+}
+
+void AsyncTcpClient::getTrackingResultAsync(const TrackingID& id, const Handler<TrackingResult>& done)
+{
+	if(id.empty())
+	{
+		TrackingResult res = TrackingResult::SUCCESS;
+		done(nullptr, res);
+		return;
+	}
+
+	queryAsync("GET TRACKING " + id, [done](std::exception_ptr error, std::string& reply)
+	{
+		TrackingResult res = error ? TrackingResult::FAILURE : parseTrackingResult(reply);
+		done(error, res);
+	});
+}
+
+/*
+ *
+ * Asynchronous loop implementation
+ *
+ */
+
+AsyncLoop::AsyncLoop():
+_stop(false)
+{
+	_wake[0] = _wake[1] = -1;
+#ifndef WIN32
+	if(pipe(_wake) < 0)
+	{
+		throw SystemException();
+	}
+	for(int i=0; i<2; ++i)
+	{
+		fcntl(_wake[i], F_SETFL, fcntl(_wake[i], F_GETFL) | O_NONBLOCK);
+		fcntl(_wake[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+}
+
+AsyncLoop::~AsyncLoop()
+{
+#ifndef WIN32
+	close(_wake[0]);
+	close(_wake[1]);
+#endif
+}
+
+void AsyncLoop::add(AsyncTcpClient& client)
+{
+	if(std::find(_clients.begin(), _clients.end(), &client) == _clients.end())
+	{
+		_clients.push_back(&client);
+	}
+}
+
+void AsyncLoop::remove(AsyncTcpClient& client)
+{
+	std::vector<AsyncTcpClient*>::iterator it = std::find(_clients.begin(), _clients.end(), &client);
+	if(it != _clients.end())
 	{
-		return TrackingResult::UNKNOWN;
+		// runOnce() may be going through the list
+		*it = nullptr;
 	}
-	else if (result == "ERR INVALID-ARGUMENT")
+}
+
+void AsyncLoop::wake()
+{
+#ifndef WIN32
+	char c = 0;
+	// Full means a wake up is due already
+	if(::write(_wake[1], &c, 1) < 0)
 	{
-		return TrackingResult::INVALID_ARGUMENT;
+		return;
 	}
-	else
+#endif
+}
+
+void AsyncLoop::post(const std::function<void()>& task)
+{
 	{
-		return TrackingResult::FAILURE;
+		std::lock_guard<std::mutex> lock(_mutex);
+		_tasks.push_back(task);
 	}
+	wake();
 }
 
-bool TcpClient::isFeatureEnabled(const Feature& feature)
+void AsyncLoop::stop()
 {
-	std::string result = sendQuery("GET " + feature);
-	detectError(result);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	wake();
+}
 
-	if (result == "ON")
+void AsyncLoop::run()
+{
+	while(true)
 	{
-		return true;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(_stop)
+			{
+				_stop = false;
+				return;
+			}
+		}
+		runOnce();
 	}
-	else if (result == "OFF")
+}
+
+void AsyncLoop::runOnce(int timeout)
+{
+	_clients.erase(std::remove(_clients.begin(), _clients.end(),
+		static_cast<AsyncTcpClient*>(nullptr)), _clients.end());
+
+#ifndef WIN32
+	std::vector<struct pollfd> fds(_clients.size() + 1);
+	fds[0].fd = _wake[0];
+#else
+	std::vector<WSAPOLLFD> fds(_clients.size() + 1);
+	fds[0].fd = INVALID_SOCKET;
+	// Nothing ends the wait for posted tasks: keep it short
+	if(timeout < 0 || timeout > 100)
 	{
-		return false;
+		timeout = 100;
 	}
-	else
+#endif
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+
+	size_t count = _clients.size();
+	for(size_t n=0; n<count; ++n)
 	{
-		throw NutException("Unknown feature result " + result);
+		int fd = _clients[n]->getFd();
+#ifndef WIN32
+		// Negative ones are left out by poll()
+		fds[n+1].fd = fd;
+#else
+		fds[n+1].fd = fd < 0 ? INVALID_SOCKET : static_cast<SOCKET>(fd);
+#endif
+		fds[n+1].events = POLLIN;
+		if(_clients[n]->wantWrite())
+		{
+			fds[n+1].events |= POLLOUT;
+		}
+		fds[n+1].revents = 0;
+	}
+
+#ifndef WIN32
+	int res = poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout);
+#else
+	int res = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout);
+#endif
+	if(res < 0 && errno != EINTR)
+	{
+		throw SystemException();
+	}
+
+#ifndef WIN32
+	if(fds[0].revents)
+	{
+		char buf[64];
+		while(::read(_wake[0], buf, sizeof(buf)) > 0)
+			;
+	}
+#endif
+
+	std::vector<std::function<void()> > tasks;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		tasks.swap(_tasks);
+	}
+	for(size_t n=0; n<tasks.size(); ++n)
+	{
+		tasks[n]();
+	}
+
+	for(size_t n=0; res > 0 && n<count; ++n)
+	{
+		// Handlers may have removed clients (not shifting the others)
+		if(fds[n+1].revents && _clients[n])
+		{
+			_clients[n]->process();
+		}
 	}
 }
-void TcpClient::setFeature(const Feature& feature, bool status)
+
+/*
+ *
+ * Client pool implementation
+ *
+ */
+
+ClientPool::Lease::Lease(ClientPool* pool, TcpClient* client, unsigned int generation):
+_pool(pool),
+_client(client),
+_generation(generation)
 {
-	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
-	detectError(result);
 }
 
-std::vector<std::string> TcpClient::get
-	(const std::string& subcmd, const std::string& params)
+ClientPool::Lease::Lease(Lease&& lease):
+_pool(lease._pool),
+_client(lease._client),
+_generation(lease._generation)
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	lease._client = nullptr;
+}
+
+ClientPool::Lease& ClientPool::Lease::operator=(Lease&& lease)
+{
+	if(this != &lease)
 	{
-		req += " " + params;
+		release(true);
+		_pool = lease._pool;
+		_client = lease._client;
+		_generation = lease._generation;
+		lease._client = nullptr;
 	}
-	std::string res = sendQuery("GET " + req);
-	detectError(res);
-	if(res.substr(0, req.size()) != req)
+	return *this;
+}
+
+ClientPool::Lease::~Lease()
+{
+	release(true);
+}
+
+void ClientPool::Lease::discard()
+{
+	release(false);
+}
+
+void ClientPool::Lease::release(bool keep)
+{
+	if(_client)
 	{
-		throw NutException("Invalid response");
+		_pool->release(_client, _generation, keep);
+		_client = nullptr;
 	}
+}
 
-	return explode(res, req.size());
+ClientPool::ClientPool(const std::string& host, uint16_t port, size_t size):
+_host(host),
+_port(port),
+_size(size > 0 ? size : 1),
+_open(0),
+_generation(0),
+_tls(false),
+_tlsVerify(false),
+_ttl(0)
+{
 }
 
-std::vector<std::vector<std::string> > TcpClient::list
-	(const std::string& subcmd, const std::string& params)
+ClientPool::~ClientPool()
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	for(size_t n=0; n<_idle.size(); ++n)
 	{
-		req += " " + params;
+		delete _idle[n];
 	}
-	std::vector<std::string> query;
-	query.push_back("LIST " + req);
-	sendAsyncQueries(query);
-	return parseList(req);
 }
 
-std::vector<std::vector<std::string> > TcpClient::parseList
-	(const std::string& req)
+void ClientPool::reset()
 {
-	std::string res = _socket->read();
-	detectError(res);
-	if(res != ("BEGIN LIST " + req))
+	/* Called with _mutex held */
+	++_generation;
+	for(size_t n=0; n<_idle.size(); ++n)
 	{
-		throw NutException("Invalid response");
+		delete _idle[n];
 	}
+	_open -= _idle.size();
+	_idle.clear();
+	_released.notify_all();
+}
 
-	std::vector<std::vector<std::string> > arr;
-	while(true)
+void ClientPool::setCredentials(const std::string& user, const std::string& passwd)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_user = user;
+	_passwd = passwd;
+	reset();
+}
+
+void ClientPool::addDeviceLogin(const std::string& dev)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_logins.push_back(dev);
+	reset();
+}
+
+void ClientPool::setTLS(bool verify, const std::string& certPath)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_tls = true;
+	_tlsVerify = verify;
+	_certPath = certPath;
+	reset();
+}
+
+void ClientPool::setCacheTTL(std::chrono::milliseconds ttl)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_ttl = ttl;
+	_cache.clear();
+}
+
+void ClientPool::setUp(TcpClient& client)
+{
+	std::string user, passwd, certPath;
+	std::vector<std::string> logins;
+	bool tls, tlsVerify;
 	{
-		res = _socket->read();
-		detectError(res);
-		if(res == ("END LIST " + req))
+		std::lock_guard<std::mutex> lock(_mutex);
+		user = _user;
+		passwd = _passwd;
+		logins = _logins;
+		tls = _tls;
+		tlsVerify = _tlsVerify;
+		certPath = _certPath;
+	}
+
+	client.connect(_host, _port);
+	if(tls)
+	{
+		client.startTLS(tlsVerify, certPath);
+	}
+	if(!user.empty())
+	{
+		client.authenticate(user, passwd);
+	}
+	for(size_t n=0; n<logins.size(); ++n)
+	{
+		client.deviceLogin(logins[n]);
+	}
+}
+
+ClientPool::Lease ClientPool::acquire()
+{
+	TcpClient* client = nullptr;
+	unsigned int generation;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(_idle.empty() && _open >= _size)
 		{
-			return arr;
+			_released.wait(lock);
 		}
-		if(res.substr(0, req.size()) == req)
+		if(!_idle.empty())
 		{
-			arr.push_back(explode(res, req.size()));
+			client = _idle.back();
+			_idle.pop_back();
 		}
 		else
 		{
-			throw NutException("Invalid response");
+			++_open;
 		}
+		generation = _generation;
 	}
-}
 
-std::string TcpClient::sendQuery(const std::string& req)
-{
-	_socket->write(req);
-	return _socket->read();
-}
-
-void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
-{
-	for (std::vector<std::string>::const_iterator it = req.cbegin(); it != req.cend(); ++it)
+	try
+	{
+		if(!client)
+		{
+			client = new TcpClient();
+		}
+		if(!client->isConnected())
+		{
+			setUp(*client);
+		}
+	}
+	catch(...)
 	{
-		_socket->write(*it);
+		release(client, generation, false);
+		throw;
 	}
+	return Lease(this, client, generation);
 }
 
-void TcpClient::detectError(const std::string& req)
+void ClientPool::release(TcpClient* client, unsigned int generation, bool keep)
 {
-	if(req.substr(0,3)=="ERR")
 	{
-		throw NutException(req.substr(4));
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(keep && client && generation == _generation)
+		{
+			_idle.push_back(client);
+			client = nullptr;
+		}
+		else
+		{
+			--_open;
+		}
 	}
+	// Closed outside of the lock
+	delete client;
+	_released.notify_one();
 }
 
-std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+std::vector<std::string> ClientPool::getDeviceVariableValue(const std::string& dev, const std::string& name)
 {
-	std::vector<std::string> res;
-	std::string temp;
-
-	enum STATE {
-		INIT,
-		SIMPLE_STRING,
-		QUOTED_STRING,
-		SIMPLE_ESCAPE,
-		QUOTED_ESCAPE
-	} state = INIT;
-
-	for(size_t idx=begin; idx<str.size(); ++idx)
-	{
-		char c = str[idx];
-		switch(state)
-		{
-		case INIT:
-			if(c==' ' /* || c=='\t' */)
-			{ /* Do nothing */ }
-			else if(c=='"')
-			{
-				state = QUOTED_STRING;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-				state = SIMPLE_STRING;
-			}
-			break;
-		case SIMPLE_STRING:
-			if(c==' ' /* || c=='\t' */)
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = QUOTED_STRING;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case QUOTED_STRING:
-			if(c=='\\')
-			{
-				state = QUOTED_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case SIMPLE_ESCAPE:
-			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = SIMPLE_STRING;
-			break;
-		case QUOTED_ESCAPE:
-			if(c=='\\' || c=='"')
-			{
-				temp += c;
-			}
-			else
+	std::string key = dev + " " + name;
+	bool cache;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		cache = _ttl.count() > 0;
+		std::map<std::string, Cached>::iterator it = _cache.find(key);
+		if(it != _cache.end())
+		{
+			if(std::chrono::steady_clock::now() < it->second.expiry)
 			{
-				temp += '\\' + c; // Really do this ?
+				return it->second.values;
 			}
-			state = QUOTED_STRING;
-			break;
+			_cache.erase(it);
+		}
+	}
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-# pragma clang diagnostic push
-# pragma clang diagnostic ignored "-Wunreachable-code"
-# pragma clang diagnostic ignored "-Wcovered-switch-default"
-#endif
-		default:
-			/* Must not occur. */
+	std::vector<std::string> values;
+	for(int attempt = 0; ; ++attempt)
+	{
+		Lease client = acquire();
+		try
+		{
+			values = client->getDeviceVariableValue(dev, name);
 			break;
-#ifdef __clang__
-# pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
+		}
+		catch(IOException&)
+		{
+			// The connection may have been closed by the server
+			// while it was idle: try a new one once
+			client.discard();
+			if(attempt > 0)
+			{
+				throw;
+			}
 		}
 	}
 
-	if(!temp.empty())
+	if(cache)
 	{
-		res.push_back(temp);
+		std::lock_guard<std::mutex> lock(_mutex);
+		Cached& cached = _cache[key];
+		cached.values = values;
+		cached.expiry = std::chrono::steady_clock::now() + _ttl;
 	}
-
-	return res;
+	return values;
 }
 
-std::string TcpClient::escape(const std::string& str)
+void ClientPool::invalidate(const std::string& dev)
 {
-	std::string res = "\"";
-
-	for(size_t n=0; n<str.size(); n++)
+	std::lock_guard<std::mutex> lock(_mutex);
+	if(dev.empty())
 	{
-		char c = str[n];
-		if(c=='"')
-			res += "\\\"";
-		else if(c=='\\')
-			res += "\\\\";
-		else
-			res += c;
+		_cache.clear();
+		return;
 	}
 
-	res += '"';
-	return res;
+	std::string prefix = dev + " ";
+	std::map<std::string, Cached>::iterator it = _cache.lower_bound(prefix);
+	while(it != _cache.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+	{
+		it = _cache.erase(it);
+	}
 }
 
-TrackingID TcpClient::sendTrackingQuery(const std::string& req)
+/*
+ *
+ * Typed values implementation
+ *
+ */
+
+/* Indexed by the bit numbers of the StatusFlags, as in common/nutstatus.c */
+static const char* const statusTokens[] = {
+	"OL", "OB", "LB", "HB", "RB", "CHRG", "DISCHRG", "BYPASS",
+	"CAL", "OFF", "OVER", "TRIM", "BOOST", "FSD", "ALARM", "ECO"
+};
+
+#ifdef HAVE_NUTCOMMON
+static_assert(StatusFlags::OL == NUT_STATUS_OL && StatusFlags::CHRG == NUT_STATUS_CHRG
+	&& StatusFlags::ECO == NUT_STATUS_ECO && StatusFlags::OTHER == NUT_STATUS_OTHER,
+	"StatusFlags must have the bits of nut_status_t");
+#endif
+
+/* The token of len characters at str is tok, without regard to case */
+static bool statusTokenEquals(const char* tok, const char* str, size_t len)
 {
-	std::string reply = sendQuery(req);
-	detectError(reply);
-	std::vector<std::string> res = explode(reply);
+	size_t i;
 
-	if (res.size() == 1 && res[0] == "OK")
+	for (i = 0; i < len && tok[i]; i++)
 	{
-		return TrackingID("");
+		if (toupper(static_cast<unsigned char>(str[i])) != tok[i])
+			return false;
 	}
-	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
+
+	return i == len && tok[i] == '\0';
+}
+
+StatusFlags StatusFlags::parse(const std::string& status)
+{
+	uint32_t bits = 0;
+	size_t pos = 0;
+
+	while ((pos = status.find_first_not_of(' ', pos)) != std::string::npos)
 	{
-		return TrackingID(res[2]);
+		size_t end = status.find(' ', pos);
+		size_t len = (end == std::string::npos ? status.size() : end) - pos;
+		uint32_t flag = OTHER;
+
+		for (size_t i = 0; i < sizeof(statusTokens) / sizeof(statusTokens[0]); i++)
+		{
+			if (statusTokenEquals(statusTokens[i], status.c_str() + pos, len))
+			{
+				flag = 1u << i;
+				break;
+			}
+		}
+
+		bits |= flag;
+		pos += len;
 	}
-	else
+
+	return StatusFlags(bits);
+}
+
+std::string StatusFlags::toString()const
+{
+	std::string res;
+
+	for (size_t i = 0; i < sizeof(statusTokens) / sizeof(statusTokens[0]); i++)
 	{
-		throw NutException("Unknown query result");
+		if (_bits & (1u << i))
+		{
+			if (!res.empty())
+				res += ' ';
+			res += statusTokens[i];
+		}
 	}
+
+	return res;
+}
+
+/* Test that what strto*() stopped at is only blanks */
+static bool parsedAll(const char* end)
+{
+	while (*end == ' ' || *end == '\t')
+		end++;
+	return *end == '\0';
+}
+
+bool parseVariableValue(const std::string& text, double& value)
+{
+	const char* str = text.c_str();
+	char* end;
+
+	errno = 0;
+	double res = strtod(str, &end);
+	if (end == str || errno == ERANGE || !parsedAll(end))
+		return false;
+
+	value = res;
+	return true;
+}
+
+bool parseVariableValue(const std::string& text, long& value)
+{
+	const char* str = text.c_str();
+	char* end;
+
+	errno = 0;
+	long res = strtol(str, &end, 10);
+	if (end == str || errno == ERANGE || !parsedAll(end))
+		return false;
+
+	value = res;
+	return true;
+}
+
+bool parseVariableValue(const std::string& text, StatusFlags& value)
+{
+	value = StatusFlags::parse(text);
+	return true;
 }
 
 /*
@@ -1846,6 +4145,166 @@ void Command::execute(const std::string& param)
 	getDevice()->executeCommand(getName(), param);
 }
 
+/*
+ *
+ * DeviceSnapshot implementation
+ *
+ */
+
+DeviceSnapshot::DeviceSnapshot()
+{
+}
+
+void DeviceSnapshot::update(Client& client, const std::string& dev)
+{
+	TcpClient* tcp = dynamic_cast<TcpClient*>(&client);
+	if (tcp)
+	{
+		std::set<std::string> devs;
+		devs.insert(dev);
+		tcp->visitDevicesVariableValues(devs,
+			[this](const std::string&, const std::string& name, std::vector<std::string>& values)
+			{
+				visit(name, values);
+			});
+	}
+	else
+	{
+		std::map<std::string,std::vector<std::string> > vars = client.getDeviceVariableValues(dev);
+		for (std::map<std::string,std::vector<std::string> >::const_iterator it = vars.begin(); it != vars.end(); ++it)
+		{
+			visit(it->first, it->second);
+		}
+	}
+
+	/* Drop those not listed this time, and look for them anew */
+	std::vector<Entry>::iterator last = std::remove_if(_entries.begin(), _entries.end(),
+		[](const Entry& entry){return !entry.seen;});
+	_entries.erase(last, _entries.end());
+	for (std::vector<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it)
+	{
+		it->seen = false;
+	}
+}
+
+void DeviceSnapshot::update(Device& dev)
+{
+	if (!dev.isOk()) throw NutException("Invalid device");
+	update(*dev.getClient(), dev.getName());
+}
+
+void DeviceSnapshot::visit(const std::string& name, const std::vector<std::string>& values)
+{
+	static const std::string none;
+	const std::string& value = values.empty() ? none : values[0];
+
+	/* Listed in the order of the names: mostly appended, or found */
+	std::vector<Entry>::iterator it = std::lower_bound(_entries.begin(), _entries.end(), name.c_str(),
+		[](const Entry& entry, const char* key){return strcmp(entry.name.c_str(), key) < 0;});
+
+	if (it != _entries.end() && it->name == name)
+	{
+		it->seen = true;
+		if (it->value == value)
+			return;
+		it->value = value;
+	}
+	else
+	{
+		Entry entry;
+		entry.name = name;
+		entry.value = value;
+		entry.seen = true;
+		it = _entries.insert(it, entry);
+	}
+
+	it->parsed = it->valid = 0;
+
+	/* The well-known ones are likely to be read as what they are */
+	switch (variableTypeHint(name.c_str()))
+	{
+		case VariableType::NUMBER:
+			readEntry(&*it, &Entry::number, VariableType::NUMBER, it->number);
+			break;
+		case VariableType::INTEGER:
+			readEntry(&*it, &Entry::integer, VariableType::INTEGER, it->integer);
+			break;
+		case VariableType::STATUS:
+			readEntry(&*it, &Entry::status, VariableType::STATUS, it->status);
+			break;
+		case VariableType::STRING:
+		default:
+			break;
+	}
+}
+
+size_t DeviceSnapshot::size()const
+{
+	return _entries.size();
+}
+
+const DeviceSnapshot::Entry* DeviceSnapshot::find(const char* name)const
+{
+	std::vector<Entry>::const_iterator it = std::lower_bound(_entries.begin(), _entries.end(), name,
+		[](const Entry& entry, const char* key){return strcmp(entry.name.c_str(), key) < 0;});
+
+	if (it == _entries.end() || strcmp(it->name.c_str(), name) != 0)
+		return nullptr;
+	return &*it;
+}
+
+bool DeviceSnapshot::has(const char* name)const
+{
+	return find(name) != nullptr;
+}
+
+const std::string* DeviceSnapshot::getValue(const char* name)const
+{
+	const Entry* entry = find(name);
+	return entry ? &entry->value : nullptr;
+}
+
+template<typename T> bool DeviceSnapshot::readEntry(const Entry* entry, T Entry::* field, VariableType type, T& value)
+{
+	unsigned int bit = 1u << static_cast<unsigned int>(type);
+
+	if (!entry)
+		return false;
+
+	if (!(entry->parsed & bit))
+	{
+		entry->parsed |= bit;
+		if (parseVariableValue(entry->value, const_cast<Entry*>(entry)->*field))
+			entry->valid |= bit;
+	}
+
+	if (!(entry->valid & bit))
+		return false;
+
+	value = entry->*field;
+	return true;
+}
+
+bool DeviceSnapshot::read(const char* name, double& value)const
+{
+	return readEntry(find(name), &Entry::number, VariableType::NUMBER, value);
+}
+
+bool DeviceSnapshot::read(const char* name, long& value)const
+{
+	return readEntry(find(name), &Entry::integer, VariableType::INTEGER, value);
+}
+
+bool DeviceSnapshot::read(const char* name, StatusFlags& value)const
+{
+	return readEntry(find(name), &Entry::status, VariableType::STATUS, value);
+}
+
+StatusFlags DeviceSnapshot::getStatus()const
+{
+	return get<StatusFlags>("ups.status", StatusFlags());
+}
+
 } /* namespace nut */
 
 
@@ -2247,6 +4706,145 @@ strarr nutclient_get_device_variable_values(NUTCLIENT_t client, const char* dev,
 	return nullptr;
 }
 
+/* pack what was read into one allocation: the array, then the strings
+ * (each device name once) */
+static nutclient_variable_t* variables_to_array(const std::vector<std::string>& devs, const std::vector<std::pair<size_t, std::pair<std::string, std::string> > >& vars, size_t* count)
+{
+	size_t size = (vars.size() + 1) * sizeof(nutclient_variable_t);
+	for (size_t i = 0; i < devs.size(); ++i)
+	{
+		size += devs[i].size() + 1;
+	}
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		size += vars[i].second.first.size() + 1 + vars[i].second.second.size() + 1;
+	}
+
+	nutclient_variable_t* arr = static_cast<nutclient_variable_t*>(xcalloc(1, size));
+	char* str = reinterpret_cast<char*>(arr + vars.size() + 1);
+
+	std::vector<const char*> devstr(devs.size());
+	for (size_t i = 0; i < devs.size(); ++i)
+	{
+		memcpy(str, devs[i].c_str(), devs[i].size() + 1);
+		devstr[i] = str;
+		str += devs[i].size() + 1;
+	}
+
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		const std::string& name = vars[i].second.first;
+		const std::string& value = vars[i].second.second;
+
+		arr[i].dev = devstr[vars[i].first];
+		memcpy(str, name.c_str(), name.size() + 1);
+		arr[i].name = str;
+		str += name.size() + 1;
+		memcpy(str, value.c_str(), value.size() + 1);
+		arr[i].value = str;
+		str += value.size() + 1;
+	}
+
+	/* arr[vars.size()] is all NULL from xcalloc() */
+	if (count)
+	{
+		*count = vars.size();
+	}
+	return arr;
+}
+
+static std::string join_values(const std::vector<std::string>& values)
+{
+	std::string res;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		if (i)
+		{
+			res += ' ';
+		}
+		res += values[i];
+	}
+	return res;
+}
+
+nutclient_variable_t* nutclient_get_devices_all_variables(NUTCLIENT_t client, const strarr devs, size_t* count)
+{
+	if(client && devs)
+	{
+		nut::Client* cl = static_cast<nut::Client*>(client);
+		try
+		{
+			std::set<std::string> devset;
+			for (char** pdev = devs; *pdev; ++pdev)
+			{
+				devset.insert(*pdev);
+			}
+
+			/* in the order of the set, as they are asked for */
+			std::vector<std::string> devnames(devset.begin(), devset.end());
+			std::map<std::string, size_t> devidx;
+			for (size_t i = 0; i < devnames.size(); ++i)
+			{
+				devidx[devnames[i]] = i;
+			}
+
+			std::vector<std::pair<size_t, std::pair<std::string, std::string> > > vars;
+
+			nut::TcpClient* tcp = dynamic_cast<nut::TcpClient*>(cl);
+			if (tcp)
+			{
+				/* pipelined, and without the maps in between */
+				tcp->visitDevicesVariableValues(devset,
+					[&](const std::string& dev, const std::string& name, std::vector<std::string>& values)
+					{
+						std::map<std::string, size_t>::const_iterator it = devidx.find(dev);
+						if (it != devidx.end())
+						{
+							vars.push_back(std::make_pair(it->second,
+								std::make_pair(name, join_values(values))));
+						}
+					});
+			}
+			else
+			{
+				std::map<std::string,std::map<std::string,std::vector<std::string> > > res = cl->getDevicesVariableValues(devset);
+				for (std::map<std::string,std::map<std::string,std::vector<std::string> > >::const_iterator dit = res.begin(); dit != res.end(); ++dit)
+				{
+					std::map<std::string, size_t>::const_iterator it = devidx.find(dit->first);
+					if (it == devidx.end())
+					{
+						continue;
+					}
+					for (std::map<std::string,std::vector<std::string> >::const_iterator vit = dit->second.begin(); vit != dit->second.end(); ++vit)
+					{
+						vars.push_back(std::make_pair(it->second,
+							std::make_pair(vit->first, join_values(vit->second))));
+					}
+				}
+			}
+
+			return variables_to_array(devnames, vars, count);
+		}
+		catch(...){}
+	}
+	return nullptr;
+}
+
+nutclient_variable_t* nutclient_get_device_all_variables(NUTCLIENT_t client, const char* dev, size_t* count)
+{
+	char* devs[2];
+
+	if (!dev)
+	{
+		return nullptr;
+	}
+
+	devs[0] = const_cast<char*>(dev);
+	devs[1] = nullptr;
+
+	return nutclient_get_devices_all_variables(client, devs, count);
+}
+
 void nutclient_set_device_variable_value(NUTCLIENT_t client, const char* dev, const char* var, const char* value)
 {
 	if(client)
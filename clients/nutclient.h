@@ -28,6 +28,10 @@
 #include <map>
 #include <set>
 #include <exception>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <cstdint>
 #include <ctime>
 
@@ -47,6 +51,7 @@ class Socket;
 
 class Client;
 class TcpClient;
+class AsyncTcpClient;
 class Device;
 class Variable;
 class Command;
@@ -149,6 +154,172 @@ typedef enum
 
 typedef std::string Feature;
 
+/**
+ * Standard tokens of a "ups.status" value (OL, OB, LB...), one bit each,
+ * the same bits as nut_status_t of the NUT sources (see nutstatus.h).
+ */
+class StatusFlags
+{
+public:
+	enum Flag : uint32_t
+	{
+		OL = 1u << 0,
+		OB = 1u << 1,
+		LB = 1u << 2,
+		HB = 1u << 3,
+		RB = 1u << 4,
+		CHRG = 1u << 5,
+		DISCHRG = 1u << 6,
+		BYPASS = 1u << 7,
+		CAL = 1u << 8,
+		OFF = 1u << 9,
+		OVER = 1u << 10,
+		TRIM = 1u << 11,
+		BOOST = 1u << 12,
+		FSD = 1u << 13,
+		ALARM = 1u << 14,
+		ECO = 1u << 15,
+		/** Any token which is not one of the above */
+		OTHER = 1u << 31
+	};
+
+	constexpr StatusFlags(uint32_t bits = 0):_bits(bits){}
+
+	/**
+	 * Flags of the (space separated) tokens of a "ups.status" value,
+	 * compared without regard to case.
+	 */
+	static StatusFlags parse(const std::string& status);
+
+	constexpr uint32_t bits()const{return _bits;}
+	/**
+	 * Test if all of the flags are set, e.g. has(OB | LB).
+	 */
+	constexpr bool has(uint32_t flags)const{return (_bits & flags) == flags;}
+	/**
+	 * Test if one of the flags at least is set.
+	 */
+	constexpr bool any(uint32_t flags)const{return (_bits & flags) != 0;}
+	constexpr bool operator==(const StatusFlags& flags)const{return _bits == flags._bits;}
+	constexpr bool operator!=(const StatusFlags& flags)const{return _bits != flags._bits;}
+
+	/**
+	 * Tokens of the flags (but OTHER), in the order of the bits.
+	 */
+	std::string toString()const;
+
+private:
+	uint32_t _bits;
+};
+
+/**
+ * How the value of a variable is best read, see variableTypeHint().
+ */
+enum class VariableType
+{
+	/** Text, or not known */
+	STRING,
+	/** Measure or setting which may have decimals (volts, percent...) */
+	NUMBER,
+	/** Whole number (seconds, counts) */
+	INTEGER,
+	/** Tokens of ups.status, read as StatusFlags */
+	STATUS
+};
+
+namespace internal
+{
+struct VariableTypeHint
+{
+	const char* name;
+	VariableType type;
+};
+
+/* Some well-known names of docs/nut-names.txt, not the ones which are
+ * text (see variableTypeHint()); kept sorted. */
+constexpr VariableTypeHint variableTypeHints[] = {
+	{"battery.capacity", VariableType::NUMBER},
+	{"battery.charge", VariableType::NUMBER},
+	{"battery.charge.low", VariableType::NUMBER},
+	{"battery.charge.restart", VariableType::NUMBER},
+	{"battery.charge.warning", VariableType::NUMBER},
+	{"battery.current", VariableType::NUMBER},
+	{"battery.packs", VariableType::INTEGER},
+	{"battery.packs.bad", VariableType::INTEGER},
+	{"battery.runtime", VariableType::INTEGER},
+	{"battery.runtime.low", VariableType::INTEGER},
+	{"battery.runtime.restart", VariableType::INTEGER},
+	{"battery.temperature", VariableType::NUMBER},
+	{"battery.voltage", VariableType::NUMBER},
+	{"battery.voltage.nominal", VariableType::NUMBER},
+	{"device.uptime", VariableType::INTEGER},
+	{"input.current", VariableType::NUMBER},
+	{"input.frequency", VariableType::NUMBER},
+	{"input.frequency.nominal", VariableType::NUMBER},
+	{"input.load", VariableType::NUMBER},
+	{"input.power", VariableType::NUMBER},
+	{"input.realpower", VariableType::NUMBER},
+	{"input.transfer.high", VariableType::NUMBER},
+	{"input.transfer.low", VariableType::NUMBER},
+	{"input.voltage", VariableType::NUMBER},
+	{"input.voltage.nominal", VariableType::NUMBER},
+	{"outlet.count", VariableType::INTEGER},
+	{"output.current", VariableType::NUMBER},
+	{"output.frequency", VariableType::NUMBER},
+	{"output.frequency.nominal", VariableType::NUMBER},
+	{"output.voltage", VariableType::NUMBER},
+	{"output.voltage.nominal", VariableType::NUMBER},
+	{"ups.delay.reboot", VariableType::INTEGER},
+	{"ups.delay.shutdown", VariableType::INTEGER},
+	{"ups.delay.start", VariableType::INTEGER},
+	{"ups.efficiency", VariableType::NUMBER},
+	{"ups.load", VariableType::NUMBER},
+	{"ups.power", VariableType::NUMBER},
+	{"ups.power.nominal", VariableType::NUMBER},
+	{"ups.realpower", VariableType::NUMBER},
+	{"ups.realpower.nominal", VariableType::NUMBER},
+	{"ups.status", VariableType::STATUS},
+	{"ups.temperature", VariableType::NUMBER},
+	{"ups.test.interval", VariableType::INTEGER},
+	{"ups.timer.reboot", VariableType::INTEGER},
+	{"ups.timer.shutdown", VariableType::INTEGER},
+	{"ups.timer.start", VariableType::INTEGER},
+};
+
+constexpr bool variableNameEquals(const char* a, const char* b)
+{
+	return *a == *b && (*a == '\0' || variableNameEquals(a + 1, b + 1));
+}
+
+constexpr VariableType variableTypeHintFrom(const char* name, size_t i)
+{
+	return i == sizeof(variableTypeHints) / sizeof(variableTypeHints[0]) ? VariableType::STRING
+		: variableNameEquals(name, variableTypeHints[i].name) ? variableTypeHints[i].type
+		: variableTypeHintFrom(name, i + 1);
+}
+} /* namespace internal */
+
+/**
+ * How the value of a well-known variable is best read, e.g. NUMBER for
+ * "battery.charge"; STRING for the others (not known, or text).  Usable
+ * at compile time:
+ *   static_assert(nut::variableTypeHint("ups.status") == nut::VariableType::STATUS, "");
+ */
+constexpr VariableType variableTypeHint(const char* name)
+{
+	return internal::variableTypeHintFrom(name, 0);
+}
+
+/**
+ * Read the value of a variable as a number (all of the text but the
+ * blanks around it, see strtod()), a whole number (see strtol(), so
+ * "12.5" is not one), or the tokens of ups.status.
+ * \return false if it is not one, value is left alone then.
+ */
+bool parseVariableValue(const std::string& text, double& value);
+bool parseVariableValue(const std::string& text, long& value);
+bool parseVariableValue(const std::string& text, StatusFlags& value);
+
 /**
  * A nut client is the starting point to dialog to NUTD.
  * It can connect to an NUTD then retrieve its device list.
@@ -376,6 +547,7 @@ class TcpClient : public Client
 	 * generally, but still want covered with integration tests
 	 */
 	friend class NutActiveClientTest;
+	friend class AsyncTcpClient;
 
 public:
 	/**
@@ -457,12 +629,74 @@ public:
 	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name) override;
 	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev) override;
 	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs) override;
+	/**
+	 * Retrieve values of the variables of a device which changed since
+	 * an earlier call (needs NUT protocol version 1.4, "LIST VAR ... SINCE").
+	 * \param dev Device name
+	 * \param token [in,out] Token returned by the previous call, or "0"
+	 * to get all variables; updated for use in the next call.
+	 * \param full [out] Set to true if all variables were sent, so those
+	 * known from earlier calls but missing from the result are gone.
+	 * \return Changed variable values indexed by variable names.
+	 */
+	std::map<std::string,std::vector<std::string> > getDeviceVariableValuesSince(const std::string& dev, std::string& token, bool& full);
+	/**
+	 * Retrieve values of the variables of a device whose names start
+	 * with a prefix, e.g. "battery." or "outlet.12." (needs NUT protocol
+	 * version 1.4, "LIST VAR ... PREFIX").
+	 * \param dev Device name
+	 * \param prefix Start of the variable names (letters, digits, dots,
+	 * dashes and underscores), compared case insensitively
+	 * \return Variable values indexed by variable names.
+	 */
+	std::map<std::string,std::vector<std::string> > getDeviceVariableValuesWithPrefix(const std::string& dev, const std::string& prefix);
+	/**
+	 * Called by visitDevicesVariableValues() for each variable, with
+	 * its device name, its name and its values (usually one), which
+	 * it may move from; all are only valid during the call.
+	 */
+	typedef std::function<void(const std::string& dev, const std::string& name, std::vector<std::string>& values)> VariableVisitor;
+	/**
+	 * Retrieve values of all variables of a set of devices, as
+	 * getDevicesVariableValues() does, but hand them to a visitor as
+	 * they are read rather than collecting them in maps.
+	 * \param devs Device names
+	 * \param visit Called for each variable
+	 */
+	void visitDevicesVariableValues(const std::set<std::string>& devs, const VariableVisitor& visit);
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value) override;
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values) override;
 
 	virtual std::set<std::string> getDeviceCommandNames(const std::string& dev) override;
 	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name) override;
 	virtual TrackingID executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param="") override;
+	/**
+	 * Set several variables of a device, sending the requests without
+	 * waiting for each reply, so it costs about one round trip.
+	 * \param dev Device name
+	 * \param values Values by variable names
+	 * \param errors If not null, gets the errors by variable names,
+	 * rather than throwing them.
+	 * \return Tracking ids by names of the variables set (empty ids if
+	 * tracking is off).
+	 * \throw NutException naming the failed variables (once all replies
+	 * were read), unless errors is given.
+	 */
+	std::map<std::string,TrackingID> setDeviceVariables(const std::string& dev, const std::map<std::string,std::string>& values, std::map<std::string,std::string>* errors = nullptr);
+	/**
+	 * Execute several commands of a device, sending the requests without
+	 * waiting for each reply, so it costs about one round trip.
+	 * \param dev Device name
+	 * \param names Command names
+	 * \param params Parameters of the commands with the same index, if any
+	 * \param errors If not null, gets the error of each command (empty
+	 * for those executed), rather than throwing them.
+	 * \return Tracking id of each command (empty for failed ones, or if
+	 * tracking is off).
+	 * \throw NutException naming the failed commands (once all replies
+	 * were read), unless errors is given.
+	 */
+	std::vector<TrackingID> executeDeviceCommands(const std::string& dev, const std::vector<std::string>& names, const std::vector<std::string>& params = std::vector<std::string>(), std::vector<std::string>* errors = nullptr);
 
 	virtual void deviceLogin(const std::string& dev) override;
 	/* FIXME: Protocol update needed to handle master/primary alias
@@ -477,23 +711,84 @@ public:
 	virtual std::map<std::string, std::set<std::string>> listDeviceClients(void) override;
 
 	virtual TrackingResult getTrackingResult(const TrackingID& id) override;
+	/**
+	 * Retrieve the results of several tracked requests, in one query to
+	 * servers which take several ids with "GET TRACKING" (else pipelined).
+	 * \param ids Tracking ids
+	 * \return Result for each id
+	 */
+	std::vector<TrackingResult> getTrackingResults(const std::vector<TrackingID>& ids);
 
 	virtual bool isFeatureEnabled(const Feature& feature) override;
 	virtual void setFeature(const Feature& feature, bool status) override;
 
+	/**
+	 * Have GET VAR and LIST VAR replies sent as binary records rather
+	 * than text lines (needs NUT protocol version 1.4, "FRAMING"), which
+	 * saves formatting and quoting values on both sides.
+	 * \param enable True for binary framing, false for text.
+	 * \return True if binary framing is on, false if not (e.g. an older
+	 * server which does not support it).
+	 */
+	bool setBinaryFraming(bool enable);
+
+	/**
+	 * Switch the connection to TLS ("STARTTLS"), with OpenSSL or NSS
+	 * as libupsclient was built with. The session of an earlier
+	 * connection to the same server (and with the same settings) is
+	 * resumed if the server allows, so reconnecting is cheaper.
+	 * \param verify True to verify the server certificate.
+	 * \param certPath With OpenSSL, the directory of trusted CA
+	 * certificates (the system ones if empty); with NSS, the
+	 * certificate database directory (none if empty).
+	 * \throw NutException if the server does not support it (the
+	 * connection goes on without TLS), IOException if the handshake
+	 * failed (the connection is closed).
+	 */
+	void startTLS(bool verify = false, const std::string& certPath = "");
+	/**
+	 * Test if the connection uses TLS.
+	 */
+	bool isTLS()const;
+
+	/**
+	 * Have both directions of the connection compressed with deflate
+	 * ("COMPRESS DEFLATE"), which saves most of the traffic of clients
+	 * polling over slow or metered links. Call it after startTLS(), if
+	 * that is used too.
+	 * \return True if the connection is compressed, false if not (e.g.
+	 * an older server, or a build without zlib on either side).
+	 */
+	bool startCompression();
+	/**
+	 * Test if the connection is compressed.
+	 */
+	bool isCompressed()const;
+
 protected:
 	std::string sendQuery(const std::string& req);
 	void sendAsyncQueries(const std::vector<std::string>& req);
+	/* Send queries a batch at a time, return their one line replies */
+	std::vector<std::string> sendQueries(const std::vector<std::string>& req);
 	static void detectError(const std::string& req);
 	TrackingID sendTrackingQuery(const std::string& req);
+	static TrackingID parseTrackingID(const std::string& reply);
+	static TrackingResult parseTrackingResult(const std::string& reply);
 
 	std::vector<std::string> get(const std::string& subcmd, const std::string& params = "");
 
 	std::vector<std::vector<std::string> > list(const std::string& subcmd, const std::string& params = "");
 
 	std::vector<std::vector<std::string> > parseList(const std::string& req);
+	/* Read "VAR <dev> <var> <values...>" lines up to the end one */
+	void readVariableList(const std::string& end, const VariableVisitor& visit);
 
 	static std::vector<std::string> explode(const std::string& str, size_t begin=0);
+	static void explode(const std::string& str, size_t begin, std::vector<std::string>& res);
+	/* explode(), plus the value of a binary framing record */
+	std::vector<std::string> explodeReply(const std::string& str, size_t begin=0);
+	void explodeReply(const std::string& str, size_t begin, std::vector<std::string>& res);
+	static std::string& field(std::vector<std::string>& res, size_t count, bool& open);
 	static std::string escape(const std::string& str);
 
 private:
@@ -503,6 +798,258 @@ private:
 	internal::Socket* _socket;
 };
 
+/**
+ * TCP NUTD client which can also send requests without waiting for
+ * their replies: the handler given with each is called from process()
+ * once its reply came, in the order of the requests.
+ * Requests and process() are made from one thread, usually running an
+ * AsyncLoop, or another event loop watching getFd() (for writing too,
+ * when wantWrite()). Handlers may make requests, but not synchronous
+ * ones. The synchronous methods of TcpClient still work (so do Device,
+ * Variable and Command objects got from it): they first wait for the
+ * replies to the requests made before.
+ * Binary framing is not supported by asynchronous requests.
+ */
+class AsyncTcpClient : public TcpClient
+{
+public:
+	/**
+	 * Called with the error (and an empty result) if the request
+	 * failed, else with no error and the result, which it may move from.
+	 */
+	template<typename T>
+	using Handler = std::function<void(std::exception_ptr error, T& result)>;
+	typedef std::function<void(std::exception_ptr error)> DoneHandler;
+
+	/**
+	 * Construct a nut AsyncTcpClient object.
+	 * You must call one of TcpClient::connect() after.
+	 */
+	AsyncTcpClient();
+	/**
+	 * Construct a nut AsyncTcpClient object then connect it (waiting
+	 * for it) to the specified server.
+	 * \param host Server host name.
+	 * \param port Server port.
+	 */
+	AsyncTcpClient(const std::string& host, uint16_t port = 3493);
+	~AsyncTcpClient() override;
+
+	/**
+	 * Retrieve the socket to watch for the client.
+	 * \return Socket descriptor, -1 if not connected.
+	 */
+	int getFd()const;
+	/**
+	 * Test if requests wait to be sent, so process() is to be called
+	 * when the socket is writable too.
+	 */
+	bool wantWrite()const;
+	/**
+	 * Retrieve the number of requests not replied to yet.
+	 */
+	size_t getPending()const;
+	/**
+	 * Send requests and read replies as far as possible without
+	 * waiting, calling the handlers of the replies read.
+	 * If the connection is lost, all pending handlers get the error.
+	 * \return Number of requests not replied to yet.
+	 */
+	size_t process();
+
+	void authenticateAsync(const std::string& user, const std::string& passwd, const DoneHandler& done);
+	void getDeviceNamesAsync(const Handler<std::set<std::string> >& done);
+	void getDevicesAsync(const Handler<std::set<Device> >& done);
+	void getDeviceVariableValueAsync(const std::string& dev, const std::string& name, const Handler<std::vector<std::string> >& done);
+	void getDeviceVariableValuesAsync(const std::string& dev, const Handler<std::map<std::string,std::vector<std::string> > >& done);
+	void setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::string& value, const Handler<TrackingID>& done);
+	void executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param, const Handler<TrackingID>& done);
+	void getTrackingResultAsync(const TrackingID& id, const Handler<TrackingResult>& done);
+
+	/**
+	 * Send any request, its one line reply going to the handler.
+	 * \param req Request line.
+	 * \param done Called with the reply line (which may be an error).
+	 */
+	void queryAsync(const std::string& req, const Handler<std::string>& done);
+
+protected:
+	void getAsync(const std::string& subcmd, const std::string& params, const Handler<std::vector<std::string> >& done);
+	void listAsync(const std::string& subcmd, const std::string& params, const Handler<std::vector<std::vector<std::string> > >& done);
+	void trackingQueryAsync(const std::string& req, const Handler<TrackingID>& done);
+	static std::exception_ptr replyError(const std::string& reply);
+};
+
+/**
+ * Event loop for AsyncTcpClient objects, e.g. connected to several
+ * servers: it waits for any of them to have I/O to do, and has them
+ * process() it. Other threads may hand tasks over to the loop (e.g.
+ * making requests) with post().
+ */
+class AsyncLoop
+{
+public:
+	AsyncLoop();
+	~AsyncLoop();
+
+	/**
+	 * Have the loop handle a client, until remove() (which is to be
+	 * called before it is destroyed).
+	 */
+	void add(AsyncTcpClient& client);
+	void remove(AsyncTcpClient& client);
+
+	/**
+	 * Wait for I/O of the clients or for posted tasks, and handle them.
+	 * \param timeout Longest wait in milliseconds, negative for no limit.
+	 */
+	void runOnce(int timeout = -1);
+	/**
+	 * Call runOnce() until stop().
+	 */
+	void run();
+	/**
+	 * Make run() return. May be called from any thread.
+	 */
+	void stop();
+	/**
+	 * Have a task run by the loop thread. May be called from any thread.
+	 */
+	void post(const std::function<void()>& task);
+
+private:
+	AsyncLoop(const AsyncLoop&) = delete;
+	AsyncLoop& operator=(const AsyncLoop&) = delete;
+	void wake();
+
+	/* Removed ones are nullptr until the next runOnce() */
+	std::vector<AsyncTcpClient*> _clients;
+	std::mutex _mutex;
+	std::vector<std::function<void()> > _tasks;
+	bool _stop;
+	int _wake[2]; /* Pipe to end a wait, not used on Windows */
+};
+
+/**
+ * Pool of connections to a server, shared by threads: up to a number
+ * of TcpClient objects are connected (and authenticated, and logged
+ * into devices, as set up) when needed, lent with acquire() and kept
+ * for the next one when given back. A connection found closed is
+ * opened again when next lent. Changing the settings closes the
+ * connections (those lent once given back), to open them anew.
+ * GET VAR results may also be cached for a while, so several threads
+ * asking for the same variable (e.g. "ups.status") make one query.
+ * The pool must outlive its leases.
+ */
+class ClientPool
+{
+public:
+	/**
+	 * Connection lent by the pool, given back when destroyed.
+	 */
+	class Lease
+	{
+	public:
+		Lease(Lease&& lease);
+		Lease& operator=(Lease&& lease);
+		~Lease();
+
+		TcpClient& operator*()const{return *_client;}
+		TcpClient* operator->()const{return _client;}
+		/**
+		 * Close the connection rather than give it back as is, e.g.
+		 * after changing its settings.
+		 */
+		void discard();
+
+	private:
+		friend class ClientPool;
+		Lease(ClientPool* pool, TcpClient* client, unsigned int generation);
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		void release(bool keep);
+
+		ClientPool* _pool;
+		TcpClient* _client;
+		unsigned int _generation;
+	};
+
+	/**
+	 * Construct a pool of connections to a server, not connecting yet.
+	 * \param host Server host name.
+	 * \param port Server port.
+	 * \param size Most connections open at once.
+	 */
+	ClientPool(const std::string& host, uint16_t port = 3493, size_t size = 4);
+	~ClientPool();
+
+	/**
+	 * Authenticate the connections.
+	 */
+	void setCredentials(const std::string& user, const std::string& passwd);
+	/**
+	 * Have the connections log into a device.
+	 */
+	void addDeviceLogin(const std::string& dev);
+	/**
+	 * Have the connections use TLS, see TcpClient::startTLS().
+	 */
+	void setTLS(bool verify = false, const std::string& certPath = "");
+	/**
+	 * Keep GET VAR results for some time, 0 (the default) for not at all.
+	 */
+	void setCacheTTL(std::chrono::milliseconds ttl);
+
+	/**
+	 * Lend a connection, waiting for one to be given back if all are.
+	 * \throw NutException (or IOException) if it could not be set up.
+	 */
+	Lease acquire();
+
+	/**
+	 * Retrieve the values of a variable, from the cache if recent
+	 * enough, else with a lent connection (trying again on another
+	 * one if it was closed).
+	 */
+	std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name);
+	/**
+	 * Forget the cached values of a device (all if empty), e.g. after
+	 * setting some.
+	 */
+	void invalidate(const std::string& dev = "");
+
+private:
+	ClientPool(const ClientPool&) = delete;
+	ClientPool& operator=(const ClientPool&) = delete;
+	void setUp(TcpClient& client);
+	void release(TcpClient* client, unsigned int generation, bool keep);
+	/* Settings changed: drop the connections */
+	void reset();
+
+	std::string _host;
+	uint16_t _port;
+	size_t _size;
+
+	/* Guards all below */
+	std::mutex _mutex;
+	std::condition_variable _released;
+	std::vector<TcpClient*> _idle;
+	size_t _open;
+	unsigned int _generation; /* Of the settings */
+	std::string _user, _passwd;
+	std::vector<std::string> _logins;
+	bool _tls, _tlsVerify;
+	std::string _certPath;
+	std::chrono::milliseconds _ttl;
+	struct Cached
+	{
+		std::vector<std::string> values;
+		std::chrono::steady_clock::time_point expiry;
+	};
+	/* By "<dev> <var>" */
+	std::map<std::string, Cached> _cache;
+};
+
 /**
  * Device attached to a client.
  * Device is a lightweight class which can be copied easily.
@@ -511,6 +1058,7 @@ class Device
 {
 	friend class Client;
 	friend class TcpClient;
+	friend class AsyncTcpClient;
 	friend class TcpClientMock;
 #ifdef _NUTCLIENTTEST_BUILD
 	friend class NutClientTest;
@@ -568,6 +1116,22 @@ public:
 	 * \return Value of the variable, if available.
 	 */
 	std::vector<std::string> getVariableValue(const std::string& name);
+	/**
+	 * Retrieve the value of a variable as a double, a long or
+	 * StatusFlags, e.g. get<double>("battery.charge"); see
+	 * parseVariableValue().  DeviceSnapshot is better suited to reading
+	 * the same variables again and again.
+	 * \param name Name of the variable to get.
+	 * \throw NutException if it has no such value.
+	 */
+	template<typename T> T get(const std::string& name)
+	{
+		T value;
+		std::vector<std::string> values = getVariableValue(name);
+		if (values.empty() || !parseVariableValue(values[0], value))
+			throw NutException("Variable " + name + " of " + _name + " has no value of this type");
+		return value;
+	}
 	/**
 	 * Intend to retrieve values of all variables of the devices.
 	 * \return Map of all variables values indexed by their names.
@@ -723,6 +1287,15 @@ public:
 	 * \return Value of the variable.
 	 */
 	std::vector<std::string> getValue();
+	/**
+	 * Retrieve the value of the variable as a double, a long or
+	 * StatusFlags, see Device::get().
+	 * \throw NutException if it has no such value.
+	 */
+	template<typename T> T get()
+	{
+		return getDevice()->get<T>(_name);
+	}
 	/**
 	 * Intend to retireve variable description.
 	 * \return Variable description if provided.
@@ -823,6 +1396,96 @@ private:
 	std::string _name;
 };
 
+/**
+ * Values of all the variables of a device as of the last update(), for
+ * those who read the same ones again and again (e.g. a monitoring loop).
+ * An update lists them at once and keeps the storage of those it knew;
+ * reading one by name does not allocate, and parses its value once per
+ * change at most (at the update already for the well-known names, see
+ * variableTypeHint()).
+ * A snapshot is not meant to be used by several threads at once.
+ */
+class DeviceSnapshot
+{
+public:
+	DeviceSnapshot();
+
+	/**
+	 * Read all the variables of a device anew, dropping those gone.
+	 * \param client Client to read them with.
+	 * \param dev Device name.
+	 */
+	void update(Client& client, const std::string& dev);
+	/**
+	 * Read all the variables of a device anew, dropping those gone.
+	 */
+	void update(Device& dev);
+
+	/**
+	 * Number of variables of the device.
+	 */
+	size_t size()const;
+	/**
+	 * Test if the device has a variable.
+	 */
+	bool has(const char* name)const;
+	/**
+	 * Retrieve the (first) value of a variable as it was sent.
+	 * \return Value of the variable, nullptr if it has none.
+	 */
+	const std::string* getValue(const char* name)const;
+	/**
+	 * Retrieve the value of a variable as a double, a long or
+	 * StatusFlags, e.g. get<double>("battery.charge"); see
+	 * parseVariableValue().
+	 * \throw NutException if it has no such value.
+	 */
+	template<typename T> T get(const char* name)const
+	{
+		T value;
+		if (!read(name, value))
+			throw NutException(std::string("Variable ") + name + " has no value of this type");
+		return value;
+	}
+	/**
+	 * Retrieve the value of a variable as a double, a long or
+	 * StatusFlags, or fallback if it has no such value.
+	 */
+	template<typename T> T get(const char* name, T fallback)const
+	{
+		read(name, fallback);
+		return fallback;
+	}
+	/**
+	 * Retrieve ups.status, no flags if there is none.
+	 */
+	StatusFlags getStatus()const;
+
+private:
+	struct Entry
+	{
+		std::string name;
+		std::string value;
+		/* Which of number, integer and status were tried (parsed) and
+		 * could be read (valid), VariableType bits */
+		mutable unsigned int parsed, valid;
+		mutable double number;
+		mutable long integer;
+		mutable StatusFlags status;
+		bool seen;
+	};
+
+	void visit(const std::string& name, const std::vector<std::string>& values);
+	const Entry* find(const char* name)const;
+	template<typename T> static bool readEntry(const Entry* entry, T Entry::* field, VariableType type, T& value);
+	bool read(const char* name, double& value)const;
+	bool read(const char* name, long& value)const;
+	bool read(const char* name, StatusFlags& value)const;
+
+	/* Sorted by name */
+	std::vector<Entry> _entries;
+};
+
 } /* namespace nut */
 
 #endif /* __cplusplus */
@@ -985,6 +1648,40 @@ char* nutclient_get_device_variable_description(NUTCLIENT_t client, const char*
  */
 strarr nutclient_get_device_variable_values(NUTCLIENT_t client, const char* dev, const char* var);
 
+/**
+ * A variable of a device and its value, as returned by
+ * nutclient_get_device_all_variables(); the strings are in the same
+ * allocation as the array.
+ */
+typedef struct {
+	const char* dev;	/**< Device name */
+	const char* name;	/**< Variable name */
+	const char* value;	/**< Its value (several are separated by spaces) */
+} nutclient_variable_t;
+
+/**
+ * Intend to retrieve all variables of a device with their values, in
+ * one request rather than one for each variable.
+ * \param client Nut client handle.
+ * \param dev Device name.
+ * \param count Set to the number of variables, if not NULL.
+ * \return Array of the variables, ended by one with a NULL name, or NULL
+ * on error. Must be freed with free(), once: it is a single allocation.
+ */
+nutclient_variable_t* nutclient_get_device_all_variables(NUTCLIENT_t client, const char* dev, size_t* count);
+
+/**
+ * Intend to retrieve all variables of several devices with their values,
+ * the requests for all of them sent at once (see
+ * TcpClient::visitDevicesVariableValues()).
+ * \param client Nut client handle.
+ * \param devs Device names, ended by NULL.
+ * \param count Set to the number of variables, if not NULL.
+ * \return Array of the variables of all devices, ended by one with a
+ * NULL name, or NULL on error. Must be freed with free().
+ */
+nutclient_variable_t* nutclient_get_devices_all_variables(NUTCLIENT_t client, const strarr devs, size_t* count);
+
 /**
  * Intend to set device variable value.
  * \param client Nut client handle.
@@ -20,6 +20,10 @@
 #include "config.h"
 #include "nutclientmem.h"
 
+#include <cstdlib>
+#include <iterator>
+#include <thread>
+
 namespace nut
 {
 
@@ -67,11 +71,13 @@ std::string MemClientStub::getDeviceVariableDescription(const std::string& dev,
 
 ListValue MemClientStub::getDeviceVariableValue(const std::string& dev, const std::string& name)
 {
+	delay();
+
 	ListValue res;
 	auto it_dev = _values.find(dev);
 	if (it_dev != _values.end())
 	{
-		auto map = it_dev->second;
+		const auto& map = it_dev->second;
 		auto it_map = map.find(name);
 		if (it_map != map.end())
 		{
@@ -83,6 +89,8 @@ ListValue MemClientStub::getDeviceVariableValue(const std::string& dev, const st
 
 ListObject MemClientStub::getDeviceVariableValues(const std::string& dev)
 {
+	delay();
+
 	ListObject res;
 	auto it_dev = _values.find(dev);
 	if (it_dev != _values.end())
@@ -94,63 +102,186 @@ ListObject MemClientStub::getDeviceVariableValues(const std::string& dev)
 
 ListDevice MemClientStub::getDevicesVariableValues(const std::set<std::string>& devs)
 {
+	delay();
+
 	ListDevice res;
 	for (auto itr = devs.begin(); itr != devs.end(); itr++)
 	{
-		std::string dev = *itr;
-		auto it_dev = _values.find(dev);
+		auto it_dev = _values.find(*itr);
 		if (it_dev != _values.end())
 		{
-			res.insert(std::pair<std::string, ListObject>(dev, it_dev->second));
+			// Names come in order, so each one goes at the end
+			res.emplace_hint(res.end(), *itr, it_dev->second);
 		}
 	}
 	return res;
 }
 
-TrackingID MemClientStub::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+std::map<std::string,std::vector<std::string> > MemClientStub::getDeviceVariableValuesWithPrefix(const std::string& dev, const std::string& prefix)
 {
+	delay();
+
+	std::map<std::string,std::vector<std::string> > res;
+
+	// The names which start with it follow each other from there on
+	// (compared case sensitively here, unlike upsd does)
 	auto it_dev = _values.find(dev);
-	if (it_dev == _values.end())
+	if (it_dev != _values.end())
 	{
-		ListObject list;
-		_values.emplace(dev, list);
-		it_dev = _values.find(dev);
+		for (auto it_map = it_dev->second.lower_bound(prefix);
+			it_map != it_dev->second.end()
+			&& it_map->first.compare(0, prefix.size(), prefix) == 0;
+			it_map++)
+		{
+			res.emplace_hint(res.end(), it_map->first, it_map->second);
+		}
 	}
-	if (it_dev != _values.end())
+
+	return res;
+}
+
+std::map<std::string,std::vector<std::string> > MemClientStub::getDeviceVariableValuesSince(const std::string& dev, std::string& token, bool& full)
+{
+	delay();
+
+	std::map<std::string,std::vector<std::string> > res;
+	uint64_t since = token.empty() ? 0 : std::strtoull(token.c_str(), nullptr, 10);
+
+	// A token newer than the store comes from another one (as from
+	// an earlier run of a server): all is sent, as for "0"
+	full = (since == 0 || since > _generation);
+
+	auto it_dev = _values.find(dev);
+	auto it_changed = _changed.find(dev);
+	if (it_dev != _values.end() && it_changed != _changed.end())
+	{
+		for (auto it_map = it_dev->second.begin(); it_map != it_dev->second.end(); it_map++)
+		{
+			if (!full)
+			{
+				auto it_gen = it_changed->second.find(it_map->first);
+				if (it_gen != it_changed->second.end() && it_gen->second <= since)
+				{
+					continue;
+				}
+			}
+			res.emplace_hint(res.end(), it_map->first, it_map->second);
+		}
+	}
+
+	token = std::to_string(_generation);
+	return res;
+}
+
+void MemClientStub::visitDevicesVariableValues(const std::set<std::string>& devs, const TcpClient::VariableVisitor& visit)
+{
+	delay();
+
+	// The visitor may move from the values: hand it a copy
+	ListValue values;
+	for (auto itr = devs.begin(); itr != devs.end(); itr++)
 	{
-		auto map = &(it_dev->second);
-		auto it_map = map->find(name);
-		if (it_map != map->end())
+		auto it_dev = _values.find(*itr);
+		if (it_dev == _values.end())
 		{
-			it_map->second[0] = value;
+			continue;
 		}
-		else
+		for (auto it_map = it_dev->second.begin(); it_map != it_dev->second.end(); it_map++)
 		{
-			ListValue list_value;
-			list_value.push_back(value);
-			map->emplace(name, list_value);
+			values = it_map->second;
+			visit(*itr, it_map->first, values);
 		}
 	}
-	return "";
 }
 
-TrackingID MemClientStub::setDeviceVariable(const std::string& dev, const std::string& name, const ListValue& values)
+TrackingID MemClientStub::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
 {
+	delay();
+
+	ListValue values(1, value);
 	auto it_dev = _values.find(dev);
 	if (it_dev != _values.end())
 	{
-		auto map = &(it_dev->second);
-		auto it_map = map->find(name);
-		if (it_map != map->end())
+		auto it_map = it_dev->second.find(name);
+		if (it_map != it_dev->second.end() && !it_map->second.empty())
+		{
+			// Only the first value changes
+			values = it_map->second;
+			values[0] = value;
+		}
+	}
+	store(dev, name, values);
+	return "";
+}
+
+TrackingID MemClientStub::setDeviceVariable(const std::string& dev, const std::string& name, const ListValue& values)
+{
+	delay();
+
+	if (_values.find(dev) != _values.end())
+	{
+		store(dev, name, values);
+	}
+	return "";
+}
+
+void MemClientStub::populate(size_t devices, size_t variables)
+{
+	const ListValue values(1, "0");
+	for (size_t d = 0; d < devices; d++)
+	{
+		const std::string dev = "dev" + std::to_string(d);
+		for (size_t v = 0; v < variables; v++)
+		{
+			store(dev, "var" + std::to_string(v), values);
+		}
+	}
+}
+
+void MemClientStub::mutate(size_t count)
+{
+	if (_values.empty())
+	{
+		return;
+	}
+
+	for (size_t n = 0; n < count; n++)
+	{
+		// xorshift64: cheap, and the same changes for the same seed
+		_seed ^= _seed << 13;
+		_seed ^= _seed >> 7;
+		_seed ^= _seed << 17;
+
+		auto it_dev = std::next(_values.begin(), static_cast<long>(_seed % _values.size()));
+		if (it_dev->second.empty())
 		{
-			it_map->second = values;
+			continue;
 		}
-		else
+		auto it_map = std::next(it_dev->second.begin(), static_cast<long>((_seed >> 32) % it_dev->second.size()));
+
+		// Keep the number of values, change the first one
+		ListValue values = it_map->second;
+		if (values.empty())
 		{
-			map->emplace(name, values);
+			values.push_back("");
 		}
+		values[0] = std::to_string(_generation + 1);
+		store(it_dev->first, it_map->first, values);
+	}
+}
+
+void MemClientStub::store(const std::string& dev, const std::string& name, const ListValue& values)
+{
+	_values[dev][name] = values;
+	_changed[dev][name] = ++_generation;
+}
+
+void MemClientStub::delay() const
+{
+	if (_latency.count() > 0)
+	{
+		std::this_thread::sleep_for(_latency);
 	}
-	return "";
 }
 
 std::set<std::string> MemClientStub::getDeviceCommandNames(const std::string& dev)
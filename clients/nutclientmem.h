@@ -35,6 +35,8 @@ typedef std::map<std::string, ListObject> ListDevice;
 /**
  * Memory client stub.
  * Class to stub TCPClient for test (data store in local memory).
+ * It can also stand in for a server in benchmarks of client code:
+ * see populate(), setLatency() and mutate().
  */
 class MemClientStub : public Client
 {
@@ -42,9 +44,42 @@ public:
 	/**
 	 * Construct a nut MemClientStub object.
 	 */
-	MemClientStub() {}
+	MemClientStub() : _generation(0), _latency(0), _seed(1) {}
 	~MemClientStub() override {}
 
+	/**
+	 * Add generated devices ("dev0", "dev1", ...), each with the given
+	 * number of variables ("var0", "var1", ...) set to "0".
+	 * \param devices Number of devices
+	 * \param variables Number of variables of each device
+	 */
+	void populate(size_t devices, size_t variables);
+	/**
+	 * Delay each call which reads or writes variables, as a round trip
+	 * to a server would.
+	 * \param latency Delay of each call (none by default)
+	 */
+	void setLatency(std::chrono::microseconds latency) { _latency = latency; }
+	/**
+	 * Change the values of some variables, picked at random (but the
+	 * same ones for the same seed and calls), as a server would after
+	 * updates from its drivers.
+	 * \param count Number of changes
+	 */
+	void mutate(size_t count);
+	/**
+	 * Reset the generator of mutate().
+	 * \param seed Any number but 0
+	 */
+	void setSeed(uint64_t seed) { _seed = seed ? seed : 1; }
+
+	/** As TcpClient::getDeviceVariableValuesSince() */
+	std::map<std::string,std::vector<std::string> > getDeviceVariableValuesSince(const std::string& dev, std::string& token, bool& full);
+	/** As TcpClient::getDeviceVariableValuesWithPrefix() */
+	std::map<std::string,std::vector<std::string> > getDeviceVariableValuesWithPrefix(const std::string& dev, const std::string& prefix);
+	/** As TcpClient::visitDevicesVariableValues() */
+	void visitDevicesVariableValues(const std::set<std::string>& devs, const TcpClient::VariableVisitor& visit);
+
 	virtual void authenticate(const std::string& user, const std::string& passwd) override {
 		NUT_UNUSED_VARIABLE(user);
 		NUT_UNUSED_VARIABLE(passwd);
@@ -84,7 +119,18 @@ public:
 	virtual void setFeature(const Feature& feature, bool status) override;
 
 private:
+	/** Set a variable and note its change */
+	void store(const std::string& dev, const std::string& name, const ListValue& values);
+	/** Wait for the latency, if any */
+	void delay() const;
+
 	ListDevice _values;
+	/** Number of changes so far, and its value at the last change of each variable */
+	uint64_t _generation;
+	std::map<std::string, std::map<std::string, uint64_t> > _changed;
+	std::chrono::microseconds _latency;
+	/** State of the mutate() generator */
+	uint64_t _seed;
 };
 
 } /* namespace nut */
@@ -34,6 +34,35 @@
 static char		*upsname = NULL, *hostname = NULL;
 static UPSCONN_t	*ups = NULL;
 
+/* -j / -T: the variables of many UPSes, from one connection per upsd,
+ * all of them at once over non-blocking connections (see bulk_run()) */
+#define BULK_JSON	1
+#define BULK_TSV	2
+#define BULK_TIMEOUT	10
+
+typedef struct bulk_host_s {
+	char	*hostname;
+	uint16_t	port;
+	char	*label;		/* as given, after the '@' */
+	UPSCONN_t	conn;
+	int	active;		/* answers still to come */
+	struct bulk_host_s	*next;
+} bulk_host_t;
+
+typedef struct bulk_ups_s {
+	char	*upsname;	/* NULL for <*@host>, until LIST UPS names them */
+	bulk_host_t	*host;
+	char	**vars;		/* name, value, name, value... */
+	size_t	numvars, maxvars;
+	char	*error;
+	int	done;
+	struct bulk_ups_s	*last;	/* of those of <*@host>, see bulk_list_ups() */
+	struct bulk_ups_s	*next;
+} bulk_ups_t;
+
+static bulk_host_t	*bulk_hosts = NULL;
+static bulk_ups_t	*bulk_upses = NULL;
+
 static void usage(const char *prog)
 {
 	print_banner_once(prog, 2);
@@ -42,6 +71,8 @@ static void usage(const char *prog)
 	printf("\nusage: %s -l | -L [<hostname>[:port]]\n", prog);
 	printf("       %s <ups> [<variable>]\n", prog);
 	printf("       %s -c <ups>\n", prog);
+	printf("       %s -s [<hostname>[:port]]\n", prog);
+	printf("       %s -j | -T [-w <seconds>] <ups> [<ups>...]\n", prog);
 
 	printf("\nFirst form (lists UPSes):\n");
 	printf("  -l         - lists each UPS on <hostname>, one per line.\n");
@@ -57,6 +88,20 @@ static void usage(const char *prog)
 	printf("  -c         - lists each client connected on <ups>, one per line.\n");
 	printf("  <ups>      - upsd server, <upsname>[@<hostname>[:<port>]] form\n");
 
+	printf("\nFourth form (lists counters of the server's own load):\n");
+	printf("  -s         - lists each counter of <hostname> and its value.\n");
+	printf("               Default hostname: localhost\n");
+
+	printf("\nFifth form (lists variables of many UPSes at once):\n");
+	printf("  -j         - one line of JSON for each UPS, with all its variables.\n");
+	printf("  -T         - one line for each variable: <ups>, <variable>, <value>,\n");
+	printf("               separated by tabs.\n");
+	printf("  -w         - give up on servers which did not answer in <seconds>\n");
+	printf("               (default: %d).\n", BULK_TIMEOUT);
+	printf("  <ups>      - upsd server, <upsname>[@<hostname>[:<port>]] form,\n");
+	printf("               or *@<hostname>[:<port>] for all of its UPSes.\n");
+	printf("               All servers are asked at once, each over one connection.\n");
+
 	printf("\nCommon arguments:\n");
 	printf("  -V         - display the version of this software\n");
 	printf("  -h         - display this help text\n");
@@ -206,8 +251,441 @@ static void list_clients(const char *devname)
 	}
 }
 
+static void list_stats(void)
+{
+	int		ret;
+	size_t	numq, numa;
+	const char	*query[4];
+	char		**answer;
+
+	query[0] = "STATS";
+	numq = 1;
+
+	ret = upscli_list_start(ups, numq, query);
+
+	if (ret < 0) {
+		/* check for an old upsd */
+		if (upscli_upserror(ups) == UPSCLI_ERR_UNKCOMMAND
+		 || upscli_upserror(ups) == UPSCLI_ERR_INVALIDARG
+		) {
+			fatalx(EXIT_FAILURE, "Error: upsd is too old to support this query");
+		}
+
+		fatalx(EXIT_FAILURE, "Error: %s", upscli_strerror(ups));
+	}
+
+	while (upscli_list_next(ups, numq, query, &numa, &answer) == 1) {
+
+		/* STATS <name> <value> */
+		if (numa < 3) {
+			fatalx(EXIT_FAILURE, "Error: insufficient data (got %" PRIuSIZE " args, need at least 3)", numa);
+		}
+
+		printf("%s: %s\n", answer[1], answer[2]);
+	}
+}
+
+/* a string in JSON, with what may not appear as is escaped */
+static void json_string(const char *str)
+{
+	const	unsigned char	*p;
+
+	putchar('"');
+
+	for (p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p < 0x20)
+			printf("\\u%04x", (unsigned int)*p);
+		else
+			putchar(*p);
+	}
+
+	putchar('"');
+}
+
+/* a field of TSV: tabs, line breaks and backslashes as \t, \n, \r, \\ */
+static void tsv_field(const char *str)
+{
+	for (; *str; str++) {
+		switch (*str)
+		{
+		case '\t':
+			fputs("\\t", stdout);
+			break;
+		case '\n':
+			fputs("\\n", stdout);
+			break;
+		case '\r':
+			fputs("\\r", stdout);
+			break;
+		case '\\':
+			fputs("\\\\", stdout);
+			break;
+		default:
+			putchar(*str);
+		}
+	}
+}
+
+static bulk_host_t *bulk_host(const char *target)
+{
+	bulk_host_t	*host, **last;
+	const char	*at = strchr(target, '@');
+	char	*name = NULL;
+	uint16_t	port;
+
+	if (upscli_splitaddr(at ? at + 1 : "localhost", &name, &port) != 0) {
+		fatalx(EXIT_FAILURE, "Error: invalid UPS definition: %s\n"
+			"Required format: upsname[@hostname[:port]] or *@hostname[:port]", target);
+	}
+
+	for (last = &bulk_hosts; *last; last = &(*last)->next) {
+		if (!strcmp((*last)->hostname, name) && (*last)->port == port) {
+			free(name);
+			return *last;
+		}
+	}
+
+	host = xcalloc(1, sizeof(*host));
+	host->hostname = name;
+	host->port = port;
+	host->label = xstrdup(at ? at + 1 : "localhost");
+	*last = host;
+
+	return host;
+}
+
+/* a new entry of the list, after prev (NULL: at the end) */
+static bulk_ups_t *bulk_ups_add(bulk_host_t *host, const char *name, bulk_ups_t *prev)
+{
+	bulk_ups_t	*u, **last;
+
+	u = xcalloc(1, sizeof(*u));
+	u->upsname = (name ? xstrdup(name) : NULL);
+	u->host = host;
+
+	if (prev) {
+		u->next = prev->next;
+		prev->next = u;
+		return u;
+	}
+
+	for (last = &bulk_upses; *last; last = &(*last)->next);
+	*last = u;
+
+	return u;
+}
+
+static void bulk_fail(bulk_ups_t *u, const char *why)
+{
+	if (!u->error) {
+		u->error = xstrdup(why);
+	}
+	u->done = 1;
+}
+
+static void bulk_list_var(UPSCONN_t *conn, void *arg, int upserror,
+	size_t numa, char **answer)
+{
+	bulk_ups_t	*u = arg;
+
+	if (upserror != UPSCLI_ERR_NONE) {
+		bulk_fail(u, upscli_strerror(conn));
+		return;
+	}
+
+	/* the end of the list */
+	if (numa == 0) {
+		u->done = 1;
+		return;
+	}
+
+	/* VAR <upsname> <varname> <val> */
+	if (numa < 4) {
+		return;
+	}
+
+	if (u->numvars + 2 > u->maxvars) {
+		u->maxvars = (u->maxvars ? u->maxvars * 2 : 64);
+		u->vars = xrealloc(u->vars, u->maxvars * sizeof(*u->vars));
+	}
+
+	u->vars[u->numvars++] = xstrdup(answer[2]);
+	u->vars[u->numvars++] = xstrdup(answer[3]);
+}
+
+static int bulk_queue_vars(bulk_ups_t *u)
+{
+	const char	*query[2];
+
+	query[0] = "VAR";
+	query[1] = u->upsname;
+
+	return upscli_queue(&u->host->conn, "LIST", 2, query, bulk_list_var, u);
+}
+
+/* a line of LIST UPS for <*@host>: ask for the variables of that one too,
+ * on the same connection, and show it after those named before it */
+static void bulk_list_ups(UPSCONN_t *conn, void *arg, int upserror,
+	size_t numa, char **answer)
+{
+	bulk_ups_t	*all = arg, *u;
+
+	if (upserror != UPSCLI_ERR_NONE) {
+		bulk_fail(all, upscli_strerror(conn));
+		return;
+	}
+
+	if (numa == 0) {
+		all->done = 1;
+		return;
+	}
+
+	/* UPS <upsname> <description> */
+	if (numa < 2) {
+		return;
+	}
+
+	u = bulk_ups_add(all->host, answer[1], all->last ? all->last : all);
+	all->last = u;
+
+	if (bulk_queue_vars(u) < 0) {
+		bulk_fail(u, upscli_strerror(conn));
+	}
+}
+
+/* connect to every server and queue all of the queries for it */
+static void bulk_start(void)
+{
+	bulk_host_t	*host;
+	bulk_ups_t	*u;
+	const char	*query[1];
+	int	ret;
+
+	for (host = bulk_hosts; host; host = host->next) {
+		if (upscli_connect_start(&host->conn, host->hostname, host->port,
+			UPSCLI_CONN_TRYSSL) < 0
+		) {
+			upsdebugx(1, "%s: %s: %s", __func__, host->label,
+				upscli_strerror(&host->conn));
+			continue;
+		}
+		host->active = 1;
+	}
+
+	for (u = bulk_upses; u; u = u->next) {
+		if (!u->host->active) {
+			bulk_fail(u, upscli_strerror(&u->host->conn));
+			continue;
+		}
+
+		if (u->upsname) {
+			ret = bulk_queue_vars(u);
+		} else {
+			query[0] = "UPS";
+			ret = upscli_queue(&u->host->conn, "LIST", 1, query, bulk_list_ups, u);
+		}
+
+		if (ret < 0) {
+			bulk_fail(u, upscli_strerror(&u->host->conn));
+		}
+	}
+}
+
+/* wait for the answers of all servers at once, for timeout seconds at most */
+static void bulk_run(int timeout)
+{
+	bulk_host_t	*host;
+	bulk_ups_t	*u;
+	fd_set	rfds, wfds;
+	struct	timeval	tv, start, now;
+	double	left;
+	int	fd, maxfd, want, ret;
+
+	gettimeofday(&start, NULL);
+	bulk_start();
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		maxfd = -1;
+
+		for (host = bulk_hosts; host; host = host->next) {
+			if (!host->active)
+				continue;
+
+			fd = upscli_fd(&host->conn);
+			want = upscli_want(&host->conn);
+
+			if (want & UPSCLI_WANT_READ)
+				FD_SET(fd, &rfds);
+			if (want & UPSCLI_WANT_WRITE)
+				FD_SET(fd, &wfds);
+
+			if (fd > maxfd)
+				maxfd = fd;
+		}
+
+		if (maxfd < 0)
+			break;
+
+		gettimeofday(&now, NULL);
+		left = timeout - difftimeval(now, start);
+		if (left < 0)
+			left = 0;
+
+		tv.tv_sec = (time_t)left;
+		tv.tv_usec = (suseconds_t)((left - (double)tv.tv_sec) * 1000000);
+
+		ret = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+
+		if (ret < 0) {
+#ifndef WIN32
+			if (errno == EINTR)
+				continue;
+#endif
+			/* just try them all then */
+			upsdebug_with_errno(1, "%s: select", __func__);
+		}
+
+		gettimeofday(&now, NULL);
+		left = timeout - difftimeval(now, start);
+
+		for (host = bulk_hosts; host; host = host->next) {
+			if (!host->active)
+				continue;
+
+			fd = upscli_fd(&host->conn);
+
+			if ((ret < 0 || FD_ISSET(fd, &rfds) || FD_ISSET(fd, &wfds))
+			 && upscli_process(&host->conn) <= 0) {
+				/* all answered, or the connection failed */
+				host->active = 0;
+				continue;
+			}
+
+			if (left <= 0) {
+				upsdebugx(1, "%s: %s did not answer in %d sec",
+					__func__, host->label, timeout);
+				host->active = 0;
+			}
+		}
+	}
+
+	/* what is still waiting was not answered in time */
+	for (u = bulk_upses; u; u = u->next) {
+		if (!u->done) {
+			bulk_fail(u, "Timed out");
+		}
+	}
+}
+
+static void bulk_print_json(const bulk_ups_t *u, const char *name)
+{
+	size_t	i;
+
+	printf("{\"ups\":");
+	json_string(name);
+
+	if (u->error) {
+		printf(",\"error\":");
+		json_string(u->error);
+		printf("}\n");
+		return;
+	}
+
+	printf(",\"vars\":{");
+	for (i = 0; i < u->numvars; i += 2) {
+		if (i)
+			putchar(',');
+		json_string(u->vars[i]);
+		putchar(':');
+		json_string(u->vars[i + 1]);
+	}
+	printf("}}\n");
+}
+
+static void bulk_print_tsv(const bulk_ups_t *u, const char *name)
+{
+	size_t	i;
+
+	if (u->error) {
+		fprintf(stderr, "Error: %s: %s\n", name, u->error);
+		return;
+	}
+
+	for (i = 0; i < u->numvars; i += 2) {
+		tsv_field(name);
+		putchar('\t');
+		tsv_field(u->vars[i]);
+		putchar('\t');
+		tsv_field(u->vars[i + 1]);
+		putchar('\n');
+	}
+}
+
+/* in the order they were given, those of <*@host> in its place;
+ * returns the number of UPSes which could not be read */
+static int bulk_print(int mode)
+{
+	const bulk_ups_t	*u;
+	char	name[LARGEBUF];
+	int	failed = 0;
+
+	for (u = bulk_upses; u; u = u->next) {
+		/* <*@host> itself only shows if LIST UPS failed */
+		if (!u->upsname && !u->error) {
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "%s@%s",
+			u->upsname ? u->upsname : "*", u->host->label);
+
+		if (mode == BULK_JSON) {
+			bulk_print_json(u, name);
+		} else {
+			bulk_print_tsv(u, name);
+		}
+
+		failed += (u->error != NULL);
+	}
+
+	return failed;
+}
+
+static void bulk_free(void)
+{
+	bulk_host_t	*host, *hnext;
+	bulk_ups_t	*u, *unext;
+	size_t	i;
+
+	for (u = bulk_upses; u; u = unext) {
+		unext = u->next;
+		for (i = 0; i < u->numvars; i++) {
+			free(u->vars[i]);
+		}
+		free(u->vars);
+		free(u->upsname);
+		free(u->error);
+		free(u);
+	}
+	bulk_upses = NULL;
+
+	for (host = bulk_hosts; host; host = hnext) {
+		hnext = host->next;
+		upscli_disconnect(&host->conn);
+		free(host->hostname);
+		free(host->label);
+		free(host);
+	}
+	bulk_hosts = NULL;
+}
+
 static void clean_exit(void)
 {
+	bulk_free();
+
 	if (ups) {
 		upscli_disconnect(ups);
 	}
@@ -221,7 +699,8 @@ int main(int argc, char **argv)
 {
 	int	i = 0;
 	uint16_t	port;
-	int	varlist = 0, clientlist = 0, verbose = 0;
+	int	varlist = 0, clientlist = 0, statlist = 0, verbose = 0;
+	int	bulk = 0, timeout = BULK_TIMEOUT;
 	const char	*prog = xbasename(argv[0]);
 	char	*s = NULL;
 
@@ -236,7 +715,7 @@ int main(int argc, char **argv)
 	}
 	upsdebugx(1, "Starting NUT client: %s", prog);
 
-	while ((i = getopt(argc, argv, "+hlLcV")) != -1) {
+	while ((i = getopt(argc, argv, "+hlLcsVjTw:")) != -1) {
 
 		switch (i)
 		{
@@ -250,6 +729,20 @@ int main(int argc, char **argv)
 		case 'c':
 			clientlist = 1;
 			break;
+		case 's':
+			statlist = 1;
+			break;
+		case 'j':
+			bulk = BULK_JSON;
+			break;
+		case 'T':
+			bulk = BULK_TSV;
+			break;
+		case 'w':
+			if (!str_to_int(optarg, &timeout, 10) || timeout < 1) {
+				fatalx(EXIT_FAILURE, "Error: invalid timeout: %s", optarg);
+			}
+			break;
 
 		case 'V':
 			/* just show the version and optional
@@ -271,7 +764,38 @@ int main(int argc, char **argv)
 	/* be a good little client that cleans up after itself */
 	atexit(clean_exit);
 
-	if (varlist) {
+	if (bulk) {
+		if (argc < 1) {
+			usage(prog);
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < argc; i++) {
+			const char	*at = strchr(argv[i], '@');
+
+			if (at == argv[i]) {
+				fatalx(EXIT_FAILURE, "Error: invalid UPS definition: %s\n"
+					"Required format: upsname[@hostname[:port]] or *@hostname[:port]", argv[i]);
+			}
+
+			if (!strncmp(argv[i], "*@", 2) || !strcmp(argv[i], "*")) {
+				bulk_ups_add(bulk_host(argv[i]), NULL, NULL);
+			} else {
+				char	*name = xstrdup(argv[i]);
+
+				if (at) {
+					name[at - argv[i]] = '\0';
+				}
+				bulk_ups_add(bulk_host(argv[i]), name, NULL);
+				free(name);
+			}
+		}
+
+		bulk_run(timeout);
+		exit(bulk_print(bulk) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	if (varlist || statlist) {
 		if (upscli_splitaddr(argv[0] ? argv[0] : "localhost", &hostname, &port) != 0) {
 			fatalx(EXIT_FAILURE, "Error: invalid hostname.\nRequired format: [hostname[:port]]");
 		}
@@ -295,6 +819,12 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	if (statlist) {
+		upsdebugx(1, "Calling list_stats()");
+		list_stats();
+		exit(EXIT_SUCCESS);
+	}
+
 	if (clientlist) {
 		upsdebugx(1, "Calling list_clients()");
 		list_clients(upsname);
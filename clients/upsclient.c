@@ -59,6 +59,11 @@
 #include "nut_stdint.h"
 #include "timehead.h"
 #include "upsclient.h"
+#include "binframe.h"
+
+#ifdef WITH_ZLIB
+# include <zlib.h>
+#endif
 
 /* WA for Solaris/i386 bug: non-blocking connect sets errno to ENOENT */
 #if (defined NUT_PLATFORM_SOLARIS)
@@ -153,6 +158,11 @@ typedef struct HOST_CERT_s {
 	struct HOST_CERT_s	*next;
 }	HOST_CERT_t;
 static HOST_CERT_t* upscli_find_host_cert(const char* hostname);
+static void upscli_binary_drop(const UPSCONN_t *ups);
+static void upscli_rxbuf_drop(const UPSCONN_t *ups);
+static void upscli_async_drop(const UPSCONN_t *ups);
+static void upscli_watch_drop(const UPSCONN_t *ups);
+static void upscli_zip_drop(const UPSCONN_t *ups);
 
 
 static int upscli_initialized = 0;
@@ -671,7 +681,7 @@ static ssize_t upscli_select_read(const int fd, void *buf, const size_t buflen,
 # pragma GCC diagnostic ignored "-Wtautological-constant-out-of-range-compare"
 #endif
 /* internal: abstract the SSL calls for the other functions */
-static ssize_t net_read(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
+static ssize_t net_read_raw(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
 {
 	ssize_t	ret = -1;
 
@@ -756,7 +766,7 @@ static ssize_t upscli_select_write(const int fd, const void *buf, const size_t b
 # pragma GCC diagnostic ignored "-Wtautological-constant-out-of-range-compare"
 #endif
 /* internal: abstract the SSL calls for the other functions */
-static ssize_t net_write(UPSCONN_t *ups, const char *buf, size_t buflen, const time_t timeout)
+static ssize_t net_write_raw(UPSCONN_t *ups, const char *buf, size_t buflen, const time_t timeout)
 {
 	ssize_t	ret = -1;
 
@@ -810,47 +820,33 @@ static ssize_t net_write(UPSCONN_t *ups, const char *buf, size_t buflen, const t
 
 #ifdef WITH_SSL
 
-/*
- * 1 : OK
- * -1 : ERROR
- * 0 : SSL NOT SUPPORTED
+/* Intend to initialize upscli with no ssl db if not already done.
+ * Compatibility stuff for old clients which do not initialize them.
  */
-static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
+static void upscli_sslcheckinit(void)
 {
-#ifdef WITH_OPENSSL
-	int res;
-#elif defined(WITH_NSS) /* WITH_OPENSSL */
-	SECStatus	status;
-	PRFileDesc	*socket;
-	HOST_CERT_t *cert;
-#endif /* WITH_OPENSSL | WITH_NSS */
-	char	buf[UPSCLI_NETBUF_LEN];
-
-	/* Intend to initialize upscli with no ssl db if not already done.
-	 * Compatibility stuff for old clients which do not initialize them.
-	 */
 	if (upscli_initialized==0) {
 		upsdebugx(3, "upscli not initialized, "
 			"force initialisation without SSL configuration");
 		upscli_init(0, NULL, NULL, NULL);
 	}
+}
 
-	/* see if upsd even talks SSL/TLS */
-	snprintf(buf, sizeof(buf), "STARTTLS\n");
-
-	if (upscli_sendline(ups, buf, strlen(buf)) != 0) {
-		return -1;
-	}
-
-	if (upscli_readline(ups, buf, sizeof(buf)) != 0) {
-		return -1;
-	}
-
-	if (strncmp(buf, "OK STARTTLS", 11) != 0) {
-		return 0;		/* not supported */
-	}
-
-	/* upsd is happy, so let's crank up the client */
+/* set up the client side of TLS once upsd accepted STARTTLS, with the
+ * socket left non-blocking if nonblock is set (the handshake is left
+ * to upscli_sslhandshake)
+ * 1 : OK
+ * -1 : ERROR
+ * 0 : SSL NOT SUPPORTED
+ */
+static int upscli_sslstart(UPSCONN_t *ups, int verifycert, int nonblock)
+{
+#ifdef WITH_NSS
+	SECStatus	status;
+	PRFileDesc	*socket;
+	HOST_CERT_t *cert;
+	PRSocketOptionData	sockopt;
+#endif /* WITH_NSS */
 
 #ifdef WITH_OPENSSL
 
@@ -876,20 +872,11 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		SSL_set_verify(ups->ssl, SSL_VERIFY_NONE, NULL);
 	}
 
-	res = SSL_connect(ups->ssl);
-	switch(res)
-	{
-	case 1:
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(ups->ssl));
-		break;
-	case 0:
-		upslog_with_errno(1, "SSL_connect do not accept handshake.");
-		ssl_error(ups->ssl, res);
-		return -1;
-	default:
-		upslog_with_errno(1, "Unknown return value from SSL_connect %d", res);
-		ssl_error(ups->ssl, res);
-		return -1;
+	/* the queued requests are written in parts, from a buffer which
+	 * moves as more are queued */
+	if (nonblock) {
+		SSL_set_mode(ups->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE
+			| SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 	}
 
 	return 1;
@@ -972,8 +959,72 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 		return -1;
 	}
 
+	/* NSPR takes imported sockets for blocking ones unless told */
+	if (nonblock) {
+		sockopt.option = PR_SockOpt_Nonblocking;
+		sockopt.value.non_blocking = PR_TRUE;
+		if (PR_SetSocketOption(ups->ssl, &sockopt) != PR_SUCCESS) {
+			nss_error("upscli_sslinit / PR_SetSocketOption");
+			return -1;
+		}
+	}
+
+	return 1;
+
+#endif /* WITH_OPENSSL | WITH_NSS */
+}
+
+/* run the TLS handshake: 1 once done, -1 on errors, or (only if want
+ * is not NULL, for non-blocking sockets) 0 if it has to wait for the
+ * socket to be ready for what *want tells */
+static int upscli_sslhandshake(UPSCONN_t *ups, int *want)
+{
+#ifdef WITH_OPENSSL
+	int res;
+
+	res = SSL_connect(ups->ssl);
+
+	if (want && res < 0) {
+		switch (SSL_get_error(ups->ssl, res))
+		{
+		case SSL_ERROR_WANT_READ:
+			*want |= UPSCLI_WANT_READ;
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			*want |= UPSCLI_WANT_WRITE;
+			return 0;
+		default:
+			break;
+		}
+	}
+
+	switch(res)
+	{
+	case 1:
+		upsdebugx(3, "SSL connected (%s)", SSL_get_version(ups->ssl));
+		break;
+	case 0:
+		upslog_with_errno(1, "SSL_connect do not accept handshake.");
+		ssl_error(ups->ssl, res);
+		return -1;
+	default:
+		upslog_with_errno(1, "Unknown return value from SSL_connect %d", res);
+		ssl_error(ups->ssl, res);
+		return -1;
+	}
+
+	return 1;
+
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	SECStatus	status;
+
 	status = SSL_ForceHandshake(ups->ssl);
 	if (status != SECSuccess) {
+		if (want && PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+			*want |= UPSCLI_WANT_READ;
+			return 0;
+		}
+
 		nss_error("upscli_sslinit / SSL_ForceHandshake");
 		ups->ssl = NULL;
 		/* EKI wtf unimport or free the socket ? */
@@ -986,6 +1037,42 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
+/*
+ * 1 : OK
+ * -1 : ERROR
+ * 0 : SSL NOT SUPPORTED
+ */
+static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
+{
+	char	buf[UPSCLI_NETBUF_LEN];
+	int	ret;
+
+	upscli_sslcheckinit();
+
+	/* see if upsd even talks SSL/TLS */
+	snprintf(buf, sizeof(buf), "STARTTLS\n");
+
+	if (upscli_sendline(ups, buf, strlen(buf)) != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, buf, sizeof(buf)) != 0) {
+		return -1;
+	}
+
+	if (strncmp(buf, "OK STARTTLS", 11) != 0) {
+		return 0;		/* not supported */
+	}
+
+	/* upsd is happy, so let's crank up the client */
+	ret = upscli_sslstart(ups, verifycert, 0);
+	if (ret != 1) {
+		return ret;
+	}
+
+	return upscli_sslhandshake(ups, NULL);
+}
+
 #else /* WITH_SSL */
 
 static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
@@ -998,40 +1085,13 @@ static int upscli_sslinit(UPSCONN_t *ups, int verifycert)
 
 #endif /* WITH_SSL */
 
-int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags, struct timeval * timeout)
+/* resolve host for upscli_tryconnect() and upscli_connect_start() */
+static int upscli_resolve(UPSCONN_t *ups, const char *host, uint16_t port,
+		int flags, struct addrinfo **res)
 {
-	int				sock_fd;
-	struct addrinfo	hints, *res, *ai;
+	struct addrinfo	hints;
 	char			sport[NI_MAXSERV];
-	int				v, certverify, tryssl, forcessl, ret;
-	HOST_CERT_t*	hostcert;
-	fd_set 			wfds;
-	int			error;
-	socklen_t		error_size;
-
-#ifndef WIN32
-	long			fd_flags;
-#else
-	HANDLE event = NULL;
-	unsigned long argp;
-
-	WSADATA WSAdata;
-	WSAStartup(2,&WSAdata);
-#endif
-	if (!ups) {
-		return -1;
-	}
-
-	/* clear out any lingering junk */
-	memset(ups, 0, sizeof(*ups));
-	ups->upsclient_magic = UPSCLIENT_MAGIC;
-	ups->fd = -1;
-
-	if (!host) {
-		upslogx(LOG_WARNING, "%s: Host not specified", __func__);
-		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
-		return -1;
-	}
+	int				v;
 
 	snprintf(sport, sizeof(sport), "%" PRIuMAX, (uintmax_t)port);
 
@@ -1048,7 +1108,7 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 
-	while ((v = getaddrinfo(host, sport, &hints, &res)) != 0) {
+	while ((v = getaddrinfo(host, sport, &hints, res)) != 0) {
 		switch (v)
 		{
 		case EAI_AGAIN:
@@ -1071,6 +1131,102 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags
 		return -1;
 	}
 
+	return 0;
+}
+
+/* what the connection flags or a host security rule ask for */
+static void upscli_sslopts(const char *host, int flags,
+		int *certverify, int *tryssl, int *forcessl)
+{
+	HOST_CERT_t*	hostcert;
+
+	hostcert = upscli_find_host_cert(host);
+
+	if (hostcert != NULL) {
+		/* An host security rule is specified. */
+		*certverify	= hostcert->certverify;
+		*forcessl	= hostcert->forcessl;
+	} else {
+		*certverify	= (flags & UPSCLI_CONN_CERTVERIF) != 0 ? 1 : 0;
+		*forcessl	= (flags & UPSCLI_CONN_REQSSL) != 0 ? 1 : 0;
+	}
+	*tryssl = (flags & UPSCLI_CONN_TRYSSL) != 0 ? 1 : 0;
+}
+
+/* whether the connection may go on after the outcome ret of the
+ * upscli_sslinit() steps: 0 if so, -1 if it must be dropped */
+static int upscli_sslcheck(UPSCONN_t *ups, int ret,
+		int certverify, int tryssl, int forcessl)
+{
+	const char	*host = ups->host;
+
+	if (forcessl && ret != 1) {
+		upslogx(LOG_ERR, "Can not connect to NUT server %s in SSL, disconnect", host);
+		ups->upserror = UPSCLI_ERR_SSLFAIL;
+		return -1;
+	} else if (tryssl && ret == -1) {
+		upslogx(LOG_NOTICE, "Error while connecting to NUT server %s, disconnect", host);
+		return -1;
+	} else if (tryssl && ret == 0) {
+		if (certverify != 0) {
+			upslogx(LOG_NOTICE, "Can not connect to NUT server %s in SSL and "
+				"certificate is needed, disconnect", host);
+			return -1;
+		}
+		upsdebugx(3, "Can not connect to NUT server %s in SSL, continue unencrypted", host);
+	} else {
+		upslogx(LOG_INFO, "Connected to NUT server %s in SSL", host);
+		if (certverify == 0) {
+			/* you REALLY should set CERTVERIFY to 1 if using SSL... */
+			upslogx(LOG_WARNING, "Certificate verification is disabled");
+		}
+	}
+
+	return 0;
+}
+
+int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags, struct timeval * timeout)
+{
+	int				sock_fd;
+	struct addrinfo	*res, *ai;
+	int				v, certverify, tryssl, forcessl, ret;
+	fd_set 			wfds;
+	int			error;
+	socklen_t		error_size;
+
+#ifndef WIN32
+	long			fd_flags;
+#else
+	HANDLE event = NULL;
+	unsigned long argp;
+
+	WSADATA WSAdata;
+	WSAStartup(2,&WSAdata);
+#endif
+	if (!ups) {
+		return -1;
+	}
+
+	/* clear out any lingering junk */
+	upscli_binary_drop(ups);
+	upscli_rxbuf_drop(ups);
+	upscli_zip_drop(ups);
+	upscli_async_drop(ups);
+	upscli_watch_drop(ups);
+	memset(ups, 0, sizeof(*ups));
+	ups->upsclient_magic = UPSCLIENT_MAGIC;
+	ups->fd = -1;
+
+	if (!host) {
+		upslogx(LOG_WARNING, "%s: Host not specified", __func__);
+		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
+		return -1;
+	}
+
+	if (upscli_resolve(ups, host, port, flags, &res) < 0) {
+		return -1;
+	}
+
 	for (ai = res; ai != NULL; ai = ai->ai_next) {
 
 		sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
@@ -1189,43 +1345,13 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, uint16_t port, int flags
 
 	ups->port = port;
 
-	hostcert = upscli_find_host_cert(host);
-
-	if (hostcert != NULL) {
-		/* An host security rule is specified. */
-		certverify	= hostcert->certverify;
-		forcessl	= hostcert->forcessl;
-	} else {
-		certverify	= (flags & UPSCLI_CONN_CERTVERIF) != 0 ? 1 : 0;
-		forcessl	= (flags & UPSCLI_CONN_REQSSL) != 0 ? 1 : 0;
-	}
-	tryssl = (flags & UPSCLI_CONN_TRYSSL) != 0 ? 1 : 0;
+	upscli_sslopts(host, flags, &certverify, &tryssl, &forcessl);
 
 	if (tryssl || forcessl) {
 		ret = upscli_sslinit(ups, certverify);
-		if (forcessl && ret != 1) {
-			upslogx(LOG_ERR, "Can not connect to NUT server %s in SSL, disconnect", host);
-			ups->upserror = UPSCLI_ERR_SSLFAIL;
-			upscli_disconnect(ups);
-			return -1;
-		} else if (tryssl && ret == -1) {
-			upslogx(LOG_NOTICE, "Error while connecting to NUT server %s, disconnect", host);
+		if (upscli_sslcheck(ups, ret, certverify, tryssl, forcessl) < 0) {
 			upscli_disconnect(ups);
 			return -1;
-		} else if (tryssl && ret == 0) {
-			if (certverify != 0) {
-				upslogx(LOG_NOTICE, "Can not connect to NUT server %s in SSL and "
-					"certificate is needed, disconnect", host);
-				upscli_disconnect(ups);
-				return -1;
-			}
-			upsdebugx(3, "Can not connect to NUT server %s in SSL, continue unencrypted", host);
-		} else {
-			upslogx(LOG_INFO, "Connected to NUT server %s in SSL", host);
-			if (certverify == 0) {
-				/* you REALLY should set CERTVERIFY to 1 if using SSL... */
-				upslogx(LOG_WARNING, "Certificate verification is disabled");
-			}
 		}
 	}
 
@@ -1363,260 +1489,2514 @@ static int verify_resp(size_t num, const char **q, char **a)
 	return 1;	/* OK */
 }
 
-int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
-		size_t *numa, char ***answer)
+/* LIST VAR * or LIST VAR <ups1> <ups2> ... (protocol 1.4) */
+static int list_multi(size_t num, const char **q)
 {
-	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
-
-	if (!ups) {
-		return -1;
+	if ((num < 2) || (strcasecmp(q[0], "VAR") != 0)) {
+		return 0;
 	}
 
-	if (numq < 1) {
-		ups->upserror = UPSCLI_ERR_INVALIDARG;
-		return -1;
+	if (!strcmp(q[1], "*")) {
+		return 1;
 	}
 
-	/* create the string to send to upsd */
-	build_cmd(cmd, sizeof(cmd), "GET", numq, query);
+	return ((num > 2) && (strcasecmp(q[2], "SINCE") != 0)
+		&& (strcasecmp(q[2], "PREFIX") != 0));
+}
+
+/* each line of such a list is VAR <ups> <var> <val> for one of the
+ * devices asked for (or any device, for "*") */
+static int verify_list_resp(size_t num, const char **q, size_t numa, char **a)
+{
+	size_t	i;
+
+	if (!list_multi(num, q)) {
+		return verify_resp(num, q, a);
+	}
+
+	if ((numa < 2) || (strcasecmp(q[0], a[0]) != 0)) {
+		return 0;	/* mismatch */
+	}
+
+	if (!strcmp(q[1], "*")) {
+		return 1;	/* OK */
+	}
+
+	for (i = 1; i < num; i++) {
+		if (!strcasecmp(q[i], a[1])) {
+			return 1;	/* OK */
+		}
+	}
+
+	return 0;	/* mismatch */
+}
+
+/* the state kept aside for each connection below is in lists hashed on
+ * the UPSCONN_t address, as a program watching many UPSes or loading
+ * upsd may have thousands of connections at once */
+#define UPSCLI_CONN_BUCKETS	256
+#define UPSCLI_CONN_HASH(ups)	((((uintptr_t)(ups)) / sizeof(void *)) % UPSCLI_CONN_BUCKETS)
+
+/* COMPRESS DEFLATE state of a connection (see netzip.c of upsd), kept
+ * aside like the receive buffer below: one raw deflate stream each way,
+ * on top of TLS if any, for as long as the connection lasts */
+#ifdef WITH_ZLIB
+/* the commands are short: a small window and hash tables do for them */
+# define UPSCLI_ZIP_WINDOW_BITS	10
+# define UPSCLI_ZIP_MEM_LEVEL	4
+# define UPSCLI_ZIP_INBUF_LEN	4096
+
+typedef struct upscli_zip_s {
+	const UPSCONN_t	*ups;
+	z_stream	out;
+	z_stream	in;
+	unsigned char	inbuf[UPSCLI_ZIP_INBUF_LEN];	/* read, not inflated yet */
+	int	more;	/* the last inflate() filled the buffer it had */
+	struct upscli_zip_s	*next;
+} upscli_zip_t;
+
+static upscli_zip_t	*upscli_zips[UPSCLI_CONN_BUCKETS];
+
+#if (defined HAVE_PTHREAD) && (!defined WIN32)
+static pthread_mutex_t	upscli_zips_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define upscli_zips_lock()	pthread_mutex_lock(&upscli_zips_mutex)
+# define upscli_zips_unlock()	pthread_mutex_unlock(&upscli_zips_mutex)
+#else
+# define upscli_zips_lock()
+# define upscli_zips_unlock()
+#endif
+
+static upscli_zip_t *upscli_zip_find(const UPSCONN_t *ups)
+{
+	upscli_zip_t	*zip;
+
+	upscli_zips_lock();
+
+	for (zip = upscli_zips[UPSCLI_CONN_HASH(ups)]; zip; zip = zip->next) {
+		if (zip->ups == ups) {
+			break;
+		}
+	}
+
+	upscli_zips_unlock();
+
+	return zip;
+}
+
+/* the streams end with the connection */
+static void upscli_zip_drop(const UPSCONN_t *ups)
+{
+	upscli_zip_t	**zipp, *zip;
+
+	upscli_zips_lock();
+
+	for (zipp = &upscli_zips[UPSCLI_CONN_HASH(ups)]; *zipp; zipp = &(*zipp)->next) {
+		if ((*zipp)->ups == ups) {
+			break;
+		}
+	}
+
+	zip = *zipp;
+	if (zip) {
+		*zipp = zip->next;
+	}
+
+	upscli_zips_unlock();
+
+	if (zip) {
+		deflateEnd(&zip->out);
+		inflateEnd(&zip->in);
+		free(zip);
+	}
+}
+
+/* 1 if inflating gives more without reading the connection */
+static int upscli_zip_pending(const UPSCONN_t *ups)
+{
+	upscli_zip_t	*zip = upscli_zip_find(ups);
+
+	return (zip && (zip->in.avail_in > 0 || zip->more));
+}
+
+/* read and inflate what upsd sent, as net_read_raw() does */
+static ssize_t upscli_zip_read(UPSCONN_t *ups, upscli_zip_t *zip, char *buf, size_t buflen, const time_t timeout)
+{
+	ssize_t	ret;
+	int	zret;
+
+	for (;;) {
+		zip->in.next_out = (Bytef *)buf;
+		zip->in.avail_out = (uInt)buflen;
+
+		zret = inflate(&zip->in, Z_SYNC_FLUSH);
+
+		if (zret != Z_OK && zret != Z_BUF_ERROR) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		zip->more = (zip->in.avail_out == 0);
+		if (zip->in.avail_out < buflen) {
+			return (ssize_t)(buflen - zip->in.avail_out);
+		}
+
+		/* all of it was inflated, and did not end a block yet */
+		ret = net_read_raw(ups, (char *)zip->inbuf, sizeof(zip->inbuf), timeout);
+
+		if (ret < 1) {
+			return ret;
+		}
+
+		zip->in.next_in = zip->inbuf;
+		zip->in.avail_in = (uInt)ret;
+	}
+}
+
+/* deflate and send a whole command, as net_write_raw() does */
+static ssize_t upscli_zip_write(UPSCONN_t *ups, upscli_zip_t *zip, const char *buf, size_t buflen, const time_t timeout)
+{
+	unsigned char	out[UPSCLI_NETBUF_LEN];
+	size_t	len, sent;
+	ssize_t	ret;
+
+	zip->out.next_in = (Bytef *)buf;
+	zip->out.avail_in = (uInt)buflen;
+
+	do {
+		zip->out.next_out = out;
+		zip->out.avail_out = sizeof(out);
+
+		if (deflate(&zip->out, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		len = sizeof(out) - zip->out.avail_out;
+		for (sent = 0; sent < len; sent += (size_t)ret) {
+			ret = net_write_raw(ups, (const char *)out + sent, len - sent, timeout);
+
+			if (ret < 1) {
+				return ret;
+			}
+		}
+	} while (zip->out.avail_out == 0);
+
+	return (ssize_t)buflen;
+}
+#else	/* !WITH_ZLIB */
+static void upscli_zip_drop(const UPSCONN_t *ups)
+{
+	NUT_UNUSED_VARIABLE(ups);
+}
+
+static int upscli_zip_pending(const UPSCONN_t *ups)
+{
+	NUT_UNUSED_VARIABLE(ups);
+
+	return 0;
+}
+#endif	/* WITH_ZLIB */
+
+static ssize_t net_read(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
+{
+#ifdef WITH_ZLIB
+	upscli_zip_t	*zip = upscli_zip_find(ups);
+
+	if (zip) {
+		return upscli_zip_read(ups, zip, buf, buflen, timeout);
+	}
+#endif
+
+	return net_read_raw(ups, buf, buflen, timeout);
+}
+
+static ssize_t net_write(UPSCONN_t *ups, const char *buf, size_t buflen, const time_t timeout)
+{
+#ifdef WITH_ZLIB
+	upscli_zip_t	*zip = upscli_zip_find(ups);
+
+	if (zip) {
+		return upscli_zip_write(ups, zip, buf, buflen, timeout);
+	}
+#endif
+
+	return net_write_raw(ups, buf, buflen, timeout);
+}
+
+/* receive buffer of a connection, kept aside like the binary framing
+ * state below: the readbuf in UPSCONN_t is only 64 bytes, which cost
+ * a select() and a read() per 64 bytes of a LIST answer */
+#define UPSCLI_RXBUF_LEN	16384
+
+typedef struct upscli_rxbuf_s {
+	const UPSCONN_t	*ups;
+	size_t	len;	/* bytes in data */
+	size_t	idx;	/* first unread one */
+	char	data[UPSCLI_RXBUF_LEN];
+	struct upscli_rxbuf_s	*next;
+} upscli_rxbuf_t;
+
+static upscli_rxbuf_t	*upscli_rxbufs[UPSCLI_CONN_BUCKETS];
+
+#if (defined HAVE_PTHREAD) && (!defined WIN32)
+static pthread_mutex_t	upscli_rxbufs_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define upscli_rxbufs_lock()	pthread_mutex_lock(&upscli_rxbufs_mutex)
+# define upscli_rxbufs_unlock()	pthread_mutex_unlock(&upscli_rxbufs_mutex)
+#else
+# define upscli_rxbufs_lock()
+# define upscli_rxbufs_unlock()
+#endif
+
+/* the receive buffer of a connection, created upon its first read */
+static upscli_rxbuf_t *upscli_rxbuf_get(const UPSCONN_t *ups)
+{
+	upscli_rxbuf_t	*rx;
+
+	upscli_rxbufs_lock();
+
+	for (rx = upscli_rxbufs[UPSCLI_CONN_HASH(ups)]; rx; rx = rx->next) {
+		if (rx->ups == ups) {
+			break;
+		}
+	}
+
+	if (!rx) {
+		rx = xcalloc(1, sizeof(*rx));
+		rx->ups = ups;
+		rx->next = upscli_rxbufs[UPSCLI_CONN_HASH(ups)];
+		upscli_rxbufs[UPSCLI_CONN_HASH(ups)] = rx;
+	}
+
+	upscli_rxbufs_unlock();
+
+	return rx;
+}
+
+/* unread data is worthless once the connection is gone */
+static void upscli_rxbuf_drop(const UPSCONN_t *ups)
+{
+	upscli_rxbuf_t	**rxp, *rx;
+
+	upscli_rxbufs_lock();
+
+	for (rxp = &upscli_rxbufs[UPSCLI_CONN_HASH(ups)]; *rxp; rxp = &(*rxp)->next) {
+		if ((*rxp)->ups == ups) {
+			break;
+		}
+	}
+
+	rx = *rxp;
+	if (rx) {
+		*rxp = rx->next;
+	}
+
+	upscli_rxbufs_unlock();
+
+	free(rx);
+}
+
+/* have unread bytes in the receive buffer, reading the connection
+ * if needed; on errors, disconnects and returns -1 */
+static int upscli_rxbuf_fill(UPSCONN_t *ups, upscli_rxbuf_t *rx, const time_t timeout)
+{
+	ssize_t	ret;
+
+	if (rx->idx < rx->len) {
+		return 0;
+	}
+
+	ret = net_read(ups, rx->data, sizeof(rx->data), timeout);
+
+	if (ret < 1) {
+		upscli_disconnect(ups);
+		return -1;
+	}
+
+	/* Here ret is safe to cast since it is >=1 and certainly
+	 * fits under SIZE_MAX being it signed sibling
+	 */
+	rx->len = (size_t)ret;
+	rx->idx = 0;
+
+	return 0;
+}
+
+/* binary framing state of a connection (see binframe.h), kept aside
+ * since UPSCONN_t is part of the library ABI */
+typedef struct upscli_binary_s {
+	const UPSCONN_t	*ups;
+	char	**names;	/* by id: "<ups>\0<var>" */
+	size_t	numnames;
+	char	*answer[4];	/* VAR <ups> <var> <value> */
+	char	value[SMALLBUF];
+	unsigned char	rec[BINFRAME_MAX_LEN + 1];
+	struct upscli_binary_s	*next;
+} upscli_binary_t;
+
+static upscli_binary_t	*upscli_binaries[UPSCLI_CONN_BUCKETS];
+
+#if (defined HAVE_PTHREAD) && (!defined WIN32)
+static pthread_mutex_t	upscli_binaries_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define upscli_binaries_lock()		pthread_mutex_lock(&upscli_binaries_mutex)
+# define upscli_binaries_unlock()	pthread_mutex_unlock(&upscli_binaries_mutex)
+#else
+# define upscli_binaries_lock()
+# define upscli_binaries_unlock()
+#endif
+
+static upscli_binary_t *upscli_binary_find(const UPSCONN_t *ups)
+{
+	upscli_binary_t	*bin;
+
+	upscli_binaries_lock();
+
+	for (bin = upscli_binaries[UPSCLI_CONN_HASH(ups)]; bin; bin = bin->next) {
+		if (bin->ups == ups) {
+			break;
+		}
+	}
+
+	upscli_binaries_unlock();
+
+	return bin;
+}
+
+static void upscli_binary_forget(upscli_binary_t *bin)
+{
+	size_t	i;
+
+	for (i = 0; i < bin->numnames; i++) {
+		free(bin->names[i]);
+	}
+
+	free(bin->names);
+	bin->names = NULL;
+	bin->numnames = 0;
+}
+
+/* back to text framing, upon FRAMING TEXT or disconnect */
+static void upscli_binary_drop(const UPSCONN_t *ups)
+{
+	upscli_binary_t	**binp, *bin;
+
+	upscli_binaries_lock();
+
+	for (binp = &upscli_binaries[UPSCLI_CONN_HASH(ups)]; *binp; binp = &(*binp)->next) {
+		if ((*binp)->ups == ups) {
+			break;
+		}
+	}
+
+	bin = *binp;
+	if (bin) {
+		*binp = bin->next;
+	}
+
+	upscli_binaries_unlock();
+
+	if (bin) {
+		upscli_binary_forget(bin);
+		free(bin);
+	}
+}
+
+/* len bytes off the connection, from the same buffer as upscli_readline() */
+static int upscli_read_bytes(UPSCONN_t *ups, unsigned char *buf, size_t len)
+{
+	upscli_rxbuf_t	*rx = upscli_rxbuf_get(ups);
+	size_t	recv, n;
+
+	for (recv = 0; recv < len; recv += n) {
+
+		if (upscli_rxbuf_fill(ups, rx, DEFAULT_NETWORK_TIMEOUT) < 0) {
+			return -1;
+		}
+
+		n = rx->len - rx->idx;
+		if (n > len - recv) {
+			n = len - recv;
+		}
+
+		memcpy(buf + recv, rx->data + rx->idx, n);
+		rx->idx += n;
+	}
+
+	return 0;
+}
+
+/* the next record; NAME and RESET are taken care of here, BEGIN and END
+ * come back as the text line upsd would have sent, values in bin->answer */
+static int upscli_binary_read(UPSCONN_t *ups, upscli_binary_t *bin,
+		char *buf, size_t buflen)
+{
+	unsigned char	hdr[BINFRAME_HEADER_LEN];
+	size_t	len;
+	uint32_t	id;
+	const char	*prefix;
+	char	*name, *p, **names;
+
+	for (;;) {
+		if (upscli_read_bytes(ups, hdr, 1) != 0) {
+			return -1;
+		}
+
+		/* not a record: ERR ..., or any reply which is not framed */
+		if (hdr[0] >= BINFRAME_TYPE_MAX) {
+			buf[0] = (char)hdr[0];
+
+			if (hdr[0] == '\n') {
+				buf[0] = '\0';
+				return 0;
+			}
+
+			return (upscli_readline(ups, buf + 1, buflen - 1) == 0) ? 0 : -1;
+		}
+
+		if (upscli_read_bytes(ups, hdr + 1, BINFRAME_HEADER_LEN - 1) != 0) {
+			return -1;
+		}
+
+		len = ((size_t)hdr[1] << 8) | (size_t)hdr[2];
+
+		if (upscli_read_bytes(ups, bin->rec, len) != 0) {
+			return -1;
+		}
+
+		bin->rec[len] = '\0';
+
+		switch (hdr[0])
+		{
+		case BINFRAME_BEGIN:
+		case BINFRAME_END:
+			prefix = (hdr[0] == BINFRAME_BEGIN) ? "BEGIN LIST " : "END LIST ";
+
+			if (strlen(prefix) + len >= buflen) {
+				break;
+			}
+
+			memcpy(buf, prefix, strlen(prefix));
+			memcpy(buf + strlen(prefix), bin->rec, len + 1);
+			return 0;
+
+		case BINFRAME_NAME:
+			if (len < BINFRAME_ID_LEN) {
+				break;
+			}
+
+			id = binframe_get_u32(bin->rec);
+			name = (char *)bin->rec + BINFRAME_ID_LEN;
+			p = strchr(name, ' ');
+
+			/* ids are handed out in order, starting at 1 */
+			if ((id != bin->numnames + 1) || !p) {
+				break;
+			}
+
+			*p = '\0';
+
+			names = xrealloc(bin->names, (bin->numnames + 1) * sizeof(*names));
+			names[bin->numnames] = xmalloc(len - BINFRAME_ID_LEN + 1);
+			memcpy(names[bin->numnames], name, len - BINFRAME_ID_LEN + 1);
+			bin->names = names;
+			bin->numnames++;
+			continue;
+
+		case BINFRAME_RESET:
+			upscli_binary_forget(bin);
+			continue;
+
+		case BINFRAME_STR:
+		case BINFRAME_NUM:
+			if (len < BINFRAME_ID_LEN) {
+				break;
+			}
+
+			id = binframe_get_u32(bin->rec);
+
+			if ((id < 1) || (id > bin->numnames)) {
+				break;
+			}
+
+			if (hdr[0] == BINFRAME_STR) {
+				bin->answer[3] = (char *)bin->rec + BINFRAME_ID_LEN;
+			} else {
+				if ((len != BINFRAME_NUM_LEN)
+				 || !binframe_num_format(
+					binframe_get_i64(bin->rec + BINFRAME_ID_LEN + 1),
+					bin->rec[BINFRAME_ID_LEN],
+					bin->value, sizeof(bin->value))
+				) {
+					break;
+				}
+
+				bin->answer[3] = bin->value;
+			}
+
+			bin->answer[0] = "VAR";
+			bin->answer[1] = bin->names[id - 1];
+			bin->answer[2] = bin->names[id - 1] + strlen(bin->names[id - 1]) + 1;
+			return 1;
+
+		default:
+			/* a newer kind of record: skip it */
+			continue;
+		}
+
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+}
+
+/* the next line of a reply into buf (returns 0), or with binary framing
+ * on, possibly a value instead (returns 1, with VAR <ups> <var> <value>
+ * in answer); -1 on errors */
+static int upscli_read_reply(UPSCONN_t *ups, char *buf, size_t buflen,
+		char ***answer)
+{
+	upscli_binary_t	*bin = upscli_binary_find(ups);
+	int	ret;
+
+	if (!bin) {
+		return (upscli_readline(ups, buf, buflen) == 0) ? 0 : -1;
+	}
+
+	ret = upscli_binary_read(ups, bin, buf, buflen);
+
+	if (ret == 1) {
+		*answer = bin->answer;
+	}
+
+	return ret;
+}
+
+/* FRAMING BINARY|TEXT (protocol 1.4): returns 1 once upsd sends GET VAR
+ * and LIST VAR replies as records, 0 for text (e.g. an older server which
+ * does not know the command), or -1 on errors */
+int upscli_set_binary(UPSCONN_t *ups, int enable)
+{
+	char	buf[UPSCLI_NETBUF_LEN];
+	upscli_binary_t	*bin;
+
+	if (!ups) {
+		return -1;
+	}
+
+	snprintf(buf, sizeof(buf), "FRAMING %s\n", enable ? "BINARY" : "TEXT");
+
+	if (upscli_sendline(ups, buf, strlen(buf)) != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, buf, sizeof(buf)) != 0) {
+		return -1;
+	}
+
+	if (strncmp(buf, "OK", 2) != 0) {
+		/* nothing changed on the server side */
+		upscli_errcheck(ups, buf);
+		return (upscli_binary_find(ups) != NULL);
+	}
+
+	if (!enable) {
+		upscli_binary_drop(ups);
+		return 0;
+	}
+
+	if (upscli_binary_find(ups)) {
+		return 1;
+	}
+
+	bin = xcalloc(1, sizeof(*bin));
+	bin->ups = ups;
+
+	upscli_binaries_lock();
+	bin->next = upscli_binaries[UPSCLI_CONN_HASH(ups)];
+	upscli_binaries[UPSCLI_CONN_HASH(ups)] = bin;
+	upscli_binaries_unlock();
+
+	return 1;
+}
+
+/* read the answer to a GET query sent earlier: 0 if it came, 1 if the
+ * server returned an error for it (the connection remains usable),
+ * -1 on other errors */
+static int upscli_get_answer(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	char	tmp[UPSCLI_NETBUF_LEN], **vals;
+	int	ret;
+
+	ret = upscli_read_reply(ups, tmp, sizeof(tmp), &vals);
+
+	if (ret < 0) {
+		return -1;
+	}
+
+	/* a value record is just the VAR <ups> <var> <val> */
+	if (ret > 0) {
+		if ((numq > 4) || !verify_resp(numq, query, vals)) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		*numa = 4;
+		*answer = vals;
+
+		return 0;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return 1;
+	}
+
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	/* q: [GET] VAR <ups> <var>   *
+	 * a: VAR <ups> <var> <val> */
+
+	if (ups->pc_ctx.numargs < numq) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	if (!verify_resp(numq, query, ups->pc_ctx.arglist)) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	*numa = ups->pc_ctx.numargs;
+	*answer = ups->pc_ctx.arglist;
+
+	return 0;
+}
+
+int upscli_get_send(UPSCONN_t *ups, size_t numq, const char **query)
+{
+	char	cmd[UPSCLI_NETBUF_LEN];
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (numq < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* create the string to send to upsd */
+	build_cmd(cmd, sizeof(cmd), "GET", numq, query);
+
+	return (upscli_sendline(ups, cmd, strlen(cmd)) == 0) ? 0 : -1;
+}
+
+int upscli_get_recv(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	if (!ups) {
+		return -1;
+	}
+
+	if (numq < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	return (upscli_get_answer(ups, numq, query, numa, answer) == 0) ? 0 : -1;
+}
+
+int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	if (upscli_get_send(ups, numq, query) != 0) {
+		return -1;
+	}
+
+	return upscli_get_recv(ups, numq, query, numa, answer);
+}
+
+/* read the BEGIN line of a LIST query sent earlier: 0 if it came, 1 if
+ * the server returned an error instead (the connection remains usable),
+ * -1 on other errors */
+static int upscli_list_begin(UPSCONN_t *ups, size_t numq, const char **query)
+{
+	char	tmp[UPSCLI_NETBUF_LEN], **vals;
+
+	/* a value before BEGIN LIST is as wrong as any other line there */
+	if (upscli_read_reply(ups, tmp, sizeof(tmp), &vals) != 0) {
+		if (ups->fd >= 0) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+		}
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return 1;
+	}
+
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	if (ups->pc_ctx.numargs < 2) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* the response must start with BEGIN LIST */
+	if ((strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0) ||
+		(strcasecmp(ups->pc_ctx.arglist[1], "LIST") != 0)) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* q: [LIST] VAR <ups>       *
+	 * a: [BEGIN LIST] VAR <ups> */
+
+	/* e.g. an older server ignoring "SINCE <token>" */
+	if (ups->pc_ctx.numargs < numq + 2) {
+		/* or one listing just the first of several devices: skip it,
+		 * so the connection stays usable for simpler queries */
+		if (list_multi(numq, query)) {
+			while (upscli_readline(ups, tmp, sizeof(tmp)) == 0) {
+				if (!strncmp(tmp, "END LIST ", 9)) {
+					break;
+				}
+			}
+		}
+
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* compare q[0]... to a[2]... */
+
+	if (!verify_resp(numq, query, &ups->pc_ctx.arglist[2])) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
+{
+	char	cmd[UPSCLI_NETBUF_LEN];
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (numq < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* create the string to send to upsd */
+	build_cmd(cmd, sizeof(cmd), "LIST", numq, query);
 
 	if (upscli_sendline(ups, cmd, strlen(cmd)) != 0) {
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
-		return -1;
+	return (upscli_list_begin(ups, numq, query) == 0) ? 0 : -1;
+}
+
+int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	char	tmp[UPSCLI_NETBUF_LEN], **vals;
+	int	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	ret = upscli_read_reply(ups, tmp, sizeof(tmp), &vals);
+
+	if (ret < 0) {
+		return -1;
+	}
+
+	if (ret > 0) {
+		*numa = 4;
+		*answer = vals;
+
+		if (!verify_list_resp(numq, query, 4, vals)) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		return 1;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return -1;
+	}
+
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	if (ups->pc_ctx.numargs < 1) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	*numa = ups->pc_ctx.numargs;
+	*answer = ups->pc_ctx.arglist;
+
+	/* see if this is the end */
+	if (ups->pc_ctx.numargs >= 2) {
+		if ((!strcmp(ups->pc_ctx.arglist[0], "END")) &&
+			(!strcmp(ups->pc_ctx.arglist[1], "LIST")))
+			return 0;
+	}
+
+	/* q: VAR <ups> */
+	/* a: VAR <ups> <val> */
+
+	if (!verify_list_resp(numq, query, ups->pc_ctx.numargs, ups->pc_ctx.arglist)) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* just another part of the list */
+	return 1;
+}
+
+/* send n queries at once */
+static int upscli_send_many(UPSCONN_t *ups, const char *cmdname,
+		upscli_query_t *queries, size_t n)
+{
+	char	cmd[UPSCLI_NETBUF_LEN], *buf;
+	size_t	i, len = 0;
+	int	ret;
+
+	buf = xmalloc(n * sizeof(cmd));
+
+	for (i = 0; i < n; i++) {
+		build_cmd(cmd, sizeof(cmd), cmdname, queries[i].numq, queries[i].query);
+		memcpy(buf + len, cmd, strlen(cmd));
+		len += strlen(cmd);
+	}
+
+	ret = upscli_sendline(ups, buf, len);
+	free(buf);
+
+	return ret;
+}
+
+/* how many queries are written before their answers are read, so that
+ * neither side sits on a full socket buffer waiting for the other */
+#define UPSCLI_PIPELINE_MAX	32
+
+/* Send count GET queries without waiting for each answer, then read the
+ * answers in order: cb gets the answer to queries[idx] (valid during the
+ * call only), and queries[idx].upserror tells if there was none (the
+ * server returned an error for that query). Returns 0 once all answers
+ * were read, -1 if the connection failed (see ups->upserror). */
+int upscli_get_many(UPSCONN_t *ups, upscli_query_t *queries, size_t count,
+		upscli_answer_cb_t cb, void *arg)
+{
+	size_t	first, n, i, numa;
+	char	**answer;
+	int	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (!queries || !cb) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (queries[i].numq < 1 || !queries[i].query) {
+			ups->upserror = UPSCLI_ERR_INVALIDARG;
+			return -1;
+		}
+
+		queries[i].upserror = UPSCLI_ERR_NONE;
+	}
+
+	for (first = 0; first < count; first += n) {
+		n = count - first;
+		if (n > UPSCLI_PIPELINE_MAX) {
+			n = UPSCLI_PIPELINE_MAX;
+		}
+
+		if (upscli_send_many(ups, "GET", &queries[first], n) != 0) {
+			return -1;
+		}
+
+		for (i = first; i < first + n; i++) {
+			ret = upscli_get_answer(ups, queries[i].numq, queries[i].query,
+				&numa, &answer);
+
+			if (ret < 0) {
+				return -1;
+			}
+
+			if (ret > 0) {
+				queries[i].upserror = ups->upserror;
+				continue;
+			}
+
+			cb(arg, i, numa, answer);
+		}
+	}
+
+	return 0;
+}
+
+/* The same for LIST queries: cb gets each line of each list (with idx
+ * telling which query it answers), until the END line. */
+int upscli_list_many(UPSCONN_t *ups, upscli_query_t *queries, size_t count,
+		upscli_answer_cb_t cb, void *arg)
+{
+	size_t	first, n, i, numa;
+	char	**answer;
+	int	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (!queries || !cb) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (queries[i].numq < 1 || !queries[i].query) {
+			ups->upserror = UPSCLI_ERR_INVALIDARG;
+			return -1;
+		}
+
+		queries[i].upserror = UPSCLI_ERR_NONE;
+	}
+
+	for (first = 0; first < count; first += n) {
+		n = count - first;
+		if (n > UPSCLI_PIPELINE_MAX) {
+			n = UPSCLI_PIPELINE_MAX;
+		}
+
+		if (upscli_send_many(ups, "LIST", &queries[first], n) != 0) {
+			return -1;
+		}
+
+		for (i = first; i < first + n; i++) {
+			ret = upscli_list_begin(ups, queries[i].numq, queries[i].query);
+
+			if (ret < 0) {
+				return -1;
+			}
+
+			if (ret > 0) {
+				queries[i].upserror = ups->upserror;
+				continue;
+			}
+
+			while ((ret = upscli_list_next(ups, queries[i].numq, queries[i].query,
+				&numa, &answer)) == 1) {
+				cb(arg, i, numa, answer);
+			}
+
+			if (ret < 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* The same for commands with a one line reply, like SET VAR or INSTCMD
+ * (cmdname "SET" and queries such as { "VAR", ups, var, value }, or
+ * cmdname "INSTCMD" and { ups, cmd }): cb gets each reply, e.g. OK
+ * TRACKING <id>, so a batch of settings or commands costs one round
+ * trip, with the tracking ids collected. */
+int upscli_cmd_many(UPSCONN_t *ups, const char *cmdname,
+		upscli_query_t *queries, size_t count,
+		upscli_answer_cb_t cb, void *arg)
+{
+	size_t	first, n, i;
+	char	tmp[UPSCLI_NETBUF_LEN];
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (!cmdname || !queries || !cb) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (queries[i].numq < 1 || !queries[i].query) {
+			ups->upserror = UPSCLI_ERR_INVALIDARG;
+			return -1;
+		}
+
+		queries[i].upserror = UPSCLI_ERR_NONE;
+	}
+
+	for (first = 0; first < count; first += n) {
+		n = count - first;
+		if (n > UPSCLI_PIPELINE_MAX) {
+			n = UPSCLI_PIPELINE_MAX;
+		}
+
+		if (upscli_send_many(ups, cmdname, &queries[first], n) != 0) {
+			return -1;
+		}
+
+		for (i = first; i < first + n; i++) {
+			if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+				return -1;
+			}
+
+			if (upscli_errcheck(ups, tmp) != 0) {
+				queries[i].upserror = ups->upserror;
+				continue;
+			}
+
+			if (!pconf_line(&ups->pc_ctx, tmp)) {
+				ups->upserror = UPSCLI_ERR_PARSE;
+				return -1;
+			}
+
+			cb(arg, i, ups->pc_ctx.numargs, ups->pc_ctx.arglist);
+		}
+	}
+
+	return 0;
+}
+
+/* After upscli_list_next() returned 0 for a "LIST VAR <ups> SINCE <token>"
+ * query, copy the token for the next such query from the END line into buf.
+ * Returns 1 if the server sent a full list (variables missing from it are
+ * gone), 0 if only the changes were sent, or -1 on errors. */
+int upscli_list_since_token(UPSCONN_t *ups, char *buf, size_t buflen)
+{
+	size_t	i;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (!buf || buflen < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* a: END LIST VAR <ups> SINCE <token> [FULL] */
+	if ((ups->pc_ctx.numargs < 2)
+	 || (strcmp(ups->pc_ctx.arglist[0], "END") != 0)
+	 || (strcmp(ups->pc_ctx.arglist[1], "LIST") != 0)
+	) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	for (i = 2; i + 1 < ups->pc_ctx.numargs; i++) {
+		if (strcasecmp(ups->pc_ctx.arglist[i], "SINCE") != 0) {
+			continue;
+		}
+
+		if (strlen(ups->pc_ctx.arglist[i + 1]) >= buflen) {
+			ups->upserror = UPSCLI_ERR_INVALIDARG;
+			return -1;
+		}
+
+		snprintf(buf, buflen, "%s", ups->pc_ctx.arglist[i + 1]);
+
+		return ((i + 2 < ups->pc_ctx.numargs)
+			&& !strcasecmp(ups->pc_ctx.arglist[i + 2], "FULL"));
+	}
+
+	/* the server did not understand SINCE, or it was not asked for */
+	ups->upserror = UPSCLI_ERR_PROTOCOL;
+	return -1;
+}
+
+ssize_t upscli_sendline_timeout(UPSCONN_t *ups, const char *buf, size_t buflen, const time_t timeout)
+{
+	ssize_t	ret;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	if ((!buf) || (buflen < 1)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	ret = net_write(ups, buf, buflen, timeout);
+
+	if (ret < 1) {
+		upscli_disconnect(ups);
+		return -1;
+	}
+
+	return 0;
+}
+
+ssize_t upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen)
+{
+	return upscli_sendline_timeout(ups, buf, buflen, 0);
+}
+
+/* WATCH subscriptions of a connection (see upscli_watch()): the
+ * notifications read while waiting for replies, kept aside since
+ * UPSCONN_t is part of the library ABI */
+typedef struct upscli_watch_s {
+	const UPSCONN_t	*ups;
+	size_t	active;	/* subscriptions accepted by the server */
+	char	**lines;	/* a ring of notifications not handled yet */
+	size_t	first, count, size;
+	char	line[UPSCLI_NETBUF_LEN];	/* the one handed out last */
+	struct upscli_watch_s	*next;
+} upscli_watch_t;
+
+static upscli_watch_t	*upscli_watches[UPSCLI_CONN_BUCKETS];
+
+#if (defined HAVE_PTHREAD) && (!defined WIN32)
+static pthread_mutex_t	upscli_watches_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define upscli_watches_lock()		pthread_mutex_lock(&upscli_watches_mutex)
+# define upscli_watches_unlock()	pthread_mutex_unlock(&upscli_watches_mutex)
+#else
+# define upscli_watches_lock()
+# define upscli_watches_unlock()
+#endif
+
+static upscli_watch_t *upscli_watch_find(const UPSCONN_t *ups)
+{
+	upscli_watch_t	*w;
+
+	upscli_watches_lock();
+
+	for (w = upscli_watches[UPSCLI_CONN_HASH(ups)]; w; w = w->next) {
+		if (w->ups == ups) {
+			break;
+		}
+	}
+
+	upscli_watches_unlock();
+
+	return w;
+}
+
+static void upscli_watch_drop(const UPSCONN_t *ups)
+{
+	upscli_watch_t	**wp, *w;
+	size_t	i;
+
+	upscli_watches_lock();
+
+	for (wp = &upscli_watches[UPSCLI_CONN_HASH(ups)]; *wp; wp = &(*wp)->next) {
+		if ((*wp)->ups == ups) {
+			break;
+		}
+	}
+
+	w = *wp;
+	if (w) {
+		*wp = w->next;
+	}
+
+	upscli_watches_unlock();
+
+	if (!w) {
+		return;
+	}
+
+	for (i = 0; i < w->count; i++) {
+		free(w->lines[(w->first + i) % w->size]);
+	}
+
+	free(w->lines);
+	free(w);
+}
+
+/* keep a notification line read on a watching connection: returns 1
+ * if kept, 0 if the connection does not watch anything */
+static int upscli_watch_keep(const UPSCONN_t *ups, const char *line)
+{
+	upscli_watch_t	*w = upscli_watch_find(ups);
+	char	**lines;
+	size_t	i;
+
+	if (!w) {
+		return 0;
+	}
+
+	if (w->count == w->size) {
+		/* unroll the ring into a bigger one */
+		lines = xcalloc(w->size ? 2 * w->size : 8, sizeof(*lines));
+		for (i = 0; i < w->count; i++) {
+			lines[i] = w->lines[(w->first + i) % w->size];
+		}
+
+		free(w->lines);
+		w->lines = lines;
+		w->size = w->size ? 2 * w->size : 8;
+		w->first = 0;
+	}
+
+	w->lines[(w->first + w->count) % w->size] = xstrdup(line);
+	w->count++;
+
+	return 1;
+}
+
+/* read one line, whatever it is */
+static ssize_t upscli_readline_raw(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
+{
+	upscli_rxbuf_t	*rx;
+	size_t	recv, n;
+	char	*eol;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	if ((!buf) || (buflen < 1)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	rx = upscli_rxbuf_get(ups);
+
+	/* copy what the buffer has up to the end of the line at once */
+	for (recv = 0; recv < (buflen-1); recv += n) {
+
+		if (upscli_rxbuf_fill(ups, rx, timeout) < 0) {
+			return -1;
+		}
+
+		n = rx->len - rx->idx;
+		if (n > buflen - 1 - recv) {
+			n = buflen - 1 - recv;
+		}
+
+		eol = memchr(rx->data + rx->idx, '\n', n);
+		if (eol) {
+			n = (size_t)(eol - (rx->data + rx->idx));
+		}
+
+		memcpy(buf + recv, rx->data + rx->idx, n);
+		rx->idx += n;
+
+		if (eol) {
+			/* the newline is consumed, not returned */
+			rx->idx++;
+			recv += n;
+			break;
+		}
+	}
+
+	buf[recv] = '\0';
+	return 0;
+}
+
+ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
+{
+	ssize_t	ret;
+
+	/* notifications for WATCH subscriptions may come in between
+	 * the lines of any reply: keep them aside for upscli_notify_next() */
+	while ((ret = upscli_readline_raw(ups, buf, buflen, timeout)) == 0) {
+		if (strncmp(buf, "NOTIFY ", 7) != 0 || upscli_watch_keep(ups, buf) == 0) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+ssize_t upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen)
+{
+	return upscli_readline_timeout(ups, buf, buflen, DEFAULT_NETWORK_TIMEOUT);
+}
+
+int upscli_watch(UPSCONN_t *ups, const char *upsname, const char *prefix)
+{
+	char	buf[UPSCLI_NETBUF_LEN];
+	const char	*query[2];
+	upscli_watch_t	*w;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (!upsname) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	query[0] = upsname;
+	query[1] = prefix;
+	build_cmd(buf, sizeof(buf), "WATCH", prefix ? 2 : 1, query);
+
+	/* notifications may come before the reply, if there were
+	 * subscriptions already, so set things up for them first */
+	w = upscli_watch_find(ups);
+	if (!w) {
+		w = xcalloc(1, sizeof(*w));
+		w->ups = ups;
+
+		upscli_watches_lock();
+		w->next = upscli_watches[UPSCLI_CONN_HASH(ups)];
+		upscli_watches[UPSCLI_CONN_HASH(ups)] = w;
+		upscli_watches_unlock();
+	}
+
+	if (upscli_sendline(ups, buf, strlen(buf)) != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, buf, sizeof(buf)) != 0) {
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, buf) != 0 || strncmp(buf, "OK", 2) != 0) {
+		if (strncmp(buf, "ERR", 3) != 0) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+		}
+
+		/* e.g. an older server which does not know the command */
+		if (w->active == 0) {
+			upscli_watch_drop(ups);
+		}
+
+		return -1;
+	}
+
+	w->active++;
+
+	return 0;
+}
+
+int upscli_notify_next(UPSCONN_t *ups, size_t *numa, char ***answer)
+{
+	upscli_watch_t	*w;
+	upscli_rxbuf_t	*rx;
+	int	ready;
+
+	if (!ups) {
+		return -1;
+	}
+
+	w = upscli_watch_find(ups);
+
+	if (!w || !numa || !answer) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	if (w->count > 0) {
+		char	*line = w->lines[w->first];
+
+		snprintf(w->line, sizeof(w->line), "%s", line);
+		free(line);
+
+		w->first = (w->first + 1) % w->size;
+		w->count--;
+	} else {
+		/* only read what is there already: a line, or its beginning */
+		rx = upscli_rxbuf_get(ups);
+		ready = (rx->idx < rx->len);
+
+#ifdef WITH_OPENSSL
+		if (!ready && ups->ssl) {
+			ready = (SSL_pending(ups->ssl) > 0);
+		}
+#endif	/* WITH_OPENSSL */
+
+		if (!ready) {
+			ready = upscli_zip_pending(ups);
+		}
+
+		if (!ready) {
+			fd_set	fds;
+			struct timeval	tv;
+
+			FD_ZERO(&fds);
+			FD_SET(ups->fd, &fds);
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+
+			ready = (select(ups->fd + 1, &fds, NULL, NULL, &tv) > 0);
+		}
+
+		if (!ready) {
+			return 0;
+		}
+
+		if (upscli_readline_raw(ups, w->line, sizeof(w->line), DEFAULT_NETWORK_TIMEOUT) != 0) {
+			return -1;
+		}
+
+		/* nothing else may come without being asked for */
+		if (strncmp(w->line, "NOTIFY ", 7) != 0) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+	}
+
+	if (!pconf_line(&ups->pc_ctx, w->line)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	*numa = ups->pc_ctx.numargs;
+	*answer = ups->pc_ctx.arglist;
+
+	return 1;
+}
+
+/* --- connections driven by the caller's event loop --- */
+
+/* WIN32: see the non-blocking connect in upscli_tryconnect() */
+#ifndef WIN32
+# define UPSCLI_CONNECTING(e)	((e) == EINPROGRESS || SOLARIS_i386_NBCONNECT_ENOENT(e) || AIX_NBCONNECT_0(e))
+#else
+# define UPSCLI_CONNECTING(e)	((e) == WSAEWOULDBLOCK)
+#endif
+
+/* a request sent by upscli_queue(), waiting for its answer */
+typedef struct upscli_request_s {
+	int	list;	/* LIST: 1 until its BEGIN line came, then 2 */
+	int	get;	/* GET: the answer must be for the query */
+	size_t	numq;
+	char	**query;
+	upscli_reply_cb_t	cb;
+	void	*arg;
+	struct upscli_request_s	*next;
+} upscli_request_t;
+
+#define UPSCLI_ASYNC_CONNECTING	0	/* connect() in progress */
+#define UPSCLI_ASYNC_STARTTLS	1	/* STARTTLS sent, or being sent */
+#define UPSCLI_ASYNC_HANDSHAKE	2	/* TLS handshake in progress */
+#define UPSCLI_ASYNC_READY	3
+
+/* state of a connection opened by upscli_connect_start(), kept aside
+ * like the receive buffer and the binary framing state above */
+typedef struct upscli_async_s {
+	const UPSCONN_t	*ups;
+	int	state;
+	int	want;	/* UPSCLI_WANT_* to wait for before going on */
+	int	certverify, tryssl, forcessl;
+	struct addrinfo	*res, *ai;	/* addresses, the next one to try */
+	size_t	hellolen;	/* bytes of STARTTLS written */
+	char	*out;	/* queued requests not written yet */
+	size_t	outlen, outsize;
+	upscli_request_t	*head, *tail;	/* waiting for their answers */
+	size_t	pending;
+	struct upscli_async_s	*next;
+} upscli_async_t;
+
+static upscli_async_t	*upscli_asyncs[UPSCLI_CONN_BUCKETS];
+
+#if (defined HAVE_PTHREAD) && (!defined WIN32)
+static pthread_mutex_t	upscli_asyncs_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define upscli_asyncs_lock()	pthread_mutex_lock(&upscli_asyncs_mutex)
+# define upscli_asyncs_unlock()	pthread_mutex_unlock(&upscli_asyncs_mutex)
+#else
+# define upscli_asyncs_lock()
+# define upscli_asyncs_unlock()
+#endif
+
+static upscli_async_t *upscli_async_find(const UPSCONN_t *ups)
+{
+	upscli_async_t	*as;
+
+	if (!ups || ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		return NULL;
+	}
+
+	upscli_asyncs_lock();
+
+	for (as = upscli_asyncs[UPSCLI_CONN_HASH(ups)]; as; as = as->next) {
+		if (as->ups == ups) {
+			break;
+		}
+	}
+
+	upscli_asyncs_unlock();
+
+	return as;
+}
+
+static void upscli_request_free(upscli_request_t *req)
+{
+	size_t	i;
+
+	for (i = 0; i < req->numq; i++) {
+		free(req->query[i]);
+	}
+
+	free(req->query);
+	free(req);
+}
+
+/* pending callbacks are not called when the connection is dropped */
+static void upscli_async_drop(const UPSCONN_t *ups)
+{
+	upscli_async_t	**asp, *as;
+	upscli_request_t	*req;
+
+	upscli_asyncs_lock();
+
+	for (asp = &upscli_asyncs[UPSCLI_CONN_HASH(ups)]; *asp; asp = &(*asp)->next) {
+		if ((*asp)->ups == ups) {
+			break;
+		}
+	}
+
+	as = *asp;
+	if (as) {
+		*asp = as->next;
+	}
+
+	upscli_asyncs_unlock();
+
+	if (!as) {
+		return;
+	}
+
+	while ((req = as->head) != NULL) {
+		as->head = req->next;
+		upscli_request_free(req);
+	}
+
+	if (as->res) {
+		freeaddrinfo(as->res);
+	}
+
+	free(as->out);
+	free(as);
+}
+
+/* the connection is lost: drop it, then tell the requests waiting */
+static void upscli_async_fail(UPSCONN_t *ups, upscli_async_t *as)
+{
+	upscli_request_t	*req, *next;
+	int	upserror = ups->upserror;
+
+	req = as->head;
+	as->head = as->tail = NULL;
+
+	upscli_disconnect(ups);
+	ups->upserror = upserror;
+
+	for (; req; req = next) {
+		next = req->next;
+		req->cb(ups, req->arg, upserror, 0, NULL);
+		upscli_request_free(req);
+	}
+}
+
+static int upscli_wouldblock(int e)
+{
+#ifndef WIN32
+# if (defined EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+	if (e == EWOULDBLOCK) {
+		return 1;
+	}
+# endif
+	return (e == EAGAIN || e == EINTR);
+#else
+	return (e == WSAEWOULDBLOCK || e == EINTR);
+#endif
+}
+
+/* read what the connection has without waiting: the byte count, 0 if
+ * it has nothing yet (*want tells what to wait for), -1 on errors */
+static ssize_t upscli_nb_read(UPSCONN_t *ups, char *buf, size_t buflen, int *want)
+{
+	ssize_t	ret;
+
+#ifdef WITH_SSL
+	if (ups->ssl) {
+#ifdef WITH_OPENSSL
+		int	iret;
+
+		if (buflen > INT_MAX) {
+			buflen = INT_MAX;
+		}
+
+		iret = SSL_read(ups->ssl, buf, (int)buflen);
+		if (iret > 0) {
+			return (ssize_t)iret;
+		}
+
+		switch (SSL_get_error(ups->ssl, iret))
+		{
+		case SSL_ERROR_WANT_READ:
+			*want |= UPSCLI_WANT_READ;
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			*want |= UPSCLI_WANT_WRITE;
+			return 0;
+		case SSL_ERROR_ZERO_RETURN:
+			ups->upserror = UPSCLI_ERR_SRVDISC;
+			return -1;
+		default:
+			ups->upserror = UPSCLI_ERR_SSLERR;
+			return -1;
+		}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+		if (buflen > PR_INT32_MAX) {
+			buflen = PR_INT32_MAX;
+		}
+
+		ret = PR_Read(ups->ssl, buf, (PRInt32)buflen);
+		if (ret > 0) {
+			return ret;
+		}
+
+		if (ret < 0 && PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+			*want |= UPSCLI_WANT_READ;
+			return 0;
+		}
+
+		ups->upserror = (ret == 0) ? UPSCLI_ERR_SRVDISC : UPSCLI_ERR_SSLERR;
+		return -1;
+#endif	/* WITH_OPENSSL | WITH_NSS*/
+	}
+#endif
+
+	ret = read(ups->fd, buf, buflen);
+	if (ret > 0) {
+		return ret;
+	}
+
+	if (ret == 0) {
+		ups->upserror = UPSCLI_ERR_SRVDISC;
+		return -1;
+	}
+
+	if (upscli_wouldblock(errno)) {
+		*want |= UPSCLI_WANT_READ;
+		return 0;
+	}
+
+	ups->upserror = UPSCLI_ERR_READ;
+	ups->syserrno = errno;
+	return -1;
+}
+
+/* write what the connection takes without waiting: the byte count, 0
+ * if it takes nothing yet (*want tells what to wait for), -1 on errors */
+static ssize_t upscli_nb_write(UPSCONN_t *ups, const char *buf, size_t buflen, int *want)
+{
+	ssize_t	ret;
+
+#ifdef WITH_SSL
+	if (ups->ssl) {
+#ifdef WITH_OPENSSL
+		int	iret;
+
+		if (buflen > INT_MAX) {
+			buflen = INT_MAX;
+		}
+
+		iret = SSL_write(ups->ssl, buf, (int)buflen);
+		if (iret > 0) {
+			return (ssize_t)iret;
+		}
+
+		switch (SSL_get_error(ups->ssl, iret))
+		{
+		case SSL_ERROR_WANT_READ:
+			*want |= UPSCLI_WANT_READ;
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			*want |= UPSCLI_WANT_WRITE;
+			return 0;
+		default:
+			ups->upserror = UPSCLI_ERR_SSLERR;
+			return -1;
+		}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+		if (buflen > PR_INT32_MAX) {
+			buflen = PR_INT32_MAX;
+		}
+
+		ret = PR_Write(ups->ssl, buf, (PRInt32)buflen);
+		if (ret > 0) {
+			return ret;
+		}
+
+		if (ret < 0 && PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+			*want |= UPSCLI_WANT_WRITE;
+			return 0;
+		}
+
+		ups->upserror = UPSCLI_ERR_SSLERR;
+		return -1;
+#endif	/* WITH_OPENSSL | WITH_NSS*/
+	}
+#endif
+
+	ret = write(ups->fd, buf, buflen);
+	if (ret > 0) {
+		return ret;
+	}
+
+	if (ret < 0 && upscli_wouldblock(errno)) {
+		*want |= UPSCLI_WANT_WRITE;
+		return 0;
+	}
+
+	ups->upserror = UPSCLI_ERR_WRITE;
+	ups->syserrno = errno;
+	return -1;
+}
+
+/* the next complete line in the receive buffer, reading what the
+ * connection has without waiting: 1 if there is one (in *line, valid
+ * until the next call, without its newline), 0 if not yet, -1 on errors */
+static int upscli_async_readline(UPSCONN_t *ups, upscli_async_t *as, char **line)
+{
+	upscli_rxbuf_t	*rx;
+	char	*eol;
+	ssize_t	ret;
+
+	rx = upscli_rxbuf_get(ups);
+
+	for (;;) {
+		eol = memchr(rx->data + rx->idx, '\n', rx->len - rx->idx);
+
+		if (eol) {
+			*eol = '\0';
+			*line = rx->data + rx->idx;
+			rx->idx = (size_t)(eol - rx->data) + 1;
+			return 1;
+		}
+
+		/* keep the start of the line, and make room for the rest */
+		if (rx->idx > 0) {
+			memmove(rx->data, rx->data + rx->idx, rx->len - rx->idx);
+			rx->len -= rx->idx;
+			rx->idx = 0;
+		}
+
+		if (rx->len >= sizeof(rx->data)) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		ret = upscli_nb_read(ups, rx->data + rx->len,
+			sizeof(rx->data) - rx->len, &as->want);
+
+		if (ret < 1) {
+			return (int)ret;
+		}
+
+		rx->len += (size_t)ret;
+	}
+}
+
+/* write as much of the queued requests as the connection takes */
+static int upscli_async_flush(UPSCONN_t *ups, upscli_async_t *as)
+{
+	ssize_t	ret;
+
+	while (as->outlen > 0) {
+		ret = upscli_nb_write(ups, as->out, as->outlen, &as->want);
+
+		if (ret < 1) {
+			return (int)ret;
+		}
+
+		as->outlen -= (size_t)ret;
+		memmove(as->out, as->out + ret, as->outlen);
+	}
+
+	return 0;
+}
+
+/* start connecting to the next address: 0 if connected already,
+ * 1 if in progress, -1 if there is none left */
+static int upscli_async_try(UPSCONN_t *ups, upscli_async_t *as)
+{
+	struct addrinfo	*ai;
+	int	sock_fd, v;
+#ifndef WIN32
+	long	fd_flags;
+#else
+	unsigned long	argp;
+#endif
+
+	while ((ai = as->ai) != NULL) {
+		as->ai = ai->ai_next;
+
+		sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (sock_fd < 0) {
+			switch (errno)
+			{
+			case EAFNOSUPPORT:
+			case EINVAL:
+				break;
+			default:
+				ups->upserror = UPSCLI_ERR_SOCKFAILURE;
+				ups->syserrno = errno;
+			}
+			continue;
+		}
+
+		/* the socket remains non-blocking for good */
+#ifndef WIN32
+		fd_flags = fcntl(sock_fd, F_GETFL);
+		fd_flags |= O_NONBLOCK;
+		fcntl(sock_fd, F_SETFL, fd_flags);
+#else
+		argp = 1;
+		ioctlsocket(sock_fd, FIONBIO, &argp);
+#endif
+
+		while ((v = connect(sock_fd, ai->ai_addr, ai->ai_addrlen)) < 0) {
+			if (errno != EINTR) {
+				break;
+			}
+		}
+
+		if (v == 0) {
+			ups->fd = sock_fd;
+			return 0;
+		}
+
+		if (UPSCLI_CONNECTING(errno)) {
+			ups->fd = sock_fd;
+			as->want |= UPSCLI_WANT_WRITE;
+			return 1;
+		}
+
+		if (errno != EAFNOSUPPORT) {
+			ups->upserror = UPSCLI_ERR_CONNFAILURE;
+			ups->syserrno = errno;
+		}
+
+		close(sock_fd);
+	}
+
+	return -1;
+}
+
+/* the connection is up: 0 once set for STARTTLS or requests, -1 if
+ * it can not be used as asked */
+static int upscli_async_connected(UPSCONN_t *ups, upscli_async_t *as)
+{
+	freeaddrinfo(as->res);
+	as->res = as->ai = NULL;
+
+	ups->upserror = 0;
+	ups->syserrno = 0;
+
+	if (as->tryssl || as->forcessl) {
+#ifdef WITH_SSL
+		upscli_sslcheckinit();
+		as->state = UPSCLI_ASYNC_STARTTLS;
+		return 0;
+#else
+		/* not supported */
+		if (upscli_sslcheck(ups, 0, as->certverify, as->tryssl, as->forcessl) < 0) {
+			return -1;
+		}
+#endif /* WITH_SSL */
+	}
+
+	as->state = UPSCLI_ASYNC_READY;
+	return 0;
+}
+
+/* the steps below return 0 once done with theirs, 1 if they have to
+ * wait for as->want, -1 if the connection failed */
+
+static int upscli_async_connecting(UPSCONN_t *ups, upscli_async_t *as)
+{
+	fd_set	wfds;
+	struct timeval	tv;
+	int	error = 0;
+	socklen_t	error_size = sizeof(error);
+
+	/* only check how it went once the socket is writable */
+	FD_ZERO(&wfds);
+	FD_SET(ups->fd, &wfds);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	if (select(ups->fd + 1, NULL, &wfds, NULL, &tv) < 1) {
+		as->want |= UPSCLI_WANT_WRITE;
+		return 1;
+	}
+
+	getsockopt(ups->fd, SOL_SOCKET, SO_ERROR, SOCK_OPT_CAST &error, &error_size);
+
+	if (error == 0) {
+		return upscli_async_connected(ups, as);
+	}
+
+	ups->upserror = UPSCLI_ERR_CONNFAILURE;
+	ups->syserrno = error;
+	close(ups->fd);
+	ups->fd = -1;
+
+	switch (upscli_async_try(ups, as))
+	{
+	case 0:
+		return upscli_async_connected(ups, as);
+	case 1:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+#ifdef WITH_SSL
+
+static int upscli_async_starttls(UPSCONN_t *ups, upscli_async_t *as)
+{
+	static const char	hello[] = "STARTTLS\n";
+	char	*line;
+	ssize_t	ret;
+	int	ssl;
+
+	while (as->hellolen < sizeof(hello) - 1) {
+		ret = upscli_nb_write(ups, hello + as->hellolen,
+			sizeof(hello) - 1 - as->hellolen, &as->want);
+
+		if (ret < 1) {
+			return (ret < 0) ? -1 : 1;
+		}
+
+		as->hellolen += (size_t)ret;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
+	switch (upscli_async_readline(ups, as, &line))
+	{
+	case 1:
+		break;
+	case 0:
+		return 1;
+	default:
 		return -1;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
-		ups->upserror = UPSCLI_ERR_PARSE;
+	if (strncmp(line, "OK STARTTLS", 11) != 0) {
+		ssl = 0;	/* not supported */
+	} else {
+		ssl = upscli_sslstart(ups, as->certverify, 1);
+		if (ssl == 1) {
+			as->state = UPSCLI_ASYNC_HANDSHAKE;
+			return 0;
+		}
+	}
+
+	if (upscli_sslcheck(ups, ssl, as->certverify, as->tryssl, as->forcessl) < 0) {
 		return -1;
 	}
 
-	/* q: [GET] VAR <ups> <var>   *
-	 * a: VAR <ups> <var> <val> */
+	as->state = UPSCLI_ASYNC_READY;
+	return 0;
+}
 
-	if (ups->pc_ctx.numargs < numq) {
-		ups->upserror = UPSCLI_ERR_PROTOCOL;
-		return -1;
+static int upscli_async_handshake(UPSCONN_t *ups, upscli_async_t *as)
+{
+	int	ssl;
+
+	ssl = upscli_sslhandshake(ups, &as->want);
+
+	if (ssl == 0) {
+		return 1;
 	}
 
-	if (!verify_resp(numq, query, ups->pc_ctx.arglist)) {
-		ups->upserror = UPSCLI_ERR_PROTOCOL;
+	if (upscli_sslcheck(ups, ssl, as->certverify, as->tryssl, as->forcessl) < 0) {
 		return -1;
 	}
 
-	*numa = ups->pc_ctx.numargs;
-	*answer = ups->pc_ctx.arglist;
-
+	as->state = UPSCLI_ASYNC_READY;
 	return 0;
 }
 
-int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
+#endif /* WITH_SSL */
+
+int upscli_connect_start(UPSCONN_t *ups, const char *host, uint16_t port, int flags)
 {
-	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
+	upscli_async_t	*as;
+	struct addrinfo	*res;
+	int	ret;
+
+#ifdef WIN32
+	WSADATA WSAdata;
+	WSAStartup(2,&WSAdata);
+#endif
 
 	if (!ups) {
 		return -1;
 	}
 
-	if (numq < 1) {
-		ups->upserror = UPSCLI_ERR_INVALIDARG;
+	/* clear out any lingering junk */
+	upscli_binary_drop(ups);
+	upscli_rxbuf_drop(ups);
+	upscli_zip_drop(ups);
+	upscli_async_drop(ups);
+	upscli_watch_drop(ups);
+	memset(ups, 0, sizeof(*ups));
+	ups->upsclient_magic = UPSCLIENT_MAGIC;
+	ups->fd = -1;
+
+	if (!host) {
+		upslogx(LOG_WARNING, "%s: Host not specified", __func__);
+		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
 		return -1;
 	}
 
-	/* create the string to send to upsd */
-	build_cmd(cmd, sizeof(cmd), "LIST", numq, query);
-
-	if (upscli_sendline(ups, cmd, strlen(cmd)) != 0) {
+	/* this one does block, unless host is a numeric address */
+	if (upscli_resolve(ups, host, port, flags, &res) < 0) {
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	pconf_init(&ups->pc_ctx, NULL);
+	ups->host = xstrdup(host);
+	ups->port = port;
+
+	as = xcalloc(1, sizeof(*as));
+	as->ups = ups;
+	as->state = UPSCLI_ASYNC_CONNECTING;
+	as->res = as->ai = res;
+	upscli_sslopts(host, flags, &as->certverify, &as->tryssl, &as->forcessl);
+
+	upscli_asyncs_lock();
+	as->next = upscli_asyncs[UPSCLI_CONN_HASH(ups)];
+	upscli_asyncs[UPSCLI_CONN_HASH(ups)] = as;
+	upscli_asyncs_unlock();
+
+	ret = upscli_async_try(ups, as);
+
+	if (ret == 0) {
+		ret = upscli_async_connected(ups, as);
+	}
+
+	if (ret < 0) {
+		upscli_async_fail(ups, as);
 		return -1;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
+	return upscli_connect_continue(ups);
+}
+
+int upscli_connect_continue(UPSCONN_t *ups)
+{
+	upscli_async_t	*as;
+	int	ret;
+
+	as = upscli_async_find(ups);
+
+	if (!as) {
+		if (ups) {
+			ups->upserror = UPSCLI_ERR_INVALIDARG;
+		}
 		return -1;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
-		ups->upserror = UPSCLI_ERR_PARSE;
+	as->want = 0;
+
+	for (;;) {
+		switch (as->state)
+		{
+		case UPSCLI_ASYNC_CONNECTING:
+			ret = upscli_async_connecting(ups, as);
+			break;
+#ifdef WITH_SSL
+		case UPSCLI_ASYNC_STARTTLS:
+			ret = upscli_async_starttls(ups, as);
+			break;
+		case UPSCLI_ASYNC_HANDSHAKE:
+			ret = upscli_async_handshake(ups, as);
+			break;
+#endif /* WITH_SSL */
+		default:
+			/* requests queued meanwhile can go now */
+			as->want |= UPSCLI_WANT_READ;
+			if (as->outlen > 0) {
+				as->want |= UPSCLI_WANT_WRITE;
+			}
+			return 0;
+		}
+
+		if (ret < 0) {
+			upscli_async_fail(ups, as);
+			return -1;
+		}
+
+		if (ret > 0) {
+			return 1;
+		}
+	}
+}
+
+int upscli_want(UPSCONN_t *ups)
+{
+	upscli_async_t	*as;
+
+	as = upscli_async_find(ups);
+
+	if (!as) {
+		return 0;
+	}
+
+	return as->want;
+}
+
+int upscli_queue(UPSCONN_t *ups, const char *cmdname, size_t numq,
+		const char **query, upscli_reply_cb_t cb, void *arg)
+{
+	upscli_async_t	*as;
+	upscli_request_t	*req;
+	char	cmd[UPSCLI_NETBUF_LEN];
+	size_t	i, len;
+
+	if (!ups) {
 		return -1;
 	}
 
-	if (ups->pc_ctx.numargs < 2) {
-		ups->upserror = UPSCLI_ERR_PROTOCOL;
+	as = upscli_async_find(ups);
+
+	if (!as || !cmdname || !cb) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-	/* the response must start with BEGIN LIST */
-	if ((strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0) ||
-		(strcasecmp(ups->pc_ctx.arglist[1], "LIST") != 0)) {
-		ups->upserror = UPSCLI_ERR_PROTOCOL;
+	req = xcalloc(1, sizeof(*req));
+	req->list = (strcasecmp(cmdname, "LIST") == 0);
+	req->get = (strcasecmp(cmdname, "GET") == 0);
+
+	if ((req->list || req->get) && (numq < 1)) {
+		free(req);
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-	/* q: [LIST] VAR <ups>       *
-	 * a: [BEGIN LIST] VAR <ups> */
+	req->numq = numq;
+	req->query = xcalloc(numq + 1, sizeof(*req->query));
+	for (i = 0; i < numq; i++) {
+		req->query[i] = xstrdup(query[i]);
+	}
 
-	/* compare q[0]... to a[2]... */
+	req->cb = cb;
+	req->arg = arg;
 
-	if (!verify_resp(numq, query, &ups->pc_ctx.arglist[2])) {
-		ups->upserror = UPSCLI_ERR_PROTOCOL;
-		return -1;
+	/* create the string to send to upsd */
+	build_cmd(cmd, sizeof(cmd), cmdname, numq, query);
+	len = strlen(cmd);
+
+	if (as->outlen + len > as->outsize) {
+		as->outsize = as->outlen + len + UPSCLI_NETBUF_LEN;
+		as->out = xrealloc(as->out, as->outsize);
+	}
+
+	memcpy(as->out + as->outlen, cmd, len);
+	as->outlen += len;
+
+	if (as->tail) {
+		as->tail->next = req;
+	} else {
+		as->head = req;
+	}
+	as->tail = req;
+	as->pending++;
+
+	if (as->state == UPSCLI_ASYNC_READY) {
+		as->want |= UPSCLI_WANT_WRITE;
 	}
 
 	return 0;
 }
 
-int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
-		size_t *numa, char ***answer)
+/* the request at the head of the queue is answered */
+static upscli_request_t *upscli_async_done(upscli_async_t *as)
 {
-	char	tmp[UPSCLI_NETBUF_LEN];
+	upscli_request_t	*req = as->head;
 
-	if (!ups) {
-		return -1;
+	as->head = req->next;
+	if (!as->head) {
+		as->tail = NULL;
 	}
+	as->pending--;
+
+	return req;
+}
+
+/* hand an answer line to the request at the head of the queue: 0 if
+ * done, -1 if the line makes no sense there */
+static int upscli_async_answer(UPSCONN_t *ups, upscli_async_t *as, char *line)
+{
+	upscli_request_t	*req = as->head;
+	const char	**query;
+	size_t	numa;
+	char	**answer;
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	/* nothing was asked */
+	if (!req) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
 		return -1;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
-		return -1;
+	query = (const char **)req->query;
+
+	if (upscli_errcheck(ups, line) != 0) {
+		req = upscli_async_done(as);
+		req->cb(ups, req->arg, ups->upserror, 0, NULL);
+		upscli_request_free(req);
+		return 0;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
+	if (!pconf_line(&ups->pc_ctx, line)) {
 		ups->upserror = UPSCLI_ERR_PARSE;
 		return -1;
 	}
 
-	if (ups->pc_ctx.numargs < 1) {
-		ups->upserror = UPSCLI_ERR_PROTOCOL;
-		return -1;
-	}
+	numa = ups->pc_ctx.numargs;
+	answer = ups->pc_ctx.arglist;
 
-	*numa = ups->pc_ctx.numargs;
-	*answer = ups->pc_ctx.arglist;
+	switch (req->list)
+	{
+	case 1:
+		/* q: [LIST] VAR <ups>       *
+		 * a: [BEGIN LIST] VAR <ups> */
+		if ((numa < req->numq + 2)
+		 || (strcasecmp(answer[0], "BEGIN") != 0)
+		 || (strcasecmp(answer[1], "LIST") != 0)
+		 || !verify_resp(req->numq, query, &answer[2])) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
 
-	/* see if this is the end */
-	if (ups->pc_ctx.numargs >= 2) {
-		if ((!strcmp(ups->pc_ctx.arglist[0], "END")) &&
-			(!strcmp(ups->pc_ctx.arglist[1], "LIST")))
+		req->list = 2;
+		return 0;
+
+	case 2:
+		if ((numa >= 2) && (!strcmp(answer[0], "END"))
+		 && (!strcmp(answer[1], "LIST"))) {
+			req = upscli_async_done(as);
+			req->cb(ups, req->arg, UPSCLI_ERR_NONE, 0, NULL);
+			upscli_request_free(req);
 			return 0;
-	}
+		}
 
-	/* q: VAR <ups> */
-	/* a: VAR <ups> <val> */
+		if ((numa < 1) || !verify_list_resp(req->numq, query, numa, answer)) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
 
-	if (!verify_resp(numq, query, ups->pc_ctx.arglist)) {
+		/* just another part of the list */
+		req->cb(ups, req->arg, UPSCLI_ERR_NONE, numa, answer);
+		return 0;
+
+	default:
+		break;
+	}
+
+	/* q: [GET] VAR <ups> <var>   *
+	 * a: VAR <ups> <var> <val> */
+	if (req->get && ((numa < req->numq) || !verify_resp(req->numq, query, answer))) {
 		ups->upserror = UPSCLI_ERR_PROTOCOL;
 		return -1;
 	}
 
-	/* just another part of the list */
-	return 1;
+	req = upscli_async_done(as);
+	req->cb(ups, req->arg, UPSCLI_ERR_NONE, numa, answer);
+	upscli_request_free(req);
+
+	return 0;
 }
 
-ssize_t upscli_sendline_timeout(UPSCONN_t *ups, const char *buf, size_t buflen, const time_t timeout)
+int upscli_process(UPSCONN_t *ups)
 {
-	ssize_t	ret;
+	upscli_async_t	*as;
+	char	*line;
+	int	ret;
 
-	if (!ups) {
-		return -1;
-	}
+	as = upscli_async_find(ups);
 
-	if (ups->fd < 0) {
-		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+	if (!as) {
+		if (ups) {
+			ups->upserror = UPSCLI_ERR_INVALIDARG;
+		}
 		return -1;
 	}
 
-	if ((!buf) || (buflen < 1)) {
-		ups->upserror = UPSCLI_ERR_INVALIDARG;
-		return -1;
+	if (as->state != UPSCLI_ASYNC_READY) {
+		ret = upscli_connect_continue(ups);
+
+		if (ret != 0) {
+			return (ret < 0) ? -1 : (int)as->pending;
+		}
 	}
 
-	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
-		ups->upserror = UPSCLI_ERR_INVALIDARG;
+	as->want = 0;
+
+	if (upscli_async_flush(ups, as) < 0) {
+		upscli_async_fail(ups, as);
 		return -1;
 	}
 
-	ret = net_write(ups, buf, buflen, timeout);
+	while ((ret = upscli_async_readline(ups, as, &line)) > 0) {
+		if (upscli_async_answer(ups, as, line) < 0) {
+			ret = -1;
+			break;
+		}
+	}
 
-	if (ret < 1) {
-		upscli_disconnect(ups);
+	/* callbacks may have queued more requests */
+	if ((ret < 0) || (upscli_async_flush(ups, as) < 0)) {
+		upscli_async_fail(ups, as);
 		return -1;
 	}
 
-	return 0;
-}
+	as->want |= UPSCLI_WANT_READ;
+	if (as->outlen > 0) {
+		as->want |= UPSCLI_WANT_WRITE;
+	}
 
-ssize_t upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen)
-{
-	return upscli_sendline_timeout(ups, buf, buflen, 0);
+	return (int)as->pending;
 }
 
-ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
+/* COMPRESS DEFLATE: returns 1 once both directions of the connection are
+ * compressed, 0 if they are not (e.g. an older server, or a build
+ * without zlib on either side), or -1 on errors.  Not for connections
+ * of upscli_connect_start(), which are read and written elsewhere */
+int upscli_compress(UPSCONN_t *ups)
 {
-	ssize_t	ret;
-	size_t	recv;
+#ifdef WITH_ZLIB
+	char	buf[UPSCLI_NETBUF_LEN];
+	upscli_rxbuf_t	*rx;
+	upscli_zip_t	*zip;
 
 	if (!ups) {
 		return -1;
 	}
 
-	if (ups->fd < 0) {
-		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC || upscli_async_find(ups)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-	if ((!buf) || (buflen < 1)) {
-		ups->upserror = UPSCLI_ERR_INVALIDARG;
-		return -1;
+	if (upscli_zip_find(ups)) {
+		return 1;
 	}
 
-	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
-		ups->upserror = UPSCLI_ERR_INVALIDARG;
+	zip = xcalloc(1, sizeof(*zip));
+	zip->ups = ups;
+
+	if (deflateInit2(&zip->out, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		-UPSCLI_ZIP_WINDOW_BITS, UPSCLI_ZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK
+	) {
+		free(zip);
+		ups->upserror = UPSCLI_ERR_NOMEM;
 		return -1;
 	}
 
-	for (recv = 0; recv < (buflen-1); recv++) {
+	if (inflateInit2(&zip->in, -MAX_WBITS) != Z_OK) {
+		deflateEnd(&zip->out);
+		free(zip);
+		ups->upserror = UPSCLI_ERR_NOMEM;
+		return -1;
+	}
 
-		if (ups->readidx == ups->readlen) {
+	snprintf(buf, sizeof(buf), "COMPRESS DEFLATE\n");
 
-			ret = net_read(ups, ups->readbuf, sizeof(ups->readbuf), timeout);
+	if (upscli_sendline(ups, buf, strlen(buf)) != 0
+	 || upscli_readline(ups, buf, sizeof(buf)) != 0
+	) {
+		deflateEnd(&zip->out);
+		inflateEnd(&zip->in);
+		free(zip);
+		return -1;
+	}
 
-			if (ret < 1) {
-				upscli_disconnect(ups);
-				return -1;
-			}
+	if (strncmp(buf, "OK", 2) != 0) {
+		/* still in the clear */
+		upscli_errcheck(ups, buf);
+		deflateEnd(&zip->out);
+		inflateEnd(&zip->in);
+		free(zip);
+		return 0;
+	}
 
-			/* Here ret is safe to cast since it is >=1 and certainly
-			 * fits under SIZE_MAX being it signed sibling
-			 */
-			ups->readlen = (size_t)ret;
-			ups->readidx = 0;
+	/* what came right behind the OK is compressed already */
+	rx = upscli_rxbuf_get(ups);
+	if (rx->idx < rx->len) {
+		if (rx->len - rx->idx > sizeof(zip->inbuf)) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			deflateEnd(&zip->out);
+			inflateEnd(&zip->in);
+			free(zip);
+			upscli_disconnect(ups);
+			return -1;
 		}
+		memcpy(zip->inbuf, rx->data + rx->idx, rx->len - rx->idx);
+		zip->in.next_in = zip->inbuf;
+		zip->in.avail_in = (uInt)(rx->len - rx->idx);
+		rx->idx = rx->len;
+	}
 
-		buf[recv] = ups->readbuf[ups->readidx++];
+	upscli_zips_lock();
+	zip->next = upscli_zips[UPSCLI_CONN_HASH(ups)];
+	upscli_zips[UPSCLI_CONN_HASH(ups)] = zip;
+	upscli_zips_unlock();
 
-		if (buf[recv] == '\n') {
-			break;
-		}
+	return 1;
+#else	/* !WITH_ZLIB */
+	if (!ups) {
+		return -1;
 	}
 
-	buf[recv] = '\0';
 	return 0;
-}
-
-ssize_t upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen)
-{
-	return upscli_readline_timeout(ups, buf, buflen, DEFAULT_NETWORK_TIMEOUT);
+#endif	/* WITH_ZLIB */
 }
 
 /* split upsname[@hostname[:port]] into separate components */
@@ -1761,15 +4141,21 @@ int upscli_disconnect(UPSCONN_t *ups)
 	}
 
 	pconf_finish(&ups->pc_ctx);
+	upscli_binary_drop(ups);
+	upscli_rxbuf_drop(ups);
+	upscli_async_drop(ups);
+	upscli_watch_drop(ups);
 
 	free(ups->host);
 	ups->host = NULL;
 
 	if (ups->fd < 0) {
+		upscli_zip_drop(ups);
 		return 0;
 	}
 
 	net_write(ups, "LOGOUT\n", 7, 0);
+	upscli_zip_drop(ups);
 
 #ifdef WITH_OPENSSL
 	if (ups->ssl) {
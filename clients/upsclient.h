@@ -89,6 +89,8 @@ typedef struct {
 	void *ssl;
 #endif /* WITH_OPENSSL | WITH_NSS */
 
+	/* no longer used (upsclient.c keeps a larger receive buffer
+	 * aside), only kept for the ABI */
 	char	readbuf[64];
 	size_t	readlen;
 	size_t	readidx;
@@ -110,17 +112,67 @@ void upscli_add_host_cert(const char* hostname, const char* certname, int certve
 int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer);
 
+/* upscli_get() in two halves, to have queries on several connections
+ * in flight at once: wait for upscli_fd() to get readable in between */
+int upscli_get_send(UPSCONN_t *ups, size_t numq, const char **query);
+int upscli_get_recv(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer);
+
 int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query);
 
 int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer);
 
+int upscli_list_since_token(UPSCONN_t *ups, char *buf, size_t buflen);
+
+/* one of the queries sent at once by upscli_get_many() or upscli_list_many() */
+typedef struct {
+	size_t	numq;
+	const char	**query;
+	int	upserror;	/* UPSCLI_ERR_NONE if answered, or why not */
+} upscli_query_t;
+
+/* called with each answer (or list line) to queries[idx] */
+typedef void (*upscli_answer_cb_t)(void *arg, size_t idx, size_t numa, char **answer);
+
+int upscli_get_many(UPSCONN_t *ups, upscli_query_t *queries, size_t count,
+		upscli_answer_cb_t cb, void *arg);
+int upscli_list_many(UPSCONN_t *ups, upscli_query_t *queries, size_t count,
+		upscli_answer_cb_t cb, void *arg);
+int upscli_cmd_many(UPSCONN_t *ups, const char *cmdname,
+		upscli_query_t *queries, size_t count,
+		upscli_answer_cb_t cb, void *arg);
+
+/* connections driven by the caller's event loop: see upscli_connect_start(3) */
+int upscli_connect_start(UPSCONN_t *ups, const char *host, uint16_t port, int flags);
+int upscli_connect_continue(UPSCONN_t *ups);
+
+/* returns the UPSCLI_WANT_* events to wait for on upscli_fd() */
+int upscli_want(UPSCONN_t *ups);
+
+/* called with the answer to a request (upserror is UPSCLI_ERR_NONE),
+ * with each line of a LIST and then with numa == 0 at its end, or
+ * with why there is no answer (the server or connection failed) */
+typedef void (*upscli_reply_cb_t)(UPSCONN_t *ups, void *arg, int upserror,
+		size_t numa, char **answer);
+
+int upscli_queue(UPSCONN_t *ups, const char *cmdname, size_t numq,
+		const char **query, upscli_reply_cb_t cb, void *arg);
+int upscli_process(UPSCONN_t *ups);
+
+int upscli_set_binary(UPSCONN_t *ups, int enable);
+int upscli_compress(UPSCONN_t *ups);
+
 ssize_t upscli_sendline_timeout(UPSCONN_t *ups, const char *buf, size_t buflen, const time_t timeout);
 ssize_t upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen);
 
 ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout);
 ssize_t upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen);
 
+/* subscribe to pushed variable changes, and fetch them without blocking */
+int upscli_watch(UPSCONN_t *ups, const char *upsname, const char *prefix);
+int upscli_notify_next(UPSCONN_t *ups, size_t *numa, char ***answer);
+
 int upscli_splitname(const char *buf, char **upsname, char **hostname,
 			uint16_t *port);
 
@@ -200,6 +252,11 @@ int upscli_ssl(UPSCONN_t *ups);
 #define UPSCLI_CONN_INET6		0x0008	/* IPv6 only */
 #define UPSCLI_CONN_CERTVERIF	0x0010	/* Verify certificates for SSL	*/
 
+/* events returned by upscli_want */
+
+#define UPSCLI_WANT_READ		0x0001	/* wait until upscli_fd() is readable */
+#define UPSCLI_WANT_WRITE		0x0002	/* wait until upscli_fd() is writable */
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
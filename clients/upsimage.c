@@ -52,7 +52,11 @@ static	char	*monhost = NULL, *cmd = NULL;
 
 static	uint16_t	port;
 static	char	*upsname, *hostname;
-static	UPSCONN_t	ups;
+
+/* the same drawing inputs always give the same image, so it is known by
+ * a hash of them: browsers get that as its ETag, and it names the copy of
+ * the PNG kept in the STATUSCACHE directory (if any) */
+static	char	imgtag[SMALLBUF] = "";
 
 #define RED(x)		((x >> 16) & 0xff)
 #define GREEN(x)	((x >> 8)  & 0xff)
@@ -114,19 +118,146 @@ static int get_imgarg(const char *name)
 	return -1;
 }
 
+/* remember what the image to draw depends on, beyond imgarg[] */
+static void set_imgtag(const char *key)
+{
+	uint64_t	h = 14695981039346656037ULL;	/* FNV-1a */
+	char	buf[LARGEBUF];
+	const	char	*p;
+	int	i;
+
+	snprintf(buf, sizeof(buf), "%s", key);
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		snprintfcat(buf, sizeof(buf), " %d", imgarg[i].val);
+
+	for (p = buf; *p; p++) {
+		h ^= (uint64_t)(unsigned char)*p;
+		h *= 1099511628211ULL;
+	}
+
+	snprintf(imgtag, sizeof(imgtag), "%016" PRIxMAX, (uintmax_t)h);
+}
+
+static void image_path(char *buf, size_t buflen)
+{
+	snprintf(buf, buflen, "%s/image-%s.png", cgi_cachedir(), imgtag);
+}
+
+static void image_headers(void)
+{
+	printf("Pragma: no-cache\n");
+	printf("ETag: \"%s\"\n", imgtag);
+	printf("Content-type: image/png\n\n");
+}
+
+/* answer from what the browser or the cache directory already have,
+ * if they have this image */
+static void send_cached_image(void)
+{
+	const	char	*inm = getenv("HTTP_IF_NONE_MATCH");
+	char	fn[LARGEBUF], tag[SMALLBUF], *data;
+	FILE	*f;
+	struct	stat	st;
+
+	snprintf(tag, sizeof(tag), "\"%s\"", imgtag);
+
+	if (inm && (strstr(inm, tag) || !strcmp(inm, "*"))) {
+		printf("Status: 304 Not Modified\n");
+		printf("ETag: %s\n\n", tag);
+		cgi_disconnect();
+		exit(EXIT_SUCCESS);
+	}
+
+	if (!cgi_cachedir())
+		return;
+
+	image_path(fn, sizeof(fn));
+
+	if ((f = fopen(fn, "rb")) == NULL)
+		return;
+
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= 0) {
+		fclose(f);
+		return;
+	}
+
+	data = xmalloc((size_t)st.st_size);
+
+	if (fread(data, 1, (size_t)st.st_size, f) != (size_t)st.st_size) {
+		free(data);
+		fclose(f);
+		return;
+	}
+
+	fclose(f);
+
+	image_headers();
+	fwrite(data, 1, (size_t)st.st_size, stdout);
+	free(data);
+
+	cgi_disconnect();
+	exit(EXIT_SUCCESS);
+}
+
+/* keep a copy of the PNG for the next requests of the same image */
+static void cache_image(const void *data, int size)
+{
+	char	fn[LARGEBUF], tmpfn[LARGEBUF];
+	FILE	*f;
+	int	ok;
+
+	image_path(fn, sizeof(fn));
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%ld", fn, (long)getpid());
+
+	if ((f = fopen(tmpfn, "wb")) == NULL)
+		return;
+
+	ok = (fwrite(data, 1, (size_t)size, f) == (size_t)size);
+	ok = (fclose(f) == 0) && ok;
+
+#ifdef WIN32
+	/* rename() does not replace files there */
+	if (ok)
+		unlink(fn);
+#endif
+
+	if (!ok || rename(tmpfn, fn) != 0)
+		unlink(tmpfn);
+}
+
 /* write the HTML header then have gd dump the image */
 static void drawimage(gdImagePtr im)
 	__attribute__((noreturn));
 
 static void drawimage(gdImagePtr im)
 {
-	printf("Pragma: no-cache\n");
-	printf("Content-type: image/png\n\n");
+	void	*data;
+	int	size = 0;
+
+	if (!imgtag[0]) {
+		printf("Pragma: no-cache\n");
+		printf("Content-type: image/png\n\n");
+
+		gdImagePng(im, stdout);
+	} else {
+		data = gdImagePngPtr(im, &size);
+
+		image_headers();
+
+		if (data) {
+			fwrite(data, 1, (size_t)size, stdout);
+
+			if (cgi_cachedir())
+				cache_image(data, size);
+
+			gdFree(data);
+		}
+	}
 
-	gdImagePng(im, stdout);
 	gdImageDestroy(im);
 
-	upscli_disconnect(&ups);
+	cgi_disconnect();
 
 	exit(EXIT_SUCCESS);
 }
@@ -238,7 +369,7 @@ static void drawbar(
 {
 	gdImagePtr	im;
 	int		bar_color, summary_color;
-	char		text[SMALLBUF];
+	char		text[SMALLBUF], key[LARGEBUF];
 	int		bar_y;
 	int		width, height, scale_height;
 
@@ -247,17 +378,6 @@ static void drawbar(
 	height = get_imgarg("height");
 	scale_height = get_imgarg("scale_height");
 
-	/* create the image */
-	im = gdImageCreate(width, height);
-
-	/* draw the scale */
-	drawscale(im, lvllo, lvlhi, step, step5, step10, redlo1, redhi1,
-		redlo2, redhi2, grnlo, grnhi);
-
-	/* allocate colors for the bar and summary text */
-	bar_color	= color_alloc(im, get_imgarg("bar_col"));
-	summary_color	= color_alloc(im, get_imgarg("summary_col"));
-
 	/* rescale UPS value to fit in the scale */
 	bar_y = (int)((1.0 - (value - lvllo) / (lvlhi - lvllo)) * scale_height);
 
@@ -271,11 +391,7 @@ static void drawbar(
 	if (bar_y > scale_height)
 		bar_y = scale_height;
 
-	/* draw it */
-	gdImageFilledRectangle(im, 25, bar_y, width - 25, scale_height,
-		bar_color);
-
-	/* stick the text version of the value at the bottom center */
+	/* the text version of the value */
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
 #endif
@@ -289,6 +405,30 @@ static void drawbar(
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
+
+	/* values which round to the same bar and text make the same image */
+	snprintf(key, sizeof(key), "bar %d %d %d %d %d %d %d %d %d %d %d %d %s",
+		lvllo, lvlhi, step, step5, step10, redlo1, redhi1,
+		redlo2, redhi2, grnlo, grnhi, bar_y, text);
+	set_imgtag(key);
+	send_cached_image();
+
+	/* create the image */
+	im = gdImageCreate(width, height);
+
+	/* draw the scale */
+	drawscale(im, lvllo, lvlhi, step, step5, step10, redlo1, redhi1,
+		redlo2, redhi2, grnlo, grnhi);
+
+	/* allocate colors for the bar and summary text */
+	bar_color	= color_alloc(im, get_imgarg("bar_col"));
+	summary_color	= color_alloc(im, get_imgarg("summary_col"));
+
+	/* draw it */
+	gdImageFilledRectangle(im, 25, bar_y, width - 25, scale_height,
+		bar_color);
+
+	/* stick the text version of the value at the bottom center */
 	gdImageString(im, gdFontMediumBold,
 		(width - (int)(strlen(text))*gdFontMediumBold->w)/2,
 		height - gdFontMediumBold->h,
@@ -588,29 +728,10 @@ static void draw_humidity(double var, int min, int nom, int max,
 	drawbar(0, 100, 2, 10, 20, 0, min, max, 100, -1, -1, var, format);
 }
 
+/* all the values of the UPS come at once: see cgi_getvar() */
 static int get_var(const char *var, char *buf, size_t buflen)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
-
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
-
-	numq = 3;
-
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
-
-	if (ret < 0)
-		return 0;
-
-	if (numa < numq)
-		return 0;
-
-	snprintf(buf, buflen, "%s", answer[3]);
-	return 1;
+	return (cgi_getvar(monhost, var, buf, buflen) == 1);
 }
 
 int main(int argc, char **argv)
@@ -639,9 +760,9 @@ int main(int argc, char **argv)
 #endif
 	}
 
-	if (upscli_connect(&ups, hostname, port, 0) < 0) {
+	if (!cgi_checkups(monhost)) {
 		noimage("Can't connect to server:\n%s\n",
-			upscli_strerror(&ups));
+			cgi_strerror());
 #ifndef HAVE___ATTRIBUTE__NORETURN
 		exit(EXIT_FAILURE);	/* Should not get here in practice, but compiler is afraid we can fall through */
 #endif
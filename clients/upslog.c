@@ -39,6 +39,7 @@
 #include "timehead.h"
 #include "nut_stdint.h"
 #include "upslog.h"
+#include "upslogbin.h"
 
 #ifdef WIN32
 #include "wincompat.h"
@@ -54,7 +55,17 @@
 #endif
 	static	char	logbuffer[LARGEBUF], *logformat;
 
-	static	flist_t	*fhead = NULL;
+	static	flist_t	*fhead = NULL, *fcurrent = NULL;
+
+	/* when the values being logged were asked for */
+	static	time_t	sampletime = 0;
+
+	/* -b: compact binary logs rather than text lines */
+	static	int	binary_out = 0;
+
+	/* -r: what %HOST% and %PID% were for the upslog that wrote the log */
+	static	char	*rechost = NULL;
+	static	long	recpid = 0;
 	struct 	monhost_ups {
 		char	*monhost;
 		char	*logfn;
@@ -63,6 +74,10 @@
 		uint16_t	port;
 		UPSCONN_t	*ups;
 		FILE	*logfile;
+		char	**vals;	/* the %VAR snapshot for its next line */
+		upslog_bin_t	*bin;	/* with -b: the binary log writer */
+		int	sampling;	/* waiting for the answers to that */
+		int	listing;	/* asked with a LIST VAR */
 		struct	monhost_ups	*next;
 	};
 	static	struct	monhost_ups *monhost_ups_anchor = NULL;
@@ -70,6 +85,9 @@
 	static	struct	monhost_ups *monhost_ups_prev = NULL;
 
 
+/* how long to wait for upsd to answer, unless the interval is shorter */
+#define SAMPLE_TIMEOUT 10
+
 #define DEFAULT_LOGFORMAT "%TIME @Y@m@d @H@M@S% %VAR battery.charge% " \
 		"%VAR input.voltage% %VAR ups.load% [%VAR ups.status%] " \
 		"%VAR ups.temperature% %VAR input.frequency%"
@@ -84,11 +102,20 @@ static void reopen_log(void)
 			return;
 		}
 
+		/* what is buffered goes to the old file */
+		if (monhost_ups_current->bin)
+			upslog_bin_flush(monhost_ups_current->bin);
+
 		if ((monhost_ups_current->logfile = freopen(
-		    monhost_ups_current->logfn, "a",
+		    monhost_ups_current->logfn, binary_out ? "ab" : "a",
 		    monhost_ups_current->logfile)) == NULL)
 			fatal_with_errno(EXIT_FAILURE,
 				"could not reopen logfile %s", logfn);
+
+		/* the new file starts with its own header */
+		if (monhost_ups_current->bin)
+			upslog_bin_restart(monhost_ups_current->bin,
+				monhost_ups_current->logfile);
 	}
 }
 
@@ -166,6 +193,9 @@ static void help(const char *prog)
 	printf("		  and it would not imply foregrounding\n");
 	printf("		- NOTE: '-s ups' and/or '-l file' options are ignored\n");
 	printf("		  if tuples are used, but you can specify many tuples\n");
+	printf("  -b		- write compact binary logs instead of text lines\n");
+	printf("  -r <file>	- print binary log <file> (or - for stdin) as text, and exit\n");
+	printf("		- the format stored in it is used, unless -f is given\n");
 	printf("  -u <user>	- Switch to <user> if started as root\n");
 	printf("  -V		- Display the version of this software\n");
 	printf("  -h		- Display this help text\n");
@@ -195,6 +225,11 @@ static void do_host(const char *arg)
 	char	hn[LARGEBUF];
 	NUT_UNUSED_VARIABLE(arg);
 
+	if (rechost) {
+		snprintfcat(logbuffer, sizeof(logbuffer), "%s", rechost);
+		return;
+	}
+
 	ret = gethostname(hn, sizeof(hn));
 
 	if (ret != 0) {
@@ -216,7 +251,8 @@ static void do_pid(const char *arg)
 {
 	NUT_UNUSED_VARIABLE(arg);
 
-	snprintfcat(logbuffer, sizeof(logbuffer), "%ld", (long)getpid());
+	snprintfcat(logbuffer, sizeof(logbuffer), "%ld",
+		recpid ? recpid : (long)getpid());
 }
 
 static void do_time(const char *arg)
@@ -233,7 +269,7 @@ static void do_time(const char *arg)
 		if (format[i] == '@')
 			format[i] = '%';
 
-	time(&tod);
+	tod = sampletime ? sampletime : time(NULL);
 	strftime(timebuf, sizeof(timebuf), format, localtime_r(&tod, &tmbuf));
 
 	snprintfcat(logbuffer, sizeof(logbuffer), "%s", timebuf);
@@ -241,48 +277,161 @@ static void do_time(const char *arg)
 	free(format);
 }
 
-static void getvar(const char *var)
+/* can a %VAR with this argument be looked up at all */
+static int var_valid(const char *arg)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
+	if ((!arg) || (strlen(arg) < 1)) {
+		return 0;
+	}
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
-	numq = 3;
+	/* old variable names are no longer supported */
+	if (!strchr(arg, '.')) {
+		return 0;
+	}
+
+	/* a UPS name is now required */
+	return (upsname != NULL);
+}
 
-	ret = upscli_get(ups, numq, query, &numa, &answer);
+/* distinct variables named by the format, collected by compile_format() */
+static	char	**snapnames = NULL;
+static	size_t	snapcount = 0;
 
-	if ((ret < 0) || (numa < numq)) {
-		snprintfcat(logbuffer, sizeof(logbuffer), "NA");
+/* remember that the format uses var, and return its snapshot index */
+static int snap_add(const char *var)
+{
+	size_t	i;
+
+	for (i = 0; i < snapcount; i++) {
+		if (!strcmp(snapnames[i], var)) {
+			return (int)i;
+		}
+	}
+
+	snapnames = xrealloc(snapnames, (snapcount + 1) * sizeof(*snapnames));
+	snapnames[snapcount] = xstrdup(var);
+
+	return (int)snapcount++;
+}
+
+static void snap_set(struct monhost_ups *mu, const char *var, const char *val)
+{
+	size_t	i;
+
+	for (i = 0; i < snapcount; i++) {
+		if (!strcmp(snapnames[i], var)) {
+			free(mu->vals[i]);
+			mu->vals[i] = xstrdup(val);
+			return;
+		}
+	}
+}
+
+static void snap_clear(struct monhost_ups *mu)
+{
+	size_t	i;
+
+	if (!mu->vals) {
+		mu->vals = xcalloc(snapcount ? snapcount : 1, sizeof(*mu->vals));
 		return;
 	}
 
-	snprintfcat(logbuffer, sizeof(logbuffer), "%s", answer[3]);
+	for (i = 0; i < snapcount; i++) {
+		free(mu->vals[i]);
+		mu->vals[i] = NULL;
+	}
 }
 
-static void do_var(const char *arg)
+static void sample_answer(UPSCONN_t *conn, void *arg, int upserror,
+	size_t numa, char **answer)
 {
-	if ((!arg) || (strlen(arg) < 1)) {
-		snprintfcat(logbuffer, sizeof(logbuffer), "INVALID");
+	struct	monhost_ups	*mu = arg;
+	const	char	*query[3];
+	size_t	i;
+
+	/* VAR <ups> <name> <value>, whether from LIST VAR or GET VAR;
+	 * the end of a list comes with numa == 0 */
+	if (upserror == UPSCLI_ERR_NONE) {
+		if (numa >= 4) {
+			snap_set(mu, answer[2], answer[3]);
+		}
 		return;
 	}
 
-	/* old variable names are no longer supported */
-	if (!strchr(arg, '.')) {
-		snprintfcat(logbuffer, sizeof(logbuffer), "INVALID");
+	/* what was not answered shows as NA, but if just the listing was
+	 * refused, ask for the variables one by one (still all at once) */
+	if (!mu->listing || upscli_fd(conn) < 0) {
 		return;
 	}
 
-	/* a UPS name is now required */
-	if (!upsname) {
+	mu->listing = 0;
+
+	query[0] = "VAR";
+	query[1] = mu->upsname;
+
+	for (i = 0; i < snapcount; i++) {
+		query[2] = snapnames[i];
+		upscli_queue(conn, "GET", 3, query, sample_answer, mu);
+	}
+}
+
+/* queue the queries for the next line of this UPS, connecting first if
+ * needed: a single LIST VAR when the format names several variables, so
+ * they all come from the same moment, or a GET for just one; returns 1
+ * if there are answers to wait for */
+static int sample_start(struct monhost_ups *mu)
+{
+	const	char	*query[3];
+
+	snap_clear(mu);
+	mu->listing = 0;
+
+	if (snapcount == 0 || !mu->upsname) {
+		return 0;
+	}
+
+	if (upscli_fd(mu->ups) < 0
+	 && upscli_connect_start(mu->ups, mu->hostname, mu->port, UPSCLI_CONN_TRYSSL) < 0) {
+		upsdebugx(1, "%s: %s: %s", __func__, mu->monhost,
+			upscli_strerror(mu->ups));
+		return 0;
+	}
+
+	query[0] = "VAR";
+	query[1] = mu->upsname;
+
+	if (snapcount > 1) {
+		mu->listing = 1;
+		if (upscli_queue(mu->ups, "LIST", 2, query, sample_answer, mu) < 0) {
+			upscli_disconnect(mu->ups);
+			return 0;
+		}
+	} else {
+		query[2] = snapnames[0];
+		if (upscli_queue(mu->ups, "GET", 3, query, sample_answer, mu) < 0) {
+			upscli_disconnect(mu->ups);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void do_var(const char *arg)
+{
+	if (!var_valid(arg)) {
 		snprintfcat(logbuffer, sizeof(logbuffer), "INVALID");
 		return;
 	}
 
-	getvar(arg);
+	if (!fcurrent || fcurrent->snap < 0 || !monhost_ups_current
+	 || !monhost_ups_current->vals || !monhost_ups_current->vals[fcurrent->snap]) {
+		snprintfcat(logbuffer, sizeof(logbuffer), "NA");
+		return;
+	}
+
+	snprintfcat(logbuffer, sizeof(logbuffer), "%s",
+		monhost_ups_current->vals[fcurrent->snap]);
 }
 
 static void do_etime(const char *arg)
@@ -290,7 +439,7 @@ static void do_etime(const char *arg)
 	time_t	tod;
 	NUT_UNUSED_VARIABLE(arg);
 
-	time(&tod);
+	tod = sampletime ? sampletime : time(NULL);
 	snprintfcat(logbuffer, sizeof(logbuffer), "%ld", (unsigned long) tod);
 }
 
@@ -320,6 +469,12 @@ static void add_call(void (*fptr)(const char *arg), const char *arg)
 	else
 		tmp->arg = NULL;
 
+	/* var_valid() cannot tell yet: the UPS name comes with each host */
+	if (fptr == do_var && arg && strchr(arg, '.'))
+		tmp->snap = snap_add(arg);
+	else
+		tmp->snap = -1;
+
 	tmp->next = NULL;
 
 	if (last)
@@ -410,20 +565,262 @@ static void run_flist(struct monhost_ups *monhost_ups_print)
 {
 	flist_t	*tmp;
 
+	/* the snapshot is all there is to keep, the line can be made later */
+	if (monhost_ups_print->bin) {
+		if (upslog_bin_add(monhost_ups_print->bin, sampletime,
+			monhost_ups_print->vals) < 0)
+			upslog_with_errno(LOG_ERR, "could not write to %s",
+				monhost_ups_print->logfn);
+		return;
+	}
+
 	tmp = fhead;
 
 	memset(logbuffer, 0, sizeof(logbuffer));
 
 	while (tmp) {
+		fcurrent = tmp;
 		tmp->fptr(tmp->arg);
 
 		tmp = tmp->next;
 	}
 
+	fcurrent = NULL;
+
 	fprintf(monhost_ups_print->logfile, "%s\n", logbuffer);
 	fflush(monhost_ups_print->logfile);
 }
 
+/* write the line of this UPS with the snapshot it got */
+static void sample_done(struct monhost_ups *mu)
+{
+	mu->sampling = 0;
+
+	monhost_ups_current = mu;
+	ups = mu->ups;	/* XXX Not ideal */
+	upsname = mu->upsname;	/* XXX Not ideal */
+
+	run_flist(mu);
+}
+
+/* take a snapshot of every UPS at the same time over their non-blocking
+ * connections and write each line as soon as its answers are in, so a
+ * slow or dead upsd delays none of the others; those not answered in
+ * timeout seconds are logged with NA and disconnected */
+static void sample_all(int timeout)
+{
+	struct	monhost_ups	*mu;
+	fd_set	rfds, wfds;
+	struct	timeval	tv, start, now;
+	double	left;
+	int	fd, maxfd, want, ret;
+
+	gettimeofday(&start, NULL);
+	sampletime = start.tv_sec;
+
+	for (mu = monhost_ups_anchor; mu != NULL; mu = mu->next) {
+		mu->sampling = sample_start(mu);
+		if (!mu->sampling) {
+			sample_done(mu);
+		}
+	}
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		maxfd = -1;
+
+		for (mu = monhost_ups_anchor; mu != NULL; mu = mu->next) {
+			if (!mu->sampling)
+				continue;
+
+			fd = upscli_fd(mu->ups);
+			want = upscli_want(mu->ups);
+
+			if (want & UPSCLI_WANT_READ)
+				FD_SET(fd, &rfds);
+			if (want & UPSCLI_WANT_WRITE)
+				FD_SET(fd, &wfds);
+
+			if (fd > maxfd)
+				maxfd = fd;
+		}
+
+		if (maxfd < 0)
+			return;
+
+		gettimeofday(&now, NULL);
+		left = timeout - difftimeval(now, start);
+		if (left < 0)
+			left = 0;
+
+		tv.tv_sec = (time_t)left;
+		tv.tv_usec = (suseconds_t)((left - (double)tv.tv_sec) * 1000000);
+
+		ret = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+
+		if (ret < 0) {
+#ifndef WIN32
+			if (errno == EINTR)
+				continue;
+#endif
+			/* just try them all then */
+			upslog_with_errno(LOG_ERR, "%s: select", __func__);
+		}
+
+		gettimeofday(&now, NULL);
+		left = timeout - difftimeval(now, start);
+
+		for (mu = monhost_ups_anchor; mu != NULL; mu = mu->next) {
+			if (!mu->sampling)
+				continue;
+
+			fd = upscli_fd(mu->ups);
+
+			if ((ret < 0 || FD_ISSET(fd, &rfds) || FD_ISSET(fd, &wfds))
+			 && upscli_process(mu->ups) <= 0) {
+				/* all answered, or the connection failed */
+				sample_done(mu);
+				continue;
+			}
+
+			if (left <= 0) {
+				upsdebugx(1, "%s: %s did not answer in %d sec",
+					__func__, mu->monhost, timeout);
+
+				/* a late answer would confuse the next query */
+				upscli_disconnect(mu->ups);
+				sample_done(mu);
+			}
+		}
+	}
+}
+
+/* forget the compiled format, to compile another one */
+static void free_format(void)
+{
+	flist_t	*tmp, *next;
+	size_t	i;
+
+	for (tmp = fhead; tmp; tmp = next) {
+		next = tmp->next;
+		free((char *)tmp->arg);
+		free(tmp);
+	}
+	fhead = NULL;
+
+	for (i = 0; i < snapcount; i++)
+		free(snapnames[i]);
+	free(snapnames);
+	snapnames = NULL;
+	snapcount = 0;
+}
+
+/* -r: turn a binary log back into the text lines upslog would have
+ * written, with the format stored in it unless -f was given */
+static	struct	monhost_ups	readback_ups;
+static	int	*readback_map = NULL;
+static	size_t	readback_cols = 0;
+static	char	*readback_fmt = NULL;
+static	int	readback_keepfmt = 0;
+
+static void readback_header(void *arg, const upslog_bin_header_t *hdr)
+{
+	size_t	i, j;
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (!readback_keepfmt && (!readback_fmt || strcmp(readback_fmt, hdr->format))) {
+		free_format();
+		free(readback_fmt);
+		readback_fmt = xstrdup(hdr->format);
+		logformat = readback_fmt;
+		compile_format();
+	}
+
+	free(readback_ups.vals);
+	readback_ups.vals = NULL;
+	snap_clear(&readback_ups);
+
+	/* the columns of the log that the format uses */
+	readback_cols = hdr->ncols;
+	readback_map = xrealloc(readback_map,
+		(readback_cols ? readback_cols : 1) * sizeof(*readback_map));
+
+	for (i = 0; i < readback_cols; i++) {
+		readback_map[i] = -1;
+		for (j = 0; j < snapcount; j++) {
+			if (!strcmp(hdr->names[i], snapnames[j])) {
+				readback_map[i] = (int)j;
+				break;
+			}
+		}
+	}
+
+	free(monhost);
+	monhost = xstrdup(hdr->upshost);
+	free(upsname);
+	upsname = xstrdup(hdr->upsname);
+	free(rechost);
+	rechost = xstrdup(hdr->hostname);
+	recpid = hdr->pid;
+}
+
+static void readback_record(void *arg, time_t when, char **vals)
+{
+	size_t	i;
+	NUT_UNUSED_VARIABLE(arg);
+
+	snap_clear(&readback_ups);
+
+	for (i = 0; i < readback_cols; i++) {
+		if (readback_map[i] >= 0 && vals[i])
+			readback_ups.vals[readback_map[i]] = xstrdup(vals[i]);
+	}
+
+	sampletime = when;
+	monhost_ups_current = &readback_ups;
+	run_flist(&readback_ups);
+}
+
+static void readback(const char *fn, int keepfmt)
+	__attribute__((noreturn));
+
+static void readback(const char *fn, int keepfmt)
+{
+	FILE	*f;
+	int	ret;
+
+	if (!strcmp(fn, "-"))
+		f = stdin;
+	else if ((f = fopen(fn, "rb")) == NULL)
+		fatal_with_errno(EXIT_FAILURE, "could not open %s", fn);
+
+	/* with -f, the format given is used for all the records */
+	readback_keepfmt = keepfmt;
+	if (keepfmt)
+		compile_format();
+
+	readback_ups.logfile = stdout;
+	readback_ups.logfn = (char *)"-";
+	monhost = NULL;
+	upsname = NULL;
+
+	ret = upslog_bin_read(f, readback_header, readback_record, NULL);
+
+	if (f != stdin)
+		fclose(f);
+
+	if (ret == UPSLOG_BIN_ERR_NOZLIB)
+		fatalx(EXIT_FAILURE, "%s has compressed blocks, "
+			"and this upslog was built without zlib", fn);
+
+	if (ret < 0)
+		fatalx(EXIT_FAILURE, "%s is not a binary upslog file, "
+			"or it is damaged or cut short", fn);
+
+	exit(EXIT_SUCCESS);
+}
+
 	/* -s <monhost>
 	 * -l <log file>
 	 * -i <interval>
@@ -440,13 +837,15 @@ int main(int argc, char **argv)
 	const char	*user = NULL;
 	struct passwd	*new_uid = NULL;
 	const char	*pidfilebase = prog;
+	const char	*readfn = NULL;
+	int	format_given = 0;
 
 	logformat = DEFAULT_LOGFORMAT;
 	user = RUN_AS_USER;
 
 	print_banner_once(prog, 0);
 
-	while ((i = getopt(argc, argv, "+hs:l:i:f:u:Vp:FBm:")) != -1) {
+	while ((i = getopt(argc, argv, "+hs:l:i:f:u:Vp:FBm:br:")) != -1) {
 		switch(i) {
 			case 'h':
 				help(prog);
@@ -503,6 +902,15 @@ int main(int argc, char **argv)
 
 			case 'f':
 				logformat = optarg;
+				format_given = 1;
+				break;
+
+			case 'b':
+				binary_out = 1;
+				break;
+
+			case 'r':
+				readfn = optarg;
 				break;
 
 			case 'u':
@@ -539,6 +947,9 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if (readfn)
+		readback(readfn, format_given);
+
 	/* not enough args for the old way? */
 	if ((argc == 1) || (argc == 2))
 		help(prog);
@@ -602,14 +1013,20 @@ int main(int argc, char **argv)
 		}
 
 		monhost_ups_current->ups = xmalloc(sizeof(UPSCONN_t));
-		if (upscli_connect(monhost_ups_current->ups, monhost_ups_current->hostname, monhost_ups_current->port, UPSCLI_CONN_TRYSSL) < 0)
+		monhost_ups_current->vals = NULL;
+		monhost_ups_current->bin = NULL;
+		monhost_ups_current->sampling = 0;
+		monhost_ups_current->listing = 0;
+
+		/* only started here, it goes on along with the first queries */
+		if (upscli_connect_start(monhost_ups_current->ups, monhost_ups_current->hostname, monhost_ups_current->port, UPSCLI_CONN_TRYSSL) < 0)
 			fprintf(stderr, "Warning: initial connect failed: %s\n",
 				upscli_strerror(monhost_ups_current->ups));
 
 		if (strcmp(monhost_ups_current->logfn, "-") == 0)
 			monhost_ups_current->logfile = stdout;
 		else
-			monhost_ups_current->logfile = fopen(monhost_ups_current->logfn, "a");
+			monhost_ups_current->logfile = fopen(monhost_ups_current->logfn, binary_out ? "ab" : "a");
 
 		if (monhost_ups_current->logfile == NULL)
 			fatal_with_errno(EXIT_FAILURE, "could not open logfile %s", logfn);
@@ -641,6 +1058,30 @@ int main(int argc, char **argv)
 
 	compile_format();
 
+	if (binary_out) {
+		upslog_bin_header_t	hdr;
+		char	hn[LARGEBUF];
+
+		if (gethostname(hn, sizeof(hn)) != 0)
+			hn[0] = '\0';
+
+		hdr.format = logformat;
+		hdr.hostname = hn;
+		hdr.pid = (long)getpid();
+		hdr.ncols = snapcount;
+		hdr.names = snapnames;
+
+		for (monhost_ups_current = monhost_ups_anchor;
+		     monhost_ups_current != NULL;
+		     monhost_ups_current = monhost_ups_current->next) {
+			/* what %UPSHOST% gives in text logs */
+			hdr.upshost = monhost ? monhost : monhost_ups_current->monhost;
+			hdr.upsname = monhost_ups_current->upsname;
+			monhost_ups_current->bin = upslog_bin_open(
+				monhost_ups_current->logfile, &hdr);
+		}
+	}
+
 	upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 
 	while (exit_flag == 0) {
@@ -666,21 +1107,15 @@ int main(int argc, char **argv)
 			upsnotify(NOTIFY_STATE_READY, NULL);
 		}
 
-		for (monhost_ups_current = monhost_ups_anchor;
-		     monhost_ups_current != NULL;
-		     monhost_ups_current = monhost_ups_current->next) {
-			ups = monhost_ups_current->ups;	/* XXX Not ideal */
-			upsname = monhost_ups_current->upsname;	/* XXX Not ideal */
-			/* reconnect if necessary */
-			if (upscli_fd(ups) < 0) {
-				upscli_connect(ups, monhost_ups_current->hostname, monhost_ups_current->port, 0);
-			}
+		/* all in one go, bounded so the next tick is not missed */
+		sample_all((interval < SAMPLE_TIMEOUT) ? ((interval > 0) ? interval : 1) : SAMPLE_TIMEOUT);
 
-			run_flist(monhost_ups_current);
-
-			/* don't keep connection open if we don't intend to use it shortly */
-			if (interval > 30) {
-				upscli_disconnect(ups);
+		/* don't keep connections open if we don't intend to use them shortly */
+		if (interval > 30) {
+			for (monhost_ups_current = monhost_ups_anchor;
+			     monhost_ups_current != NULL;
+			     monhost_ups_current = monhost_ups_current->next) {
+				upscli_disconnect(monhost_ups_current->ups);
 			}
 		}
 	}
@@ -692,6 +1127,8 @@ int main(int argc, char **argv)
 	     monhost_ups_current != NULL;
 	     monhost_ups_current = monhost_ups_current->next) {
 
+		upslog_bin_close(monhost_ups_current->bin);
+
 		if (monhost_ups_current->logfile != stdout)
 			fclose(monhost_ups_current->logfile);
 
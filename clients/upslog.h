@@ -13,6 +13,7 @@ extern "C" {
 typedef struct flist_s {
 	void	(*fptr)(const char *arg);
 	const	char	*arg;
+	int	snap;	/* %VAR: index into the per-line snapshot, or -1 */
 	struct flist_s	*next;
 } flist_t;
 
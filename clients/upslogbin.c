@@ -0,0 +1,810 @@
+/* upslogbin.c - compact binary log files of upslog
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* File layout (all integers are LEB128 varints, signed ones zigzagged,
+ * strings are a length then the bytes):
+ *
+ * The file is a sequence of chunks, each starting with a tag byte.
+ *
+ * 'H' - header, written when a log is opened (or reopened):
+ *	"NUTLOG", version, format, upshost, upsname, hostname, pid,
+ *	ncols, then the ncols variable names
+ *
+ * 'B' - block of records, written every UPSLOG_BIN_BLOCK records or
+ *	UPSLOG_BIN_SYNC seconds: nrec, payload length, then the payload
+ *	stored by column:
+ *	- the times: the first one, then the difference with the previous
+ *	- each variable, with a type byte chosen for the values it has in
+ *	  this block:
+ *	  BIN_COL_NA: no value at all;
+ *	  BIN_COL_NUM: decimal numbers with the same count of decimals,
+ *	  that count, a bitmap of the records having a value, then the
+ *	  difference of each value (times 10^decimals) with the previous;
+ *	  BIN_COL_STR: the bitmap, then for each value 0 if it is the same
+ *	  as the previous one, or its length plus 1 and its bytes.
+ *
+ * 'Z' - the same block, deflated, when upslog is built with zlib and
+ *	that makes it smaller: nrec, payload length, deflated length, then
+ *	the deflated payload (a zlib stream). Readers built without zlib
+ *	stop there.
+ *
+ * Values of UPS variables mostly stay the same or change a little from
+ * one record to the next, so most of them take one byte or less.
+ */
+
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nut_stdint.h"
+#include "binframe.h"
+#include "upslogbin.h"
+
+#ifdef WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#define BIN_MAGIC	"NUTLOG"
+#define BIN_VERSION	1
+
+#define BIN_TAG_HEADER	'H'
+#define BIN_TAG_BLOCK	'B'
+#define BIN_TAG_ZBLOCK	'Z'
+
+#define BIN_COL_NA	0
+#define BIN_COL_NUM	1
+#define BIN_COL_STR	2
+
+/* sanity limits for the reader */
+#define BIN_MAX_STR	65536
+#define BIN_MAX_COLS	4096
+#define BIN_MAX_RECS	65536
+#define BIN_MAX_BLOCK	(64 * 1024 * 1024)
+
+typedef struct {
+	unsigned char	*data;
+	size_t	len, size;
+} binbuf_t;
+
+struct upslog_bin_s {
+	FILE	*f;
+	upslog_bin_header_t	hdr;
+	size_t	nrec;
+	time_t	*times;
+	char	**vals;	/* nrec rows of ncols */
+	binbuf_t	out;
+#ifdef WITH_ZLIB
+	binbuf_t	zip;	/* the deflated payload */
+#endif
+};
+
+static void buf_put(binbuf_t *b, const void *data, size_t len)
+{
+	if (len == 0) {
+		return;
+	}
+
+	if (b->len + len > b->size) {
+		b->size = b->len + len + 4096;
+		b->data = xrealloc(b->data, b->size);
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void buf_byte(binbuf_t *b, unsigned int c)
+{
+	unsigned char	byte = (unsigned char)c;
+
+	buf_put(b, &byte, 1);
+}
+
+static void buf_uint(binbuf_t *b, uint64_t val)
+{
+	while (val >= 0x80) {
+		buf_byte(b, (unsigned int)((val & 0x7f) | 0x80));
+		val >>= 7;
+	}
+
+	buf_byte(b, (unsigned int)val);
+}
+
+static void buf_int(binbuf_t *b, int64_t val)
+{
+	buf_uint(b, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static void buf_str(binbuf_t *b, const char *str)
+{
+	size_t	len = str ? strlen(str) : 0;
+
+	buf_uint(b, len);
+	buf_put(b, str, len);
+}
+
+/* the count of decimals of a number binframe_num_format() gives back
+ * the same, or -1 */
+static int num_parse(const char *str, int64_t *val)
+{
+	unsigned int	decimals;
+
+	if (!binframe_num_parse(str, val, &decimals)) {
+		return -1;
+	}
+
+	return (int)decimals;
+}
+
+static char *num_format(int64_t val, int decimals)
+{
+	char	buf[SMALLBUF];
+
+	if (binframe_num_format(val, (unsigned int)decimals, buf, sizeof(buf)) == 0) {
+		buf[0] = '\0';
+	}
+
+	return xstrdup(buf);
+}
+
+static void header_write(upslog_bin_t *bin)
+{
+	binbuf_t	b = { NULL, 0, 0 };
+	size_t	i;
+
+	buf_byte(&b, BIN_TAG_HEADER);
+	buf_put(&b, BIN_MAGIC, strlen(BIN_MAGIC));
+	buf_uint(&b, BIN_VERSION);
+	buf_str(&b, bin->hdr.format);
+	buf_str(&b, bin->hdr.upshost);
+	buf_str(&b, bin->hdr.upsname);
+	buf_str(&b, bin->hdr.hostname);
+	buf_int(&b, bin->hdr.pid);
+	buf_uint(&b, bin->hdr.ncols);
+
+	for (i = 0; i < bin->hdr.ncols; i++) {
+		buf_str(&b, bin->hdr.names[i]);
+	}
+
+	fwrite(b.data, 1, b.len, bin->f);
+	fflush(bin->f);
+
+	free(b.data);
+}
+
+static char *xstrdup_or_empty(const char *str)
+{
+	return xstrdup(str ? str : "");
+}
+
+upslog_bin_t *upslog_bin_open(FILE *f, const upslog_bin_header_t *hdr)
+{
+	upslog_bin_t	*bin;
+	size_t	i;
+
+	bin = xcalloc(1, sizeof(*bin));
+	bin->f = f;
+
+	bin->hdr.format = xstrdup_or_empty(hdr->format);
+	bin->hdr.upshost = xstrdup_or_empty(hdr->upshost);
+	bin->hdr.upsname = xstrdup_or_empty(hdr->upsname);
+	bin->hdr.hostname = xstrdup_or_empty(hdr->hostname);
+	bin->hdr.pid = hdr->pid;
+	bin->hdr.ncols = hdr->ncols;
+	bin->hdr.names = xcalloc(hdr->ncols ? hdr->ncols : 1, sizeof(char *));
+
+	for (i = 0; i < hdr->ncols; i++) {
+		bin->hdr.names[i] = xstrdup(hdr->names[i]);
+	}
+
+	bin->times = xcalloc(UPSLOG_BIN_BLOCK, sizeof(*bin->times));
+	bin->vals = xcalloc(UPSLOG_BIN_BLOCK * (hdr->ncols ? hdr->ncols : 1),
+		sizeof(*bin->vals));
+
+	header_write(bin);
+
+	return bin;
+}
+
+/* the values of column col in the buffered records, as one column */
+static void block_column(upslog_bin_t *bin, size_t col, binbuf_t *b)
+{
+	size_t	i, nbits = (bin->nrec + 7) / 8, present = 0;
+	unsigned char	bits[(UPSLOG_BIN_BLOCK + 7) / 8];
+	int64_t	val, prev = 0;
+	const	char	*str, *last = NULL;
+	int	decimals = -1, d;
+
+	memset(bits, 0, sizeof(bits));
+
+	for (i = 0; i < bin->nrec; i++) {
+		str = bin->vals[i * bin->hdr.ncols + col];
+		if (!str) {
+			continue;
+		}
+
+		bits[i / 8] |= (unsigned char)(1 << (i % 8));
+		present++;
+
+		/* numbers only if they all have the same count of decimals */
+		d = num_parse(str, &val);
+		if (present == 1) {
+			decimals = d;
+		} else if (d != decimals) {
+			decimals = -1;
+		}
+	}
+
+	if (present == 0) {
+		buf_byte(b, BIN_COL_NA);
+		return;
+	}
+
+	if (decimals >= 0) {
+		buf_byte(b, BIN_COL_NUM);
+		buf_byte(b, (unsigned int)decimals);
+		buf_put(b, bits, nbits);
+
+		for (i = 0; i < bin->nrec; i++) {
+			str = bin->vals[i * bin->hdr.ncols + col];
+			if (!str) {
+				continue;
+			}
+
+			num_parse(str, &val);
+			buf_int(b, val - prev);
+			prev = val;
+		}
+
+		return;
+	}
+
+	buf_byte(b, BIN_COL_STR);
+	buf_put(b, bits, nbits);
+
+	for (i = 0; i < bin->nrec; i++) {
+		str = bin->vals[i * bin->hdr.ncols + col];
+		if (!str) {
+			continue;
+		}
+
+		if (last && !strcmp(str, last)) {
+			buf_uint(b, 0);
+		} else {
+			buf_uint(b, (uint64_t)strlen(str) + 1);
+			buf_put(b, str, strlen(str));
+		}
+
+		last = str;
+	}
+}
+
+#ifdef WITH_ZLIB
+/* deflate the payload of a block into out; 0 if that made it smaller */
+static int block_deflate(const binbuf_t *payload, binbuf_t *out)
+{
+	uLongf	len = compressBound((uLong)payload->len);
+
+	if (out->size < len) {
+		out->size = len;
+		out->data = xrealloc(out->data, out->size);
+	}
+
+	if (compress2(out->data, &len, payload->data, (uLong)payload->len,
+		Z_DEFAULT_COMPRESSION) != Z_OK
+	 || len >= payload->len
+	) {
+		return -1;
+	}
+
+	out->len = len;
+
+	return 0;
+}
+#endif
+
+int upslog_bin_flush(upslog_bin_t *bin)
+{
+	binbuf_t	payload = { NULL, 0, 0 };
+	size_t	i, col;
+	int	ret = 0;
+
+	if (!bin) {
+		return -1;
+	}
+
+	if (bin->nrec > 0) {
+		buf_int(&payload, (int64_t)bin->times[0]);
+		for (i = 1; i < bin->nrec; i++) {
+			buf_int(&payload, (int64_t)(bin->times[i] - bin->times[i - 1]));
+		}
+
+		for (col = 0; col < bin->hdr.ncols; col++) {
+			block_column(bin, col, &payload);
+		}
+
+		bin->out.len = 0;
+#ifdef WITH_ZLIB
+		if (block_deflate(&payload, &bin->zip) == 0) {
+			buf_byte(&bin->out, BIN_TAG_ZBLOCK);
+			buf_uint(&bin->out, bin->nrec);
+			buf_uint(&bin->out, payload.len);
+			buf_uint(&bin->out, bin->zip.len);
+			buf_put(&bin->out, bin->zip.data, bin->zip.len);
+		} else
+#endif
+		{
+			buf_byte(&bin->out, BIN_TAG_BLOCK);
+			buf_uint(&bin->out, bin->nrec);
+			buf_uint(&bin->out, payload.len);
+			buf_put(&bin->out, payload.data, payload.len);
+		}
+
+		if (fwrite(bin->out.data, 1, bin->out.len, bin->f) != bin->out.len) {
+			ret = -1;
+		}
+
+		for (i = 0; i < bin->nrec * bin->hdr.ncols; i++) {
+			free(bin->vals[i]);
+			bin->vals[i] = NULL;
+		}
+		bin->nrec = 0;
+
+		free(payload.data);
+	}
+
+	if (fflush(bin->f) != 0) {
+		ret = -1;
+	}
+
+	/* the block is the unit of loss, rather than whatever the OS kept */
+#ifndef WIN32
+	fsync(fileno(bin->f));
+#else
+	_commit(_fileno(bin->f));
+#endif
+
+	return ret;
+}
+
+int upslog_bin_add(upslog_bin_t *bin, time_t when, char **vals)
+{
+	size_t	i;
+	char	**row;
+
+	if (!bin) {
+		return -1;
+	}
+
+	row = &bin->vals[bin->nrec * bin->hdr.ncols];
+	for (i = 0; i < bin->hdr.ncols; i++) {
+		row[i] = (vals && vals[i]) ? xstrdup(vals[i]) : NULL;
+	}
+	bin->times[bin->nrec++] = when;
+
+	if (bin->nrec >= UPSLOG_BIN_BLOCK
+	 || when - bin->times[0] >= UPSLOG_BIN_SYNC
+	 || when < bin->times[0]
+	) {
+		return upslog_bin_flush(bin);
+	}
+
+	return 0;
+}
+
+int upslog_bin_restart(upslog_bin_t *bin, FILE *f)
+{
+	if (!bin) {
+		return -1;
+	}
+
+	upslog_bin_flush(bin);
+
+	bin->f = f;
+	header_write(bin);
+
+	return 0;
+}
+
+void upslog_bin_close(upslog_bin_t *bin)
+{
+	size_t	i;
+
+	if (!bin) {
+		return;
+	}
+
+	upslog_bin_flush(bin);
+
+	for (i = 0; i < bin->hdr.ncols; i++) {
+		free(bin->hdr.names[i]);
+	}
+
+	free(bin->hdr.names);
+	free(bin->hdr.format);
+	free(bin->hdr.upshost);
+	free(bin->hdr.upsname);
+	free(bin->hdr.hostname);
+	free(bin->times);
+	free(bin->vals);
+	free(bin->out.data);
+#ifdef WITH_ZLIB
+	free(bin->zip.data);
+#endif
+	free(bin);
+}
+
+/* reading, from a file (the header) or a buffer (the blocks) */
+typedef struct {
+	FILE	*f;
+	const	unsigned char	*p, *end;
+	int	err;
+} binread_t;
+
+static int get_byte(binread_t *r)
+{
+	int	c;
+
+	if (r->err) {
+		return -1;
+	}
+
+	if (r->f) {
+		if ((c = fgetc(r->f)) == EOF) {
+			r->err = 1;
+			return -1;
+		}
+		return c;
+	}
+
+	if (r->p >= r->end) {
+		r->err = 1;
+		return -1;
+	}
+
+	return *r->p++;
+}
+
+static uint64_t get_uint(binread_t *r)
+{
+	uint64_t	val = 0;
+	int	c, shift;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if ((c = get_byte(r)) < 0) {
+			return 0;
+		}
+
+		val |= (uint64_t)(c & 0x7f) << shift;
+
+		if (!(c & 0x80)) {
+			return val;
+		}
+	}
+
+	r->err = 1;
+	return 0;
+}
+
+static int64_t get_int(binread_t *r)
+{
+	uint64_t	val = get_uint(r);
+
+	return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+static int get_bytes(binread_t *r, void *data, size_t len)
+{
+	if (r->err) {
+		return -1;
+	}
+
+	if (r->f) {
+		if (len > 0 && fread(data, 1, len, r->f) != len) {
+			r->err = 1;
+			return -1;
+		}
+		return 0;
+	}
+
+	if ((size_t)(r->end - r->p) < len) {
+		r->err = 1;
+		return -1;
+	}
+
+	memcpy(data, r->p, len);
+	r->p += len;
+
+	return 0;
+}
+
+static char *get_str(binread_t *r)
+{
+	uint64_t	len = get_uint(r);
+	char	*str;
+
+	if (r->err || len > BIN_MAX_STR) {
+		r->err = 1;
+		return NULL;
+	}
+
+	str = xmalloc((size_t)len + 1);
+	if (get_bytes(r, str, (size_t)len) < 0) {
+		free(str);
+		return NULL;
+	}
+	str[len] = '\0';
+
+	return str;
+}
+
+static void header_free(upslog_bin_header_t *hdr)
+{
+	size_t	i;
+
+	for (i = 0; hdr->names && i < hdr->ncols; i++) {
+		free(hdr->names[i]);
+	}
+
+	free(hdr->names);
+	free(hdr->format);
+	free(hdr->upshost);
+	free(hdr->upsname);
+	free(hdr->hostname);
+	memset(hdr, 0, sizeof(*hdr));
+}
+
+static int header_read(binread_t *r, upslog_bin_header_t *hdr)
+{
+	char	magic[sizeof(BIN_MAGIC) - 1];
+	uint64_t	ncols;
+	size_t	i;
+
+	header_free(hdr);
+
+	if (get_bytes(r, magic, sizeof(magic)) < 0
+	 || memcmp(magic, BIN_MAGIC, sizeof(magic))
+	 || get_uint(r) != BIN_VERSION
+	) {
+		return -1;
+	}
+
+	hdr->format = get_str(r);
+	hdr->upshost = get_str(r);
+	hdr->upsname = get_str(r);
+	hdr->hostname = get_str(r);
+	hdr->pid = (long)get_int(r);
+	ncols = get_uint(r);
+
+	if (r->err || ncols > BIN_MAX_COLS) {
+		return -1;
+	}
+
+	hdr->ncols = (size_t)ncols;
+	hdr->names = xcalloc(hdr->ncols ? hdr->ncols : 1, sizeof(char *));
+
+	for (i = 0; i < hdr->ncols; i++) {
+		hdr->names[i] = get_str(r);
+	}
+
+	return r->err ? -1 : 0;
+}
+
+/* decode a block into nrec rows of ncols values */
+static int block_read(binread_t *r, size_t nrec, size_t ncols,
+	time_t *times, char **vals)
+{
+	unsigned char	*bits;
+	size_t	i, col, nbits = (nrec + 7) / 8;
+	int64_t	val;
+	char	*last;
+	uint64_t	len;
+	int	type, decimals;
+
+	times[0] = (time_t)get_int(r);
+	for (i = 1; i < nrec; i++) {
+		times[i] = times[i - 1] + (time_t)get_int(r);
+	}
+
+	bits = xmalloc(nbits);
+
+	for (col = 0; col < ncols && !r->err; col++) {
+		if ((type = get_byte(r)) == BIN_COL_NA) {
+			continue;
+		}
+
+		if (type == BIN_COL_NUM) {
+			decimals = get_byte(r);
+			if (decimals < 0 || decimals > BINFRAME_NUM_DIGITS) {
+				r->err = 1;
+				break;
+			}
+		} else if (type != BIN_COL_STR) {
+			r->err = 1;
+			break;
+		}
+
+		if (get_bytes(r, bits, nbits) < 0) {
+			break;
+		}
+
+		val = 0;
+		last = NULL;
+
+		for (i = 0; i < nrec && !r->err; i++) {
+			if (!(bits[i / 8] & (1 << (i % 8)))) {
+				continue;
+			}
+
+			if (type == BIN_COL_NUM) {
+				val += get_int(r);
+				vals[i * ncols + col] = num_format(val, decimals);
+				continue;
+			}
+
+			len = get_uint(r);
+
+			if (len == 0 && last) {
+				vals[i * ncols + col] = xstrdup(last);
+			} else if (len == 0 || len - 1 > BIN_MAX_STR) {
+				r->err = 1;
+			} else {
+				vals[i * ncols + col] = xmalloc((size_t)len);
+				if (get_bytes(r, vals[i * ncols + col], (size_t)len - 1) == 0) {
+					vals[i * ncols + col][len - 1] = '\0';
+				} else {
+					vals[i * ncols + col][0] = '\0';
+				}
+			}
+
+			last = vals[i * ncols + col];
+		}
+	}
+
+	free(bits);
+
+	return r->err ? -1 : 0;
+}
+
+/* the payload (len bytes) of a block, inflated from zlen bytes for a
+ * deflated one; NULL with *err set if it can't be had */
+static unsigned char *block_payload(binread_t *r, int tag,
+	uint64_t len, uint64_t zlen, int *err)
+{
+	unsigned char	*payload = xmalloc((size_t)len ? (size_t)len : 1);
+#ifdef WITH_ZLIB
+	unsigned char	*zipped;
+	uLongf	outlen = (uLongf)len;
+#endif
+
+	if (tag == BIN_TAG_BLOCK) {
+		if (get_bytes(r, payload, (size_t)len) < 0) {
+			/* cut short, as when the writer was interrupted */
+			free(payload);
+			*err = -1;
+			return NULL;
+		}
+
+		return payload;
+	}
+
+#ifdef WITH_ZLIB
+	zipped = xmalloc((size_t)zlen ? (size_t)zlen : 1);
+
+	if (get_bytes(r, zipped, (size_t)zlen) < 0
+	 || uncompress(payload, &outlen, zipped, (uLong)zlen) != Z_OK
+	 || outlen != len
+	) {
+		free(zipped);
+		free(payload);
+		*err = -1;
+		return NULL;
+	}
+
+	free(zipped);
+
+	return payload;
+#else
+	NUT_UNUSED_VARIABLE(r);
+	NUT_UNUSED_VARIABLE(zlen);
+
+	free(payload);
+	*err = UPSLOG_BIN_ERR_NOZLIB;
+	return NULL;
+#endif
+}
+
+int upslog_bin_read(FILE *f, upslog_bin_header_cb_t header_cb,
+	upslog_bin_record_cb_t record_cb, void *arg)
+{
+	binread_t	fr = { NULL, NULL, NULL, 0 }, br;
+	upslog_bin_header_t	hdr;
+	unsigned char	*payload;
+	uint64_t	nrec, len, zlen;
+	time_t	*times;
+	char	**vals;
+	size_t	i, n;
+	int	tag, ret = 0, have_header = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	fr.f = f;
+
+	while ((tag = fgetc(f)) != EOF) {
+		if (tag == BIN_TAG_HEADER) {
+			if (header_read(&fr, &hdr) < 0) {
+				ret = -1;
+				break;
+			}
+
+			have_header = 1;
+			if (header_cb) {
+				header_cb(arg, &hdr);
+			}
+			continue;
+		}
+
+		nrec = get_uint(&fr);
+		len = get_uint(&fr);
+		zlen = (tag == BIN_TAG_ZBLOCK) ? get_uint(&fr) : 0;
+
+		if ((tag != BIN_TAG_BLOCK && tag != BIN_TAG_ZBLOCK)
+		 || !have_header || fr.err
+		 || nrec == 0 || nrec > BIN_MAX_RECS
+		 || len > BIN_MAX_BLOCK || zlen > BIN_MAX_BLOCK
+		) {
+			ret = -1;
+			break;
+		}
+
+		if ((payload = block_payload(&fr, tag, len, zlen, &ret)) == NULL) {
+			break;
+		}
+
+		n = (size_t)nrec * (hdr.ncols ? hdr.ncols : 1);
+		times = xcalloc((size_t)nrec, sizeof(*times));
+		vals = xcalloc(n, sizeof(*vals));
+
+		br.f = NULL;
+		br.p = payload;
+		br.end = payload + len;
+		br.err = 0;
+
+		if (block_read(&br, (size_t)nrec, hdr.ncols, times, vals) < 0) {
+			ret = -1;
+		} else if (record_cb) {
+			for (i = 0; i < (size_t)nrec; i++) {
+				record_cb(arg, times[i], &vals[i * hdr.ncols]);
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			free(vals[i]);
+		}
+		free(vals);
+		free(times);
+		free(payload);
+
+		if (ret < 0) {
+			break;
+		}
+	}
+
+	header_free(&hdr);
+
+	return ret;
+}
@@ -0,0 +1,59 @@
+/* upslogbin.h - compact binary log files of upslog */
+
+#ifndef NUT_UPSLOGBIN_H_SEEN
+#define NUT_UPSLOGBIN_H_SEEN 1
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* records kept in memory before they are written out as one block */
+#define UPSLOG_BIN_BLOCK	64
+
+/* ... unless the oldest of them is that many seconds old */
+#define UPSLOG_BIN_SYNC	60
+
+/* what a binary log says about the upslog run that wrote it */
+typedef struct {
+	char	*format;	/* the text format of the log */
+	char	*upshost;	/* what %UPSHOST% stands for */
+	char	*upsname;
+	char	*hostname;	/* what %HOST% stands for */
+	long	pid;	/* what %PID% stands for */
+	size_t	ncols;	/* one column per %VAR variable */
+	char	**names;
+} upslog_bin_header_t;
+
+typedef struct upslog_bin_s	upslog_bin_t;
+
+/* writing: records are buffered and written out (and synced) by blocks */
+upslog_bin_t *upslog_bin_open(FILE *f, const upslog_bin_header_t *hdr);
+int upslog_bin_add(upslog_bin_t *bin, time_t when, char **vals);
+int upslog_bin_flush(upslog_bin_t *bin);
+int upslog_bin_restart(upslog_bin_t *bin, FILE *f);
+void upslog_bin_close(upslog_bin_t *bin);
+
+/* reading: the callbacks get each header and each record in turn;
+ * vals[i] is NULL where the value was not available; returns 0, -1 if
+ * the file is damaged or cut short, or UPSLOG_BIN_ERR_NOZLIB if it has
+ * deflated blocks and this build has no zlib */
+#define UPSLOG_BIN_ERR_NOZLIB	(-2)
+
+typedef void (*upslog_bin_header_cb_t)(void *arg, const upslog_bin_header_t *hdr);
+typedef void (*upslog_bin_record_cb_t)(void *arg, time_t when, char **vals);
+
+int upslog_bin_read(FILE *f, upslog_bin_header_cb_t header_cb,
+	upslog_bin_record_cb_t record_cb, void *arg);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_UPSLOGBIN_H_SEEN */
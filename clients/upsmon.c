@@ -27,23 +27,43 @@
 #ifndef WIN32
 # include <sys/wait.h>
 # include <sys/socket.h>
+# include <sys/un.h>
+# include <netinet/in.h>
+# include <netdb.h>
 # include <unistd.h>
 # include <fcntl.h>
+# include <limits.h>
+# ifdef HAVE_SPAWN_H
+#  include <spawn.h>
+# endif
 #else
 # include <wincompat.h>
 #endif
 
 #include "nut_stdint.h"
+#include "nutstatus.h"
+#include "nuthmac.h"
+#include "nutbeacon.h"
 #include "upsclient.h"
 #include "upsmon.h"
 #include "parseconf.h"
 #include "timehead.h"
+#include "nuttrace.h"
+#include "nut_usdt.h"
 
 #ifdef HAVE_STDARG_H
 # include <stdarg.h>
 #endif
 
 static	char	*shutdowncmd = NULL, *notifycmd = NULL;
+
+	/* identical notifications (same type, UPS and text) coming again
+	 * within so many seconds are only delivered once (0 = all are) */
+static	unsigned int	notifyratelimit = 0;
+
+	/* socket of a upssched daemon to stream EXEC events to, instead of
+	 * running NOTIFYCMD (which should then be upssched) for each */
+static	char	*upsschedpipe = NULL;
 static	char	*powerdownflag = NULL, *configfile = NULL;
 
 static	unsigned int	minsupplies = 1, sleepval = 5;
@@ -51,12 +71,56 @@ static	unsigned int	minsupplies = 1, sleepval = 5;
 	/* sum of all power values from config file */
 static	unsigned int	totalpv = 0;
 
+	/* sum of power values of the UPSes not critical now, kept up to
+	 * date by recalc() as their verdicts change */
+static	unsigned int	val_ol = 0;
+
 	/* default TTL of a device gone AWOL, 3 x polling interval = 15 sec */
 static	int deadtime = 15;
 
 	/* default polling interval = 5 sec */
 static	unsigned int	pollfreq = 5, pollfreqalert = 5;
 
+	/* If the server supports WATCH, changes of ups.status are pushed
+	 * to us as they happen, and a fully online UPS is only polled for
+	 * liveness every so many seconds (0 = never watch, always poll).
+	 * A UPS in any other state is polled every POLLFREQALERT as usual.
+	 */
+static	unsigned int	watchheartbeat = 30;
+
+#ifndef WIN32
+	/* With BEACON, upsd tells the status of its UPSes in signed UDP
+	 * datagrams as soon as it changes (see server/beacon.c), and we act
+	 * upon them as they come.  While they keep coming, a fully online
+	 * UPS is only polled every WATCHHEARTBEAT seconds, as if watched;
+	 * the TCP connection is still what LOGIN and FSD go over.
+	 */
+typedef struct beacon_listener_s {
+	char	*addr;
+	char	*port;
+	int	fd;		/* -1 until opened */
+	int	failed;		/* complained about it already */
+	struct beacon_listener_s	*next;
+} beacon_listener_t;
+
+	/* what was last taken from each upsd, to refuse replays */
+typedef struct beacon_source_s {
+	struct sockaddr_storage	addr;
+	uint32_t	id, seq;
+	uint64_t	when;
+	struct beacon_source_s	*next;
+} beacon_source_t;
+
+static	beacon_listener_t	*beacon_listeners = NULL;
+static	beacon_source_t	*beacon_sources = NULL;
+static	char	*beaconkey = NULL;
+
+	/* beacons sent longer ago than that (by our clock) are refused */
+# define BEACON_MAXSKEW	60
+	/* and the status they tell holds for so many of their intervals */
+# define BEACON_MISSED	3
+#endif	/* !WIN32 */
+
 	/* If pollfail_log_throttle_max > 0, error messages for same
 	 * state of an UPS (e.g. "Data stale" or "Driver not connected")
 	 * will only be repeated every so many POLLFREQ loops.
@@ -178,6 +242,15 @@ static int nut_debug_level_args = 0;
 
 /* pre-declare internal methods */
 static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize);
+static void pollups_wait(void (*finish)(utype_t *ups));
+static void ups_free(utype_t *ups);
+
+/* the servers which tell about ups: the one of its MONITOR line, then
+ * the one of its MONITORALT line if any (see addalt()) */
+static utype_t *source_next(utype_t *ups, utype_t *src)
+{
+	return (src == ups) ? (utype_t *)ups->alt : NULL;
+}
 
 static void setflag(int *val, int flag)
 {
@@ -290,73 +363,617 @@ static unsigned __stdcall async_notify(LPVOID param)
 }
 #endif
 
-static void notify(const char *notice, int flags, const char *ntype,
-			const char *upsname)
-{
 #ifndef WIN32
-	char	exec[LARGEBUF];
-	int	ret;
-#endif
+/* Notifications are handed over through a pipe to a long-lived helper
+ * process (the notifier), which delivers them one after another, so a
+ * slow NOTIFYCMD does not wedge upsmon, and a storm of power events does
+ * not cost a fork for each of them. */
 
-	upsdebugx(6, "%s: sending notification for [%s]: type %s with flags 0x%04x: %s",
-		__func__, upsname ? upsname : "upsmon itself", ntype, flags, notice);
+/* a notification as written to the notifier: this header, then the type,
+ * UPS name and text, each with its NUL byte; the whole record is kept
+ * within PIPE_BUF bytes, so it is written at once or not at all */
+typedef struct notifier_msg_s {
+	int	flags;
+	size_t	len;		/* of the strings following	*/
+} notifier_msg_t;
 
-	if (flag_isset(flags, NOTIFY_IGNORE)) {
-		upsdebugx(6, "%s: NOTIFY_IGNORE", __func__);
+/* a notification received by the notifier */
+typedef struct notifier_item_s {
+	int	flags;
+	const char	*ntype, *upsname, *notice;
+	char	buf[PIPE_BUF];
+} notifier_item_t;
+
+	/* how many notifications the notifier reads and handles at once */
+#define NOTIFIER_BATCH	32
+
+	/* report the backlog of the notifier when it grows beyond this */
+#define NOTIFIER_BACKLOG_WARN	(4 * NOTIFIER_BATCH)
+
+static	pid_t	notifier_pid = -1;
+static	int	notifier_fd = -1;
+
+	/* sent since start, and lost because the pipe was full */
+static	size_t	notifier_sent = 0, notifier_dropped = 0;
+
+extern	char	**environ;
+
+static void notifier_stop(void)
+{
+	if (notifier_fd < 0)
 		return;
+
+	/* the notifier delivers what it still has, and exits on EOF; it is
+	 * reaped with the other children in the main loop */
+	upsdebugx(2, "%s: closing the pipe to notifier [%" PRIiMAX "]",
+		__func__, (intmax_t)notifier_pid);
+	close(notifier_fd);
+	notifier_fd = -1;
+	notifier_pid = -1;
+}
+
+/* hand an event over to the upssched daemon through the connection
+ * kept by the notifier: returns 0 if done, -1 to run NOTIFYCMD instead
+ * (which is upssched, and starts the daemon if it is not running) */
+static int notifier_upssched(const notifier_item_t *n)
+{
+	static	int	fd = -1;
+	struct	sockaddr_un	sa;
+	char	buf[SMALLBUF], enc1[SMALLBUF], enc2[SMALLBUF];
+	size_t	len, got = 0;
+	ssize_t	ret;
+	fd_set	rfds;
+	struct	timeval	tv;
+
+	if (fd < 0) {
+		memset(&sa, '\0', sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if (strlen(upsschedpipe) >= sizeof(sa.sun_path))
+			return -1;
+		snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", upsschedpipe);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+
+		if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+			upsdebug_with_errno(2, "%s: no upssched daemon at %s yet",
+				__func__, upsschedpipe);
+			close(fd);
+			fd = -1;
+			return -1;
+		}
+
+		set_close_on_exec(fd);
+		upsdebugx(2, "%s: connected to upssched at %s", __func__, upsschedpipe);
 	}
 
-	if (flag_isset(flags, NOTIFY_SYSLOG)) {
-		upsdebugx(6, "%s: NOTIFY_SYSLOG (as LOG_NOTICE)", __func__);
-		upslogx(LOG_NOTICE, "%s", notice);
+	snprintf(buf, sizeof(buf), "EVENT \"%s\" \"%s\"\n",
+		pconf_encode(n->upsname, enc1, sizeof(enc1)),
+		pconf_encode(n->ntype, enc2, sizeof(enc2)));
+	len = strlen(buf);
+
+	ret = write(fd, buf, len);
+	if (ret != (ssize_t)len)
+		goto fail;
+
+	/* the daemon confirms once it handled the event */
+	while (got < sizeof(buf) - 1 && !memchr(buf, '\n', got)) {
+		FD_ZERO(&rfds);
+		FD_SET(fd, &rfds);
+		tv.tv_sec = NET_TIMEOUT;
+		tv.tv_usec = 0;
+
+		ret = select(fd + 1, &rfds, NULL, NULL, &tv);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			goto fail;
+
+		ret = read(fd, buf + got, sizeof(buf) - 1 - got);
+		if (ret <= 0)
+			goto fail;
+
+		got += (size_t)ret;
 	}
 
-#ifndef WIN32
-	/* fork here so upsmon doesn't get wedged if the notifier is slow */
-	ret = fork();
+	if (got >= 2 && !strncmp(buf, "OK", 2)) {
+		upsdebugx(6, "%s: upssched handled %s for [%s]",
+			__func__, n->ntype, n->upsname);
+		return 0;
+	}
 
-	if (ret < 0) {
-		upslog_with_errno(LOG_ERR, "Can't fork to notify");
-		return;
+fail:
+	upsdebugx(1, "%s: lost the connection to upssched, "
+		"running NOTIFYCMD instead", __func__);
+	close(fd);
+	fd = -1;
+	return -1;
+}
+
+/* run NOTIFYCMD for one notification, and wait for it */
+static void notifier_exec(const notifier_item_t *n)
+{
+	char	cmd[LARGEBUF], *argv[32], *word;
+	size_t	argc = 0;
+	pid_t	pid;
+	int	ret, status;
+
+	setenv("UPSNAME", n->upsname, 1);
+	setenv("NOTIFYTYPE", n->ntype, 1);
+
+	if (strpbrk(notifycmd, "|&;<>()$`\\\"'*?[]#~=%{}\n")) {
+		/* shell syntax: let it have the text as a safely quoted
+		 * argument rather than spliced into the command line */
+		snprintf(cmd, sizeof(cmd), "%s \"$1\"", notifycmd);
+		argv[argc++] = "/bin/sh";
+		argv[argc++] = "-c";
+		argv[argc++] = cmd;
+		argv[argc++] = "sh";
+	} else {
+		/* just a program and its options */
+		snprintf(cmd, sizeof(cmd), "%s", notifycmd);
+		for (word = strtok(cmd, " \t"); word && argc < SIZEOF_ARRAY(argv) - 2;
+			word = strtok(NULL, " \t")
+		) {
+			argv[argc++] = word;
+		}
+
+		if (argc == 0)
+			return;
 	}
 
-	if (ret != 0) {	/* parent */
-		upsdebugx(6, "%s (parent): forked a child to notify via subprocesses", __func__);
+	argv[argc++] = (char *)n->notice;
+	argv[argc] = NULL;
+
+	upsdebugx(6, "%s: NOTIFY_EXEC: calling NOTIFYCMD as '%s \"%s\"'",
+		__func__, notifycmd, n->notice);
+
+#if (defined HAVE_SPAWN_H) && (defined HAVE_POSIX_SPAWNP)
+	ret = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+	if (ret != 0) {
+		errno = ret;
+		upslog_with_errno(LOG_ERR, "%s: can't run NOTIFYCMD", __func__);
 		return;
 	}
+#else
+	pid = fork();
+	if (pid < 0) {
+		upslog_with_errno(LOG_ERR, "%s: can't fork", __func__);
+		return;
+	}
+
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		_exit(EXIT_FAILURE);
+	}
+#endif
 
-	/* child continues and does all the work */
-	upsdebugx(6, "%s (child): forked to notify via subprocesses", __func__);
+	while ((ret = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+		;
 
-	if (flag_isset(flags, NOTIFY_WALL)) {
-		upsdebugx(6, "%s (child): NOTIFY_WALL", __func__);
-		wall(notice);
+	if (ret == pid && WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		upsdebugx(1, "%s: NOTIFYCMD exited with code %d",
+			__func__, WEXITSTATUS(status));
 	}
+}
 
-	if (flag_isset(flags, NOTIFY_EXEC)) {
-		if (notifycmd != NULL) {
-			upsdebugx(6, "%s (child): NOTIFY_EXEC: calling NOTIFYCMD as '%s \"%s\"'",
-				__func__, notifycmd, notice);
+/* what NOTIFYRATELIMIT holds back for a UPS: the latest repeated
+ * notification, delivered when its time comes unless it is the same
+ * as the last one delivered, so the final state is never missed */
+typedef struct notifier_held_s {
+	char	*upsname;
+	uint32_t	last;		/* hash of the last one delivered	*/
+	notifier_item_t	*held;		/* the latest one held back, if any	*/
+	time_t	until;			/* when to deliver it		*/
+	struct notifier_held_s	*next;
+} notifier_held_t;
 
-			snprintf(exec, sizeof(exec), "%s \"%s\"", notifycmd, notice);
+static	notifier_held_t	*notifier_helds = NULL;
 
-			if (upsname)
-				setenv("UPSNAME", upsname, 1);
-			else
-				setenv("UPSNAME", "", 1);
+static uint32_t notifier_hash(const notifier_item_t *n)
+{
+	const char	*strs[3], *c;
+	uint32_t	hash = 2166136261U;	/* FNV-1a */
+	size_t	i;
+
+	strs[0] = n->ntype;
+	strs[1] = n->upsname;
+	strs[2] = n->notice;
+
+	for (i = 0; i < SIZEOF_ARRAY(strs); i++) {
+		for (c = strs[i]; ; c++) {
+			hash = (hash ^ (unsigned char)*c) * 16777619U;
+			if (*c == '\0')
+				break;
+		}
+	}
 
-			setenv("NOTIFYTYPE", ntype, 1);
-			if (system(exec) == -1) {
-				upslog_with_errno(LOG_ERR, "%s", __func__);
+	return hash;
+}
+
+/* was the same notification delivered less than NOTIFYRATELIMIT ago?
+ * if not, it is about to be, so remember that */
+static int notifier_repeated(uint32_t hash, time_t now)
+{
+	static struct {
+		uint32_t	hash;
+		time_t	when;
+	}	seen[64];
+	size_t	slot = hash % SIZEOF_ARRAY(seen);
+
+	if (seen[slot].hash == hash && seen[slot].when <= now
+	&& (now - seen[slot].when) < (time_t)notifyratelimit
+	) {
+		return 1;
+	}
+
+	seen[slot].hash = hash;
+	seen[slot].when = now;
+	return 0;
+}
+
+static notifier_held_t *notifier_held_get(const char *upsname)
+{
+	notifier_held_t	*h;
+
+	for (h = notifier_helds; h; h = h->next) {
+		if (!strcmp(h->upsname, upsname))
+			return h;
+	}
+
+	h = xcalloc(1, sizeof(*h));
+	h->upsname = xstrdup(upsname);
+	h->next = notifier_helds;
+	notifier_helds = h;
+
+	return h;
+}
+
+/* read one notification from the pipe: 1 if done, 0 on EOF, -1 on errors */
+static int notifier_read(int fd, notifier_item_t *n)
+{
+	notifier_msg_t	hdr;
+	size_t	got = 0;
+	ssize_t	ret;
+	char	*end;
+
+	/* the records are written at once, so what starts is all there */
+	while (got < sizeof(hdr) + (got >= sizeof(hdr) ? hdr.len : 0)) {
+		if (got < sizeof(hdr))
+			ret = read(fd, (char *)&hdr + got, sizeof(hdr) - got);
+		else
+			ret = read(fd, n->buf + got - sizeof(hdr), sizeof(hdr) + hdr.len - got);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return (ret == 0 && got == 0) ? 0 : -1;
+
+		got += (size_t)ret;
+
+		if (got == sizeof(hdr) && (hdr.len < 3 || hdr.len > sizeof(n->buf)))
+			return -1;
+	}
+
+	/* three strings, each terminated */
+	n->flags = hdr.flags;
+	n->ntype = n->buf;
+	end = n->buf + hdr.len;
+	if (end[-1] != '\0'
+	|| (n->upsname = memchr(n->ntype, '\0', (size_t)(end - n->ntype))) == NULL
+	|| ++n->upsname >= end
+	|| (n->notice = memchr(n->upsname, '\0', (size_t)(end - n->upsname))) == NULL
+	|| ++n->notice >= end
+	) {
+		return -1;
+	}
+
+	return 1;
+}
+
+/* deliver some notifications, with one wall for all of them */
+static void notifier_deliver(notifier_item_t **items, size_t count)
+{
+	char	text[LARGEBUF];
+	size_t	i, len = 0;
+	int	ret;
+
+	text[0] = '\0';
+	for (i = 0; i < count; i++) {
+		if (flag_isset(items[i]->flags, NOTIFY_WALL) && len < sizeof(text)) {
+			ret = snprintf(text + len, sizeof(text) - len, "%s%s",
+				len ? "\n" : "", items[i]->notice);
+			if (ret > 0)
+				len += (size_t)ret;
+		}
+	}
+
+	if (len > 0) {
+		upsdebugx(6, "%s: NOTIFY_WALL", __func__);
+		wall(text);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!flag_isset(items[i]->flags, NOTIFY_EXEC))
+			continue;
+
+		if (upsschedpipe && notifier_upssched(items[i]) == 0)
+			continue;
+
+		if (notifycmd == NULL) {
+			upsdebugx(6, "%s: NOTIFY_EXEC: no NOTIFYCMD was configured", __func__);
+			continue;
+		}
+
+		notifier_exec(items[i]);
+	}
+}
+
+/* main loop of the notifier: deliver the notifications in batches of
+ * those which are there already, until upsmon closes the pipe */
+static void notifier_run(int fd)
+{
+	notifier_item_t	*items, *due[NOTIFIER_BATCH];
+	notifier_held_t	*h;
+	size_t	count, ndue, i, backlog = 0;
+	fd_set	rfds;
+	struct	timeval	tv;
+	int	ret, done = 0, warned = 0;
+	uint32_t	hash;
+	time_t	now, next;
+
+	items = xcalloc(NOTIFIER_BATCH, sizeof(*items));
+
+	while (!done) {
+		/* wait for one (or for the first held one to be due), and
+		 * take all those which follow it */
+		next = 0;
+		for (h = notifier_helds; h; h = h->next) {
+			if (h->held && (next == 0 || h->until < next))
+				next = h->until;
+		}
+
+		for (count = 0; count < NOTIFIER_BATCH; count++) {
+			if (count > 0 || next > 0) {
+				FD_ZERO(&rfds);
+				FD_SET(fd, &rfds);
+				time(&now);
+				tv.tv_sec = (count == 0 && next > now) ? (next - now) : 0;
+				tv.tv_usec = 0;
+
+				/* nothing (more) now, or interrupted: go
+				 * on with what there is, and wait again */
+				if (select(fd + 1, &rfds, NULL, NULL, &tv) <= 0)
+					break;
 			}
-		} else {
-			upsdebugx(6, "%s (child): NOTIFY_EXEC: no NOTIFYCMD was configured", __func__);
+
+			ret = notifier_read(fd, &items[count]);
+			if (ret <= 0) {
+				if (ret < 0)
+					upslog_with_errno(LOG_ERR, "%s: bad notification record", __func__);
+				done = 1;
+				break;
+			}
+		}
+
+		/* full batches in a row tell there is more queued */
+		if (count == NOTIFIER_BATCH)
+			backlog += count;
+		else
+			backlog = count;
+
+		upsdebugx(3, "%s: handling %" PRIuSIZE " notifications, at least %"
+			PRIuSIZE " were queued", __func__, count, backlog);
+
+		if (backlog > NOTIFIER_BACKLOG_WARN && !warned) {
+			upslogx(LOG_WARNING, "Notifier is falling behind: "
+				"at least %" PRIuSIZE " notifications queued", backlog);
+			warned = 1;
+		} else if (backlog <= NOTIFIER_BATCH) {
+			warned = 0;
+		}
+
+		time(&now);
+
+		for (i = 0, ndue = 0; i < count; i++) {
+			if (notifyratelimit == 0) {
+				due[ndue++] = &items[i];
+				continue;
+			}
+
+			hash = notifier_hash(&items[i]);
+			h = notifier_held_get(items[i].upsname);
+
+			if (!notifier_repeated(hash, now)) {
+				/* anything held back for this UPS is older */
+				free(h->held);
+				h->held = NULL;
+				h->last = hash;
+				due[ndue++] = &items[i];
+				continue;
+			}
+
+			upsdebugx(2, "%s: holding back [%s], repeated too soon",
+				__func__, items[i].notice);
+
+			if (!h->held) {
+				h->held = xmalloc(sizeof(*h->held));
+				h->until = now + (time_t)notifyratelimit;
+			}
+
+			/* the strings point into the copied buffer */
+			*h->held = items[i];
+			h->held->ntype = h->held->buf + (items[i].ntype - items[i].buf);
+			h->held->upsname = h->held->buf + (items[i].upsname - items[i].buf);
+			h->held->notice = h->held->buf + (items[i].notice - items[i].buf);
+		}
+
+		notifier_deliver(due, ndue);
+
+		/* the latest of those held back, when their time comes */
+		for (h = notifier_helds; h; h = h->next) {
+			if (!h->held || (h->until > now && !done))
+				continue;
+
+			hash = notifier_hash(h->held);
+			if (hash != h->last) {
+				notifier_repeated(hash, now);
+				h->last = hash;
+				due[0] = h->held;
+				notifier_deliver(due, 1);
+			}
+
+			free(h->held);
+			h->held = NULL;
 		}
 	}
 
-	upsdebugx(6, "%s (child): exiting after notifications", __func__);
+	upsdebugx(2, "%s: exiting, upsmon closed the pipe", __func__);
+	free(items);
+}
 
-	exit(EXIT_SUCCESS);
+/* start the notifier, which gets the current settings */
+static int notifier_start(void)
+{
+	int	pfd[2];
+	pid_t	pid;
+	utype_t	*ups, *src;
+
+	if (pipe(pfd) < 0) {
+		upslog_with_errno(LOG_ERR, "Can't create a pipe to notify");
+		return -1;
+	}
+
+	pid = fork();
+
+	if (pid < 0) {
+		upslog_with_errno(LOG_ERR, "Can't fork to notify");
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		/* do not keep anything open which others wait to see closed */
+		close(pfd[1]);
+		if (use_pipe)
+			close(pipefd[1]);
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			for (src = ups; src != NULL; src = source_next(ups, src)) {
+				if (upscli_fd(&src->conn) >= 0)
+					close(upscli_fd(&src->conn));
+			}
+		}
+
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGUSR1, SIG_IGN);
+		signal(SIGUSR2, SIG_IGN);
+		signal(SIGCHLD, SIG_DFL);
+
+		notifier_run(pfd[0]);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(pfd[0]);
+
+	/* never wait for the notifier: rather lose a notification */
+	fcntl(pfd[1], F_SETFL, fcntl(pfd[1], F_GETFL) | O_NONBLOCK);
+	set_close_on_exec(pfd[1]);
+
+	upsdebugx(2, "%s: notifier [%" PRIiMAX "] started",
+		__func__, (intmax_t)pid);
+
+	notifier_fd = pfd[1];
+	notifier_pid = pid;
+	return 0;
+}
+
+/* hand a notification over to the notifier, starting it if needed */
+static void notifier_send(const char *notice, int flags, const char *ntype,
+			const char *upsname)
+{
+	char	buf[PIPE_BUF];
+	notifier_msg_t	hdr;
+	size_t	lt, lu, ln, max = sizeof(buf) - sizeof(hdr);
+	ssize_t	ret;
+	int	tries;
+
+	lt = strlen(ntype) + 1;
+	lu = strlen(NUT_STRARG(upsname)) + 1;
+	ln = strlen(notice) + 1;
+
+	/* a huge text would be cut, anything else is small */
+	if (lt + lu + 1 > max)
+		return;
+	if (lt + lu + ln > max)
+		ln = max - lt - lu;
+
+	hdr.flags = flags;
+	hdr.len = lt + lu + ln;
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), ntype, lt);
+	memcpy(buf + sizeof(hdr) + lt, NUT_STRARG(upsname), lu);
+	memcpy(buf + sizeof(hdr) + lt + lu, notice, ln);
+	buf[sizeof(hdr) + hdr.len - 1] = '\0';
+
+	for (tries = 0; tries < 2; tries++) {
+		if (notifier_fd < 0 && notifier_start() < 0)
+			return;
+
+		ret = write(notifier_fd, buf, sizeof(hdr) + hdr.len);
+
+		if (ret == (ssize_t)(sizeof(hdr) + hdr.len)) {
+			notifier_sent++;
+			upsdebugx(6, "%s: queued for notifier [%" PRIiMAX "] (%"
+				PRIuSIZE " sent, %" PRIuSIZE " dropped so far)",
+				__func__, (intmax_t)notifier_pid,
+				notifier_sent, notifier_dropped);
+			return;
+		}
+
+		if (ret < 0 && errno == EINTR) {
+			tries--;
+			continue;
+		}
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			notifier_dropped++;
+			upslogx(LOG_ERR, "Notifier is stuck, lost a notification "
+				"(%" PRIuSIZE " so far): %s",
+				notifier_dropped, notice);
+			return;
+		}
+
+		/* the notifier is gone, try with a new one */
+		upslog_with_errno(LOG_WARNING, "Notifier [%" PRIiMAX "] is gone",
+			(intmax_t)notifier_pid);
+		notifier_stop();
+	}
+}
+#endif	/* !WIN32 */
+
+static void notify(const char *notice, int flags, const char *ntype,
+			const char *upsname)
+{
+	upsdebugx(6, "%s: sending notification for [%s]: type %s with flags 0x%04x: %s",
+		__func__, upsname ? upsname : "upsmon itself", ntype, flags, notice);
+
+	if (flag_isset(flags, NOTIFY_IGNORE)) {
+		upsdebugx(6, "%s: NOTIFY_IGNORE", __func__);
+		return;
+	}
+
+	if (flag_isset(flags, NOTIFY_SYSLOG)) {
+		upsdebugx(6, "%s: NOTIFY_SYSLOG (as LOG_NOTICE)", __func__);
+		upslogx(LOG_NOTICE, "%s", notice);
+	}
+
+#ifndef WIN32
+	/* the notifier runs them so upsmon doesn't get wedged if slow */
+	if (flag_isset(flags, NOTIFY_WALL) || flag_isset(flags, NOTIFY_EXEC))
+		notifier_send(notice, flags, ntype, upsname);
 #else
 	async_notify_t * data;
 	time_t t;
@@ -389,6 +1006,8 @@ static void do_notify(const utype_t *ups, int ntype, const char *extra)
 	if (ups)
 		upsname = ups->sys;
 
+	NUT_TRACE2(NUT_TRACE_UPSMON_EVENT, ntype, 0, upsname, extra);
+
 	for (i = 0; notifylist[i].name != NULL; i++) {
 		if (notifylist[i].type == ntype) {
 			const char	*msgfmt = (notifylist[i].msg ? notifylist[i].msg : notifylist[i].stockmsg);
@@ -661,6 +1280,18 @@ static void ups_is_gone(utype_t *ups)
 	}
 }
 
+/* a server did not tell the status of its UPS: with MONITORALT, the UPS
+ * is gone only if the other one did not either (see pollups_all()) */
+static void source_is_gone(utype_t *src)
+{
+	if (src->alt || src->owner) {
+		upsdebugx(2, "%s: UPS [%s]: no status from this server", __func__, src->sys);
+		return;
+	}
+
+	ups_is_gone(src);
+}
+
 static void ups_is_off(utype_t *ups)
 {
 	time_t	now;
@@ -862,6 +1493,7 @@ static void ups_on_batt(utype_t *ups)
 	ups->linestate = 0;
 
 	upsdebugx(3, "%s: %s (first time)", __func__, ups->sys);
+	NUT_USDT1(upsmon_onbatt, ups->upsname);
 
 	/* must have changed from OL to OB, so notify */
 
@@ -915,6 +1547,8 @@ static void doshutdown(void)
 
 static void doshutdown(void)
 {
+	NUT_USDT0(upsmon_shutdown);
+
 	upsnotify(NOTIFY_STATE_STOPPING, "Executing automatic power-fail shutdown");
 
 	/* this should probably go away at some point */
@@ -1066,18 +1700,16 @@ static void clear_alarm(void)
 #endif
 }
 
-static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
+/* fill the query for get_var(), returns its length or 0 on errors */
+static size_t get_var_query(utype_t *ups, const char *var, const char **query)
 {
-	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
+	size_t	numq;
 
 	/* this shouldn't happen */
 	if (!ups->upsname) {
 		upslogx(LOG_ERR, "get_var: programming error: no UPS name set [%s]",
 			ups->sys);
-		return -1;
+		return 0;
 	}
 
 	numq = 0;
@@ -1105,13 +1737,17 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 
 	if (numq == 0) {
 		upslogx(LOG_ERR, "get_var: programming error: var=%s", var);
-		return -1;
+		return 0;
 	}
 
-	upsdebugx(3, "%s: %s / %s", __func__, ups->sys, var);
-
-	ret = upscli_get(&ups->conn, numq, query, &numa, &answer);
+	return numq;
+}
 
+/* check the answer (or failure 'ret') to a get_var() query, and copy
+ * the value into buf */
+static int get_var_value(utype_t *ups, const char *var, int ret,
+	size_t numq, size_t numa, char **answer, char *buf, size_t bufsize)
+{
 	if (ret < 0) {
 
 		/* detect old upsd */
@@ -1137,46 +1773,96 @@ static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
 	return 0;
 }
 
+static int get_var(utype_t *ups, const char *var, char *buf, size_t bufsize)
+{
+	int	ret;
+	size_t	numq, numa = 0;
+	const	char	*query[4];
+	char	**answer = NULL;
+
+	numq = get_var_query(ups, var, query);
+
+	if (numq == 0) {
+		return -1;
+	}
+
+	upsdebugx(3, "%s: %s / %s", __func__, ups->sys, var);
+
+	ret = upscli_get(&ups->conn, numq, query, &numa, &answer);
+
+	return get_var_value(ups, var, ret, numq, numa, answer, buf, bufsize);
+}
+
 /* Called by upsmon which is the primary on some UPS(es) to wait
  * until all secondaries log out from it on the shared upsd server
  * or the HOSTSYNC timeout expires
  */
-static void sync_secondaries(void)
+/* highest login count seen by sync_finish() in this round */
+static long	sync_maxlogins;
+
+/* handle the answer to the login count query sent by sync_secondaries() */
+static void sync_finish(utype_t *ups)
 {
-	utype_t	*ups;
 	char	temp[SMALLBUF];
+	int	ret;
+	long	logins;
+	const	char	*query[4];
+	size_t	numq, numa = 0;
+	char	**answer = NULL;
+
+	numq = get_var_query(ups, "numlogins", query);
+
+	set_alarm();
+	ret = upscli_get_recv(&ups->conn, numq, query, &numa, &answer);
+	clear_alarm();
+
+	if (get_var_value(ups, "numlogins", ret, numq, numa, answer, temp, sizeof(temp)) >= 0) {
+		logins = strtol(temp, (char **)NULL, 10);
+
+		if (logins > sync_maxlogins)
+			sync_maxlogins = logins;
+	}
+}
+
+static void sync_secondaries(void)
+{
+	utype_t	*ups, *src;
+	const	char	*query[4];
+	size_t	numq;
 	time_t	start, now;
-	long	maxlogins, logins;
 
 	time(&start);
 
 	for (;;) {
-		maxlogins = 0;
+		sync_maxlogins = 0;
 
+		/* ask all servers at once, then take the answers as they come;
+		 * those of MONITORALT have secondaries of their own */
 		for (ups = firstups; ups != NULL; ups = ups->next) {
+			for (src = ups; src != NULL; src = source_next(ups, src)) {
+				src->polling = 0;
 
-			/* only check login count on devices we are the primary for */
-			if (!flag_isset(ups->status, ST_PRIMARY))
-				continue;
-
-			set_alarm();
+				/* only check login count on devices we are the primary for */
+				if (!flag_isset(src->status, ST_PRIMARY))
+					continue;
 
-			if (get_var(ups, "numlogins", temp, sizeof(temp)) >= 0) {
-				logins = strtol(temp, (char **)NULL, 10);
+				numq = get_var_query(src, "numlogins", query);
 
-				if (logins > maxlogins)
-					maxlogins = logins;
+				if (numq > 0 && upscli_get_send(&src->conn, numq, query) == 0) {
+					src->polldeadline = time(NULL) + NET_TIMEOUT;
+					src->polling = 1;
+				}
 			}
-
-			clear_alarm();
 		}
 
+		pollups_wait(sync_finish);
+
 		/* if no UPS has more than 1 login (that would be us),
 		 * then secondaries are all gone */
 		/* TO THINK: how about redundant setups with several primary-mode
 		 * clients managing an UPS, or possibly differend UPSes, with the
 		 * same upsd? */
-		if (maxlogins <= 1)
+		if (sync_maxlogins <= 1)
 			return;
 
 		/* after HOSTSYNC seconds, assume secondaries are stuck - and bail */
@@ -1187,6 +1873,7 @@ static void sync_secondaries(void)
 			return;
 		}
 
+		/* upsd does not tell when logins go away, so ask again soon */
 		usleep(250000);
 	}
 }
@@ -1196,16 +1883,18 @@ static void forceshutdown(void)
 
 static void forceshutdown(void)
 {
-	utype_t	*ups;
+	utype_t	*ups, *src;
 	int	isaprimary = 0;
 
 	upsdebugx(1, "Shutting down any UPSes in PRIMARY mode...");
 
-	/* set FSD on any "primary" UPS entries (forced shutdown in progress) */
+	/* set FSD on any "primary" UPS entries (forced shutdown in progress),
+	 * on each server which tells about them */
 	for (ups = firstups; ups != NULL; ups = ups->next)
 		if (flag_isset(ups->status, ST_PRIMARY)) {
 			isaprimary = 1;
-			setfsd(ups);
+			for (src = ups; src != NULL; src = source_next(ups, src))
+				setfsd(src);
 		}
 
 	/* if we're not a primary on anything, we should shut down now */
@@ -1441,10 +2130,46 @@ static int is_ups_critical(utype_t *ups)
 }
 
 /* recalculate the online power value and see if things are still OK */
+/* the *state fields which is_ups_critical() looks at, in one number */
+static int crit_states(const utype_t *ups)
+{
+	return ((ups->commstate + 1) << 0) | ((ups->linestate + 1) << 2)
+		| ((ups->offstate + 1) << 4) | ((ups->bypassstate + 1) << 6)
+		| ((ups->alarmstate + 1) << 8);
+}
+
+/* does the verdict of is_ups_critical() for this UPS still hold? it
+ * only depends on the status flags and states, unless some timer is
+ * involved: lost communications, OB+LB (HOSTSYNC, OBLBDURATION) */
+static int crit_known(const utype_t *ups)
+{
+	if (ups->critical < 0)
+		return 0;
+
+	if (ups->commstate == 0 || ups->oblbsince > 0
+	|| (flag_isset(ups->status, ST_ONBATT) && flag_isset(ups->status, ST_LOWBATT))
+	) {
+		return 0;
+	}
+
+	return (ups->critflags == ups->status && ups->critstates == crit_states(ups));
+}
+
+/* forget all verdicts, e.g. after power values or settings changed */
+static void recalc_reset(void)
+{
+	utype_t	*ups;
+
+	for (ups = firstups; ups != NULL; ups = ups->next)
+		ups->critical = -1;
+
+	val_ol = 0;
+}
+
 static void recalc(void)
 {
 	utype_t	*ups;
-	unsigned int	val_ol = 0;
+	int	crit;
 	time_t	now;
 
 	time(&now);
@@ -1462,13 +2187,27 @@ static void recalc(void)
 		 * this means a UPS we've never heard from is assumed OL     *
 		 * whether this is really the best thing to do is undecided  */
 
+		/* only look again at UPSes whose status changed meanwhile */
+		if (crit_known(ups)) {
+			ups = ups->next;
+			continue;
+		}
+
 		/* crit = (FSD) || (OB & LB) > HOSTSYNC seconds || (CAL || BYPASS || ALARM || OFF) && nocomms */
 		/* Note: ECO mode not considered easily fatal here */
-		if (is_ups_critical(ups))
+		crit = is_ups_critical(ups);
+		if (crit)
 			upsdebugx(1, "Critical UPS: %s", ups->sys);
-		else
+
+		if (crit && ups->critical == 0)
+			val_ol -= ups->pv;
+		else if (!crit && ups->critical != 0)
 			val_ol += ups->pv;
 
+		ups->critical = crit;
+		ups->critflags = ups->status;
+		ups->critstates = crit_states(ups);
+
 		ups = ups->next;
 	}
 
@@ -1487,6 +2226,7 @@ static void ups_low_batt(utype_t *ups)
 	}
 
 	upsdebugx(3, "%s: %s (first time)", __func__, ups->sys);
+	NUT_USDT1(upsmon_lowbatt, ups->upsname);
 
 	/* must have changed from !LB to LB, so notify */
 
@@ -1574,7 +2314,9 @@ static void drop_connection(utype_t *ups)
 	if(ups->ecostate == 1 || flag_isset(ups->status, ST_ECO))
 		upsdebugx(2, "Disconnected UPS [%s] was last seen in status ECO.", ups->sys);
 
-	ups->commstate = 0;
+	/* the other server of MONITORALT may still tell the status */
+	if (!ups->alt)
+		ups->commstate = 0;
 
 	/* forget poll-failure logging throttling */
 	ups->pollfail_log_throttle_count = -1;
@@ -1583,6 +2325,9 @@ static void drop_connection(utype_t *ups)
 	clearflag(&ups->status, ST_LOGIN);
 	clearflag(&ups->status, ST_CLICONNECTED);
 
+	ups->watching = 0;
+	ups->beaconuntil = 0;
+
 	upscli_disconnect(&ups->conn);
 }
 
@@ -1797,6 +2542,9 @@ static void addups(int reloading, const char *sys, const char *pvs,
 
 	tmp->lastpoll = 0;
 	tmp->lastnoncrit = 0;
+	tmp->watching = 0;
+	tmp->lastheartbeat = 0;
+	tmp->critical = -1;
 	tmp->lastrbwarn = 0;
 	tmp->lastncwarn = 0;
 
@@ -1841,6 +2589,83 @@ static void addups(int reloading, const char *sys, const char *pvs,
 			tmp->sys);
 }
 
+/* MONITORALT <system> <alternate system>: the UPS of a MONITOR line is
+ * served by another upsd too, with the same credentials; both are asked
+ * at once, and the first answer tells the status (see pollups_all()) */
+static void addalt(const char *sys, const char *altsys)
+{
+	utype_t	*ups, *alt;
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		if (!strcmp(ups->sys, sys))
+			break;
+	}
+
+	if (!ups) {
+		upslogx(LOG_WARNING, "Ignoring MONITORALT for UPS [%s] "
+			"without a MONITOR line before it", sys);
+		return;
+	}
+
+	if (!strcmp(ups->sys, altsys)) {
+		upslogx(LOG_WARNING, "Ignoring MONITORALT of UPS [%s] to itself", sys);
+		return;
+	}
+
+	alt = ups->alt;
+
+	if (alt) {
+		/* reloading: keep the connection if nothing changed */
+		if (!strcmp(alt->sys, altsys) && !strcmp(alt->un, ups->un)
+		&&  !strcmp(alt->pw, ups->pw)
+		&&  flag_isset(alt->status, ST_PRIMARY) == flag_isset(ups->status, ST_PRIMARY)
+		) {
+			alt->retain = 1;
+			return;
+		}
+
+		upslogx(LOG_INFO, "UPS [%s]: redefined its other server", ups->sys);
+		drop_connection(alt);
+		ups->alt = NULL;
+		ups_free(alt);
+	}
+
+	alt = xcalloc(1, sizeof(utype_t));
+	alt->sys = xstrdup(altsys);
+	alt->un = xstrdup(ups->un);
+	alt->pw = xstrdup(ups->pw);
+	alt->owner = ups;
+	alt->retain = 1;
+
+	/* only a source of ups->status, the rest is not used */
+	alt->commstate = -1;
+	alt->linestate = -1;
+	alt->offstate = -1;
+	alt->bypassstate = -1;
+	alt->ecostate = -1;
+	alt->alarmstate = -1;
+	alt->pollfail_log_throttle_count = -1;
+	alt->pollfail_log_throttle_state = UPSCLI_ERR_NONE;
+	alt->critical = -1;
+
+	if (flag_isset(ups->status, ST_PRIMARY))
+		setflag(&alt->status, ST_PRIMARY);
+
+	if (upscli_splitname(alt->sys, &alt->upsname, &alt->hostname,
+		&alt->port) != 0 || !alt->upsname
+	) {
+		upslogx(LOG_ERR, "Error: unable to split UPS name [%s], "
+			"ignoring MONITORALT", alt->sys);
+		ups_free(alt);
+		return;
+	}
+
+	ups->alt = alt;
+
+	if (nut_debug_level > -1)
+		upslogx(LOG_INFO, "UPS: %s (also through %s)", ups->sys, alt->sys);
+}
+
 static void set_notifymsg(const char *name, const char *msg)
 {
 	int	i;
@@ -1934,6 +2759,43 @@ static void checkmode(char *cfgentry, char *oldvalue, char *newvalue,
 	upslogx(LOG_WARNING, "You must restart upsmon for this change to work");
 }
 
+#ifndef WIN32
+/* BEACON <address> [<port>]: listen for the beacons there, once we
+ * are in the main loop (see beacon_open()) */
+static void beacon_add(const char *addr, const char *port)
+{
+	beacon_listener_t	*l, **last;
+
+	for (last = &beacon_listeners; *last; last = &(*last)->next);
+
+	l = xcalloc(1, sizeof(*l));
+	l->addr = xstrdup(addr);
+	l->port = xstrdup(port);
+	l->fd = -1;
+	*last = l;
+}
+
+/* forget the listeners and the key (before a reload names them again) */
+static void beacon_free(void)
+{
+	beacon_listener_t	*l, *next;
+
+	for (l = beacon_listeners; l; l = next) {
+		next = l->next;
+		if (l->fd >= 0) {
+			close(l->fd);
+		}
+		free(l->addr);
+		free(l->port);
+		free(l);
+	}
+	beacon_listeners = NULL;
+
+	free(beaconkey);
+	beaconkey = NULL;
+}
+#endif	/* !WIN32 */
+
 /* returns 1 if used, 0 if not, so we can complain about bogus configs */
 static int parse_conf_arg(size_t numargs, char **arg)
 {
@@ -1997,6 +2859,24 @@ static int parse_conf_arg(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* UPSSCHED_PIPEFN <filename> */
+	if (!strcmp(arg[0], "UPSSCHED_PIPEFN")) {
+		free(upsschedpipe);
+		upsschedpipe = xstrdup(arg[1]);
+		return 1;
+	}
+
+	/* NOTIFYRATELIMIT <num> */
+	if (!strcmp(arg[0], "NOTIFYRATELIMIT")) {
+		int inotifyratelimit = atoi(arg[1]);
+		if (inotifyratelimit < 0) {
+			upsdebugx(0, "Ignoring invalid NOTIFYRATELIMIT value: %d", inotifyratelimit);
+		} else {
+			notifyratelimit = (unsigned int)inotifyratelimit;
+		}
+		return 1;
+	}
+
 	/* POLLFREQ <num> */
 	if (!strcmp(arg[0], "POLLFREQ")) {
 		int ipollfreq = atoi(arg[1]);
@@ -2008,6 +2888,36 @@ static int parse_conf_arg(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* WATCHHEARTBEAT <num> */
+	if (!strcmp(arg[0], "WATCHHEARTBEAT")) {
+		int iwatchheartbeat = atoi(arg[1]);
+		if (iwatchheartbeat < 0) {
+			upsdebugx(0, "Ignoring invalid WATCHHEARTBEAT value: %d", iwatchheartbeat);
+		} else {
+			watchheartbeat = (unsigned int)iwatchheartbeat;
+		}
+		return 1;
+	}
+
+	/* BEACON <address> [<port>] */
+	if (!strcmp(arg[0], "BEACON")) {
+#ifndef WIN32
+		beacon_add(arg[1], numargs > 2 ? arg[2] : NUT_BEACON_PORT);
+#else
+		upslogx(LOG_WARNING, "BEACON is not supported on this platform, ignored");
+#endif
+		return 1;
+	}
+
+	/* BEACONKEY <secret> */
+	if (!strcmp(arg[0], "BEACONKEY")) {
+#ifndef WIN32
+		free(beaconkey);
+		beaconkey = xstrdup(arg[1]);
+#endif
+		return 1;
+	}
+
 	/* POLLFREQALERT <num> */
 	if (!strcmp(arg[0], "POLLFREQALERT")) {
 		int ipollfreqalert = atoi(arg[1]);
@@ -2150,6 +3060,12 @@ static int parse_conf_arg(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* MONITORALT <system> <alternate system> */
+	if (!strcmp(arg[0], "MONITORALT")) {
+		addalt(arg[1], arg[2]);
+		return 1;
+	}
+
 	/* CERTIDENT <name> <passwd> */
 	if (!strcmp(arg[0], "CERTIDENT")) {
 		free(certname);
@@ -2248,6 +3164,10 @@ static void loadconfig(void)
 				ups = ups->next;
 			}
 		}
+
+#ifndef WIN32
+		beacon_free();
+#endif
 	}
 
 	while (pconf_file_next(&ctx)) {
@@ -2339,6 +3259,11 @@ static void set_exit_flag(int sig)
 
 static void ups_free(utype_t *ups)
 {
+	if (ups->alt) {
+		drop_connection(ups->alt);
+		ups_free(ups->alt);
+	}
+
 	free(ups->sys);
 	free(ups->upsname);
 	free(ups->hostname);
@@ -2372,9 +3297,14 @@ static void upsmon_cleanup(void)
 		utmp = unext;
 	}
 
+#ifndef WIN32
+	notifier_stop();
+#endif
+
 	free(run_as_user);
 	free(shutdowncmd);
 	free(notifycmd);
+	free(upsschedpipe);
 	free(powerdownflag);
 	free(configfile);
 
@@ -2443,6 +3373,12 @@ static void setup_signals(void)
 
 	sa.sa_handler = set_reload_flag;
 	sigaction(SIGCMD_RELOAD, &sa, NULL);
+
+# ifdef SIGURG
+	/* dump the trace ring, see nuttrace.h */
+	sa.sa_handler = nut_trace_dump_request;
+	sigaction(SIGURG, &sa, NULL);
+# endif
 #else
 	pipe_create(UPSMON_PIPE_NAME);
 #endif
@@ -2467,6 +3403,7 @@ static void update_crittimer(utype_t *ups)
 static int try_connect(utype_t *ups)
 {
 	int	flags = 0, ret;
+	struct	timeval	tv;
 
 	upsdebugx(1, "Trying to connect to UPS [%s]", ups->sys);
 
@@ -2491,7 +3428,7 @@ static int try_connect(utype_t *ups)
 			upslogx(LOG_ERR, "UPS [%s]: Connection impossible, "
 				"dropping link", ups->sys);
 
-			ups_is_gone(ups);
+			source_is_gone(ups);
 			drop_connection(ups);
 
 			return 0;	/* failed */
@@ -2502,12 +3439,16 @@ static int try_connect(utype_t *ups)
 		flags |= UPSCLI_CONN_CERTVERIF;
 	}
 
-	ret = upscli_connect(&ups->conn, ups->hostname, ups->port, flags);
+	/* an unreachable server should not stall the polling loop for long */
+	tv.tv_sec = NET_TIMEOUT;
+	tv.tv_usec = 0;
+
+	ret = upscli_tryconnect(&ups->conn, ups->hostname, ups->port, flags, &tv);
 
 	if (ret < 0) {
 		upslogx(LOG_ERR, "UPS [%s]: connect failed: %s",
 			ups->sys, upscli_strerror(&ups->conn));
-		ups_is_gone(ups);
+		source_is_gone(ups);
 		return 0;
 	}
 
@@ -2521,8 +3462,27 @@ static int try_connect(utype_t *ups)
 
 	ret = do_upsd_auth(ups);
 
-	if (ret == 1)
+	if (ret == 1) {
+		/* have status changes pushed, if the server can do that
+		 * (that of MONITORALT is only polled, see pollups_all()) */
+		if (watchheartbeat > 0 && !ups->owner) {
+			if (upscli_watch(&ups->conn, ups->upsname, "ups.status") == 0) {
+				upsdebugx(1, "UPS [%s]: watching status changes", ups->sys);
+				ups->watching = 1;
+			} else if (upscli_fd(&ups->conn) == -1) {
+				upslogx(LOG_ERR, "UPS [%s]: WATCH failed: %s",
+					ups->sys, upscli_strerror(&ups->conn));
+				drop_connection(ups);
+				return 0;
+			} else {
+				upsdebugx(1, "UPS [%s]: server does not push status "
+					"changes (%s), polling it",
+					ups->sys, upscli_strerror(&ups->conn));
+			}
+		}
+
 		return 1;		/* everything is happy */
+	}
 
 	/* something failed in the auth so we may not be completely logged in */
 
@@ -2531,16 +3491,35 @@ static int try_connect(utype_t *ups)
 	return 0;
 }
 
+/* find the (alphanumerically) first status token not reported since cutoff */
+static st_tree_t *find_stale_status_token(st_tree_t *node, const st_tree_timespec_t *cutoff)
+{
+	st_tree_t	*found;
+
+	if (!node)
+		return NULL;
+
+	if ((found = find_stale_status_token(node->left, cutoff)) != NULL)
+		return found;
+
+	if (st_tree_node_compare_timestamp(node, cutoff) < 0)
+		return node;
+
+	return find_stale_status_token(node->right, cutoff);
+}
+
 /* deal with the contents of STATUS or ups.status for this ups */
 static void parse_status(utype_t *ups, char *status)
 {
 	char	*statword, *ptr, other_stat_words[SMALLBUF];
 	int	handled_stat_words = 0, changed_other_stat_words = 0;
 	st_tree_timespec_t	st_start;
+	nut_status_t	flags;
 
 	clear_alarm();
 
 	upsdebugx(2, "%s: [%s]", __func__, status);
+	NUT_USDT_STATUS(upsmon_status, ups->upsname, status);
 
 	/* empty response is the same as a dead ups */
 	if (status == NULL || status[0] == '\0') {
@@ -2550,22 +3529,25 @@ static void parse_status(utype_t *ups, char *status)
 
 	ups_is_alive(ups);
 
+	/* the whole tokens, not parts of others (e.g. "LB" of "OLB") */
+	flags = nut_status_parse(status);
+
 	/* clear these out early if they disappear */
-	if (!strstr(status, "LB"))
+	if (!(flags & NUT_STATUS_LB))
 		clearflag(&ups->status, ST_LOWBATT);
-	if (!strstr(status, "FSD"))
+	if (!(flags & NUT_STATUS_FSD))
 		clearflag(&ups->status, ST_FSD);
 
 	/* similar to above - clear these flags and send notifications */
-	if (!strstr(status, "CAL"))
+	if (!(flags & NUT_STATUS_CAL))
 		ups_is_notcal(ups);
-	if (!strstr(status, "OFF"))
+	if (!(flags & NUT_STATUS_OFF))
 		ups_is_notoff(ups);
-	if (!strstr(status, "BYPASS"))
+	if (!(flags & NUT_STATUS_BYPASS))
 		ups_is_notbypass(ups);
-	if (!strstr(status, "ECO"))
+	if (!(flags & NUT_STATUS_ECO))
 		ups_is_noteco(ups);
-	if (!strstr(status, "ALARM"))
+	if (!(flags & NUT_STATUS_ALARM))
 		ups_is_notalarm(ups);
 
 	statword = status;
@@ -2585,59 +3567,51 @@ static void parse_status(utype_t *ups, char *status)
 		handled_stat_words++;
 
 		/* Keep in sync with "Status data" chapter of docs/new-drivers.txt */
-		if (!strcasecmp(statword, "OL")) {
+		handled++;
+		switch (nut_status_flag(statword, strlen(statword))) {
+		case NUT_STATUS_OL:
 			ups_on_line(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "OB")) {
+			break;
+		case NUT_STATUS_OB:
 			ups_on_batt(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "LB")) {
+			break;
+		case NUT_STATUS_LB:
 			ups_low_batt(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "RB")) {
+			break;
+		case NUT_STATUS_RB:
 			upsreplbatt(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "CAL")) {
+			break;
+		case NUT_STATUS_CAL:
 			ups_is_cal(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "OFF")) {
+			break;
+		case NUT_STATUS_OFF:
 			ups_is_off(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "BYPASS")) {
+			break;
+		case NUT_STATUS_BYPASS:
 			ups_is_bypass(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "ECO")) {
+			break;
+		case NUT_STATUS_ECO:
 			ups_is_eco(ups);
-			handled++;
-		}
-		else if (!strcasecmp(statword, "ALARM")) {
+			break;
+		case NUT_STATUS_ALARM:
 			ups_is_alarm(ups);
-			handled++;
-		}
-		/* do it last to override any possible OL */
-		else if (!strcasecmp(statword, "FSD")) {
+			break;
+		case NUT_STATUS_FSD:
 			ups_fsd(ups);
-			handled++;
-		}
+			break;
 		/* Known standard status tokens, some being obsoleted, no upsmon reaction assigned */
-		else if (
-		    !strcasecmp(statword, "HB")
-		 || !strcasecmp(statword, "CHRG")
-		 || !strcasecmp(statword, "DISCHRG")
-		 || !strcasecmp(statword, "OVER")
-		 || !strcasecmp(statword, "TRIM")
-		 || !strcasecmp(statword, "BOOST")
-		) {
+		case NUT_STATUS_HB:
+		case NUT_STATUS_CHRG:
+		case NUT_STATUS_DISCHRG:
+		case NUT_STATUS_OVER:
+		case NUT_STATUS_TRIM:
+		case NUT_STATUS_BOOST:
 			/* FIXME: Do we want these logged similar to OTHERs? */
 			upsdebugx(4, "Known and ignored status token: [%s]", statword);
-			handled++;
+			break;
+		default:
+			handled = 0;
+			break;
 		}
 
 		if (!handled) {
@@ -2687,43 +3661,18 @@ static void parse_status(utype_t *ups, char *status)
 	}
 
 	if (ups->status_tokens) {
-		st_tree_t	*node = ups->status_tokens, *sttmp = node;
-
-		/* Scroll to the leftmost entry for alphanumeric sorted processing */
-		while (sttmp) {
-			node = sttmp;
-			sttmp = sttmp->left;
-		}
-
-		/* Go from left to right, on a freeing spree if need be */
-		while (node) {
-			sttmp = node->right;
-			if (st_tree_node_compare_timestamp(node, &st_start) < 0) {
-				upsdebugx(5, "Unexpected status token: [%s]: disappeared",
-					NUT_STRARG(node->var));
-				changed_other_stat_words++;
-
-				/* whatever is on the left, hang it off current right */
-				if (node->right) {
-					node->right->left = node->left;	/* May be NULL*/
-				}
-				/* whatever is on the right, hang it off current left */
-				if (node->left) {
-					node->left->right = node->right;	/* May be NULL*/
-				}
-
-				if (node == ups->status_tokens) {
-					ups->status_tokens = node->left ? node->left : node->right;
-				}
+		st_tree_t	*node;
 
-				/* forget the neighbors before dropping the remaining
-				 * "tree" of one node */
-				node->right = NULL;
-				node->left = NULL;
+		/* Go in alphanumeric order, on a freeing spree if need be */
+		while ((node = find_stale_status_token(ups->status_tokens, &st_start)) != NULL) {
+			upsdebugx(5, "Unexpected status token: [%s]: disappeared",
+				NUT_STRARG(node->var));
+			changed_other_stat_words++;
 
-				state_infofree(node);
+			if (!state_delinfo(&(ups->status_tokens), node->var)) {
+				/* should not happen, but do not loop forever */
+				break;
 			}
-			node = sttmp;
 		}
 	}
 
@@ -2741,60 +3690,18 @@ static void parse_status(utype_t *ups, char *status)
 		}
 	}
 
+	NUT_TRACE(NUT_TRACE_UPSMON_POLL, (long)ups->status, handled_stat_words, ups->sys);
+
 	upsdebugx(3, "Handled %d status tokens", handled_stat_words);
 }
 
-/* see what the status of the UPS is and handle any changes */
-static void pollups(utype_t *ups)
+/* handle a failed status query of this UPS; 'drop' if the connection
+ * can not be used anymore even though upsclient did not close it */
+static void pollups_failed(utype_t *ups, int drop)
 {
-	char	status[SMALLBUF];
 	int	pollfail_log = 0;	/* if we throttle, only upsdebugx() but not upslogx() the failures */
 	int	upserror;
 
-	/* try a reconnect here */
-	if (!flag_isset(ups->status, ST_CLICONNECTED)) {
-		if (try_connect(ups) != 1) {
-			return;
-		}
-	}
-
-	if (upscli_ssl(&ups->conn) == 1)
-		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
-	else
-		upsdebugx(2, "%s: %s", __func__, ups->sys);
-
-	set_alarm();
-
-	if (get_var(ups, "status", status, sizeof(status)) == 0) {
-		clear_alarm();
-
-		/* reset pollfail log throttling */
-#if 0
-		/* Note: last error is never cleared, so we reset it below */
-		upserror = upscli_upserror(&ups->conn);
-		upsdebugx(3, "%s: Poll UPS [%s] after getvar(status) okay: upserror=%d: %s",
-			__func__, ups->sys, upserror, upscli_strerror(&ups->conn));
-#endif
-		upserror = UPSCLI_ERR_NONE;
-		if (pollfail_log_throttle_max >= 0
-		&&  ups->pollfail_log_throttle_state != upserror
-		) {
-			/* Notify throttled log that we are okay now */
-			upslogx(LOG_ERR, "Poll UPS [%s] recovered from "
-				"failure state code %d - now %d",
-				ups->sys, ups->pollfail_log_throttle_state,
-				upserror);
-		}
-		ups->pollfail_log_throttle_state = upserror;
-		ups->pollfail_log_throttle_count = -1;
-
-		parse_status(ups, status);
-		return;
-	}
-
-	/* fallthrough: no communications */
-	clear_alarm();
-
 	/* try to make some of these a little friendlier */
 	upserror = upscli_upserror(&ups->conn);
 	upsdebugx(3, "%s: Poll UPS [%s] after getvar(status) failed: upserror=%d",
@@ -2872,17 +3779,758 @@ static void pollups(utype_t *ups)
 	}
 
 	/* throw COMMBAD or NOCOMM as conditions may warrant */
-	ups_is_gone(ups);
+	source_is_gone(ups);
 
 	/* if upsclient lost the connection, clean up things on our side */
-	if (upscli_fd(&ups->conn) == -1) {
+	if (drop || upscli_fd(&ups->conn) == -1) {
 		drop_connection(ups);
 		return;
 	}
 }
 
-/* see if the powerdownflag file is there and proper */
-static int pdflag_status(void)
+
+/* send the status query to this UPS, reconnecting first if needed;
+ * returns 1 if its answer is to be handled by pollups_finish() */
+static int pollups_start(utype_t *ups)
+{
+	const	char	*query[4];
+	size_t	numq;
+
+	/* try a reconnect here */
+	if (!flag_isset(ups->status, ST_CLICONNECTED)) {
+		if (try_connect(ups) != 1) {
+			return 0;
+		}
+	}
+
+	if (upscli_ssl(&ups->conn) == 1)
+		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
+	else
+		upsdebugx(2, "%s: %s", __func__, ups->sys);
+
+	numq = get_var_query(ups, "status", query);
+
+	if (numq == 0 || upscli_get_send(&ups->conn, numq, query) != 0) {
+		pollups_failed(ups, 0);
+		return 0;
+	}
+
+	ups->polldeadline = time(NULL) + NET_TIMEOUT;
+	return 1;
+}
+
+/* apply the status changes pushed by upsd for a watched UPS; returns
+ * how many were handled, or -1 if the connection was lost meanwhile */
+static int watch_handle(utype_t *ups)
+{
+	char	status[SMALLBUF];
+	size_t	numa;
+	char	**answer;
+	int	ret, handled = 0;
+
+	while ((ret = upscli_notify_next(&ups->conn, &numa, &answer)) == 1) {
+		if (numa < 4 || strcmp(answer[0], "NOTIFY")
+		||  strcasecmp(answer[2], ups->upsname)
+		||  strcmp(answer[3], "ups.status")
+		) {
+			continue;
+		}
+
+		if (!strcmp(answer[1], "VAR") && numa >= 5) {
+			upsdebugx(2, "%s: UPS [%s] status now [%s]",
+				__func__, ups->sys, answer[4]);
+			snprintf(status, sizeof(status), "%s", answer[4]);
+			parse_status(ups, status);
+			handled++;
+		} else if (!strcmp(answer[1], "DELVAR")) {
+			/* let the next poll tell what happened */
+			ups->lastheartbeat = 0;
+			handled++;
+		}
+	}
+
+	if (ret < 0) {
+		upsdebugx(1, "%s: UPS [%s]: %s",
+			__func__, ups->sys, upscli_strerror(&ups->conn));
+		pollups_failed(ups, 1);
+		return -1;
+	}
+
+	return handled;
+}
+
+#ifndef WIN32
+/* open the BEACON sockets not opened yet */
+static void beacon_open(void)
+{
+	beacon_listener_t	*l;
+	struct addrinfo	hints, *res;
+	struct sockaddr_storage	any;
+	socklen_t	anylen;
+	int	ret, one = 1;
+
+	for (l = beacon_listeners; l; l = l->next) {
+		if (l->fd >= 0)
+			continue;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_protocol = IPPROTO_UDP;
+
+		if ((ret = getaddrinfo(l->addr, l->port, &hints, &res)) != 0) {
+			if (!l->failed) {
+				upslogx(LOG_ERR, "BEACON %s port %s: %s",
+					l->addr, l->port, gai_strerror(ret));
+				l->failed = 1;
+			}
+			continue;
+		}
+
+		if ((l->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0) {
+			if (!l->failed) {
+				upslog_with_errno(LOG_ERR, "BEACON %s port %s: socket",
+					l->addr, l->port);
+				l->failed = 1;
+			}
+			freeaddrinfo(res);
+			continue;
+		}
+
+		setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, (void *)&one, sizeof(one));
+		set_close_on_exec(l->fd);
+
+		/* the port on any address of ours: a multicast group or a
+		 * broadcast address is not one of them */
+		memset(&any, 0, sizeof(any));
+		if (res->ai_family == AF_INET6) {
+			struct sockaddr_in6	*sin6 = (struct sockaddr_in6 *)&any;
+
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_port = ((struct sockaddr_in6 *)res->ai_addr)->sin6_port;
+			anylen = sizeof(*sin6);
+		} else {
+			struct sockaddr_in	*sin = (struct sockaddr_in *)&any;
+
+			sin->sin_family = AF_INET;
+			sin->sin_port = ((struct sockaddr_in *)res->ai_addr)->sin_port;
+			anylen = sizeof(*sin);
+		}
+
+		ret = bind(l->fd, (struct sockaddr *)&any, anylen);
+
+		if (ret == 0 && res->ai_family == AF_INET
+		&&  IN_MULTICAST(ntohl(((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr))
+		) {
+			struct ip_mreq	mreq;
+
+			memset(&mreq, 0, sizeof(mreq));
+			mreq.imr_multiaddr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			ret = setsockopt(l->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (void *)&mreq, sizeof(mreq));
+		} else if (ret == 0 && res->ai_family == AF_INET6
+		&&  IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr)
+		) {
+			struct ipv6_mreq	mreq6;
+
+			memset(&mreq6, 0, sizeof(mreq6));
+			mreq6.ipv6mr_multiaddr = ((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+			ret = setsockopt(l->fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, (void *)&mreq6, sizeof(mreq6));
+		}
+
+		freeaddrinfo(res);
+
+		if (ret != 0) {
+			if (!l->failed) {
+				upslog_with_errno(LOG_ERR, "BEACON %s port %s", l->addr, l->port);
+				l->failed = 1;
+			}
+			close(l->fd);
+			l->fd = -1;
+			continue;
+		}
+
+		upsdebugx(1, "Listening for beacons on %s port %s", l->addr, l->port);
+		l->failed = 0;
+	}
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/* is a the same host as b (whatever the ports)? */
+static int beacon_same_host(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+
+	if (a->ss_family == AF_INET)
+		return !memcmp(&((const struct sockaddr_in *)a)->sin_addr,
+			&((const struct sockaddr_in *)b)->sin_addr, sizeof(struct in_addr));
+
+	if (a->ss_family == AF_INET6)
+		return !memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr,
+			&((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+
+	return 0;
+}
+
+/* did the beacon from <from> come from the upsd we talk to for ups? */
+static int beacon_from_peer(utype_t *ups, const struct sockaddr_storage *from)
+{
+	struct sockaddr_storage	peer;
+	socklen_t	len = sizeof(peer);
+	int	fd = upscli_fd(&ups->conn);
+
+	if (fd < 0 || !flag_isset(ups->status, ST_CLICONNECTED)
+	||  getpeername(fd, (struct sockaddr *)&peer, &len) != 0
+	) {
+		return 0;
+	}
+
+	return beacon_same_host(&peer, from);
+}
+
+/* the status a beacon told of ups; returns 1 if it was taken */
+static int beacon_apply(utype_t *ups, int flags, uint32_t status, time_t until)
+{
+	char	text[SMALLBUF];
+
+	if (flags & NUT_BEACON_STALE) {
+		/* nothing to go by: polled as usual */
+		ups->beaconuntil = 0;
+		return 0;
+	}
+
+	if (ups->beaconuntil > 0 && status == ups->beaconstatus) {
+		ups->beaconuntil = until;
+		return 0;
+	}
+
+	ups->beaconstatus = status;
+
+	/* the tokens themselves are needed for those (or ups.alarm):
+	 * the next cycle polls it */
+	if (status & (NUT_STATUS_OTHER | NUT_STATUS_ALARM)) {
+		ups->beaconuntil = 0;
+		return 0;
+	}
+
+	ups->beaconuntil = until;
+
+	nut_status_format(text, sizeof(text), status);
+	upsdebugx(2, "%s: UPS [%s] status now [%s]", __func__, ups->sys, text);
+	parse_status(ups, text);
+
+	return 1;
+}
+
+/* read a datagram from a BEACON socket and take what it tells, if it
+ * is signed with our BEACONKEY and new; returns how many UPSes it
+ * changed the status of */
+static int beacon_read(beacon_listener_t *l)
+{
+	unsigned char	buf[NUT_BEACON_MAXLEN + 1], mac[NUT_SHA256_LEN];
+	struct sockaddr_storage	from;
+	socklen_t	fromlen = sizeof(from);
+	beacon_source_t	*src;
+	utype_t	*ups;
+	char	name[256];
+	ssize_t	ret;
+	size_t	len, pos, count, i, namelen;
+	uint32_t	id, seq, interval;
+	uint64_t	when;
+	time_t	now, until;
+	int	handled = 0;
+
+	ret = recvfrom(l->fd, (void *)buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+	if (ret < 0) {
+		upsdebug_with_errno(2, "%s: recvfrom", __func__);
+		return 0;
+	}
+	len = (size_t)ret;
+
+	if (len < NUT_BEACON_HDRLEN + NUT_BEACON_MACLEN || len > NUT_BEACON_MAXLEN
+	||  memcmp(buf, NUT_BEACON_MAGIC, 4) || buf[4] != NUT_BEACON_VERSION
+	) {
+		upsdebugx(3, "%s: not a beacon (%" PRIuSIZE " bytes)", __func__, len);
+		return 0;
+	}
+
+	if (!beaconkey) {
+		upsdebugx(2, "%s: no BEACONKEY to check a beacon with", __func__);
+		return 0;
+	}
+
+	len -= NUT_BEACON_MACLEN;
+	nut_hmac_sha256(beaconkey, strlen(beaconkey), buf, len, mac);
+	if (!nut_hmac_equal(mac, buf + len, NUT_BEACON_MACLEN)) {
+		upsdebugx(2, "%s: beacon with a wrong signature, ignored", __func__);
+		return 0;
+	}
+
+	interval = (uint32_t)buf[6] << 8 | buf[7];
+	id = get_be32(buf + 8);
+	seq = get_be32(buf + 12);
+	when = (uint64_t)get_be32(buf + 16) << 32 | get_be32(buf + 20);
+	count = (size_t)buf[24] << 8 | buf[25];
+
+	time(&now);
+	if (when > (uint64_t)now + BEACON_MAXSKEW || when + BEACON_MAXSKEW < (uint64_t)now) {
+		static int	warned = 0;
+
+		if (!warned) {
+			upslogx(LOG_WARNING, "Beacon sent %" PRIi64 " seconds from now, ignored "
+				"(are the clocks of both hosts right?)", (int64_t)(when - (uint64_t)now));
+			warned = 1;
+		}
+		return 0;
+	}
+
+	/* against replays: newer than the last one from there */
+	for (src = beacon_sources; src; src = src->next) {
+		if (beacon_same_host(&src->addr, &from))
+			break;
+	}
+
+	if (!src) {
+		src = xcalloc(1, sizeof(*src));
+		memcpy(&src->addr, &from, sizeof(from));
+		src->next = beacon_sources;
+		beacon_sources = src;
+	} else if (src->id == id ? (seq <= src->seq) : (when < src->when)) {
+		upsdebugx(2, "%s: old beacon (run %08x, number %u), ignored",
+			__func__, (unsigned int)id, (unsigned int)seq);
+		return 0;
+	}
+
+	src->id = id;
+	src->seq = seq;
+	src->when = when;
+
+	until = now + (time_t)(BEACON_MISSED * (interval ? interval : 1)) + 1;
+
+	for (i = 0, pos = NUT_BEACON_HDRLEN; i < count; i++) {
+		if (pos >= len || pos + 1 + buf[pos] + 5 > len) {
+			upsdebugx(1, "%s: truncated beacon", __func__);
+			break;
+		}
+
+		namelen = buf[pos];
+		memcpy(name, buf + pos + 1, namelen);
+		name[namelen] = '\0';
+		pos += 1 + namelen;
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			if (!strcmp(ups->upsname, name) && beacon_from_peer(ups, &from)
+			&&  beacon_apply(ups, buf[pos], get_be32(buf + pos + 1), until)
+			) {
+				handled++;
+			}
+		}
+
+		pos += 5;
+	}
+
+	return handled;
+}
+#endif	/* !WIN32 */
+
+/* can a watched (or beacon fed) UPS do without a status poll in this cycle? */
+static int watch_enough(utype_t *ups)
+{
+	time_t	now;
+
+	time(&now);
+
+#ifndef WIN32
+	if (!ups->watching && ups->beaconuntil <= now)
+		return 0;
+#else
+	if (!ups->watching)
+		return 0;
+#endif
+
+	/* critical or in-between states are polled as usual */
+	if (!flag_isset(ups->status, ST_ONLINE) || flag_isset(ups->status, ST_ONBATT)
+	||  flag_isset(ups->status, ST_LOWBATT) || flag_isset(ups->status, ST_FSD)
+	) {
+		return 0;
+	}
+
+	if (ups->lastheartbeat == 0 || (now - ups->lastheartbeat) >= (time_t)watchheartbeat
+	||  now < ups->lastheartbeat
+	) {
+		return 0;
+	}
+
+	if (ups->watching && watch_handle(ups) < 0)
+		return 1;	/* lost, reconnect in the next cycle */
+
+	/* the connection and status are current enough */
+	ups_is_alive(ups);
+
+	return 1;
+}
+
+#ifndef WIN32
+/* sleep between main loop cycles, handling the status changes pushed
+ * for watched UPSes (or told by beacons) as they come; returns early if
+ * interrupted */
+static void watch_sleep(unsigned int sec)
+{
+	utype_t	*ups;
+	beacon_listener_t	*l;
+	fd_set	rfds;
+	struct	timeval	tv, start, now;
+	double	left;
+	int	fd, maxfd, ret, handled;
+
+	gettimeofday(&start, NULL);
+
+	beacon_open();
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		maxfd = -1;
+
+		for (l = beacon_listeners; l != NULL; l = l->next) {
+			if (l->fd < 0)
+				continue;
+
+			FD_SET(l->fd, &rfds);
+			if (l->fd > maxfd)
+				maxfd = l->fd;
+		}
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			if (!ups->watching)
+				continue;
+
+			fd = upscli_fd(&ups->conn);
+			if (fd < 0)
+				continue;
+
+			FD_SET(fd, &rfds);
+			if (fd > maxfd)
+				maxfd = fd;
+		}
+
+		if (maxfd < 0) {
+			/* nothing pushed to us: sleep tight */
+			gettimeofday(&now, NULL);
+			left = sec - difftimeval(now, start);
+			if (left > 0)
+				sleep((unsigned int)(left + 0.5));
+			return;
+		}
+
+		gettimeofday(&now, NULL);
+		left = sec - difftimeval(now, start);
+		if (left <= 0 || left > sec)
+			return;
+
+		tv.tv_sec = (time_t)left;
+		tv.tv_usec = (suseconds_t)((left - (double)tv.tv_sec) * 1000000);
+
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+		if (ret <= 0)
+			return;	/* time is up, or a signal came */
+
+		handled = 0;
+		for (l = beacon_listeners; l != NULL; l = l->next) {
+			if (l->fd >= 0 && FD_ISSET(l->fd, &rfds))
+				handled += beacon_read(l);
+		}
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			if (!ups->watching || upscli_fd(&ups->conn) < 0)
+				continue;
+
+			if (FD_ISSET(upscli_fd(&ups->conn), &rfds)
+			&&  watch_handle(ups) != 0
+			) {
+				handled++;
+			}
+		}
+
+		/* react now rather than at the next cycle */
+		if (handled)
+			recalc();
+	}
+}
+#endif	/* !WIN32 */
+
+/* handle the answer to the status query sent by pollups_start() to this
+ * server of a UPS: the first valid one of this cycle tells its status */
+static void pollups_finish(utype_t *src)
+{
+	char	status[SMALLBUF];
+	int	ret, upserror;
+	const	char	*query[4];
+	size_t	numq, numa = 0;
+	char	**answer = NULL;
+	utype_t	*ups = (src->owner ? (utype_t *)src->owner : src), *other;
+
+	numq = get_var_query(src, "status", query);
+
+	/* the answer is (at least partly) there already, this is just
+	 * in case the rest of it does not follow */
+	set_alarm();
+	ret = upscli_get_recv(&src->conn, numq, query, &numa, &answer);
+
+	if (get_var_value(src, "status", ret, numq, numa, answer, status, sizeof(status)) == 0) {
+		clear_alarm();
+
+		/* reset pollfail log throttling */
+#if 0
+		/* Note: last error is never cleared, so we reset it below */
+		upserror = upscli_upserror(&ups->conn);
+		upsdebugx(3, "%s: Poll UPS [%s] after getvar(status) okay: upserror=%d: %s",
+			__func__, ups->sys, upserror, upscli_strerror(&ups->conn));
+#endif
+		upserror = UPSCLI_ERR_NONE;
+		if (pollfail_log_throttle_max >= 0
+		&&  src->pollfail_log_throttle_state != upserror
+		) {
+			/* Notify throttled log that we are okay now */
+			upslogx(LOG_ERR, "Poll UPS [%s] recovered from "
+				"failure state code %d - now %d",
+				src->sys, src->pollfail_log_throttle_state,
+				upserror);
+		}
+		src->pollfail_log_throttle_state = upserror;
+		src->pollfail_log_throttle_count = -1;
+
+		/* with MONITORALT, that of the slower server is just as
+		 * true but no news: do not flip back and forth */
+		if (ups->answered) {
+			upsdebugx(3, "%s: UPS [%s]: answered later than the other server, not used",
+				__func__, src->sys);
+			return;
+		}
+
+		ups->answered = 1;
+
+		if (ups->alt) {
+			upsdebugx(2, "%s: UPS [%s]: status from [%s]",
+				__func__, ups->sys, src->sys);
+
+			/* the other one gets a little while to answer too, as
+			 * both connections are to be kept; not NET_TIMEOUT */
+			other = (src == ups ? (utype_t *)ups->alt : ups);
+			if (other->polling == 1 && other->polldeadline > time(NULL) + NET_ALT_GRACE)
+				other->polldeadline = time(NULL) + NET_ALT_GRACE;
+		}
+
+		parse_status(ups, status);
+
+		/* for watch_enough() */
+		time(&ups->lastheartbeat);
+
+		/* anything pushed meanwhile is applied in order after that,
+		 * ending with the same status unless it changed again */
+		if (ups->watching)
+			watch_handle(ups);
+
+		return;
+	}
+
+	/* fallthrough: no communications */
+	clear_alarm();
+
+	pollups_failed(src, 0);
+}
+
+/* handle the answers to the queries sent to the UPSes marked as
+ * polling with the finish() method (pollups_finish() for the status
+ * queries sent by pollups_start()) as they come, giving up on those
+ * not answered by their deadline */
+static void pollups_wait(void (*finish)(utype_t *ups))
+{
+	utype_t	*ups, *src;
+	fd_set	rfds;
+	struct	timeval	tv;
+	time_t	now, next;
+	int	fd, maxfd, ret;
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		maxfd = -1;
+		next = 0;
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			for (src = ups; src != NULL; src = source_next(ups, src)) {
+				if (src->polling != 1)
+					continue;
+
+				fd = upscli_fd(&src->conn);
+				FD_SET(fd, &rfds);
+
+				if (fd > maxfd)
+					maxfd = fd;
+
+				if (next == 0 || src->polldeadline < next)
+					next = src->polldeadline;
+			}
+		}
+
+		if (maxfd < 0)
+			return;
+
+		time(&now);
+		tv.tv_sec = (next > now) ? (next - now) : 0;
+		tv.tv_usec = 0;
+
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+		if (ret < 0) {
+#ifndef WIN32
+			if (errno == EINTR)
+				continue;
+#endif
+			/* just read the answers one by one then */
+			upslog_with_errno(LOG_ERR, "%s: select", __func__);
+		}
+
+		time(&now);
+
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			for (src = ups; src != NULL; src = source_next(ups, src)) {
+				if (src->polling != 1)
+					continue;
+
+				if (ret < 0 || FD_ISSET(upscli_fd(&src->conn), &rfds)) {
+					src->polling = 0;
+					finish(src);
+				} else if (now >= src->polldeadline) {
+					upsdebugx(1, "%s: UPS [%s] did not answer in time",
+						__func__, src->sys);
+					src->polling = 0;
+
+					/* a late answer would confuse the next query */
+					src->conn.upserror = UPSCLI_ERR_READ;
+					src->conn.syserrno = ETIMEDOUT;
+					pollups_failed(src, 1);
+				}
+			}
+		}
+	}
+}
+
+/* no more polling in this cycle (the OS prepares for sleep) */
+static void pollups_abort(utype_t *ups)
+{
+	utype_t	*src;
+
+	upsdebugx(2, "Aborting UPS polling sub-loop because OS is preparing for sleep or just woke up");
+
+	for (; ups != NULL; ups = ups->next) {
+		for (src = ups; src != NULL; src = source_next(ups, src)) {
+			if (src->polling != 1)
+				src->polling = 0;
+		}
+	}
+
+	pollups_wait(pollups_finish);
+}
+
+/* see what the status of each UPS is and handle any changes: the queries
+ * go to all of them at once and the answers are handled as they come,
+ * so one slow or unreachable upsd does not delay noticing the events
+ * on the others; reconnecting to those we lost waits until that is done.
+ * With MONITORALT, both servers of a UPS are asked, and the first answer
+ * tells its status; a lost one is reconnected only after recalc() (see
+ * pollups_reconnect()) if the other one answered meanwhile.
+ * Returns -1 if polling was aborted because the OS prepares for sleep. */
+static int pollups_all(void)
+{
+	utype_t	*ups, *src;
+	int	reconnect = 0;
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		if (isPreparingForSleepSupported() && (sleep_inhibitor_status = isPreparingForSleep()) >= 0) {
+			pollups_abort(ups);
+			return -1;
+		}
+
+		ups->answered = 0;
+
+		if (flag_isset(ups->status, ST_CLICONNECTED) && watch_enough(ups)) {
+			ups->polling = 0;
+			ups->answered = 1;
+
+			if (ups->alt && !flag_isset(((utype_t *)ups->alt)->status, ST_CLICONNECTED))
+				((utype_t *)ups->alt)->polling = -2;
+			continue;
+		}
+
+		for (src = ups; src != NULL; src = source_next(ups, src)) {
+			if (!flag_isset(src->status, ST_CLICONNECTED)) {
+				src->polling = -1;
+				reconnect++;
+				continue;
+			}
+
+			src->polling = pollups_start(src);
+		}
+	}
+
+	pollups_wait(pollups_finish);
+
+	for (ups = firstups; reconnect && ups != NULL; ups = ups->next) {
+		for (src = ups; src != NULL; src = source_next(ups, src)) {
+			if (src->polling != -1)
+				continue;
+
+			if (isPreparingForSleepSupported() && (sleep_inhibitor_status = isPreparingForSleep()) >= 0) {
+				pollups_abort(ups);
+				return -1;
+			}
+
+			/* the status is known already, act on it first */
+			if (ups->answered) {
+				src->polling = -2;
+				continue;
+			}
+
+			src->polling = pollups_start(src);
+		}
+	}
+
+	if (reconnect)
+		pollups_wait(pollups_finish);
+
+	/* neither server of MONITORALT told the status */
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		if (ups->alt && !ups->answered)
+			ups_is_gone(ups);
+	}
+
+	return 0;
+}
+
+/* reconnect to the servers left for later by pollups_all() */
+static void pollups_reconnect(void)
+{
+	utype_t	*ups, *src;
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		for (src = ups; src != NULL; src = source_next(ups, src)) {
+			if (src->polling != -2)
+				continue;
+
+			src->polling = 0;
+			try_connect(src);
+		}
+	}
+}
+
+/* see if the powerdownflag file is there and proper */
+static int pdflag_status(void)
 {
 	FILE	*pdf;
 	char	buf[SMALLBUF];
@@ -3178,6 +4826,8 @@ static void reload_conf(void)
 
 	while (tmp) {
 		tmp->retain = 0;
+		if (tmp->alt)
+			((utype_t *)tmp->alt)->retain = 0;
 		tmp = tmp->next;
 	}
 
@@ -3194,12 +4844,27 @@ static void reload_conf(void)
 		next = tmp->next;
 
 		/* !retain means it wasn't in the .conf this time around */
-		if (tmp->retain == 0)
+		if (tmp->retain == 0) {
 			delete_ups(tmp);
+		} else if (tmp->alt && ((utype_t *)tmp->alt)->retain == 0) {
+			upslogx(LOG_NOTICE, "No longer monitoring UPS [%s] through %s",
+				tmp->sys, ((utype_t *)tmp->alt)->sys);
+			drop_connection(tmp->alt);
+			ups_free(tmp->alt);
+			tmp->alt = NULL;
+		}
 
 		tmp = next;
 	}
 
+	/* power values and settings may have changed */
+	recalc_reset();
+
+#ifndef WIN32
+	/* the next notification starts a notifier with the new settings */
+	notifier_stop();
+#endif
+
 	/* see if the user just blew off a foot */
 	if (totalpv < minsupplies) {
 		upslogx(LOG_CRIT, "Fatal error: total power value (%d) less "
@@ -3616,6 +5281,9 @@ int main(int argc, char *argv[])
 	/* prep our signal handlers */
 	setup_signals();
 
+	/* in the unprivileged child, if NUT_TRACE asks for it */
+	nut_trace_init(prog);
+
 	/* reopen the log for the child process */
 	closelog();
 	open_syslog(prog);
@@ -3647,6 +5315,8 @@ int main(int argc, char *argv[])
 			upsnotify(NOTIFY_STATE_READY, NULL);
 		}
 
+		nut_trace_dump_pending();
+
 		if (isPreparingForSleepSupported()) {
 			if (sleep_inhibitor_status < 0) {
 				/* We may be coming fresh from an aborted loop cycle
@@ -3743,15 +5413,11 @@ int main(int argc, char *argv[])
 		/* Reset the value, regardless of support */
 		sleep_inhibitor_status = -2;
 
-		for (ups = firstups; ups != NULL; ups = ups->next) {
-			if (isPreparingForSleepSupported() && (sleep_inhibitor_status = isPreparingForSleep()) >= 0) {
-				upsdebugx(2, "Aborting UPS polling sub-loop because OS is preparing for sleep or just woke up");
-				goto end_loop_cycle;
-			}
-			pollups(ups);
-		}
+		if (pollups_all() < 0)
+			goto end_loop_cycle;
 
 		recalc();
+		pollups_reconnect();
 
 		/* make sure the parent hasn't died */
 		if (use_pipe)
@@ -3776,7 +5442,7 @@ int main(int argc, char *argv[])
 				/* WARNING: This call can take several seconds itself
 				 * on some systems, seen e.g. with Ubuntu in WSL after
 				 * the PC spent some life-time sleeping */
-				sleep(1);
+				watch_sleep(1);
 				upsdebugx(7, "delay between main loop cycles: after sleep 1...");
 				sleep_inhibitor_status = isPreparingForSleep();
 				upsdebugx(7, "delay between main loop cycles: after isPreparingForSleep()...");
@@ -3812,8 +5478,8 @@ int main(int argc, char *argv[])
 			 * so we aborted it, we end soon after ifdef/endif,
 			 * and so not handling here specially */
 		} else {
-			/* sleep tight */
-			sleep(sleepval);
+			/* sleep tight, unless upsd has news for us */
+			watch_sleep(sleepval);
 		}
 		gettimeofday(&end, NULL);
 		upsdebugx(4, "%u-sec delay between main loop cycles finished, took %.06f",
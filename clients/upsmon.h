@@ -87,6 +87,28 @@ typedef struct {
 	int	pollfail_log_throttle_state;	/* Last (error) state which we throttle */
 	int	pollfail_log_throttle_count;	/* How many pollfreq loops this UPS was in this state since last logged report? */
 
+	/* polling all UPSes at once, see pollups_all() in upsmon.c */
+	int	polling;		/* 1: waiting for status answer, -1: to reconnect later in this cycle, -2: after recalc() */
+	time_t	polldeadline;		/* when to stop waiting for it	*/
+
+	/* status pushed by upsd, see WATCHHEARTBEAT in upsmon.c */
+	int	watching;		/* 1: WATCH on ups.status accepted	*/
+	time_t	lastheartbeat;		/* time of last status poll while watching */
+
+	/* status told by the beacons of upsd, see BEACON in upsmon.c */
+	time_t	beaconuntil;		/* trusted until then, 0: poll	*/
+	uint32_t	beaconstatus;		/* the status bits last told	*/
+
+	/* the same UPS through another upsd, see MONITORALT in upsmon.c */
+	void	*alt;			/* that other server, polled along */
+	void	*owner;			/* for it: the UPS it tells about */
+	int	answered;		/* 1: a server told the status this cycle */
+
+	/* cached is_ups_critical() verdict, see recalc() in upsmon.c */
+	int	critical;		/* -1: not known yet, else last verdict */
+	int	critflags;		/* status flags it was made for	*/
+	int	critstates;		/* and the *state fields, packed	*/
+
 	time_t	lastpoll;		/* time of last successful poll	*/
 	time_t  lastnoncrit;		/* time of last non-crit poll	*/
 	time_t	lastrbwarn;		/* time of last REPLBATT warning*/
@@ -210,6 +232,7 @@ static struct {
 /* various constants */
 
 #define NET_TIMEOUT 10		/* wait 10 seconds max for upsd to respond */
+#define NET_ALT_GRACE 2		/* and for the other one of MONITORALT once one did */
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -37,6 +37,11 @@
  *
  * the daemon will shut down automatically when no more timers are active
  *
+ * upsmon may also keep a connection to the daemon and stream its events
+ * as "EVENT <upsname> <notifytype>" lines, which the daemon matches
+ * itself against the AT lines (parsed once, and again upon SIGHUP);
+ * the daemon stays around as long as such a connection is open
+ *
  */
 
 #include "common.h"
@@ -60,13 +65,33 @@
 #include "timehead.h"
 #include "nut_stdint.h"
 
+/* the timers are kept in a binary min-heap ordered by expiry (and
+ * by creation for the same expiry), and found by name through a hash
+ * table, so bursts of START-TIMER and CANCEL-TIMER stay cheap */
 typedef struct ttype_s {
 	char	*name;
-	time_t	etime;
-	struct ttype_s	*next;
+	uint64_t	etime;		/* expiry, milliseconds of now_ms()	*/
+	uint64_t	seq;		/* order of creation		*/
+	size_t	heapidx;		/* position in theap[]		*/
+	struct ttype_s	*hnext;		/* same hash bucket, oldest first	*/
 } ttype_t;
 
-static ttype_t	*thead = NULL;
+static ttype_t	**theap = NULL, **thash = NULL;
+static size_t	tcount = 0, theapsize = 0, thashsize = 0;
+static uint64_t	tseq = 0;
+
+/* the AT lines of the configuration, in order */
+typedef struct attype_s {
+	char	*ntype, *un, *cmd, *ca1, *ca2;
+	struct attype_s	*next;
+} attype_t;
+
+static attype_t	*athead = NULL;
+
+#ifndef WIN32
+/* set by SIGHUP for the daemon to read the configuration again */
+static volatile sig_atomic_t	reload_flag = 0;
+#endif
 static conn_t	*connhead = NULL;
 static char	*cmdscript = NULL, *pipefn = NULL, *lockfn = NULL;
 
@@ -81,11 +106,17 @@ static OVERLAPPED connect_overlapped;
 #define PARENT_STARTED		-2
 #define PARENT_UNNECESSARY	-3
 #define MAX_TRIES 		30
-#define EMPTY_WAIT		15	/* min passes with no timers to exit */
+#define EMPTY_WAIT		15	/* min seconds with no timers to exit */
 #define US_LISTEN_BACKLOG	16
 #define US_SOCK_BUF_LEN		256
 #define US_MAX_READ		128
 
+static void at_run(const char *un, const char *ntype, int indaemon);
+static void at_free(void);
+#ifndef WIN32
+static void checkconf(void);
+#endif
+
 /* --- server functions --- */
 
 static void exec_cmd(const char *cmd)
@@ -120,93 +151,173 @@ static void exec_cmd(const char *cmd)
 	return;
 }
 
-static void removetimer(ttype_t *tfind)
+/* a monotonic clock in milliseconds, for the timers */
+static uint64_t now_ms(void)
 {
-	ttype_t	*tmp, *last;
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
 
-	last = NULL;
-	tmp = thead;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec * 1000 + (uint64_t)(ts.tv_nsec / 1000000);
+#endif
+	{
+		struct timeval	tv;
 
-	while (tmp) {
-		if (tmp == tfind) {	/* found it */
-			if (last == NULL)	/* deleting first */
-				thead = tmp->next;
-			else
-				last->next = tmp->next;
+		gettimeofday(&tv, NULL);
+		return (uint64_t)tv.tv_sec * 1000 + (uint64_t)(tv.tv_usec / 1000);
+	}
+}
 
-			free(tmp->name);
-			free(tmp);
-			return;
-		}
+static size_t timer_hash(const char *name)
+{
+	size_t	hash = 5381;
 
-		last = tmp;
-		tmp = tmp->next;
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+
+	return hash & (thashsize - 1);
+}
+
+static int timer_before(const ttype_t *a, const ttype_t *b)
+{
+	if (a->etime != b->etime)
+		return a->etime < b->etime;
+
+	return a->seq < b->seq;
+}
+
+static void heap_set(size_t idx, ttype_t *t)
+{
+	theap[idx] = t;
+	t->heapidx = idx;
+}
+
+/* move the timer at idx up or down to where it belongs */
+static void heap_fix(size_t idx)
+{
+	ttype_t	*t = theap[idx];
+	size_t	child;
+
+	while (idx > 0 && timer_before(t, theap[(idx - 1) / 2])) {
+		heap_set(idx, theap[(idx - 1) / 2]);
+		idx = (idx - 1) / 2;
 	}
 
-	/* this one should never happen */
+	for (;;) {
+		child = 2 * idx + 1;
+		if (child >= tcount)
+			break;
+
+		if (child + 1 < tcount && timer_before(theap[child + 1], theap[child]))
+			child++;
+
+		if (!timer_before(theap[child], t))
+			break;
 
-	upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
+		heap_set(idx, theap[child]);
+		idx = child;
+	}
+
+	heap_set(idx, t);
 }
 
-static void checktimers(void)
+static void removetimer(ttype_t *tfind)
 {
-	ttype_t	*tmp, *tmpnext;
-	time_t	now;
-	static	int	emptyctr = 0;
+	ttype_t	**tptr;
+	size_t	idx;
+
+	/* unlink from its hash bucket */
+	for (tptr = &thash[timer_hash(tfind->name)]; *tptr; tptr = &(*tptr)->hnext) {
+		if (*tptr == tfind)
+			break;
+	}
 
-	/* if the queue is empty we might be ready to exit */
-	if (!thead) {
+	if (!*tptr || tfind->heapidx >= tcount || theap[tfind->heapidx] != tfind) {
+		/* this one should never happen */
+		upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
+		return;
+	}
 
-		emptyctr++;
+	*tptr = tfind->hnext;
 
-		/* wait a little while in case someone wants us again */
-		if (emptyctr < EMPTY_WAIT)
-			return;
+	/* and from the heap, moving the last one in its place */
+	idx = tfind->heapidx;
+	tcount--;
+	if (idx < tcount) {
+		heap_set(idx, theap[tcount]);
+		heap_fix(idx);
+	}
+
+	free(tfind->name);
+	free(tfind);
+}
+
+/* run the timers which are due; returns how many milliseconds to wait
+ * for the next one, or before exiting if there are no timers left */
+static uint64_t checktimers(void)
+{
+	ttype_t	*tmp;
+	uint64_t	now;
+	static	uint64_t	emptysince = 0;
+
+	now = now_ms();
+
+	while (tcount > 0 && theap[0]->etime <= now) {
+		tmp = theap[0];
 
 		if (nut_debug_level)
-			upslogx(LOG_INFO, "Timer queue empty, exiting");
+			upslogx(LOG_INFO, "Event: %s ", tmp->name);
 
-#ifdef UPSSCHED_RACE_TEST
-		upslogx(LOG_INFO, "triggering race: sleeping 15 sec before exit");
-		sleep(15);
-#endif
+		exec_cmd(tmp->name);
 
-		upsdebugx(1, "Timer queue empty, closing pipe and exiting upssched daemon");
-		unlink(pipefn);
-		exit(EXIT_SUCCESS);
+		/* delete from queue */
+		removetimer(tmp);
+
+		/* the command may have taken a while */
+		now = now_ms();
 	}
 
-	emptyctr = 0;
+	if (tcount > 0) {
+		emptysince = 0;
+		return theap[0]->etime - now;
+	}
 
-	/* flip through LL, look for activity */
-	tmp = thead;
+	/* connections may be kept by upsmon to stream its events */
+	if (connhead) {
+		emptysince = 0;
+		return EMPTY_WAIT * 1000;
+	}
 
-	time(&now);
-	while (tmp) {
-		tmpnext = tmp->next;
+	/* if the queue is empty we might be ready to exit,
+	 * but wait a little while in case someone wants us again */
+	if (emptysince == 0)
+		emptysince = now;
 
-		if (now >= tmp->etime) {
-			if (nut_debug_level)
-				upslogx(LOG_INFO, "Event: %s ", tmp->name);
+	if (now - emptysince < EMPTY_WAIT * 1000)
+		return EMPTY_WAIT * 1000 - (now - emptysince);
 
-			exec_cmd(tmp->name);
+	if (nut_debug_level)
+		upslogx(LOG_INFO, "Timer queue empty, exiting");
 
-			/* delete from queue */
-			removetimer(tmp);
-		}
+#ifdef UPSSCHED_RACE_TEST
+	upslogx(LOG_INFO, "triggering race: sleeping 15 sec before exit");
+	sleep(15);
+#endif
 
-		tmp = tmpnext;
-	}
+	upsdebugx(1, "Timer queue empty, closing pipe and exiting upssched daemon");
+	unlink(pipefn);
+	exit(EXIT_SUCCESS);
 }
 
 static void start_timer(const char *name, const char *ofsstr)
 {
-	time_t	now;
+	uint64_t	now;
 	long	ofs;
-	ttype_t	*tmp, *last;
+	ttype_t	*tmp, **tptr, **oldhash;
+	size_t	oldsize, i;
 
 	/* get the time */
-	time(&now);
+	now = now_ms();
 
 	/* add an event for <now> + <time> */
 	ofs = strtol(ofsstr, (char **) NULL, 10);
@@ -219,30 +330,57 @@ static void start_timer(const char *name, const char *ofsstr)
 	if (nut_debug_level)
 		upslogx(LOG_INFO, "New timer: %s (%ld seconds)", name, ofs);
 
-	/* now add to the queue */
-	tmp = last = thead;
+	/* make room: the heap grows by doubling, and the hash table is
+	 * kept at least as large as the heap (both powers of two) */
+	if (tcount == theapsize) {
+		theapsize = theapsize ? 2 * theapsize : 16;
+		theap = xrealloc(theap, theapsize * sizeof(*theap));
+	}
 
-	while (tmp) {
-		last = tmp;
-		tmp = tmp->next;
+	if (thashsize < theapsize) {
+		oldhash = thash;
+		oldsize = thashsize;
+
+		thashsize = theapsize;
+		thash = xcalloc(thashsize, sizeof(*thash));
+
+		/* rehash, keeping the order of same-named timers */
+		for (i = 0; i < oldsize; i++) {
+			while ((tmp = oldhash[i]) != NULL) {
+				oldhash[i] = tmp->hnext;
+				tmp->hnext = NULL;
+
+				for (tptr = &thash[timer_hash(tmp->name)]; *tptr; tptr = &(*tptr)->hnext)
+					;
+				*tptr = tmp;
+			}
+		}
+
+		free(oldhash);
 	}
 
 	tmp = xmalloc(sizeof(ttype_t));
 	tmp->name = xstrdup(name);
-	tmp->etime = now + ofs;
-	tmp->next = NULL;
-
-	if (last)
-		last->next = tmp;
-	else
-		thead = tmp;
+	tmp->etime = now + (uint64_t)ofs * 1000;
+	tmp->seq = tseq++;
+	tmp->hnext = NULL;
+
+	/* now add to the queue, and after the same-named ones */
+	heap_set(tcount, tmp);
+	tcount++;
+	heap_fix(tmp->heapidx);
+
+	for (tptr = &thash[timer_hash(name)]; *tptr; tptr = &(*tptr)->hnext)
+		;
+	*tptr = tmp;
 }
 
 static void cancel_timer(const char *name, const char *cname)
 {
 	ttype_t	*tmp;
 
-	for (tmp = thead; tmp != NULL; tmp = tmp->next) {
+	tmp = thashsize ? thash[timer_hash(name)] : NULL;
+	for (; tmp != NULL; tmp = tmp->hnext) {
 		if (!strcmp(tmp->name, name)) {		/* match */
 			if (nut_debug_level)
 				upslogx(LOG_INFO, "Cancelling timer: %s", name);
@@ -660,6 +798,17 @@ static int sock_arg(conn_t *conn)
 		return 1;
 	}
 
+	/* EVENT <upsname> <notifytype> */
+	if (!strcmp(conn->ctx.arglist[0], "EVENT")) {
+		/* as they would be for upssched started by upsmon */
+		setenv("UPSNAME", conn->ctx.arglist[1], 1);
+		setenv("NOTIFYTYPE", conn->ctx.arglist[2], 1);
+
+		at_run(conn->ctx.arglist[1], conn->ctx.arglist[2], 1);
+		send_to_one(conn, "OK\n");
+		return 1;
+	}
+
 	/* unknown */
 	return 0;
 }
@@ -787,6 +936,42 @@ static int sock_read(conn_t *conn)
 	return 0;	/* fell out without parsing anything */
 }
 
+#ifndef WIN32
+static void set_reload_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	reload_flag = 1;
+}
+
+/* read the configuration again, for the AT lines and CMDSCRIPT: the
+ * daemon keeps the socket and lock file it started with */
+static void reload_conf(void)
+{
+	char	*oldpipefn = pipefn, *oldlockfn = lockfn;
+
+	upslogx(LOG_INFO, "Reloading configuration");
+	reload_flag = 0;
+
+	at_free();
+	free(cmdscript);
+	cmdscript = NULL;
+	pipefn = NULL;
+	lockfn = NULL;
+
+	checkconf();
+
+	if (pipefn && strcmp(pipefn, oldpipefn) != 0) {
+		upslogx(LOG_WARNING, "PIPEFN changed, this takes effect "
+			"when the timer daemon is started again");
+	}
+
+	free(pipefn);
+	free(lockfn);
+	pipefn = oldpipefn;
+	lockfn = oldlockfn;
+}
+#endif
+
 static void start_daemon(TYPE_FD lockfd)
 {
 	int	maxfd = 0;	/* Unidiomatic use vs. "pipefd" below, which is "int" on non-WIN32 */
@@ -878,6 +1063,9 @@ static void start_daemon(TYPE_FD lockfd)
 	if (nut_debug_level)
 		upslogx(LOG_INFO, "Timer daemon started");
 
+	/* SIGHUP reloads the configuration, see reload_conf() */
+	signal(SIGHUP, set_reload_flag);
+
 	/* release the parent */
 	us_serialize(SERIALIZE_SET);
 
@@ -892,12 +1080,18 @@ static void start_daemon(TYPE_FD lockfd)
 	for (;;) {
 		int	zero_reads = 0, total_reads = 0;
 		struct timeval	start, now;
+		uint64_t	next;
+
+		if (reload_flag)
+			reload_conf();
+
+		/* run what is due, and wait just until the next timer */
+		next = checktimers();
 
 		gettimeofday(&start, NULL);
 
-		/* wait at most 1s so we can check our timers regularly */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+		tv.tv_sec = (time_t)(next / 1000);
+		tv.tv_usec = (suseconds_t)((next % 1000) * 1000);
 
 		FD_ZERO(&rfds);
 		FD_SET(pipefd, &rfds);
@@ -938,8 +1132,6 @@ static void start_daemon(TYPE_FD lockfd)
 			}
 		}
 
-		checktimers();
-
 		/* upsdebugx(6, "zero_reads=%d total_reads=%d", zero_reads, total_reads); */
 		if (zero_reads && zero_reads == total_reads) {
 			/* Catch run-away loops - that is, consider
@@ -959,6 +1151,9 @@ static void start_daemon(TYPE_FD lockfd)
 			upsdebugx(6, "difftimeval() => %f sec", d);
 			if (d > 0 && d < 0.2) {
 				d = (1.0 - d) * 1000000.0;
+				/* but do not make a timer late */
+				if (d > (double)next * 1000.0)
+					d = (double)next * 1000.0;
 				upsdebugx(5, "Enforcing a throttling sleep: %f usec", d);
 				usleep((useconds_t)d);
 			}
@@ -992,11 +1187,8 @@ static void start_daemon(TYPE_FD lockfd)
 	/* now watch for activity */
 
 	for (;;) {
-		/* wait at most 1s so we can check our timers regularly */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-
-		timeout_ms = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+		/* run what is due, and wait just until the next timer */
+		timeout_ms = (DWORD)checktimers();
 
 		maxfd = 0;
 
@@ -1045,8 +1237,6 @@ static void start_daemon(TYPE_FD lockfd)
 			}
 
 		}
-
-		checktimers();
 	}
 #endif /* WIN32 */
 }
@@ -1302,9 +1492,12 @@ static void sendcmd(const char *cmd, const char *arg1, const char *arg2)
 	fatalx(EXIT_FAILURE, "Unable to connect to daemon and unable to start daemon");
 }
 
-static void parse_at(const char *ntype, const char *un, const char *cmd,
+/* remember an AT line of the configuration */
+static void at_add(const char *ntype, const char *un, const char *cmd,
 		const char *ca1, const char *ca2)
 {
+	attype_t	*at, **atptr;
+
 	/* complain both ways in case we don't have a tty */
 
 	if (!cmdscript) {
@@ -1322,64 +1515,108 @@ static void parse_at(const char *ntype, const char *un, const char *cmd,
 		fatalx(EXIT_FAILURE, "LOCKFN must be set before any ATs in the config file!");
 	}
 
-	/* check upsname: does this apply to us? */
-	upsdebugx(2, "%s: is '%s' in AT command the '%s' we were launched to process?",
-		__func__, un, upsname);
-	if (strcmp(upsname, un) != 0) {
-		if (strcmp(un, "*") != 0) {
+	at = xcalloc(1, sizeof(*at));
+	at->ntype = xstrdup(ntype);
+	at->un = xstrdup(un);
+	at->cmd = xstrdup(cmd);
+	at->ca1 = xstrdup(ca1);
+	at->ca2 = ca2 ? xstrdup(ca2) : NULL;
+
+	for (atptr = &athead; *atptr; atptr = &(*atptr)->next)
+		;
+	*atptr = at;
+}
+
+static void at_free(void)
+{
+	attype_t	*at;
+
+	while ((at = athead) != NULL) {
+		athead = at->next;
+
+		free(at->ntype);
+		free(at->un);
+		free(at->cmd);
+		free(at->ca1);
+		free(at->ca2);
+		free(at);
+	}
+}
+
+/* carry out the AT lines matching an event: the daemon handles the
+ * timers itself, the command line process asks the daemon for them */
+static void at_run(const char *un, const char *ntype, int indaemon)
+{
+	attype_t	*at;
+
+	for (at = athead; at; at = at->next) {
+		/* check upsname: does this apply to us? */
+		upsdebugx(2, "%s: is '%s' in AT command the '%s' we were launched to process?",
+			__func__, at->un, un);
+		if (strcmp(un, at->un) != 0) {
+			if (strcmp(at->un, "*") != 0) {
+				upsdebugx(1, "%s: SKIP: '%s' in AT command "
+					"did not match the '%s' UPSNAME "
+					"we were launched to process",
+					__func__, at->un, un);
+				continue;	/* not for us, and not the wildcard */
+			} else {
+				upsdebugx(1, "%s: this AT command is for a wildcard: matched", __func__);
+			}
+		} else {
+			upsdebugx(1, "%s: '%s' in AT command matched the '%s' "
+				"UPSNAME we were launched to process",
+				__func__, at->un, un);
+		}
+
+		/* see if the current notify type matches the one from the .conf */
+		if (strcasecmp(ntype, at->ntype) != 0) {
 			upsdebugx(1, "%s: SKIP: '%s' in AT command "
-				"did not match the '%s' UPSNAME "
+				"did not match the '%s' NOTIFYTYPE "
 				"we were launched to process",
-				__func__, un, upsname);
-			return;		/* not for us, and not the wildcard */
-		} else {
-			upsdebugx(1, "%s: this AT command is for a wildcard: matched", __func__);
+				__func__, at->ntype, ntype);
+			continue;
 		}
-	} else {
-		upsdebugx(1, "%s: '%s' in AT command matched the '%s' "
-			"UPSNAME we were launched to process",
-			__func__, un, upsname);
-	}
 
-	/* see if the current notify type matches the one from the .conf */
-	if (strcasecmp(notify_type, ntype) != 0) {
-		upsdebugx(1, "%s: SKIP: '%s' in AT command "
-			"did not match the '%s' NOTIFYTYPE "
-			"we were launched to process",
-			__func__, ntype, notify_type);
-		return;
-	}
+		/* if command is valid, send it to the daemon (which may start it) */
+
+		if (!strcmp(at->cmd, "START-TIMER")) {
+			upsdebugx(1, "%s: processing %s", __func__, at->cmd);
+			if (indaemon && !at->ca2)
+				upslogx(LOG_ERR, "START-TIMER %s without a length", at->ca1);
+			else if (indaemon)
+				start_timer(at->ca1, at->ca2);
+			else
+				sendcmd("START", at->ca1, at->ca2);
+			continue;
+		}
 
-	/* if command is valid, send it to the daemon (which may start it) */
+		if (!strcmp(at->cmd, "CANCEL-TIMER")) {
+			upsdebugx(1, "%s: processing %s", __func__, at->cmd);
+			if (indaemon)
+				cancel_timer(at->ca1, at->ca2);
+			else
+				sendcmd("CANCEL", at->ca1, at->ca2);
+			continue;
+		}
 
-	if (!strcmp(cmd, "START-TIMER")) {
-		upsdebugx(1, "%s: processing %s", __func__, cmd);
-		sendcmd("START", ca1, ca2);
-		return;
-	}
+		if (!strcmp(at->cmd, "EXECUTE")) {
+			upsdebugx(1, "%s: processing %s", __func__, at->cmd);
 
-	if (!strcmp(cmd, "CANCEL-TIMER")) {
-		upsdebugx(1, "%s: processing %s", __func__, cmd);
-		sendcmd("CANCEL", ca1, ca2);
-		return;
-	}
+			if (at->ca1[0] == '\0') {
+				upslogx(LOG_ERR, "Empty EXECUTE command argument");
+				continue;
+			}
 
-	if (!strcmp(cmd, "EXECUTE")) {
-		upsdebugx(1, "%s: processing %s", __func__, cmd);
+			if (nut_debug_level)
+				upslogx(LOG_INFO, "Executing command: %s", at->ca1);
 
-		if (ca1[0] == '\0') {
-			upslogx(LOG_ERR, "Empty EXECUTE command argument");
-			return;
+			exec_cmd(at->ca1);
+			continue;
 		}
 
-		if (nut_debug_level)
-			upslogx(LOG_INFO, "Executing command: %s", ca1);
-
-		exec_cmd(ca1);
-		return;
+		upslogx(LOG_ERR, "Invalid command: %s", at->cmd);
 	}
-
-	upslogx(LOG_ERR, "Invalid command: %s", cmd);
 }
 
 static int conf_arg(size_t numargs, char **arg)
@@ -1421,9 +1658,9 @@ static int conf_arg(size_t numargs, char **arg)
 
 		/* don't use arg[5] unless we have it... */
 		if (numargs > 5)
-			parse_at(arg[1], arg[2], arg[3], arg[4], arg[5]);
+			at_add(arg[1], arg[2], arg[3], arg[4], arg[5]);
 		else
-			parse_at(arg[1], arg[2], arg[3], arg[4], NULL);
+			at_add(arg[1], arg[2], arg[3], arg[4], NULL);
 
 		return 1;
 	}
@@ -1567,10 +1804,13 @@ int main(int argc, char **argv)
 
 	/* see if this matches anything in the config file */
 	/* This is actually the processing loop:
-	 * checkconf -> conf_arg -> parse_at -> sendcmd -> daemon if needed
+	 * checkconf -> conf_arg -> at_add, then
+	 * at_run -> sendcmd -> daemon if needed
 	 *  -> start_daemon -> conn_add(pipefd) or sock_read(conn)
 	 */
 	checkconf();
+	at_run(upsname, notify_type, 0);
+	at_free();
 
 	upsdebugx(1, "Exiting upssched (CLI process)");
 	exit(EXIT_SUCCESS);
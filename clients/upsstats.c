@@ -32,18 +32,33 @@
 #define MAX_PARSE_ARGS 16
 
 static char	*monhost = NULL;
-static int	use_celsius = 1, refreshdelay = -1, treemode = 0;
+static int	use_celsius = 1, refreshdelay = -1, treemode = 0, jsonmode = 0;
 
 	/* from cgilib's checkhost() */
 static char	*monhostdesc = NULL;
 
-static uint16_t	port;
-static char	*upsname, *hostname;
 static char	*upsimgpath="upsimage.cgi", *upsstatpath="upsstats.cgi";
-static UPSCONN_t	ups;
 
-static FILE	*tf;
-static long	forofs = 0;
+/* a template is read once and split into these, then run over for
+ * each UPS between FOREACHUPS and ENDFOR */
+typedef enum {
+	TPL_TEXT = 0,	/* to pass through */
+	TPL_CMD,	/* between two '@' */
+	TPL_EOL	/* end of a line of the template */
+} tpl_optype_t;
+
+typedef struct {
+	tpl_optype_t	type;
+	char	*text;
+} tpl_op_t;
+
+static tpl_op_t	*tplops = NULL;
+static size_t	tplcount = 0, tplalloc = 0;
+
+/* first op of the line after FOREACHUPS (0: not in a loop), and whether
+ * ENDFOR asked to go back there at the end of its line */
+static size_t	forop = 0, tplpos = 0;
+static int	forjump = 0;
 
 static ulist_t	*ulhead = NULL, *currups = NULL;
 
@@ -68,31 +83,29 @@ void parsearg(char *var, char *value)
 		/* FIXME: Validate that treemode is allowed */
 		treemode = 1;
 	}
+
+	if (!strcmp(var, "json"))
+		jsonmode = 1;
 }
 
 static void report_error(void)
 {
-	if (upscli_upserror(&ups) == UPSCLI_ERR_VARNOTSUPP)
-		printf("Not supported\n");
-	else
-		printf("[error: %s]\n", upscli_strerror(&ups));
+	printf("[error: %s]\n", cgi_strerror());
 }
 
-/* make sure we're actually connected to upsd */
-static int check_ups_fd(int do_report)
+/* make sure the values of the UPS can be had (from upsd or the cache) */
+static int check_ups(int do_report)
 {
-	if (upscli_fd(&ups) == -1) {
+	if (!currups) {
 		if (do_report)
-			report_error();
+			printf("No UPS specified for monitoring\n");
 
 		return 0;
 	}
 
-	/* also check for insanity in currups */
-
-	if (!currups) {
+	if (!cgi_checkups(currups->sys)) {
 		if (do_report)
-			printf("No UPS specified for monitoring\n");
+			report_error();
 
 		return 0;
 	}
@@ -101,46 +114,23 @@ static int check_ups_fd(int do_report)
 	return 1;
 }
 
+/* all the values of the UPS come at once: see cgi_getvar() */
 static int get_var(const char *var, char *buf, size_t buflen, int verbose)
 {
 	int	ret;
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
 
-	if (!check_ups_fd(1))
+	if (!check_ups(verbose))
 		return 0;
 
-	if (!upsname) {
-		if (verbose)
-			printf("[No UPS name specified]\n");
-
-		return 0;
-	}
+	ret = cgi_getvar(currups->sys, var, buf, buflen);
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	query[2] = var;
-
-	numq = 3;
-
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
-
-	if (ret < 0) {
-		if (verbose)
-			report_error();
-		return 0;
-	}
+	if (ret == 0 && verbose)
+		printf("Not supported\n");
 
-	if (numa < numq) {
-		if (verbose)
-			printf("[Invalid response]\n");
+	if (ret < 0 && verbose)
+		report_error();
 
-		return 0;
-	}
-
-	snprintf(buf, buflen, "%s", answer[3]);
-	return 1;
+	return (ret == 1);
 }
 
 static void parse_var(const char *var)
@@ -347,61 +337,20 @@ static int do_img(char *buf)
 	return 0;
 }
 
+/* the values of each UPS are fetched when first needed, see cgilib */
 static void ups_connect(void)
 {
-	static ulist_t	*lastups = NULL;
-	char	*newups, *newhost;
+	char	*newups = NULL, *newhost = NULL;
 	uint16_t	newport;
 
-	/* try to minimize reconnects */
-	if (lastups) {
-
-		/* don't reconnect if these are both the same UPS */
-		if (!strcmp(lastups->sys, currups->sys)) {
-			lastups = currups;
-			return;
-		}
-
-		/* see if it's just on the same host */
-		newups = newhost = NULL;
-
-		if (upscli_splitname(currups->sys, &newups, &newhost,
-			&newport) != 0) {
-			printf("Unusable UPS definition [%s]\n", currups->sys);
-			fprintf(stderr, "Unusable UPS definition [%s]\n",
-				currups->sys);
-			exit(EXIT_FAILURE);
-		}
-
-		if ((!strcmp(newhost, hostname)) && (port == newport)) {
-			free(upsname);
-			upsname = newups;
-
-			free(newhost);
-			lastups = currups;
-			return;
-		}
-
-		/* not the same upsd, so disconnect */
-		free(newups);
-		free(newhost);
-	}
-
-	upscli_disconnect(&ups);
-
-	free(upsname);
-	free(hostname);
-
-	if (upscli_splitname(currups->sys, &upsname, &hostname, &port) != 0) {
+	if (upscli_splitname(currups->sys, &newups, &newhost, &newport) != 0) {
 		printf("Unusable UPS definition [%s]\n", currups->sys);
 		fprintf(stderr, "Unusable UPS definition [%s]\n", currups->sys);
 		exit(EXIT_FAILURE);
 	}
 
-	if (upscli_connect(&ups, hostname, port, 0) < 0)
-		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(&ups));
-
-	lastups = currups;
+	free(newups);
+	free(newhost);
 }
 
 static void do_hostlink(void)
@@ -435,7 +384,7 @@ static void do_ifsupp(const char *var, const char *val)
 	char	dummy[SMALLBUF];
 
 	/* if not connected, act like it's not supported and skip the rest */
-	if (!check_ups_fd(0)) {
+	if (!check_ups(0)) {
 		skip_clause = 1;
 		return;
 	}
@@ -515,7 +464,7 @@ static void do_ifbetween(const char *s)
 		return;
 	}
 
-	if (!check_ups_fd(0)) {
+	if (!check_ups(0)) {
 		return;
 	}
 
@@ -596,7 +545,7 @@ static void do_statuscolor(void)
 	int	severity, i;
 	char	stat[SMALLBUF], *sp, *ptr;
 
-	if (!check_ups_fd(0)) {
+	if (!check_ups(0)) {
 
 		/* can't print the warning here - give a red error condition */
 		printf("#FF0000");
@@ -724,7 +673,11 @@ static int do_command(char *cmd)
 	}
 
 	if (!strcmp(cmd, "FOREACHUPS")) {
-		forofs = ftell(tf);
+		/* the loop starts with the next line */
+		for (forop = tplpos; forop < tplcount; forop++)
+			if (tplops[forop].type == TPL_EOL)
+				break;
+		forop++;
 
 		currups = ulhead;
 		ups_connect();
@@ -734,14 +687,15 @@ static int do_command(char *cmd)
 	if (!strcmp(cmd, "ENDFOR")) {
 
 		/* if not in a for, ignore this */
-		if (forofs == 0) {
+		if (forop == 0) {
 			return 1;
 		}
 
 		currups = currups->next;
 
 		if (currups) {
-			fseek(tf, forofs, SEEK_SET);
+			/* once done with this line, like the rest of it */
+			forjump = 1;
 			ups_connect();
 		}
 
@@ -806,11 +760,26 @@ static int do_command(char *cmd)
 	return 0;
 }
 
+static void tpl_add(tpl_optype_t type, const char *text, size_t len)
+{
+	if (tplcount == tplalloc) {
+		tplalloc = tplalloc ? tplalloc * 2 : 64;
+		tplops = xrealloc(tplops, tplalloc * sizeof(*tplops));
+	}
+
+	assert (len < INT_MAX);
+	tplops[tplcount].type = type;
+	tplops[tplcount].text = xmalloc(len + 1);
+	snprintf(tplops[tplcount].text, len + 1, "%.*s", (int)len, text);
+	tplcount++;
+}
+
+/* split a line into text and commands, as they will be run */
 static void parse_line(const char *buf)
 {
-	char	cmd[SMALLBUF];
-	size_t	i, len;
+	size_t	i, len, cmdlen = 0;
 	char	do_cmd = 0;
+	const	char	*cmd = "";
 
 	for (i = 0; buf[i]; i += len) {
 
@@ -818,35 +787,34 @@ static void parse_line(const char *buf)
 
 		if (len == 0) {
 			if (do_cmd) {
-				do_command(cmd);
+				tpl_add(TPL_CMD, cmd, cmdlen);
 				do_cmd = 0;
 			} else {
-				cmd[0] = '\0';
+				cmd = "";
+				cmdlen = 0;
 				do_cmd = 1;
 			}
 			i++;	/* skip over the '@' character */
 			continue;
 		}
-		assert (len < INT_MAX);
 
 		if (do_cmd) {
-			snprintf(cmd, sizeof(cmd), "%.*s", (int)len, &buf[i]);
+			/* as long as a command may be */
+			cmd = &buf[i];
+			cmdlen = (len < SMALLBUF) ? len : SMALLBUF - 1;
 			continue;
 		}
 
-		if (skip_clause || skip_block) {
-			/* ignore this */
-			continue;
-		}
-
-		/* pass it trough */
-		printf("%.*s", (int)len, &buf[i]);
+		tpl_add(TPL_TEXT, &buf[i], len);
 	}
+
+	tpl_add(TPL_EOL, "", 0);
 }
 
-static void display_template(const char *tfn)
+static void load_template(const char *tfn)
 {
 	char	fn[SMALLBUF], buf[LARGEBUF];
+	FILE	*tf;
 
 	snprintf(fn, sizeof(fn), "%s/%s", confpath(), tfn);
 
@@ -867,27 +835,56 @@ static void display_template(const char *tfn)
 	fclose(tf);
 }
 
-static void display_tree(int verbose)
+static void display_template(const char *tfn)
 {
-	size_t	numq, numa;
-	const	char	*query[4];
-	char	**answer;
-
-	if (!upsname) {
-		if (verbose)
-			printf("[No UPS name specified]\n");
-		return;
+	char	cmd[SMALLBUF];
+	tpl_op_t	*op;
+
+	load_template(tfn);
+
+	for (tplpos = 0; tplpos < tplcount; tplpos++) {
+		op = &tplops[tplpos];
+
+		switch (op->type) {
+		case TPL_CMD:
+			/* the commands may cut up their copy */
+			snprintf(cmd, sizeof(cmd), "%s", op->text);
+			do_command(cmd);
+			break;
+
+		case TPL_TEXT:
+			if (!skip_clause && !skip_block)
+				printf("%s", op->text);
+			break;
+
+		case TPL_EOL:
+		default:
+			if (forjump) {
+				forjump = 0;
+				tplpos = forop - 1;
+			}
+			break;
+		}
 	}
+}
 
-	query[0] = "VAR";
-	query[1] = upsname;
-	numq = 2;
+static void display_tree_var(void *arg, const char *name, const char *value)
+{
+	NUT_UNUSED_VARIABLE(arg);
 
-	if (upscli_list_start(&ups, numq, query) < 0) {
-		if (verbose)
-			report_error();
+	printf("<TR BGCOLOR=\"#60B0B0\" ALIGN=\"LEFT\">\n");
+
+	printf("<TD>%s</TD>\n", name);
+	printf("<TD>:</TD>\n");
+	printf("<TD>%s<br></TD>\n", value);
+
+	printf("</TR>\n");
+}
+
+static void display_tree(int verbose)
+{
+	if (!check_ups(verbose))
 		return;
-	}
 
 	printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
 	printf("	\"http://www.w3.org/TR/REC-html40/loose.dtd\">\n");
@@ -908,24 +905,7 @@ static void display_tree(int verbose)
 
 	printf("<TR><TH COLSPAN=3 BGCOLOR=\"#60B0B0\"></TH></TR>\n");
 
-	while (upscli_list_next(&ups, numq, query, &numa, &answer) == 1) {
-
-		/* VAR <upsname> <varname> <val> */
-		if (numa < 4) {
-			if (verbose)
-				printf("[Invalid response]\n");
-
-			return;
-		}
-
-		printf("<TR BGCOLOR=\"#60B0B0\" ALIGN=\"LEFT\">\n");
-
-		printf("<TD>%s</TD>\n", answer[2]);
-		printf("<TD>:</TD>\n");
-		printf("<TD>%s<br></TD>\n", answer[3]);
-
-		printf("</TR>\n");
-	}
+	cgi_listvars(currups->sys, display_tree_var, NULL);
 
 	printf("</TABLE>\n");
 	printf("</TD></TR></TABLE>\n");
@@ -975,6 +955,12 @@ static void load_hosts_conf(void)
 	if (!pconf_file_begin(&ctx, fn)) {
 		pconf_finish(&ctx);
 
+		if (jsonmode) {
+			printf("{\"error\":\"can't open hosts.conf\"}\n");
+			fprintf(stderr, "upsstats: %s\n", ctx.errmsg);
+			exit(EXIT_FAILURE);
+		}
+
 		printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
 		printf("	\"http://www.w3.org/TR/REC-html40/loose.dtd\">\n");
 		printf("<HTML><HEAD>\n");
@@ -1002,11 +988,21 @@ static void load_hosts_conf(void)
 		if (!strcmp(ctx.arglist[0], "MONITOR"))
 			add_ups(ctx.arglist[1], ctx.arglist[2]);
 
+		/* STATUSCACHE <directory> <seconds> */
+		if (!strcmp(ctx.arglist[0], "STATUSCACHE"))
+			cgi_statuscache(ctx.arglist[1], ctx.arglist[2]);
+
 	}
 
 	pconf_finish(&ctx);
 
 	if (!ulhead) {
+		if (jsonmode) {
+			printf("{\"error\":\"no hosts to monitor\"}\n");
+			fprintf(stderr, "upsstats: no hosts to monitor\n");
+			exit(EXIT_FAILURE);
+		}
+
 		printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
 		printf("	\"http://www.w3.org/TR/REC-html40/loose.dtd\">\n");
 		printf("<HTML><HEAD>\n");
@@ -1021,6 +1017,87 @@ static void load_hosts_conf(void)
 	}
 }
 
+/* a string in JSON, with what may not appear as is escaped */
+static void json_string(const char *str)
+{
+	const	unsigned char	*p;
+
+	putchar('"');
+
+	for (p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p < 0x20)
+			printf("\\u%04x", (unsigned int)*p);
+		else
+			putchar(*p);
+	}
+
+	putchar('"');
+}
+
+static void json_var(void *arg, const char *name, const char *value)
+{
+	int	*first = arg;
+
+	if (!*first)
+		putchar(',');
+	*first = 0;
+
+	json_string(name);
+	putchar(':');
+	json_string(value);
+}
+
+/* all the values of the UPSes of the page as one document:
+ * {"version":"...","ups":[{"host":"...","desc":"...","vars":{...}},...]}
+ * with "error" instead of "vars" for a UPS which can't be read */
+static void display_json(void)
+{
+	int	first;
+
+	if (monhost) {
+		if (!checkhost(monhost, &monhostdesc)) {
+			printf("{\"error\":\"Access to that host is not authorized\"}\n");
+			exit(EXIT_FAILURE);
+		}
+
+		add_ups(monhost, monhostdesc);
+	} else {
+		load_hosts_conf();
+	}
+
+	printf("{\"version\":");
+	json_string(UPS_VERSION);
+	printf(",\"ups\":[");
+
+	for (currups = ulhead; currups; currups = currups->next) {
+		if (currups != ulhead)
+			putchar(',');
+
+		printf("{\"host\":");
+		json_string(currups->sys);
+		printf(",\"desc\":");
+		json_string(currups->desc);
+
+		if (!cgi_checkups(currups->sys)) {
+			printf(",\"error\":");
+			json_string(cgi_strerror());
+			putchar('}');
+			continue;
+		}
+
+		first = 1;
+		printf(",\"vars\":{");
+		cgi_listvars(currups->sys, json_var, &first);
+		printf("}}");
+	}
+
+	printf("]}\n");
+
+	cgi_disconnect();
+}
+
 static void display_single(void)
 {
 	if (!checkhost(monhost, &monhostdesc)) {
@@ -1040,7 +1117,7 @@ static void display_single(void)
 	else
 		display_template("upsstats-single.html");
 
-	upscli_disconnect(&ups);
+	cgi_disconnect();
 }
 
 int main(int argc, char **argv)
@@ -1050,6 +1127,15 @@ int main(int argc, char **argv)
 
 	extractcgiargs();
 
+	if (jsonmode) {
+		printf("Content-type: application/json\n");
+		printf("Pragma: no-cache\n");
+		printf("\n");
+
+		display_json();
+		exit(EXIT_SUCCESS);
+	}
+
 	printf("Content-type: text/html\n");
 	printf("Pragma: no-cache\n");
 	printf("\n");
@@ -1068,7 +1154,7 @@ int main(int argc, char **argv)
 
 	display_template("upsstats.html");
 
-	upscli_disconnect(&ups);
+	cgi_disconnect();
 
 	return 0;
 }
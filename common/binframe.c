@@ -0,0 +1,150 @@
+/* binframe.c - Network UPS Tools binary framing of network protocol replies
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"	/* must be first */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "binframe.h"
+
+size_t binframe_header(unsigned char *buf, unsigned int type, size_t len)
+{
+	buf[0] = (unsigned char)type;
+	buf[1] = (unsigned char)((len >> 8) & 0xff);
+	buf[2] = (unsigned char)(len & 0xff);
+
+	return BINFRAME_HEADER_LEN;
+}
+
+void binframe_put_u32(unsigned char *buf, uint32_t val)
+{
+	buf[0] = (unsigned char)(val >> 24);
+	buf[1] = (unsigned char)(val >> 16);
+	buf[2] = (unsigned char)(val >> 8);
+	buf[3] = (unsigned char)val;
+}
+
+uint32_t binframe_get_u32(const unsigned char *buf)
+{
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16)
+		| ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+void binframe_put_i64(unsigned char *buf, int64_t val)
+{
+	binframe_put_u32(buf, (uint32_t)((uint64_t)val >> 32));
+	binframe_put_u32(buf + 4, (uint32_t)((uint64_t)val & 0xffffffffU));
+}
+
+int64_t binframe_get_i64(const unsigned char *buf)
+{
+	uint64_t	u = ((uint64_t)binframe_get_u32(buf) << 32)
+		| (uint64_t)binframe_get_u32(buf + 4);
+
+	/* two's complement, without relying on the conversion of
+	 * out-of-range values to a signed type */
+	if (u & ((uint64_t)1 << 63)) {
+		return -(int64_t)(~u) - 1;
+	}
+
+	return (int64_t)u;
+}
+
+int binframe_num_parse(const char *val, int64_t *mantissa, unsigned int *decimals)
+{
+	const char	*p = val;
+	int64_t	m = 0;
+	unsigned int	digits = 0, dec = 0;
+	int	neg = 0, frac = 0;
+
+	if (*p == '-') {
+		neg = 1;
+		p++;
+	}
+
+	/* the integer part: "0" or no leading zeros */
+	if (*p == '0' && p[1] >= '0' && p[1] <= '9') {
+		return 0;
+	}
+
+	if (*p < '0' || *p > '9') {
+		return 0;
+	}
+
+	for (; *p; p++) {
+		if (*p == '.' && !frac) {
+			frac = 1;
+
+			/* at least one digit after the dot */
+			if (p[1] < '0' || p[1] > '9') {
+				return 0;
+			}
+			continue;
+		}
+
+		if (*p < '0' || *p > '9' || ++digits > BINFRAME_NUM_DIGITS) {
+			return 0;
+		}
+
+		m = m * 10 + (*p - '0');
+		dec += (unsigned int)frac;
+	}
+
+	/* "-0" or "-0.00" would come back without the sign */
+	if (neg && m == 0) {
+		return 0;
+	}
+
+	*mantissa = (neg ? -m : m);
+	*decimals = dec;
+
+	return 1;
+}
+
+size_t binframe_num_format(int64_t mantissa, unsigned int decimals,
+	char *buf, size_t bufsize)
+{
+	uint64_t	u, scale = 1;
+	unsigned int	i;
+	int	ret;
+
+	if (decimals > BINFRAME_NUM_DIGITS) {
+		return 0;
+	}
+
+	for (i = 0; i < decimals; i++) {
+		scale *= 10;
+	}
+
+	u = (mantissa < 0 ? (uint64_t)(-(mantissa + 1)) + 1 : (uint64_t)mantissa);
+
+	if (decimals == 0) {
+		ret = snprintf(buf, bufsize, "%s%" PRIuMAX,
+			(mantissa < 0 ? "-" : ""), (uintmax_t)u);
+	} else {
+		ret = snprintf(buf, bufsize, "%s%" PRIuMAX ".%0*" PRIuMAX,
+			(mantissa < 0 ? "-" : ""), (uintmax_t)(u / scale),
+			(int)decimals, (uintmax_t)(u % scale));
+	}
+
+	if (ret < 0 || (size_t)ret >= bufsize) {
+		return 0;
+	}
+
+	return (size_t)ret;
+}
@@ -28,6 +28,9 @@
 # include <pwd.h>
 # include <grp.h>
 # include <sys/un.h>
+# ifdef HAVE_PTHREAD
+#  include <pthread.h>	/* upslog_batch_mutex */
+# endif
 #else
 # include <wincompat.h>
 # include <processthreadsapi.h>
@@ -38,6 +41,13 @@
 # include <unistd.h>	/* readlink */
 #endif
 
+#ifdef __linux__
+# include <sys/syscall.h>	/* pidfd_open, pidfd_send_signal */
+# if (defined SYS_pidfd_open) && (defined SYS_pidfd_send_signal)
+#  define NUT_HAVE_PIDFD	1
+# endif
+#endif
+
 #include <dirent.h>
 #if !HAVE_DECL_REALPATH
 # include <sys/stat.h>
@@ -784,6 +794,9 @@ void background(void)
 #ifndef WIN32
 	int	pid;
 
+	/* not written twice, by both processes */
+	upslog_flush();
+
 	if ((pid = fork()) < 0)
 		fatal_with_errno(EXIT_FAILURE, "Unable to enter background");
 #endif
@@ -1902,6 +1915,73 @@ int sendsignalpid(pid_t pid, int sig, const char *progname, int check_current_pr
 #endif
 }
 
+#ifndef WIN32
+int nut_proc_open(nut_proc_t *proc, pid_t pid, const char *progname, int check_current_progname)
+{
+	proc->pid = pid;
+	proc->pidfd = -1;
+	proc->progname = progname;
+	proc->check_current_progname = check_current_progname;
+
+#ifdef NUT_HAVE_PIDFD
+	/* first, so that the checks below are about the process it holds
+	 * (ENOSYS on older kernels: then we do without) */
+	if (pid >= 2 && pid <= get_max_pid_t()) {
+		proc->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+		if (proc->pidfd < 0) {
+			upsdebug_with_errno(3, "%s: pidfd_open(%" PRIdMAX ")",
+				__func__, (intmax_t)pid);
+			proc->pidfd = -1;
+		}
+	}
+#endif
+
+	/* the usual checks of its name, and that it can be signalled */
+	if (sendsignalpid(pid, 0, progname, check_current_progname) < 0) {
+		nut_proc_close(proc);
+		return -1;
+	}
+
+	/* still alive after the checks, so the PID was not reused meanwhile
+	 * and the checks were about the very process the pidfd refers to */
+	if (proc->pidfd >= 0 && nut_proc_signal(proc, 0) < 0) {
+		nut_proc_close(proc);
+		return -1;
+	}
+
+	return 0;
+}
+
+int nut_proc_signal(nut_proc_t *proc, int sig)
+{
+#ifdef NUT_HAVE_PIDFD
+	if (proc->pidfd >= 0) {
+		if (syscall(SYS_pidfd_send_signal, proc->pidfd, sig, NULL, 0) < 0) {
+			/* like kill() in sendsignalpid(): gone is no news for 0 */
+			if (nut_debug_level > 0
+			 || (sig ? nut_sendsignal_debug_level > 1
+			         : nut_sendsignal_debug_level >= NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING)
+			) {
+				perror("pidfd_send_signal");
+			}
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
+	return sendsignalpid(proc->pid, sig, proc->progname, proc->check_current_progname);
+}
+
+void nut_proc_close(nut_proc_t *proc)
+{
+	if (proc->pidfd >= 0) {
+		close(proc->pidfd);
+		proc->pidfd = -1;
+	}
+}
+#endif	/* !WIN32 */
+
 /* parses string buffer into a pid_t if it passes
  * a few sanity checks; returns -1 on error
  */
@@ -2795,14 +2875,104 @@ void nut_report_config_flags(void)
 	}
 }
 
+/* Batched stderr output, see upslog_set_batch(); a daemon's helper
+ * threads (e.g. upsd STARTTLS handshake workers) log too */
+static char	*upslog_batch_buf = NULL;
+static size_t	upslog_batch_len = 0, upslog_batch_size = 0;
+
+#if (defined HAVE_PTHREAD) && (!defined WIN32)
+static pthread_mutex_t	upslog_batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define upslog_batch_lock()	pthread_mutex_lock(&upslog_batch_mutex)
+# define upslog_batch_unlock()	pthread_mutex_unlock(&upslog_batch_mutex)
+#else
+# define upslog_batch_lock()
+# define upslog_batch_unlock()
+#endif
+
+/* with upslog_batch_mutex held */
+static void upslog_batch_write(void)
+{
+	if (upslog_batch_len > 0) {
+		fwrite(upslog_batch_buf, 1, upslog_batch_len, stderr);
+		upslog_batch_len = 0;
+	}
+#ifdef WIN32
+	fflush(stderr);
+#endif
+}
+
+void upslog_flush(void)
+{
+	upslog_batch_lock();
+	upslog_batch_write();
+	upslog_batch_unlock();
+}
+
+void upslog_set_batch(size_t size)
+{
+	static int	registered = 0;
+	/* not allocated under the lock: xmalloc() failing logs */
+	char	*buf = (size > 0) ? xmalloc(size) : NULL, *old;
+
+	upslog_batch_lock();
+
+	upslog_batch_write();
+	old = upslog_batch_buf;
+	upslog_batch_buf = buf;
+	upslog_batch_size = size;
+
+	if (size > 0 && !registered) {
+		atexit(upslog_flush);
+		registered = 1;
+	}
+
+	upslog_batch_unlock();
+
+	free(old);
+}
+
+/* Write a line (without its newline) to stderr, or add it to the batch;
+ * errors and warnings are not held back */
+static void upslog_stderr(int priority, const char *prefix, const char *line)
+{
+	size_t	prefixlen = strlen(prefix), linelen = strlen(line);
+	size_t	len = prefixlen + linelen + 1;
+
+	upslog_batch_lock();
+
+	if (!upslog_batch_buf || len > upslog_batch_size) {
+		upslog_batch_write();
+		fprintf(stderr, "%s%s\n", prefix, line);
+#ifdef WIN32
+		fflush(stderr);
+#endif
+		upslog_batch_unlock();
+		return;
+	}
+
+	if (upslog_batch_len + len > upslog_batch_size) {
+		upslog_batch_write();
+	}
+
+	memcpy(upslog_batch_buf + upslog_batch_len, prefix, prefixlen);
+	memcpy(upslog_batch_buf + upslog_batch_len + prefixlen, line, linelen);
+	upslog_batch_buf[upslog_batch_len + len - 1] = '\n';
+	upslog_batch_len += len;
+
+	if (priority <= LOG_WARNING) {
+		upslog_batch_write();
+	}
+
+	upslog_batch_unlock();
+}
+
 static void vupslog(int priority, const char *fmt, va_list va, int use_strerror)
 {
 	int	ret, errno_orig = errno;
-	size_t	bufsize = LARGEBUF;
-	char	*buf = xcalloc(sizeof(char), bufsize);
-
-	/* Be pedantic about our limitations */
-	bufsize *= sizeof(char);
+	/* Most messages fit here: no allocation for them */
+	char	stackbuf[LARGEBUF];
+	size_t	bufsize = sizeof(stackbuf);
+	char	*buf = stackbuf;
 
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
@@ -2858,7 +3028,11 @@ static void vupslog(int priority, const char *fmt, va_list va, int use_strerror)
 						newbufsize);
 				}
 				bufsize = newbufsize;
-				buf = xrealloc(buf, bufsize);
+				if (buf == stackbuf) {
+					buf = xmalloc(bufsize);
+				} else {
+					buf = xrealloc(buf, bufsize);
+				}
 				continue;
 			}
 		} else {
@@ -2934,6 +3108,7 @@ vupslog_too_long:
 	if (xbit_test(upslog_flags, UPSLOG_STDERR)) {
 		if (nut_debug_level > 0) {
 			struct timeval		now;
+			char	stamp[32];
 
 			gettimeofday(&now, NULL);
 
@@ -2944,20 +3119,18 @@ vupslog_too_long:
 
 			/* Print all in one shot, to better avoid
 			 * mixed lines in parallel threads */
-			fprintf(stderr, "%4.0f.%06ld\t%s\n",
+			snprintf(stamp, sizeof(stamp), "%4.0f.%06ld\t",
 				difftime(now.tv_sec, upslog_start.tv_sec),
-				(long)(now.tv_usec - upslog_start.tv_usec),
-				buf);
+				(long)(now.tv_usec - upslog_start.tv_usec));
+			upslog_stderr(priority, stamp, buf);
 		} else {
-			fprintf(stderr, "%s\n", buf);
+			upslog_stderr(priority, "", buf);
 		}
-#ifdef WIN32
-		fflush(stderr);
-#endif
 	}
 	if (xbit_test(upslog_flags, UPSLOG_SYSLOG))
 		syslog(priority, "%s", buf);
-	free(buf);
+	if (buf != stackbuf)
+		free(buf);
 }
 
 
@@ -3376,6 +3549,14 @@ failed:
 	s_upsdebugx(level, "%s", "Failed to print an ASCII data dump for debug");
 }
 
+/* see upslog_set_fatal_hook() */
+static void	(*fatal_hook)(void) = NULL;
+
+void upslog_set_fatal_hook(void (*hook)(void))
+{
+	fatal_hook = hook;
+}
+
 static void vfatal(const char *fmt, va_list va, int use_strerror)
 {
 	/* Normally we enable SYSLOG and disable STDERR,
@@ -3433,6 +3614,9 @@ void fatal_with_errno(int status, const char *fmt, ...)
 #endif
 	va_end(va);
 
+	if (fatal_hook)
+		fatal_hook();
+
 	exit(status);
 }
 
@@ -3456,6 +3640,9 @@ void fatalx(int status, const char *fmt, ...)
 #endif
 	va_end(va);
 
+	if (fatal_hook)
+		fatal_hook();
+
 	exit(status);
 }
 
@@ -3876,6 +4063,64 @@ void upsdebugx_report_search_paths(int level, int report_search_paths_builtin) {
 #endif
 }
 
+static char * get_libname_candidate(char *current_test_path, const char *dirname) {
+	/* Implementation detail for get_libname_in_dir() below.
+	 * Returns pointer to allocated copy of the resolved path
+	 * (caller must free later) if the named file is (points to?)
+	 * a valid file, or NULL otherwise.
+	 * The current_test_path buffer (LARGEBUF) may be modified.
+	 */
+	char *libname_path = NULL;
+#if HAVE_DECL_REALPATH
+	NUT_UNUSED_VARIABLE(dirname);
+
+	libname_path = realpath(current_test_path, NULL);
+#else
+	struct stat	st;
+
+	/* Just check if candidate name is (points to?) valid file */
+	if (stat(current_test_path, &st) == 0) {
+		if (st.st_size > 0) {
+			libname_path = xstrdup(current_test_path);
+		}
+	}
+
+# ifdef WIN32
+	if (!libname_path) {
+		char *p;
+		for (p = current_test_path; *p != '\0' && (p - current_test_path) < LARGEBUF; p++) {
+			if (*p == '/') *p = '\\';
+		}
+		upsdebugx(4, "%s: WIN32: re-checking with %s",
+			__func__, current_test_path);
+		if (stat(current_test_path, &st) == 0) {
+			if (st.st_size > 0) {
+				libname_path = xstrdup(current_test_path);
+			}
+		}
+	}
+	if (!libname_path && strcmp(dirname, ".") == 0 && current_test_path[0] == '.' && current_test_path[1] == '\\' && current_test_path[2] != '\0') {
+		/* Seems mingw stat() only works for files in current dir,
+		 * so for others a chdir() is needed (and memorizing the
+		 * original dir, and no threading at this moment, to be safe!)
+		 * https://stackoverflow.com/a/66096983/4715872
+		 */
+		upsdebugx(4, "%s: WIN32: re-checking with %s",
+			__func__, current_test_path + 2);
+		if (stat(current_test_path + 2, &st) == 0) {
+			if (st.st_size > 0) {
+				libname_path = xstrdup(current_test_path + 2);
+			}
+		}
+	}
+# else
+	NUT_UNUSED_VARIABLE(dirname);
+# endif /* WIN32 */
+#endif  /* HAVE_DECL_REALPATH */
+
+	return libname_path;
+}
+
 static char * get_libname_in_dir(const char* base_libname, size_t base_libname_length, const char* dirname, int index) {
 	/* Implementation detail for get_libname() below.
 	 * Returns pointer to allocated copy of the buffer
@@ -3892,7 +4137,28 @@ static char * get_libname_in_dir(const char* base_libname, size_t base_libname_l
 	upsdebugx(3, "%s('%s', %" PRIuSIZE ", '%s', %i): Entering method...",
 		__func__, base_libname, base_libname_length, dirname, index);
 
+	if (index >= 0) {
+		upsdebugx(4, "%s: Looking for lib %s in directory #%d : %s",
+			__func__, base_libname, index, dirname);
+	} else {
+		upsdebugx(4, "%s: Looking for lib %s in directory : %s",
+			__func__, base_libname, dirname);
+	}
+
+	/* Only an entry with exactly this name would do, so ask for it:
+	 * one stat(), however large (or remote) the directory is */
 	memset(current_test_path, 0, LARGEBUF);
+	snprintf(current_test_path, LARGEBUF, "%s/%s", dirname, base_libname);
+	libname_path = get_libname_candidate(current_test_path, dirname);
+
+	upsdebugx(libname_path ? 2 : 5, "Candidate path for lib %s is %s (realpath %s)",
+		base_libname, current_test_path,
+		NUT_STRARG(libname_path));
+
+	/* Reading through the directory only tells about seemingly related
+	 * names, which nobody sees unless debugging */
+	if (libname_path != NULL || nut_debug_level < 1)
+		return libname_path;
 
 	if ((dp = opendir(dirname)) == NULL) {
 		if (index >= 0) {
@@ -3907,99 +4173,32 @@ static char * get_libname_in_dir(const char* base_libname, size_t base_libname_l
 		return NULL;
 	}
 
-	if (index >= 0) {
-		upsdebugx(4, "%s: Looking for lib %s in directory #%d : %s",
-			__func__, base_libname, index, dirname);
-	} else {
-		upsdebugx(4, "%s: Looking for lib %s in directory : %s",
-			__func__, base_libname, dirname);
-	}
-
-	/* TODO: Try a quick stat() first? */
 	while ((dirp = readdir(dp)) != NULL)
 	{
-#if !HAVE_DECL_REALPATH
-		struct stat	st;
-#endif
-		int compres;
-
 		upsdebugx(5, "%s: Comparing lib %s with dirpath entry %s",
 			__func__, base_libname, dirp->d_name);
-		compres = strncmp(dirp->d_name, base_libname, base_libname_length);
-		if (compres == 0) {
-			/* avoid "*.dll.a", ".so.1.2.3" etc. */
-			if (dirp->d_name[base_libname_length] != '\0') {
-				if (!libname_alias) {
-					libname_alias = xstrdup(dirp->d_name);
-				}
-				continue;
-			}
 
-			snprintf(current_test_path, LARGEBUF, "%s/%s", dirname, dirp->d_name);
-#if HAVE_DECL_REALPATH
-			libname_path = realpath(current_test_path, NULL);
-#else
-			/* Just check if candidate name is (points to?) valid file */
-			libname_path = NULL;
-			if (stat(current_test_path, &st) == 0) {
-				if (st.st_size > 0) {
-					libname_path = xstrdup(current_test_path);
-				}
-			}
-
-# ifdef WIN32
-			if (!libname_path) {
-				char *p;
-				for (p = current_test_path; *p != '\0' && (p - current_test_path) < LARGEBUF; p++) {
-					if (*p == '/') *p = '\\';
-				}
-				upsdebugx(4, "%s: WIN32: re-checking with %s",
-					__func__, current_test_path);
-				if (stat(current_test_path, &st) == 0) {
-					if (st.st_size > 0) {
-						libname_path = xstrdup(current_test_path);
-					}
-				}
-			}
-			if (!libname_path && strcmp(dirname, ".") == 0 && current_test_path[0] == '.' && current_test_path[1] == '\\' && current_test_path[2] != '\0') {
-				/* Seems mingw stat() only works for files in current dir,
-				 * so for others a chdir() is needed (and memorizing the
-				 * original dir, and no threading at this moment, to be safe!)
-				 * https://stackoverflow.com/a/66096983/4715872
-				 */
-				upsdebugx(4, "%s: WIN32: re-checking with %s",
-					__func__, current_test_path + 2);
-				if (stat(current_test_path + 2, &st) == 0) {
-					if (st.st_size > 0) {
-						libname_path = xstrdup(current_test_path + 2);
-					}
-				}
-			}
-# endif /* WIN32 */
-#endif  /* HAVE_DECL_REALPATH */
-
-			upsdebugx(2, "Candidate path for lib %s is %s (realpath %s)",
-				base_libname, current_test_path,
-				NUT_STRARG(libname_path));
-			if (libname_path != NULL)
-				break;
+		/* avoid "*.dll.a", ".so.1.2.3" etc. */
+		if (strncmp(dirp->d_name, base_libname, base_libname_length) == 0
+		 && dirp->d_name[base_libname_length] != '\0'
+		) {
+			libname_alias = xstrdup(dirp->d_name);
+			break;
 		}
 	} /* while iterating dir */
 
 	closedir(dp);
 
 	if (libname_alias) {
-		if (!libname_path) {
-			upsdebugx(1, "Got no strong candidate path for lib %s in %s"
-				", but saw seemingly related names (are you missing"
-				" a symbolic link, perhaps?) e.g.: %s",
-				base_libname, dirname, libname_alias);
-		}
+		upsdebugx(1, "Got no strong candidate path for lib %s in %s"
+			", but saw seemingly related names (are you missing"
+			" a symbolic link, perhaps?) e.g.: %s",
+			base_libname, dirname, libname_alias);
 
 		free(libname_alias);
 	}
 
-	return libname_path;
+	return NULL;
 }
 
 static char * get_libname_in_pathset(const char* base_libname, size_t base_libname_length, char* pathset, int *counter)
@@ -50,6 +50,31 @@ NutParser::~NutParser() {}
 // Tool functions
 //
 
+/**
+ * Parse a configuration from a stream: in place, if the stream has its
+ * contents in memory (e.g. a mapped file), or from a copy otherwise.
+ */
+template <class C>
+static bool parseFromStream(C & config, NutStream & istream)
+{
+	const char * data;
+	size_t size;
+
+	if (istream.view(data, size)) {
+		config.parseFromData(data, size);
+		return true;
+	}
+
+	std::string str;
+
+	if (NutStream::NUTS_OK != istream.getString(str))
+		return false;
+
+	config.parseFromString(str);
+
+	return true;
+}
+
 /**
  * Parse a specified type from a string and set it as Settable if success.
  */
@@ -90,14 +115,29 @@ Settable<T> StringToSettableNumber(const std::string & src)
 
 NutParser::NutParser(const char* buffer, unsigned int options) :
 _options(options),
-_buffer(buffer),
-_pos(0) {
+_buffer(buffer ? buffer : ""),
+_data(_buffer.data()),
+_size(_buffer.size()),
+_pos(0),
+_scratchUsed(0) {
 }
 
 NutParser::NutParser(const std::string& buffer, unsigned int options) :
 _options(options),
 _buffer(buffer),
-_pos(0) {
+_data(_buffer.data()),
+_size(_buffer.size()),
+_pos(0),
+_scratchUsed(0) {
+}
+
+NutParser::NutParser(const char* data, size_t size, unsigned int options) :
+_options(options),
+_buffer(),
+_data(data),
+_size(size),
+_pos(0),
+_scratchUsed(0) {
 }
 
 void NutParser::setOptions(unsigned int options, bool set)
@@ -114,15 +154,15 @@ void NutParser::setOptions(unsigned int options, bool set)
 
 char NutParser::get()
 {
-	if (_pos >= _buffer.size())
+	if (_pos >= _size)
 		return 0;
 	else
-		return _buffer[_pos++];
+		return _data[_pos++];
 }
 
 char NutParser::peek()
 {
-	return _buffer[_pos];
+	return _pos < _size ? _data[_pos] : 0;
 }
 
 size_t NutParser::getPos()const
@@ -137,7 +177,7 @@ void NutParser::setPos(size_t pos)
 
 char NutParser::charAt(size_t pos)const
 {
-	return _buffer[pos];
+	return pos < _size ? _data[pos] : 0;
 }
 
 void NutParser::pushPos()
@@ -467,6 +507,275 @@ std::list<NutParser::Token> NutParser::parseLine()
 	}
 }
 
+/* Characters which go to the text of a (not escaped) STRING token as
+ * they are; and likewise for a QUOTED_STRING token */
+static inline bool isStringChar(char c, bool colon)
+{
+	return isgraph(c) && c != '"' && c != '#' && c != '[' && c != ']'
+		&& c != '=' && c != '\\' && !(colon && c == ':');
+}
+
+static inline bool isQuotedStringChar(char c)
+{
+	return (c == ' ' || c == '\t' || isgraph(c)) && c != '"' && c != '\\';
+}
+
+/* Add the characters at the given position of the data to the text of
+ * a token: its span grows while they are contiguous, but once they are
+ * not (after an escape or a dropped character), the text goes on in a
+ * scratch buffer.
+ */
+void NutParser::lexAppend(TokenView& tok, size_t at, size_t len)
+{
+	if (tok.scratch != std::string::npos) {
+		_scratch[tok.scratch].append(_data + at, len);
+	} else if (tok.ptr == nullptr) {
+		tok.ptr = _data + at;
+	} else if (tok.ptr + tok.len != _data + at) {
+		if (_scratchUsed == _scratch.size())
+			_scratch.push_back(std::string());
+
+		std::string& buf = _scratch[_scratchUsed];
+		buf.assign(tok.ptr, tok.len);
+		buf.append(_data + at, len);
+
+		tok.scratch = _scratchUsed++;
+		tok.ptr = nullptr;
+	}
+
+	tok.len += len;
+}
+
+/** Single-pass counterpart of parseToken(): same state machine and same
+ * tokens, but runs of plain characters are taken at once, and the token
+ * text is left in place where possible.
+ * \return Token view.
+ */
+NutParser::TokenView NutParser::lexToken()
+{
+	typedef enum {
+		LEXPARSING_STATE_DEFAULT,
+		LEXPARSING_STATE_QUOTED_STRING,
+		LEXPARSING_STATE_STRING,
+		LEXPARSING_STATE_COMMENT
+	} LEXPARSING_STATE_e;
+	LEXPARSING_STATE_e state = LEXPARSING_STATE_DEFAULT;
+
+	TokenView token;
+	bool escaped = false;
+	const bool colon = !hasOptions(OPTION_IGNORE_COLON);
+	size_t pos = _pos, end;
+
+	while (pos < _size) {
+		/* Position of c */
+		size_t at = pos;
+		char c = _data[pos++];
+
+		if (c == 0) /* EOF, like get() tells it */
+			break;
+
+		switch (state) {
+			case LEXPARSING_STATE_DEFAULT: /* Wait for a non-space char */
+			{
+				if (c == ' ' || c == '\t') {
+					/* Space : do nothing */
+				} else if (c == '[' || c == ']' || c == '=' || (c == ':' && colon)
+				||  c == '\r' || c == '\n'
+				) {
+					token.type = (c == '[') ? Token::TOKEN_BRACKET_OPEN
+						: (c == ']') ? Token::TOKEN_BRACKET_CLOSE
+						: (c == '=') ? Token::TOKEN_EQUAL
+						: (c == ':') ? Token::TOKEN_COLON
+						: Token::TOKEN_EOL;
+					lexAppend(token, at, 1);
+					_pos = pos;
+					return token;
+				} else if (c == '#') {
+					token.type = Token::TOKEN_COMMENT;
+					state = LEXPARSING_STATE_COMMENT;
+				} else if (c == '"') {
+					/* Begin of QUOTED STRING */
+					token.type = Token::TOKEN_QUOTED_STRING;
+					state = LEXPARSING_STATE_QUOTED_STRING;
+				} else if (c == '\\') {
+					/* Begin of STRING with escape */
+					token.type = Token::TOKEN_STRING;
+					state = LEXPARSING_STATE_STRING;
+					escaped = true;
+				} else if (isgraph(c)) {
+					/* Begin of STRING */
+					token.type = Token::TOKEN_STRING;
+					state = LEXPARSING_STATE_STRING;
+					pos--;
+				} else {
+					/* Position left as it was */
+					return TokenView(Token::TOKEN_UNKNOWN);
+				}
+				break;
+			}
+			case LEXPARSING_STATE_QUOTED_STRING:
+			{
+				if (c == '"') {
+					if (escaped) {
+						escaped = false;
+						lexAppend(token, at, 1);
+					} else {
+						_pos = pos;
+						return token;
+					}
+				} else if (c == '\\') {
+					if (escaped) {
+						escaped = false;
+						lexAppend(token, at, 1);
+					} else {
+						escaped = true;
+					}
+				} else if (c == ' ' || c == '\t' || isgraph(c)) {
+					/* With the plain characters which follow */
+					for (end = pos; end < _size && isQuotedStringChar(_data[end]); end++) {}
+					lexAppend(token, at, end - at);
+					pos = end;
+				} else if (c == '\r' || c == '\n') /* EOL */{
+					_pos = at;
+					return token;
+				}
+				/* Else a bad character, dropped like parseToken() does */
+				break;
+			}
+			case LEXPARSING_STATE_STRING:
+			{
+				if (c == ' ' || c == '\t' || c == '"' || c == '#' || c == '[' || c == ']'
+				||  (c == ':' && colon)
+				||  c == '='
+				) {
+					if (escaped) {
+						escaped = false;
+						lexAppend(token, at, 1);
+					} else {
+						_pos = at;
+						return token;
+					}
+				} else if (c == '\\') {
+					if (escaped) {
+						escaped = false;
+						lexAppend(token, at, 1);
+					} else {
+						escaped = true;
+					}
+				} else if (c == '\r' || c == '\n') /* EOL */{
+					_pos = at;
+					return token;
+				} else if (isgraph(c)) {
+					/* With the plain characters which follow */
+					for (end = pos; end < _size && isStringChar(_data[end], colon); end++) {}
+					lexAppend(token, at, end - at);
+					pos = end;
+				}
+				/* Else a bad character, dropped like parseToken() does */
+				break;
+			}
+			case LEXPARSING_STATE_COMMENT:
+			{
+				if (c == '\r' || c == '\n') {
+					_pos = pos;
+					return token;
+				} else {
+					/* With the rest of the line */
+					for (end = pos; end < _size && _data[end] != '\r' && _data[end] != '\n' && _data[end] != 0; end++) {}
+					lexAppend(token, at, end - at);
+					pos = end;
+				}
+				break;
+			}
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+# pragma clang diagnostic push
+# pragma clang diagnostic ignored "-Wunreachable-code"
+# pragma clang diagnostic ignored "-Wcovered-switch-default"
+#endif
+			default:
+				/* Must not occur. */
+				break;
+#ifdef __clang__
+# pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
+		}
+	}
+	_pos = pos;
+	return token;
+}
+
+const std::vector<NutParser::TokenView>& NutParser::lexLine()
+{
+	_tokens.clear();
+	_scratchUsed = 0;
+
+	while (true) {
+		_tokens.push_back(lexToken());
+
+		switch (_tokens.back().type) {
+			case Token::TOKEN_STRING:
+			case Token::TOKEN_QUOTED_STRING:
+			case Token::TOKEN_BRACKET_OPEN:
+			case Token::TOKEN_BRACKET_CLOSE:
+			case Token::TOKEN_EQUAL:
+			case Token::TOKEN_COLON:
+				break;
+			case Token::TOKEN_COMMENT:
+			case Token::TOKEN_UNKNOWN:
+			case Token::TOKEN_NONE:
+			case Token::TOKEN_EOL:
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+# pragma clang diagnostic push
+# pragma clang diagnostic ignored "-Wunreachable-code"
+# pragma clang diagnostic ignored "-Wcovered-switch-default"
+#endif
+			default:
+#ifdef __clang__
+# pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
+				return _tokens;
+		}
+	}
+}
+
+std::string NutParser::tokenString(const TokenView& tok)const
+{
+	if (tok.scratch != std::string::npos)
+		return _scratch[tok.scratch];
+
+	if (tok.ptr == nullptr)
+		return std::string();
+
+	return std::string(tok.ptr, tok.len);
+}
+
 //
 // NutConfigParser
 //
@@ -481,6 +790,11 @@ NutParser(buffer, options)
 {
 }
 
+NutConfigParser::NutConfigParser(const char* data, size_t size, unsigned int options) :
+NutParser(data, size, options)
+{
+}
+
 void NutConfigParser::parseConfig(BaseConfiguration* config)
 {
 	NUT_UNUSED_VARIABLE(config);
@@ -500,7 +814,9 @@ void NutConfigParser::parseConfig()
 		CPS_DIRECTIVE_VALUES
 	} state = CPS_DEFAULT;
 
-	Token tok;
+	/* Tokens of the current line */
+	const std::vector<TokenView>* line = nullptr;
+	size_t next = 0;
 	std::string name;
 	std::list<std::string> values;
 	char sep = 0;
@@ -521,14 +837,18 @@ void NutConfigParser::parseConfig()
 # pragma clang diagnostic ignored "-Wcovered-switch-default"
 #endif
 	while (1) {
-		tok = parseToken();
+		if (line == nullptr || next >= line->size()) {
+			line = &lexLine();
+			next = 0;
+		}
+		const TokenView& tok = (*line)[next++];
 		if (!tok)
 			break;
 		switch (state) {
 			case CPS_DEFAULT:
 				switch (tok.type) {
 					case Token::TOKEN_COMMENT:
-						onParseComment(tok.str);
+						onParseComment(tokenString(tok));
 						/* Clean and return to default */
 						break;
 					case Token::TOKEN_BRACKET_OPEN:
@@ -536,7 +856,7 @@ void NutConfigParser::parseConfig()
 						break;
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
-						name = tok.str;
+						name = tokenString(tok);
 						state = CPS_DIRECTIVE_HAVE_NAME;
 						break;
 
@@ -556,7 +876,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Should occur ! */
-						name = tok.str;
+						name = tokenString(tok);
 						state = CPS_SECTION_HAVE_NAME;
 						break;
 					case Token::TOKEN_BRACKET_CLOSE:
@@ -565,7 +885,7 @@ void NutConfigParser::parseConfig()
 						break;
 					case Token::TOKEN_COMMENT:
 						/* Lack of closing bracket !!! */
-						onParseSectionName(name, tok.str);
+						onParseSectionName(name, tokenString(tok));
 						/* Clean and return to default */
 						name.clear();
 						state = CPS_DEFAULT;
@@ -596,7 +916,7 @@ void NutConfigParser::parseConfig()
 						break;
 					case Token::TOKEN_COMMENT:
 						/* Lack of closing bracket !!! */
-						onParseSectionName(name, tok.str);
+						onParseSectionName(name, tokenString(tok));
 						/* Clean and return to default */
 						name.clear();
 						state = CPS_DEFAULT;
@@ -625,7 +945,7 @@ void NutConfigParser::parseConfig()
 				switch (tok.type) {
 					case Token::TOKEN_COMMENT:
 						/* Could occur ! */
-						onParseSectionName(name, tok.str);
+						onParseSectionName(name, tokenString(tok));
 						/* Clean and return to default */
 						name.clear();
 						state = CPS_DEFAULT;
@@ -655,7 +975,7 @@ void NutConfigParser::parseConfig()
 				switch (tok.type) {
 					case Token::TOKEN_COMMENT:
 						/* Could occur ! */
-						onParseDirective(name, 0, std::list<std::string > (), tok.str);
+						onParseDirective(name, 0, std::list<std::string > (), tokenString(tok));
 						/* Clean and return to default */
 						name.clear();
 						state = CPS_DEFAULT;
@@ -670,13 +990,13 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_COLON:
 					case Token::TOKEN_EQUAL:
 						/* Could occur ! */
-						sep = tok.str[0];
+						sep = tok.ptr[0];
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Could occur ! */
-						values.push_back(tok.str);
+						values.push_back(tokenString(tok));
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 
@@ -693,7 +1013,7 @@ void NutConfigParser::parseConfig()
 				switch (tok.type) {
 					case Token::TOKEN_COMMENT:
 						/* Could occur ! */
-						onParseDirective(name, sep, values, tok.str);
+						onParseDirective(name, sep, values, tokenString(tok));
 						/* Clean and return to default */
 						name.clear();
 						values.clear();
@@ -712,7 +1032,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Could occur ! */
-						values.push_back(tok.str);
+						values.push_back(tokenString(tok));
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 
@@ -784,6 +1104,11 @@ NutConfigParser(buffer)
 {
 }
 
+DefaultConfigParser::DefaultConfigParser(const char* data, size_t size):
+NutConfigParser(data, size, NutParser::OPTION_DEFAULT)
+{
+}
+
 void DefaultConfigParser::onParseBegin()
 {
 	// Start with empty section (i.e. global one)
@@ -822,10 +1147,9 @@ void DefaultConfigParser::onParseDirective(
 	// Separator has no specific semantic in this context
 
 	// Save values
-	_section.entries[directiveName].name = directiveName;
-	_section.entries[directiveName].values = values;
-
-	// TODO Can probably be optimized.
+	GenericConfigSectionEntry& entry = _section.entries[directiveName];
+	entry.name = directiveName;
+	entry.values = values;
 }
 
 void DefaultConfigParser::onParseEnd()
@@ -853,6 +1177,22 @@ void GenericConfigSection::clear()
 	entries.clear();
 }
 
+//
+// GenericConfigDiff
+//
+
+bool GenericConfigDiff::empty()const
+{
+	return addedSections.empty() && removedSections.empty() && changedSections.empty();
+}
+
+void GenericConfigDiff::clear()
+{
+	addedSections.clear();
+	removedSections.clear();
+	changedSections.clear();
+}
+
 //
 // GenericConfigParser
 //
@@ -869,6 +1209,12 @@ _config(nullptr)
 {
 }
 
+GenericConfigParser::GenericConfigParser(const char* data, size_t size):
+DefaultConfigParser(data, size),
+_config(nullptr)
+{
+}
+
 void GenericConfigParser::parseConfig(BaseConfiguration* config)
 {
 	if(config!=nullptr)
@@ -880,7 +1226,7 @@ void GenericConfigParser::parseConfig(BaseConfiguration* config)
 }
 
 
-void GenericConfigParser::onParseSection(const GenericConfigSection& section)
+void GenericConfigParser::onParseSection(GenericConfigSection& section)
 {
 	if(_config!=nullptr)
 	{
@@ -892,70 +1238,178 @@ void GenericConfigParser::onParseSection(const GenericConfigSection& section)
 // GenericConfiguration
 //
 
-void GenericConfiguration::setGenericConfigSection(const GenericConfigSection& section)
+void GenericConfiguration::setGenericConfigSection(GenericConfigSection& section)
 {
-	sections[section.name] = section;
+	// Take the entries over instead of copying them
+	GenericConfigSection& dst = sections[section.name];
+	dst.name = section.name;
+	dst.entries.swap(section.entries);
 }
 
 
 void GenericConfiguration::parseFromString(const std::string& str)
 {
-	GenericConfigParser parser(str);
+	parseFromData(str.data(), str.size());
+}
+
+void GenericConfiguration::parseFromData(const char* data, size_t size)
+{
+	GenericConfigParser parser(data, size);
 	parser.parseConfig(this);
 }
 
 
 bool GenericConfiguration::parseFrom(NutStream & istream)
 {
-	// TODO: The parser is highly inefficient, it should use NutStream, directly
-	std::string str;
+	return parseFromStream(*this, istream);
+}
 
-	if (NutStream::NUTS_OK != istream.getString(str))
+
+bool GenericConfiguration::writeTo(NutStream & ostream) const
+{
+	GenericConfigWriter writer(ostream);
+
+	return NutWriter::NUTW_OK == writer.writeConfig(*this);
+}
+
+
+GenericConfigDiff GenericConfiguration::diff(const GenericConfiguration & other) const
+{
+	GenericConfigDiff changes;
+
+	// Both maps are sorted by name: walk them side by side
+	SectionMap::const_iterator mine = sections.begin(), theirs = other.sections.begin();
+
+	while (mine != sections.end() || theirs != other.sections.end()) {
+		if (theirs == other.sections.end()
+		||  (mine != sections.end() && mine->first < theirs->first)
+		) {
+			changes.removedSections.push_back(mine->first);
+			++mine;
+			continue;
+		}
+
+		if (mine == sections.end() || theirs->first < mine->first) {
+			changes.addedSections.push_back(theirs->first);
+			++theirs;
+			continue;
+		}
+
+		// Same section in both
+		const GenericConfigSection::EntryMap & old_entries = mine->second.entries;
+		const GenericConfigSection::EntryMap & new_entries = theirs->second.entries;
+		GenericConfigSection::EntryMap::const_iterator old_iter = old_entries.begin();
+		GenericConfigSection::EntryMap::const_iterator new_iter = new_entries.begin();
+		GenericConfigDiff::SectionChange change;
+
+		while (old_iter != old_entries.end() || new_iter != new_entries.end()) {
+			if (new_iter == new_entries.end()
+			||  (old_iter != old_entries.end() && old_iter->first < new_iter->first)
+			) {
+				change.removedEntries.push_back(old_iter->first);
+				++old_iter;
+			} else if (old_iter == old_entries.end() || new_iter->first < old_iter->first) {
+				change.addedEntries.push_back(new_iter->first);
+				++new_iter;
+			} else {
+				if (old_iter->second.values != new_iter->second.values)
+					change.changedEntries.push_back(old_iter->first);
+				++old_iter;
+				++new_iter;
+			}
+		}
+
+		if (!change.addedEntries.empty() || !change.removedEntries.empty() || !change.changedEntries.empty()) {
+			change.name = mine->first;
+			changes.changedSections.push_back(change);
+		}
+
+		++mine;
+		++theirs;
+	}
+
+	return changes;
+}
+
+
+bool GenericConfiguration::reloadFrom(NutStream & istream, GenericConfigDiff & changes)
+{
+	GenericConfiguration fresh;
+
+	if (!parseFromStream(fresh, istream))
 		return false;
 
-	parseFromString(str);
+	reload(fresh, changes);
 
 	return true;
 }
 
 
-bool GenericConfiguration::writeTo(NutStream & ostream) const
+void GenericConfiguration::reloadFromString(const std::string& str, GenericConfigDiff & changes)
 {
-	GenericConfigWriter writer(ostream);
+	GenericConfiguration fresh;
 
-	return NutWriter::NUTW_OK == writer.writeConfig(*this);
+	fresh.parseFromString(str);
+	reload(fresh, changes);
 }
 
 
-bool GenericConfiguration::get(const std::string & section, const std::string & entry, ConfigParamList & params, bool caseSensitive) const
+void GenericConfiguration::reload(GenericConfiguration & fresh, GenericConfigDiff & changes)
+{
+	changes = diff(fresh);
+
+	std::list<std::string>::const_iterator name;
+
+	for (name = changes.removedSections.begin(); name != changes.removedSections.end(); ++name)
+		sections.erase(*name);
+
+	// Take the new sections over, like the parser does
+	for (name = changes.addedSections.begin(); name != changes.addedSections.end(); ++name)
+		setGenericConfigSection(fresh.sections[*name]);
+
+	std::list<GenericConfigDiff::SectionChange>::const_iterator change;
+
+	for (change = changes.changedSections.begin(); change != changes.changedSections.end(); ++change)
+		setGenericConfigSection(fresh.sections[change->name]);
+}
+
+
+const ConfigParamList * GenericConfiguration::find(const std::string & section, const std::string & entry, bool caseSensitive) const
 {
 	// Get section
 	SectionMap::const_iterator section_iter = sections.find(section);
 	if (section_iter == sections.end())
-		return false;
+		return nullptr;
 
 	// Get entry
 	const GenericConfigSection::EntryMap & entries = section_iter->second.entries;
 
 	GenericConfigSection::EntryMap::const_iterator entry_iter = entries.find(entry);
-	if (entry_iter == entries.end()) {
-		if (caseSensitive)
-			return false;
+	if (entry_iter != entries.end())
+		return &entry_iter->second.values;
 
-		// Another pass, maybe slower and inefficient, for case-insensitive matching
-		// We are already at one end of the entries, so scroll back to beginning
-		GenericConfigSection::EntryMap::const_iterator entry_begin = entries.begin();
-		for (; entry_iter != entry_begin; entry_iter--) {
-			if (!(::strcasecmp(entry_iter->first.c_str(), entry.c_str())))
-				goto found;
-		}
+	if (caseSensitive)
+		return nullptr;
 
-		return false;
+	// Another pass, maybe slower and inefficient, for case-insensitive matching
+	for (entry_iter = entries.begin(); entry_iter != entries.end(); ++entry_iter) {
+		if (!(::strcasecmp(entry_iter->first.c_str(), entry.c_str())))
+			return &entry_iter->second.values;
 	}
 
-found:
+	return nullptr;
+}
+
+
+bool GenericConfiguration::get(const std::string & section, const std::string & entry, ConfigParamList & params, bool caseSensitive) const
+{
+	const ConfigParamList * values = find(section, entry, caseSensitive);
+
+	if (nullptr == values)
+		return false;
+
 	// Provide parameters values
-	params = entry_iter->second.values;
+	params = *values;
 
 	return true;
 }
@@ -1040,17 +1494,12 @@ void GenericConfiguration::removeSection(const std::string & section)
 
 std::string GenericConfiguration::getStr(const std::string & section, const std::string & entry, bool caseSensitive) const
 {
-	std::string str;
+	const ConfigParamList * values = find(section, entry, caseSensitive);
 
-	ConfigParamList params;
+	if (nullptr == values || values->empty())
+		return std::string();
 
-	if (!get(section, entry, params, caseSensitive))
-		return str;
-
-	if (params.empty())
-		return str;
-
-	return params.front();
+	return values->front();
 }
 
 
@@ -1083,13 +1532,8 @@ bool GenericConfiguration::getFlag(
 		const std::string & section,
 		const std::string & entry) const
 {
-	ConfigParamList params;
-
-	if (!get(section, entry, params))
-		return false;
-
 	// Flag - if exists then "true"
-	return true;
+	return nullptr != find(section, entry);
 }
 
 
@@ -1114,16 +1558,13 @@ long long int GenericConfiguration::getInt(
 		const std::string & entry,
 		long long int val) const
 {
-	ConfigParamList params;
-
-	if (!get(section, entry, params))
-		return val;
+	const ConfigParamList * values = find(section, entry);
 
-	if (params.empty())
+	if (nullptr == values || values->empty())
 		return val;
 
 	// TBD: What if there are multiple values?
-	std::stringstream val_str(params.front());
+	std::stringstream val_str(values->front());
 
 	val_str >> val;
 
@@ -1148,16 +1589,13 @@ long long int GenericConfiguration::getIntHex(
 		const std::string & entry,
 		long long int val) const
 {
-	ConfigParamList params;
+	const ConfigParamList * values = find(section, entry);
 
-	if (!get(section, entry, params))
-		return val;
-
-	if (params.empty())
+	if (nullptr == values || values->empty())
 		return val;
 
 	// TBD: What if there are multiple values?
-	std::string s = params.front();
+	std::string s = values->front();
 	size_t foundPos = s.rfind("0x", 0);
 	if (foundPos == std::string::npos || foundPos != 0) {
 		// Add the prefix for hex conversion
@@ -1197,16 +1635,13 @@ double GenericConfiguration::getDouble(
 		const std::string & entry,
 		double val) const
 {
-	ConfigParamList params;
+	const ConfigParamList * values = find(section, entry);
 
-	if (!get(section, entry, params))
-		return val;
-
-	if (params.empty())
+	if (nullptr == values || values->empty())
 		return val;
 
 	// TBD: What if there are multiple values?
-	std::stringstream val_str(params.front());
+	std::stringstream val_str(values->front());
 
 	val_str >> val;
 
@@ -1231,16 +1666,13 @@ nut::BoolInt GenericConfiguration::getBoolInt(
 		const std::string & entry,
 		nut::BoolInt val) const
 {
-	ConfigParamList params;
+	const ConfigParamList * values = find(section, entry);
 
-	if (!get(section, entry, params))
-		return val;
-
-	if (params.empty())
+	if (nullptr == values || values->empty())
 		return val;
 
 	// TBD: What if there are multiple values?
-	nut::BoolInt bi(params.front());
+	nut::BoolInt bi(values->front());
 
 	return bi;
 }
@@ -1277,7 +1709,12 @@ UpsmonConfiguration::UpsmonConfiguration()
 
 void UpsmonConfiguration::parseFromString(const std::string& str)
 {
-	UpsmonConfigParser parser(str);
+	parseFromData(str.data(), str.size());
+}
+
+void UpsmonConfiguration::parseFromData(const char* data, size_t size)
+{
+	UpsmonConfigParser parser(data, size);
 	parser.parseUpsmonConfig(this);
 }
 
@@ -1352,15 +1789,7 @@ UpsmonConfiguration::NotifyType UpsmonConfiguration::NotifyTypeFromString(const
 
 bool UpsmonConfiguration::parseFrom(NutStream & istream)
 {
-	// TODO: The parser is highly inefficient, it should use NutStream, directly
-	std::string str;
-
-	if (NutStream::NUTS_OK != istream.getString(str))
-		return false;
-
-	parseFromString(str);
-
-	return true;
+	return parseFromStream(*this, istream);
 }
 
 
@@ -1386,6 +1815,11 @@ NutConfigParser(buffer)
 {
 }
 
+UpsmonConfigParser::UpsmonConfigParser(const char* data, size_t size):
+NutConfigParser(data, size, NutParser::OPTION_DEFAULT)
+{
+}
+
 void UpsmonConfigParser::parseUpsmonConfig(UpsmonConfiguration* config)
 {
 	if(config!=nullptr)
@@ -1666,7 +2100,12 @@ NutConfiguration::NutConfiguration():
 
 void NutConfiguration::parseFromString(const std::string& str)
 {
-	NutConfConfigParser parser(str);
+	parseFromData(str.data(), str.size());
+}
+
+void NutConfiguration::parseFromData(const char* data, size_t size)
+{
+	NutConfConfigParser parser(data, size);
 	parser.parseNutConfConfig(this);
 }
 
@@ -1691,15 +2130,7 @@ NutConfiguration::NutMode NutConfiguration::NutModeFromString(const std::string&
 
 bool NutConfiguration::parseFrom(NutStream & istream)
 {
-	// TODO: The parser is highly inefficient, it should use NutStream, directly
-	std::string str;
-
-	if (NutStream::NUTS_OK != istream.getString(str))
-		return false;
-
-	parseFromString(str);
-
-	return true;
+	return parseFromStream(*this, istream);
 }
 
 
@@ -1725,6 +2156,11 @@ NutConfigParser(buffer)
 {
 }
 
+NutConfConfigParser::NutConfConfigParser(const char* data, size_t size):
+NutConfigParser(data, size, NutParser::OPTION_DEFAULT)
+{
+}
+
 void NutConfConfigParser::parseNutConfConfig(NutConfiguration* config)
 {
 	if(config!=nullptr)
@@ -1839,22 +2275,19 @@ UpsdConfiguration::UpsdConfiguration()
 
 void UpsdConfiguration::parseFromString(const std::string& str)
 {
-	UpsdConfigParser parser(str);
+	parseFromData(str.data(), str.size());
+}
+
+void UpsdConfiguration::parseFromData(const char* data, size_t size)
+{
+	UpsdConfigParser parser(data, size);
 	parser.parseUpsdConfig(this);
 }
 
 
 bool UpsdConfiguration::parseFrom(NutStream & istream)
 {
-	// TODO: The parser is highly inefficient, it should use NutStream, directly
-	std::string str;
-
-	if (NutStream::NUTS_OK != istream.getString(str))
-		return false;
-
-	parseFromString(str);
-
-	return true;
+	return parseFromStream(*this, istream);
 }
 
 
@@ -1880,6 +2313,11 @@ NutConfigParser(buffer, NutParser::OPTION_IGNORE_COLON)
 {
 }
 
+UpsdConfigParser::UpsdConfigParser(const char* data, size_t size):
+NutConfigParser(data, size, NutParser::OPTION_IGNORE_COLON)
+{
+}
+
 void UpsdConfigParser::parseUpsdConfig(UpsdConfiguration* config)
 {
 	if(config!=nullptr)
@@ -1948,6 +2386,27 @@ void UpsdConfigParser::onParseDirective(const std::string& directiveName, char s
 				_config->maxConn = StringToSettableNumber<unsigned int>(values.front());
 			}
 		}
+		else if(directiveName == "MAXCLIENTQUEUE")
+		{
+			if(values.size()>0)
+			{
+				_config->maxClientQueue = StringToSettableNumber<unsigned int>(values.front());
+			}
+		}
+		else if(directiveName == "SSL_HANDSHAKE_WORKERS")
+		{
+			if(values.size()>0)
+			{
+				_config->sslHandshakeWorkers = StringToSettableNumber<unsigned int>(values.front());
+			}
+		}
+		else if(directiveName == "CLIENT_INACTIVITY_DELAY")
+		{
+			if(values.size()>0)
+			{
+				_config->clientInactivityDelay = StringToSettableNumber<unsigned int>(values.front());
+			}
+		}
 		else if(directiveName == "TRACKINGDELAY")
 		{
 			if(values.size()>0)
@@ -2031,6 +2490,96 @@ void UpsdConfigParser::onParseEnd()
 }
 
 
+//
+// UpsConfiguration
+//
+
+/** First value of a section entry, or an empty string */
+static const std::string & sectionValue(const GenericConfigSection & section, const std::string & key)
+{
+	static const std::string none;
+
+	GenericConfigSection::EntryMap::const_iterator entry = section.entries.find(key);
+	if (entry == section.entries.end() || entry->second.values.empty())
+		return none;
+
+	return entry->second.values.front();
+}
+
+
+/** Integer value of a section entry, as getInt() reads it */
+static long long int sectionInt(const GenericConfigSection & section, const std::string & key)
+{
+	const std::string & str = sectionValue(section, key);
+	long long int val = 0;
+
+	if (!str.empty()) {
+		std::stringstream val_str(str);
+		val_str >> val;
+	}
+
+	return val;
+}
+
+
+const std::string & UpsConfiguration::Device::get(const std::string & key) const
+{
+	return sectionValue(*section, key);
+}
+
+
+UpsConfiguration::DeviceList UpsConfiguration::devices() const
+{
+	DeviceList list;
+	list.reserve(sections.size());
+
+	// Sections are in the order of names, so is the list
+	SectionMap::const_iterator iter;
+	for (iter = sections.begin(); iter != sections.end(); ++iter) {
+		if (iter->first.empty())
+			continue;
+
+		const GenericConfigSection & section = iter->second;
+		const std::string & nolock = sectionValue(section, "nolock");
+
+		Device dev;
+		dev.name          = iter->first;
+		dev.driver        = sectionValue(section, "driver");
+		dev.port          = sectionValue(section, "port");
+		dev.desc          = sectionValue(section, "desc");
+		dev.sdorder       = sectionInt(section, "sdorder");
+		dev.maxStartDelay = sectionInt(section, "maxstartdelay");
+		dev.noLock        = !nolock.empty() && str2bool(nolock);
+		dev.section       = &section;
+
+		list.push_back(dev);
+	}
+
+	return list;
+}
+
+
+const UpsConfiguration::Device * UpsConfiguration::findDevice(const DeviceList & list, const std::string & ups)
+{
+	size_t lo = 0, hi = list.size();
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = list[mid].name.compare(ups);
+
+		if (0 == cmp)
+			return &list[mid];
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return nullptr;
+}
+
+
 //
 // UpsdUsersConfiguration
 //
@@ -2049,6 +2598,46 @@ UpsdUsersConfiguration::upsmon_mode_t UpsdUsersConfiguration::getUpsmonMode() co
 }
 
 
+UpsdUsersConfiguration::UserList UpsdUsersConfiguration::users() const
+{
+	static const ConfigParamList none;
+
+	UserList list;
+	list.reserve(sections.size());
+
+	SectionMap::const_iterator iter;
+	for (iter = sections.begin(); iter != sections.end(); ++iter) {
+		if (iter->first.empty())
+			continue;
+
+		const GenericConfigSection & section = iter->second;
+		const std::string & mode = sectionValue(section, "upsmon");
+
+		GenericConfigSection::EntryMap::const_iterator actions  = section.entries.find("actions");
+		GenericConfigSection::EntryMap::const_iterator instcmds = section.entries.find("instcmds");
+
+		User user;
+		user.name     = iter->first;
+		user.password = sectionValue(section, "password");
+		user.actions  = actions  == section.entries.end() ? none : actions->second.values;
+		user.instcmds = instcmds == section.entries.end() ? none : instcmds->second.values;
+
+		if ("primary" == mode || "master" == mode)
+			user.upsmonMode = UPSMON_PRIMARY;
+		else if ("secondary" == mode || "slave" == mode)
+			user.upsmonMode = UPSMON_SECONDARY;
+		else
+			user.upsmonMode = UPSMON_UNDEF;
+
+		user.section = &section;
+
+		list.push_back(user);
+	}
+
+	return list;
+}
+
+
 void UpsdUsersConfiguration::setUpsmonMode(upsmon_mode_t mode)
 {
 	assert(UPSMON_UNDEF != mode);
@@ -2060,15 +2649,7 @@ void UpsdUsersConfiguration::setUpsmonMode(upsmon_mode_t mode)
 
 bool UpsdUsersConfiguration::parseFrom(NutStream & istream)
 {
-	// TODO: The parser is highly inefficient, it should use NutStream, directly
-	std::string str;
-
-	if (NutStream::NUTS_OK != istream.getString(str))
-		return false;
-
-	parseFromString(str);
-
-	return true;
+	return parseFromStream(*this, istream);
 }
 
 
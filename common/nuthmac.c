@@ -0,0 +1,207 @@
+/* nuthmac.c - Network UPS Tools SHA-256 and HMAC-SHA256
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"	/* must be first */
+
+#include <string.h>
+
+#include "nut_stdint.h"
+#include "nuthmac.h"
+
+#define SHA256_BLOCK	64
+
+typedef struct {
+	uint32_t	h[8];
+	uint64_t	len;		/* bytes hashed so far */
+	unsigned char	buf[SHA256_BLOCK];
+	size_t	used;		/* of buf */
+} sha256_ctx_t;
+
+static const uint32_t	sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(sha256_ctx_t *ctx, const unsigned char *p)
+{
+	uint32_t	w[64], a, b, c, d, e, f, g, h, t1, t2;
+	size_t	i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16
+			| (uint32_t)p[i * 4 + 2] << 8 | (uint32_t)p[i * 4 + 3];
+	}
+
+	for (i = 16; i < 64; i++) {
+		w[i] = (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10))
+			+ w[i - 7]
+			+ (ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3))
+			+ w[i - 16];
+	}
+
+	a = ctx->h[0]; b = ctx->h[1]; c = ctx->h[2]; d = ctx->h[3];
+	e = ctx->h[4]; f = ctx->h[5]; g = ctx->h[6]; h = ctx->h[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+			+ ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))
+			+ ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+	ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+}
+
+static void sha256_init(sha256_ctx_t *ctx)
+{
+	static const uint32_t	iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(ctx->h, iv, sizeof(iv));
+	ctx->len = 0;
+	ctx->used = 0;
+}
+
+static void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len)
+{
+	const unsigned char	*p = data;
+	size_t	n;
+
+	ctx->len += len;
+
+	while (len > 0) {
+		if (ctx->used == 0 && len >= SHA256_BLOCK) {
+			sha256_block(ctx, p);
+			p += SHA256_BLOCK;
+			len -= SHA256_BLOCK;
+			continue;
+		}
+
+		n = SHA256_BLOCK - ctx->used;
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(ctx->buf + ctx->used, p, n);
+		ctx->used += n;
+		p += n;
+		len -= n;
+
+		if (ctx->used == SHA256_BLOCK) {
+			sha256_block(ctx, ctx->buf);
+			ctx->used = 0;
+		}
+	}
+}
+
+static void sha256_final(sha256_ctx_t *ctx, unsigned char *digest)
+{
+	uint64_t	bits = ctx->len * 8;
+	size_t	i;
+
+	ctx->buf[ctx->used++] = 0x80;
+
+	if (ctx->used > SHA256_BLOCK - 8) {
+		memset(ctx->buf + ctx->used, 0, SHA256_BLOCK - ctx->used);
+		sha256_block(ctx, ctx->buf);
+		ctx->used = 0;
+	}
+
+	memset(ctx->buf + ctx->used, 0, SHA256_BLOCK - 8 - ctx->used);
+	for (i = 0; i < 8; i++) {
+		ctx->buf[SHA256_BLOCK - 1 - i] = (unsigned char)(bits >> (i * 8));
+	}
+	sha256_block(ctx, ctx->buf);
+
+	for (i = 0; i < 8; i++) {
+		digest[i * 4] = (unsigned char)(ctx->h[i] >> 24);
+		digest[i * 4 + 1] = (unsigned char)(ctx->h[i] >> 16);
+		digest[i * 4 + 2] = (unsigned char)(ctx->h[i] >> 8);
+		digest[i * 4 + 3] = (unsigned char)ctx->h[i];
+	}
+
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void nut_sha256(const void *data, size_t len, unsigned char *digest)
+{
+	sha256_ctx_t	ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, digest);
+}
+
+void nut_hmac_sha256(const void *key, size_t keylen,
+	const void *data, size_t len, unsigned char *mac)
+{
+	sha256_ctx_t	ctx;
+	unsigned char	k[SHA256_BLOCK], pad[SHA256_BLOCK], inner[NUT_SHA256_LEN];
+	size_t	i;
+
+	/* a key longer than a block is hashed first */
+	memset(k, 0, sizeof(k));
+	if (keylen > SHA256_BLOCK) {
+		nut_sha256(key, keylen, k);
+	} else if (keylen > 0) {
+		memcpy(k, key, keylen);
+	}
+
+	for (i = 0; i < SHA256_BLOCK; i++) {
+		pad[i] = k[i] ^ 0x36;
+	}
+	sha256_init(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, inner);
+
+	for (i = 0; i < SHA256_BLOCK; i++) {
+		pad[i] = k[i] ^ 0x5c;
+	}
+	sha256_init(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, inner, sizeof(inner));
+	sha256_final(&ctx, mac);
+
+	memset(k, 0, sizeof(k));
+	memset(pad, 0, sizeof(pad));
+}
+
+int nut_hmac_equal(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	unsigned char	diff = 0;
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		diff |= a[i] ^ b[i];
+	}
+
+	return (diff == 0);
+}
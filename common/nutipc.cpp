@@ -45,6 +45,22 @@
 
 #include <iostream>
 
+#include <vector>
+
+#ifndef WIN32
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/wait.h>
+# if (defined HAVE_SYS_EVENTFD_H)
+#  include <sys/eventfd.h>
+# endif
+# if (defined HAVE_SPAWN_H) && (defined HAVE_POSIX_SPAWNP)
+#  include <spawn.h>
+# endif
+
+extern char ** environ;
+#endif
+
 
 namespace nut {
 
@@ -209,25 +225,478 @@ int Process::Executor::operator () ()
 }
 
 
-int sigPipeWriteCmd(int fh, void * cmd, size_t cmd_size)
+pid_t Process::spawn(const Executor & executor, int out_fd, int err_fd)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 	throw(std::runtime_error)
 #endif
 {
-	char * cmd_bytes = reinterpret_cast<char *>(cmd);
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(out_fd);
+	NUT_UNUSED_VARIABLE(err_fd);
+
+	/* FIXME: Implement (for NUT processes) via CreateProcess? */
+	std::stringstream e;
+
+	e << "Can't execute binary " << executor.binary() <<
+		": not implemented on this platform yet";
+
+	throw std::runtime_error(e.str());
+#else
+	const Executor::Arguments & args = executor.arguments();
+	std::vector<char *> argv;
+
+	argv.reserve(args.size() + 2);
+	argv.push_back(const_cast<char *>(executor.binary().c_str()));
+
+	Executor::Arguments::const_iterator arg = args.begin();
+
+	for (; arg != args.end(); ++arg)
+		argv.push_back(const_cast<char *>(arg->c_str()));
+
+	argv.push_back(nullptr);
+
+	pid_t pid;
+
+# if (defined HAVE_SPAWN_H) && (defined HAVE_POSIX_SPAWNP)
+	posix_spawn_file_actions_t actions;
+
+	::posix_spawn_file_actions_init(&actions);
+
+	if (out_fd >= 0)
+		::posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+	if (err_fd >= 0)
+		::posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+
+	int status = ::posix_spawnp(&pid, argv[0], &actions, nullptr, &argv[0], environ);
+
+	::posix_spawn_file_actions_destroy(&actions);
+
+	if (status) {
+		std::stringstream e;
+
+		e << "Failed to execute binary " << executor.binary() << ": ";
+		e << status << ": " << strerror(status);
+
+		throw std::runtime_error(e.str());
+	}
+# else
+	pid = ::fork();
+
+	if (-1 == pid) {
+		int erno = errno;
+
+		std::stringstream e;
+
+		e << "Failed to fork for binary " << executor.binary() << ": ";
+		e << erno << ": " << strerror(erno);
+
+		throw std::runtime_error(e.str());
+	}
+
+	if (0 == pid) {
+		if (out_fd >= 0)
+			::dup2(out_fd, STDOUT_FILENO);
+
+		if (err_fd >= 0)
+			::dup2(err_fd, STDERR_FILENO);
+
+		::execvp(argv[0], &argv[0]);
+
+		// Like a shell does for a command it can't run
+		::_exit(127);
+	}
+# endif
+
+	return pid;
+#endif
+}
+
+
+bool Process::waitFor(pid_t pid, int & exit_code, bool block)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::logic_error)
+#endif
+{
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(exit_code);
+	NUT_UNUSED_VARIABLE(block);
+
+	std::stringstream e;
+
+	e << "Can't wait for PID " << pid <<
+		": not implemented on this platform yet";
+
+	throw std::logic_error(e.str());
+#else
+	int status = 0;
+	pid_t wpid;
 
 	do {
-		ssize_t written = ::write(fh, cmd_bytes, cmd_size);
+		wpid = ::waitpid(pid, &status, block ? 0 : WNOHANG);
+	} while (-1 == wpid && EINTR == errno);
 
-		if (written < 0)
-			return errno;
+	if (-1 == wpid) {
+		int erno = errno;
+
+		std::stringstream e;
+
+		e << "Failed to wait for process " << pid << ": ";
+		e << erno << ": " << strerror(erno);
+
+		throw std::logic_error(e.str());
+	}
+
+	if (0 == wpid)
+		return false;
+
+	// Like a shell tells a command killed by a signal
+	exit_code = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+	return true;
+#endif
+}
+
+
+#ifndef WIN32
+/**
+ *  \brief  Create an output capture pipe
+ *
+ *  Both ends are closed on exec (the write end is duplicated
+ *  to the command output), the read end is non-blocking.
+ *
+ *  \param  fds  Read end, write end
+ */
+static void capturePipe(int fds[2]) {
+	if (::pipe(fds)) {
+		int erno = errno;
+
+		std::stringstream e;
+
+		e << "Failed to create output capture pipe: ";
+		e << erno << ": " << strerror(erno);
+
+		throw std::runtime_error(e.str());
+	}
+
+	::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+}
+
+
+/**
+ *  \brief  Read the available captured output
+ *
+ *  The pipe is closed (and \c fd set to -1) at its end.
+ *
+ *  \param  fd   Capture pipe read end
+ *  \param  buf  Captured output
+ */
+static void captureRead(int & fd, std::string & buf) {
+	char chunk[4096];
+
+	while (-1 != fd) {
+		ssize_t read_out = ::read(fd, chunk, sizeof(chunk));
+
+		if (read_out > 0) {
+			buf.append(chunk, static_cast<size_t>(read_out));
+			continue;
+		}
+
+		if (-1 == read_out) {
+			if (EINTR == errno)
+				continue;
+
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				return;
+		}
+
+		// End of output (or a broken pipe)
+		::close(fd);
+		fd = -1;
+	}
+}
+#endif	/* WIN32 */
+
+
+Process::Execution::Execution(const std::string & binary, const Executor::Arguments & arguments, unsigned int capture):
+	m_pid(0),
+	m_exited(false),
+	m_exit_code(0),
+	m_out_fd(-1),
+	m_err_fd(-1)
+{
+	start(Executor(binary, arguments), capture);
+}
+
+
+Process::Execution::Execution(const std::string & command, unsigned int capture):
+	m_pid(0),
+	m_exited(false),
+	m_exit_code(0),
+	m_out_fd(-1),
+	m_err_fd(-1)
+{
+	start(Executor(command), capture);
+}
+
+
+void Process::Execution::start(const Executor & executor, unsigned int capture)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::runtime_error)
+#endif
+{
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(capture);
+
+	m_pid = spawn(executor);
+#else
+	int out_pipe[2] = { -1, -1 };
+	int err_pipe[2] = { -1, -1 };
 
-		cmd_bytes += written;
-		cmd_size  -= static_cast<size_t>(written);
+	try {
+		if (capture & CAPTURE_STDOUT)
+			capturePipe(out_pipe);
 
-	} while (cmd_size);
+		if (capture & CAPTURE_STDERR)
+			capturePipe(err_pipe);
+
+		m_pid = spawn(executor, out_pipe[1], err_pipe[1]);
+	}
+	catch (...) {
+		for (int i = 0; i < 2; ++i) {
+			if (-1 != out_pipe[i])
+				::close(out_pipe[i]);
+
+			if (-1 != err_pipe[i])
+				::close(err_pipe[i]);
+		}
+
+		throw;
+	}
+
+	// The command has got the write ends
+	if (-1 != out_pipe[1])
+		::close(out_pipe[1]);
+
+	if (-1 != err_pipe[1])
+		::close(err_pipe[1]);
+
+	m_out_fd = out_pipe[0];
+	m_err_fd = err_pipe[0];
+#endif
+}
+
+
+bool Process::Execution::read() {
+#ifndef WIN32
+	captureRead(m_out_fd, m_out);
+	captureRead(m_err_fd, m_err);
+#endif
+
+	return -1 != m_out_fd || -1 != m_err_fd;
+}
+
+
+int Process::Execution::wait()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::logic_error)
+#endif
+{
+	if (m_exited)
+		return m_exit_code;
+
+#ifndef WIN32
+	// Take the output until the command closes it (it could
+	// block on a full pipe otherwise)
+	while (read()) {
+		struct pollfd fds[2];
+		nfds_t nfds = 0;
+
+		if (-1 != m_out_fd) {
+			fds[nfds].fd     = m_out_fd;
+			fds[nfds].events = POLLIN;
+			++nfds;
+		}
+
+		if (-1 != m_err_fd) {
+			fds[nfds].fd     = m_err_fd;
+			fds[nfds].events = POLLIN;
+			++nfds;
+		}
+
+		if (-1 == ::poll(fds, nfds, -1) && EINTR != errno)
+			break;
+	}
+#endif
+
+	waitFor(m_pid, m_exit_code);
+
+	m_exited = true;
+
+	return m_exit_code;
+}
+
+
+Process::Execution::~Execution() {
+	wait();
+
+	// In case the output was not read to its end
+	if (-1 != m_out_fd)
+		::close(m_out_fd);
+
+	if (-1 != m_err_fd)
+		::close(m_err_fd);
+}
+
+
+pid_t Process::ExecutionPool::run(const Executor & executor)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+	throw(std::runtime_error)
+#endif
+{
+	reap();
+
+	// Wait for the oldest one to make room
+	while (m_running.size() >= m_max) {
+		int exit_code;
+
+		waitFor(m_running.front(), exit_code);
+
+		if (exit_code)
+			++m_failed;
+
+		m_running.pop_front();
+	}
+
+	m_running.push_back(spawn(executor));
+
+	return m_running.back();
+}
+
+
+size_t Process::ExecutionPool::reap(bool block) {
+	std::list<pid_t>::iterator pid = m_running.begin();
+
+	while (pid != m_running.end()) {
+		int exit_code;
+
+		if (!waitFor(*pid, exit_code, block)) {
+			++pid;
+			continue;
+		}
+
+		if (exit_code)
+			++m_failed;
+
+		pid = m_running.erase(pid);
+	}
+
+	return m_running.size();
+}
+
+
+Process::ExecutionPool::~ExecutionPool() {
+	try {
+		reap(true);
+	}
+	catch (...) {
+		// The children were reaped by someone else already
+	}
+}
+
+
+int sigWakeOpen(int fds[2]) {
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(fds);
+
+	return ENOSYS;
+#elif (defined HAVE_SYS_EVENTFD_H)
+	/* One counter for both ends */
+	int efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (-1 == efd)
+		return errno;
+
+	fds[0] = fds[1] = efd;
+
+	return 0;
+#else
+	if (::pipe(fds))
+		return errno;
+
+	/* Neither the signal handler nor the draining shall block */
+	for (int i = 0; i < 2; ++i) {
+		int flags = ::fcntl(fds[i], F_GETFL);
+
+		::fcntl(fds[i], F_SETFL, flags | O_NONBLOCK);
+		::fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
 
 	return 0;
+#endif
+}
+
+
+void sigWake(int fh) {
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(fh);
+#else
+	/* A full channel (EAGAIN) has a wake-up pending already, and
+	 * any other error means that the handling side is going down */
+# if (defined HAVE_SYS_EVENTFD_H)
+	uint64_t one = 1;
+
+	ssize_t written = ::write(fh, &one, sizeof(one));
+# else
+	char one = 1;
+
+	ssize_t written = ::write(fh, &one, sizeof(one));
+# endif
+
+	NUT_UNUSED_VARIABLE(written);
+#endif
+}
+
+
+int sigWakeDrain(int fh) {
+#ifdef WIN32
+	NUT_UNUSED_VARIABLE(fh);
+
+	return ENOSYS;
+#else
+	/* An eventfd is reset by one read, a pipe takes a few at most */
+	char buf[64];
+
+	for (;;) {
+		ssize_t read_out = ::read(fh, buf, sizeof(buf));
+
+		if (read_out > 0)
+			continue;
+
+		if (0 == read_out || EAGAIN == errno || EWOULDBLOCK == errno)
+			return 0;
+
+		if (EINTR != errno)
+			return errno;
+	}
+#endif
+}
+
+
+int sigWakeClose(int fds[2]) {
+	int status = 0;
+
+	if (-1 != fds[1] && fds[1] != fds[0] && ::close(fds[1]))
+		status = errno;
+
+	if (-1 != fds[0] && ::close(fds[0]) && !status)
+		status = errno;
+
+	fds[0] = fds[1] = -1;
+
+	return status;
 }
 
 
@@ -0,0 +1,135 @@
+/* nutstatus.c - Network UPS Tools ups.status tokens as bit flags
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"	/* must be first */
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_STRINGS_H
+#include <strings.h>	/* for strncasecmp() */
+#endif
+
+#include "nutstatus.h"
+
+/* indexed by the bit numbers of the NUT_STATUS_* flags */
+static const struct {
+	const char	*token;
+	size_t	len;
+} nut_status_tokens[] = {
+	{ "OL", 2 },
+	{ "OB", 2 },
+	{ "LB", 2 },
+	{ "HB", 2 },
+	{ "RB", 2 },
+	{ "CHRG", 4 },
+	{ "DISCHRG", 7 },
+	{ "BYPASS", 6 },
+	{ "CAL", 3 },
+	{ "OFF", 3 },
+	{ "OVER", 4 },
+	{ "TRIM", 4 },
+	{ "BOOST", 5 },
+	{ "FSD", 3 },
+	{ "ALARM", 5 },
+	{ "ECO", 3 },
+	{ NULL, 0 }
+};
+
+nut_status_t nut_status_flag(const char *token, size_t len)
+{
+	size_t	i;
+
+	for (i = 0; nut_status_tokens[i].token; i++) {
+		if (nut_status_tokens[i].len == len
+		 && !strncasecmp(nut_status_tokens[i].token, token, len)
+		) {
+			return (nut_status_t)1 << i;
+		}
+	}
+
+	return 0;
+}
+
+const char *nut_status_token(nut_status_t flag)
+{
+	size_t	i;
+
+	for (i = 0; nut_status_tokens[i].token; i++) {
+		if (flag == ((nut_status_t)1 << i))
+			return nut_status_tokens[i].token;
+	}
+
+	return NULL;
+}
+
+nut_status_t nut_status_parse(const char *status)
+{
+	nut_status_t	flags = 0, flag;
+	size_t	len;
+
+	if (!status)
+		return 0;
+
+	while (*status) {
+		if (*status == ' ') {
+			status++;
+			continue;
+		}
+
+		len = strcspn(status, " ");
+		flag = nut_status_flag(status, len);
+		flags |= (flag ? flag : NUT_STATUS_OTHER);
+		status += len;
+	}
+
+	return flags;
+}
+
+int nut_status_format(char *buf, size_t buflen, nut_status_t flags)
+{
+	size_t	i, len = 0;
+
+	if (buflen > 0)
+		buf[0] = '\0';
+
+	for (i = 0; nut_status_tokens[i].token; i++) {
+		size_t	tlen = nut_status_tokens[i].len;
+
+		if (!(flags & ((nut_status_t)1 << i)))
+			continue;
+
+		if (len > 0) {
+			if (len + 1 < buflen) {
+				buf[len] = ' ';
+				buf[len + 1] = '\0';
+			}
+			len++;
+		}
+
+		if (len + tlen < buflen) {
+			memcpy(buf + len, nut_status_tokens[i].token, tlen + 1);
+		} else if (len < buflen) {
+			/* cut, as snprintf() would */
+			memcpy(buf + len, nut_status_tokens[i].token, buflen - len - 1);
+			buf[buflen - 1] = '\0';
+		}
+		len += tlen;
+	}
+
+	return (int)len;
+}
@@ -51,6 +51,9 @@ extern "C" {
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP)
+# include <sys/mman.h>
+#endif
 
 /* Windows/Linux Socket compatibility layer, lifted from nutclient.cpp
  * (note we do not use wincompat.h here as it slightly conflicts, with
@@ -96,6 +99,7 @@ static inline int sktclose(int fh)
 #  include <arpa/inet.h>
 #  include <netdb.h> /* gethostbyname */
 #  include <fcntl.h>
+#  include <sys/uio.h>	/* writev */
 #  ifndef INVALID_SOCKET
 #    define INVALID_SOCKET -1
 #  endif
@@ -134,6 +138,12 @@ static inline int sktclose(int fh)
 /* End of Windows/Linux Socket compatibility layer */
 }
 
+/* Size of the blocks read at once by the buffered streams */
+#define NUTSTREAM_BLOCK_SIZE	4096
+
+/* Chunks gathered by one writev(); _XOPEN_IOV_MAX, the least allowed */
+#define NUTSTREAM_IOV_MAX	16
+
 
 namespace nut {
 
@@ -143,6 +153,73 @@ namespace nut {
  */
 NutStream::~NutStream() {}
 
+
+NutStream::status_t NutStream::getLine(std::string & line) {
+	line.clear();
+
+	for (;;) {
+		char ch;
+
+		status_t status = getChar(ch);
+
+		if (NUTS_EOF == status)
+			return line.empty() ? NUTS_EOF : NUTS_OK;
+
+		if (NUTS_OK != status)
+			return status;
+
+		readChar();
+
+		if ('\n' == ch)
+			return NUTS_OK;
+
+		line += ch;
+	}
+}
+
+
+NutStream::status_t NutStream::getData(std::string & data, size_t size) {
+	data.clear();
+
+	while (data.size() < size) {
+		char ch;
+
+		status_t status = getChar(ch);
+
+		if (NUTS_EOF == status)
+			break;
+
+		if (NUTS_OK != status)
+			return status;
+
+		readChar();
+
+		data += ch;
+	}
+
+	return data.empty() && size > 0 ? NUTS_EOF : NUTS_OK;
+}
+
+
+bool NutStream::view(const char * & data, size_t & size) const {
+	NUT_UNUSED_VARIABLE(data);
+	NUT_UNUSED_VARIABLE(size);
+
+	return false;
+}
+
+
+NutStream::status_t NutStream::putData(const std::vector<std::string> & data) {
+	for (size_t i = 0; i < data.size(); ++i) {
+		status_t status = putData(data[i]);
+
+		if (NUTS_OK != status)
+			return status;
+	}
+
+	return NUTS_OK;
+}
+
 NutStream::status_t NutMemory::getChar(char & ch) {
 	if (m_pos == m_impl.size())
 		return NUTS_EOF;
@@ -171,6 +248,56 @@ NutStream::status_t NutMemory::getString(std::string & str) {
 }
 
 
+NutStream::status_t NutMemory::getLine(std::string & line) {
+	if (m_pos >= m_impl.size()) {
+		line.clear();
+
+		return NUTS_EOF;
+	}
+
+	size_t eol = m_impl.find('\n', m_pos);
+
+	if (std::string::npos == eol) {
+		line = m_impl.substr(m_pos);
+
+		m_pos = m_impl.size();
+	}
+	else {
+		line = m_impl.substr(m_pos, eol - m_pos);
+
+		m_pos = eol + 1;
+	}
+
+	return NUTS_OK;
+}
+
+
+NutStream::status_t NutMemory::getData(std::string & data, size_t size) {
+	if (m_pos >= m_impl.size()) {
+		data.clear();
+
+		return 0 == size ? NUTS_OK : NUTS_EOF;
+	}
+
+	data = m_impl.substr(m_pos, size);
+
+	m_pos += data.size();
+
+	return NUTS_OK;
+}
+
+
+bool NutMemory::view(const char * & data, size_t & size) const {
+	if (m_pos > m_impl.size())
+		return false;
+
+	data = m_impl.data() + m_pos;
+	size = m_impl.size() - m_pos;
+
+	return true;
+}
+
+
 NutStream::status_t NutMemory::putChar(char ch) {
 	m_impl += ch;
 
@@ -190,6 +317,21 @@ NutStream::status_t NutMemory::putData(const std::string & data) {
 }
 
 
+NutStream::status_t NutMemory::putData(const std::vector<std::string> & data) {
+	size_t size = m_impl.size();
+
+	for (size_t i = 0; i < data.size(); ++i)
+		size += data[i].size();
+
+	m_impl.reserve(size);
+
+	for (size_t i = 0; i < data.size(); ++i)
+		m_impl += data[i];
+
+	return NUTS_OK;
+}
+
+
 /* Here we align with OS envvars like TMPDIR or TEMPDIR,
  * consider portability to Windows, or use of tmpfs like
  * /dev/shm or (/var)/run on some platforms - e.g. NUT
@@ -322,7 +464,11 @@ NutFile::NutFile(anonymous_t):
 	m_name(""),
 	m_impl(nullptr),
 	m_current_ch('\0'),
-	m_current_ch_valid(false)
+	m_current_ch_valid(false),
+	m_map(nullptr),
+	m_map_size(0),
+	m_pending(),
+	m_tmp_name()
 {
 #ifdef WIN32
 	/* Suggestions from https://sourceforge.net/p/mingw/bugs/666/ because
@@ -415,9 +561,11 @@ const char * NutFile::strAccessMode(access_t mode)
 
 	switch (mode) {
 		case READ_ONLY:
+		case READ_ONLY_MAPPED:
 			mode_str = read_only;
 			break;
 		case WRITE_ONLY:
+		case WRITE_ATOMIC:
 			mode_str = write_only;
 			break;
 		case READ_WRITE:
@@ -480,9 +628,21 @@ bool NutFile::open(access_t mode, int & err_code, std::string & err_msg)
 
 	if (nullptr != m_impl) {
 		/* TOTHINK: Should we care about errors in this close()? */
+		unmap();
 		::fclose(m_impl);
+		m_impl = nullptr;
+
+		/* A replacement not committed is dropped */
+		if (!m_tmp_name.empty()) {
+			::unlink(m_tmp_name.c_str());
+			m_tmp_name.clear();
+			std::string().swap(m_pending);
+		}
 	}
 
+	if (WRITE_ATOMIC == mode)
+		return openAtomic(err_code, err_msg);
+
 #ifdef WIN32
 	/* This currently fails with mingw due to looking at POSIXified paths:
 	 *   - Failed to open file /c/Users/abuild/Documents/FOSS/nut/conf/nut.conf.sample: 2: No such file or directory
@@ -506,9 +666,14 @@ bool NutFile::open(access_t mode, int & err_code, std::string & err_msg)
 
 	mode_str = strAccessMode(mode);
 	m_impl = ::fopen(m_name.c_str(), mode_str);
+	m_current_ch_valid = false;
+
+	if (nullptr != m_impl) {
+		if (READ_ONLY_MAPPED == mode)
+			map();
 
-	if (nullptr != m_impl)
 		return true;
+	}
 
 	err_code = errno;
 	err_msg  = "Failed to open file '" + m_name + "': "
@@ -551,6 +716,11 @@ bool NutFile::close(int & err_code, std::string & err_msg)
 		return true;
 	}
 
+	unmap();
+
+	if (!m_tmp_name.empty())
+		return commitAtomic(err_code, err_msg);
+
 	err_code = ::fclose(m_impl);
 
 	if (0 != err_code) {
@@ -599,7 +769,11 @@ NutFile::NutFile(const std::string & name, access_t mode):
 	m_name(name),
 	m_impl(nullptr),
 	m_current_ch('\0'),
-	m_current_ch_valid(false)
+	m_current_ch_valid(false),
+	m_map(nullptr),
+	m_map_size(0),
+	m_pending(),
+	m_tmp_name()
 {
 	openx(mode);
 }
@@ -624,6 +798,176 @@ NutFile::NutFile(access_t mode):
 }
 
 
+bool NutFile::openAtomic(int & err_code, std::string & err_msg)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	/* The temporary file is next to the target, so that the rename
+	 * is one in the same file system */
+#ifdef WIN32
+	m_tmp_name = m_name + ".tmp";
+	m_impl = ::fopen(m_tmp_name.c_str(), strAccessMode(WRITE_ATOMIC));
+#else
+	std::string tmpl = m_name + ".XXXXXX";
+	int fd = ::mkstemp(&tmpl[0]);
+
+	if (fd >= 0) {
+		struct stat info;
+
+		m_tmp_name = tmpl;
+
+		/* The file gets the permissions it had (or would get from
+		 * a plain open) rather than the private ones of mkstemp() */
+		if (0 == ::stat(m_name.c_str(), &info)) {
+			::fchmod(fd, info.st_mode & 07777);
+
+			if (0 != ::fchown(fd, info.st_uid, info.st_gid)) {
+				/* Not ours to give away unless privileged: it
+				 * stays owned by the writer, like a new file */
+			}
+		} else {
+			mode_t mask = ::umask(0);
+
+			::umask(mask);
+			::fchmod(fd, 0666 & ~mask);
+		}
+
+		m_impl = ::fdopen(fd, strAccessMode(WRITE_ATOMIC));
+
+		if (nullptr == m_impl) {
+			int fdopen_errno = errno;
+
+			::close(fd);
+			errno = fdopen_errno;
+		}
+	}
+#endif
+
+	m_current_ch_valid = false;
+
+	if (nullptr != m_impl) {
+		m_pending.clear();
+
+		return true;
+	}
+
+	err_code = errno;
+	err_msg  = "Failed to create a temporary file for '" + m_name + "': "
+			+ std::string(::strerror(err_code));
+
+	if (!m_tmp_name.empty()) {
+		::unlink(m_tmp_name.c_str());
+		m_tmp_name.clear();
+	}
+
+	return false;
+}
+
+
+bool NutFile::commitAtomic(int & err_code, std::string & err_msg)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	const char * data = m_pending.data();
+	size_t left = m_pending.size();
+	int fd = fileno(m_impl);
+
+	err_code = 0;
+
+	/* One write() for the whole contents, unless it comes up short */
+	while (left > 0) {
+		ssize_t written = ::write(fd, data, left);
+
+		if (written < 0) {
+			if (EINTR == errno)
+				continue;
+
+			err_code = errno;
+			break;
+		}
+
+		data += written;
+		left -= static_cast<size_t>(written);
+	}
+
+#ifndef WIN32
+	if (0 == err_code && 0 != ::fsync(fd))
+		err_code = errno;
+#endif
+
+	if (0 != ::fclose(m_impl) && 0 == err_code)
+		err_code = errno;
+
+	m_impl = nullptr;
+	std::string().swap(m_pending);
+
+	if (0 == err_code) {
+#ifdef WIN32
+		if (!MoveFileExA(m_tmp_name.c_str(), m_name.c_str(),
+			MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)
+		)
+			err_code = EACCES;
+#else
+		if (0 != ::rename(m_tmp_name.c_str(), m_name.c_str()))
+			err_code = errno;
+#endif
+	}
+
+	if (0 != err_code) {
+		err_msg = "Failed to replace file '" + m_name + "': "
+				+ std::string(::strerror(err_code));
+
+		::unlink(m_tmp_name.c_str());
+	}
+
+	m_tmp_name.clear();
+
+	return 0 == err_code;
+}
+
+
+void NutFile::map()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP)
+	struct stat st;
+
+	// Only regular files, and not empty ones (these can't be mapped);
+	// the stdio stream serves the others, and view() tells so
+	if (0 != ::fstat(fileno(m_impl), &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return;
+
+	size_t size = static_cast<size_t>(st.st_size);
+	void * addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(m_impl), 0);
+
+	if (MAP_FAILED == addr)
+		return;
+
+	m_map      = static_cast<const char *>(addr);
+	m_map_size = size;
+#endif	/* HAVE_MMAP */
+}
+
+
+void NutFile::unmap()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP)
+	if (nullptr != m_map)
+		::munmap(const_cast<char *>(m_map), m_map_size);
+#endif	/* HAVE_MMAP */
+
+	m_map      = nullptr;
+	m_map_size = 0;
+}
+
+
 /**
  *  \brief  C fgetc wrapper
  *
@@ -703,21 +1047,86 @@ NutStream::status_t NutFile::getString(std::string & str)
 	if (nullptr == m_impl)
 		return NUTS_ERROR;
 
-	// Note that ::fgetc is used instead of ::fgets
+	// Note that ::fread is used instead of ::fgets
 	// That's because of \0 char. support
+	char buffer[NUTSTREAM_BLOCK_SIZE];
+
 	for (;;) {
-		char ch;
+		size_t read_cnt = ::fread(buffer, 1, sizeof(buffer), m_impl);
 
-		status_t status = fgetcWrapper(m_impl, ch);
+		str.append(buffer, read_cnt);
 
-		if (NUTS_ERROR == status)
-			return status;
+		if (read_cnt < sizeof(buffer))
+			return ::ferror(m_impl) ? NUTS_ERROR : NUTS_OK;
+	}
+}
 
-		if (NUTS_EOF == status)
-			return NUTS_OK;
 
-		str += ch;
+NutStream::status_t NutFile::getData(std::string & data, size_t size)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	data.clear();
+
+	if (0 == size)
+		return NUTS_OK;
+
+	if (nullptr == m_impl)
+		return NUTS_ERROR;
+
+	if (m_current_ch_valid)
+		data += m_current_ch;
+
+	m_current_ch_valid = false;
+
+	char buffer[NUTSTREAM_BLOCK_SIZE];
+
+	while (data.size() < size) {
+		size_t want = size - data.size();
+
+		if (want > sizeof(buffer))
+			want = sizeof(buffer);
+
+		size_t read_cnt = ::fread(buffer, 1, want, m_impl);
+
+		data.append(buffer, read_cnt);
+
+		if (read_cnt < want) {
+			if (::ferror(m_impl))
+				return NUTS_ERROR;
+
+			break;
+		}
 	}
+
+	return data.empty() ? NUTS_EOF : NUTS_OK;
+}
+
+
+bool NutFile::view(const char * & data, size_t & size) const
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	if (nullptr == m_map)
+		return false;
+
+	// The view starts where the stream is (less the cached character)
+	long pos = ::ftell(m_impl);
+
+	if (pos < 0 || static_cast<size_t>(pos) > m_map_size)
+		return false;
+
+	size_t offset = static_cast<size_t>(pos);
+
+	if (m_current_ch_valid && offset > 0)
+		--offset;
+
+	data = m_map + offset;
+	size = m_map_size - offset;
+
+	return true;
 }
 
 
@@ -731,6 +1140,12 @@ NutStream::status_t NutFile::putChar(char ch)
 	if (nullptr == m_impl)
 		return NUTS_ERROR;
 
+	if (!m_tmp_name.empty()) {
+		m_pending += ch;
+
+		return NUTS_OK;
+	}
+
 	c = ::fputc(static_cast<int>(ch), m_impl);
 
 	return EOF == c ? NUTS_ERROR : NUTS_OK;
@@ -747,6 +1162,12 @@ NutStream::status_t NutFile::putString(const std::string & str)
 	if (nullptr == m_impl)
 		return NUTS_ERROR;
 
+	if (!m_tmp_name.empty()) {
+		m_pending.append(str.c_str());
+
+		return NUTS_OK;
+	}
+
 	c = ::fputs(str.c_str(), m_impl);
 
 	return EOF == c ? NUTS_ERROR : NUTS_OK;
@@ -758,10 +1179,33 @@ NutStream::status_t NutFile::putData(const std::string & data)
 		throw()
 #endif
 {
-	// Unfortunately, C FILE interface doesn't have non C-string
-	// put function (i.e. function for raw data output with size specifier
+	if (nullptr == m_impl)
+		return NUTS_ERROR;
+
+	// Unlike ::fputs, ::fwrite is fine with null characters
+	if (data.empty())
+		return NUTS_OK;
+
+	if (!m_tmp_name.empty()) {
+		m_pending += data;
+
+		return NUTS_OK;
+	}
+
+	size_t write_cnt = ::fwrite(data.data(), 1, data.size(), m_impl);
+
+	return write_cnt == data.size() ? NUTS_OK : NUTS_ERROR;
+}
+
+
+NutStream::status_t NutFile::putData(const std::vector<std::string> & data)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	// The FILE buffer gathers the chunks already
 	for (size_t i = 0; i < data.size(); ++i) {
-		status_t st = putChar(data.at(i));
+		status_t st = putData(data[i]);
 
 		if (NUTS_ERROR == st)
 			return NUTS_ERROR;
@@ -1089,8 +1533,7 @@ NutSocket::NutSocket(domain_t dom, type_t type, proto_t proto):
 	m_impl(-1),
 	m_domain(dom),
 	m_type(type),
-	m_current_ch('\0'),
-	m_current_ch_valid(false)
+	m_rbuf_pos(0)
 {
 	int cdom   = static_cast<int>(dom);
 	int ctype  = static_cast<int>(type);
@@ -1256,39 +1699,49 @@ NutSocket::~NutSocket() {
 }
 
 
-NutStream::status_t NutSocket::getChar(char & ch)
+NutStream::status_t NutSocket::fillReadBuffer()
 #if (defined __cplusplus) && (__cplusplus < 201100)
 		throw()
 #endif
 {
-	if (m_current_ch_valid) {
-		ch = m_current_ch;
+	m_rbuf.resize(NUTSTREAM_BLOCK_SIZE);
+	m_rbuf_pos = 0;
 
-		return NUTS_OK;
-	}
+	ssize_t read_cnt;
 
-	// TBD: Perhaps we should buffer more bytes at once
-	// However, buffering is already done in kernel space,
-	// so unless we need greater reading efficiency, char-by-char
-	// reading should be sufficient
+	do {
+		read_cnt = sktread(m_impl, &m_rbuf[0], NUTSTREAM_BLOCK_SIZE);
+	} while (read_cnt < 0 && EINTR == errno);
 
-	ssize_t read_cnt = ::read(m_impl, &ch, 1);
+	if (read_cnt <= 0) {
+		m_rbuf.clear();
 
-	if (1 == read_cnt) {
-		m_current_ch       = ch;
-		m_current_ch_valid = true;
+		// TODO: At least logging of the error (errno), if not propagation
 
-		return NUTS_OK;
+		return 0 == read_cnt ? NUTS_EOF : NUTS_ERROR;
 	}
 
-	if (0 == read_cnt)
-		return NUTS_EOF;
+	m_rbuf.resize(static_cast<size_t>(read_cnt));
+
+	return NUTS_OK;
+}
 
-	assert(-1 == read_cnt);
 
-	// TODO: At least logging of the error (errno), if not propagation
+NutStream::status_t NutSocket::getChar(char & ch)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	if (m_rbuf_pos >= m_rbuf.size()) {
+		status_t status = fillReadBuffer();
 
-	return NUTS_ERROR;
+		if (NUTS_OK != status)
+			return status;
+	}
+
+	ch = m_rbuf[m_rbuf_pos];
+
+	return NUTS_OK;
 }
 
 
@@ -1297,7 +1750,8 @@ void NutSocket::readChar()
 		throw()
 #endif
 {
-	m_current_ch_valid = false;
+	if (m_rbuf_pos < m_rbuf.size())
+		++m_rbuf_pos;
 }
 
 
@@ -1306,72 +1760,198 @@ NutStream::status_t NutSocket::getString(std::string & str)
 		throw()
 #endif
 {
-	if (m_current_ch_valid)
-		str += m_current_ch;
+	for (;;) {
+		if (m_rbuf_pos < m_rbuf.size())
+			str.append(m_rbuf, m_rbuf_pos, std::string::npos);
 
-	m_current_ch_valid = false;
+		status_t status = fillReadBuffer();
 
-	char buffer[512];
+		if (NUTS_EOF == status)
+			return NUTS_OK;
+
+		if (NUTS_OK != status)
+			return status;
+	}
+}
+
+
+NutStream::status_t NutSocket::getLine(std::string & line)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+	line.clear();
 
 	for (;;) {
-		ssize_t read_cnt = sktread(m_impl, buffer, sizeof(buffer) / sizeof(buffer[0]));
+		if (m_rbuf_pos >= m_rbuf.size()) {
+			status_t status = fillReadBuffer();
 
-		if (read_cnt < 0)
-			return NUTS_ERROR;
+			if (NUTS_EOF == status)
+				return line.empty() ? NUTS_EOF : NUTS_OK;
+
+			if (NUTS_OK != status)
+				return status;
+		}
+
+		size_t eol = m_rbuf.find('\n', m_rbuf_pos);
+
+		if (std::string::npos != eol) {
+			line.append(m_rbuf, m_rbuf_pos, eol - m_rbuf_pos);
+			m_rbuf_pos = eol + 1;
 
-		if (0 == read_cnt)
 			return NUTS_OK;
+		}
 
-		str.append(buffer, static_cast<size_t>(read_cnt));
+		line.append(m_rbuf, m_rbuf_pos, std::string::npos);
+		m_rbuf_pos = m_rbuf.size();
 	}
 }
 
 
-NutStream::status_t NutSocket::putChar(char ch)
+NutStream::status_t NutSocket::getData(std::string & data, size_t size)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 		throw()
 #endif
 {
-	ssize_t write_cnt = sktwrite(m_impl, &ch, 1);
+	data.clear();
 
-	if (1 == write_cnt)
-		return NUTS_OK;
+	while (data.size() < size) {
+		if (m_rbuf_pos >= m_rbuf.size()) {
+			status_t status = fillReadBuffer();
+
+			if (NUTS_EOF == status)
+				return data.empty() ? NUTS_EOF : NUTS_OK;
+
+			if (NUTS_OK != status)
+				return status;
+		}
+
+		size_t chunk = m_rbuf.size() - m_rbuf_pos;
 
-	assert(-1 == write_cnt);
+		if (chunk > size - data.size())
+			chunk = size - data.size();
 
-	// TODO: At least logging of the error (errno), if not propagation
+		data.append(m_rbuf, m_rbuf_pos, chunk);
+		m_rbuf_pos += chunk;
+	}
 
-	return NUTS_ERROR;
+	return NUTS_OK;
 }
 
 
-NutStream::status_t NutSocket::putString(const std::string & str)
+/**
+ *  \brief  Write all of a buffer to a socket
+ *
+ *  Short writes are resumed.
+ *
+ *  \param  fh    Socket
+ *  \param  buf   Data
+ *  \param  size  Data size
+ *
+ *  \retval NUTS_OK    on success
+ *  \retval NUTS_ERROR on write error
+ */
+static NutStream::status_t sktwriteAll(int fh, const char * buf, size_t size) {
+	while (size > 0) {
+		ssize_t write_cnt = sktwrite(fh, buf, size);
+
+		if (write_cnt <= 0) {
+			if (write_cnt < 0 && EINTR == errno)
+				continue;
+
+			// TODO: At least logging of the error (errno), if not propagation
+
+			return NutStream::NUTS_ERROR;
+		}
+
+		buf  += write_cnt;
+		size -= static_cast<size_t>(write_cnt);
+	}
+
+	return NutStream::NUTS_OK;
+}
+
+
+NutStream::status_t NutSocket::putChar(char ch)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 		throw()
 #endif
 {
-	size_t str_len = str.size();
-
-	// Avoid the costly system call unless necessary
-	if (0 == str_len)
-		return NUTS_OK;
+	return sktwriteAll(m_impl, &ch, 1);
+}
 
-	ssize_t write_cnt = sktwrite(m_impl, str.data(), str_len);
 
-	// TODO: Under certain circumstances, less than the whole
-	// string might be written
+NutStream::status_t NutSocket::putString(const std::string & str)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
 	// Review the code if async. I/O is supported (in which case
 	// the function shall have to implement the blocking using
 	// select/poll/epoll on its own (probably select for portability)
 
-	assert(write_cnt > 0);
+	return sktwriteAll(m_impl, str.data(), str.size());
+}
 
-	if (static_cast<size_t>(write_cnt) == str_len)
-		return NUTS_OK;
 
-	// TODO: At least logging of the error (errno), if not propagation
+NutStream::status_t NutSocket::putData(const std::vector<std::string> & data)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+{
+#ifdef WIN32
+	// No writev() for sockets; gather the chunks here instead
+	std::string str;
+
+	for (size_t i = 0; i < data.size(); ++i)
+		str += data[i];
+
+	return putString(str);
+#else
+	// Current chunk, and how much of it is written already
+	size_t i = 0, done = 0;
+
+	for (;;) {
+		struct iovec iov[NUTSTREAM_IOV_MAX];
+		int iov_cnt = 0;
+
+		for (size_t j = i; j < data.size() && iov_cnt < NUTSTREAM_IOV_MAX; ++j) {
+			size_t skip = (j == i ? done : 0);
+
+			if (data[j].size() <= skip)
+				continue;
+
+			iov[iov_cnt].iov_base = const_cast<char *>(data[j].data() + skip);
+			iov[iov_cnt].iov_len  = data[j].size() - skip;
+			++iov_cnt;
+		}
+
+		if (0 == iov_cnt)
+			return NUTS_OK;
+
+		ssize_t write_cnt = ::writev(m_impl, iov, iov_cnt);
+
+		if (write_cnt <= 0) {
+			if (write_cnt < 0 && EINTR == errno)
+				continue;
 
-	return NUTS_ERROR;
+			// TODO: At least logging of the error (errno), if not propagation
+
+			return NUTS_ERROR;
+		}
+
+		// Skip what got written
+		size_t left = static_cast<size_t>(write_cnt);
+
+		while (i < data.size() && left >= data[i].size() - done) {
+			left -= data[i].size() - done;
+			done  = 0;
+			++i;
+		}
+
+		done += left;
+	}
+#endif	/* WIN32 */
 }
 
 }  // end of namespace nut
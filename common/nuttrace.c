@@ -0,0 +1,232 @@
+/* nuttrace.c - Network UPS Tools binary trace ring for daemons
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"	/* must be first */
+
+#include <stdio.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#include "common.h"
+#include "timehead.h"
+#include "nuttrace.h"
+
+/* the most records a ring may have (48 MiB) */
+#define NUT_TRACE_MAX	(1024 * 1024)
+
+nut_trace_rec_t	*nut_trace_ring = NULL;
+
+static uint64_t	nut_trace_next = 0;	/* records added so far */
+static size_t	nut_trace_mask = 0;	/* records in the ring - 1 */
+static char	nut_trace_name[SMALLBUF];
+static volatile sig_atomic_t	nut_trace_dump_flag = 0;
+
+static const char	*nut_trace_names[NUT_TRACE_EVENTS] = {
+	"none",
+	"net-cmd",
+	"net-send",
+	"sstate-read",
+	"sstate-line",
+	"dstate-cmd",
+	"dstate-send",
+	"upsmon-poll",
+	"upsmon-event",
+	"mark"
+};
+
+static uint64_t nut_trace_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+void nut_trace_add(nut_trace_event_t event, long a, int64_t b, const char *s, const char *s2)
+{
+	nut_trace_rec_t	*rec = &nut_trace_ring[nut_trace_next++ & nut_trace_mask];
+	size_t	i = 0;
+
+	rec->ns = nut_trace_now();
+	rec->event = (uint32_t)event;
+	rec->a = (int32_t)a;
+	rec->b = b;
+
+	/* no strncpy(): it would pad the rest, and s2 follows */
+	if (s) {
+		for (; i < NUT_TRACE_STRLEN && s[i]; i++)
+			rec->s[i] = s[i];
+	}
+	if (s2 && i < NUT_TRACE_STRLEN - 1) {
+		if (i > 0)
+			rec->s[i++] = ' ';
+		for (; i < NUT_TRACE_STRLEN && *s2; i++)
+			rec->s[i] = *s2++;
+	}
+	if (i < NUT_TRACE_STRLEN)
+		rec->s[i] = '\0';
+}
+
+void nut_trace_add_buf(nut_trace_event_t event, long a, const char *buf, size_t len)
+{
+	nut_trace_rec_t	*rec = &nut_trace_ring[nut_trace_next++ & nut_trace_mask];
+	size_t	i, n = (len < NUT_TRACE_STRLEN ? len : NUT_TRACE_STRLEN);
+
+	rec->ns = nut_trace_now();
+	rec->event = (uint32_t)event;
+	rec->a = (int32_t)a;
+	rec->b = (int64_t)len;
+
+	for (i = 0; i < n; i++)
+		rec->s[i] = buf[i];
+	if (i < NUT_TRACE_STRLEN)
+		rec->s[i] = '\0';
+}
+
+static void nut_trace_fatal(void)
+{
+	nut_trace_dump("fatal error");
+}
+
+void nut_trace_init(const char *name)
+{
+	const char	*env = getenv("NUT_TRACE");
+	unsigned long	want;
+	size_t	size = 1;
+
+	snprintf(nut_trace_name, sizeof(nut_trace_name), "%s", name);
+
+	if (!env || !*env)
+		return;
+
+	want = strtoul(env, NULL, 10);
+	if (want == 0)
+		return;
+	if (want > NUT_TRACE_MAX)
+		want = NUT_TRACE_MAX;
+
+	while (size < want)
+		size <<= 1;
+
+	nut_trace_free();
+	nut_trace_ring = xcalloc(size, sizeof(*nut_trace_ring));
+	nut_trace_mask = size - 1;
+	nut_trace_next = 0;
+
+	upslog_set_fatal_hook(nut_trace_fatal);
+
+	upslogx(LOG_INFO, "Tracing the latest %" PRIuSIZE " events in memory"
+		" (%" PRIuSIZE " bytes)", size, size * sizeof(*nut_trace_ring));
+}
+
+/* one record as a line of text; characters of the string which could
+ * break it (newlines of protocol lines, mostly) are shown as '.' */
+static int nut_trace_format(const nut_trace_rec_t *rec, uint64_t first, char *buf, size_t bufsize)
+{
+	char	s[NUT_TRACE_STRLEN + 1];
+	uint64_t	ns = rec->ns - first;
+	size_t	i;
+
+	for (i = 0; i < NUT_TRACE_STRLEN && rec->s[i]; i++)
+		s[i] = (rec->s[i] < ' ' || rec->s[i] == 0x7f) ? '.' : rec->s[i];
+	s[i] = '\0';
+
+	return snprintf(buf, bufsize, "%6" PRIu64 ".%09" PRIu64 " %-12s %11" PRIi32 " %11" PRIi64 " [%s]\n",
+		ns / 1000000000, ns % 1000000000,
+		(rec->event < NUT_TRACE_EVENTS ? nut_trace_names[rec->event] : "?"),
+		rec->a, rec->b, s);
+}
+
+int nut_trace_dump(const char *why)
+{
+	const char	*path = getenv("NUT_TRACE_FILE");
+	char	fn[PATH_MAX], buf[LARGEBUF];
+	uint64_t	n, start, first;
+	size_t	size = nut_trace_mask + 1;
+	int	fd, len, count = 0;
+
+	if (!nut_trace_ring)
+		return -1;
+
+	if (!path || !*path) {
+		snprintf(fn, sizeof(fn), "%s/%s.trace", dflt_statepath(), nut_trace_name);
+		path = fn;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd < 0) {
+		upslog_with_errno(LOG_WARNING, "Can not dump the trace to %s", path);
+		return -1;
+	}
+
+	start = (nut_trace_next > size ? nut_trace_next - size : 0);
+	first = nut_trace_ring[start & nut_trace_mask].ns;
+
+	len = snprintf(buf, sizeof(buf), "=== %s[%" PRIiMAX "] trace (%s): %" PRIu64
+		" events, the latest %" PRIu64 " follow (seconds since the first)\n",
+		nut_trace_name, (intmax_t)getpid(), why, nut_trace_next, nut_trace_next - start);
+
+	for (n = start; ; n++) {
+		/* written a bufferful at a time */
+		if (len > 0 && (n == nut_trace_next || (size_t)len > sizeof(buf) - SMALLBUF)) {
+			if (write(fd, buf, (size_t)len) != len)
+				break;
+			len = 0;
+		}
+		if (n == nut_trace_next)
+			break;
+
+		len += nut_trace_format(&nut_trace_ring[n & nut_trace_mask], first,
+			buf + len, sizeof(buf) - (size_t)len);
+		count++;
+	}
+
+	close(fd);
+
+	upslogx(LOG_NOTICE, "Dumped %d trace events to %s", count, path);
+	return count;
+}
+
+void nut_trace_dump_request(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	nut_trace_dump_flag = 1;
+}
+
+void nut_trace_dump_pending(void)
+{
+	if (!nut_trace_dump_flag)
+		return;
+
+	nut_trace_dump_flag = 0;
+	nut_trace_dump("signal");
+}
+
+void nut_trace_free(void)
+{
+	free(nut_trace_ring);
+	nut_trace_ring = NULL;
+	nut_trace_mask = 0;
+	upslog_set_fatal_hook(NULL);
+}
@@ -787,10 +787,13 @@ NutWriter::status_t UpsdConfigWriter::writeConfig(const UpsdConfiguration & conf
 	UPSD_DIRECTIVEX("DEBUG_MIN",                int,          config.debugMin);
 	UPSD_DIRECTIVEX("MAXAGE",                   unsigned int, config.maxAge);
 	UPSD_DIRECTIVEX("MAXCONN",                  unsigned int, config.maxConn);
+	UPSD_DIRECTIVEX("MAXCLIENTQUEUE",           unsigned int, config.maxClientQueue);
 	UPSD_DIRECTIVEX("TRACKINGDELAY",            unsigned int, config.trackingDelay);
+	UPSD_DIRECTIVEX("CLIENT_INACTIVITY_DELAY",  unsigned int, config.clientInactivityDelay);
 	UPSD_DIRECTIVEX("ALLOW_NO_DEVICE",          bool,         config.allowNoDevice);
 	UPSD_DIRECTIVEX("ALLOW_NOT_ALL_LISTENERS",  bool,         config.allowNotAllListeners);
 	UPSD_DIRECTIVEX("DISABLE_WEAK_SSL",         bool,         config.disableWeakSsl);
+	UPSD_DIRECTIVEX("SSL_HANDSHAKE_WORKERS",    unsigned int, config.sslHandshakeWorkers);
 	CONFIG_DIRECTIVEX("STATEPATH",              std::string,  config.statePath, true);
 	CONFIG_DIRECTIVEX("CERTFILE",               std::string,  config.certFile, true);
 	CONFIG_DIRECTIVEX("CERTPATH",               std::string,  config.certPath, true);
@@ -28,6 +28,8 @@
  * two entry points for parsing lines.  You can have it read a file
  * (pconf_file_begin and pconf_file_next), take lines directly from
  * the caller (pconf_line), or go along a character at a time (pconf_char).
+ * Socket readers which get arbitrary chunks of input can hand over a
+ * whole buffer (pconf_feed), which returns after each complete line.
  * The parsing is identical no matter how you feed it.
  *
  * Since there are no more callbacks, you take the successful return
@@ -74,6 +76,11 @@
  * Finally, there is argsize, which remembers how long each of the
  * arglist elements are.  This is how we know when to expand them.
  *
+ * pconf_feed takes a shortcut for the common case: runs of characters
+ * which cannot change the state (plain word characters, the insides of
+ * "quotes", comments) are copied or skipped in one go, and only the
+ * characters around them go through the state machine.
+ *
  */
 
 #include "config.h" /* should be first */
@@ -179,7 +186,8 @@ static void addchar(PCONF_CTX_t *ctx)
 {
 	size_t	wbuflen;
 
-	wbuflen = strlen(ctx->wordbuf);
+	/* wordptr always points at the trailing NULL of wordbuf */
+	wbuflen = (size_t)(ctx->wordptr - ctx->wordbuf);
 
 	/* CVE-2012-2944: only allow the subset of ASCII charset from Space to ~ */
 	if ((ctx->ch < 0x20) || (ctx->ch > 0x7f)) {
@@ -213,6 +221,42 @@ static void addchar(PCONF_CTX_t *ctx)
 	*ctx->wordptr = '\0';
 }
 
+/* append a run of characters already known to be valid word characters */
+static void addchars(PCONF_CTX_t *ctx, const char *src, size_t len)
+{
+	size_t	wbuflen;
+
+	wbuflen = (size_t)(ctx->wordptr - ctx->wordbuf);
+
+	if (ctx->wordlen_limit != 0) {
+		if (wbuflen >= ctx->wordlen_limit) {
+
+			/* limit reached: don't append any more */
+			return;
+		}
+
+		if (len > ctx->wordlen_limit - wbuflen)
+			len = ctx->wordlen_limit - wbuflen;
+	}
+
+	/* allow for the null */
+	if (wbuflen + len >= ctx->wordbufsize) {
+		ctx->wordbufsize = wbuflen + len + 8;
+
+		ctx->wordbuf = realloc(ctx->wordbuf, ctx->wordbufsize);
+
+		if (!ctx->wordbuf)
+			pconf_fatal(ctx, "realloc wordbuf failed");
+
+		/* repoint as wordbuf may have moved */
+		ctx->wordptr = &ctx->wordbuf[wbuflen];
+	}
+
+	memcpy(ctx->wordptr, src, len);
+	ctx->wordptr += len;
+	*ctx->wordptr = '\0';
+}
+
 static void endofword(PCONF_CTX_t *ctx)
 {
 	if (ctx->arg_limit != 0) {
@@ -593,7 +637,47 @@ int pconf_line(PCONF_CTX_t *ctx, const char *line)
 	return 1;
 }
 
-#define PCONF_ESCAPE "#\\\""
+/* a byte of x is 0 (exact for "any", not for "which") */
+#define PCONF_WORD_ONES	((uint64_t)0x0101010101010101ULL)
+#define PCONF_WORD_HAS_ZERO(x) \
+	(((x) - PCONF_WORD_ONES) & ~(x) & (PCONF_WORD_ONES << 7))
+
+/* the characters pconf_encode() escapes */
+static int pconf_is_escaped(char ch)
+{
+	return (ch == '#' || ch == '\\' || ch == '"');
+}
+
+/* How many characters of src (len of them) pconf_encode() escapes:
+ * a word at a time, as most values (numbers, status words) have none;
+ * those words with one are counted a byte at a time */
+size_t pconf_encode_count(const char *src, size_t len)
+{
+	size_t	i = 0, j, count = 0;
+	uint64_t	word;
+
+	for (; i + sizeof(word) <= len; i += sizeof(word)) {
+		/* memcpy: any alignment, and no aliasing trouble */
+		memcpy(&word, src + i, sizeof(word));
+
+		if (!PCONF_WORD_HAS_ZERO(word ^ (PCONF_WORD_ONES * '#'))
+		 && !PCONF_WORD_HAS_ZERO(word ^ (PCONF_WORD_ONES * '\\'))
+		 && !PCONF_WORD_HAS_ZERO(word ^ (PCONF_WORD_ONES * '"')))
+			continue;
+
+		for (j = 0; j < sizeof(word); j++) {
+			if (pconf_is_escaped(src[i + j]))
+				count++;
+		}
+	}
+
+	for (; i < len; i++) {
+		if (pconf_is_escaped(src[i]))
+			count++;
+	}
+
+	return count;
+}
 
 char *pconf_encode(const char *src, char *dest, size_t destsize)
 {
@@ -602,15 +686,24 @@ char *pconf_encode(const char *src, char *dest, size_t destsize)
 	if (destsize < 1)
 		return dest;
 
-	memset(dest, '\0', destsize);
-
 	/* always leave room for a final NULL */
 	maxlen = destsize - 1;
 	srclen = strlen(src);
+
+	/* nothing to escape: a copy, as far as it fits */
+	if (!pconf_encode_count(src, srclen)) {
+		if (srclen > maxlen)
+			srclen = maxlen;
+		memmove(dest, src, srclen);
+		memset(dest + srclen, '\0', destsize - srclen);
+		return dest;
+	}
+
+	memset(dest, '\0', destsize);
 	destlen = 0;
 
 	for (i = 0; i < srclen; i++) {
-		if (strchr(PCONF_ESCAPE, src[i])) {
+		if (pconf_is_escaped(src[i])) {
 
 			/* if they both won't fit, we're done */
 			if (destlen >= maxlen - 1)
@@ -652,3 +745,105 @@ int pconf_char(PCONF_CTX_t *ctx, char ch)
 
 	return 0;
 }
+
+/* characters which findwordstart/collect/quotecollect would only append
+ * to the current word (see addchar for the valid range) */
+#define PCONF_WORDCHAR(c)	((c) > 0x20 && (c) <= 0x7f \
+	&& (c) != '#' && (c) != '\\' && (c) != '=')
+#define PCONF_QUOTECHAR(c)	((c) >= 0x20 && (c) <= 0x7f \
+	&& (c) != '#' && (c) != '\\' && (c) != '"')
+
+/* parse a buffer of input, returning after the first complete line;
+ * the return value is like that of pconf_char, and *used tells how
+ * much of buf was consumed, so the caller can feed the rest later */
+int pconf_feed(PCONF_CTX_t *ctx, const char *buf, size_t len, size_t *used)
+{
+	const unsigned char	*start = (const unsigned char *)buf;
+	const unsigned char	*p = start, *end = start + len, *run;
+
+	*used = 0;
+
+	if (!check_magic(ctx))
+		return -1;
+
+	/* if the last call finished a line, clean stuff up for another */
+	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR)) {
+		ctx->numargs = 0;
+		ctx->state = STATE_FINDWORDSTART;
+	}
+
+	while (p < end) {
+		switch (ctx->state) {
+			case STATE_COLLECT:
+				for (run = p; p < end && PCONF_WORDCHAR(*p); p++)
+					;
+				if (p > run)
+					addchars(ctx, (const char *)run, (size_t)(p - run));
+				break;
+
+			case STATE_QUOTECOLLECT:
+				for (run = p; p < end && PCONF_QUOTECHAR(*p); p++)
+					;
+				if (p > run)
+					addchars(ctx, (const char *)run, (size_t)(p - run));
+				break;
+
+			case STATE_FINDEOL:
+				run = memchr(p, 10, (size_t)(end - p));
+				p = (run ? run : end);
+				break;
+
+			default:
+				break;
+		}
+
+		if (p >= end)
+			break;
+
+		/* anything else goes through the state machine */
+		ctx->ch = *p++;
+		parse_char(ctx);
+
+		if (ctx->state == STATE_ENDOFLINE) {
+			*used = (size_t)(p - start);
+			return 1;
+		}
+
+		if (ctx->state == STATE_PARSEERR) {
+			*used = (size_t)(p - start);
+			return -1;
+		}
+	}
+
+	*used = len;
+	return 0;
+}
+
+/* 1 if what was fed so far ends in the middle of a line, which only
+ * this ctx knows of (see pconf_feed), else 0 */
+int pconf_feed_pending(const PCONF_CTX_t *ctx)
+{
+	if (!ctx || ctx->magic != PCONF_CTX_t_MAGIC)
+		return 0;
+
+	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR))
+		return 0;
+
+	return (ctx->state != STATE_FINDWORDSTART) || (ctx->numargs > 0);
+}
+
+/* the memory the words of ctx take, as allocated (not the ctx itself) */
+size_t pconf_bytes(const PCONF_CTX_t *ctx)
+{
+	size_t	bytes, i;
+
+	if (!ctx || ctx->magic != PCONF_CTX_t_MAGIC)
+		return 0;
+
+	bytes = ctx->wordbufsize + ctx->maxargs * (sizeof(char *) + sizeof(size_t));
+
+	for (i = 0; i < ctx->maxargs; i++)
+		bytes += ctx->argsize[i];
+
+	return bytes;
+}
@@ -0,0 +1,439 @@
+/* shmstate.c - Network UPS Tools driver state table in shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"	/* must be first */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "common.h"
+#include "shmstate.h"
+
+#ifdef WITH_SHMSTATE
+
+/* how often a reader retries a slot which is being rewritten */
+#define SHMSTATE_READ_TRIES	1000
+
+/* index entries: slot number + 1, or these */
+#define SHMSTATE_INDEX_EMPTY	0
+#define SHMSTATE_INDEX_DELETED	(-1)
+
+struct shmstate_s {
+	char	*fn;
+	int	fd;
+	int	writer;
+
+	void	*map;
+	size_t	mapsize;
+	shmstate_header_t	*hdr;
+	shmstate_slot_t	*slots;
+
+	/* writer only: open hash of the slots by (case-insensitive)
+	 * variable name, and the slots which were freed for reuse */
+	long	*index;
+	size_t	indexsize;
+	size_t	indexdeleted;
+	long	*freeslots;
+	size_t	numfree;
+	long	nextslot;
+};
+
+static size_t shmstate_mapsize(size_t numslots)
+{
+	return sizeof(shmstate_header_t) + numslots * sizeof(shmstate_slot_t);
+}
+
+static size_t shmstate_hash(const char *var)
+{
+	/* FNV-1a */
+	uint32_t	h = 2166136261U;
+
+	for (; *var; var++) {
+		h ^= (uint32_t)tolower((unsigned char)*var);
+		h *= 16777619U;
+	}
+
+	return (size_t)h;
+}
+
+/* find the index entry of var, or where it should be added */
+static long *shmstate_index_find(const shmstate_t *shm, const char *var, int *found)
+{
+	size_t	i, pos, mask = shm->indexsize - 1;
+	long	*deleted = NULL;
+
+	*found = 0;
+
+	for (i = 0, pos = shmstate_hash(var) & mask; i < shm->indexsize; i++, pos = (pos + 1) & mask) {
+		long	*entry = &shm->index[pos];
+
+		if (*entry == SHMSTATE_INDEX_EMPTY)
+			return (deleted ? deleted : entry);
+
+		if (*entry == SHMSTATE_INDEX_DELETED) {
+			if (!deleted)
+				deleted = entry;
+			continue;
+		}
+
+		if (!strcasecmp(shm->slots[*entry - 1].var, var)) {
+			*found = 1;
+			return entry;
+		}
+	}
+
+	/* only reachable with no empty entries left, see shmstate_del() */
+	return deleted;
+}
+
+static void shmstate_index_rebuild(shmstate_t *shm)
+{
+	long	slot;
+	int	found;
+
+	memset(shm->index, 0, shm->indexsize * sizeof(*shm->index));
+	shm->indexdeleted = 0;
+
+	for (slot = 0; slot < shm->nextslot; slot++) {
+		if (shm->slots[slot].var[0] == '\0')
+			continue;
+
+		*shmstate_index_find(shm, shm->slots[slot].var, &found) = slot + 1;
+	}
+}
+
+/* publish changes of one slot to the readers */
+static void shmstate_write(shmstate_slot_t *slot, const char *var, const char *val)
+{
+	slot->seq++;
+	__sync_synchronize();
+
+	if (var)
+		snprintf(slot->var, sizeof(slot->var), "%s", var);
+	snprintf(slot->val, sizeof(slot->val), "%s", val);
+
+	__sync_synchronize();
+	slot->seq++;
+}
+
+shmstate_t *shmstate_create(const char *fn, size_t numslots)
+{
+	shmstate_t	*shm;
+	int	fd;
+	size_t	mapsize = shmstate_mapsize(numslots);
+	void	*map;
+
+	if (numslots < 1 || numslots > LONG_MAX / 4)
+		return NULL;
+
+	/* never reuse a file which someone may still have mapped */
+	unlink(fn);
+
+	fd = open(fn, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		upslog_with_errno(LOG_WARNING, "%s: can't create %s", __func__, fn);
+		return NULL;
+	}
+
+	if (ftruncate(fd, (off_t)mapsize) < 0) {
+		upslog_with_errno(LOG_WARNING, "%s: can't resize %s", __func__, fn);
+		close(fd);
+		unlink(fn);
+		return NULL;
+	}
+
+	map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		upslog_with_errno(LOG_WARNING, "%s: can't map %s", __func__, fn);
+		close(fd);
+		unlink(fn);
+		return NULL;
+	}
+
+	set_close_on_exec(fd);
+
+	shm = xcalloc(1, sizeof(*shm));
+	shm->fn = xstrdup(fn);
+	shm->fd = fd;
+	shm->writer = 1;
+	shm->map = map;
+	shm->mapsize = mapsize;
+	shm->hdr = map;
+	shm->slots = (shmstate_slot_t *)((char *)map + sizeof(shmstate_header_t));
+
+	for (shm->indexsize = 16; shm->indexsize < 2 * numslots; shm->indexsize *= 2)
+		;
+	shm->index = xcalloc(shm->indexsize, sizeof(*shm->index));
+	shm->freeslots = xcalloc(numslots, sizeof(*shm->freeslots));
+
+	/* the file starts out zeroed, so all slots are free; publish the
+	 * header last, so readers never accept a half-initialized file */
+	shm->hdr->slotsize = (uint32_t)sizeof(shmstate_slot_t);
+	shm->hdr->numslots = (uint32_t)numslots;
+	shm->hdr->version = SHMSTATE_VERSION;
+	__sync_synchronize();
+	shm->hdr->magic = SHMSTATE_MAGIC;
+
+	upsdebugx(2, "%s: exporting up to %" PRIuSIZE " values in %s",
+		__func__, numslots, fn);
+
+	return shm;
+}
+
+long shmstate_set(shmstate_t *shm, const char *var, const char *val)
+{
+	long	*entry, slot;
+	int	found;
+
+	if (!shm || !shm->writer || strlen(var) >= SHMSTATE_VARLEN)
+		return -1;
+
+	entry = shmstate_index_find(shm, var, &found);
+	if (!entry)
+		return -1;
+
+	if (found) {
+		slot = *entry - 1;
+		shmstate_write(&shm->slots[slot], NULL, val);
+		return slot;
+	}
+
+	if (shm->numfree > 0) {
+		slot = shm->freeslots[--shm->numfree];
+	} else if (shm->nextslot < (long)shm->hdr->numslots) {
+		slot = shm->nextslot++;
+	} else {
+		/* full: this one stays on the socket */
+		return -1;
+	}
+
+	if (*entry == SHMSTATE_INDEX_DELETED)
+		shm->indexdeleted--;
+	*entry = slot + 1;
+
+	shmstate_write(&shm->slots[slot], var, val);
+	return slot;
+}
+
+long shmstate_find(const shmstate_t *shm, const char *var)
+{
+	long	*entry;
+	int	found;
+
+	if (!shm || !shm->writer)
+		return -1;
+
+	entry = shmstate_index_find(shm, var, &found);
+
+	return (found ? *entry - 1 : -1);
+}
+
+void shmstate_del(shmstate_t *shm, const char *var)
+{
+	long	*entry, slot;
+	int	found;
+
+	if (!shm || !shm->writer)
+		return;
+
+	entry = shmstate_index_find(shm, var, &found);
+	if (!found)
+		return;
+
+	slot = *entry - 1;
+	*entry = SHMSTATE_INDEX_DELETED;
+	shm->indexdeleted++;
+
+	shmstate_write(&shm->slots[slot], "", "");
+	shm->freeslots[shm->numfree++] = slot;
+
+	/* keep some empty entries around to end the searches early */
+	if (shm->indexdeleted > shm->indexsize / 4)
+		shmstate_index_rebuild(shm);
+}
+
+shmstate_t *shmstate_open(const char *fn)
+{
+	shmstate_t	*shm;
+	int	fd;
+	struct stat	st;
+	void	*map;
+	const shmstate_header_t	*hdr;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		upsdebug_with_errno(2, "%s: can't open %s", __func__, fn);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(shmstate_header_t)) {
+		upsdebugx(2, "%s: %s is too small", __func__, fn);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		upslog_with_errno(LOG_WARNING, "%s: can't map %s", __func__, fn);
+		close(fd);
+		return NULL;
+	}
+
+	hdr = map;
+	if (hdr->magic != SHMSTATE_MAGIC
+	 || hdr->version != SHMSTATE_VERSION
+	 || hdr->slotsize != sizeof(shmstate_slot_t)
+	 || shmstate_mapsize(hdr->numslots) > (size_t)st.st_size
+	) {
+		upslogx(LOG_WARNING, "%s: %s is not a usable NUT state table", __func__, fn);
+		munmap(map, (size_t)st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	set_close_on_exec(fd);
+
+	shm = xcalloc(1, sizeof(*shm));
+	shm->fn = xstrdup(fn);
+	shm->fd = fd;
+	shm->map = map;
+	shm->mapsize = (size_t)st.st_size;
+	shm->hdr = map;
+	shm->slots = (shmstate_slot_t *)((char *)map + sizeof(shmstate_header_t));
+
+	return shm;
+}
+
+int shmstate_get(const shmstate_t *shm, long slot, const char *var,
+	char *val, size_t valsize)
+{
+	const shmstate_slot_t	*sp;
+	char	svar[SHMSTATE_VARLEN], sval[ST_MAX_VALUE_LEN];
+	uint32_t	seq;
+	int	i;
+
+	if (!shm || slot < 0 || slot >= (long)shm->hdr->numslots)
+		return 0;
+
+	sp = &shm->slots[slot];
+
+	for (i = 0; i < SHMSTATE_READ_TRIES; i++) {
+		seq = sp->seq;
+		__sync_synchronize();
+
+		if (seq & 1)
+			continue;
+
+		memcpy(svar, sp->var, sizeof(svar));
+		memcpy(sval, sp->val, sizeof(sval));
+
+		__sync_synchronize();
+		if (sp->seq != seq)
+			continue;
+
+		svar[sizeof(svar) - 1] = '\0';
+		sval[sizeof(sval) - 1] = '\0';
+
+		/* the slot was reused since the driver told us about it */
+		if (strcasecmp(svar, var))
+			return 0;
+
+		snprintf(val, valsize, "%s", sval);
+		return 1;
+	}
+
+	upsdebugx(1, "%s: slot %ld of %s kept changing", __func__, slot, shm->fn);
+	return -1;
+}
+
+void shmstate_close(shmstate_t *shm)
+{
+	if (!shm)
+		return;
+
+	munmap(shm->map, shm->mapsize);
+	close(shm->fd);
+
+	if (shm->writer)
+		unlink(shm->fn);
+
+	free(shm->index);
+	free(shm->freeslots);
+	free(shm->fn);
+	free(shm);
+}
+
+#else	/* !WITH_SHMSTATE */
+
+shmstate_t *shmstate_create(const char *fn, size_t numslots)
+{
+	NUT_UNUSED_VARIABLE(numslots);
+	upslogx(LOG_WARNING, "%s: shared state export is not supported "
+		"on this platform, not creating %s", __func__, fn);
+	return NULL;
+}
+
+long shmstate_set(shmstate_t *shm, const char *var, const char *val)
+{
+	NUT_UNUSED_VARIABLE(shm);
+	NUT_UNUSED_VARIABLE(var);
+	NUT_UNUSED_VARIABLE(val);
+	return -1;
+}
+
+long shmstate_find(const shmstate_t *shm, const char *var)
+{
+	NUT_UNUSED_VARIABLE(shm);
+	NUT_UNUSED_VARIABLE(var);
+	return -1;
+}
+
+void shmstate_del(shmstate_t *shm, const char *var)
+{
+	NUT_UNUSED_VARIABLE(shm);
+	NUT_UNUSED_VARIABLE(var);
+}
+
+shmstate_t *shmstate_open(const char *fn)
+{
+	NUT_UNUSED_VARIABLE(fn);
+	return NULL;
+}
+
+int shmstate_get(const shmstate_t *shm, long slot, const char *var,
+	char *val, size_t valsize)
+{
+	NUT_UNUSED_VARIABLE(shm);
+	NUT_UNUSED_VARIABLE(slot);
+	NUT_UNUSED_VARIABLE(var);
+	NUT_UNUSED_VARIABLE(val);
+	NUT_UNUSED_VARIABLE(valsize);
+	return 0;
+}
+
+void shmstate_close(shmstate_t *shm)
+{
+	NUT_UNUSED_VARIABLE(shm);
+}
+
+#endif	/* WITH_SHMSTATE */
@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #ifndef WIN32
@@ -36,29 +37,203 @@
 #include "state.h"
 #include "parseconf.h"
 
+/* interned variable names, see st_name_t */
+static st_name_t	**st_names = NULL;		/* by id */
+static st_name_t	**st_names_sorted = NULL;	/* by order */
+static size_t	st_names_count = 0, st_names_alloc = 0;
+
+/* open addressing hash of the names: id + 1 of each, 0 if empty */
+static size_t	*st_names_hash = NULL;
+static size_t	st_names_hash_size = 0;
+
+/* order keys are spaced this far apart when (re)assigned */
+#define ST_NAME_ORDER_GAP	((uint64_t)1 << 32)
+
+/* The nodes, enum and range items of all trees are carved out of
+ * chunks of ST_SLAB_CHUNK objects of a size, and freed ones are kept
+ * on a list for reuse rather than given back, so that drivers with
+ * thousands of variables do not spread them all over the heap. The
+ * chunks are only freed by state_slabs_free() */
+#define ST_SLAB_CHUNK	64
+
+/* enum values up to this long (with the NUL) are kept in the item */
+#define ST_ENUM_VALBUF_LEN	16
+
+typedef struct st_slab_s {
+	size_t	size;		/* of each object, aligned */
+	void	*free;		/* list of free objects, linked by first bytes */
+	void	*chunks;	/* list of chunks, linked by first bytes */
+} st_slab_t;
+
+/* enough for any member the objects may have */
+typedef union {
+	void	*p;
+	long	l;
+	double	d;
+	uint64_t	u;
+} st_slab_align_t;
+
+#define ST_SLAB_SIZE(size)	\
+	(((size) + sizeof(st_slab_align_t) - 1) / sizeof(st_slab_align_t) * sizeof(st_slab_align_t))
+
+static st_slab_t	st_node_slab = { ST_SLAB_SIZE(sizeof(st_tree_t)), NULL, NULL };
+static st_slab_t	st_enum_slab = { ST_SLAB_SIZE(sizeof(enum_t) + ST_ENUM_VALBUF_LEN), NULL, NULL };
+static st_slab_t	st_range_slab = { ST_SLAB_SIZE(sizeof(range_t)), NULL, NULL };
+
+/* The enum and range lists are pooled: the variables (of all the trees)
+ * with the same list, e.g. the outlet.N.status of each outlet, share one
+ * copy of it, which is not changed while shared. A variable about to
+ * change its list gets a copy of its own first (see st_list_edit()),
+ * which joins the pool again when done, or is dropped for the copy the
+ * pool already has with the same values (see st_list_settle()). */
+struct st_list_s {
+	size_t	refs;		/* variables (and others) using it */
+	size_t	id;		/* 0 while out of the pool */
+	size_t	hash;		/* of the values, while in the pool */
+	enum_t	*enums;		/* one of these, as the list is of enums */
+	range_t	*ranges;	/* or of ranges; never both, nor none */
+	struct st_list_s	*hnext;	/* chain in the pool */
+};
+
+static st_slab_t	st_list_slab = { ST_SLAB_SIZE(sizeof(st_list_t)), NULL, NULL };
+
+/* the pool: hash chains of the lists, by their values */
+static st_list_t	**st_lists_hash = NULL;
+static size_t	st_lists_hash_size = 0, st_lists_count = 0;
+static size_t	st_lists_lastid = 0;	/* ids are not reused */
+
 /* internal helpers */
 
-static void val_escape(st_tree_t *node)
+static st_tree_t *st_tree_find_name(st_tree_t *node, const st_name_t *name);
+
+/* case-insensitive, as names are compared (FNV-1a) */
+static size_t st_name_hash(const char *var)
+{
+	size_t	hash = 2166136261U;
+
+	for (; *var; var++) {
+		hash ^= (size_t)tolower((unsigned char)*var);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static void st_names_hash_add(const st_name_t *name)
 {
-	char	etmp[ST_MAX_VALUE_LEN];
+	size_t	mask = st_names_hash_size - 1;
+	size_t	i = st_name_hash(name->name) & mask;
+
+	while (st_names_hash[i]) {
+		i = (i + 1) & mask;
+	}
+
+	st_names_hash[i] = name->id + 1;
+}
+
+/* give all names new order keys, evenly spaced */
+static void st_names_relabel(void)
+{
+	size_t	i;
+
+	upsdebugx(6, "%s: %" PRIuSIZE " names", __func__, st_names_count);
 
-	/* escape any tricky stuff like \ and " */
-	pconf_encode(node->raw, etmp, sizeof(etmp));
+	for (i = 0; i < st_names_count; i++) {
+		st_names_sorted[i]->order = (uint64_t)(i + 1) * ST_NAME_ORDER_GAP;
+	}
+}
+
+/* rawlen is strlen(node->raw) */
+static void val_escape(st_tree_t *node, size_t rawlen)
+{
+	size_t	len = rawlen + pconf_encode_count(node->raw, rawlen);
 
-	/* if nothing was escaped, we don't need to do anything else */
-	if (!strcmp(node->raw, etmp)) {
+	/* if nothing needs escaping (most values), raw is the one to send */
+	if (len == rawlen) {
 		node->val = node->raw;
+		node->vallen = rawlen;
 		return;
 	}
 
+	/* escape any tricky stuff like \ and ", cut as pconf_encode() cuts */
+	if (len >= ST_MAX_VALUE_LEN) {
+		len = ST_MAX_VALUE_LEN - 1;
+	}
+
 	/* if the escaped value grew, deal with it */
-	if (node->safesize < (strlen(etmp) + 1)) {
-		node->safesize = strlen(etmp) + 1;
+	if (node->safesize < len + 1) {
+		node->safesize = len + 1;
 		node->safe = xrealloc(node->safe, node->safesize);
 	}
 
-	snprintf(node->safe, node->safesize, "%s", etmp);
+	pconf_encode(node->raw, node->safe, len + 1);
 	node->val = node->safe;
+	/* shorter if cut between a backslash and its character */
+	node->vallen = strlen(node->safe);
+}
+
+/* a zeroed object from the slab */
+static void *st_slab_alloc(st_slab_t *slab)
+{
+	void	*obj;
+
+	if (!slab->free) {
+		/* the chunk starts with its link, aligned like an object */
+		size_t	hdr = ST_SLAB_SIZE(sizeof(void *)), i;
+		char	*chunk = xmalloc(hdr + ST_SLAB_CHUNK * slab->size);
+
+		*(void **)chunk = slab->chunks;
+		slab->chunks = chunk;
+
+		for (i = ST_SLAB_CHUNK; i-- > 0; ) {
+			obj = chunk + hdr + i * slab->size;
+			*(void **)obj = slab->free;
+			slab->free = obj;
+		}
+	}
+
+	obj = slab->free;
+	slab->free = *(void **)obj;
+	memset(obj, 0, slab->size);
+
+	return obj;
+}
+
+static void st_slab_free(st_slab_t *slab, void *obj)
+{
+	if (!obj) {
+		return;
+	}
+
+	*(void **)obj = slab->free;
+	slab->free = obj;
+}
+
+static void st_slab_destroy(st_slab_t *slab)
+{
+	while (slab->chunks) {
+		void	*next = *(void **)slab->chunks;
+
+		free(slab->chunks);
+		slab->chunks = next;
+	}
+
+	slab->free = NULL;
+}
+
+/* the in-place buffer of an enum item */
+static char *st_enum_valbuf(enum_t *item)
+{
+	return (char *)item + sizeof(*item);
+}
+
+static void st_tree_enum_item_free(enum_t *item)
+{
+	if (item->val != st_enum_valbuf(item)) {
+		free(item->val);
+	}
+
+	st_slab_free(&st_enum_slab, item);
 }
 
 static void st_tree_enum_free(enum_t *list)
@@ -69,8 +244,7 @@ static void st_tree_enum_free(enum_t *list)
 
 	st_tree_enum_free(list->next);
 
-	free(list->val);
-	free(list);
+	st_tree_enum_item_free(list);
 }
 
 static void st_tree_range_free(range_t *list)
@@ -81,54 +255,363 @@ static void st_tree_range_free(range_t *list)
 
 	st_tree_range_free(list->next);
 
-	free(list);
+	st_slab_free(&st_range_slab, list);
+}
+
+static enum_t *st_enum_item_new(const char *val)
+{
+	enum_t	*item = st_slab_alloc(&st_enum_slab);
+
+	if (strlen(val) < ST_ENUM_VALBUF_LEN) {
+		item->val = st_enum_valbuf(item);
+		snprintf(item->val, ST_ENUM_VALBUF_LEN, "%s", val);
+	} else {
+		item->val = xstrdup(val);
+	}
+
+	return item;
+}
+
+/* of the values, in order (FNV-1a, as for the names) */
+static size_t st_list_hash(const st_list_t *list)
+{
+	size_t	hash = 2166136261U;
+	const enum_t	*etmp;
+	const range_t	*rtmp;
+	const char	*p;
+
+	for (etmp = list->enums; etmp; etmp = etmp->next) {
+		/* with the NUL, so "a","bc" is not "ab","c" */
+		p = etmp->val;
+		do {
+			hash ^= (size_t)(unsigned char)*p;
+			hash *= 16777619U;
+		} while (*p++);
+	}
+
+	for (rtmp = list->ranges; rtmp; rtmp = rtmp->next) {
+		hash ^= (size_t)(unsigned int)rtmp->min;
+		hash *= 16777619U;
+		hash ^= (size_t)(unsigned int)rtmp->max;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static int st_list_equal(const st_list_t *a, const st_list_t *b)
+{
+	const enum_t	*ea = a->enums, *eb = b->enums;
+	const range_t	*ra = a->ranges, *rb = b->ranges;
+
+	for (; ea && eb; ea = ea->next, eb = eb->next) {
+		if (strcmp(ea->val, eb->val)) {
+			return 0;
+		}
+	}
+
+	for (; ra && rb; ra = ra->next, rb = rb->next) {
+		if (ra->min != rb->min || ra->max != rb->max) {
+			return 0;
+		}
+	}
+
+	/* and neither is longer */
+	return (!ea && !eb && !ra && !rb);
+}
+
+static void st_lists_pool_add(st_list_t *list)
+{
+	size_t	i;
+
+	if (st_lists_count >= st_lists_hash_size) {
+		size_t	newsize = (st_lists_hash_size ? st_lists_hash_size * 2 : 64);
+		st_list_t	**newhash = xcalloc(newsize, sizeof(*newhash));
+
+		for (i = 0; i < st_lists_hash_size; i++) {
+			while (st_lists_hash[i]) {
+				st_list_t	*tmp = st_lists_hash[i];
+
+				st_lists_hash[i] = tmp->hnext;
+				tmp->hnext = newhash[tmp->hash & (newsize - 1)];
+				newhash[tmp->hash & (newsize - 1)] = tmp;
+			}
+		}
+
+		free(st_lists_hash);
+		st_lists_hash = newhash;
+		st_lists_hash_size = newsize;
+	}
+
+	i = list->hash & (st_lists_hash_size - 1);
+	list->hnext = st_lists_hash[i];
+	st_lists_hash[i] = list;
+	list->id = ++st_lists_lastid;
+	st_lists_count++;
+}
+
+static void st_lists_pool_del(st_list_t *list)
+{
+	st_list_t	**lp = &st_lists_hash[list->hash & (st_lists_hash_size - 1)];
+
+	while (*lp != list) {
+		lp = &(*lp)->hnext;
+	}
+
+	*lp = list->hnext;
+	list->hnext = NULL;
+	list->id = 0;
+	st_lists_count--;
+}
+
+/* the list at *lp, made ready to change: a new one if there is none,
+ * a copy if it is shared, and out of the pool until st_list_settle() */
+static st_list_t *st_list_edit(st_list_t **lp)
+{
+	st_list_t	*list = *lp, *copy;
+	const enum_t	*etmp;
+	const range_t	*rtmp;
+	enum_t	**etail;
+	range_t	**rtail;
+
+	if (!list) {
+		list = st_slab_alloc(&st_list_slab);
+		list->refs = 1;
+		*lp = list;
+		return list;
+	}
+
+	if (list->refs == 1) {
+		if (list->id) {
+			st_lists_pool_del(list);
+		}
+		return list;
+	}
+
+	copy = st_slab_alloc(&st_list_slab);
+	copy->refs = 1;
+
+	etail = &copy->enums;
+	for (etmp = list->enums; etmp; etmp = etmp->next) {
+		*etail = st_enum_item_new(etmp->val);
+		etail = &(*etail)->next;
+	}
+
+	rtail = &copy->ranges;
+	for (rtmp = list->ranges; rtmp; rtmp = rtmp->next) {
+		*rtail = st_slab_alloc(&st_range_slab);
+		(*rtail)->min = rtmp->min;
+		(*rtail)->max = rtmp->max;
+		rtail = &(*rtail)->next;
+	}
+
+	list->refs--;
+	*lp = copy;
+
+	return copy;
+}
+
+/* done changing the list at *lp (see st_list_edit()): back into the
+ * pool, or replaced by the one already there with the same values, or
+ * gone if there are no values left */
+static void st_list_settle(st_list_t **lp)
+{
+	st_list_t	*list = *lp, *tmp;
+
+	if (!list->enums && !list->ranges) {
+		state_list_free(list);
+		*lp = NULL;
+		return;
+	}
+
+	list->hash = st_list_hash(list);
+
+	if (st_lists_hash_size) {
+		for (tmp = st_lists_hash[list->hash & (st_lists_hash_size - 1)]; tmp; tmp = tmp->hnext) {
+			if (tmp->hash == list->hash && st_list_equal(tmp, list)) {
+				tmp->refs++;
+				state_list_free(list);
+				*lp = tmp;
+				return;
+			}
+		}
+	}
+
+	st_lists_pool_add(list);
+}
+
+/* the lists of the node, as the readers of enum_list and range_list
+ * see them */
+static void st_tree_node_lists_sync(st_tree_t *node)
+{
+	node->enum_list = (node->enums ? node->enums->enums : NULL);
+	node->range_list = (node->ranges ? node->ranges->ranges : NULL);
 }
 
 /* free all memory associated with a node */
 static void st_tree_node_free(st_tree_t *node)
 {
-	free(node->var);
-	free(node->raw);
+	/* never free node->var, it is the interned name */
+	if (node->raw != node->rawbuf) {
+		free(node->raw);
+	}
 	free(node->safe);
 
 	/* never free node->val, since it's just a pointer to raw or safe */
 
-	/* blow away the list of enums */
-	st_tree_enum_free(node->enum_list);
+	/* let go of the list of enums */
+	state_list_free(node->enums);
 
 	/* and the list of ranges */
-	st_tree_range_free(node->range_list);
+	state_list_free(node->ranges);
 
 	/* now finally kill the node itself */
-	free(node);
+	st_slab_free(&st_node_slab, node);
 }
 
-/* add a subtree to another subtree */
-static void st_tree_node_add(st_tree_t **nptr, st_tree_t *sptr)
+/* The tree is kept height-balanced (AVL), since drivers tend to add
+ * their variables in (nearly) sorted order, e.g. outlet.1.*, outlet.2.*
+ * and so on, which would turn a plain binary search tree into a list.
+ * The nodes remain sorted by strcasecmp() of their names (compared by
+ * the order keys of the interned names) from left to
+ * right, so in-order walks (e.g. for LIST VAR) work as before.
+ */
+
+static int st_tree_height(const st_tree_t *node)
 {
-	if (!sptr) {
-		return;
-	}
+	return (node ? node->height : 0);
+}
 
-	while (*nptr) {
+static void st_tree_fix_height(st_tree_t *node)
+{
+	int	hl = st_tree_height(node->left), hr = st_tree_height(node->right);
 
-		st_tree_t	*node = *nptr;
+	node->height = (hl > hr ? hl : hr) + 1;
+}
 
-		if (strcasecmp(node->var, sptr->var) > 0) {
-			nptr = &node->left;
-			continue;
+static st_tree_t *st_tree_rotate_right(st_tree_t *node)
+{
+	st_tree_t	*top = node->left;
+
+	node->left = top->right;
+	top->right = node;
+
+	st_tree_fix_height(node);
+	st_tree_fix_height(top);
+
+	return top;
+}
+
+static st_tree_t *st_tree_rotate_left(st_tree_t *node)
+{
+	st_tree_t	*top = node->right;
+
+	node->right = top->left;
+	top->left = node;
+
+	st_tree_fix_height(node);
+	st_tree_fix_height(top);
+
+	return top;
+}
+
+/* restore the balance of a subtree after one of its children changed
+ * height by at most one; returns the (possibly new) subtree root */
+static st_tree_t *st_tree_rebalance(st_tree_t *node)
+{
+	int	diff;
+
+	st_tree_fix_height(node);
+	diff = st_tree_height(node->left) - st_tree_height(node->right);
+
+	if (diff > 1) {
+		if (st_tree_height(node->left->left) < st_tree_height(node->left->right)) {
+			node->left = st_tree_rotate_left(node->left);
 		}
+		return st_tree_rotate_right(node);
+	}
 
-		if (strcasecmp(node->var, sptr->var) < 0) {
-			nptr = &node->right;
-			continue;
+	if (diff < -1) {
+		if (st_tree_height(node->right->right) < st_tree_height(node->right->left)) {
+			node->right = st_tree_rotate_right(node->right);
 		}
+		return st_tree_rotate_left(node);
+	}
+
+	return node;
+}
+
+/* add a new node to a (sub)tree, returns the new subtree root */
+static st_tree_t *st_tree_node_add(st_tree_t *node, st_tree_t *sptr)
+{
+	if (!node) {
+		sptr->left = sptr->right = NULL;
+		sptr->height = 1;
+		return sptr;
+	}
 
+	if (node->name->order > sptr->name->order) {
+		node->left = st_tree_node_add(node->left, sptr);
+	} else if (node->name->order < sptr->name->order) {
+		node->right = st_tree_node_add(node->right, sptr);
+	} else {
 		upsdebugx(1, "%s: duplicate value (shouldn't happen)", __func__);
-		return;
+		return node;
+	}
+
+	return st_tree_rebalance(node);
+}
+
+/* detach the leftmost node of a subtree into *min,
+ * returns the new subtree root */
+static st_tree_t *st_tree_node_unlink_min(st_tree_t *node, st_tree_t **min)
+{
+	if (!node->left) {
+		*min = node;
+		return node->right;
+	}
+
+	node->left = st_tree_node_unlink_min(node->left, min);
+
+	return st_tree_rebalance(node);
+}
+
+/* detach the node <target> (known to be in the subtree) from it,
+ * returns the new subtree root; the node itself is not freed */
+static st_tree_t *st_tree_node_unlink(st_tree_t *node, const st_tree_t *target)
+{
+	if (!node) {
+		return NULL;
+	}
+
+	if (node != target) {
+		if (node->name->order > target->name->order) {
+			node->left = st_tree_node_unlink(node->left, target);
+		} else {
+			node->right = st_tree_node_unlink(node->right, target);
+		}
+
+		return st_tree_rebalance(node);
+	}
+
+	if (!node->left) {
+		return node->right;
+	}
+
+	if (!node->right) {
+		return node->left;
 	}
 
-	*nptr = sptr;
+	{ /* scoping */
+		/* the in-order successor takes the place of the node */
+		st_tree_t	*succ = NULL, *rest;
+
+		rest = st_tree_node_unlink_min(node->right, &succ);
+		succ->left = node->left;
+		succ->right = rest;
+
+		return st_tree_rebalance(succ);
+	}
 }
 
 static int st_tree_node_refresh_timestamp(const st_tree_t *node)
@@ -156,6 +639,26 @@ int state_get_timestamp(st_tree_timespec_t *now)
 #endif
 }
 
+uintmax_t state_timestamp_token(const st_tree_timespec_t *ts)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	return (uintmax_t)ts->tv_sec * 1000000 + (uintmax_t)(ts->tv_nsec / 1000);
+#else
+	return (uintmax_t)ts->tv_sec * 1000000 + (uintmax_t)ts->tv_usec;
+#endif
+}
+
+void state_token_timestamp(uintmax_t token, st_tree_timespec_t *ts)
+{
+	memset(ts, 0, sizeof(*ts));
+	ts->tv_sec = (time_t)(token / 1000000);
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	ts->tv_nsec = (long)(token % 1000000) * 1000;
+#else
+	ts->tv_usec = (suseconds_t)(token % 1000000);
+#endif
+}
+
 /* Returns -1 if the node->lastset is "older" than cutoff,
  * 0 if it is equal, or +1 if it is newer.
  * Returns -2 or -3 if node or cutoff are null.
@@ -196,99 +699,63 @@ int st_tree_node_compare_timestamp(
  */
 int state_delinfo(st_tree_t **nptr, const char *var)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
-
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
-			return 0;
-		}
+	st_tree_t	*node = state_tree_find(*nptr, var);
 
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
+	if (!node) {
+		return 0;	/* not found */
+	}
 
-		/* now point the parent at the old right child */
-		*nptr = node->right;
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
+		return 0;
+	}
 
-		st_tree_node_free(node);
+	*nptr = st_tree_node_unlink(*nptr, node);
 
-		return 1;
-	}
+	st_tree_node_free(node);
 
-	return 0;	/* not found */
+	return 1;
 }
 
 int state_delinfo_olderthan(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
-
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
-			return 0;
-		}
+	st_tree_t	*node = state_tree_find(*nptr, var);
 
-		if (st_tree_node_compare_timestamp(node, cutoff) >= 0) {
-			upsdebugx(6, "%s: not deleting recently updated variable [%s]", __func__, var);
-			return 0;
-		}
-		upsdebugx(6, "%s: deleting variable [%s] last updated too long ago", __func__, var);
+	if (!node) {
+		return 0;	/* not found */
+	}
 
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
+		return 0;
+	}
 
-		/* now point the parent at the old right child */
-		*nptr = node->right;
+	if (st_tree_node_compare_timestamp(node, cutoff) >= 0) {
+		upsdebugx(6, "%s: not deleting recently updated variable [%s]", __func__, var);
+		return 0;
+	}
+	upsdebugx(6, "%s: deleting variable [%s] last updated too long ago", __func__, var);
 
-		st_tree_node_free(node);
+	*nptr = st_tree_node_unlink(*nptr, node);
 
-		return 1;
-	}
+	st_tree_node_free(node);
 
-	return 0;	/* not found */
+	return 1;
 }
 
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
+	const st_name_t	*name = state_name_intern(var);
+	st_tree_t	*node = st_tree_find_name(*nptr, name);
+	size_t	len = strlen(val);
 
+	if (node) {
 		/* refresh even if "skip-writing" same info value */
 		st_tree_node_refresh_timestamp(node);
 
+		/* the typed setters below note their number after this */
+		node->numtype = ST_NUM_NONE;
+
 		/* updating an existing entry */
 		if (!strcasecmp(node->raw, val)) {
 			return 0;	/* no change */
@@ -300,52 +767,122 @@ int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 			return 0;	/* no change */
 		}
 
-		/* expand the buffer if the value grows */
-		if (node->rawsize < (strlen(val) + 1)) {
-			node->rawsize = strlen(val) + 1;
-			node->raw = xrealloc(node->raw, node->rawsize);
+		/* expand the buffer if the value grows (out of the node) */
+		if (node->rawsize < (len + 1)) {
+			node->rawsize = len + 1;
+			if (node->raw == node->rawbuf) {
+				node->raw = xmalloc(node->rawsize);
+			} else {
+				node->raw = xrealloc(node->raw, node->rawsize);
+			}
 		}
 
 		/* store the literal value for later comparisons */
-		snprintf(node->raw, node->rawsize, "%s", val);
+		memcpy(node->raw, val, len + 1);
 
-		val_escape(node);
+		val_escape(node, len);
 
 		return 1;	/* changed */
 	}
 
-	*nptr = xcalloc(1, sizeof(**nptr));
+	node = st_slab_alloc(&st_node_slab);
+
+	node->name = name;
+	node->var = name->name;
+	if (len < sizeof(node->rawbuf)) {
+		node->raw = node->rawbuf;
+		node->rawsize = sizeof(node->rawbuf);
+	} else {
+		node->raw = xmalloc(len + 1);
+		node->rawsize = len + 1;
+	}
+	memcpy(node->raw, val, len + 1);
+	st_tree_node_refresh_timestamp(node);
 
-	(*nptr)->var = xstrdup(var);
-	(*nptr)->raw = xstrdup(val);
-	(*nptr)->rawsize = strlen(val) + 1;
-	st_tree_node_refresh_timestamp(*nptr);
+	val_escape(node, len);
 
-	val_escape(*nptr);
+	*nptr = st_tree_node_add(*nptr, node);
 
 	return 1;	/* added */
 }
 
-static int st_tree_enum_add(enum_t **list, const char *enc)
+/* Like state_setinfo() for a number, formatted with precision digits
+ * after the point; if it is the same number as last time (compared
+ * bitwise, so -0.0 or a NaN just get formatted), nothing is formatted
+ * and only the timestamp is refreshed */
+int state_setinfo_double(st_tree_t **nptr, const char *var, double val, int precision)
 {
-	enum_t	*item;
+	st_tree_t	*node = state_tree_find(*nptr, var);
+	char	buf[ST_MAX_VALUE_LEN];
+	int	ret;
 
-	while (*list) {
+	if (node && node->numtype == ST_NUM_DOUBLE && node->numprec == precision
+	 && !memcmp(&node->numdouble, &val, sizeof(val))
+	) {
+		st_tree_node_refresh_timestamp(node);
+		return 0;	/* no change */
+	}
 
-		if (strcmp((*list)->val, enc)) {
-			list = &(*list)->next;
-			continue;
-		}
+	str_from_double(buf, sizeof(buf), val, precision);
+	ret = state_setinfo(nptr, var, buf);
 
-		return 0;	/* duplicate */
+	if (!node) {
+		node = state_tree_find(*nptr, var);
 	}
 
-	item = xcalloc(1, sizeof(*item));
-	item->val = xstrdup(enc);
-	item->next = *list;
+	/* unless it was immutable and kept another value */
+	if (node && !strcmp(node->raw, buf)) {
+		node->numtype = ST_NUM_DOUBLE;
+		node->numprec = precision;
+		node->numdouble = val;
+	}
+
+	return ret;
+}
+
+/* the same for an integer */
+int state_setinfo_long(st_tree_t **nptr, const char *var, long val)
+{
+	st_tree_t	*node = state_tree_find(*nptr, var);
+	char	buf[ST_MAX_VALUE_LEN];
+	int	ret;
+
+	if (node && node->numtype == ST_NUM_LONG && node->numlong == val) {
+		st_tree_node_refresh_timestamp(node);
+		return 0;	/* no change */
+	}
+
+	str_from_long(buf, sizeof(buf), val);
+	ret = state_setinfo(nptr, var, buf);
+
+	if (!node) {
+		node = state_tree_find(*nptr, var);
+	}
+
+	if (node && !strcmp(node->raw, buf)) {
+		node->numtype = ST_NUM_LONG;
+		node->numlong = val;
+	}
+
+	return ret;
+}
+
+static int st_list_addenum(st_list_t **lp, const char *enc)
+{
+	enum_t	*item;
+
+	for (item = (*lp ? (*lp)->enums : NULL); item; item = item->next) {
+		if (!strcmp(item->val, enc)) {
+			return 0;	/* duplicate */
+		}
+	}
+
+	item = st_enum_item_new(enc);
+	item->next = st_list_edit(lp)->enums;
 
 	/* now we're done creating it, add it to the list */
-	*list = item;
+	(*lp)->enums = item;
+	st_list_settle(lp);
 
 	return 1;	/* added */
 }
@@ -354,6 +891,7 @@ int state_addenum(st_tree_t *root, const char *var, const char *val)
 {
 	st_tree_t	*sttmp;
 	char	enc[ST_MAX_VALUE_LEN];
+	int	ret;
 
 	/* find the tree node for var */
 	sttmp = state_tree_find(root, var);
@@ -368,30 +906,32 @@ int state_addenum(st_tree_t *root, const char *var, const char *val)
 	pconf_encode(val, enc, sizeof(enc));
 
 	st_tree_node_refresh_timestamp(sttmp);
-	return st_tree_enum_add(&sttmp->enum_list, enc);
+	ret = st_list_addenum(&sttmp->enums, enc);
+	st_tree_node_lists_sync(sttmp);
+
+	return ret;
 }
 
-static int st_tree_range_add(range_t **list, const int min, const int max)
+static int st_list_addrange(st_list_t **lp, const int min, const int max)
 {
 	range_t	*item;
 
-	while (*list) {
-
-		if (((*list)->min != min) && ((*list)->max != max)) {
-			list = &(*list)->next;
+	for (item = (*lp ? (*lp)->ranges : NULL); item; item = item->next) {
+		if ((item->min != min) && (item->max != max)) {
 			continue;
 		}
 
 		return 0;	/* duplicate */
 	}
 
-	item = xcalloc(1, sizeof(*item));
+	item = st_slab_alloc(&st_range_slab);
 	item->min = min;
 	item->max = max;
-	item->next = *list;
+	item->next = st_list_edit(lp)->ranges;
 
 	/* now we're done creating it, add it to the list */
-	*list = item;
+	(*lp)->ranges = item;
+	st_list_settle(lp);
 
 	return 1;	/* added */
 }
@@ -399,6 +939,7 @@ static int st_tree_range_add(range_t **list, const int min, const int max)
 int state_addrange(st_tree_t *root, const char *var, const int min, const int max)
 {
 	st_tree_t	*sttmp;
+	int	ret;
 
 	/* sanity check */
 	if (min > max) {
@@ -417,7 +958,10 @@ int state_addrange(st_tree_t *root, const char *var, const int min, const int ma
 	}
 
 	st_tree_node_refresh_timestamp(sttmp);
-	return st_tree_range_add(&sttmp->range_list, min, max);
+	ret = st_list_addrange(&sttmp->ranges, min, max);
+	st_tree_node_lists_sync(sttmp);
+
+	return ret;
 }
 
 int state_setaux(st_tree_t *root, const char *var, const char *auxs)
@@ -596,6 +1140,101 @@ void state_infofree(st_tree_t *node)
 	st_tree_node_free(node);
 }
 
+/* a list as allocated, divided among the variables sharing it */
+static size_t st_list_bytes(const st_list_t *list)
+{
+	size_t	bytes;
+	const enum_t	*etmp;
+	const range_t	*rtmp;
+
+	if (!list) {
+		return 0;
+	}
+
+	bytes = st_list_slab.size;
+
+	for (etmp = list->enums; etmp; etmp = etmp->next) {
+		bytes += st_enum_slab.size;
+		if (etmp->val != st_enum_valbuf((enum_t *)etmp)) {
+			bytes += strlen(etmp->val) + 1;
+		}
+	}
+
+	for (rtmp = list->ranges; rtmp; rtmp = rtmp->next) {
+		bytes += st_range_slab.size;
+	}
+
+	return bytes / list->refs;
+}
+
+/* The memory a tree takes: its nodes, their values and their share of
+ * the enum and range lists, as allocated (without the overhead of
+ * malloc() or the unused objects of the slabs); the interned names are
+ * shared by all the trees, so they are not counted */
+size_t state_tree_bytes(const st_tree_t *node)
+{
+	size_t	bytes;
+
+	if (!node) {
+		return 0;
+	}
+
+	bytes = st_node_slab.size + node->safesize;
+
+	if (node->raw != node->rawbuf) {
+		bytes += node->rawsize;
+	}
+
+	bytes += st_list_bytes(node->enums) + st_list_bytes(node->ranges);
+
+	return bytes + state_tree_bytes(node->left) + state_tree_bytes(node->right);
+}
+
+static size_t st_slab_bytes(const st_slab_t *slab)
+{
+	size_t	bytes = 0;
+	const void	*chunk;
+
+	for (chunk = slab->chunks; chunk; chunk = *(void * const *)chunk) {
+		bytes += ST_SLAB_SIZE(sizeof(void *)) + ST_SLAB_CHUNK * slab->size;
+	}
+
+	return bytes;
+}
+
+/* The memory all the trees share: the interned names, the pool of enum
+ * and range lists, and the slabs as allocated, with their free objects
+ * (state_tree_bytes() counts the used ones again, for each tree) */
+size_t state_shared_bytes(void)
+{
+	size_t	bytes, i;
+
+	bytes = st_names_alloc * 2 * sizeof(*st_names)
+		+ st_names_hash_size * sizeof(*st_names_hash)
+		+ st_lists_hash_size * sizeof(*st_lists_hash);
+
+	for (i = 0; i < st_names_count; i++) {
+		bytes += sizeof(*st_names[i]) + strlen(st_names[i]->name) + 1;
+	}
+
+	return bytes + st_slab_bytes(&st_node_slab) + st_slab_bytes(&st_enum_slab)
+		+ st_slab_bytes(&st_range_slab) + st_slab_bytes(&st_list_slab);
+}
+
+/* for a clean exit (e.g. under valgrind); no tree may be left using them */
+void state_slabs_free(void)
+{
+	st_slab_destroy(&st_node_slab);
+	st_slab_destroy(&st_enum_slab);
+	st_slab_destroy(&st_range_slab);
+	st_slab_destroy(&st_list_slab);
+
+	free(st_lists_hash);
+	st_lists_hash = NULL;
+	st_lists_hash_size = 0;
+	st_lists_count = 0;
+}
+
 void state_cmdfree(cmdlist_t *list)
 {
 	if (!list) {
@@ -637,33 +1276,35 @@ int state_delcmd(cmdlist_t **list, const char *cmd)
 	return 0;	/* not found */
 }
 
-static int st_tree_del_enum(enum_t **list, const char *val)
+static int st_list_delenum(st_list_t **lp, const char *val)
 {
-	while (*list) {
+	enum_t	*item, **ep;
 
-		enum_t	*item = *list;
-
-		/* if this is not the right value, go on to the next */
-		if (strcasecmp(item->val, val)) {
-			list = &item->next;
-			continue;
+	for (item = (*lp ? (*lp)->enums : NULL); item; item = item->next) {
+		if (!strcasecmp(item->val, val)) {
+			break;
 		}
+	}
 
-		/* we found it! */
-		*list = item->next;
+	if (!item) {
+		return 0;	/* not found */
+	}
 
-		free(item->val);
-		free(item);
+	/* the same one, in the copy if it was shared */
+	for (ep = &st_list_edit(lp)->enums; strcasecmp((*ep)->val, val); ep = &(*ep)->next);
 
-		return 1;	/* deleted */
-	}
+	item = *ep;
+	*ep = item->next;
+	st_tree_enum_item_free(item);
+	st_list_settle(lp);
 
-	return 0;	/* not found */
+	return 1;	/* deleted */
 }
 
 int state_delenum(st_tree_t *root, const char *var, const char *val)
 {
 	st_tree_t	*sttmp;
+	int	ret;
 
 	/* find the tree node for var */
 	sttmp = state_tree_find(root, var);
@@ -673,35 +1314,42 @@ int state_delenum(st_tree_t *root, const char *var, const char *val)
 	}
 
 	st_tree_node_refresh_timestamp(sttmp);
-	return st_tree_del_enum(&sttmp->enum_list, val);
+	ret = st_list_delenum(&sttmp->enums, val);
+	st_tree_node_lists_sync(sttmp);
+
+	return ret;
 }
 
-static int st_tree_del_range(range_t **list, const int min, const int max)
+/* a range matches if either of min and max does, as in st_list_addrange() */
+static int st_list_delrange(st_list_t **lp, const int min, const int max)
 {
-	while (*list) {
-
-		range_t	*item = *list;
+	range_t	*item, **rp;
 
-		/* if this is not the right value, go on to the next */
-		if (((*list)->min != min) && ((*list)->max != max)) {
-			list = &item->next;
-			continue;
+	for (item = (*lp ? (*lp)->ranges : NULL); item; item = item->next) {
+		if ((item->min == min) || (item->max == max)) {
+			break;
 		}
+	}
 
-		/* we found it! */
-		*list = item->next;
+	if (!item) {
+		return 0;	/* not found */
+	}
 
-		free(item);
+	/* the same one, in the copy if it was shared */
+	for (rp = &st_list_edit(lp)->ranges; ((*rp)->min != min) && ((*rp)->max != max); rp = &(*rp)->next);
 
-		return 1;	/* deleted */
-	}
+	item = *rp;
+	*rp = item->next;
+	st_slab_free(&st_range_slab, item);
+	st_list_settle(lp);
 
-	return 0;	/* not found */
+	return 1;	/* deleted */
 }
 
 int state_delrange(st_tree_t *root, const char *var, const int min, const int max)
 {
 	st_tree_t	*sttmp;
+	int	ret;
 
 	/* find the tree node for var */
 	sttmp = state_tree_find(root, var);
@@ -711,19 +1359,143 @@ int state_delrange(st_tree_t *root, const char *var, const int min, const int ma
 	}
 
 	st_tree_node_refresh_timestamp(sttmp);
-	return st_tree_del_range(&sttmp->range_list, min, max);
+	ret = st_list_delrange(&sttmp->ranges, min, max);
+	st_tree_node_lists_sync(sttmp);
+
+	return ret;
 }
 
-st_tree_t *state_tree_find(st_tree_t *node, const char *var)
+/* make list the enums of var (NULL: none), as state_addenum() would
+ * have, one value at a time; 1 if that changed them */
+int state_setenums(st_tree_t *root, const char *var, st_list_t *list)
 {
-	while (node) {
+	st_tree_t	*sttmp;
+
+	if (list && list->ranges) {
+		upslogx(LOG_ERR, "%s: not a list of enums for %s", __func__, var);
+		return 0;
+	}
+
+	sttmp = state_tree_find(root, var);
+
+	if (!sttmp) {
+		upslogx(LOG_ERR, "%s: base variable (%s) "
+			"does not exist", __func__, var);
+		return 0;	/* failed */
+	}
 
-		if (strcasecmp(node->var, var) > 0) {
+	/* pooled, so the same values are the same list */
+	if (sttmp->enums == list) {
+		return 0;
+	}
+
+	if (list) {
+		list->refs++;
+	}
+	state_list_free(sttmp->enums);
+	sttmp->enums = list;
+
+	st_tree_node_refresh_timestamp(sttmp);
+	st_tree_node_lists_sync(sttmp);
+
+	return 1;
+}
+
+/* the same for ranges, see state_setenums() */
+int state_setranges(st_tree_t *root, const char *var, st_list_t *list)
+{
+	st_tree_t	*sttmp;
+
+	if (list && list->enums) {
+		upslogx(LOG_ERR, "%s: not a list of ranges for %s", __func__, var);
+		return 0;
+	}
+
+	sttmp = state_tree_find(root, var);
+
+	if (!sttmp) {
+		upslogx(LOG_ERR, "%s: base variable (%s) "
+			"does not exist", __func__, var);
+		return 0;	/* failed */
+	}
+
+	if (sttmp->ranges == list) {
+		return 0;
+	}
+
+	if (list) {
+		list->refs++;
+	}
+	state_list_free(sttmp->ranges);
+	sttmp->ranges = list;
+
+	st_tree_node_refresh_timestamp(sttmp);
+	st_tree_node_lists_sync(sttmp);
+
+	return 1;
+}
+
+int state_list_addenum(st_list_t **list, const char *val)
+{
+	char	enc[ST_MAX_VALUE_LEN];
+
+	if (*list && (*list)->ranges) {
+		upslogx(LOG_ERR, "%s: not a list of enums", __func__);
+		return 0;
+	}
+
+	/* as state_addenum() has it */
+	pconf_encode(val, enc, sizeof(enc));
+
+	return st_list_addenum(list, enc);
+}
+
+int state_list_addrange(st_list_t **list, const int min, const int max)
+{
+	if (*list && (*list)->enums) {
+		upslogx(LOG_ERR, "%s: not a list of ranges", __func__);
+		return 0;
+	}
+
+	if (min > max) {
+		upslogx(LOG_ERR, "%s: min is superior to max! (%i, %i)",
+			__func__, min, max);
+		return 0;
+	}
+
+	return st_list_addrange(list, min, max);
+}
+
+size_t state_list_id(const st_list_t *list)
+{
+	return (list ? list->id : 0);
+}
+
+/* let go of a list (the caller's, or a variable's) */
+void state_list_free(st_list_t *list)
+{
+	if (!list || --list->refs > 0) {
+		return;
+	}
+
+	if (list->id) {
+		st_lists_pool_del(list);
+	}
+
+	st_tree_enum_free(list->enums);
+	st_tree_range_free(list->ranges);
+	st_slab_free(&st_list_slab, list);
+}
+
+static st_tree_t *st_tree_find_name(st_tree_t *node, const st_name_t *name)
+{
+	while (node) {
+		if (node->name->order > name->order) {
 			node = node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (node->name->order < name->order) {
 			node = node->right;
 			continue;
 		}
@@ -733,3 +1505,148 @@ st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 
 	return node;
 }
+
+st_tree_t *state_tree_find(st_tree_t *node, const char *var)
+{
+	const st_name_t	*name = state_name_find(var);
+
+	/* a name nobody set is in no tree */
+	if (!name) {
+		return NULL;
+	}
+
+	return st_tree_find_name(node, name);
+}
+
+/* the first node after name in the order of the tree (the first node
+ * if name is NULL), whatever was added or removed since it was seen;
+ * for walks which give up control between nodes (see dstate.c) */
+st_tree_t *state_tree_next(st_tree_t *node, const st_name_t *name)
+{
+	st_tree_t	*next = NULL;
+
+	while (node) {
+		if (!name || node->name->order > name->order) {
+			next = node;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+
+	return next;
+}
+
+const st_name_t *state_name_find(const char *var)
+{
+	size_t	mask, i;
+
+	if (!st_names_hash_size) {
+		return NULL;
+	}
+
+	mask = st_names_hash_size - 1;
+
+	for (i = st_name_hash(var) & mask; st_names_hash[i]; i = (i + 1) & mask) {
+		st_name_t	*name = st_names[st_names_hash[i] - 1];
+
+		if (!strcasecmp(name->name, var)) {
+			return name;
+		}
+	}
+
+	return NULL;
+}
+
+const st_name_t *state_name_intern(const char *var)
+{
+	st_name_t	*name;
+	size_t	lo = 0, hi, i;
+	uint64_t	before, after;
+
+	if ((name = (st_name_t *)state_name_find(var)) != NULL) {
+		return name;
+	}
+
+	if (st_names_count == st_names_alloc) {
+		st_names_alloc = (st_names_alloc ? st_names_alloc * 2 : 64);
+		st_names = xrealloc(st_names, st_names_alloc * sizeof(*st_names));
+		st_names_sorted = xrealloc(st_names_sorted,
+			st_names_alloc * sizeof(*st_names_sorted));
+	}
+
+	/* keep the hash at most half full */
+	if ((st_names_count + 1) * 2 > st_names_hash_size) {
+		free(st_names_hash);
+		st_names_hash_size = (st_names_hash_size ? st_names_hash_size * 2 : 128);
+		st_names_hash = xcalloc(st_names_hash_size, sizeof(*st_names_hash));
+
+		for (i = 0; i < st_names_count; i++) {
+			st_names_hash_add(st_names[i]);
+		}
+	}
+
+	name = xcalloc(1, sizeof(*name));
+	name->name = xstrdup(var);
+	name->id = st_names_count;
+
+	/* where it sorts among the others */
+	hi = st_names_count;
+	while (lo < hi) {
+		size_t	mid = lo + (hi - lo) / 2;
+
+		if (strcasecmp(st_names_sorted[mid]->name, var) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	memmove(&st_names_sorted[lo + 1], &st_names_sorted[lo],
+		(st_names_count - lo) * sizeof(*st_names_sorted));
+	st_names_sorted[lo] = name;
+	st_names[st_names_count++] = name;
+	st_names_hash_add(name);
+
+	/* an order key between those of its neighbours, if there is room;
+	 * drivers tend to add names in order, so leave room after the last */
+	before = (lo > 0 ? st_names_sorted[lo - 1]->order : 0);
+	if (lo + 1 < st_names_count) {
+		after = st_names_sorted[lo + 1]->order;
+	} else {
+		after = (before < UINT64_MAX - ST_NAME_ORDER_GAP
+			? before + ST_NAME_ORDER_GAP : UINT64_MAX);
+	}
+
+	if (after - before < 2) {
+		st_names_relabel();
+	} else {
+		name->order = before + (after - before) / 2;
+	}
+
+	return name;
+}
+
+const st_name_t *state_name_byid(size_t id)
+{
+	return (id < st_names_count ? st_names[id] : NULL);
+}
+
+/* for a clean exit (e.g. under valgrind); no tree may be left using them */
+void state_names_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < st_names_count; i++) {
+		free(st_names[i]->name);
+		free(st_names[i]);
+	}
+
+	free(st_names);
+	free(st_names_sorted);
+	free(st_names_hash);
+
+	st_names = st_names_sorted = NULL;
+	st_names_hash = NULL;
+	st_names_count = st_names_alloc = st_names_hash_size = 0;
+}
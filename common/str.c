@@ -24,6 +24,8 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>	/* signbit() */
+#include <stdio.h>
 #include <stdlib.h>
 
 #ifdef HAVE_STRING_H
@@ -244,6 +246,35 @@ int	str_is_double_strict(const char *string, const int base)
 	return str_to_double_strict(string, &number, base);
 }
 
+/* Strip the spaces around <string> for the non-strict str_to_*(): into
+ * <buf>, or (if it does not fit) a copy in *<heap> for the caller to free */
+static const char	*str_to_trimmed(const char *string, char *buf, const size_t buflen, char **heap)
+{
+	size_t	len;
+
+	while (isspace((unsigned char)*string))
+		string++;
+
+	len = strlen(string);
+	while (len > 0 && isspace((unsigned char)string[len - 1]))
+		len--;
+
+	if (string[len] == '\0')
+		return string;	/* nothing to cut */
+
+	if (len >= buflen) {
+		*heap = malloc(len + 1);
+		if (*heap == NULL)
+			return NULL;
+		buf = *heap;
+	}
+
+	memcpy(buf, string, len);
+	buf[len] = '\0';
+
+	return buf;
+}
+
 int	str_to_short(const char *string, short *number, const int base)
 {
 	long	num;
@@ -402,7 +433,9 @@ int	str_to_uint_strict(const char *string, unsigned int *number, const int base)
 
 int	str_to_long(const char *string, long *number, const int base)
 {
-	char	*str;
+	char	buf[64], *heap = NULL;	/* numbers are short */
+	const char	*str;
+	int	ret;
 
 	*number = 0;
 
@@ -414,19 +447,14 @@ int	str_to_long(const char *string, long *number, const int base)
 		return 0;
 	}
 
-	str = strdup(string);
+	str = str_to_trimmed(string, buf, sizeof(buf), &heap);
 	if (str == NULL)
 		return 0;
 
-	str_trim_space(str);
-
-	if (!str_to_long_strict(str, number, base)) {
-		free(str);
-		return 0;
-	}
+	ret = str_to_long_strict(str, number, base);
 
-	free(str);
-	return 1;
+	free(heap);
+	return ret;
 }
 
 int	str_to_long_strict(const char *string, long *number, const int base)
@@ -466,7 +494,9 @@ int	str_to_long_strict(const char *string, long *number, const int base)
 
 int	str_to_ulong(const char *string, unsigned long *number, const int base)
 {
-	char	*str;
+	char	buf[64], *heap = NULL;	/* numbers are short */
+	const char	*str;
+	int	ret;
 
 	*number = 0;
 
@@ -478,19 +508,14 @@ int	str_to_ulong(const char *string, unsigned long *number, const int base)
 		return 0;
 	}
 
-	str = strdup(string);
+	str = str_to_trimmed(string, buf, sizeof(buf), &heap);
 	if (str == NULL)
 		return 0;
 
-	str_trim_space(str);
-
-	if (!str_to_ulong_strict(str, number, base)) {
-		free(str);
-		return 0;
-	}
+	ret = str_to_ulong_strict(str, number, base);
 
-	free(str);
-	return 1;
+	free(heap);
+	return ret;
 }
 
 int	str_to_ulong_strict(const char *string, unsigned long *number, const int base)
@@ -532,7 +557,9 @@ int	str_to_ulong_strict(const char *string, unsigned long *number, const int bas
 
 int	str_to_double(const char *string, double *number, const int base)
 {
-	char	*str;
+	char	buf[64], *heap = NULL;	/* numbers are short */
+	const char	*str;
+	int	ret;
 
 	*number = 0;
 
@@ -544,19 +571,14 @@ int	str_to_double(const char *string, double *number, const int base)
 		return 0;
 	}
 
-	str = strdup(string);
+	str = str_to_trimmed(string, buf, sizeof(buf), &heap);
 	if (str == NULL)
 		return 0;
 
-	str_trim_space(str);
+	ret = str_to_double_strict(str, number, base);
 
-	if (!str_to_double_strict(str, number, base)) {
-		free(str);
-		return 0;
-	}
-
-	free(str);
-	return 1;
+	free(heap);
+	return ret;
 }
 
 int	str_to_double_strict(const char *string, double *number, const int base)
@@ -595,6 +617,10 @@ int	str_to_double_strict(const char *string, double *number, const int base)
 		return 0;
 	}
 
+	/* plain decimals (most of them) need no strtod() */
+	if (base != 16 && string[str_scan_double(string, number)] == '\0')
+		return 1;
+
 	errno = 0;
 	*number = strtod(string, &ptr);
 
@@ -615,6 +641,182 @@ int	str_to_double_strict(const char *string, double *number, const int base)
 	return 1;
 }
 
+/* powers of ten which are exact as doubles */
+static const double	str_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+size_t	str_scan_long(const char *string, long *number)
+{
+	const char	*s = string;
+	unsigned long	value = 0;
+	int	neg = 0, any = 0, digits = 0;
+	char	*ptr;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	if (*s == '+' || *s == '-')
+		neg = (*s++ == '-');
+
+	for (; *s >= '0' && *s <= '9'; s++) {
+		any = 1;
+		if (value == 0 && *s == '0')
+			continue;
+		/* what may not fit is left to strtol() */
+		if (++digits > (sizeof(long) > 4 ? 18 : 9)) {
+			*number = strtol(string, &ptr, 10);
+			return (size_t)(ptr - string);
+		}
+		value = value * 10 + (unsigned long)(*s - '0');
+	}
+
+	if (!any) {
+		*number = 0;
+		return 0;
+	}
+
+	*number = neg ? -(long)value : (long)value;
+	return (size_t)(s - string);
+}
+
+size_t	str_scan_double(const char *string, double *number)
+{
+	const char	*s = string;
+	uint64_t	mantissa = 0;
+	int	neg = 0, any = 0, digits = 0, decimals = 0;
+	char	*ptr;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	if (*s == '+' || *s == '-')
+		neg = (*s++ == '-');
+
+	for (; *s >= '0' && *s <= '9'; s++) {
+		any = 1;
+		if (mantissa == 0 && *s == '0')
+			continue;
+		if (++digits <= 15)
+			mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+	}
+
+	if (*s == '.') {
+		for (s++; *s >= '0' && *s <= '9'; s++) {
+			any = 1;
+			decimals++;
+			if (mantissa == 0 && *s == '0')
+				continue;
+			if (++digits <= 15)
+				mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+		}
+	}
+
+	if (!any) {
+		*number = 0;
+		return 0;
+	}
+
+	/* Up to 15 digits are exact as a double, and so are the powers of
+	 * ten up to 1e22: their quotient is then rounded just like strtod()
+	 * does. Longer numbers, and exponents or hexadecimals, are its job. */
+	if (digits > 15
+	 || decimals >= (int)(sizeof(str_pow10) / sizeof(str_pow10[0]))
+	 || *s == 'e' || *s == 'E' || *s == 'x' || *s == 'X'
+	) {
+		*number = strtod(string, &ptr);
+		return (size_t)(ptr - string);
+	}
+
+	*number = (double)mantissa / str_pow10[decimals];
+	if (neg)
+		*number = -*number;
+
+	return (size_t)(s - string);
+}
+
+/* Copy the digits formatted backwards at the end of <tmp> (from <p>)
+ * into <buf> the way snprintf() would */
+static int	str_from_tmp(char *buf, const size_t buflen, const char *p, const char *end)
+{
+	size_t	len = (size_t)(end - p);
+
+	if (buflen > 0) {
+		size_t	n = (len < buflen) ? len : buflen - 1;
+		memcpy(buf, p, n);
+		buf[n] = '\0';
+	}
+
+	return (int)len;
+}
+
+int	str_from_long(char *buf, const size_t buflen, const long number)
+{
+	char	tmp[32], *end = tmp + sizeof(tmp), *p = end;
+	unsigned long	value = (number < 0)
+		? 0UL - (unsigned long)number : (unsigned long)number;
+
+	do {
+		*--p = (char)('0' + (value % 10));
+		value /= 10;
+	} while (value);
+
+	if (number < 0)
+		*--p = '-';
+
+	return str_from_tmp(buf, buflen, p, end);
+}
+
+int	str_from_double(char *buf, const size_t buflen, const double number, const int precision)
+{
+	char	tmp[32], *end = tmp + sizeof(tmp), *p = end;
+	double	scaled, frac;
+	uint64_t	whole;
+	int	i;
+
+	if (precision < 0 || precision > 9)
+		goto slow;
+
+	/* also false for NaN */
+	scaled = number * str_pow10[precision];
+	if (!(scaled > -1e9 && scaled < 1e9))
+		goto slow;
+
+	whole = (uint64_t)(scaled < 0 ? -scaled : scaled);
+	frac = (scaled < 0 ? -scaled : scaled) - (double)whole;
+
+	/* snprintf() rounds the exact binary value, which the multiplication
+	 * may have rounded onto (or across) the half: let it decide those */
+	if (frac > 0.5 - 1e-6 && frac < 0.5 + 1e-6)
+		goto slow;
+
+	if (frac > 0.5)
+		whole++;
+
+	for (i = 0; i < precision; i++) {
+		*--p = (char)('0' + (whole % 10));
+		whole /= 10;
+	}
+
+	if (precision > 0)
+		*--p = '.';
+
+	do {
+		*--p = (char)('0' + (whole % 10));
+		whole /= 10;
+	} while (whole);
+
+	/* as "%f" does, also for what rounds to zero (and for -0.0) */
+	if (signbit(number))
+		*--p = '-';
+
+	return str_from_tmp(buf, buflen, p, end);
+
+slow:
+	return snprintf(buf, buflen, "%.*f", precision, number);
+}
+
 int str_ends_with(const char *s, const char *suff) {
 	size_t slen;
 	size_t sufflen;
@@ -23,13 +23,362 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "upsconf.h"
 #include "common.h"
 #include "parseconf.h"
+#include "nut_stdint.h"
 
 	static	char	*ups_section;
 
+/* The settings of ups.conf, once parsed in full (by upsdrvctl, upsd or a
+ * driver), are kept in UPSCONF_CACHE in the state path: a driver only
+ * needs the global settings and its own section, which it then finds
+ * through an index sorted by section name rather than by parsing every
+ * section again - 400 drivers started at once used to parse 400 files
+ * each.  The cache is only used while ups.conf is the very file it was
+ * made from (same device, inode, size and modification time), and only
+ * if it was written by us or root and nobody else may write it.
+ *
+ * The file is made to be mapped as is: a header, the index, then the
+ * names and the settings of each section, one after the other as
+ * 'F' <name> NUL (flags) or 'V' <name> NUL <value> NUL. */
+#ifndef WIN32
+# define UPSCONF_CACHE	"ups.conf.cache"
+#endif
+
+#define UPSCONF_CACHE_MAGIC	"NUTUCF1"
+
+typedef struct {
+	char		magic[8];
+	uint64_t	dev, ino, size;
+	int64_t		mtime, mtime_nsec;
+	uint32_t	numsect;
+	uint32_t	global_off, global_len;	/* of the settings before any section */
+} upsconf_cache_hdr_t;
+
+typedef struct {
+	uint32_t	name_off;
+	uint32_t	data_off, data_len;
+} upsconf_cache_idx_t;
+
+#ifdef UPSCONF_CACHE
+/* what read_upsconf() saw, to be written out */
+typedef struct {
+	char	*name;	/* NULL for the global settings */
+	char	*data;
+	size_t	len, size;
+} upsconf_sect_t;
+
+static upsconf_sect_t	cache_global, *cache_sect = NULL, *cache_cur = NULL;
+static size_t	cache_numsect = 0;
+static int	cache_build = 0;
+
+static void cache_append(upsconf_sect_t *sect, const void *buf, size_t len)
+{
+	if (sect->len + len > sect->size) {
+		while (sect->len + len > sect->size) {
+			sect->size = (sect->size ? sect->size * 2 : 256);
+		}
+		sect->data = xrealloc(sect->data, sect->size);
+	}
+
+	memcpy(sect->data + sect->len, buf, len);
+	sect->len += len;
+}
+
+static void cache_add(const char *var, const char *val)
+{
+	upsconf_sect_t	*sect = (cache_cur ? cache_cur : &cache_global);
+
+	cache_append(sect, (val ? "V" : "F"), 1);
+	cache_append(sect, var, strlen(var) + 1);
+	if (val) {
+		cache_append(sect, val, strlen(val) + 1);
+	}
+}
+
+static void cache_section(const char *name)
+{
+	size_t	i;
+
+	/* a section given twice goes on where it was */
+	for (i = 0; i < cache_numsect; i++) {
+		if (!strcmp(cache_sect[i].name, name)) {
+			cache_cur = &cache_sect[i];
+			return;
+		}
+	}
+
+	cache_sect = xrealloc(cache_sect, (cache_numsect + 1) * sizeof(*cache_sect));
+	cache_cur = &cache_sect[cache_numsect++];
+	memset(cache_cur, 0, sizeof(*cache_cur));
+	cache_cur->name = xstrdup(name);
+}
+
+static void cache_clear(void)
+{
+	size_t	i;
+
+	for (i = 0; i < cache_numsect; i++) {
+		free(cache_sect[i].name);
+		free(cache_sect[i].data);
+	}
+
+	free(cache_sect);
+	free(cache_global.data);
+	memset(&cache_global, 0, sizeof(cache_global));
+	cache_sect = cache_cur = NULL;
+	cache_numsect = 0;
+	cache_build = 0;
+}
+
+static int cache_sect_cmp(const void *a, const void *b)
+{
+	return strcmp(((const upsconf_sect_t *)a)->name,
+		((const upsconf_sect_t *)b)->name);
+}
+
+static void cache_stat(upsconf_cache_hdr_t *hdr, const struct stat *st)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, UPSCONF_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->dev = (uint64_t)st->st_dev;
+	hdr->ino = (uint64_t)st->st_ino;
+	hdr->size = (uint64_t)st->st_size;
+	hdr->mtime = (int64_t)st->st_mtime;
+# ifdef HAVE_STRUCT_STAT_ST_MTIM
+	hdr->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+# endif
+}
+
+/* the cache, if it can be trusted and was made from the ups.conf of st;
+ * returns its length, and the mapping (or copy) in *map */
+static size_t cache_open(const struct stat *st, char **map)
+{
+	char	fn[SMALLBUF];
+	struct	stat	cst;
+	upsconf_cache_hdr_t	want;
+	const	upsconf_cache_hdr_t	*hdr;
+	size_t	len;
+	int	fd;
+
+	snprintf(fn, sizeof(fn), "%s/%s", dflt_statepath(), UPSCONF_CACHE);
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+
+	/* the settings may start programs: only ours or root's count */
+	if (fstat(fd, &cst) != 0
+	 || (cst.st_uid != geteuid() && cst.st_uid != 0)
+	 || (cst.st_mode & (S_IWGRP | S_IWOTH))
+	 || (size_t)cst.st_size < sizeof(*hdr)
+	 || (uintmax_t)cst.st_size > (uintmax_t)UINT32_MAX
+	) {
+		close(fd);
+		return 0;
+	}
+
+	len = (size_t)cst.st_size;
+
+# if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	*map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (*map == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+# else
+	*map = xmalloc(len);
+	if (read(fd, *map, len) != (ssize_t)len) {
+		free(*map);
+		close(fd);
+		return 0;
+	}
+# endif
+	close(fd);
+
+	hdr = (const upsconf_cache_hdr_t *)*map;
+	cache_stat(&want, st);
+
+	if (memcmp(hdr->magic, want.magic, sizeof(want.magic))
+	 || hdr->dev != want.dev || hdr->ino != want.ino
+	 || hdr->size != want.size || hdr->mtime != want.mtime
+	 || hdr->mtime_nsec != want.mtime_nsec
+	 || hdr->numsect > (len - sizeof(*hdr)) / sizeof(upsconf_cache_idx_t)
+	 || hdr->global_off > len || hdr->global_len > len - hdr->global_off
+	) {
+		upsdebugx(2, "%s: %s is out of date", __func__, fn);
+# if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+		munmap(*map, len);
+# else
+		free(*map);
+# endif
+		return 0;
+	}
+
+	return len;
+}
+
+static void cache_close(char *map, size_t len)
+{
+# if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	munmap(map, len);
+# else
+	NUT_UNUSED_VARIABLE(len);
+	free(map);
+# endif
+}
+
+/* write out what read_upsconf() saw of the ups.conf of st */
+static void cache_write(const struct stat *st)
+{
+	char	fn[SMALLBUF], tmp[SMALLBUF], *map;
+	upsconf_cache_hdr_t	hdr;
+	upsconf_cache_idx_t	*idx;
+	size_t	i, off, len;
+	FILE	*f;
+	int	fd;
+
+	/* up to date already (e.g. upsd after upsdrvctl) */
+	if ((len = cache_open(st, &map)) > 0) {
+		cache_close(map, len);
+		return;
+	}
+
+	snprintf(fn, sizeof(fn), "%s/%s", dflt_statepath(), UPSCONF_CACHE);
+	snprintf(tmp, sizeof(tmp), "%s.%" PRIdMAX, fn, (intmax_t)getpid());
+
+	qsort(cache_sect, cache_numsect, sizeof(*cache_sect), cache_sect_cmp);
+
+	cache_stat(&hdr, st);
+	hdr.numsect = (uint32_t)cache_numsect;
+
+	/* names, then the settings of each section */
+	idx = xcalloc(cache_numsect + 1, sizeof(*idx));
+	off = sizeof(hdr) + cache_numsect * sizeof(*idx);
+	for (i = 0; i < cache_numsect; i++) {
+		idx[i].name_off = (uint32_t)off;
+		off += strlen(cache_sect[i].name) + 1;
+	}
+	hdr.global_off = (uint32_t)off;
+	hdr.global_len = (uint32_t)cache_global.len;
+	off += cache_global.len;
+	for (i = 0; i < cache_numsect; i++) {
+		idx[i].data_off = (uint32_t)off;
+		idx[i].data_len = (uint32_t)cache_sect[i].len;
+		off += cache_sect[i].len;
+	}
+
+	if ((uintmax_t)off > (uintmax_t)UINT32_MAX) {
+		free(idx);
+		return;
+	}
+
+	/* no more readable than ups.conf, which may hold passwords */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, st->st_mode & 0640);
+	if (fd < 0) {
+		upsdebug_with_errno(2, "%s: can't create %s", __func__, tmp);
+		free(idx);
+		return;
+	}
+
+	if (geteuid() == 0 && fchown(fd, 0, st->st_gid) != 0) {
+		upsdebug_with_errno(2, "%s: can't chown %s", __func__, tmp);
+	}
+
+	f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		free(idx);
+		return;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(idx, sizeof(*idx), cache_numsect, f);
+	for (i = 0; i < cache_numsect; i++) {
+		fwrite(cache_sect[i].name, strlen(cache_sect[i].name) + 1, 1, f);
+	}
+	if (cache_global.len) {
+		fwrite(cache_global.data, cache_global.len, 1, f);
+	}
+	for (i = 0; i < cache_numsect; i++) {
+		if (cache_sect[i].len) {
+			fwrite(cache_sect[i].data, cache_sect[i].len, 1, f);
+		}
+	}
+
+	free(idx);
+
+	if (ferror(f) | fclose(f)) {
+		upsdebug_with_errno(2, "%s: can't write %s", __func__, tmp);
+		unlink(tmp);
+		return;
+	}
+
+	if (rename(tmp, fn) != 0) {
+		upsdebug_with_errno(2, "%s: can't rename %s", __func__, tmp);
+		unlink(tmp);
+		return;
+	}
+
+	upsdebugx(2, "%s: %s has %" PRIuSIZE " sections", __func__, fn, cache_numsect);
+}
+
+/* call back do_upsconf_args() with the settings in data */
+static int cache_replay(const char *section, const char *data, size_t len)
+{
+	char	*buf, *p, *end, *var, *val, *name;
+
+	if (!len) {
+		return 1;
+	}
+
+	/* the callback may change them, the mapping is read-only */
+	buf = xmalloc(len);
+	memcpy(buf, data, len);
+	end = buf + len;
+	name = (section ? xstrdup(section) : NULL);
+
+	for (p = buf; p < end; ) {
+		char	type = *p++;
+
+		var = p;
+		p = memchr(p, '\0', (size_t)(end - p));
+		if (!p++) {
+			break;
+		}
+
+		val = NULL;
+		if (type == 'V') {
+			if (p >= end) {
+				break;
+			}
+			val = p;
+			p = memchr(p, '\0', (size_t)(end - p));
+			if (!p++) {
+				break;
+			}
+		}
+
+		do_upsconf_args(name, var, val);
+	}
+
+	free(name);
+	free(buf);
+
+	return (p == end);
+}
+#endif	/* UPSCONF_CACHE */
+
 /* handle arguments separated by parseconf */
 static void conf_args(size_t numargs, char **arg)
 {
@@ -43,11 +392,21 @@ static void conf_args(size_t numargs, char **arg)
 
 		arg[0][strlen(arg[0])-1] = '\0';
 		ups_section = xstrdup(&arg[0][1]);
+#ifdef UPSCONF_CACHE
+		if (cache_build) {
+			cache_section(ups_section);
+		}
+#endif
 		return;
 	}
 
 	/* handle 'foo' (flag) */
 	if (numargs == 1) {
+#ifdef UPSCONF_CACHE
+		if (cache_build) {
+			cache_add(arg[0], NULL);
+		}
+#endif
 		do_upsconf_args(ups_section, arg[0], NULL);
 		return;
 	}
@@ -57,6 +416,11 @@ static void conf_args(size_t numargs, char **arg)
 
 	/* handle 'foo = bar', 'foo=bar', 'foo =bar' or 'foo= bar' forms */
 	if (!strcmp(arg[1], "=")) {
+#ifdef UPSCONF_CACHE
+		if (cache_build) {
+			cache_add(arg[0], arg[2]);
+		}
+#endif
 		do_upsconf_args(ups_section, arg[0], arg[2]);
 		return;
 	}
@@ -77,13 +441,25 @@ int read_upsconf(int fatal_errors)
 {
 	char	fn[SMALLBUF];
 	PCONF_CTX_t	ctx;
+#ifdef UPSCONF_CACHE
+	struct	stat	st, st2;
+	int	errors = 0;
+#endif
 
 	ups_section = NULL;
 	snprintf(fn, sizeof(fn), "%s/ups.conf", confpath());
 
+#ifdef UPSCONF_CACHE
+	/* taken before, so that an edit while we read is not cached */
+	cache_build = (stat(fn, &st) == 0);
+#endif
+
 	pconf_init(&ctx, upsconf_err);
 
 	if (!pconf_file_begin(&ctx, fn)) {
+#ifdef UPSCONF_CACHE
+		cache_clear();
+#endif
 		if (fatal_errors) {
 			fatalx(EXIT_FAILURE, "Can't open %s: %s", fn, ctx.errmsg);
 		} else {
@@ -96,6 +472,9 @@ int read_upsconf(int fatal_errors)
 		if (pconf_parse_error(&ctx)) {
 			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
 				fn, ctx.linenum, ctx.errmsg);
+#ifdef UPSCONF_CACHE
+			errors++;
+#endif
 			continue;
 		}
 
@@ -106,5 +485,88 @@ int read_upsconf(int fatal_errors)
 
 	free(ups_section);
 
+#ifdef UPSCONF_CACHE
+	/* a file with errors is parsed each time, so they are reported */
+	if (cache_build && !errors && stat(fn, &st2) == 0
+	 && st2.st_ino == st.st_ino && st2.st_size == st.st_size
+	 && st2.st_mtime == st.st_mtime
+	) {
+		cache_write(&st);
+	}
+	cache_clear();
+#endif
+
 	return 1; /* Handled OK */
 }
+
+/* the global settings and those of one section only, from the cache if
+ * it is current (see above), otherwise as read_upsconf() does */
+int read_upsconf_section(const char *section, int fatal_errors)
+{
+#ifdef UPSCONF_CACHE
+	char	fn[SMALLBUF], *map = NULL;
+	const	char	*base;
+	const	upsconf_cache_hdr_t	*hdr;
+	const	upsconf_cache_idx_t	*idx;
+	struct	stat	st;
+	size_t	len, lo, hi, mid;
+	int	cmp, ok = 1;
+
+	snprintf(fn, sizeof(fn), "%s/ups.conf", confpath());
+
+	if (!section || stat(fn, &st) != 0 || !(len = cache_open(&st, &map))) {
+		return read_upsconf(fatal_errors);
+	}
+
+	base = map;
+	hdr = (const upsconf_cache_hdr_t *)map;
+	idx = (const upsconf_cache_idx_t *)(map + sizeof(*hdr));
+
+	upsdebugx(2, "%s: [%s] from the cache of %s", __func__, section, fn);
+
+	ok = cache_replay(NULL, base + hdr->global_off, hdr->global_len);
+
+	/* the names are NUL-terminated strings, see cache_write() */
+	for (lo = 0, hi = hdr->numsect; ok && lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+
+		if (idx[mid].name_off >= len
+		 || !memchr(base + idx[mid].name_off, '\0', len - idx[mid].name_off)
+		 || idx[mid].data_off > len
+		 || idx[mid].data_len > len - idx[mid].data_off
+		) {
+			ok = 0;
+			break;
+		}
+
+		cmp = strcmp(section, base + idx[mid].name_off);
+		if (cmp == 0) {
+			ok = cache_replay(section, base + idx[mid].data_off, idx[mid].data_len);
+			break;
+		}
+
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	cache_close(map, len);
+
+	if (!ok) {
+		/* what was called back already is called back again,
+		 * as it would be upon a reload */
+		upslogx(LOG_WARNING, "%s: the cache of %s is damaged, reading the file",
+			__func__, fn);
+		snprintf(fn, sizeof(fn), "%s/%s", dflt_statepath(), UPSCONF_CACHE);
+		unlink(fn);	/* for read_upsconf() to make it anew */
+		return read_upsconf(fatal_errors);
+	}
+
+	return 1;
+#else
+	NUT_UNUSED_VARIABLE(section);
+	return read_upsconf(fatal_errors);
+#endif
+}
@@ -27,6 +27,7 @@
 #include "main.h"
 #include "adelsystem_cbi.h"
 #include <modbus.h>
+#include "modbus_bus.h"
 #include <timehead.h>
 
 #define DRIVER_NAME "NUT ADELSYSTEM DC-UPS CB/CBI driver"
@@ -624,7 +625,9 @@ int read_all_regs(modbus_t *mb, uint16_t *data)
 	int rval;
 
 	/* read all HOLDING registers */
+	modbus_bus_lock(mb);
 	rval = modbus_read_registers(mb, regs[H_REG_STARTIDX].xaddr, MAX_H_REGS, data);
+	modbus_bus_unlock(mb);
 	if (rval == -1) {
 		upslogx(LOG_ERR,
 				"ERROR:(%s) modbus_read: addr:0x%x, length:%8d, path:%s\n",
@@ -655,6 +658,7 @@ int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
 	uint16_t mask8 = 0x00FF;
 	uint16_t mask16 = 0xFFFF;
 
+	modbus_bus_lock(mb);
 	switch (type) {
 		case COIL:
 			rval = modbus_read_bits(mb, addr, 1, (uint8_t *)data);
@@ -701,6 +705,7 @@ int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
 # pragma GCC diagnostic pop
 #endif
 	}
+	modbus_bus_unlock(mb);
 	if (rval == -1) {
 		upslogx(LOG_ERR,
 				"ERROR:(%s) modbus_read: addr:0x%x, type:%8s, path:%s\n",
@@ -731,6 +736,7 @@ int register_write(modbus_t *mb, int addr, regtype_t type, void *data)
 	uint16_t mask8 = 0x00FF;
 	uint16_t mask16 = 0xFFFF;
 
+	modbus_bus_lock(mb);
 	switch (type) {
 		case COIL:
 			*(uint16_t *)data = *(uint16_t *)data & mask8;
@@ -758,6 +764,7 @@ int register_write(modbus_t *mb, int addr, regtype_t type, void *data)
 			upsdebugx(2,"ERROR: register_write: invalid register type %d\n", type);
 			break;
 	}
+	modbus_bus_unlock(mb);
 	if (rval == -1) {
 		upslogx(LOG_ERR,
 				"ERROR:(%s) modbus_write: addr:0x%x, type:%8s, path:%s\n",
@@ -40,7 +40,7 @@ static info_lkp_t apc_epdu_sw_outlet_switchability_info[] = {
 };
 
 /* POWERNET-MIB Snmp2NUT lookup table */
-static snmp_info_t apc_epdu_mib[] = {
+static const snmp_info_t apc_epdu_mib[] = {
 
 	/* Device page */
 	snmp_info_default("device.mfr", ST_FLAG_STRING, SU_INFOSIZE, NULL, "APC", SU_FLAG_STATIC | SU_FLAG_ABSENT | SU_FLAG_OK, NULL),
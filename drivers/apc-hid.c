@@ -323,7 +323,7 @@ static usage_tables_t apc_utab[] = {
 /* --------------------------------------------------------------- */
 
 /* HID2NUT lookup table */
-static hid_info_t apc_hid2nut[] = {
+static const hid_info_t apc_hid2nut[] = {
   /* Battery page */
   { "battery.charge", 0, 0, "UPS.PowerSummary.RemainingCapacity", NULL, "%.0f", 0, NULL },
   { "battery.charge.low", ST_FLAG_RW | ST_FLAG_STRING, 10, "UPS.PowerSummary.RemainingCapacityLimit", NULL, "%.0f", HU_FLAG_SEMI_STATIC, NULL },
@@ -605,4 +605,5 @@ subdriver_t apc_subdriver = {
 	apc_format_mfr,
 	apc_format_serial,
 	apc_fix_report_desc,
+	NULL,
 };
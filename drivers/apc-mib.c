@@ -171,7 +171,7 @@ static info_lkp_t apcc_transfer_reasons[] = {
 
 
 
-static snmp_info_t apcc_mib[] = {
+static const snmp_info_t apcc_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
@@ -44,7 +44,7 @@ static info_lkp_t apc_pdu_sw_outlet_switchability_info[] = {
 };
 
 /* POWERNET-MIB Snmp2NUT lookup table */
-static snmp_info_t apc_pdu_mib[] = {
+static const snmp_info_t apc_pdu_mib[] = {
 
 	/* Device page */
 	snmp_info_default("device.mfr", ST_FLAG_STRING, SU_INFOSIZE, NULL, "APC",
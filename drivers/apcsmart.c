@@ -35,9 +35,10 @@
 
 #include "apcsmart.h"
 #include "apcsmart_tabs.h"
+#include "capcache.h"
 
 #define DRIVER_NAME	"APC Smart protocol driver"
-#define DRIVER_VERSION	"3.35"
+#define DRIVER_VERSION	"3.36"
 
 #ifdef WIN32
 # ifndef ECANCELED
@@ -975,25 +976,12 @@ static void deprecate_vars(void)
 	}
 }
 
+static void apc_parsecaps(const char *temp, int qco);
+
 static void apc_getcaps(int qco)
 {
-	const	char	*ptr, *entptr;
-	char	upsloc, temp[APC_LBUF], cmd, loc, etmp[APC_SBUF], *endtemp;
-	int	matrix, valid;
-	size_t	nument, entlen, i;
+	char	temp[APC_LBUF];
 	ssize_t	ret;
-	apc_vartab_t *vt;
-
-	/*
-	 * If we can do caps, then we need the Firmware revision which has the
-	 * locale descriptor as the last character (ugh); this is valid for
-	 * both 'V' and 'b' commands.
-	 */
-	ptr = dstate_getinfo("ups.firmware");
-	if (ptr)
-		upsloc = ptr[strlen(ptr) - 1];
-	else
-		upsloc = 0;
 
 	/* get capability string */
 	apc_flush(0);
@@ -1019,6 +1007,32 @@ static void apc_getcaps(int qco)
 		return;
 	}
 
+	/* for the next start, see apc_cached_setup() */
+	capcache_set("caps", temp);
+	capcache_set("qco", qco ? "1" : "0");
+
+	apc_parsecaps(temp, qco);
+}
+
+static void apc_parsecaps(const char *temp, int qco)
+{
+	const	char	*ptr, *entptr, *endtemp;
+	char	upsloc, cmd, loc, etmp[APC_SBUF];
+	int	matrix, valid;
+	size_t	nument, entlen, i;
+	apc_vartab_t *vt;
+
+	/*
+	 * If we can do caps, then we need the Firmware revision which has the
+	 * locale descriptor as the last character (ugh); this is valid for
+	 * both 'V' and 'b' commands.
+	 */
+	ptr = dstate_getinfo("ups.firmware");
+	if (ptr)
+		upsloc = ptr[strlen(ptr) - 1];
+	else
+		upsloc = 0;
+
 	/* recv always puts a \0 at the end, so this is safe */
 	/* however it assumes a zero byte cannot be embedded */
 	endtemp = &temp[0] + strlen(temp);
@@ -1299,7 +1313,7 @@ static int firmware_table_lookup(void)
 	return 0;
 }
 
-static int getbaseinfo(void)
+static int probebaseinfo(void)
 {
 	unsigned int	i;
 	ssize_t	ret;
@@ -1361,6 +1375,159 @@ static int getbaseinfo(void)
 	return 1;
 }
 
+/*
+ * Who the device is, asked quickly: model, serial number and firmware
+ * (by both commands, as probebaseinfo() may use either). Empty if it
+ * does not tell any of these, as then there is nothing to tell a
+ * replaced UPS by.
+ */
+static void apc_identity(char *id, size_t idlen)
+{
+	static const char	idcmds[] = { '\001', 'n', APC_FW_NEW, APC_FW_OLD, 0 };
+	char	temp[APC_LBUF];
+	ssize_t	ret;
+	size_t	i;
+	int	known = 0;
+
+	id[0] = '\0';
+
+	for (i = 0; idcmds[i]; i++) {
+		apc_flush(0);
+		if (apc_write((const unsigned char)idcmds[i]) != 1)
+			break;
+
+		ret = apc_read(temp, sizeof(temp), SER_TO);
+		if (ret < 1 || !strcmp(temp, "NA"))
+			temp[0] = '\0';
+		else
+			known = 1;
+
+		snprintfcat(id, idlen, "%s%s", (i ? "|" : ""), temp);
+	}
+
+	if (!known || idcmds[i])
+		id[0] = '\0';
+
+	upsdebugx(1, "%s: [%s]", __func__, id);
+}
+
+/* what probebaseinfo() found, for the next start */
+static void apc_cache_found(void)
+{
+	char	list[APC_LBUF];
+	const	char	*model;
+	int	i;
+
+	list[0] = '\0';
+	for (i = 0; apc_vartab[i].name != NULL; i++) {
+		if (apc_vartab[i].flags & APC_PRESENT)
+			snprintfcat(list, sizeof(list), "%s%d", (*list ? "," : ""), i);
+	}
+	capcache_set("vars", list);
+
+	list[0] = '\0';
+	for (i = 0; apc_cmdtab[i].name != NULL; i++) {
+		if (apc_cmdtab[i].flags & APC_PRESENT)
+			snprintfcat(list, sizeof(list), "%s%d", (*list ? "," : ""), i);
+	}
+	capcache_set("cmds", list);
+
+	/* as set by the firmware table or for old models */
+	if ((model = dstate_getinfo("ups.model")))
+		capcache_set("model", model);
+}
+
+/*
+ * Set up what probebaseinfo() found on an earlier start (of this driver
+ * version, on this port, with a UPS of the same identity): the variables
+ * which were present are read once, rather than trying every command
+ * the UPS may or may not know. Returns 0 if what was kept is not usable.
+ */
+static int apc_cached_setup(void)
+{
+	const	char	*vars = capcache_get("vars"), *cmds = capcache_get("cmds"),
+		*caps = capcache_get("caps"), *qco = capcache_get("qco"),
+		*model = capcache_get("model"), *temp;
+	char	*end;
+	long	idx;
+	int	numvars, numcmds;
+	apc_vartab_t	*vt;
+	apc_cmdtab_t	*ct;
+
+	if (!vars || !cmds)
+		return 0;
+
+	for (numvars = 0; apc_vartab[numvars].name != NULL; numvars++)
+		;
+	for (numcmds = 0; apc_cmdtab[numcmds].name != NULL; numcmds++)
+		;
+
+	/* the same driver version, so the same tables - but still */
+	for (temp = vars; *temp; temp = (*end ? end + 1 : end)) {
+		idx = strtol(temp, &end, 10);
+		if (end == temp || idx < 0 || idx >= numvars || (*end && *end != ','))
+			return 0;
+	}
+	for (temp = cmds; *temp; temp = (*end ? end + 1 : end)) {
+		idx = strtol(temp, &end, 10);
+		if (end == temp || idx < 0 || idx >= numcmds || (*end && *end != ','))
+			return 0;
+	}
+
+	/* the firmware table sets it first, a variable may override it */
+	if (model)
+		dstate_setinfo("ups.model", "%s", model);
+
+	for (temp = vars; *temp; temp = (*end ? end + 1 : end)) {
+		const	char	*val;
+
+		vt = &apc_vartab[strtol(temp, &end, 10)];
+		vt->flags |= APC_PRESENT;
+
+		val = preread_data(vt);
+		if (!val || !rexhlp(vt->regex, val)) {
+			warn_cv((const unsigned char)vt->cmd, "variable", vt->name);
+			vt->flags &= ~(unsigned int)APC_PRESENT;
+			continue;
+		}
+
+		apc_dstate_setinfo(vt, val);
+		var_string_setup(vt);
+	}
+
+	for (temp = cmds; *temp; temp = (*end ? end + 1 : end)) {
+		ct = &apc_cmdtab[strtol(temp, &end, 10)];
+		ct->flags |= APC_PRESENT;
+		dstate_addcmd(ct->name);
+	}
+
+	if (caps)
+		apc_parsecaps(caps, (qco && !strcmp(qco, "1")));
+
+	return 1;
+}
+
+static int getbaseinfo(void)
+{
+	char	id[APC_LBUF];
+
+	apc_identity(id, sizeof(id));
+
+	if (capcache_load(id)) {
+		if (apc_cached_setup())
+			return 1;
+		capcache_drop();
+	}
+
+	if (!probebaseinfo())
+		return 0;
+
+	apc_cache_found();
+	capcache_save(id);
+
+	return 1;
+}
+
 /* check for calibration status and either start or stop */
 static int do_cal(int start)
 {
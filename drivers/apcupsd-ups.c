@@ -57,7 +57,7 @@ typedef struct pollfd {
 #include "nut_stdint.h"
 
 #define DRIVER_NAME	"apcupsd network client UPS driver"
-#define DRIVER_VERSION	"0.73"
+#define DRIVER_VERSION	"0.74"
 
 #define POLL_INTERVAL_MIN 10
 
@@ -73,17 +73,13 @@ upsdrv_info_t upsdrv_info = {
 static uint16_t port=3551;
 static struct sockaddr_in host;
 
-static void process(char *item,char *data)
+/* one NUT variable from the value of its NIS key */
+static void process_one(int i,char *data)
 {
-	int i;
 	char *p1;
 	char *p2;
 
-	for(i=0;nut_data[i].info_type;i++)if(!(nut_data[i].apcupsd_item))
-		dstate_setinfo(nut_data[i].info_type,"%s",
-			nut_data[i].default_value);
-	else if(!strcmp(nut_data[i].apcupsd_item,item))
-			switch(nut_data[i].drv_flags&~DU_FLAG_INIT)
+	switch(nut_data[i].drv_flags&~DU_FLAG_INIT)
 	{
 	case DU_FLAG_STATUS:
 		status_init();
@@ -184,162 +180,242 @@ static void process(char *item,char *data)
 	}
 }
 
-static int getdata(void)
+
+/* NIS key -> nut_data entries, so that each line of the answer only
+ * costs a lookup (keys we have no variable for are skipped) */
+#define NIS_HASH	64
+
+static int nis_head[NIS_HASH];	/* first entry + 1, 0 if none */
+static int nis_next[SIZEOF_ARRAY(nut_data)];	/* same */
+
+static size_t nis_hash(const char *s)
 {
-	ssize_t x;
-	uint16_t n;
-	char *item;
-	char *data;
-	struct pollfd p;
-	char bfr[1024];
-	st_tree_timespec_t start;
-	int ret = -1;
-#ifndef WIN32
-	int fd_flags;
-#else
+	size_t h=5381;
+
+	while(*s)h=h*33+(unsigned char)*s++;
+	return h&(NIS_HASH-1);
+}
+
+static void nis_index(void)
+{
+	int i;
+	size_t h;
+
+	/* backwards, so that entries sharing a key keep the table order */
+	for(i=(int)SIZEOF_ARRAY(nut_data)-1;i>=0;i--)
+		if(nut_data[i].apcupsd_item)
+	{
+		h=nis_hash(nut_data[i].apcupsd_item);
+		nis_next[i]=nis_head[h];
+		nis_head[h]=i+1;
+	}
+}
+
+static void process(char *item,char *data)
+{
+	int i;
+
+	for(i=nis_head[nis_hash(item)]-1;i>=0;i=nis_next[i]-1)
+		if(!strcmp(nut_data[i].apcupsd_item,item))process_one(i,data);
+}
+
+/* The connection to apcupsd is kept from one update to the next (it
+ * answers any number of requests on it), and made again when it fails.
+ * Its answers come in frames of a 2 byte length and that many bytes,
+ * read through nis_buf; an empty frame ends the answer. */
+static TYPE_FD_SOCK nis_fd=ERROR_FD_SOCK;
+#ifdef WIN32
 	/* Note: while the code below uses "pollfd" for simplicity as it is
 	 * available in mingw headers (although poll() method usually is not),
 	 * WIN32 builds use WaitForMultipleObjects(); see also similar code
 	 * in upsd.c for networking.
 	 */
-	HANDLE event = NULL;
+static HANDLE nis_event=NULL;
 #endif
+static char nis_buf[4096];
+static size_t nis_len=0;
 
-	state_get_timestamp((st_tree_timespec_t *)&start);
+static void nis_close(void)
+{
+	if(VALID_FD_SOCK(nis_fd))close(nis_fd);
+	nis_fd=ERROR_FD_SOCK;
+#ifdef WIN32
+	if(nis_event!=NULL)CloseHandle(nis_event);
+	nis_event=NULL;
+#endif
+	nis_len=0;
+}
+
+static int nis_connect(void)
+{
+#ifndef WIN32
+	int fd_flags;
+#endif
 
-	if (INVALID_FD_SOCK( (p.fd = socket(AF_INET, SOCK_STREAM, 0)) ))
+	if(INVALID_FD_SOCK((nis_fd=socket(AF_INET,SOCK_STREAM,0))))
 	{
 		upsdebugx(1,"socket error");
-		/* return -1; */
-		ret = -1;
-		goto getdata_return;
+		return -1;
 	}
 
-	if(connect(p.fd,(struct sockaddr *)&host,sizeof(host)))
+	if(connect(nis_fd,(struct sockaddr *)&host,sizeof(host)))
 	{
 		upsdebugx(1,"can't connect to apcupsd");
-		/* close(p.fd);
-		return -1; */
-		ret = -1;
-		goto getdata_return;
+		nis_close();
+		return -1;
 	}
 
 #ifndef WIN32
-	/* WSAEventSelect automatically sets the socket to nonblocking mode */
-	fd_flags = fcntl(p.fd, F_GETFL);
-	if (fd_flags == -1) {
-		upsdebugx(1,"unexpected fcntl(fd, F_GETFL) failure");
-		/* close(p.fd);
-		return -1; */
-		ret = -1;
-		goto getdata_return;
-	}
-	fd_flags |= O_NONBLOCK;
-	if(fcntl(p.fd, F_SETFL, fd_flags) == -1)
+	fd_flags=fcntl(nis_fd,F_GETFL);
+	if(fd_flags==-1||fcntl(nis_fd,F_SETFL,fd_flags|O_NONBLOCK)==-1)
 	{
 		upsdebugx(1,"unexpected fcntl(fd, F_SETFL, fd_flags|O_NONBLOCK) failure");
-		/* close(p.fd);
-		return -1; */
-		ret = -1;
-		goto getdata_return;
+		nis_close();
+		return -1;
 	}
 #else
-	event = CreateEvent(
+	nis_event=CreateEvent(
 		NULL,  /* Security */
 		FALSE, /* auto-reset */
 		FALSE, /* initial state */
 		NULL); /* no name */
 
-	/* Associate socket event to the socket via its Event object */
-	WSAEventSelect( p.fd, event, FD_CONNECT );
+	/* WSAEventSelect automatically sets the socket to nonblocking mode */
+	WSAEventSelect(nis_fd,nis_event,FD_READ|FD_CLOSE);
 #endif
 
-	p.events=POLLIN;
-
-	n=htons(6);
-	x=write(p.fd,&n,2);
-	x=write(p.fd,"status",6);
+	upsdebugx(2,"connected to apcupsd");
+	return 0;
+}
 
-	/* TODO: double-check for poll() in configure script */
+/* 1 if there is something to read within 15 seconds */
+static int nis_wait(void)
+{
 #ifndef WIN32
-	while(poll(&p,1,15000)==1)
+	struct pollfd p;
+
+	p.fd=nis_fd;
+	p.events=POLLIN;
+	return poll(&p,1,15000)==1;
 #else
-	while (WaitForMultipleObjects(1, &event, FALSE, 15000) == WAIT_TIMEOUT)
+	return WaitForMultipleObjects(1,&nis_event,FALSE,15000)==WAIT_OBJECT_0;
 #endif
+}
+
+/* the next frame into bfr (NUL-terminated), returns its length (0 at
+ * the end of the answer), or -1 on error or timeout */
+static ssize_t nis_frame(char *bfr,size_t len)
+{
+	ssize_t x;
+	size_t n;
+
+	for(;;)
 	{
-		if(read(p.fd,&n,2)!=2)
+		if(nis_len>=2)
 		{
-			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			n=((size_t)(unsigned char)nis_buf[0]<<8)|
+				(unsigned char)nis_buf[1];
+			if(n>=len||n>sizeof(nis_buf)-2)
+			{
+				upsdebugx(1,"apcupsd communication error");
+				return -1;
+			}
+			if(nis_len>=n+2)
+			{
+				memcpy(bfr,nis_buf+2,n);
+				bfr[n]=0;
+				nis_len-=n+2;
+				memmove(nis_buf,nis_buf+n+2,nis_len);
+				return (ssize_t)n;
+			}
 		}
 
-		if(!(x=ntohs(n)))
+		if(!nis_wait())
 		{
-			ret = 0;
-			goto getdata_return;
+			upsdebugx(1,"no answer from apcupsd");
+			return -1;
 		}
-		else if(x<0||x>=(int)sizeof(bfr))
-		/* Note: LGTM.com suggests "Comparison is always false because x >= 0"
-		 * for the line above, probably because ntohs() returns an uint type.
-		 * I am reluctant to fix this one, because googling for headers from
-		 * random OSes showed various types used as the return value (uint16_t,
-		 * unsigned_short, u_short, in_port_t...)
-		 */
+
+		x=read(nis_fd,nis_buf+nis_len,sizeof(nis_buf)-nis_len);
+		if(x<=0)
 		{
-			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			if(x<0&&(errno==EAGAIN||errno==EINTR))continue;
+			upsdebugx(1,"unexpected connection close by apcupsd");
+			return -1;
 		}
+		nis_len+=(size_t)x;
+	}
+}
 
-#ifndef WIN32
-		if(poll(&p,1,15000)!=1)break;
-#else
-		if (WaitForMultipleObjects(1, &event, FALSE, 15000) != WAIT_OBJECT_0) break;
-#endif
+/* one "status" request on the connection */
+static int nis_status(void)
+{
+	ssize_t x;
+	char *item;
+	char *data;
+	char bfr[1024];
+	static const char req[8]={0,6,'s','t','a','t','u','s'};
 
-		if(read(p.fd,bfr,(size_t)x)!=x)
-		{
-			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
-		}
+	nis_len=0;
 
-		bfr[x]=0;
+	if(write(nis_fd,req,sizeof(req))!=(ssize_t)sizeof(req))
+	{
+		upsdebugx(1,"can't send to apcupsd");
+		return -1;
+	}
 
+	while((x=nis_frame(bfr,sizeof(bfr)))>0)
+	{
 		if(!(item=strtok(bfr," \t:\r\n")))
 		{
 			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			return -1;
 		}
 
 		if(!(data=strtok(NULL,"\r\n")))
 		{
 			upsdebugx(1,"apcupsd communication error");
-			ret = -1;
-			goto getdata_return;
+			return -1;
 		}
 		while(*data==' '||*data=='\t'||*data==':')data++;
 
 		process(item,data);
 	}
 
-	upsdebugx(1,"unexpected connection close by apcupsd");
-	ret = -1;
+	return (x==0)?0:-1;
+}
 
-getdata_return:
-	if (VALID_FD_SOCK(p.fd))
-		close(p.fd);
-#ifdef WIN32
-	if (event != NULL)
-		CloseHandle(event);
-#endif
+static int getdata(void)
+{
+	int i;
+	int reused;
+	st_tree_timespec_t start;
+	int ret = -1;
+
+	state_get_timestamp((st_tree_timespec_t *)&start);
+
+	for(i=0;nut_data[i].info_type;i++)if(!(nut_data[i].apcupsd_item))
+		dstate_setinfo(nut_data[i].info_type,"%s",
+			nut_data[i].default_value);
+
+	/* apcupsd may have dropped a connection kept since the last
+	 * update (or restarted): then try once more with a new one */
+	for(;;)
+	{
+		reused=VALID_FD_SOCK(nis_fd);
+		if(!reused&&nis_connect())break;
+
+		if(!(ret=nis_status()))break;
+
+		nis_close();
+		if(!reused)break;
+		upsdebugx(1,"reconnecting to apcupsd");
+	}
 
 	/* Remove any unprotected entries not refreshed in this run */
-	for(x=0;nut_data[x].info_type;x++)
-		if(!(nut_data[x].drv_flags & DU_FLAG_INIT) && !(nut_data[x].drv_flags & DU_FLAG_PRESERVE))
-			dstate_delinfo_olderthan(nut_data[x].info_type, &start);
+	for(i=0;nut_data[i].info_type;i++)
+		if(!(nut_data[i].drv_flags & DU_FLAG_INIT) && !(nut_data[i].drv_flags & DU_FLAG_PRESERVE))
+			dstate_delinfo_olderthan(nut_data[i].info_type, &start);
 
 	return ret;
 }
@@ -411,8 +487,11 @@ void upsdrv_initups(void)
 	/* TODO: add IPv6 support */
 	host.sin_family=AF_INET;
 	host.sin_port=htons(port);
+
+	nis_index();
 }
 
 void upsdrv_cleanup(void)
 {
+	nis_close();
 }
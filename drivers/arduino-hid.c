@@ -79,7 +79,7 @@ static usage_tables_t arduino_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t arduino_hid2nut[] = {
+static const hid_info_t arduino_hid2nut[] = {
 
 	/* USB HID PDC defaults */
 	{ "ups.delay.start", ST_FLAG_RW | ST_FLAG_STRING, 10, "UPS.PowerSummary.DelayBeforeStartup", NULL, DEFAULT_ONDELAY, HU_FLAG_ABSENT, NULL},
@@ -186,4 +186,5 @@ subdriver_t arduino_subdriver = {
 	arduino_format_mfr,
 	arduino_format_serial,
 	fix_report_desc,
+	NULL,
 };
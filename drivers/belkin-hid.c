@@ -100,6 +100,13 @@ static double liebert_config_voltage_mult = 1.0;
 static double liebert_line_voltage_mult = 1.0;
 static char liebert_conversion_buf[10];
 
+/* per device, see addhostvars() */
+static const dstate_hostvar_t belkin_hostvars[] = {
+	DSTATE_HOSTVAR(liebert_config_voltage_mult),
+	DSTATE_HOSTVAR(liebert_line_voltage_mult),
+	DSTATE_HOSTVAR_END
+};
+
 static info_lkp_t liebert_online_info[] = {
 	{ 0, NULL, liebert_online_fun, NULL }
 };
@@ -466,7 +473,7 @@ static usage_tables_t belkin_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t belkin_hid2nut[] = {
+static const hid_info_t belkin_hid2nut[] = {
 
   /* interpreted Belkin variables */
   { "battery.charge", 0, 0, "UPS.BELKINBatterySystem.BELKINCharge", NULL, "%.0f", 0, NULL },
@@ -689,4 +696,5 @@ subdriver_t belkin_subdriver = {
 	belkin_format_mfr,
 	belkin_format_serial,
 	fix_report_desc,
+	belkin_hostvars,
 };
@@ -0,0 +1,283 @@
+/* capcache.c - what a driver learned from probing its device, kept for
+                the next start
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Some serial drivers ask their device about everything it might
+ * support, one question at a time and with a timeout for each question
+ * it does not understand, which can take minutes per device.  The
+ * answers do not change unless the device does, so a driver may keep
+ * them here (in <statepath>/<driver>-<ups>.caps) and only ask the device
+ * who it is on the next start.
+ *
+ * The file is text, one "<key> <value>" per line, with the bytes of the
+ * value which are not printable (and '%') written as %XX.  The first
+ * lines tell which driver version, port and device it is about. */
+
+#include "config.h"  /* must be the first header */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "main.h"
+#include "dstate.h"
+#include "capcache.h"
+
+#define CAPCACHE_MAGIC	"NUTCAPS 1"
+
+typedef struct capcache_s {
+	char	*key;
+	char	*val;
+	struct capcache_s	*next;
+} capcache_t;
+
+static capcache_t	*capcache = NULL;
+
+static int capcache_enabled(void)
+{
+#ifdef WIN32
+	return 0;
+#else
+	/* nothing to go by when driven by hand with -s, or told not to */
+	return (upsname && device_path
+		&& !dstate_getinfo("driver.flag.nocapcache"));
+#endif
+}
+
+static void capcache_fn(char *fn, size_t fnlen)
+{
+	snprintf(fn, fnlen, "%s/%s-%s%s", dflt_statepath(), progname, upsname,
+		CAPCACHE_SUFFIX);
+}
+
+static void capcache_escape(char *buf, size_t buflen, const char *val)
+{
+	const	char	*hex = "0123456789ABCDEF";
+	size_t	i = 0;
+
+	for (; *val && i + 4 < buflen; val++) {
+		unsigned char	c = (unsigned char)*val;
+
+		if (c <= ' ' || c >= 0x7f || c == '%') {
+			buf[i++] = '%';
+			buf[i++] = hex[c >> 4];
+			buf[i++] = hex[c & 0x0f];
+		} else {
+			buf[i++] = (char)c;
+		}
+	}
+
+	buf[i] = '\0';
+}
+
+static void capcache_unescape(char *val)
+{
+	char	*in, *out;
+	unsigned int	c;
+
+	for (in = out = val; *in; in++) {
+		if (*in == '%' && in[1] && in[2] && sscanf(in + 1, "%2X", &c) == 1) {
+			*out++ = (char)c;
+			in += 2;
+		} else {
+			*out++ = *in;
+		}
+	}
+
+	*out = '\0';
+}
+
+const char *capcache_get(const char *key)
+{
+	capcache_t	*item;
+
+	for (item = capcache; item; item = item->next) {
+		if (!strcmp(item->key, key)) {
+			return item->val;
+		}
+	}
+
+	return NULL;
+}
+
+void capcache_set(const char *key, const char *val)
+{
+	capcache_t	*item;
+
+	for (item = capcache; item; item = item->next) {
+		if (!strcmp(item->key, key)) {
+			free(item->val);
+			item->val = xstrdup(val);
+			return;
+		}
+	}
+
+	item = xcalloc(1, sizeof(*item));
+	item->key = xstrdup(key);
+	item->val = xstrdup(val);
+	item->next = capcache;
+	capcache = item;
+}
+
+static void capcache_free(void)
+{
+	capcache_t	*item, *next;
+
+	for (item = capcache; item; item = next) {
+		next = item->next;
+		free(item->key);
+		free(item->val);
+		free(item);
+	}
+
+	capcache = NULL;
+}
+
+/* the lines the file must start with to be about this device */
+static void capcache_header(char *buf, size_t buflen, const char *identity)
+{
+	char	tmp[LARGEBUF];
+
+	snprintf(buf, buflen, "%s\ndriver %s %s\n", CAPCACHE_MAGIC, progname,
+		upsdrv_info.version);
+
+	capcache_escape(tmp, sizeof(tmp), device_path);
+	snprintfcat(buf, buflen, "port %s\n", tmp);
+
+	capcache_escape(tmp, sizeof(tmp), identity);
+	snprintfcat(buf, buflen, "id %s\n", tmp);
+}
+
+int capcache_load(const char *identity)
+{
+	char	fn[LARGEBUF], want[LARGEBUF * 2], line[LARGEBUF * 3], *val;
+	size_t	hlen = 0, wlen;
+	FILE	*f;
+
+	capcache_free();
+
+	if (!capcache_enabled() || !identity || !*identity) {
+		return 0;
+	}
+
+	capcache_fn(fn, sizeof(fn));
+	capcache_header(want, sizeof(want), identity);
+	wlen = strlen(want);
+
+	f = fopen(fn, "r");
+	if (!f) {
+		upsdebugx(1, "%s: no %s, probing the device", __func__, fn);
+		return 0;
+	}
+
+	/* the header must be the very same, line by line */
+	while (hlen < wlen && fgets(line, sizeof(line), f)) {
+		size_t	len = strlen(line);
+
+		if (len > wlen - hlen || strncmp(want + hlen, line, len)) {
+			break;
+		}
+		hlen += len;
+	}
+
+	if (hlen != wlen) {
+		upsdebugx(1, "%s: %s is for another driver, port or device, "
+			"probing the device", __func__, fn);
+		fclose(f);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		val = strchr(line, ' ');
+		if (!val) {
+			continue;
+		}
+		*val++ = '\0';
+
+		capcache_unescape(val);
+		capcache_set(line, val);
+	}
+
+	fclose(f);
+
+	upsdebugx(1, "%s: using what %s remembers of the device", __func__, fn);
+
+	return 1;
+}
+
+void capcache_save(const char *identity)
+{
+	char	fn[LARGEBUF], tmp[LARGEBUF + 8], buf[LARGEBUF * 3];
+	capcache_t	*item;
+	FILE	*f;
+	int	fd;
+
+	if (!capcache_enabled() || !identity || !*identity || !capcache) {
+		return;
+	}
+
+	capcache_fn(fn, sizeof(fn));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		upsdebug_with_errno(1, "%s: can't write %s", __func__, tmp);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	capcache_header(buf, sizeof(buf), identity);
+	fputs(buf, f);
+
+	for (item = capcache; item; item = item->next) {
+		capcache_escape(buf, sizeof(buf), item->val);
+		fprintf(f, "%s %s\n", item->key, buf);
+	}
+
+	if (ferror(f) | fclose(f) || rename(tmp, fn) != 0) {
+		upsdebug_with_errno(1, "%s: can't write %s", __func__, fn);
+		unlink(tmp);
+		return;
+	}
+
+	upsdebugx(1, "%s: saved what was found in %s", __func__, fn);
+}
+
+void capcache_drop(void)
+{
+	char	fn[LARGEBUF];
+
+	capcache_free();
+
+	if (!capcache_enabled()) {
+		return;
+	}
+
+	capcache_fn(fn, sizeof(fn));
+	if (unlink(fn) == 0) {
+		upsdebugx(1, "%s: removed %s", __func__, fn);
+	}
+}
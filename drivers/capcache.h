@@ -0,0 +1,56 @@
+/* capcache.h - what a driver learned from probing its device, kept for
+                the next start (see capcache.c)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_CAPCACHE_H_SEEN
+#define NUT_CAPCACHE_H_SEEN 1
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* next to the driver socket in the state path */
+#define CAPCACHE_SUFFIX	".caps"
+
+/* Load what was saved by the same driver (and version) for the same
+ * port, if the device still gives the same identity (e.g. its model,
+ * serial number and firmware, which the driver asks for quickly).
+ * Returns 1 if it was found, after which capcache_get() has the values,
+ * or 0 (the driver then probes as usual, and saves what it found). */
+int capcache_load(const char *identity);
+
+/* a value loaded or set before, or NULL */
+const char *capcache_get(const char *key);
+
+/* remember a value, for capcache_save() */
+void capcache_set(const char *key, const char *val);
+
+/* write out what was set, for capcache_load(identity) of the next start */
+void capcache_save(const char *identity);
+
+/* forget it all and remove the file, e.g. when it proved wrong */
+void capcache_drop(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_CAPCACHE_H_SEEN */
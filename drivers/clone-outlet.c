@@ -23,6 +23,7 @@
 #include "main.h"
 #include "parseconf.h"
 #include "nut_stdint.h"
+#include "shmstate.h"
 
 #include <sys/types.h>
 #ifndef WIN32
@@ -31,7 +32,7 @@
 #endif
 
 #define DRIVER_NAME	"Clone outlet UPS driver"
-#define DRIVER_VERSION	"0.07"
+#define DRIVER_VERSION	"0.08"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -69,6 +70,8 @@ static struct {
 static int	dumpdone = 0;
 
 static PCONF_CTX_t	sock_ctx;
+static char	*subscribe = NULL;	/* "SUBSCRIBE ..." line, see subscribe_init() */
+static shmstate_t	*shm = NULL;	/* values exported by the driver, if it does */
 static time_t	last_poll = 0, last_heard = 0, last_ping = 0;
 
 #ifndef WIN32
@@ -79,6 +82,37 @@ static char     	read_buf[SMALLBUF];
 static OVERLAPPED	read_overlapped;
 #endif
 
+static int sstate_sendline(const char *buf);
+
+/* the value of var in the slot named by a SHMSET line, from the state
+ * table shared by the driver; returns 0 if there is none to take */
+static int sstate_shmget(const char *var, const char *slotstr, char *val, size_t valsize)
+{
+	char	cmd[SMALLBUF];
+	long	slot;
+
+	if (!str_to_long(slotstr, &slot, 10)) {
+		return 0;
+	}
+
+	switch (shmstate_get(shm, slot, var, val, valsize))
+	{
+		case 1:
+			return 1;
+
+		case 0:
+			/* slot got reused: the variable was deleted meanwhile,
+			 * and its DELINFO is right behind this line */
+			return 0;
+
+		default:
+			/* the driver kept rewriting it - ask for it as text */
+			snprintf(cmd, sizeof(cmd), "DUMPVALUE %s\n", var);
+			sstate_sendline(cmd);
+			return 0;
+	}
+}
+
 static int parse_args(size_t numargs, char **arg)
 {
 	if (numargs < 1) {
@@ -120,8 +154,18 @@ static int parse_args(size_t numargs, char **arg)
 		goto skip_out;
 	}
 
-	/* SETINFO <varname> <value> */
-	if (!strcasecmp(arg[0], "SETINFO")) {
+	/* SETINFO <varname> <value>, or SHMSET <varname> <slot>
+	 * with the value in the state table shared by the driver */
+	if (!strcasecmp(arg[0], "SETINFO") || !strcasecmp(arg[0], "SHMSET")) {
+		char	shmval[ST_MAX_VALUE_LEN];
+		const char	*val = arg[2];
+
+		if (!strcasecmp(arg[0], "SHMSET")) {
+			if (!sstate_shmget(arg[1], arg[2], shmval, sizeof(shmval))) {
+				return 1;
+			}
+			val = shmval;
+		}
 
 		if (!strncasecmp(arg[1], "driver.", 7)) {
 			/* don't pass on upstream driver settings */
@@ -129,23 +173,23 @@ static int parse_args(size_t numargs, char **arg)
 		}
 
 		if (!strcasecmp(arg[1], prefix.delay.shutdown)) {
-			outlet.delay.shutdown = strtol(arg[2], NULL, 10);
+			outlet.delay.shutdown = strtol(val, NULL, 10);
 		}
 
 		if (!strcasecmp(arg[1], prefix.timer.shutdown)) {
-			outlet.timer.shutdown = strtol(arg[2], NULL, 10);
+			outlet.timer.shutdown = strtol(val, NULL, 10);
 		}
 
 		if (!strcasecmp(arg[1], prefix.status)) {
-			outlet.status = strcasecmp(arg[2], "off");
+			outlet.status = strcasecmp(val, "off");
 		}
 
 		if (!strcasecmp(arg[1], "ups.status")) {
-			snprintf(ups.status, sizeof(ups.status), "%s", arg[2]);
+			snprintf(ups.status, sizeof(ups.status), "%s", val);
 			return 1;
 		}
 
-		dstate_setinfo(arg[1], "%s", arg[2]);
+		dstate_setinfo(arg[1], "%s", val);
 		return 1;
 	}
 
@@ -171,10 +215,47 @@ skip_out:
 }
 
 
+/* "SUBSCRIBE" line asking the driver for only some of its variables,
+ * when the "subscribe" option lists them: those, and the ones in own
+ * which this driver looks at itself */
+static void subscribe_init(const char *own)
+{
+	char	buf[LARGEBUF], *list, *pattern;
+	const char	*val = getval("subscribe");
+
+	if (!val) {
+		return;
+	}
+
+	snprintf(buf, sizeof(buf), "SUBSCRIBE %s", own);
+
+	list = xstrdup(val);
+	for (pattern = strtok(list, ", "); pattern; pattern = strtok(NULL, ", ")) {
+		snprintfcat(buf, sizeof(buf), " %s", pattern);
+	}
+	free(list);
+
+	snprintfcat(buf, sizeof(buf), "\n");
+	subscribe = xstrdup(buf);
+}
+
+
+/* what to send upon (re)connecting to the driver */
+static const char *sstate_dumpcmd(void)
+{
+	static char	buf[LARGEBUF + SMALLBUF];
+
+	snprintf(buf, sizeof(buf), "%s%sDUMPALL\n",
+		subscribe ? subscribe : "", shm ? "SHMSTATE\n" : "");
+
+	return buf;
+}
+
+
 static TYPE_FD sstate_connect(void)
 {
 	TYPE_FD	fd;
-	const char	*dumpcmd = "DUMPALL\n";
+	const char	*dumpcmd;
 
 #ifndef WIN32
 	ssize_t	ret;
@@ -242,7 +323,21 @@ static TYPE_FD sstate_connect(void)
 		return ERROR_FD;
 	}
 
+	/* a driver exporting its values next to the socket will only send
+	 * their slots if we ask first; see shmstate.h */
+	{ /* scoping */
+		char	shmfn[SMALLBUF];
+
+		shmstate_close(shm);
+
+		snprintf(shmfn, sizeof(shmfn), "%s%s", sa.sun_path, SHMSTATE_SUFFIX);
+		if ((shm = shmstate_open(shmfn)) != NULL) {
+			upsdebugx(2, "UPS [%s] exports its values in %s", device_path, shmfn);
+		}
+	}
+
 	/* get a dump started so we have a fresh set of data */
+	dumpcmd = sstate_dumpcmd();
 	ret = write(fd, dumpcmd, strlen(dumpcmd));
 
 	if (ret != (int)strlen(dumpcmd)) {
@@ -282,6 +377,8 @@ static TYPE_FD sstate_connect(void)
 	/* get a dump started so we have a fresh set of data */
 	DWORD bytesWritten = 0;
 
+	dumpcmd = sstate_dumpcmd();
+
 	result = WriteFile (fd,dumpcmd,strlen(dumpcmd),&bytesWritten,NULL);
 	if (result == 0 || bytesWritten != strlen(dumpcmd)) {
 		upslog_with_errno(LOG_ERR, "Initial write to UPS [%s] failed", device_path);
@@ -530,6 +627,7 @@ void upsdrv_help(void)
 void upsdrv_makevartable(void)
 {
 	addvar(VAR_VALUE, "prefix", "Outlet prefix (mandatory)");
+	addvar(VAR_VALUE, "subscribe", "Get only these variables of the UPS (comma-separated names, or beginnings of names followed by '*')");
 }
 
 
@@ -552,6 +650,10 @@ void upsdrv_initups(void)
 	snprintf(buf, sizeof(buf), "%s.status", val);
 	prefix.status = xstrdup(buf);
 
+	snprintf(buf, sizeof(buf), "ups.status %s %s %s",
+		prefix.delay.shutdown, prefix.timer.shutdown, prefix.status);
+	subscribe_init(buf);
+
 	extrafd = upsfd = sstate_connect();
 }
 
@@ -563,4 +665,9 @@ void upsdrv_cleanup(void)
 	free(prefix.status);
 
 	sstate_disconnect();
+
+	shmstate_close(shm);
+	shm = NULL;
+	free(subscribe);
+	subscribe = NULL;
 }
@@ -25,6 +25,7 @@
 #include "parseconf.h"
 #include "attribute.h"
 #include "nut_stdint.h"
+#include "shmstate.h"
 
 #include <sys/types.h>
 #ifndef WIN32
@@ -33,7 +34,7 @@
 #endif
 
 #define DRIVER_NAME	"Clone UPS driver"
-#define DRIVER_VERSION	"0.07"
+#define DRIVER_VERSION	"0.08"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -67,6 +68,8 @@ static int	dumpdone = 0, online = 1, outlet = 1;
 static long	offdelay = 120, ondelay = 30;
 
 static PCONF_CTX_t	sock_ctx;
+static char	*subscribe = NULL;	/* "SUBSCRIBE ..." line, see subscribe_init() */
+static shmstate_t	*shm = NULL;	/* values exported by the driver, if it does */
 static time_t	last_poll = 0, last_heard = 0, last_ping = 0;
 
 #ifndef WIN32
@@ -80,6 +83,37 @@ static OVERLAPPED	read_overlapped;
 static int instcmd(const char *cmdname, const char *extra);
 
 
+static int sstate_sendline(const char *buf);
+
+/* the value of var in the slot named by a SHMSET line, from the state
+ * table shared by the driver; returns 0 if there is none to take */
+static int sstate_shmget(const char *var, const char *slotstr, char *val, size_t valsize)
+{
+	char	cmd[SMALLBUF];
+	long	slot;
+
+	if (!str_to_long(slotstr, &slot, 10)) {
+		return 0;
+	}
+
+	switch (shmstate_get(shm, slot, var, val, valsize))
+	{
+		case 1:
+			return 1;
+
+		case 0:
+			/* slot got reused: the variable was deleted meanwhile,
+			 * and its DELINFO is right behind this line */
+			return 0;
+
+		default:
+			/* the driver kept rewriting it - ask for it as text */
+			snprintf(cmd, sizeof(cmd), "DUMPVALUE %s\n", var);
+			sstate_sendline(cmd);
+			return 0;
+	}
+}
+
 static int parse_args(size_t numargs, char **arg)
 {
 	if (numargs < 1) {
@@ -121,8 +155,18 @@ static int parse_args(size_t numargs, char **arg)
 		goto skip_out;
 	}
 
-	/* SETINFO <varname> <value> */
-	if (!strcasecmp(arg[0], "SETINFO")) {
+	/* SETINFO <varname> <value>, or SHMSET <varname> <slot>
+	 * with the value in the state table shared by the driver */
+	if (!strcasecmp(arg[0], "SETINFO") || !strcasecmp(arg[0], "SHMSET")) {
+		char	shmval[ST_MAX_VALUE_LEN];
+		const char	*val = arg[2];
+
+		if (!strcasecmp(arg[0], "SHMSET")) {
+			if (!sstate_shmget(arg[1], arg[2], shmval, sizeof(shmval))) {
+				return 1;
+			}
+			val = shmval;
+		}
 
 		if (!strncasecmp(arg[1], "driver.", 7) ||
 				!strcasecmp(arg[1], "battery.charge.low") ||
@@ -134,7 +178,7 @@ static int parse_args(size_t numargs, char **arg)
 		}
 
 		if (!strcasecmp(arg[1], "ups.status")) {
-			snprintf(ups.status, sizeof(ups.status), "%s", arg[2]);
+			snprintf(ups.status, sizeof(ups.status), "%s", val);
 
 			online = strstr(ups.status, "OL") ? 1 : 0;
 
@@ -145,7 +189,7 @@ static int parse_args(size_t numargs, char **arg)
 		}
 
 		if (!strcasecmp(arg[1], "battery.charge")) {
-			battery.charge.act = strtod(arg[2], NULL);
+			battery.charge.act = strtod(val, NULL);
 
 			dstate_setinfo("battery.charge.low", "%g", battery.charge.low);
 			dstate_setflags("battery.charge.low", ST_FLAG_RW | ST_FLAG_STRING);
@@ -153,14 +197,14 @@ static int parse_args(size_t numargs, char **arg)
 		}
 
 		if (!strcasecmp(arg[1], "battery.runtime")) {
-			battery.runtime.act = strtod(arg[2], NULL);
+			battery.runtime.act = strtod(val, NULL);
 
 			dstate_setinfo("battery.runtime.low", "%g", battery.runtime.low);
 			dstate_setflags("battery.runtime.low", ST_FLAG_RW | ST_FLAG_STRING);
 			dstate_setaux("battery.runtime.low", 4);
 		}
 
-		dstate_setinfo(arg[1], "%s", arg[2]);
+		dstate_setinfo(arg[1], "%s", val);
 		return 1;
 	}
 
@@ -186,10 +230,47 @@ skip_out:
 }
 
 
+/* "SUBSCRIBE" line asking the driver for only some of its variables,
+ * when the "subscribe" option lists them: those, and the ones in own
+ * which this driver looks at itself */
+static void subscribe_init(const char *own)
+{
+	char	buf[LARGEBUF], *list, *pattern;
+	const char	*val = getval("subscribe");
+
+	if (!val) {
+		return;
+	}
+
+	snprintf(buf, sizeof(buf), "SUBSCRIBE %s", own);
+
+	list = xstrdup(val);
+	for (pattern = strtok(list, ", "); pattern; pattern = strtok(NULL, ", ")) {
+		snprintfcat(buf, sizeof(buf), " %s", pattern);
+	}
+	free(list);
+
+	snprintfcat(buf, sizeof(buf), "\n");
+	subscribe = xstrdup(buf);
+}
+
+
+/* what to send upon (re)connecting to the driver */
+static const char *sstate_dumpcmd(void)
+{
+	static char	buf[LARGEBUF + SMALLBUF];
+
+	snprintf(buf, sizeof(buf), "%s%sDUMPALL\n",
+		subscribe ? subscribe : "", shm ? "SHMSTATE\n" : "");
+
+	return buf;
+}
+
+
 static TYPE_FD sstate_connect(void)
 {
 	TYPE_FD	fd;
-	const char	*dumpcmd = "DUMPALL\n";
+	const char	*dumpcmd;
 
 #ifndef WIN32
 	ssize_t	ret;
@@ -257,7 +338,21 @@ static TYPE_FD sstate_connect(void)
 		return ERROR_FD;
 	}
 
+	/* a driver exporting its values next to the socket will only send
+	 * their slots if we ask first; see shmstate.h */
+	{ /* scoping */
+		char	shmfn[SMALLBUF];
+
+		shmstate_close(shm);
+
+		snprintf(shmfn, sizeof(shmfn), "%s%s", sa.sun_path, SHMSTATE_SUFFIX);
+		if ((shm = shmstate_open(shmfn)) != NULL) {
+			upsdebugx(2, "UPS [%s] exports its values in %s", device_path, shmfn);
+		}
+	}
+
 	/* get a dump started so we have a fresh set of data */
+	dumpcmd = sstate_dumpcmd();
 	ret = write(fd, dumpcmd, strlen(dumpcmd));
 
 	if (ret != (int)strlen(dumpcmd)) {
@@ -297,6 +392,8 @@ static TYPE_FD sstate_connect(void)
 	/* get a dump started so we have a fresh set of data */
 	DWORD bytesWritten = 0;
 
+	dumpcmd = sstate_dumpcmd();
+
 	result = WriteFile (fd,dumpcmd,strlen(dumpcmd),&bytesWritten,NULL);
 	if (result == 0 || bytesWritten != strlen(dumpcmd)) {
 		upslog_with_errno(LOG_ERR, "Initial write to UPS [%s] failed", device_path);
@@ -686,11 +783,20 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, "load.off", "Command to switch off outlet");
 	addvar(VAR_VALUE, "load.on", "Command to switch on outlet");
 	addvar(VAR_VALUE, "load.status", "Variable that indicates outlet is on/off");
+
+	addvar(VAR_VALUE, "subscribe", "Get only these variables of the UPS (comma-separated names, or beginnings of names followed by '*')");
 }
 
 
 void upsdrv_initups(void)
 {
+	char	own[SMALLBUF];
+	const char	*val = getval("load.status");
+
+	snprintf(own, sizeof(own), "ups.status battery.charge battery.runtime%s%s",
+		val ? " " : "", val ? val : "");
+	subscribe_init(own);
+
 	extrafd = upsfd = sstate_connect();
 }
 
@@ -698,4 +804,9 @@ void upsdrv_initups(void)
 void upsdrv_cleanup(void)
 {
 	sstate_disconnect();
+
+	shmstate_close(shm);
+	shm = NULL;
+	free(subscribe);
+	subscribe = NULL;
 }
@@ -174,7 +174,7 @@ static info_lkp_t cpqpower_outlet_switchability_info[] = {
 
 /* Snmp2NUT lookup table */
 
-static snmp_info_t cpqpower_mib[] = {
+static const snmp_info_t cpqpower_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
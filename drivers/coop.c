@@ -0,0 +1,320 @@
+/* coop.c - cooperative tasks for the device I/O of drivers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Drivers talk to their device as a sequence of blocking steps: send a
+ * question, wait for the answer (with a timeout), parse it, go on with
+ * the next one.  While one of them waits, the process does nothing else:
+ * not even answer upsd on the driver socket, nor talk to the other
+ * devices it may host.
+ *
+ * Rather than rewriting each driver as a state machine, its updates may
+ * run in a task with a stack of its own: when the serial helpers (or the
+ * driver itself) would wait for the device, coop_wait() goes back to the
+ * main loop, which adds that fd and deadline to its poll() and resumes
+ * the task when either comes.  The driver code does not change, only the
+ * state it keeps must be per device (see addhostvars() in main.h) if the
+ * process runs several, as their updates now overlap.
+ *
+ * This uses the ucontext functions, where there are any; elsewhere a task
+ * is just a function call, and coop_wait() blocks as before. */
+
+#include "config.h"  /* must be the first header */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef WIN32
+# include <poll.h>
+#endif
+
+#if defined(HAVE_UCONTEXT_H) && defined(HAVE_SWAPCONTEXT) && !defined(WIN32) && !defined(__APPLE__)
+# include <ucontext.h>
+# define COOP_TASKS	1
+# if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#  include <sys/mman.h>
+# endif
+#endif
+
+#include "common.h"
+#include "coop.h"
+
+struct coop_task_s {
+#ifdef COOP_TASKS
+	ucontext_t	ctx;	/* of the task, while the caller runs */
+	ucontext_t	caller;	/* of coop_run() or coop_resume(), while the task runs */
+	void	*stack;
+	size_t	stacksize;
+#endif
+	void	(*fn)(void *);
+	void	*arg;
+	int	state;	/* COOP_DONE or COOP_WAITING */
+	int	fd;	/* what it waits for */
+	struct timeval	deadline;
+	int	forever;	/* no deadline */
+};
+
+/* the task running now, if any */
+static coop_task_t	*coop_current = NULL;
+
+#ifdef COOP_TASKS
+/* makecontext() only passes ints, so the task is taken from here */
+static void coop_main(void)
+{
+	coop_task_t	*task = coop_current;
+
+	task->fn(task->arg);
+	task->state = COOP_DONE;
+
+	/* back to coop_run() or coop_resume(), through uc_link */
+}
+
+static void *coop_stack_alloc(size_t size)
+{
+# if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+	/* only the pages the task touches take memory */
+	void	*stack = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return (stack == MAP_FAILED) ? NULL : stack;
+# else
+	return malloc(size);
+# endif
+}
+
+static void coop_stack_free(void *stack, size_t size)
+{
+# if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+	munmap(stack, size);
+# else
+	NUT_UNUSED_VARIABLE(size);
+	free(stack);
+# endif
+}
+#endif	/* COOP_TASKS */
+
+coop_task_t *coop_new(void)
+{
+#ifdef COOP_TASKS
+	coop_task_t	*task = xcalloc(1, sizeof(*task));
+
+	task->stacksize = COOP_STACK_SIZE;
+	task->stack = coop_stack_alloc(task->stacksize);
+
+	if (!task->stack) {
+		upslog_with_errno(LOG_WARNING, "%s: can't allocate a task stack", __func__);
+		free(task);
+		return NULL;
+	}
+
+	task->state = COOP_DONE;
+	task->fd = -1;
+
+	return task;
+#else
+	return NULL;
+#endif
+}
+
+void coop_free(coop_task_t *task)
+{
+	/* not the stack we are on, e.g. for an exit() from the task */
+	if (!task || task == coop_current) {
+		return;
+	}
+
+#ifdef COOP_TASKS
+	/* what a task waiting now still had on its stack is dropped */
+	coop_stack_free(task->stack, task->stacksize);
+#endif
+	free(task);
+}
+
+#ifdef COOP_TASKS
+/* switch to task until it waits or returns */
+static int coop_switch(coop_task_t *task)
+{
+	coop_current = task;
+
+	if (swapcontext(&task->caller, &task->ctx) < 0) {
+		fatal_with_errno(EXIT_FAILURE, "%s: swapcontext", __func__);
+	}
+
+	coop_current = NULL;
+
+	return task->state;
+}
+#endif
+
+int coop_run(coop_task_t *task, void (*fn)(void *), void *arg)
+{
+#ifdef COOP_TASKS
+	/* tasks do not nest: one started from a task is just a call */
+	if (task && !coop_current) {
+		if (task->state == COOP_WAITING) {
+			upsdebugx(1, "%s: the task is still waiting", __func__);
+			return COOP_WAITING;
+		}
+
+		task->fn = fn;
+		task->arg = arg;
+		task->fd = -1;
+
+		if (getcontext(&task->ctx) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "%s: getcontext", __func__);
+		}
+
+		task->ctx.uc_stack.ss_sp = task->stack;
+		task->ctx.uc_stack.ss_size = task->stacksize;
+		task->ctx.uc_link = &task->caller;
+		makecontext(&task->ctx, coop_main, 0);
+
+		return coop_switch(task);
+	}
+#else
+	NUT_UNUSED_VARIABLE(task);
+#endif
+
+	fn(arg);
+
+	return COOP_DONE;
+}
+
+int coop_resume(coop_task_t *task)
+{
+#ifdef COOP_TASKS
+	if (task && task->state == COOP_WAITING && !coop_current) {
+		return coop_switch(task);
+	}
+#else
+	NUT_UNUSED_VARIABLE(task);
+#endif
+
+	return COOP_DONE;
+}
+
+int coop_waitfor(const coop_task_t *task, int *fd, struct timeval *deadline)
+{
+	if (!task || task->state != COOP_WAITING) {
+		return 0;
+	}
+
+	*fd = task->fd;
+
+	if (task->forever) {
+		/* a day, then it checks and waits again */
+		gettimeofday(deadline, NULL);
+		deadline->tv_sec += 86400;
+	} else {
+		*deadline = task->deadline;
+	}
+
+	return 1;
+}
+
+int coop_in_task(void)
+{
+	return (coop_current != NULL);
+}
+
+#ifndef WIN32
+/* whether fd has data now, without waiting */
+static int coop_ready(int fd, int timeout_msec)
+{
+	struct pollfd	pfd;
+	int	ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	ret = poll(&pfd, 1, timeout_msec);
+
+	return (ret > 0) ? 1 : ret;
+}
+#endif
+
+int coop_wait(int fd, long timeout_msec)
+{
+#ifdef COOP_TASKS
+	coop_task_t	*task = coop_current;
+
+	if (task) {
+		struct timeval	now;
+
+		task->fd = fd;
+		task->forever = (timeout_msec < 0);
+
+		gettimeofday(&task->deadline, NULL);
+		if (!task->forever) {
+			task->deadline.tv_sec += timeout_msec / 1000;
+			task->deadline.tv_usec += (timeout_msec % 1000) * 1000;
+			if (task->deadline.tv_usec >= 1000000) {
+				task->deadline.tv_sec++;
+				task->deadline.tv_usec -= 1000000;
+			}
+		}
+
+		for (;;) {
+			int	ret;
+
+			task->state = COOP_WAITING;
+
+			if (swapcontext(&task->ctx, &task->caller) < 0) {
+				fatal_with_errno(EXIT_FAILURE, "%s: swapcontext", __func__);
+			}
+
+			/* resumed: the main loop found something, or it is time */
+			if (fd >= 0 && (ret = coop_ready(fd, 0)) != 0) {
+				task->fd = -1;
+				return ret;
+			}
+
+			gettimeofday(&now, NULL);
+			if (!task->forever && (now.tv_sec > task->deadline.tv_sec
+			 || (now.tv_sec == task->deadline.tv_sec && now.tv_usec >= task->deadline.tv_usec))
+			) {
+				task->fd = -1;
+				return 0;
+			}
+		}
+	}
+#endif
+
+#ifndef WIN32
+	if (fd >= 0) {
+		return coop_ready(fd, (timeout_msec < 0 || timeout_msec > INT_MAX) ? -1 : (int)timeout_msec);
+	}
+#endif
+
+	if (timeout_msec >= 0) {
+		usleep((useconds_t)(timeout_msec * 1000));
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+void coop_sleep(long msec)
+{
+	if (msec > 0) {
+		coop_wait(-1, msec);
+	}
+}
@@ -0,0 +1,72 @@
+/* coop.h - cooperative tasks for the device I/O of drivers (see coop.c)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_COOP_H_SEEN
+#define NUT_COOP_H_SEEN 1
+
+#include "timehead.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* the stack of a task: upsdrv_updateinfo() and all it calls run on it */
+#define COOP_STACK_SIZE	(256 * 1024)
+
+/* what coop_run() and coop_resume() return */
+#define COOP_DONE	0	/* the function returned */
+#define COOP_WAITING	1	/* it waits in coop_wait(), see coop_waitfor() */
+
+typedef struct coop_task_s coop_task_t;
+
+/* A task to run functions in, or NULL where tasks are not supported
+ * (the functions are then just called, and coop_wait() blocks) */
+coop_task_t *coop_new(void);
+void coop_free(coop_task_t *task);
+
+/* Call fn(arg) in task, until it returns or waits for something */
+int coop_run(coop_task_t *task, void (*fn)(void *), void *arg);
+
+/* Go on with what task waits for, once coop_waitfor() says it may be
+ * there; the task checks it itself, and waits again if it is not */
+int coop_resume(coop_task_t *task);
+
+/* If task waits: the fd it waits to read from (-1 for none) and until
+ * when at most, and 1; otherwise 0 */
+int coop_waitfor(const coop_task_t *task, int *fd, struct timeval *deadline);
+
+/* 1 when called from a task (coop_wait() then lets the main loop go on) */
+int coop_in_task(void);
+
+/* Wait until fd (-1 for none) has data to read, for up to timeout_msec
+ * (<0 for no limit): outside of a task, with poll(); from a task, by
+ * letting the main loop run until then.  Returns 1 if fd has data, 0 if
+ * the time is up, -1 on error (errno is set). */
+int coop_wait(int fd, long timeout_msec);
+
+/* sleep for msec, or let the main loop run meanwhile from a task */
+void coop_sleep(long msec);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_COOP_H_SEEN */
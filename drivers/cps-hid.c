@@ -59,6 +59,14 @@ static double	battery_scale = 1;
 static int	might_need_battery_scale = 0;
 static int	battery_scale_checked = 0;
 
+/* per device, see addhostvars() */
+static const dstate_hostvar_t cps_hostvars[] = {
+	DSTATE_HOSTVAR(battery_scale),
+	DSTATE_HOSTVAR(might_need_battery_scale),
+	DSTATE_HOSTVAR(battery_scale_checked),
+	DSTATE_HOSTVAR_END
+};
+
 /*! If the ratio of the battery voltage to the nominal battery voltage exceeds
  * this factor, we assume that the battery voltage needs to be scaled by 2/3.
  */
@@ -198,7 +206,7 @@ static usage_tables_t cps_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t cps_hid2nut[] = {
+static const hid_info_t cps_hid2nut[] = {
 #if WITH_UNMAPPED_DATA_POINTS
   { "unmapped.ups.powersummary.rechargeable", 0, 0, "UPS.PowerSummary.Rechargeable", NULL, "%.0f", 0, NULL },
   { "unmapped.ups.powersummary.capacitymode", 0, 0, "UPS.PowerSummary.CapacityMode", NULL, "%.0f", 0, NULL },
@@ -527,4 +535,5 @@ subdriver_t cps_subdriver = {
 	cps_format_mfr,
 	cps_format_serial,
 	cps_fix_report_desc,
+	cps_hostvars,
 };
@@ -167,7 +167,7 @@ static info_lkp_t delta_ups_output_source_info[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t delta_ups_hid2nut[] = {
+static const hid_info_t delta_ups_hid2nut[] = {
 	{ "input.sensitivity", ST_FLAG_RW, 0, "UPS.DeltaCustom.[1].DeltaConfigSensitivity", NULL, "%s", 0, delta_ups_sensitivity_info },
 	{ "input.voltage.nominal", 0, 0, "UPS.PowerSummary.Input.ConfigVoltage", NULL, "%.1f", HU_FLAG_SEMI_STATIC, NULL },
 	{ "input.voltage", 0, 0, "UPS.PowerSummary.Input.Voltage", NULL, "%.1f", HU_FLAG_QUICK_POLL, NULL },
@@ -320,4 +320,5 @@ subdriver_t delta_ups_subdriver = {
 	delta_ups_format_mfr,
 	delta_ups_format_serial,
 	fix_report_desc,
+	NULL,
 };
@@ -64,7 +64,7 @@ static info_lkp_t delta_ups_pwr_info[] = {
 };
 
 /* DELTA_UPS Snmp2NUT lookup table */
-static snmp_info_t delta_ups_mib[] = {
+static const snmp_info_t delta_ups_mib[] = {
 
 	/* Data format:
 	 * snmp_info_default(info_type, info_flags, info_len, OID, dfl, flags, oid2info, setvar),
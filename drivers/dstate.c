@@ -31,6 +31,7 @@
 # include <sys/types.h>
 # include <sys/socket.h>
 # include <sys/un.h>
+# include <poll.h>
 #else
 # include <strings.h>
 # include "wincompat.h"
@@ -39,9 +40,13 @@
 #include "common.h"
 #include "dstate.h"
 #include "state.h"
+#include "shmstate.h"
 #include "parseconf.h"
 #include "attribute.h"
 #include "nut_stdint.h"
+#include "nutstatus.h"
+#include "nuttrace.h"
+#include "nut_usdt.h"
 
 	static TYPE_FD	sockfd = ERROR_FD;
 #ifndef WIN32
@@ -52,9 +57,57 @@
 #endif
 	static int	stale = 1, alarm_active = 0, ignorelb = 0;
 	static char	status_buf[ST_MAX_VALUE_LEN], alarm_buf[ST_MAX_VALUE_LEN];
+	static size_t	status_len = 0;	/* of the text in status_buf */
+	static nut_status_t	status_flags = 0;	/* the standard tokens in it */
 	static st_tree_t	*dtree_root = NULL;
 	static conn_t	*connhead = NULL;
 	static cmdlist_t *cmdhead = NULL;
+	static shmstate_t	*shmstate = NULL;	/* with the "sharedstate" flag */
+	static int	batch_depth = 0;	/* see dstate_begin_batch() */
+	static int	cmds_held = 0;	/* see dstate_hold_commands() */
+	static struct held_cmd_s	*held_head = NULL, *held_tail = NULL;
+	static st_tree_timespec_t	dump_since_floor;	/* see dump_since() */
+
+/* Counters of the hot paths, published as driver.perf.* by
+ * dstate_perf_update() with the "perfstats" flag; device I/O is only
+ * timed then, the rest is cheap enough to count anyway */
+	static int	perf_enabled = 0;
+	static uintmax_t	perf_updates = 0, perf_broadcasts = 0,
+		perf_written = 0, perf_wakeups = 0, perf_io_calls = 0,
+		perf_coalesced = 0;
+	static uintmax_t	perf_histogram[DSTATE_PERF_HISTOGRAM_BUCKETS];
+	static long	perf_update_max = 0;
+	static int	perf_io_depth = 0;	/* see dstate_perf_io_begin() */
+	static struct timeval	perf_io_start;
+	static long	perf_io_usec = 0;	/* since the previous update */
+
+#ifndef WIN32
+/* Persistent poll() registration: the listening socket, the caller's
+ * extra fd and then one slot per connection, added and removed along
+ * with the connhead list, so dstate_poll_fds() does not rebuild a set
+ * on every call and is not limited by FD_SETSIZE */
+# define POLL_SLOT_LISTEN	0
+# define POLL_SLOT_EXTRA	1
+# define POLL_SLOT_CONNS	2
+	static struct pollfd	*pollfds = NULL;
+	static conn_t	**pollconns = NULL;
+	static size_t	pollcount = 0, pollsize = 0;
+
+/* Event sources of the driver (see dstate_addevent()), kept in a list
+ * so they may be registered before dstate_init(); those have a slot
+ * after the connections, with pollevents[] set instead of pollconns[] */
+typedef struct dstate_event_s {
+	int	fd;
+	short	events;
+	dstate_event_handler_t	handler;
+	void	*arg;
+	size_t	pollidx;	/* 0 while not in the poll() array */
+	struct dstate_event_s	*next;
+} dstate_event_t;
+
+	static dstate_event_t	*evhead = NULL;
+	static dstate_event_t	**pollevents = NULL;
+#endif
 
 	struct ups_handler	upsh;
 
@@ -176,8 +229,8 @@ static TYPE_FD sock_open(const char *fn)
 			PIPE_READMODE_BYTE |
 			PIPE_WAIT,
 			PIPE_UNLIMITED_INSTANCES,	/* max. instances */
-			ST_SOCK_BUF_LEN,	/* output buffer size */
-			ST_SOCK_BUF_LEN,	/* input buffer size */
+			DSTATE_PIPE_BUF_LEN,	/* output buffer size */
+			DSTATE_PIPE_BUF_LEN,	/* input buffer size */
 			0,			/* client time-out */
 			NULL);			/* FIXME: default security attribute */
 
@@ -196,55 +249,803 @@ static TYPE_FD sock_open(const char *fn)
 		fatal_with_errno(EXIT_FAILURE, "Can't create event");
 	}
 
-	/* Wait for a connection */
-	ConnectNamedPipe(fd,&connect_overlapped);
-#endif
+	/* Wait for a connection */
+	ConnectNamedPipe(fd,&connect_overlapped);
+#endif
+
+	return fd;
+}
+
+#ifndef WIN32
+static void poll_grow(void)
+{
+	if (pollcount < pollsize) {
+		return;
+	}
+
+	pollsize *= 2;
+	pollfds = xrealloc(pollfds, pollsize * sizeof(*pollfds));
+	pollconns = xrealloc(pollconns, pollsize * sizeof(*pollconns));
+	pollevents = xrealloc(pollevents, pollsize * sizeof(*pollevents));
+}
+
+static void poll_add_event(dstate_event_t *ev)
+{
+	poll_grow();
+
+	pollfds[pollcount].fd = ev->fd;
+	pollfds[pollcount].events = ev->events;
+	pollfds[pollcount].revents = 0;
+	pollconns[pollcount] = NULL;
+	pollevents[pollcount] = ev;
+	ev->pollidx = pollcount++;
+}
+
+static void poll_init(void)
+{
+	dstate_event_t	*ev;
+
+	pollsize = 8;
+	pollfds = xcalloc(pollsize, sizeof(*pollfds));
+	pollconns = xcalloc(pollsize, sizeof(*pollconns));
+	pollevents = xcalloc(pollsize, sizeof(*pollevents));
+
+	pollfds[POLL_SLOT_LISTEN].fd = sockfd;
+	pollfds[POLL_SLOT_LISTEN].events = POLLIN;
+	pollfds[POLL_SLOT_EXTRA].fd = -1;	/* ignored by poll() */
+	pollfds[POLL_SLOT_EXTRA].events = POLLIN;
+	pollcount = POLL_SLOT_CONNS;
+
+	/* those the driver registered in upsdrv_initups() and so on */
+	for (ev = evhead; ev; ev = ev->next) {
+		poll_add_event(ev);
+	}
+}
+
+static void poll_add(conn_t *conn)
+{
+	poll_grow();
+
+	pollfds[pollcount].fd = conn->fd;
+	pollfds[pollcount].events = POLLIN;
+	pollfds[pollcount].revents = 0;
+	pollconns[pollcount] = conn;
+	pollevents[pollcount] = NULL;
+	conn->pollidx = pollcount++;
+}
+
+/* move the last slot into the freed one, see dstate_poll_fds() for why
+ * this is safe while it walks the array */
+static void poll_del_slot(size_t idx)
+{
+	size_t	last = pollcount - 1;
+
+	if (idx != last) {
+		pollfds[idx] = pollfds[last];
+		pollconns[idx] = pollconns[last];
+		pollevents[idx] = pollevents[last];
+
+		if (pollconns[idx]) {
+			pollconns[idx]->pollidx = idx;
+		} else {
+			pollevents[idx]->pollidx = idx;
+		}
+	}
+
+	pollcount--;
+}
+
+static void poll_del(conn_t *conn)
+{
+	size_t	idx = conn->pollidx;
+
+	if (idx < POLL_SLOT_CONNS || idx >= pollcount || pollconns[idx] != conn) {
+		return;
+	}
+
+	poll_del_slot(idx);
+}
+
+static void poll_free(void)
+{
+	dstate_event_t	*ev;
+
+	for (ev = evhead; ev; ev = ev->next) {
+		ev->pollidx = 0;
+	}
+
+	free(pollfds);
+	free(pollconns);
+	free(pollevents);
+	pollfds = NULL;
+	pollconns = NULL;
+	pollevents = NULL;
+	pollcount = pollsize = 0;
+}
+
+int dstate_addevent(int fd, short events, dstate_event_handler_t handler, void *arg)
+{
+	dstate_event_t	*ev;
+
+	if (fd < 0 || !handler) {
+		return -1;
+	}
+
+	for (ev = evhead; ev; ev = ev->next) {
+		if (ev->fd == fd) {
+			upslogx(LOG_WARNING, "%s: fd %d is already registered", __func__, fd);
+			return -1;
+		}
+	}
+
+	ev = xcalloc(1, sizeof(*ev));
+	ev->fd = fd;
+	ev->events = events;
+	ev->handler = handler;
+	ev->arg = arg;
+	ev->next = evhead;
+	evhead = ev;
+
+	/* otherwise poll_init() adds it */
+	if (pollfds) {
+		poll_add_event(ev);
+	}
+
+	upsdebugx(3, "%s: watching fd %d for events 0x%x", __func__, fd, (unsigned int)events);
+	return 0;
+}
+
+void dstate_delevent(int fd)
+{
+	dstate_event_t	**evp, *ev;
+
+	for (evp = &evhead; (ev = *evp) != NULL; evp = &ev->next) {
+		if (ev->fd != fd) {
+			continue;
+		}
+
+		if (ev->pollidx >= POLL_SLOT_CONNS && ev->pollidx < pollcount
+		 && pollevents[ev->pollidx] == ev) {
+			poll_del_slot(ev->pollidx);
+		}
+
+		*evp = ev->next;
+		free(ev);
+		upsdebugx(3, "%s: no longer watching fd %d", __func__, fd);
+		return;
+	}
+}
+
+static void dstate_delevents(void)
+{
+	while (evhead) {
+		dstate_delevent(evhead->fd);
+	}
+}
+
+/* how late (in msec) we woke up for the end of the polling interval */
+void dstate_loop_latency(const struct timeval *deadline)
+{
+	struct timeval	now;
+	long	late;
+
+	gettimeofday(&now, NULL);
+	late = (long)(now.tv_sec - deadline->tv_sec) * 1000
+		+ (long)(now.tv_usec - deadline->tv_usec) / 1000;
+
+	dstate_setinfo("driver.loop.latency", "%ld", (late > 0 ? late : 0));
+}
+#endif
+
+/* replace the SUBSCRIBE patterns of conn (with none: everything) */
+static void conn_subscribe(conn_t *conn, size_t numpatterns, char **patterns)
+{
+	size_t	i;
+
+	for (i = 0; i < conn->numsubscribed; i++) {
+		free(conn->subscribed[i]);
+	}
+	free(conn->subscribed);
+	conn->subscribed = NULL;
+	conn->numsubscribed = 0;
+
+	if (!numpatterns) {
+		return;
+	}
+
+	conn->subscribed = xcalloc(numpatterns, sizeof(*conn->subscribed));
+	for (i = 0; i < numpatterns; i++) {
+		conn->subscribed[conn->numsubscribed++] = xstrdup(patterns[i]);
+	}
+}
+
+/* did conn ask for the variable var (of varlen characters)? A pattern
+ * is either a name, or the start of names followed by a '*' */
+static int conn_subscribed(const conn_t *conn, const char *var, size_t varlen)
+{
+	size_t	i;
+
+	if (!conn->numsubscribed) {
+		return 1;
+	}
+
+	for (i = 0; i < conn->numsubscribed; i++) {
+		const char	*pattern = conn->subscribed[i];
+		size_t	len = strlen(pattern);
+
+		if (len && pattern[len - 1] == '*') {
+			if (varlen >= len - 1 && !strncasecmp(var, pattern, len - 1)) {
+				return 1;
+			}
+		} else if (varlen == len && !strncasecmp(var, pattern, len)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* note that the shared list with id went to conn in this dump;
+ * 0 if it already did */
+static int conn_list_sent(conn_t *conn, size_t id)
+{
+	size_t	i, mask;
+
+	if (conn->listsentcount * 2 >= conn->listsentsize) {
+		size_t	*old = conn->listsent, oldsize = conn->listsentsize;
+
+		conn->listsentsize = (oldsize ? oldsize * 2 : 64);
+		conn->listsent = xcalloc(conn->listsentsize, sizeof(*conn->listsent));
+		conn->listsentcount = 0;
+
+		for (i = 0; i < oldsize; i++) {
+			if (old[i]) {
+				conn_list_sent(conn, old[i]);
+			}
+		}
+		free(old);
+	}
+
+	/* the ids are given in sequence, so they spread well as they are */
+	mask = conn->listsentsize - 1;
+	for (i = id & mask; conn->listsent[i]; i = (i + 1) & mask) {
+		if (conn->listsent[i] == id) {
+			return 0;
+		}
+	}
+
+	conn->listsent[i] = id;
+	conn->listsentcount++;
+
+	return 1;
+}
+
+/* done with a dump (or starting one): the next sends the lists again */
+static void conn_lists_forget(conn_t *conn)
+{
+	free(conn->listsent);
+	conn->listsent = NULL;
+	conn->listsentcount = 0;
+	conn->listsentsize = 0;
+	conn->dumplists = 0;
+}
+
+/* an INSTCMD or SET which came while commands were held */
+typedef struct held_cmd_s {
+	conn_t	*conn;	/* NULL once it disconnected */
+	size_t	numarg;
+	char	**arg;
+	struct held_cmd_s	*next;
+} held_cmd_t;
+
+static void held_cmd_add(conn_t *conn, size_t numarg, char **arg)
+{
+	held_cmd_t	*held = xcalloc(1, sizeof(*held));
+	size_t	i;
+
+	held->conn = conn;
+	held->numarg = numarg;
+	held->arg = xcalloc(numarg, sizeof(*held->arg));
+	for (i = 0; i < numarg; i++)
+		held->arg[i] = xstrdup(arg[i]);
+
+	if (held_tail)
+		held_tail->next = held;
+	else
+		held_head = held;
+	held_tail = held;
+}
+
+static void held_cmd_free(held_cmd_t *held)
+{
+	size_t	i;
+
+	for (i = 0; i < held->numarg; i++)
+		free(held->arg[i]);
+	free(held->arg);
+	free(held);
+}
+
+/* conn is going away: its held commands still run, without a reply */
+static void held_cmd_forget(conn_t *conn)
+{
+	held_cmd_t	*held;
+
+	for (held = held_head; held; held = held->next) {
+		if (held->conn == conn)
+			held->conn = NULL;
+	}
+}
+
+static void sock_disconnect(conn_t *conn)
+{
+#ifndef WIN32
+	upsdebugx(3, "%s: disconnecting socket %d (%" PRIuMAX " bytes written)",
+		__func__, (int)conn->fd, conn->written);
+	poll_del(conn);
+	close(conn->fd);
+#else
+	/* FIXME not sure if this is the right way to close a connection */
+	if( conn->read_overlapped.hEvent != INVALID_HANDLE_VALUE) {
+		CloseHandle(conn->read_overlapped.hEvent);
+		conn->read_overlapped.hEvent = INVALID_HANDLE_VALUE;
+	}
+	if (conn->write_overlapped.hEvent != NULL) {
+		CloseHandle(conn->write_overlapped.hEvent);
+		conn->write_overlapped.hEvent = NULL;
+	}
+	upsdebugx(3, "%s: disconnecting named pipe handle %p", __func__, conn->fd);
+	DisconnectNamedPipe(conn->fd);
+#endif
+
+	upsdebugx(5, "%s: finishing parsing context", __func__);
+	pconf_finish(&conn->ctx);
+	held_cmd_forget(conn);
+
+	upsdebugx(5, "%s: relinking the chain of connections", __func__);
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		connhead = conn->next;
+	}
+
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	} else {
+		/* conntail = conn->prev; */
+	}
+
+	upsdebugx(5, "%s: freeing the conn object", __func__);
+	conn_subscribe(conn, 0, NULL);
+	conn_lists_forget(conn);
+	free(conn->batchbuf);
+	free(conn);
+}
+
+/* have poll() tell us when conn can take more of what it has queued */
+static void conn_pollout(conn_t *conn)
+{
+#ifndef WIN32
+	size_t	idx = conn->pollidx;
+
+	if (idx < POLL_SLOT_CONNS || idx >= pollcount || pollconns[idx] != conn) {
+		return;
+	}
+
+	pollfds[idx].events = POLLIN;
+	if (conn->batchlen || conn->dumping) {
+		pollfds[idx].events |= POLLOUT;
+	}
+#else
+	NUT_UNUSED_VARIABLE(conn);
+#endif
+}
+
+/* the second word of a protocol line (the variable it is about), if any */
+static const char *queue_line_key(const char *line, const char *end, size_t *keylen)
+{
+	const char	*key, *p;
+
+	key = memchr(line, ' ', (size_t)(end - line));
+	if (!key) {
+		return NULL;
+	}
+
+	key++;
+	for (p = key; p < end && *p != ' ' && *p != '\n'; p++);
+
+	*keylen = (size_t)(p - key);
+	return *keylen ? key : NULL;
+}
+
+/* Make the queue of conn shorter by dropping the SETINFO (or SHMSET)
+ * lines which a later one for the same variable makes moot, so that a
+ * listener which can not keep up gets the latest value of each variable
+ * rather than every value it had.  Any other line about that variable in
+ * between (DELINFO, SETFLAGS...) keeps the earlier value, in case it is
+ * needed there.  The first line may have been partly written already,
+ * so it is left alone. */
+static void conn_coalesce(conn_t *conn)
+{
+	struct {
+		const char	*key;
+		size_t	keylen;
+		int	set;	/* a later line sets it */
+	}	*tab;
+	size_t	*lines, nlines = 0, tabsize = 16, i, first, out, dropped = 0;
+	char	*drop;
+	const char	*buf = conn->batchbuf, *end = buf + conn->batchlen, *p;
+
+	p = memchr(buf, '\n', conn->batchlen);
+	if (!p) {
+		return;
+	}
+	first = (size_t)(p + 1 - buf);
+
+	for (p = buf + first; p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++) {
+		nlines++;
+	}
+	nlines++;	/* in case the last one lacks its newline */
+
+	while (tabsize < nlines * 2) {
+		tabsize *= 2;
+	}
+
+	lines = xcalloc(nlines + 1, sizeof(*lines));
+	drop = xcalloc(nlines, 1);
+	tab = xcalloc(tabsize, sizeof(*tab));
+
+	nlines = 0;
+	for (p = buf + first; p < end; nlines++) {
+		const char	*nl = memchr(p, '\n', (size_t)(end - p));
+
+		lines[nlines] = (size_t)(p - buf);
+		p = nl ? nl + 1 : end;
+	}
+	lines[nlines] = conn->batchlen;
+
+	/* from the last line back, so the one kept is the latest */
+	for (i = nlines; i-- > 0; ) {
+		const char	*line = buf + lines[i], *lend = buf + lines[i + 1];
+		const char	*key;
+		size_t	keylen, h;
+		uint32_t	hash = 2166136261U;
+		int	setter;
+
+		key = queue_line_key(line, lend, &keylen);
+		if (!key) {
+			continue;
+		}
+
+		for (p = key; p < key + keylen; p++) {
+			hash = (hash ^ (unsigned char)*p) * 16777619U;
+		}
+
+		for (h = hash & (tabsize - 1); tab[h].key; h = (h + 1) & (tabsize - 1)) {
+			if (tab[h].keylen == keylen && !memcmp(tab[h].key, key, keylen)) {
+				break;
+			}
+		}
+
+		if (!tab[h].key) {
+			tab[h].key = key;
+			tab[h].keylen = keylen;
+		}
+
+		setter = (!strncmp(line, "SETINFO ", 8) || !strncmp(line, "SHMSET ", 7));
+		if (!setter) {
+			tab[h].set = 0;
+		} else if (tab[h].set) {
+			drop[i] = 1;
+			dropped++;
+		} else {
+			tab[h].set = 1;
+		}
+	}
+
+	/* the keys point into the buffer: done with them before it moves */
+	out = first;
+	for (i = 0; i < nlines; i++) {
+		size_t	len = lines[i + 1] - lines[i];
+
+		if (drop[i]) {
+			continue;
+		}
+
+		if (out != lines[i]) {
+			memmove(conn->batchbuf + out, conn->batchbuf + lines[i], len);
+		}
+		out += len;
+	}
+
+	upsdebugx(2, "%s: socket %d is behind, dropped %" PRIuSIZE
+		" superseded values (%" PRIuSIZE " of %" PRIuSIZE " bytes left)",
+		__func__, (int)conn->fd, dropped, out, conn->batchlen);
+
+	perf_coalesced += dropped;
+	conn->batchlen = out;
+
+	free(tab);
+	free(drop);
+	free(lines);
+}
+
+/* queue buf for conn, behind what it already has; returns 0 if the queue
+ * outgrew DSTATE_CONN_QUEUE_MAX even with only the latest value of each
+ * variable in it, in which case the connection was dropped */
+static int conn_queue(conn_t *conn, const char *buf, size_t buflen)
+{
+	if (conn->batchlen + buflen > conn->batchsize) {
+		conn->batchsize = conn->batchlen + buflen;
+		if (conn->batchsize < DSTATE_BATCH_FLUSH_SIZE)
+			conn->batchsize = DSTATE_BATCH_FLUSH_SIZE;
+		conn->batchbuf = xrealloc(conn->batchbuf, conn->batchsize);
+	}
+
+	memcpy(conn->batchbuf + conn->batchlen, buf, buflen);
+	conn->batchlen += buflen;
+
+	if (conn->batchlen > DSTATE_CONN_QUEUE_MAX) {
+		conn_coalesce(conn);
+
+		if (conn->batchlen > DSTATE_CONN_QUEUE_MAX) {
+			upslogx(LOG_WARNING, "%s: socket %d is not reading what it is "
+				"sent (%" PRIuSIZE " bytes queued), disconnecting",
+				__func__, (int)conn->fd, conn->batchlen);
+			sock_disconnect(conn);
+
+			/* TOTHINK: Maybe fallback elsewhere in other cases? */
+			if (do_synchronous == -1) {
+				upsdebugx(0, "%s: synchronous mode was 'auto', "
+					"will try 'on' for next connections",
+					__func__);
+				do_synchronous = 1;
+			}
+
+			dstate_setinfo("driver.parameter.synchronous", "%s",
+				(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
+
+			return 0;
+		}
+	}
+
+	if (batch_depth == 0) {
+		conn_pollout(conn);
+	}
+
+	return 1;
+}
+
+#ifndef WIN32
+/* write as much of the queue of conn as its socket takes now; returns
+ * 0 if that failed, in which case the connection was dropped */
+static int conn_write_some(conn_t *conn)
+{
+	ssize_t	ret;
+
+	if (!conn->batchlen) {
+		return 1;
+	}
+
+	ret = write(conn->fd, conn->batchbuf, conn->batchlen);
+
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return 1;
+	}
+
+	if (ret < 1) {
+		upsdebug_with_errno(1, "%s: write %" PRIuSIZE " bytes to socket %d "
+			"failed, disconnecting", __func__, conn->batchlen, (int)conn->fd);
+		sock_disconnect(conn);
+		return 0;
+	}
+
+	upsdebugx(6, "%s: wrote %" PRIiSIZE " of %" PRIuSIZE " queued bytes to socket %d",
+		__func__, ret, conn->batchlen, (int)conn->fd);
+
+	conn->written += (size_t)ret;
+	perf_written += (size_t)ret;
+
+	conn->batchlen -= (size_t)ret;
+	memmove(conn->batchbuf, conn->batchbuf + ret, conn->batchlen);
+	conn_pollout(conn);
+
+	return 1;
+}
+#else
+/* write to the pipe of conn, waiting for the system to take it all when
+ * the pipe buffer is full (it is opened for overlapped I/O, which a
+ * WriteFile() without an OVERLAPPED may not be used with); returns the
+ * number of bytes written, or -1 */
+static ssize_t conn_write_pipe(conn_t *conn, const char *buf, size_t buflen)
+{
+	DWORD	bytesWritten = 0;
+
+	if (!WriteFile(conn->fd, buf, (DWORD)buflen, &bytesWritten,
+		&conn->write_overlapped)
+	) {
+		if (GetLastError() != ERROR_IO_PENDING
+		 || !GetOverlappedResult(conn->fd, &conn->write_overlapped,
+			&bytesWritten, TRUE)
+		) {
+			return -1;
+		}
+	}
+
+	return (ssize_t)bytesWritten;
+}
+#endif
+
+/* write a buffer to one listener, or queue what its socket does not take
+ * now (behind anything queued already) for dstate_poll_fds() to write as
+ * it does; returns 0 if that failed, in which case the connection was
+ * dropped (and conn is gone) */
+static int send_buf_to_one(conn_t *conn, const char *buf, size_t buflen)
+{
+	ssize_t	ret = 0;
+	size_t	sent = 0;
+
+	if (buflen >= SSIZE_MAX) {
+		/* Can't compare buflen to ret... though should not happen with ST_SOCK_BUF_LEN */
+		upslog_with_errno(LOG_NOTICE, "%s failed: buffered message too large", __func__);
+		return 1;	/* dropped, but the connection is fine */
+	}
+
+#ifndef WIN32
+	if (conn->batchlen || conn->dumping) {
+		return conn_queue(conn, buf, buflen);
+	}
+#endif
+
+	while (sent < buflen) {
+#ifndef WIN32
+		ret = write(conn->fd, buf + sent, buflen - sent);
+#else
+		ret = conn_write_pipe(conn, buf + sent, buflen - sent);
+		if (ret < 0) {
+			upsdebugx(2, "%s: write failed on handle %p, disconnecting", __func__, conn->fd);
+			sock_disconnect(conn);
+			return 0;
+		}
+#endif
+
+		if (ret > 0) {
+			sent += (size_t)ret;
+			continue;
+		}
+
+#ifndef WIN32
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+#endif
+
+		break;
+	}
+
+	conn->written += sent;
+	perf_written += sent;
+
+#ifndef WIN32
+	/* upsd is busy: rather than wait for it, go on with the device */
+	if (sent != buflen && ret < 0 && errno == EAGAIN) {
+		upsdebugx(6, "%s: socket %d is full, queued %" PRIiSIZE " bytes",
+			__func__, (int)conn->fd, buflen - sent);
+		return conn_queue(conn, buf + sent, buflen - sent);
+	}
+#endif
+
+	if (sent != buflen) {
+#ifndef WIN32
+		upsdebug_with_errno(0, "WARNING: %s: write %" PRIiSIZE " bytes to "
+			"socket %d failed (ret=%" PRIiSIZE "), disconnecting.",
+			__func__, buflen - sent, (int)conn->fd, ret);
+#else
+		upsdebug_with_errno(0, "WARNING: %s: write %" PRIiSIZE " bytes to "
+			"handle %p failed (ret=%" PRIiSIZE "), disconnecting.",
+			__func__, buflen - sent, conn->fd, ret);
+#endif
+		upsdebugx(6, "%s: failed write: %s", __func__, buf + sent);
+
+		sock_disconnect(conn);
+		return 0;
+	}
+
+	upsdebugx(6, "%s: write %" PRIiSIZE " bytes to socket %d succeeded: %s",
+		__func__, buflen, conn->fd, buf);
 
-	return fd;
+	return 1;
 }
 
-static void sock_disconnect(conn_t *conn)
+/* send what was collected for conn during a batch; see send_buf_to_one() */
+static int batch_flush(conn_t *conn)
 {
+	if (!conn->batchlen)
+		return 1;
+
+	upsdebugx(5, "%s: sending %" PRIuSIZE " batched bytes", __func__, conn->batchlen);
+
 #ifndef WIN32
-	upsdebugx(3, "%s: disconnecting socket %d", __func__, (int)conn->fd);
-	close(conn->fd);
+	/* as much as the socket takes now, dstate_poll_fds() writes the rest */
+	return conn_write_some(conn);
 #else
-	/* FIXME not sure if this is the right way to close a connection */
-	if( conn->read_overlapped.hEvent != INVALID_HANDLE_VALUE) {
-		CloseHandle(conn->read_overlapped.hEvent);
-		conn->read_overlapped.hEvent = INVALID_HANDLE_VALUE;
-	}
-	upsdebugx(3, "%s: disconnecting named pipe handle %p", __func__, conn->fd);
-	DisconnectNamedPipe(conn->fd);
-#endif
+	if (!send_buf_to_one(conn, conn->batchbuf, conn->batchlen))
+		return 0;
 
-	upsdebugx(5, "%s: finishing parsing context", __func__);
-	pconf_finish(&conn->ctx);
+	conn->batchlen = 0;
+	conn_pollout(conn);
+	return 1;
+#endif
+}
 
-	upsdebugx(5, "%s: relinking the chain of connections", __func__);
-	if (conn->prev) {
-		conn->prev->next = conn->next;
-	} else {
-		connhead = conn->next;
+static void batch_append(conn_t *conn, const char *buf, size_t buflen)
+{
+	if (conn->batchlen + buflen > DSTATE_BATCH_FLUSH_SIZE) {
+		if (!batch_flush(conn))
+			return;
 	}
 
-	if (conn->next) {
-		conn->next->prev = conn->prev;
-	} else {
-		/* conntail = conn->prev; */
+	conn_queue(conn, buf, buflen);
+}
+
+/* send buf to all listeners, or shmbuf (if not NULL) to
+ * those which asked for SHMSET instead of SETINFO lines */
+static void send_buf_to_all(const char *buf, const char *shmbuf)
+{
+	size_t	buflen, shmbuflen, varlen = 0;
+	conn_t	*conn, *cnext;
+	long	sent = 0;
+	const char	*var = NULL;
+	int	havevar = 0;
+
+	buflen = strlen(buf);
+	shmbuflen = (shmbuf ? strlen(shmbuf) : 0);
+	perf_broadcasts++;
+
+	for (conn = connhead; conn; conn = cnext) {
+		const char	*cbuf = buf;
+		size_t	cbuflen = buflen;
+
+		cnext = conn->next;
+		if (conn->nobroadcast)
+			continue;
+
+		/* the variable it is about, found once if anyone SUBSCRIBEd;
+		 * the commands (ADDCMD, DELCMD) go to everyone */
+		if (conn->numsubscribed) {
+			if (!havevar) {
+				havevar = 1;
+				if (strncmp(buf, "ADDCMD ", 7) && strncmp(buf, "DELCMD ", 7)) {
+					var = queue_line_key(buf, buf + buflen, &varlen);
+				}
+			}
+
+			if (var && !conn_subscribed(conn, var, varlen))
+				continue;
+		}
+
+		if (shmbuf && conn->shmstate) {
+			cbuf = shmbuf;
+			cbuflen = shmbuflen;
+		}
+
+		/* behind what is still queued for it, e.g. a DUMPALL */
+		if (batch_depth > 0 || conn->batchlen || conn->dumping) {
+			batch_append(conn, cbuf, cbuflen);
+		} else {
+			send_buf_to_one(conn, cbuf, cbuflen);
+		}
+		sent++;
 	}
 
-	upsdebugx(5, "%s: freeing the conn object", __func__);
-	free(conn);
+	NUT_TRACE_BUF(NUT_TRACE_DSTATE_SEND, sent, buf, buflen);
 }
 
 static void send_to_all(const char *fmt, ...)
 {
-	ssize_t	ret;
+	int	ret;
 	char	buf[ST_SOCK_BUF_LEN];
-	size_t	buflen;
 	va_list	ap;
-	conn_t	*conn, *cnext;
 
 	va_start(ap, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
@@ -267,68 +1068,9 @@ static void send_to_all(const char *fmt, ...)
 		return;
 	}
 
-	if (ret <= INT_MAX)
-		upsdebugx(5, "%s: %.*s", __func__, (int)(ret-1), buf);
-
-	buflen = strlen(buf);
-	if (buflen >= SSIZE_MAX) {
-		/* Can't compare buflen to ret... though should not happen with ST_SOCK_BUF_LEN */
-		upslog_with_errno(LOG_NOTICE, "%s failed: buffered message too large", __func__);
-		return;
-	}
-
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
-		if (conn->nobroadcast)
-			continue;
-
-#ifndef WIN32
-		ret = write(conn->fd, buf, buflen);
-#else
-		DWORD bytesWritten = 0;
-		BOOL  result = FALSE;
-
-		result = WriteFile (conn->fd, buf, buflen, &bytesWritten, NULL);
-		if( result == 0 ) {
-			upsdebugx(2, "%s: write failed on handle %p, disconnecting", __func__, conn->fd);
-			sock_disconnect(conn);
-			continue;
-		}
-		else  {
-			ret = (ssize_t)bytesWritten;
-		}
-#endif
-
-		if ((ret < 1) || (ret != (ssize_t)buflen)) {
-#ifndef WIN32
-			upsdebug_with_errno(0, "WARNING: %s: write %" PRIiSIZE " bytes to "
-				"socket %d failed (ret=%" PRIiSIZE "), disconnecting.",
-				__func__, buflen, (int)conn->fd, ret);
-#else
-			upsdebug_with_errno(0, "WARNING: %s: write %" PRIiSIZE " bytes to "
-				"handle %p failed (ret=%" PRIiSIZE "), disconnecting.",
-				__func__, buflen, conn->fd, ret);
-#endif
-			upsdebugx(6, "%s: failed write: %s", __func__, buf);
-
-			sock_disconnect(conn);
-
-			/* TOTHINK: Maybe fallback elsewhere in other cases? */
-			if (ret < 0 && errno == EAGAIN && do_synchronous == -1) {
-				upsdebugx(0, "%s: synchronous mode was 'auto', "
-					"will try 'on' for next connections",
-					__func__);
-				do_synchronous = 1;
-			}
+	upsdebugx(5, "%s: %.*s", __func__, ret-1, buf);
 
-			dstate_setinfo("driver.parameter.synchronous", "%s",
-				(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
-		} else {
-			upsdebugx(6, "%s: write %" PRIiSIZE " bytes to socket %d succeeded "
-				"(ret=%" PRIiSIZE "): %s",
-				__func__, buflen, conn->fd, ret, buf);
-		}
-	}
+	send_buf_to_all(buf, NULL);
 }
 
 static int send_to_one(conn_t *conn, const char *fmt, ...)
@@ -337,10 +1079,6 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 	va_list	ap;
 	char	buf[ST_SOCK_BUF_LEN];
 	size_t	buflen;
-#ifdef WIN32
-	DWORD bytesWritten = 0;
-	BOOL  result = FALSE;
-#endif
 
 	va_start(ap, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
@@ -374,89 +1112,30 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 	if (ret <= INT_MAX)
 		upsdebugx(5, "%s: %.*s", __func__, (int)(ret-1), buf);
 
-/*
-	upsdebugx(0, "%s: writing %" PRIiSIZE " bytes to socket %d: %s",
-		__func__, buflen, conn->fd, buf);
-*/
-
-#ifndef WIN32
-	ret = write(conn->fd, buf, buflen);
-#else
-	result = WriteFile (conn->fd, buf, buflen, &bytesWritten, NULL);
-	if( result == 0 ) {
-		ret = 0;
+	/* a DUMPALL in progress is sent as the socket takes it */
+	if (conn->dumping) {
+		return conn_queue(conn, buf, buflen);
 	}
-	else  {
-		ret = (ssize_t)bytesWritten;
-	}
-#endif
 
-	if (ret < 0) {
-		/* Hacky bugfix: throttle down for upsd to read that */
-#ifndef WIN32
-		upsdebug_with_errno(1, "%s: had to throttle down to retry "
-			"writing %" PRIiSIZE " bytes to socket %d (ret=%" PRIiSIZE ") : %s",
-			__func__, buflen, (int)conn->fd, ret, buf);
-#else
-		upsdebug_with_errno(1, "%s: had to throttle down to retry "
-			"writing %" PRIiSIZE " bytes to handle %p (ret=%" PRIiSIZE ") : %s",
-			__func__, buflen, conn->fd, ret, buf);
-#endif
-		usleep(200);
-#ifndef WIN32
-		ret = write(conn->fd, buf, buflen);
-#else
-		result = WriteFile (conn->fd, buf, buflen, &bytesWritten, NULL);
-		if( result == 0 ) {
-			ret = 0;
-		}
-		else  {
-			ret = (ssize_t)bytesWritten;
-		}
-#endif
-		if (ret == (ssize_t)buflen) {
-			upsdebugx(1, "%s: throttling down helped", __func__);
+#ifdef WIN32
+	/* ...or here, where nothing tells when the pipe takes more, in
+	 * pieces of DSTATE_BATCH_FLUSH_SIZE rather than a line at a time */
+	if (conn->corked) {
+		if (conn->batchlen + buflen > DSTATE_BATCH_FLUSH_SIZE
+		 && !batch_flush(conn)
+		) {
+			return 0;	/* failed */
 		}
-	}
 
-	if ((ret < 1) || (ret != (ssize_t)buflen)) {
-#ifndef WIN32
-		upsdebug_with_errno(0, "WARNING: %s: write %" PRIiSIZE " bytes to "
-			"socket %d failed (ret=%" PRIiSIZE "), disconnecting.",
-			__func__, buflen, (int)conn->fd, ret);
-#else
-		upsdebug_with_errno(0, "WARNING: %s: write %" PRIiSIZE " bytes to "
-			"handle %p failed (ret=%" PRIiSIZE "), disconnecting.",
-			__func__, buflen, conn->fd, ret);
+		return conn_queue(conn, buf, buflen);
+	}
 #endif
-		upsdebugx(6, "%s: failed write: %s", __func__, buf);
-		sock_disconnect(conn);
-
-		/* TOTHINK: Maybe fallback elsewhere in other cases? */
-		if (ret < 0 && errno == EAGAIN && do_synchronous == -1) {
-			upsdebugx(0, "%s: synchronous mode was 'auto', "
-				"will try 'on' for next connections",
-				__func__);
-			do_synchronous = 1;
-		}
-
-		dstate_setinfo("driver.parameter.synchronous", "%s",
-			(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
 
+	/* keep the order with anything broadcast earlier */
+	if (!batch_flush(conn))
 		return 0;	/* failed */
-	} else {
-#ifndef WIN32
-		upsdebugx(6, "%s: write %" PRIiSIZE " bytes to socket %d succeeded "
-			"(ret=%" PRIiSIZE "): %s",
-			__func__, buflen, conn->fd, ret, buf);
-#else
-		upsdebugx(6, "%s: write %" PRIiSIZE " bytes to handle %p succeeded "
-			"(ret=%" PRIiSIZE "): %s",
-			__func__, buflen, conn->fd, ret, buf);
-#endif
-	}
 
-	return 1;	/* OK */
+	return send_buf_to_one(conn, buf, buflen);
 }
 
 static void sock_connect(TYPE_FD sock)
@@ -512,6 +1191,7 @@ static void sock_connect(TYPE_FD sock)
 
 	conn = (conn_t *)xcalloc(1, sizeof(*conn));
 	conn->fd = fd;
+	poll_add(conn);
 
 #else /* WIN32 */
 
@@ -530,8 +1210,8 @@ static void sock_connect(TYPE_FD sock)
 			PIPE_READMODE_BYTE |
 			PIPE_WAIT,
 			PIPE_UNLIMITED_INSTANCES,	/* max. instances */
-			ST_SOCK_BUF_LEN,	/* output buffer size */
-			ST_SOCK_BUF_LEN,	/* input buffer size */
+			DSTATE_PIPE_BUF_LEN,	/* output buffer size */
+			DSTATE_PIPE_BUF_LEN,	/* input buffer size */
 			0,			/* client time-out */
 			NULL);			/* FIXME: default security attribute */
 
@@ -566,6 +1246,12 @@ static void sock_connect(TYPE_FD sock)
 		fatal_with_errno(EXIT_FAILURE, "Can't create event");
 	}
 
+	/* manual-reset, as GetOverlappedResult() waits for it */
+	conn->write_overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (conn->write_overlapped.hEvent == NULL) {
+		fatal_with_errno(EXIT_FAILURE, "Can't create event");
+	}
+
 	ReadFile (conn->fd, conn->buf,
 		sizeof(conn->buf) - 1, /* -1 to be sure to have a trailling 0 */
 		NULL, &(conn->read_overlapped));
@@ -591,24 +1277,97 @@ static void sock_connect(TYPE_FD sock)
 
 }
 
-static int st_tree_dump_conn_one_node(st_tree_t *node, conn_t *conn)
+/* "ENUMLIST <id> <value>..." (or "RANGELIST <id> <min> <max>...") for
+ * a list which was not sent to conn yet in this dump, in as few lines
+ * as the limits of parseconf on the other side allow */
+static int send_list(conn_t *conn, const st_tree_t *node, int ranges)
+{
+	char	line[ST_SOCK_BUF_LEN];
+	const enum_t	*etmp = node->enum_list;
+	const range_t	*rtmp = node->range_list;
+	size_t	id = state_list_id(ranges ? node->ranges : node->enums);
+	size_t	args = 0;
+
+	if (!conn_list_sent(conn, id)) {
+		return 1;	/* it has it */
+	}
+
+	while (ranges ? (rtmp != NULL) : (etmp != NULL)) {
+		if (!args) {
+			snprintf(line, sizeof(line), "%s %" PRIuSIZE,
+				ranges ? "RANGELIST" : "ENUMLIST", id);
+		}
+
+		if (ranges) {
+			snprintfcat(line, sizeof(line), " %i %i", rtmp->min, rtmp->max);
+			rtmp = rtmp->next;
+			args += 2;
+		} else {
+			snprintfcat(line, sizeof(line), " \"%s\"", etmp->val);
+			etmp = etmp->next;
+			args++;
+		}
+
+		/* room for another value (at most ST_MAX_VALUE_LEN long,
+		 * escaped already) in the line and its arguments? */
+		if (args + 2 + 2 > PCONF_DEFAULT_ARG_LIMIT
+		 || strlen(line) + ST_MAX_VALUE_LEN + 4 > sizeof(line)
+		 || (ranges ? (rtmp == NULL) : (etmp == NULL))
+		) {
+			if (!send_to_one(conn, "%s\n", line)) {
+				return 0;
+			}
+			args = 0;
+		}
+	}
+
+	return 1;
+}
+
+static int st_tree_dump_conn_one_node(st_tree_t *node, conn_t *conn, int use_shm)
 {
 	enum_t	*etmp;
 	range_t	*rtmp;
+	long	slot;
+
+	if (!conn_subscribed(conn, node->var, strlen(node->var))) {
+		return 1;	/* not wanted there */
+	}
+
+	slot = ((use_shm && conn->shmstate) ? shmstate_find(shmstate, node->var) : -1);
 
-	if (!send_to_one(conn, "SETINFO %s \"%s\"\n", node->var, node->val)) {
+	if (slot >= 0) {
+		if (!send_to_one(conn, "SHMSET %s %ld\n", node->var, slot)) {
+			return 0;	/* write failed, bail out */
+		}
+	} else if (!send_to_one(conn, "SETINFO %s \"%s\"\n", node->var, node->val)) {
 		return 0;	/* write failed, bail out */
 	}
 
-	/* send any enums */
-	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+	/* send any enums: once for all the variables with the same, if
+	 * the dump was asked so */
+	if (conn->dumplists && node->enums) {
+		if (!send_list(conn, node, 0)
+		 || !send_to_one(conn, "SETENUMS %s %" PRIuSIZE "\n",
+			node->var, state_list_id(node->enums))
+		) {
+			return 0;
+		}
+	} else for (etmp = node->enum_list; etmp; etmp = etmp->next) {
 		if (!send_to_one(conn, "ADDENUM %s \"%s\"\n", node->var, etmp->val)) {
 			return 0;
 		}
 	}
 
-	/* send any ranges */
-	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+	/* send any ranges, the same way */
+	if (conn->dumplists && node->ranges) {
+		if (!send_list(conn, node, 1)
+		 || !send_to_one(conn, "SETRANGES %s %" PRIuSIZE "\n",
+			node->var, state_list_id(node->ranges))
+		) {
+			return 0;
+		}
+	} else for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
 		if (!send_to_one(conn, "ADDRANGE %s %i %i\n", node->var, rtmp->min, rtmp->max)) {
 			return 0;
 		}
@@ -662,7 +1421,7 @@ static int st_tree_dump_conn(st_tree_t *node, conn_t *conn)
 		}
 	}
 
-	if (!st_tree_dump_conn_one_node(node, conn))
+	if (!st_tree_dump_conn_one_node(node, conn, 1))
 		return 0;	/* one of writes failed, bail out */
 
 	if (node->right) {
@@ -686,11 +1445,144 @@ static int cmd_dump_conn(conn_t *conn)
 }
 
 
+/* "STAMP <token>": everything changed before that token was sent to
+ * conn before this line (or is in the shared state table) */
+static int send_stamp(conn_t *conn)
+{
+	st_tree_timespec_t	now;
+
+	state_get_timestamp(&now);
+	return send_to_one(conn, "STAMP %" PRIuMAX "\n", state_timestamp_token(&now));
+}
+
+#ifndef WIN32
+/* For "DUMPALL SINCE <token>" (a stamp of ours, see GETSTAMP): can the
+ * variables changed since then tell all that changed? Not if something
+ * was deleted since (or we were started since), nor for a token from
+ * the future, e.g. from before a reboot */
+static int dump_since(conn_t *conn, const char *token)
+{
+	st_tree_timespec_t	now;
+	uintmax_t	since;
+	char	*end = NULL;
+
+	errno = 0;
+	since = strtoumax(token, &end, 10);
+	if (!*token || !end || *end || errno || since == 0) {
+		return 0;
+	}
+
+	state_get_timestamp(&now);
+	if (since > state_timestamp_token(&now)
+	 || since <= state_timestamp_token(&dump_since_floor)
+	) {
+		return 0;
+	}
+
+	state_token_timestamp(since, &conn->dumpsince);
+	return 1;
+}
+
+/* Queue the next few variables of a DUMPALL for conn, and the end of
+ * it when there are no more: the main loop gets back to other sockets
+ * (and the device) in between, instead of writing the whole tree at
+ * once. What changes meanwhile is broadcast behind the queued lines,
+ * and the walk goes on after the last variable sent, whatever was
+ * added or removed, so upsd ends up with the current values.
+ * Returns 0 if conn was dropped. */
+static int dump_resume(conn_t *conn)
+{
+	st_tree_t	*node = NULL;
+	size_t	count;
+
+	for (count = 0; count < DSTATE_DUMP_CHUNK_NODES; count++) {
+		if (conn->batchlen >= DSTATE_BATCH_FLUSH_SIZE) {
+			return 1;	/* let the socket take that first */
+		}
+
+		node = state_tree_next(dtree_root, conn->dumpnext);
+		if (!node) {
+			break;
+		}
+
+		conn->dumpnext = node->name;
+
+		/* unchanged since what the client already has */
+		if (conn->dumpdelta
+		 && st_tree_node_compare_timestamp(node, &conn->dumpsince) < 0
+		) {
+			continue;
+		}
+
+		if (!st_tree_dump_conn_one_node(node, conn, 1)) {
+			return 0;
+		}
+	}
+
+	if (node) {
+		return 1;	/* more next time */
+	}
+
+	if (!cmd_dump_conn(conn)) {
+		return 0;
+	}
+
+	if ((stale == 0) && !send_to_one(conn, "DATAOK\n")) {
+		return 0;
+	}
+
+	/* what the client has once it read up to here, for a later
+	 * DUMPALL SINCE (e.g. after a restart of upsd) */
+	if (!send_stamp(conn)) {
+		return 0;
+	}
+
+	send_to_one(conn, "DUMPDONE\n");
+
+	upsdebugx(3, "%s: DUMPALL for socket %d is queued to the end",
+		__func__, (int)conn->fd);
+	conn->dumping = 0;
+	conn->dumpdelta = 0;
+	conn->dumpnext = NULL;
+	conn_lists_forget(conn);
+	conn_pollout(conn);
+
+	return 1;
+}
+#endif
+
 static void send_tracking(conn_t *conn, const char *id, int value)
 {
+	/* a held command whose client has gone since */
+	if (!conn)
+		return;
+
 	send_to_one(conn, "TRACKING %s %i\n", id, value);
 }
 
+static int sock_arg(conn_t *conn, size_t numarg, char **arg);
+
+void dstate_hold_commands(int hold)
+{
+	held_cmd_t	*held;
+
+	cmds_held = hold;
+	if (hold)
+		return;
+
+	/* in the order they came; sock_arg() may hold them again */
+	while (held_head && !cmds_held) {
+		held = held_head;
+		held_head = held->next;
+		if (!held_head)
+			held_tail = NULL;
+
+		upsdebugx(3, "%s: running the held %s", __func__, held->arg[0]);
+		sock_arg(held->conn, held->numarg, held->arg);
+		held_cmd_free(held);
+	}
+}
+
 static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 {
 #ifdef WIN32
@@ -704,6 +1596,8 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 0;
 	}
 
+	NUT_TRACE2(NUT_TRACE_DSTATE_CMD, (long)numarg, 0, arg[0], (numarg > 1 ? arg[1] : NULL));
+
 	if (!strcasecmp(arg[0], "LOGOUT")) {
 		send_to_one(conn, "OK Goodbye\n");
 #ifndef WIN32
@@ -725,6 +1619,46 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 1;
 	}
 
+	if (!strcasecmp(arg[0], "GETSTAMP")) {
+		send_stamp(conn);
+		return 1;
+	}
+
+	/* DUMPALL [SINCE <token>] [SHAREDLISTS] */
+	if (!strcasecmp(arg[0], "DUMPALL")) {
+		size_t	i;
+
+		/* the ids of a dump started over are sent again */
+		conn_lists_forget(conn);
+		for (i = 1; i < numarg; i++) {
+			if (!strcasecmp(arg[i], "SHAREDLISTS")) {
+				conn->dumplists = 1;
+			}
+		}
+	}
+
+#ifndef WIN32
+	if (!strcasecmp(arg[0], "DUMPALL")) {
+		/* (re)start from the first variable, see dump_resume() */
+		conn->dumping = 1;
+		conn->dumpnext = NULL;
+		conn->dumpdelta = (numarg >= 3 && !strcasecmp(arg[1], "SINCE")
+			&& dump_since(conn, arg[2]));
+
+		/* else it gets a full dump, as it can tell by the lack of this */
+		if (conn->dumpdelta && !send_to_one(conn, "DUMPDELTA\n")) {
+			return 1;
+		}
+
+		if (stale == 1) {
+			send_to_one(conn, "DATASTALE\n");
+		}
+
+		dump_resume(conn);
+		return 1;
+	}
+#endif
+
 	if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSTATUS") || (!strcasecmp(arg[0], "DUMPVALUE") && numarg > 1)) {
 		/* first thing: the staleness flag (see also below) */
 		if ((stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
@@ -732,6 +1666,10 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		}
 
 		if (!strcasecmp(arg[0], "DUMPALL")) {
+#ifdef WIN32
+			/* see send_to_one(); flushed with DUMPDONE below */
+			conn->corked = 1;
+#endif
 			if (!st_tree_dump_conn(dtree_root, conn)) {
 				return 1;
 			}
@@ -748,16 +1686,29 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 				upsdebugx(1, "%s: %s was requested but currently no %s is known",
 					__func__, arg[0], NUT_STRARG(varname));
 			} else {
-				if (!st_tree_dump_conn_one_node(sttmp, conn))
+				/* always as text: upsd asks this way
+				 * when it could not read the slot */
+				if (!st_tree_dump_conn_one_node(sttmp, conn, 0))
 					return 1;
 			}
 		}
 
-		if ((stale == 0) && !send_to_one(conn, "DATAOK\n")) {
+		if ((stale == 0) && !send_to_one(conn, "DATAOK\n")) {
+			return 1;
+		}
+
+		if (!strcasecmp(arg[0], "DUMPALL")) {
+			conn_lists_forget(conn);
+		}
+
+		if (!send_to_one(conn, "DUMPDONE\n")) {
 			return 1;
 		}
 
-		send_to_one(conn, "DUMPDONE\n");
+#ifdef WIN32
+		conn->corked = 0;
+		batch_flush(conn);
+#endif
 		return 1;
 	}
 
@@ -779,6 +1730,33 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 1;
 	}
 
+	if (!strcasecmp(arg[0], "SHMSTATE")) {
+		char buf[SMALLBUF];
+#ifndef WIN32
+		snprintf(buf, sizeof(buf), "socket %d", conn->fd);
+#else
+		snprintf(buf, sizeof(buf), "handle %p", conn->fd);
+#endif
+		if (shmstate) {
+			conn->shmstate = 1;
+			upsdebugx(1, "%s: %s requested SHMSET updates",
+				__func__, buf);
+		} else {
+			upsdebugx(1, "%s: %s requested SHMSET updates, "
+				"but the 'sharedstate' flag is not set",
+				__func__, buf);
+		}
+		return 1;
+	}
+
+	/* SUBSCRIBE [<pattern>...] */
+	if (!strcasecmp(arg[0], "SUBSCRIBE")) {
+		conn_subscribe(conn, numarg - 1, arg + 1);
+		upsdebugx(1, "%s: socket %d subscribed to %" PRIuSIZE " pattern(s)",
+			__func__, (int)conn->fd, conn->numsubscribed);
+		return 1;
+	}
+
 	/* BROADCAST <0|1> */
 	if (!strcasecmp(arg[0], "BROADCAST")) {
 		int i;
@@ -804,6 +1782,14 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 0;
 	}
 
+	/* the driver is in the middle of an exchange with the device */
+	if (cmds_held && (!strcasecmp(arg[0], "INSTCMD") || !strcasecmp(arg[0], "SET"))) {
+		upsdebugx(3, "%s: holding %s %s until the update is done",
+			__func__, arg[0], arg[1]);
+		held_cmd_add(conn, numarg, arg);
+		return 1;
+	}
+
 	/* INSTCMD <cmdname> [<cmdparam>] [TRACKING <id>] */
 	if (!strcasecmp(arg[0], "INSTCMD")) {
 		int ret;
@@ -954,7 +1940,7 @@ static void sock_read(conn_t *conn)
 		upsdebugx(2, "%s: read() returned 0; flags=%04X O_NDELAY=%04X", __func__, flags, O_NDELAY);
 		if (flags & O_NDELAY || O_NDELAY == 0) {
 			/* O_NDELAY with zero bytes means nothing to read but
-			 * since read() follows a successful select() with
+			 * since read() follows a successful poll() with
 			 * ready file descriptor, ret shouldn't be 0.
 			 * This may also mean that the counterpart has exited
 			 * and the file descriptor should be reaped.
@@ -1033,9 +2019,17 @@ static void sock_read(conn_t *conn)
 	}
 
 #ifdef WIN32
-	/* Restart async read */
+	/* Restart async read; whether it completes now or later, its event
+	 * is signaled and the next dstate_poll_fds() gets the result */
 	memset(conn->buf,0,sizeof(conn->buf));
-	ReadFile(conn->fd,conn->buf,sizeof(conn->buf)-1,NULL,&(conn->read_overlapped)); /* -1 to be sure to have a trailling 0 */
+	if (!ReadFile(conn->fd,conn->buf,sizeof(conn->buf)-1,NULL,&(conn->read_overlapped)) /* -1 to be sure to have a trailling 0 */
+	 && GetLastError() != ERROR_IO_PENDING
+	) {
+		/* ...unless it failed to start, e.g. upsd went away */
+		upsdebugx(1, "%s: read error %d on handle %p, disconnecting",
+			__func__, (int)GetLastError(), conn->fd);
+		sock_disconnect(conn);
+	}
 #endif
 }
 
@@ -1067,7 +2061,23 @@ static void sock_close(void)
 
 	connhead = NULL;
 	/* conntail = NULL; */
+
+#ifndef WIN32
+	poll_free();
+#endif
+}
+
+#ifndef WIN32
+static void dstate_shm_export(const st_tree_t *node)
+{
+	if (!node)
+		return;
+
+	dstate_shm_export(node->left);
+	shmstate_set(shmstate, node->var, node->raw);
+	dstate_shm_export(node->right);
 }
+#endif
 
 /* interface */
 
@@ -1075,6 +2085,9 @@ char * dstate_init(const char *prog, const char *devname)
 {
 	char	sockname[SMALLBUF];
 
+	/* a DUMPALL SINCE an earlier start can not be answered with changes */
+	state_get_timestamp(&dump_since_floor);
+
 #ifndef WIN32
 	/* do this here for now */
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_STRICT_PROTOTYPES)
@@ -1101,47 +2114,221 @@ char * dstate_init(const char *prog, const char *devname)
 
 #ifndef WIN32
 	upsdebugx(2, "%s: sock %s open on fd %d", __func__, sockname, sockfd);
+	poll_init();
 #else
 	upsdebugx(2, "%s: sock %s open on handle %p", __func__, sockname, sockfd);
 #endif
 
+#ifndef WIN32
+	if (dstate_getinfo("driver.flag.sharedstate")) {
+		char	shmname[SMALLBUF + sizeof(SHMSTATE_SUFFIX)];
+
+		snprintf(shmname, sizeof(shmname), "%s%s", sockname, SHMSTATE_SUFFIX);
+		shmstate = shmstate_create(shmname, SHMSTATE_DEFAULT_SLOTS);
+
+		/* publish what main.c and upsdrv_initinfo() have set so far */
+		if (shmstate)
+			dstate_shm_export(dtree_root);
+	}
+#endif
+
 	/* NOTE: Caller must free this string */
 	return xstrdup(sockname);
 }
 
 /* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
-int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
+#ifndef WIN32
+struct pollfd *dstate_pollfds(TYPE_FD arg_extrafd, size_t *count)
+{
+	pollfds[POLL_SLOT_EXTRA].fd = (VALID_FD(arg_extrafd) ? arg_extrafd : -1);
+	*count = pollcount;
+
+	return pollfds;
+}
+
+/* handle what poll() found on the slots; with clients_only, the event
+ * sources are left alone (for the next poll() of the main loop), and the
+ * return value tells if any client sent something */
+static int poll_handle(TYPE_FD arg_extrafd, int clients_only)
 {
-	int	maxfd = 0; /* Unidiomatic use vs. "sockfd" below, which is "int" on non-WIN32 */
-	int	overrun = 0;
 	conn_t	*conn, *cnext;
-	struct timeval	now;
+	int	extra_ready, clients_read = 0;
+	size_t	i;
 
-#ifndef WIN32
-	int	ret;
-	fd_set	rfds;
+	if (!clients_only)
+		perf_wakeups++;
 
-	FD_ZERO(&rfds);
-	FD_SET(sockfd, &rfds);
+	/* sock_connect() and sock_disconnect() below may move slots around */
+	extra_ready = (VALID_FD(arg_extrafd)
+		&& (pollfds[POLL_SLOT_EXTRA].revents & (POLLIN | POLLHUP | POLLERR)));
 
-	maxfd = sockfd;
+	if (pollfds[POLL_SLOT_LISTEN].revents & POLLIN) {
+		sock_connect(sockfd);
+	}
 
-	if (VALID_FD(arg_extrafd)) {
-		FD_SET(arg_extrafd, &rfds);
+	/* Walk backwards: a connection dropped while we handle another one
+	 * only gets its slot filled from the end, which we have already
+	 * visited, and whose revents we clear before handling it */
+	for (i = pollcount; i-- > POLL_SLOT_CONNS; ) {
+		short	revents;
+
+		if (i >= pollcount) {
+			continue;	/* several connections were dropped */
+		}
+
+		revents = pollfds[i].revents;
+		pollfds[i].revents = 0;
+
+		if (!revents) {
+			continue;
+		}
+
+		if (!pollconns[i]) {
+			dstate_event_t	*ev = pollevents[i];
+
+			if (clients_only) {
+				continue;
+			}
+
+			/* a closed fd would wake every poll() up, drop it */
+			if (revents & POLLNVAL) {
+				upslogx(LOG_WARNING, "%s: event fd %d was closed",
+					__func__, ev->fd);
+				dstate_delevent(ev->fd);
+			} else if (ev->handler(ev->fd, revents, ev->arg) > 0) {
+				extra_ready = 1;
+			}
+		} else if (revents & POLLNVAL) {
+			sock_disconnect(pollconns[i]);
+		} else {
+			conn = pollconns[i];
+
+			if (revents & POLLOUT) {
+				if (!conn_write_some(conn)) {
+					continue;
+				}
+
+				if (conn->dumping && !dump_resume(conn)) {
+					continue;
+				}
+			}
 
-		if (arg_extrafd > maxfd) {
-			maxfd = arg_extrafd;
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				sock_read(conn);
+				clients_read = 1;
+			}
 		}
 	}
 
-	for (conn = connhead; conn; conn = conn->next) {
-		FD_SET(conn->fd, &rfds);
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
 
-		if (conn->fd > maxfd) {
-			maxfd = conn->fd;
+		if (conn->closing) {
+			sock_disconnect(conn);
 		}
 	}
 
+	if (clients_only)
+		return clients_read;
+
+	/* tell the caller if that fd or an event source woke up */
+	return extra_ready;
+}
+
+int dstate_poll_handle(TYPE_FD arg_extrafd)
+{
+	return poll_handle(arg_extrafd, 0);
+}
+
+int dstate_poll_clients(void)
+{
+	static int	busy = 0;
+	int	ret;
+
+	/* not before dstate_init(), and not from a command it is handling */
+	if (!pollfds || busy) {
+		return 0;
+	}
+
+	/* only the socket: the UPS fd and event sources are for the main loop */
+	pollfds[POLL_SLOT_EXTRA].fd = -1;
+
+	ret = poll(pollfds, (nfds_t)pollcount, 0);
+
+	if (ret < 1) {
+		return 0;
+	}
+
+	busy = 1;
+	ret = poll_handle(ERROR_FD, 1);
+	busy = 0;
+
+	return ret;
+}
+
+const dstate_hostvar_t *dstate_hostvars(void)
+{
+	static const dstate_hostvar_t	vars[] = {
+		DSTATE_HOSTVAR(sockfd),
+		DSTATE_HOSTVAR(sockfn),
+		DSTATE_HOSTVAR(stale),
+		DSTATE_HOSTVAR(alarm_active),
+		DSTATE_HOSTVAR(ignorelb),
+		DSTATE_HOSTVAR(status_buf),
+		DSTATE_HOSTVAR(status_len),
+		DSTATE_HOSTVAR(status_flags),
+		DSTATE_HOSTVAR(alarm_buf),
+		DSTATE_HOSTVAR(dtree_root),
+		DSTATE_HOSTVAR(connhead),
+		DSTATE_HOSTVAR(cmdhead),
+		DSTATE_HOSTVAR(shmstate),
+		DSTATE_HOSTVAR(batch_depth),
+		DSTATE_HOSTVAR(cmds_held),
+		DSTATE_HOSTVAR(held_head),
+		DSTATE_HOSTVAR(held_tail),
+		DSTATE_HOSTVAR(dump_since_floor),
+		DSTATE_HOSTVAR(pollfds),
+		DSTATE_HOSTVAR(pollconns),
+		DSTATE_HOSTVAR(pollevents),
+		DSTATE_HOSTVAR(evhead),
+		DSTATE_HOSTVAR(perf_enabled),
+		DSTATE_HOSTVAR(perf_updates),
+		DSTATE_HOSTVAR(perf_broadcasts),
+		DSTATE_HOSTVAR(perf_written),
+		DSTATE_HOSTVAR(perf_coalesced),
+		DSTATE_HOSTVAR(perf_wakeups),
+		DSTATE_HOSTVAR(perf_io_calls),
+		DSTATE_HOSTVAR(perf_histogram),
+		DSTATE_HOSTVAR(perf_update_max),
+		DSTATE_HOSTVAR(perf_io_depth),
+		DSTATE_HOSTVAR(perf_io_start),
+		DSTATE_HOSTVAR(perf_io_usec),
+		DSTATE_HOSTVAR(pollcount),
+		DSTATE_HOSTVAR(pollsize),
+		DSTATE_HOSTVAR(upsh),
+		DSTATE_HOSTVAR_END
+	};
+
+	return vars;
+}
+#else	/* WIN32 */
+
+int dstate_poll_clients(void)
+{
+	/* FIXME: the named pipes are only serviced by dstate_poll_fds() */
+	return 0;
+}
+#endif	/* WIN32 */
+
+int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
+{
+	int	overrun = 0;
+	struct timeval	now;
+
+#ifndef WIN32
+	int	ret, timeout_ms;
+	struct timeval	deadline = timeout;
+
 	gettimeofday(&now, NULL);
 
 	/* number of microseconds should always be positive */
@@ -1159,9 +2346,15 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		timeout.tv_usec -= now.tv_usec;
 	}
 
-	ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+	/* round up, so we do not wake up just short of the deadline */
+	timeout_ms = (int)(timeout.tv_sec * 1000) + (int)((timeout.tv_usec + 999) / 1000);
+
+	pollfds[POLL_SLOT_EXTRA].fd = (VALID_FD(arg_extrafd) ? arg_extrafd : -1);
+
+	ret = poll(pollfds, (nfds_t)pollcount, timeout_ms);
 
 	if (ret == 0) {
+		dstate_loop_latency(&deadline);
 		return 1;	/* timer expired */
 	}
 
@@ -1174,42 +2367,23 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 			break;
 
 		default:
-			upslog_with_errno(LOG_ERR, "%s: select unix sockets failed", __func__);
+			upslog_with_errno(LOG_ERR, "%s: poll unix sockets failed", __func__);
 		}
 
 		return overrun;
 	}
 
-	if (FD_ISSET(sockfd, &rfds)) {
-		sock_connect(sockfd);
-	}
-
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
-
-		if (FD_ISSET(conn->fd, &rfds)) {
-			sock_read(conn);
-		}
-	}
-
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
-
-		if (conn->closing) {
-			sock_disconnect(conn);
-		}
-	}
-
-	/* tell the caller if that fd woke up */
-	if (VALID_FD(arg_extrafd) && (FD_ISSET(arg_extrafd, &rfds))) {
-		return 1;
+	if (dstate_poll_handle(arg_extrafd)) {
+		return 1;	/* extrafd has data, or an event source asks for an update */
 	}
 
 #else /* WIN32 */
 
+	int	maxfd = 0;
 	DWORD	ret;
 	HANDLE	rfds[32];
 	DWORD	timeout_ms;
+	conn_t	*conn, *cnext;
 
 	/* FIXME: Should such table (and limit) be used in reality? */
 	NUT_UNUSED_VARIABLE(arg_extrafd);
@@ -1304,10 +2478,44 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
  * COMMON
  ******************************************************************/
 
+/* tell the clients about the new value of a node: the line is put
+ * together from the lengths known, the value (vallen bytes) is not
+ * formatted again */
+static void dstate_send_setinfo(const st_tree_t *node, const char *value, size_t vallen)
+{
+	char	buf[ST_SOCK_BUF_LEN], shmbuf[ST_SOCK_BUF_LEN];
+	long	slot = shmstate_set(shmstate, node->var, node->raw);
+	size_t	varlen = strlen(node->var), len = 0;
+
+	if (sizeof("SETINFO  \"\"\n") + varlen + vallen <= sizeof(buf)) {
+		memcpy(buf, "SETINFO ", 8);
+		len = 8;
+		memcpy(buf + len, node->var, varlen);
+		len += varlen;
+		memcpy(buf + len, " \"", 2);
+		len += 2;
+		memcpy(buf + len, value, vallen);
+		len += vallen;
+		memcpy(buf + len, "\"\n", 3);
+	} else {
+		/* cut, as it always was */
+		snprintf(buf, sizeof(buf), "SETINFO %s \"%s\"\n", node->var, value);
+	}
+	upsdebugx(5, "%s: %.*s", __func__, (int)strcspn(buf, "\n"), buf);
+
+	if (slot >= 0) {
+		snprintf(shmbuf, sizeof(shmbuf), "SHMSET %s %ld\n", node->var, slot);
+		send_buf_to_all(buf, shmbuf);
+	} else {
+		send_buf_to_all(buf, NULL);
+	}
+}
+
 int dstate_setinfo(const char *var, const char *fmt, ...)
 {
 	int	ret;
 	char	value[ST_MAX_VALUE_LEN];
+	const st_tree_t	*node;
 	va_list	ap;
 
 	va_start(ap, fmt);
@@ -1329,7 +2537,38 @@ int dstate_setinfo(const char *var, const char *fmt, ...)
 	ret = state_setinfo(&dtree_root, var, value);
 
 	if (ret == 1) {
-		send_to_all("SETINFO %s \"%s\"\n", var, value);
+		/* the escaped value: a quote or backslash in the raw one
+		 * would break the line for upsd */
+		node = state_tree_find(dtree_root, var);
+		dstate_send_setinfo(node, node->val, node->vallen);
+	}
+
+	return ret;
+}
+
+/* Typed setters: drivers which have the number anyway save the
+ * formatting (and comparing) of its text when it did not change */
+int dstate_setinfo_double(const char *var, double value, int precision)
+{
+	int	ret = state_setinfo_double(&dtree_root, var, value, precision);
+	const st_tree_t	*node;
+
+	if (ret == 1) {
+		node = state_tree_find(dtree_root, var);
+		dstate_send_setinfo(node, node->val, node->vallen);
+	}
+
+	return ret;
+}
+
+int dstate_setinfo_long(const char *var, long value)
+{
+	int	ret = state_setinfo_long(&dtree_root, var, value);
+	const st_tree_t	*node;
+
+	if (ret == 1) {
+		node = state_tree_find(dtree_root, var);
+		dstate_send_setinfo(node, node->val, node->vallen);
 	}
 
 	return ret;
@@ -1487,6 +2726,12 @@ const char *dstate_getinfo(const char *var)
 	return state_getinfo(dtree_root, var);
 }
 
+/* the memory taken by the data of this device */
+size_t dstate_bytes(void)
+{
+	return state_tree_bytes(dtree_root);
+}
+
 void dstate_addcmd(const char *cmdname)
 {
 	int	ret;
@@ -1507,6 +2752,8 @@ int dstate_delinfo(const char *var)
 
 	/* update listeners */
 	if (ret == 1) {
+		shmstate_del(shmstate, var);
+		state_get_timestamp(&dump_since_floor);
 		send_to_all("DELINFO %s\n", var);
 	}
 
@@ -1521,6 +2768,8 @@ int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff)
 
 	/* update listeners */
 	if (ret == 1) {
+		shmstate_del(shmstate, var);
+		state_get_timestamp(&dump_since_floor);
 		send_to_all("DELINFO %s\n", var);
 	}
 
@@ -1535,6 +2784,7 @@ int dstate_delenum(const char *var, const char *val)
 
 	/* update listeners */
 	if (ret == 1) {
+		state_get_timestamp(&dump_since_floor);
 		send_to_all("DELENUM %s \"%s\"\n", var, val);
 	}
 
@@ -1549,6 +2799,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 
 	/* update listeners */
 	if (ret == 1) {
+		state_get_timestamp(&dump_since_floor);
 		send_to_all("DELRANGE %s %i %i\n", var, min, max);
 	}
 
@@ -1563,21 +2814,142 @@ int dstate_delcmd(const char *cmd)
 
 	/* update listeners */
 	if (ret == 1) {
+		state_get_timestamp(&dump_since_floor);
 		send_to_all("DELCMD %s\n", cmd);
 	}
 
 	return ret;
 }
 
+/* Collect broadcasts (SETINFO, DATAOK etc.) from now on, and send each
+ * listener what it got with a single write() in dstate_commit_batch()
+ * instead of one per message. Calls may be nested. */
+void dstate_begin_batch(void)
+{
+	batch_depth++;
+}
+
+void dstate_commit_batch(void)
+{
+	conn_t	*conn, *cnext;
+
+	if (batch_depth < 1) {
+		upsdebugx(1, "%s: no batch was started", __func__);
+		return;
+	}
+
+	if (--batch_depth > 0)
+		return;
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+
+		/* those get their queue as the socket takes it */
+		if (conn->dumping) {
+			conn_pollout(conn);
+		} else {
+			batch_flush(conn);
+		}
+	}
+}
+
+void dstate_perf_enable(void)
+{
+	perf_enabled = 1;
+}
+
+/* Bracket a call to the device (serial line, USB, SNMP...): the time
+ * spent there is reported by dstate_perf_update(). Nested calls (e.g.
+ * ser_get_line() reading a char at a time) only count once. */
+void dstate_perf_io_begin(void)
+{
+	if (!perf_enabled || perf_io_depth++ > 0) {
+		return;
+	}
+
+	gettimeofday(&perf_io_start, NULL);
+}
+
+void dstate_perf_io_end(void)
+{
+	struct timeval	now;
+
+	if (!perf_enabled || perf_io_depth < 1 || --perf_io_depth > 0) {
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+	perf_io_usec += (long)(now.tv_sec - perf_io_start.tv_sec) * 1000000
+		+ (long)(now.tv_usec - perf_io_start.tv_usec);
+	perf_io_calls++;
+}
+
+/* count an update which took duration msec, and with the "perfstats"
+ * flag publish the counters; see driver.perf.* in docs/nut-names.txt */
+void dstate_perf_update(long duration)
+{
+	static const long	bounds[DSTATE_PERF_HISTOGRAM_BUCKETS - 1] = { 10, 100, 1000, 10000 };
+	char	histogram[SMALLBUF];
+	size_t	i;
+
+	for (i = 0; i < DSTATE_PERF_HISTOGRAM_BUCKETS - 1 && duration >= bounds[i]; i++)
+		;
+	perf_histogram[i]++;
+	perf_updates++;
+	if (duration > perf_update_max) {
+		perf_update_max = duration;
+	}
+
+	if (!perf_enabled) {
+		return;
+	}
+
+	histogram[0] = '\0';
+	for (i = 0; i < DSTATE_PERF_HISTOGRAM_BUCKETS; i++) {
+		snprintfcat(histogram, sizeof(histogram), "%s%" PRIuMAX,
+			(i ? " " : ""), perf_histogram[i]);
+	}
+
+	dstate_begin_batch();
+	dstate_setinfo("driver.perf.update.count", "%" PRIuMAX, perf_updates);
+	dstate_setinfo_long("driver.perf.update.max", perf_update_max);
+	dstate_setinfo("driver.perf.update.histogram", "%s", histogram);
+	dstate_setinfo_long("driver.perf.io.duration", perf_io_usec / 1000);
+	dstate_setinfo("driver.perf.io.calls", "%" PRIuMAX, perf_io_calls);
+	dstate_setinfo("driver.perf.broadcasts", "%" PRIuMAX, perf_broadcasts);
+	dstate_setinfo("driver.perf.write.bytes", "%" PRIuMAX, perf_written);
+	dstate_setinfo("driver.perf.write.coalesced", "%" PRIuMAX, perf_coalesced);
+	dstate_setinfo("driver.perf.wakeups", "%" PRIuMAX, perf_wakeups);
+	dstate_commit_batch();
+
+	perf_io_usec = 0;
+}
+
 void dstate_free(void)
 {
 	state_infofree(dtree_root);
 	dtree_root = NULL;
 
+	shmstate_close(shmstate);
+	shmstate = NULL;
+
 	state_cmdfree(cmdhead);
 	cmdhead = NULL;
 
+	while (held_head) {
+		held_cmd_t	*held = held_head;
+
+		held_head = held->next;
+		held_cmd_free(held);
+	}
+	held_tail = NULL;
+	cmds_held = 0;
+
 	sock_close();
+
+#ifndef WIN32
+	dstate_delevents();
+#endif
 }
 
 const st_tree_t *dstate_getroot(void)
@@ -1621,6 +2993,20 @@ void status_init(void)
 	}
 
 	memset(status_buf, 0, sizeof(status_buf));
+	status_len = 0;
+	status_flags = 0;
+}
+
+/* the flag of a standard token, spelled exactly as the standard does
+ * (as status_get() was always case-sensitive), or 0 */
+static nut_status_t status_flag(const char *buf, size_t len)
+{
+	nut_status_t	flag = nut_status_flag(buf, len);
+
+	if (flag && strncmp(nut_status_token(flag), buf, len))
+		return 0;
+
+	return flag;
 }
 
 /* check if a status element has been set, return 0 if not, 1 if yes
@@ -1629,30 +3015,54 @@ int status_get(const char *buf)
 {
 	char	*s = NULL;
 	size_t	offset = 0, buflen = 0;
+	nut_status_t	flag;
 
-	if (!buf || !*buf || !*status_buf)
+	if (!buf || !*buf || !status_len)
 		return 0;
 
-	s = strstr(status_buf, buf);
 	buflen = strlen(buf);
 
-	/* not found */
-	if (!s)
+	/* the standard tokens are just a bit */
+	if ((flag = status_flag(buf, buflen)) != 0)
+		return (status_flags & flag) ? 1 : 0;
+
+	if (!(status_flags & NUT_STATUS_OTHER) && !strchr(buf, ' '))
 		return 0;
 
-	offset = status_buf - s;
-	if (offset == 0 || status_buf[offset - 1] == ' ') {
-		/* We have hit the start of token */
-		if (s[buflen] == '\0' || s[buflen] == ' ') {
-			/* And we have hit the end of token */
+	for (s = strstr(status_buf, buf); s; s = strstr(s + 1, buf)) {
+		offset = (size_t)(s - status_buf);
+		if ((offset == 0 || status_buf[offset - 1] == ' ')
+		 && (s[buflen] == '\0' || s[buflen] == ' ')
+		) {
+			/* We have hit the start and the end of a token */
 			return 1;
 		}
 	}
 
-	/* buf was a substring of some other token */
+	/* buf was only a substring of some other token(s) */
 	return 0;
 }
 
+/* append a token to status_buf, or skip it if it does not fit (rather
+ * than leave a part of it) */
+static void status_append(const char *buf, size_t len, nut_status_t flag)
+{
+	size_t	sep = status_len ? 1 : 0;
+
+	if (status_len + sep + len >= sizeof(status_buf)) {
+		upsdebugx(1, "%s: no room left for status %.*s", __func__, (int)len, buf);
+		return;
+	}
+
+	if (sep)
+		status_buf[status_len++] = ' ';
+
+	memcpy(status_buf + status_len, buf, len);
+	status_len += len;
+	status_buf[status_len] = '\0';
+	status_flags |= (flag ? flag : NUT_STATUS_OTHER);
+}
+
 /* add a status element */
 void status_set(const char *buf)
 {
@@ -1666,40 +3076,53 @@ void status_set(const char *buf)
 		return;
 	}
 
-	/* separate with a space if multiple elements are present */
-	if (strlen(status_buf) > 0) {
-		snprintfcat(status_buf, sizeof(status_buf), " %s", buf);
-	} else {
-		snprintfcat(status_buf, sizeof(status_buf), "%s", buf);
+	/* some drivers set several at once, e.g. "OL BYPASS" */
+	while (*buf) {
+		size_t	len = strcspn(buf, " ");
+		nut_status_t	flag = status_flag(buf, len);
+
+		if (len > 0 && !(flag & status_flags))
+			status_append(buf, len, flag);
+
+		buf += len;
+		while (*buf == ' ')
+			buf++;
 	}
 }
 
-/* write the status_buf into the externally visible dstate storage */
-void status_commit(void)
+/* is battery.<name> below battery.<name>.low? */
+static int status_below_low(const char *name, const char **val, const char **low)
 {
-	while (ignorelb) {
-		const char	*val, *low;
+	char	var[SMALLBUF];
+	long	v, l;
 
-		val = dstate_getinfo("battery.charge");
-		low = dstate_getinfo("battery.charge.low");
+	snprintf(var, sizeof(var), "battery.%s", name);
+	*val = dstate_getinfo(var);
+	snprintfcat(var, sizeof(var), ".low");
+	*low = dstate_getinfo(var);
 
-		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
-			upsdebugx(2, "%s: appending LB flag [charge '%s' below '%s']", __func__, val, low);
-			break;
-		}
+	if (!*val || !*low)
+		return 0;
+
+	str_scan_long(*val, &v);
+	str_scan_long(*low, &l);
+
+	return (v < l);
+}
 
-		val = dstate_getinfo("battery.runtime");
-		low = dstate_getinfo("battery.runtime.low");
+/* write the status_buf into the externally visible dstate storage */
+void status_commit(void)
+{
+	const char	*val, *low;
 
-		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+	if (ignorelb && !(status_flags & NUT_STATUS_LB)) {
+		if (status_below_low("charge", &val, &low)) {
+			status_append("LB", 2, NUT_STATUS_LB);
+			upsdebugx(2, "%s: appending LB flag [charge '%s' below '%s']", __func__, val, low);
+		} else if (status_below_low("runtime", &val, &low)) {
+			status_append("LB", 2, NUT_STATUS_LB);
 			upsdebugx(2, "%s: appending LB flag [runtime '%s' below '%s']", __func__, val, low);
-			break;
 		}
-
-		/* LB condition not detected */
-		break;
 	}
 
 	if (alarm_active) {
@@ -1707,6 +3130,8 @@ void status_commit(void)
 	} else {
 		dstate_setinfo("ups.status", "%s", status_buf);
 	}
+
+	NUT_USDT_STATUS(driver_status, upsname, status_buf);
 }
 
 /* similar handlers for ups.alarm */
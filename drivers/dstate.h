@@ -48,6 +48,8 @@ typedef struct conn_s {
 #ifdef WIN32
 	char    buf[LARGEBUF];
 	OVERLAPPED read_overlapped;
+	OVERLAPPED write_overlapped;
+	int	corked;	/* a DUMPALL is being collected, see send_to_one() */
 #endif
 	PCONF_CTX_t	ctx;
 	struct conn_s	*prev;
@@ -55,6 +57,24 @@ typedef struct conn_s {
 	int	nobroadcast;	/* connections can request to ignore send_to_all() updates */
 	int	readzero;	/* how many times in a row we had zero bytes read; see DSTATE_CONN_READZERO_THROTTLE_USEC and DSTATE_CONN_READZERO_THROTTLE_MAX */
 	int	closing;	/* raised during LOGOUT processing, to close the socket when time is right */
+	int	shmstate;	/* connection asked for SHMSET lines instead of SETINFO (see shmstate.h) */
+	char	**subscribed;	/* patterns of the variables it asked for with SUBSCRIBE (none: all) */
+	size_t	numsubscribed;
+	char	*batchbuf;	/* what is to be written once the batch is committed or the socket takes it */
+	size_t	batchlen;
+	size_t	batchsize;
+	int	dumping;	/* DUMPALL is being sent a few variables at a time */
+	const st_name_t	*dumpnext;	/* ...and the last one sent (NULL before the first) */
+	int	dumpdelta;	/* ...only those changed since dumpsince (DUMPALL SINCE) */
+	st_tree_timespec_t	dumpsince;
+	int	dumplists;	/* ...with shared lists (DUMPALL SHAREDLISTS) */
+	size_t	*listsent;	/* ...hash of the ids of those sent, 0 if empty */
+	size_t	listsentcount;
+	size_t	listsentsize;
+	uintmax_t	written;	/* bytes, for debugging (and driver.perf.*) */
+#ifndef WIN32
+	size_t	pollidx;	/* slot in the poll() array of dstate.c */
+#endif
 } conn_t;
 
 /* sleep after read()ing zero bytes */
@@ -63,6 +83,33 @@ typedef struct conn_s {
 /* close socket after read()ing zero bytes this many times in a row */
 #define DSTATE_CONN_READZERO_THROTTLE_MAX	5
 
+/* send batched broadcasts early when this much has been collected */
+#define DSTATE_BATCH_FLUSH_SIZE	16384
+
+/* size of the named pipe buffers (WIN32): a whole batch fits, so it is
+ * written without waiting for upsd to read a part of it first */
+#define DSTATE_PIPE_BUF_LEN	DSTATE_BATCH_FLUSH_SIZE
+
+/* keep only the latest value of each variable in the queue of a listener
+ * which lets more pile up, and disconnect it if that is still too much */
+#define DSTATE_CONN_QUEUE_MAX	262144
+
+/* how many variables DUMPALL sends before going back to the main loop */
+#define DSTATE_DUMP_CHUNK_NODES	64
+
+/* updates shorter than 10, 100, 1000, 10000 msec, and longer ones */
+#define DSTATE_PERF_HISTOGRAM_BUCKETS	5
+
+/* a variable holding the state of the device which a driver talks to;
+ * see addhostvars() in main.h */
+typedef struct dstate_hostvar_s {
+	void	*addr;
+	size_t	size;
+} dstate_hostvar_t;
+
+#define DSTATE_HOSTVAR(var)	{ (void *)&(var), sizeof(var) }
+#define DSTATE_HOSTVAR_END	{ NULL, 0 }
+
 #include "main.h"	/* for set_exit_flag(); uses conn_t itself */
 
 	extern	struct	ups_handler	upsh;
@@ -73,8 +120,25 @@ typedef struct conn_s {
 
 char * dstate_init(const char *prog, const char *devname);
 int dstate_poll_fds(struct timeval timeout, TYPE_FD extrafd);
+/* Serve the clients of the driver socket which sent something, without
+ * waiting: a driver in a long walk of a slow (e.g. serial) device may
+ * call this between two exchanges with it, so that instant commands and
+ * variable changes do not wait for the end of the walk. The handlers of
+ * these requests run from here, so it must not be called while they may
+ * interfere with an exchange in progress. Returns 1 if any client sent
+ * something (the device state may have changed), 0 otherwise. */
+int dstate_poll_clients(void);
+/* While the driver waits for the device in the middle of an update (see
+ * coop.h), the INSTCMD and SET requests of the clients are kept, and run
+ * in the order they came once it is done (hold is 0 again); the other
+ * requests are answered meanwhile. */
+void dstate_hold_commands(int hold);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
+/* same as dstate_setinfo(var, "%.*f", precision, value) or "%ld", but
+ * nothing is formatted if the number is the same as the last time */
+int dstate_setinfo_double(const char *var, double value, int precision);
+int dstate_setinfo_long(const char *var, long value);
 int dstate_addenum(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 int dstate_addrange(const char *var, const int min, const int max);
@@ -83,12 +147,19 @@ void dstate_addflags(const char *var, const int addflags);
 void dstate_delflags(const char *var, const int delflags);
 void dstate_setaux(const char *var, long aux);
 const char *dstate_getinfo(const char *var);
+size_t dstate_bytes(void);
 void dstate_addcmd(const char *cmdname);
 int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff);
 int dstate_delinfo(const char *var);
 int dstate_delenum(const char *var, const char *val);
 int dstate_delrange(const char *var, const int min, const int max);
 int dstate_delcmd(const char *cmd);
+void dstate_begin_batch(void);
+void dstate_commit_batch(void);
+void dstate_perf_enable(void);
+void dstate_perf_io_begin(void);
+void dstate_perf_io_end(void);
+void dstate_perf_update(long duration);
 void dstate_free(void);
 const st_tree_t *dstate_getroot(void);
 const cmdlist_t *dstate_getcmdlist(void);
@@ -127,4 +198,28 @@ int dstate_detect_phasecount(
 
 void dstate_dump(void);
 
+#ifndef WIN32
+/* For main.c running several devices in one process, with one poll()
+ * for all of them: the poll set of the current device (valid until the
+ * next call into dstate), then the handling of what poll() found there,
+ * which returns 1 if extrafd has data; dstate_poll_fds() does all that
+ * for one device. The variables dstate keeps for the current device
+ * are listed by dstate_hostvars(). */
+struct pollfd;
+struct pollfd *dstate_pollfds(TYPE_FD extrafd, size_t *count);
+int dstate_poll_handle(TYPE_FD extrafd);
+void dstate_loop_latency(const struct timeval *deadline);
+const dstate_hostvar_t *dstate_hostvars(void);
+
+/* Event sources: the driver may have the main loop poll() other fds
+ * of its own (an interrupt endpoint, a GPIO line, a trap socket...),
+ * whose handler is called with the revents poll() found there and
+ * returns 1 to run upsdrv_updateinfo() now instead of waiting for the
+ * end of poll_interval, or 0 if that event needs no update. They may
+ * be added before dstate_init(); dstate_free() drops them all. */
+typedef int (*dstate_event_handler_t)(int fd, short revents, void *arg);
+int dstate_addevent(int fd, short events, dstate_event_handler_t handler, void *arg);
+void dstate_delevent(int fd);
+#endif
+
 #endif	/* DSTATE_H_SEEN */
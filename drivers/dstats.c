@@ -0,0 +1,421 @@
+/* dstats.c - rolling-window statistics of driver variables
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Clients wanting the minimum, maximum or average of a reading over the
+ * last minutes had to poll upsd as often as the driver polls the device,
+ * and keep the history themselves.  The driver sees every reading anyway:
+ * after each update, the variables named with "stats" in ups.conf are
+ * added to a window of samples per time span, and what the window holds
+ * is published as more variables, so a client polling once in a while
+ * still gets the whole picture.
+ *
+ * Each window is a ring of the samples in its span, with their sum, and
+ * the sequence numbers of the candidates for its minimum and maximum in
+ * two more rings (each value in these is smaller, resp. larger, than all
+ * the ones after it in the window): adding or dropping a sample costs
+ * O(1) on average, whatever the length of the window. */
+
+#include "config.h"  /* must be the first header */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "common.h"
+#include "dstate.h"
+#include "dstats.h"
+
+typedef struct {
+	time_t	span;		/* seconds */
+	char	label[24];	/* of the span, in the names: "1m", "90s" */
+
+	/* the samples, at seq & (size - 1); size is a power of two */
+	double	*value;
+	time_t	*when;
+	size_t	size;
+	uint64_t	first, next;	/* seq of the oldest one, and of the next one */
+
+	/* candidates for the minimum and the maximum, oldest first */
+	uint64_t	*minseq, *maxseq;
+	size_t	minfirst, mincount, maxfirst, maxcount;
+
+	double	sum;
+	size_t	dropped;	/* since sum was last made anew */
+} dstats_window_t;
+
+typedef struct {
+	char	*var;
+	int	precision;	/* of the samples */
+	dstats_window_t	win[DSTATS_MAX_WINDOWS];
+} dstats_var_t;
+
+struct dstats_s {
+	dstats_var_t	*vars;
+	size_t	varcount;
+	size_t	wincount;
+};
+
+#define DSTATS_INITIAL_SIZE	16
+
+static void window_init(dstats_window_t *w, time_t span)
+{
+	memset(w, 0, sizeof(*w));
+	w->span = span;
+
+	if (span % 3600 == 0) {
+		snprintf(w->label, sizeof(w->label), "%ldh", (long)(span / 3600));
+	} else if (span % 60 == 0) {
+		snprintf(w->label, sizeof(w->label), "%ldm", (long)(span / 60));
+	} else {
+		snprintf(w->label, sizeof(w->label), "%lds", (long)span);
+	}
+}
+
+static void window_free(dstats_window_t *w)
+{
+	free(w->value);
+	free(w->when);
+	free(w->minseq);
+	free(w->maxseq);
+	memset(w, 0, sizeof(*w));
+}
+
+static size_t window_count(const dstats_window_t *w)
+{
+	return (size_t)(w->next - w->first);
+}
+
+static double window_at(const dstats_window_t *w, uint64_t seq)
+{
+	return w->value[seq & (w->size - 1)];
+}
+
+/* A ring of seq numbers, count of them from first on, in a new one of
+ * size; these stay below the size of the samples, so never wrap there */
+static uint64_t *seq_ring_grow(uint64_t *ring, size_t oldsize, size_t *first, size_t count, size_t size)
+{
+	uint64_t	*grown = xcalloc(size, sizeof(*grown));
+	size_t	i;
+
+	for (i = 0; i < count; i++) {
+		grown[i] = ring[(*first + i) & (oldsize - 1)];
+	}
+
+	free(ring);
+	*first = 0;
+
+	return grown;
+}
+
+/* Twice the room for samples (or a first one) */
+static void window_grow(dstats_window_t *w)
+{
+	size_t	size = w->size ? w->size * 2 : DSTATS_INITIAL_SIZE;
+	double	*value = xcalloc(size, sizeof(*value));
+	time_t	*when = xcalloc(size, sizeof(*when));
+	uint64_t	seq;
+
+	for (seq = w->first; seq < w->next; seq++) {
+		value[seq & (size - 1)] = w->value[seq & (w->size - 1)];
+		when[seq & (size - 1)] = w->when[seq & (w->size - 1)];
+	}
+
+	if (w->size) {
+		w->minseq = seq_ring_grow(w->minseq, w->size, &w->minfirst, w->mincount, size);
+		w->maxseq = seq_ring_grow(w->maxseq, w->size, &w->maxfirst, w->maxcount, size);
+	} else {
+		w->minseq = xcalloc(size, sizeof(*w->minseq));
+		w->maxseq = xcalloc(size, sizeof(*w->maxseq));
+	}
+
+	free(w->value);
+	free(w->when);
+	w->value = value;
+	w->when = when;
+	w->size = size;
+}
+
+/* Drop the samples which are out of the span at now */
+static void window_expire(dstats_window_t *w, time_t now)
+{
+	while (w->first < w->next && w->when[w->first & (w->size - 1)] <= now - w->span) {
+		w->sum -= window_at(w, w->first);
+
+		if (w->mincount && w->minseq[w->minfirst] == w->first) {
+			w->minfirst = (w->minfirst + 1) & (w->size - 1);
+			w->mincount--;
+		}
+		if (w->maxcount && w->maxseq[w->maxfirst] == w->first) {
+			w->maxfirst = (w->maxfirst + 1) & (w->size - 1);
+			w->maxcount--;
+		}
+
+		w->first++;
+		w->dropped++;
+	}
+
+	if (w->first == w->next) {
+		w->sum = 0;
+		w->dropped = 0;
+		return;
+	}
+
+	/* what rounds off the sum as samples come and go adds up: once the
+	 * whole window was replaced, add it up anew */
+	if (w->dropped >= w->size) {
+		uint64_t	seq;
+
+		w->sum = 0;
+		for (seq = w->first; seq < w->next; seq++) {
+			w->sum += window_at(w, seq);
+		}
+		w->dropped = 0;
+	}
+}
+
+static void window_add(dstats_window_t *w, time_t now, double value)
+{
+	size_t	mask;
+
+	window_expire(w, now);
+
+	if (window_count(w) == w->size) {
+		window_grow(w);
+	}
+
+	mask = w->size - 1;
+	w->value[w->next & mask] = value;
+	w->when[w->next & mask] = now;
+	w->sum += value;
+
+	/* the older ones which can't be the minimum (maximum) any more go */
+	while (w->mincount
+	 && window_at(w, w->minseq[(w->minfirst + w->mincount - 1) & mask]) >= value
+	) {
+		w->mincount--;
+	}
+	w->minseq[(w->minfirst + w->mincount++) & mask] = w->next;
+
+	while (w->maxcount
+	 && window_at(w, w->maxseq[(w->maxfirst + w->maxcount - 1) & mask]) <= value
+	) {
+		w->maxcount--;
+	}
+	w->maxseq[(w->maxfirst + w->maxcount++) & mask] = w->next;
+
+	w->next++;
+}
+
+/* Publish what window w of v holds, or drop its variables if nothing */
+static void window_publish(const dstats_var_t *v, const dstats_window_t *w)
+{
+	char	name[ST_MAX_VALUE_LEN];
+	size_t	count = window_count(w);
+	int	avgprec = (v->precision < 3) ? v->precision + 1 : v->precision;
+
+	snprintf(name, sizeof(name), "%s.%s.minimum", v->var, w->label);
+	if (count) {
+		dstate_setinfo_double(name, window_at(w, w->minseq[w->minfirst]), v->precision);
+	} else {
+		dstate_delinfo(name);
+	}
+
+	snprintf(name, sizeof(name), "%s.%s.maximum", v->var, w->label);
+	if (count) {
+		dstate_setinfo_double(name, window_at(w, w->maxseq[w->maxfirst]), v->precision);
+	} else {
+		dstate_delinfo(name);
+	}
+
+	snprintf(name, sizeof(name), "%s.%s.average", v->var, w->label);
+	if (count) {
+		dstate_setinfo_double(name, w->sum / (double)count, avgprec);
+	} else {
+		dstate_delinfo(name);
+	}
+}
+
+/* A value is a number, maybe with decimals (how many: in *precision) */
+static int dstats_parse(const char *val, double *value, int *precision)
+{
+	const char	*dot;
+	char	*end;
+
+	errno = 0;
+	*value = strtod(val, &end);
+
+	if (end == val || errno) {
+		return 0;
+	}
+
+	while (isspace((unsigned char)*end)) {
+		end++;
+	}
+	if (*end) {
+		return 0;
+	}
+
+	*precision = 0;
+	if ((dot = strchr(val, '.')) != NULL) {
+		for (dot++; isdigit((unsigned char)*dot); dot++) {
+			(*precision)++;
+		}
+	}
+
+	return 1;
+}
+
+/* "60", "15m" or "1h", in seconds; 0 if none of these */
+static time_t dstats_parse_window(const char *val)
+{
+	char	*end;
+	long	span;
+
+	errno = 0;
+	span = strtol(val, &end, 10);
+
+	if (end == val || errno || span <= 0) {
+		return 0;
+	}
+
+	if (!strcmp(end, "m")) {
+		span *= 60;
+	} else if (!strcmp(end, "h")) {
+		span *= 3600;
+	} else if (*end && strcmp(end, "s")) {
+		return 0;
+	}
+
+	/* a day, sampled every second, is 86400 doubles per variable */
+	return (span > 86400) ? 0 : (time_t)span;
+}
+
+dstats_t *dstats_new(const char *vars, const char *windows)
+{
+	dstats_t	*stats = xcalloc(1, sizeof(*stats));
+	time_t	spans[DSTATS_MAX_WINDOWS];
+	char	*list, *tok, *last = NULL;
+	size_t	i, j;
+
+	if (!windows || !*windows) {
+		windows = DSTATS_WINDOWS_DEFAULT;
+	}
+
+	list = xstrdup(windows);
+	for (tok = strtok_r(list, ", ", &last); tok; tok = strtok_r(NULL, ", ", &last)) {
+		time_t	span = dstats_parse_window(tok);
+
+		if (!span || stats->wincount == DSTATS_MAX_WINDOWS) {
+			upslogx(LOG_ERR, "%s: window '%s' is not valid, or one too many "
+				"(at most %d, of up to a day)", __func__, tok, DSTATS_MAX_WINDOWS);
+			free(list);
+			dstats_free(stats);
+			return NULL;
+		}
+
+		spans[stats->wincount++] = span;
+	}
+	free(list);
+
+	stats->vars = xcalloc(DSTATS_MAX_VARS, sizeof(*stats->vars));
+
+	list = xstrdup(vars ? vars : "");
+	for (tok = strtok_r(list, ", ", &last); tok; tok = strtok_r(NULL, ", ", &last)) {
+		dstats_var_t	*v;
+
+		if (stats->varcount == DSTATS_MAX_VARS) {
+			upslogx(LOG_ERR, "%s: at most %d variables", __func__, DSTATS_MAX_VARS);
+			free(list);
+			dstats_free(stats);
+			return NULL;
+		}
+
+		v = &stats->vars[stats->varcount++];
+		v->var = xstrdup(tok);
+		for (j = 0; j < stats->wincount; j++) {
+			window_init(&v->win[j], spans[j]);
+		}
+	}
+	free(list);
+
+	if (!stats->varcount || !stats->wincount) {
+		upslogx(LOG_ERR, "%s: no variables or no windows", __func__);
+		dstats_free(stats);
+		return NULL;
+	}
+
+	for (i = 0; i < stats->varcount; i++) {
+		upsdebugx(2, "%s: statistics of %s over %" PRIuSIZE " window(s)",
+			__func__, stats->vars[i].var, stats->wincount);
+	}
+
+	return stats;
+}
+
+void dstats_free(dstats_t *stats)
+{
+	size_t	i, j;
+
+	if (!stats) {
+		return;
+	}
+
+	for (i = 0; i < stats->varcount; i++) {
+		free(stats->vars[i].var);
+		for (j = 0; j < stats->wincount; j++) {
+			window_free(&stats->vars[i].win[j]);
+		}
+	}
+
+	free(stats->vars);
+	free(stats);
+}
+
+void dstats_sample(dstats_t *stats, time_t now)
+{
+	size_t	i, j;
+
+	if (!stats) {
+		return;
+	}
+
+	for (i = 0; i < stats->varcount; i++) {
+		dstats_var_t	*v = &stats->vars[i];
+		const char	*val = dstate_getinfo(v->var);
+		double	value;
+		int	precision;
+
+		/* no sample this time: the windows only get older */
+		if (!val || !dstats_parse(val, &value, &precision)) {
+			for (j = 0; j < stats->wincount; j++) {
+				window_expire(&v->win[j], now);
+				window_publish(v, &v->win[j]);
+			}
+			continue;
+		}
+
+		if (precision > v->precision) {
+			v->precision = precision;
+		}
+
+		for (j = 0; j < stats->wincount; j++) {
+			window_add(&v->win[j], now, value);
+			window_publish(v, &v->win[j]);
+		}
+	}
+}
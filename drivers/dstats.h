@@ -0,0 +1,57 @@
+/* dstats.h - rolling-window statistics of driver variables (see dstats.c)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_DSTATS_H_SEEN
+#define NUT_DSTATS_H_SEEN 1
+
+#include "timehead.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* the windows when ups.conf names none: a minute and a quarter of an hour */
+#define DSTATS_WINDOWS_DEFAULT	"60,900"
+
+/* at most this many variables and windows */
+#define DSTATS_MAX_VARS	32
+#define DSTATS_MAX_WINDOWS	4
+
+typedef struct dstats_s dstats_t;
+
+/* The statistics of the variables named in vars, over each of windows
+ * (both comma-separated lists; a window is a number of seconds, or of
+ * minutes or hours with an "m" or "h" after it).  NULL if a list is
+ * not valid, after saying why. */
+dstats_t *dstats_new(const char *vars, const char *windows);
+void dstats_free(dstats_t *stats);
+
+/* Add the values the variables have now (those which have a number) to
+ * the windows, drop what is older than each window, and publish the
+ * minimum, maximum and average of what is left as <var>.<window>.minimum,
+ * .maximum and .average (e.g. input.voltage.15m.average). */
+void dstats_sample(dstats_t *stats, time_t now);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_DSTATS_H_SEEN */
@@ -39,6 +39,7 @@
 #endif
 
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <string.h>
 
 #include "main.h"
@@ -48,7 +49,7 @@
 #include "dummy-ups.h"
 
 #define DRIVER_NAME	"Device simulation and repeater driver"
-#define DRIVER_VERSION	"0.20"
+#define DRIVER_VERSION	"0.21"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info =
@@ -80,6 +81,11 @@ enum drivermode {
 	 */
 	MODE_DUMMY_ONCE,
 
+	/* use a definition file compiled once into a list of events,
+	 * replayed again and again at a configurable rate (and with
+	 * sub-second TIMER lines), to load upsd and its clients */
+	MODE_DUMMY_BENCH,
+
 	/* use libupsclient to repeat another UPS */
 	MODE_REPEATER,
 
@@ -97,14 +103,45 @@ static struct stat	datafile_stat;
 
 #define MAX_STRING_SIZE	128
 
+/* benchmark mode: the definition file compiled into a list of events */
+typedef enum {
+	BENCH_SET = 0,	/* <varname>: <value> */
+	BENCH_STATUS,	/* ups.status: <flags> */
+	BENCH_TIMER	/* TIMER <seconds> */
+} bench_type_t;
+
+typedef struct {
+	bench_type_t	type;
+	char	*var;
+	char	*value;
+	long	usec;	/* BENCH_TIMER delay */
+	int	published;	/* flags were set by setvar() already */
+	int	random;	/* numeric value varied on each pass */
+	double	base;
+	int	decimals;
+} bench_event_t;
+
+static bench_event_t	*bench_events = NULL;
+static size_t	bench_count = 0, bench_next = 0;
+static long	bench_rate = 0;	/* SETINFO per second, 0 = no limit */
+static long	bench_random = 0;	/* how many numeric variables to vary */
+static struct timeval	bench_due;	/* when the next event is due */
+static struct timeval	bench_mark;	/* start of the current rate report */
+static uintmax_t	bench_sets = 0, bench_window = 0, bench_passes = 0;
+static time_t	bench_lastlog = 0;
+
 static int setvar(const char *varname, const char *val);
 static int instcmd(const char *cmdname, const char *extra);
 static int parse_data_file(TYPE_FD arg_upsfd);
+static void bench_compile(void);
+static void bench_run(void);
+static void bench_free(void);
 static dummy_info_t *find_info(const char *varname);
 static int is_valid_data(const char* varname);
 static int is_valid_value(const char* varname, const char *value);
 /* libupsclient update */
 static int upsclient_update_vars(void);
+static void upsclient_drop_unlisted(const st_tree_timespec_t *start);
 
 /* connection information */
 static char		*client_upsname = NULL, *hostname = NULL;
@@ -114,6 +151,38 @@ static uint16_t	port;
 /* repeater mode parameters */
 static int repeater_disable_strict_start = 0;
 
+/* "LIST VAR <ups> SINCE <token>" state: the token for the next
+ * request, and whether the server understands it at all */
+static char	since_token[SMALLBUF] = "0";
+static int	since_supported = 1;
+
+/* all of the above is per device, so one process can run several */
+static const dstate_hostvar_t	dummy_hostvars[] = {
+	DSTATE_HOSTVAR(mode),
+	DSTATE_HOSTVAR(ctx),
+	DSTATE_HOSTVAR(next_update),
+	DSTATE_HOSTVAR(datafile_stat),
+	DSTATE_HOSTVAR(client_upsname),
+	DSTATE_HOSTVAR(hostname),
+	DSTATE_HOSTVAR(ups),
+	DSTATE_HOSTVAR(port),
+	DSTATE_HOSTVAR(repeater_disable_strict_start),
+	DSTATE_HOSTVAR(since_token),
+	DSTATE_HOSTVAR(since_supported),
+	DSTATE_HOSTVAR(bench_events),
+	DSTATE_HOSTVAR(bench_count),
+	DSTATE_HOSTVAR(bench_next),
+	DSTATE_HOSTVAR(bench_rate),
+	DSTATE_HOSTVAR(bench_random),
+	DSTATE_HOSTVAR(bench_due),
+	DSTATE_HOSTVAR(bench_mark),
+	DSTATE_HOSTVAR(bench_sets),
+	DSTATE_HOSTVAR(bench_window),
+	DSTATE_HOSTVAR(bench_passes),
+	DSTATE_HOSTVAR(bench_lastlog),
+	DSTATE_HOSTVAR_END
+};
+
 /* Driver functions */
 
 void upsdrv_initinfo(void)
@@ -148,6 +217,25 @@ void upsdrv_initinfo(void)
 			dstate_dataok();
 			break;
 
+		case MODE_DUMMY_BENCH:
+			for ( item = nut_data ; item->info_type != NULL ; item++ )
+			{
+				if (item->drv_flags & DU_FLAG_INIT)
+				{
+					dstate_setinfo(item->info_type, "%s", item->default_value);
+					dstate_setflags(item->info_type, item->info_flags);
+
+					if (item->info_flags & ST_FLAG_STRING)
+						dstate_setaux(item->info_type, (long)item->info_len);
+				}
+			}
+
+			bench_compile();
+			upsh.setvar = setvar;
+
+			dstate_dataok();
+			break;
+
 		case MODE_META:
 		case MODE_REPEATER:
 			/* Obtain the target name */
@@ -266,7 +354,15 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1, "upsdrv_updateinfo...");
 
-	sleep(1);
+	if (mode == MODE_DUMMY_BENCH) {
+		bench_run();
+		dstate_dataok();
+		return;
+	}
+
+	/* would hold up all the other devices of this process */
+	if (hosted_devices < 2)
+		sleep(1);
 
 	switch (mode)
 	{
@@ -328,6 +424,10 @@ void upsdrv_updateinfo(void)
 			}
 			break;
 
+		case MODE_DUMMY_BENCH:
+			/* handled above */
+			break;
+
 		case MODE_META:
 		case MODE_REPEATER:
 			if (upsclient_update_vars() > 0)
@@ -336,7 +436,9 @@ void upsdrv_updateinfo(void)
 			}
 			else
 			{
-				/* try to reconnect */
+				/* try to reconnect, tokens of the old connection
+				 * may mean nothing to a restarted server */
+				snprintf(since_token, sizeof(since_token), "0");
 				upscli_disconnect(ups);
 				if (upscli_connect(ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
 				{
@@ -414,8 +516,12 @@ void upsdrv_help(void)
 
 void upsdrv_makevartable(void)
 {
-	addvar(VAR_VALUE,	"mode",	"Specify mode instead of guessing it from port value (dummy = dummy-loop, dummy-once, repeater)"); /* meta */
+	addvar(VAR_VALUE,	"mode",	"Specify mode instead of guessing it from port value (dummy = dummy-loop, dummy-once, dummy-bench, repeater)"); /* meta */
 	addvar(VAR_FLAG,    "repeater_disable_strict_start", "Do not terminate the driver encountering errors when starting the repeater mode");
+	addvar(VAR_VALUE,	"bench_rate",	"SETINFO per second to replay in dummy-bench mode (default: 0 = as fast as possible)");
+	addvar(VAR_VALUE,	"bench_random",	"Number of numeric variables to vary on each pass in dummy-bench mode (default: 0)");
+
+	addhostvars(dummy_hostvars);
 }
 
 void upsdrv_initups(void)
@@ -427,6 +533,7 @@ void upsdrv_initups(void)
 		if (!strcmp(val, "dummy-loop")
 		&&  !strcmp(val, "dummy-once")
 		&&  !strcmp(val, "dummy")
+		&&  !strcmp(val, "dummy-bench")
 		&&  !strcmp(val, "repeater")
 		/* &&  !strcmp(val, "meta") */
 		) {
@@ -461,6 +568,10 @@ void upsdrv_initups(void)
 			if (!strcmp(val, "dummy")) {
 				upsdebugx(2, "Dummy (simulation) mode default (looping infinitely) was explicitly requested");
 				mode = MODE_DUMMY_LOOP;
+			} else
+			if (!strcmp(val, "dummy-bench")) {
+				upsdebugx(2, "Dummy (simulation) benchmark mode was explicitly requested");
+				mode = MODE_DUMMY_BENCH;
 			}
 		}
 
@@ -487,6 +598,11 @@ void upsdrv_initups(void)
 				dstate_setinfo("driver.parameter.mode", "dummy-loop");
 				break;
 
+			case MODE_DUMMY_BENCH:
+				upsdebugx(1, "Dummy (simulation) benchmark mode replaying a compiled sequence");
+				dstate_setinfo("driver.parameter.mode", "dummy-bench");
+				break;
+
 			case MODE_NONE:
 			case MODE_REPEATER:
 			case MODE_META:
@@ -554,6 +670,18 @@ void upsdrv_initups(void)
 	{
 		repeater_disable_strict_start = 1;
 	}
+
+	val = getval("bench_rate");
+	if (val && (!str_to_long(val, &bench_rate, 10) || bench_rate < 0))
+	{
+		fatalx(EXIT_FAILURE, "Invalid bench_rate value: %s", val);
+	}
+
+	val = getval("bench_random");
+	if (val && (!str_to_long(val, &bench_random, 10) || bench_random < 0))
+	{
+		fatalx(EXIT_FAILURE, "Invalid bench_random value: %s", val);
+	}
 }
 
 void upsdrv_cleanup(void)
@@ -575,6 +703,8 @@ void upsdrv_cleanup(void)
 		free(hostname);
 		free(ups);
 	}
+
+	bench_free();
 }
 
 static int setvar(const char *varname, const char *val)
@@ -645,24 +775,54 @@ static int setvar(const char *varname, const char *val)
 
 static int upsclient_update_vars(void)
 {
-	int		ret;
+	int		ret, full = 1;
 	size_t	numq, numa;
 	const char	*query[4];
 	char		**answer;
+	st_tree_timespec_t	start;
 
 	query[0] = "VAR";
 	query[1] = client_upsname;
 	numq = 2;
 
+	/* only ask for what changed since the previous listing */
+	if (since_supported) {
+		query[2] = "SINCE";
+		query[3] = since_token;
+		numq = 4;
+	}
+
+	state_get_timestamp(&start);
 	ret = upscli_list_start(ups, numq, query);
 
+	if (ret < 0 && since_supported
+	 && (upscli_upserror(ups) == UPSCLI_ERR_INVALIDARG
+	  || upscli_upserror(ups) == UPSCLI_ERR_PROTOCOL
+	  || upscli_upserror(ups) == UPSCLI_ERR_UNKCOMMAND
+	  || upscli_upserror(ups) == UPSCLI_ERR_INVLISTTYPE)
+	) {
+		/* an older server: it may be sending a full listing we
+		 * could not follow, so start over on a new connection */
+		upsdebugx(1, "Server does not support delta listings, using full ones");
+		since_supported = 0;
+		numq = 2;
+
+		upscli_disconnect(ups);
+		if (upscli_connect(ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0) {
+			upsdebugx(1, "Error reconnecting: %s", upscli_strerror(ups));
+			return -1;
+		}
+
+		ret = upscli_list_start(ups, numq, query);
+	}
+
 	if (ret < 0)
 	{
 		upsdebugx(1, "Error: %s (%i)", upscli_strerror(ups), upscli_upserror(ups));
 		return ret;
 	}
 
-	while (upscli_list_next(ups, numq, query, &numa, &answer) == 1)
+	while (upscli_list_next(ups, 2, query, &numa, &answer) == 1)
 	{
 		/* VAR <upsname> <varname> <val> */
 		if (numa < 4)
@@ -677,9 +837,72 @@ static int upsclient_update_vars(void)
 		if (strncmp(answer[2], "driver.", 7))
 			setvar(answer[2], answer[3]);
 	}
+
+	if (since_supported) {
+		full = upscli_list_since_token(ups, since_token, sizeof(since_token));
+		if (full < 0) {
+			upsdebugx(1, "No token for delta listings: %s", upscli_strerror(ups));
+			snprintf(since_token, sizeof(since_token), "0");
+			since_supported = 0;
+			full = 1;
+		}
+	}
+
+	/* what a full listing did not mention is gone upstream */
+	if (full)
+		upsclient_drop_unlisted(&start);
+
 	return 1;
 }
 
+/* Remove the variables which were not set since start (but for the
+ * driver collection and device.type, which main.c sets on its own) */
+static void upsclient_drop_unlisted(const st_tree_timespec_t *start)
+{
+	const st_tree_t	*node, *stack[64];
+	char	**gone = NULL;
+	size_t	depth = 0, count = 0, i;
+
+	/* collect first, deleting rebalances the tree */
+	node = dstate_getroot();
+	while (node || depth > 0)
+	{
+		if (node)
+		{
+			if (depth < SIZEOF_ARRAY(stack))
+			{
+				stack[depth++] = node;
+				node = node->left;
+				continue;
+			}
+
+			/* AVL trees are not nearly that deep */
+			break;
+		}
+
+		node = stack[--depth];
+
+		if (strncmp(node->var, "driver.", 7)
+		 && strcmp(node->var, "device.type")
+		 && st_tree_node_compare_timestamp(node, start) < 0)
+		{
+			gone = xrealloc(gone, (count + 1) * sizeof(*gone));
+			gone[count++] = xstrdup(node->var);
+		}
+
+		node = node->right;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		upsdebugx(2, "%s: %s is gone upstream", __func__, gone[i]);
+		dstate_delinfo_olderthan(gone[i], start);
+		free(gone[i]);
+	}
+
+	free(gone);
+}
+
 /* find info element definition in info array */
 static dummy_info_t *find_info(const char *varname)
 {
@@ -865,3 +1088,266 @@ static int parse_data_file(TYPE_FD arg_upsfd)
 	}
 	return 1;
 }
+
+/* for benchmark mode
+ * compile the definition file into bench_events[], once
+ */
+static void bench_compile(void)
+{
+	PCONF_CTX_t	bctx;
+	char	fn[SMALLBUF];
+	char	*ptr, var_value[MAX_STRING_SIZE];
+	size_t	counter, alloc = 0, i;
+	long	randoms = 0;
+	bench_event_t	*ev;
+
+	prepare_filepath(fn, sizeof(fn));
+	pconf_init(&bctx, upsconf_err);
+
+	if (!pconf_file_begin(&bctx, fn))
+		fatalx(EXIT_FAILURE, "Can't open dummy-ups definition file %s: %s",
+			fn, bctx.errmsg);
+
+	while (pconf_file_next(&bctx))
+	{
+		if (pconf_parse_error(&bctx))
+		{
+			upsdebugx(2, "Parse error: %s:%d: %s",
+				fn, bctx.linenum, bctx.errmsg);
+			continue;
+		}
+
+		if (bctx.numargs < 1)
+			continue;
+
+		if (bench_count == alloc)
+		{
+			alloc = alloc ? alloc * 2 : 64;
+			bench_events = xrealloc(bench_events, alloc * sizeof(*bench_events));
+		}
+
+		ev = &bench_events[bench_count];
+		memset(ev, 0, sizeof(*ev));
+
+		/* TIMER <seconds>, which may be fractional here */
+		if (!strncmp(bctx.arglist[0], "TIMER", 5))
+		{
+			double	delay = 0;
+
+			if (bctx.numargs < 2 || !str_to_double(bctx.arglist[1], &delay, 10) || delay < 0)
+			{
+				upsdebugx(2, "%s: %s:%d: bad TIMER value, skipped",
+					__func__, fn, bctx.linenum);
+				continue;
+			}
+
+			ev->type = BENCH_TIMER;
+			ev->usec = (long)(delay * 1000000);
+			bench_count++;
+			continue;
+		}
+
+		if ((ptr = strchr(bctx.arglist[0], ':')) != NULL)
+			*ptr = '\0';
+
+		if (!strncmp(bctx.arglist[0], "driver.", 7))
+			continue;
+
+		var_value[0] = '\0';
+		for (counter = 1; counter < bctx.numargs; counter++)
+		{
+			snprintfcat(var_value, sizeof(var_value), "%s%s",
+				(counter > 1) ? " " : "", bctx.arglist[counter]);
+		}
+
+		ev->type = strncmp(bctx.arglist[0], "ups.status", 10) ? BENCH_SET : BENCH_STATUS;
+		ev->var = xstrdup(bctx.arglist[0]);
+		ev->value = xstrdup(var_value);
+		bench_count++;
+
+		/* the first bench_random numeric variables get varied */
+		if (ev->type != BENCH_SET || randoms >= bench_random
+		 || !str_to_double_strict(ev->value, &ev->base, 10))
+			continue;
+
+		for (i = 0; i + 1 < bench_count; i++)
+		{
+			if (bench_events[i].random && !strcmp(bench_events[i].var, ev->var))
+				break;
+		}
+
+		if (i + 1 < bench_count)
+			continue;
+
+		ev->random = 1;
+		ev->decimals = ((ptr = strchr(ev->value, '.')) != NULL) ? (int)strlen(ptr + 1) : 0;
+		randoms++;
+	}
+
+	pconf_finish(&bctx);
+
+	upslogx(LOG_INFO, "Benchmark mode: %" PRIuSIZE " events compiled from %s, "
+		"replayed at %ld SETINFO/s%s, %ld variable(s) randomized",
+		bench_count, fn, bench_rate, bench_rate ? "" : " (no limit)", randoms);
+
+	gettimeofday(&bench_due, NULL);
+	bench_mark = bench_due;
+	bench_lastlog = bench_due.tv_sec;
+}
+
+static void bench_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < bench_count; i++)
+	{
+		free(bench_events[i].var);
+		free(bench_events[i].value);
+	}
+
+	free(bench_events);
+	bench_events = NULL;
+	bench_count = bench_next = 0;
+}
+
+static void bench_timeval_add(struct timeval *tv, long usec)
+{
+	tv->tv_sec += usec / 1000000;
+	tv->tv_usec += usec % 1000000;
+	if (tv->tv_usec >= 1000000)
+	{
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+}
+
+static void bench_play(bench_event_t *ev)
+{
+	char	buf[MAX_STRING_SIZE];
+	const char	*value = ev->value;
+
+	if (ev->type == BENCH_STATUS)
+	{
+		status_init();
+		status_set(value);
+		status_commit();
+		bench_sets++;
+		return;
+	}
+
+	/* the file values on the first pass, then +/- 10% around them */
+	if (ev->random && bench_passes > 0)
+	{
+		snprintf(buf, sizeof(buf), "%.*f", ev->decimals,
+			ev->base * (0.9 + 0.2 * (double)rand() / (double)RAND_MAX));
+		value = buf;
+	}
+
+	/* setvar() sets the flags and checks the value: once is enough */
+	if (!ev->published)
+	{
+		setvar(ev->var, value);
+		ev->published = 1;
+	}
+	else
+	{
+		dstate_setinfo(ev->var, "%s", value);
+	}
+
+	bench_sets++;
+}
+
+/* Replay the events on their schedule until the next update is due,
+ * serving the clients meanwhile, then report the achieved rate */
+static void bench_run(void)
+{
+	struct timeval	now, end;
+	long	slice, wait;
+	double	elapsed;
+	uintmax_t	played = 0;
+	bench_event_t	*ev;
+
+	if (!bench_count)
+		return;
+
+	/* most of the polling interval (up to a minute, so that the rate
+	 * gets reported), or a short turn with other devices in this process */
+	if (hosted_devices > 1)
+		slice = 100000;
+	else if (poll_interval > 60)
+		slice = 60 * 900000L;
+	else if (poll_interval > 0)
+		slice = (long)poll_interval * 900000L;
+	else
+		slice = 100000;
+
+	gettimeofday(&now, NULL);
+	end = now;
+	bench_timeval_add(&end, slice);
+
+	/* rather start over than play a burst to catch up */
+	if (difftimeval(now, bench_due) > 1.0)
+		bench_due = now;
+
+	while (difftimeval(end, now) > 0)
+	{
+		wait = (long)(difftimeval(bench_due, now) * 1000000);
+		if (wait > 0)
+		{
+			/* make the changes so far visible, then idle */
+			dstate_commit_batch();
+			dstate_begin_batch();
+			dstate_poll_clients();
+
+			usleep((useconds_t)((wait < 10000) ? wait : 10000));
+			gettimeofday(&now, NULL);
+			continue;
+		}
+
+		ev = &bench_events[bench_next];
+
+		if (ev->type == BENCH_TIMER)
+		{
+			bench_timeval_add(&bench_due, ev->usec);
+		}
+		else
+		{
+			bench_play(ev);
+			if (bench_rate > 0)
+				bench_timeval_add(&bench_due, 1000000 / bench_rate);
+			played++;
+		}
+
+		if (++bench_next == bench_count)
+		{
+			bench_next = 0;
+			bench_passes++;
+		}
+
+		if (!(played % 256))
+		{
+			dstate_poll_clients();
+			gettimeofday(&now, NULL);
+		}
+	}
+
+	bench_window += played;
+	elapsed = difftimeval(now, bench_mark);
+	if (elapsed <= 0)
+		return;
+
+	dstate_setinfo("driver.perf.bench.rate", "%.0f", (double)bench_window / elapsed);
+	dstate_setinfo("driver.perf.bench.setinfo", "%" PRIuMAX, bench_sets);
+	dstate_setinfo("driver.perf.bench.passes", "%" PRIuMAX, bench_passes);
+
+	if (now.tv_sec - bench_lastlog >= 60)
+	{
+		upslogx(LOG_INFO, "Benchmark mode: %.0f SETINFO/s achieved (target: %ld), "
+			"%" PRIuMAX " in total, %" PRIuMAX " passes",
+			(double)bench_window / elapsed, bench_rate, bench_sets, bench_passes);
+		bench_lastlog = now.tv_sec;
+	}
+
+	bench_window = 0;
+	bench_mark = now;
+}
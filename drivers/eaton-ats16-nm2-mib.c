@@ -188,7 +188,7 @@ static info_lkp_t eaton_ats16_nm2_ambient_drycontacts_info[] = {
 };
 
 /* EATON_ATS Snmp2NUT lookup table */
-static snmp_info_t eaton_ats16_nm2_mib[] = {
+static const snmp_info_t eaton_ats16_nm2_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
@@ -88,7 +88,7 @@ static info_lkp_t eaton_ats16_nmc_ambient_drycontacts_info[] = {
 };
 
 /* EATON_ATS_NMC Snmp2NUT lookup table */
-static snmp_info_t eaton_ats16_nmc_mib[] = {
+static const snmp_info_t eaton_ats16_nmc_mib[] = {
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
 	snmp_info_default("device.contact", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.4.0", NULL, SU_FLAG_OK, NULL),
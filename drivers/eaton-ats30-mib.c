@@ -75,7 +75,7 @@ static info_lkp_t eaton_ats30_status_info[] = {
 };
 
 /* EATON_ATS30 Snmp2NUT lookup table */
-static snmp_info_t eaton_ats30_mib[] = {
+static const snmp_info_t eaton_ats30_mib[] = {
 	/* device type: ats */
 	snmp_info_default("device.type", ST_FLAG_STRING, SU_INFOSIZE, NULL, "ats", SU_FLAG_STATIC | SU_FLAG_ABSENT | SU_FLAG_OK, NULL),
 
@@ -47,7 +47,7 @@
 #define APHEL1_OID_OUTLET_CURRENT			".1.3.6.1.4.1.17373.3.2"
 
 /* Snmp2NUT lookup table for GenesisII MIB */
-static snmp_info_t eaton_aphel_genesisII_mib[] = {
+static const snmp_info_t eaton_aphel_genesisII_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
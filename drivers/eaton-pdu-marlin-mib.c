@@ -299,7 +299,7 @@ static info_lkp_t marlin_device_count_info[] = {
 
 
 /* Snmp2NUT lookup table for Eaton Marlin MIB */
-static snmp_info_t eaton_marlin_mib[] = {
+static const snmp_info_t eaton_marlin_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE,
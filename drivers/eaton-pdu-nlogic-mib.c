@@ -67,7 +67,7 @@ static info_lkp_t eaton_nlogic_outlet_type_info[] = {
 
 
 /* EATON_PDU_NLOGIC Snmp2NUT lookup table */
-static snmp_info_t eaton_pdu_nlogic_mib[] = {
+static const snmp_info_t eaton_pdu_nlogic_mib[] = {
 
 /* Data format:
  * { info_type, info_flags, info_len, OID, dfl, flags, oid2info },
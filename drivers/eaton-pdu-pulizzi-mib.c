@@ -66,7 +66,7 @@ static info_lkp_t pulizzi_sw_outlet_switchability_info[] = {
 };
 
 /* Snmp2NUT lookup table for Eaton Pulizzi Switched ePDU MIB */
-static snmp_info_t eaton_pulizzi_switched_mib[] = {
+static const snmp_info_t eaton_pulizzi_switched_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
@@ -85,7 +85,7 @@ static info_lkp_t revelation_outlet_switchability_info[] = {
 #define AR_OID_OUTLET_POWERFACTOR		AR_BASE_OID ".1.2.2.1.9"
 
 /* Snmp2NUT lookup table for Eaton Revelation MIB */
-static snmp_info_t eaton_aphel_revelation_mib[] = {
+static const snmp_info_t eaton_aphel_revelation_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
@@ -77,7 +77,7 @@ static info_lkp_t avocent_outlet_status_info[] = {
 	info_lkp_sentinel
 };
 
-static snmp_info_t emerson_avocent_pdu_mib[] = {
+static const snmp_info_t emerson_avocent_pdu_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
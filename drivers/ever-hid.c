@@ -105,9 +105,19 @@ static const char *ever_mac_address_fun(double value)
 	return line;
 }
 
+/* which of the reports the next call of these reads */
+static int	ip_report_counter = 1;
+static int	packets_report_counter = 1;
+
+/* per device, see addhostvars() */
+static const dstate_hostvar_t ever_hostvars[] = {
+	DSTATE_HOSTVAR(ip_report_counter),
+	DSTATE_HOSTVAR(packets_report_counter),
+	DSTATE_HOSTVAR_END
+};
+
 static const char *ever_ip_address_fun(double value)
 {
-	static int	report_counter = 1;
 	int	report_id = 211, len;
 	int	n = 0;	/* number of characters currently in line */
 	int	i;	/* number of bytes output from buffer */
@@ -115,16 +125,16 @@ static const char *ever_ip_address_fun(double value)
 	static char	line[100];
 	NUT_UNUSED_VARIABLE(value);
 
-	if(report_counter == 1)
+	if(ip_report_counter == 1)
 		report_id = 211; /* notification dest ip */
-	else if(report_counter == 2)
+	else if(ip_report_counter == 2)
 		report_id = 230; /* ip address */
-	else if(report_counter == 3)
+	else if(ip_report_counter == 3)
 		report_id = 231;	/* network mask */
-	else if(report_counter == 4)
+	else if(ip_report_counter == 4)
 		report_id = 232;	/* default gateway */
 
-	report_counter== 4 ? report_counter=1 : report_counter++;
+	ip_report_counter== 4 ? ip_report_counter=1 : ip_report_counter++;
 
 	len = reportbuf->len[report_id];
 	buf = reportbuf->data[report_id];
@@ -143,22 +153,21 @@ static const char *ever_ip_address_fun(double value)
 
 static const char *ever_packets_fun(double value)
 {
-	static int	report_counter = 1;
 	int	report_id = 215, len, res;
 	const unsigned char	*buf;
 	static char	line[200];
 	NUT_UNUSED_VARIABLE(value);
 
-	if(report_counter == 1 )
+	if(packets_report_counter == 1 )
 		report_id = 215;
-	else if(report_counter == 2 )
+	else if(packets_report_counter == 2 )
 		report_id = 216;
-	else if(report_counter == 3 )
+	else if(packets_report_counter == 3 )
 		report_id = 217;
-	else if(report_counter == 4 )
+	else if(packets_report_counter == 4 )
 		report_id = 218;
 
-	report_counter== 4 ? report_counter=1 : report_counter++;
+	packets_report_counter== 4 ? packets_report_counter=1 : packets_report_counter++;
 
 	len = reportbuf->len[report_id];
 	buf = reportbuf->data[report_id];
@@ -491,7 +500,7 @@ static usage_tables_t ever_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t ever_hid2nut[] = {
+static const hid_info_t ever_hid2nut[] = {
 
   /* Note: fields marked with "experimental." prefix were proposed without
    * an exact match vs. docs/nut-names.txt definitions. PRs are welcome to
@@ -783,4 +792,5 @@ subdriver_t ever_subdriver = {
 	ever_format_mfr,
 	ever_format_serial,
 	fix_report_desc,
+	ever_hostvars,
 };
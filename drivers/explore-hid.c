@@ -36,7 +36,7 @@ static usage_tables_t explore_utab[] = {
 /*                 Data lookup table (HID <-> NUT)                 */
 /* --------------------------------------------------------------- */
 
-static hid_info_t explore_hid2nut[] =
+static const hid_info_t explore_hid2nut[] =
 {
   /* end of structure. */
   { NULL, 0, 0, NULL, NULL, NULL, 0, NULL }
@@ -75,4 +75,5 @@ subdriver_t explore_subdriver = {
 	explore_format_mfr,
 	explore_format_serial,
 	fix_report_desc,
+	NULL,
 };
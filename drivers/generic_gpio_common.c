@@ -70,7 +70,9 @@ static
 #endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 struct gpioups_t *generic_gpio_open(const char *chipName) {
 	struct gpioups_t *upsfdlocal=xcalloc(sizeof(*upsfdlocal),1);
-	upsfdlocal->runOptions=0; /*	don't use ROPT_REQRES and ROPT_EVMODE yet	*/
+	upsfdlocal->runOptions=0; /*	don't use ROPT_REQRES yet	*/
+	if(testvar("eventmode"))
+		upsfdlocal->runOptions|=ROPT_EVMODE;
 	upsfdlocal->chipName=chipName;
 
 	if(!testvar("rules"))	/* rules is required configuration parameter */
@@ -490,6 +492,7 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, "mfr", "Override UPS manufacturer name");
 	addvar(VAR_VALUE, "model", "Override UPS model name");
 	addvar(VAR_VALUE, "rules", "Line rules to produce status strings");
+	addvar(VAR_FLAG, "eventmode", "Update the status as soon as a line changes");
 }
 
 void upsdrv_initups(void)
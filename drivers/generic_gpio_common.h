@@ -55,7 +55,7 @@ typedef struct gpioups_t {
 	void	*lib_data;	/* pointer to driver's gpio support library data structure */
 	const char *chipName;	/* port or file name to reference GPIO chip */
 	int	initial;	/* initialization flag - 0 on 1st entry */
-	int	runOptions;	/* run options, not yet used */
+	int	runOptions;	/* run options, ROPT_EVMODE with the eventmode flag */
 	int	aInfoAvailable;	/* non-zero if previous state information is available */
 	int	chipLinesCount;	/* gpio chip lines count, set after sucessful open */
 	int	upsLinesCount;	/* no of lines used in rules */
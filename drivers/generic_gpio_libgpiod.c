@@ -26,6 +26,8 @@
 #include "generic_gpio_common.h"
 #include "generic_gpio_libgpiod.h"
 
+#include <poll.h>
+
 #define DRIVER_NAME	"GPIO UPS driver"
 #define DRIVER_VERSION	"1.02"
 
@@ -39,6 +41,7 @@ upsdrv_info_t upsdrv_info = {
 };
 
 static void reserve_lines_libgpiod(struct gpioups_t *gpioupsfd, int inner);
+static void watch_lines_libgpiod(struct gpioups_t *gpioupsfdlocal);
 
 /*	CyberPower 12V open collector state definitions
 	0 ON BATTERY			Low when operating from utility line
@@ -99,7 +102,52 @@ static void reserve_lines_libgpiod(struct gpioups_t *gpioupsfdlocal, int inner)
 			config.request_type,
 			gpioRc
 		);
+		if(!inner && (gpioupsfdlocal->runOptions&ROPT_EVMODE))
+			watch_lines_libgpiod(gpioupsfdlocal);
+	}
+}
+
+/*
+ * line edge event seen by the driver main loop: consume it and have
+ * the status updated right away
+ */
+static int event_line_libgpiod(int fd, short revents, void *arg) {
+	struct gpiod_line_event event;
+	NUT_UNUSED_VARIABLE(arg);
+
+	if(!(revents&POLLIN))
+		return 0;
+	if(gpiod_line_event_read_fd(fd, &event)) {
+		upsdebug_with_errno(5, "Event read failed on fd %d", fd);
+		return 0;
+	}
+	upsdebugx(5, "Event type %d on fd %d", event.event_type, fd);
+	return 1;
+}
+
+/*
+ * with lines reserved for the whole run, let the driver main loop poll
+ * their event fds instead of waiting for events in gpio_get_lines_states
+ */
+static void watch_lines_libgpiod(struct gpioups_t *gpioupsfdlocal) {
+	struct libgpiod_data_t *libgpiod_data = (struct libgpiod_data_t *)(gpioupsfdlocal->lib_data);
+	int num_lines_local = (int)gpiod_line_bulk_num_lines(&libgpiod_data->gpioLines);
+	int j;
+
+	for(j=0; j<num_lines_local; j++) {
+		int fd = gpiod_line_event_get_fd(gpiod_line_bulk_get_line(&libgpiod_data->gpioLines, j));
+		if(fd < 0 || dstate_addevent(fd, POLLIN, event_line_libgpiod, NULL))
+			break;
 	}
+	if(j<num_lines_local) {
+		/* fall back to waiting in gpio_get_lines_states */
+		while(j-- > 0)
+			dstate_delevent(gpiod_line_event_get_fd(gpiod_line_bulk_get_line(&libgpiod_data->gpioLines, j)));
+		upsdebugx(5, "GPIO line event fds not available, waiting for events on updates");
+		return;
+	}
+	libgpiod_data->eventsWatched = 1;
+	upsdebugx(5, "GPIO watching %d line event fds", num_lines_local);
 }
 
 /*
@@ -157,6 +205,12 @@ void gpio_close(struct gpioups_t *gpioupsfdlocal) {
 	if(gpioupsfdlocal) {
 		struct libgpiod_data_t *libgpiod_data = (struct libgpiod_data_t *)(gpioupsfdlocal->lib_data);
 		if(libgpiod_data) {
+			if(libgpiod_data->eventsWatched) {
+				int num_lines_local = (int)gpiod_line_bulk_num_lines(&libgpiod_data->gpioLines);
+				int j;
+				for(j=0; j<num_lines_local; j++)
+					dstate_delevent(gpiod_line_event_get_fd(gpiod_line_bulk_get_line(&libgpiod_data->gpioLines, j)));
+			}
 			if(libgpiod_data->gpioChipHandle) {
 				gpiod_chip_close(libgpiod_data->gpioChipHandle);
 			}
@@ -175,7 +229,7 @@ void gpio_get_lines_states(struct gpioups_t *gpioupsfdlocal) {
 	struct libgpiod_data_t *libgpiod_data = (struct libgpiod_data_t *)(gpioupsfdlocal->lib_data);
 
 	reserve_lines_libgpiod(gpioupsfdlocal, 1);
-	if(gpioupsfdlocal->runOptions&ROPT_EVMODE) {
+	if((gpioupsfdlocal->runOptions&ROPT_EVMODE) && !libgpiod_data->eventsWatched) {
 		struct timespec timeoutLong = {1,0};
 		struct gpiod_line_event event;
 		int monRes;
@@ -29,6 +29,7 @@ typedef struct libgpiod_data_t {
 	struct gpiod_chip	*gpioChipHandle;	/* libgpiod chip handle when opened */
 	struct gpiod_line_bulk	gpioLines;	/* libgpiod lines to monitor */
 	struct gpiod_line_bulk	gpioEventLines;	/* libgpiod lines for event monitoring */
+	int	eventsWatched;	/* line event fds handed to the driver main loop */
 } libgpiod_data;
 
 #endif	/* GENERIC_GPIO_LIBGPIOD_H_SEEN */
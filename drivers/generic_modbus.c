@@ -23,6 +23,7 @@
 #include "main.h"
 #include "generic_modbus.h"
 #include <modbus.h>
+#include "modbus_bus.h"
 #include "timehead.h"
 #include "nut_stdint.h"
 
@@ -46,6 +47,13 @@ static uint32_t mod_resp_to_s = MODRESP_TIMEOUT_s;         /* set the modbus res
 static uint32_t mod_resp_to_us = MODRESP_TIMEOUT_us;       /* set the modbus response time out (us) */
 static uint32_t mod_byte_to_s = MODBYTE_TIMEOUT_s;         /* set the modbus byte time out (us) */
 static uint32_t mod_byte_to_us = MODBYTE_TIMEOUT_us;       /* set the modbus byte time out (us) */
+static int mod_read_gap = MOD_READ_GAP;                    /* unused addresses allowed within one read */
+static int mod_read_max = MOD_READ_MAX;                    /* max registers (or bits) per read, 0: protocol limit */
+
+static rdrange_t rdranges[NUMOF_SIG_STATES];               /* reads done at each update */
+static int rdrange_cnt = 0;                                /* number of reads in rdranges */
+static int sigrange[NUMOF_SIG_STATES];                     /* read serving each signal, NOTUSED if not read at updates */
+static int sigval[NUMOF_SIG_STATES];                       /* signal value read at this update, -1 on error */
 
 /* get config vars set by -x or defined in ups.conf driver section */
 void get_config_vars(void);
@@ -59,6 +67,12 @@ void modbus_reconnect(void);
 /* modbus register read function */
 int register_read(modbus_t *mb, int addr, regtype_t type, void *data);
 
+/* group the signals read at each update into as few reads as possible */
+void plan_reads(void);
+
+/* read the signals of each planned read into sigval */
+void read_signals(void);
+
 /* instant command triggered by upsd */
 int upscmd(const char *cmd, const char *arg);
 
@@ -176,6 +190,9 @@ void upsdrv_initups(void)
 	}
 /* #elif (defined NUT_MODBUS_TIMEOUT_ARG_timeval) // some un-castable type in fields */
 #endif /* NUT_MODBUS_TIMEOUT_ARG_* */
+
+	/* group the signal reads */
+	plan_reads();
 }
 
 /* update UPS signal state */
@@ -189,6 +206,9 @@ void upsdrv_updateinfo(void)
 	status_init();      /* initialize ups.status update */
 	alarm_init();       /* initialize ups.alarm update */
 
+	/* read all signals first, with as few modbus reads as possible */
+	read_signals();
+
 	/*
 	 * update UPS status regarding MAINS state either via OL | OB.
 	 * if both statuses are mapped to contacts then only OL is evaluated.
@@ -360,6 +380,8 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, "mod_resp_to_us", "modbus response timeout (us)");
 	addvar(VAR_VALUE, "mod_byte_to_s", "modbus byte timeout (s)");
 	addvar(VAR_VALUE, "mod_byte_to_us", "modbus byte timeout (us)");
+	addvar(VAR_VALUE, "mod_read_gap", "unused addresses allowed within one modbus read");
+	addvar(VAR_VALUE, "mod_read_max", "maximum registers (or bits) per modbus read");
 	addvar(VAR_VALUE, "OL_addr", "modbus address for OL state");
 	addvar(VAR_VALUE, "OB_addr", "modbus address for OB state");
 	addvar(VAR_VALUE, "LB_addr", "modbus address for LB state");
@@ -409,6 +431,7 @@ int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
 	uint16_t mask8 = 0x000F;
 	uint16_t mask16 = 0x00FF;
 
+	modbus_bus_lock(mb);
 	switch (type) {
 		case COIL:
 			rval = modbus_read_bits(mb, addr, 1, (uint8_t *)data);
@@ -456,6 +479,7 @@ int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
 # pragma GCC diagnostic pop
 #endif
 	}
+	modbus_bus_unlock(mb);
 	if (rval == -1) {
 		upslogx(LOG_ERR,"ERROR:(%s) modbus_read: addr:0x%x, type:%8s, path:%s\n",
 			modbus_strerror(errno),
@@ -476,6 +500,187 @@ int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
 	return rval;
 }
 
+/* tell if a signal is read at each update (see upsdrv_updateinfo) */
+static int signal_polled(devstate_t state)
+{
+	switch (state) {
+		case OL_T:
+		case HB_T:
+		case LB_T:
+		case RB_T:
+		case CHRG_T:
+			return sigar[state].addr != NOTUSED;
+		case OB_T:
+			/* if both OL and OB are mapped only OL is evaluated */
+			return sigar[OL_T].addr == NOTUSED && sigar[OB_T].addr != NOTUSED;
+		case DISCHRG_T:
+			return sigar[CHRG_T].addr == NOTUSED && sigar[DISCHRG_T].addr != NOTUSED;
+
+		case BYPASS_T:
+		case CAL_T:
+		case FSD_T:
+		case OFF_T:
+		case OVER_T:
+		case TRIM_T:
+		case BOOST_T:
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+		/* All enum cases defined as of the time of coding
+		 * have been covered above. Handle later definitions,
+		 * memory corruptions and buggy inputs below...
+		 */
+		default:
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT)
+# pragma GCC diagnostic pop
+#endif
+			return 0;
+	}
+}
+
+/* group the signals read at each update into as few reads as possible */
+void plan_reads(void)
+{
+	int order[NUMOF_SIG_STATES];    /* polled signals sorted by type and address */
+	int cnt = 0;
+	int i, j, maxcnt;
+	rdrange_t *r = NULL;
+
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		sigrange[i] = NOTUSED;
+		sigval[i] = -1;
+		if (!signal_polled((devstate_t)i)) {
+			continue;
+		}
+
+		/* insertion sort, there are only a few of them */
+		for (j = cnt; j > 0; j--) {
+			sigattr_t *prev = &sigar[order[j - 1]];
+			if (prev->type < sigar[i].type
+			 || (prev->type == sigar[i].type && prev->addr <= sigar[i].addr)
+			) {
+				break;
+			}
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		cnt++;
+	}
+
+	rdrange_cnt = 0;
+	for (i = 0; i < cnt; i++) {
+		sigattr_t *sig = &sigar[order[i]];
+
+		if (sig->type == COIL || sig->type == INPUT_B) {
+			maxcnt = MODBUS_MAX_READ_BITS;
+		} else {
+			maxcnt = MODBUS_MAX_READ_REGISTERS;
+		}
+		if (mod_read_max > 0 && mod_read_max < maxcnt) {
+			maxcnt = mod_read_max;
+		}
+
+		/* extend the current read, or start a new one */
+		if (r != NULL
+		 && r->type == sig->type
+		 && sig->addr - (r->addr + r->count) <= mod_read_gap
+		 && sig->addr - r->addr + 1 <= maxcnt
+		) {
+			if (sig->addr - r->addr + 1 > r->count) {
+				r->count = sig->addr - r->addr + 1;
+			}
+		} else {
+			r = &rdranges[rdrange_cnt++];
+			r->type = sig->type;
+			r->addr = sig->addr;
+			r->count = 1;
+		}
+		sigrange[order[i]] = rdrange_cnt - 1;
+	}
+
+	for (i = 0; i < rdrange_cnt; i++) {
+		upsdebugx(2, "plan_reads: read %d: addr: 0x%x, type: %d, count: %d",
+			i, rdranges[i].addr, rdranges[i].type, rdranges[i].count);
+	}
+}
+
+/* read the signals of each planned read into sigval */
+void read_signals(void)
+{
+	uint8_t bits[MODBUS_MAX_READ_BITS];
+	uint16_t regs[MODBUS_MAX_READ_REGISTERS];
+	int i, n, rval;
+
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		sigval[i] = -1;
+	}
+
+	for (n = 0; n < rdrange_cnt; n++) {
+		rdrange_t *r = &rdranges[n];
+
+		modbus_bus_lock(mbctx);
+		if (r->type == COIL) {
+			rval = modbus_read_bits(mbctx, r->addr, r->count, bits);
+		} else if (r->type == INPUT_B) {
+			rval = modbus_read_input_bits(mbctx, r->addr, r->count, bits);
+		} else if (r->type == INPUT_R) {
+			rval = modbus_read_input_registers(mbctx, r->addr, r->count, regs);
+		} else {
+			rval = modbus_read_registers(mbctx, r->addr, r->count, regs);
+		}
+		modbus_bus_unlock(mbctx);
+		upsdebugx(3, "read_signals: addr: 0x%x, type: %d, count: %d, rval: %d",
+			r->addr, r->type, r->count, rval);
+
+		/* a single address: nothing else to try */
+		if (rval != r->count && r->count == 1) {
+			upslogx(LOG_ERR,"ERROR:(%s) modbus_read: addr:0x%x, type:%8s, path:%s\n",
+				modbus_strerror(errno),
+				r->addr,
+				(r->type == COIL) ? "COIL" :
+				(r->type == INPUT_B) ? "INPUT_B" :
+				(r->type == INPUT_R) ? "INPUT_R" : "HOLDING",
+				device_path
+			);
+
+			/* on BROKEN PIPE error try to reconnect */
+			if (errno == EPIPE) {
+				upsdebugx(2, "read_signals: error(%s)", modbus_strerror(errno));
+				modbus_reconnect();
+			}
+			continue;
+		}
+
+		for (i = 0; i < NUMOF_SIG_STATES; i++) {
+			int reg_val;
+
+			if (sigrange[i] != n) {
+				continue;
+			}
+
+			if (rval == r->count) {
+				int ofs = sigar[i].addr - r->addr;
+
+				/* same masks as register_read() */
+				if (r->type == COIL || r->type == INPUT_B) {
+					sigval[i] = bits[ofs] & 0x000F;
+				} else {
+					sigval[i] = regs[ofs] & 0x00FF;
+				}
+				continue;
+			}
+
+			/* the device may not like some address in between,
+			 * ask for each signal alone (this logs the errors
+			 * and reconnects when needed) */
+			if (register_read(mbctx, sigar[i].addr, sigar[i].type, &reg_val) > -1) {
+				sigval[i] = reg_val;
+			}
+		}
+	}
+}
+
 /* write a modbus register */
 int register_write(modbus_t *mb, int addr, regtype_t type, void *data)
 {
@@ -485,6 +690,7 @@ int register_write(modbus_t *mb, int addr, regtype_t type, void *data)
 	uint16_t mask8 = 0x000F;
 	uint16_t mask16 = 0x00FF;
 
+	modbus_bus_lock(mb);
 	switch (type) {
 		case COIL:
 			*(uint16_t *)data = *(uint16_t *)data & mask8;
@@ -512,6 +718,7 @@ int register_write(modbus_t *mb, int addr, regtype_t type, void *data)
 			upsdebugx(2,"ERROR: register_write: invalid register type %d\n", type);
 			break;
 	}
+	modbus_bus_unlock(mb);
 	if (rval == -1) {
 		upslogx(LOG_ERR,"ERROR:(%s) modbus_read: addr:0x%x, type:%8s, path:%s\n",
 			modbus_strerror(errno),
@@ -725,6 +932,12 @@ int get_signal_state(devstate_t state)
 			break;
 	}
 
+	/* already read by read_signals() at this update */
+	if (sigrange[state] != NOTUSED) {
+		upsdebugx(3, "get_signal_state: state: %d", sigval[state]);
+		return sigval[state];
+	}
+
 	rval = register_read(mbctx, addr, rtype, &reg_val);
 	if (rval > -1) {
 		rval = reg_val;
@@ -823,6 +1036,24 @@ void get_config_vars(void)
 	}
 	upsdebugx(2, "mod_byte_to_us %d", mod_byte_to_us);
 
+	/* check if the read gap is set and get the value */
+	if (testvar("mod_read_gap")) {
+		mod_read_gap = (int)strtol(getval("mod_read_gap"), NULL, 10);
+		if (mod_read_gap < 0) {
+			fatalx(EXIT_FAILURE, "get_config_vars: Invalid mod_read_gap %d", mod_read_gap);
+		}
+	}
+	upsdebugx(2, "mod_read_gap %d", mod_read_gap);
+
+	/* check if the read size limit is set and get the value */
+	if (testvar("mod_read_max")) {
+		mod_read_max = (int)strtol(getval("mod_read_max"), NULL, 10);
+		if (mod_read_max < 0) {
+			fatalx(EXIT_FAILURE, "get_config_vars: Invalid mod_read_max %d", mod_read_max);
+		}
+	}
+	upsdebugx(2, "mod_read_max %d", mod_read_max);
+
 	/* check if OL address is set and get the value */
 	if (testvar("OL_addr")) {
 		sigar[OL_T].addr = (int)strtol(getval("OL_addr"), NULL, 0);
@@ -94,6 +94,23 @@ typedef struct sigattr sigattr_t;
 #define NUMOF_SIG_STATES 14
 #define NOTUSED -1
 
+/*
+ * signals read at each update are served from as few modbus reads as
+ * possible: a read of one register (or bit) type covers the addresses
+ * of several signals when at most MOD_READ_GAP unused addresses lie
+ * between them, and up to MOD_READ_MAX registers (0: protocol limit)
+ */
+#define MOD_READ_GAP 0
+#define MOD_READ_MAX 0
+
+/* a read of consecutive addresses serving one or more signals */
+struct rdrange {
+	regtype_t type;     /* register type */
+	int addr;           /* first address */
+	int count;          /* number of registers (or bits) */
+};
+typedef struct rdrange rdrange_t;
+
 /* define the duration of the shutdown pulse */
 #define SHTDOWN_PULSE_DURATION NOTUSED
 
@@ -478,6 +478,72 @@ int FindObject(HIDDesc_t *pDesc_arg, HIDData_t *pData)
 	return 1;
 }
 
+/*
+ * PathIndex_hash
+ * Hash of Type and the first Size nodes of Path
+ * -------------------------------------------------------------------------- */
+static size_t PathIndex_hash(const HIDPath_t *Path, uint8_t Size, uint8_t Type)
+{
+	size_t	hash = 2166136261U;
+	uint8_t	i;
+
+	hash = (hash ^ Type) * 16777619U;
+	hash = (hash ^ Size) * 16777619U;
+	for (i = 0; i < Size; i++) {
+		hash = (hash ^ Path->Node[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * PathIndex_build
+ * Index the items of a parsed descriptor by type and by each prefix of
+ * their path, so that FindObject_with_Path() finds the first item whose
+ * path starts with the one asked for without looking at them all. The
+ * index is left out (and the items scanned) if it can not be allocated.
+ * -------------------------------------------------------------------------- */
+static void PathIndex_build(HIDDesc_t *pDesc_arg)
+{
+	size_t	i, h, mask, keys = 0;
+	uint8_t	size;
+
+	for (i = 0; i < pDesc_arg->nitems; i++) {
+		keys += (size_t)pDesc_arg->item[i].Path.Size + 1;
+	}
+
+	/* keep the hash at most half full */
+	for (pDesc_arg->pathidx_size = 64; pDesc_arg->pathidx_size < keys * 2; pDesc_arg->pathidx_size *= 2)
+		;
+	pDesc_arg->pathidx = calloc(pDesc_arg->pathidx_size, sizeof(*pDesc_arg->pathidx));
+	if (!pDesc_arg->pathidx) {
+		pDesc_arg->pathidx_size = 0;
+		return;
+	}
+	mask = pDesc_arg->pathidx_size - 1;
+
+	for (i = 0; i < pDesc_arg->nitems; i++) {
+		HIDData_t	*pData = &pDesc_arg->item[i];
+
+		for (size = 0; size <= pData->Path.Size; size++) {
+			for (h = PathIndex_hash(&pData->Path, size, pData->Type) & mask; pDesc_arg->pathidx[h].item; h = (h + 1) & mask) {
+				HIDData_t	*pFirst = &pDesc_arg->item[pDesc_arg->pathidx[h].item - 1];
+
+				/* the first item with this prefix is the one found */
+				if (pDesc_arg->pathidx[h].Size == size && pFirst->Type == pData->Type
+				 && !memcmp(pFirst->Path.Node, pData->Path.Node, size * sizeof(HIDNode_t))) {
+					break;
+				}
+			}
+
+			if (!pDesc_arg->pathidx[h].item) {
+				pDesc_arg->pathidx[h].item = i + 1;
+				pDesc_arg->pathidx[h].Size = size;
+			}
+		}
+	}
+}
+
 /*
  * FindObject_with_Path
  * Get pData item with given Path and Type. Return NULL if not found.
@@ -486,6 +552,21 @@ HIDData_t *FindObject_with_Path(HIDDesc_t *pDesc_arg, HIDPath_t *Path, uint8_t T
 {
 	size_t	i;
 
+	if (pDesc_arg->pathidx_size && Path->Size <= PATH_SIZE) {
+		size_t	mask = pDesc_arg->pathidx_size - 1;
+
+		for (i = PathIndex_hash(Path, Path->Size, Type) & mask; pDesc_arg->pathidx[i].item; i = (i + 1) & mask) {
+			HIDData_t *pData = &pDesc_arg->item[pDesc_arg->pathidx[i].item - 1];
+
+			if (pDesc_arg->pathidx[i].Size == Path->Size && pData->Type == Type
+			 && !memcmp(pData->Path.Node, Path->Node, (Path->Size) * sizeof(HIDNode_t))) {
+				return pData;
+			}
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < pDesc_arg->nitems; i++) {
 		HIDData_t *pData = &pDesc_arg->item[i];
 
@@ -764,6 +845,8 @@ HIDDesc_t *Parse_ReportDesc(const usb_ctrl_charbuf ReportDesc, const usb_ctrl_ch
 
 	pDesc_var->item = realloc(pDesc_var->item, pDesc_var->nitems * sizeof(*pDesc_var->item));
 
+	PathIndex_build(pDesc_var);
+
 	return pDesc_var;
 }
 
@@ -775,5 +858,6 @@ void Free_ReportDesc(HIDDesc_t *pDesc_arg)
 	}
 
 	free(pDesc_arg->item);
+	free(pDesc_arg->pathidx);
 	free(pDesc_arg);
 }
@@ -315,8 +315,30 @@ typedef struct {
 	long		PhyMax;				/* Physical Max			*/
 	int8_t		have_PhyMin;			/* Physical Min defined?		*/
 	int8_t		have_PhyMax;			/* Physical Max defined?		*/
+
+	/* Logical to physical conversion, precomputed from the above by
+	 * HIDPrepareConversions(): physical = ((logical - LogMin) * ConvFactor
+	 * + PhyMin) clamped to PhyMin..PhyMax, times ConvScale (10^exponent) */
+	double		ConvFactor;			/* (PhyMax-PhyMin)/(LogMax-LogMin)	*/
+	double		ConvScale;			/* Unit exponent multiplier		*/
+	int8_t		ConvMode;			/* HID_CONV_* below			*/
 } HIDData_t;
 
+/* HIDData_t ConvMode values */
+#define HID_CONV_NONE		0	/* not computed yet			*/
+#define HID_CONV_LOGICAL	1	/* physical = logical * ConvScale	*/
+#define HID_CONV_LINEAR		2	/* linear map with clamping, see above	*/
+
+/*
+ * HIDPathSlot struct
+ *
+ * One slot of the hash of a descriptor's items by path and type
+ * -------------------------------------------------------------------------- */
+typedef struct {
+	size_t		item;				/* item index + 1, 0 if empty	*/
+	uint8_t		Size;				/* length of the path prefix	*/
+} HIDPathSlot_t;
+
 /*
  * HIDDesc struct
  *
@@ -326,6 +348,8 @@ typedef struct {
 	size_t		nitems;				/* number of items in descriptor */
 	HIDData_t	*item;				/* list of items			*/
 	size_t		replen[256];		/* list of report lengths, in byte */
+	HIDPathSlot_t	*pathidx;		/* items by (path prefix, type)	*/
+	size_t		pathidx_size;		/* slots in pathidx, 0 if none	*/
 } HIDDesc_t;
 
 #ifdef __cplusplus
@@ -78,7 +78,7 @@ static info_lkp_t hpe_cis_outlet_switchability_info[] = {
 };
 
 /* HPE_PDU_CIS Snmp2NUT lookup table */
-static snmp_info_t hpe_pdu3_cis_mib[] = {
+static const snmp_info_t hpe_pdu3_cis_mib[] = {
 
 /* standard MIB items; if the vendor MIB contains better OIDs for
  * this (e.g. with daisy-chain support), consider adding those here
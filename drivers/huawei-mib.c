@@ -114,7 +114,7 @@ static info_lkp_t huawei_test_result_info[] = {
 
 
 /* HUAWEI Snmp2NUT lookup table */
-static snmp_info_t huawei_mib[] = {
+static const snmp_info_t huawei_mib[] = {
 
 	/* Data format:
 	 * snmp_info_default(info_type, info_flags, info_len, OID, dfl, flags, oid2info, setvar),
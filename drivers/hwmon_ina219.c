@@ -37,7 +37,7 @@
 #define BATTERY_CHARGE_LOW                  15
 
 #define DRIVER_NAME                         "hwmon-INA219 UPS driver"
-#define DRIVER_VERSION                      "0.02"
+#define DRIVER_VERSION                      "0.03"
 
 upsdrv_info_t upsdrv_info = {
 	DRIVER_NAME,
@@ -79,6 +79,32 @@ static int voltage = 0;
  */
 static int current = 0;
 
+/**
+ * @brief Descriptors of in1_input and curr1_input, open from the first
+ * update on (-1 when not, or after they failed).
+ */
+static int voltage_fd = -1;
+static int current_fd = -1;
+
+/**
+ * @brief Updates with the same status and charge before polling every
+ * lowpower_interval instead of every pollinterval.
+ */
+#define LOWPOWER_STABLE_UPDATES             3
+
+/**
+ * @brief Poll interval (sec) while the readings are stable, 0 if not used.
+ */
+static time_t lowpower_interval = 0;
+
+/**
+ * @brief The poll interval otherwise.
+ */
+static time_t normal_interval = 0;
+
+static int stable_updates = 0;
+static char last_state[ST_MAX_VALUE_LEN + 8];
+
 static int file_contains(const char *path, const char *text)
 {
 	FILE *f;
@@ -103,27 +129,21 @@ static int file_contains(const char *path, const char *text)
 	return 1;
 }
 
-static int file_read_number(const char *path, int *value)
+/**
+ * @brief Read a number from an attribute kept open: sysfs makes it anew
+ * for each read from its start, so there is no need to reopen it.
+ */
+static int fd_read_number(int fd, int *value)
 {
 	char buf[128];
 	ssize_t ret;
-	int fd;
 
-	if ((fd = open(path, O_RDONLY)) < 0)
+	if ((ret = pread(fd, buf, sizeof(buf) - 1, 0)) < 0)
 		return -errno;
 
-	if ((ret = pread(fd, buf, sizeof(buf), 0)) < 0) {
-		const int _e = -errno;
-		close(fd);
-		return _e;
-	}
-	else {
-		close(fd);
-
-		buf[ret] = '\0';
-		*value = atoi(buf);
-		return 0;
-	}
+	buf[ret] = '\0';
+	*value = atoi(buf);
+	return 0;
 }
 
 static int detect_ina219(const char *ina219_dir)
@@ -202,6 +222,7 @@ static int scan_hwmon_ina219(const char *sysfs_hwmon_dir)
 static int update_intvar(
 	const char *base_path,
 	const char *name,
+	int *fd,
 	int *value)
 {
 	char path[PATH_MAX];
@@ -213,9 +234,18 @@ static int update_intvar(
 		return -ENAMETOOLONG;
 	}
 
-	if ((ret = file_read_number(path, value)) < 0) {
+	if (*fd < 0 && (*fd = open(path, O_RDONLY)) < 0) {
+		ret = -errno;
+		upslog_with_errno(LOG_ERR, "open(%s) has failed", path);
+		return ret;
+	}
+
+	if ((ret = fd_read_number(*fd, value)) < 0) {
 		errno = -ret;
-		upslog_with_errno(LOG_ERR, "file_read_number(%s) has failed", path);
+		upslog_with_errno(LOG_ERR, "fd_read_number(%s) has failed", path);
+		/* the device may have gone, open it anew next time */
+		close(*fd);
+		*fd = -1;
 		return ret;
 	}
 
@@ -224,18 +254,20 @@ static int update_intvar(
 
 static int update_voltage(void)
 {
-	return update_intvar(ina219_base_path, "in1_input", &voltage);
+	return update_intvar(ina219_base_path, "in1_input", &voltage_fd, &voltage);
 }
 
 static int update_current(void)
 {
-	return update_intvar(ina219_base_path, "curr1_input", &current);
+	return update_intvar(ina219_base_path, "curr1_input", &current_fd, &current);
 }
 
 void upsdrv_makevartable(void)
 {
 	addvar(VAR_VALUE, "sysfs_dir",
 			"Path to sysfs dir of hwmon if port=auto (" SYSFS_HWMON_DIR ")");
+	addvar(VAR_VALUE, "lowpower_interval",
+			"Poll interval (seconds) while the readings are stable (default: 0, not used)");
 }
 
 static int parse_voltage(const char *s, double *v)
@@ -373,6 +405,9 @@ void upsdrv_initups(void)
 	if (getval("sysfs_dir"))
 		hwmon_dir = getval("sysfs_dir");
 
+	if (getval("lowpower_interval"))
+		lowpower_interval = (time_t)atoi(getval("lowpower_interval"));
+
 	if ((ret = scan_hwmon_ina219(hwmon_dir)) < 0) {
 		errno = -ret;
 		fatal_with_errno(EXIT_FAILURE, "scan_hwmon_ina219(%s) has failed",
@@ -416,6 +451,45 @@ static unsigned int battery_charge_compute(void)
 	return (unsigned int) charge;
 }
 
+/**
+ * @brief Poll every lowpower_interval while the status and the charge
+ * stay the same (and not on battery), every pollinterval otherwise.
+ */
+static void lowpower_update(unsigned int charge)
+{
+	const char *status = dstate_getinfo("ups.status");
+	char state[sizeof(last_state)];
+
+	if (lowpower_interval <= 0)
+		return;
+
+	if (normal_interval == 0)
+		normal_interval = poll_interval;
+
+	snprintf(state, sizeof(state), "%s %u", status ? status : "", charge);
+
+	if (!status || strstr(status, "OB") || strstr(status, "LB")
+	 || strcmp(state, last_state)
+	) {
+		snprintf(last_state, sizeof(last_state), "%s", state);
+		stable_updates = 0;
+		if (poll_interval != normal_interval) {
+			upsdebugx(1, "readings changed, polling every %" PRIdMAX " sec",
+					(intmax_t)normal_interval);
+			poll_interval = normal_interval;
+		}
+		return;
+	}
+
+	if (++stable_updates >= LOWPOWER_STABLE_UPDATES
+	 && poll_interval != lowpower_interval
+	) {
+		upsdebugx(1, "readings stable, polling every %" PRIdMAX " sec",
+				(intmax_t)lowpower_interval);
+		poll_interval = lowpower_interval;
+	}
+}
+
 void upsdrv_updateinfo(void)
 {
 	unsigned int charge = 0;
@@ -459,6 +533,8 @@ void upsdrv_updateinfo(void)
 
 	status_commit();
 	dstate_dataok();
+
+	lowpower_update(charge);
 }
 
 void upsdrv_shutdown(void)
@@ -479,4 +555,8 @@ void upsdrv_help(void)
 
 void upsdrv_cleanup(void)
 {
+	if (voltage_fd >= 0)
+		close(voltage_fd);
+	if (current_fd >= 0)
+		close(current_fd);
 }
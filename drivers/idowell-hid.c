@@ -64,7 +64,7 @@ static usage_tables_t idowell_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t idowell_hid2nut[] = {
+static const hid_info_t idowell_hid2nut[] = {
 #if WITH_UNMAPPED_DATA_POINTS || (defined DEBUG)
 	{ "unmapped.ups.flow.[4].flowid", 0, 0, "UPS.Flow.[4].FlowID", NULL, "%.0f", 0, NULL },
 	{ "unmapped.ups.powerconverter.output.outputid", 0, 0, "UPS.PowerConverter.Output.OutputID", NULL, "%.0f", 0, NULL },
@@ -169,4 +169,5 @@ subdriver_t idowell_subdriver = {
 	idowell_format_mfr,
 	idowell_format_serial,
 	fix_report_desc,
+	NULL,
 };
@@ -110,7 +110,7 @@ static info_lkp_t ietf_beeper_status_info[] = {
 };
 
 /* Snmp2NUT lookup table info_type, info_flags, info_len, OID, dfl, flags, oid2info, setvar */
-static snmp_info_t ietf_mib[] = {
+static const snmp_info_t ietf_mib[] = {
 
 	/* standard MIB items */
 	snmp_info_default("device.description", ST_FLAG_STRING | ST_FLAG_RW, SU_INFOSIZE, ".1.3.6.1.2.1.1.1.0", NULL, SU_FLAG_OK, NULL),
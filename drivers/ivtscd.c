@@ -21,11 +21,12 @@
 #include "config.h"
 #include "main.h"
 #include "serial.h"
+#include "coop.h"
 #include "nut_stdint.h"
 #include "attribute.h"
 
 #define DRIVER_NAME	"IVT Solar Controller driver"
-#define DRIVER_VERSION	"0.06"
+#define DRIVER_VERSION	"0.07"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -52,6 +53,12 @@ static struct {
 	float	temperature;
 } battery;
 
+/* what each device has of its own, when a process runs several */
+static const dstate_hostvar_t	ivt_hostvars[] = {
+	DSTATE_HOSTVAR(battery),
+	DSTATE_HOSTVAR_END
+};
+
 static ssize_t ivt_status(void)
 {
 	char	reply[SMALLBUF];
@@ -76,7 +83,7 @@ static ssize_t ivt_status(void)
 	}
 
 	upsdebugx(3, "send: F");
-	sleep(1);	/* allow controller some time to digest this */
+	coop_sleep(1000);	/* allow controller some time to digest this */
 
 	/*
 	 * read: R:12,57;- 1,1;20;12,57;13,18;- 2,1; 1,5;\n
@@ -215,6 +222,10 @@ void upsdrv_help(void)
 
 void upsdrv_makevartable(void)
 {
+	addhostvars(ivt_hostvars);
+
+	/* nothing but the serial helpers waits for the controller */
+	allow_coop_updates();
 }
 
 void upsdrv_initups(void)
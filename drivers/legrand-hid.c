@@ -122,7 +122,7 @@ static info_lkp_t legrand_times10M_info[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t legrand_hid2nut[] = {
+static const hid_info_t legrand_hid2nut[] = {
 	/* Input Data */
 	{ "input.voltage", 0, 0, "UPS.Input.Voltage", NULL, "%.0f", 0, NULL },
 	{ "input.voltage", 0, 0, "UPS.PowerConverter.Input.Voltage", NULL, "%.0f", 0, legrand_times1M_info },
@@ -233,4 +233,5 @@ subdriver_t legrand_subdriver = {
 	legrand_format_mfr,
 	legrand_format_serial,
 	fix_report_desc,
+	NULL,
 };
@@ -33,6 +33,7 @@
 #include "config.h" /* must be the first header */
 
 #include <stdio.h>
+#include <ctype.h>
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
@@ -43,6 +44,7 @@
 #include "libhid.h"
 #include "hidparser.h"
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
+#include "dstate.h" /* for dstate_perf_io_begin() */
 #include "nut_stdint.h"
 
 /* Communication layers and drivers (USB and MGE SHUT) */
@@ -55,7 +57,6 @@
 #endif	/* SHUT_MODE / USB */
 
 /* support functions */
-static double logical_to_physical(HIDData_t *Data, long logical);
 static long physical_to_logical(HIDData_t *Data, double physical);
 static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab);
 static long hid_lookup_usage(const char *name, usage_tables_t *utab);
@@ -63,6 +64,8 @@ static int string_to_path(const char *string, HIDPath_t *path, usage_tables_t *u
 static int path_to_string(char *string, size_t size, const HIDPath_t *path, usage_tables_t *utab);
 static int8_t get_unit_expo(const HIDData_t *hiddata);
 static double exponent(double a, int8_t b);
+static void prepare_conversion(HIDData_t *Data);
+static double convert_value(HIDData_t *Data, long logical);
 
 /* Tweak flag for APC Back-UPS */
 size_t max_report_size = 0;
@@ -93,11 +96,70 @@ void free_report_buffer(reportbuf_t *rbuf)
 
 	for (i=0; i<256; i++) {
 		free(rbuf->data[i]);
+		free(rbuf->prev[i]);
 	}
 
 	free(rbuf);
 }
 
+/* within a walk (between these two calls), each report is retrieved from
+   the device at most once: the reports the walk needs are the union of
+   those of the items it reads, and one already read in this walk is used
+   as it is whatever its age. Outside of a walk, only the age counts. */
+void begin_report_walk(reportbuf_t *rbuf)
+{
+	if (!rbuf)
+		return;
+
+	rbuf->walk++;
+	if (rbuf->walk == 0) {
+		/* wrapped: forget which reports the old walks got */
+		memset(rbuf->walk_seen, 0, sizeof(rbuf->walk_seen));
+		rbuf->walk = 1;
+	}
+}
+
+void end_report_walk(reportbuf_t *rbuf)
+{
+	if (!rbuf)
+		return;
+
+	memset(rbuf->walk_seen, 0, sizeof(rbuf->walk_seen));
+	rbuf->walk = 0;
+}
+
+/* a report was just retrieved: move to a new generation of it if its
+   data differs from the last one, so the users of its items can tell
+   whether their values may have changed (see usbhid-ups hid_ups_walk()) */
+static void report_retrieved(reportbuf_t *rbuf, int id)
+{
+	if (rbuf->gen[id] && !memcmp(rbuf->prev[id], rbuf->data[id], rbuf->len[id]))
+		return;
+
+	memcpy(rbuf->prev[id], rbuf->data[id], rbuf->len[id]);
+
+	rbuf->gen[id]++;
+	if (rbuf->gen[id] == 0)
+		rbuf->gen[id] = 1;
+}
+
+/* milliseconds on a clock which does not jump with the wall clock (if
+   there is one), for the report buffer timestamps; never 0 */
+static uint64_t report_buffer_msec(void)
+{
+	struct timeval	tv;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000 + 1;
+#endif
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000 + 1;
+}
+
 /* allocate a new report buffer. Return pointer on success, else NULL
    with errno set. The returned data structure must later be freed
    with free_report_buffer(). */
@@ -136,7 +198,8 @@ reportbuf_t *new_report_buffer(HIDDesc_t *arg_pDesc)
 		}
 
 		rbuf->data[id] = calloc(rbuf->len[id], sizeof(*(rbuf->data[id])));
-		if (rbuf->data[id])
+		rbuf->prev[id] = calloc(rbuf->len[id], sizeof(*(rbuf->prev[id])));
+		if (rbuf->data[id] && rbuf->prev[id])
 			continue;
 
 		/* on failure, give up what we got so far */
@@ -153,8 +216,9 @@ reportbuf_t *new_report_buffer(HIDDesc_t *arg_pDesc)
 
 /* refresh the report with the given id in the report buffer rbuf.  If
    the report is not yet in the buffer, or if it is older than "age"
-   seconds, then the report is freshly read from the USB
-   device. Otherwise, it is unchanged.
+   seconds (to the millisecond) and was not read yet in the current walk,
+   then the report is freshly read from the USB device. Otherwise, it is
+   unchanged.
    Return 0 on success, -1 on error with errno set. */
 /* because buggy firmwares from APC return wrong report size, we either
    ask the report with the found report size or with the whole buffer size
@@ -165,7 +229,10 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	int	ret;
 	size_t	r;
 
-	if (interrupt_only || rbuf->ts[id] + age > time(NULL)) {
+	if (interrupt_only
+	 || (rbuf->walk && rbuf->walk_seen[id] == rbuf->walk)
+	 || (rbuf->ts[id] && rbuf->ts[id] + (uint64_t)age * 1000 > report_buffer_msec())
+	) {
 		/* buffered report is still good; nothing to do */
 		upsdebug_hex(3, "Report[buf]", rbuf->data[id], rbuf->len[id]);
 		return 0;
@@ -228,9 +295,11 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 # pragma GCC diagnostic pop
 #endif
 
+	dstate_perf_io_begin();
 	ret = comm_driver->get_report(udev, id,
 		(usb_ctrl_charbuf)rbuf->data[id],
 		(usb_ctrl_charbufsize)r);
+	dstate_perf_io_end();
 
 	if (ret <= 0) {
 		errno = -ret;
@@ -251,7 +320,9 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	rbuf->ts[id] = report_buffer_msec();
+	rbuf->walk_seen[id] = rbuf->walk;
+	report_retrieved(rbuf, id);
 
 	return 0;
 }
@@ -336,9 +407,11 @@ static int set_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t
 # pragma GCC diagnostic pop
 #endif
 
+	dstate_perf_io_begin();
 	ret = comm_driver->set_report(udev, id,
 		(usb_ctrl_charbuf)rbuf->data[id],
 		(usb_ctrl_charbufsize)r);
+	dstate_perf_io_end();
 	if (ret <= 0) {
 		return -1;
 	}
@@ -347,6 +420,7 @@ static int set_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t
 
 	/* expire report */
 	rbuf->ts[id] = 0;
+	rbuf->walk_seen[id] = 0;
 
 	return 0;
 }
@@ -372,7 +446,9 @@ static int file_report_buffer(reportbuf_t *rbuf, unsigned char *buf, size_t bufl
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	rbuf->ts[id] = report_buffer_msec();
+	rbuf->walk_seen[id] = rbuf->walk;
+	report_retrieved(rbuf, id);
 
 	return 0;
 }
@@ -481,6 +557,206 @@ const char *HIDDataType(const HIDData_t *hiddata)
 	}
 }
 
+/* ---------------------------------------------------------------------- */
+/* usage index: the names and codes of a set of usage tables, each in an
+   open addressing hash of the entries, with the first of duplicates as
+   the linear scans found it; built on the first lookup in the tables */
+
+typedef struct hid_usage_index_s {
+	usage_tables_t	*utab;
+	const usage_lkp_t	**byname, **bycode;	/* NULL if empty */
+	size_t	size;	/* of both, a power of two */
+	struct hid_usage_index_s	*next;
+} hid_usage_index_t;
+
+static hid_usage_index_t	*usage_index = NULL;
+
+/* case insensitive, as the names are compared */
+static size_t usage_name_key(const char *name)
+{
+	size_t	hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (size_t)tolower((unsigned char)*name++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static size_t usage_code_key(HIDNode_t code)
+{
+	/* pages (high half) and ids (low half) both vary */
+	return (size_t)(code ^ (code >> 15)) * 2654435761U;
+}
+
+static hid_usage_index_t *usage_index_get(usage_tables_t *utab)
+{
+	hid_usage_index_t	*ui;
+	size_t	count = 0, mask, k;
+	int	i, j;
+
+	for (ui = usage_index; ui; ui = ui->next) {
+		if (ui->utab == utab)
+			return ui;
+	}
+
+	for (i = 0; utab[i] != NULL; i++) {
+		for (j = 0; utab[i][j].usage_name != NULL; j++)
+			count++;
+	}
+
+	ui = xcalloc(1, sizeof(*ui));
+	ui->utab = utab;
+
+	/* at most half full */
+	for (ui->size = 64; ui->size < count * 2; ui->size *= 2)
+		;
+	mask = ui->size - 1;
+	ui->byname = xcalloc(ui->size, sizeof(*ui->byname));
+	ui->bycode = xcalloc(ui->size, sizeof(*ui->bycode));
+
+	for (i = 0; utab[i] != NULL; i++) {
+		for (j = 0; utab[i][j].usage_name != NULL; j++) {
+			const usage_lkp_t	*u = &utab[i][j];
+
+			for (k = usage_name_key(u->usage_name) & mask; ui->byname[k]; k = (k + 1) & mask) {
+				if (!strcasecmp(ui->byname[k]->usage_name, u->usage_name))
+					break;
+			}
+			if (!ui->byname[k])
+				ui->byname[k] = u;
+
+			for (k = usage_code_key(u->usage_code) & mask; ui->bycode[k]; k = (k + 1) & mask) {
+				if (ui->bycode[k]->usage_code == u->usage_code)
+					break;
+			}
+			if (!ui->bycode[k])
+				ui->bycode[k] = u;
+		}
+	}
+
+	upsdebugx(5, "%s: indexed %" PRIuSIZE " usages", __func__, count);
+
+	ui->next = usage_index;
+	usage_index = ui;
+
+	return ui;
+}
+
+static void usage_index_free(void)
+{
+	hid_usage_index_t	*ui;
+
+	while ((ui = usage_index) != NULL) {
+		usage_index = ui->next;
+		free(ui->byname);
+		free(ui->bycode);
+		free(ui);
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+/* path cache: each textual HID path is translated once for a set of usage
+   tables, by string_to_path(), and kept in an open addressing hash of the
+   entries (index + 1, 0 if empty) for the next lookups of that path */
+
+typedef struct {
+	char		*text;
+	usage_tables_t	*utab;
+	HIDPath_t	Path;
+	int		depth;	/* as returned by string_to_path() */
+} hid_path_cache_t;
+
+static hid_path_cache_t	*path_cache = NULL;
+static size_t	path_cache_count = 0;
+static size_t	path_cache_alloc = 0;
+static size_t	*path_cache_hash = NULL;
+static size_t	path_cache_hash_size = 0;
+
+static size_t path_cache_key(const char *text, const usage_tables_t *utab)
+{
+	size_t	hash = 2166136261U;
+
+	while (*text) {
+		hash ^= (size_t)(unsigned char)*text++;
+		hash *= 16777619U;
+	}
+
+	return hash ^ (size_t)((uintptr_t)utab / sizeof(*utab));
+}
+
+static void path_cache_hash_add(size_t n)
+{
+	size_t	mask = path_cache_hash_size - 1, i;
+
+	for (i = path_cache_key(path_cache[n].text, path_cache[n].utab) & mask; path_cache_hash[i]; i = (i + 1) & mask)
+		;
+	path_cache_hash[i] = n + 1;
+}
+
+void HIDFreePathCache(void)
+{
+	size_t	i;
+
+	for (i = 0; i < path_cache_count; i++) {
+		free(path_cache[i].text);
+	}
+
+	free(path_cache);
+	free(path_cache_hash);
+	path_cache = NULL;
+	path_cache_hash = NULL;
+	path_cache_count = 0;
+	path_cache_alloc = 0;
+	path_cache_hash_size = 0;
+
+	usage_index_free();
+}
+
+/* translate a HID string path with string_to_path(), once */
+static const HIDPath_t *path_cache_get(const char *hidpath, usage_tables_t *utab, int *depth)
+{
+	size_t	mask, i;
+	hid_path_cache_t	*pc;
+
+	if (path_cache_hash_size) {
+		mask = path_cache_hash_size - 1;
+		for (i = path_cache_key(hidpath, utab) & mask; path_cache_hash[i]; i = (i + 1) & mask) {
+			pc = &path_cache[path_cache_hash[i] - 1];
+			if (pc->utab == utab && !strcmp(pc->text, hidpath)) {
+				*depth = pc->depth;
+				return &pc->Path;
+			}
+		}
+	}
+
+	if (path_cache_count == path_cache_alloc) {
+		path_cache_alloc = path_cache_alloc ? path_cache_alloc * 2 : 256;
+		path_cache = xrealloc(path_cache, path_cache_alloc * sizeof(*path_cache));
+	}
+
+	/* keep the hash at most half full */
+	if ((path_cache_count + 1) * 2 > path_cache_hash_size) {
+		free(path_cache_hash);
+		path_cache_hash_size = path_cache_hash_size ? path_cache_hash_size * 2 : 512;
+		path_cache_hash = xcalloc(path_cache_hash_size, sizeof(*path_cache_hash));
+		for (i = 0; i < path_cache_count; i++) {
+			path_cache_hash_add(i);
+		}
+	}
+
+	pc = &path_cache[path_cache_count];
+	memset(pc, 0, sizeof(*pc));
+	pc->text = xstrdup(hidpath);
+	pc->utab = utab;
+	pc->depth = string_to_path(hidpath, &pc->Path, utab);
+	path_cache_hash_add(path_cache_count++);
+
+	*depth = pc->depth;
+	return &pc->Path;
+}
+
 /* Returns pointer to the corresponding HIDData_t item
  * or NULL if path is not found in report descriptor
  */
@@ -489,7 +765,7 @@ HIDData_t *HIDGetItemData(const char *hidpath, usage_tables_t *utab)
 	int	r;
 	HIDPath_t Path;
 
-	r = string_to_path(hidpath, &Path, utab);
+	memcpy(&Path, path_cache_get(hidpath, utab, &r), sizeof(Path));
 	if (r <= 0) {
 		return NULL;
 	}
@@ -526,17 +802,65 @@ int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, ti
 		return -errno;
 	}
 
-	*Value = hValue;
+	/* Convert Logical Min, Max and Value into Physical,
+	 * process exponents and units */
+	*Value = convert_value(hiddata, hValue);
 
-	/* Convert Logical Min, Max and Value into Physical */
-	*Value = logical_to_physical(hiddata, hValue);
+	return 1;
+}
 
-	/* Process exponents and units */
-	*Value *= exponent(10, get_unit_expo(hiddata));
+/* HIDGetDataValue() for several items at once, typically those of one
+ * report as returned by HIDGetEvents(): the report is refreshed once for
+ * each run of items sharing a report ID, then the values are decoded from
+ * the buffer in a single pass.
+ * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
+ */
+int HIDGetDataValues(hid_dev_handle_t udev, HIDData_t **hiddata, int count, double *Values, time_t age)
+{
+	int	i, r;
+	long	hValue;
+	HIDData_t	*pData;
+
+	for (i = 0; i < count; i++) {
+
+		pData = hiddata[i];
+
+		if (pData == NULL) {
+			return 0;
+		}
+
+		if (i == 0 || pData->ReportID != hiddata[i-1]->ReportID) {
+			r = refresh_report_buffer(reportbuf, udev, pData, age);
+			if (r<0) {
+				upsdebug_with_errno(1, "Can't retrieve Report %02x", pData->ReportID);
+				return -errno;
+			}
+		}
+
+		GetValue(reportbuf->data[pData->ReportID], pData, &hValue);
+		Values[i] = convert_value(pData, hValue);
+	}
 
 	return 1;
 }
 
+/* Precompute the logical to physical conversion of all the items of
+ * pDesc; to be called again if they were modified after parsing (see
+ * fix_report_desc() in usbhid-ups). Items not prepared by this are done
+ * on their first conversion anyway. */
+void HIDPrepareConversions(HIDDesc_t *pDesc_arg)
+{
+	size_t	i;
+
+	if (pDesc_arg == NULL) {
+		return;
+	}
+
+	for (i = 0; i < pDesc_arg->nitems; i++) {
+		prepare_conversion(&pDesc_arg->item[i]);
+	}
+}
+
 /* Return the physical value associated with the given path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
@@ -670,6 +994,7 @@ int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
 
 	/* flush the report buffer (data may have changed) */
 	memset(reportbuf->ts, 0, sizeof(reportbuf->ts));
+	memset(reportbuf->walk_seen, 0, sizeof(reportbuf->walk_seen));
 
 	upsdebugx(4, "Set report succeeded");
 	return 1;
@@ -753,10 +1078,13 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
 # pragma GCC diagnostic pop
 #endif
 
+	dstate_perf_io_begin();
 	buflen = comm_driver->get_interrupt(
 		udev, (usb_ctrl_charbuf)buf,
 		(usb_ctrl_charbufsize)r,
-		750);
+		/* not to hold up the other devices of this process for long */
+		hosted_devices > 1 ? 100 : 750);
+	dstate_perf_io_end();
 
 	if (buflen <= 0) {
 		return buflen;	/* propagate "error" or "no event" code */
@@ -802,43 +1130,55 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
  * Support functions
  *******************************************************/
 
-static double logical_to_physical(HIDData_t *Data, long logical)
+/* Precompute the logical to physical conversion factor and the unit
+ * exponent multiplier, so convert_value() is a multiply-add, a clamp
+ * and a multiply */
+static void prepare_conversion(HIDData_t *Data)
 {
-	double physical;
-	double Factor;
-
 	upsdebugx(5, "PhyMax = %ld, PhyMin = %ld, LogMax = %ld, LogMin = %ld",
 		Data->PhyMax, Data->PhyMin, Data->LogMax, Data->LogMin);
 
+	Data->ConvScale = exponent(10, get_unit_expo(Data));
+
 	/* HID spec says that if one or both are undefined, or if they are
-	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. */
+	 * both 0, then PhyMin = LogMin, PhyMax = LogMax. Paranoia: Max
+	 * should be greater than Min, else the logical value is used as is */
 	if (!Data->have_PhyMax || !Data->have_PhyMin ||
-		(Data->PhyMax == 0 && Data->PhyMin == 0))
+		(Data->PhyMax == 0 && Data->PhyMin == 0) ||
+		(Data->PhyMax <= Data->PhyMin) || (Data->LogMax <= Data->LogMin))
 	{
-		return (double)logical;
+		Data->ConvFactor = 1;
+		Data->ConvMode = HID_CONV_LOGICAL;
+		return;
 	}
 
-	/* Paranoia */
-	if ((Data->PhyMax <= Data->PhyMin) || (Data->LogMax <= Data->LogMin))
-	{
-		/* this should not really happen */
-		upsdebugx(5, "Max was not greater than Min, returning logical value as is");
-		return (double)logical;
-	}
+	Data->ConvFactor = (double)(Data->PhyMax - Data->PhyMin) / (Data->LogMax - Data->LogMin);
+	Data->ConvMode = HID_CONV_LINEAR;
+}
 
-	Factor = (double)(Data->PhyMax - Data->PhyMin) / (Data->LogMax - Data->LogMin);
-	/* Convert Value */
-	physical = (double)((logical - Data->LogMin) * Factor) + Data->PhyMin;
+/* Convert Logical Min, Max and Value into Physical, and process exponents
+ * and units, with the values precomputed by prepare_conversion() */
+static double convert_value(HIDData_t *Data, long logical)
+{
+	double physical;
 
-	if (physical > Data->PhyMax) {
-		return Data->PhyMax;
+	if (Data->ConvMode == HID_CONV_NONE) {
+		prepare_conversion(Data);
+	}
+
+	if (Data->ConvMode == HID_CONV_LOGICAL) {
+		return (double)logical * Data->ConvScale;
 	}
 
-	if (physical < Data->PhyMin) {
-		return Data->PhyMin;
+	physical = (double)((logical - Data->LogMin) * Data->ConvFactor) + Data->PhyMin;
+
+	if (physical > Data->PhyMax) {
+		physical = Data->PhyMax;
+	} else if (physical < Data->PhyMin) {
+		physical = Data->PhyMin;
 	}
 
-	return physical;
+	return physical * Data->ConvScale;
 }
 
 static long physical_to_logical(HIDData_t *Data, double physical)
@@ -1019,19 +1359,17 @@ static int path_to_string(char *string, size_t size, const HIDPath_t *path, usag
  */
 static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 {
-	int i, j;
+	hid_usage_index_t	*ui = usage_index_get(utab);
+	size_t	mask = ui->size - 1, k;
 
-	for (i = 0; utab[i] != NULL; i++)
+	for (k = usage_name_key(name) & mask; ui->byname[k]; k = (k + 1) & mask)
 	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (strcasecmp(utab[i][j].usage_name, name))
-				continue;
+		if (strcasecmp(ui->byname[k]->usage_name, name))
+			continue;
 
-			/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
-			upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)utab[i][j].usage_code);
-			return (long)(utab[i][j].usage_code);
-		}
+		/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
+		upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)ui->byname[k]->usage_code);
+		return (long)(ui->byname[k]->usage_code);
 	}
 
 	upsdebugx(5, "hid_lookup_usage: %s -> not found in lookup table", name);
@@ -1041,18 +1379,16 @@ static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 /* usage conversion numeric -> string */
 static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab)
 {
-	int i, j;
+	hid_usage_index_t	*ui = usage_index_get(utab);
+	size_t	mask = ui->size - 1, k;
 
-	for (i = 0; utab[i] != NULL; i++)
+	for (k = usage_code_key(usage) & mask; ui->bycode[k]; k = (k + 1) & mask)
 	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (utab[i][j].usage_code != usage)
-				continue;
+		if (ui->bycode[k]->usage_code != usage)
+			continue;
 
-			upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, utab[i][j].usage_name);
-			return utab[i][j].usage_name;
-		}
+		upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, ui->bycode[k]->usage_name);
+		return ui->bycode[k]->usage_name;
 	}
 
 	upsdebugx(5, "hid_lookup_path: %08x -> not found in lookup table", (unsigned int)usage);
@@ -92,9 +92,13 @@ extern HIDDesc_t	*pDesc;	/* parsed Report Descriptor */
 /* report buffer structure: holds data about most recent report for
    each given report id */
 typedef struct reportbuf_s {
-	time_t	ts[256];			/* timestamp when report was retrieved */
+	uint64_t	ts[256];		/* when report was retrieved (msec, monotonic), 0 if expired */
 	size_t	len[256];			/* size of report data */
 	unsigned char	*data[256];		/* report data (allocated) */
+	unsigned int	walk;			/* current walk (see begin_report_walk()), 0 if none */
+	unsigned int	walk_seen[256];	/* walk in which report was last retrieved */
+	unsigned int	gen[256];		/* changes with the report data, 0 if never retrieved */
+	unsigned char	*prev[256];		/* report data at the last gen change (allocated) */
 } reportbuf_t;
 
 extern reportbuf_t	*reportbuf;	/* buffer for most recent reports */
@@ -125,6 +129,13 @@ bool_t HIDSetItemValue(hid_dev_handle_t udev, const char *hidpath, double value,
  * -------------------------------------------------------------------------- */
 HIDData_t *HIDGetItemData(const char *hidpath, usage_tables_t *utab);
 
+/*
+ * HIDFreePathCache
+ * Forget the HID paths HIDGetItemData() translated, and the indexes of
+ * the usage tables it looked their parts up in
+ * -------------------------------------------------------------------------- */
+void HIDFreePathCache(void);
+
 /*
  * GetDataItem
  * -------------------------------------------------------------------------- */
@@ -135,6 +146,16 @@ char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab);
  * -------------------------------------------------------------------------- */
 int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, time_t age);
 
+/*
+ * HIDGetDataValues
+ * -------------------------------------------------------------------------- */
+int HIDGetDataValues(hid_dev_handle_t udev, HIDData_t **hiddata, int count, double *Values, time_t age);
+
+/*
+ * HIDPrepareConversions
+ * -------------------------------------------------------------------------- */
+void HIDPrepareConversions(HIDDesc_t *pDesc_arg);
+
 /*
  * HIDSetDataValue
  * -------------------------------------------------------------------------- */
@@ -158,5 +179,7 @@ const char *HIDDataType(const HIDData_t *hiddata);
 
 void free_report_buffer(reportbuf_t *rbuf);
 reportbuf_t *new_report_buffer(HIDDesc_t *pDesc);
+void begin_report_walk(reportbuf_t *rbuf);
+void end_report_walk(reportbuf_t *rbuf);
 
 #endif /* NUT_LIBHID_H_SEEN */
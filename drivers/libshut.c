@@ -41,6 +41,7 @@
 #include "serial.h"
 #include "libshut.h"
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
+#include "dstate.h" /* for libshut_update_stats() */
 
 #define SHUT_DRIVER_NAME	"SHUT communication driver"
 #define SHUT_DRIVER_VERSION	"0.89"
@@ -334,6 +335,53 @@ static int shut_control_msg(
 	usb_ctrl_charbufsize size,
 	usb_ctrl_timeout_msec timeout);
 
+/* Bytes read from the port ahead of their use: each read takes all the
+ * bytes which came in (a whole frame, typically) in one system call,
+ * and shut_get_char() hands them out one at a time */
+static unsigned char	shut_rxbuf[64];
+static size_t	shut_rxhead = 0, shut_rxlen = 0;
+
+/* Request statistics, published by libshut_update_stats() */
+static uintmax_t	shut_stats_requests = 0, shut_stats_retries = 0,
+	shut_stats_timeouts = 0, shut_stats_reads = 0, shut_stats_bytes = 0;
+static long	shut_stats_latency_max = 0;	/* msec */
+
+static ssize_t shut_get_char(usb_dev_handle upsfd, unsigned char *ch, time_t d_sec)
+{
+	ssize_t	ret;
+
+	if (shut_rxhead >= shut_rxlen) {
+		shut_rxhead = shut_rxlen = 0;
+
+		ret = ser_get_buf(upsfd, shut_rxbuf, sizeof(shut_rxbuf), d_sec, 0);
+		shut_stats_reads++;
+		if (ret < 1) {
+			if (ret == 0)
+				shut_stats_timeouts++;
+			return ret;
+		}
+
+		shut_rxlen = (size_t)ret;
+		shut_stats_bytes += (uintmax_t)ret;
+	}
+
+	*ch = shut_rxbuf[shut_rxhead++];
+	return 1;
+}
+
+/* forget the bytes read ahead (the port was opened or closed) */
+static void shut_rx_flush(void)
+{
+	shut_rxhead = shut_rxlen = 0;
+}
+
+/* ask the UPS to send its last frame again */
+static void shut_send_nok(usb_dev_handle upsfd)
+{
+	shut_stats_retries++;
+	ser_send_char(upsfd, SHUT_NOK);
+}
+
 /* Data portability */
 /* realign packet data according to Endianess */
 #define BYTESWAP(in) ((((uint16_t)in & 0x00FF) << 8) + (((uint16_t)in & 0xFF00) >> 8))
@@ -446,6 +494,7 @@ static int libshut_open(
 
 	/* initialize serial port */
 	/* FIXME: add variable baudrate detection */
+	shut_rx_flush();
 	*arg_upsfd = ser_open(arg_device_path);
 	ser_set_speed(*arg_upsfd, arg_device_path, B2400);
 	setline(*arg_upsfd, 1);
@@ -701,6 +750,7 @@ static void libshut_close(usb_dev_handle arg_upsfd)
 	}
 
 	ser_close(arg_upsfd, NULL);
+	shut_rx_flush();
 }
 
 /* return the report of ID=type in report
@@ -908,7 +958,7 @@ int shut_synchronise(usb_dev_handle arg_upsfd)
 			continue;
 		}
 
-		ser_get_char(arg_upsfd, &reply, 1, 0);
+		shut_get_char(arg_upsfd, &reply, 1);
 		if (reply == c)
 		{
 			upsdebugx (3, "Syncing and notification setting done");
@@ -963,7 +1013,7 @@ static int shut_packet_recv(
 	while(datalen>0 && Retry<3)
 	{
 		/* if(serial_read (SHUT_TIMEOUT, &Start[0]) > 0) */
-		if(ser_get_char(arg_upsfd, &Start[0], SHUT_TIMEOUT/1000, 0) > 0)
+		if(shut_get_char(arg_upsfd, &Start[0], SHUT_TIMEOUT/1000) > 0)
 		{
 			/* sdata.shut_pkt.bType = Start[0]; */
 			if(Start[0]==SHUT_SYNC)
@@ -981,7 +1031,7 @@ static int shut_packet_recv(
 			else
 			{
 				/* if((serial_read (SHUT_TIMEOUT, &Start[1]) > 0) && */
-				if( (ser_get_char(arg_upsfd, &Start[1], SHUT_TIMEOUT/1000, 0) > 0) &&
+				if( (shut_get_char(arg_upsfd, &Start[1], SHUT_TIMEOUT/1000) > 0) &&
 							((Start[1]>>4)==(Start[1]&0x0F)))
 				{
 					upsdebug_hex(4, "Receive", Start, 2);
@@ -990,7 +1040,7 @@ static int shut_packet_recv(
 						upsdebugx (4,
 							"shut_packet_recv: invalid frame size = %d",
 							Size);
-						ser_send_char(arg_upsfd, SHUT_NOK);
+						shut_send_nok(arg_upsfd);
 						Retry++;
 						break;
 					}
@@ -998,13 +1048,13 @@ static int shut_packet_recv(
 					for(recv=0;recv<Size;recv++)
 					{
 						/* if(serial_read (SHUT_TIMEOUT, &Frame[recv]) < 1) */
-						if(ser_get_char(arg_upsfd, &Frame[recv], SHUT_TIMEOUT/1000, 0) < 1)
+						if(shut_get_char(arg_upsfd, &Frame[recv], SHUT_TIMEOUT/1000) < 1)
 							break;
 					}
 					upsdebug_hex(4, "Receive", Frame, Size);
 
 					/* serial_read (SHUT_TIMEOUT, &Chk[0]); */
-					ser_get_char(arg_upsfd, &Chk[0], SHUT_TIMEOUT/1000, 0);
+					shut_get_char(arg_upsfd, &Chk[0], SHUT_TIMEOUT/1000);
 					if(Chk[0]==shut_checksum(Frame, Size))
 					{
 						upsdebugx (4, "shut_checksum: %02x => OK", Chk[0]);
@@ -1040,7 +1090,7 @@ static int shut_packet_recv(
 					else
 					{
 						upsdebugx (4, "shut_checksum: %02x => NOK", Chk[0]);
-						ser_send_char(arg_upsfd, SHUT_NOK);
+						shut_send_nok(arg_upsfd);
 						/* shut_token_send(SHUT_NOK); */
 						Retry++;
 					}
@@ -1166,6 +1216,17 @@ static int shut_get_descriptor(
  *                    int value, int index, unsigned char *bytes, int size,
  *                    int timeout)
  */
+static int shut_control_transfer(
+	usb_dev_handle arg_upsfd,
+	usb_ctrl_requesttype requesttype,
+	usb_ctrl_request request,
+	usb_ctrl_msgvalue value,
+	usb_ctrl_repindex index,
+	usb_ctrl_charbuf bytes,
+	usb_ctrl_charbufsize size,
+	usb_ctrl_timeout_msec timeout);
+
+/* shut_control_transfer(), counted and timed for the statistics */
 static int shut_control_msg(
 	usb_dev_handle arg_upsfd,
 	usb_ctrl_requesttype requesttype,
@@ -1175,6 +1236,34 @@ static int shut_control_msg(
 	usb_ctrl_charbuf bytes,
 	usb_ctrl_charbufsize size,
 	usb_ctrl_timeout_msec timeout)
+{
+	struct timeval	start, end;
+	long	msec;
+	int	ret;
+
+	gettimeofday(&start, NULL);
+	ret = shut_control_transfer(arg_upsfd, requesttype, request, value,
+		index, bytes, size, timeout);
+	gettimeofday(&end, NULL);
+
+	msec = (long)(end.tv_sec - start.tv_sec) * 1000
+		+ (long)(end.tv_usec - start.tv_usec) / 1000;
+	shut_stats_requests++;
+	if (msec > shut_stats_latency_max)
+		shut_stats_latency_max = msec;
+
+	return ret;
+}
+
+static int shut_control_transfer(
+	usb_dev_handle arg_upsfd,
+	usb_ctrl_requesttype requesttype,
+	usb_ctrl_request request,
+	usb_ctrl_msgvalue value,
+	usb_ctrl_repindex index,
+	usb_ctrl_charbuf bytes,
+	usb_ctrl_charbufsize size,
+	usb_ctrl_timeout_msec timeout)
 {
 	unsigned char shut_pkt[11];
 	short Retry=1, set_pass = -1;
@@ -1183,7 +1272,7 @@ static int shut_control_msg(
 	struct shut_ctrltransfer_s ctrl;
 	int ret = 0;
 
-	upsdebugx (3, "entering shut_control_msg");
+	upsdebugx (3, "entering shut_control_transfer");
 
 	/* deal for set requests */
 	if (requesttype == REQUEST_TYPE_SET_REPORT)
@@ -1333,7 +1422,7 @@ static int shut_control_msg(
 				{
 					upsdebugx(4, "Retry = %i", Retry);
 					/* Send a NACK to get a resend from the UPS */
-					ser_send_char(arg_upsfd, SHUT_NOK);
+					shut_send_nok(arg_upsfd);
 					Retry++;
 				}
 				break;
@@ -1342,7 +1431,7 @@ static int shut_control_msg(
 				/* FIXME: notification caught => to be processed */
 
 				/* Send a NACK for the moment, to get a resend from the UPS */
-				ser_send_char(arg_upsfd, SHUT_NOK);
+				shut_send_nok(arg_upsfd);
 				Retry++;
 				goto fallthrough_default;
 
@@ -1377,7 +1466,7 @@ int shut_wait_ack(usb_dev_handle arg_upsfd)
 	int retCode = -1;
 	unsigned char c = '\0';
 
-	ser_get_char(arg_upsfd, &c, SHUT_TIMEOUT/1000, 0);
+	shut_get_char(arg_upsfd, &c, SHUT_TIMEOUT/1000);
 	if (c == SHUT_OK)
 	{
 		upsdebugx (2, "shut_wait_ack(): ACK received");
@@ -1398,3 +1487,15 @@ int shut_wait_ack(usb_dev_handle arg_upsfd)
 
 	return retCode;
 }
+
+/* Publish the request statistics as driver.perf.shut.* (with the
+ * "perfstats" flag, see docs/nut-names.txt) */
+void libshut_update_stats(void)
+{
+	dstate_setinfo("driver.perf.shut.requests", "%" PRIuMAX, shut_stats_requests);
+	dstate_setinfo("driver.perf.shut.retries", "%" PRIuMAX, shut_stats_retries);
+	dstate_setinfo("driver.perf.shut.timeouts", "%" PRIuMAX, shut_stats_timeouts);
+	dstate_setinfo("driver.perf.shut.reads", "%" PRIuMAX, shut_stats_reads);
+	dstate_setinfo("driver.perf.shut.bytes", "%" PRIuMAX, shut_stats_bytes);
+	dstate_setinfo_long("driver.perf.shut.latency.max", shut_stats_latency_max);
+}
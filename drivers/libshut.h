@@ -168,6 +168,9 @@ typedef struct shut_communication_subdriver_s {
 
 extern shut_communication_subdriver_t	shut_subdriver;
 
+/* publish the SHUT request statistics as driver.perf.shut.* */
+void libshut_update_stats(void);
+
 /*!
  * Notification levels
  * These are however not processed currently
@@ -61,6 +61,17 @@ static char *strcasestr(const char *haystack, const char *needle);
 
 static void nut_libusb_close(usb_dev_handle *udev);
 
+/* the usb_* options of the device were parsed into usb_subdriver */
+static int	usb_hid_number_opts_parsed = 0;
+
+/* per device when the driver runs several (see addhostvars() in main.h);
+ * libusb 0.1 keeps one list of the busses for all of them anyway */
+static const dstate_hostvar_t	nut_libusb_hostvars[] = {
+	DSTATE_HOSTVAR(usb_subdriver),
+	DSTATE_HOSTVAR(usb_hid_number_opts_parsed),
+	DSTATE_HOSTVAR_END
+};
+
 /*! Add USB-related driver variables with addvar() and dstate_setinfo().
  * This removes some code duplication across the USB drivers.
  */
@@ -136,6 +147,10 @@ static inline int typesafe_control_msg(
 		(char *) bytes, (int) size, timeout);
 }
 
+const dstate_hostvar_t *nut_usb_hostvars(void)
+{
+	return nut_libusb_hostvars;
+}
 
 /* invoke matcher against device */
 static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
@@ -241,7 +256,6 @@ static int nut_libusb_open(usb_dev_handle **udevp,
 
 	struct usb_bus *busses;
 
-	static int usb_hid_number_opts_parsed = 0;
 	if (!usb_hid_number_opts_parsed) {
 		const char *s;
 		unsigned short us = 0;
@@ -346,36 +360,6 @@ static int nut_libusb_open(usb_dev_handle **udevp,
 			/* supported vendors are now checked by the
 			   supplied matcher */
 
-			/* open the device */
-			*udevp = udev = usb_open(dev);
-			if (!udev) {
-				/* It seems that with libusb-0.1 API we
-				 * can only evaluate the string value of
-				 * usb_strerror() return values - in the
-				 * library source there is magic about
-				 * tracking errors in their string buffer
-				 * or as a printable errno, and no reliably
-				 * usable way to learn of an EACCESS or
-				 * other situation diagnostics otherwise.
-				 * So we have to search for sub-strings
-				 * and hope for locale to be right...
-				 */
-				char *libusb_error = usb_strerror();
-				upsdebugx(1, "Failed to open device (%04X/%04X), skipping: %s",
-					dev->descriptor.idVendor,
-					dev->descriptor.idProduct,
-					libusb_error);
-
-				count_open_errors++;
-				if (strcasestr(libusb_error, "Access denied")
-				||  strcasestr(libusb_error, "insufficient permissions")
-				) {
-					count_open_EACCESS++;
-				}
-
-				continue;
-			}
-
 			/* collect the identifying information of this
 			   device. Note that this is safe, because
 			   there's no need to claim an interface for
@@ -410,6 +394,44 @@ static int nut_libusb_open(usb_dev_handle **udevp,
 			sprintf(curDevice->BusPort, "%03d", 0);
 #endif
 
+			/* the IDs and location are known without opening the
+			 * device: only open and query those which may be the
+			 * one we want */
+			if (!USBMatchDeviceIDs(matcher, curDevice)) {
+				upsdebugx(2, "Device does not match - skipping");
+				continue;
+			}
+
+			/* open the device */
+			*udevp = udev = usb_open(dev);
+			if (!udev) {
+				/* It seems that with libusb-0.1 API we
+				 * can only evaluate the string value of
+				 * usb_strerror() return values - in the
+				 * library source there is magic about
+				 * tracking errors in their string buffer
+				 * or as a printable errno, and no reliably
+				 * usable way to learn of an EACCESS or
+				 * other situation diagnostics otherwise.
+				 * So we have to search for sub-strings
+				 * and hope for locale to be right...
+				 */
+				char *libusb_error = usb_strerror();
+				upsdebugx(1, "Failed to open device (%04X/%04X), skipping: %s",
+					dev->descriptor.idVendor,
+					dev->descriptor.idProduct,
+					libusb_error);
+
+				count_open_errors++;
+				if (strcasestr(libusb_error, "Access denied")
+				||  strcasestr(libusb_error, "insufficient permissions")
+				) {
+					count_open_EACCESS++;
+				}
+
+				continue;
+			}
+
 			if (dev->descriptor.iManufacturer) {
 				ret = nut_usb_get_string(udev, dev->descriptor.iManufacturer,
 					string, sizeof(string));
@@ -1013,5 +1035,8 @@ usb_communication_subdriver_t usb_subdriver = {
 	LIBUSB_DEFAULT_INTERFACE,
 	LIBUSB_DEFAULT_DESC_INDEX,
 	LIBUSB_DEFAULT_HID_EP_IN,
-	LIBUSB_DEFAULT_HID_EP_OUT
+	LIBUSB_DEFAULT_HID_EP_OUT,
+	NULL,	/* no asynchronous interrupt transfers */
+	NULL,	/* no hotplug events */
+	NULL
 };
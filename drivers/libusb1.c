@@ -31,6 +31,11 @@
 #include "usb-common.h"
 #include "nut_libusb.h"
 #include "nut_stdint.h"
+#include "dstate.h" /* for dstate_addevent() */
+
+#ifndef WIN32
+# include <poll.h>
+#endif
 
 #define USB_DRIVER_NAME		"USB communication driver (libusb 1.0)"
 #define USB_DRIVER_VERSION	"0.50"
@@ -48,6 +53,59 @@ upsdrv_info_t comm_upsdrv_info = {
 
 static void nut_libusb_close(libusb_device_handle *udev);
 
+/* the usb_* options of the device were parsed into usb_subdriver */
+static int	usb_hid_number_opts_parsed = 0;
+
+static const dstate_hostvar_t	nut_libusb_hostvars[] = {
+	DSTATE_HOSTVAR(usb_subdriver),
+	DSTATE_HOSTVAR(usb_hid_number_opts_parsed),
+	DSTATE_HOSTVAR_END
+};
+
+/* With several devices run by this process (see addhostvars() in main.h),
+ * the bus is enumerated once for all of them: the list is kept, along with
+ * the strings read from the devices opened to match them (so the others do
+ * not open and ask them again), and which of them one of ours uses. It is
+ * enumerated anew when a device is not found in there, as it may have been
+ * plugged in since. The list holds a reference to the default libusb
+ * context, so all these devices share it even as they reconnect. */
+typedef struct {
+	int	probed;		/* the strings below were read */
+	int	claimed;	/* used by a device of this process */
+	char	*Vendor, *Product, *Serial;
+} nut_libusb_known_t;
+
+static libusb_device	**known_list = NULL;
+static nut_libusb_known_t	*known = NULL;
+static ssize_t	known_count = 0;
+
+#ifndef WIN32
+/* Asynchronous interrupt transfers (see nut_libusb_start_interrupt_async()):
+ * the transfer kept submitted, the reports it brought which get_interrupt()
+ * did not hand out yet, and the libusb error which stopped it (if any) */
+#define ASYNC_QUEUE_SIZE	16
+#define ASYNC_REPORT_SIZE	512
+
+static struct libusb_transfer	*async_transfer = NULL;
+static unsigned char	async_buf[ASYNC_REPORT_SIZE];
+static struct {
+	int	len;
+	unsigned char	data[ASYNC_REPORT_SIZE];
+} async_queue[ASYNC_QUEUE_SIZE];
+static size_t	async_head = 0, async_count = 0;
+static int	async_error = LIBUSB_SUCCESS;
+static int	async_done = 0;	/* the transfer will not come back */
+
+/* Hotplug watch (see nut_libusb_watch_hotplug()): whether it is on, and
+ * the arrivals seen since nut_libusb_hotplug_arrived() last looked */
+# if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+#  define NUT_LIBUSB_HOTPLUG	1
+static libusb_hotplug_callback_handle	hotplug_handle;
+static int	hotplug_active = 0;
+static int	hotplug_arrivals = 0;
+# endif
+#endif	/* !WIN32 */
+
 /*! Add USB-related driver variables with addvar() and dstate_setinfo().
  * This removes some code duplication across the USB drivers.
  */
@@ -102,6 +160,11 @@ void nut_usb_addvars(void)
 	upsdebugx(1, "Using USB implementation: %s", dstate_getinfo("driver.version.usb"));
 }
 
+const dstate_hostvar_t *nut_usb_hostvars(void)
+{
+	return nut_libusb_hostvars;
+}
+
 /* invoke matcher against device */
 static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
 	if (!matcher) {
@@ -110,6 +173,141 @@ static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
 	return matcher->match_function(device, matcher->privdata);
 }
 
+static void nut_libusb_known_drop(libusb_device **list, nut_libusb_known_t *kn, ssize_t count)
+{
+	ssize_t	i;
+
+	for (i = 0; i < count; i++) {
+		free(kn[i].Vendor);
+		free(kn[i].Product);
+		free(kn[i].Serial);
+	}
+	free(kn);
+
+	if (list) {
+		libusb_free_device_list(list, 1);
+	}
+}
+
+static void nut_libusb_known_free(void)
+{
+	if (!known_list) {
+		return;
+	}
+
+	nut_libusb_known_drop(known_list, known, known_count);
+	known_list = NULL;
+	known = NULL;
+	known_count = 0;
+	libusb_exit(NULL);
+}
+
+/* The devices on the bus, enumerated now (*enumerated is set) if fresh
+ * or if this process runs one device, else as known from before. Give
+ * the list back with nut_libusb_free_device_list(). */
+static ssize_t nut_libusb_get_device_list(libusb_device ***devlist,
+	int fresh, int *enumerated)
+{
+	libusb_device	**list;
+	nut_libusb_known_t	*kn;
+	ssize_t	count, i, j;
+
+	*enumerated = 1;
+
+	if (hosted_devices < 2) {
+		return libusb_get_device_list(NULL, devlist);
+	}
+
+	if (known_list && !fresh) {
+		*enumerated = 0;
+		*devlist = known_list;
+		return known_count;
+	}
+
+	*devlist = NULL;
+	count = libusb_get_device_list(NULL, &list);
+	if (count < 0) {
+		return count;
+	}
+
+	/* keep what is known of the devices still there: libusb has the
+	 * same libusb_device for one as long as it is referenced */
+	kn = xcalloc((size_t)count + 1, sizeof(*kn));
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < known_count; j++) {
+			if (known_list[j] == list[i]) {
+				kn[i] = known[j];
+				memset(&known[j], 0, sizeof(known[j]));
+				break;
+			}
+		}
+	}
+
+	if (known_list) {
+		nut_libusb_known_drop(known_list, known, known_count);
+	} else if (libusb_init(NULL) >= 0) {
+		static int	atexit_done = 0;
+
+		if (!atexit_done) {
+			atexit(nut_libusb_known_free);
+			atexit_done = 1;
+		}
+	}
+
+	known_list = list;
+	known = kn;
+	known_count = count;
+
+	*devlist = known_list;
+	return known_count;
+}
+
+static void nut_libusb_free_device_list(libusb_device **devlist)
+{
+	if (devlist && devlist != known_list) {
+		libusb_free_device_list(devlist, 1);
+	}
+}
+
+/* the device is no longer used by one of ours */
+static void nut_libusb_known_release(libusb_device_handle *udev)
+{
+	libusb_device	*device = libusb_get_device(udev);
+	ssize_t	i;
+
+	for (i = 0; i < known_count; i++) {
+		if (known_list[i] == device) {
+			known[i].claimed = 0;
+			return;
+		}
+	}
+}
+
+/* Whether the matchers take the device, with its strings as read before
+ * (copied to curDevice), without opening it */
+static int nut_libusb_known_matches(USBDeviceMatcher_t *matcher,
+	const nut_libusb_known_t *kn, USBDevice_t *curDevice)
+{
+	USBDeviceMatcher_t	*m;
+	int	ret;
+
+	curDevice->Vendor = kn->Vendor ? xstrdup(kn->Vendor) : NULL;
+	curDevice->Product = kn->Product ? xstrdup(kn->Product) : NULL;
+	curDevice->Serial = kn->Serial ? xstrdup(kn->Serial) : NULL;
+
+	for (m = matcher; m; m = m->next) {
+		ret = matches(m, curDevice);
+		if (ret == -1) {
+			fatal_with_errno(EXIT_FAILURE, "matcher");
+		}
+		if (ret == 0 || ret == -2) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 /*! If needed, set the USB alternate interface.
  *
  * In NUT 2.7.2 and earlier, the following call was made unconditionally:
@@ -190,6 +388,8 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 	libusb_device **devlist;
 	ssize_t	devcount = 0;
 	size_t	devnum;
+	int	fresh = 0, enumerated;
+	nut_libusb_known_t	*kn;
 	struct libusb_device_descriptor dev_desc;
 	struct libusb_config_descriptor *conf_desc = NULL;
 	const struct libusb_interface_descriptor *if_desc;
@@ -211,7 +411,6 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 	unsigned char	rdbuf[MAX_REPORT_SIZE];
 	int32_t		rdlen;
 
-	static int	usb_hid_number_opts_parsed = 0;
 	if (!usb_hid_number_opts_parsed) {
 		const char	*s;
 		unsigned short	us = 0;
@@ -298,11 +497,14 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 #ifndef __linux__ /* SUN_LIBUSB (confirmed to work on Solaris and FreeBSD) */
 	/* Causes a double free corruption in linux if device is detached! */
 	/* nut_libusb_close(*udevp); */
-	if (*udevp)
+	if (*udevp) {
+		nut_libusb_known_release(*udevp);
 		libusb_close(*udevp);
+	}
 #endif
 
-	devcount = libusb_get_device_list(NULL, &devlist);
+enumerate:
+	devcount = nut_libusb_get_device_list(&devlist, fresh, &enumerated);
 
 	/* devcount may be < 0, loop will get skipped;
 	 * its SSIZE_MAX < SIZE_MAX for devnum */
@@ -318,21 +520,6 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 
 		/* supported vendors are now checked by the supplied matcher */
 
-		/* open the device */
-		ret = libusb_open(device, udevp);
-		if (ret != 0) {
-			upsdebugx(1, "Failed to open device (%04X/%04X), skipping: %s",
-				dev_desc.idVendor,
-				dev_desc.idProduct,
-				libusb_strerror((enum libusb_error)ret));
-			count_open_errors++;
-			if (ret == LIBUSB_ERROR_ACCESS) {
-				count_open_EACCESS++;
-			}
-			continue;
-		}
-		udev = *udevp;
-
 		/* collect the identifying information of this
 		   device. Note that this is safe, because
 		   there's no need to claim an interface for
@@ -355,7 +542,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		bus_num = libusb_get_bus_number(device);
 		curDevice->Bus = (char *)malloc(4);
 		if (curDevice->Bus == NULL) {
-			libusb_free_device_list(devlist, 1);
+			nut_libusb_free_device_list(devlist);
 			fatal_with_errno(EXIT_FAILURE, "Out of memory");
 		}
 		sprintf(curDevice->Bus, "%03d", bus_num);
@@ -363,7 +550,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		device_addr = libusb_get_device_address(device);
 		curDevice->Device = (char *)malloc(4);
 		if (curDevice->Device == NULL) {
-			libusb_free_device_list(devlist, 1);
+			nut_libusb_free_device_list(devlist);
 			fatal_with_errno(EXIT_FAILURE, "Out of memory");
 		}
 		if (device_addr > 0) {
@@ -389,7 +576,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		bus_port = libusb_get_port_number(device);
 		curDevice->BusPort = (char *)malloc(4);
 		if (curDevice->BusPort == NULL) {
-			libusb_free_device_list(devlist, 1);
+			nut_libusb_free_device_list(devlist);
 			fatal_with_errno(EXIT_FAILURE, "Out of memory");
 		}
 		if (bus_port > 0) {
@@ -406,13 +593,48 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		curDevice->ProductID = dev_desc.idProduct;
 		curDevice->bcdDevice = dev_desc.bcdDevice;
 
-		if (dev_desc.iManufacturer) {
+		/* the IDs and location are known without opening the device:
+		 * with several devices on the bus (and as many drivers), only
+		 * open and query those which may be the one we want */
+		if (!USBMatchDeviceIDs(matcher, curDevice)) {
+			upsdebugx(2, "Device does not match - skipping");
+			continue;
+		}
+
+		/* what another device of this process found out */
+		kn = (devlist == known_list) ? &known[devnum] : NULL;
+		if (kn && kn->claimed) {
+			upsdebugx(2, "Device is used by another one of this driver - skipping");
+			continue;
+		}
+		if (kn && kn->probed && !nut_libusb_known_matches(matcher, kn, curDevice)) {
+			upsdebugx(2, "Device does not match - skipping");
+			nut_libusb_subdriver_defaults(&usb_subdriver);
+			continue;
+		}
+
+		/* open the device */
+		ret = libusb_open(device, udevp);
+		if (ret != 0) {
+			upsdebugx(1, "Failed to open device (%04X/%04X), skipping: %s",
+				dev_desc.idVendor,
+				dev_desc.idProduct,
+				libusb_strerror((enum libusb_error)ret));
+			count_open_errors++;
+			if (ret == LIBUSB_ERROR_ACCESS) {
+				count_open_EACCESS++;
+			}
+			continue;
+		}
+		udev = *udevp;
+
+		if (dev_desc.iManufacturer && !curDevice->Vendor) {
 			ret = nut_usb_get_string(udev, dev_desc.iManufacturer,
 				string, sizeof(string));
 			if (ret > 0) {
 				curDevice->Vendor = strdup(string);
 				if (curDevice->Vendor == NULL) {
-					libusb_free_device_list(devlist, 1);
+					nut_libusb_free_device_list(devlist);
 					fatal_with_errno(EXIT_FAILURE, "Out of memory");
 				}
 			} else {
@@ -420,13 +642,13 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 		}
 
-		if (dev_desc.iProduct) {
+		if (dev_desc.iProduct && !curDevice->Product) {
 			ret = nut_usb_get_string(udev, dev_desc.iProduct,
 				string, sizeof(string));
 			if (ret > 0) {
 				curDevice->Product = strdup(string);
 				if (curDevice->Product == NULL) {
-					libusb_free_device_list(devlist, 1);
+					nut_libusb_free_device_list(devlist);
 					fatal_with_errno(EXIT_FAILURE, "Out of memory");
 				}
 			} else {
@@ -434,13 +656,13 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 		}
 
-		if (dev_desc.iSerialNumber) {
+		if (dev_desc.iSerialNumber && !curDevice->Serial) {
 			ret = nut_usb_get_string(udev, dev_desc.iSerialNumber,
 				string, sizeof(string));
 			if (ret > 0) {
 				curDevice->Serial = strdup(string);
 				if (curDevice->Serial == NULL) {
-					libusb_free_device_list(devlist, 1);
+					nut_libusb_free_device_list(devlist);
 					fatal_with_errno(EXIT_FAILURE, "Out of memory");
 				}
 			} else {
@@ -448,6 +670,13 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 		}
 
+		if (kn && !kn->probed) {
+			kn->Vendor = curDevice->Vendor ? xstrdup(curDevice->Vendor) : NULL;
+			kn->Product = curDevice->Product ? xstrdup(curDevice->Product) : NULL;
+			kn->Serial = curDevice->Serial ? xstrdup(curDevice->Serial) : NULL;
+			kn->probed = 1;
+		}
+
 		upsdebugx(2, "- VendorID: %04x", curDevice->VendorID);
 		upsdebugx(2, "- ProductID: %04x", curDevice->ProductID);
 		upsdebugx(2, "- Manufacturer: %s", curDevice->Vendor ? curDevice->Vendor : "unknown");
@@ -473,7 +702,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 				upsdebugx(2, "Device does not match - skipping");
 				goto next_device;
 			} else if (ret==-1) {
-				libusb_free_device_list(devlist, 1);
+				nut_libusb_free_device_list(devlist);
 				fatal_with_errno(EXIT_FAILURE, "matcher");
 #ifndef HAVE___ATTRIBUTE__NORETURN
 # if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE)
@@ -573,7 +802,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 
 			libusb_free_config_descriptor(conf_desc);
-			libusb_free_device_list(devlist, 1);
+			nut_libusb_free_device_list(devlist);
 			fatalx(EXIT_FAILURE,
 				"Can't claim USB device [%04x:%04x]@%d/%d/%d: %s",
 				curDevice->VendorID, curDevice->ProductID,
@@ -590,7 +819,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 
 			libusb_free_config_descriptor(conf_desc);
-			libusb_free_device_list(devlist, 1);
+			nut_libusb_free_device_list(devlist);
 			fatalx(EXIT_FAILURE,
 				"Can't claim USB device [%04x:%04x]@%d/%d/%d: %s",
 				curDevice->VendorID, curDevice->ProductID,
@@ -612,7 +841,10 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		 */
 		if (!callback) {
 			libusb_free_config_descriptor(conf_desc);
-			libusb_free_device_list(devlist, 1);
+			nut_libusb_free_device_list(devlist);
+			if (kn) {
+				kn->claimed = 1;
+			}
 			return 1;
 		}
 
@@ -801,7 +1033,10 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			);
 
 		fflush(stdout);
-		libusb_free_device_list(devlist, 1);
+		nut_libusb_free_device_list(devlist);
+		if (kn) {
+			kn->claimed = 1;
+		}
 
 		return rdlen;
 
@@ -817,7 +1052,17 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 
 	/* If we got here, we did not return a successfully chosen device above */
 	*udevp = NULL;
-	libusb_free_device_list(devlist, 1);
+	nut_libusb_free_device_list(devlist);
+
+	if (!enumerated) {
+		/* not among the devices known from before */
+		upsdebugx(2, "libusb1: enumerating the USB devices again");
+		fresh = 1;
+		count_open_EACCESS = 0;
+		count_open_errors = 0;
+		count_open_attempts = 0;
+		goto enumerate;
+	}
 	upsdebugx(2, "libusb1: No appropriate HID device found");
 	fflush(stdout);
 
@@ -1084,6 +1329,32 @@ static int nut_libusb_get_interrupt(
 	/* ret = libusb_interrupt_transfer(udev, 0x81, buf, bufsize, &bufsize, timeout); */
 	/* libusb0: ret = usb_interrupt_read(udev, USB_ENDPOINT_IN + usb_subdriver.hid_ep_in, (char *)buf, bufsize, timeout); */
 	/* Interrupt EP is LIBUSB_ENDPOINT_IN with offset defined in hid_ep_in, which is 0 by default, unless overridden in subdriver. */
+#ifndef WIN32
+	if (async_transfer) {
+		struct timeval	tv = { 0, 0 };
+
+		/* collect what completed since the main loop last looked */
+		libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+
+		if (async_count > 0) {
+			ret = async_queue[async_head].len;
+			if (ret > tmpbufsize) {
+				ret = tmpbufsize;
+			}
+			memcpy(buf, async_queue[async_head].data, (size_t)ret);
+			async_head = (async_head + 1) % ASYNC_QUEUE_SIZE;
+			async_count--;
+			return ret;
+		}
+
+		if (async_error != LIBUSB_SUCCESS) {
+			return nut_libusb_strerror(async_error, __func__);
+		}
+
+		return 0;	/* no event */
+	}
+#endif	/* !WIN32 */
+
 	ret = libusb_interrupt_transfer(udev,
 		LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
 		(unsigned char *)buf, tmpbufsize, &tmpbufsize, timeout);
@@ -1106,16 +1377,321 @@ static int nut_libusb_get_interrupt(
 	return nut_libusb_strerror(ret, __func__);
 }
 
+#ifndef WIN32
+/* libusb calls this from libusb_handle_events*() when the
+ * interrupt transfer completed (or failed, or was cancelled) */
+static void LIBUSB_CALL nut_libusb_async_cb(struct libusb_transfer *transfer)
+{
+	size_t	tail;
+	int	ret;
+
+	switch (transfer->status)
+	{
+	case LIBUSB_TRANSFER_COMPLETED:
+		if (transfer->actual_length <= 0) {
+			break;
+		}
+
+		if (async_count == ASYNC_QUEUE_SIZE) {
+			upsdebugx(1, "%s: report queue full, dropping the oldest", __func__);
+			async_head = (async_head + 1) % ASYNC_QUEUE_SIZE;
+			async_count--;
+		}
+
+		tail = (async_head + async_count) % ASYNC_QUEUE_SIZE;
+		async_queue[tail].len = transfer->actual_length;
+		memcpy(async_queue[tail].data, transfer->buffer, (size_t)transfer->actual_length);
+		async_count++;
+		break;
+
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		break;
+
+	case LIBUSB_TRANSFER_CANCELLED:
+		async_done = 1;
+		return;
+
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		async_error = LIBUSB_ERROR_NO_DEVICE;
+		async_done = 1;
+		return;
+
+	case LIBUSB_TRANSFER_STALL:
+		async_error = LIBUSB_ERROR_PIPE;
+		async_done = 1;
+		return;
+
+	case LIBUSB_TRANSFER_OVERFLOW:
+	case LIBUSB_TRANSFER_ERROR:
+	default:
+		async_error = LIBUSB_ERROR_IO;
+		async_done = 1;
+		return;
+	}
+
+	ret = libusb_submit_transfer(transfer);
+	if (ret != LIBUSB_SUCCESS) {
+		async_error = ret;
+		async_done = 1;
+	}
+}
+
+/* dstate event handler for the fds libusb polls: returns 1 (update now)
+ * if reports came in, or the transfer stopped, or a watched device came */
+static int nut_libusb_async_event(int fd, short revents, void *arg)
+{
+	struct timeval	tv = { 0, 0 };
+
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(revents);
+	NUT_UNUSED_VARIABLE(arg);
+
+	libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+
+#ifdef NUT_LIBUSB_HOTPLUG
+	if (hotplug_arrivals > 0) {
+		return 1;
+	}
+#endif
+	return (async_count > 0 || async_error != LIBUSB_SUCCESS);
+}
+
+static void LIBUSB_CALL nut_libusb_pollfd_added(int fd, short events, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+
+	dstate_addevent(fd, events, nut_libusb_async_event, NULL);
+}
+
+static void LIBUSB_CALL nut_libusb_pollfd_removed(int fd, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+
+	dstate_delevent(fd);
+}
+
+/* Stop listening to the fds libusb polls */
+static void nut_libusb_drop_pollfds(void)
+{
+	const struct libusb_pollfd	**fds;
+	size_t	i;
+
+	libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+	fds = libusb_get_pollfds(NULL);
+	if (fds) {
+		for (i = 0; fds[i] != NULL; i++) {
+			dstate_delevent(fds[i]->fd);
+		}
+		libusb_free_pollfds(fds);
+	}
+}
+
+/* Keep an interrupt transfer submitted, and have the driver main loop
+ * poll the fds libusb waits on, so the reports are read as they come
+ * rather than once per poll_interval with a blocking call */
+static int nut_libusb_start_interrupt_async(
+	libusb_device_handle *udev,
+	usb_ctrl_charbufsize bufsize)
+{
+	const struct libusb_pollfd	**fds;
+	size_t	i;
+	int	ret;
+
+	if (!udev || async_transfer) {
+		return -1;
+	}
+
+	if (!libusb_pollfds_handle_timeouts(NULL)) {
+		/* only the interrupt transfer (which has no timeout) is
+		 * handled out of the control calls, but be careful */
+		upsdebugx(1, "%s: libusb needs its own timeouts here, not used", __func__);
+		return -1;
+	}
+
+	fds = libusb_get_pollfds(NULL);
+	if (!fds) {
+		upsdebugx(1, "%s: libusb gives no fds to poll", __func__);
+		return -1;
+	}
+
+	async_transfer = libusb_alloc_transfer(0);
+	if (!async_transfer) {
+		libusb_free_pollfds(fds);
+		return -1;
+	}
+
+	async_head = async_count = 0;
+	async_error = LIBUSB_SUCCESS;
+	async_done = 0;
+
+	if (bufsize <= 0 || (uintmax_t)bufsize > sizeof(async_buf)) {
+		bufsize = (usb_ctrl_charbufsize)sizeof(async_buf);
+	}
+
+	libusb_fill_interrupt_transfer(async_transfer, udev,
+		LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in,
+		async_buf, (int)bufsize, nut_libusb_async_cb, NULL, 0);
+
+	ret = libusb_submit_transfer(async_transfer);
+	if (ret != LIBUSB_SUCCESS) {
+		upsdebugx(1, "%s: %s", __func__, libusb_strerror((enum libusb_error)ret));
+		libusb_free_transfer(async_transfer);
+		async_transfer = NULL;
+		libusb_free_pollfds(fds);
+		return -1;
+	}
+
+	for (i = 0; fds[i] != NULL; i++) {
+		dstate_addevent(fds[i]->fd, fds[i]->events, nut_libusb_async_event, NULL);
+	}
+	libusb_free_pollfds(fds);
+	libusb_set_pollfd_notifiers(NULL, nut_libusb_pollfd_added, nut_libusb_pollfd_removed, NULL);
+
+	upsdebugx(2, "%s: interrupt transfer submitted", __func__);
+	return 0;
+}
+
+/* Cancel the interrupt transfer, and drop the fds libusb had polled */
+static void nut_libusb_stop_interrupt_async(void)
+{
+	struct timeval	tv = { 0, 100000 };
+	int	tries;
+
+	if (!async_transfer) {
+		return;
+	}
+
+	if (!async_done) {
+		libusb_cancel_transfer(async_transfer);
+	}
+
+	/* the transfer belongs to libusb until the callback saw it end */
+	for (tries = 0; !async_done && tries < 10; tries++) {
+		libusb_handle_events_timeout_completed(NULL, &tv, &async_done);
+	}
+
+	if (async_done) {
+		libusb_free_transfer(async_transfer);
+	} else {
+		upsdebugx(1, "%s: interrupt transfer did not end, not freed", __func__);
+	}
+	async_transfer = NULL;
+	async_count = 0;
+
+	nut_libusb_drop_pollfds();
+}
+
+#ifdef NUT_LIBUSB_HOTPLUG
+static int LIBUSB_CALL nut_libusb_hotplug_cb(libusb_context *ctx,
+	libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(device);
+	NUT_UNUSED_VARIABLE(user_data);
+
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		upsdebugx(2, "%s: device arrived", __func__);
+		hotplug_arrivals++;
+	}
+
+	return 0;	/* keep the callback registered */
+}
+
+/* While the device is away, have libusb tell (through the fds the driver
+ * main loop polls) when one with its IDs arrives, rather than enumerating
+ * the bus every poll_interval to find out. The watch holds a reference to
+ * the libusb context, as closing the device drops the one it had. */
+static int nut_libusb_watch_hotplug(USBDevice_t *device)
+{
+	const struct libusb_pollfd	**fds;
+	size_t	i;
+	int	ret;
+
+	if (!device) {
+		if (hotplug_active) {
+			libusb_hotplug_deregister_callback(NULL, hotplug_handle);
+			nut_libusb_drop_pollfds();
+			libusb_exit(NULL);
+			hotplug_active = 0;
+			upsdebugx(2, "%s: stopped watching", __func__);
+		}
+		return 0;
+	}
+
+	if (hotplug_active) {
+		return 0;
+	}
+
+	if (libusb_init(NULL) < 0) {
+		return -1;
+	}
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		upsdebugx(1, "%s: libusb has no hotplug support here", __func__);
+		libusb_exit(NULL);
+		return -1;
+	}
+
+	fds = libusb_get_pollfds(NULL);
+	if (!fds) {
+		upsdebugx(1, "%s: libusb gives no fds to poll", __func__);
+		libusb_exit(NULL);
+		return -1;
+	}
+
+	/* with LIBUSB_HOTPLUG_ENUMERATE, a matching device already there
+	 * counts as arrived: it may not have gone away at all */
+	hotplug_arrivals = 0;
+	ret = libusb_hotplug_register_callback(NULL,
+		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_ENUMERATE,
+		device->VendorID ? device->VendorID : LIBUSB_HOTPLUG_MATCH_ANY,
+		device->ProductID ? device->ProductID : LIBUSB_HOTPLUG_MATCH_ANY,
+		LIBUSB_HOTPLUG_MATCH_ANY,
+		nut_libusb_hotplug_cb, NULL, &hotplug_handle);
+	if (ret != LIBUSB_SUCCESS) {
+		upsdebugx(1, "%s: %s", __func__, libusb_strerror((enum libusb_error)ret));
+		libusb_free_pollfds(fds);
+		libusb_exit(NULL);
+		return -1;
+	}
+
+	for (i = 0; fds[i] != NULL; i++) {
+		dstate_addevent(fds[i]->fd, fds[i]->events, nut_libusb_async_event, NULL);
+	}
+	libusb_free_pollfds(fds);
+	libusb_set_pollfd_notifiers(NULL, nut_libusb_pollfd_added, nut_libusb_pollfd_removed, NULL);
+
+	hotplug_active = 1;
+	upsdebugx(2, "%s: watching for %04x:%04x", __func__,
+		device->VendorID, device->ProductID);
+	return 0;
+}
+
+static int nut_libusb_hotplug_arrived(void)
+{
+	int	arrived = (hotplug_arrivals > 0);
+
+	hotplug_arrivals = 0;
+	return arrived;
+}
+#endif	/* NUT_LIBUSB_HOTPLUG */
+#endif	/* !WIN32 */
+
 static void nut_libusb_close(libusb_device_handle *udev)
 {
 	if (!udev) {
 		return;
 	}
 
+#ifndef WIN32
+	nut_libusb_stop_interrupt_async();
+#endif
+
 	/* usb_release_interface() sometimes blocks and goes
 	 * into uninterruptible sleep.  So don't do it.
 	 */
 	/* libusb_release_interface(udev, usb_subdriver.hid_rep_index); */
+	nut_libusb_known_release(udev);
 	libusb_close(udev);
 	libusb_exit(NULL);
 }
@@ -1133,5 +1709,17 @@ usb_communication_subdriver_t usb_subdriver = {
 	LIBUSB_DEFAULT_INTERFACE,
 	LIBUSB_DEFAULT_DESC_INDEX,
 	LIBUSB_DEFAULT_HID_EP_IN,
-	LIBUSB_DEFAULT_HID_EP_OUT
+	LIBUSB_DEFAULT_HID_EP_OUT,
+#ifndef WIN32
+	nut_libusb_start_interrupt_async,
+#else
+	NULL,
+#endif
+#ifdef NUT_LIBUSB_HOTPLUG
+	nut_libusb_watch_hotplug,
+	nut_libusb_hotplug_arrived
+#else
+	NULL,
+	NULL
+#endif
 };
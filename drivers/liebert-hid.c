@@ -67,7 +67,7 @@ static usage_tables_t liebert_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t liebert_hid2nut[] = {
+static const hid_info_t liebert_hid2nut[] = {
 
 #if WITH_UNMAPPED_DATA_POINTS
   { "unmapped.ups.powersummary.flowid", 0, 0, "UPS.PowerSummary.FlowID", NULL, "%.0f", 0, NULL },
@@ -190,4 +190,5 @@ subdriver_t liebert_subdriver = {
 	liebert_format_mfr,
 	liebert_format_serial,
 	fix_report_desc,
+	NULL,
 };
@@ -21,15 +21,19 @@
 #include "config.h"
 #include "main.h"
 #include "attribute.h"
+#include "nut_stdint.h"
 
 #include <regex.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <notify.h>
 
 #include "CoreFoundation/CoreFoundation.h"
 #include "IOKit/ps/IOPowerSources.h"
 #include "IOKit/ps/IOPSKeys.h"
 
 #define DRIVER_NAME	"Mac OS X UPS meta-driver"
-#define DRIVER_VERSION	"1.42"
+#define DRIVER_VERSION	"1.43"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
@@ -47,6 +51,62 @@ upsdrv_info_t upsdrv_info = {
 static CFStringRef g_power_source_name = NULL;
 static double max_capacity_value = 100.0;
 
+/* IOKit posts this notify(3) name when a power source changes (any of
+ * its values, since 10.9; only its AC/battery state before that) */
+#ifdef kIOPSNotifyAnyPowerSource
+# define PS_NOTIFY_NAME	kIOPSNotifyAnyPowerSource
+#else
+# define PS_NOTIFY_NAME	kIOPSNotifyPowerSource
+#endif
+
+static int ps_notify_fd = -1;
+static int ps_notify_token;
+
+/* the main loop found the notify fd readable: update now */
+static int ps_notify_event(int fd, short revents, void *arg)
+{
+	int	token;
+
+	NUT_UNUSED_VARIABLE(revents);
+	NUT_UNUSED_VARIABLE(arg);
+
+	/* one token per notification, several may have piled up */
+	while (read(fd, &token, sizeof(token)) == (ssize_t)sizeof(token))
+		;
+
+	upsdebugx(2, "%s: power source changed", __func__);
+
+	return 1;
+}
+
+static void ps_notify_start(void)
+{
+	int	flags;
+
+	if (notify_register_file_descriptor(PS_NOTIFY_NAME, &ps_notify_fd, 0,
+		&ps_notify_token) != NOTIFY_STATUS_OK
+	) {
+		upslogx(LOG_WARNING, "Can't register for power source "
+			"notifications, only polling every %" PRIdMAX " seconds",
+			(intmax_t)poll_interval);
+		ps_notify_fd = -1;
+		return;
+	}
+
+	flags = fcntl(ps_notify_fd, F_GETFL);
+	if (flags < 0 || fcntl(ps_notify_fd, F_SETFL, flags | O_NONBLOCK) < 0
+	 || dstate_addevent(ps_notify_fd, POLLIN, ps_notify_event, NULL) < 0
+	) {
+		upslogx(LOG_WARNING, "Can't watch power source notifications, "
+			"only polling");
+		notify_cancel(ps_notify_token);
+		ps_notify_fd = -1;
+		return;
+	}
+
+	upsdebugx(1, "Watching %s notifications", PS_NOTIFY_NAME);
+}
+
 /*! Copy the current power dictionary.
  *
  * Caller must release power dictionary when finished with it.
@@ -249,15 +309,6 @@ void upsdrv_updateinfo(void)
 		}
 	}
 
-	/* TODO: it should be possible to set poll_interval (and maxage in the
-	 * server) to an absurdly large value, and use notify(3) to get
-	 * updates.
-	 */
-
-	/*
-	 * poll_interval = 2;
-	 */
-
 	dstate_dataok();
 	CFRelease(power_dictionary);
 }
@@ -458,6 +509,9 @@ void upsdrv_initups(void)
 
 	g_power_source_name = potential_model;
 
+	/* changes get here as they happen, polling is only a safety net */
+	ps_notify_start();
+
 	/* the upsh handlers can't be done here, as they get initialized
 	 * shortly after upsdrv_initups returns to main.
 	 */
@@ -472,6 +526,12 @@ void upsdrv_cleanup(void)
 	upsdebugx(1, "Cleanup: release references");
 	CFRelease(g_power_source_name);
 
+	if (ps_notify_fd >= 0) {
+		dstate_delevent(ps_notify_fd);
+		notify_cancel(ps_notify_token);	/* closes the fd */
+		ps_notify_fd = -1;
+	}
+
 	/* free(dynamic_mem); */
 	/* ser_close(upsfd, device_path); */
 }
@@ -27,9 +27,13 @@
 #include "dstate.h"
 #include "attribute.h"
 #include "upsdrvquery.h"
+#include "nuttrace.h"
+#include "coop.h"
+#include "dstats.h"
 
 #ifndef WIN32
 # include <grp.h>
+# include <poll.h>
 #endif
 #include <fcntl.h>
 #include <sys/types.h>
@@ -83,6 +87,34 @@ vartab_t	*vartab_h = NULL;
  * user and group may be set globally or per-driver
  */
 time_t	poll_interval = 2;
+
+/* the updates are due on a fixed grid of poll_interval from the start
+ * (so a slow update does not push the next ones later), shifted by
+ * pollphase (msec, or derived from the device name for "auto") and by
+ * up to polljitter (msec) at random for each one */
+static long	poll_phase = 0, poll_jitter = 0;
+static int	poll_phase_auto = 0;
+static struct timeval	poll_due, poll_next;	/* without and with jitter */
+static intmax_t	poll_overruns = 0;
+
+/* upsdrv_updateinfo() runs as a task (see coop.h) if the driver allows
+ * it and the device has no "nocoop" flag: then it may wait for the device
+ * in the middle, while the main loop goes on */
+static int	coop_allowed = 0;
+static int	coop_disabled = 0;
+static coop_task_t	*coop_task = NULL;
+static struct timeval	poll_update_start;	/* of the update in progress */
+
+/* rolling-window statistics of the variables named by "stats" */
+static char	*stats_vars = NULL, *stats_windows = NULL;
+static dstats_t	*stats = NULL;
+
+/* devices run by this process: more than one with "-a" given several
+ * times to a driver which listed its per-device state by addhostvars() */
+size_t	hosted_devices = 1;
+static const dstate_hostvar_t	**drv_hostvars = NULL;	/* ended by NULL */
+static unsigned char	*drv_hostvars_initial = NULL;
+static size_t	drv_hostvars_size = 0;
 static char	*chroot_path = NULL, *user = NULL, *group = NULL;
 static int	user_from_cmdline = 0, group_from_cmdline = 0;
 
@@ -769,6 +801,57 @@ void addvar(int vartype, const char *name, const char *desc)
 	do_addvar(vartype, name, desc, 0);
 }
 
+static size_t hostvars_size(const dstate_hostvar_t *vars)
+{
+	size_t	size = 0;
+
+	for (; vars && vars->addr; vars++) {
+		size += vars->size;
+	}
+
+	return size;
+}
+
+/* copy the variables into state, returns the end of what was written */
+static unsigned char *hostvars_save(const dstate_hostvar_t *vars, unsigned char *state)
+{
+	for (; vars && vars->addr; vars++) {
+		memcpy(state, vars->addr, vars->size);
+		state += vars->size;
+	}
+
+	return state;
+}
+
+/* public callback from driver - its updates may run as tasks */
+void allow_coop_updates(void)
+{
+	coop_allowed = 1;
+}
+
+/* public callback from driver - the variables holding the state of one
+ * device, which lets the driver run several of them in one process */
+void addhostvars(const dstate_hostvar_t *vars)
+{
+	size_t	n = 0, size = hostvars_size(vars);
+
+	/* upsdrv_makevartable() is called again for each device */
+	for (; drv_hostvars && drv_hostvars[n]; n++) {
+		if (drv_hostvars[n] == vars) {
+			return;
+		}
+	}
+
+	drv_hostvars = xrealloc(drv_hostvars, (n + 2) * sizeof(*drv_hostvars));
+	drv_hostvars[n] = vars;
+	drv_hostvars[n + 1] = NULL;
+
+	/* what a device starts with */
+	drv_hostvars_initial = xrealloc(drv_hostvars_initial, drv_hostvars_size + size + 1);
+	hostvars_save(vars, drv_hostvars_initial + drv_hostvars_size);
+	drv_hostvars_size += size;
+}
+
 /* Try each instant command in the comma-separated list of
  * sdcmds, until the first one that reports it was handled.
  * Returns STAT_INSTCMD_HANDLED if one of those was accepted
@@ -1130,6 +1213,54 @@ invalid:
 	return STAT_SET_INVALID;
 }
 
+/* pollphase and polljitter, from the global or the driver section;
+ * returns 1 if var was one of them */
+static int poll_schedule_arg(const char *var, const char *val)
+{
+	char	buf[SMALLBUF];
+	long	msec;
+
+	if (!strcmp(var, "pollphase")) {
+		if (poll_phase_auto)
+			snprintf(buf, sizeof(buf), "auto");
+		else
+			snprintf(buf, sizeof(buf), "%ld", poll_phase);
+
+		/* the schedule is laid out once, when the loop starts */
+		if (testval_reloadable(var, buf, val, 0) > 0) {
+			if (!strcasecmp(val, "auto")) {
+				poll_phase_auto = 1;
+				poll_phase = 0;
+			} else if (str_to_long(val, &msec, 10) && msec >= 0) {
+				poll_phase_auto = 0;
+				poll_phase = msec;
+			} else {
+				fatalx(EXIT_FAILURE, "Error: UPS [%s]: invalid pollphase: %s",
+					NUT_STRARG(upsname), val);
+			}
+		}
+
+		return 1;
+	}
+
+	if (!strcmp(var, "polljitter")) {
+		snprintf(buf, sizeof(buf), "%ld", poll_jitter);
+
+		if (testval_reloadable(var, buf, val, 1) > 0) {
+			if (str_to_long(val, &msec, 10) && msec >= 0) {
+				poll_jitter = msec;
+			} else {
+				fatalx(EXIT_FAILURE, "Error: UPS [%s]: invalid polljitter: %s",
+					NUT_STRARG(upsname), val);
+			}
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
 /* handle -x / ups.conf config details that are for this part of the code */
 static int main_arg(char *var, char *val)
 {
@@ -1155,6 +1286,17 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	/* the updates are started as they are when the loop begins */
+	if (!strcmp(var, "nocoop")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			coop_disabled = 1;
+			dstate_setinfo("driver.flag.nocoop", "enabled");
+		}
+		return 1;	/* handled */
+	}
+
 	/* FIXME: this one we could potentially reload, but need to figure
 	 * out that the flag line was commented away or deleted -- there is
 	 * no setting value to flip in configs here
@@ -1168,6 +1310,37 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	/* the state table is set up once, when the socket is */
+	if (!strcmp(var, "sharedstate")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			dstate_setinfo("driver.flag.sharedstate", "enabled");
+		}
+		return 1;	/* handled */
+	}
+
+	/* see capcache.c */
+	if (!strcmp(var, "nocapcache")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			dstate_setinfo("driver.flag.nocapcache", "enabled");
+		}
+		return 1;	/* handled */
+	}
+
+	/* see dstate_perf_update() */
+	if (!strcmp(var, "perfstats")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			dstate_setinfo("driver.flag.perfstats", "enabled");
+			dstate_perf_enable();
+		}
+		return 1;	/* handled */
+	}
+
 	if (!strcmp(var, "allow_killpower")) {
 		if (reload_flag) {
 			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
@@ -1273,6 +1446,10 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	/* per-driver overrides of the global settings */
+	if (poll_schedule_arg(var, val))
+		return 1;	/* handled */
+
 	/* Allow per-driver overrides of the global setting
 	 * and allow to reload this, why not.
 	 * Note: this may cause "spurious" redefinitions of the
@@ -1300,10 +1477,33 @@ static int main_arg(char *var, char *val)
 	if (!strcmp(var, "sdorder"))
 		return 1;	/* handled */
 
+	/* only for upsdrvctl (which passes us all "-a" of the group) */
+	if (!strcmp(var, "hostgroup"))
+		return 1;	/* handled */
+
 	/* only for upsd (at the moment) - ignored here */
 	if (!strcmp(var, "desc"))
 		return 1;	/* handled */
 
+	/* the windows are made once the driver runs: no reload */
+	if (!strcmp(var, "stats")) {
+		if (testinfo_reloadable(var, "driver.parameter.stats", val, 0) > 0) {
+			free(stats_vars);
+			stats_vars = xstrdup(val);
+			dstate_setinfo("driver.parameter.stats", "%s", val);
+		}
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "statswindows")) {
+		if (testinfo_reloadable(var, "driver.parameter.statswindows", val, 0) > 0) {
+			free(stats_windows);
+			stats_windows = xstrdup(val);
+			dstate_setinfo("driver.parameter.statswindows", "%s", val);
+		}
+		return 1;	/* handled */
+	}
+
 	if (!strcmp(var, "sdcommands")) {
 		if (testinfo_reloadable(var, "driver.parameter.sdcommands", val, 1) > 0) {
 			if (device_sdcommands)
@@ -1389,6 +1589,9 @@ static void do_global_args(const char *var, const char *val)
 		return;
 	}
 
+	if (poll_schedule_arg(var, val))
+		return;
+
 	/* In checks below, testinfo_reloadable(..., 0) should forbid
 	 * re-population of the setting with a new value, but emit a
 	 * warning if it did change (so driver restart is needed to apply)
@@ -1712,13 +1915,13 @@ static int handle_reload_flag(void) {
 	 */
 	reload_requires_restart = -1;
 	/* 0 - Do not abort drivers started with '-s TMP_UPS_NAME' */
-	if (read_upsconf(0) < 0) {
-		upsdebugx(1, "%s: read_upsconf() failed fundamentally; "
+	if (read_upsconf_section(upsname, 0) < 0) {
+		upsdebugx(1, "%s: read_upsconf_section() failed fundamentally; "
 			"is this driver running via ups.conf at all?",
 			__func__);
 	}
 
-	upsdebugx(1, "%s: read_upsconf() for [%s] completed, restart-required verdict was: %d",
+	upsdebugx(1, "%s: read_upsconf_section() for [%s] completed, restart-required verdict was: %d",
 		__func__, upsname, reload_requires_restart);
 
 	/* handle reload-or-error reports */
@@ -1822,190 +2025,1128 @@ void vartab_free(void)
 }
 
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
-static void exit_upsdrv_cleanup(void)
+static int timeval_before(const struct timeval *a, const struct timeval *b)
 {
-	dstate_setinfo("driver.state", "cleanup.upsdrv");
-	upsdrv_cleanup();
+	return (a->tv_sec < b->tv_sec
+		|| (a->tv_sec == b->tv_sec && a->tv_usec < b->tv_usec));
 }
 
-static void exit_cleanup(void)
+static void timeval_add_msec(struct timeval *tv, long msec)
 {
-	dstate_setinfo("driver.state", "cleanup.exit");
+	tv->tv_sec += msec / 1000;
+	tv->tv_usec += (msec % 1000) * 1000;
 
-	if (!dump_data && !help_only) {
-		upsnotify(NOTIFY_STATE_STOPPING, "exit_cleanup()");
+	if (tv->tv_usec >= 1000000) {
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
 	}
+}
 
-	free(chroot_path);
-	free(device_path);
-	free(user);
-	free(group);
+/* the jittered deadline for the update due at poll_due */
+static void poll_schedule_jitter(void)
+{
+	long	jitter = poll_jitter;
 
-	if (pidfn) {
-		unlink(pidfn);
-		free(pidfn);
-	}
+	poll_next = poll_due;
 
-	dstate_free();
-	vartab_free();
+	/* never into the next interval */
+	if (jitter >= (long)poll_interval * 1000)
+		jitter = (long)poll_interval * 1000 - 1;
 
-#ifdef WIN32
-	if(mutex != INVALID_HANDLE_VALUE) {
-		ReleaseMutex(mutex);
-		CloseHandle(mutex);
-	}
-#endif
+	if (jitter > 0)
+		timeval_add_msec(&poll_next, (long)(rand() % (jitter + 1)));
 }
-#endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 
-void set_exit_flag(int sig)
+/* lay out the schedule from now, shifted by the phase of this device */
+static void poll_schedule_start(void)
 {
-	switch (exit_flag) {
-		case -2:
-			upsdebugx(1, "%s: raising exit flag due to programmatic abort: EXIT_SUCCESS", __func__);
-			break;
-		case -1:
-			upsdebugx(1, "%s: raising exit flag due to programmatic abort: EXIT_FAILURE", __func__);
-			break;
-		default:
-			upsdebugx(1, "%s: raising exit flag due to signal %d", __func__, sig);
+	static int	seeded = 0;
+	long	period = (long)poll_interval * 1000, phase = poll_phase;
+
+	if (!seeded) {
+		srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+		seeded = 1;
 	}
-	exit_flag = sig;
+
+	if (poll_phase_auto && upsname) {
+		/* spread drivers started together over the interval */
+		const char	*p;
+		unsigned long	hash = 5381;
+
+		for (p = upsname; *p; p++)
+			hash = hash * 33 + (unsigned char)*p;
+
+		phase = (long)(hash % (unsigned long)period);
+	}
+
+	gettimeofday(&poll_due, NULL);
+	timeval_add_msec(&poll_due, phase % period);
+	poll_schedule_jitter();
+
+	upsdebugx(1, "Polling every %" PRIdMAX " sec with a phase of %ld msec "
+		"and up to %ld msec of jitter",
+		(intmax_t)poll_interval, phase % period, poll_jitter);
 }
 
-static void set_reload_flag(
-#ifndef WIN32
-	int
-#else
-	char *
-#endif
-	sig)
+/* the next deadline is the next slot of the grid which is still ahead */
+static void poll_update_done(void)
 {
-#ifndef WIN32
-/* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upd and upsmon */
-	switch (sig) {
-		case SIGCMD_RELOAD_OR_EXIT:	/* SIGUSR1 */
-			/* reload-or-exit (this driver instance may die) */
-			reload_flag = 2;
-			break;
+	struct timeval	end;
+	long	duration;
+	intmax_t	skipped = 0;
 
-#ifdef SIGCMD_RELOAD_OR_RESTART
-		case SIGCMD_RELOAD_OR_RESTART:	/* SIGUSR2 */
-			/* reload-or-restart (this driver instance may recycle itself) */
-			/* FIXME: Not implemented yet */
-			reload_flag = 3;
-			break;
-#endif
+	/* what the driver just read goes into the windows, if not stale */
+	if (!dstate_is_stale()) {
+		dstats_sample(stats, poll_update_start.tv_sec);
+	}
 
-		case SIGCMD_EXIT:	/* Not even a signal, but a socket protocol action,
-			* and not a reload either - just applied here for consistency */
-/*
-			reload_flag = 15;
-			break;
-*/
-			set_exit_flag(EF_EXIT_SUCCESS);
-			return;
+	dstate_setinfo_long("driver.state.bytes", (long)dstate_bytes());
+	dstate_commit_batch();
+	dstate_setinfo("driver.state", "quiet");
 
-		case SIGCMD_RELOAD:	/* SIGHUP */
-		case SIGCMD_RELOAD_OR_ERROR:	/* Not even a signal, but a socket protocol action */
-		default:
-			/* reload what we can, log what needs a restart so skipped */
-			reload_flag = 1;
+	gettimeofday(&end, NULL);
+	duration = (long)(end.tv_sec - poll_update_start.tv_sec) * 1000
+		+ (long)(end.tv_usec - poll_update_start.tv_usec) / 1000;
+
+	if (!timeval_before(&poll_update_start, &poll_due)) {
+		timeval_add_msec(&poll_due, (long)poll_interval * 1000);
 	}
 
-	upsdebugx(1, "%s: raising reload flag due to signal %d (%s) => reload_flag=%d",
-		__func__, sig, strsignal(sig), reload_flag);
-#else
-	if (sig && !strcmp(sig, SIGCMD_RELOAD_OR_ERROR)) {
-		/* reload what we can, log what needs a restart so skipped */
-		reload_flag = 1;
-	} else if (sig && !strcmp(sig, SIGCMD_EXIT)) {
-		set_exit_flag(EF_EXIT_SUCCESS);
-		return;
-	} else {
-		/* non-fatal reload as a fallback */
-		reload_flag = 1;
+	/* rather skip the slots we missed than poll in a burst to catch up */
+	while (!timeval_before(&end, &poll_due)) {
+		timeval_add_msec(&poll_due, (long)poll_interval * 1000);
+		skipped++;
 	}
 
-	upsdebugx(1, "%s: raising reload flag due to command %s => reload_flag=%d",
-		__func__, sig, reload_flag);
-#endif  /* WIN32 */
+	if (skipped) {
+		poll_overruns++;
+		upsdebugx(1, "Update took %ld msec, skipped %" PRIdMAX
+			" polling interval(s)", duration, skipped);
+	}
+
+	poll_schedule_jitter();
+
+	dstate_setinfo("driver.update.duration", "%ld", duration);
+	dstate_setinfo("driver.update.overrun", "%" PRIdMAX, poll_overruns);
+	dstate_perf_update(duration);
 }
 
-#ifndef WIN32
-/* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upd and upsmon */
-static void handle_dstate_dump(int sig) {
-	/* no set_dump_flag() here, make it instant */
-	upsdebugx(1, "%s: starting driver state dump for [%s] due to signal %d",
-		__func__, upsname, sig);
-	/* FIXME: upslogx() instead of printf() when backgrounded, if STDOUT got closed? */
-	dstate_dump();
-	upsdebugx(1, "%s: finished driver state dump for [%s]",
-		__func__, upsname);
+static void poll_update_task(void *arg)
+{
+	NUT_UNUSED_VARIABLE(arg);
+	upsdrv_updateinfo();
 }
 
-# ifndef DRIVERS_MAIN_WITHOUT_MAIN
-static
-# endif /* DRIVERS_MAIN_WITHOUT_MAIN */
-void setup_signals(void)
+/* the task of the update went back to the main loop, or finished */
+static int poll_update_step(int state)
 {
-	struct sigaction	sa;
+	if (state == COOP_WAITING) {
+		/* what it set so far goes out now, and the clients are
+		 * answered meanwhile, except for the commands */
+		dstate_commit_batch();
+		dstate_hold_commands(1);
+		return 0;
+	}
 
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = 0;
+	poll_update_done();
+	dstate_hold_commands(0);
+	return 1;
+}
 
-	/* handle shutdown signals */
-	sa.sa_handler = set_exit_flag;
-	sigaction(SIGTERM, &sa, NULL);
-	sigaction(SIGINT, &sa, NULL);
-	sigaction(SIGQUIT, &sa, NULL);
+/* one upsdrv_updateinfo(), on time or early (extrafd had data); returns
+ * 1 when it is done, or 0 if it waits for the device in a task, to be
+ * gone on with by poll_update_resume() */
+static int poll_update(void)
+{
+	gettimeofday(&poll_update_start, NULL);
 
-	/* basic signal setup to ignore SIGPIPE */
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_STRICT_PROTOTYPES)
-# pragma GCC diagnostic push
-# pragma GCC diagnostic ignored "-Wstrict-prototypes"
-#endif
-	sa.sa_handler = SIG_IGN;
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_STRICT_PROTOTYPES)
-# pragma GCC diagnostic pop
-#endif
-	sigaction(SIGPIPE, &sa, NULL);
+	dstate_setinfo("driver.state", "updateinfo");
+	dstate_begin_batch();
 
-	/* handle reloading */
-	sa.sa_handler = set_reload_flag;
-	sigaction(SIGCMD_RELOAD, &sa, NULL);	/* SIGHUP */
-	sigaction(SIGCMD_RELOAD_OR_EXIT, &sa, NULL);	/* SIGUSR1 */
-# ifdef SIGCMD_RELOAD_OR_RESTART
-/* FIXME: Want SIGCMD_RELOAD_OR_RESTART implemented */
-	sigaction(SIGCMD_RELOAD_OR_RESTART, &sa, NULL);	/* SIGUSR2 */
-# endif
+	if (coop_task) {
+		return poll_update_step(coop_run(coop_task, poll_update_task, NULL));
+	}
 
-# ifdef SIGCMD_DATA_DUMP
-	/* handle run-time data dump (may be limited to non-backgrounding lifetimes) */
-	sa.sa_handler = handle_dstate_dump;
-	sigaction(SIGCMD_DATA_DUMP, &sa, NULL);	/* SIGURG or SIGWINCH something else on obscure systems */
-# endif
+	upsdrv_updateinfo();
+	poll_update_done();
+	return 1;
 }
-#endif /* WIN32*/
 
-/* This source file is used in some unit tests to mock realistic driver
- * behavior - using a production driver skeleton, but their own main().
- */
-#ifndef DRIVERS_MAIN_WITHOUT_MAIN
-int main(int argc, char **argv)
+/* if the update waits: for what (see coop_waitfor()) */
+static int poll_update_waiting(int *fd, struct timeval *deadline)
 {
-	struct	passwd	*new_uid = NULL;
-	int	i, do_forceshutdown = 0;
-	int	update_count = 0;
+	return coop_waitfor(coop_task, fd, deadline);
+}
 
-#ifndef WIN32
-	int	cmd = 0;
-	pid_t	oldpid = -1;
-#else
-/* FIXME: *actually* handle WIN32 builds too */
-	const char	*cmd = NULL;
+/* what the update waits for may be there, or its time is up */
+static int poll_update_resume(void)
+{
+	dstate_begin_batch();
+	return poll_update_step(coop_resume(coop_task));
+}
+#endif	/* DRIVERS_MAIN_WITHOUT_MAIN */
+
+#if !(defined DRIVERS_MAIN_WITHOUT_MAIN) && !(defined WIN32)
+/* With "-a" given several times, this process runs all those devices:
+ * main.c, dstate.c and the driver keep the state of the current device
+ * in their usual variables, which host_switch() puts away and replaces
+ * with those of another device before anything is done for it. So the
+ * driver code and its (read-only) tables are shared by all the devices,
+ * and one poll() in host_loop() waits for all of their sockets. */
+typedef struct host_device_s {
+	const char	*name;
+	unsigned char	*state;	/* while another device is current */
+	struct timeval	due;	/* of its next upsdrv_updateinfo() */
+	int	wake;		/* its extrafd had data, update it now */
+	size_t	pollfirst, pollcount;	/* its slots in the poll() set */
+	int	busy;		/* its update waits for the device, in a task */
+	struct timeval	busydue;	/* ...until then at most */
+	size_t	busyslot;	/* ...for this slot of the poll() set to read */
+} host_device_t;
+
+static host_device_t	*host_devices = NULL;
+static size_t	host_current = 0, host_started = 0;
+
+/* the per-device variables of main.c */
+static const dstate_hostvar_t	main_hostvars[] = {
+	DSTATE_HOSTVAR(upsfd),
+	DSTATE_HOSTVAR(device_path),
+	DSTATE_HOSTVAR(device_sdcommands),
+	DSTATE_HOSTVAR(upsname),
+	DSTATE_HOSTVAR(device_name),
+	DSTATE_HOSTVAR(extrafd),
+	DSTATE_HOSTVAR(handling_upsdrv_shutdown),
+	DSTATE_HOSTVAR(do_lock_port),
+	DSTATE_HOSTVAR(do_synchronous),
+	DSTATE_HOSTVAR(upsname_found),
+	DSTATE_HOSTVAR(vartab_h),
+	DSTATE_HOSTVAR(poll_interval),
+	DSTATE_HOSTVAR(pidfn),
+	DSTATE_HOSTVAR(poll_phase),
+	DSTATE_HOSTVAR(poll_phase_auto),
+	DSTATE_HOSTVAR(poll_jitter),
+	DSTATE_HOSTVAR(poll_due),
+	DSTATE_HOSTVAR(poll_next),
+	DSTATE_HOSTVAR(poll_overruns),
+	DSTATE_HOSTVAR(coop_disabled),
+	DSTATE_HOSTVAR(coop_task),
+	DSTATE_HOSTVAR(poll_update_start),
+	DSTATE_HOSTVAR(stats_vars),
+	DSTATE_HOSTVAR(stats_windows),
+	DSTATE_HOSTVAR(stats),
+	DSTATE_HOSTVAR_END
+};
+
+/* those of main.c and dstate.c as they were when main() began */
+static unsigned char	*host_initial = NULL;
+
+static const unsigned char *hostvars_load(const dstate_hostvar_t *vars, const unsigned char *state)
+{
+	for (; vars && vars->addr; vars++) {
+		memcpy(vars->addr, state, vars->size);
+		state += vars->size;
+	}
 
-	const char	*drv_name;
+	return state;
+}
+
+static size_t host_common_size(void)
+{
+	return hostvars_size(main_hostvars) + hostvars_size(dstate_hostvars());
+}
+
+static void host_save(unsigned char *state)
+{
+	size_t	n;
+
+	state = hostvars_save(main_hostvars, state);
+	state = hostvars_save(dstate_hostvars(), state);
+	for (n = 0; drv_hostvars[n]; n++) {
+		state = hostvars_save(drv_hostvars[n], state);
+	}
+}
+
+static void host_load(const unsigned char *state)
+{
+	size_t	n;
+
+	state = hostvars_load(main_hostvars, state);
+	state = hostvars_load(dstate_hostvars(), state);
+	for (n = 0; drv_hostvars[n]; n++) {
+		state = hostvars_load(drv_hostvars[n], state);
+	}
+}
+
+static void host_snapshot(void)
+{
+	host_initial = xmalloc(host_common_size());
+	hostvars_save(dstate_hostvars(),
+		hostvars_save(main_hostvars, host_initial));
+}
+
+/* make device k the current one */
+static void host_switch(size_t k)
+{
+	if (k == host_current) {
+		return;
+	}
+
+	host_save(host_devices[host_current].state);
+	host_load(host_devices[k].state);
+	host_current = k;
+}
+
+static void host_each(void (*func)(void), size_t count)
+{
+	size_t	k;
+
+	for (k = 0; k < count; k++) {
+		host_switch(k);
+		func();
+	}
+
+	host_switch(0);
+}
+
+/* another "-a id": a device to run next to the first one */
+static void host_add(const char *name)
+{
+	size_t	size = host_common_size() + drv_hostvars_size, k;
+	host_device_t	*dev;
+
+	if (!drv_hostvars) {
+		fatalx(EXIT_FAILURE, "Error: driver %s can run only one device, "
+			"so option '-a id' can not be given more than once.", progname);
+	}
+
+	if (!host_devices) {
+		host_devices = xcalloc(1, sizeof(*host_devices));
+		host_devices[0].name = upsname;
+		host_devices[0].state = xmalloc(size);
+	}
+
+	for (k = 0; k < hosted_devices; k++) {
+		if (!strcmp(host_devices[k].name, name)) {
+			fatalx(EXIT_FAILURE, "Error: option '-a %s' was given twice", name);
+		}
+	}
+
+	host_devices = xrealloc(host_devices, (hosted_devices + 1) * sizeof(*host_devices));
+	dev = &host_devices[hosted_devices++];
+	memset(dev, 0, sizeof(*dev));
+
+	dev->name = name;
+	dev->state = xmalloc(size);
+	memcpy(dev->state, host_initial, host_common_size());
+	memcpy(dev->state + host_common_size(), drv_hostvars_initial,
+		drv_hostvars_size);
+}
+
+/* the ups.conf sections of the devices after the first one, which was
+ * read when its "-a" came; all before chroot and dropping privileges */
+static void host_read_conf(void)
+{
+	size_t	k;
+
+	for (k = 1; k < hosted_devices; k++) {
+		host_switch(k);
+		upsname = host_devices[k].name;
+
+		dstate_setinfo("driver.state", "init.starting");
+		upsdrv_makevartable();
+		read_upsconf_section(upsname, 1);
+
+		if (!upsname_found) {
+			fatalx(EXIT_FAILURE, "Error: Section %s not found in ups.conf",
+				upsname);
+		}
+
+		if (!device_path) {
+			fatalx(EXIT_FAILURE, "Error: you must specify a port name "
+				"in ups.conf for [%s]", upsname);
+		}
+	}
+
+	host_switch(0);
+}
+
+static void stop_duplicate_driver(const char *pidfnbuf);
+static void init_device(int do_forceshutdown);
+
+/* the devices after the first one, brought up the same way */
+static void host_init_devices(int write_pidfiles)
+{
+	size_t	k;
+
+	for (k = 1; k < hosted_devices; k++) {
+		host_switch(k);
+
+		upsdebugx(1, "Starting device [%s] (%" PRIuSIZE " of %" PRIuSIZE ")",
+			upsname, k + 1, hosted_devices);
+
+		if (write_pidfiles) {
+			char	pidfnbuf[SMALLBUF];
+
+			snprintf(pidfnbuf, sizeof(pidfnbuf), "%s/%s-%s.pid",
+				altpidpath(), progname, upsname);
+			stop_duplicate_driver(pidfnbuf);
+			pidfn = xstrdup(pidfnbuf);
+		}
+
+		dstate_setinfo("driver.state", "init.starting");
+
+		/* upsdrv_cleanup() for this one too, if it fails */
+		host_started = k + 1;
+		init_device(0);
+	}
+
+	host_switch(0);
+}
+
+static void host_writepid(void)
+{
+	if (pidfn) {
+		writepid(pidfn);
+	}
+}
+
+/* a device whose updateinfo is due, or whose extrafd woke us up */
+static void host_update(host_device_t *dev)
+{
+	if (!dev->wake) {
+		dstate_loop_latency(&dev->due);
+	}
+	dev->wake = 0;
+
+	dev->busy = !poll_update();
+	dev->due = poll_next;
+}
+
+/* the slot and deadline of a device whose update waits */
+static void host_busy_poll(host_device_t *dev, struct pollfd **fds,
+	size_t *numfds, size_t *sizefds)
+{
+	int	fd;
+
+	dev->busyslot = SIZE_MAX;
+
+	if (!poll_update_waiting(&fd, &dev->busydue)) {
+		dev->busy = 0;	/* should not happen */
+		return;
+	}
+
+	if (fd < 0) {
+		return;
+	}
+
+	if (*numfds + 1 > *sizefds) {
+		*sizefds = (*numfds + 1) * 2;
+		*fds = xrealloc(*fds, *sizefds * sizeof(**fds));
+	}
+
+	(*fds)[*numfds].fd = fd;
+	(*fds)[*numfds].events = POLLIN;
+	(*fds)[*numfds].revents = 0;
+	dev->busyslot = (*numfds)++;
+}
+
+/* the regular loop instead of the one in main(): each device on its own
+ * pollinterval, and the sockets (and extrafd) of all in one poll() */
+static void host_loop(void)
+{
+	struct pollfd	*fds = NULL;
+	size_t	numfds, sizefds = 0, k, i;
+	int	busy;
+
+	/* each on its own schedule (and phase, if derived from its name) */
+	for (k = 0; k < hosted_devices; k++) {
+		host_switch(k);
+		poll_schedule_start();
+		host_devices[k].due = poll_next;
+	}
+
+	while (!exit_flag) {
+		struct timeval	now, next;
+		int	ret, timeout_ms;
+
+		upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
+
+		numfds = 0;
+		gettimeofday(&now, NULL);
+
+		for (k = 0; k < hosted_devices && !exit_flag; k++) {
+			host_device_t	*dev = &host_devices[k];
+			struct pollfd	*devfds;
+
+			host_switch(k);
+
+			if (!dev->busy && (dev->wake || dev->due.tv_sec < now.tv_sec
+			 || (dev->due.tv_sec == now.tv_sec && dev->due.tv_usec <= now.tv_usec))
+			) {
+				host_update(dev);
+			}
+
+			devfds = dstate_pollfds(extrafd, &dev->pollcount);
+
+			if (numfds + dev->pollcount > sizefds) {
+				sizefds = (numfds + dev->pollcount) * 2;
+				fds = xrealloc(fds, sizefds * sizeof(*fds));
+			}
+
+			memcpy(fds + numfds, devfds, dev->pollcount * sizeof(*fds));
+			dev->pollfirst = numfds;
+			numfds += dev->pollcount;
+
+			if (dev->busy) {
+				host_busy_poll(dev, &fds, &numfds, &sizefds);
+			}
+		}
+
+		if (exit_flag) {
+			break;
+		}
+
+		busy = 0;
+		next = host_devices[0].busy ? host_devices[0].busydue : host_devices[0].due;
+		for (k = 0; k < hosted_devices; k++) {
+			const struct timeval	*due = host_devices[k].busy
+				? &host_devices[k].busydue : &host_devices[k].due;
+
+			busy |= host_devices[k].busy;
+
+			if (due->tv_sec < next.tv_sec
+			 || (due->tv_sec == next.tv_sec && due->tv_usec < next.tv_usec)
+			) {
+				next = *due;
+			}
+		}
+
+		gettimeofday(&now, NULL);
+		if (next.tv_sec < now.tv_sec
+		 || (next.tv_sec == now.tv_sec && next.tv_usec <= now.tv_usec)
+		) {
+			timeout_ms = 0;
+		} else {
+			/* round up, so we do not wake up just short of the deadline */
+			timeout_ms = (int)((next.tv_sec - now.tv_sec) * 1000)
+				+ (int)((next.tv_usec - now.tv_usec + 999) / 1000);
+		}
+
+		ret = poll(fds, (nfds_t)numfds, timeout_ms);
+
+		if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+			upslog_with_errno(LOG_ERR, "%s: poll unix sockets failed", __func__);
+		}
+
+		for (k = 0; ret > 0 && k < hosted_devices; k++) {
+			host_device_t	*dev = &host_devices[k];
+			struct pollfd	*devfds;
+			size_t	count;
+
+			for (i = 0; i < dev->pollcount; i++) {
+				if (fds[dev->pollfirst + i].revents) {
+					break;
+				}
+			}
+
+			if (i == dev->pollcount) {
+				continue;
+			}
+
+			host_switch(k);
+
+			/* nothing was added or dropped since we copied it */
+			devfds = dstate_pollfds(extrafd, &count);
+			for (i = 0; i < count; i++) {
+				devfds[i].revents = fds[dev->pollfirst + i].revents;
+			}
+
+			if (dstate_poll_handle(extrafd)) {
+				dev->wake = 1;
+			}
+		}
+
+		/* go on with the updates which waited for this, or long enough */
+		gettimeofday(&now, NULL);
+		for (k = 0; busy && k < hosted_devices && !exit_flag; k++) {
+			host_device_t	*dev = &host_devices[k];
+
+			if (!dev->busy) {
+				continue;
+			}
+
+			if ((dev->busyslot == SIZE_MAX || !fds[dev->busyslot].revents)
+			 && (dev->busydue.tv_sec > now.tv_sec
+			  || (dev->busydue.tv_sec == now.tv_sec && dev->busydue.tv_usec > now.tv_usec))
+			) {
+				continue;
+			}
+
+			host_switch(k);
+			if (poll_update_resume()) {
+				dev->busy = 0;
+				dev->due = poll_next;
+			}
+		}
+
+		nut_trace_dump_pending();
+
+		/* not in the middle of an update */
+		if (reload_flag && !exit_flag && !busy) {
+			int	flag = reload_flag;
+
+			for (k = 0; k < hosted_devices; k++) {
+				host_switch(k);
+				reload_flag = flag;
+				handle_reload_flag();
+			}
+		}
+	}
+
+	host_switch(0);
+	free(fds);
+}
+#endif	/* !DRIVERS_MAIN_WITHOUT_MAIN && !WIN32 */
+
+#ifndef DRIVERS_MAIN_WITHOUT_MAIN
+static void exit_upsdrv_cleanup_device(void)
+{
+	dstate_setinfo("driver.state", "cleanup.upsdrv");
+	upsdrv_cleanup();
+}
+
+static void exit_upsdrv_cleanup(void)
+{
+#ifndef WIN32
+	if (host_devices) {
+		host_each(exit_upsdrv_cleanup_device, host_started);
+		return;
+	}
+#endif
+	exit_upsdrv_cleanup_device();
+}
+
+static void exit_cleanup_device(void)
+{
+	dstate_setinfo("driver.state", "cleanup.exit");
+
+	free(device_path);
+	device_path = NULL;
+
+	if (pidfn) {
+		unlink(pidfn);
+		free(pidfn);
+		pidfn = NULL;
+	}
+
+	dstate_free();
+	vartab_free();
+
+	coop_free(coop_task);
+	coop_task = NULL;
+
+	dstats_free(stats);
+	stats = NULL;
+	free(stats_vars);
+	stats_vars = NULL;
+	free(stats_windows);
+	stats_windows = NULL;
+}
+
+static void exit_cleanup(void)
+{
+	if (!dump_data && !help_only) {
+		upsnotify(NOTIFY_STATE_STOPPING, "exit_cleanup()");
+	}
+
+	free(chroot_path);
+	free(user);
+	free(group);
+
+#ifndef WIN32
+	if (host_devices) {
+		size_t	k;
+
+		host_each(exit_cleanup_device, hosted_devices);
+
+		for (k = 0; k < hosted_devices; k++) {
+			free(host_devices[k].state);
+		}
+		free(host_devices);
+		host_devices = NULL;
+	} else
+#endif
+	exit_cleanup_device();
+
+#ifdef WIN32
+	if(mutex != INVALID_HANDLE_VALUE) {
+		ReleaseMutex(mutex);
+		CloseHandle(mutex);
+	}
+#endif
+}
+#endif /* DRIVERS_MAIN_WITHOUT_MAIN */
+
+void set_exit_flag(int sig)
+{
+	switch (exit_flag) {
+		case -2:
+			upsdebugx(1, "%s: raising exit flag due to programmatic abort: EXIT_SUCCESS", __func__);
+			break;
+		case -1:
+			upsdebugx(1, "%s: raising exit flag due to programmatic abort: EXIT_FAILURE", __func__);
+			break;
+		default:
+			upsdebugx(1, "%s: raising exit flag due to signal %d", __func__, sig);
+	}
+	exit_flag = sig;
+}
+
+static void set_reload_flag(
+#ifndef WIN32
+	int
+#else
+	char *
+#endif
+	sig)
+{
+#ifndef WIN32
+/* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upd and upsmon */
+	switch (sig) {
+		case SIGCMD_RELOAD_OR_EXIT:	/* SIGUSR1 */
+			/* reload-or-exit (this driver instance may die) */
+			reload_flag = 2;
+			break;
+
+#ifdef SIGCMD_RELOAD_OR_RESTART
+		case SIGCMD_RELOAD_OR_RESTART:	/* SIGUSR2 */
+			/* reload-or-restart (this driver instance may recycle itself) */
+			/* FIXME: Not implemented yet */
+			reload_flag = 3;
+			break;
+#endif
+
+		case SIGCMD_EXIT:	/* Not even a signal, but a socket protocol action,
+			* and not a reload either - just applied here for consistency */
+/*
+			reload_flag = 15;
+			break;
+*/
+			set_exit_flag(EF_EXIT_SUCCESS);
+			return;
+
+		case SIGCMD_RELOAD:	/* SIGHUP */
+		case SIGCMD_RELOAD_OR_ERROR:	/* Not even a signal, but a socket protocol action */
+		default:
+			/* reload what we can, log what needs a restart so skipped */
+			reload_flag = 1;
+	}
+
+	upsdebugx(1, "%s: raising reload flag due to signal %d (%s) => reload_flag=%d",
+		__func__, sig, strsignal(sig), reload_flag);
+#else
+	if (sig && !strcmp(sig, SIGCMD_RELOAD_OR_ERROR)) {
+		/* reload what we can, log what needs a restart so skipped */
+		reload_flag = 1;
+	} else if (sig && !strcmp(sig, SIGCMD_EXIT)) {
+		set_exit_flag(EF_EXIT_SUCCESS);
+		return;
+	} else {
+		/* non-fatal reload as a fallback */
+		reload_flag = 1;
+	}
+
+	upsdebugx(1, "%s: raising reload flag due to command %s => reload_flag=%d",
+		__func__, sig, reload_flag);
+#endif  /* WIN32 */
+}
+
+#ifndef WIN32
+/* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upd and upsmon */
+static void handle_dstate_dump(int sig) {
+	/* no set_dump_flag() here, make it instant */
+	upsdebugx(1, "%s: starting driver state dump for [%s] due to signal %d",
+		__func__, upsname, sig);
+	/* FIXME: upslogx() instead of printf() when backgrounded, if STDOUT got closed? */
+	dstate_dump();
+	upsdebugx(1, "%s: finished driver state dump for [%s]",
+		__func__, upsname);
+
+	/* and the trace ring (if any), from the main loop */
+	nut_trace_dump_request(sig);
+}
+
+# ifndef DRIVERS_MAIN_WITHOUT_MAIN
+static
+# endif /* DRIVERS_MAIN_WITHOUT_MAIN */
+void setup_signals(void)
+{
+	struct sigaction	sa;
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+
+	/* handle shutdown signals */
+	sa.sa_handler = set_exit_flag;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
+
+	/* basic signal setup to ignore SIGPIPE */
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_STRICT_PROTOTYPES)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wstrict-prototypes"
+#endif
+	sa.sa_handler = SIG_IGN;
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_STRICT_PROTOTYPES)
+# pragma GCC diagnostic pop
+#endif
+	sigaction(SIGPIPE, &sa, NULL);
+
+	/* handle reloading */
+	sa.sa_handler = set_reload_flag;
+	sigaction(SIGCMD_RELOAD, &sa, NULL);	/* SIGHUP */
+	sigaction(SIGCMD_RELOAD_OR_EXIT, &sa, NULL);	/* SIGUSR1 */
+# ifdef SIGCMD_RELOAD_OR_RESTART
+/* FIXME: Want SIGCMD_RELOAD_OR_RESTART implemented */
+	sigaction(SIGCMD_RELOAD_OR_RESTART, &sa, NULL);	/* SIGUSR2 */
+# endif
+
+# ifdef SIGCMD_DATA_DUMP
+	/* handle run-time data dump (may be limited to non-backgrounding lifetimes) */
+	sa.sa_handler = handle_dstate_dump;
+	sigaction(SIGCMD_DATA_DUMP, &sa, NULL);	/* SIGURG or SIGWINCH something else on obscure systems */
+# endif
+}
+#endif /* WIN32*/
+
+/* This source file is used in some unit tests to mock realistic driver
+ * behavior - using a production driver skeleton, but their own main().
+ */
+#ifndef DRIVERS_MAIN_WITHOUT_MAIN
+#ifndef WIN32
+/* Try to prevent that driver is started multiple times. If a PID file
+ * already exists, send a TERM signal to the process and try if it goes
+ * away. If not, retry a couple of times. */
+static void stop_duplicate_driver(const char *pidfnbuf)
+{
+	int	i;
+
+	for (i = 0; i < 3; i++) {
+		struct stat	st;
+		int	sigret;
+
+		if ((sigret = stat(pidfnbuf, &st)) != 0) {
+			upsdebug_with_errno(1, "PID file %s not found; stat() returned %d", pidfnbuf, sigret);
+			break;
+		}
+
+		upslogx(LOG_WARNING, "Duplicate driver instance detected (PID file %s exists)! Terminating other driver!", pidfnbuf);
+
+		if ((sigret = sendsignalfn(pidfnbuf, SIGTERM, progname, 1) != 0)) {
+			upsdebug_with_errno(1, "Can't send signal to PID, assume invalid PID file %s; "
+				"sendsignalfn() returned %d", pidfnbuf, sigret);
+			break;
+		}
+
+		upsdebugx(1, "Signal sent without errors, allow the other driver instance some time to quit");
+		sleep(5);
+
+		if (exit_flag)
+			fatalx(EXIT_FAILURE, "Got a break signal during attempt to terminate other driver");
+	}
+
+	if (i > 0) {
+		struct stat	st;
+		if (stat(pidfnbuf, &st) == 0) {
+			upslogx(LOG_WARNING, "Duplicate driver instance is still alive (PID file %s exists) after several termination attempts! Killing other driver!", pidfnbuf);
+			if (sendsignalfn(pidfnbuf, SIGKILL, progname, 1) == 0) {
+				sleep(5);
+				if (sendsignalfn(pidfnbuf, 0, progname, 1) == 0) {
+					upslogx(LOG_WARNING, "Duplicate driver instance is still alive (could signal the process)");
+					/* TODO: Should we writepid() below in this case?
+					 * Or if driver init fails, restore the old content
+					 * for that running sibling? */
+				} else {
+					upslogx(LOG_WARNING, "Could not signal the other driver after kill, either its process is finally dead or owned by another user!");
+				}
+			} else {
+				upslogx(LOG_WARNING, "Could not signal the other driver, either its process is dead or owned by another user!");
+			}
+			/* Note: PID file would remain here, but invalid
+			 * as far as further killers would be concerned */
+		}
+	}
+}
+#endif	/* !WIN32 */
+
+/* bring up the device of upsname, up to serving its socket */
+static void init_device(int do_forceshutdown)
+{
+	static int	atexit_done = 0;
+
+	/* clear out callback handler data */
+	memset(&upsh, '\0', sizeof(upsh));
+
+	/* note: device.type is set early to be overridden by the driver
+	 * when its a pdu! */
+	dstate_setinfo("device.type", "ups");
+
+	dstate_setinfo("driver.state", "init.device");
+	upsdrv_initups();
+	dstate_setinfo("driver.state", "init.quiet");
+
+	/* UPS is detected now, cleanup upon exit (once, for all devices) */
+	if (!atexit_done) {
+		atexit(exit_upsdrv_cleanup);
+		atexit_done = 1;
+	}
+
+	/* now see if things are very wrong out there */
+	if (upsdrv_info.status == DRV_BROKEN) {
+		fatalx(EXIT_FAILURE, "Fatal error: broken driver. It probably needs to be converted.\n");
+	}
+
+	/* publish the top-level data: version numbers, driver name */
+	dstate_setinfo("driver.version", "%s", UPS_VERSION);
+	dstate_setinfo("driver.version.internal", "%s", upsdrv_info.version);
+	dstate_setinfo("driver.name", "%s", progname);
+
+	/*
+	 * If we are not debugging, send the early startup logs generated by
+	 * upsdrv_initinfo() and upsdrv_updateinfo() to syslog, not just stderr.
+	 * Otherwise these logs are lost.
+	 */
+	if ((nut_debug_level == 0) && (!dump_data))
+		syslogbit_set();
+
+	/* get the base data established before allowing connections */
+	dstate_setinfo("driver.state", "init.info");
+	upsdrv_initinfo();
+
+	/* Register a way to call upsdrv_shutdown() among `sdcommands` */
+	dstate_addcmd("shutdown.default");
+
+	if (do_forceshutdown) {
+		dstate_setinfo("driver.state", "fsd.killpower");
+		forceshutdown();
+	}
+
+	/* Note: a few drivers also call their upsdrv_updateinfo() during
+	 * their upsdrv_initinfo(), possibly to impact the initialization */
+	dstate_setinfo("driver.state", "init.updateinfo");
+	upsdrv_updateinfo();
+	dstate_setinfo("driver.state", "init.quiet");
+
+	/* the updates from the main loop on, unless the data is dumped */
+	if (coop_allowed && !coop_disabled && !dump_data) {
+		coop_task = coop_new();
+		upsdebugx(1, "Updates %s while waiting for the device",
+			coop_task ? "let the main loop run" : "block");
+	}
+
+	if (stats_vars && !dump_data) {
+		stats = dstats_new(stats_vars, stats_windows);
+		if (!stats) {
+			fatalx(EXIT_FAILURE, "Error: UPS [%s]: invalid stats or statswindows",
+				NUT_STRARG(upsname));
+		}
+	}
+
+	if (dstate_getinfo("driver.flag.ignorelb")) {
+		int	have_lb_method = 0;
+
+		if (dstate_getinfo("battery.charge") && dstate_getinfo("battery.charge.low")) {
+			upslogx(LOG_INFO, "using 'battery.charge' to set battery low state");
+			have_lb_method++;
+		}
+
+		if (dstate_getinfo("battery.runtime") && dstate_getinfo("battery.runtime.low")) {
+			upslogx(LOG_INFO, "using 'battery.runtime' to set battery low state");
+			have_lb_method++;
+		}
+
+		if (!have_lb_method) {
+			fatalx(EXIT_FAILURE,
+				"The 'ignorelb' flag is set, but there is no way to determine the\n"
+				"battery state of charge.\n\n"
+				"Only set this flag if both 'battery.charge' and 'battery.charge.low'\n"
+				"and/or 'battery.runtime' and 'battery.runtime.low' are available.\n");
+		}
+	}
+
+	/* now we can start servicing requests */
+	/* Only write pid if we're not just dumping data, for discovery */
+	if (!dump_data) {
+		char * sockname = dstate_init(progname, upsname);
+		/* Normally we stick to the built-in account info,
+		 * so if they were not over-ridden - no-op here:
+		 */
+		if (strcmp(group, RUN_AS_GROUP)
+		||  strcmp(user,  RUN_AS_USER)
+		) {
+#ifndef WIN32
+			int allOk = 1;
+			/* Use file descriptor, not name, to first check and then manipulate permissions:
+			 *   https://cwe.mitre.org/data/definitions/367.html
+			 *   https://wiki.sei.cmu.edu/confluence/display/c/FIO01-C.+Be+careful+using+functions+that+use+file+names+for+identification
+			 * Alas, Unix sockets on most systems can not be open()ed
+			 * so there is no file descriptor to manipulate.
+			 * Fall back to name-based "les secure" operations then.
+			 */
+			TYPE_FD fd = ERROR_FD;
+
+			/* Tune group access permission to the pipe,
+			 * so that upsd can access it (using the
+			 * specified or retained default group):
+			 */
+			struct group *grp = getgrnam(group);
+			upsdebugx(1, "Group and/or user account for this driver "
+				"was customized ('%s:%s') compared to built-in "
+				"defaults. Fixing socket '%s' ownership/access.",
+				user, group, sockname);
+
+			if (grp == NULL) {
+				upsdebug_with_errno(1, "WARNING: could not resolve group name '%s'", group);
+				allOk = 0;
+				goto sockname_ownership_finished;
+			} else {
+				struct stat statbuf;
+				mode_t mode;
+
+				if (INVALID_FD((fd = open(sockname, O_RDWR | O_APPEND)))) {
+					upsdebug_with_errno(1, "WARNING: opening socket file for stat/chown failed,"
+						" which is rather typical for Unix socket handling");
+					allOk = 0;
+				}
+
+				if ((VALID_FD(fd) && fstat(fd, &statbuf))
+				||  (INVALID_FD(fd) && stat(sockname, &statbuf))
+				) {
+					upsdebug_with_errno(1, "WARNING: stat for chown of socket file failed");
+					allOk = 0;
+					if (INVALID_FD(fd)) {
+						/* Can not proceed with ops below */
+						goto sockname_ownership_finished;
+					}
+				} else {
+					/* Maybe open() and some stat() succeeed so far */
+					allOk = 1;
+					/* Here we do a portable chgrp() essentially: */
+					if ((VALID_FD(fd) && fchown(fd, statbuf.st_uid, grp->gr_gid))
+					||  (INVALID_FD(fd) && chown(sockname, statbuf.st_uid, grp->gr_gid))
+					) {
+						upsdebug_with_errno(1, "WARNING: chown of socket file failed");
+						allOk = 0;
+					}
+				}
+
+				/* Refresh file info */
+				if ((VALID_FD(fd) && fstat(fd, &statbuf))
+				||  (INVALID_FD(fd) && stat(sockname, &statbuf))
+				) {
+					/* Logically we'd fail chown above if file
+					 * does not exist or is not accessible */
+					upsdebug_with_errno(1, "WARNING: stat for chmod of socket file failed");
+					allOk = 0;
+				} else {
+					/* chmod g+rw sockname */
+					mode = statbuf.st_mode;
+					mode |= S_IWGRP;
+					mode |= S_IRGRP;
+					if ((VALID_FD(fd) && fchmod(fd, mode))
+					|| (INVALID_FD(fd) && chmod(sockname, mode))
+					) {
+						upsdebug_with_errno(1, "WARNING: chmod of socket file failed");
+						allOk = 0;
+					}
+				}
+			}
+
+sockname_ownership_finished:
+			if (allOk) {
+				upsdebugx(1, "Group access for this driver successfully fixed "
+					"(using file %s based methods)",
+					VALID_FD(fd) ? "descriptor" : "name");
+			} else {
+				upsdebugx(0, "WARNING: Needed to fix group access "
+					"to filesystem socket of this driver, but failed; "
+					"run the driver with more debugging to see how exactly.\n"
+					"Consumers of the socket, such as upsd data server, "
+					"can fail to interact with the driver and represent "
+					"the device: %s",
+					sockname);
+			}
+
+			if (VALID_FD(fd)) {
+				close(fd);
+				fd = ERROR_FD;
+			}
+#else	/* not WIN32 */
+			upsdebugx(1, "Options for alternate user/group are not implemented on this platform");
+#endif	/* WIN32 */
+		}
+		free(sockname);
+	}
+
+	/* The poll_interval may have been changed from the default */
+	dstate_setinfo("driver.parameter.pollinterval", "%" PRIdMAX, (intmax_t)poll_interval);
+
+	/* The synchronous option may have been changed from the default */
+	dstate_setinfo("driver.parameter.synchronous", "%s",
+		(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
+
+	/* remap the device.* info from ups.* for the transition period */
+	if (dstate_getinfo("ups.mfr") != NULL)
+		dstate_setinfo("device.mfr", "%s", dstate_getinfo("ups.mfr"));
+	if (dstate_getinfo("ups.model") != NULL)
+		dstate_setinfo("device.model", "%s", dstate_getinfo("ups.model"));
+	if (dstate_getinfo("ups.serial") != NULL)
+		dstate_setinfo("device.serial", "%s", dstate_getinfo("ups.serial"));
+}
+
+/* the commands and flags main.c handles for each device */
+static void init_device_commands(void)
+{
+	/* May already be set by parsed configuration flag,
+	 * only set default if not: */
+	if (dstate_getinfo("driver.flag.allow_killpower") == NULL)
+		dstate_setinfo("driver.flag.allow_killpower", "0");
+
+	dstate_setflags("driver.flag.allow_killpower", ST_FLAG_RW | ST_FLAG_NUMBER);
+	dstate_addcmd("driver.killpower");
+
+#ifndef WIN32
+/* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upd and upsmon */
+	dstate_addcmd("driver.reload");
+	dstate_addcmd("driver.reload-or-exit");
+# ifndef DRIVERS_MAIN_WITHOUT_MAIN
+	dstate_addcmd("driver.reload-or-error");
+# endif
+# ifdef SIGCMD_RELOAD_OR_RESTART
+	dstate_addcmd("driver.reload-or-restart");
+# endif
+#endif
+
+	dstate_setinfo("driver.state", "quiet");
+}
+
+int main(int argc, char **argv)
+{
+	struct	passwd	*new_uid = NULL;
+	int	i, do_forceshutdown = 0;
+	int	update_count = 0;
+	int	single_only = 0;	/* options which only make sense for one device */
+	int	upsname_from_s = 0;
+
+#ifndef WIN32
+	int	cmd = 0;
+	pid_t	oldpid = -1;
+#else
+/* FIXME: *actually* handle WIN32 builds too */
+	const char	*cmd = NULL;
+
+	const char	*drv_name;
 	char	*dot;
 #endif
 
@@ -2076,6 +3217,11 @@ int main(int argc, char **argv)
 		}	/* else nothing to bother about */
 	}
 
+#ifndef WIN32
+	/* what each device (of several with "-a") starts with */
+	host_snapshot();
+#endif
+
 	dstate_setinfo("driver.state", "init.starting");
 
 	atexit(exit_cleanup);
@@ -2121,13 +3267,20 @@ int main(int argc, char **argv)
 	while ((i = getopt(argc, argv, optstring)) != -1) {
 		switch (i) {
 			case 'a':
+#ifndef WIN32
+				if (upsname && !upsname_from_s) {
+					/* read in host_read_conf() */
+					host_add(optarg);
+					break;
+				}
+#endif
 				if (upsname)
 					fatalx(EXIT_FAILURE, "Error: options '-a id' and '-s id' "
 						"are mutually exclusive and single-use only.");
 
 				upsname = optarg;
 
-				read_upsconf(1);
+				read_upsconf_section(upsname, 1);
 
 				if (!upsname_found)
 					fatalx(EXIT_FAILURE, "Error: Section %s not found in ups.conf",
@@ -2140,6 +3293,8 @@ int main(int argc, char **argv)
 
 				upsname = optarg;
 				upsname_found = 1;
+				upsname_from_s = 1;
+				single_only = 1;
 				break;
 			case 'F':
 				if (foreground > 0) {
@@ -2167,6 +3322,7 @@ int main(int argc, char **argv)
 							ipv);
 					}
 				}
+				single_only = 1;
 				break;
 			case 'k':
 				do_lock_port = 0;
@@ -2292,6 +3448,7 @@ int main(int argc, char **argv)
 				exit(EXIT_SUCCESS);
 			case 'x':
 				splitxarg(optarg);
+				single_only = 1;
 				break;
 			case 'h':
 				help_msg();
@@ -2325,6 +3482,21 @@ int main(int argc, char **argv)
 			"Error: specifying '-a id' or '-s id' is now mandatory. Try -h for help.");
 	}
 
+#ifndef WIN32
+	if (host_devices) {
+		if (single_only || cmd || do_forceshutdown || dump_data) {
+			fatalx(EXIT_FAILURE,
+				"Error: options -s, -x, -i, -k, -c and -d are for one device, "
+				"they can not be used with several '-a id'. Try -h for help.");
+		}
+
+		host_read_conf();
+	}
+#else
+	NUT_UNUSED_VARIABLE(single_only);
+	NUT_UNUSED_VARIABLE(upsname_from_s);
+#endif
+
 	/* we need to get the port from somewhere, unless we are just sending a signal and exiting */
 	if (!device_path && !cmd) {
 		fatalx(EXIT_FAILURE,
@@ -2668,54 +3840,7 @@ int main(int argc, char **argv)
 			exit((cmdret == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
 		} /* if (cmd) */
 
-		/* Try to prevent that driver is started multiple times. If a PID file */
-		/* already exists, send a TERM signal to the process and try if it goes */
-		/* away. If not, retry a couple of times. */
-		for (i = 0; i < 3; i++) {
-			struct stat	st;
-			int	sigret;
-
-			if ((sigret = stat(pidfnbuf, &st)) != 0) {
-				upsdebug_with_errno(1, "PID file %s not found; stat() returned %d", pidfnbuf, sigret);
-				break;
-			}
-
-			upslogx(LOG_WARNING, "Duplicate driver instance detected (PID file %s exists)! Terminating other driver!", pidfnbuf);
-
-			if ((sigret = sendsignalfn(pidfnbuf, SIGTERM, progname, 1) != 0)) {
-				upsdebug_with_errno(1, "Can't send signal to PID, assume invalid PID file %s; "
-					"sendsignalfn() returned %d", pidfnbuf, sigret);
-				break;
-			}
-
-			upsdebugx(1, "Signal sent without errors, allow the other driver instance some time to quit");
-			sleep(5);
-
-			if (exit_flag)
-				fatalx(EXIT_FAILURE, "Got a break signal during attempt to terminate other driver");
-		}
-
-		if (i > 0) {
-			struct stat	st;
-			if (stat(pidfnbuf, &st) == 0) {
-				upslogx(LOG_WARNING, "Duplicate driver instance is still alive (PID file %s exists) after several termination attempts! Killing other driver!", pidfnbuf);
-				if (sendsignalfn(pidfnbuf, SIGKILL, progname, 1) == 0) {
-					sleep(5);
-					if (sendsignalfn(pidfnbuf, 0, progname, 1) == 0) {
-						upslogx(LOG_WARNING, "Duplicate driver instance is still alive (could signal the process)");
-						/* TODO: Should we writepid() below in this case?
-						 * Or if driver init fails, restore the old content
-						 * for that running sibling? */
-					} else {
-						upslogx(LOG_WARNING, "Could not signal the other driver after kill, either its process is finally dead or owned by another user!");
-					}
-				} else {
-					upslogx(LOG_WARNING, "Could not signal the other driver, either its process is dead or owned by another user!");
-				}
-				/* Note: PID file would remain here, but invalid
-				 * as far as further killers would be concerned */
-			}
-		}
+		stop_duplicate_driver(pidfnbuf);
 
 		/* Only write pid if we're not just dumping data, for discovery */
 		if (!dump_data) {
@@ -2769,206 +3894,14 @@ int main(int argc, char **argv)
 	/* Restore the signal errors verbosity */
 	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_DEFAULT;
 
-	/* clear out callback handler data */
-	memset(&upsh, '\0', sizeof(upsh));
-
-	/* note: device.type is set early to be overridden by the driver
-	 * when its a pdu! */
-	dstate_setinfo("device.type", "ups");
-
-	dstate_setinfo("driver.state", "init.device");
-	upsdrv_initups();
-	dstate_setinfo("driver.state", "init.quiet");
-
-	/* UPS is detected now, cleanup upon exit */
-	atexit(exit_upsdrv_cleanup);
-
-	/* now see if things are very wrong out there */
-	if (upsdrv_info.status == DRV_BROKEN) {
-		fatalx(EXIT_FAILURE, "Fatal error: broken driver. It probably needs to be converted.\n");
-	}
-
-	/* publish the top-level data: version numbers, driver name */
-	dstate_setinfo("driver.version", "%s", UPS_VERSION);
-	dstate_setinfo("driver.version.internal", "%s", upsdrv_info.version);
-	dstate_setinfo("driver.name", "%s", progname);
-
-	/*
-	 * If we are not debugging, send the early startup logs generated by
-	 * upsdrv_initinfo() and upsdrv_updateinfo() to syslog, not just stderr.
-	 * Otherwise these logs are lost.
-	 */
-	if ((nut_debug_level == 0) && (!dump_data))
-		syslogbit_set();
-
-	/* get the base data established before allowing connections */
-	dstate_setinfo("driver.state", "init.info");
-	upsdrv_initinfo();
-
-	/* Register a way to call upsdrv_shutdown() among `sdcommands` */
-	dstate_addcmd("shutdown.default");
-
-	if (do_forceshutdown) {
-		dstate_setinfo("driver.state", "fsd.killpower");
-		forceshutdown();
-	}
-
-	/* Note: a few drivers also call their upsdrv_updateinfo() during
-	 * their upsdrv_initinfo(), possibly to impact the initialization */
-	dstate_setinfo("driver.state", "init.updateinfo");
-	upsdrv_updateinfo();
-	dstate_setinfo("driver.state", "init.quiet");
-
-	if (dstate_getinfo("driver.flag.ignorelb")) {
-		int	have_lb_method = 0;
-
-		if (dstate_getinfo("battery.charge") && dstate_getinfo("battery.charge.low")) {
-			upslogx(LOG_INFO, "using 'battery.charge' to set battery low state");
-			have_lb_method++;
-		}
-
-		if (dstate_getinfo("battery.runtime") && dstate_getinfo("battery.runtime.low")) {
-			upslogx(LOG_INFO, "using 'battery.runtime' to set battery low state");
-			have_lb_method++;
-		}
-
-		if (!have_lb_method) {
-			fatalx(EXIT_FAILURE,
-				"The 'ignorelb' flag is set, but there is no way to determine the\n"
-				"battery state of charge.\n\n"
-				"Only set this flag if both 'battery.charge' and 'battery.charge.low'\n"
-				"and/or 'battery.runtime' and 'battery.runtime.low' are available.\n");
-		}
-	}
+	init_device(do_forceshutdown);
 
-	/* now we can start servicing requests */
-	/* Only write pid if we're not just dumping data, for discovery */
-	if (!dump_data) {
-		char * sockname = dstate_init(progname, upsname);
-		/* Normally we stick to the built-in account info,
-		 * so if they were not over-ridden - no-op here:
-		 */
-		if (strcmp(group, RUN_AS_GROUP)
-		||  strcmp(user,  RUN_AS_USER)
-		) {
 #ifndef WIN32
-			int allOk = 1;
-			/* Use file descriptor, not name, to first check and then manipulate permissions:
-			 *   https://cwe.mitre.org/data/definitions/367.html
-			 *   https://wiki.sei.cmu.edu/confluence/display/c/FIO01-C.+Be+careful+using+functions+that+use+file+names+for+identification
-			 * Alas, Unix sockets on most systems can not be open()ed
-			 * so there is no file descriptor to manipulate.
-			 * Fall back to name-based "les secure" operations then.
-			 */
-			TYPE_FD fd = ERROR_FD;
-
-			/* Tune group access permission to the pipe,
-			 * so that upsd can access it (using the
-			 * specified or retained default group):
-			 */
-			struct group *grp = getgrnam(group);
-			upsdebugx(1, "Group and/or user account for this driver "
-				"was customized ('%s:%s') compared to built-in "
-				"defaults. Fixing socket '%s' ownership/access.",
-				user, group, sockname);
-
-			if (grp == NULL) {
-				upsdebug_with_errno(1, "WARNING: could not resolve group name '%s'", group);
-				allOk = 0;
-				goto sockname_ownership_finished;
-			} else {
-				struct stat statbuf;
-				mode_t mode;
-
-				if (INVALID_FD((fd = open(sockname, O_RDWR | O_APPEND)))) {
-					upsdebug_with_errno(1, "WARNING: opening socket file for stat/chown failed,"
-						" which is rather typical for Unix socket handling");
-					allOk = 0;
-				}
-
-				if ((VALID_FD(fd) && fstat(fd, &statbuf))
-				||  (INVALID_FD(fd) && stat(sockname, &statbuf))
-				) {
-					upsdebug_with_errno(1, "WARNING: stat for chown of socket file failed");
-					allOk = 0;
-					if (INVALID_FD(fd)) {
-						/* Can not proceed with ops below */
-						goto sockname_ownership_finished;
-					}
-				} else {
-					/* Maybe open() and some stat() succeeed so far */
-					allOk = 1;
-					/* Here we do a portable chgrp() essentially: */
-					if ((VALID_FD(fd) && fchown(fd, statbuf.st_uid, grp->gr_gid))
-					||  (INVALID_FD(fd) && chown(sockname, statbuf.st_uid, grp->gr_gid))
-					) {
-						upsdebug_with_errno(1, "WARNING: chown of socket file failed");
-						allOk = 0;
-					}
-				}
-
-				/* Refresh file info */
-				if ((VALID_FD(fd) && fstat(fd, &statbuf))
-				||  (INVALID_FD(fd) && stat(sockname, &statbuf))
-				) {
-					/* Logically we'd fail chown above if file
-					 * does not exist or is not accessible */
-					upsdebug_with_errno(1, "WARNING: stat for chmod of socket file failed");
-					allOk = 0;
-				} else {
-					/* chmod g+rw sockname */
-					mode = statbuf.st_mode;
-					mode |= S_IWGRP;
-					mode |= S_IRGRP;
-					if ((VALID_FD(fd) && fchmod(fd, mode))
-					|| (INVALID_FD(fd) && chmod(sockname, mode))
-					) {
-						upsdebug_with_errno(1, "WARNING: chmod of socket file failed");
-						allOk = 0;
-					}
-				}
-			}
-
-sockname_ownership_finished:
-			if (allOk) {
-				upsdebugx(1, "Group access for this driver successfully fixed "
-					"(using file %s based methods)",
-					VALID_FD(fd) ? "descriptor" : "name");
-			} else {
-				upsdebugx(0, "WARNING: Needed to fix group access "
-					"to filesystem socket of this driver, but failed; "
-					"run the driver with more debugging to see how exactly.\n"
-					"Consumers of the socket, such as upsd data server, "
-					"can fail to interact with the driver and represent "
-					"the device: %s",
-					sockname);
-			}
-
-			if (VALID_FD(fd)) {
-				close(fd);
-				fd = ERROR_FD;
-			}
-#else	/* not WIN32 */
-			upsdebugx(1, "Options for alternate user/group are not implemented on this platform");
-#endif	/* WIN32 */
-		}
-		free(sockname);
+	if (host_devices) {
+		/* their PID files are written along after backgrounding */
+		host_init_devices(pidfn != NULL);
 	}
-
-	/* The poll_interval may have been changed from the default */
-	dstate_setinfo("driver.parameter.pollinterval", "%" PRIdMAX, (intmax_t)poll_interval);
-
-	/* The synchronous option may have been changed from the default */
-	dstate_setinfo("driver.parameter.synchronous", "%s",
-		(do_synchronous==1)?"yes":((do_synchronous==0)?"no":"auto"));
-
-	/* remap the device.* info from ups.* for the transition period */
-	if (dstate_getinfo("ups.mfr") != NULL)
-		dstate_setinfo("device.mfr", "%s", dstate_getinfo("ups.mfr"));
-	if (dstate_getinfo("ups.model") != NULL)
-		dstate_setinfo("device.model", "%s", dstate_getinfo("ups.model"));
-	if (dstate_getinfo("ups.serial") != NULL)
-		dstate_setinfo("device.serial", "%s", dstate_getinfo("ups.serial"));
+#endif
 
 	switch (foreground) {
 		case 0:
@@ -2997,27 +3930,15 @@ sockname_ownership_finished:
 			upslogx(LOG_WARNING, "Running as foreground process, not saving a PID file");
 	}
 
-	/* May already be set by parsed configuration flag,
-	 * only set default if not: */
-	if (dstate_getinfo("driver.flag.allow_killpower") == NULL)
-		dstate_setinfo("driver.flag.allow_killpower", "0");
-
-	dstate_setflags("driver.flag.allow_killpower", ST_FLAG_RW | ST_FLAG_NUMBER);
-	dstate_addcmd("driver.killpower");
-
 #ifndef WIN32
-/* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upd and upsmon */
-	dstate_addcmd("driver.reload");
-	dstate_addcmd("driver.reload-or-exit");
-# ifndef DRIVERS_MAIN_WITHOUT_MAIN
-	dstate_addcmd("driver.reload-or-error");
-# endif
-# ifdef SIGCMD_RELOAD_OR_RESTART
-	dstate_addcmd("driver.reload-or-restart");
-# endif
+	if (host_devices) {
+		/* the first one was written above */
+		host_each(host_writepid, hosted_devices);
+		host_each(init_device_commands, hosted_devices);
+	} else
 #endif
+	init_device_commands();
 
-	dstate_setinfo("driver.state", "quiet");
 	if (dump_data) {
 		upsdebugx(1, "Driver initialization completed, beginning data dump (%d loops)", dump_data);
 	} else {
@@ -3025,19 +3946,54 @@ sockname_ownership_finished:
 		upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 	}
 
-	while (!exit_flag) {
-		struct timeval	timeout;
+	/* named like the PID file, see nuttrace.h */
+#ifndef WIN32
+	if (host_devices) {
+		nut_trace_init(progname);
+	} else
+#endif
+	{
+		char	tracename[SMALLBUF];
+
+		snprintf(tracename, sizeof(tracename), "%s-%s", progname, NUT_STRARG(upsname));
+		nut_trace_init(tracename);
+	}
+
+#ifndef WIN32
+	if (host_devices) {
+		upsdebugx(1, "Running %" PRIuSIZE " devices in this process", hosted_devices);
+		host_loop();
+	}
+#endif
+
+	poll_schedule_start();
 
+	while (!exit_flag) {
 		if (!dump_data) {
 			upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
+
+			while (!dstate_poll_fds(poll_next, extrafd) && !exit_flag) {
+				/* repeat until time is up or extrafd has data */
+				handle_reload_flag();
+				nut_trace_dump_pending();
+			}
+
+			if (exit_flag) {
+				break;
+			}
 		}
 
-		gettimeofday(&timeout, NULL);
-		timeout.tv_sec += poll_interval;
+		if (!poll_update()) {
+			int	fd;
+			struct timeval	deadline;
 
-		dstate_setinfo("driver.state", "updateinfo");
-		upsdrv_updateinfo();
-		dstate_setinfo("driver.state", "quiet");
+			/* serve the socket while the update waits for the device */
+			while (!exit_flag && poll_update_waiting(&fd, &deadline)) {
+				dstate_poll_fds(deadline, fd);
+				nut_trace_dump_pending();
+				poll_update_resume();
+			}
+		}
 
 		/* Dump the data tree (in upsc-like format) to stdout and exit */
 		if (dump_data) {
@@ -3050,12 +4006,6 @@ sockname_ownership_finished:
 			else
 				update_count++;
 		}
-		else {
-			while (!dstate_poll_fds(timeout, extrafd) && !exit_flag) {
-				/* repeat until time is up or extrafd has data */
-				handle_reload_flag();
-			}
-		}
 
 		handle_reload_flag();
 	}
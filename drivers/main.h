@@ -17,6 +17,7 @@ extern int		broken_driver, experimental_driver,
 			do_lock_port, exit_flag, handling_upsdrv_shutdown;
 extern TYPE_FD		upsfd, extrafd;
 extern time_t		poll_interval;
+extern size_t		hosted_devices;
 
 /* functions & variables required in each driver */
 void upsdrv_initups(void);	/* open connection to UPS, fail if not found */
@@ -98,6 +99,21 @@ typedef struct vartab_s {
 void addvar(int vartype, const char *name, const char *desc);
 void addvar_reloadable(int vartype, const char *name, const char *desc);
 
+/* callback from driver (in upsdrv_makevartable) - the variables holding
+ * the state of one device, ended by DSTATE_HOSTVAR_END; with these, main
+ * can run several devices (as several "-a" are given) in one process, by
+ * swapping in those of each device before calling into the driver for it.
+ * Tables which the driver changes as it runs must be copied per device.
+ * A driver built of several modules may call it once for each of them. */
+void addhostvars(const dstate_hostvar_t *vars);
+
+/* callback from driver (in upsdrv_makevartable) - its upsdrv_updateinfo()
+ * may run as a task (see coop.h), which lets the main loop go on while
+ * it waits for the device in the serial helpers or coop_wait(): so the
+ * socket is served meanwhile (INSTCMD and SET are run once the update is
+ * done), and the updates of the devices run by one process overlap. */
+void allow_coop_updates(void);
+
 /* Several helpers for driver configuration reloading follow:
  * * testval_reloadable() checks if we are currently reloading (or initially
  *   loading) the configuration, and if strings oldval==newval or not,
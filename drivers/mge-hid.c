@@ -239,6 +239,19 @@ static int	advanced_battery_monitoring = ABM_UNKNOWN;
 /* Internal flag to process the different ABM paths as seen in HID */
 static int	advanced_battery_path = ABM_PATH_UNKNOWN;
 
+/* Nominal output voltage first seen, see nominal_output_voltage_fun() */
+static long	nominal_output_voltage = -1;
+
+/* per device, see addhostvars() */
+static const dstate_hostvar_t mge_hostvars[] = {
+	DSTATE_HOSTVAR(mge_type),
+	DSTATE_HOSTVAR(country_code),
+	DSTATE_HOSTVAR(advanced_battery_monitoring),
+	DSTATE_HOSTVAR(advanced_battery_path),
+	DSTATE_HOSTVAR(nominal_output_voltage),
+	DSTATE_HOSTVAR_END
+};
+
 /* TODO: Lifted from strptime.c... maybe should externalize the fallback?
  * NOTE: HAVE_DECL_* are always defined, 0 or 1. Many other flags are not.
  */
@@ -1190,13 +1203,11 @@ static info_lkp_t eaton_compute_realpower_info[] = {
 /* Limit nominal output voltage according to HV or LV models */
 static const char *nominal_output_voltage_fun(double value)
 {
-	static long	nominal = -1;
-
-	if (nominal < 0) {
-		nominal = value;
+	if (nominal_output_voltage < 0) {
+		nominal_output_voltage = value;
 	}
 
-	switch ((long)nominal)
+	switch (nominal_output_voltage)
 	{
 	/* LV models */
 	case 100:
@@ -1735,7 +1746,7 @@ static models_name_t mge_model_names [] =
 /*                 Data lookup table (HID <-> NUT)                 */
 /* --------------------------------------------------------------- */
 
-static hid_info_t mge_hid2nut[] =
+static const hid_info_t mge_hid2nut[] =
 {
 	/* Device collection */
 	/* Just declared to call *hid2info */
@@ -2291,4 +2302,5 @@ subdriver_t mge_subdriver = {
 	mge_format_mfr,
 	mge_format_serial,
 	fix_report_desc,
+	mge_hostvars,
 };
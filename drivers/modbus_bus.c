@@ -0,0 +1,108 @@
+/*  modbus_bus.c - sharing one Modbus RTU line between driver instances
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "main.h"
+#include "modbus_bus.h"
+#include "timehead.h"
+
+#ifdef HAVE_FLOCK
+# include <sys/file.h>
+#endif
+
+/* descriptor locked by modbus_bus_lock(), -1 if none */
+static int	bus_locked_fd = -1;
+
+/* warn (once) when the line can not be shared */
+static int	bus_lock_warned = 0;
+
+void modbus_bus_lock(modbus_t *ctx)
+{
+#if (defined HAVE_FLOCK) && !(defined WIN32)
+	int	fd, ret;
+	struct timeval	start, now;
+	long	waited;
+
+	if (ctx == NULL || bus_locked_fd >= 0) {
+		return;
+	}
+
+	fd = modbus_get_socket(ctx);
+	if (fd < 0) {
+		return;
+	}
+
+	/* most of the time nobody else uses the line */
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+		bus_locked_fd = fd;
+		return;
+	}
+
+	if (errno != EWOULDBLOCK) {
+		/* e.g. a TCP socket on some systems: nothing to share */
+		if (!bus_lock_warned) {
+			upsdebug_with_errno(2, "%s: can not lock the modbus line", __func__);
+			bus_lock_warned = 1;
+		}
+		return;
+	}
+
+	/* another driver is in a transaction, wait for our turn */
+	gettimeofday(&start, NULL);
+	do {
+		ret = flock(fd, LOCK_EX);
+	} while (ret != 0 && errno == EINTR && !exit_flag);
+
+	if (ret != 0) {
+		upsdebug_with_errno(2, "%s: can not lock the modbus line", __func__);
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+	waited = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+	upsdebugx(3, "%s: waited %ld ms for the modbus line", __func__, waited);
+
+	bus_locked_fd = fd;
+
+	/* drop whatever is left of the previous exchange of another driver */
+	modbus_flush(ctx);
+#else
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(bus_lock_warned);
+#endif
+}
+
+void modbus_bus_unlock(modbus_t *ctx)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+
+#if (defined HAVE_FLOCK) && !(defined WIN32)
+	int	save_errno;
+
+	if (bus_locked_fd < 0) {
+		return;
+	}
+
+	/* the context may have been re-created meanwhile: the lock went
+	 * away with the descriptor it was on; keep errno of the transaction
+	 * for the caller */
+	save_errno = errno;
+	flock(bus_locked_fd, LOCK_UN);
+	bus_locked_fd = -1;
+	errno = save_errno;
+#endif
+}
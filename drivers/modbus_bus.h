@@ -0,0 +1,40 @@
+/*  modbus_bus.h - sharing one Modbus RTU line between driver instances
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef NUT_MODBUS_BUS_H
+#define NUT_MODBUS_BUS_H
+
+#include <modbus.h>
+
+/*
+ * Several drivers may talk to different slaves daisy-chained on one
+ * RS-485 line, each opening the same serial device. Each Modbus
+ * transaction (a request and its response) is done between
+ * modbus_bus_lock() and modbus_bus_unlock(), which take and release an
+ * advisory lock on the device, so that the requests of the drivers do
+ * not collide on the line and each one reads its own response. Waiting
+ * drivers get the line in turn, one transaction at a time.
+ *
+ * With Modbus TCP (or if locking is not available) these do nothing.
+ * The lock is taken on the file descriptor of the context, so a context
+ * re-created by a reconnection is handled transparently.
+ */
+void modbus_bus_lock(modbus_t *ctx);
+void modbus_bus_unlock(modbus_t *ctx);
+
+#endif /* NUT_MODBUS_BUS_H */
@@ -41,6 +41,10 @@
 
 #include "nut_stdint.h"
 
+#ifndef WIN32
+# include <poll.h>
+#endif
+
 #define DRIVER_NAME	"network XML UPS"
 #define DRIVER_VERSION	"0.47"
 
@@ -237,12 +241,21 @@ uint32_t		ups_status = 0;
 static int		timeout = 5;
 int		shutdown_duration = 120;
 static int		shutdown_timer = 0;
+static int		pollfreq = 30;
 static time_t		lastheard = 0;
+static time_t		lastpoll = 0;	/* pages last polled */
+static time_t		lastproduct = 0;	/* product page last polled */
 static subdriver_t	*subdriver = &mge_xml_subdriver;
 static ne_session	*session = NULL;
 static ne_socket	*sock = NULL;
 static ne_uri		uri;
 static char	*product_page = NULL;
+static ne_xml_parser	*alarm_parser = NULL;	/* alarm message being received */
+#ifndef WIN32
+static int	alarm_fd = -1;	/* alarm socket watched by the main loop */
+#endif
+static int	alarm_pending = 0;	/* alarm messages came in since the last update */
+static int	alarm_lost = 0;	/* alarm socket closed or broken */
 
 /* Support functions */
 static void netxml_alarm_set(void);
@@ -255,6 +268,12 @@ static int instcmd(const char *cmdname, const char *extra);
 static int setvar(const char *varname, const char *val);
 
 static int netxml_alarm_subscribe(const char *page);
+static int netxml_alarm_read(void);
+static int netxml_alarm_feed(const char *buf, size_t len);
+static void netxml_alarm_reset(void);
+static void netxml_alarm_watch(void);
+static void netxml_alarm_close(void);
+static void netxml_publish(void);
 
 #if HAVE_NE_SET_CONNECT_TIMEOUT && HAVE_NE_SOCK_CONNECT_TIMEOUT
 	/* we don't need to use alarm() */
@@ -282,12 +301,13 @@ void upsdrv_initinfo(void)
 
 		dstate_setinfo("driver.version.data", "%s", subdriver->version);
 
-		if (testvar("subscribe") && (netxml_alarm_subscribe(subdriver->subscribe) == NE_OK)) {
-/* TODO: port extrafd to Windows */
-#ifndef WIN32
-			extrafd = ne_sock_fd(sock);
-#endif
-			time(&lastheard);
+		if (testvar("subscribe")) {
+			if (netxml_alarm_subscribe(subdriver->subscribe) == NE_OK) {
+				netxml_alarm_watch();
+				time(&lastheard);
+			} else {
+				netxml_alarm_close();
+			}
 		}
 
 		/* Register r/w variables */
@@ -307,58 +327,56 @@ void upsdrv_updateinfo(void)
 {
 	ssize_t	ret;
 	int	errors = 0;
+	time_t	now;
 
-	/* We really should be dealing with alarms through a separate callback, so that we can keep the
-	 * processing of alarms and polling for data separated. Currently, this isn't supported by the
-	 * driver main body, so we'll have to revert to polling each time we're called, unless the
-	 * socket indicates we're no longer connected.
+	/* With a subscription, the NMC pushes the alarms (and status changes)
+	 * on the alarm socket, which the main loop watches for us: an update
+	 * called early for those only needs to publish what they said, the
+	 * pages are polled on the regular schedule.
 	 */
 	if (testvar("subscribe")) {
-		char	buf[LARGEBUF];
-
-		ret = ne_sock_read(sock, buf, sizeof(buf));
-
-		if (ret > 0) {
-			/* alarm message received */
-
-			ne_xml_parser	*parser = ne_xml_create();
-			upsdebugx(2, "%s: ne_sock_read(%" PRIiSIZE " bytes) => %s", __func__, ret, buf);
-			ne_xml_push_handler(parser, subdriver->startelm_cb, subdriver->cdata_cb, subdriver->endelm_cb, NULL);
-			ne_xml_parse(parser, buf, strlen(buf));
-			ne_xml_destroy(parser);
-			time(&lastheard);
-
-		} else if ((ret == NE_SOCK_TIMEOUT) && (difftime(time(NULL), lastheard) < 180)) {
-			/* timed out */
-
-			upsdebugx(2, "%s: ne_sock_read(timeout)", __func__);
+#ifdef WIN32
+		/* The main loop cannot watch the neon socket on Windows:
+		 * read it here at each update, blocking for up to one
+		 * second (the socket read timeout) as before */
+		if (sock && !alarm_lost) {
+			netxml_alarm_read();
+		}
+#endif
+		time(&now);
 
-		} else {
-			/* connection closed or unknown error */
+		if (!sock || alarm_lost || difftime(now, lastheard) >= 180) {
+			/* connection closed, unknown error or silent for too long */
 
-			upslogx(LOG_ERR, "NSM connection with '%s' lost", uri.host);
+			if (sock) {
+				upslogx(LOG_ERR, "NSM connection with '%s' lost", uri.host);
+			}
 
-			upsdebugx(2, "%s: ne_sock_read(%" PRIiSIZE ") => %s", __func__, ret, ne_sock_error(sock));
-			ne_sock_close(sock);
+			netxml_alarm_close();
 
 			if (netxml_alarm_subscribe(subdriver->subscribe) == NE_OK) {
-/* TODO: port extrafd to Windows */
-#ifndef WIN32
-				extrafd = ne_sock_fd(sock);
-#endif
+				netxml_alarm_watch();
 				time(&lastheard);
 				return;
 			}
 
+			netxml_alarm_close();
 			dstate_datastale();
-/* TODO: port extrafd to Windows */
-#ifndef WIN32
-			extrafd = ERROR_FD;
-#endif
 			return;
 		}
+
+		if (alarm_pending && difftime(now, lastpoll) < (double)poll_interval) {
+			upsdebugx(2, "%s: publishing pushed alarms only", __func__);
+			alarm_pending = 0;
+			netxml_publish();
+			return;
+		}
+
+		alarm_pending = 0;
 	}
 
+	time(&now);
+
 	/* get additional data */
 	ret = netxml_get_page(subdriver->getobject);
 	if (ret != NE_OK) {
@@ -370,27 +388,26 @@ void upsdrv_updateinfo(void)
 		errors++;
 	}
 
-	/* also refresh the product information, at least for firmware information */
-	ret = netxml_get_page(product_page);
-	if (ret != NE_OK) {
-		errors++;
+	/* also refresh the product information, at least for firmware
+	 * information; that hardly changes, so while the subscription
+	 * is up only do it every pollfreq */
+	if (!sock || difftime(now, lastproduct) >= (double)pollfreq) {
+		ret = netxml_get_page(product_page);
+		if (ret != NE_OK) {
+			errors++;
+		} else {
+			lastproduct = now;
+		}
 	}
 
+	lastpoll = now;
+
 	if (errors > 1) {
 		dstate_datastale();
 		return;
 	}
 
-	status_init();
-
-	alarm_init();
-	netxml_alarm_set();
-	alarm_commit();
-
-	netxml_status_set();
-	status_commit();
-
-	dstate_dataok();
+	netxml_publish();
 }
 
 void upsdrv_shutdown(void) {
@@ -550,6 +567,9 @@ void upsdrv_makevartable(void)
 
 	addvar(VAR_FLAG, "subscribe", "authenticated subscription on NMC");
 
+	snprintf(buf, sizeof(buf), "product information polling interval with a subscription (default: %d seconds)", pollfreq);
+	addvar(VAR_VALUE, "pollfreq", buf);
+
 	addvar(VAR_VALUE | VAR_SENSITIVE, "login", "login value for authenticated mode");
 	addvar(VAR_VALUE | VAR_SENSITIVE, "password", "password value for authenticated mode");
 
@@ -595,6 +615,15 @@ void upsdrv_initups(void)
 		}
 	}
 
+	val = getval("pollfreq");
+	if (val) {
+		pollfreq = atoi(val);
+
+		if (pollfreq < 1) {
+			fatalx(EXIT_FAILURE, "pollfreq must be greater than 0");
+		}
+	}
+
 	val = getval("shutdown_duration");
 	if (val) {
 		shutdown_duration = atoi(val);
@@ -697,9 +726,7 @@ void upsdrv_cleanup(void)
 	free(subdriver->setobject);
 	free(product_page);
 
-	if (sock) {
-		ne_sock_close(sock);
-	}
+	netxml_alarm_close();
 
 	if (session) {
 		ne_session_destroy(session);
@@ -917,6 +944,142 @@ static int netxml_alarm_subscribe(const char *page)
 	return NE_OK;
 }
 
+/* Feed data read from the alarm socket to the parser as it arrives.
+ * Each alarm message is a separate XML document terminated by a NUL
+ * byte, so a single read may hold several messages, or only part of
+ * one: keep the parser across reads and start a new one after each
+ * terminator, instead of buffering complete messages first.
+ */
+static int netxml_alarm_feed(const char *buf, size_t len)
+{
+	const char	*end;
+	size_t	n;
+	int	messages = 0;
+
+	while (len > 0) {
+		end = memchr(buf, '\0', len);
+		n = end ? (size_t)(end - buf) : len;
+
+		if (n > 0) {
+			if (!alarm_parser) {
+				alarm_parser = ne_xml_create();
+				ne_xml_push_handler(alarm_parser, subdriver->startelm_cb, subdriver->cdata_cb, subdriver->endelm_cb, NULL);
+			}
+
+			if (ne_xml_parse(alarm_parser, buf, n)) {
+				upsdebugx(2, "%s: %s", __func__, ne_xml_get_error(alarm_parser));
+			}
+		}
+
+		if (!end) {
+			/* rest of this message comes with the next read */
+			break;
+		}
+
+		if (alarm_parser) {
+			/* end of document */
+			ne_xml_parse(alarm_parser, "", 0);
+			netxml_alarm_reset();
+			messages++;
+		}
+
+		buf += n + 1;
+		len -= n + 1;
+	}
+
+	return messages;
+}
+
+/* Read what the NMC sent on the alarm socket; returns 1 if complete
+ * alarm messages came in, 0 if not (yet), -1 if the connection broke
+ * (it is then reopened by upsdrv_updateinfo()) */
+static int netxml_alarm_read(void)
+{
+	char	buf[LARGEBUF];
+	ssize_t	ret;
+
+	ret = ne_sock_read(sock, buf, sizeof(buf));
+
+	if (ret > 0) {
+		/* alarm message (or part of it) received */
+
+		upsdebugx(2, "%s: ne_sock_read(%" PRIiSIZE " bytes) => %.*s", __func__, ret, (int)ret, buf);
+		time(&lastheard);
+
+		if (netxml_alarm_feed(buf, (size_t)ret) > 0) {
+			alarm_pending = 1;
+			return 1;
+		}
+
+		return 0;
+	}
+
+	if (ret == NE_SOCK_TIMEOUT) {
+		upsdebugx(2, "%s: ne_sock_read(timeout)", __func__);
+		return 0;
+	}
+
+	upsdebugx(2, "%s: ne_sock_read(%" PRIiSIZE ") => %s", __func__, ret, ne_sock_error(sock));
+	alarm_lost = 1;
+	return -1;
+}
+
+#ifndef WIN32
+/* The main loop found the alarm socket readable (or hung up) */
+static int netxml_alarm_event(int fd, short revents, void *arg)
+{
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(revents);
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (alarm_lost) {
+		/* still waiting for upsdrv_updateinfo() to reconnect */
+		return 1;
+	}
+
+	return (netxml_alarm_read() != 0);
+}
+#endif
+
+/* Have the main loop watch the alarm socket, and call the driver
+ * as soon as an alarm comes in, rather than at the next poll */
+static void netxml_alarm_watch(void)
+{
+	alarm_lost = 0;
+	alarm_pending = 0;
+#ifndef WIN32
+	if (dstate_addevent(ne_sock_fd(sock), POLLIN, netxml_alarm_event, NULL) == 0) {
+		alarm_fd = ne_sock_fd(sock);
+	}
+#endif
+}
+
+static void netxml_alarm_close(void)
+{
+#ifndef WIN32
+	if (alarm_fd >= 0) {
+		dstate_delevent(alarm_fd);
+		alarm_fd = -1;
+	}
+#endif
+	if (sock) {
+		ne_sock_close(sock);
+		sock = NULL;
+	}
+
+	netxml_alarm_reset();
+	alarm_lost = 0;
+}
+
+/* Drop a partially received alarm message */
+static void netxml_alarm_reset(void)
+{
+	if (alarm_parser) {
+		ne_xml_destroy(alarm_parser);
+		alarm_parser = NULL;
+	}
+}
+
 static int netxml_dispatch_request(ne_request *request, ne_xml_parser *parser)
 {
 	int ret;
@@ -968,6 +1131,22 @@ static int netxml_authenticate(void *userdata, const char *realm, int attempt, c
 	return attempt;
 }
 
+/* Publish the status and alarms from what the pages and the alarm
+ * messages said */
+static void netxml_publish(void)
+{
+	status_init();
+
+	alarm_init();
+	netxml_alarm_set();
+	alarm_commit();
+
+	netxml_status_set();
+	status_commit();
+
+	dstate_dataok();
+}
+
 /* Convert the local status information to NUT format and set NUT
    alarms. */
 static void netxml_alarm_set(void)
@@ -22,6 +22,10 @@
 #ifndef NUT_IPMI_H
 #define NUT_IPMI_H
 
+/* SDR cache of a BMC ("localhost" for in-band access) in the state path,
+ * shared by the driver and nut-scanner */
+#define NUT_IPMI_SDR_CACHE_FMT	"ipmi-sdr-%s.cache"
+
 typedef enum {
 	PSU_STATUS_UNKNOWN = 1,
 	PSU_PRESENT,			/* = status OL */
@@ -98,6 +98,8 @@ static ipmi_monitoring_ctx_t mon_ctx = NULL;
   /* Constants */
 #  define IPMI_SDR_MAX_RECORD_LENGTH                               IPMI_SDR_CACHE_MAX_SDR_RECORD_LENGTH
 #  define IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST             IPMI_SDR_CACHE_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST
+#  define IPMI_SDR_ERR_CACHE_INVALID                               IPMI_SDR_CACHE_ERR_CACHE_INVALID
+#  define IPMI_SDR_ERR_CACHE_OUT_OF_DATE                           IPMI_SDR_CACHE_ERR_CACHE_OUT_OF_DATE
 #  define IPMI_FRU_AREA_SIZE_MAX                                   IPMI_FRU_PARSE_AREA_SIZE_MAX
 #  define IPMI_FRU_FLAGS_SKIP_CHECKSUM_CHECKS                      IPMI_FRU_PARSE_FLAGS_SKIP_CHECKSUM_CHECKS
 #  define IPMI_FRU_AREA_TYPE_BOARD_INFO_AREA                       IPMI_FRU_PARSE_AREA_TYPE_BOARD_INFO_AREA
@@ -106,10 +108,6 @@ static ipmi_monitoring_ctx_t mon_ctx = NULL;
 #  define NUT_IPMI_SDR_CACHE_DEFAULTS                              IPMI_SDR_CACHE_CREATE_FLAGS_DEFAULT, IPMI_SDR_CACHE_VALIDATION_FLAGS_DEFAULT
 #endif /* HAVE_FREEIPMI_11X_12X */
 
-/* FIXME: freeipmi auto selects a cache based on the hostname you are
- * connecting too, but this is probably fine for you
- */
-#define CACHE_LOCATION "/tmp/sdrcache"
 
 /* Support functions */
 static const char* libfreeipmi_getfield (uint8_t language_code,
@@ -336,25 +334,31 @@ static void libfreeipmi_cleanup(void)
 	if (fru_ctx) {
 		ipmi_fru_close_device_id (fru_ctx);
 		ipmi_fru_ctx_destroy (fru_ctx);
+		fru_ctx = NULL;
 	}
 
 	if (sdr_ctx) {
 		ipmi_sdr_ctx_destroy (sdr_ctx);
+		sdr_ctx = NULL;
 	}
 
 #ifndef HAVE_FREEIPMI_11X_12X
 	if (sdr_parse_ctx) {
 		ipmi_sdr_parse_ctx_destroy (sdr_parse_ctx);
+		sdr_parse_ctx = NULL;
 	}
 #endif
 
+	/* called again when the driver exits */
 	if (ipmi_ctx) {
 		ipmi_ctx_close (ipmi_ctx);
 		ipmi_ctx_destroy (ipmi_ctx);
+		ipmi_ctx = NULL;
 	}
 
 	if (mon_ctx) {
 		ipmi_monitoring_ctx_destroy (mon_ctx);
+		mon_ctx = NULL;
 	}
 }
 
@@ -585,10 +589,77 @@ static int libfreeipmi_get_board_info (const void *areabuf,
 }
 
 
+/* The SDR cache of the BMC, kept in the state path for the next starts
+ * (and shared with nut-scanner, which names it the same way); FreeIPMI
+ * checks it against the SDR version and the last change times the BMC
+ * reports when it is opened, so a cache which is out of date is made
+ * anew here. */
+static void libfreeipmi_sdr_cache_open (void)
+{
+	char cache_file[LARGEBUF];
+	int errnum;
+
+	snprintf (cache_file, sizeof(cache_file), "%s/" NUT_IPMI_SDR_CACHE_FMT,
+		dflt_statepath(), "localhost");
+
+	if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, cache_file) == 0)
+	{
+		upsdebugx(2, "Using the SDR cache %s", cache_file);
+		return;
+	}
+
+	errnum = ipmi_sdr_ctx_errnum (sdr_ctx);
+
+	if (errnum == IPMI_SDR_ERR_CACHE_INVALID
+		|| errnum == IPMI_SDR_ERR_CACHE_OUT_OF_DATE)
+	{
+		upsdebugx(1, "SDR cache %s is out of date, reading the SDR again",
+			cache_file);
+		if (ipmi_sdr_cache_delete (sdr_ctx, cache_file) < 0)
+		{
+			libfreeipmi_cleanup();
+			fatalx(EXIT_FAILURE, "ipmi_sdr_cache_delete: %s",
+				ipmi_sdr_ctx_errormsg (sdr_ctx));
+		}
+	}
+	else if (errnum != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
+	{
+		libfreeipmi_cleanup();
+		fatalx(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
+			ipmi_sdr_ctx_errormsg (sdr_ctx));
+	}
+
+	upsdebugx(1, "Reading the SDR into %s", cache_file);
+
+	if (ipmi_sdr_cache_create (sdr_ctx,
+			 ipmi_ctx, cache_file,
+			 NUT_IPMI_SDR_CACHE_DEFAULTS,
+			 NULL, NULL) < 0)
+	{
+		libfreeipmi_cleanup();
+		fatalx(EXIT_FAILURE, "ipmi_sdr_cache_create: %s",
+			ipmi_sdr_ctx_errormsg (sdr_ctx));
+	}
+
+	if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, cache_file) < 0)
+	{
+		libfreeipmi_cleanup();
+		fatalx(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
+			ipmi_sdr_ctx_errormsg (sdr_ctx));
+	}
+}
+
 /* Get the sensors list & values, specific to the given FRU ID
  * Return -1 on error, or the number of sensors found otherwise */
 static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 {
+	/* a sensor record, to be matched with the FRU entity once known */
+	typedef struct {
+		uint16_t record_id;
+		uint8_t entity_id;
+		uint8_t entity_instance;
+	} sensor_entity_t;
+
 	uint8_t sdr_record[IPMI_SDR_MAX_RECORD_LENGTH];
 	uint8_t record_type, logical_physical_fru_device, logical_fru_device_device_slave_address;
 	uint8_t tmp_entity_id, tmp_entity_instance;
@@ -597,6 +668,8 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 	int found_device_id = 0;
 	uint16_t record_id;
 	uint8_t entity_id = 0, entity_instance = 0;
+	sensor_entity_t *sensors = NULL;
+	size_t sensors_count = 0, s;
 	int i;
 
 	if (ipmi_ctx == NULL)
@@ -620,37 +693,7 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 	}
 #endif
 
-	if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, CACHE_LOCATION) < 0)
-	{
-		if (ipmi_sdr_ctx_errnum (sdr_ctx) != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
-		{
-			libfreeipmi_cleanup();
-			fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
-				ipmi_sdr_ctx_errormsg (sdr_ctx));
-		}
-	}
-
-	if (ipmi_sdr_ctx_errnum (sdr_ctx) == IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
-	{
-		if (ipmi_sdr_cache_create (sdr_ctx,
-				 ipmi_ctx, CACHE_LOCATION,
-				 NUT_IPMI_SDR_CACHE_DEFAULTS,
-				 NULL, NULL) < 0)
-		{
-			libfreeipmi_cleanup();
-			fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_create: %s",
-				ipmi_sdr_ctx_errormsg (sdr_ctx));
-		}
-		if (ipmi_sdr_cache_open (sdr_ctx, ipmi_ctx, CACHE_LOCATION) < 0)
-		{
-			if (ipmi_sdr_ctx_errnum (sdr_ctx) != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST)
-			{
-				libfreeipmi_cleanup();
-				fatal_with_errno(EXIT_FAILURE, "ipmi_sdr_cache_open: %s",
-					ipmi_sdr_ctx_errormsg (sdr_ctx));
-			}
-		}
-	}
+	libfreeipmi_sdr_cache_open ();
 
 	if (ipmi_sdr_cache_record_count (sdr_ctx, &record_count) < 0) {
 		fprintf (stderr,
@@ -661,6 +704,10 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 
 	upsdebugx(3, "Found %i records in SDR cache", record_count);
 
+	sensors = xcalloc (record_count ? record_count : 1, sizeof(*sensors));
+
+	/* One pass over the SDR: the FRU device locator of our device
+	 * tells its entity, and the sensors of that entity are ours */
 	for (i = 0; i < record_count; i++, ipmi_sdr_cache_next (sdr_ctx))
 	{
 		memset (sdr_record, '\0', IPMI_SDR_MAX_RECORD_LENGTH);
@@ -673,10 +720,11 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 				ipmi_sdr_ctx_errormsg (sdr_ctx));
 			goto cleanup;
 		}
+
 		if (ipmi_sdr_parse_record_id_and_type (SDR_PARSE_CTX,
 				sdr_record,
 				(unsigned int)sdr_record_len,
-				NULL,
+				&record_id,
 				&record_type) < 0)
 		{
 			fprintf (stderr, "ipmi_sdr_parse_record_id_and_type: %s\n",
@@ -684,10 +732,34 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 			goto cleanup;
 		}
 
-		upsdebugx (5, "Checking record %i (/%i)", i, record_count);
+		upsdebugx (5, "Checking record %i (/%i)", record_id, record_count);
+
+		if (record_type == IPMI_SDR_FORMAT_FULL_SENSOR_RECORD
+			|| record_type == IPMI_SDR_FORMAT_COMPACT_SENSOR_RECORD
+			|| record_type == IPMI_SDR_FORMAT_EVENT_ONLY_RECORD)
+		{
+			if (ipmi_sdr_parse_entity_id_instance_type (SDR_PARSE_CTX,
+					sdr_record,
+					(unsigned int)sdr_record_len,
+					&tmp_entity_id,
+					&tmp_entity_instance,
+					NULL) < 0)
+			{
+				fprintf (stderr, "ipmi_sdr_parse_entity_instance_type: %s\n",
+					ipmi_sdr_ctx_errormsg (sdr_ctx));
+				goto cleanup;
+			}
 
-		if (record_type != IPMI_SDR_FORMAT_FRU_DEVICE_LOCATOR_RECORD) {
-			upsdebugx(1, "=======> not device locator (%i)!!", record_type);
+			sensors[sensors_count].record_id = record_id;
+			sensors[sensors_count].entity_id = tmp_entity_id;
+			sensors[sensors_count].entity_instance = tmp_entity_instance;
+			sensors_count++;
+			continue;
+		}
+
+		if (record_type != IPMI_SDR_FORMAT_FRU_DEVICE_LOCATOR_RECORD
+			|| found_device_id)
+		{
 			continue;
 		}
 
@@ -725,7 +797,6 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 					ipmi_sdr_ctx_errormsg (sdr_ctx));
 				goto cleanup;
 			}
-			break;
 		}
 	}
 
@@ -737,82 +808,44 @@ static int libfreeipmi_get_sensors_info (IPMIDevice_t *ipmi_dev)
 	else
 		upsdebugx(1, "Found device id %d", ipmi_dev->ipmi_id);
 
-	if (ipmi_sdr_cache_first (sdr_ctx) < 0)
+	for (s = 0; s < sensors_count; s++)
 	{
-		fprintf (stderr, "ipmi_sdr_cache_first: %s\n",
-			ipmi_sdr_ctx_errormsg (sdr_ctx));
-		goto cleanup;
-	}
-
-	for (i = 0; i < record_count; i++, ipmi_sdr_cache_next (sdr_ctx))
-	{
-		/* uint8_t sdr_record[IPMI_SDR_CACHE_MAX_SDR_RECORD_LENGTH];
-		uint8_t record_type, tmp_entity_id, tmp_entity_instance;
-		int sdr_record_len; */
-
-		memset (sdr_record, '\0', IPMI_SDR_MAX_RECORD_LENGTH);
-		if ((sdr_record_len = ipmi_sdr_cache_record_read (sdr_ctx,
-				sdr_record,
-				IPMI_SDR_MAX_RECORD_LENGTH)) < 0)
+		if (sensors[s].entity_id != entity_id
+			|| sensors[s].entity_instance != entity_instance)
 		{
-			fprintf (stderr, "ipmi_sdr_cache_record_read: %s\n",
-				ipmi_sdr_ctx_errormsg (sdr_ctx));
-			goto cleanup;
-		}
-
-		if (ipmi_sdr_parse_record_id_and_type (SDR_PARSE_CTX,
-				sdr_record,
-				(unsigned int)sdr_record_len,
-				&record_id,
-				&record_type) < 0)
-		{
-			fprintf (stderr, "ipmi_sdr_parse_record_id_and_type: %s\n",
-				ipmi_sdr_ctx_errormsg (sdr_ctx));
-			goto cleanup;
-		}
-
-		upsdebugx (5, "Checking record %i (/%i)", record_id, record_count);
-
-		if (record_type != IPMI_SDR_FORMAT_FULL_SENSOR_RECORD
-			&& record_type != IPMI_SDR_FORMAT_COMPACT_SENSOR_RECORD
-			&& record_type != IPMI_SDR_FORMAT_EVENT_ONLY_RECORD) {
 			continue;
 		}
 
-		if (ipmi_sdr_parse_entity_id_instance_type (SDR_PARSE_CTX,
-				sdr_record,
-				(unsigned int)sdr_record_len,
-				&tmp_entity_id,
-				&tmp_entity_instance,
-				NULL) < 0)
+		if (ipmi_dev->sensors_count >= SIZEOF_ARRAY(ipmi_dev->sensors_id_list))
 		{
-			fprintf (stderr, "ipmi_sdr_parse_entity_instance_type: %s\n",
-				ipmi_sdr_ctx_errormsg (sdr_ctx));
-			goto cleanup;
+			upsdebugx (1, "Too many sensors for device id %u, "
+				"record id %u and next are ignored",
+				ipmi_dev->ipmi_id, sensors[s].record_id);
+			break;
 		}
 
-		if (tmp_entity_id == entity_id
-			&& tmp_entity_instance == entity_instance)
-		{
-			upsdebugx (1, "Found record id = %u for device id %u",
-				record_id, ipmi_dev->ipmi_id);
+		upsdebugx (1, "Found record id = %u for device id %u",
+			sensors[s].record_id, ipmi_dev->ipmi_id);
 
-			/* Add it to the tracked list */
-			ipmi_dev->sensors_id_list[ipmi_dev->sensors_count] = record_id;
-			ipmi_dev->sensors_count++;
-		}
+		/* Add it to the tracked list */
+		ipmi_dev->sensors_id_list[ipmi_dev->sensors_count] = sensors[s].record_id;
+		ipmi_dev->sensors_count++;
 	}
 
 
 cleanup:
 	/* Cleanup */
+	free (sensors);
+
 	if (sdr_ctx) {
 		ipmi_sdr_ctx_destroy (sdr_ctx);
+		sdr_ctx = NULL;
 	}
 
 #ifndef HAVE_FREEIPMI_11X_12X
 	if (sdr_parse_ctx) {
 		ipmi_sdr_parse_ctx_destroy (sdr_parse_ctx);
+		sdr_parse_ctx = NULL;
 	}
 #endif /* HAVE_FREEIPMI_11X_12X */
 
@@ -863,8 +896,8 @@ int nut_ipmi_monitoring_init(void)
 	}
 
 #if HAVE_FREEIPMI_MONITORING
-	/* FIXME: replace "/tmp" by a proper place, using mkdtemp() or similar */
-	if (ipmi_monitoring_ctx_sdr_cache_directory (mon_ctx, "/tmp") < 0) {
+	/* its own copy of the SDR, also kept for the next starts */
+	if (ipmi_monitoring_ctx_sdr_cache_directory (mon_ctx, dflt_statepath()) < 0) {
 		upsdebugx (1, "ipmi_monitoring_ctx_sdr_cache_directory() error: %s",
 					ipmi_monitoring_ctx_errormsg (mon_ctx));
 		return -1;
@@ -114,8 +114,33 @@ typedef struct usb_communication_subdriver_s {
 	usb_ctrl_descindex hid_desc_index;		/* HID descriptor is at this index (non-trivial for composite USB devices); see comments above */
 	usb_ctrl_endpoint hid_ep_in;			/* Input interrupt endpoint. Default is 1	*/
 	usb_ctrl_endpoint hid_ep_out;			/* Output interrupt endpoint. Default is 1	*/
+
+	/* Optional (NULL where not supported): keep a transfer submitted on
+	 * the input interrupt endpoint, with the driver main loop polling
+	 * for its completion. Until close_dev(), get_interrupt() then hands
+	 * out the reports which came in meanwhile, one per call, without
+	 * waiting (0 if there is none). Returns 0 if started, < 0 if not. */
+	int (*start_interrupt_async)(usb_dev_handle *sdev,
+		usb_ctrl_charbufsize bufsize);
+
+	/* Optional (NULL where not supported): while the device is away,
+	 * watch for the arrival of one with the vendor and product IDs of
+	 * device (stop watching if NULL), with the driver main loop polling
+	 * for the hotplug events. Returns 0 if watching, < 0 if not. */
+	int (*watch_hotplug)(USBDevice_t *device);
+
+	/* Whether a watched device arrived (or was already there when the
+	 * watch started) since the last call: 1 if so, else 0 */
+	int (*hotplug_arrived)(void);
 } usb_communication_subdriver_t;
 
 extern usb_communication_subdriver_t	usb_subdriver;
 
+/* The variables of the communication driver which are per device (see
+ * addhostvars() in main.h), usb_subdriver among them. The devices of a
+ * process share the libusb context, and with libusb 1.0 they share the
+ * bus enumeration as well, along with what was read from each device to
+ * match it */
+const dstate_hostvar_t *nut_usb_hostvars(void);
+
 #endif /* NUT_LIBUSB_H_SEEN */
@@ -58,7 +58,7 @@
 #	define DRIVER_NAME	"Generic Q* Serial driver"
 #endif	/* QX_USB */
 
-#define DRIVER_VERSION	"0.39"
+#define DRIVER_VERSION	"0.40"
 
 #ifdef QX_SERIAL
 #	include "serial.h"
@@ -149,16 +149,43 @@ static int	hunnox_step = 0;
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
 #endif	/* QX_USB && QX_SERIAL */
 
+/* Answers got during the current walk, keyed by the (preprocessed)
+ * command, so that items sharing a query reuse its answer even when
+ * they are not adjacent in the qx2nut table */
+#define QX_WALK_CACHE_SIZE	32
+
+static struct {
+	char	command[SMALLBUF];	/* Command sent to the UPS to get answer (after preprocess_command) */
+	char	answer[SMALLBUF];	/* Answer from the UPS (after preprocess_answer) */
+} walk_cache[QX_WALK_CACHE_SIZE];
+static size_t	walk_cache_used = 0;	/* Entries of walk_cache filled in the current walk */
+static size_t	walk_cache_next = 0;	/* Entry of walk_cache to overwrite when it is full */
+
+static unsigned long	walk_commands = 0;	/* Commands sent to the UPS during the last walk */
+static unsigned long	walk_cached = 0;	/* Items served from walk_cache during the last walk */
+static bool_t	walk_served_clients = FALSE;	/* Whether requests of the clients were served during the last walk */
+
+/* Index of the active subdriver's qx2nut table, built the first time it is
+ * needed (and again when the table changes, e.g. while probing subdrivers):
+ * the items each walk mode may visit, and their names hashed for lookups */
+#define QX_NAME_HASH_SIZE	256
+
 static struct {
-	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
-	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
+	item_t	*table;				/* qx2nut table the index was built for */
+	item_t	**walk[QX_WALKMODE_FULL_UPDATE + 1];	/* Items to visit in each walk mode, in table order */
+	size_t	walk_len[QX_WALKMODE_FULL_UPDATE + 1];	/* Number of items in walk[] */
+	size_t	*name_next;			/* Next item (position + 1) with the same name hash, 0 if none */
+	size_t	name_head[QX_NAME_HASH_SIZE];	/* First item (position + 1) for each name hash, 0 if none */
+} qx_index = { NULL, { NULL, NULL, NULL }, { 0, 0, 0 }, NULL, { 0 } };
 
 
 /* == Support functions == */
 static int	subdriver_matcher(void);
 static ssize_t	qx_command(const char *cmd, char *buf, size_t buflen);
 static int	qx_process_answer(item_t *item, const size_t len); /* returns just 0 or -1 */
+static int	qx_walk_process(item_t *item);
+static void	qx_index_build(void);
+static void	qx_index_free(void);
 static bool_t	qx_ups_walk(walkmode_t mode);
 static void	ups_status_set(void);
 static void	ups_alarm_set(void);
@@ -547,11 +574,130 @@ static int				langid_fix = -1;
 
 static int	(*subdriver_command)(const char *cmd, char *buf, size_t buflen) = NULL;
 
+/* Bridged (USB to serial) subdrivers: the size of the packets of their
+ * interrupt IN endpoint, and how long they were seen to take, so that
+ * reads are as large, and waits for what may not come as short, as
+ * they can be */
+#define QX_BRIDGE_ENDPOINT	0x81
+#define QX_BRIDGE_TIMEOUT	1000	/* msec, for a reply to come */
+#define QX_BRIDGE_DRAIN_MIN	50	/* msec, for more of a reply to come */
+#define QX_BRIDGE_WRITE_MIN	500	/* msec, for a write, once timed */
+
+static struct {
+	int	initialized;
+	int	chunk;	/* wMaxPacketSize of QX_BRIDGE_ENDPOINT */
+	double	gap;	/* slowest packet after the first one of a reply, sec */
+	double	write;	/* slowest write of a command, sec */
+} qx_bridge = { 0, 8, 0, 0 };
+
+/* Find out the packet size of the bridge, once per device */
+static void	qx_bridge_init(void)
+{
+#if WITH_LIBUSB_1_0
+	struct libusb_device	*dev;
+	struct libusb_config_descriptor	*config;
+	const struct libusb_interface_descriptor	*alt;
+	uint8_t	i;
+#endif	/* WITH_LIBUSB_1_0 */
+
+	if (qx_bridge.initialized)
+		return;
+
+	qx_bridge.initialized = 1;
+	qx_bridge.chunk = 8;
+	qx_bridge.gap = 0;
+	qx_bridge.write = 0;
+
+#if WITH_LIBUSB_1_0
+	if ((dev = libusb_get_device(udev)) == NULL
+	 || libusb_get_active_config_descriptor(dev, &config) != 0
+	) {
+		upsdebugx(4, "%s: no configuration descriptor, reading 8 bytes at a time", __func__);
+		return;
+	}
+
+	if (config->bNumInterfaces > 0 && config->interface[0].num_altsetting > 0) {
+		alt = &config->interface[0].altsetting[0];
+		for (i = 0; i < alt->bNumEndpoints; i++) {
+			if (alt->endpoint[i].bEndpointAddress != QX_BRIDGE_ENDPOINT)
+				continue;
+			/* more than that would not fit the replies (SMALLBUF) */
+			if (alt->endpoint[i].wMaxPacketSize > 8 && alt->endpoint[i].wMaxPacketSize <= 64)
+				qx_bridge.chunk = alt->endpoint[i].wMaxPacketSize;
+			break;
+		}
+	}
+
+	libusb_free_config_descriptor(config);
+#endif	/* WITH_LIBUSB_1_0 */
+
+	upsdebugx(4, "%s: reading %d bytes at a time", __func__, qx_bridge.chunk);
+}
+
+/* The wait for more of a reply, when there may be none: some times the
+ * slowest packet seen after the first one, not a whole reply timeout */
+static int	qx_bridge_drain_timeout(void)
+{
+	double	ms = 3 * qx_bridge.gap * 1000;
+
+	if (ms < QX_BRIDGE_DRAIN_MIN)
+		return QX_BRIDGE_DRAIN_MIN;
+	if (ms > QX_BRIDGE_TIMEOUT)
+		return QX_BRIDGE_TIMEOUT;
+	return (int)ms;
+}
+
+/* Write a command chunk (of 8 bytes) with a SET_REPORT to the bridge;
+ * once writes were timed, not waiting for up to timeout when they take
+ * milliseconds anyway (a bridge which does not answer fails sooner) */
+static int	qx_bridge_write(char *data, int value, int timeout)
+{
+	struct timeval	start, now;
+	double	ms = 10 * qx_bridge.write * 1000;
+	int	ret;
+
+	if (qx_bridge.write > 0 && ms < timeout)
+		timeout = ms < QX_BRIDGE_WRITE_MIN ? QX_BRIDGE_WRITE_MIN : (int)ms;
+
+	gettimeofday(&start, NULL);
+	ret = usb_control_msg(udev,
+		USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
+		0x09, value, 0,
+		(usb_ctrl_charbuf)data, 8, timeout);
+	gettimeofday(&now, NULL);
+
+	if (ret > 0 && difftimeval(now, start) > qx_bridge.write)
+		qx_bridge.write = difftimeval(now, start);
+
+	return ret;
+}
+
+/* Read a packet (of up to len bytes) from the bridge: the first one of
+ * a reply (more == 0) may take a whole reply timeout, the next ones are
+ * timed for qx_bridge_drain_timeout() */
+static int	qx_bridge_read(char *data, int len, int more, int timeout)
+{
+	struct timeval	start, now;
+	int	ret;
+
+	gettimeofday(&start, NULL);
+	ret = usb_interrupt_read(udev, QX_BRIDGE_ENDPOINT,
+		(usb_ctrl_charbuf)data, len, timeout);
+	gettimeofday(&now, NULL);
+
+	if (more && ret > 0 && difftimeval(now, start) > qx_bridge.gap) {
+		qx_bridge.gap = difftimeval(now, start);
+		upsdebugx(4, "%s: slowest packet so far: %.3f sec", __func__, qx_bridge.gap);
+	}
+
+	return ret;
+}
+
 /* Cypress communication subdriver */
 static int	cypress_command(const char *cmd, char *buf, size_t buflen)
 {
 	char	tmp[SMALLBUF];
-	int	ret = 0;
+	int	ret = 0, chunk;
 	size_t	i;
 
 	if (buflen > INT_MAX) {
@@ -561,6 +707,9 @@ static int	cypress_command(const char *cmd, char *buf, size_t buflen)
 		buflen = (INT_MAX - 1);
 	}
 
+	qx_bridge_init();
+	chunk = (size_t)qx_bridge.chunk <= buflen ? qx_bridge.chunk : 8;
+
 	/* Send command */
 	memset(tmp, 0, sizeof(tmp));
 	snprintf(tmp, sizeof(tmp), "%s", cmd);
@@ -569,10 +718,7 @@ static int	cypress_command(const char *cmd, char *buf, size_t buflen)
 
 		/* Write data in 8-byte chunks */
 		/* ret = usb->set_report(udev, 0, (unsigned char *)&tmp[i], 8); */
-		ret = usb_control_msg(udev,
-			USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
-			0x09, 0x200, 0,
-			(usb_ctrl_charbuf)&tmp[i], 8, 5000);
+		ret = qx_bridge_write(&tmp[i], 0x200, 5000);
 
 		if (ret <= 0) {
 			upsdebugx(3, "send: %s (%d)",
@@ -588,13 +734,11 @@ static int	cypress_command(const char *cmd, char *buf, size_t buflen)
 	/* Read reply */
 	memset(buf, 0, buflen);
 
-	for (i = 0; (i <= buflen-8) && (memchr(buf, '\r', buflen) == NULL); i += (size_t)ret) {
+	for (i = 0; (i + (size_t)chunk <= buflen) && (memchr(buf, '\r', buflen) == NULL); i += (size_t)ret) {
 
-		/* Read data in 8-byte chunks */
+		/* Read data in chunks of the packet size (usually 8 bytes) */
 		/* ret = usb->get_interrupt(udev, (unsigned char *)&buf[i], 8, 1000); */
-		ret = usb_interrupt_read(udev,
-			0x81,
-			(usb_ctrl_charbuf)&buf[i], 8, 1000);
+		ret = qx_bridge_read(&buf[i], chunk, i > 0, QX_BRIDGE_TIMEOUT);
 
 		/* Any errors here mean that we are unable to read a reply
 		 * (which will happen after successfully writing a command
@@ -634,6 +778,8 @@ static int	sgs_command(const char *cmd, char *buf, size_t buflen)
 		buflen = (INT_MAX - 1);
 	}
 
+	qx_bridge_init();
+
 	/* Send command */
 	cmdlen = strlen(cmd);
 
@@ -649,10 +795,7 @@ static int	sgs_command(const char *cmd, char *buf, size_t buflen)
 		memcpy(&tmp[1], &cmd[i], (unsigned char)ret);
 
 		/* Write data in 8-byte chunks */
-		ret = usb_control_msg(udev,
-			USB_ENDPOINT_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
-			0x09, 0x200, 0,
-			(usb_ctrl_charbuf)tmp, 8, 5000);
+		ret = qx_bridge_write(tmp, 0x200, 5000);
 
 		if (ret <= 0) {
 			upsdebugx(3, "send: %s (%d)",
@@ -674,10 +817,12 @@ static int	sgs_command(const char *cmd, char *buf, size_t buflen)
 
 		memset(tmp, 0, sizeof(tmp));
 
-		/* Read data in 8-byte chunks */
-		ret = usb_interrupt_read(udev,
-			0x81,
-			(usb_ctrl_charbuf)tmp, 8, 1000);
+		/* Read data in 8-byte chunks (each with its length, so this
+		 * bridge ends a reply with a timeout: once the reply has its
+		 * CR, wait only as long as more of it could take) */
+		ret = qx_bridge_read(tmp, 8, i > 0,
+			(i > 0 && memchr(buf, '\r', i) != NULL)
+				? qx_bridge_drain_timeout() : QX_BRIDGE_TIMEOUT);
 
 		/* No error!!! */
 		/* if (ret == -110) */
@@ -729,7 +874,7 @@ static int	sgs_command(const char *cmd, char *buf, size_t buflen)
 static int	phoenix_command(const char *cmd, char *buf, size_t buflen)
 {
 	char	tmp[SMALLBUF];
-	int	ret;
+	int	ret, chunk;
 	size_t	i;
 
 	if (buflen > INT_MAX) {
@@ -739,13 +884,16 @@ static int	phoenix_command(const char *cmd, char *buf, size_t buflen)
 		buflen = (INT_MAX - 1);
 	}
 
+	qx_bridge_init();
+	chunk = (size_t)qx_bridge.chunk <= buflen ? qx_bridge.chunk : 8;
+
 	for (i = 0; i < 8; i++) {
 
-		/* Read data in 8-byte chunks */
+		/* Read data in chunks of the packet size (usually 8 bytes);
+		 * what is left to flush is there already, or comes as fast
+		 * as the rest of a reply: no need for a whole reply timeout */
 		/* ret = usb->get_interrupt(udev, (unsigned char *)tmp, 8, 1000); */
-		ret = usb_interrupt_read(udev,
-			0x81,
-			(usb_ctrl_charbuf)tmp, 8, 1000);
+		ret = qx_bridge_read(tmp, chunk, 0, qx_bridge_drain_timeout());
 
 		/* This USB to serial implementation is crappy.
 		 * In order to read correct replies we need to flush the
@@ -782,9 +930,7 @@ static int	phoenix_command(const char *cmd, char *buf, size_t buflen)
 
 		/* Write data in 8-byte chunks */
 		/* ret = usb->set_report(udev, 0, (unsigned char *)&tmp[i], 8); */
-		ret = usb_control_msg(udev,
-			USB_ENDPOINT_OUT + USB_TYPE_CLASS + USB_RECIP_INTERFACE,
-			0x09, 0x200, 0, (usb_ctrl_charbuf)&tmp[i], 8, 1000);
+		ret = qx_bridge_write(&tmp[i], 0x200, 1000);
 
 		if (ret <= 0) {
 			upsdebugx(3, "send: %s (%d)",
@@ -799,13 +945,11 @@ static int	phoenix_command(const char *cmd, char *buf, size_t buflen)
 	/* Read reply */
 	memset(buf, 0, buflen);
 
-	for (i = 0; (i <= buflen-8) && (memchr(buf, '\r', buflen) == NULL); i += (size_t)ret) {
+	for (i = 0; (i + (size_t)chunk <= buflen) && (memchr(buf, '\r', buflen) == NULL); i += (size_t)ret) {
 
-		/* Read data in 8-byte chunks */
+		/* Read data in chunks of the packet size (usually 8 bytes) */
 		/* ret = usb->get_interrupt(udev, (unsigned char *)&buf[i], 8, 1000); */
-		ret = usb_interrupt_read(udev,
-			0x81,
-			(usb_ctrl_charbuf)&buf[i], 8, 1000);
+		ret = qx_bridge_read(&buf[i], chunk, i > 0, QX_BRIDGE_TIMEOUT);
 
 		/* Any errors here mean that we are unable to read a reply
 		 * (which will happen after successfully writing a command
@@ -3051,7 +3195,11 @@ void	upsdrv_updateinfo(void)
 		}
 
 		lastpoll = now;
-		data_has_changed = FALSE;
+
+		/* A setvar/instcmd served during the walk may have come
+		 * after the semi-static items were polled */
+		if (walk_served_clients == FALSE)
+			data_has_changed = FALSE;
 
 		ups_alarm_set();
 		alarm_commit();
@@ -3438,6 +3586,8 @@ void	upsdrv_cleanup(void)
 {
 	upsdebugx(1, "%s...", __func__);
 
+	qx_index_free();
+
 #ifndef TESTING
 
 # ifdef QX_SERIAL
@@ -3508,6 +3658,9 @@ static ssize_t	qx_command(const char *cmd, char *buf, size_t buflen)
 		if (udev == NULL) {
 			dstate_setinfo("driver.state", "reconnect.trying");
 
+			/* the device may not be the same bridge */
+			qx_bridge.initialized = 0;
+
 			ret = usb->open_dev(&udev, &usbdevice, reopen_matcher, NULL);
 
 			if (ret < 1) {
@@ -3886,7 +4039,11 @@ static void	qx_set_var(item_t *item)
 static bool_t	qx_ups_walk(walkmode_t mode)
 {
 	item_t	*item;
+	size_t	i;
 	int	retcode;
+	unsigned long	commands_seen = 0;
+
+	qx_index_build();
 
 	/* Clear batt.{chrg,runt}.act for guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE) {
@@ -3895,15 +4052,33 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		battery_voltage_reports_one_pack_considered = 0;
 	}
 
-	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
-	memset(previous_item.answer, 0, sizeof(previous_item.answer));
+	/* Forget the answers of the previous walk */
+	walk_cache_used = 0;
+	walk_cache_next = 0;
+	walk_commands = 0;
+	walk_cached = 0;
+	walk_served_clients = FALSE;
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE
 	 *      and QX_WALKMODE_FULL_UPDATE */
 
-	/* Device data walk */
-	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+	/* Device data walk (only the items this mode may need) */
+	for (i = 0; i < qx_index.walk_len[mode]; i++) {
+
+		item = qx_index.walk[mode][i];
+
+		/* Serve the requests of the clients (e.g. instant commands)
+		 * in between two exchanges with the UPS rather than only at
+		 * the end of the walk; what they did may change the answers */
+		if (mode != QX_WALKMODE_INIT && walk_commands != commands_seen) {
+			commands_seen = walk_commands;
+
+			if (dstate_poll_clients()) {
+				walk_served_clients = TRUE;
+				walk_cache_used = 0;
+				walk_cache_next = 0;
+			}
+		}
 
 		/* Skip this item */
 		if (item->qxflags & QX_FLAG_SKIP)
@@ -4016,31 +4191,9 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Check whether the previous item uses the same command
-		 * and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0
-		&&  strlen(previous_item.answer) > 0
-		&&  !strcasecmp(previous_item.command, item->command)
-		) {
-
-			snprintf(item->answer, sizeof(item->answer), "%s",
-				previous_item.answer);
-
-			/* Process the answer */
-			retcode = qx_process_answer(item, strlen(item->answer));
-
-		/* ..otherwise: execute command to get answer from the UPS */
-		} else {
-
-			retcode = qx_process(item, NULL);
-
-		}
-
-		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s",
-			item->command);
-		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s",
-			item->answer);
+		/* Use the answer to the same command, if already got
+		 * during this walk, otherwise ask the UPS */
+		retcode = qx_walk_process(item);
 
 		if (retcode) {
 
@@ -4086,6 +4239,14 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 	}
 
+	upsdebugx(3, "%s: %lu command(s) sent, %lu answer(s) reused",
+		__func__, walk_commands, walk_cached);
+
+	if (dstate_getinfo("driver.flag.perfstats")) {
+		dstate_setinfo("driver.perf.qx.commands", "%lu", walk_commands);
+		dstate_setinfo("driver.perf.qx.cached", "%lu", walk_cached);
+	}
+
 	/* Update battery guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE
 	&&  (d_equal(batt.runt.act, -1) || d_equal(batt.chrg.act, -1))
@@ -4232,12 +4393,96 @@ static void	ups_status_set(void)
 	}
 }
 
+/* Case-insensitive hash of a NUT variable/command name for qx_index */
+static size_t	qx_name_hash(const char *name)
+{
+	size_t	hash = 5381;
+
+	for (; *name; name++)
+		hash = hash * 33 + (size_t)tolower((unsigned char)*name);
+
+	return hash % QX_NAME_HASH_SIZE;
+}
+
+/* Free the index of the qx2nut table */
+static void	qx_index_free(void)
+{
+	size_t	mode;
+
+	for (mode = 0; mode <= QX_WALKMODE_FULL_UPDATE; mode++) {
+		free(qx_index.walk[mode]);
+		qx_index.walk[mode] = NULL;
+		qx_index.walk_len[mode] = 0;
+	}
+
+	free(qx_index.name_next);
+	qx_index.name_next = NULL;
+	memset(qx_index.name_head, 0, sizeof(qx_index.name_head));
+
+	qx_index.table = NULL;
+}
+
+/* Build the index of the active subdriver's qx2nut table, if not done yet.
+ * Only the flags which never change at runtime are considered here:
+ * QX_FLAG_SKIP and QX_FLAG_SEMI_STATIC are still checked while walking. */
+static void	qx_index_build(void)
+{
+	item_t	*item;
+	size_t	count, pos, hash;
+
+	if (qx_index.table == subdriver->qx2nut)
+		return;
+
+	qx_index_free();
+
+	for (count = 0; subdriver->qx2nut[count].info_type != NULL; count++);
+
+	qx_index.walk[QX_WALKMODE_INIT] = xcalloc(count + 1, sizeof(item_t *));
+	qx_index.walk[QX_WALKMODE_QUICK_UPDATE] = xcalloc(count + 1, sizeof(item_t *));
+	qx_index.walk[QX_WALKMODE_FULL_UPDATE] = xcalloc(count + 1, sizeof(item_t *));
+	qx_index.name_next = xcalloc(count + 1, sizeof(size_t));
+
+	for (pos = 0; pos < count; pos++) {
+
+		item = &subdriver->qx2nut[pos];
+
+		/* Device capabilities enumeration looks at every item */
+		qx_index.walk[QX_WALKMODE_INIT][qx_index.walk_len[QX_WALKMODE_INIT]++] = item;
+
+		/* Quick update only deals with status and alarms */
+		if (item->qxflags & QX_FLAG_QUICK_POLL)
+			qx_index.walk[QX_WALKMODE_QUICK_UPDATE][qx_index.walk_len[QX_WALKMODE_QUICK_UPDATE]++] = item;
+
+		/* These don't need polling after initinfo() */
+		if (!(item->qxflags & (QX_FLAG_ABSENT | QX_FLAG_CMD | QX_FLAG_SETVAR | QX_FLAG_STATIC)))
+			qx_index.walk[QX_WALKMODE_FULL_UPDATE][qx_index.walk_len[QX_WALKMODE_FULL_UPDATE]++] = item;
+	}
+
+	/* Chain the items with the same name hash, keeping the table order
+	 * so that find_nut_info() still returns the first matching item */
+	for (pos = count; pos > 0; pos--) {
+		hash = qx_name_hash(subdriver->qx2nut[pos - 1].info_type);
+		qx_index.name_next[pos - 1] = qx_index.name_head[hash];
+		qx_index.name_head[hash] = pos;
+	}
+
+	qx_index.table = subdriver->qx2nut;
+
+	upsdebugx(3, "%s: %" PRIuSIZE " items, %" PRIuSIZE " for quick updates, %" PRIuSIZE " for full updates",
+		__func__, count, qx_index.walk_len[QX_WALKMODE_QUICK_UPDATE], qx_index.walk_len[QX_WALKMODE_FULL_UPDATE]);
+}
+
 /* See header file for details. */
 item_t	*find_nut_info(const char *varname, const unsigned long flag, const unsigned long noflag)
 {
 	item_t	*item;
+	size_t	pos;
+
+	qx_index_build();
+
+	for (pos = qx_index.name_head[qx_name_hash(varname)]; pos; pos = qx_index.name_next[pos - 1]) {
 
-	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+		item = &subdriver->qx2nut[pos - 1];
 
 		if (strcasecmp(item->info_type, varname))
 			continue;
@@ -4290,23 +4535,50 @@ static int	qx_process_answer(item_t *item, const size_t len)
 		return -1;
 	}
 
-	/* Get value */
+	/* Get value: what snprintf("%.*s") used to cut, without parsing
+	 * a format for every item of every walk */
 	if (strlen(item->answer)) {
-		snprintf(item->value, sizeof(item->value), "%.*s",
-			item->to ? 1 + item->to - item->from : (int)strcspn(item->answer, "\r") - item->from,
-			item->answer + item->from);
+		const char	*from = item->answer + item->from;
+		int	width = item->to
+			? 1 + item->to - item->from
+			: (int)strcspn(item->answer, "\r") - item->from;
+		size_t	len = strlen(from);
+
+		/* a negative precision is none, as with printf() */
+		if (width >= 0 && (size_t)width < len)
+			len = (size_t)width;
+		if (len > sizeof(item->value) - 1)
+			len = sizeof(item->value) - 1;
+
+		memcpy(item->value, from, len);
+		item->value[len] = '\0';
 	} else {
-		snprintf(item->value, sizeof(item->value), "%s", "");
+		item->value[0] = '\0';
 	}
 
 	return 0;
 }
 
-/* See header file for details. */
-int	qx_process(item_t *item, const char *command)
+/* The precision of a "%.<N>f" format of item->dfl, the usual one for
+ * numbers, or -1 for any other format */
+static int	qx_dfl_precision(const char *dfl)
 {
-	char	buf[sizeof(item->answer) - 1] = "", *cmd;
-	ssize_t	len;
+	if (dfl[0] == '%' && dfl[1] == '.'
+	 && dfl[2] >= '0' && dfl[2] <= '9'
+	 && dfl[3] == 'f' && dfl[4] == '\0'
+	) {
+		return dfl[2] - '0';
+	}
+
+	return -1;
+}
+
+/* Prepare the command to be sent to the UPS for item (command, if not NULL,
+ * otherwise item->command), running its preprocess_command() function.
+ * Return the command (to be freed by the caller) or NULL in case of errors. */
+static char	*qx_prepare_command(item_t *item, const char *command)
+{
+	char	*cmd;
 	size_t cmdlen = command ?
 		(strlen(command) >= SMALLBUF ? strlen(command) + 1 : SMALLBUF) :
 		(item->command && strlen(item->command) >= SMALLBUF ? strlen(item->command) + 1 : SMALLBUF);
@@ -4314,7 +4586,7 @@ int	qx_process(item_t *item, const char *command)
 
 	if ( !(cmd = xmalloc(cmdsz)) ) {
 		upslogx(LOG_ERR, "qx_process() failed to allocate buffer");
-		return -1;
+		return NULL;
 	}
 
 	/* Prepare the command to be used */
@@ -4329,18 +4601,28 @@ int	qx_process(item_t *item, const char *command)
 		upsdebugx(4, "%s: failed to preprocess command [%s]",
 			__func__, item->info_type);
 		free (cmd);
-		return -1;
+		return NULL;
 	}
 
+	return cmd;
+}
+
+/* Send the already prepared cmd to the UPS and process its answer for item.
+ * Return -1 on failure, 0 for a good answer. */
+static int	qx_process_prepared(item_t *item, const char *cmd)
+{
+	char	buf[sizeof(item->answer) - 1] = "";
+	ssize_t	len;
+
 	/* Send the command */
 	len = qx_command(cmd, buf, sizeof(buf));
+	walk_commands++;
 
 	memset(item->answer, 0, sizeof(item->answer));
 
 	if (len < 0 || len > INT_MAX) {
 		upsdebugx(4, "%s: failed to preprocess answer [%s]",
 			__func__, item->info_type);
-		free (cmd);
 		return -1;
 	}
 
@@ -4355,21 +4637,90 @@ int	qx_process(item_t *item, const char *command)
 			/* Clear the failed answer, preventing it from
 			 * being reused by next items with same command */
 			memset(item->answer, 0, sizeof(item->answer));
-			free (cmd);
 			return -1;
 		}
 	}
 
-	free (cmd);
-
 	/* Process the answer to get the value */
 	return qx_process_answer(item, (size_t)len);
 }
 
+/* Process item during a walk: reuse the answer to the same (preprocessed)
+ * command if one was already got during this walk, otherwise send the
+ * command to the UPS and remember its answer for the next items.
+ * Return -1 on failure, 0 for a good answer. */
+static int	qx_walk_process(item_t *item)
+{
+	char	*cmd;
+	size_t	i;
+	int	retcode;
+
+	if ( !(cmd = qx_prepare_command(item, NULL)) )
+		return -1;
+
+	for (i = 0; i < walk_cache_used; i++) {
+
+		if (strcmp(walk_cache[i].command, cmd))
+			continue;
+
+		upsdebugx(4, "%s: reusing answer to [%s] for %s",
+			__func__, walk_cache[i].command, item->info_type);
+
+		snprintf(item->answer, sizeof(item->answer), "%s",
+			walk_cache[i].answer);
+		walk_cached++;
+		free(cmd);
+
+		/* Process the answer */
+		return qx_process_answer(item, strlen(item->answer));
+	}
+
+	retcode = qx_process_prepared(item, cmd);
+
+	/* Remember the answer (if any) for the next items: when the cache
+	 * is full, overwrite its entries in turn */
+	if (strlen(item->answer) > 0 && strlen(cmd) < sizeof(walk_cache[0].command)) {
+
+		if (walk_cache_used < QX_WALK_CACHE_SIZE) {
+			i = walk_cache_used++;
+		} else {
+			i = walk_cache_next;
+			walk_cache_next = (walk_cache_next + 1) % QX_WALK_CACHE_SIZE;
+		}
+
+		snprintf(walk_cache[i].command, sizeof(walk_cache[i].command), "%s",
+			cmd);
+		snprintf(walk_cache[i].answer, sizeof(walk_cache[i].answer), "%s",
+			item->answer);
+	}
+
+	free(cmd);
+
+	return retcode;
+}
+
+/* See header file for details. */
+int	qx_process(item_t *item, const char *command)
+{
+	char	*cmd;
+	int	retcode;
+
+	if ( !(cmd = qx_prepare_command(item, command)) )
+		return -1;
+
+	retcode = qx_process_prepared(item, cmd);
+
+	free (cmd);
+
+	return retcode;
+}
+
 /* See header file for details. */
 int	ups_infoval_set(item_t *item)
 {
 	char	value[SMALLBUF] = "";
+	double	number = 0;
+	int	precision = -1;
 
 	/* Item need to be preprocessed? */
 	if (item->preprocess != NULL){
@@ -4412,6 +4763,11 @@ int	ups_infoval_set(item_t *item)
 				return -1;
 			}
 
+			str_scan_double(value, &number);
+
+			if ((precision = qx_dfl_precision(item->dfl)) >= 0) {
+				str_from_double(value, sizeof(value), number, precision);
+			} else {
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
 #endif
@@ -4421,10 +4777,11 @@ int	ups_infoval_set(item_t *item)
 #ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
 #pragma GCC diagnostic ignored "-Wformat-security"
 #endif
-			snprintf(value, sizeof(value), item->dfl, strtod(value, NULL));
+				snprintf(value, sizeof(value), item->dfl, number);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
+			}
 		}
 
 	}
@@ -4440,13 +4797,23 @@ int	ups_infoval_set(item_t *item)
 		return -1;
 	}
 
-	dstate_setinfo(item->info_type, "%s", value);
+	/* a number which did not change since the last walk is not even
+	 * compared as text again */
+	if (precision >= 0)
+		dstate_setinfo_double(item->info_type, number, precision);
+	else
+		dstate_setinfo(item->info_type, "%s", value);
 
 	/* Fill batt.{chrg,runt}.act for guesstimation */
-	if (!strcasecmp(item->info_type, "battery.charge"))
-		batt.chrg.act = strtol(value, NULL, 10);
-	else if (!strcasecmp(item->info_type, "battery.runtime"))
-		batt.runt.act = strtol(value, NULL, 10);
+	if (!strcasecmp(item->info_type, "battery.charge")) {
+		long	act;
+		str_scan_long(value, &act);
+		batt.chrg.act = act;
+	} else if (!strcasecmp(item->info_type, "battery.runtime")) {
+		long	act;
+		str_scan_long(value, &act);
+		batt.runt.act = act;
+	}
 
 	return 1;
 }
@@ -45,6 +45,15 @@ static double vout_scale= 1;
 static double ccharge_scale = 1;
 static double cdischarge_scale = 1;
 
+/* per device, see addhostvars() */
+static const dstate_hostvar_t openups_hostvars[] = {
+	DSTATE_HOSTVAR(vin_scale),
+	DSTATE_HOSTVAR(vout_scale),
+	DSTATE_HOSTVAR(ccharge_scale),
+	DSTATE_HOSTVAR(cdischarge_scale),
+	DSTATE_HOSTVAR_END
+};
+
 static char openups_scratch_buf[20];
 
 static void *get_voltage_multiplier(USBDevice_t *device)
@@ -302,7 +311,7 @@ static usage_tables_t openups_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t openups_hid2nut[] = {
+static const hid_info_t openups_hid2nut[] = {
 	{"ups.serial", 0, 0, "UPS.PowerSummary.iSerialNumber", NULL, "%s", 0, stringid_conversion},
 
 	/* Battery */
@@ -398,4 +407,5 @@ subdriver_t openups_subdriver = {
 	openups_format_mfr,
 	openups_format_serial,
 	fix_report_desc,
+	openups_hostvars,
 };
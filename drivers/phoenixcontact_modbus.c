@@ -23,6 +23,7 @@
 
 #include "main.h"
 #include <modbus.h>
+#include "modbus_bus.h"
 #include "nut_stdint.h"
 
 #define DRIVER_NAME	"NUT PhoenixContact Modbus driver"
@@ -583,7 +584,9 @@ void upsdrv_cleanup(void)
 static int mrir(modbus_t * arg_ctx, int addr, int nb, uint16_t * dest)
 {
 	int r;
+	modbus_bus_lock(arg_ctx);
 	r = modbus_read_input_registers(arg_ctx, addr, nb, dest);
+	modbus_bus_unlock(arg_ctx);
 	if (r == -1) {
 		upslogx(LOG_ERR, "mrir: modbus_read_input_registers(addr:%d, count:%d): %s (%s)", addr, nb, modbus_strerror(errno), device_path);
 		errcount++;
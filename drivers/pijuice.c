@@ -23,7 +23,7 @@
 #include "nut_stdint.h"
 
 #define DRIVER_NAME                         "PiJuice UPS driver"
-#define DRIVER_VERSION                      "0.13"
+#define DRIVER_VERSION                      "0.14"
 
 /*
  * Linux I2C userland is a bit of a mess until distros refresh to
@@ -239,6 +239,18 @@ static uint8_t battery_power = 0;
  */
 static float battery_charge_level = 0;
 
+/*
+ * Low power mode: while the status and the charge level stay the
+ * same (and not on battery), poll every lowpower_interval seconds
+ * instead of every pollinterval, to wake the Pi and the HAT less
+ */
+#define LOWPOWER_STABLE_UPDATES             3
+
+static time_t lowpower_interval = 0;
+static time_t normal_interval = 0;
+static int stable_updates = 0;
+static char last_state[ST_MAX_VALUE_LEN + 8];
+
 /* driver description structure */
 upsdrv_info_t upsdrv_info = {
 	DRIVER_NAME,
@@ -781,6 +793,47 @@ static void get_i2c_address(void)
 	}
 }
 
+static void lowpower_update(void)
+{
+	const char *status = dstate_getinfo( "ups.status" );
+	char state[sizeof(last_state)];
+
+	if ( lowpower_interval <= 0 )
+	{
+		return;
+	}
+
+	if ( normal_interval == 0 )
+	{
+		normal_interval = poll_interval;
+	}
+
+	snprintf( state, sizeof(state), "%s %d",
+		status ? status : "", (int)battery_charge_level );
+
+	if ( !status || strstr( status, "OB" ) || strstr( status, "LB" )
+	 || strcmp( state, last_state ) )
+	{
+		snprintf( last_state, sizeof(last_state), "%s", state );
+		stable_updates = 0;
+		if ( poll_interval != normal_interval )
+		{
+			upsdebugx( 1, "Readings changed, polling every %" PRIdMAX " seconds",
+				(intmax_t)normal_interval );
+			poll_interval = normal_interval;
+		}
+		return;
+	}
+
+	if ( ++stable_updates >= LOWPOWER_STABLE_UPDATES
+	 && poll_interval != lowpower_interval )
+	{
+		upsdebugx( 1, "Readings stable, polling every %" PRIdMAX " seconds",
+			(intmax_t)lowpower_interval );
+		poll_interval = lowpower_interval;
+	}
+}
+
 void upsdrv_initinfo(void)
 {
 
@@ -823,10 +876,17 @@ void upsdrv_updateinfo(void)
 	get_io_voltage();
 	get_io_current();
 	get_time();
-	get_power_off();
+
+	/* only ever logged: spare the bus the read otherwise */
+	if ( nut_debug_level >= 1 )
+	{
+		get_power_off();
+	}
 
 	status_commit();
 	dstate_dataok();
+
+	lowpower_update();
 }
 
 /* handler for commands to be sent to UPS */
@@ -871,6 +931,8 @@ void upsdrv_help(void)
 void upsdrv_makevartable(void)
 {
 	addvar(VAR_VALUE, "i2c_address", "Override i2c address setting");
+	addvar(VAR_VALUE, "lowpower_interval",
+		"Poll interval (seconds) while the readings are stable (default: 0, not used)");
 }
 
 void upsdrv_initups(void)
@@ -884,6 +946,9 @@ void upsdrv_initups(void)
 
 	if (getval("i2c_address"))
 		i2c_address = atoi(getval("i2c_address"));
+
+	if (getval("lowpower_interval"))
+		lowpower_interval = (time_t)atoi(getval("lowpower_interval"));
 }
 
 void upsdrv_cleanup(void)
@@ -62,6 +62,12 @@ static char powercom_scratch_buf[32];
  */
 static char powercom_sdcmd_byte_order_fallback = 0;
 
+/* per device, see addhostvars() */
+static const dstate_hostvar_t powercom_hostvars[] = {
+	DSTATE_HOSTVAR(powercom_sdcmd_byte_order_fallback),
+	DSTATE_HOSTVAR_END
+};
+
 static const char *powercom_startup_fun(double value)
 {
 	uint16_t	i = value;
@@ -358,7 +364,7 @@ static usage_tables_t powercom_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t powercom_hid2nut[] = {
+static const hid_info_t powercom_hid2nut[] = {
 	{ "BOOL", 0, 0, "UPS.PowerSummary.PresentStatus.ACPresent", NULL, NULL, 0, online_info },
 	{ "BOOL", 0, 0, "UPS.PowerSummary.PresentStatus.BatteryPresent", NULL, NULL, 0, nobattery_info },
 	{ "BOOL", 0, 0, "UPS.PowerSummary.PresentStatus.BelowRemainingCapacityLimit", NULL, NULL, 0, lowbatt_info },
@@ -605,4 +611,5 @@ subdriver_t powercom_subdriver = {
 	powercom_format_mfr,
 	powercom_format_serial,
 	fix_report_desc,
+	powercom_hostvars,
 };
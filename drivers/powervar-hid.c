@@ -69,7 +69,7 @@ static usage_tables_t powervar_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t powervar_hid2nut[] = {
+static const hid_info_t powervar_hid2nut[] = {
 
 	/* Battery page */
 	{ "battery.type", 0, 0, "UPS.PowerSummary.iDeviceChemistry", NULL, "%s", 0, stringid_conversion },
@@ -146,4 +146,5 @@ subdriver_t powervar_subdriver = {
 	powervar_format_mfr,
 	powervar_format_serial,
 	fix_report_desc,
+	NULL,
 };
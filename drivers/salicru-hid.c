@@ -83,7 +83,7 @@ static usage_tables_t salicru_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t salicru_hid2nut[] = {
+static const hid_info_t salicru_hid2nut[] = {
 
 #ifdef DEBUG
   { "experimental.ups.powersummary.imanufacturer", 0, 0, "UPS.PowerSummary.iManufacturer", NULL, "%.0f", 0, NULL },
@@ -282,4 +282,5 @@ subdriver_t salicru_subdriver = {
 	salicru_format_mfr,
 	salicru_format_serial,
 	fix_report_desc,
+	NULL,
 };
@@ -21,6 +21,7 @@
 #include "timehead.h"
 #include "serial.h"
 #include "main.h"
+#include "coop.h"
 #include "attribute.h"
 
 #ifndef WIN32
@@ -41,9 +42,29 @@
 
 	static unsigned int	comm_failures = 0;
 
+/* Bytes read from a port but not consumed yet: a line read fetches
+ * whatever the port has, and keeps what follows the end character for
+ * the next read instead of dropping it (it may be the start of the
+ * next, possibly unsolicited, message). Drivers normally use one port,
+ * the few slots are for the odd one using more. */
+#define SER_RXBUF_SIZE	256
+#define SER_RXBUF_PORTS	4
+
+typedef struct {
+	TYPE_FD_SER	fd;
+	int	inuse;
+	size_t	head;	/* position of the first byte not consumed yet */
+	size_t	len;	/* number of bytes not consumed yet */
+	char	data[SER_RXBUF_SIZE];
+} ser_rxbuf_t;
+
+static ser_rxbuf_t	ser_rxbuf[SER_RXBUF_PORTS];
+
 static void ser_open_error(const char *port)
 	__attribute__((noreturn));
 
+static void ser_rxbuf_drop(TYPE_FD_SER fd);
+
 static void ser_open_error(const char *port)
 {
 	struct	stat	fs;
@@ -157,6 +178,9 @@ TYPE_FD_SER ser_open_nf(const char *port)
 
 	lock_set(fd, port);
 
+	/* a recycled descriptor must not see the data of a previous port */
+	ser_rxbuf_drop(fd);
+
 	return fd;
 }
 
@@ -325,6 +349,8 @@ int ser_close(TYPE_FD_SER fd, const char *port)
 #endif
 	}
 
+	ser_rxbuf_drop(fd);
+
 	if (close(fd) != 0)
 		return -1;
 
@@ -436,34 +462,130 @@ ssize_t ser_send_buf_pace(TYPE_FD_SER fd, useconds_t d_usec, const void *buf,
 	const char	*data = buf;
 
 	assert(buflen < SSIZE_MAX);
+	dstate_perf_io_begin();
 	for (sent = 0; sent < (ssize_t)buflen; sent += ret) {
 		/* Conditions above ensure that (buflen - sent) > 0 below */
 		ret = write(fd, &data[sent], (d_usec == 0) ? (size_t)((ssize_t)buflen - sent) : 1);
 
 		if (ret < 1) {
+			dstate_perf_io_end();
 			return ret;
 		}
 
 		usleep(d_usec);
 	}
+	dstate_perf_io_end();
 
 	return sent;
 }
 
+/* select_read(), timed for driver.perf.* */
+static ssize_t ser_select_read(TYPE_FD_SER fd, void *buf, size_t buflen,
+	time_t d_sec, suseconds_t d_usec)
+{
+	ssize_t	ret;
+
+	dstate_perf_io_begin();
+#ifndef WIN32
+	/* in a task, the main loop goes on until the device answers */
+	if (coop_in_task()) {
+		ret = coop_wait(fd, (long)d_sec * 1000 + (long)(d_usec + 999) / 1000);
+		if (ret > 0) {
+			ret = read(fd, buf, buflen);
+		}
+	} else
+#endif
+	ret = select_read(fd, buf, buflen, d_sec, d_usec);
+	dstate_perf_io_end();
+
+	return ret;
+}
+
+/* find the read buffer of fd, or (if create is set) give it one */
+static ser_rxbuf_t *ser_rxbuf_find(TYPE_FD_SER fd, int create)
+{
+	size_t	i;
+	ser_rxbuf_t	*rx = NULL;
+
+	for (i = 0; i < SER_RXBUF_PORTS; i++) {
+
+		if (!ser_rxbuf[i].inuse) {
+			if (!rx)
+				rx = &ser_rxbuf[i];
+			continue;
+		}
+
+		if (ser_rxbuf[i].fd == fd)
+			return &ser_rxbuf[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	/* all taken by other ports: the first one loses its pending data */
+	if (!rx) {
+		upsdebugx(3, "%s: too many serial ports, dropping buffered data", __func__);
+		rx = &ser_rxbuf[0];
+	}
+
+	rx->fd = fd;
+	rx->inuse = 1;
+	rx->head = 0;
+	rx->len = 0;
+
+	return rx;
+}
+
+/* forget what was read from fd and not consumed yet */
+static void ser_rxbuf_drop(TYPE_FD_SER fd)
+{
+	ser_rxbuf_t	*rx = ser_rxbuf_find(fd, 0);
+
+	if (rx)
+		rx->inuse = 0;
+}
+
+/* move up to buflen bytes already read from fd to buf */
+static size_t ser_rxbuf_take(TYPE_FD_SER fd, void *buf, size_t buflen)
+{
+	size_t	len;
+	ser_rxbuf_t	*rx = ser_rxbuf_find(fd, 0);
+
+	if (!rx || !rx->len)
+		return 0;
+
+	len = (buflen < rx->len) ? buflen : rx->len;
+	memcpy(buf, &rx->data[rx->head], len);
+	rx->head += len;
+	rx->len -= len;
+
+	return len;
+}
+
 ssize_t ser_get_char(TYPE_FD_SER fd, void *ch, time_t d_sec, useconds_t d_usec)
 {
+	if (ser_rxbuf_take(fd, ch, 1))
+		return 1;
+
 	/* Per standard below, we can cast here, because required ranges are
 	 * effectively the same (and signed -1 for suseconds_t), and at most long:
 	 * https://pubs.opengroup.org/onlinepubs/009604599/basedefs/sys/types.h.html
 	 */
-	return select_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
+	return ser_select_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
 }
 
 ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec)
 {
+	size_t	len;
+
 	memset(buf, '\0', buflen);
 
-	return select_read(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
+	/* what is already there, like a read() would return it */
+	len = ser_rxbuf_take(fd, buf, buflen);
+	if (len)
+		return (ssize_t)len;
+
+	return ser_select_read(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
 }
 
 /* keep reading until buflen bytes are received or a timeout occurs */
@@ -476,9 +598,12 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 	assert(buflen < SSIZE_MAX);
 	memset(buf, '\0', buflen);
 
-	for (recv = 0; recv < (ssize_t)buflen; recv += ret) {
+	/* never reads ahead: the driver may read the rest of the port itself */
+	recv = (ssize_t)ser_rxbuf_take(fd, buf, buflen);
+
+	for (ret = 0; recv < (ssize_t)buflen; recv += ret) {
 
-		ret = select_read(fd, &data[recv],
+		ret = ser_select_read(fd, &data[recv],
 			(size_t)((ssize_t)buflen - recv),
 			d_sec, (suseconds_t)d_usec);
 
@@ -490,49 +615,95 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 	return recv;
 }
 
-/* reads a line up to <endchar>, discarding anything else that may follow,
-   with callouts to the handler if anything matches the alertset */
+/* reads a line up to <endchar>, keeping anything else that may follow for
+   the next read, with callouts to the handler if anything matches the alertset */
 ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, const char *alertset, void handler(char ch),
 	time_t d_sec, useconds_t d_usec)
 {
-	ssize_t	i, ret;
-	char	tmp[64];
-	char	*data = buf;
+	ssize_t	ret;
+	char	*data = buf, ch;
 	ssize_t	count = 0, maxcount;
+	unsigned char	charclass[256];	/* 0: data, 1: ignored, 2: alert */
+	const unsigned char	*p;
+	ser_rxbuf_t	*rx;
 
 	assert(buflen < SSIZE_MAX && buflen > 0);
 	memset(buf, '\0', buflen);
 
 	maxcount = (ssize_t)buflen - 1;		/* for trailing \0 */
 
+	/* look the sets up once rather than strchr() them for each byte;
+	 * alertset first so that ignset wins, and NUL was always ignored */
+	memset(charclass, 0, sizeof(charclass));
+	for (p = (const unsigned char *)alertset; *p; p++)
+		charclass[*p] = 2;
+	for (p = (const unsigned char *)ignset; *p; p++)
+		charclass[*p] = 1;
+	charclass[0] = 1;
+
+	rx = ser_rxbuf_find(fd, 1);
+
 	while (count < maxcount) {
-		ret = select_read(fd, tmp, sizeof(tmp), d_sec, (suseconds_t)d_usec);
 
-		if (ret < 1) {
-			return ret;
+		if (!rx->len) {
+			rx->head = 0;
+			ret = ser_select_read(fd, rx->data, sizeof(rx->data), d_sec, (suseconds_t)d_usec);
+
+			if (ret < 1) {
+				return ret;
+			}
+
+			rx->len = (size_t)ret;
 		}
 
-		for (i = 0; i < ret; i++) {
+		while (rx->len > 0 && count < maxcount) {
+
+			ch = rx->data[rx->head];
+			rx->head++;
+			rx->len--;
+
+			if (ch == endchar) {
+				/* the other half of a CR/LF line ending is no
+				 * data for anyone, drop it when it is there */
+				if (rx->len > 0
+				 && (((endchar == '\r') && (rx->data[rx->head] == '\n'))
+				  || ((endchar == '\n') && (rx->data[rx->head] == '\r')))
+				) {
+					rx->head++;
+					rx->len--;
+				}
 
-			if ((count == maxcount) || (tmp[i] == endchar)) {
 				return count;
 			}
 
-			if (strchr(ignset, tmp[i]))
-				continue;
+			switch (charclass[(unsigned char)ch])
+			{
+			case 1:
+				break;
 
-			if (strchr(alertset, tmp[i])) {
+			case 2:
 				if (handler)
-					handler(tmp[i]);
+					handler(ch);
+				break;
 
-				continue;
+			default:
+				data[count++] = ch;
+				break;
 			}
-
-			data[count++] = tmp[i];
 		}
 	}
 
+	/* the line did not fit: drop its remainder as far as it was read */
+	while (rx->len > 0) {
+		ch = rx->data[rx->head];
+		rx->head++;
+		rx->len--;
+
+		if (ch == endchar)
+			break;
+	}
+
 	return count;
 }
 
@@ -570,6 +741,11 @@ ssize_t ser_flush_in(TYPE_FD_SER fd, const char *ignset, int verbose)
 
 int ser_flush_io(TYPE_FD_SER fd)
 {
+	ser_rxbuf_t	*rx = ser_rxbuf_find(fd, 0);
+
+	if (rx)
+		rx->len = 0;
+
 	return tcflush(fd, TCIOFLUSH);
 }
 
@@ -0,0 +1,78 @@
+/*  snmp-ups-mibc.c - compile the MIB-to-NUT mappings built into snmp-ups
+ *  into the files of its "mibdir" (see snmp-ups-mibfile.h)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "common.h"	/* includes "config.h" which must be the first header */
+
+#include <stdio.h>
+#include <ctype.h>
+
+#include "snmp-ups-mibfile.h"
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-D] <directory>\n\n", prog);
+	printf("Write each MIB-to-NUT mapping of snmp-ups to <directory>, as\n");
+	printf("NN-name%s in the order they are tried in with \"mibs=auto\".\n\n", SU_MIBFILE_SUFFIX);
+	printf("  -D	raise debugging level\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char	*prog = xbasename(argv[0]), *dir;
+	char	fn[LARGEBUF], name[SMALLBUF];
+	size_t	i, j;
+	int	c;
+
+	while ((c = getopt(argc, argv, "hD")) != -1) {
+		switch (c) {
+			case 'D':
+				nut_debug_level++;
+				break;
+			case 'h':
+			default:
+				usage(prog);
+				exit((c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(prog);
+		exit(EXIT_FAILURE);
+	}
+	dir = argv[optind];
+
+	for (i = 0; mib2nut_builtin[i] != NULL; i++) {
+		/* the mapping names are short words, but they end in a file name */
+		snprintf(name, sizeof(name), "%s", mib2nut_builtin[i]->mib_name);
+		for (j = 0; name[j] != '\0'; j++) {
+			if (!isalnum((unsigned char)name[j]) && name[j] != '-' && name[j] != '_') {
+				name[j] = '_';
+			}
+		}
+
+		snprintf(fn, sizeof(fn), "%s/%03" PRIuSIZE "-%s%s",
+			dir, i + 1, name, SU_MIBFILE_SUFFIX);
+		if (su_mibfile_write(mib2nut_builtin[i], fn) < 0) {
+			fatalx(EXIT_FAILURE, "Can't compile the %s mapping",
+				mib2nut_builtin[i]->mib_name);
+		}
+	}
+
+	upsdebugx(1, "%" PRIuSIZE " mappings compiled into %s", i, dir);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,650 @@
+/*  snmp-ups-mibfile.c - compiled MIB-to-NUT mapping files of snmp-ups
+ *  (see snmp-ups-mibfile.h for the format)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "common.h"	/* includes "config.h" which must be the first header */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "snmp-ups-mibfile.h"
+#include "eaton-pdu-marlin-helpers.h"
+
+#ifndef O_BINARY
+# define O_BINARY	0
+#endif
+
+#if WITH_SNMP_LKP_FUN
+/* The lookup functions a table may name; one used by a new table must be
+ * added here for the table to be compiled */
+static const struct {
+	const char	*name;
+	const char	*(*fun_vp2s)(void *snmp_value);
+	long	(*nuf_s2l)(const char *nut_value);
+} su_mibfile_funcs[] = {
+	{ "su_usdate_to_isodate_info_fun", su_usdate_to_isodate_info_fun, NULL },
+	{ "su_temperature_read_fun", su_temperature_read_fun, NULL },
+	{ "eaton_sensor_temperature_unit_fun", eaton_sensor_temperature_unit_fun, NULL },
+	{ "marlin_device_count_fun", NULL, marlin_device_count_fun },
+	{ NULL, NULL, NULL }
+};
+#endif	/* WITH_SNMP_LKP_FUN */
+
+/* A mapping of su_mibfile_load(), its tables filled in while mapped */
+typedef struct {
+	mib2nut_info_t	m2n;	/* first: what the callers are handed */
+	char	*fn;
+	su_mibfile_hdr_t	hdr;
+	char	*names;	/* the strings of m2n, read from the file */
+	size_t	refs;	/* holders of the tables below */
+	char	*map;
+	snmp_info_t	*info;
+	info_lkp_t	*lkp;
+	alarms_info_t	*alarms;
+} su_mibfile_t;
+
+/* The strings of a file being written, each only once */
+typedef struct {
+	char	*buf;
+	size_t	len, size;
+	size_t	base;	/* offset of buf in the file */
+} su_mibfile_strings_t;
+
+static uint32_t su_mibfile_str(su_mibfile_strings_t *st, const char *s)
+{
+	size_t	i, n;
+
+	if (s == NULL) {
+		return 0;
+	}
+
+	/* the same OIDs and names come back all over a table */
+	n = strlen(s) + 1;
+	for (i = 0; i + n <= st->len; i += strlen(st->buf + i) + 1) {
+		if (!memcmp(st->buf + i, s, n)) {
+			return (uint32_t)(st->base + i);
+		}
+	}
+
+	if (st->len + n > st->size) {
+		while (st->len + n > st->size) {
+			st->size = (st->size ? st->size * 2 : 4096);
+		}
+		st->buf = xrealloc(st->buf, st->size);
+	}
+
+	memcpy(st->buf + st->len, s, n);
+	st->len += n;
+
+	return (uint32_t)(st->base + st->len - n);
+}
+
+#if WITH_SNMP_LKP_FUN
+static int su_mibfile_funname(su_mibfile_strings_t *st, const info_lkp_t *lkp, su_mibfile_lkp_t *rec)
+{
+	size_t	i;
+
+	if (lkp->fun_vp2s != NULL) {
+		for (i = 0; su_mibfile_funcs[i].name != NULL && su_mibfile_funcs[i].fun_vp2s != lkp->fun_vp2s; i++)
+			;
+		if (su_mibfile_funcs[i].name == NULL) {
+			return -1;
+		}
+		rec->fun_vp2s = su_mibfile_str(st, su_mibfile_funcs[i].name);
+	}
+
+	if (lkp->nuf_s2l != NULL) {
+		for (i = 0; su_mibfile_funcs[i].name != NULL && su_mibfile_funcs[i].nuf_s2l != lkp->nuf_s2l; i++)
+			;
+		if (su_mibfile_funcs[i].name == NULL) {
+			return -1;
+		}
+		rec->nuf_s2l = su_mibfile_str(st, su_mibfile_funcs[i].name);
+	}
+
+	return 0;
+}
+#endif	/* WITH_SNMP_LKP_FUN */
+
+int su_mibfile_write(const mib2nut_info_t *m2n, const char *fn)
+{
+	su_mibfile_hdr_t	hdr;
+	su_mibfile_strings_t	st;
+	su_mibfile_info_t	*info = NULL;
+	su_mibfile_lkp_t	*lkp = NULL;
+	su_mibfile_alarm_t	*alarms = NULL;
+	const info_lkp_t	**tables = NULL, *p;
+	uint32_t	*table_first = NULL;
+	size_t	i, j, ntables = 0, off;
+	int	ret = -1;
+	FILE	*f;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(&st, 0, sizeof(st));
+	memcpy(hdr.magic, SU_MIBFILE_MAGIC, sizeof(hdr.magic));
+	hdr.byteorder = SU_MIBFILE_BYTEORDER;
+
+	/* count the records first, the strings go after them */
+	for (i = 0; m2n->snmp_info != NULL && m2n->snmp_info[i].info_type != NULL; i++) {
+		p = m2n->snmp_info[i].oid2info;
+		if (p == NULL) {
+			continue;
+		}
+		for (j = 0; j < ntables && tables[j] != p; j++)
+			;
+		if (j < ntables) {
+			continue;
+		}
+		tables = xrealloc(tables, (ntables + 1) * sizeof(*tables));
+		table_first = xrealloc(table_first, (ntables + 1) * sizeof(*table_first));
+		tables[ntables] = p;
+		table_first[ntables++] = hdr.lkp_count;
+		for (; p->info_value != NULL; p++) {
+			hdr.lkp_count++;
+		}
+		hdr.lkp_count++;	/* sentinel */
+	}
+	hdr.info_count = (uint32_t)i;
+
+	if (m2n->alarms_info != NULL) {
+		for (i = 0; m2n->alarms_info[i].OID != NULL; i++)
+			;
+		hdr.alarms_count = (uint32_t)i + 1;
+	}
+
+	off = sizeof(hdr);
+	off = (off + 7) & ~(size_t)7;	/* for info_len */
+	hdr.info_off = (uint32_t)off;
+	off += hdr.info_count * sizeof(*info);
+	hdr.lkp_off = (uint32_t)off;
+	off += hdr.lkp_count * sizeof(*lkp);
+	if (hdr.alarms_count > 0) {
+		hdr.alarms_off = (uint32_t)off;
+		off += hdr.alarms_count * sizeof(*alarms);
+	}
+	hdr.strings_off = (uint32_t)off;
+	st.base = off;
+
+	/* the strings of the header come first, to be read on their own */
+	hdr.mib_name = su_mibfile_str(&st, m2n->mib_name);
+	hdr.mib_version = su_mibfile_str(&st, m2n->mib_version);
+	hdr.oid_pwr_status = su_mibfile_str(&st, m2n->oid_pwr_status);
+	hdr.oid_auto_check = su_mibfile_str(&st, m2n->oid_auto_check);
+	hdr.sysOID = su_mibfile_str(&st, m2n->sysOID);
+	hdr.names_off = hdr.strings_off;
+	hdr.names_len = (uint32_t)st.len;
+
+	info = xcalloc(hdr.info_count + 1, sizeof(*info));
+	for (i = 0; i < hdr.info_count; i++) {
+		const snmp_info_t	*s = &m2n->snmp_info[i];
+
+		info[i].info_type = su_mibfile_str(&st, s->info_type);
+		info[i].info_flags = s->info_flags;
+		info[i].info_len = s->info_len;
+		info[i].OID = su_mibfile_str(&st, s->OID);
+		info[i].dfl = su_mibfile_str(&st, s->dfl);
+		info[i].flags = s->flags;
+		for (j = 0; s->oid2info != NULL && tables[j] != s->oid2info; j++)
+			;
+		info[i].oid2info = (s->oid2info != NULL ? table_first[j] + 1 : 0);
+	}
+
+	lkp = xcalloc(hdr.lkp_count + 1, sizeof(*lkp));
+	for (i = 0, j = 0; i < ntables; i++) {
+		for (p = tables[i]; ; p++, j++) {
+			lkp[j].oid_value = p->oid_value;
+			lkp[j].info_value = su_mibfile_str(&st, p->info_value);
+#if WITH_SNMP_LKP_FUN
+			if (su_mibfile_funname(&st, p, &lkp[j]) < 0) {
+				upslogx(LOG_ERR, "%s: %s: a lookup table of %s has a function "
+					"which su_mibfile_funcs[] does not know of",
+					__func__, fn, m2n->mib_name);
+				goto out;
+			}
+#endif	/* WITH_SNMP_LKP_FUN */
+			if (p->info_value == NULL) {
+				j++;
+				break;
+			}
+		}
+	}
+
+	if (hdr.alarms_count > 0) {
+		alarms = xcalloc(hdr.alarms_count, sizeof(*alarms));
+		for (i = 0; i + 1 < hdr.alarms_count; i++) {
+			alarms[i].OID = su_mibfile_str(&st, m2n->alarms_info[i].OID);
+			alarms[i].status_value = su_mibfile_str(&st, m2n->alarms_info[i].status_value);
+			alarms[i].alarm_value = su_mibfile_str(&st, m2n->alarms_info[i].alarm_value);
+		}
+	}
+
+	/* never empty, for the check of its last NUL */
+	if (st.len == 0) {
+		su_mibfile_str(&st, "");
+	}
+	hdr.strings_len = (uint32_t)st.len;
+	hdr.size = (uint32_t)(hdr.strings_off + st.len);
+
+	f = fopen(fn, "wb");
+	if (f == NULL) {
+		upslog_with_errno(LOG_ERR, "%s: can't create %s", __func__, fn);
+		goto out;
+	}
+
+	off = sizeof(hdr);
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	 || (off < hdr.info_off && fwrite("\0\0\0\0\0\0\0", hdr.info_off - off, 1, f) != 1)
+	 || (hdr.info_count > 0 && fwrite(info, sizeof(*info), hdr.info_count, f) != hdr.info_count)
+	 || (hdr.lkp_count > 0 && fwrite(lkp, sizeof(*lkp), hdr.lkp_count, f) != hdr.lkp_count)
+	 || (hdr.alarms_count > 0 && fwrite(alarms, sizeof(*alarms), hdr.alarms_count, f) != hdr.alarms_count)
+	 || fwrite(st.buf, st.len, 1, f) != 1
+	) {
+		upslog_with_errno(LOG_ERR, "%s: can't write %s", __func__, fn);
+		fclose(f);
+		unlink(fn);
+		goto out;
+	}
+
+	if (fclose(f) != 0) {
+		upslog_with_errno(LOG_ERR, "%s: can't write %s", __func__, fn);
+		unlink(fn);
+		goto out;
+	}
+
+	upsdebugx(1, "%s: %s: %" PRIu32 " entries, %" PRIu32 " lookup values, "
+		"%" PRIu32 " bytes", __func__, fn, hdr.info_count, hdr.lkp_count, hdr.size);
+	ret = 0;
+
+out:
+	free(st.buf);
+	free(info);
+	free(lkp);
+	free(alarms);
+	free(tables);
+	free(table_first);
+
+	return ret;
+}
+
+/* Whether [off, off + count * recsize) is in a file of size bytes */
+static int su_mibfile_inside(uint32_t size, uint32_t off, uint32_t count, size_t recsize)
+{
+	return off <= size && (uint64_t)count * recsize <= (uint64_t)(size - off);
+}
+
+static int su_mibfile_check_hdr(const su_mibfile_hdr_t *hdr, size_t size)
+{
+	return !memcmp(hdr->magic, SU_MIBFILE_MAGIC, sizeof(hdr->magic))
+		&& hdr->byteorder == SU_MIBFILE_BYTEORDER
+		&& (size_t)hdr->size == size
+		&& hdr->info_off % 8 == 0
+		&& su_mibfile_inside(hdr->size, hdr->info_off, hdr->info_count, sizeof(su_mibfile_info_t))
+		&& su_mibfile_inside(hdr->size, hdr->lkp_off, hdr->lkp_count, sizeof(su_mibfile_lkp_t))
+		&& (hdr->alarms_count == 0 || hdr->alarms_off > 0)
+		&& su_mibfile_inside(hdr->size, hdr->alarms_off, hdr->alarms_count, sizeof(su_mibfile_alarm_t))
+		&& hdr->strings_len > 0
+		&& su_mibfile_inside(hdr->size, hdr->strings_off, hdr->strings_len, 1)
+		&& hdr->names_len > 0
+		&& hdr->names_off >= hdr->strings_off
+		&& su_mibfile_inside(hdr->strings_off + hdr->strings_len, hdr->names_off, hdr->names_len, 1);
+}
+
+/* String at offset off of a file, if it is in the len bytes at first of
+ * buf (which end with a NUL); *bad is set if it is not */
+static const char *su_mibfile_getstr(const char *buf, uint32_t first, uint32_t len, uint32_t off, int *bad)
+{
+	if (off == 0) {
+		return NULL;
+	}
+
+	if (off < first || off - first >= len) {
+		*bad = 1;
+		return NULL;
+	}
+
+	return buf + (off - first);
+}
+
+/* Read the header and its strings of file fn */
+static su_mibfile_t *su_mibfile_open(const char *fn)
+{
+	su_mibfile_t	*f;
+	su_mibfile_hdr_t	hdr;
+	struct stat	st;
+	char	*names;
+	int	fd, bad = 0;
+
+	fd = open(fn, O_RDONLY | O_BINARY);
+	if (fd < 0) {
+		upslog_with_errno(LOG_WARNING, "%s: can't open %s", __func__, fn);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0
+	 || (uintmax_t)st.st_size > (uintmax_t)UINT32_MAX
+	 || read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)
+	 || !su_mibfile_check_hdr(&hdr, (size_t)st.st_size)
+	) {
+		upslogx(LOG_WARNING, "%s: %s is not a MIB mapping compiled by this "
+			"version of %s, ignored", __func__, fn, "snmp-ups-mibc");
+		close(fd);
+		return NULL;
+	}
+
+	names = xmalloc(hdr.names_len);
+	if (lseek(fd, (off_t)hdr.names_off, SEEK_SET) != (off_t)hdr.names_off
+	 || read(fd, names, hdr.names_len) != (ssize_t)hdr.names_len
+	 || names[hdr.names_len - 1] != '\0'
+	) {
+		upslogx(LOG_WARNING, "%s: can't read %s, ignored", __func__, fn);
+		free(names);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	f = xcalloc(1, sizeof(*f));
+	f->fn = xstrdup(fn);
+	f->hdr = hdr;
+	f->names = names;
+	f->m2n.mib_name = su_mibfile_getstr(names, hdr.names_off, hdr.names_len, hdr.mib_name, &bad);
+	f->m2n.mib_version = su_mibfile_getstr(names, hdr.names_off, hdr.names_len, hdr.mib_version, &bad);
+	f->m2n.oid_pwr_status = su_mibfile_getstr(names, hdr.names_off, hdr.names_len, hdr.oid_pwr_status, &bad);
+	f->m2n.oid_auto_check = su_mibfile_getstr(names, hdr.names_off, hdr.names_len, hdr.oid_auto_check, &bad);
+	f->m2n.sysOID = su_mibfile_getstr(names, hdr.names_off, hdr.names_len, hdr.sysOID, &bad);
+
+	if (bad || f->m2n.mib_name == NULL) {
+		upslogx(LOG_WARNING, "%s: %s has no valid name, ignored", __func__, fn);
+		free(f->fn);
+		free(f->names);
+		free(f);
+		return NULL;
+	}
+
+	return f;
+}
+
+static int su_mibfile_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+mib2nut_info_t **su_mibfile_load(const char *dir)
+{
+	DIR	*dp;
+	struct dirent	*dirp;
+	char	**names = NULL, fn[LARGEBUF];
+	size_t	i, n = 0, count = 0, len, slen = strlen(SU_MIBFILE_SUFFIX);
+	mib2nut_info_t	**list;
+	su_mibfile_t	*f;
+
+	dp = opendir(dir);
+	if (dp == NULL) {
+		upsdebug_with_errno(1, "%s: can't open %s", __func__, dir);
+		return NULL;
+	}
+
+	while ((dirp = readdir(dp)) != NULL) {
+		len = strlen(dirp->d_name);
+		if (len <= slen || strcmp(dirp->d_name + len - slen, SU_MIBFILE_SUFFIX)) {
+			continue;
+		}
+		names = xrealloc(names, (n + 1) * sizeof(*names));
+		names[n++] = xstrdup(dirp->d_name);
+	}
+	closedir(dp);
+
+	if (n == 0) {
+		upsdebugx(1, "%s: no compiled mappings in %s", __func__, dir);
+		return NULL;
+	}
+
+	qsort(names, n, sizeof(*names), su_mibfile_name_cmp);
+
+	list = xcalloc(n + 1, sizeof(*list));
+	for (i = 0; i < n; i++) {
+		snprintf(fn, sizeof(fn), "%s/%s", dir, names[i]);
+		free(names[i]);
+		if ((f = su_mibfile_open(fn)) != NULL) {
+			list[count++] = &f->m2n;
+		}
+	}
+	free(names);
+
+	if (count == 0) {
+		free(list);
+		return NULL;
+	}
+
+	upsdebugx(1, "%s: %" PRIuSIZE " compiled mappings in %s", __func__, count, dir);
+	return list;
+}
+
+/* Fill in the tables of f from its mapping; returns 0, or -1 */
+static int su_mibfile_tables(su_mibfile_t *f)
+{
+	const su_mibfile_hdr_t	*hdr = &f->hdr;
+	const su_mibfile_info_t	*info = (const su_mibfile_info_t *)(f->map + hdr->info_off);
+	const su_mibfile_lkp_t	*lkp = (const su_mibfile_lkp_t *)(f->map + hdr->lkp_off);
+	const su_mibfile_alarm_t	*alarms = (const su_mibfile_alarm_t *)(f->map + hdr->alarms_off);
+	const char	*strings = f->map + hdr->strings_off;
+#if WITH_SNMP_LKP_FUN
+	const char	*s;
+#endif
+	uint32_t	i;
+	int	bad = 0;
+
+#define SU_MIBFILE_STR(off)	su_mibfile_getstr(strings, hdr->strings_off, hdr->strings_len, (off), &bad)
+
+	f->lkp = xcalloc(hdr->lkp_count + 1, sizeof(*f->lkp));
+	for (i = 0; i < hdr->lkp_count; i++) {
+		f->lkp[i].oid_value = lkp[i].oid_value;
+		f->lkp[i].info_value = SU_MIBFILE_STR(lkp[i].info_value);
+#if WITH_SNMP_LKP_FUN
+		if ((s = SU_MIBFILE_STR(lkp[i].fun_vp2s)) != NULL) {
+			size_t	j;
+
+			for (j = 0; su_mibfile_funcs[j].name != NULL && strcmp(su_mibfile_funcs[j].name, s); j++)
+				;
+			if ((f->lkp[i].fun_vp2s = su_mibfile_funcs[j].fun_vp2s) == NULL) {
+				upslogx(LOG_ERR, "%s: %s: unknown lookup function %s", __func__, f->fn, s);
+				return -1;
+			}
+		}
+		if ((s = SU_MIBFILE_STR(lkp[i].nuf_s2l)) != NULL) {
+			size_t	j;
+
+			for (j = 0; su_mibfile_funcs[j].name != NULL && strcmp(su_mibfile_funcs[j].name, s); j++)
+				;
+			if ((f->lkp[i].nuf_s2l = su_mibfile_funcs[j].nuf_s2l) == NULL) {
+				upslogx(LOG_ERR, "%s: %s: unknown lookup function %s", __func__, f->fn, s);
+				return -1;
+			}
+		}
+#else
+		if (lkp[i].fun_vp2s != 0 || lkp[i].nuf_s2l != 0) {
+			upslogx(LOG_ERR, "%s: %s: lookup functions are not supported by this build",
+				__func__, f->fn);
+			return -1;
+		}
+#endif	/* WITH_SNMP_LKP_FUN */
+	}
+
+	/* the strings are used in place: the tables are only read */
+	f->info = xcalloc(hdr->info_count + 1, sizeof(*f->info));
+	for (i = 0; i < hdr->info_count; i++) {
+		f->info[i].info_type = (char *)SU_MIBFILE_STR(info[i].info_type);
+		f->info[i].info_flags = info[i].info_flags;
+		f->info[i].info_len = info[i].info_len;
+		f->info[i].OID = (char *)SU_MIBFILE_STR(info[i].OID);
+		f->info[i].dfl = (char *)SU_MIBFILE_STR(info[i].dfl);
+		f->info[i].flags = info[i].flags;
+		if (f->info[i].info_type == NULL || info[i].oid2info > hdr->lkp_count) {
+			bad = 1;
+		} else if (info[i].oid2info > 0) {
+			f->info[i].oid2info = &f->lkp[info[i].oid2info - 1];
+		}
+	}
+
+	if (hdr->alarms_count > 0) {
+		f->alarms = xcalloc(hdr->alarms_count + 1, sizeof(*f->alarms));
+		for (i = 0; i + 1 < hdr->alarms_count; i++) {
+			f->alarms[i].OID = SU_MIBFILE_STR(alarms[i].OID);
+			f->alarms[i].status_value = SU_MIBFILE_STR(alarms[i].status_value);
+			f->alarms[i].alarm_value = SU_MIBFILE_STR(alarms[i].alarm_value);
+			if (f->alarms[i].OID == NULL) {
+				bad = 1;
+			}
+		}
+	}
+
+#undef SU_MIBFILE_STR
+
+	if (bad) {
+		upslogx(LOG_ERR, "%s: %s is damaged", __func__, f->fn);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void su_mibfile_release(su_mibfile_t *f)
+{
+	free(f->info);
+	free(f->lkp);
+	free(f->alarms);
+	f->info = NULL;
+	f->lkp = NULL;
+	f->alarms = NULL;
+
+	if (f->map != NULL) {
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+		munmap(f->map, f->hdr.size);
+#else
+		free(f->map);
+#endif
+		f->map = NULL;
+	}
+
+	f->m2n.snmp_info = NULL;
+	f->m2n.alarms_info = NULL;
+	f->refs = 0;
+}
+
+int su_mibfile_map(mib2nut_info_t *m2n)
+{
+	su_mibfile_t	*f = (su_mibfile_t *)m2n;
+	struct stat	st;
+	int	fd;
+
+	if (f->refs > 0) {
+		f->refs++;
+		return 0;
+	}
+
+	fd = open(f->fn, O_RDONLY | O_BINARY);
+	if (fd < 0) {
+		upslog_with_errno(LOG_ERR, "%s: can't open %s", __func__, f->fn);
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0 || (uintmax_t)st.st_size != (uintmax_t)f->hdr.size) {
+		upslogx(LOG_ERR, "%s: %s has changed since it was loaded", __func__, f->fn);
+		close(fd);
+		return -1;
+	}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	f->map = mmap(NULL, f->hdr.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (f->map == MAP_FAILED) {
+		upslog_with_errno(LOG_ERR, "%s: can't map %s", __func__, f->fn);
+		f->map = NULL;
+		close(fd);
+		return -1;
+	}
+#else
+	f->map = xmalloc(f->hdr.size);
+	if (read(fd, f->map, f->hdr.size) != (ssize_t)f->hdr.size) {
+		upslog_with_errno(LOG_ERR, "%s: can't read %s", __func__, f->fn);
+		free(f->map);
+		f->map = NULL;
+		close(fd);
+		return -1;
+	}
+#endif
+	close(fd);
+
+	if (memcmp(f->map, &f->hdr, sizeof(f->hdr))
+	 || f->map[f->hdr.strings_off + f->hdr.strings_len - 1] != '\0'
+	) {
+		upslogx(LOG_ERR, "%s: %s has changed since it was loaded, or is damaged",
+			__func__, f->fn);
+		su_mibfile_release(f);
+		return -1;
+	}
+
+	if (su_mibfile_tables(f) < 0) {
+		su_mibfile_release(f);
+		return -1;
+	}
+
+	upsdebugx(2, "%s: mapped %s (%s)", __func__, f->fn, f->m2n.mib_name);
+	f->m2n.snmp_info = f->info;
+	f->m2n.alarms_info = f->alarms;
+	f->refs = 1;
+
+	return 0;
+}
+
+void su_mibfile_unmap(mib2nut_info_t *m2n)
+{
+	su_mibfile_t	*f = (su_mibfile_t *)m2n;
+
+	if (f->refs == 0 || --f->refs > 0) {
+		return;
+	}
+
+	upsdebugx(2, "%s: unmapped %s (%s)", __func__, f->fn, f->m2n.mib_name);
+	su_mibfile_release(f);
+}
+
+void su_mibfile_free(mib2nut_info_t **list)
+{
+	su_mibfile_t	*f;
+	size_t	i;
+
+	if (list == NULL) {
+		return;
+	}
+
+	for (i = 0; list[i] != NULL; i++) {
+		f = (su_mibfile_t *)list[i];
+		su_mibfile_release(f);
+		free(f->fn);
+		free(f->names);
+		free(f);
+	}
+
+	free(list);
+}
@@ -0,0 +1,100 @@
+/*  snmp-ups-mibfile.h - compiled MIB-to-NUT mapping files of snmp-ups
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef SNMP_UPS_MIBFILE_H
+#define SNMP_UPS_MIBFILE_H
+
+#include "snmp-ups.h"
+#include "nut_stdint.h"
+
+/* The mib2nut_info_t tables of the *-mib.c files can be compiled, one
+ * mapping per file, by snmp-ups-mibc at build time into the "mibdir"
+ * of snmp-ups (SU_MIBFILE_DIR by default): the driver then reads the
+ * few strings of each header, and only maps the tables of the mappings
+ * it tries for a device, so that a process does not carry the tables of
+ * every device NUT knows of, the strings are shared with the other
+ * drivers through the page cache, and an updated mapping can ship as a
+ * file without rebuilding the driver.
+ *
+ * A file is a su_mibfile_hdr_t, the records of the tables and then the
+ * strings; strings are referenced by their offset in the file (0 for
+ * NULL), lookup tables by their first record + 1 (0 for none), and the
+ * lookup functions by their name (see su_mibfile_funcs[]).  The numbers
+ * are in the byte order of the build: a file of another one, or of
+ * another version of the format, is refused.
+ *
+ * Files are named "NN-name.nutmib", the order of their names being the
+ * one the mappings are tried in with "mibs=auto". */
+
+#define SU_MIBFILE_MAGIC	"NUTMIB1"
+#define SU_MIBFILE_BYTEORDER	0x01020304U
+#define SU_MIBFILE_SUFFIX	".nutmib"
+
+#ifndef SU_MIBFILE_DIR
+# define SU_MIBFILE_DIR	NUT_DATADIR "/snmp-ups"
+#endif
+
+typedef struct {
+	char		magic[8];
+	uint32_t	byteorder;
+	uint32_t	size;	/* of the file */
+	uint32_t	mib_name, mib_version, oid_pwr_status, oid_auto_check, sysOID;
+	uint32_t	names_off, names_len;	/* where the strings above are */
+	uint32_t	info_off, info_count;	/* su_mibfile_info_t, no sentinel */
+	uint32_t	lkp_off, lkp_count;	/* su_mibfile_lkp_t, with sentinels */
+	uint32_t	alarms_off, alarms_count;	/* su_mibfile_alarm_t, with sentinel */
+	uint32_t	strings_off, strings_len;
+} su_mibfile_hdr_t;
+
+typedef struct {
+	uint32_t	info_type;
+	int32_t		info_flags;
+	double		info_len;
+	uint32_t	OID, dfl;
+	uint32_t	flags;
+	uint32_t	oid2info;
+} su_mibfile_info_t;
+
+typedef struct {
+	int32_t		oid_value;
+	uint32_t	info_value;
+	uint32_t	fun_vp2s, nuf_s2l;	/* names of the functions */
+} su_mibfile_lkp_t;
+
+typedef struct {
+	uint32_t	OID, status_value, alarm_value;
+} su_mibfile_alarm_t;
+
+/* Write mapping m2n to file fn; returns 0, or -1 (with a message) */
+int su_mibfile_write(const mib2nut_info_t *m2n, const char *fn);
+
+/* The mappings compiled in directory dir, in the order of their file
+ * names, as a NULL terminated array, or NULL if there are none; their
+ * snmp_info and alarms_info are NULL until su_mibfile_map() */
+mib2nut_info_t **su_mibfile_load(const char *dir);
+
+/* Map (or hold on to, if already mapped) the tables of m2n, one of the
+ * mappings of su_mibfile_load(); returns 0, or -1 (with a message) */
+int su_mibfile_map(mib2nut_info_t *m2n);
+
+/* Let go of the tables of m2n, once nobody holds on to them */
+void su_mibfile_unmap(mib2nut_info_t *m2n);
+
+/* Free what su_mibfile_load() returned */
+void su_mibfile_free(mib2nut_info_t **list);
+
+#endif /* SNMP_UPS_MIBFILE_H */
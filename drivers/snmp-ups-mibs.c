@@ -0,0 +1,97 @@
+/*  snmp-ups-mibs.c - the MIB-to-NUT mappings built into snmp-ups
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* The list is shared by the driver and snmp-ups-mibc, which compiles
+ * these mappings into the files the driver prefers when it finds them
+ * (see snmp-ups-mibfile.h) */
+#include "common.h"	/* includes "config.h" which must be the first header */
+#include "snmp-ups.h"
+
+/* include all known mib2nut lookup tables */
+#include "apc-mib.h"
+#include "mge-mib.h"
+#include "netvision-mib.h"
+#include "eaton-pdu-genesis2-mib.h"
+#include "eaton-pdu-marlin-mib.h"
+#include "eaton-pdu-pulizzi-mib.h"
+#include "eaton-pdu-revelation-mib.h"
+#include "raritan-pdu-mib.h"
+#include "raritan-px2-mib.h"
+#include "baytech-mib.h"
+#include "compaq-mib.h"
+#include "bestpower-mib.h"
+#include "cyberpower-mib.h"
+#include "delta_ups-mib.h"
+#include "huawei-mib.h"
+#include "ietf-mib.h"
+#include "xppc-mib.h"
+#include "eaton-ats16-nmc-mib.h"
+#include "eaton-ats16-nm2-mib.h"
+#include "apc-ats-mib.h"
+#include "apc-pdu-mib.h"
+#include "apc-epdu-mib.h"
+#include "eaton-ats30-mib.h"
+#include "emerson-avocent-pdu-mib.h"
+#include "hpe-pdu-mib.h"
+#include "hpe-pdu3-cis-mib.h"
+#include "eaton-pdu-nlogic-mib.h"
+#include "eaton-ups-pwnm2-mib.h"
+#include "eaton-ups-pxg-mib.h"
+
+mib2nut_info_t *mib2nut_builtin[] = {
+	&apc_ats,			/* This struct comes from : apc-ats-mib.c */
+	&apc_pdu_rpdu,		/* This struct comes from : apc-pdu-mib.c */
+	&apc_pdu_rpdu2,		/* This struct comes from : apc-pdu-mib.c */
+	&apc_pdu_msp,		/* This struct comes from : apc-pdu-mib.c */
+	&apc_pdu_epdu,		/* This struct comes from : apc-epdu-mib.c */
+	&apc,				/* This struct comes from : apc-mib.c */
+	&baytech,			/* This struct comes from : baytech-mib.c */
+	&bestpower,			/* This struct comes from : bestpower-mib.c */
+	&compaq,			/* This struct comes from : compaq-mib.c */
+	&cyberpower,		/* This struct comes from : cyberpower-mib.c */
+	&cyberpower2,		/* This struct comes from : cyberpower-mib.c */
+	&delta_ups,			/* This struct comes from : delta_ups-mib.c */
+	&eaton_ats16_nmc,		/* This struct comes from : eaton-ats16-nmc-mib.c */
+	&eaton_ats16_nm2,	/* This struct comes from : eaton-ats16-nm2-mib.c */
+	&eaton_ats30,		/* This struct comes from : eaton-ats30-mib.c */
+	&eaton_marlin,		/* This struct comes from : eaton-mib.c */
+	&eaton_pdu_nlogic,	/* This struct comes from : eaton-pdu-nlogic-mib.c */
+	&eaton_pxg_ups,		/* This struct comes from : eaton-ups-pxg-mib.c */
+	&eaton_pw_nm2, 		/* This struct comes from : eaton-ups-pwnm2-mib.c */
+	&emerson_avocent_pdu,	/* This struct comes from : emerson-avocent-pdu-mib.c */
+	&aphel_revelation,	/* This struct comes from : eaton-mib.c */
+	&aphel_genesisII,	/* This struct comes from : eaton-mib.c */
+	&pulizzi_switched1,	/* This struct comes from : eaton-mib.c */
+	&pulizzi_switched2,	/* This struct comes from : eaton-mib.c */
+	&hpe_pdu,			/* This struct comes from : hpe-pdu-mib.c */
+	&hpe_pdu3_cis,		/* This struct comes from : hpe-pdu3-cis-mib.c */
+	&huawei,			/* This struct comes from : huawei-mib.c */
+	&mge,				/* This struct comes from : mge-mib.c */
+	&netvision,			/* This struct comes from : netvision-mib.c */
+	&raritan,			/* This struct comes from : raritan-pdu-mib.c */
+	&raritan_px2,		/* This struct comes from : raritan-px2-mib.c */
+	&xppc,				/* This struct comes from : xppc-mib.c */
+	/*
+	 * Prepend vendor specific MIB mappings before IETF, so that
+	 * if a device supports both IETF and vendor specific MIB,
+	 * the vendor specific one takes precedence (when mibs=auto)
+	 */
+	&tripplite_ietf,	/* This struct comes from : ietf-mib.c */
+	&ietf,				/* This struct comes from : ietf-mib.c */
+	/* end of structure. */
+	NULL
+};
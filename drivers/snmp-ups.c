@@ -36,40 +36,20 @@
 #include "nut_float.h"
 #include "nut_stdint.h"
 #include "snmp-ups.h"
+#include "snmp-ups-mibfile.h"
 #include "parseconf.h"
+#include "apc-iem-mib.h"	/* quirks of APC devices with an IEM */
 
-#include <ctype.h> /* for isprint() */
+#include <net-snmp/library/scapi.h>	/* sc_hash() */
 
-/* include all known mib2nut lookup tables */
-#include "apc-mib.h"
-#include "mge-mib.h"
-#include "netvision-mib.h"
-#include "eaton-pdu-genesis2-mib.h"
-#include "eaton-pdu-marlin-mib.h"
-#include "eaton-pdu-pulizzi-mib.h"
-#include "eaton-pdu-revelation-mib.h"
-#include "raritan-pdu-mib.h"
-#include "raritan-px2-mib.h"
-#include "baytech-mib.h"
-#include "compaq-mib.h"
-#include "bestpower-mib.h"
-#include "cyberpower-mib.h"
-#include "delta_ups-mib.h"
-#include "huawei-mib.h"
-#include "ietf-mib.h"
-#include "xppc-mib.h"
-#include "eaton-ats16-nmc-mib.h"
-#include "eaton-ats16-nm2-mib.h"
-#include "apc-ats-mib.h"
-#include "apc-pdu-mib.h"
-#include "apc-epdu-mib.h"
-#include "eaton-ats30-mib.h"
-#include "emerson-avocent-pdu-mib.h"
-#include "hpe-pdu-mib.h"
-#include "hpe-pdu3-cis-mib.h"
-#include "eaton-pdu-nlogic-mib.h"
-#include "eaton-ups-pwnm2-mib.h"
-#include "eaton-ups-pxg-mib.h"
+#include <ctype.h> /* for isprint() */
+#ifndef WIN32
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netdb.h>
+# include <fcntl.h>
+# include <poll.h>
+#endif
 
 /* Address API change */
 #if ( ! NUT_HAVE_LIBNETSNMP_usmAESPrivProtocol ) && ( ! defined usmAESPrivProtocol )
@@ -93,49 +73,14 @@
 # endif
 #endif
 
-static mib2nut_info_t *mib2nut[] = {
-	&apc_ats,			/* This struct comes from : apc-ats-mib.c */
-	&apc_pdu_rpdu,		/* This struct comes from : apc-pdu-mib.c */
-	&apc_pdu_rpdu2,		/* This struct comes from : apc-pdu-mib.c */
-	&apc_pdu_msp,		/* This struct comes from : apc-pdu-mib.c */
-	&apc_pdu_epdu,		/* This struct comes from : apc-epdu-mib.c */
-	&apc,				/* This struct comes from : apc-mib.c */
-	&baytech,			/* This struct comes from : baytech-mib.c */
-	&bestpower,			/* This struct comes from : bestpower-mib.c */
-	&compaq,			/* This struct comes from : compaq-mib.c */
-	&cyberpower,		/* This struct comes from : cyberpower-mib.c */
-	&cyberpower2,		/* This struct comes from : cyberpower-mib.c */
-	&delta_ups,			/* This struct comes from : delta_ups-mib.c */
-	&eaton_ats16_nmc,		/* This struct comes from : eaton-ats16-nmc-mib.c */
-	&eaton_ats16_nm2,	/* This struct comes from : eaton-ats16-nm2-mib.c */
-	&eaton_ats30,		/* This struct comes from : eaton-ats30-mib.c */
-	&eaton_marlin,		/* This struct comes from : eaton-mib.c */
-	&eaton_pdu_nlogic,	/* This struct comes from : eaton-pdu-nlogic-mib.c */
-	&eaton_pxg_ups,		/* This struct comes from : eaton-ups-pxg-mib.c */
-	&eaton_pw_nm2, 		/* This struct comes from : eaton-ups-pwnm2-mib.c */
-	&emerson_avocent_pdu,	/* This struct comes from : emerson-avocent-pdu-mib.c */
-	&aphel_revelation,	/* This struct comes from : eaton-mib.c */
-	&aphel_genesisII,	/* This struct comes from : eaton-mib.c */
-	&pulizzi_switched1,	/* This struct comes from : eaton-mib.c */
-	&pulizzi_switched2,	/* This struct comes from : eaton-mib.c */
-	&hpe_pdu,			/* This struct comes from : hpe-pdu-mib.c */
-	&hpe_pdu3_cis,		/* This struct comes from : hpe-pdu3-cis-mib.c */
-	&huawei,			/* This struct comes from : huawei-mib.c */
-	&mge,				/* This struct comes from : mge-mib.c */
-	&netvision,			/* This struct comes from : netvision-mib.c */
-	&raritan,			/* This struct comes from : raritan-pdu-mib.c */
-	&raritan_px2,		/* This struct comes from : raritan-px2-mib.c */
-	&xppc,				/* This struct comes from : xppc-mib.c */
-	/*
-	 * Prepend vendor specific MIB mappings before IETF, so that
-	 * if a device supports both IETF and vendor specific MIB,
-	 * the vendor specific one takes precedence (when mibs=auto)
-	 */
-	&tripplite_ietf,	/* This struct comes from : ietf-mib.c */
-	&ietf,				/* This struct comes from : ietf-mib.c */
-	/* end of structure. */
-	NULL
-};
+/* The MIB-to-NUT mappings tried for a device: the ones compiled into the
+ * files of "mibdir" (see snmp-ups-mibfile.h) if there are any, or else
+ * the built-in ones; shared by all the devices a process hosts, with a
+ * count of those which settled on a compiled mapping */
+static mib2nut_info_t **mib2nut = mib2nut_builtin;
+static mib2nut_info_t **mibfiles = NULL;
+static bool_t mibfiles_loaded = FALSE;
+static size_t mibfiles_used = 0;
 
 struct snmp_session g_snmp_sess, *g_snmp_sess_p;
 const char *OID_pwr_status;
@@ -143,6 +88,60 @@ int g_pwr_battery;
 int pollfreq; /* polling frequency */
 int semistaticfreq; /* semistatic entry update frequency */
 static int semistatic_countdown = 0;
+static int adaptivefreq = DEFAULT_ADAPTIVEFREQ; /* most update cycles between polls of a steady entry */
+static int getbatch = DEFAULT_GETBATCH; /* OIDs per GET request in updates */
+static int maxrepetitions = DEFAULT_MAXREPETITIONS; /* rows per GETBULK request */
+static int window = DEFAULT_WINDOW; /* GET requests out at a time in updates */
+
+/* The OIDs which the walk of the device in hand will ask for, got
+ * ahead with a few multi-varbind GETs (see su_prefetch()) and handed
+ * out by nut_snmp_get() */
+typedef struct {
+	char	*OID;
+	const oid	*name;	/* see su_parse_oid() */
+	size_t	name_len;
+	struct snmp_pdu	*pdu;	/* response with just this varbind, or NULL */
+} su_prefetch_t;
+
+static su_prefetch_t *prefetch = NULL;
+static size_t prefetch_count = 0;
+static size_t prefetch_alloc = 0;
+static size_t prefetch_next = 0;	/* where nut_snmp_get() looks first */
+
+/* Ranges of prefetch[] which still have to be asked for, and how many
+ * requests are out (see su_prefetch_run()) */
+typedef struct {
+	size_t	first;
+	size_t	count;
+} su_prefetch_range_t;
+
+/* What su_prefetch_cb() gets back for a request it answers */
+typedef struct {
+	su_prefetch_range_t	range;
+	struct timeval	sent;
+} su_prefetch_sent_t;
+
+static su_prefetch_range_t *prefetch_todo = NULL;
+static size_t prefetch_todo_count = 0;
+static size_t prefetch_todo_alloc = 0;
+static int prefetch_inflight = 0;
+static bool_t prefetch_stop = FALSE;
+
+/* The OIDs parsed so far, so that each text is only parsed once (see
+ * su_parse_oid()), with an open addressing hash of them: index + 1 of
+ * each, 0 if empty. What an OID text parses into does not depend on the
+ * device, so this is shared by all the devices a process hosts. */
+typedef struct {
+	char	*OID;
+	oid	*name;
+	size_t	name_len;
+} su_oid_t;
+
+static su_oid_t *oid_cache = NULL;
+static size_t oid_cache_count = 0;
+static size_t oid_cache_alloc = 0;
+static size_t *oid_cache_hash = NULL;
+static size_t oid_cache_hash_size = 0;
 
 static int quirk_symmetra_threephase = 0;
 
@@ -168,13 +167,13 @@ static daisychain_info_t **daisychain_info = NULL;
 /* pointer to the Snmp2Nut lookup table */
 mib2nut_info_t *mib2nut_info;
 /* FIXME: to be trashed */
-snmp_info_t *snmp_info;
+const snmp_info_t *snmp_info;
 alarms_info_t *alarms_info;
 static const char *mibname;
 static const char *mibvers;
 
 #define DRIVER_NAME	"Generic SNMP UPS driver"
-#define DRIVER_VERSION	"1.32"
+#define DRIVER_VERSION	"1.34"
 
 /* driver description structure */
 upsdrv_info_t	upsdrv_info = {
@@ -210,12 +209,172 @@ static int outletgroup_template_index_base = -1;
 static int ambient_template_index_base = -1;
 static int device_template_offset = -1;
 
+/* the flags of the snmp_info entries, as learnt from this device: the
+ * MIB tables are read-only, so they can be shared (see su_flags()) */
+static snmp_info_flags_t *snmp_info_flags = NULL;
+static size_t snmp_info_count = 0;
+
+/* How often each snmp_info entry is polled in updates, by how often its
+ * value was seen to change (see su_poll_start()), up to "adaptivefreq"
+ * update cycles apart; su_poll_entry is the entry being walked, for
+ * su_setinfo() to tell when its value changes */
+typedef struct {
+	int	interval;	/* in update cycles */
+	int	countdown;	/* update cycles to the next poll */
+	int	steady;	/* polls since the interval changed, without a change */
+	bool_t	due;	/* in this update */
+	bool_t	changed;	/* in this update, on any unit or instance */
+} su_poll_t;
+
+/* polls without a change before the interval doubles */
+#define SU_POLL_STEADY	3
+
+static su_poll_t *snmp_info_poll = NULL;
+static const snmp_info_t *su_poll_entry = NULL;
+
+/* SNMP request statistics, kept with the "perfstats" flag and published
+ * as driver.perf.snmp.* after each update (see su_stats_update()): the
+ * round trips, and for each OID (by its index in oid_cache[]) the
+ * requests it was in and how long they took */
+#define SU_STATS_BUCKETS	4	/* under 10, 100, 1000 msec, and longer */
+#define SU_STATS_TOP	5	/* slowest OIDs in the debug output */
+
+typedef struct {
+	uintmax_t	requests;
+	uintmax_t	timeouts;
+	uintmax_t	errors;
+	uintmax_t	usec;	/* in all */
+	long	usec_max;
+} su_stats_t;
+
+static const long stats_bucket_usec[SU_STATS_BUCKETS - 1] = { 10000, 100000, 1000000 };
+static bool_t stats_enabled = FALSE;
+static su_stats_t stats_total;
+static uintmax_t stats_histogram[SU_STATS_BUCKETS];
+static uintmax_t stats_update_requests = 0;	/* round trips of this update */
+static su_stats_t *oid_stats = NULL;
+static size_t oid_stats_alloc = 0;
+
+/* Template instances, made once and kept for the next updates (see
+ * su_instance_find()), with an open addressing hash of them by their
+ * template, daisy chain unit and instance number: index + 1 of each, 0
+ * if empty. The init walk works the topology out, so they are only kept
+ * by update walks, and dropped by the next init walk. */
+typedef struct {
+	const snmp_info_t	*tmpl;
+	int	device;
+	int	number;	/* -1 for the daisy chain unit instances of su_ups_get() */
+	snmp_info_t	info;
+} su_instance_t;
+
+static su_instance_t **instances = NULL;
+static size_t instances_count = 0;
+static size_t instances_alloc = 0;
+static size_t *instances_hash = NULL;
+static size_t instances_hash_size = 0;
+static bool_t instances_kept = FALSE;
+
+/* Only walk the entries which tell of events (see su_poll_event()), for
+ * a trap, in between the updates every "pollfreq" */
+static bool_t su_poll_events_only = FALSE;
+
+#ifndef WIN32
+/* The socket traps from the agent come in on (see su_trap_open()), and
+ * whether one came in since the last update */
+static int trap_fd = -1;
+static bool_t trap_pending = FALSE;
+static struct sockaddr_storage *trap_agent = NULL;	/* addresses of the agent */
+static size_t trap_agent_count = 0;
+#endif
+
+/* open addressing hash of the snmp_info entries by (case-insensitive)
+ * name, for su_find_info(): index + 1 of the first entry of each name,
+ * 0 if empty; only good while snmp_info is snmp_info_hashed */
+static size_t *snmp_info_hash = NULL;
+static size_t snmp_info_hash_size = 0;
+static const snmp_info_t *snmp_info_hashed = NULL;
+
+/* what every device hosted by this process has for its own (see
+ * addhostvars()); the MIB tables it points into are shared */
+static const dstate_hostvar_t snmp_hostvars[] = {
+	DSTATE_HOSTVAR(g_snmp_sess),
+	DSTATE_HOSTVAR(g_snmp_sess_p),
+	DSTATE_HOSTVAR(OID_pwr_status),
+	DSTATE_HOSTVAR(g_pwr_battery),
+	DSTATE_HOSTVAR(pollfreq),
+	DSTATE_HOSTVAR(semistaticfreq),
+	DSTATE_HOSTVAR(semistatic_countdown),
+	DSTATE_HOSTVAR(adaptivefreq),
+	DSTATE_HOSTVAR(getbatch),
+	DSTATE_HOSTVAR(maxrepetitions),
+	DSTATE_HOSTVAR(window),
+	DSTATE_HOSTVAR(quirk_symmetra_threephase),
+	DSTATE_HOSTVAR(devices_count),
+	DSTATE_HOSTVAR(current_device_number),
+	DSTATE_HOSTVAR(daisychain_enabled),
+	DSTATE_HOSTVAR(daisychain_info),
+	DSTATE_HOSTVAR(mib2nut_info),
+	DSTATE_HOSTVAR(snmp_info),
+	DSTATE_HOSTVAR(alarms_info),
+	DSTATE_HOSTVAR(mibname),
+	DSTATE_HOSTVAR(mibvers),
+	DSTATE_HOSTVAR(lastpoll),
+	DSTATE_HOSTVAR(comm_status),
+	DSTATE_HOSTVAR(template_index_base),
+	DSTATE_HOSTVAR(device_template_index_base),
+	DSTATE_HOSTVAR(outlet_template_index_base),
+	DSTATE_HOSTVAR(outletgroup_template_index_base),
+	DSTATE_HOSTVAR(ambient_template_index_base),
+	DSTATE_HOSTVAR(device_template_offset),
+	DSTATE_HOSTVAR(snmp_info_flags),
+	DSTATE_HOSTVAR(snmp_info_count),
+	DSTATE_HOSTVAR(snmp_info_poll),
+	DSTATE_HOSTVAR(stats_enabled),
+	DSTATE_HOSTVAR(stats_total),
+	DSTATE_HOSTVAR(stats_histogram),
+	DSTATE_HOSTVAR(stats_update_requests),
+	DSTATE_HOSTVAR(oid_stats),
+	DSTATE_HOSTVAR(oid_stats_alloc),
+	DSTATE_HOSTVAR(instances),
+	DSTATE_HOSTVAR(instances_count),
+	DSTATE_HOSTVAR(instances_alloc),
+	DSTATE_HOSTVAR(instances_hash),
+	DSTATE_HOSTVAR(instances_hash_size),
+#ifndef WIN32
+	DSTATE_HOSTVAR(trap_fd),
+	DSTATE_HOSTVAR(trap_pending),
+	DSTATE_HOSTVAR(trap_agent),
+	DSTATE_HOSTVAR(trap_agent_count),
+#endif
+	DSTATE_HOSTVAR(snmp_info_hash),
+	DSTATE_HOSTVAR(snmp_info_hash_size),
+	DSTATE_HOSTVAR(snmp_info_hashed),
+	DSTATE_HOSTVAR(temperature_unit),
+	DSTATE_HOSTVAR_END
+};
+
 /* sysOID location */
 #define SYSOID_OID	".1.3.6.1.2.1.1.2.0"
 
 /* Forward functions declarations */
 static void disable_transfer_oids(void);
-bool_t get_and_process_data(int mode, snmp_info_t *su_info_p);
+static void su_prefetch(int mode);
+static void su_prefetch_free(void);
+static void su_stats_update(void);
+static void su_oid_cache_free(void);
+static void su_sysoid_index_free(void);
+static const oid *su_parse_oid(const char *OID, size_t *name_len);
+static su_oid_t *su_oid_find(const char *OID);
+static bool_t su_poll_due(const snmp_info_t *su_info_p);
+static void su_poll_reset(void);
+static void su_poll_changed(void);
+static void su_instances_free(void);
+static snmp_info_t *su_instance_find(const snmp_info_t *tmpl, int number);
+#ifndef WIN32
+static void su_trap_open(void);
+static void su_trap_close(void);
+#endif
+bool_t get_and_process_data(int mode, const snmp_info_t *su_info_p);
 int extract_template_number(snmp_info_flags_t template_type, const char* varname);
 snmp_info_flags_t get_template_type(const char* varname);
 
@@ -224,7 +383,7 @@ snmp_info_flags_t get_template_type(const char* varname);
  * --------------------------------------------- */
 void upsdrv_initinfo(void)
 {
-	snmp_info_t *su_info_p;
+	const snmp_info_t *su_info_p;
 
 	upsdebugx(1, "SNMP UPS driver: entering %s()", __func__);
 
@@ -242,7 +401,7 @@ void upsdrv_initinfo(void)
 	 * outlet (and groups) commands are processed later, during initial walk */
 	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++)
 	{
-		if (su_info_p->flags == 0UL) {
+		if (SU_FLAGS(su_info_p) == 0UL) {
 			upsdebugx(4,
 				"SNMP UPS driver: %s: MIB2NUT mapping '%s' (OID '%s') did not define flags bits. "
 				"Entry would be treated as SU_FLAG_OK if available in returned data.",
@@ -253,10 +412,10 @@ void upsdrv_initinfo(void)
 			/* Treat as OK if avail, otherwise discarded */
 		}
 
-		su_info_p->flags |= SU_FLAG_OK;
+		SU_FLAGS(su_info_p) |= SU_FLAG_OK;
 		if ((SU_TYPE(su_info_p) == SU_TYPE_CMD)
-			&& !(su_info_p->flags & SU_OUTLET)
-			&& !(su_info_p->flags & SU_OUTLET_GROUP))
+			&& !(SU_FLAGS(su_info_p) & SU_OUTLET)
+			&& !(SU_FLAGS(su_info_p) & SU_OUTLET_GROUP))
 		{
 			/* first check that this OID actually exists */
 
@@ -299,9 +458,17 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1,"SNMP UPS driver: entering %s()", __func__);
 
-	/* only update every pollfreq */
+	/* only update every pollfreq, and the status when a trap came in */
 	/* FIXME: only update status (SU_STATUS_*), à la usbhid-ups, in between */
-	if (time(NULL) > (lastpoll + pollfreq)) {
+#ifndef WIN32
+	su_poll_events_only = (trap_pending && time(NULL) <= (lastpoll + pollfreq));
+	trap_pending = FALSE;
+#endif
+	if (su_poll_events_only || time(NULL) > (lastpoll + pollfreq)) {
+		char	*status = NULL;
+
+		if (adaptivefreq > 1 && dstate_getinfo("ups.status") != NULL)
+			status = xstrdup(dstate_getinfo("ups.status"));
 
 		alarm_init();
 		status_init();
@@ -328,7 +495,24 @@ void upsdrv_updateinfo(void)
 			alarm_commit();
 
 		/* store timestamp */
-		lastpoll = time(NULL);
+		if (!su_poll_events_only)
+			lastpoll = time(NULL);
+		su_poll_events_only = FALSE;
+
+		/* a status change may come with changes in values polled
+		 * less often: get them all in the next round already */
+		if (status != NULL) {
+			if (dstate_getinfo("ups.status") == NULL
+			 || strcmp(status, dstate_getinfo("ups.status"))
+			) {
+				upsdebugx(1, "%s: status changed, polling all again", __func__);
+				su_poll_reset();
+				lastpoll = 0;
+			}
+			free(status);
+		}
+
+		su_stats_update();
 	}
 	else {
 		/* Just tell the same status to upsd */
@@ -394,6 +578,8 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, SU_VAR_MIBS,
 		"NOTE: You can run the driver binary with '-x mibs=--list' for an up to date listing)\n"
 		"Set MIB compliance (default=ietf, allowed: mge,apcc,netvision,pw,cpqpower,...)");
+	addvar(VAR_VALUE, SU_VAR_MIBDIR,
+		"Set the directory of the compiled MIB-to-NUT mappings, which replace the built-in ones if there are any (default=" SU_MIBFILE_DIR ")");
 	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_COMMUNITY,
 		"Set community name (default=public)");
 	addvar(VAR_VALUE, SU_VAR_VERSION,
@@ -402,6 +588,18 @@ void upsdrv_makevartable(void)
 		"Set polling frequency in seconds, to reduce network flow (default=30)");
 	addvar(VAR_VALUE, SU_VAR_SEMISTATICFREQ,
 		"Set semistatic value update frequency in update cycles, to reduce network flow (default=10)");
+	addvar(VAR_VALUE, SU_VAR_ADAPTIVEFREQ,
+		"Poll values seen not to change less often, down to once in this many update cycles (default=1, poll all in each cycle)");
+	addvar(VAR_VALUE, SU_VAR_GETBATCH,
+		"Set how many OIDs to get per request in updates, 1 to get them one by one (default=20)");
+	addvar(VAR_VALUE, SU_VAR_MAXREPETITIONS,
+		"Set how many rows to get per GETBULK request in table walks with SNMPv2c/v3, 0 not to use GETBULK (default=20)");
+	addvar(VAR_VALUE, SU_VAR_WINDOW,
+		"Set how many GET requests may be out at a time in updates (default=4)");
+#ifndef WIN32
+	addvar(VAR_VALUE, SU_VAR_TRAPPORT,
+		"Set the UDP port to receive traps from the device on, to update its status at once (default: none)");
+#endif
 	addvar(VAR_VALUE, SU_VAR_RETRIES,
 		"Specifies the number of Net-SNMP retries to be used in the requests (default=5)");
 	addvar(VAR_VALUE, SU_VAR_TIMEOUT,
@@ -418,6 +616,10 @@ void upsdrv_makevartable(void)
 		"Set the authentication pass phrase used for authenticated SNMPv3 messages (no default)");
 	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_PRIVPASSWD,
 		"Set the privacy pass phrase used for encrypted SNMPv3 messages (no default)");
+#ifndef WIN32
+	addvar(VAR_FLAG, SU_VAR_KEYCACHE,
+		"Keep the SNMPv3 keys made from the pass phrases in the state path, for quicker starts");
+#endif
 
 	/* Construct addvar() for SU_VAR_AUTHPROT: */
 	{ int comma = 0;
@@ -584,11 +786,14 @@ void upsdrv_makevartable(void)
 		"Set start delay time after shutdown");
 	addvar(VAR_VALUE, SU_VAR_OFFDELAY,
 		"Set delay time before shutdown ");
+
+	addhostvars(snmp_hostvars);
 }
 
 void upsdrv_initups(void)
 {
-	snmp_info_t *su_info_p, *cur_info_p;
+	const snmp_info_t *su_info_p;
+	snmp_info_t *cur_info_p;
 	char model[SU_INFOSIZE];
 	bool_t status= FALSE;
 	const char *mibs;
@@ -598,6 +803,15 @@ void upsdrv_initups(void)
 
 	/* Retrieve user's parameters */
 	mibs = testvar(SU_VAR_MIBS) ? getval(SU_VAR_MIBS) : "auto";
+
+	/* The compiled mappings, if any, replace the built-in ones; this is
+	 * done once for all the devices a process hosts */
+	if (!mibfiles_loaded) {
+		mibfiles = su_mibfile_load(testvar(SU_VAR_MIBDIR) ? getval(SU_VAR_MIBDIR) : SU_MIBFILE_DIR);
+		mib2nut = (mibfiles != NULL ? mibfiles : mib2nut_builtin);
+		mibfiles_loaded = TRUE;
+	}
+
 	if (!strcmp(mibs, "--list")) {
 		int i;
 
@@ -614,7 +828,8 @@ void upsdrv_initups(void)
 				mib2nut[i]->sysOID  		? mib2nut[i]->sysOID : "<NULL>" ,
 				mib2nut[i]->oid_auto_check	? mib2nut[i]->oid_auto_check : "<NULL>" );
 		}
-		printf("\nOverall this driver has loaded %d MIB-to-NUT mapping tables\n", i);
+		printf("\nOverall this driver has loaded %d MIB-to-NUT mapping tables%s\n", i,
+			mibfiles != NULL ? " (compiled ones, from the 'mibdir')" : "");
 		exit(EXIT_SUCCESS);
 		/* fatalx(EXIT_FAILURE, "Marking the exit code as failure since the driver is not started now"); */
 	}
@@ -651,6 +866,46 @@ void upsdrv_initups(void)
 	}
 	semistatic_countdown = semistaticfreq;
 
+	/* init the longest adaptive polling interval */
+	if (getval(SU_VAR_ADAPTIVEFREQ))
+		adaptivefreq = atoi(getval(SU_VAR_ADAPTIVEFREQ));
+	else
+		adaptivefreq = DEFAULT_ADAPTIVEFREQ;
+	if (adaptivefreq < 1) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_ADAPTIVEFREQ);
+		adaptivefreq = DEFAULT_ADAPTIVEFREQ;
+	}
+
+	/* init the number of OIDs per GET request in updates */
+	if (getval(SU_VAR_GETBATCH))
+		getbatch = atoi(getval(SU_VAR_GETBATCH));
+	else
+		getbatch = DEFAULT_GETBATCH;
+	if (getbatch < 1) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_GETBATCH);
+		getbatch = DEFAULT_GETBATCH;
+	}
+
+	/* init the number of rows per GETBULK request in walks */
+	if (getval(SU_VAR_MAXREPETITIONS))
+		maxrepetitions = atoi(getval(SU_VAR_MAXREPETITIONS));
+	else
+		maxrepetitions = DEFAULT_MAXREPETITIONS;
+	if (maxrepetitions < 0) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_MAXREPETITIONS);
+		maxrepetitions = DEFAULT_MAXREPETITIONS;
+	}
+
+	/* init the number of GET requests out at a time in updates */
+	if (getval(SU_VAR_WINDOW))
+		window = atoi(getval(SU_VAR_WINDOW));
+	else
+		window = DEFAULT_WINDOW;
+	if (window < 1) {
+		upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_WINDOW);
+		window = DEFAULT_WINDOW;
+	}
+
 	/* Get UPS Model node to see if there's a MIB */
 /* FIXME: extend and use match_model_OID(char *model) */
 	su_info_p = su_find_info("ups.model");
@@ -685,8 +940,9 @@ void upsdrv_initups(void)
 		}
 		else {
 			upsdebugx(2, "Found entry, not a template %s", su_info_p->OID);
-			/* Otherwise, just point at what we found */
-			cur_info_p = su_info_p;
+			/* Otherwise, just point at what we found
+			 * (only read below, the MIB tables are const) */
+			cur_info_p = (snmp_info_t *)su_info_p;
 		}
 
 		/* Actually get the data */
@@ -787,6 +1043,13 @@ void upsdrv_initups(void)
 
 	/* set shutdown and autostart delay */
 	set_delays();
+
+	stats_enabled = (dstate_getinfo("driver.flag.perfstats") != NULL);
+
+#ifndef WIN32
+	/* get the status at once when the device sends a trap */
+	su_trap_open();
+#endif
 }
 
 void upsdrv_cleanup(void)
@@ -795,6 +1058,51 @@ void upsdrv_cleanup(void)
 	if (daisychain_info)
 		free(daisychain_info);
 
+	free(snmp_info_flags);
+	snmp_info_flags = NULL;
+	snmp_info_count = 0;
+	free(snmp_info_poll);
+	snmp_info_poll = NULL;
+	free(snmp_info_hash);
+	snmp_info_hash = NULL;
+	snmp_info_hash_size = 0;
+	snmp_info_hashed = NULL;
+
+	su_sysoid_index_free();
+	su_prefetch_free();
+
+	/* let go of the compiled mapping of this device, and of all of
+	 * them with the last device */
+	if (mibfiles != NULL) {
+		if (mib2nut_info != NULL) {
+			su_mibfile_unmap(mib2nut_info);
+			mibfiles_used--;
+		}
+		if (mibfiles_used == 0) {
+			su_mibfile_free(mibfiles);
+			mibfiles = NULL;
+			mib2nut = mib2nut_builtin;
+			mibfiles_loaded = FALSE;
+		}
+	}
+	mib2nut_info = NULL;
+	free(prefetch);
+	prefetch = NULL;
+	prefetch_alloc = 0;
+	free(prefetch_todo);
+	prefetch_todo = NULL;
+	prefetch_todo_alloc = 0;
+
+	su_oid_cache_free();
+	free(oid_stats);
+	oid_stats = NULL;
+	oid_stats_alloc = 0;
+	su_instances_free();
+
+#ifndef WIN32
+	su_trap_close();
+#endif
+
 	/* Net-SNMP specific cleanup */
 	nut_snmp_cleanup();
 }
@@ -803,6 +1111,223 @@ void upsdrv_cleanup(void)
  * SNMP functions.
  * ----------------------------------------------------------- */
 
+/* SNMPv3 keys (Ku) made from pass phrases: generate_Ku() hashes a
+ * megabyte of the pass phrase by design, so each one (identified by its
+ * digest, with the authentication protocol) is only turned into a key
+ * once per process, e.g. for all devices of a hostgroup.  With the
+ * SU_VAR_KEYCACHE flag, the keys are also kept in SU_KEYCACHE_FILE in
+ * the state path, for the next start and the other drivers run by the
+ * same user; it is as secret as ups.conf, so it is only used if nobody
+ * else may read it.  The engine ID of each agent is not part of it:
+ * Net-SNMP localizes the key for it in snmp_open(), which is cheap. */
+#define SU_KEYCACHE_FILE	"snmp-ups.keys"
+#define SU_KU_DIGEST_LEN	64	/* up to SHA-512 */
+
+typedef struct su_ku_s {
+	char	*proto;		/* authProtocol name */
+	u_char	digest[SU_KU_DIGEST_LEN];
+	size_t	digestlen;
+	u_char	ku[USM_AUTH_KU_LEN];
+	size_t	kulen;
+	struct su_ku_s	*next;
+} su_ku_t;
+
+static su_ku_t	*su_ku_list = NULL;
+
+static su_ku_t *su_ku_find(const char *proto, const u_char *digest, size_t digestlen)
+{
+	su_ku_t	*ku;
+
+	for (ku = su_ku_list; ku; ku = ku->next) {
+		if (ku->digestlen == digestlen && !strcmp(ku->proto, proto)
+		 && !memcmp(ku->digest, digest, digestlen)
+		) {
+			return ku;
+		}
+	}
+
+	return NULL;
+}
+
+static void su_ku_add(const char *proto, const u_char *digest, size_t digestlen,
+	const u_char *key, size_t keylen)
+{
+	su_ku_t	*ku;
+
+	if (digestlen > sizeof(ku->digest) || keylen > sizeof(ku->ku)
+	 || su_ku_find(proto, digest, digestlen)
+	) {
+		return;
+	}
+
+	ku = xcalloc(1, sizeof(*ku));
+	ku->proto = xstrdup(proto);
+	memcpy(ku->digest, digest, digestlen);
+	ku->digestlen = digestlen;
+	memcpy(ku->ku, key, keylen);
+	ku->kulen = keylen;
+	ku->next = su_ku_list;
+	su_ku_list = ku;
+}
+
+#ifndef WIN32
+static void su_hex_write(FILE *f, const u_char *buf, size_t len)
+{
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		fprintf(f, "%02x", buf[i]);
+	}
+}
+
+/* returns the number of bytes, 0 if it is not hex or too long */
+static size_t su_hex_read(const char *hex, u_char *buf, size_t buflen)
+{
+	size_t	len = 0;
+	unsigned int	c;
+
+	for (; hex[0] && hex[1]; hex += 2) {
+		if (len >= buflen || !isxdigit((unsigned char)hex[0])
+		 || !isxdigit((unsigned char)hex[1])
+		 || sscanf(hex, "%2x", &c) != 1
+		) {
+			return 0;
+		}
+		buf[len++] = (u_char)c;
+	}
+
+	return (*hex ? 0 : len);
+}
+
+static void su_keycache_load(void)
+{
+	char	fn[SMALLBUF], line[LARGEBUF], proto[SMALLBUF], digesthex[LARGEBUF], kuhex[LARGEBUF];
+	u_char	digest[SU_KU_DIGEST_LEN], key[USM_AUTH_KU_LEN];
+	size_t	digestlen, keylen;
+	struct stat	st;
+	FILE	*f;
+
+	snprintf(fn, sizeof(fn), "%s/%s", dflt_statepath(), SU_KEYCACHE_FILE);
+
+	f = fopen(fn, "r");
+	if (!f) {
+		return;
+	}
+
+	if (fstat(fileno(f), &st) != 0 || st.st_uid != geteuid()
+	 || (st.st_mode & (S_IRWXG | S_IRWXO))
+	) {
+		upslogx(LOG_WARNING, "Not using %s: it must belong to the driver "
+			"user and be accessible to nobody else", fn);
+		fclose(f);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%255s %1023s %1023s", proto, digesthex, kuhex) != 3) {
+			continue;
+		}
+
+		digestlen = su_hex_read(digesthex, digest, sizeof(digest));
+		keylen = su_hex_read(kuhex, key, sizeof(key));
+		if (digestlen && keylen) {
+			su_ku_add(proto, digest, digestlen, key, keylen);
+		}
+	}
+
+	fclose(f);
+}
+
+static void su_keycache_save(void)
+{
+	char	fn[SMALLBUF], tmp[SMALLBUF + 32];
+	su_ku_t	*ku;
+	FILE	*f;
+	int	fd;
+
+	snprintf(fn, sizeof(fn), "%s/%s", dflt_statepath(), SU_KEYCACHE_FILE);
+	snprintf(tmp, sizeof(tmp), "%s.%" PRIdMAX, fn, (intmax_t)getpid());
+
+	/* what other drivers saved meanwhile is kept too */
+	su_keycache_load();
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		upsdebug_with_errno(1, "%s: can't write %s", __func__, tmp);
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		return;
+	}
+
+	for (ku = su_ku_list; ku; ku = ku->next) {
+		fprintf(f, "%s ", ku->proto);
+		su_hex_write(f, ku->digest, ku->digestlen);
+		fprintf(f, " ");
+		su_hex_write(f, ku->ku, ku->kulen);
+		fprintf(f, "\n");
+	}
+
+	if (ferror(f) | fclose(f) || rename(tmp, fn) != 0) {
+		upsdebug_with_errno(1, "%s: can't write %s", __func__, fn);
+		unlink(tmp);
+	}
+}
+#endif	/* !WIN32 */
+
+/* generate_Ku() for the pass phrase, or what it gave for it before */
+static int su_generate_Ku(const char *protoname, const oid *proto, u_int protolen,
+	const char *pass, u_char *key, size_t *keylen)
+{
+	u_char	digest[SU_KU_DIGEST_LEN];
+	size_t	digestlen = sizeof(digest);
+	su_ku_t	*ku;
+	int	ret;
+#ifndef WIN32
+	static int	loaded = 0;
+	int	keycache = testvar(SU_VAR_KEYCACHE);
+#endif
+
+	if (sc_hash(proto, protolen, (u_char *)pass, strlen(pass),
+		digest, &digestlen) != SNMPERR_SUCCESS
+	) {
+		/* not kept then, but no worse than before */
+		return generate_Ku(proto, protolen, (const unsigned char *)pass,
+			strlen(pass), key, keylen);
+	}
+
+#ifndef WIN32
+	if (keycache && !loaded) {
+		su_keycache_load();
+		loaded = 1;
+	}
+#endif
+
+	ku = su_ku_find(protoname, digest, digestlen);
+	if (ku && ku->kulen <= *keylen) {
+		upsdebugx(2, "%s: reusing the %s key of this pass phrase",
+			__func__, protoname);
+		memcpy(key, ku->ku, ku->kulen);
+		*keylen = ku->kulen;
+		return SNMPERR_SUCCESS;
+	}
+
+	ret = generate_Ku(proto, protolen, (const unsigned char *)pass,
+		strlen(pass), key, keylen);
+
+	if (ret == SNMPERR_SUCCESS) {
+		su_ku_add(protoname, digest, digestlen, key, *keylen);
+#ifndef WIN32
+		if (keycache) {
+			su_keycache_save();
+		}
+#endif
+	}
+
+	return ret;
+}
+
 void nut_snmp_init(const char *type, const char *hostname)
 {
 	char *ns_options = NULL;
@@ -985,9 +1510,9 @@ net-snmp/library/keytools.h:   int    generate_Ku(const oid * hashtype, u_int ha
 					g_snmp_sess.securityAuthProtoLen);
 			}
 
-			if (generate_Ku(g_snmp_sess.securityAuthProto,
+			if (su_generate_Ku(authProtocol, g_snmp_sess.securityAuthProto,
 				(u_int)g_snmp_sess.securityAuthProtoLen,
-				(const unsigned char *) authPassword, strlen(authPassword),
+				authPassword,
 				g_snmp_sess.securityAuthKey,
 				&g_snmp_sess.securityAuthKeyLen) !=
 				SNMPERR_SUCCESS) {
@@ -1053,9 +1578,9 @@ net-snmp/library/keytools.h:   int    generate_Ku(const oid * hashtype, u_int ha
 					g_snmp_sess.securityAuthProtoLen);
 			}
 
-			if (generate_Ku(g_snmp_sess.securityAuthProto,
+			if (su_generate_Ku(authProtocol, g_snmp_sess.securityAuthProto,
 				(u_int)g_snmp_sess.securityAuthProtoLen,
-				(const unsigned char *) privPassword, strlen(privPassword),
+				privPassword,
 				g_snmp_sess.securityPrivKey,
 				&g_snmp_sess.securityPrivKeyLen) !=
 				SNMPERR_SUCCESS) {
@@ -1085,166 +1610,1065 @@ void nut_snmp_cleanup(void)
 	SOCK_CLEANUP; /* wrapper not needed on Unix! */
 }
 
-/* Free a struct snmp_pdu * returned by nut_snmp_walk */
-static void nut_snmp_free(struct snmp_pdu ** array_to_free)
+#ifndef WIN32
+/* Whether a datagram came from the agent this driver talks to */
+static bool_t su_trap_from_agent(const struct sockaddr_storage *from)
 {
-	struct snmp_pdu ** current_element;
+	size_t	i;
 
-	if (array_to_free != NULL) {
-		current_element = array_to_free;
+	for (i = 0; i < trap_agent_count; i++) {
+		const struct sockaddr_storage	*agent = &trap_agent[i];
 
-		while (*current_element != NULL) {
-			snmp_free_pdu(*current_element);
-			current_element++;
+		if (agent->ss_family != from->ss_family)
+			continue;
+
+		if (from->ss_family == AF_INET
+		 && !memcmp(&((const struct sockaddr_in *)agent)->sin_addr,
+			&((const struct sockaddr_in *)from)->sin_addr,
+			sizeof(struct in_addr))
+		) {
+			return TRUE;
 		}
 
-		free( array_to_free );
+		if (from->ss_family == AF_INET6
+		 && !memcmp(&((const struct sockaddr_in6 *)agent)->sin6_addr,
+			&((const struct sockaddr_in6 *)from)->sin6_addr,
+			sizeof(struct in6_addr))
+		) {
+			return TRUE;
+		}
 	}
+
+	return FALSE;
 }
 
-/* Return a NULL terminated array of snmp_pdu * */
-static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
+/* The trap socket has data: read all the datagrams there are, and ask
+ * for an update if a trap (or inform) came from the agent. What the
+ * trap says is not decoded: the update gets the status and alarms. */
+static int su_trap_event(int fd, short revents, void *arg)
 {
-	int status;
-	struct snmp_pdu *pdu, *response = NULL;
-	oid name[MAX_OID_LEN];
-	size_t name_len = MAX_OID_LEN;
-	oid * current_name;
-	size_t current_name_len;
-	static unsigned int numerr = 0;
-	int nb_iteration = 0;
-	struct snmp_pdu ** ret_array = NULL;
-	int type = SNMP_MSG_GET;
+	unsigned char	buf[LARGEBUF];
+	struct sockaddr_storage	from;
+	socklen_t	fromlen;
+	ssize_t	len;
+	int	ret = 0;
+
+	NUT_UNUSED_VARIABLE(revents);
+	NUT_UNUSED_VARIABLE(arg);
+
+	for (;;) {
+		fromlen = sizeof(from);
+		len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+		if (len < 0)
+			break;
 
-	upsdebugx(3, "%s(%s)", __func__, OID);
-	upsdebugx(4, "%s: max. iteration = %i", __func__, max_iteration);
+		/* a BER SEQUENCE from the agent, or it is none of our business */
+		if (len < 2 || buf[0] != 0x30 || !su_trap_from_agent(&from)) {
+			upsdebugx(3, "%s: ignoring a datagram of %" PRIiSIZE " bytes",
+				__func__, len);
+			continue;
+		}
 
-	/* create and send request. */
-	if (!snmp_parse_oid(OID, name, &name_len)) {
-		upsdebugx(2, "[%s] %s: %s: %s",
-			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
-		return NULL;
+		upsdebugx(2, "%s: got a trap from the agent", __func__);
+		trap_pending = TRUE;
+		ret = 1;
 	}
 
-	current_name = name;
-	current_name_len = name_len;
+	return ret;
+}
 
-	while( nb_iteration < max_iteration ) {
-		struct snmp_pdu	**new_ret_array;
+/* The host part of the "port" (hostname, IPv4 or [IPv6] address, with
+ * a Net-SNMP transport prefix and a :port suffix or not) */
+static void su_trap_agent_host(char *buf, size_t buflen)
+{
+	const char	*host = device_path, *p;
+	size_t	len;
 
-		/* Going to a shorter OID means we are outside our sub-tree */
-		if( current_name_len < name_len ) {
-			break;
-		}
+	if (!strncasecmp(host, "udp:", 4) || !strncasecmp(host, "tcp:", 4))
+		host += 4;
+	else if (!strncasecmp(host, "udp6:", 5) || !strncasecmp(host, "tcp6:", 5))
+		host += 5;
 
-		pdu = snmp_pdu_create(type);
+	if (*host == '[' && (p = strchr(host, ']')) != NULL) {
+		host++;
+		len = (size_t)(p - host);
+	}
+	else if ((p = strchr(host, ':')) != NULL && strchr(p + 1, ':') == NULL) {
+		len = (size_t)(p - host);
+	}
+	else {
+		len = strlen(host);
+	}
 
-		if (pdu == NULL) {
-			fatalx(EXIT_FAILURE, "Not enough memory");
-		}
+	if (len >= buflen)
+		len = buflen - 1;
+	memcpy(buf, host, len);
+	buf[len] = '\0';
+}
 
-		snmp_add_null_var(pdu, current_name, current_name_len);
+/* Listen to traps on the snmp_trap_port, if one was given */
+static void su_trap_open(void)
+{
+	struct addrinfo	hints, *res, *ai;
+	char	host[SMALLBUF];
+	const char	*port = getval(SU_VAR_TRAPPORT);
+	int	fd = -1, flags;
+	size_t	n;
 
-		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	if (port == NULL || trap_fd >= 0)
+		return;
 
-		if (!response) {
-			break;
-		}
+	/* the addresses the traps may come from */
+	su_trap_agent_host(host, sizeof(host));
 
-		if (!((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))) {
-			if (mibname == NULL) {
-				/* We are probing for proper mib - ignore errors */
-				snmp_free_pdu(response);
-				nut_snmp_free(ret_array);
-				return NULL;
-			}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
 
-			if (response->errstat == SNMP_ERR_NOSUCHNAME) {
-				upsdebugx(4, "%s: OID does not exist, skipping", __func__);
-				snmp_free_pdu(response);
-				nut_snmp_free(ret_array);
-				return NULL;
-			}
+	if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+		upslogx(LOG_WARNING, "%s: can't resolve %s, not listening to traps",
+			__func__, host);
+		return;
+	}
 
-			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
+	for (n = 0, ai = res; ai != NULL; ai = ai->ai_next)
+		n++;
 
-			/* Error throttling otherwise */
-			numerr++;
-			upsdebugx(4, "%s: numerr++ (total=%i)", __func__, numerr);
+	trap_agent = xcalloc(n, sizeof(*trap_agent));
+	for (trap_agent_count = 0, ai = res; ai != NULL; ai = ai->ai_next) {
+		if (ai->ai_addrlen <= sizeof(*trap_agent))
+			memcpy(&trap_agent[trap_agent_count++], ai->ai_addr, ai->ai_addrlen);
+	}
+	freeaddrinfo(res);
 
-			if ((numerr == SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
-				upslogx(LOG_WARNING, "[%s] Warning: excessive poll "
-						"failures, limiting error reporting (OID = %s)",
-						upsname?upsname:device_name, OID);
-			}
+	if (trap_agent_count == 0) {
+		su_trap_close();
+		return;
+	}
 
-			if ((numerr < SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
-				if (type == SNMP_MSG_GETNEXT) {
-					upsdebugx(2, "=> No more OID, walk complete");
-				}
-				else {
-					nut_snmp_perror(g_snmp_sess_p, status, response,
-							"%s: %s", __func__, OID);
-				}
-			}
+	/* the socket they come in on, of the agent's address family */
+	hints.ai_family = trap_agent[0].ss_family;
+	hints.ai_flags = AI_PASSIVE;
 
-			snmp_free_pdu(response);
-			break;
-		} else {
-			/* Checked the "type" field of the returned varbind if
-			 * it is a type error exception (only applicable with
-			 * SNMPv2 or SNMPv3 protocol, would not happen with
-			 * SNMPv1). This allows to proceed interpreting large
-			 * responses when one entry in the middle is rejectable.
-			 */
-			if (response->variables->type == SNMP_NOSUCHOBJECT ||
-			    response->variables->type == SNMP_NOSUCHINSTANCE ||
-			    response->variables->type == SNMP_ENDOFMIBVIEW) {
-				upslogx(LOG_WARNING, "[%s] Warning: type error exception (OID = %s)",
-						upsname?upsname:device_name, OID);
-				snmp_free_pdu(response);
-				break;
-			}
-			else {
-				/* no error */
-				numerr = 0;
-			}
-		}
+	if (getaddrinfo(NULL, port, &hints, &res) != 0) {
+		upslogx(LOG_WARNING, "%s: bad %s value %s, not listening to traps",
+			__func__, SU_VAR_TRAPPORT, port);
+		su_trap_close();
+		return;
+	}
 
-		nb_iteration++;
-		/* +1 is for the terminating NULL */
-		new_ret_array = realloc(
-			ret_array,
-			sizeof(struct snmp_pdu*) * ((size_t)nb_iteration+1)
-			);
-		if (new_ret_array == NULL) {
-			upsdebugx(1, "%s: Failed to realloc thread", __func__);
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
 			break;
-		}
-		else {
-			ret_array = new_ret_array;
-		}
-		ret_array[nb_iteration-1] = response;
-		ret_array[nb_iteration]=NULL;
 
-		current_name = response->variables->name;
-		current_name_len = response->variables->name_length;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
 
-		type = SNMP_MSG_GETNEXT;
+	if (fd < 0) {
+		upslog_with_errno(LOG_WARNING, "%s: can't listen to traps on UDP port %s",
+			__func__, port);
+		su_trap_close();
+		return;
 	}
 
-	return ret_array;
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0
+	 || dstate_addevent(fd, POLLIN, su_trap_event, NULL)
+	) {
+		upslogx(LOG_WARNING, "%s: can't watch the trap socket", __func__);
+		close(fd);
+		su_trap_close();
+		return;
+	}
+
+	trap_fd = fd;
+	upslogx(LOG_INFO, "Listening to traps from %s on UDP port %s", host, port);
 }
 
-struct snmp_pdu *nut_snmp_get(const char *OID)
+static void su_trap_close(void)
 {
-	struct snmp_pdu ** pdu_array;
-	struct snmp_pdu * ret_pdu;
+	if (trap_fd >= 0) {
+		dstate_delevent(trap_fd);
+		close(trap_fd);
+		trap_fd = -1;
+	}
 
-	if (OID == NULL)
-		return NULL;
+	free(trap_agent);
+	trap_agent = NULL;
+	trap_agent_count = 0;
+	trap_pending = FALSE;
+}
+#endif	/* !WIN32 */
 
-	upsdebugx(3, "%s(%s)", __func__, OID);
+/* Count a round trip started at "sent", which timed out, failed or
+ * got an answer; return how long it took, in usec */
+static long su_stats_request(const struct timeval *sent, bool_t timeout, bool_t error)
+{
+	struct timeval	now;
+	long	usec;
+	size_t	i;
+
+	gettimeofday(&now, NULL);
+	usec = (long)(now.tv_sec - sent->tv_sec) * 1000000
+		+ (long)(now.tv_usec - sent->tv_usec);
+
+	stats_total.requests++;
+	stats_update_requests++;
+	if (timeout)
+		stats_total.timeouts++;
+	else if (error)
+		stats_total.errors++;
+	stats_total.usec += (uintmax_t)usec;
+	if (usec > stats_total.usec_max)
+		stats_total.usec_max = usec;
+
+	for (i = 0; i < SU_STATS_BUCKETS - 1 && usec >= stats_bucket_usec[i]; i++)
+		;
+	stats_histogram[i]++;
+
+	return usec;
+}
+
+/* Count a request which asked for this OID (among others, maybe) */
+static void su_stats_oid(const char *OID, long usec, bool_t timeout, bool_t error)
+{
+	su_oid_t	*o = su_oid_find(OID);
+	su_stats_t	*st;
+	size_t	i;
+
+	if (o == NULL)
+		return;
+
+	i = (size_t)(o - oid_cache);
+	if (i >= oid_stats_alloc) {
+		size_t	n = oid_cache_alloc;
+
+		oid_stats = xrealloc(oid_stats, n * sizeof(*oid_stats));
+		memset(&oid_stats[oid_stats_alloc], 0, (n - oid_stats_alloc) * sizeof(*oid_stats));
+		oid_stats_alloc = n;
+	}
+
+	st = &oid_stats[i];
+	st->requests++;
+	if (timeout)
+		st->timeouts++;
+	else if (error)
+		st->errors++;
+	st->usec += (uintmax_t)usec;
+	if (usec > st->usec_max)
+		st->usec_max = usec;
+}
+
+/* snmp_synch_response(), timed for driver.perf.io.* and counted for
+ * driver.perf.snmp.* against the OID asked for */
+static int nut_snmp_synch(const char *OID, struct snmp_pdu *pdu, struct snmp_pdu **response)
+{
+	int	status;
+	struct timeval	sent;
+	long	usec;
+	bool_t	timeout, error;
+
+	if (stats_enabled)
+		gettimeofday(&sent, NULL);
+
+	dstate_perf_io_begin();
+	status = snmp_synch_response(g_snmp_sess_p, pdu, response);
+	dstate_perf_io_end();
+
+	if (stats_enabled) {
+		timeout = (status == STAT_TIMEOUT);
+		error = (status != STAT_SUCCESS || *response == NULL
+			|| (*response)->errstat != SNMP_ERR_NOERROR);
+		usec = su_stats_request(&sent, timeout, error);
+		su_stats_oid(OID, usec, timeout, error);
+	}
+
+	return status;
+}
+
+/* Publish the statistics of the SNMP requests, and log the round trips
+ * of this update and the slowest OIDs so far (debug level 2) */
+static void su_stats_update(void)
+{
+	char	buf[SMALLBUF];
+	size_t	i, j, top[SU_STATS_TOP], ntop = 0;
+
+	if (!stats_enabled)
+		return;
+
+	dstate_setinfo("driver.perf.snmp.requests", "%" PRIuMAX, stats_total.requests);
+	dstate_setinfo("driver.perf.snmp.timeouts", "%" PRIuMAX, stats_total.timeouts);
+	dstate_setinfo("driver.perf.snmp.errors", "%" PRIuMAX, stats_total.errors);
+	dstate_setinfo("driver.perf.snmp.update.requests", "%" PRIuMAX, stats_update_requests);
+	dstate_setinfo_long("driver.perf.snmp.latency.max", stats_total.usec_max / 1000);
+	dstate_setinfo("driver.perf.snmp.latency.histogram",
+		"%" PRIuMAX " %" PRIuMAX " %" PRIuMAX " %" PRIuMAX,
+		stats_histogram[0], stats_histogram[1],
+		stats_histogram[2], stats_histogram[3]);
+
+	upsdebugx(1, "%s: %" PRIuMAX " SNMP round trips in this update",
+		__func__, stats_update_requests);
+	stats_update_requests = 0;
+
+	/* the slowest OIDs, by their longest request */
+	for (i = 0; i < oid_stats_alloc && i < oid_cache_count; i++) {
+		if (oid_stats[i].requests == 0)
+			continue;
+
+		for (j = ntop; j > 0 && oid_stats[top[j - 1]].usec_max < oid_stats[i].usec_max; j--) {
+			if (j < SU_STATS_TOP)
+				top[j] = top[j - 1];
+		}
+		if (j < SU_STATS_TOP) {
+			top[j] = i;
+			if (ntop < SU_STATS_TOP)
+				ntop++;
+		}
+	}
+
+	if (ntop > 0) {
+		snprintf(buf, sizeof(buf), "%s %ld", oid_cache[top[0]].OID,
+			oid_stats[top[0]].usec_max / 1000);
+		dstate_setinfo("driver.perf.snmp.slowest", "%s", buf);
+	}
+
+	for (i = 0; i < ntop; i++) {
+		const su_stats_t	*st = &oid_stats[top[i]];
+
+		upsdebugx(2, "%s: slow OID %s: %" PRIuMAX " requests, "
+			"%" PRIuMAX " timeouts, %" PRIuMAX " errors, "
+			"%ld msec max, %" PRIuMAX " msec mean",
+			__func__, oid_cache[top[i]].OID, st->requests,
+			st->timeouts, st->errors, st->usec_max / 1000,
+			(st->usec / st->requests) / 1000);
+	}
+}
+
+/* Free a struct snmp_pdu * returned by nut_snmp_walk */
+static void nut_snmp_free(struct snmp_pdu ** array_to_free)
+{
+	struct snmp_pdu ** current_element;
+
+	if (array_to_free != NULL) {
+		current_element = array_to_free;
+
+		while (*current_element != NULL) {
+			snmp_free_pdu(*current_element);
+			current_element++;
+		}
+
+		free( array_to_free );
+	}
+}
+
+/* Whether walks may use GETBULK requests */
+static bool_t nut_snmp_bulk(void)
+{
+	return (maxrepetitions > 0
+		&& g_snmp_sess_p != NULL
+		&& g_snmp_sess_p->version != SNMP_VERSION_1);
+}
+
+static size_t su_oid_hash(const char *OID)
+{
+	size_t	hash = 2166136261U;
+
+	while (*OID) {
+		hash ^= (size_t)(unsigned char)*OID++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static void su_oid_cache_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < oid_cache_count; i++) {
+		free(oid_cache[i].OID);
+		free(oid_cache[i].name);
+	}
+
+	free(oid_cache);
+	free(oid_cache_hash);
+	oid_cache = NULL;
+	oid_cache_hash = NULL;
+	oid_cache_count = oid_cache_alloc = oid_cache_hash_size = 0;
+}
+
+/* Parse an OID text, or find what it was parsed into before: the
+ * result stays valid until upsdrv_cleanup(). Return NULL, with
+ * snmp_errno set, if it does not parse (which is not remembered). */
+static su_oid_t *su_oid_find(const char *OID)
+{
+	size_t	mask, i;
+	su_oid_t	*o;
+
+	if (oid_cache_hash_size == 0)
+		return NULL;
+
+	mask = oid_cache_hash_size - 1;
+	for (i = su_oid_hash(OID) & mask; oid_cache_hash[i]; i = (i + 1) & mask) {
+		o = &oid_cache[oid_cache_hash[i] - 1];
+		if (!strcmp(o->OID, OID))
+			return o;
+	}
+
+	return NULL;
+}
+
+static const oid *su_parse_oid(const char *OID, size_t *name_len)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	len = MAX_OID_LEN, mask, i;
+	su_oid_t	*o;
+
+	if ((o = su_oid_find(OID)) != NULL) {
+		*name_len = o->name_len;
+		return o->name;
+	}
+
+	if (!snmp_parse_oid(OID, name, &len))
+		return NULL;
+
+	if (oid_cache_count == oid_cache_alloc) {
+		oid_cache_alloc = oid_cache_alloc ? oid_cache_alloc * 2 : 128;
+		oid_cache = xrealloc(oid_cache, oid_cache_alloc * sizeof(*oid_cache));
+	}
+
+	o = &oid_cache[oid_cache_count++];
+	o->OID = xstrdup(OID);
+	o->name = xcalloc(len, sizeof(oid));
+	memcpy(o->name, name, len * sizeof(oid));
+	o->name_len = len;
+
+	/* keep the hash at most half full */
+	if (oid_cache_count * 2 > oid_cache_hash_size) {
+		free(oid_cache_hash);
+		oid_cache_hash_size = oid_cache_hash_size ? oid_cache_hash_size * 2 : 256;
+		oid_cache_hash = xcalloc(oid_cache_hash_size, sizeof(*oid_cache_hash));
+		mask = oid_cache_hash_size - 1;
+		for (len = 0; len < oid_cache_count; len++) {
+			for (i = su_oid_hash(oid_cache[len].OID) & mask; oid_cache_hash[i]; i = (i + 1) & mask)
+				;
+			oid_cache_hash[i] = len + 1;
+		}
+	}
+	else {
+		mask = oid_cache_hash_size - 1;
+		for (i = su_oid_hash(OID) & mask; oid_cache_hash[i]; i = (i + 1) & mask)
+			;
+		oid_cache_hash[i] = oid_cache_count;
+	}
+
+	*name_len = o->name_len;
+	return o->name;
+}
+
+/* Return a NULL terminated array of snmp_pdu *
+ * (one varbind each, also when they came in one GETBULK response) */
+static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
+{
+	int status;
+	struct snmp_pdu *pdu, *response = NULL;
+	const oid *name;
+	size_t name_len;
+	oid current_name[MAX_OID_LEN];
+	size_t current_name_len;
+	static unsigned int numerr = 0;
+	int nb_iteration = 0;
+	struct snmp_pdu ** ret_array = NULL;
+	size_t ret_alloc = 0;
+	int type = SNMP_MSG_GET;
+	netsnmp_variable_list *vp;
+	int i;
+	bool_t done = FALSE, kept;
+
+	upsdebugx(3, "%s(%s)", __func__, OID);
+	upsdebugx(4, "%s: max. iteration = %i", __func__, max_iteration);
+
+	/* create and send request. */
+	if ((name = su_parse_oid(OID, &name_len)) == NULL) {
+		upsdebugx(2, "[%s] %s: %s: %s",
+			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
+		return NULL;
+	}
+
+	memcpy(current_name, name, name_len * sizeof(oid));
+	current_name_len = name_len;
+
+	while( !done && nb_iteration < max_iteration ) {
+		/* Going to a shorter OID means we are outside our sub-tree */
+		if( current_name_len < name_len ) {
+			break;
+		}
+
+		pdu = snmp_pdu_create(type);
+
+		if (pdu == NULL) {
+			fatalx(EXIT_FAILURE, "Not enough memory");
+		}
+
+		if (type == SNMP_MSG_GETBULK) {
+			pdu->non_repeaters = 0;
+			pdu->max_repetitions = max_iteration - nb_iteration;
+			if (pdu->max_repetitions > maxrepetitions)
+				pdu->max_repetitions = maxrepetitions;
+		}
+
+		snmp_add_null_var(pdu, current_name, current_name_len);
+
+		status = nut_snmp_synch(OID, pdu, &response);
+
+		if (!response) {
+			break;
+		}
+
+		if (!((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))) {
+			if (mibname == NULL) {
+				/* We are probing for proper mib - ignore errors */
+				snmp_free_pdu(response);
+				nut_snmp_free(ret_array);
+				return NULL;
+			}
+
+			if (response->errstat == SNMP_ERR_NOSUCHNAME) {
+				upsdebugx(4, "%s: OID does not exist, skipping", __func__);
+				snmp_free_pdu(response);
+				nut_snmp_free(ret_array);
+				return NULL;
+			}
+
+			upsdebugx(3, "status = %i, response->errstat = %li", status, response->errstat);
+
+			/* Error throttling otherwise */
+			numerr++;
+			upsdebugx(4, "%s: numerr++ (total=%i)", __func__, numerr);
+
+			if ((numerr == SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
+				upslogx(LOG_WARNING, "[%s] Warning: excessive poll "
+						"failures, limiting error reporting (OID = %s)",
+						upsname?upsname:device_name, OID);
+			}
+
+			if ((numerr < SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
+				if (type != SNMP_MSG_GET) {
+					upsdebugx(2, "=> No more OID, walk complete");
+				}
+				else {
+					nut_snmp_perror(g_snmp_sess_p, status, response,
+							"%s: %s", __func__, OID);
+				}
+			}
+
+			snmp_free_pdu(response);
+			break;
+		} else {
+			/* Checked the "type" field of the returned varbind if
+			 * it is a type error exception (only applicable with
+			 * SNMPv2 or SNMPv3 protocol, would not happen with
+			 * SNMPv1). This allows to proceed interpreting large
+			 * responses when one entry in the middle is rejectable.
+			 */
+			if (response->variables->type == SNMP_NOSUCHOBJECT ||
+			    response->variables->type == SNMP_NOSUCHINSTANCE ||
+			    response->variables->type == SNMP_ENDOFMIBVIEW) {
+				upslogx(LOG_WARNING, "[%s] Warning: type error exception (OID = %s)",
+						upsname?upsname:device_name, OID);
+				snmp_free_pdu(response);
+				break;
+			}
+			else {
+				/* no error */
+				numerr = 0;
+			}
+		}
+
+		kept = FALSE;
+		for (i = 0, vp = response->variables;
+			vp != NULL && nb_iteration < max_iteration;
+			i++, vp = vp->next_variable
+		) {
+			/* the end of a GETBULK answer may be past the MIB */
+			if (i > 0
+			&& (vp->type == SNMP_NOSUCHOBJECT
+			 || vp->type == SNMP_NOSUCHINSTANCE
+			 || vp->type == SNMP_ENDOFMIBVIEW)
+			) {
+				done = TRUE;
+				break;
+			}
+
+			/* +1 is for the terminating NULL */
+			if ((size_t)nb_iteration + 1 >= ret_alloc) {
+				struct snmp_pdu	**new_ret_array;
+				size_t	new_alloc = ret_alloc ? ret_alloc * 2 : 16;
+
+				if (new_alloc > (size_t)max_iteration + 1)
+					new_alloc = (size_t)max_iteration + 1;
+
+				new_ret_array = realloc(ret_array,
+					sizeof(struct snmp_pdu*) * new_alloc);
+				if (new_ret_array == NULL) {
+					upsdebugx(1, "%s: Failed to realloc thread", __func__);
+					done = TRUE;
+					break;
+				}
+				ret_array = new_ret_array;
+				ret_alloc = new_alloc;
+			}
+
+			/* keep the response itself when it has just this one */
+			if (i == 0 && vp->next_variable == NULL) {
+				ret_array[nb_iteration] = response;
+				kept = TRUE;
+			}
+			else
+				ret_array[nb_iteration] = snmp_split_pdu(response, i, 1);
+			nb_iteration++;
+			ret_array[nb_iteration] = NULL;
+
+			memcpy(current_name, vp->name, vp->name_length * sizeof(oid));
+			current_name_len = vp->name_length;
+
+			/* Going to a shorter OID means we are outside our sub-tree */
+			if (current_name_len < name_len) {
+				done = TRUE;
+				break;
+			}
+		}
+
+		if (!kept)
+			snmp_free_pdu(response);
+
+		type = nut_snmp_bulk() ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT;
+	}
+
+	return ret_array;
+}
+
+/* Count the rows of a table column (its OID, without the row index) with
+ * GETBULK requests, from index "first" up to the first one missing, as
+ * probing them one by one would. Return -1 if it can not tell, e.g. for
+ * SNMPv1 sessions, so the caller probes. */
+static int nut_snmp_count_rows(const char *column, int first)
+{
+	int status, count = 0;
+	struct snmp_pdu *pdu, *response;
+	const oid *name;
+	size_t name_len;
+	oid current_name[MAX_OID_LEN];
+	size_t current_name_len;
+	netsnmp_variable_list *vp;
+
+	if (!nut_snmp_bulk() || first < 0)
+		return -1;
+
+	if ((name = su_parse_oid(column, &name_len)) == NULL || name_len >= MAX_OID_LEN) {
+		return -1;
+	}
+
+	upsdebugx(3, "%s(%s, %i)", __func__, column, first);
+
+	memcpy(current_name, name, name_len * sizeof(oid));
+	current_name_len = name_len;
+
+	for (;;) {
+		pdu = snmp_pdu_create(SNMP_MSG_GETBULK);
+		if (pdu == NULL) {
+			fatalx(EXIT_FAILURE, "Not enough memory");
+		}
+		pdu->non_repeaters = 0;
+		pdu->max_repetitions = maxrepetitions;
+		snmp_add_null_var(pdu, current_name, current_name_len);
+
+		response = NULL;
+		status = nut_snmp_synch(column, pdu, &response);
+
+		if (status != STAT_SUCCESS || response == NULL
+		||  response->errstat != SNMP_ERR_NOERROR
+		) {
+			if (response != NULL)
+				snmp_free_pdu(response);
+			return -1;
+		}
+
+		for (vp = response->variables; vp != NULL; vp = vp->next_variable) {
+			/* past the column (or the MIB): done */
+			if (vp->type == SNMP_NOSUCHOBJECT
+			 || vp->type == SNMP_NOSUCHINSTANCE
+			 || vp->type == SNMP_ENDOFMIBVIEW
+			 || vp->name_length != name_len + 1
+			 || memcmp(vp->name, name, name_len * sizeof(oid))
+			) {
+				break;
+			}
+
+			/* rows before the first one wanted */
+			if (vp->name[name_len] < (oid)first)
+				continue;
+
+			/* a gap ends the count */
+			if (vp->name[name_len] != (oid)first + (oid)count)
+				break;
+
+			count++;
+		}
+
+		if (vp != NULL || response->variables == NULL) {
+			snmp_free_pdu(response);
+			break;
+		}
+
+		/* on from the last row of this answer */
+		for (vp = response->variables; vp->next_variable != NULL; vp = vp->next_variable)
+			;
+		memcpy(current_name, vp->name, vp->name_length * sizeof(oid));
+		current_name_len = vp->name_length;
+		snmp_free_pdu(response);
+	}
+
+	upsdebugx(3, "%s: %i rows", __func__, count);
+	return count;
+}
+
+/* Forget what su_prefetch() got and nut_snmp_get() did not hand out */
+static void su_prefetch_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < prefetch_count; i++) {
+		free(prefetch[i].OID);
+		if (prefetch[i].pdu != NULL)
+			snmp_free_pdu(prefetch[i].pdu);
+	}
+
+	prefetch_count = 0;
+	prefetch_next = 0;
+}
+
+static void su_prefetch_add(const char *OID)
+{
+	const oid	*name;
+	size_t	name_len;
+	su_prefetch_t	*p;
+
+	if ((name = su_parse_oid(OID, &name_len)) == NULL) {
+		/* left to nut_snmp_walk(), which reports it */
+		return;
+	}
+
+	if (prefetch_count == prefetch_alloc) {
+		prefetch_alloc = prefetch_alloc ? prefetch_alloc * 2 : 64;
+		prefetch = xrealloc(prefetch, prefetch_alloc * sizeof(*prefetch));
+	}
+
+	p = &prefetch[prefetch_count++];
+	p->OID = xstrdup(OID);
+	p->name = name;
+	p->name_len = name_len;
+	p->pdu = NULL;
+}
+
+/* Ask for prefetch[first .. first + count - 1] later (see su_prefetch_run()) */
+static void su_prefetch_todo(size_t first, size_t count)
+{
+	if (count == 0)
+		return;
+
+	if (prefetch_todo_count == prefetch_todo_alloc) {
+		prefetch_todo_alloc = prefetch_todo_alloc ? prefetch_todo_alloc * 2 : 16;
+		prefetch_todo = xrealloc(prefetch_todo,
+			prefetch_todo_alloc * sizeof(*prefetch_todo));
+	}
+
+	prefetch_todo[prefetch_todo_count].first = first;
+	prefetch_todo[prefetch_todo_count].count = count;
+	prefetch_todo_count++;
+}
+
+/* Net-SNMP calls this with the answer to a GET sent by su_prefetch_send()
+ * (and frees it afterwards), or when it timed out. What this does not get
+ * is left to the usual one OID at a time path, which then reports the
+ * error (if any) as it always did. */
+static int su_prefetch_cb(int operation, struct snmp_session *sess,
+	int reqid, struct snmp_pdu *response, void *magic)
+{
+	su_prefetch_sent_t	*sent = (su_prefetch_sent_t *)magic;
+	su_prefetch_range_t	range = sent->range;
+	size_t	i;
+	long	bad, usec;
+	netsnmp_variable_list	*vp;
+
+	NUT_UNUSED_VARIABLE(sess);
+	NUT_UNUSED_VARIABLE(reqid);
+
+	prefetch_inflight--;
+
+	if (stats_enabled) {
+		bool_t	timeout = (operation == NETSNMP_CALLBACK_OP_TIMED_OUT);
+		bool_t	error = (operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE
+			|| response == NULL || response->errstat != SNMP_ERR_NOERROR);
+
+		usec = su_stats_request(&sent->sent, timeout, error);
+		for (i = range.first; i < range.first + range.count; i++)
+			su_stats_oid(prefetch[i].OID, usec, timeout, error);
+	}
+
+	free(magic);
+
+	if (operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE || response == NULL) {
+		/* no answer: do not send more, what is out will time out too */
+		upsdebugx(2, "%s: no answer for %" PRIuSIZE " OIDs from %s",
+			__func__, range.count, prefetch[range.first].OID);
+		prefetch_stop = TRUE;
+		return 1;
+	}
+
+	if (response->errstat != SNMP_ERR_NOERROR) {
+		bad = response->errindex;
+		upsdebugx(3, "%s: error %li at varbind %li of %" PRIuSIZE,
+			__func__, response->errstat, bad, range.count);
+
+		if (range.count < 2)
+			return 1;
+
+		if (response->errstat == SNMP_ERR_TOOBIG || bad < 1 || (size_t)bad > range.count) {
+			/* the agent's limits: split the request in two */
+			su_prefetch_todo(range.first, range.count / 2);
+			su_prefetch_todo(range.first + range.count / 2,
+				range.count - range.count / 2);
+			return 1;
+		}
+
+		/* SNMPv1 fails the whole request for one missing OID,
+		 * and says which: ask for the others again */
+		su_prefetch_todo(range.first, (size_t)bad - 1);
+		su_prefetch_todo(range.first + (size_t)bad, range.count - (size_t)bad);
+		return 1;
+	}
+
+	for (i = 0, vp = response->variables; vp != NULL && i < range.count; i++, vp = vp->next_variable) {
+		/* SNMPv2c/v3 exceptions are per varbind */
+		if (vp->type == SNMP_NOSUCHOBJECT
+		 || vp->type == SNMP_NOSUCHINSTANCE
+		 || vp->type == SNMP_ENDOFMIBVIEW)
+			continue;
+
+		prefetch[range.first + i].pdu = snmp_split_pdu(response, (int)i, 1);
+	}
+
+	return 1;
+}
+
+/* Send a GET for one range of prefetch[], without waiting for the answer */
+static void su_prefetch_send(su_prefetch_range_t range)
+{
+	size_t	i;
+	struct snmp_pdu	*pdu;
+	su_prefetch_sent_t	*magic;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+
+	for (i = range.first; i < range.first + range.count; i++)
+		snmp_add_null_var(pdu, prefetch[i].name, prefetch[i].name_len);
+
+	magic = xmalloc(sizeof(*magic));
+	magic->range = range;
+	gettimeofday(&magic->sent, NULL);
+
+	if (snmp_async_send(g_snmp_sess_p, pdu, su_prefetch_cb, magic) == 0) {
+		nut_snmp_perror(g_snmp_sess_p, 0, NULL, "%s: snmp_async_send", __func__);
+		snmp_free_pdu(pdu);
+		free(magic);
+		prefetch_stop = TRUE;
+		return;
+	}
+
+	prefetch_inflight++;
+}
+
+/* Send what is to be sent, up to "window" requests at a time, until all
+ * is answered. The requests which are out must be seen to the end even
+ * if no more get sent: their callback refers to prefetch[]. */
+static void su_prefetch_run(void)
+{
+	int	numfds, block, ret;
+	fd_set	fdset;
+	struct timeval	timeout;
+
+	prefetch_stop = FALSE;
+
+	dstate_perf_io_begin();
+	for (;;) {
+		while (!prefetch_stop && prefetch_todo_count > 0
+		&& prefetch_inflight < window
+		) {
+			prefetch_todo_count--;
+			su_prefetch_send(prefetch_todo[prefetch_todo_count]);
+		}
+
+		if (prefetch_inflight <= 0)
+			break;
+
+		numfds = 0;
+		block = 1;
+		FD_ZERO(&fdset);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
+		snmp_select_info(&numfds, &fdset, &timeout, &block);
+
+		ret = select(numfds, &fdset, NULL, NULL, block ? NULL : &timeout);
+		if (ret > 0) {
+			snmp_read(&fdset);
+		}
+		else if (ret == 0) {
+			snmp_timeout();
+		}
+		else if (errno != EINTR) {
+			upsdebug_with_errno(1, "%s: select", __func__);
+			snmp_timeout();
+		}
+	}
+	dstate_perf_io_end();
+
+	prefetch_todo_count = 0;
+}
+
+/* What the update walk of the device in hand will ask for one at a time:
+ * the entries which are due in this cycle, as snmp_ups_walk() and
+ * su_ups_get() pick them */
+static void su_prefetch_device(void)
+{
+	const snmp_info_t	*su_info_p, *inst;
+	snmp_info_flags_t	flags;
+	char	buf[SU_INFOSIZE];
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++) {
+		flags = SU_FLAGS(su_info_p);
+
+		if (su_info_p->OID == NULL
+		 || !(flags & SU_FLAG_OK)
+		 || (flags & (SU_FLAG_STATIC | SU_FLAG_ABSENT))
+		 || (flags & (SU_OUTLET | SU_OUTLET_GROUP | SU_AMBIENT_TEMPLATE))
+		 || SU_TYPE(su_info_p) == SU_TYPE_CMD
+		 || ((flags & SU_FLAG_SEMI_STATIC) && semistatic_countdown != 0)
+		 || !su_poll_due(su_info_p)
+		) {
+			continue;
+		}
+
+		if (strchr(su_info_p->OID, '%') != NULL
+		 && (inst = su_instance_find(su_info_p, -1)) != NULL
+		) {
+			/* as an earlier update adapted it */
+			su_prefetch_add(inst->OID);
+		}
+		else if (strchr(su_info_p->OID, '%') != NULL) {
+			/* daisychain template, as su_ups_get() adapts it */
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
+#pragma GCC diagnostic ignored "-Wformat-security"
+#endif
+			snprintf(buf, sizeof(buf), su_info_p->OID,
+				current_device_number + device_template_offset);
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic pop
+#endif
+			su_prefetch_add(buf);
+		}
+		else {
+			su_prefetch_add(su_info_p->OID);
+		}
+	}
+}
+
+/* Get ahead what the update walk of all the devices (the units of a
+ * daisychain too) will ask for, in multi-varbind GETs of "getbatch"
+ * OIDs, with up to "window" of them out at a time */
+static void su_prefetch(int mode)
+{
+	int	saved_current_device_number = current_device_number;
+	size_t	i, n;
+
+	su_prefetch_free();
+
+	if (mode != SU_WALKMODE_UPDATE || (getbatch < 2 && window < 2))
+		return;
+
+	for (current_device_number = (daisychain_enabled == FALSE && devices_count == 1 ? 1 : 0) ;
+		current_device_number <= devices_count; current_device_number++)
+	{
+		/* snmp_ups_walk() skips the whole daisychain */
+		if (current_device_number == 0 && daisychain_enabled == TRUE)
+			continue;
+
+		su_prefetch_device();
+	}
+	current_device_number = saved_current_device_number;
+
+	/* su_prefetch_run() takes the last queued first */
+	for (n = (prefetch_count + (size_t)getbatch - 1) / (size_t)getbatch; n > 0; n--) {
+		i = (n - 1) * (size_t)getbatch;
+		su_prefetch_todo(i, prefetch_count - i < (size_t)getbatch
+			? prefetch_count - i : (size_t)getbatch);
+	}
+
+	su_prefetch_run();
+
+	upsdebugx(2, "%s: got %" PRIuSIZE " OIDs ahead", __func__, prefetch_count);
+}
+
+/* The response su_prefetch() got for this OID, if any; the caller owns it */
+static struct snmp_pdu *su_prefetched(const char *OID)
+{
+	size_t	i, j;
+	struct snmp_pdu	*pdu;
+
+	/* the walk asks in about the order they were got */
+	for (j = 0; j < prefetch_count; j++) {
+		i = (prefetch_next + j) % prefetch_count;
+		if (prefetch[i].pdu == NULL || strcmp(prefetch[i].OID, OID))
+			continue;
+
+		pdu = prefetch[i].pdu;
+		prefetch[i].pdu = NULL;
+		prefetch_next = i + 1;
+		return pdu;
+	}
+
+	return NULL;
+}
+
+struct snmp_pdu *nut_snmp_get(const char *OID)
+{
+	struct snmp_pdu ** pdu_array;
+	struct snmp_pdu * ret_pdu;
+
+	if (OID == NULL)
+		return NULL;
+
+	upsdebugx(3, "%s(%s)", __func__, OID);
+
+	if ((ret_pdu = su_prefetched(OID)) != NULL) {
+		upsdebugx(4, "%s: got ahead", __func__);
+		return ret_pdu;
+	}
 
 	pdu_array = nut_snmp_walk(OID,1);
 
@@ -1481,12 +2905,12 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 	int status;
 	bool_t ret = FALSE;
 	struct snmp_pdu *pdu, *response = NULL;
-	oid name[MAX_OID_LEN];
-	size_t name_len = MAX_OID_LEN;
+	const oid *name;
+	size_t name_len;
 
 	upsdebugx(1, "entering %s(%s, %c, %s)", __func__, OID, type, value);
 
-	if (!snmp_parse_oid(OID, name, &name_len)) {
+	if ((name = su_parse_oid(OID, &name_len)) == NULL) {
 		upslogx(LOG_ERR, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
 		return FALSE;
@@ -1503,7 +2927,7 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 		return FALSE;
 	}
 
-	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	status = nut_snmp_synch(OID, pdu, &response);
 
 	if ((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))
 		ret = TRUE;
@@ -1602,7 +3026,7 @@ net-snmp/types.h:    long            errstat;
 /* deal with APCC weirdness on Symmetras */
 static void disable_transfer_oids(void)
 {
-	snmp_info_t *su_info_p;
+	const snmp_info_t *su_info_p;
 
 	upslogx(LOG_INFO, "Disabling transfer OIDs");
 
@@ -1616,12 +3040,12 @@ static void disable_transfer_oids(void)
 
 	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++) {
 		if (!strcasecmp(su_info_p->info_type, "input.transfer.low")) {
-			su_info_p->flags &= ~SU_FLAG_OK;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 			continue;
 		}
 
 		if (!strcasecmp(su_info_p->info_type, "input.transfer.high")) {
-			su_info_p->flags &= ~SU_FLAG_OK;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 			continue;
 		}
 	}
@@ -1629,7 +3053,7 @@ static void disable_transfer_oids(void)
 
 /* Universal function to add or update info element.
  * If value is NULL, use the default one (su_info_p->dfl) if provided */
-void su_setinfo(snmp_info_t *su_info_p, const char *value)
+void su_setinfo(const snmp_info_t *su_info_p, const char *value)
 {
 	info_lkp_t	*info_lkp;
 	char info_type[128]; /* We tweak incoming "su_info_p->info_type" value in some cases */
@@ -1717,10 +3141,14 @@ void su_setinfo(snmp_info_t *su_info_p, const char *value)
 	if ((strcasecmp(su_info_p->info_type, "ups.status"))
 		&& (strcasecmp(strrchr(su_info_p->info_type, '.'), ".alarm")))
 	{
-		if (value != NULL)
-			dstate_setinfo(info_type, "%s", value);
-		else if (su_info_p->dfl != NULL)
-			dstate_setinfo(info_type, "%s", su_info_p->dfl);
+		if (value != NULL) {
+			if (dstate_setinfo(info_type, "%s", value) == 1)
+				su_poll_changed();
+		}
+		else if (su_info_p->dfl != NULL) {
+			if (dstate_setinfo(info_type, "%s", su_info_p->dfl) == 1)
+				su_poll_changed();
+		}
 		else {
 			upsdebugx(3, "%s: no value nor default provided, aborting...", __func__);
 			return;
@@ -1749,7 +3177,7 @@ void su_setinfo(snmp_info_t *su_info_p, const char *value)
 	}
 }
 
-void su_status_set(snmp_info_t *su_info_p, long value)
+void su_status_set(const snmp_info_t *su_info_p, long value)
 {
 	const char *info_value = NULL;
 
@@ -1764,7 +3192,7 @@ void su_status_set(snmp_info_t *su_info_p, long value)
 	/* TODO: else */
 }
 
-void su_alarm_set(snmp_info_t *su_info_p, long value)
+void su_alarm_set(const snmp_info_t *su_info_p, long value)
 {
 	const char *info_value = NULL;
 	const char *info_type = NULL;
@@ -1792,17 +3220,17 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 		char alarm_info_value_more[SU_LARGEBUF + 32]; /* can sprintf() SU_LARGEBUF plus markup into here */
 
 		/* Special handling for outlet & outlet groups alarms */
-		if ((su_info_p->flags & SU_OUTLET)
-			|| (su_info_p->flags & SU_OUTLET_GROUP)) {
+		if ((SU_FLAGS(su_info_p) & SU_OUTLET)
+			|| (SU_FLAGS(su_info_p) & SU_OUTLET_GROUP)) {
 			/* Extract template number */
-			item_number = extract_template_number(su_info_p->flags, info_type);
+			item_number = extract_template_number(SU_FLAGS(su_info_p), info_type);
 
 			upsdebugx(2, "%s: appending %s %i", __func__,
-				(su_info_p->flags & SU_OUTLET_GROUP) ? "outlet group" : "outlet", item_number);
+				(SU_FLAGS(su_info_p) & SU_OUTLET_GROUP) ? "outlet group" : "outlet", item_number);
 
 			/* Inject in the alarm string */
 			snprintf(alarm_info_value, sizeof(alarm_info_value),
-				"outlet%s %i %s", (su_info_p->flags & SU_OUTLET_GROUP) ? " group" : "",
+				"outlet%s %i %s", (SU_FLAGS(su_info_p) & SU_OUTLET_GROUP) ? " group" : "",
 				item_number, info_value);
 			info_value = &alarm_info_value[0];
 		}
@@ -1828,10 +3256,57 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 	/* TODO: else */
 }
 
+static size_t su_info_hash(const char *type)
+{
+	size_t	hash = 2166136261U;
+
+	while (*type) {
+		hash ^= (size_t)tolower((unsigned char)*type++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* Index the snmp_info entries by name, for su_find_info() */
+static void su_info_hash_build(void)
+{
+	size_t	n, i, mask;
+
+	free(snmp_info_hash);
+	snmp_info_hash = NULL;
+	snmp_info_hash_size = 0;
+	snmp_info_hashed = NULL;
+
+	if (snmp_info == NULL)
+		return;
+
+	/* keep the hash at most half full */
+	for (n = 0; snmp_info[n].info_type != NULL; n++)
+		;
+	for (snmp_info_hash_size = 64; snmp_info_hash_size < n * 2; snmp_info_hash_size *= 2)
+		;
+	snmp_info_hash = xcalloc(snmp_info_hash_size, sizeof(*snmp_info_hash));
+	mask = snmp_info_hash_size - 1;
+
+	for (n = 0; snmp_info[n].info_type != NULL; n++) {
+		for (i = su_info_hash(snmp_info[n].info_type) & mask; snmp_info_hash[i]; i = (i + 1) & mask) {
+			/* the first entry of a name is the one found */
+			if (!strcasecmp(snmp_info[snmp_info_hash[i] - 1].info_type, snmp_info[n].info_type))
+				break;
+		}
+		if (!snmp_info_hash[i])
+			snmp_info_hash[i] = n + 1;
+	}
+
+	snmp_info_hashed = snmp_info;
+}
+
 /* find info element definition in my info array. */
-snmp_info_t *su_find_info(const char *type)
+const snmp_info_t *su_find_info(const char *type)
 {
-	snmp_info_t *su_info_p;
+	const snmp_info_t *su_info_p;
+	size_t	i, mask;
 
 	if (snmp_info == NULL) {
 		fatalx(EXIT_FAILURE, "%s: snmp_info is not initialized", __func__);
@@ -1841,6 +3316,21 @@ snmp_info_t *su_find_info(const char *type)
 		upsdebugx(1, "%s: WARNING: snmp_info is empty", __func__);
 	}
 
+	if (snmp_info == snmp_info_hashed) {
+		mask = snmp_info_hash_size - 1;
+		for (i = su_info_hash(type) & mask; snmp_info_hash[i]; i = (i + 1) & mask) {
+			su_info_p = &snmp_info[snmp_info_hash[i] - 1];
+			if (!strcasecmp(su_info_p->info_type, type)) {
+				upsdebugx(3, "%s: \"%s\" found", __func__, type);
+				return su_info_p;
+			}
+		}
+
+		upsdebugx(3, "%s: unknown info type (%s)", __func__, type);
+		return NULL;
+	}
+
+	/* a table tried while looking for the MIB of the device */
 	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++)
 		if (!strcasecmp(su_info_p->info_type, type)) {
 			upsdebugx(3, "%s: \"%s\" found", __func__, type);
@@ -1856,7 +3346,8 @@ snmp_info_t *su_find_info(const char *type)
 static bool_t match_model_OID(void)
 {
 	bool_t retCode = FALSE;
-	snmp_info_t *su_info_p, *cur_info_p;
+	const snmp_info_t *su_info_p;
+	snmp_info_t *cur_info_p;
 	char testOID_buf[LARGEBUF];
 
 	/* Try to get device.model first */
@@ -1892,8 +3383,9 @@ static bool_t match_model_OID(void)
 		}
 		else {
 			upsdebugx(2, "Found entry, not a template %s", su_info_p->OID);
-			/* Otherwise, just point at what we found */
-			cur_info_p = su_info_p;
+			/* Otherwise, just point at what we found
+			 * (only read below, the MIB tables are const) */
+			cur_info_p = (snmp_info_t *)su_info_p;
 		}
 
 		upsdebugx(2, "Testing %s using OID %s", cur_info_p->info_type, cur_info_p->OID);
@@ -1913,6 +3405,90 @@ static bool_t match_model_OID(void)
 	return retCode;
 }
 
+/* The snmp_info of mapping m2n: a compiled one only has its tables while
+ * it is tried or used for a device, between su_m2n_map() and the
+ * su_m2n_unmap() if it does not match */
+static const snmp_info_t *su_m2n_map(mib2nut_info_t *m2n)
+{
+	if (mibfiles != NULL && su_mibfile_map(m2n) < 0)
+		return NULL;
+
+	return m2n->snmp_info;
+}
+
+static void su_m2n_unmap(mib2nut_info_t *m2n)
+{
+	if (mibfiles != NULL)
+		su_mibfile_unmap(m2n);
+}
+
+/* The sysOIDs of the mib2nut[] entries, parsed and sorted (entries
+ * with the same sysOID in mib2nut[] order), for match_sysoid() to look
+ * a device up in; shared by all the devices a process hosts */
+typedef struct {
+	oid	*name;
+	size_t	name_len;
+	int	index;	/* in mib2nut[] */
+} su_sysoid_t;
+
+static su_sysoid_t *sysoid_index = NULL;
+static size_t sysoid_index_count = 0;
+
+static int su_sysoid_cmp(const void *a, const void *b)
+{
+	const su_sysoid_t	*sa = a, *sb = b;
+	int	ret = snmp_oid_compare(sa->name, sa->name_len, sb->name, sb->name_len);
+
+	return ret ? ret : sa->index - sb->index;
+}
+
+static void su_sysoid_index_build(void)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	name_len;
+	int	i;
+
+	if (sysoid_index != NULL)
+		return;
+
+	for (i = 0; mib2nut[i] != NULL; i++)
+		;
+	sysoid_index = xcalloc((size_t)i + 1, sizeof(*sysoid_index));
+
+	for (i = 0; mib2nut[i] != NULL; i++) {
+		if (mib2nut[i]->sysOID == NULL)
+			continue;
+
+		name_len = MAX_OID_LEN;
+		if (!read_objid(mib2nut[i]->sysOID, name, &name_len)) {
+			upsdebugx(2, "%s: can't build OID %s: %s",
+				__func__, mib2nut[i]->sysOID, snmp_api_errstring(snmp_errno));
+			continue;
+		}
+
+		sysoid_index[sysoid_index_count].name = xcalloc(name_len, sizeof(oid));
+		memcpy(sysoid_index[sysoid_index_count].name, name, name_len * sizeof(oid));
+		sysoid_index[sysoid_index_count].name_len = name_len;
+		sysoid_index[sysoid_index_count].index = i;
+		sysoid_index_count++;
+	}
+
+	qsort(sysoid_index, sysoid_index_count, sizeof(*sysoid_index), su_sysoid_cmp);
+	upsdebugx(2, "%s: %" PRIuSIZE " sysOIDs indexed", __func__, sysoid_index_count);
+}
+
+static void su_sysoid_index_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < sysoid_index_count; i++)
+		free(sysoid_index[i].name);
+
+	free(sysoid_index);
+	sysoid_index = NULL;
+	sysoid_index_count = 0;
+}
+
 /* Try to find the MIB using sysOID matching.
  * Return a pointer to a mib2nut definition if found, NULL otherwise */
 static mib2nut_info_t *match_sysoid(void)
@@ -1920,8 +3496,7 @@ static mib2nut_info_t *match_sysoid(void)
 	char sysOID_buf[LARGEBUF];
 	oid device_sysOID[MAX_OID_LEN];
 	size_t device_sysOID_len = MAX_OID_LEN;
-	oid mib2nut_sysOID[MAX_OID_LEN];
-	size_t mib2nut_sysOID_len = MAX_OID_LEN;
+	size_t lo, hi, mid, j;
 	int i;
 
 	/* Retrieve sysOID value of this device */
@@ -1946,68 +3521,195 @@ static mib2nut_info_t *match_sysoid(void)
 		return NULL;
 	}
 
-	/* Now, iterate on mib2nut definitions */
-	for (i = 0; mib2nut[i] != NULL; i++)
+	/* Now, look up the first mib2nut definition with this sysOID */
+	su_sysoid_index_build();
+
+	lo = 0;
+	hi = sysoid_index_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (snmp_oid_compare(sysoid_index[mid].name, sysoid_index[mid].name_len,
+			device_sysOID, device_sysOID_len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* ...and try each of them, as they come in mib2nut[] */
+	for (j = lo; j < sysoid_index_count; j++)
 	{
-		upsdebugx(1, "%s: checking MIB %s", __func__, mib2nut[i]->mib_name);
+		if (netsnmp_oid_equals(device_sysOID, device_sysOID_len,
+			sysoid_index[j].name, sysoid_index[j].name_len))
+			break;
 
-		if (mib2nut[i]->sysOID == NULL)
+		i = sysoid_index[j].index;
+		upsdebugx(2, "%s: sysOID matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
+		/* Counter verify, using {ups,device}.model */
+		snmp_info = su_m2n_map(mib2nut[i]);
+
+		if (snmp_info == NULL) {
+			upsdebugx(0, "%s: WARNING: snmp_info is not initialized "
+				"for mapping table entry #%d \"%s\"",
+				__func__, i, mib2nut[i]->mib_name
+				);
 			continue;
+		}
+		else if (snmp_info[0].info_type == NULL) {
+			upsdebugx(1, "%s: WARNING: snmp_info is empty "
+				"for mapping table entry #%d \"%s\"",
+				__func__, i, mib2nut[i]->mib_name);
+		}
+
+		if (match_model_OID() != TRUE)
+		{
+			upsdebugx(2, "%s: testOID provided and doesn't match MIB '%s'!", __func__, mib2nut[i]->mib_name);
+			snmp_info = NULL;
+			su_m2n_unmap(mib2nut[i]);
+			continue;
+		}
+		else
+			upsdebugx(2, "%s: testOID provided and matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
+
+		return mib2nut[i];
+	}
+
+	/* Yell all to call for user report */
+	upslogx(LOG_ERR, "No matching MIB found for sysOID '%s'!\n" \
+		"Please report it to NUT developers, with an 'upsc' output for your device.\n" \
+		"Going back to the classic MIB detection method.",
+		sysOID_buf);
+
+	return NULL;
+}
+
+/* Whether an entry tells of events: the status, alarms and input voltages */
+static bool_t su_poll_event(const snmp_info_t *su_info_p)
+{
+	const char	*type = su_info_p->info_type;
+	const char	*dot = strrchr(type, '.');
+
+	return (!strcasecmp(type, "ups.status")
+		|| (dot != NULL && (!strcasecmp(dot, ".alarm") || !strcasecmp(dot, ".alarms")))
+		|| (!strncmp(type, "input.", 6) && strstr(type, "voltage") != NULL));
+}
+
+/* Whether an entry may be polled less often than in each update: not
+ * those which tell of events, nor what has a frequency of its own */
+static bool_t su_poll_adaptive(const snmp_info_t *su_info_p)
+{
+	return (!su_poll_event(su_info_p)
+		&& !(SU_FLAGS(su_info_p) & (SU_FLAG_STATIC | SU_FLAG_SEMI_STATIC))
+		&& SU_TYPE(su_info_p) != SU_TYPE_CMD);
+}
+
+/* Pick the entries due in this update, before it gets ahead of the walk */
+static void su_poll_start(void)
+{
+	size_t	i;
+
+	if (snmp_info_poll == NULL)
+		return;
+
+	for (i = 0; i < snmp_info_count; i++) {
+		snmp_info_poll[i].changed = FALSE;
+
+		/* for a trap: just the events, the countdowns run on updates */
+		if (su_poll_events_only) {
+			snmp_info_poll[i].due = su_poll_event(&snmp_info[i]);
+			continue;
+		}
+
+		snmp_info_poll[i].due = (snmp_info_poll[i].countdown == 0);
+		if (!snmp_info_poll[i].due)
+			snmp_info_poll[i].countdown--;
+	}
+}
 
-		/* Clear variables */
-		memset(mib2nut_sysOID, 0, sizeof(mib2nut_sysOID));
-		mib2nut_sysOID_len = MAX_OID_LEN;
+/* Space out the polls of the entries polled in this update which did
+ * not change, and poll again in each update those which did */
+static void su_poll_end(void)
+{
+	size_t	i;
+	su_poll_t	*p;
 
-		if (!read_objid(mib2nut[i]->sysOID, mib2nut_sysOID, &mib2nut_sysOID_len))
-		{
-			upsdebugx(2, "%s: can't build OID %s: %s",
-				__func__, sysOID_buf, snmp_api_errstring(snmp_errno));
+	if (snmp_info_poll == NULL || su_poll_events_only)
+		return;
 
-			/* Try to continue anyway! */
+	for (i = 0; i < snmp_info_count; i++) {
+		p = &snmp_info_poll[i];
+		if (!p->due)
 			continue;
+
+		if (adaptivefreq < 2 || p->changed || !su_poll_adaptive(&snmp_info[i])) {
+			p->interval = 1;
+			p->steady = 0;
+		}
+		else if (++p->steady >= SU_POLL_STEADY && p->interval < adaptivefreq) {
+			p->steady = 0;
+			p->interval *= 2;
+			if (p->interval > adaptivefreq)
+				p->interval = adaptivefreq;
+			upsdebugx(2, "%s: polling %s once in %d updates",
+				__func__, snmp_info[i].info_type, p->interval);
 		}
 
-		/* Now compare these */
-		upsdebugx(1, "%s: comparing %s with %s", __func__, sysOID_buf, mib2nut[i]->sysOID);
-		if (!netsnmp_oid_equals(device_sysOID, device_sysOID_len, mib2nut_sysOID, mib2nut_sysOID_len))
-		{
-			upsdebugx(2, "%s: sysOID matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
-			/* Counter verify, using {ups,device}.model */
-			snmp_info = mib2nut[i]->snmp_info;
+		p->countdown = p->interval - 1;
+	}
+}
 
-			if (snmp_info == NULL) {
-				upsdebugx(0, "%s: WARNING: snmp_info is not initialized "
-					"for mapping table entry #%d \"%s\"",
-					__func__, i, mib2nut[i]->mib_name
-					);
-				continue;
-			}
-			else if (snmp_info[0].info_type == NULL) {
-				upsdebugx(1, "%s: WARNING: snmp_info is empty "
-					"for mapping table entry #%d \"%s\"",
-					__func__, i, mib2nut[i]->mib_name);
-			}
+/* Poll all the entries in each update again, e.g. after a status change */
+static void su_poll_reset(void)
+{
+	size_t	i;
 
-			if (match_model_OID() != TRUE)
-			{
-				upsdebugx(2, "%s: testOID provided and doesn't match MIB '%s'!", __func__, mib2nut[i]->mib_name);
-				snmp_info = NULL;
-				continue;
-			}
-			else
-				upsdebugx(2, "%s: testOID provided and matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
+	if (snmp_info_poll == NULL)
+		return;
 
-			return mib2nut[i];
-		}
+	for (i = 0; i < snmp_info_count; i++) {
+		snmp_info_poll[i].interval = 1;
+		snmp_info_poll[i].countdown = 0;
+		snmp_info_poll[i].steady = 0;
+	}
+}
+
+/* Whether an entry is polled in this update */
+static bool_t su_poll_due(const snmp_info_t *su_info_p)
+{
+	if (snmp_info_poll == NULL
+	 || su_info_p < snmp_info
+	 || su_info_p >= snmp_info + snmp_info_count
+	) {
+		return TRUE;
 	}
 
-	/* Yell all to call for user report */
-	upslogx(LOG_ERR, "No matching MIB found for sysOID '%s'!\n" \
-		"Please report it to NUT developers, with an 'upsc' output for your device.\n" \
-		"Going back to the classic MIB detection method.",
-		sysOID_buf);
+	return snmp_info_poll[su_info_p - snmp_info].due;
+}
 
-	return NULL;
+/* The value of the entry being walked, or of one of its instances or
+ * units, changed */
+static void su_poll_changed(void)
+{
+	if (snmp_info_poll != NULL
+	 && su_poll_entry != NULL
+	 && su_poll_entry >= snmp_info
+	 && su_poll_entry < snmp_info + snmp_info_count
+	) {
+		snmp_info_poll[su_poll_entry - snmp_info].changed = TRUE;
+	}
+}
+
+snmp_info_flags_t *su_flags(const snmp_info_t *su_info_p)
+{
+	/* an entry of the (read-only) MIB table of this device... */
+	if (snmp_info_flags != NULL
+	 && su_info_p >= snmp_info
+	 && su_info_p < snmp_info + snmp_info_count
+	) {
+		return &snmp_info_flags[su_info_p - snmp_info];
+	}
+
+	/* ...or an instance made by instantiate_info(), which is writable */
+	return (snmp_info_flags_t *)&su_info_p->flags;
 }
 
 /* Load the right snmp_info_t structure matching mib parameter */
@@ -2068,7 +3770,7 @@ bool_t load_mib2nut(const char *mib)
 				__func__, mib2nut[i]->mib_name);
 
 			/* Classic method: test an OID specific to this MIB */
-			snmp_info = mib2nut[i]->snmp_info;
+			snmp_info = su_m2n_map(mib2nut[i]);
 
 			if (snmp_info == NULL) {
 				upsdebugx(0, "%s: WARNING: snmp_info is not initialized "
@@ -2095,6 +3797,7 @@ bool_t load_mib2nut(const char *mib)
 				upsdebugx(3, "%s: testOID provided and doesn't match MIB '%s'!",
 					__func__, mib2nut[i]->mib_name);
 				snmp_info = NULL;
+				su_m2n_unmap(mib2nut[i]);
 				continue;
 			}
 			else
@@ -2111,6 +3814,38 @@ bool_t load_mib2nut(const char *mib)
 	if (m2n != NULL)
 	{
 		snmp_info = m2n->snmp_info;
+		mib2nut_info = m2n;
+		if (mibfiles != NULL)
+			mibfiles_used++;
+
+		/* SU_FLAG_OK and others are set and cleared for what this
+		 * device has, the table only holds where they start from */
+		free(snmp_info_flags);
+		snmp_info_flags = NULL;
+		free(snmp_info_poll);
+		snmp_info_poll = NULL;
+		snmp_info_count = 0;
+		if (snmp_info != NULL) {
+			size_t	n;
+
+			for (n = 0; snmp_info[n].info_type != NULL; n++)
+				;
+
+			snmp_info_flags = xcalloc(n + 1, sizeof(*snmp_info_flags));
+			snmp_info_poll = xcalloc(n + 1, sizeof(*snmp_info_poll));
+			for (snmp_info_count = 0; snmp_info_count < n; snmp_info_count++) {
+				const char	*OID = snmp_info[snmp_info_count].OID;
+				size_t	name_len;
+
+				snmp_info_flags[snmp_info_count] = snmp_info[snmp_info_count].flags;
+				snmp_info_poll[snmp_info_count].interval = 1;
+
+				/* parse the plain OIDs now, rather than in the walks */
+				if (OID != NULL && *OID != '\0' && strchr(OID, '%') == NULL)
+					su_parse_oid(OID, &name_len);
+			}
+		}
+		su_info_hash_build();
 		OID_pwr_status = m2n->oid_pwr_status;
 		mibname = m2n->mib_name;
 		mibvers = m2n->mib_version;
@@ -2218,9 +3953,9 @@ const char *su_find_infoval(info_lkp_t *oid2info, void *raw_value)
 }
 
 /* FIXME: doesn't work with templates! */
-static void disable_competition(snmp_info_t *entry)
+static void disable_competition(const snmp_info_t *entry)
 {
-	snmp_info_t	*p;
+	const snmp_info_t	*p;
 
 	if (snmp_info == NULL) {
 		fatalx(EXIT_FAILURE, "%s: snmp_info is not initialized", __func__);
@@ -2234,7 +3969,7 @@ static void disable_competition(snmp_info_t *entry)
 		if(p!=entry && !strcmp(p->info_type, entry->info_type)) {
 			upsdebugx(2, "%s: disabling %s %s",
 					__func__, p->info_type, p->OID);
-			p->flags &= ~SU_FLAG_OK;
+			SU_FLAGS(p) &= ~SU_FLAG_OK;
 		}
 	}
 }
@@ -2300,7 +4035,7 @@ static bool_t is_multiple_template(const char *OID_template)
 /* Instantiate an snmp_info_t from a template.
  * Useful for device, outlet, outlet.group and ambient templates.
  * Note: remember to adapt info_type, OID and optionaly dfl */
-static snmp_info_t *instantiate_info(snmp_info_t *info_template, snmp_info_t *new_instance)
+static snmp_info_t *instantiate_info(const snmp_info_t *info_template, snmp_info_t *new_instance)
 {
 	upsdebugx(1, "%s(%s)", __func__,
 		info_template ? info_template->info_type : "n/a");
@@ -2330,7 +4065,7 @@ static snmp_info_t *instantiate_info(snmp_info_t *info_template, snmp_info_t *ne
 	new_instance->info_len = info_template->info_len;
 	/* FIXME: check if we need to adapt this one... */
 	new_instance->dfl = info_template->dfl;
-	new_instance->flags = info_template->flags;
+	new_instance->flags = SU_FLAGS(info_template);
 	new_instance->oid2info = info_template->oid2info;
 
 	upsdebugx(2, "instantiate_info: template instantiated");
@@ -2339,7 +4074,7 @@ static snmp_info_t *instantiate_info(snmp_info_t *info_template, snmp_info_t *ne
 
 /* Free a dynamically allocated snmp_info_t.
  * Useful for outlet and outlet.group templates */
-static void free_info(snmp_info_t *su_info_p)
+static void free_info(const snmp_info_t *su_info_p)
 {
 	/* sanity check */
 	if (su_info_p == NULL)
@@ -2351,7 +4086,119 @@ static void free_info(snmp_info_t *su_info_p)
 	if (su_info_p->OID != NULL)
 		free ((char *)su_info_p->OID);
 
-	free (su_info_p);
+	free ((snmp_info_t *)su_info_p);
+}
+
+static size_t su_instance_hash(const snmp_info_t *tmpl, int device, int number)
+{
+	size_t	hash = (size_t)((uintptr_t)tmpl / sizeof(*tmpl));
+
+	hash = hash * 31 + (size_t)device;
+	hash = hash * 31 + (size_t)(number + 1);
+
+	return hash * 2654435761U;
+}
+
+static void su_instances_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < instances_count; i++) {
+		free((char *)instances[i]->info.info_type);
+		free((char *)instances[i]->info.OID);
+		if (instances[i]->info.dfl != instances[i]->tmpl->dfl)
+			free((char *)instances[i]->info.dfl);
+		free(instances[i]);
+	}
+
+	free(instances);
+	free(instances_hash);
+	instances = NULL;
+	instances_hash = NULL;
+	instances_count = instances_alloc = instances_hash_size = 0;
+}
+
+/* The instance of this template for the current device and instance
+ * number, if an earlier update made it, with the flags of the template */
+static snmp_info_t *su_instance_find(const snmp_info_t *tmpl, int number)
+{
+	size_t	i, mask;
+	su_instance_t	*inst;
+
+	if (!instances_kept || instances_hash_size == 0)
+		return NULL;
+
+	mask = instances_hash_size - 1;
+	for (i = su_instance_hash(tmpl, current_device_number, number) & mask;
+		instances_hash[i]; i = (i + 1) & mask)
+	{
+		inst = instances[instances_hash[i] - 1];
+		if (inst->tmpl == tmpl
+		 && inst->device == current_device_number
+		 && inst->number == number
+		) {
+			inst->info.flags = SU_FLAGS(tmpl);
+			return &inst->info;
+		}
+	}
+
+	return NULL;
+}
+
+/* Keep a copy of this instance for the next updates: return it, or NULL
+ * if instances are not kept in this walk */
+static snmp_info_t *su_instance_add(const snmp_info_t *tmpl, int number, const snmp_info_t *from)
+{
+	size_t	i, mask;
+	su_instance_t	*inst;
+
+	if (!instances_kept)
+		return NULL;
+
+	inst = xcalloc(1, sizeof(*inst));
+	inst->tmpl = tmpl;
+	inst->device = current_device_number;
+	inst->number = number;
+	inst->info = *from;
+	inst->info.info_type = xstrdup(from->info_type);
+	if (from->OID != NULL)
+		inst->info.OID = xstrdup(from->OID);
+	if (from->dfl != NULL && from->dfl != tmpl->dfl)
+		inst->info.dfl = xstrdup(from->dfl);
+
+	if (instances_count == instances_alloc) {
+		instances_alloc = instances_alloc ? instances_alloc * 2 : 64;
+		instances = xrealloc(instances, instances_alloc * sizeof(*instances));
+	}
+	instances[instances_count++] = inst;
+
+	/* keep the hash at most half full */
+	if (instances_count * 2 > instances_hash_size) {
+		free(instances_hash);
+		instances_hash_size = instances_hash_size ? instances_hash_size * 2 : 256;
+		instances_hash = xcalloc(instances_hash_size, sizeof(*instances_hash));
+		mask = instances_hash_size - 1;
+		for (number = 0; (size_t)number < instances_count; number++) {
+			su_instance_t	*p = instances[number];
+
+			for (i = su_instance_hash(p->tmpl, p->device, p->number) & mask;
+				instances_hash[i]; i = (i + 1) & mask)
+				;
+			instances_hash[i] = (size_t)number + 1;
+		}
+	}
+	else {
+		mask = instances_hash_size - 1;
+		for (i = su_instance_hash(tmpl, inst->device, inst->number) & mask;
+			instances_hash[i]; i = (i + 1) & mask)
+			;
+		instances_hash[i] = instances_count;
+	}
+
+	upsdebugx(3, "%s: keeping %s (%s)", __func__,
+		inst->info.info_type, inst->info.OID ? inst->info.OID : "no OID");
+
+	return &inst->info;
 }
 
 /* return the base SNMP index (0 or 1) to start template iteration on
@@ -2412,7 +4259,7 @@ static int base_snmp_template_index(const snmp_info_t *su_info_p)
 			/* Test if this template also includes daisychain, in which case
 			 * we just use the current device index */
 			if (is_multiple_template(su_info_p->OID) == TRUE) {
-				if (su_info_p->flags & SU_TYPE_DAISY_1) {
+				if (SU_FLAGS(su_info_p) & SU_TYPE_DAISY_1) {
 					snprintf(test_OID, sizeof(test_OID), su_info_p->OID,
 						current_device_number + device_template_offset, base_index);
 				}
@@ -2429,13 +4276,13 @@ static int base_snmp_template_index(const snmp_info_t *su_info_p)
 #endif
 
 			if (nut_snmp_get(test_OID) != NULL) {
-				if (su_info_p->flags & SU_FLAG_ZEROINVALID) {
+				if (SU_FLAGS(su_info_p) & SU_FLAG_ZEROINVALID) {
 					long value;
 					if ((nut_snmp_get_int(test_OID, &value)) && (value!=0)) {
 						break;
 					}
 				}
-				else if (su_info_p->flags & SU_FLAG_NAINVALID) {
+				else if (SU_FLAGS(su_info_p) & SU_FLAG_NAINVALID) {
 					char value[SU_BUFSIZE];
 					if ((nut_snmp_get_str(test_OID, value, SU_BUFSIZE, NULL))
 						&& (strncmp(value, "N/A", 3))) {
@@ -2450,11 +4297,11 @@ static int base_snmp_template_index(const snmp_info_t *su_info_p)
 
 		/* Only store if it's a template for outlets or outlets groups,
 		 * not for daisychain (which has different index) */
-		if (su_info_p->flags & SU_OUTLET)
+		if (SU_FLAGS(su_info_p) & SU_OUTLET)
 			outlet_template_index_base = base_index;
-		else if (su_info_p->flags & SU_OUTLET_GROUP)
+		else if (SU_FLAGS(su_info_p) & SU_OUTLET_GROUP)
 			outletgroup_template_index_base = base_index;
-		else if (su_info_p->flags & SU_AMBIENT_TEMPLATE)
+		else if (SU_FLAGS(su_info_p) & SU_AMBIENT_TEMPLATE)
 			ambient_template_index_base = base_index;
 		else
 			device_template_index_base = base_index;
@@ -2467,12 +4314,13 @@ static int base_snmp_template_index(const snmp_info_t *su_info_p)
 /* Try to determine the number of items (outlets, outlet groups, ...),
  * using a template definition. Walk through the template until we can't
  * get anymore values. I.e., if we can iterate up to 8 item, return 8 */
-static int guesstimate_template_count(snmp_info_t *su_info_p)
+static int guesstimate_template_count(const snmp_info_t *su_info_p)
 {
 	int base_index = 0;
 	char test_OID[SU_INFOSIZE];
 	int base_count;
 	const char *OID_template = su_info_p->OID;
+	const char *p;
 
 	upsdebugx(1, "%s(%s)", __func__, OID_template);
 
@@ -2500,7 +4348,7 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 		base_index++;
 	}
 	else {
-		if (su_info_p->flags & SU_FLAG_ZEROINVALID) {
+		if (SU_FLAGS(su_info_p) & SU_FLAG_ZEROINVALID) {
 			long value;
 			if ((nut_snmp_get_int(test_OID, &value)) && (value==0)) {
 				base_index++;
@@ -2508,6 +4356,18 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 		}
 	}
 
+	/* Tables whose index is last can be counted a few rows per request */
+	if ((p = strstr(OID_template, ".%i")) != NULL && p[3] == '\0'
+	&&  (size_t)(p - OID_template) < sizeof(test_OID)
+	) {
+		snprintf(test_OID, sizeof(test_OID), "%.*s",
+			(int)(p - OID_template), OID_template);
+		if ((base_count = nut_snmp_count_rows(test_OID, base_index)) >= 0) {
+			upsdebugx(3, "%s: %i", __func__, base_count);
+			return base_count;
+		}
+	}
+
 	/* Now, actually iterate */
 	for (base_count = 0 ;  ; base_count++) {
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
@@ -2531,24 +4391,196 @@ static int guesstimate_template_count(snmp_info_t *su_info_p)
 	return base_count;
 }
 
+/* Make the instance of a template for the current device and instance
+ * number: its name, default value and OID (for process_template()).
+ * Return FALSE if there is no such instance on this device. */
+static bool_t instantiate_template(const char *type, const snmp_info_t *su_info_p,
+	int cur_template_number, snmp_info_t *cur_info_p)
+{
+	int cur_nut_index = 0;
+	char tmp_buf[SU_INFOSIZE];
+
+	/* Special processing for daisychain:
+	 * append 'device.x' to the NUT variable name, except for the
+	 * whole daisychain ("device.0") */
+	if (!strncmp(type, "device", 6))
+	{
+		/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
+		if (current_device_number > 0) {
+			char *ptr = NULL;
+			/* Another special processing for daisychain
+			 * device collection needs special appending */
+			if (!strncmp(su_info_p->info_type, "device.", 7))
+				ptr = (char*)&su_info_p->info_type[7];
+			else
+				ptr = (char*)su_info_p->info_type;
+
+			snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+					"device.%i.%s", current_device_number, ptr);
+		}
+		else
+		{
+			/* Device 1 ("device.0", whole daisychain) needs no
+			 * special processing */
+			cur_nut_index = cur_template_number;
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
+#pragma GCC diagnostic ignored "-Wformat-security"
+#endif
+			snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+					su_info_p->info_type, cur_nut_index);
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic pop
+#endif
+		}
+	}
+	else if (!strncmp(type, "outlet", 6)) /* Outlet and outlet groups templates */
+	{
+		/* Get the index of the current template instance */
+		cur_nut_index = cur_template_number;
+
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
+#pragma GCC diagnostic ignored "-Wformat-security"
+#endif
+		/* Special processing for daisychain */
+		if (daisychain_enabled == TRUE) {
+			/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
+			if ((devices_count > 1) && (current_device_number > 0)) {
+				memset(&tmp_buf[0], 0, SU_INFOSIZE);
+				strcat(&tmp_buf[0], "device.%i.");
+				strcat(&tmp_buf[0], su_info_p->info_type);
+
+				upsdebugx(4, "FORMATTING STRING = %s", &tmp_buf[0]);
+				snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+					&tmp_buf[0], current_device_number, cur_nut_index);
+			}
+			else {
+				/* FIXME: daisychain-whole, what to do? */
+				snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+					su_info_p->info_type, cur_nut_index);
+			}
+		}
+		else {
+			snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+				su_info_p->info_type, cur_nut_index);
+		}
+	}
+	else if (!strncmp(type, "ambient", 7))
+	{
+		/* FIXME: can be grouped with outlet* above */
+		/* Get the index of the current template instance */
+		cur_nut_index = cur_template_number;
+
+		/* Special processing for daisychain */
+		if (daisychain_enabled == TRUE) {
+			/* Only publish on the daisychain host */
+			if ( (SU_FLAGS(su_info_p) & SU_TYPE_DAISY_MASTER_ONLY)
+				&& (current_device_number != 1) ) {
+					upsdebugx(2, "discarding variable due to daisychain master flag");
+					return FALSE;
+				}
+
+			/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
+			if ((devices_count > 1) && (current_device_number > 0)) {
+				memset(&tmp_buf[0], 0, SU_INFOSIZE);
+				strcat(&tmp_buf[0], "device.%i.");
+				strcat(&tmp_buf[0], su_info_p->info_type);
+
+				upsdebugx(4, "FORMATTING STRING = %s", &tmp_buf[0]);
+					snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+						&tmp_buf[0], current_device_number, cur_nut_index);
+			}
+			else {
+				/* FIXME: daisychain-whole, what to do? */
+				snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+					su_info_p->info_type, cur_nut_index);
+			}
+		}
+		else {
+			snprintf((char*)cur_info_p->info_type, SU_INFOSIZE,
+				su_info_p->info_type, cur_nut_index);
+		}
+	}
+	else
+		upsdebugx(4, "Error: unknown template type '%s", type);
+
+	/* check if default value is also a template */
+	if ((cur_info_p->dfl != NULL) &&
+		(strstr(su_info_p->dfl, "%i") != NULL)) {
+		cur_info_p->dfl = (char *)xmalloc(SU_INFOSIZE);
+		snprintf((char *)cur_info_p->dfl, SU_INFOSIZE, su_info_p->dfl, cur_nut_index);
+	}
+
+	if (cur_info_p->OID != NULL) {
+		/* Special processing for daisychain */
+		if (!strncmp(type, "device", 6)) {
+			if (current_device_number > 0) {
+				snprintf((char *)cur_info_p->OID, SU_INFOSIZE, su_info_p->OID, current_device_number + device_template_offset);
+			}
+			/*else
+			 * FIXME: daisychain-whole, what to do?
+			 */
+		}
+		else {
+			/* Special processing for daisychain:
+			 * these outlet | outlet groups also include formatting info,
+			 * so we have to check if the daisychain is enabled, and if
+			 * the formatting info for it are in 1rst or 2nd position */
+			if (daisychain_enabled == TRUE) {
+				if (SU_FLAGS(su_info_p) & SU_TYPE_DAISY_1) {
+					snprintf((char *)cur_info_p->OID, SU_INFOSIZE,
+						su_info_p->OID, current_device_number + device_template_offset, cur_template_number);
+				}
+				else if (SU_FLAGS(su_info_p) & SU_TYPE_DAISY_2) {
+					snprintf((char *)cur_info_p->OID, SU_INFOSIZE,
+						su_info_p->OID, cur_template_number + device_template_offset,
+						current_device_number - device_template_offset);
+				}
+				else {
+					/* Note: no device daisychain templating (SU_TYPE_DAISY_MASTER_ONLY)! */
+					snprintf((char *)cur_info_p->OID, SU_INFOSIZE, su_info_p->OID, cur_template_number);
+				}
+			}
+			else {
+				snprintf((char *)cur_info_p->OID, SU_INFOSIZE, su_info_p->OID, cur_template_number);
+			}
+		}
+	}
+#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
+#pragma GCC diagnostic pop
+#endif
+
+	return TRUE;
+}
+
 /* Process template definition, instantiate and get data or register
  * command
  * type: outlet, outlet.group, device */
-static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_p)
+static bool_t process_template(int mode, const char* type, const snmp_info_t *su_info_p)
 {
 	/* Default to TRUE, and leave to get_and_process_data() to set
 	 * to FALSE when actually getting data from devices, to avoid false
 	 * negative with server side data */
 	bool_t status = TRUE;
 	int cur_template_number = 1;
-	int cur_nut_index = 0;
 	int template_count = 0;
 	int base_snmp_index = 0;
-	snmp_info_t cur_info_p;
+	snmp_info_t cur_info_p, *info_p;
+	bool_t cur_info_made = FALSE;
 	char template_count_var[SU_BUFSIZE * 2];
 	/* Needed *2 to fit a max size_t in snprintf() below,
 	 * even if that should never happen */
-	char tmp_buf[SU_INFOSIZE];
 
 	upsdebugx(1, "%s template definition found (%s)...", type, su_info_p->info_type);
 
@@ -2560,7 +4592,7 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 
 	if(dstate_getinfo(template_count_var) == NULL) {
 		/* FIXME: should we disable it?
-		 * su_info_p->flags &= ~SU_FLAG_OK;
+		 * SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 		 * or rely on guesstimation? */
 		template_count = guesstimate_template_count(su_info_p);
 		/* Publish the count estimation */
@@ -2575,9 +4607,6 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 
 	/* Only instantiate templates if needed! */
 	if (template_count > 0) {
-		/* general init of data using the template */
-		instantiate_info(su_info_p, &cur_info_p);
-
 		base_snmp_index = base_snmp_template_index(su_info_p);
 
 		for (cur_template_number = base_snmp_index ;
@@ -2585,188 +4614,46 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 				cur_template_number++)
 		{
 			upsdebugx(1, "Processing instance %i/%i...", cur_template_number, template_count);
-			/* Special processing for daisychain:
-			 * append 'device.x' to the NUT variable name, except for the
-			 * whole daisychain ("device.0") */
-			if (!strncmp(type, "device", 6))
-			{
-				/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
-				if (current_device_number > 0) {
-					char *ptr = NULL;
-					/* Another special processing for daisychain
-					 * device collection needs special appending */
-					if (!strncmp(su_info_p->info_type, "device.", 7))
-						ptr = (char*)&su_info_p->info_type[7];
-					else
-						ptr = (char*)su_info_p->info_type;
-
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							"device.%i.%s", current_device_number, ptr);
-				}
-				else
-				{
-					/* Device 1 ("device.0", whole daisychain) needs no
-					 * special processing */
-					cur_nut_index = cur_template_number;
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
-#pragma GCC diagnostic ignored "-Wformat-security"
-#endif
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							su_info_p->info_type, cur_nut_index);
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
-#pragma GCC diagnostic pop
-#endif
-				}
-			}
-			else if (!strncmp(type, "outlet", 6)) /* Outlet and outlet groups templates */
-			{
-				/* Get the index of the current template instance */
-				cur_nut_index = cur_template_number;
-
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_FORMAT_SECURITY
-#pragma GCC diagnostic ignored "-Wformat-security"
-#endif
-				/* Special processing for daisychain */
-				if (daisychain_enabled == TRUE) {
-					/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
-					if ((devices_count > 1) && (current_device_number > 0)) {
-						memset(&tmp_buf[0], 0, SU_INFOSIZE);
-						strcat(&tmp_buf[0], "device.%i.");
-						strcat(&tmp_buf[0], su_info_p->info_type);
-
-						upsdebugx(4, "FORMATTING STRING = %s", &tmp_buf[0]);
-						snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							&tmp_buf[0], current_device_number, cur_nut_index);
-					}
-					else {
-						/* FIXME: daisychain-whole, what to do? */
-						snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							su_info_p->info_type, cur_nut_index);
-					}
-				}
-				else {
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-						su_info_p->info_type, cur_nut_index);
-				}
-			}
-			else if (!strncmp(type, "ambient", 7))
-			{
-				/* FIXME: can be grouped with outlet* above */
-				/* Get the index of the current template instance */
-				cur_nut_index = cur_template_number;
-
-				/* Special processing for daisychain */
-				if (daisychain_enabled == TRUE) {
-					/* Only publish on the daisychain host */
-					if ( (su_info_p->flags & SU_TYPE_DAISY_MASTER_ONLY)
-						&& (current_device_number != 1) ) {
-							upsdebugx(2, "discarding variable due to daisychain master flag");
-							continue;
-						}
 
-					/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
-					if ((devices_count > 1) && (current_device_number > 0)) {
-						memset(&tmp_buf[0], 0, SU_INFOSIZE);
-						strcat(&tmp_buf[0], "device.%i.");
-						strcat(&tmp_buf[0], su_info_p->info_type);
-
-						upsdebugx(4, "FORMATTING STRING = %s", &tmp_buf[0]);
-							snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-								&tmp_buf[0], current_device_number, cur_nut_index);
-					}
-					else {
-						/* FIXME: daisychain-whole, what to do? */
-						snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							su_info_p->info_type, cur_nut_index);
-					}
-				}
-				else {
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-						su_info_p->info_type, cur_nut_index);
+			/* made in an earlier update, or made now */
+			if ((info_p = su_instance_find(su_info_p, cur_template_number)) == NULL) {
+				if (!cur_info_made) {
+					/* general init of data using the template */
+					instantiate_info(su_info_p, &cur_info_p);
+					cur_info_made = TRUE;
 				}
+				if (!instantiate_template(type, su_info_p, cur_template_number, &cur_info_p))
+					continue;
+				if ((info_p = su_instance_add(su_info_p, cur_template_number, &cur_info_p)) == NULL)
+					info_p = &cur_info_p;
 			}
-			else
-				upsdebugx(4, "Error: unknown template type '%s", type);
-
-			/* check if default value is also a template */
-			if ((cur_info_p.dfl != NULL) &&
-				(strstr(su_info_p->dfl, "%i") != NULL)) {
-				cur_info_p.dfl = (char *)xmalloc(SU_INFOSIZE);
-				snprintf((char *)cur_info_p.dfl, SU_INFOSIZE, su_info_p->dfl, cur_nut_index);
-			}
-
-			if (cur_info_p.OID != NULL) {
-				/* Special processing for daisychain */
-				if (!strncmp(type, "device", 6)) {
-					if (current_device_number > 0) {
-						snprintf((char *)cur_info_p.OID, SU_INFOSIZE, su_info_p->OID, current_device_number + device_template_offset);
-					}
-					/*else
-					 * FIXME: daisychain-whole, what to do?
-					 */
-				}
-				else {
-					/* Special processing for daisychain:
-					 * these outlet | outlet groups also include formatting info,
-					 * so we have to check if the daisychain is enabled, and if
-					 * the formatting info for it are in 1rst or 2nd position */
-					if (daisychain_enabled == TRUE) {
-						if (su_info_p->flags & SU_TYPE_DAISY_1) {
-							snprintf((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, current_device_number + device_template_offset, cur_template_number);
-						}
-						else if (su_info_p->flags & SU_TYPE_DAISY_2) {
-							snprintf((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, cur_template_number + device_template_offset,
-								current_device_number - device_template_offset);
-						}
-						else {
-							/* Note: no device daisychain templating (SU_TYPE_DAISY_MASTER_ONLY)! */
-							snprintf((char *)cur_info_p.OID, SU_INFOSIZE, su_info_p->OID, cur_template_number);
-						}
-					}
-					else {
-						snprintf((char *)cur_info_p.OID, SU_INFOSIZE, su_info_p->OID, cur_template_number);
-					}
-				}
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
-#pragma GCC diagnostic pop
-#endif
+			info_p->flags = SU_FLAGS(su_info_p);
 
+			if (info_p->OID != NULL) {
 				/* add instant commands to the info database. */
 				if (SU_TYPE(su_info_p) == SU_TYPE_CMD) {
-					upsdebugx(1, "Adding template command %s", cur_info_p.info_type);
+					upsdebugx(1, "Adding template command %s", info_p->info_type);
 					/* FIXME: only add if "su_ups_get(cur_info_p) == TRUE" */
 					if (mode == SU_WALKMODE_INIT)
-						dstate_addcmd(cur_info_p.info_type);
+						dstate_addcmd(info_p->info_type);
 				}
 				else /* get and process this data */
-					status = get_and_process_data(mode, &cur_info_p);
+					status = get_and_process_data(mode, info_p);
 			} else {
 				/* server side (ABSENT) data */
-				su_setinfo(&cur_info_p, NULL);
+				su_setinfo(info_p, NULL);
 			}
 			/* set back the flag */
-			su_info_p->flags = cur_info_p.flags;
+			SU_FLAGS(su_info_p) = info_p->flags;
+		}
+		if (cur_info_made) {
+			free((char*)cur_info_p.info_type);
+			if (cur_info_p.OID != NULL)
+				free((char*)cur_info_p.OID);
+			if ((cur_info_p.dfl != NULL) &&
+				(strstr(su_info_p->dfl, "%i") != NULL))
+				free((char*)cur_info_p.dfl);
 		}
-		free((char*)cur_info_p.info_type);
-		if (cur_info_p.OID != NULL)
-			free((char*)cur_info_p.OID);
-		if ((cur_info_p.dfl != NULL) &&
-			(strstr(su_info_p->dfl, "%i") != NULL))
-			free((char*)cur_info_p.dfl);
 	}
 	else {
 		upsdebugx(1, "No %s present, discarding template definition...", type);
@@ -2834,7 +4721,7 @@ static int extract_template_number_from_snmp_info_t(const char* varname)
 
 
 /* process a single data from a walk */
-bool_t get_and_process_data(int mode, snmp_info_t *su_info_p)
+bool_t get_and_process_data(int mode, const snmp_info_t *su_info_p)
 {
 	bool_t status = FALSE;
 
@@ -2847,28 +4734,28 @@ bool_t get_and_process_data(int mode, snmp_info_t *su_info_p)
 
 	/* set stale flag if data is stale, clear if not. */
 	if (status == TRUE) {
-		if (su_info_p->flags & SU_FLAG_STALE) {
+		if (SU_FLAGS(su_info_p) & SU_FLAG_STALE) {
 			upslogx(LOG_INFO, "[%s] %s: data resumed for %s",
 				upsname?upsname:device_name, __func__, su_info_p->info_type);
-			su_info_p->flags &= ~SU_FLAG_STALE;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_STALE;
 		}
-		if(su_info_p->flags & SU_FLAG_UNIQUE) {
+		if(SU_FLAGS(su_info_p) & SU_FLAG_UNIQUE) {
 			/* We should be the only provider of this */
 			upsdebugx(4, "%s: unique flag", __func__);
 			disable_competition(su_info_p);
-			su_info_p->flags &= ~SU_FLAG_UNIQUE;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_UNIQUE;
 		}
 		dstate_dataok();
 	} else {
 		if (mode == SU_WALKMODE_INIT) {
 			/* handle unsupported vars */
 			upsdebugx(4, "%s: Disabling var '%s'", __func__, su_info_p->info_type);
-			su_info_p->flags &= ~SU_FLAG_OK;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 		} else	{
-			if (!(su_info_p->flags & SU_FLAG_STALE)) {
+			if (!(SU_FLAGS(su_info_p) & SU_FLAG_STALE)) {
 				upslogx(LOG_INFO, "[%s] snmp_ups_walk: data stale for %s",
 					upsname?upsname:device_name, su_info_p->info_type);
-				su_info_p->flags |= SU_FLAG_STALE;
+				SU_FLAGS(su_info_p) |= SU_FLAG_STALE;
 			}
 			dstate_datastale();
 		}
@@ -2887,7 +4774,7 @@ bool_t get_and_process_data(int mode, snmp_info_t *su_info_p)
  * Return TRUE if daisychain support is enabled, FALSE otherwise */
 bool_t daisychain_init(void)
 {
-	snmp_info_t *su_info_p = NULL;
+	const snmp_info_t *su_info_p = NULL;
 
 	upsdebugx(1, "Checking if daisychain support has to be enabled");
 
@@ -3018,9 +4905,9 @@ bool_t daisychain_init(void)
  * Return 0 if OK, 1 if the caller needs to "continue" the walk loop (i.e.
  * skip the present data)
  */
-static int process_phase_data(const char* type, long *nb_phases, snmp_info_t *su_info_p)
+static int process_phase_data(const char* type, long *nb_phases, const snmp_info_t *su_info_p)
 {
-	snmp_info_t *tmp_info_p;
+	const snmp_info_t *tmp_info_p;
 	char tmpOID[SU_INFOSIZE];
 	char tmpInfo[SU_INFOSIZE];
 	long tmpValue;
@@ -3126,22 +5013,22 @@ static int process_phase_data(const char* type, long *nb_phases, snmp_info_t *su
 
 	/* Actual processing of phases related data */
 /* FIXME: don't clear SU_INPHASES in daisychain mode!!! ??? */
-	if (su_info_p->flags & single_phase_flag) {
+	if (SU_FLAGS(su_info_p) & single_phase_flag) {
 		if (*nb_phases == 1) {
 			upsdebugx(1, "%s_phases is 1", type);
-			su_info_p->flags &= ~phases_flag;
+			SU_FLAGS(su_info_p) &= ~phases_flag;
 		} else {
 			upsdebugx(1, "%s_phases is not 1", type);
-			su_info_p->flags &= ~SU_FLAG_OK;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 			return 1;
 		}
-	} else if (su_info_p->flags & three_phase_flag) {
+	} else if (SU_FLAGS(su_info_p) & three_phase_flag) {
 		if (*nb_phases == 3) {
 			upsdebugx(1, "%s_phases is 3", type);
-			su_info_p->flags &= ~phases_flag;
+			SU_FLAGS(su_info_p) &= ~phases_flag;
 		} else {
 			upsdebugx(1, "%s_phases is not 3", type);
-			su_info_p->flags &= ~SU_FLAG_OK;
+			SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 			return 1;
 		}
 	} else {
@@ -3159,10 +5046,10 @@ bool_t snmp_ups_walk(int mode)
 	/* Experimental workaround for stale info */
 	static unsigned long	iterations = 0;
 #endif
-	snmp_info_t *su_info_p;
+	const snmp_info_t *su_info_p;
 	bool_t status = FALSE;
 
-	if (mode == SU_WALKMODE_UPDATE) {
+	if (mode == SU_WALKMODE_UPDATE && !su_poll_events_only) {
 		semistatic_countdown--;
 		if (semistatic_countdown < 0)
 			semistatic_countdown = semistaticfreq;
@@ -3187,6 +5074,16 @@ bool_t snmp_ups_walk(int mode)
 	 * for the whole (#0) virtual device, so it *seems* similar to unitary.
 	 */
 
+	/* the template instances made by an init walk may not hold later */
+	if (mode == SU_WALKMODE_INIT)
+		su_instances_free();
+	instances_kept = (mode == SU_WALKMODE_UPDATE);
+
+	/* what the loop will ask for, got ahead for all devices at once */
+	if (mode == SU_WALKMODE_UPDATE)
+		su_poll_start();
+	su_prefetch(mode);
+
 	for (current_device_number = (daisychain_enabled == FALSE && devices_count == 1 ? 1 : 0) ;
 		current_device_number <= devices_count; current_device_number++)
 	{
@@ -3249,7 +5146,7 @@ bool_t snmp_ups_walk(int mode)
 			if (mode == SU_WALKMODE_INIT &&
 				(!strncmp(su_info_p->info_type, "device.count", 12)))
 			{
-				su_info_p->flags &= ~SU_FLAG_OK;
+				SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
 				continue;
 			}
 
@@ -3266,33 +5163,37 @@ bool_t snmp_ups_walk(int mode)
 
 			/* skip instcmd, not linked to outlets */
 			if ((SU_TYPE(su_info_p) == SU_TYPE_CMD)
-				&& !(su_info_p->flags & SU_OUTLET)
-				&& !(su_info_p->flags & SU_OUTLET_GROUP)) {
+				&& !(SU_FLAGS(su_info_p) & SU_OUTLET)
+				&& !(SU_FLAGS(su_info_p) & SU_OUTLET_GROUP)) {
 				upsdebugx(1, "SU_CMD_MASK => %s", su_info_p->OID);
 				continue;
 			}
 			/* skip elements we shouldn't show in update mode */
-			if ((mode == SU_WALKMODE_UPDATE) && !(su_info_p->flags & SU_FLAG_OK))
+			if ((mode == SU_WALKMODE_UPDATE) && !(SU_FLAGS(su_info_p) & SU_FLAG_OK))
 				continue;
 
 			/* skip semi-static elements in update mode: only parse when countdown reaches 0 */
-			if ((mode == SU_WALKMODE_UPDATE) && (su_info_p->flags & SU_FLAG_SEMI_STATIC)) {
+			if ((mode == SU_WALKMODE_UPDATE) && (SU_FLAGS(su_info_p) & SU_FLAG_SEMI_STATIC)) {
 				if (semistatic_countdown != 0)
 					continue;
 				upsdebugx(1, "Refreshing semi-static entry %s", su_info_p->OID);
 			}
 
 			/* skip static elements in update mode */
-			if ((mode == SU_WALKMODE_UPDATE) && (su_info_p->flags & SU_FLAG_STATIC))
+			if ((mode == SU_WALKMODE_UPDATE) && (SU_FLAGS(su_info_p) & SU_FLAG_STATIC))
+				continue;
+
+			/* skip elements seen not to change, but in every "interval" updates */
+			if ((mode == SU_WALKMODE_UPDATE) && !su_poll_due(su_info_p))
 				continue;
 
 			/* Set default value if we cannot fetch it */
 			/* and set static flag on this element.
 			 * Not applicable to outlets (need SU_FLAG_STATIC tagging) */
-			if ((su_info_p->flags & SU_FLAG_ABSENT)
-				&& !(su_info_p->flags & SU_OUTLET)
-				&& !(su_info_p->flags & SU_OUTLET_GROUP)
-				&& !(su_info_p->flags & SU_AMBIENT_TEMPLATE))
+			if ((SU_FLAGS(su_info_p) & SU_FLAG_ABSENT)
+				&& !(SU_FLAGS(su_info_p) & SU_OUTLET)
+				&& !(SU_FLAGS(su_info_p) & SU_OUTLET_GROUP)
+				&& !(SU_FLAGS(su_info_p) & SU_AMBIENT_TEMPLATE))
 			{
 				if (mode == SU_WALKMODE_INIT)
 				{
@@ -3312,14 +5213,14 @@ bool_t snmp_ups_walk(int mode)
 							su_setinfo(su_info_p, NULL);
 						}
 					}
-					su_info_p->flags |= SU_FLAG_STATIC;
+					SU_FLAGS(su_info_p) |= SU_FLAG_STATIC;
 				}
 				continue;
 			}
 
 #ifdef COUNT_ITERATIONS
 			/* check stale elements only on each PN_STALE_RETRY iteration. */
-			if ((su_info_p->flags & SU_FLAG_STALE) &&
+			if ((SU_FLAGS(su_info_p) & SU_FLAG_STALE) &&
 					(iterations % SU_STALE_RETRY) != 0)
 				continue;
 #endif
@@ -3329,7 +5230,7 @@ bool_t snmp_ups_walk(int mode)
 			 * time */
 			/* Process input phases information */
 			walked_input_phases = &daisychain_info[current_device_number]->input_phases;
-			if (su_info_p->flags & SU_INPHASES) {
+			if (SU_FLAGS(su_info_p) & SU_INPHASES) {
 				upsdebugx(1, "Check input_phases (%ld)", *walked_input_phases);
 				if (process_phase_data("input", walked_input_phases, su_info_p) == 1)
 					continue;
@@ -3337,7 +5238,7 @@ bool_t snmp_ups_walk(int mode)
 
 			/* Process output phases information */
 			walked_output_phases = &daisychain_info[current_device_number]->output_phases;
-			if (su_info_p->flags & SU_OUTPHASES) {
+			if (SU_FLAGS(su_info_p) & SU_OUTPHASES) {
 				upsdebugx(1, "Check output_phases (%ld)", *walked_output_phases);
 				if (process_phase_data("output", walked_output_phases, su_info_p) == 1)
 					continue;
@@ -3345,28 +5246,30 @@ bool_t snmp_ups_walk(int mode)
 
 			/* Process bypass phases information */
 			walked_bypass_phases = &daisychain_info[current_device_number]->bypass_phases;
-			if (su_info_p->flags & SU_BYPPHASES) {
+			if (SU_FLAGS(su_info_p) & SU_BYPPHASES) {
 				upsdebugx(1, "Check bypass_phases (%ld)", *walked_bypass_phases);
 				if (process_phase_data("input.bypass", walked_bypass_phases, su_info_p) == 1)
 					continue;
 			}
 
+			su_poll_entry = su_info_p;
+
 			/* process template (outlet, outlet group, inc. daisychain) definition */
-			if (su_info_p->flags & SU_OUTLET) {
+			if (SU_FLAGS(su_info_p) & SU_OUTLET) {
 				/* Skip commands after init */
 				if ((SU_TYPE(su_info_p) == SU_TYPE_CMD) && (mode == SU_WALKMODE_UPDATE))
 					continue;
 				else
 					status = process_template(mode, "outlet", su_info_p);
 			}
-			else if (su_info_p->flags & SU_OUTLET_GROUP) {
+			else if (SU_FLAGS(su_info_p) & SU_OUTLET_GROUP) {
 				/* Skip commands after init */
 				if ((SU_TYPE(su_info_p) == SU_TYPE_CMD) && (mode == SU_WALKMODE_UPDATE))
 					continue;
 				else
 					status = process_template(mode, "outlet.group", su_info_p);
 			}
-			else if (su_info_p->flags & SU_AMBIENT_TEMPLATE) {
+			else if (SU_FLAGS(su_info_p) & SU_AMBIENT_TEMPLATE) {
 				/* Skip commands after init */
 				if ((SU_TYPE(su_info_p) == SU_TYPE_CMD) && (mode == SU_WALKMODE_UPDATE))
 					continue;
@@ -3386,6 +5289,8 @@ bool_t snmp_ups_walk(int mode)
 			}
 		}	/* for (su_info_p... */
 
+		su_poll_entry = NULL;
+
 		if (devices_count > 1) {
 			/* commit the device alarm buffer */
 			device_alarm_commit(current_device_number);
@@ -3395,6 +5300,12 @@ bool_t snmp_ups_walk(int mode)
 		}
 	}
 
+	su_prefetch_free();
+
+	if (mode == SU_WALKMODE_UPDATE)
+		su_poll_end();
+	instances_kept = FALSE;
+
 #ifdef COUNT_ITERATIONS
 	iterations++;
 #endif
@@ -3402,7 +5313,7 @@ bool_t snmp_ups_walk(int mode)
 	return status;
 }
 
-bool_t su_ups_get(snmp_info_t *su_info_p)
+bool_t su_ups_get(const snmp_info_t *su_info_p)
 {
 	static char buf[SU_INFOSIZE];
 	bool_t status;
@@ -3415,14 +5326,19 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 	int index = 0;
 	char *format_char = NULL;
 	int saved_current_device_number = -1;
-	snmp_info_t *tmp_info_p = NULL;
+	snmp_info_t *tmp_info_p = NULL, *cached_info_p;
 
 	upsdebugx(2, "%s: %s %s", __func__, su_info_p->info_type, su_info_p->OID);
 
 	/* Check if this is a daisychain template */
 	if (su_info_p->OID != NULL
 	&&  (format_char = strchr(su_info_p->OID, '%')) != NULL
+	&&  (cached_info_p = su_instance_find(su_info_p, -1)) != NULL
 	) {
+		/* instantiated in an earlier update */
+		su_info_p = cached_info_p;
+	}
+	else if (format_char != NULL) {
 		upsdebugx(3, "%s: calling instantiate_info() for "
 			"daisy-chain template", __func__);
 		tmp_info_p = instantiate_info(su_info_p, tmp_info_p);
@@ -3466,7 +5382,14 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 				return FALSE;
 			}
 
-			su_info_p = tmp_info_p;
+			/* keep it for the next updates */
+			if ((cached_info_p = su_instance_add(su_info_p, -1, tmp_info_p)) != NULL) {
+				free_info(tmp_info_p);
+				tmp_info_p = NULL;
+				su_info_p = cached_info_p;
+			}
+			else
+				su_info_p = tmp_info_p;
 		}
 		else {
 			upsdebugx(2, "%s: can't instantiate template", __func__);
@@ -3651,7 +5574,7 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 			temp = value * su_info_p->info_len;
 		}
 
-		snprintf(buf, sizeof(buf), "%.1f", temp);
+		str_from_double(buf, sizeof(buf), temp, 1);
 		su_setinfo(su_info_p, buf);
 
 		free_info(tmp_info_p);
@@ -3677,9 +5600,10 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 				if (!strcasecmp(su_info_p->info_type, "input.transfer.low")
 				 || !strcasecmp(su_info_p->info_type, "input.transfer.high")) {
 					/* Convert from three phase line-to-line voltage to line-to-neutral voltage */
-					double tmp_dvalue = atof(buf);
+					double tmp_dvalue;
+					str_scan_double(buf, &tmp_dvalue);
 					tmp_dvalue = tmp_dvalue * 0.707;
-					snprintf(buf, sizeof(buf), "%.2f", tmp_dvalue);
+					str_from_double(buf, sizeof(buf), tmp_dvalue, 2);
 				}
 			}
 			/* Check if there is a string reformatting function */
@@ -3694,12 +5618,12 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 			__func__, (format_char!=NULL ? "" : "out"));
 		status = nut_snmp_get_int(su_info_p->OID, &value);
 		if (status == TRUE) {
-			if ((su_info_p->flags&SU_FLAG_NEGINVALID && value<0)
-				|| (su_info_p->flags&SU_FLAG_ZEROINVALID && value==0)) {
-				su_info_p->flags &= ~SU_FLAG_OK;
-				if(su_info_p->flags&SU_FLAG_UNIQUE) {
+			if ((SU_FLAGS(su_info_p)&SU_FLAG_NEGINVALID && value<0)
+				|| (SU_FLAGS(su_info_p)&SU_FLAG_ZEROINVALID && value==0)) {
+				SU_FLAGS(su_info_p) &= ~SU_FLAG_OK;
+				if(SU_FLAGS(su_info_p)&SU_FLAG_UNIQUE) {
 					disable_competition(su_info_p);
-					su_info_p->flags &= ~SU_FLAG_UNIQUE;
+					SU_FLAGS(su_info_p) &= ~SU_FLAG_UNIQUE;
 				}
 				free_info(tmp_info_p);
 				return FALSE;
@@ -3715,9 +5639,9 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 				 */
 				dvalue = value * su_info_p->info_len;
 				if (f_equal((int)dvalue, dvalue))
-					snprintf(buf, sizeof(buf), "%i", (int)dvalue);
+					str_from_long(buf, sizeof(buf), (int)dvalue);
 				else
-					snprintf(buf, sizeof(buf), "%.2f", (float)dvalue);
+					str_from_double(buf, sizeof(buf), (float)dvalue, 2);
 			}
 		}
 	}
@@ -3754,7 +5678,7 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
  */
 static int su_setOID(int mode, const char *varname, const char *val)
 {
-	snmp_info_t *su_info_p = NULL;
+	const snmp_info_t *su_info_p = NULL;
 	bool_t status;
 	int retval = STAT_SET_FAILED;
 	int cmd_offset = 0;	/* FIXME: Does not seem to be actually used! */
@@ -3879,7 +5803,8 @@ static int su_setOID(int mode, const char *varname, const char *val)
 		}
 	} else {
 		/* is indeed an outlet.* or device.x.outlet.* */
-		snmp_info_t	*tmp_info_p;
+		const snmp_info_t	*tmp_info_p;
+		snmp_info_t	*outlet_info_p;
 		/* Point the outlet or outlet group number in the string */
 		const char	*item_number_ptr = NULL;
 		char	*item_varname;
@@ -3922,13 +5847,14 @@ static int su_setOID(int mode, const char *varname, const char *val)
 		free(item_varname);
 
 		/* for an snmp_info_t instance */
-		su_info_p = instantiate_info(tmp_info_p, su_info_p);
+		outlet_info_p = instantiate_info(tmp_info_p, NULL);
+		su_info_p = outlet_info_p;
 
 		/* check if default value is also a template */
 		if ((su_info_p->dfl != NULL) &&
 			(strstr(tmp_info_p->dfl, "%i") != NULL))
 		{
-			su_info_p->dfl = (char *)xmalloc(SU_INFOSIZE);
+			outlet_info_p->dfl = (char *)xmalloc(SU_INFOSIZE);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
 #endif
@@ -3949,7 +5875,7 @@ static int su_setOID(int mode, const char *varname, const char *val)
 			if (mode==SU_MODE_INSTCMD) {
 				/* Workaround buggy Eaton Pulizzi implementation
 				 * which have different offsets index for data & commands! */
-				if (su_info_p->flags & SU_CMD_OFFSET) {
+				if (SU_FLAGS(su_info_p) & SU_CMD_OFFSET) {
 					cmd_offset++;
 					upsdebugx(3, "Adding command offset, now: %i", cmd_offset);
 				}
@@ -3981,7 +5907,7 @@ static int su_setOID(int mode, const char *varname, const char *val)
 				if (devices_count > 1)
 					daisychain_offset = 1;
 
-				if (su_info_p->flags & SU_TYPE_DAISY_1) {
+				if (SU_FLAGS(su_info_p) & SU_TYPE_DAISY_1) {
 					snprintf((char *)su_info_p->OID, SU_INFOSIZE, tmp_info_p->OID,
 						daisychain_device_number - daisychain_offset, item_number);
 				}
@@ -4013,7 +5939,7 @@ static int su_setOID(int mode, const char *varname, const char *val)
 	}
 
 	/* Sanity check */
-	if (!su_info_p || !su_info_p->info_type || !(su_info_p->flags & SU_FLAG_OK)) {
+	if (!su_info_p || !su_info_p->info_type || !(SU_FLAGS(su_info_p) & SU_FLAG_OK)) {
 
 		upsdebugx(2, "%s: info element unavailable %s", __func__, varname);
 
@@ -4109,7 +6035,7 @@ int su_setvar(const char *varname, const char *val)
  * Every command that is valid for a device has to be added for device.0
  * This then allows to composite commands, called on device.0 and executed
  * on all devices of the daisychain */
-int su_addcmd(snmp_info_t *su_info_p)
+int su_addcmd(const snmp_info_t *su_info_p)
 {
 	upsdebugx(2, "entering %s(%s)", __func__, su_info_p->info_type);
 
@@ -139,6 +139,10 @@
 #define DEFAULT_NETSNMP_RETRIES   5
 #define DEFAULT_NETSNMP_TIMEOUT   1    /* in seconds */
 #define DEFAULT_SEMISTATICFREQ    10   /* in snmpwalk update cycles */
+#define DEFAULT_ADAPTIVEFREQ      1    /* in snmpwalk update cycles, 1 = off */
+#define DEFAULT_GETBATCH          20   /* OIDs per GET request in updates */
+#define DEFAULT_MAXREPETITIONS    20   /* rows per GETBULK request in walks */
+#define DEFAULT_WINDOW            4    /* GET requests out at a time in updates */
 
 /* use explicit booleans */
 #ifndef FALSE
@@ -256,10 +260,20 @@ typedef struct {
 	                           * NOTE: With C99+ a "long" is guaranteed to be
 	                           * at least 4 bytes; consider "unsigned long long"
 	                           * when/if we get more than 32 flag values.
+	                           * NOTE: This is only the initial value, the
+	                           * MIB tables are read-only: the driver keeps
+	                           * what it learns from the device aside, so
+	                           * use SU_FLAGS() below.
 	                           */
 	info_lkp_t   *oid2info;   /* lookup table between OID and NUT values */
 } snmp_info_t;
 
+/* The flags of an snmp_info_t entry for the device in hand: the entries of
+ * the MIB tables have theirs in a per-device array, while the instances
+ * made from templates are writable and keep them in place */
+snmp_info_flags_t *su_flags(const snmp_info_t *su_info_p);
+#define SU_FLAGS(t)	(*su_flags(t))
+
 /* Help align with DMF branch codebase until it is merged */
 #if defined WITH_DMF_FUNCTIONS && WITH_DMF_FUNCTIONS
 # if defined WITH_DMF_LUA && WITH_DMF_LUA
@@ -327,7 +341,7 @@ typedef struct {
 /* The following helper macro is used like:
  *   if (SU_TYPE(su_info_p) == SU_TYPE_CMD) { ... }
  */
-#define SU_TYPE(t)			((t)->flags & (7UL << 18))
+#define SU_TYPE(t)			(SU_FLAGS(t) & (7UL << 18))
 
 /* Daisychain template definition */
 /* the following 2 flags specify the position of the daisychain device index
@@ -337,7 +351,7 @@ typedef struct {
 /* "flags" bits 21..23 (and 24 reserved for DMF) */
 #define SU_TYPE_DAISY_1		(1UL << 21)	/* Daisychain index is the 1st %i specifier in a template with more than one */
 #define SU_TYPE_DAISY_2		(1UL << 22)	/* Daisychain index is the 2nd %i specifier in a template with more than one */
-#define SU_TYPE_DAISY(t)	((t)->flags & (11UL << 21))	/* Mask the SU_TYPE_DAISY_{1,2,MASTER_ONLY} but not SU_DAISY */
+#define SU_TYPE_DAISY(t)	(SU_FLAGS(t) & (11UL << 21))	/* Mask the SU_TYPE_DAISY_{1,2,MASTER_ONLY} but not SU_DAISY */
 #define SU_DAISY			(1UL << 23)	/* Daisychain template definition - set at run-time for devices with detected "device.count" over 1 */
 /* NOTE: Previously SU_DAISY had same bit-flag value as SU_TYPE_DAISY_2 */
 #define SU_TYPE_DAISY_MASTER_ONLY	(1UL << 24)	/* Only valid for daisychain master (device.1) */
@@ -368,8 +382,14 @@ typedef struct {
 #define SU_VAR_RETRIES		"snmp_retries"
 #define SU_VAR_TIMEOUT		"snmp_timeout"
 #define SU_VAR_SEMISTATICFREQ	"semistaticfreq"
+#define SU_VAR_ADAPTIVEFREQ	"adaptivefreq"
 #define SU_VAR_MIBS			"mibs"
+#define SU_VAR_MIBDIR		"mibdir"
 #define SU_VAR_POLLFREQ		"pollfreq"
+#define SU_VAR_GETBATCH		"snmp_getbatch"
+#define SU_VAR_MAXREPETITIONS	"snmp_max_repetitions"
+#define SU_VAR_WINDOW		"snmp_window"
+#define SU_VAR_TRAPPORT		"snmp_trap_port"
 /* SNMP v3 related parameters */
 #define SU_VAR_SECLEVEL		"secLevel"
 #define SU_VAR_SECNAME		"secName"
@@ -377,6 +397,7 @@ typedef struct {
 #define SU_VAR_PRIVPASSWD	"privPassword"
 #define SU_VAR_AUTHPROT		"authProtocol"
 #define SU_VAR_PRIVPROT		"privProtocol"
+#define SU_VAR_KEYCACHE		"snmp_keycache"
 
 #define SU_VAR_ONDELAY		"ondelay"
 #define SU_VAR_OFFDELAY		"offdelay"
@@ -411,12 +432,16 @@ typedef struct {
 	const char	*mib_version;
 	const char	*oid_pwr_status;
 	const char	*oid_auto_check;	/* FIXME: rename to SysOID */
-	snmp_info_t	*snmp_info;			/* pointer to the good Snmp2Nut lookup data */
+	const snmp_info_t	*snmp_info;		/* pointer to the good Snmp2Nut lookup data */
 	const char	*sysOID;			/* OID to match against sysOID, aka MIB
 									 * main entry point */
 	alarms_info_t	*alarms_info;
 } mib2nut_info_t;
 
+/* The mappings built into the driver, NULL terminated, in the order they
+ * are tried in with "mibs=auto" (see snmp-ups-mibs.c) */
+extern mib2nut_info_t *mib2nut_builtin[];
+
 /* Common SNMP functions */
 void nut_snmp_init(const char *type, const char *hostname);
 void nut_snmp_cleanup(void);
@@ -437,12 +462,12 @@ void su_startup(void);
 void su_cleanup(void);
 void su_init_instcmds(void);
 void su_setuphandlers(void); /* need to deal with external function ptr */
-void su_setinfo(snmp_info_t *su_info_p, const char *value);
-void su_status_set(snmp_info_t *, long value);
-void su_alarm_set(snmp_info_t *, long value);
-snmp_info_t *su_find_info(const char *type);
+void su_setinfo(const snmp_info_t *su_info_p, const char *value);
+void su_status_set(const snmp_info_t *, long value);
+void su_alarm_set(const snmp_info_t *, long value);
+const snmp_info_t *su_find_info(const char *type);
 bool_t snmp_ups_walk(int mode);
-bool_t su_ups_get(snmp_info_t *su_info_p);
+bool_t su_ups_get(const snmp_info_t *su_info_p);
 
 bool_t load_mib2nut(const char *mib);
 
@@ -495,13 +520,13 @@ extern int semistaticfreq; /* semistatic entry update frequency */
 /* pointer to the Snmp2Nut lookup table */
 extern mib2nut_info_t *mib2nut_info;
 /* FIXME: to be trashed */
-extern snmp_info_t *snmp_info;
+extern const snmp_info_t *snmp_info;
 extern alarms_info_t *alarms_info;
 
 /* Common daisychain structure and functions */
 
 bool_t daisychain_init(void);
-int su_addcmd(snmp_info_t *su_info_p);
+int su_addcmd(const snmp_info_t *su_info_p);
 
 /* Structure containing info about each daisychain device, including phases
  * for input, output and bypass */
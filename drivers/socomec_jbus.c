@@ -29,6 +29,7 @@
 
 #include "main.h"
 #include <modbus.h>
+#include "modbus_bus.h"
 
 #define DRIVER_NAME	"Socomec jbus driver"
 #define DRIVER_VERSION	"0.09"
@@ -487,7 +488,9 @@ static int mrir(modbus_t * arg_ctx, int addr, int nb, uint16_t * dest)
 	}
 
 	/*r = modbus_read_input_registers(arg_ctx, addr, nb, dest);*/
+	modbus_bus_lock(arg_ctx);
 	r = modbus_read_registers(arg_ctx, addr, nb, dest);
+	modbus_bus_unlock(arg_ctx);
 	if (r == -1) {
 		upslogx(LOG_ERR, "mrir: modbus_read_input_registers(addr:%d, count:%d): %s (%s)", addr, nb, modbus_strerror(errno), device_path);
 	}
@@ -44,6 +44,15 @@ static double   io_voltage_scale = 1.0;
 static double   io_frequency_scale = 1.0;
 static double   io_current_scale = 1.0;
 
+/* per device, see addhostvars() */
+static const dstate_hostvar_t tripplite_hostvars[] = {
+	DSTATE_HOSTVAR(battery_scale),
+	DSTATE_HOSTVAR(io_voltage_scale),
+	DSTATE_HOSTVAR(io_frequency_scale),
+	DSTATE_HOSTVAR(io_current_scale),
+	DSTATE_HOSTVAR_END
+};
+
 /* Specific handlers for USB device matching */
 static void *battery_scale_1dot0(USBDevice_t *device)
 {
@@ -299,7 +308,7 @@ static usage_tables_t tripplite_utab[] = {
 /* --------------------------------------------------------------- */
 
 /* HID2NUT lookup table */
-static hid_info_t tripplite_hid2nut[] = {
+static const hid_info_t tripplite_hid2nut[] = {
 
 #if WITH_UNMAPPED_DATA_POINTS || (defined USBHID_UPS_TRIPPLITE_DEBUG)
 
@@ -565,4 +574,5 @@ subdriver_t tripplite_subdriver = {
 	tripplite_format_mfr,
 	tripplite_format_serial,
 	fix_report_desc,
+	tripplite_hostvars,
 };
@@ -29,6 +29,7 @@
 #include <sys/stat.h>
 #ifndef WIN32
 #include <sys/wait.h>
+#include <poll.h>
 #else
 #include "wincompat.h"
 #endif
@@ -45,6 +46,7 @@ typedef struct {
 	char	*upsname;
 	char	*driver;
 	char	*port;
+	char	*hostgroup;	/* one driver process runs all of a group */
 	int	sdorder;
 	int	maxstartdelay;
 	int	exceeded_timeout;
@@ -73,6 +75,9 @@ static int	maxretry = 1;
 	/* timer - delay between each restart attempt of the driver(s) */
 static int	retrydelay = 5;
 
+	/* counter - start that many drivers at a time with "start" for all */
+static int	maxparallel = 1;
+
 	/* Directory where driver executables live */
 static char	*driverpath = NULL;
 
@@ -118,6 +123,9 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 		if (!strcmp(var, "retrydelay"))
 			retrydelay = atoi(val);
 
+		if (!strcmp(var, "maxparallel"))
+			maxparallel = atoi(val);
+
 		if (!strcmp(var, "nowait")) {
 			char * s = getenv("NUT_IGNORE_NOWAIT");
 			if (s && !strcmp(s, "true")) {
@@ -144,6 +152,11 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 			if (!strcmp(var, "port"))
 				tmp->port = xstrdup(val);
 
+			if (!strcmp(var, "hostgroup")) {
+				free(tmp->hostgroup);
+				tmp->hostgroup = xstrdup(val);
+			}
+
 			if (!strcmp(var, "maxstartdelay"))
 				tmp->maxstartdelay = atoi(val);
 
@@ -164,6 +177,7 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 	tmp->upsname = xstrdup(arg_upsname);
 	tmp->driver = NULL;
 	tmp->port = NULL;
+	tmp->hostgroup = NULL;
 	tmp->pid = -1;
 	tmp->next = NULL;
 	tmp->sdorder = 0;
@@ -176,6 +190,9 @@ void do_upsconf_args(char *arg_upsname, char *var, char *val)
 	if (!strcmp(var, "port"))
 		tmp->port = xstrdup(val);
 
+	if (!strcmp(var, "hostgroup"))
+		tmp->hostgroup = xstrdup(val);
+
 	if (last)
 		last->next = tmp;
 	else
@@ -335,32 +352,43 @@ static void signal_driver(const ups_t *ups) {
 	signal_driver_cmd(ups, signal_flag);
 }
 
-/* handle sending the signal */
-static void stop_driver(const ups_t *ups)
+#ifndef WIN32
+/* a driver being stopped by stop_drivers() */
+typedef struct {
+	const ups_t	*ups;
+	char	pidfn[SMALLBUF];	/* or "PID <n>" for our own children */
+	nut_proc_t	proc;
+	int	killed;	/* got SIGKILL: will not clean up after itself */
+	int	done;
+} stop_job_t;
+
+/* find the driver process and check it once, returns 0 if it is to be
+ * signalled, -1 if not (errors are counted already) */
+static int stop_job_open(stop_job_t *job)
 {
-	char	pidfn[SMALLBUF];
-	int	ret, i;
+	const ups_t	*ups = job->ups;
+	pid_t	pid;
+	int	ret;
 
 	upsdebugx(1, "Stopping UPS: %s", ups->upsname);
 
-#ifndef WIN32
 	if (ups->pid == -1) {
 		struct stat	fs;
-		snprintf(pidfn, sizeof(pidfn), "%s/%s-%s.pid", altpidpath(),
+		snprintf(job->pidfn, sizeof(job->pidfn), "%s/%s-%s.pid", altpidpath(),
 			ups->driver, ups->upsname);
-		ret = stat(pidfn, &fs);
+		ret = stat(job->pidfn, &fs);
 
 		if ((ret != 0) && (ups->port != NULL)) {
-			upslog_with_errno(LOG_ERR, "Can't open %s", pidfn);
-			snprintf(pidfn, sizeof(pidfn), "%s/%s-%s.pid", altpidpath(),
+			upslog_with_errno(LOG_ERR, "Can't open %s", job->pidfn);
+			snprintf(job->pidfn, sizeof(job->pidfn), "%s/%s-%s.pid", altpidpath(),
 				ups->driver, xbasename(ups->port));
-			ret = stat(pidfn, &fs);
+			ret = stat(job->pidfn, &fs);
 		}
 
 		if (ret != 0) {
-			upslog_with_errno(LOG_ERR, "Can't open %s either", pidfn);
+			upslog_with_errno(LOG_ERR, "Can't open %s either", job->pidfn);
 			exec_error++;
-			return;
+			return -1;
 		}
 	} else {
 		/* We started the driver in this run of upsdrvctl
@@ -368,50 +396,204 @@ static void stop_driver(const ups_t *ups)
 		 * NOTE: Not a filename here, but using same variable
 		 * name makes the code below simpler to maintain.
 		 */
-		snprintf(pidfn, sizeof(pidfn), "PID %" PRIdMAX, (intmax_t)ups->pid);
+		snprintf(job->pidfn, sizeof(job->pidfn), "PID %" PRIdMAX, (intmax_t)ups->pid);
 	}
-#else
-	snprintf(pidfn, sizeof(pidfn), "%s-%s", ups->driver, ups->upsname);
-#endif
 
-	upsdebugx(2, "Sending signal to %s", pidfn);
+	upsdebugx(2, "Sending signal to %s", job->pidfn);
 
 	if (testmode)
-		return;
+		return -1;
+
+	pid = (ups->pid == -1) ? parsepidfile(job->pidfn) : ups->pid;
+	if (pid < 0 || nut_proc_open(&job->proc, pid, ups->driver, 0) < 0) {
+		/* reap zombie if this child died */
+		if (ups->pid != -1 && waitpid(ups->pid, NULL, WNOHANG) == ups->pid)
+			return -1;
+
+		upslog_with_errno(LOG_ERR, "Stopping %s failed", job->pidfn);
+		exec_error++;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* is the driver gone (and reaped, if it is our child)? */
+static int stop_job_gone(stop_job_t *job)
+{
+	/* reap zombie if this child died */
+	if (job->ups->pid != -1
+	 && waitpid(job->ups->pid, NULL, WNOHANG) == job->ups->pid
+	) {
+		return 1;
+	}
+
+	if (nut_proc_signal(&job->proc, 0) != 0) {
+		upsdebugx(2, "Sending signal to %s failed, driver is finally down or wrongly owned", job->pidfn);
+		/* While a TERMinated driver cleans up,
+		 * a stuck and KILLed one does not, so:
+		 */
+		if (job->killed && job->ups->pid == -1) {
+			unlink(job->pidfn);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/* wait up to <seconds> for all the drivers to go, returns how many did not;
+ * with pidfds, poll() wakes us up as soon as one of them exits */
+static size_t stop_jobs_wait(stop_job_t *jobs, size_t count, int seconds)
+{
+	struct pollfd	*fds = xcalloc(count, sizeof(*fds));
+	time_t	deadline = time(NULL) + seconds;
+	size_t	i, left;
+	nfds_t	nfds;
+
+	for (;;) {
+		left = 0;
+		nfds = 0;
+
+		for (i = 0; i < count; i++) {
+			if (jobs[i].done)
+				continue;
+
+			if (stop_job_gone(&jobs[i])) {
+				jobs[i].done = 1;
+				continue;
+			}
+
+			left++;
+			if (jobs[i].proc.pidfd >= 0) {
+				fds[nfds].fd = jobs[i].proc.pidfd;
+				fds[nfds].events = POLLIN;
+				nfds++;
+			}
+		}
+
+		if (!left || time(NULL) >= deadline)
+			break;
+
+		if (nfds == left) {
+			poll(fds, nfds, 1000);
+		} else {
+			sleep(1);
+		}
+	}
+
+	free(fds);
+	return left;
+}
+
+/* Stop several drivers at once: each is checked once, all of them get
+ * SIGTERM, and then we wait for all of them together (rather than for
+ * one after another), before the stragglers get SIGKILL */
+static void stop_drivers(const ups_t **list, size_t count)
+{
+	stop_job_t	*jobs = xcalloc(count, sizeof(*jobs));
+	size_t	i, n = 0;
 
 	/* Hush the fopen(pidfile) message but let "real errors" be seen */
 	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING - 1;
 
-#ifndef WIN32
-	if (ups->pid == -1) {
-		ret = sendsignalfn(pidfn, SIGTERM, ups->driver, 0);
-	} else {
-		ret = sendsignalpid(ups->pid, SIGTERM, ups->driver, 0);
+	for (i = 0; i < count; i++) {
+		jobs[n].ups = list[i];
+		if (stop_job_open(&jobs[n]) == 0)
+			n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		stop_job_t	*job = &jobs[i];
+
+		if (nut_proc_signal(&job->proc, SIGTERM) == 0)
+			continue;
+
 		/* reap zombie if this child died */
-		if (waitpid(ups->pid, NULL, WNOHANG) == ups->pid) {
-			goto clean_return;
+		if (job->ups->pid != -1
+		 && waitpid(job->ups->pid, NULL, WNOHANG) == job->ups->pid
+		) {
+			job->done = 1;
+			continue;
 		}
+
+		upsdebugx(2, "SIGTERM to %s failed, retrying with SIGKILL", job->pidfn);
+		if (nut_proc_signal(&job->proc, SIGKILL) == 0) {
+			job->killed = 1;
+			continue;
+		}
+
+		upslog_with_errno(LOG_ERR, "Stopping %s failed", job->pidfn);
+		exec_error++;
+		job->done = 1;
 	}
-#else
-	ret = sendsignal(pidfn, COMMAND_STOP, 0);
-#endif
 
-	if (ret < 0) {
-#ifndef WIN32
-		upsdebugx(2, "SIGTERM to %s failed, retrying with SIGKILL", pidfn);
-		if (ups->pid == -1) {
-			ret = sendsignalfn(pidfn, SIGKILL, ups->driver, 0);
-		} else {
-			ret = sendsignalpid(ups->pid, SIGKILL, ups->driver, 0);
-			/* reap zombie if this child died */
-			if (waitpid(ups->pid, NULL, WNOHANG) == ups->pid) {
-				goto clean_return;
+	if (n && stop_jobs_wait(jobs, n, 5) > 0) {
+		for (i = 0; i < n; i++) {
+			stop_job_t	*job = &jobs[i];
+
+			if (job->done)
+				continue;
+
+			upslog_with_errno(LOG_ERR, "Stopping %s failed, retrying harder", job->pidfn);
+			if (nut_proc_signal(&job->proc, SIGKILL) == 0) {
+				job->killed = 1;
+				continue;
 			}
+
+			upslog_with_errno(LOG_ERR, "Stopping %s failed", job->pidfn);
+			exec_error++;
+			job->done = 1;
 		}
-#else
+
+		stop_jobs_wait(jobs, n, 5);
+
+		for (i = 0; i < n; i++) {
+			if (!jobs[i].done) {
+				upslog_with_errno(LOG_ERR, "Stopping %s failed", jobs[i].pidfn);
+				exec_error++;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		nut_proc_close(&jobs[i].proc);
+	}
+	free(jobs);
+
+	/* Restore the signal errors verbosity */
+	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_DEFAULT;
+}
+
+/* handle sending the signal */
+static void stop_driver(const ups_t *ups)
+{
+	stop_drivers(&ups, 1);
+}
+#else	/* WIN32 */
+/* handle sending the signal */
+static void stop_driver(const ups_t *ups)
+{
+	char	pidfn[SMALLBUF];
+	int	ret, i;
+
+	upsdebugx(1, "Stopping UPS: %s", ups->upsname);
+
+	snprintf(pidfn, sizeof(pidfn), "%s-%s", ups->driver, ups->upsname);
+
+	upsdebugx(2, "Sending signal to %s", pidfn);
+
+	if (testmode)
+		return;
+
+	/* Hush the fopen(pidfile) message but let "real errors" be seen */
+	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING - 1;
+
+	ret = sendsignal(pidfn, COMMAND_STOP, 0);
+
+	if (ret < 0) {
 		upsdebugx(2, "Stopping %s failed, retrying again", pidfn);
 		ret = sendsignal(pidfn, COMMAND_STOP, 0);
-#endif
 		if (ret < 0) {
 			upslog_with_errno(LOG_ERR, "Stopping %s failed", pidfn);
 			exec_error++;
@@ -420,19 +602,7 @@ static void stop_driver(const ups_t *ups)
 	}
 
 	for (i = 0; i < 5 ; i++) {
-#ifndef WIN32
-		if (ups->pid == -1) {
-			ret = sendsignalfn(pidfn, 0, ups->driver, 0);
-		} else {
-			/* reap zombie if this child died */
-			if (waitpid(ups->pid, NULL, WNOHANG) == ups->pid) {
-				goto clean_return;
-			}
-			ret = sendsignalpid(ups->pid, 0, ups->driver, 0);
-		}
-#else
 		ret = sendsignalfn(pidfn, 0, ups->driver, 0);
-#endif
 		if (ret != 0) {
 			upsdebugx(2, "Sending signal to %s failed, driver is finally down or wrongly owned", pidfn);
 			goto clean_return;
@@ -440,44 +610,13 @@ static void stop_driver(const ups_t *ups)
 		sleep(1);
 	}
 
-#ifndef WIN32
-	upslog_with_errno(LOG_ERR, "Stopping %s failed, retrying harder", pidfn);
-	if (ups->pid == -1) {
-		ret = sendsignalfn(pidfn, SIGKILL, ups->driver, 0);
-	} else {
-		/* reap zombie if this child died */
-		if (waitpid(ups->pid, NULL, WNOHANG) == ups->pid) {
-			goto clean_return;
-		}
-		ret = sendsignalpid(ups->pid, SIGKILL, ups->driver, 0);
-	}
-#else
 	upslog_with_errno(LOG_ERR, "Stopping %s failed, retrying again", pidfn);
 	ret = sendsignal(pidfn, COMMAND_STOP, 0);
-#endif
 	if (ret == 0) {
 		for (i = 0; i < 5 ; i++) {
-#ifndef WIN32
-			if (ups->pid == -1) {
-				ret = sendsignalfn(pidfn, 0, ups->driver, 0);
-			} else {
-				/* reap zombie if this child died */
-				if (waitpid(ups->pid, NULL, WNOHANG) == ups->pid) {
-					goto clean_return;
-				}
-				ret = sendsignalpid(ups->pid, 0, ups->driver, 0);
-			}
-#else
 			ret = sendsignalfn(pidfn, 0, ups->driver, 0);
-#endif
 			if (ret != 0) {
 				upsdebugx(2, "Sending signal to %s failed, driver is finally down or wrongly owned", pidfn);
-				/* While a TERMinated driver cleans up,
-				 * a stuck and KILLed one does not, so:
-				 */
-				if (ups->pid == -1) {
-					unlink(pidfn);
-				}
 				goto clean_return;
 			}
 			sleep(1);
@@ -491,6 +630,7 @@ clean_return:
 	/* Restore the signal errors verbosity */
 	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_DEFAULT;
 }
+#endif	/* WIN32 */
 
 void set_exit_flag(const int sig)
 {
@@ -811,13 +951,13 @@ static void list_driver(const ups_t *ups)
 	printf("%s\n", ups->upsname);
 }
 
-static void status_driver(const ups_t *ups)
+/* query the driver of ups and make its line of the status table */
+static void status_line(const ups_t *ups, char *line, size_t linelen)
 {
 	/* TODO: Options (global static) for details of configuration like
 	 * the driver name, serial, etc. or even current life-cycle status
 	 * (e.g. valid PID existence, data query via socket protocol...)
 	 */
-	static int	headerShown = 0;
 #ifndef WIN32
 	char	pidfn[SMALLBUF];
 	int	cmdret = -1;
@@ -832,11 +972,6 @@ static void status_driver(const ups_t *ups)
 	struct timeval	tv;
 	udq_pipe_conn_t	*conn;
 
-	if (!ups) {
-		upsdebugx(1, "%s: skip due to ups==null", __func__);
-		return;
-	}
-
 	/* Hush the fopen(pidfile) message but let "real errors" be seen */
 	nut_sendsignal_debug_level = NUT_SENDSIGNAL_DEBUG_LEVEL_KILL_SIG0PING - 1;
 #ifndef WIN32
@@ -979,6 +1114,31 @@ static void status_driver(const ups_t *ups)
 			__func__, (intmax_t)pidFromSocket, pidAlive);
 	}
 
+	upsdebugx(2, "%s: raw values: pidAlive=%d "
+		"pidFromFile=%" PRIiMAX " pidFromSocket=%" PRIiMAX " "
+		"qretPing=%d qretPid=%d qretStatus=%d",
+		__func__, pidAlive,
+		(intmax_t)(pidFromFile), (intmax_t)(pidFromSocket),
+		qretPing, qretPid, qretStatus
+		);
+
+	snprintf(line, linelen, "%-11s\t%11s\t%s\t%" PRIiMAX "\t%s\t%s\t%s\n",
+		ups->upsname, ups->driver,
+		((pidFromFile < 0 && pidFromSocket < 0) || (pidAlive < 0)
+		 ? "N/A" : (pidAlive > 0 ? "RUNNING" : "STOPPED")),
+		(intmax_t)(pidFromFile),
+		((qretPing == STAT_INSTCMD_HANDLED) ? "RESPONSIVE" : "NOT_RESPONSIVE"),
+		(pidStrFromSocket ? pidStrFromSocket : "N/A"),
+		((qretStatus == STAT_INSTCMD_HANDLED) ? NUT_STRARG(statusStrFromSocket) : "")
+		);
+
+	nut_sendsignal_debug_level = nsdl;
+}
+
+static void status_print(const char *line)
+{
+	static int	headerShown = 0;
+
 	/* Complete any cached (error) writes before the next lines,
 	 * more so on WIN32 */
 	fflush(stderr);
@@ -998,42 +1158,210 @@ static void status_driver(const ups_t *ups)
 		headerShown = 1;
 	}
 
-	upsdebugx(2, "%s: raw values: pidAlive=%d "
-		"pidFromFile=%" PRIiMAX " pidFromSocket=%" PRIiMAX " "
-		"qretPing=%d qretPid=%d qretStatus=%d",
-		__func__, pidAlive,
-		(intmax_t)(pidFromFile), (intmax_t)(pidFromSocket),
-		qretPing, qretPid, qretStatus
-		);
+	fputs(line, stdout);
+	fflush(stdout);
+}
 
-	printf("%-11s\t%11s\t%s\t%" PRIiMAX "\t%s\t%s\t%s\n",
-		ups->upsname, ups->driver,
-		((pidFromFile < 0 && pidFromSocket < 0) || (pidAlive < 0)
-		 ? "N/A" : (pidAlive > 0 ? "RUNNING" : "STOPPED")),
-		(intmax_t)(pidFromFile),
-		((qretPing == STAT_INSTCMD_HANDLED) ? "RESPONSIVE" : "NOT_RESPONSIVE"),
-		(pidStrFromSocket ? pidStrFromSocket : "N/A"),
-		((qretStatus == STAT_INSTCMD_HANDLED) ? NUT_STRARG(statusStrFromSocket) : "")
-		);
+static void status_driver(const ups_t *ups)
+{
+	char	line[LARGEBUF];
+
+	if (!ups) {
+		upsdebugx(1, "%s: skip due to ups==null", __func__);
+		return;
+	}
+
+	status_line(ups, line, sizeof(line));
+	status_print(line);
+}
+
+#ifndef WIN32
+/* a driver being queried by status_drivers_parallel() */
+typedef struct {
+	const ups_t	*ups;
+	pid_t	pid;
+	int	fd;	/* where the child writes its line */
+	char	line[LARGEBUF];
+	size_t	len;
+	int	done;
+} status_job_t;
+
+static void status_job_run(status_job_t *job)
+{
+	int	fds[2];
+	pid_t	pid;
+
+	/* nothing buffered is to be printed twice */
 	fflush(stdout);
+	fflush(stderr);
 
-	nut_sendsignal_debug_level = nsdl;
+	if (pipe(fds) != 0 || (pid = fork()) < 0) {
+		upsdebug_with_errno(1, "%s: querying %s here", __func__, job->ups->upsname);
+		/* (not closing the pipe of a failed fork, as we exit soon) */
+		status_line(job->ups, job->line, sizeof(job->line));
+		job->done = 1;
+		return;
+	}
+
+	if (pid == 0) {
+		size_t	len, sent = 0;
+		ssize_t	ret;
+
+		close(fds[0]);
+		status_line(job->ups, job->line, sizeof(job->line));
+		len = strlen(job->line);
+
+		while (sent < len) {
+			ret = write(fds[1], job->line + sent, len - sent);
+			if (ret <= 0)
+				_exit(EXIT_FAILURE);
+			sent += (size_t)ret;
+		}
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	job->pid = pid;
+	job->fd = fds[0];
 }
 
-static void start_driver(const ups_t *ups)
+/* query all drivers, up to maxparallel at a time (each query may wait
+ * several seconds for a driver which does not answer), and print their
+ * lines in the order of ups.conf as they become available */
+static void status_drivers_parallel(void)
+{
+	status_job_t	*jobs = xcalloc((size_t)upscount, sizeof(*jobs));
+	struct pollfd	*fds = xcalloc((size_t)upscount, sizeof(*fds));
+	status_job_t	**polled = xcalloc((size_t)upscount, sizeof(*polled));
+	ups_t	*ups;
+	int	numjobs = 0, next = 0, shown = 0, running = 0, i;
+	nfds_t	nfds;
+	ssize_t	ret;
+
+	for (ups = upstable; ups && numjobs < upscount; ups = ups->next) {
+		jobs[numjobs].ups = ups;
+		jobs[numjobs].fd = -1;
+		numjobs++;
+	}
+
+	upsdebugx(1, "Querying %d drivers, up to %d at a time", numjobs, maxparallel);
+
+	for (;;) {
+		while (running < maxparallel && next < numjobs) {
+			status_job_run(&jobs[next]);
+			if (!jobs[next].done)
+				running++;
+			next++;
+		}
+
+		while (shown < numjobs && jobs[shown].done) {
+			status_print(jobs[shown].line);
+			shown++;
+		}
+
+		if (shown >= numjobs)
+			break;
+
+		nfds = 0;
+		for (i = 0; i < next; i++) {
+			if (jobs[i].done || jobs[i].fd < 0)
+				continue;
+			fds[nfds].fd = jobs[i].fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			polled[nfds] = &jobs[i];
+			nfds++;
+		}
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		for (i = 0; (nfds_t)i < nfds; i++) {
+			status_job_t	*job = polled[i];
+
+			if (!fds[i].revents)
+				continue;
+
+			ret = read(job->fd, job->line + job->len,
+				sizeof(job->line) - 1 - job->len);
+			if (ret > 0) {
+				job->len += (size_t)ret;
+				if (job->len < sizeof(job->line) - 1)
+					continue;
+			}
+
+			/* all of it, or as much as we keep */
+			job->line[job->len] = '\0';
+			close(job->fd);
+			job->fd = -1;
+			waitpid(job->pid, NULL, 0);
+
+			if (!job->len) {
+				snprintf(job->line, sizeof(job->line),
+					"%-11s\t%11s\t%s\n", job->ups->upsname,
+					job->ups->driver, "N/A");
+				exec_error++;
+			}
+
+			job->done = 1;
+			running--;
+		}
+	}
+
+	free(polled);
+	free(fds);
+	free(jobs);
+}
+#endif	/* !WIN32 */
+
+/* the UPS whose driver process also runs this one: the first section
+ * of the same hostgroup and driver, or the UPS itself */
+static ups_t *hostgroup_leader(ups_t *ups)
+{
+	ups_t	*tmp;
+
+	if (!ups->hostgroup || !ups->driver)
+		return ups;
+
+	for (tmp = upstable; tmp != ups; tmp = tmp->next) {
+		if (tmp->hostgroup && tmp->driver
+		 && !strcmp(tmp->hostgroup, ups->hostgroup)
+		 && !strcmp(tmp->driver, ups->driver)
+		) {
+			return tmp;
+		}
+	}
+
+	return ups;
+}
+
+/* the command line to start the driver of this UPS (and of the rest of
+ * its hostgroup), tied off and to be freed by the caller, with the strings
+ * made up for it in dfn and dbg */
+static char **driver_cmdline(ups_t *ups,
+	char *dfn, size_t dfnsize, char *dbg, size_t dbgsize)
 {
-	char	*argv[10];
-	char	dfn[SMALLBUF], dbg[SMALLBUF];
 	int	ret, arg = 0;
-	int	initial_exec_error = exec_error, initial_exec_timeout = exec_timeout, drv_maxretry = maxretry;
+	size_t	members = 1;
 	struct stat	fs;
+	char	**argv;
+	ups_t	*tmp;
 
-	upsdebugx(1, "Starting UPS: %s", ups->upsname);
+	for (tmp = ups->next; tmp; tmp = tmp->next) {
+		if (tmp->hostgroup && hostgroup_leader(tmp) == ups)
+			members++;
+	}
+
+	argv = xcalloc(8 + 2 * members, sizeof(*argv));
 
 #ifndef WIN32
-	snprintf(dfn, sizeof(dfn), "%s/%s", driverpath, ups->driver);
+	snprintf(dfn, dfnsize, "%s/%s", driverpath, ups->driver);
 #else
-	snprintf(dfn, sizeof(dfn), "%s/%s.exe", driverpath, ups->driver);
+	snprintf(dfn, dfnsize, "%s/%s.exe", driverpath, ups->driver);
 #endif
 	ret = stat(dfn, &fs);
 
@@ -1044,12 +1372,12 @@ static void start_driver(const ups_t *ups)
 
 	if (nut_debug_level_passthrough > 0
 	&&  nut_debug_level > 0
-	&&  sizeof(dbg) > 3
+	&&  dbgsize > 3
 	) {
 		size_t d, m;
 
 		/* cut-off point: buffer size or requested debug level */
-		m = sizeof(dbg) - 1;	/* leave a place for '\0' */
+		m = dbgsize - 1;	/* leave a place for '\0' */
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
@@ -1125,6 +1453,13 @@ static void start_driver(const ups_t *ups)
 	argv[arg++] = (char *)"-a";		/* FIXME: cast away const */
 	argv[arg++] = ups->upsname;
 
+	for (tmp = ups->next; tmp && members > 1; tmp = tmp->next) {
+		if (tmp->hostgroup && hostgroup_leader(tmp) == ups) {
+			argv[arg++] = (char *)"-a";	/* FIXME: cast away const */
+			argv[arg++] = tmp->upsname;
+		}
+	}
+
 	/* stick on the chroot / user args if given to us */
 	if (pt_root) {
 		argv[arg++] = (char *)"-r";	/* FIXME: cast away const */
@@ -1139,6 +1474,24 @@ static void start_driver(const ups_t *ups)
 	/* tie it off */
 	argv[arg++] = NULL;
 
+	return argv;
+}
+
+static void start_driver(const ups_t *arg_ups)
+{
+	char	**argv;
+	char	dfn[SMALLBUF], dbg[SMALLBUF];
+	int	initial_exec_error = exec_error, initial_exec_timeout = exec_timeout, drv_maxretry = maxretry;
+	ups_t	*ups = hostgroup_leader((ups_t *)arg_ups);	/* FIXME: cast away const */
+
+	if (ups != arg_ups) {
+		upslogx(LOG_INFO, "UPS %s is in hostgroup %s, run by the driver of %s",
+			arg_ups->upsname, arg_ups->hostgroup, ups->upsname);
+	}
+
+	upsdebugx(1, "Starting UPS: %s", ups->upsname);
+
+	argv = driver_cmdline(ups, dfn, sizeof(dfn), dbg, sizeof(dbg));
 
 	while (drv_maxretry > 0) {
 		int cur_exec_error = exec_error;
@@ -1165,7 +1518,286 @@ static void start_driver(const ups_t *ups)
 					sleep ((unsigned int)retrydelay);
 		}
 	}
+
+	free(argv);
+}
+
+#ifndef WIN32
+/* a driver being started by start_drivers_parallel() */
+typedef struct {
+	ups_t	*ups;
+	int	attempts;	/* left, see maxretry */
+	int	running;
+	time_t	deadline;	/* of the running attempt, 0 = none */
+	time_t	retry_at;	/* of the next attempt, see retrydelay */
+	int	result;		/* 0 = pending, 1 = started, -1 = failed, -2 = timed out */
+} start_job_t;
+
+static void start_job_run(start_job_t *job, time_t now)
+{
+	char	**argv;
+	char	dfn[SMALLBUF], dbg[SMALLBUF];
+	int	delay = (job->ups->maxstartdelay != -1 ? job->ups->maxstartdelay : maxstartdelay);
+	pid_t	pid;
+
+	upsdebugx(1, "Starting UPS: %s", job->ups->upsname);
+
+	argv = driver_cmdline(job->ups, dfn, sizeof(dfn), dbg, sizeof(dbg));
+
+	upsdebugx(2, "%i remaining attempts", job->attempts);
+	debugcmdline(2, "exec: ", argv);
+	job->attempts--;
+
+	if (testmode) {
+		free(argv);
+		job->result = 1;
+		return;
+	}
+
+	pid = fork();
+
+	if (pid < 0)
+		fatal_with_errno(EXIT_FAILURE, "fork");
+
+	if (pid == 0) {
+		int	ret = execv(argv[0], argv);
+
+		/* shouldn't get here normally */
+		upsdebugx(1, "%s: execv returned %d", __func__, ret);
+		fatal_with_errno(EXIT_FAILURE, "execv");
+	}
+
+	free(argv);
+
+	job->ups->pid = pid;
+	job->ups->exceeded_timeout = 0;
+	job->running = 1;
+	job->deadline = (delay >= 0 ? now + delay : 0);
+}
+
+/* an attempt did not work out: try again later, or give up */
+static void start_job_failed(start_job_t *job, time_t now, int result)
+{
+	job->running = 0;
+
+	if (job->attempts > 0) {
+		job->retry_at = now + (retrydelay >= 0 ? retrydelay : 0);
+		return;
+	}
+
+	job->result = result;
+
+	if (result == -2) {
+		job->ups->exceeded_timeout = 1;
+		exec_timeout++;
+	} else {
+		exec_error++;
+	}
+}
+
+/* the driver which was started as pid has backgrounded itself (or not) */
+static void start_job_reap(start_job_t *jobs, int numjobs, pid_t pid, int wstat, time_t now)
+{
+	int	i;
+	start_job_t	*job = NULL;
+
+	for (i = 0; i < numjobs; i++) {
+		if (jobs[i].running && jobs[i].ups->pid == pid) {
+			job = &jobs[i];
+			break;
+		}
+	}
+
+	if (!job) {
+		/* one which exceeded maxstartdelay after its last attempt
+		 * is done now; main() would revise it otherwise */
+		for (i = 0; i < numjobs; i++) {
+			if (jobs[i].result == -2 && jobs[i].ups->pid == pid) {
+				job = &jobs[i];
+				break;
+			}
+		}
+
+		if (!job) {
+			/* an earlier attempt of a driver tried again since */
+			upsdebugx(2, "%s: PID %" PRIdMAX " is not waited for any more",
+				__func__, (intmax_t)pid);
+			return;
+		}
+
+		job->ups->exceeded_timeout = 0;
+
+		if (WIFEXITED(wstat) && WEXITSTATUS(wstat) == 0) {
+			upsdebugx(1, "Driver [%s] initially exceeded maxstartdelay "
+				"but has finished by now", job->ups->upsname);
+			job->result = 1;
+		} else {
+			upslogx(LOG_WARNING, "Driver [%s] initially exceeded maxstartdelay "
+				"and has failed to start by now", job->ups->upsname);
+			job->result = -1;
+			exec_error++;
+		}
+		return;
+	}
+
+	if (WIFEXITED(wstat) == 0) {
+		upslogx(LOG_WARNING, "Driver [%s] exited abnormally",
+			job->ups->upsname);
+		start_job_failed(job, now, -1);
+		return;
+	}
+
+	if (WEXITSTATUS(wstat) != 0) {
+		upslogx(LOG_WARNING, "Driver [%s] failed to start"
+			" (exit status=%d)", job->ups->upsname, WEXITSTATUS(wstat));
+		start_job_failed(job, now, -1);
+		return;
+	}
+
+	upsdebugx(1, "Driver [%s] started", job->ups->upsname);
+	job->running = 0;
+	job->result = 1;
+}
+
+/* start all drivers, up to maxparallel at a time, each with its own
+ * maxstartdelay and maxretry attempts, and sum it up at the end */
+static void start_drivers_parallel(void)
+{
+	start_job_t	*jobs;
+	ups_t	*ups;
+	int	i, numjobs = 0, running = 0, pending, started = 0, failed = 0, timedout = 0;
+	struct sigaction	sa;
+
+	jobs = xcalloc((size_t)upscount, sizeof(*jobs));
+
+	for (ups = upstable; ups && numjobs < upscount; ups = ups->next) {
+		if (hostgroup_leader(ups) != ups)
+			continue;	/* started along with its hostgroup */
+		jobs[numjobs].ups = ups;
+		jobs[numjobs].attempts = maxretry;
+		numjobs++;
+	}
+
+	upsdebugx(1, "Starting %d drivers, up to %d at a time", numjobs, maxparallel);
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = waitpid_timeout;
+	sigaction(SIGALRM, &sa, NULL);
+
+	for (;;) {
+		time_t	now, wake = 0;
+		pid_t	pid;
+		int	wstat;
+
+		time(&now);
+
+		/* those which ran out of time count as failed attempts */
+		for (i = 0; i < numjobs; i++) {
+			if (jobs[i].running && jobs[i].deadline && jobs[i].deadline <= now) {
+				upslogx(LOG_WARNING, "Startup timer elapsed for driver [%s], continuing...",
+					jobs[i].ups->upsname);
+				running--;
+				start_job_failed(&jobs[i], now, -2);
+			}
+		}
+
+		/* fill the free slots */
+		pending = 0;
+		for (i = 0; i < numjobs; i++) {
+			start_job_t	*job = &jobs[i];
+
+			if (job->result || job->running || job->attempts <= 0) {
+				continue;
+			}
+
+			if (job->retry_at > now || running >= maxparallel) {
+				pending++;
+				if (job->retry_at > now && (!wake || job->retry_at < wake)) {
+					wake = job->retry_at;
+				}
+				continue;
+			}
+
+			start_job_run(job, now);
+			if (job->running) {
+				running++;
+			}
+		}
+
+		if (!running && !pending) {
+			break;
+		}
+
+		for (i = 0; i < numjobs; i++) {
+			if (jobs[i].running && jobs[i].deadline
+			 && (!wake || jobs[i].deadline < wake)
+			) {
+				wake = jobs[i].deadline;
+			}
+		}
+
+		if (!running) {
+			/* only retries to wait for */
+			sleep((unsigned int)(wake - now));
+			continue;
+		}
+
+		if (wake) {
+			alarm((unsigned int)(wake > now ? wake - now : 1));
+		}
+
+		pid = waitpid(-1, &wstat, 0);
+
+		alarm(0);
+
+		if (pid > 0) {
+			for (i = 0; i < numjobs; i++) {
+				if (jobs[i].running && jobs[i].ups->pid == pid) {
+					running--;
+					break;
+				}
+			}
+			start_job_reap(jobs, numjobs, pid, wstat, time(NULL));
+		} else if (errno == ECHILD) {
+			/* should not happen, but do not wait forever */
+			for (i = 0; i < numjobs; i++) {
+				if (jobs[i].running) {
+					start_job_failed(&jobs[i], now, -1);
+				}
+			}
+			running = 0;
+		}
+	}
+
+	for (i = 0; i < numjobs; i++) {
+		switch (jobs[i].result) {
+			case 1:
+				started++;
+				break;
+			case -2:
+				upslogx(LOG_WARNING, "Driver [%s] did not finish starting "
+					"within maxstartdelay", jobs[i].ups->upsname);
+				timedout++;
+				break;
+			case -1:
+				upslogx(LOG_WARNING, "Driver [%s] failed to start",
+					jobs[i].ups->upsname);
+				failed++;
+				break;
+			default:
+				/* maxretry 0 */
+				break;
+		}
+	}
+
+	upslogx((failed || timedout) ? LOG_WARNING : LOG_INFO,
+		"Started %d of %d drivers (%d failed, %d timed out)",
+		started, numjobs, failed, timedout);
+
+	free(jobs);
 }
+#endif	/* !WIN32 */
 
 static void help(const char *progname)
 	__attribute__((noreturn));
@@ -1245,18 +1877,15 @@ static void help(const char *arg_progname)
 	exit(EXIT_SUCCESS);
 }
 
-static void shutdown_driver(const ups_t *ups)
+/* the command line (in argv of 9) to have the driver of ups shut it down */
+static void shutdown_cmdline(const ups_t *ups, char **argv, char *dfn, size_t dfnlen)
 {
-	char	*argv[9];
-	char	dfn[SMALLBUF];
 	int	arg = 0;
 
-	upsdebugx(1, "Shutdown UPS: %s", ups->upsname);
-
 #ifndef WIN32
-	snprintf(dfn, sizeof(dfn), "%s/%s", driverpath, ups->driver);
+	snprintf(dfn, dfnlen, "%s/%s", driverpath, ups->driver);
 #else
-	snprintf(dfn, sizeof(dfn), "%s/%s.exe", driverpath, ups->driver);
+	snprintf(dfn, dfnlen, "%s/%s.exe", driverpath, ups->driver);
 #endif
 
 	argv[arg++] = dfn;
@@ -1276,6 +1905,16 @@ static void shutdown_driver(const ups_t *ups)
 	}
 
 	argv[arg++] = NULL;
+}
+
+static void shutdown_driver(const ups_t *ups)
+{
+	char	*argv[9];
+	char	dfn[SMALLBUF];
+
+	upsdebugx(1, "Shutdown UPS: %s", ups->upsname);
+
+	shutdown_cmdline(ups, argv, dfn, sizeof(dfn));
 
 	debugcmdline(2, "exec: ", argv);
 
@@ -1284,6 +1923,140 @@ static void shutdown_driver(const ups_t *ups)
 	}
 }
 
+#ifndef WIN32
+/* run the shutdown of several UPSes (of one sdorder) at once, up to
+ * maxparallel at a time, each within its maxstartdelay like forkexec()
+ * waits for one; returns once all of them are done or timed out */
+static void shutdown_drivers_parallel(ups_t **list, int count)
+{
+	time_t	*deadline = xcalloc((size_t)count, sizeof(*deadline));
+	int	*waiting = xcalloc((size_t)count, sizeof(*waiting));
+	int	next = 0, running = 0, i;
+	struct sigaction	sa;
+
+	upsdebugx(1, "Shutting down %d UPSes, up to %d at a time", count, maxparallel);
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = waitpid_timeout;
+	sigaction(SIGALRM, &sa, NULL);
+
+	for (;;) {
+		time_t	now, wake = 0;
+		ups_t	*ups;
+		pid_t	pid;
+		int	wstat;
+
+		time(&now);
+
+		for (i = 0; i < next; i++) {
+			if (waiting[i] && deadline[i] && deadline[i] <= now) {
+				/* main() revises it, as after forkexec() */
+				upslogx(LOG_WARNING, "Shutdown timer elapsed for [%s], continuing...",
+					list[i]->upsname);
+				list[i]->exceeded_timeout = 1;
+				waiting[i] = 0;
+				exec_timeout++;
+				running--;
+			}
+		}
+
+		while (running < maxparallel && next < count) {
+			char	*argv[9];
+			char	dfn[SMALLBUF];
+			int	delay;
+
+			ups = list[next];
+			delay = (ups->maxstartdelay != -1 ? ups->maxstartdelay : maxstartdelay);
+
+			upsdebugx(1, "Shutdown UPS: %s", ups->upsname);
+			shutdown_cmdline(ups, argv, dfn, sizeof(dfn));
+			debugcmdline(2, "exec: ", argv);
+
+			pid = fork();
+			if (pid < 0)
+				fatal_with_errno(EXIT_FAILURE, "fork");
+
+			if (pid == 0) {
+				int	ret = execv(argv[0], argv);
+
+				/* shouldn't get here normally */
+				upsdebugx(1, "%s: execv returned %d", __func__, ret);
+				fatal_with_errno(EXIT_FAILURE, "execv");
+			}
+
+			ups->pid = pid;
+			ups->exceeded_timeout = 0;
+			deadline[next] = (delay >= 0 ? now + delay : 0);
+			waiting[next] = 1;
+			running++;
+			next++;
+		}
+
+		if (!running)
+			break;
+
+		for (i = 0; i < next; i++) {
+			if (waiting[i] && deadline[i]
+			 && (!wake || deadline[i] < wake)
+			) {
+				wake = deadline[i];
+			}
+		}
+
+		if (wake)
+			alarm((unsigned int)(wake > now ? wake - now : 1));
+
+		pid = waitpid(-1, &wstat, 0);
+
+		alarm(0);
+
+		if (pid <= 0) {
+			if (errno == ECHILD)
+				break;	/* should not happen */
+			continue;	/* timer: see above */
+		}
+
+		for (i = 0; i < next; i++) {
+			if (waiting[i] && list[i]->pid == pid)
+				break;
+		}
+
+		if (i < next) {
+			waiting[i] = 0;
+			running--;
+			ups = list[i];
+		} else {
+			/* one which timed out (maybe of an earlier sdorder)
+			 * is done now; main() would revise it otherwise */
+			for (ups = upstable; ups; ups = ups->next) {
+				if (ups->exceeded_timeout && ups->pid == pid)
+					break;
+			}
+
+			if (!ups)
+				continue;
+
+			ups->exceeded_timeout = 0;
+			exec_timeout--;
+		}
+
+		if (WIFEXITED(wstat) == 0) {
+			upslogx(LOG_WARNING, "Driver [%s] exited abnormally",
+				ups->upsname);
+			exec_error++;
+		} else if (WEXITSTATUS(wstat) != 0) {
+			upslogx(LOG_WARNING, "Driver [%s] failed to shut down the UPS"
+				" (exit status=%d)", ups->upsname, WEXITSTATUS(wstat));
+			exec_error++;
+		}
+	}
+
+	free(waiting);
+	free(deadline);
+}
+#endif	/* !WIN32 */
+
 static void send_one_driver(void (*command_func)(const ups_t *), const char *arg_upsname)
 {
 	ups_t	*ups = upstable;
@@ -1305,6 +2078,27 @@ static void send_one_driver(void (*command_func)(const ups_t *), const char *arg
 	fatalx(EXIT_FAILURE, "UPS %s not found in ups.conf", arg_upsname);
 }
 
+#ifndef WIN32
+/* stop the drivers of the whole table in one go (only those we started
+ * in this run with <own_only>), see stop_drivers() */
+static void stop_all_drivers(int own_only)
+{
+	const ups_t	**list = xcalloc((size_t)upscount, sizeof(*list));
+	ups_t	*ups;
+	size_t	n = 0;
+
+	for (ups = upstable; ups && n < (size_t)upscount; ups = ups->next) {
+		if (own_only ? (ups->pid != -1) : (hostgroup_leader(ups) == ups))
+			list[n++] = ups;
+	}
+
+	if (n)
+		stop_drivers(list, n);
+
+	free(list);
+}
+#endif
+
 /* walk UPS table and send command to all UPSes according to sdorder */
 static void send_all_drivers(void (*command_func)(const ups_t *))
 {
@@ -1317,6 +2111,13 @@ static void send_all_drivers(void (*command_func)(const ups_t *))
 	exec_error = 0;
 	exec_timeout = 0;
 
+#ifndef WIN32
+	if (command_func == &status_driver && maxparallel > 1 && ups->next) {
+		status_drivers_parallel();
+		return;
+	}
+#endif
+
 	if (command_func == &list_driver || command_func == &status_driver) {
 		while (ups) {
 			command_func(ups);
@@ -1351,8 +2152,32 @@ static void send_all_drivers(void (*command_func)(const ups_t *))
 			);
 		}
 
+#ifndef WIN32
+		/* with the same conditions as forkexec() waits for them */
+		if (command_func == &start_driver
+		&&  maxparallel > 1
+		&&  ups->next
+		&&  waitfordrivers
+		&&  nut_foreground_passthrough <= 0
+		&&  !(nut_foreground_passthrough != 0
+		      && nut_debug_level > 0
+		      && nut_debug_level_passthrough > 0)
+		) {
+			start_drivers_parallel();
+			return;
+		}
+
+		if (command_func == &stop_driver && ups->next) {
+			stop_all_drivers(0);
+			return;
+		}
+#endif
+
 		while (ups) {
-			command_func(ups);
+			/* the rest of a hostgroup is started and stopped
+			 * along with its first section */
+			if (hostgroup_leader(ups) == ups)
+				command_func(ups);
 
 			ups = ups->next;
 		}
@@ -1362,6 +2187,35 @@ static void send_all_drivers(void (*command_func)(const ups_t *))
 
 	/* Orderly processing of shutdowns */
 	for (i = 0; i <= maxsdorder; i++) {
+#ifndef WIN32
+		/* those of one sdorder may go at once, as forkexec() would
+		 * wait for each of them in turn */
+		if (maxparallel > 1 && !testmode && waitfordrivers
+		 && nut_foreground_passthrough <= 0
+		 && !(nut_foreground_passthrough != 0
+		      && nut_debug_level > 0
+		      && nut_debug_level_passthrough > 0)
+		) {
+			ups_t	**list = xcalloc((size_t)upscount, sizeof(*list));
+			int	n = 0;
+
+			for (ups = upstable; ups && n < upscount; ups = ups->next) {
+				if (ups->sdorder == i)
+					list[n++] = ups;
+			}
+
+			if (n > 1) {
+				shutdown_drivers_parallel(list, n);
+				free(list);
+				continue;
+			}
+
+			free(list);
+		}
+#endif
+
+		/* every pass walks the whole table for its sdorder */
+		ups = upstable;
 		while (ups) {
 			if (ups->sdorder == i)
 				command_func(ups);
@@ -1384,6 +2238,9 @@ static void exit_cleanup(void)
 	&&  nut_foreground_passthrough > 0
 	) {
 		/* First stop the drivers, if any are running */
+#ifndef WIN32
+		stop_all_drivers(1);
+#else
 		while (tmp) {
 			next = tmp->next;
 			if (tmp->pid != -1) {
@@ -1391,6 +2248,7 @@ static void exit_cleanup(void)
 			}
 			tmp = next;
 		}
+#endif
 	}
 
 	tmp = upstable;
@@ -1399,6 +2257,7 @@ static void exit_cleanup(void)
 
 		free(tmp->driver);
 		free(tmp->port);
+		free(tmp->hostgroup);
 		free(tmp->upsname);
 		free(tmp);
 
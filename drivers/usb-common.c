@@ -376,6 +376,47 @@ void USBFreeRegexMatcher(USBDeviceMatcher_t *matcher)
 	free(matcher);
 }
 
+/* Check the fields of hd known without opening the device (VendorID,
+ * ProductID, Bus, Device and BusPort) against the exact and regex
+ * matchers of the chain, so devices they already rule out need not be
+ * opened and asked for their strings. Return 0 if one of them does,
+ * else 1: the complete matching is still to be done by the caller, and
+ * other kinds of matchers are only run then. */
+int USBMatchDeviceIDs(USBDeviceMatcher_t *matcher, USBDevice_t *hd)
+{
+	USBDeviceMatcher_t	*m;
+
+	for (m = matcher; m; m = m->next) {
+
+		if (m->match_function == &match_function_exact) {
+			USBDevice_t	*data = (USBDevice_t *)m->privdata;
+
+			if (hd->VendorID != data->VendorID
+			 || hd->ProductID != data->ProductID
+			) {
+				return 0;
+			}
+		}
+
+		if (m->match_function == &match_function_regex) {
+			regex_matcher_data_t	*data = (regex_matcher_data_t *)m->privdata;
+
+			if (match_regex_hex(data->regex[0], hd->VendorID) == 0
+			 || match_regex_hex(data->regex[1], hd->ProductID) == 0
+			 || match_regex(data->regex[5], hd->Bus) == 0
+			 || match_regex(data->regex[6], hd->Device) == 0
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+			 || match_regex(data->regex[7], hd->BusPort) == 0
+#endif
+			) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
 void warn_if_bad_usb_port_filename(const char *fn) {
 	/* USB drivers ignore the 'port' setting - log a notice
 	 * if it is not "auto". Note: per se, ignoring the port
@@ -533,6 +533,10 @@ int USBNewRegexMatcher(USBDeviceMatcher_t **matcher, char **regex, int cflags);
 void USBFreeExactMatcher(USBDeviceMatcher_t *matcher);
 void USBFreeRegexMatcher(USBDeviceMatcher_t *matcher);
 
+/* check the IDs and location of a device not opened yet against the
+   matchers, see usb-common.c; return 0 for a non-match, else 1 */
+int USBMatchDeviceIDs(USBDeviceMatcher_t *matcher, USBDevice_t *hd);
+
 /* dummy USB function and macro, inspired from the Linux kernel
  * this allows USB information extraction */
 #define USB_DEVICE(vendorID, productID)	vendorID, productID
@@ -0,0 +1,863 @@
+/* usb-replay.c - record what a USB HID device said, and say it again
+                  without the device
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Both sit where libhid.c expects its comm_driver: the recorder in front
+ * of the real one (libusb0.c or libusb1.c), the player instead of it, so
+ * the driver above runs unmodified on a device which is not there, e.g.
+ * to measure what its walks, reconnects and event handling cost.
+ *
+ * The recording is text, one event per line, each starting with the
+ * milliseconds since the recording began:
+ *
+ *   <t> open <ret> [<vid> <pid> <bcd> <vendor> <product> <serial> <bus>
+ *       <device> <report descriptor>]
+ *   <t> close
+ *   <t> get <report id> <ret> <report>
+ *   <t> set <report id> <ret>
+ *   <t> str <index> <ret> <string>
+ *   <t> int <ret> <report>
+ *
+ * with the bytes in hexadecimal, the strings with the bytes which are
+ * not printable (and '%' and '-') written as %XX, and "-" for nothing.
+ * Interrupt reads which timed out are left out. */
+
+#include "config.h"  /* must be the first header */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "timehead.h"
+#include "usb-replay.h"
+
+#define REPLAY_MAGIC	"NUTUSBREC 1"
+
+/* HID report IDs are a byte */
+#define REPLAY_IDS	256
+
+/* as the report descriptor buffers of libusb*.c */
+#define REPLAY_MAX_DESC	0x1800
+
+#define REPLAY_NONE	((size_t)-1)
+
+typedef enum {
+	REPLAY_OPEN = 0,
+	REPLAY_CLOSE,
+	REPLAY_GET,
+	REPLAY_SET,
+	REPLAY_STR,
+	REPLAY_INT
+} replay_kind_t;
+
+typedef struct replay_event_s {
+	uint64_t	t;		/* msec since the recording began */
+	replay_kind_t	kind;
+	int	id;			/* report ID or string index */
+	int	ret;			/* what the call returned */
+	unsigned char	*data;		/* report, string or report descriptor */
+	size_t	len;
+	size_t	next;			/* next event of the same kind and id */
+	USBDevice_t	device;		/* REPLAY_OPEN */
+} replay_event_t;
+
+static uint64_t replay_msec(void)
+{
+	struct timeval	tv;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+}
+
+/* ---------------------------------------------------------------------
+ * Recording
+ */
+
+static usb_communication_subdriver_t	*record_real = NULL;
+static usb_communication_subdriver_t	record_subdriver;
+static FILE	*record_file = NULL;
+static uint64_t	record_start = 0;
+
+/* the report descriptor of the device the driver accepted */
+static int (*record_callback)(usb_dev_handle *udev, USBDevice_t *hd,
+	usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen) = NULL;
+static unsigned char	record_desc[REPLAY_MAX_DESC];
+static size_t	record_desclen = 0;
+
+static void record_begin(const char *what)
+{
+	fprintf(record_file, "%" PRIu64 " %s",
+		replay_msec() - record_start, what);
+}
+
+static void record_hex(const unsigned char *data, size_t len)
+{
+	size_t	i;
+
+	if (!data || !len) {
+		fputs(" -", record_file);
+		return;
+	}
+
+	fputc(' ', record_file);
+	for (i = 0; i < len; i++) {
+		fprintf(record_file, "%02x", data[i]);
+	}
+}
+
+static void record_str(const char *val)
+{
+	if (!val) {
+		fputs(" -", record_file);
+		return;
+	}
+
+	fputc(' ', record_file);
+	for (; *val; val++) {
+		unsigned char	c = (unsigned char)*val;
+
+		if (c <= ' ' || c >= 0x7f || c == '%' || c == '-') {
+			fprintf(record_file, "%%%02X", c);
+		} else {
+			fputc(c, record_file);
+		}
+	}
+}
+
+static int record_cb(usb_dev_handle *udev, USBDevice_t *hd,
+	usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen)
+{
+	int	res = record_callback(udev, hd, rdbuf, rdlen);
+
+	if (res >= 1) {
+		record_desclen = rdlen < sizeof(record_desc) ? rdlen : sizeof(record_desc);
+		memcpy(record_desc, rdbuf, record_desclen);
+	}
+
+	return res;
+}
+
+static int record_open_dev(usb_dev_handle **sdevp, USBDevice_t *curDevice,
+	USBDeviceMatcher_t *matcher,
+	int (*callback)(usb_dev_handle *udev, USBDevice_t *hd,
+		usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen))
+{
+	int	ret;
+
+	record_callback = callback;
+	record_desclen = 0;
+
+	ret = record_real->open_dev(sdevp, curDevice, matcher,
+		callback ? &record_cb : NULL);
+
+	record_begin("open");
+	fprintf(record_file, " %d", ret);
+
+	if (ret >= 1) {
+		fprintf(record_file, " %04x %04x %04x", curDevice->VendorID,
+			curDevice->ProductID, curDevice->bcdDevice);
+		record_str(curDevice->Vendor);
+		record_str(curDevice->Product);
+		record_str(curDevice->Serial);
+		record_str(curDevice->Bus);
+		record_str(curDevice->Device);
+		record_hex(record_desc, record_desclen);
+	}
+
+	fputc('\n', record_file);
+
+	/* as libusb*.c may have adjusted them for the device */
+	record_subdriver.usb_config_index = record_real->usb_config_index;
+	record_subdriver.hid_rep_index = record_real->hid_rep_index;
+	record_subdriver.hid_desc_index = record_real->hid_desc_index;
+	record_subdriver.hid_ep_in = record_real->hid_ep_in;
+	record_subdriver.hid_ep_out = record_real->hid_ep_out;
+
+	return ret;
+}
+
+static void record_close_dev(usb_dev_handle *sdev)
+{
+	record_real->close_dev(sdev);
+
+	record_begin("close");
+	fputc('\n', record_file);
+}
+
+static int record_get_report(usb_dev_handle *sdev, usb_ctrl_repindex ReportId,
+	usb_ctrl_charbuf raw_buf, usb_ctrl_charbufsize ReportSize)
+{
+	int	ret = record_real->get_report(sdev, ReportId, raw_buf, ReportSize);
+
+	record_begin("get");
+	fprintf(record_file, " %u %d", (unsigned int)ReportId, ret);
+	record_hex((const unsigned char *)raw_buf,
+		ret > 0 && ret <= (int)ReportSize ? (size_t)ret : 0);
+	fputc('\n', record_file);
+
+	return ret;
+}
+
+static int record_set_report(usb_dev_handle *sdev, usb_ctrl_repindex ReportId,
+	usb_ctrl_charbuf raw_buf, usb_ctrl_charbufsize ReportSize)
+{
+	int	ret = record_real->set_report(sdev, ReportId, raw_buf, ReportSize);
+
+	record_begin("set");
+	fprintf(record_file, " %u %d\n", (unsigned int)ReportId, ret);
+
+	return ret;
+}
+
+static int record_get_string(usb_dev_handle *sdev,
+	usb_ctrl_strindex StringIdx, char *buf, usb_ctrl_charbufsize buflen)
+{
+	int	ret = record_real->get_string(sdev, StringIdx, buf, buflen);
+
+	record_begin("str");
+	fprintf(record_file, " %u %d", (unsigned int)StringIdx, ret);
+	record_str(ret > 0 && buflen > 0 ? buf : NULL);
+	fputc('\n', record_file);
+
+	return ret;
+}
+
+static int record_get_interrupt(usb_dev_handle *sdev,
+	usb_ctrl_charbuf buf, usb_ctrl_charbufsize bufsize,
+	usb_ctrl_timeout_msec timeout)
+{
+	int	ret = record_real->get_interrupt(sdev, buf, bufsize, timeout);
+
+	if (ret != 0) {
+		record_begin("int");
+		fprintf(record_file, " %d", ret);
+		record_hex((const unsigned char *)buf,
+			ret > 0 && ret <= (int)bufsize ? (size_t)ret : 0);
+		fputc('\n', record_file);
+	}
+
+	return ret;
+}
+
+usb_communication_subdriver_t *usb_record_open(
+	usb_communication_subdriver_t *real, const char *fn)
+{
+	record_file = fopen(fn, "w");
+	if (!record_file) {
+		fatal_with_errno(EXIT_FAILURE, "Can't write the USB recording %s", fn);
+	}
+
+	/* one line at a time, for it to be whole if the driver is killed */
+	setvbuf(record_file, NULL, _IOLBF, 0);
+	fprintf(record_file, "%s\n", REPLAY_MAGIC);
+
+	record_real = real;
+	record_start = replay_msec();
+
+	/* what the player can't do (hotplug, asynchronous interrupt
+	 * transfers) is left as is: the reports are recorded anyway */
+	record_subdriver = *real;
+	record_subdriver.open_dev = &record_open_dev;
+	record_subdriver.close_dev = &record_close_dev;
+	record_subdriver.get_report = &record_get_report;
+	record_subdriver.set_report = &record_set_report;
+	record_subdriver.get_string = &record_get_string;
+	record_subdriver.get_interrupt = &record_get_interrupt;
+
+	upslogx(LOG_INFO, "Recording what the device says to %s", fn);
+
+	return &record_subdriver;
+}
+
+/* ---------------------------------------------------------------------
+ * Replay
+ */
+
+static usb_communication_subdriver_t	replay_subdriver;
+static replay_event_t	*replay_events = NULL;
+static size_t	replay_count = 0;
+
+/* the event answering the next request of each kind (and id) */
+static size_t	replay_open = REPLAY_NONE;
+static size_t	replay_int = REPLAY_NONE;
+static size_t	replay_str = REPLAY_NONE;
+static size_t	replay_get[REPLAY_IDS];
+static size_t	replay_set[REPLAY_IDS];
+
+static double	replay_speed = 0;
+static int	replay_started = 0;
+static uint64_t	replay_base_t = 0;	/* recording time when we started */
+static uint64_t	replay_base_msec = 0;	/* our time then */
+static uint64_t	replay_vclock = 0;	/* speed 0: the last event answered */
+
+/* what the driver gets as device handle, there being no device */
+static int	replay_handle;
+
+/* where the recording is at */
+static uint64_t replay_now(void)
+{
+	if (replay_speed <= 0) {
+		return replay_vclock;
+	}
+
+	return replay_base_t
+		+ (uint64_t)((double)(replay_msec() - replay_base_msec) * replay_speed);
+}
+
+/* the event of a chain (starting at *head) which answers now, the chain
+ * then starting from it (or the one after it, with speed 0) */
+static replay_event_t *replay_answer(size_t *head)
+{
+	replay_event_t	*ev;
+	uint64_t	now;
+
+	if (*head == REPLAY_NONE) {
+		return NULL;
+	}
+
+	ev = &replay_events[*head];
+
+	if (replay_speed <= 0) {
+		if (ev->next != REPLAY_NONE) {
+			*head = ev->next;
+		}
+		if (ev->t > replay_vclock) {
+			replay_vclock = ev->t;
+		}
+		return ev;
+	}
+
+	now = replay_now();
+	while (ev->next != REPLAY_NONE && replay_events[ev->next].t <= now) {
+		*head = ev->next;
+		ev = &replay_events[*head];
+	}
+
+	return ev;
+}
+
+static void replay_set_string(char **dst, const char *src)
+{
+	free(*dst);
+	*dst = src ? xstrdup(src) : NULL;
+}
+
+static int replay_open_dev(usb_dev_handle **sdevp, USBDevice_t *curDevice,
+	USBDeviceMatcher_t *matcher,
+	int (*callback)(usb_dev_handle *udev, USBDevice_t *hd,
+		usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen))
+{
+	static unsigned char	rdbuf[REPLAY_MAX_DESC];
+	replay_event_t	*ev;
+	USBDeviceMatcher_t	*m;
+	int	ret;
+
+	*sdevp = NULL;
+
+	if (!replay_started && replay_open != REPLAY_NONE) {
+		/* the clock starts with the first time the device was found */
+		replay_base_t = replay_vclock = replay_events[replay_open].t;
+		replay_base_msec = replay_msec();
+		replay_started = 1;
+	}
+
+	ev = replay_answer(&replay_open);
+	if (!ev) {
+		upsdebugx(2, "%s: no device in the recording", __func__);
+		return -1;
+	}
+
+	if (ev->ret < 1) {
+		upsdebugx(2, "%s: the device was not found then", __func__);
+		return ev->ret;
+	}
+
+	curDevice->VendorID = ev->device.VendorID;
+	curDevice->ProductID = ev->device.ProductID;
+	curDevice->bcdDevice = ev->device.bcdDevice;
+	replay_set_string(&curDevice->Vendor, ev->device.Vendor);
+	replay_set_string(&curDevice->Product, ev->device.Product);
+	replay_set_string(&curDevice->Serial, ev->device.Serial);
+	replay_set_string(&curDevice->Bus, ev->device.Bus);
+	replay_set_string(&curDevice->Device, ev->device.Device);
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+	replay_set_string(&curDevice->BusPort, NULL);
+#endif
+
+	for (m = matcher; m; m = m->next) {
+		ret = m->match_function(curDevice, m->privdata);
+		if (ret == 0) {
+			upsdebugx(2, "%s: the recorded device does not match", __func__);
+			return -1;
+		}
+		if (ret == -1) {
+			fatal_with_errno(EXIT_FAILURE, "matcher");
+		}
+		if (ret == -2) {
+			upsdebugx(2, "%s: matcher: unspecified error", __func__);
+			return -1;
+		}
+	}
+
+	*sdevp = (usb_dev_handle *)(void *)&replay_handle;
+
+	if (!callback) {
+		return 1;
+	}
+
+	if (!ev->data) {
+		upslogx(LOG_ERR, "%s: no report descriptor in the recording", __func__);
+		*sdevp = NULL;
+		return -1;
+	}
+
+	/* the driver may as well scribble on it */
+	memcpy(rdbuf, ev->data, ev->len);
+
+	if (callback(*sdevp, curDevice, rdbuf, (usb_ctrl_charbufsize)ev->len) < 1) {
+		upsdebugx(2, "%s: caller doesn't like this device", __func__);
+		*sdevp = NULL;
+		return -1;
+	}
+
+	return (int)ev->len;
+}
+
+static void replay_close_dev(usb_dev_handle *sdev)
+{
+	NUT_UNUSED_VARIABLE(sdev);
+}
+
+static int replay_report(size_t *heads, usb_ctrl_repindex ReportId,
+	usb_ctrl_charbuf raw_buf, usb_ctrl_charbufsize ReportSize, int unknown)
+{
+	replay_event_t	*ev;
+	size_t	len;
+
+	if (ReportId >= REPLAY_IDS
+	 || !(ev = replay_answer(&heads[ReportId]))
+	) {
+		return unknown;
+	}
+
+	if (ev->ret <= 0 || !ev->data) {
+		return ev->ret;
+	}
+
+	len = ev->len < ReportSize ? ev->len : ReportSize;
+	memcpy(raw_buf, ev->data, len);
+
+	return (int)len;
+}
+
+static int replay_get_report(usb_dev_handle *sdev, usb_ctrl_repindex ReportId,
+	usb_ctrl_charbuf raw_buf, usb_ctrl_charbufsize ReportSize)
+{
+	NUT_UNUSED_VARIABLE(sdev);
+
+	/* never asked for when recording: as if the device did not know it */
+	return replay_report(replay_get, ReportId, raw_buf, ReportSize, -1);
+}
+
+static int replay_set_report(usb_dev_handle *sdev, usb_ctrl_repindex ReportId,
+	usb_ctrl_charbuf raw_buf, usb_ctrl_charbufsize ReportSize)
+{
+	replay_event_t	*ev;
+
+	NUT_UNUSED_VARIABLE(sdev);
+	NUT_UNUSED_VARIABLE(raw_buf);
+
+	if (ReportId >= REPLAY_IDS
+	 || !(ev = replay_answer(&replay_set[ReportId]))
+	) {
+		/* never set when recording: as if the device took it */
+		return (int)ReportSize;
+	}
+
+	return ev->ret;
+}
+
+static int replay_get_string(usb_dev_handle *sdev,
+	usb_ctrl_strindex StringIdx, char *buf, usb_ctrl_charbufsize buflen)
+{
+	replay_event_t	*ev;
+	size_t	i;
+
+	NUT_UNUSED_VARIABLE(sdev);
+
+	/* strings do not change: any answer for the index will do */
+	for (i = replay_str; i != REPLAY_NONE; i = replay_events[i].next) {
+		if (replay_events[i].id == (int)StringIdx) {
+			break;
+		}
+	}
+
+	if (i == REPLAY_NONE) {
+		return -1;
+	}
+
+	ev = &replay_events[i];
+	if (ev->ret <= 0 || !buflen) {
+		return ev->ret;
+	}
+
+	snprintf(buf, buflen, "%s", ev->data ? (const char *)ev->data : "");
+
+	return (int)strlen(buf);
+}
+
+static int replay_get_interrupt(usb_dev_handle *sdev,
+	usb_ctrl_charbuf buf, usb_ctrl_charbufsize bufsize,
+	usb_ctrl_timeout_msec timeout)
+{
+	replay_event_t	*ev;
+	uint64_t	now, wait;
+	size_t	len;
+
+	NUT_UNUSED_VARIABLE(sdev);
+
+	if (replay_int == REPLAY_NONE) {
+		/* the end of the recording: nothing comes anymore */
+		if (replay_speed > 0) {
+			usleep((useconds_t)timeout * 1000);
+		}
+		return 0;
+	}
+
+	ev = &replay_events[replay_int];
+
+	if (replay_speed > 0) {
+		now = replay_now();
+		if (ev->t > now) {
+			wait = (uint64_t)((double)(ev->t - now) / replay_speed);
+			if (wait > timeout) {
+				usleep((useconds_t)timeout * 1000);
+				return 0;
+			}
+			usleep((useconds_t)wait * 1000);
+		}
+	} else if (ev->t > replay_vclock) {
+		replay_vclock = ev->t;
+	}
+
+	replay_int = ev->next;
+
+	if (ev->ret <= 0 || !ev->data) {
+		return ev->ret;
+	}
+
+	len = ev->len < bufsize ? ev->len : bufsize;
+	memcpy(buf, ev->data, len);
+
+	return (int)len;
+}
+
+/* a line of any length, without its end; NULL at the end of the file */
+static char *replay_getline(FILE *f, char **buf, size_t *size)
+{
+	size_t	len = 0;
+
+	if (!*buf) {
+		*size = LARGEBUF;
+		*buf = xmalloc(*size);
+	}
+
+	while (fgets(*buf + len, (int)(*size - len), f)) {
+		len += strlen(*buf + len);
+
+		if (len > 0 && (*buf)[len - 1] == '\n') {
+			break;
+		}
+
+		*size *= 2;
+		*buf = xrealloc(*buf, *size);
+	}
+
+	if (!len) {
+		return NULL;
+	}
+
+	(*buf)[strcspn(*buf, "\r\n")] = '\0';
+
+	return *buf;
+}
+
+static unsigned char *replay_unhex(const char *hex, size_t *len)
+{
+	unsigned char	*data;
+	unsigned int	c;
+	size_t	i;
+
+	*len = 0;
+
+	if (!hex || !strcmp(hex, "-")) {
+		return NULL;
+	}
+
+	if (strlen(hex) % 2) {
+		return NULL;
+	}
+
+	data = xmalloc(strlen(hex) / 2 + 1);
+
+	for (i = 0; hex[i * 2]; i++) {
+		if (sscanf(hex + i * 2, "%2x", &c) != 1) {
+			free(data);
+			return NULL;
+		}
+		data[i] = (unsigned char)c;
+	}
+
+	*len = i;
+
+	return data;
+}
+
+static char *replay_unescape(const char *val)
+{
+	char	*str, *out;
+	unsigned int	c;
+
+	if (!val || !strcmp(val, "-")) {
+		return NULL;
+	}
+
+	str = xstrdup(val);
+
+	for (out = str; *val; val++) {
+		if (*val == '%' && val[1] && val[2] && sscanf(val + 1, "%2X", &c) == 1) {
+			*out++ = (char)c;
+			val += 2;
+		} else {
+			*out++ = *val;
+		}
+	}
+
+	*out = '\0';
+
+	return str;
+}
+
+/* hook ev (at index i) at the end of its chain */
+static void replay_link(size_t *head, size_t *tail, size_t i)
+{
+	if (*head == REPLAY_NONE) {
+		*head = i;
+	} else {
+		replay_events[*tail].next = i;
+	}
+
+	*tail = i;
+}
+
+usb_communication_subdriver_t *usb_replay_open(const char *fn, double speed)
+{
+	size_t	get_tail[REPLAY_IDS], set_tail[REPLAY_IDS];
+	size_t	open_tail = REPLAY_NONE, int_tail = REPLAY_NONE;
+	size_t	str_tail = REPLAY_NONE, alloc = 0, lineno = 1, i;
+	char	*line = NULL, *tok[13];
+	size_t	linesize = 0, ntok;
+	const unsigned char	*desc = NULL;
+	size_t	desclen = 0;
+	replay_event_t	*ev;
+	FILE	*f;
+
+	f = fopen(fn, "r");
+	if (!f) {
+		fatal_with_errno(EXIT_FAILURE, "Can't read the USB recording %s", fn);
+	}
+
+	if (!replay_getline(f, &line, &linesize) || strcmp(line, REPLAY_MAGIC)) {
+		fatalx(EXIT_FAILURE, "%s is not a USB recording", fn);
+	}
+
+	for (i = 0; i < REPLAY_IDS; i++) {
+		replay_get[i] = replay_set[i] = REPLAY_NONE;
+	}
+
+	while (replay_getline(f, &line, &linesize)) {
+		lineno++;
+
+		for (ntok = 0; ntok < SIZEOF_ARRAY(tok); ntok++) {
+			tok[ntok] = strtok(ntok ? NULL : line, " ");
+			if (!tok[ntok]) {
+				break;
+			}
+		}
+
+		if (ntok < 2) {
+			continue;
+		}
+
+		if (replay_count == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			replay_events = xrealloc(replay_events, alloc * sizeof(*replay_events));
+		}
+
+		i = replay_count;
+		ev = &replay_events[i];
+		memset(ev, 0, sizeof(*ev));
+		ev->t = strtoull(tok[0], NULL, 10);
+		ev->next = REPLAY_NONE;
+
+		if (!strcmp(tok[1], "open") && ntok >= 3) {
+			ev->kind = REPLAY_OPEN;
+			ev->ret = atoi(tok[2]);
+
+			if (ev->ret >= 1) {
+				if (ntok < 12) {
+					fatalx(EXIT_FAILURE, "%s:%" PRIuSIZE ": incomplete device",
+						fn, lineno);
+				}
+				ev->device.VendorID = (uint16_t)strtoul(tok[3], NULL, 16);
+				ev->device.ProductID = (uint16_t)strtoul(tok[4], NULL, 16);
+				ev->device.bcdDevice = (uint16_t)strtoul(tok[5], NULL, 16);
+				ev->device.Vendor = replay_unescape(tok[6]);
+				ev->device.Product = replay_unescape(tok[7]);
+				ev->device.Serial = replay_unescape(tok[8]);
+				ev->device.Bus = replay_unescape(tok[9]);
+				ev->device.Device = replay_unescape(tok[10]);
+				ev->data = replay_unhex(tok[11], &ev->len);
+
+				/* reopening does not read the descriptor again:
+				 * the one read before still holds */
+				if (ev->data) {
+					desc = ev->data;
+					desclen = ev->len;
+				} else if (desc) {
+					ev->data = xmalloc(desclen);
+					memcpy(ev->data, desc, desclen);
+					ev->len = desclen;
+				}
+
+				if (ev->len > REPLAY_MAX_DESC) {
+					fatalx(EXIT_FAILURE, "%s:%" PRIuSIZE ": report descriptor too long",
+						fn, lineno);
+				}
+			}
+
+			replay_link(&replay_open, &open_tail, i);
+		} else if (!strcmp(tok[1], "close")) {
+			continue;
+		} else if ((!strcmp(tok[1], "get") || !strcmp(tok[1], "set")) && ntok >= 4) {
+			ev->id = atoi(tok[2]);
+			ev->ret = atoi(tok[3]);
+
+			if (ev->id < 0 || ev->id >= REPLAY_IDS) {
+				continue;
+			}
+
+			if (tok[1][0] == 'g') {
+				ev->kind = REPLAY_GET;
+				ev->data = replay_unhex(ntok > 4 ? tok[4] : NULL, &ev->len);
+				replay_link(&replay_get[ev->id], &get_tail[ev->id], i);
+			} else {
+				ev->kind = REPLAY_SET;
+				replay_link(&replay_set[ev->id], &set_tail[ev->id], i);
+			}
+		} else if (!strcmp(tok[1], "str") && ntok >= 4) {
+			ev->kind = REPLAY_STR;
+			ev->id = atoi(tok[2]);
+			ev->ret = atoi(tok[3]);
+			ev->data = (unsigned char *)replay_unescape(ntok > 4 ? tok[4] : NULL);
+			replay_link(&replay_str, &str_tail, i);
+		} else if (!strcmp(tok[1], "int") && ntok >= 3) {
+			ev->kind = REPLAY_INT;
+			ev->ret = atoi(tok[2]);
+			ev->data = replay_unhex(ntok > 3 ? tok[3] : NULL, &ev->len);
+			replay_link(&replay_int, &int_tail, i);
+		} else {
+			upsdebugx(1, "%s:%" PRIuSIZE ": ignoring \"%s\"", fn, lineno, tok[1]);
+			continue;
+		}
+
+		replay_count++;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (replay_open == REPLAY_NONE) {
+		fatalx(EXIT_FAILURE, "%s: no device in the recording", fn);
+	}
+
+	replay_speed = speed;
+
+	memset(&replay_subdriver, 0, sizeof(replay_subdriver));
+	replay_subdriver.name = "USB replay";
+	replay_subdriver.version = "0.01";
+	replay_subdriver.open_dev = &replay_open_dev;
+	replay_subdriver.close_dev = &replay_close_dev;
+	replay_subdriver.get_report = &replay_get_report;
+	replay_subdriver.set_report = &replay_set_report;
+	replay_subdriver.get_string = &replay_get_string;
+	replay_subdriver.get_interrupt = &replay_get_interrupt;
+	replay_subdriver.usb_config_index = LIBUSB_DEFAULT_CONF_INDEX;
+	replay_subdriver.hid_rep_index = LIBUSB_DEFAULT_INTERFACE;
+	replay_subdriver.hid_desc_index = LIBUSB_DEFAULT_DESC_INDEX;
+	replay_subdriver.hid_ep_in = LIBUSB_DEFAULT_HID_EP_IN;
+	replay_subdriver.hid_ep_out = LIBUSB_DEFAULT_HID_EP_OUT;
+	/* no hotplug nor asynchronous interrupt transfers: the driver
+	 * falls back to looking for the device and to reading interrupts
+	 * with a timeout, which the recording answers as well */
+
+	upslogx(LOG_INFO, "Replaying %" PRIuSIZE " events of %s %s", replay_count,
+		fn, speed > 0 ? "along the clock" : "as fast as asked for");
+
+	return &replay_subdriver;
+}
+
+/* ---------------------------------------------------------------------
+ * Several devices
+ */
+
+static const dstate_hostvar_t	usb_replay_hostvar_list[] = {
+	DSTATE_HOSTVAR(record_real),
+	DSTATE_HOSTVAR(record_subdriver),
+	DSTATE_HOSTVAR(record_file),
+	DSTATE_HOSTVAR(record_start),
+	DSTATE_HOSTVAR(record_callback),
+	DSTATE_HOSTVAR(record_desc),
+	DSTATE_HOSTVAR(record_desclen),
+	DSTATE_HOSTVAR(replay_subdriver),
+	DSTATE_HOSTVAR(replay_events),
+	DSTATE_HOSTVAR(replay_count),
+	DSTATE_HOSTVAR(replay_open),
+	DSTATE_HOSTVAR(replay_int),
+	DSTATE_HOSTVAR(replay_str),
+	DSTATE_HOSTVAR(replay_get),
+	DSTATE_HOSTVAR(replay_set),
+	DSTATE_HOSTVAR(replay_speed),
+	DSTATE_HOSTVAR(replay_started),
+	DSTATE_HOSTVAR(replay_base_t),
+	DSTATE_HOSTVAR(replay_base_msec),
+	DSTATE_HOSTVAR(replay_vclock),
+	DSTATE_HOSTVAR_END
+};
+
+const dstate_hostvar_t *usb_replay_hostvars(void)
+{
+	return usb_replay_hostvar_list;
+}
@@ -0,0 +1,56 @@
+/* usb-replay.h - record what a USB HID device said, and say it again
+                  without the device (see usb-replay.c)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_USB_REPLAY_H_SEEN
+#define NUT_USB_REPLAY_H_SEEN 1
+
+#include "nut_libusb.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* A communication subdriver passing everything to real (which it uses
+ * as is otherwise), and writing what the device said, and when, to the
+ * file fn. Fatal if the file can't be written. */
+usb_communication_subdriver_t *usb_record_open(
+	usb_communication_subdriver_t *real, const char *fn);
+
+/* A communication subdriver answering from what usb_record_open() wrote
+ * to fn, as if the device was there. With speed > 0, the recording
+ * plays along the clock, that many times faster than it was made (1:
+ * in real time): a report asked for is the last one recorded by then,
+ * and the interrupts come when they came. With speed 0, each request
+ * gets the next answer recorded for it, and the interrupts come as soon
+ * as they are asked for, which is the fastest. Fatal if the file can't
+ * be read. */
+usb_communication_subdriver_t *usb_replay_open(const char *fn, double speed);
+
+/* What each device records or replays for its own, when the driver runs
+ * several (see addhostvars() in main.h) */
+const dstate_hostvar_t *usb_replay_hostvars(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_USB_REPLAY_H_SEEN */
@@ -29,7 +29,7 @@
  */
 
 #define DRIVER_NAME	"Generic HID driver"
-#define DRIVER_VERSION	"0.60"
+#define DRIVER_VERSION	"0.61"
 
 #define HU_VAR_WAITBEFORERECONNECT "waitbeforereconnect"
 
@@ -40,6 +40,7 @@
 #include "hidparser.h"
 #include "hidtypes.h"
 #include "common.h"
+#include <ctype.h>
 #ifdef WIN32
 #include "wincompat.h"
 #endif
@@ -48,6 +49,8 @@
 #include "mge-hid.h"
 
 #if !((defined SHUT_MODE) && SHUT_MODE)
+#	include "usb-replay.h"
+
 	/* explore stub goes first, others alphabetically */
 #	include "explore-hid.h"
 #	include "apc-hid.h"
@@ -151,6 +154,20 @@ static long interrupt_pipe_no_events_count = 0;
 /* How HIDGetEvents() below reports no events found */
 #define	NUT_LIBUSB_CODE_NO_EVENTS	0
 
+#if !((defined SHUT_MODE) && SHUT_MODE)
+/* Keep an interrupt transfer submitted and handle the reports as they
+ * come (the "interrupt_async" flag), see hu_interrupt_async_start() */
+static bool_t interrupt_async = FALSE;
+static bool_t interrupt_async_active = FALSE;
+
+/* While the device is away, wait for the communication driver to report
+ * its arrival rather than looking for it every pollinterval (the "hotplug"
+ * flag), see hu_reconnect_due() */
+static bool_t hotplug = FALSE;
+static bool_t hotplug_watching = FALSE;
+static bool_t hotplug_pending = FALSE;	/* arrived, not reconnected yet */
+#endif	/* !SHUT_MODE => USB */
+
 static time_t lastpoll; /* Timestamp the last polling */
 hid_dev_handle_t udev = HID_DEV_HANDLE_CLOSED;
 
@@ -245,9 +262,73 @@ static int lbrb_log_delay_without_calibrating = 0;
 static time_t last_lb_start = 0;
 static time_t last_rb_start = 0;
 
+/* HID Object data found for each entry of subdriver->hid2nut, kept
+ * here so the subdrivers' tables are read-only (see hid_item_data()) */
+static HIDData_t **hid_data = NULL;
+static const hid_info_t *hid_data_table = NULL;
+
+/* The entries of subdriver->hid2nut the device did not answer for in
+ * the HU_WALKMODE_INIT walk, kept on disk with the "mapping_cache" flag
+ * (see hu_cache_load()) so the next starts do not ask for them again:
+ * 1 for those, 0 for the others, for the table hid_absent_table */
+static bool_t mapping_cache = FALSE;
+static char *hid_absent = NULL;
+static const hid_info_t *hid_absent_table = NULL;
+static bool_t hid_absent_dirty = FALSE;	/* differs from the file */
+static uint32_t hid_desc_crc = 0;	/* of the raw report descriptor */
+
+/* The report generation (see reportbuf_t) each entry of subdriver->hid2nut
+ * was last published with by a polling walk, for the table hid_gen_table:
+ * while it stays the same, so does the value (see hu_item_unchanged()),
+ * unless a lookup function makes it of something else too */
+static unsigned int *hid_gen = NULL;
+static const hid_info_t *hid_gen_table = NULL;
+
+/* The entries of subdriver->hid2nut which have HID Object data, indexed
+ * by name and by that data once the HU_WALKMODE_INIT walk is done (see
+ * hid_info_index_build()): open addressing hashes of the entry index + 1,
+ * 0 if empty. hid_index_table is the table they are good for, or NULL
+ * while the mapping is being made. */
+static size_t *hid_index_name = NULL;
+static size_t *hid_index_data = NULL;
+static size_t hid_index_size = 0;
+static const hid_info_t *hid_index_table = NULL;
+
 /* support functions */
-static hid_info_t *find_nut_info(const char *varname);
-static hid_info_t *find_hid_info(const HIDData_t *hiddata);
+static HIDData_t **hid_item_data(const hid_info_t *item);
+static void hid_info_index_build(void);
+static void hid_info_index_free(void);
+static uint32_t hu_crc32(const unsigned char *buf, size_t len);
+static void hu_cache_load(void);
+static void hu_cache_save(void);
+/* whether the report of item was unchanged since the item was last
+ * published by a polling walk; if not, record its current generation */
+static bool_t hu_item_unchanged(const hid_info_t *item, const HIDData_t *hiddata)
+{
+	const hid_info_t	*p;
+	size_t	n = 0, i = (size_t)(item - subdriver->hid2nut);
+	unsigned int	gen = reportbuf->gen[hiddata->ReportID];
+
+	if (hid_gen_table != subdriver->hid2nut) {
+		for (p = subdriver->hid2nut; p->info_type != NULL; p++)
+			n++;
+
+		free(hid_gen);
+		hid_gen = xcalloc(n + 1, sizeof(*hid_gen));
+		hid_gen_table = subdriver->hid2nut;
+	}
+
+	if (gen != 0 && hid_gen[i] == gen)
+		return TRUE;
+
+	hid_gen[i] = gen;
+	return FALSE;
+}
+
+static bool_t hu_cache_absent(const hid_info_t *item);
+static void hu_cache_mark_absent(const hid_info_t *item);
+static const hid_info_t *find_nut_info(const char *varname);
+static const hid_info_t *find_hid_info(const HIDData_t *hiddata);
 static const char *hu_find_infoval(info_lkp_t *hid2info, const double value);
 static long hu_find_valinfo(info_lkp_t *hid2info, const char* value);
 static void process_boolean_info(const char *nutvalue);
@@ -255,7 +336,12 @@ static void ups_alarm_set(void);
 static void ups_status_set(void);
 static bool_t hid_ups_walk(walkmode_t mode);
 static int reconnect_ups(void);
-static int ups_infoval_set(hid_info_t *item, double value);
+#if !((defined SHUT_MODE) && SHUT_MODE)
+static void hu_interrupt_async_start(void);
+static void hu_hotplug_watch(bool_t on);
+#endif
+static bool_t hu_reconnect_due(time_t now);
+static int ups_infoval_set(const hid_info_t *item, double value);
 static int callback(hid_dev_handle_t argudev, HIDDevice_t *arghd,
 					usb_ctrl_charbuf rdbuf, usb_ctrl_charbufsize rdlen);
 #ifdef DEBUG
@@ -803,6 +889,62 @@ static HIDDeviceMatcher_t subdriver_matcher_struct = {
 	NULL,
 	NULL
 };
+
+/* what every device run by this process has for its own (see
+ * addhostvars()), with libhid's; the communication driver and the
+ * subdrivers list theirs, their tables are shared. Not those of the
+ * interrupt_async and hotplug flags, which are then not used */
+static const dstate_hostvar_t usbhid_hostvars[] = {
+	DSTATE_HOSTVAR(subdriver),
+	DSTATE_HOSTVAR(hd),
+	DSTATE_HOSTVAR(curDevice),
+	DSTATE_HOSTVAR(subdriver_matcher),
+	DSTATE_HOSTVAR(subdriver_matcher_struct),
+	DSTATE_HOSTVAR(exact_matcher),
+	DSTATE_HOSTVAR(regex_matcher),
+	DSTATE_HOSTVAR(pollfreq),
+	DSTATE_HOSTVAR(ups_status),
+	DSTATE_HOSTVAR(data_has_changed),
+	DSTATE_HOSTVAR(use_interrupt_pipe),
+	DSTATE_HOSTVAR(interrupt_pipe_EIO_count),
+	DSTATE_HOSTVAR(interrupt_pipe_no_events_tolerance),
+	DSTATE_HOSTVAR(interrupt_pipe_no_events_count),
+	DSTATE_HOSTVAR(lastpoll),
+	DSTATE_HOSTVAR(udev),
+	DSTATE_HOSTVAR(last_calibration_start),
+	DSTATE_HOSTVAR(last_calibration_finish),
+	DSTATE_HOSTVAR(onlinedischarge_onbattery),
+	DSTATE_HOSTVAR(onlinedischarge_calibration),
+	DSTATE_HOSTVAR(onlinedischarge_log_throttle_sec),
+	DSTATE_HOSTVAR(onlinedischarge_log_throttle_timestamp),
+	DSTATE_HOSTVAR(onlinedischarge_log_throttle_charge),
+	DSTATE_HOSTVAR(onlinedischarge_log_throttle_hovercharge),
+	DSTATE_HOSTVAR(lbrb_log_delay_sec),
+	DSTATE_HOSTVAR(lbrb_log_delay_without_calibrating),
+	DSTATE_HOSTVAR(last_lb_start),
+	DSTATE_HOSTVAR(last_rb_start),
+	DSTATE_HOSTVAR(hid_data),
+	DSTATE_HOSTVAR(hid_data_table),
+	DSTATE_HOSTVAR(mapping_cache),
+	DSTATE_HOSTVAR(hid_absent),
+	DSTATE_HOSTVAR(hid_absent_table),
+	DSTATE_HOSTVAR(hid_absent_dirty),
+	DSTATE_HOSTVAR(hid_desc_crc),
+	DSTATE_HOSTVAR(hid_gen),
+	DSTATE_HOSTVAR(hid_gen_table),
+	DSTATE_HOSTVAR(hid_index_name),
+	DSTATE_HOSTVAR(hid_index_data),
+	DSTATE_HOSTVAR(hid_index_size),
+	DSTATE_HOSTVAR(hid_index_table),
+	DSTATE_HOSTVAR(pDesc),
+	DSTATE_HOSTVAR(reportbuf),
+	DSTATE_HOSTVAR(disable_fix_report_desc),
+	DSTATE_HOSTVAR(comm_driver),
+	DSTATE_HOSTVAR(max_report_size),
+	DSTATE_HOSTVAR(interrupt_only),
+	DSTATE_HOSTVAR(interrupt_size),
+	DSTATE_HOSTVAR_END
+};
 #endif	/* !SHUT_MODE => USB */
 
 /* ---------------------------------------------
@@ -811,7 +953,7 @@ static HIDDeviceMatcher_t subdriver_matcher_struct = {
 /* process instant command and take action. */
 int instcmd(const char *cmdname, const char *extradata)
 {
-	hid_info_t	*hidups_item;
+	const hid_info_t	*hidups_item;
 	const char	*val;
 	double		value;
 
@@ -921,7 +1063,7 @@ int instcmd(const char *cmdname, const char *extradata)
 	}
 
 	/* Actual variable setting */
-	if (HIDSetDataValue(udev, hidups_item->hiddata, value) == 1) {
+	if (HIDSetDataValue(udev, *hid_item_data(hidups_item), value) == 1) {
 		upsdebugx(3, "instcmd: SUCCEED\n");
 		/* Set the status so that SEMI_STATIC vars are polled */
 		data_has_changed = TRUE;
@@ -935,7 +1077,7 @@ int instcmd(const char *cmdname, const char *extradata)
 /* set r/w variable to a value. */
 int setvar(const char *varname, const char *val)
 {
-	hid_info_t	*hidups_item;
+	const hid_info_t	*hidups_item;
 	double		value;
 
 	upsdebugx(1, "setvar(%s, %s)", varname, val);
@@ -975,7 +1117,7 @@ int setvar(const char *varname, const char *val)
 	}
 
 	/* Actual variable setting */
-	if (HIDSetDataValue(udev, hidups_item->hiddata, value) == 1) {
+	if (HIDSetDataValue(udev, *hid_item_data(hidups_item), value) == 1) {
 		upsdebugx(5, "setvar: SUCCEED\n");
 		/* Set the status so that SEMI_STATIC vars are polled */
 		data_has_changed = TRUE;
@@ -1031,6 +1173,9 @@ void upsdrv_help(void)
 void upsdrv_makevartable(void)
 {
 	char temp [MAX_STRING_SIZE];
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	size_t	i;
+#endif
 
 	upsdebugx(1, "upsdrv_makevartable...");
 
@@ -1083,6 +1228,9 @@ void upsdrv_makevartable(void)
 	addvar(VAR_FLAG, "disable_fix_report_desc",
 		"Set to disable fix-ups for broken USB encoding, etc. which we apply by default on certain vendors/products");
 
+	addvar(VAR_FLAG, "mapping_cache",
+		"Remember which mapped items the device does not answer for, and skip them at the next starts");
+
 	addvar(VAR_FLAG, "powercom_sdcmd_byte_order_fallback",
 		"Set to use legacy byte order for Powercom HID shutdown commands. Either it was wrong forever, or some older devices/firmwares had it the other way around");
 
@@ -1100,8 +1248,28 @@ void upsdrv_makevartable(void)
 		"Don't use polling, only use interrupt pipe");
 	addvar(VAR_VALUE, "interruptsize",
 		"Number of bytes to read from interrupt pipe");
+	addvar(VAR_FLAG, "interrupt_async",
+		"Keep an interrupt transfer pending and handle the reports as they come");
+	addvar(VAR_FLAG, "hotplug",
+		"Wait for hotplug events to reconnect, rather than looking for the device at each poll");
 	addvar(VAR_VALUE, HU_VAR_WAITBEFORERECONNECT,
 		"Seconds to wait before trying to reconnect");
+	addvar(VAR_VALUE, "usb_record",
+		"Record what the device says to this file");
+	addvar(VAR_VALUE, "usb_replay",
+		"Replay a recording made with usb_record instead of using a device");
+	addvar(VAR_VALUE, "usb_replay_speed",
+		"How many times faster than recorded to replay (0: as fast as asked for)");
+
+	/* several devices may share this process, see ups.conf "hostgroup" */
+	addhostvars(usbhid_hostvars);
+	addhostvars(nut_usb_hostvars());
+	addhostvars(usb_replay_hostvars());
+	for (i = 0; subdriver_list[i] != NULL; i++) {
+		if (subdriver_list[i]->hostvars) {
+			addhostvars(subdriver_list[i]->hostvars);
+		}
+	}
 
 #else	/* SHUT_MODE */
 	addvar(VAR_VALUE, "notification",
@@ -1113,10 +1281,13 @@ void upsdrv_makevartable(void)
 
 void upsdrv_updateinfo(void)
 {
-	hid_info_t	*item;
+	const hid_info_t	*item;
 	HIDData_t	*event[MAX_EVENT_NUM], *found_data;
-	int		i, evtCount;
-	double		value;
+	int		i, evtCount, evtDecoded;
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	int		evtTotal = 0;
+#endif
+	double		value, evtValue[MAX_EVENT_NUM];
 	time_t		now;
 
 	upsdebugx(1, "upsdrv_updateinfo...");
@@ -1125,8 +1296,14 @@ void upsdrv_updateinfo(void)
 
 	/* check for device availability to set datastale! */
 	if (hd == NULL) {
+#if !((defined SHUT_MODE) && SHUT_MODE)
+		/* curDevice still describes the lost device until the first
+		 * reconnection attempt looks at the others */
+		hu_hotplug_watch(TRUE);
+#endif
+
 		/* don't flood reconnection attempts */
-		if (now < (lastpoll + poll_interval)) {
+		if (!hu_reconnect_due(now)) {
 			return;
 		}
 
@@ -1146,16 +1323,26 @@ void upsdrv_updateinfo(void)
 		hd = &curDevice;
 		interrupt_pipe_EIO_count = 0;
 		interrupt_pipe_no_events_count = 0;
+#if !((defined SHUT_MODE) && SHUT_MODE)
+		hu_hotplug_watch(FALSE);
+#endif
 
 		if (hid_ups_walk(HU_WALKMODE_INIT) == FALSE) {
 			hd = NULL;
 			return;
 		}
+
+#if !((defined SHUT_MODE) && SHUT_MODE)
+		hu_interrupt_async_start();
+#endif
 	}
 #ifdef DEBUG
 	interval();
 #endif
 
+#if !((defined SHUT_MODE) && SHUT_MODE)
+next_report:
+#endif
 	/* Get HID notifications on Interrupt pipe first */
 	if (use_interrupt_pipe == TRUE) {
 		evtCount = HIDGetEvents(udev, event, MAX_EVENT_NUM);
@@ -1165,6 +1352,11 @@ void upsdrv_updateinfo(void)
 			upslog_with_errno(LOG_CRIT, "Got disconnected by another driver");
 			goto fallthrough_reconnect;
 		case NUT_LIBUSB_CODE_NO_EVENTS:	/* No HID Events */
+#if !((defined SHUT_MODE) && SHUT_MODE)
+			/* the queue of reports which came in is drained */
+			if (interrupt_async_active && evtTotal > 0)
+				break;
+#endif
 			interrupt_pipe_no_events_count++;
 			upsdebugx(1, "Got 0 HID objects (%ld times in a row, tolerance is %ld)...",
 				interrupt_pipe_no_events_count, interrupt_pipe_no_events_tolerance);
@@ -1211,11 +1403,15 @@ void upsdrv_updateinfo(void)
 		upsdebugx(1, "Not using interrupt pipe...");
 	}
 
-	/* Process pending events (HID notifications on Interrupt pipe) */
-	for (i = 0; i < evtCount; i++) {
+	/* Process pending events (HID notifications on Interrupt pipe);
+	 * they all come from the report just received, decode it once */
+	evtDecoded = (evtCount > 0
+		&& HIDGetDataValues(udev, event, evtCount, evtValue, poll_interval) == 1)
+		? evtCount : 0;
 
-		if (HIDGetDataValue(udev, event[i], &value, poll_interval) != 1)
-			continue;
+	for (i = 0; i < evtDecoded; i++) {
+
+		value = evtValue[i];
 
 		if (nut_debug_level >= 2) {
 			upsdebugx(2,
@@ -1243,6 +1439,14 @@ void upsdrv_updateinfo(void)
 
 		ups_infoval_set(item, value);
 	}
+
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	/* one report at a time: the next may be for the same report ID */
+	if (interrupt_async_active && evtCount > 0) {
+		evtTotal += evtCount;
+		goto next_report;
+	}
+#endif
 #ifdef DEBUG
 	upsdebugx(1, "took %.3f seconds handling interrupt reports...\n",
 		interval());
@@ -1277,6 +1481,11 @@ void upsdrv_updateinfo(void)
 	status_commit();
 
 	dstate_dataok();
+#if (defined SHUT_MODE) && SHUT_MODE
+	if (dstate_getinfo("driver.flag.perfstats")) {
+		libshut_update_stats();
+	}
+#endif	/* SHUT_MODE */
 #ifdef DEBUG
 	upsdebugx(1, "took %.3f seconds handling feature reports...\n",
 		interval());
@@ -1330,6 +1539,26 @@ void upsdrv_initinfo(void)
 	}
 	dstate_setinfo("driver.parameter.interrupt_pipe_no_events_tolerance", "%ld", interrupt_pipe_no_events_tolerance);
 
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	/* both watch the fds of the libusb context, which is one for all
+	 * the devices of this process (and so are the transfer and hotplug
+	 * callback the communication driver keeps) */
+	if (hosted_devices > 1) {
+		if (testvar("interrupt_async") || testvar("hotplug")) {
+			upslogx(LOG_WARNING, "The interrupt_async and hotplug flags "
+				"are ignored when the driver runs several devices");
+		}
+	} else {
+		if (testvar("interrupt_async")) {
+			interrupt_async = TRUE;
+		}
+		if (testvar("hotplug")) {
+			hotplug = TRUE;
+		}
+	}
+	hu_interrupt_async_start();
+#endif	/* !SHUT_MODE => USB */
+
 	time(&lastpoll);
 
 	/* install handlers */
@@ -1413,6 +1642,21 @@ void upsdrv_initups(void)
 
 	/* link the matchers */
 	subdriver_matcher->next = regex_matcher;
+
+	/* Talk to a recording rather than to the device, or record it */
+	val = getval("usb_replay");
+	if (val) {
+		double	speed = 0;
+		char	*speedval = getval("usb_replay_speed");
+
+		if (speedval && (!str_to_double(speedval, &speed, 10) || speed < 0)) {
+			fatalx(EXIT_FAILURE, "Error: invalid usb_replay_speed: %s", speedval);
+		}
+
+		comm_driver = usb_replay_open(val, speed);
+	} else if ((val = getval("usb_record")) != NULL) {
+		comm_driver = usb_record_open(comm_driver, val);
+	}
 #endif /* SHUT_MODE / USB */
 
 	/* First activate the few tweaks which can impact device detection */
@@ -1436,6 +1680,10 @@ void upsdrv_initups(void)
 		disable_fix_report_desc = 1;
 	}
 
+	if (testvar("mapping_cache")) {
+		mapping_cache = TRUE;
+	}
+
 	/* Search for the first supported UPS matching the
 	   regular expression (USB) or device_path (SHUT) */
 	ret = comm_driver->open_dev(&udev, &curDevice, subdriver_matcher, &callback);
@@ -1647,9 +1895,23 @@ void upsdrv_cleanup(void)
 {
 	upsdebugx(1, "upsdrv_cleanup...");
 
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	hu_hotplug_watch(FALSE);
+#endif
 	comm_driver->close_dev(udev);
 	Free_ReportDesc(pDesc);
 	free_report_buffer(reportbuf);
+	free(hid_data);
+	hid_data = NULL;
+	hid_data_table = NULL;
+	hid_info_index_free();
+	HIDFreePathCache();
+	free(hid_absent);
+	hid_absent = NULL;
+	hid_absent_table = NULL;
+	free(hid_gen);
+	hid_gen = NULL;
+	hid_gen_table = NULL;
 #if !((defined SHUT_MODE) && SHUT_MODE)
 	USBFreeExactMatcher(exact_matcher);
 	USBFreeRegexMatcher(regex_matcher);
@@ -1755,6 +2017,9 @@ static int callback(
 	/* Parse Report Descriptor */
 	Free_ReportDesc(pDesc);
 	pDesc = Parse_ReportDesc(rdbuf, rdlen);
+	if (rdlen > 0) {
+		hid_desc_crc = hu_crc32((const unsigned char *)rdbuf, (size_t)rdlen);
+	}
 	if (!pDesc) {
 		upsdebug_with_errno(1, "Failed to parse report descriptor!");
 		return 0;
@@ -1791,6 +2056,7 @@ static int callback(
 	if (subdriver->fix_report_desc(arghd, pDesc)) {
 		upsdebugx(2, "Report Descriptor Fixed");
 	}
+	HIDPrepareConversions(pDesc);
 	HIDDumpTree(udev, arghd, subdriver->utab);
 
 #if !((defined SHUT_MODE) && SHUT_MODE)
@@ -1865,7 +2131,8 @@ int fix_report_desc(HIDDevice_t *arg_pDev, HIDDesc_t *arg_pDesc) {
 /* walk ups variables and set elements of the info array. */
 static bool_t hid_ups_walk(walkmode_t mode)
 {
-	hid_info_t	*item;
+	const hid_info_t	*item;
+	HIDData_t	*hiddata;
 	double		value;
 	int		retcode;
 
@@ -1878,6 +2145,16 @@ static bool_t hid_ups_walk(walkmode_t mode)
 	/* 3 modes: HU_WALKMODE_INIT, HU_WALKMODE_QUICK_UPDATE
 	 * and HU_WALKMODE_FULL_UPDATE */
 
+	/* the mapping changes: look entries up the slow way until it is made */
+	if (mode == HU_WALKMODE_INIT) {
+		hid_index_table = NULL;
+		hid_gen_table = NULL;
+		hu_cache_load();
+	}
+
+	/* get each report the items below need once */
+	begin_report_walk(reportbuf);
+
 	/* Device data walk ----------------------------- */
 	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
 
@@ -1885,8 +2162,10 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		/* Check if we are asked to stop (reactivity++) in SHUT mode.
 		 * In USB mode, looping through this takes well under a second,
 		 * so any effort to improve reactivity here is wasted. */
-		if (exit_flag != 0)
+		if (exit_flag != 0) {
+			end_report_walk(reportbuf);
 			return TRUE;
+		}
 #endif	/* SHUT_MODE */
 
 		/* filter data according to mode */
@@ -1896,12 +2175,16 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		case HU_WALKMODE_INIT:
 			/* Apparently, we are reconnecting, so
 			 * NUT-to-HID translation is already good */
-			if (item->hiddata != NULL)
+			if (*hid_item_data(item) != NULL)
 				break;
 
+			/* the device did not answer for it before */
+			if (hu_cache_absent(item))
+				continue;
+
 			/* Create the NUT-to-HID mapping */
-			item->hiddata = HIDGetItemData(item->hidpath, subdriver->utab);
-			if (item->hiddata == NULL)
+			*hid_item_data(item) = HIDGetItemData(item->hidpath, subdriver->utab);
+			if (*hid_item_data(item) == NULL)
 				continue;
 
 			/* Special case for handling server side variables */
@@ -1932,7 +2215,7 @@ static bool_t hid_ups_walk(walkmode_t mode)
 			}
 
 			/* ...but this one does, so don't use it! */
-			item->hiddata = NULL;
+			*hid_item_data(item) = NULL;
 			continue;
 
 		case HU_WALKMODE_QUICK_UPDATE:
@@ -1982,16 +2265,18 @@ static bool_t hid_ups_walk(walkmode_t mode)
 # pragma GCC diagnostic pop
 #endif
 
+		hiddata = *hid_item_data(item);
+
 #if !((defined SHUT_MODE) && SHUT_MODE)
 		/* skip report 0x54 for Tripplite SU3000LCD2UHV due to firmware bug */
 		if ((vendorID == 0x09ae) && (productID == 0x1330)) {
-			if (item->hiddata && (item->hiddata->ReportID == 0x54)) {
+			if (hiddata && (hiddata->ReportID == 0x54)) {
 				continue;
 			}
 		}
 #endif	/* !SHUT_MODE => USB */
 
-		retcode = HIDGetDataValue(udev, item->hiddata, &value, poll_interval);
+		retcode = HIDGetDataValue(udev, hiddata, &value, poll_interval);
 
 		switch (retcode)
 		{
@@ -2013,6 +2298,7 @@ static bool_t hid_ups_walk(walkmode_t mode)
 			/* Uh oh, got to reconnect! */
 			dstate_setinfo("driver.state", "reconnect.trying");
 			hd = NULL;
+			end_report_walk(reportbuf);
 			return FALSE;
 
 		case LIBUSB_ERROR_IO:        /* I/O error */
@@ -2020,6 +2306,7 @@ static bool_t hid_ups_walk(walkmode_t mode)
 			dstate_setinfo("driver.state", "reconnect.trying");
 			interrupt_pipe_EIO_count++;
 			hd = NULL;
+			end_report_walk(reportbuf);
 			return FALSE;
 
 		case 1:
@@ -2041,15 +2328,33 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		default:
 			/* Don't know what happened, try again later... */
 		   upsdebugx(1, "HIDGetDataValue unknown retcode '%i'", retcode);
+			if (mode == HU_WALKMODE_INIT)
+				hu_cache_mark_absent(item);
 			continue;
 		}
 
 		upsdebugx(2,
 			"Path: %s, Type: %s, ReportID: 0x%02x, "
 			"Offset: %i, Size: %i, Value: %g",
-			item->hidpath, HIDDataType(item->hiddata),
-			item->hiddata->ReportID,
-			item->hiddata->Offset, item->hiddata->Size, value);
+			item->hidpath, HIDDataType(hiddata),
+			hiddata->ReportID,
+			hiddata->Offset, hiddata->Size, value);
+
+		/* Same report data as when this item was last published: so
+		 * is its value, unless a setvar may have published another
+		 * one meanwhile. Alarms are collected anew at each walk, and
+		 * status bits can come from several items, in table order.
+		 * A lookup function may read more than the report (other
+		 * variables, what the subdriver learnt of the device), so
+		 * its items are published at each walk. */
+		if (mode != HU_WALKMODE_INIT && data_has_changed == FALSE
+		 && strncmp(item->info_type, "ups.alarm", 9)
+		 && strncmp(item->info_type, "BOOL", 4)
+		 && (item->hid2info == NULL || item->hid2info->fun == NULL)
+		 && hu_item_unchanged(item, hiddata)
+		) {
+			continue;
+		}
 
 		if (item->hidflags & HU_TYPE_CMD) {
 			upsdebugx(3, "Adding command '%s' using Path '%s'",
@@ -2089,9 +2394,92 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 	}
 
+	end_report_walk(reportbuf);
+
+	if (mode == HU_WALKMODE_INIT) {
+		hid_info_index_build();
+		hu_cache_save();
+	}
+
 	return TRUE;
 }
 
+#if !((defined SHUT_MODE) && SHUT_MODE)
+/* Have the communication driver keep an interrupt transfer submitted (the
+ * "interrupt_async" flag), so the main loop wakes up for the reports as
+ * they come; otherwise (or if it can not) the interrupt pipe is read once
+ * per update, as usual */
+static void hu_interrupt_async_start(void)
+{
+	size_t	r = (interrupt_size > 0 && interrupt_size < SMALLBUF)
+		? interrupt_size : SMALLBUF;
+
+	interrupt_async_active = FALSE;
+
+	if (interrupt_async == FALSE || use_interrupt_pipe == FALSE)
+		return;
+
+	if (comm_driver->start_interrupt_async == NULL
+	 || comm_driver->start_interrupt_async(udev, (usb_ctrl_charbufsize)r) < 0
+	) {
+		upslogx(LOG_WARNING, "Asynchronous interrupt transfers are not "
+			"available, reading the interrupt pipe at each update");
+		return;
+	}
+
+	interrupt_async_active = TRUE;
+}
+
+/* Start (when the device got lost) or stop (once it is back) watching
+ * for its arrival, with the "hotplug" flag and a communication driver
+ * which can */
+static void hu_hotplug_watch(bool_t on)
+{
+	if (hotplug == FALSE || on == hotplug_watching)
+		return;
+
+	hotplug_pending = FALSE;
+
+	if (on == FALSE) {
+		comm_driver->watch_hotplug(NULL);
+		hotplug_watching = FALSE;
+		return;
+	}
+
+	if (comm_driver->watch_hotplug == NULL
+	 || comm_driver->watch_hotplug(&curDevice) < 0
+	) {
+		upslogx(LOG_WARNING, "Hotplug events are not available, "
+			"looking for the device every pollinterval");
+		hotplug = FALSE;
+		return;
+	}
+
+	hotplug_watching = TRUE;
+}
+#endif	/* !SHUT_MODE => USB */
+
+/* Whether to look for the lost device now: once per poll_interval, or
+ * with hotplug events, right when it arrived and then once per
+ * poll_interval until it is reconnected (e.g. while its permissions are
+ * being set), but not at all while it is away */
+static bool_t hu_reconnect_due(time_t now)
+{
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	if (hotplug_watching) {
+		if (comm_driver->hotplug_arrived()) {
+			hotplug_pending = TRUE;
+			return TRUE;
+		}
+
+		if (hotplug_pending == FALSE)
+			return FALSE;
+	}
+#endif	/* !SHUT_MODE => USB */
+
+	return (now >= lastpoll + poll_interval) ? TRUE : FALSE;
+}
+
 static int reconnect_ups(void)
 {
 	int ret;
@@ -2505,19 +2893,283 @@ static void ups_status_set(void)
 	}
 }
 
+/* where the HID Object data of this entry of subdriver->hid2nut is kept,
+ * the slots start as NULL for each new subdriver table */
+static HIDData_t **hid_item_data(const hid_info_t *item)
+{
+	if (hid_data_table != subdriver->hid2nut) {
+		const hid_info_t	*p;
+		size_t	n = 0;
+
+		for (p = subdriver->hid2nut; p->info_type != NULL; p++)
+			n++;
+
+		free(hid_data);
+		hid_data = xcalloc(n + 1, sizeof(*hid_data));
+		hid_data_table = subdriver->hid2nut;
+	}
+
+	return &hid_data[item - subdriver->hid2nut];
+}
+
+static size_t hid_info_name_hash(const char *name)
+{
+	size_t	hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (size_t)tolower((unsigned char)*name++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static size_t hid_info_data_hash(const HIDData_t *hiddata)
+{
+	return (size_t)((uintptr_t)hiddata / sizeof(*hiddata)) * 2654435761U;
+}
+
+static void hid_info_index_free(void)
+{
+	free(hid_index_name);
+	free(hid_index_data);
+	hid_index_name = NULL;
+	hid_index_data = NULL;
+	hid_index_size = 0;
+	hid_index_table = NULL;
+}
+
+/* Index the entries of subdriver->hid2nut which have HID Object data,
+ * for find_nut_info() and find_hid_info(); as in their scans, the first
+ * entry of a name or of a data pointer is the one found */
+static void hid_info_index_build(void)
+{
+	const hid_info_t	*item;
+	HIDData_t	*hiddata;
+	size_t	n = 0, i, mask;
+
+	hid_info_index_free();
+
+	/* keep the hashes at most half full */
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++)
+		n++;
+	for (hid_index_size = 64; hid_index_size < n * 2; hid_index_size *= 2)
+		;
+	hid_index_name = xcalloc(hid_index_size, sizeof(*hid_index_name));
+	hid_index_data = xcalloc(hid_index_size, sizeof(*hid_index_data));
+	mask = hid_index_size - 1;
+
+	for (n = 0, item = subdriver->hid2nut; item->info_type != NULL; n++, item++) {
+		if ((hiddata = *hid_item_data(item)) == NULL)
+			continue;
+
+		for (i = hid_info_name_hash(item->info_type) & mask; hid_index_name[i]; i = (i + 1) & mask) {
+			if (!strcasecmp(subdriver->hid2nut[hid_index_name[i] - 1].info_type, item->info_type))
+				break;
+		}
+		if (!hid_index_name[i])
+			hid_index_name[i] = n + 1;
+
+		/* Skip server side vars */
+		if (item->hidflags & HU_FLAG_ABSENT)
+			continue;
+
+		for (i = hid_info_data_hash(hiddata) & mask; hid_index_data[i]; i = (i + 1) & mask) {
+			if (*hid_item_data(&subdriver->hid2nut[hid_index_data[i] - 1]) == hiddata)
+				break;
+		}
+		if (!hid_index_data[i])
+			hid_index_data[i] = n + 1;
+	}
+
+	hid_index_table = subdriver->hid2nut;
+}
+
+/* CRC-32 (IEEE 802.3), to tell report descriptors apart */
+static uint32_t hu_crc32(const unsigned char *buf, size_t len)
+{
+	uint32_t	crc = 0xFFFFFFFFU;
+	size_t	i;
+	int	bit;
+
+	for (i = 0; i < len; i++) {
+		crc ^= buf[i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+static void hu_cache_path(char *buf, size_t buflen)
+{
+	snprintf(buf, buflen, "%s/%s-%s.hidmap", dflt_statepath(), progname, upsname);
+}
+
+/* the absent entries of the current table, all 0 for a new table */
+static char *hu_cache_table(void)
+{
+	const hid_info_t	*p;
+	size_t	n = 0;
+
+	if (hid_absent_table != subdriver->hid2nut) {
+		for (p = subdriver->hid2nut; p->info_type != NULL; p++)
+			n++;
+
+		free(hid_absent);
+		hid_absent = xcalloc(n + 1, 1);
+		hid_absent_table = subdriver->hid2nut;
+		hid_absent_dirty = TRUE;
+	}
+
+	return hid_absent;
+}
+
+static bool_t hu_cache_absent(const hid_info_t *item)
+{
+	if (!mapping_cache)
+		return FALSE;
+
+	return hu_cache_table()[item - subdriver->hid2nut] ? TRUE : FALSE;
+}
+
+static void hu_cache_mark_absent(const hid_info_t *item)
+{
+	if (!mapping_cache)
+		return;
+
+	upsdebugx(2, "%s: no answer for %s (%s), skipped from now on",
+		__func__, item->info_type, item->hidpath);
+	hu_cache_table()[item - subdriver->hid2nut] = 1;
+	hid_absent_dirty = TRUE;
+}
+
+/* Read which entries of the mapping table the device did not answer for
+ * when it was first set up, if that was the same device (VID, PID and
+ * report descriptor CRC) with the same subdriver. The file is a header
+ * line, then one line per absent entry: its index in the table, and its
+ * name and HID path to check that it is the same table. */
+static void hu_cache_load(void)
+{
+	char	path[LARGEBUF], line[LARGEBUF], name[SMALLBUF], hidpath[SMALLBUF];
+	char	header[LARGEBUF], *absent;
+	unsigned int	vid, pid;
+	unsigned long	crc, idx;
+	size_t	n = 0;
+	FILE	*f;
+	const hid_info_t	*p;
+
+	if (!mapping_cache || hid_absent_table == subdriver->hid2nut)
+		return;	/* not asked for, or already loaded for this table */
+
+	absent = hu_cache_table();
+	for (p = subdriver->hid2nut; p->info_type != NULL; p++)
+		n++;
+
+	hu_cache_path(path, sizeof(path));
+	f = fopen(path, "r");
+	if (!f) {
+		upsdebugx(1, "%s: no mapping cache in %s", __func__, path);
+		return;
+	}
+
+	snprintf(header, sizeof(header), "%s", "");
+	if (!fgets(line, sizeof(line), f)
+	 || sscanf(line, "NUT-HIDMAP 1 %x %x %lx %511s", &vid, &pid, &crc, header) != 4
+	 || vid != hd->VendorID || pid != hd->ProductID
+	 || (uint32_t)crc != hid_desc_crc || strcmp(header, subdriver->name)
+	) {
+		upsdebugx(1, "%s: mapping cache in %s is for another device, not used",
+			__func__, path);
+		fclose(f);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lu %511s %511s", &idx, name, hidpath) != 3
+		 || idx >= n
+		 || strcmp(subdriver->hid2nut[idx].info_type, name)
+		 || strcmp(subdriver->hid2nut[idx].hidpath, hidpath)
+		) {
+			upsdebugx(1, "%s: mapping cache in %s does not match "
+				"the mapping table, not used", __func__, path);
+			memset(absent, 0, n);
+			fclose(f);
+			return;
+		}
+		absent[idx] = 1;
+	}
+
+	fclose(f);
+	hid_absent_dirty = FALSE;
+	upsdebugx(1, "%s: using mapping cache %s", __func__, path);
+}
+
+/* Write the absent entries down for the next start, if that changed */
+static void hu_cache_save(void)
+{
+	char	path[LARGEBUF], tmppath[LARGEBUF + 8];
+	size_t	i;
+	FILE	*f;
+	const hid_info_t	*p;
+
+	if (!mapping_cache || !hid_absent_dirty)
+		return;
+
+	hu_cache_table();
+	hu_cache_path(path, sizeof(path));
+	snprintf(tmppath, sizeof(tmppath), "%s.new", path);
+
+	f = fopen(tmppath, "w");
+	if (!f) {
+		upslog_with_errno(LOG_WARNING, "Can't write the mapping cache %s", tmppath);
+		return;
+	}
+
+	fprintf(f, "NUT-HIDMAP 1 %04x %04x %08lx %s\n",
+		(unsigned int)hd->VendorID, (unsigned int)hd->ProductID,
+		(unsigned long)hid_desc_crc, subdriver->name);
+	for (i = 0, p = subdriver->hid2nut; p->info_type != NULL; i++, p++) {
+		if (hid_absent[i])
+			fprintf(f, "%" PRIuSIZE " %s %s\n", i, p->info_type, p->hidpath);
+	}
+
+	if (fclose(f) != 0 || rename(tmppath, path) != 0) {
+		upslog_with_errno(LOG_WARNING, "Can't write the mapping cache %s", path);
+		unlink(tmppath);
+		return;
+	}
+
+	hid_absent_dirty = FALSE;
+	upsdebugx(1, "%s: wrote mapping cache %s", __func__, path);
+}
+
 /* find info element definition in info array
  * by NUT varname.
  */
-static hid_info_t *find_nut_info(const char *varname)
+static const hid_info_t *find_nut_info(const char *varname)
 {
-	hid_info_t *hidups_item;
+	const hid_info_t *hidups_item;
+	size_t	i, mask;
+
+	if (hid_index_table == subdriver->hid2nut) {
+		mask = hid_index_size - 1;
+		for (i = hid_info_name_hash(varname) & mask; hid_index_name[i]; i = (i + 1) & mask) {
+			hidups_item = &subdriver->hid2nut[hid_index_name[i] - 1];
+			if (!strcasecmp(hidups_item->info_type, varname))
+				return hidups_item;
+		}
+
+		upsdebugx(2, "find_nut_info: unknown info type: %s", varname);
+		return NULL;
+	}
 
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 
 		if (strcasecmp(hidups_item->info_type, varname))
 			continue;
 
-		if (hidups_item->hiddata != NULL)
+		if (*hid_item_data(hidups_item) != NULL)
 			return hidups_item;
 	}
 
@@ -2528,22 +3180,34 @@ static hid_info_t *find_nut_info(const char *varname)
 /* find info element definition in info array
  * by HID data pointer.
  */
-static hid_info_t *find_hid_info(const HIDData_t *hiddata)
+static const hid_info_t *find_hid_info(const HIDData_t *hiddata)
 {
-	hid_info_t *hidups_item;
+	const hid_info_t *hidups_item;
+	size_t	i, mask;
 
 	if(!hiddata) {
 		upsdebugx(2, "%s: hiddata == NULL", __func__);
 		return NULL;
 	}
 
+	if (hid_index_table == subdriver->hid2nut) {
+		mask = hid_index_size - 1;
+		for (i = hid_info_data_hash(hiddata) & mask; hid_index_data[i]; i = (i + 1) & mask) {
+			hidups_item = &subdriver->hid2nut[hid_index_data[i] - 1];
+			if (*hid_item_data(hidups_item) == hiddata)
+				return hidups_item;
+		}
+
+		return NULL;
+	}
+
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 
 		/* Skip server side vars */
 		if (hidups_item->hidflags & HU_FLAG_ABSENT)
 			continue;
 
-		if (hidups_item->hiddata == hiddata)
+		if (*hid_item_data(hidups_item) == hiddata)
 			return hidups_item;
 	}
 
@@ -2606,9 +3270,28 @@ static const char *hu_find_infoval(info_lkp_t *hid2info, const double value)
 }
 
 /* return -1 on failure, 0 for a status update and 1 in all other cases */
-static int ups_infoval_set(hid_info_t *item, double value)
+/* the number of digits of a plain "%.Nf" (or "%0.Nf") format, else -1 */
+static int dfl_precision(const char *dfl)
+{
+	if (!dfl || dfl[0] != '%') {
+		return -1;
+	}
+
+	dfl += (dfl[1] == '0') ? 2 : 1;
+
+	if (dfl[0] != '.' || dfl[1] < '0' || dfl[1] > '9'
+	 || dfl[2] != 'f' || dfl[3] != '\0'
+	) {
+		return -1;
+	}
+
+	return dfl[1] - '0';
+}
+
+static int ups_infoval_set(const hid_info_t *item, double value)
 {
 	const char	*nutvalue;
+	int	precision;
 
 	/* need lookup'ed translation? */
 	if (item->hid2info != NULL){
@@ -2631,6 +3314,9 @@ static int ups_infoval_set(hid_info_t *item, double value)
 		}
 
 		dstate_setinfo(item->info_type, "%s", nutvalue);
+	} else if ((precision = dfl_precision(item->dfl)) >= 0) {
+		/* most are, and most do not change from one poll to the next */
+		dstate_setinfo_double(item->info_type, value, precision);
 	} else {
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
@@ -40,6 +40,7 @@
 #include <unistd.h>
 
 #include "libhid.h"
+#include "dstate.h"	/* for dstate_hostvar_t */
 
 extern hid_dev_handle_t	udev;
 extern bool_t	 	use_interrupt_pipe;	/* Set to FALSE if interrupt reports should not be used */
@@ -178,7 +179,8 @@ typedef struct {
 	int	info_len;		/* if ST_FLAG_STRING: length of the string */
 					/* if HU_TYPE_CMD: command value */
 	const char	*hidpath;		/* Full HID Object path (or NULL for server side vars) */
-	HIDData_t *hiddata;		/* Full HID Object data (for caching purpose, filled at runtime) */
+	HIDData_t *hiddata;		/* Unused: the tables are read-only, so usbhid-ups keeps the
+					 * HID Object data it finds for hidpath aside (leave NULL) */
 	const char	*dfl;			/* if HU_FLAG_ABSENT: default value ; format otherwise */
 	unsigned long hidflags;		/* driver's own flags */
 	info_lkp_t *hid2info;		/* lookup table between HID and NUT values */
@@ -221,11 +223,12 @@ typedef struct {
 	int (*claim)(HIDDevice_t *hd); /* return 1 if device covered by
 				      * this subdriver */
 	usage_tables_t *utab;        /* points to array of usage tables */
-	hid_info_t *hid2nut;         /* main table of vars and instcmds */
+	const hid_info_t *hid2nut;   /* main table of vars and instcmds */
 	const char *(*format_model)(HIDDevice_t *hd);  /* driver-specific methods */
 	const char *(*format_mfr)(HIDDevice_t *hd);    /* for preparing human-    */
 	const char *(*format_serial)(HIDDevice_t *hd); /* readable information    */
 	int	(*fix_report_desc)(HIDDevice_t *pDev, HIDDesc_t *arg_pDesc);		/* Function called to potentially remedy defects in the parsed Report Descriptor caused by buggy HID contents*/
+	const dstate_hostvar_t *hostvars;	/* what it learns of the device, if anything (see addhostvars()) */
 } subdriver_t;
 
 /* the following functions are exported for the benefit of subdrivers */
@@ -72,7 +72,7 @@ static info_lkp_t xpcc_power_info[] = {
 };
 
 /* XPPC Snmp2NUT lookup table */
-static snmp_info_t xppc_mib[] = {
+static const snmp_info_t xppc_mib[] = {
 
 	/* Data format:
 	 * snmp_info_default(info_type, info_flags, info_len, OID, dfl, flags, oid2info, setvar),
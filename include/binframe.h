@@ -0,0 +1,86 @@
+/* binframe.h - Network UPS Tools binary framing of network protocol replies
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_BINFRAME_H_SEEN
+#define NUT_BINFRAME_H_SEEN 1
+
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* After "FRAMING BINARY", upsd answers GET VAR and LIST VAR with records
+ * instead of text lines (see docs/net-protocol.txt); errors still come
+ * as "ERR ..." lines, which readers tell apart by the first byte: all
+ * record types are below BINFRAME_TYPE_MAX, so never printable.
+ *
+ * A record is its type (1 byte) and the length of what follows (2 bytes,
+ * network byte order), then:
+ *   BEGIN, END:	the text of the list header after "BEGIN LIST " or
+ *			"END LIST ", e.g. "VAR su700" or "VAR su700 SINCE 123"
+ *   NAME:	id (4 bytes), "<upsname> <varname>"; later records refer
+ *		to that variable by the id, for the rest of the connection
+ *   STR:	id, the raw (not escaped) value
+ *   NUM:	id, decimals (1 byte), mantissa (8 bytes, two's complement):
+ *		a value of mantissa / 10^decimals, whose text is exactly
+ *		what binframe_num_format() makes of it
+ *   RESET:	no payload, forget all ids defined so far
+ */
+#define BINFRAME_BEGIN		0x01
+#define BINFRAME_END		0x02
+#define BINFRAME_NAME		0x03
+#define BINFRAME_STR		0x04
+#define BINFRAME_NUM		0x05
+#define BINFRAME_RESET		0x06
+#define BINFRAME_TYPE_MAX	0x20
+
+#define BINFRAME_HEADER_LEN	3
+#define BINFRAME_ID_LEN		4
+#define BINFRAME_NUM_LEN	(BINFRAME_ID_LEN + 1 + 8)
+#define BINFRAME_MAX_LEN	65535
+
+/* at most this many digits fit in the mantissa */
+#define BINFRAME_NUM_DIGITS	18
+
+/* writes the record header for a payload of len bytes into buf,
+ * returns BINFRAME_HEADER_LEN */
+size_t binframe_header(unsigned char *buf, unsigned int type, size_t len);
+
+void binframe_put_u32(unsigned char *buf, uint32_t val);
+uint32_t binframe_get_u32(const unsigned char *buf);
+void binframe_put_i64(unsigned char *buf, int64_t val);
+int64_t binframe_get_i64(const unsigned char *buf);
+
+/* 1 if val is a decimal number which binframe_num_format() gives back
+ * unchanged (no leading zeros or "+", no exponent, not "-0"), else 0 */
+int binframe_num_parse(const char *val, int64_t *mantissa, unsigned int *decimals);
+
+/* the text of a NUM record value; returns its length, or 0 if it did
+ * not fit into bufsize or decimals is out of range */
+size_t binframe_num_format(int64_t mantissa, unsigned int decimals,
+	char *buf, size_t bufsize);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_BINFRAME_H_SEEN */
@@ -322,6 +322,29 @@ pid_t get_max_pid_t(void);
  * -1 for error, or zero for a successfully sent signal */
 int sendsignalpid(pid_t pid, int sig, const char *progname, int check_current_progname);
 
+#ifndef WIN32
+/* A process to signal more than once, e.g. to stop it and then see it
+ * go: nut_proc_open() does the sendsignalpid() checks of its name once,
+ * and nut_proc_signal() then works like sendsignalpid() without them.
+ * On Linux it holds a pidfd, so the signals reach that very process or
+ * fail once it is gone, even if its PID got reused (and poll() on the
+ * pidfd tells when it exits); elsewhere each signal repeats the checks.
+ */
+typedef struct nut_proc_s {
+	pid_t	pid;
+	int	pidfd;		/* -1 if none */
+	const char	*progname;	/* for sendsignalpid() without a pidfd */
+	int	check_current_progname;
+} nut_proc_t;
+
+/* returns 0 if the process passed the checks and can be signalled,
+ * -1 if not (then nothing needs closing) */
+int nut_proc_open(nut_proc_t *proc, pid_t pid, const char *progname, int check_current_progname);
+/* returns 0 for a successfully sent signal, -1 for errors */
+int nut_proc_signal(nut_proc_t *proc, int sig);
+void nut_proc_close(nut_proc_t *proc);
+#endif
+
 /* open <pidfn> and get the pid
  * returns zero or more for successfully retrieved value,
  * negative for errors:
@@ -356,6 +379,19 @@ const char *xbasename(const char *file);
    the syslog */
 void syslogbit_set(void);
 
+/* Collect the messages for stderr in a buffer of this size, written at
+   once by upslog_flush(): a daemon with tracing on can call that from
+   its main loop rather than write each line. The lines its other threads
+   log go to the same buffer, under a mutex. Warnings and errors are
+   written right away, and the rest at exit or when the buffer is full.
+   A size of 0 goes back to writing each line. */
+void upslog_set_batch(size_t size);
+void upslog_flush(void);
+
+/* Called by fatalx() and fatal_with_errno() after the message is logged
+   and before the exit, e.g. to dump the trace ring (NULL for none) */
+void upslog_set_fatal_hook(void (*hook)(void));
+
 /* Return the default path for the directory containing configuration files */
 const char * confpath(void);
 
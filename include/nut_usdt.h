@@ -0,0 +1,93 @@
+/* nut_usdt.h - Network UPS Tools static probes (USDT) on the power event path
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_USDT_H_SEEN
+#define NUT_USDT_H_SEEN 1
+
+/* When built with --with-usdt (and <sys/sdt.h> of systemtap, which
+ * bpftrace and the dtrace-compatible tools also use), the daemons have
+ * probes of the "nut" provider where a change of the UPS status goes
+ * from a driver to upsd and upsmon; they cost a no-op instruction each
+ * until a tracer attaches. See scripts/tracing/ for one which prints
+ * how long each hop takes.
+ *
+ * The probes, and their arguments:
+ *   driver_status	(UPS name, ups.status, NUT_USDT_* flags)
+ *	status_commit() of a driver
+ *   upsd_status	(UPS name, ups.status, NUT_USDT_* flags)
+ *	upsd stored a new ups.status which came from the driver
+ *   upsmon_status	(UPS name, ups.status, NUT_USDT_* flags)
+ *	parse_status() of upsmon, for each poll
+ *   upsmon_onbatt	(UPS name)
+ *   upsmon_lowbatt	(UPS name)
+ *	upsmon saw the UPS go on battery, or its battery go low
+ *   upsmon_shutdown	(no arguments)
+ *	doshutdown() of upsmon, before it runs SHUTDOWNCMD
+ *
+ * The UPS name is the one in ups.conf, without the @host of upsmon.
+ */
+
+/* Status words in the flags argument, so that the tracers need not
+ * look for them in the string */
+#define NUT_USDT_OL	0x01
+#define NUT_USDT_OB	0x02
+#define NUT_USDT_LB	0x04
+#define NUT_USDT_FSD	0x08
+
+#if (defined WITH_USDT) && WITH_USDT
+# include <string.h>
+# include <sys/sdt.h>
+
+# define NUT_USDT_ON	1
+
+# define NUT_USDT0(probe)	DTRACE_PROBE(nut, probe)
+# define NUT_USDT1(probe, a)	DTRACE_PROBE1(nut, probe, (a))
+# define NUT_USDT_STATUS(probe, ups, status) \
+	DTRACE_PROBE3(nut, probe, (ups), (status), nut_usdt_flags(status))
+
+static inline int nut_usdt_word(const char *status, const char *word)
+{
+	size_t	len = strlen(word);
+	const char	*p;
+
+	for (p = status; (p = strstr(p, word)) != NULL; p += len) {
+		if ((p == status || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return 1;
+	}
+
+	return 0;
+}
+
+static inline int nut_usdt_flags(const char *status)
+{
+	if (!status)
+		return 0;
+
+	return (nut_usdt_word(status, "OL") ? NUT_USDT_OL : 0)
+		| (nut_usdt_word(status, "OB") ? NUT_USDT_OB : 0)
+		| (nut_usdt_word(status, "LB") ? NUT_USDT_LB : 0)
+		| (nut_usdt_word(status, "FSD") ? NUT_USDT_FSD : 0);
+}
+#else
+# define NUT_USDT_ON	0
+
+# define NUT_USDT0(probe)
+# define NUT_USDT1(probe, a)
+# define NUT_USDT_STATUS(probe, ups, status)
+#endif
+
+#endif	/* NUT_USDT_H_SEEN */
@@ -0,0 +1,55 @@
+/* nutbeacon.h - Network UPS Tools status beacons: what is in a datagram
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NUTBEACON_H_SEEN
+#define NUT_NUTBEACON_H_SEEN 1
+
+/* A beacon of upsd (see server/beacon.c) tells the status of all of its
+ * devices in a UDP datagram, sent to the BEACON addresses of upsd.conf
+ * (a multicast group, a broadcast address...) whenever one of them
+ * changes, and every BEACONINTERVAL seconds otherwise; upsmon can take
+ * the status from there rather than polling upsd for it (see BEACON in
+ * upsmon.conf).  All numbers are big-endian:
+ *
+ *	0	"NUTB"
+ *	4	version (1)
+ *	5	0
+ *	6	BEACONINTERVAL, in seconds (2 bytes)
+ *	8	id of this run of upsd, random (4 bytes)
+ *	12	sequence number, one more for each datagram (4 bytes)
+ *	16	when it was sent, in seconds since the epoch (8 bytes)
+ *	24	number of devices (2 bytes)
+ *	26	for each device: the length of its name (1 byte), its name,
+ *		flags (1 byte, NUT_BEACON_STALE), the ups.status tokens as
+ *		nut_status_t bits (4 bytes, see nutstatus.h)
+ *	...	HMAC-SHA256 of all the above with BEACONKEY, its first
+ *		NUT_BEACON_MACLEN bytes
+ *
+ * A datagram is at most NUT_BEACON_MAXLEN bytes long, more devices take
+ * several of them (each with its own sequence number).
+ */
+#define NUT_BEACON_MAGIC	"NUTB"
+#define NUT_BEACON_VERSION	1
+#define NUT_BEACON_PORT	"3493"
+#define NUT_BEACON_HDRLEN	26
+#define NUT_BEACON_MACLEN	16
+#define NUT_BEACON_MAXLEN	1200
+
+/* no status known: the driver is not connected, or its data is stale */
+#define NUT_BEACON_STALE	0x01
+
+#endif	/* NUT_NUTBEACON_H_SEEN */
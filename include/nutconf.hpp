@@ -612,6 +612,10 @@ public:
 	NutParser(const char* buffer = nullptr, unsigned int options = OPTION_DEFAULT);
 	NutParser(const std::string& buffer, unsigned int options = OPTION_DEFAULT);
 
+	/** Parse the data in place, without a copy (e.g. a mapped file,
+	 *  see NutStream::view); it must outlive the parser */
+	NutParser(const char* data, size_t size, unsigned int options);
+
 	virtual ~NutParser();
 
 	/** Parsing configuration functions
@@ -656,12 +660,35 @@ public:
 		operator bool()const{return type!=TOKEN_UNKNOWN && type!=TOKEN_NONE;}
 	};
 
+	/** Token of the single-pass lexer: a span of the parsed data, or of
+	 *  a scratch buffer of the parser if it had to be unescaped */
+	struct TokenView
+	{
+		Token::TokenType type;
+		const char* ptr;	///< Start of the span (nullptr if none)
+		size_t scratch;	///< Scratch buffer index (npos if none)
+		size_t len;
+
+		TokenView(Token::TokenType type_arg = Token::TOKEN_NONE):type(type_arg),ptr(nullptr),scratch(std::string::npos),len(0){}
+
+		bool is(Token::TokenType type_arg)const{return this->type==type_arg;}
+
+		operator bool()const{return type!=Token::TOKEN_UNKNOWN && type!=Token::TOKEN_NONE;}
+	};
+
 	/** Parsing functions
 	* \{ */
 	std::string parseCHARS();
 	std::string parseSTRCHARS();
 	Token parseToken();
 	std::list<Token> parseLine();
+
+	/** Lex the tokens of the next line in a single pass, up to its EOL
+	 *  (or comment, or end of data) token; same tokens as parseToken(),
+	 *  but without a copy of their text. The vector and the views are
+	 *  valid until the next call. */
+	const std::vector<TokenView>& lexLine();
+	std::string tokenString(const TokenView& tok)const;
 	/** \} */
 
 #ifndef UNITEST_MODE
@@ -683,9 +710,25 @@ protected:
 private:
 	unsigned int _options;
 
+	/** Copy of the parsed data, unless parsed in place */
 	std::string _buffer;
+	const char* _data;
+	size_t _size;
 	size_t _pos;
 	std::vector<size_t> _stack;
+
+	/** Tokens of the last lexed line, and the scratch buffers of those
+	 *  which had to be unescaped (kept for reuse) */
+	std::vector<TokenView> _tokens;
+	std::vector<std::string> _scratch;
+	size_t _scratchUsed;
+
+	TokenView lexToken();
+	void lexAppend(TokenView& tok, size_t at, size_t len);
+
+	/* _data may point into _buffer */
+	NutParser(const NutParser&) = delete;
+	NutParser& operator=(const NutParser&) = delete;
 };
 
 
@@ -715,13 +758,31 @@ struct GenericConfigSection
 	void clear();
 };
 
+/** Differences between two generic configurations, by name */
+struct GenericConfigDiff
+{
+	/** Changes of a section present in both */
+	struct SectionChange
+	{
+		std::string name;
+		std::list<std::string> addedEntries, removedEntries, changedEntries;
+	};
+
+	std::list<std::string>   addedSections, removedSections;
+	std::list<SectionChange> changedSections;
+
+	bool empty()const;
+	void clear();
+};
+
 class BaseConfiguration
 {
 	friend class GenericConfigParser;
 public:
 	virtual ~BaseConfiguration();
 protected:
-	virtual void setGenericConfigSection(const GenericConfigSection& section) = 0;
+	/* The section may be taken over (and left empty) */
+	virtual void setGenericConfigSection(GenericConfigSection& section) = 0;
 };
 
 class NutConfigParser : public NutParser
@@ -735,6 +796,7 @@ public:
 protected:
 	NutConfigParser(const char* buffer = nullptr, unsigned int options = OPTION_DEFAULT);
 	NutConfigParser(const std::string& buffer, unsigned int options = OPTION_DEFAULT);
+	NutConfigParser(const char* data, size_t size, unsigned int options);
 
 	virtual void onParseBegin()=0;
 	virtual void onParseComment(const std::string& comment)=0;
@@ -748,9 +810,11 @@ class DefaultConfigParser : public NutConfigParser
 public:
 	DefaultConfigParser(const char* buffer = nullptr);
 	DefaultConfigParser(const std::string& buffer);
+	DefaultConfigParser(const char* data, size_t size);
 
 protected:
-	virtual void onParseSection(const GenericConfigSection& section)=0;
+	/* The section may be taken over (it is cleared afterwards) */
+	virtual void onParseSection(GenericConfigSection& section)=0;
 
 	virtual void onParseBegin() override;
 	virtual void onParseComment(const std::string& comment) override;
@@ -767,11 +831,12 @@ class GenericConfigParser : public DefaultConfigParser
 public:
 	GenericConfigParser(const char* buffer = nullptr);
 	GenericConfigParser(const std::string& buffer);
+	GenericConfigParser(const char* data, size_t size);
 
 	virtual void parseConfig(BaseConfiguration* config) override;
 
 protected:
-	virtual void onParseSection(const GenericConfigSection& section) override;
+	virtual void onParseSection(GenericConfigSection& section) override;
 
 	BaseConfiguration* _config;
 };
@@ -788,6 +853,7 @@ public:
 	virtual ~GenericConfiguration() override;
 
 	void parseFromString(const std::string& str);
+	void parseFromData(const char* data, size_t size);
 
 	/** Serialisable interface implementation \{ */
 	bool parseFrom(NutStream & istream) override;
@@ -800,9 +866,53 @@ public:
 	const GenericConfigSection& operator[](const std::string& secname)const{return sections.find(secname)->second;}
 	GenericConfigSection& operator[](const std::string& secname){return sections[secname];}
 
+	/**
+	 *  \brief  Differences to another configuration
+	 *
+	 *  Sections and entries are matched by name, and entries compared
+	 *  by their values; it takes a single pass over both.
+	 *
+	 *  \param[in]  other  Newer configuration
+	 *
+	 *  \return What changed from this configuration to \c other
+	 */
+	GenericConfigDiff diff(const GenericConfiguration & other) const;
+
+	/**
+	 *  \brief  Partial reload
+	 *
+	 *  The new contents are parsed aside, then only the sections which
+	 *  were added or changed are taken over, and the removed ones are
+	 *  dropped. Sections which did not change are left alone, so that
+	 *  the caller can apply just the \c changes.
+	 *
+	 *  \param[in]   istream  Input stream
+	 *  \param[out]  changes  What changed
+	 *
+	 *  \retval true  if the stream could be read
+	 *  \retval false otherwise (and the configuration is left as it was)
+	 */
+	bool reloadFrom(NutStream & istream, GenericConfigDiff & changes);
+	void reloadFromString(const std::string& str, GenericConfigDiff & changes);
+
 
 protected:
-	virtual void setGenericConfigSection(const GenericConfigSection& section) override;
+	virtual void setGenericConfigSection(GenericConfigSection& section) override;
+
+	/** Apply the differences to a newer configuration (taken from it) */
+	void reload(GenericConfiguration & fresh, GenericConfigDiff & changes);
+
+	/**
+	 *  \brief  Configuration parameters lookup (without a copy)
+	 *
+	 *  \param  section  Section name
+	 *  \param  entry    Entry name
+	 *  \param  caseSensitive  Use case-sensitive entry name matching? (default: true)
+	 *
+	 *  \return The parameters (valid until the entry is changed),
+	 *          or \c nullptr if the entry was not found
+	 */
+	const ConfigParamList * find(const std::string & section, const std::string & entry, bool caseSensitive = true) const;
 
 	/**
 	 *  \brief  Configuration parameters getter
@@ -1459,6 +1569,7 @@ class UpsmonConfiguration : public Serialisable
 public:
 	UpsmonConfiguration();
 	void parseFromString(const std::string& str);
+	void parseFromData(const char* data, size_t size);
 
 	Settable<int>          debugMin, pollFailLogThrottleMax;
 	Settable<int>          offDuration, oblbDuration;
@@ -1541,6 +1652,7 @@ class UpsmonConfigParser : public NutConfigParser
 public:
 	UpsmonConfigParser(const char* buffer = nullptr);
 	UpsmonConfigParser(const std::string& buffer);
+	UpsmonConfigParser(const char* data, size_t size);
 
 	void parseUpsmonConfig(UpsmonConfiguration* config);
 protected:
@@ -1559,6 +1671,7 @@ class NutConfiguration: public Serialisable
 public:
 	NutConfiguration();
 	void parseFromString(const std::string& str);
+	void parseFromData(const char* data, size_t size);
 
 	enum NutMode {
 		MODE_UNKNOWN = -1,
@@ -1591,6 +1704,7 @@ class NutConfConfigParser : public NutConfigParser
 public:
 	NutConfConfigParser(const char* buffer = nullptr);
 	NutConfConfigParser(const std::string& buffer);
+	NutConfConfigParser(const char* data, size_t size);
 
 	void parseNutConfConfig(NutConfiguration* config);
 protected:
@@ -1609,9 +1723,10 @@ class UpsdConfiguration : public Serialisable
 public:
 	UpsdConfiguration();
 	void parseFromString(const std::string& str);
+	void parseFromData(const char* data, size_t size);
 
 	Settable<int> debugMin;
-	Settable<unsigned int> maxAge, maxConn, trackingDelay, certRequestLevel;
+	Settable<unsigned int> maxAge, maxConn, maxClientQueue, trackingDelay, certRequestLevel, sslHandshakeWorkers, clientInactivityDelay;
 	Settable<std::string>  statePath, certFile, certPath;
 	Settable<bool> allowNoDevice, allowNotAllListeners, disableWeakSsl;
 
@@ -1643,6 +1758,7 @@ class UpsdConfigParser : public NutConfigParser
 public:
 	UpsdConfigParser(const char* buffer = nullptr);
 	UpsdConfigParser(const std::string& buffer);
+	UpsdConfigParser(const char* data, size_t size);
 
 	void parseUpsdConfig(UpsdConfiguration* config);
 protected:
@@ -1726,6 +1842,54 @@ public:
 
 	/** \} */
 
+	/**
+	 *  \brief  Pre-decoded view of a device section
+	 *
+	 *  The attributes most tools look at are decoded once, by \ref devices;
+	 *  others are taken from the section as they are. It refers to the
+	 *  section, so it is valid as long as the configuration is not changed.
+	 */
+	struct Device
+	{
+		std::string   name;           /**< Section name */
+		std::string   driver;         /**< "driver" */
+		std::string   port;           /**< "port" */
+		std::string   desc;           /**< "desc" */
+		long long int sdorder;        /**< "sdorder" (0 if not set) */
+		long long int maxStartDelay;  /**< "maxstartdelay" (0 if not set) */
+		bool          noLock;         /**< "nolock" flag */
+
+		/** The device section */
+		const GenericConfigSection * section;
+
+		/** Other attribute, as it is (empty if not set) */
+		const std::string & get(const std::string & key) const;
+	};
+
+	/** Device views, in the order of names */
+	typedef std::vector<Device> DeviceList;
+
+	/**
+	 *  \brief  Decode all the device sections at once
+	 *
+	 *  For tools going over many devices and attributes: one pass over
+	 *  the sections, instead of two map lookups and a conversion for
+	 *  each getter call.
+	 *
+	 *  \return Views of the device sections (the global one excluded)
+	 */
+	DeviceList devices() const;
+
+	/**
+	 *  \brief  Device view lookup by name (binary search)
+	 *
+	 *  \param  list  Device views (as returned by \ref devices)
+	 *  \param  ups   Device name
+	 *
+	 *  \return The view, or \c nullptr if there is no such device
+	 */
+	static const Device * findDevice(const DeviceList & list, const std::string & ups);
+
 	/** Generic <key>=<value> getter */
 	inline std::string getKey(const std::string & ups, const std::string & key) const { return getStr(ups, key); }
 
@@ -2008,6 +2172,7 @@ public:
 	inline bool getNoWarnNoImp(const std::string & ups)    const { return getFlag(ups, "nowarn_noimp"); }
 	inline bool getOldMAC(const std::string & ups)         const { return getFlag(ups, "oldmac"); }
 	inline bool getPollOnly(const std::string & ups)       const { return getFlag(ups, "pollonly"); }
+	inline bool getSharedState(const std::string & ups)    const { return getFlag(ups, "sharedstate"); }
 	inline bool getSilent(const std::string & ups)         const { return getFlag(ups, "silent"); }
 	inline bool getStatusOnly(const std::string & ups)     const { return getFlag(ups, "status_only"); }
 	inline bool getSubscribe(const std::string & ups)      const { return getFlag(ups, "subscribe"); }
@@ -2255,6 +2420,7 @@ public:
 	inline void setNoWarnNoImp(const std::string & ups, bool set = true)    { setFlag(ups, "nowarn_noimp",   set); }
 	inline void setOldMAC(const std::string & ups, bool set = true)         { setFlag(ups, "oldmac",         set); }
 	inline void setPollOnly(const std::string & ups, bool set = true)       { setFlag(ups, "pollonly",       set); }
+	inline void setSharedState(const std::string & ups, bool set = true)    { setFlag(ups, "sharedstate",    set); }
 	inline void setSilent(const std::string & ups, bool set = true)         { setFlag(ups, "silent",         set); }
 	inline void setStatusOnly(const std::string & ups, bool set = true)     { setFlag(ups, "status_only",    set); }	// aka OPTI_MINPOLL
 	inline void setSubscribe(const std::string & ups, bool set = true)      { setFlag(ups, "subscribe",      set); }
@@ -2309,6 +2475,34 @@ public:
 
 	upsmon_mode_t getUpsmonMode() const;
 
+	/**
+	 *  \brief  Pre-decoded view of a user section
+	 *
+	 *  Built by \ref users, it refers to the section, so it is valid as
+	 *  long as the configuration is not changed.
+	 */
+	struct User
+	{
+		std::string     name;         /**< User name */
+		std::string     password;     /**< "password" */
+		ConfigParamList actions;      /**< "actions" */
+		ConfigParamList instcmds;     /**< "instcmds" */
+		upsmon_mode_t   upsmonMode;   /**< "upsmon" */
+
+		/** The user section */
+		const GenericConfigSection * section;
+	};
+
+	/** User views, in the order of names */
+	typedef std::vector<User> UserList;
+
+	/**
+	 *  \brief  Decode all the user sections at once
+	 *
+	 *  \return Views of the user sections (the global one excluded)
+	 */
+	UserList users() const;
+
 	inline void setPassword(const std::string & user, const std::string & passwd) { setStr(user, "password", passwd); }
 
 	inline void setActions(const std::string & user, const ConfigParamList & actions)      { set(user, "actions",  actions); }
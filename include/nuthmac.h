@@ -0,0 +1,49 @@
+/* nuthmac.h - Network UPS Tools SHA-256 and HMAC-SHA256
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NUTHMAC_H_SEEN
+#define NUT_NUTHMAC_H_SEEN 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* The status beacons of upsd (see server/beacon.c) are signed with a
+ * shared secret, which must not need an SSL library to check: this is
+ * plain SHA-256 (FIPS 180-4) and HMAC (RFC 2104) with it. */
+#define NUT_SHA256_LEN	32
+
+void nut_sha256(const void *data, size_t len, unsigned char *digest);
+
+void nut_hmac_sha256(const void *key, size_t keylen,
+	const void *data, size_t len, unsigned char *mac);
+
+/* compare two MACs in a time which does not tell where they differ;
+ * returns 1 if the len bytes are the same, 0 otherwise */
+int nut_hmac_equal(const unsigned char *a, const unsigned char *b, size_t len);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_NUTHMAC_H_SEEN */
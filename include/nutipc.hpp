@@ -35,6 +35,7 @@
 #include <cstring>
 #include <cassert>
 #include <cerrno>
+#include <atomic>
 
 extern "C" {
 #include <sys/types.h>
@@ -221,6 +222,12 @@ class Process {
 		 */
 		Executor(const std::string & command);
 
+		/** Binary to be executed */
+		inline const std::string & binary() const { return m_bin; }
+
+		/** Command-line arguments to the binary */
+		inline const Arguments & arguments() const { return m_args; }
+
 		/** Execution of the binary */
 		int operator () ()
 #if (defined __cplusplus) && (__cplusplus < 201100)
@@ -229,10 +236,80 @@ class Process {
 			override;
 	};  // end of class Executor
 
+	/**
+	 *  \brief  Start an external command
+	 *
+	 *  The command is started with \c posix_spawnp where available, so
+	 *  the (possibly large) calling process is not forked; with \c fork
+	 *  and \c execvp otherwise. Its standard output and error may be
+	 *  redirected to the descriptors specified.
+	 *  An exception is thrown if the command can't be started.
+	 *
+	 *  \param  executor  Command
+	 *  \param  out_fd    Descriptor for the command stdout (-1 to inherit)
+	 *  \param  err_fd    Descriptor for the command stderr (-1 to inherit)
+	 *
+	 *  \return Command process ID
+	 */
+	static pid_t spawn(const Executor & executor, int out_fd = -1, int err_fd = -1)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw(std::runtime_error)
+#endif
+		;
+
+	/**
+	 *  \brief  Wait for a process to exit
+	 *
+	 *  \param[in]   pid        Process ID
+	 *  \param[out]  exit_code  Exit code
+	 *  \param[in]   block      Wait until it exits (otherwise, just check)
+	 *
+	 *  \retval true  if the process exited
+	 *  \retval false if it runs (not blocking)
+	 */
+	static bool waitFor(pid_t pid, int & exit_code, bool block = true)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw(std::logic_error)
+#endif
+		;
+
 	/**
 	 *  External command execution
+	 *
+	 *  The command is started by \ref spawn. Its standard output and
+	 *  error may be captured through pipes, read without blocking by
+	 *  \ref read (e.g. when an event loop sees \ref outFd readable),
+	 *  and anyway by \ref wait until the command closes them.
 	 */
-	class Execution: public Child<Executor> {
+	class Execution {
+		public:
+
+		/** Output capture flags */
+		typedef enum {
+			CAPTURE_NONE   = 0,       /**< Output is inherited */
+			CAPTURE_STDOUT = 1,       /**< Standard output is captured */
+			CAPTURE_STDERR = 1 << 1,  /**< Standard error is captured */
+		} capture_t;
+
+		private:
+
+		pid_t m_pid;        /**< Child PID    */
+		bool  m_exited;     /**< Exited flag  */
+		int   m_exit_code;  /**< Exit code    */
+
+		int   m_out_fd;     /**< Captured stdout pipe read end (or -1) */
+		int   m_err_fd;     /**< Captured stderr pipe read end (or -1) */
+
+		std::string m_out;  /**< Captured stdout */
+		std::string m_err;  /**< Captured stderr */
+
+		/** Start the command */
+		void start(const Executor & executor, unsigned int capture)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+			throw(std::runtime_error)
+#endif
+			;
+
 		public:
 
 		/**
@@ -244,9 +321,10 @@ class Process {
 		 *
 		 *  \brief  binary     Binary to be executed
 		 *  \brief  arguments  Command-line arguments to the binary
+		 *  \brief  capture    Output to capture (\ref capture_t flags)
 		 */
-		Execution(const std::string & binary, const Executor::Arguments & arguments):
-			Child<Executor>(Executor(binary, arguments)) {}
+		Execution(const std::string & binary, const Executor::Arguments & arguments,
+			unsigned int capture = CAPTURE_NONE);
 
 		/**
 		 *  Constructor
@@ -259,11 +337,139 @@ class Process {
 		 *  "/bin/sh -c '<your shell command>'" shall probably be what you want.
 		 *
 		 *  \param  command  Command to be executed
+		 *  \param  capture  Output to capture (\ref capture_t flags)
+		 */
+		Execution(const std::string & command, unsigned int capture = CAPTURE_NONE);
+
+		/* Owns the capture pipes */
+		Execution(const Execution &) = delete;
+		Execution & operator=(const Execution &) = delete;
+
+		/** Child PID */
+		inline pid_t getPID() const { return m_pid; }
+
+		/** Captured stdout pipe read end (non-blocking), -1 if none or closed */
+		inline int outFd() const { return m_out_fd; }
+
+		/** Captured stderr pipe read end (non-blocking), -1 if none or closed */
+		inline int errFd() const { return m_err_fd; }
+
+		/**
+		 *  \brief  Read the captured output available (non-blocking)
+		 *
+		 *  \retval true  if some capture pipe is still open
+		 *  \retval false otherwise
+		 */
+		bool read();
+
+		/** Standard output captured so far */
+		inline const std::string & output() const { return m_out; }
+
+		/** Standard error captured so far */
+		inline const std::string & errors() const { return m_err; }
+
+		/**
+		 *  \brief  Wait for child process to exit
+		 *
+		 *  The method blocks as long as the child runs (reading
+		 *  the captured output until the child closes it).
+		 *  It returns the child's exit code.
+		 *
+		 *  \return Child process exit code
+		 */
+		int wait()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+			throw(std::logic_error)
+#endif
+			;
+
+		/**
+		 *  \brief  Child exit code getter
+		 *
+		 *  \return Child exit code
+		 */
+		inline int exitCode() {
+			return wait();
+		}
+
+		/**
+		 *  \brief  Destructor
+		 *
+		 *  The destructor shall wait for the child process
+		 *  (unless already exited).
 		 */
-		Execution(const std::string & command): Child<Executor>(Executor(command)) {}
+		~Execution();
 
 	};  // end of class Execution
 
+	/**
+	 *  \brief  Pool of external command executions
+	 *
+	 *  For helpers run often (e.g. notification commands): they are
+	 *  started without waiting for them, at most a given number at
+	 *  once (starting one more waits for a slot then), and reaped
+	 *  as they exit.
+	 */
+	class ExecutionPool {
+		private:
+
+		/** Most commands running at once */
+		size_t m_max;
+
+		/** Running commands */
+		std::list<pid_t> m_running;
+
+		/** Commands which ended with a non-zero exit code */
+		size_t m_failed;
+
+		public:
+
+		/**
+		 *  \brief  Constructor
+		 *
+		 *  \param  max  Most commands running at once (at least 1)
+		 */
+		ExecutionPool(size_t max): m_max(max ? max : 1), m_failed(0) {}
+
+		ExecutionPool(const ExecutionPool &) = delete;
+		ExecutionPool & operator=(const ExecutionPool &) = delete;
+
+		/**
+		 *  \brief  Start a command
+		 *
+		 *  Waits for a running one to exit first, if there are as many
+		 *  as allowed.
+		 *
+		 *  \param  executor  Command
+		 *
+		 *  \return Command process ID
+		 */
+		pid_t run(const Executor & executor)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+			throw(std::runtime_error)
+#endif
+			;
+
+		/**
+		 *  \brief  Reap the commands which exited
+		 *
+		 *  \param  block  Wait for all of them to exit
+		 *
+		 *  \return Number of commands still running
+		 */
+		size_t reap(bool block = false);
+
+		/** Number of commands running (as of the last reap) */
+		inline size_t running() const { return m_running.size(); }
+
+		/** Number of commands which ended with a non-zero exit code */
+		inline size_t failed() const { return m_failed; }
+
+		/** Destructor waits for all the commands */
+		~ExecutionPool();
+
+	};  // end of class ExecutionPool
+
 	/**
 	 *  \brief  Execute command and wait for exit code
 	 *
@@ -439,57 +645,83 @@ class Signal {
 
 	public:
 
-	/** Signal handler thread handle */
+	/**
+	 *  \brief  Signal handler thread handle
+	 *
+	 *  The OS-level signal handler only marks the signal as pending,
+	 *  and wakes the handling side up unless that signal was pending
+	 *  already (so a storm of the same signal, e.g. \c CHILD, costs one
+	 *  wake-up rather than a system call pair per signal). The wake-up
+	 *  goes through an \c eventfd where available, a self-pipe otherwise.
+	 *  The pending signals are then passed to the handler \ref H in the
+	 *  order of their numbers, each once.
+	 *
+	 *  The handling is done either by a dedicated thread, or by an
+	 *  external event loop which polls \ref fd for reading and calls
+	 *  \ref dispatch when it is readable.
+	 */
 	template <class H>
 	class HandlerThread {
 		friend class Signal;
 
 		private:
 
-		/** Control commands */
-		typedef enum {
-			HT_QUIT   = 0,  /**< Shutdown the thread */
-			HT_SIGNAL = 1,  /**< Signal obtained     */
-		} command_t;
+		/** Signal numbers which may be handled are below this */
+		static const int s_max_signal = 64;
 
-		/** Communication pipe */
+		/** Wake-up channel (read end, write end; same for an eventfd) */
 		static int s_comm_pipe[2];
 
+		/** Pending signals */
+		static std::atomic<int> s_pending[s_max_signal];
+
+		/** Thread termination request */
+		static std::atomic<int> s_quit;
+
 		/** POSIX thread */
 		pthread_t m_impl;
 
+		/** Is there a thread (or an external event loop)? */
+		bool m_threaded;
+
 		/**
 		 *  \brief  Signal handler thread main routine
 		 *
-		 *  The function synchronously read commands from the communication pipe.
-		 *  It processes control commands on its own (e.g. the quit command).
-		 *  It passes all signals to signal handler instance of \ref H
-		 *  Which must implement the \ref Signal::Handler interface.
+		 *  The function waits for wake-ups on the communication channel,
+		 *  and passes the pending signals to signal handler instance of \ref H
+		 *  which must implement the \ref Signal::Handler interface.
 		 *  The handler is instantiated in scope of the routine.
-		 *  It closes the communication pipe read end in reaction to
-		 *  \ref HT_QUIT command.
+		 *  It returns when \ref quit was requested.
 		 *
-		 *  \param  comm_pipe_read_end  Communication pipe read end
+		 *  \param  comm_pipe_read_end  Communication channel read end
 		 *
-		 *  \retval N/A (the function never returns)
+		 *  \retval nullptr
 		 */
 		static void * main(void * comm_pipe_read_end);
 
+		/**
+		 *  \brief  Take the wake-ups, and handle the pending signals
+		 *
+		 *  \param  rfd      Communication channel read end
+		 *  \param  handler  Signal handler
+		 *
+		 *  \retval true  if the thread shall quit
+		 *  \retval false otherwise
+		 */
+		static bool process(int rfd, H & handler);
+
 		/**
 		 *  \brief  Signal handler routine
 		 *
 		 *  The actual signal handler routine executed by the OS when the process
 		 *  obtains signal to be handled.
-		 *  The function simply writes the signal number to the signal handler
-		 *  thread communication pipe (as parameter of the \ref HT_SIGNAL command).
+		 *  The function marks the signal as pending, and only if it was not
+		 *  pending yet, wakes the signal handling side up.
 		 *  The signal handling itself (whatever necessary) shall be done
-		 *  by the dedicated thread (to avoid possible re-entrance issues).
+		 *  by the dedicated thread or event loop (to avoid possible re-entrance issues).
 		 *
 		 *  Note that \c ::write is required to be an async-signal-safe function by
-		 *  POSIX.1-2004; also note that up to \c PIPE_BUF bytes are written atomically
-		 *  as required by IEEE Std 1003.1, 2004 Edition,\c PIPE_BUF being typically
-		 *  hundreds of bytes at least (POSIX requires 512B, Linux provides whole 4KiB
-		 *  page).
+		 *  POSIX.1-2004, as are lock-free atomic operations by C++11.
 		 *
 		 *  \param  signal  Signal
 		 */
@@ -504,29 +736,51 @@ class Signal {
 		 *  This limitation is both due sanity reasons (it wouldn't
 		 *  make much sense to handle the same signal by multiple threads)
 		 *  and because of the signal handler routine only has access
-		 *  to one communication pipe write end (the static member).
+		 *  to one communication channel (the static member).
 		 *  This is actually the only technical reason of having the class
 		 *  template (so that every instance has its own static comm. queue).
 		 *  However, for different handler classes, multiple handling threads
 		 *  may be created (if it makes sense) since these will be different
 		 *  template instances and therefore will use different static
-		 *  communication pipes.
+		 *  communication channels.
 		 *  If more than 1 instance creation is attempted, an exception is thrown.
 		 *
-		 *  \param  siglist  List of signals that shall be handled by the thread
+		 *  \param  siglist   List of signals that shall be handled by the thread
+		 *  \param  threaded  Start a thread; otherwise an external event loop
+		 *                    handles the signals (see \ref fd and \ref dispatch)
 		 */
-		HandlerThread(const Signal::List & siglist)
+		HandlerThread(const Signal::List & siglist, bool threaded = true)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 			throw(std::logic_error, std::runtime_error)
 #endif
 			;
 
+		/**
+		 *  \brief  File descriptor for an external event loop
+		 *
+		 *  It becomes readable when signals are pending; \ref dispatch
+		 *  shall be called then. It is also available with a thread,
+		 *  but should not be used then.
+		 *
+		 *  \return Communication channel read end
+		 */
+		inline int fd() const { return s_comm_pipe[0]; }
+
+		/**
+		 *  \brief  Handle the pending signals (external event loop)
+		 *
+		 *  Does not block: with no signals pending, it does nothing.
+		 *
+		 *  \param  handler  Signal handler
+		 */
+		inline void dispatch(H & handler) { process(s_comm_pipe[0], handler); }
+
 		/**
 		 *  \brief  Terminate the thread
 		 *
-		 *  The method sends the signal handler thread the \ref QUIT signal.
+		 *  The method asks the signal handler thread to quit.
 		 *  It blocks until the thread is joined.
-		 *  Closes the communication pipe write end.
+		 *  Closes the communication channel.
 		 */
 		void quit()
 #if (defined __cplusplus) && (__cplusplus < 201100)
@@ -583,10 +837,16 @@ class Signal {
 };  // end of class Signal
 
 
-/** Initialization of the communication pipes */
+/** Initialization of the communication channels */
 template <class H>
 int Signal::HandlerThread<H>::s_comm_pipe[2] = { -1, -1 };
 
+template <class H>
+std::atomic<int> Signal::HandlerThread<H>::s_pending[Signal::HandlerThread<H>::s_max_signal];
+
+template <class H>
+std::atomic<int> Signal::HandlerThread<H>::s_quit(0);
+
 
 template <class H>
 void * Signal::HandlerThread<H>::main(void * comm_pipe_read_end) {
@@ -599,12 +859,12 @@ void * Signal::HandlerThread<H>::main(void * comm_pipe_read_end) {
 		FD_ZERO(&rfds);
 		FD_SET(rfd, &rfds);
 
-		// Poll on signal pipe
+		// Poll on the communication channel
 		// Note that a straightforward blocking read could be
 		// also used.  However, select allows specifying a
 		// timeout, which could be useful in the future (but
 		// is not used in the current code).
-		int fdno = ::select(FD_SETSIZE, &rfds, nullptr, nullptr, nullptr);
+		int fdno = ::select(rfd + 1, &rfds, nullptr, nullptr, nullptr);
 
 		// -1 is an error, but EINTR means the system call was
 		// interrupted.  System calls are expected to be
@@ -618,7 +878,7 @@ void * Signal::HandlerThread<H>::main(void * comm_pipe_read_end) {
 
 			std::stringstream e;
 
-			e << "Poll on communication pipe read end ";
+			e << "Poll on communication channel read end ";
 			e << rfd << " failed: " << errno;
 
 			throw std::runtime_error(e.str());
@@ -627,104 +887,102 @@ void * Signal::HandlerThread<H>::main(void * comm_pipe_read_end) {
 		assert(1 == fdno);
 		assert(FD_ISSET(rfd, &rfds));
 
-		// Read command
-		int word;
-
-		ssize_t read_out = ::read(rfd, &word, sizeof(word));
-
-		// TBD: again, how should we treat read error?
-		if (-1 == read_out) {
-			std::stringstream e;
+		if (process(rfd, handler))
+			return nullptr;
+	}
+}
 
-			e << "Failed to read command from the command pipe: ";
-			e << errno;
 
-			throw std::runtime_error(e.str());
-		}
+/**
+ *  \brief  Create a signal wake-up channel
+ *
+ *  An \c eventfd where available (both ends are the same then),
+ *  a pipe otherwise; non-blocking.
+ *
+ *  \param  fds  Read end, write end
+ *
+ *  \retval 0     on success
+ *  \retval errno on error
+ */
+int sigWakeOpen(int fds[2]);
 
-		// POSIX probably does not prohibit reading some but
-		// not all of the multibyte message.  However, it is
-		// unlikely that an implementation using write and
-		// read on int-sized or smaller objects will split
-		// them.  For now our strategy is to hope this does
-		// not happen.
-		assert(sizeof(word) == read_out);
+/**
+ *  \brief  Wake the signal handling side up (async-signal-safe)
+ *
+ *  \param  fh  Channel write end
+ */
+void sigWake(int fh);
 
-		command_t command = static_cast<command_t>(word);
+/**
+ *  \brief  Take all the wake-ups (non-blocking)
+ *
+ *  \param  fh  Channel read end
+ *
+ *  \retval 0     on success (even with nothing to take)
+ *  \retval errno on error
+ */
+int sigWakeDrain(int fh);
 
-		switch (command) {
-			case HT_QUIT:
-				// Close comm. pipe read end
-				::close(rfd);
+/**
+ *  \brief  Close a signal wake-up channel
+ *
+ *  \param  fds  Read end, write end (set to -1)
+ *
+ *  \retval 0     on success
+ *  \retval errno on error
+ */
+int sigWakeClose(int fds[2]);
 
-				// Terminate thread
-				::pthread_exit(nullptr);
 
-			case HT_SIGNAL:
-				// Read signal number
-				read_out = ::read(rfd, &word, sizeof(word));
+template <class H>
+bool Signal::HandlerThread<H>::process(int rfd, H & handler) {
+	// Take the wake-ups first: a signal which comes later
+	// wakes us up again (if not seen by the scan below)
+	int status = sigWakeDrain(rfd);
 
-				// TBD: again, how should we treat read error?
-				if (-1 == read_out) {
-					std::stringstream e;
+	// TBD: again, how should we treat read error?
+	if (status) {
+		std::stringstream e;
 
-					e << "Failed to read signal number ";
-					e << "from the command pipe: " << errno;
+		e << "Failed to read from the communication channel: ";
+		e << status;
 
-					throw std::runtime_error(e.str());
-				}
+		throw std::runtime_error(e.str());
+	}
 
-				assert(sizeof(word) == read_out);
+	if (s_quit.load())
+		return true;
 
-				Signal::enum_t sig = static_cast<Signal::enum_t>(word);
+	for (int signo = 1; signo < s_max_signal; ++signo) {
+		if (0 == s_pending[signo].exchange(0))
+			continue;
 
-				// Handle signal
-				handler(sig);
-		}
+		// Handle signal
+		handler(static_cast<Signal::enum_t>(signo));
 	}
 
-	// Pro-forma exception
-	throw std::logic_error("INTERNAL ERROR: Unreachable code reached");
+	return false;
 }
 
 
-/**
- *  \brief  Write command to command pipe
- *
- *  \param  fh        Pipe writing end (file handle)
- *  \param  cmd       Command
- *  \param  cmd_size  Command size
- *
- *  \retval 0     on success
- *  \retval errno on error
- */
-int sigPipeWriteCmd(int fh, void * cmd, size_t cmd_size)
-#if (defined __cplusplus) && (__cplusplus < 201100)
-	throw(std::runtime_error)
-#endif
-	;
-
-
 template <class H>
 void Signal::HandlerThread<H>::signalNotifier(int signal) {
-	int sig[2] = {
-		static_cast<int>(Signal::HandlerThread<H>::HT_SIGNAL),
-	};
+	int saved_errno = errno;
 
-	sig[1] = signal;
+	// Only the first one of the signals pending wakes up
+	if (signal > 0 && signal < s_max_signal && 0 == s_pending[signal].exchange(1))
+		sigWake(s_comm_pipe[1]);
 
-	// TBD: The return value is silently ignored.
-	// Either the write should've succeeded or the handling
-	// thread is already coming down...
-	sigPipeWriteCmd(s_comm_pipe[1], sig, sizeof(sig));
+	errno = saved_errno;
 }
 
 
 template <class H>
-Signal::HandlerThread<H>::HandlerThread(const Signal::List & siglist)
+Signal::HandlerThread<H>::HandlerThread(const Signal::List & siglist, bool threaded)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 	throw(std::logic_error, std::runtime_error)
 #endif
+	: m_threaded(threaded)
 {
 #ifdef WIN32
 	NUT_UNUSED_VARIABLE(siglist);
@@ -742,30 +1000,52 @@ Signal::HandlerThread<H>::HandlerThread(const Signal::List & siglist)
 		throw std::logic_error(
 			"Attempt to start a duplicate of signal handling thread detected");
 
-	// Create communication pipe
-	if (::pipe(s_comm_pipe)) {
-		std::stringstream e;
+	Signal::List::const_iterator sig = siglist.begin();
+
+	for (; sig != siglist.end(); ++sig) {
+		int signo = static_cast<int>(*sig);
 
-		e << "Failed to create communication pipe: " << errno;
+		if (signo <= 0 || signo >= s_max_signal) {
+			std::stringstream e;
 
-		throw std::runtime_error(e.str());
+			e << "Signal " << signo << " can not be handled by the thread";
+
+			throw std::logic_error(e.str());
+		}
+
+		s_pending[signo].store(0);
 	}
 
-	// Start the thread
-	int status = ::pthread_create(&m_impl, nullptr, &main, s_comm_pipe);
+	s_quit.store(0);
+
+	// Create communication channel
+	int status = sigWakeOpen(s_comm_pipe);
 
 	if (status) {
 		std::stringstream e;
 
-		e << "Failed to start the thread: " << status;
+		e << "Failed to create communication channel: " << status;
 
 		throw std::runtime_error(e.str());
 	}
 
-	// Register signals
-	Signal::List::const_iterator sig = siglist.begin();
+	// Start the thread
+	if (m_threaded) {
+		status = ::pthread_create(&m_impl, nullptr, &main, s_comm_pipe);
 
-	for (; sig != siglist.end(); ++sig) {
+		if (status) {
+			sigWakeClose(s_comm_pipe);
+
+			std::stringstream e;
+
+			e << "Failed to start the thread: " << status;
+
+			throw std::runtime_error(e.str());
+		}
+	}
+
+	// Register signals
+	for (sig = siglist.begin(); sig != siglist.end(); ++sig) {
 		struct sigaction action;
 
 		::memset(&action, 0, sizeof(action));
@@ -802,29 +1082,30 @@ void Signal::HandlerThread<H>::quit()
 	throw(std::runtime_error)
 #endif
 {
-	static int quit = static_cast<int>(Signal::HandlerThread<H>::HT_QUIT);
+	if (m_threaded) {
+		s_quit.store(1);
+		sigWake(s_comm_pipe[1]);
 
-	sigPipeWriteCmd(s_comm_pipe[1], &quit, sizeof(quit));
+		int status = ::pthread_join(m_impl, nullptr);
 
-	int status = ::pthread_join(m_impl, nullptr);
-
-	if (status) {
-		std::stringstream e;
+		if (status) {
+			std::stringstream e;
 
-		e << "Failed to joint signal handling thread: " << status;
+			e << "Failed to joint signal handling thread: " << status;
 
-		throw std::runtime_error(e.str());
+			throw std::runtime_error(e.str());
+		}
 	}
 
-	if (::close(s_comm_pipe[1])) {
+	int status = sigWakeClose(s_comm_pipe);
+
+	if (status) {
 		std::stringstream e;
 
-		e << "Failed to close communication pipe: " << errno;
+		e << "Failed to close communication channel: " << status;
 
 		throw std::runtime_error(e.str());
 	}
-
-	s_comm_pipe[1] = -1;
 }
 
 
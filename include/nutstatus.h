@@ -0,0 +1,76 @@
+/* nutstatus.h - Network UPS Tools ups.status tokens as bit flags
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NUTSTATUS_H_SEEN
+#define NUT_NUTSTATUS_H_SEEN 1
+
+#include <stddef.h>
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* The standard tokens of ups.status (see the "Status data" chapter of
+ * docs/new-drivers.txt), one bit each, so that whoever has to look at
+ * them more than once tokenizes the text only once. The order of the
+ * bits is that of the table in common/nutstatus.c, and never changes. */
+typedef uint32_t	nut_status_t;
+
+#define NUT_STATUS_OL		((nut_status_t)1 << 0)
+#define NUT_STATUS_OB		((nut_status_t)1 << 1)
+#define NUT_STATUS_LB		((nut_status_t)1 << 2)
+#define NUT_STATUS_HB		((nut_status_t)1 << 3)
+#define NUT_STATUS_RB		((nut_status_t)1 << 4)
+#define NUT_STATUS_CHRG		((nut_status_t)1 << 5)
+#define NUT_STATUS_DISCHRG	((nut_status_t)1 << 6)
+#define NUT_STATUS_BYPASS	((nut_status_t)1 << 7)
+#define NUT_STATUS_CAL		((nut_status_t)1 << 8)
+#define NUT_STATUS_OFF		((nut_status_t)1 << 9)
+#define NUT_STATUS_OVER		((nut_status_t)1 << 10)
+#define NUT_STATUS_TRIM		((nut_status_t)1 << 11)
+#define NUT_STATUS_BOOST	((nut_status_t)1 << 12)
+#define NUT_STATUS_FSD		((nut_status_t)1 << 13)
+#define NUT_STATUS_ALARM	((nut_status_t)1 << 14)
+#define NUT_STATUS_ECO		((nut_status_t)1 << 15)
+
+/* set for any token which is not one of the above */
+#define NUT_STATUS_OTHER	((nut_status_t)1 << 31)
+
+/* the flag of the token of <len> characters at <token> (compared without
+ * regard to case, like upsmon always did), or 0 if it is not standard */
+nut_status_t nut_status_flag(const char *token, size_t len);
+
+/* the token of a single flag, or NULL */
+const char *nut_status_token(nut_status_t flag);
+
+/* the flags of all the (space separated) tokens of a ups.status value */
+nut_status_t nut_status_parse(const char *status);
+
+/* write the tokens of <flags> (without NUT_STATUS_OTHER) into <buf>, in
+ * the order of the bits; returns what snprintf() would */
+int nut_status_format(char *buf, size_t buflen, nut_status_t flags);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_NUTSTATUS_H_SEEN */
@@ -121,6 +121,55 @@ class NutStream {
 	 */
 	virtual status_t getString(std::string & str) = 0;
 
+	/**
+	 *  \brief  Read one line from the stream
+	 *
+	 *  Reads characters up to the next newline, which is consumed
+	 *  but not stored; the last line of the stream may lack it.
+	 *  The default implementation goes through \ref getChar and
+	 *  \ref readChar, the buffered streams override it.
+	 *
+	 *  \param[out]  line  Line (previous content is replaced)
+	 *
+	 *  \retval NUTS_OK    on success,
+	 *  \retval NUTS_EOF   on end of stream (nothing read),
+	 *  \retval NUTS_ERROR on read error
+	 */
+	virtual status_t getLine(std::string & line);
+
+	/**
+	 *  \brief  Read a block of data from the stream
+	 *
+	 *  The call blocks until \c size bytes are read; less are
+	 *  only provided at the end of stream.
+	 *  Null characters are passed through.
+	 *
+	 *  \param[out]  data  Data (previous content is replaced)
+	 *  \param[in]   size  Number of bytes wanted
+	 *
+	 *  \retval NUTS_OK    on success,
+	 *  \retval NUTS_EOF   on end of stream (nothing read),
+	 *  \retval NUTS_ERROR on read error
+	 */
+	virtual status_t getData(std::string & data, size_t size);
+
+	/**
+	 *  \brief  Contiguous view of the rest of the stream
+	 *
+	 *  Streams which hold their whole contents in memory (see
+	 *  \ref NutFile::READ_ONLY_MAPPED) provide it, so that it may
+	 *  be parsed in place, without a copy; the view is valid until
+	 *  the stream is modified or closed. The position in the stream
+	 *  is not shifted.
+	 *
+	 *  \param[out]  data  Start of the data
+	 *  \param[out]  size  Size of the data
+	 *
+	 *  \retval true  if the view is provided
+	 *  \retval false if the stream has none (use \ref getString)
+	 */
+	virtual bool view(const char * & data, size_t & size) const;
+
 	/**
 	 *  \brief  Put one character to the stream end
 	 *
@@ -155,6 +204,19 @@ class NutStream {
 	 */
 	virtual status_t putData(const std::string & data) = 0;
 
+	/**
+	 *  \brief  Put several chunks of data to the stream end
+	 *
+	 *  Same as \ref putData of each chunk in turn, but streams
+	 *  which can gather the chunks into one write do so.
+	 *
+	 *  \param[in]  data  Data chunks
+	 *
+	 *  \retval NUTS_OK    on success,
+	 *  \retval NUTS_ERROR on write error
+	 */
+	virtual status_t putData(const std::vector<std::string> & data);
+
 	/**
 	 *  \brief  Flush output buffers for the stream being written
 	 *
@@ -221,9 +283,13 @@ class NutMemory: public NutStream {
 	status_t getChar(char & ch) override;
 	void     readChar() override;
 	status_t getString(std::string & str) override;
+	status_t getLine(std::string & line) override;
+	status_t getData(std::string & data, size_t size) override;
+	bool     view(const char * & data, size_t & size) const override;
 	status_t putChar(char ch) override;
 	status_t putString(const std::string & str) override;
 	status_t putData(const std::string & data) override;
+	status_t putData(const std::vector<std::string> & data) override;
 
 	// No-op for this class:
 	inline bool flush (int & err_code, std::string & err_msg) override {
@@ -259,6 +325,16 @@ class NutFile: public NutStream {
 
 		/** Write only, with creation, initial position is at the end */
 		APPEND_ONLY,
+
+		/** Read-only like READ_ONLY, with the contents also mapped
+		 *  to memory where possible (see \ref view) */
+		READ_ONLY_MAPPED,
+
+		/** Write-only, replacing the file as a whole: the contents
+		 *  are gathered in memory, and written at once to a temporary
+		 *  file next to it by \ref close, which then syncs it and
+		 *  renames it over the file (so readers never see it torn) */
+		WRITE_ATOMIC,
 	} access_t;
 
 	/** Unnamed temp. file constructor flag */
@@ -283,6 +359,46 @@ class NutFile: public NutStream {
 	/** Current character cache status */
 	bool m_current_ch_valid;
 
+	/** Contents mapped to memory (READ_ONLY_MAPPED mode) */
+	const char * m_map;
+
+	/** Size of the mapping */
+	size_t m_map_size;
+
+	/** Contents to write at close (WRITE_ATOMIC mode) */
+	std::string m_pending;
+
+	/** Temporary file name (WRITE_ATOMIC mode), empty in other modes */
+	std::string m_tmp_name;
+
+	/** Create the temporary file for WRITE_ATOMIC mode */
+	bool openAtomic(int & err_code, std::string & err_msg)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		;
+
+	/** Write the gathered contents, sync and rename (WRITE_ATOMIC mode) */
+	bool commitAtomic(int & err_code, std::string & err_msg)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		;
+
+	/** Map the (just opened) file contents to memory, if possible */
+	void map()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		;
+
+	/** Release the mapping, if any */
+	void unmap()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		;
+
 	/**
 	 *  \brief  Convert enum access_t mode values to strings
 	 *          for standard library methods
@@ -308,7 +424,11 @@ class NutFile: public NutStream {
 		m_name(name),
 		m_impl(nullptr),
 		m_current_ch('\0'),
-		m_current_ch_valid(false) {}
+		m_current_ch_valid(false),
+		m_map(nullptr),
+		m_map_size(0),
+		m_pending(),
+		m_tmp_name() {}
 
 	/**
 	 *  \brief  Temporary file constructor (with open)
@@ -518,6 +638,9 @@ class NutFile: public NutStream {
 	/**
 	 *  \brief  Close file
 	 *
+	 *  In WRITE_ATOMIC mode, this is when the file gets replaced; if
+	 *  that fails, it is left as it was.
+	 *
 	 *  \param[out]  err_code  Error code
 	 *  \param[out]  err_msg   Error message
 	 *
@@ -657,6 +780,18 @@ class NutFile: public NutStream {
 #endif
 		override;
 
+	status_t getData(std::string & data, size_t size)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		override;
+
+	bool     view(const char * & data, size_t & size) const
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		override;
+
 	status_t putChar(char ch)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 		throw()
@@ -675,6 +810,12 @@ class NutFile: public NutStream {
 #endif
 		override;
 
+	status_t putData(const std::vector<std::string> & data)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		override;
+
 	/** Destructor (closes the file) */
 	~NutFile() override;
 
@@ -879,11 +1020,24 @@ class NutSocket: public NutStream {
 	domain_t m_domain;
 	type_t m_type;
 
-	/** Current character cache */
-	char m_current_ch;
+	/** Read buffer (data received, but not consumed yet) */
+	std::string m_rbuf;
 
-	/** Current character cache status */
-	bool m_current_ch_valid;
+	/** Position of the current character in the read buffer */
+	size_t m_rbuf_pos;
+
+	/**
+	 *  \brief  Refill the (fully consumed) read buffer
+	 *
+	 *  \retval NUTS_OK    on success,
+	 *  \retval NUTS_EOF   on end of stream,
+	 *  \retval NUTS_ERROR on read error
+	 */
+	status_t fillReadBuffer()
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		;
 
 	/**
 	 *  \brief  Accept client connection on a listen socket
@@ -995,8 +1149,7 @@ class NutSocket: public NutStream {
 		m_impl(-1),
 		m_domain(NUTSOCKD_UNDEFINED),
 		m_type(NUTSOCKT_UNDEFINED),
-		m_current_ch('\0'),
-		m_current_ch_valid(false)
+		m_rbuf_pos(0)
 	{
 		accept(*this, listen_sock, err_code, err_msg);
 	}
@@ -1012,8 +1165,7 @@ class NutSocket: public NutStream {
 		m_impl(-1),
 		m_domain(NUTSOCKD_UNDEFINED),
 		m_type(NUTSOCKT_UNDEFINED),
-		m_current_ch('\0'),
-		m_current_ch_valid(false)
+		m_rbuf_pos(0)
 	{
 		accept(*this, listen_sock);
 	}
@@ -1310,6 +1462,18 @@ class NutSocket: public NutStream {
 #endif
 		override;
 
+	status_t getLine(std::string & line)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		override;
+
+	status_t getData(std::string & data, size_t size)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		override;
+
 	status_t putChar(char ch)
 #if (defined __cplusplus) && (__cplusplus < 201100)
 		throw()
@@ -1327,6 +1491,12 @@ class NutSocket: public NutStream {
 		return putString(data);  // no difference on sockets
 	}
 
+	status_t putData(const std::vector<std::string> & data)
+#if (defined __cplusplus) && (__cplusplus < 201100)
+		throw()
+#endif
+		override;
+
 	/** Destructor (closes socket if necessary) */
 	~NutSocket() override;
 
@@ -0,0 +1,104 @@
+/* nuttrace.h - Network UPS Tools binary trace ring for daemons
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NUTTRACE_H_SEEN
+#define NUT_NUTTRACE_H_SEEN 1
+
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* A daemon started with NUT_TRACE=<records> in its environment keeps
+ * that many (rounded up to a power of two) of its latest events in a
+ * ring of fixed-size records in memory: a timestamp, the event, two
+ * numbers and the start of a string. Nothing is formatted or written
+ * until the ring is dumped as text, upon a signal or a fatal error, to
+ * the file named by NUT_TRACE_FILE (or <statepath>/<name>.trace).
+ *
+ * Adding an event costs a clock read and a copy of about 48 bytes, and
+ * only a pointer check when tracing is off. The ring is not locked: it
+ * is for the single-threaded daemons.
+ */
+
+/* What the numbers and the string of each event are */
+typedef enum {
+	NUT_TRACE_NONE = 0,
+	NUT_TRACE_NET_CMD,	/* upsd parse_net(): fd, args, command */
+	NUT_TRACE_NET_SEND,	/* upsd sendback_raw(): fd, length, reply */
+	NUT_TRACE_SSTATE_READ,	/* upsd sstate_readline(): fd, bytes, UPS */
+	NUT_TRACE_SSTATE_LINE,	/* upsd driver lines: args, 0, command */
+	NUT_TRACE_DSTATE_CMD,	/* driver socket commands: args, 0, command */
+	NUT_TRACE_DSTATE_SEND,	/* driver broadcasts: clients, length, line */
+	NUT_TRACE_UPSMON_POLL,	/* upsmon status of a UPS: status bits, tokens, UPS */
+	NUT_TRACE_UPSMON_EVENT,	/* upsmon notification: type, 0, UPS and extra */
+	NUT_TRACE_MARK,	/* anything else: as the caller says */
+	NUT_TRACE_EVENTS
+} nut_trace_event_t;
+
+#define NUT_TRACE_STRLEN	24
+
+typedef struct {
+	uint64_t	ns;	/* monotonic clock (or wall clock) */
+	uint32_t	event;	/* nut_trace_event_t */
+	int32_t	a;
+	int64_t	b;
+	char	s[NUT_TRACE_STRLEN];	/* cut, not always terminated */
+} nut_trace_rec_t;
+
+/* NULL unless tracing is on */
+extern nut_trace_rec_t	*nut_trace_ring;
+
+/* Add an event (s and s2 may be NULL; s2 follows s after a space) */
+#define NUT_TRACE(event, a, b, s) \
+	do { if (nut_trace_ring) { nut_trace_add((event), (a), (b), (s), NULL); } } while(0)
+#define NUT_TRACE2(event, a, b, s, s2) \
+	do { if (nut_trace_ring) { nut_trace_add((event), (a), (b), (s), (s2)); } } while(0)
+
+/* Add an event for a buffer which need not be terminated: its length
+ * goes in the second number, and its start in the string */
+#define NUT_TRACE_BUF(event, a, buf, len) \
+	do { if (nut_trace_ring) { nut_trace_add_buf((event), (a), (buf), (len)); } } while(0)
+
+void nut_trace_add(nut_trace_event_t event, long a, int64_t b, const char *s, const char *s2);
+void nut_trace_add_buf(nut_trace_event_t event, long a, const char *buf, size_t len);
+
+/* Turn tracing on if NUT_TRACE asks for it; name is for the dump file
+ * and its header. Fatal errors dump the ring from then on. */
+void nut_trace_init(const char *name);
+
+/* Write the ring, oldest first, and say where in the log; why goes in
+ * the header. Returns the number of records written, or -1. */
+int nut_trace_dump(const char *why);
+
+/* Ask for a dump from a signal handler, done by nut_trace_dump_pending()
+ * from the main loop */
+void nut_trace_dump_request(int sig);
+void nut_trace_dump_pending(void);
+
+void nut_trace_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_NUTTRACE_H_SEEN */
@@ -83,7 +83,11 @@ int pconf_parse_error(PCONF_CTX_t *ctx);
 int pconf_line(PCONF_CTX_t *ctx, const char *line);
 void pconf_finish(PCONF_CTX_t *ctx);
 char *pconf_encode(const char *src, char *dest, size_t destsize);
+size_t pconf_encode_count(const char *src, size_t len);
 int pconf_char(PCONF_CTX_t *ctx, char ch);
+int pconf_feed(PCONF_CTX_t *ctx, const char *buf, size_t len, size_t *used);
+int pconf_feed_pending(const PCONF_CTX_t *ctx);
+size_t pconf_bytes(const PCONF_CTX_t *ctx);
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -0,0 +1,88 @@
+/* shmstate.h - Network UPS Tools driver state table in shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_SHMSTATE_H_SEEN
+#define NUT_SHMSTATE_H_SEEN 1
+
+#include "extstate.h"
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* A driver started with the "sharedstate" flag keeps the values of its
+ * variables in a file mapped into memory next to its socket, and only
+ * says "SHMSET <varname> <slot>" to those socket clients (upsd) which
+ * asked for it with "SHMSTATE".  Everything else (flags, enums, ranges,
+ * commands, replies) still goes over the socket as text.
+ *
+ * Each slot is guarded by its own sequence counter: the driver (the
+ * only writer) makes it odd while it changes the slot, and readers
+ * retry when they saw it odd or changed during their copy.
+ */
+
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_FTRUNCATE) \
+ && ((defined __GNUC__) || (defined __clang__)) && !(defined WIN32)
+# define WITH_SHMSTATE 1
+#endif
+
+#define SHMSTATE_MAGIC		0x4e555453	/* "NUTS" */
+#define SHMSTATE_VERSION	1
+#define SHMSTATE_SUFFIX		".shm"
+#define SHMSTATE_VARLEN		128
+#define SHMSTATE_DEFAULT_SLOTS	4096
+
+typedef struct {
+	volatile uint32_t	seq;		/* odd while being written */
+	char	var[SHMSTATE_VARLEN];		/* empty if the slot is free */
+	char	val[ST_MAX_VALUE_LEN];
+} shmstate_slot_t;
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	slotsize;		/* sizeof(shmstate_slot_t) */
+	uint32_t	numslots;
+} shmstate_header_t;
+
+/* private to shmstate.c */
+typedef struct shmstate_s shmstate_t;
+
+/* driver side: create (replacing any old one) and export values */
+shmstate_t *shmstate_create(const char *fn, size_t numslots);
+long shmstate_set(shmstate_t *shm, const char *var, const char *val);
+long shmstate_find(const shmstate_t *shm, const char *var);
+void shmstate_del(shmstate_t *shm, const char *var);
+
+/* upsd side: map read-only and fetch values by slot */
+shmstate_t *shmstate_open(const char *fn);
+int shmstate_get(const shmstate_t *shm, long slot, const char *var,
+	char *val, size_t valsize);
+
+/* both: unmap, and for the driver also remove the file */
+void shmstate_close(shmstate_t *shm);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_SHMSTATE_H_SEEN */
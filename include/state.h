@@ -23,6 +23,7 @@
 #define NUT_STATE_H_SEEN 1
 
 #include "extstate.h"
+#include "nut_stdint.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -32,6 +33,15 @@ extern "C" {
 
 #define ST_SOCK_BUF_LEN 512
 
+/* values up to this long (with the NUL) are kept inside the st_tree_t
+ * node, as most are, rather than in a buffer of their own */
+#define ST_TREE_RAWBUF_LEN	24
+
+/* what st_tree_t numtype says the value was formatted from */
+#define ST_NUM_NONE	0
+#define ST_NUM_DOUBLE	1
+#define ST_NUM_LONG	2
+
 #include "timehead.h"
 
 #if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
@@ -40,12 +50,31 @@ typedef struct timespec	st_tree_timespec_t;
 typedef struct timeval	st_tree_timespec_t;
 #endif
 
+/* A variable name, interned: kept once per process however many trees
+ * (devices) have it, with a small id (in order of interning) and an
+ * order key which sorts like strcasecmp() of the names, so the trees
+ * compare integers rather than strings. Names differing only in case
+ * are the same name, spelled as first seen. */
+typedef struct st_name_s {
+	char	*name;
+	size_t	id;
+	uint64_t	order;
+} st_name_t;
+
+/* A list of enum values or ranges, kept once for all the variables (of
+ * all the trees) which have the same one, e.g. each outlet.N.status of
+ * a PDU; opaque, see state.c */
+typedef struct st_list_s	st_list_t;
+
 typedef struct st_tree_s {
-	char	*var;
+	char	*var;			/* name->name */
+	const st_name_t	*name;
 	char	*val;			/* points to raw or safe */
+	size_t	vallen;			/* strlen(val) */
 
 	char	*raw;			/* raw data from caller */
 	size_t	rawsize;
+	char	rawbuf[ST_TREE_RAWBUF_LEN];	/* raw, unless it is longer */
 
 	char	*safe;			/* safe data from pconf_encode */
 	size_t	safesize;
@@ -59,16 +88,35 @@ typedef struct st_tree_s {
 	 */
 	st_tree_timespec_t	lastset;
 
-	struct enum_s		*enum_list;
-	struct range_s		*range_list;
-
+	struct enum_s		*enum_list;	/* enums->..., to read */
+	struct range_s		*range_list;	/* ranges->..., to read */
+	st_list_t		*enums;		/* shared, NULL if none */
+	st_list_t		*ranges;
+
+	/* the number raw was formatted from by state_setinfo_double()
+	 * or state_setinfo_long(), so the same one is not formatted
+	 * again; any other change of the value forgets it */
+	int	numtype;		/* ST_NUM_* */
+	int	numprec;		/* digits after the point (double) */
+	double	numdouble;
+	long	numlong;
+
+	/* AVL tree, sorted by strcasecmp() of var; height of the subtree
+	 * rooted here (a leaf is 1) is maintained by state.c methods */
 	struct st_tree_s	*left;
 	struct st_tree_s	*right;
+	int	height;
 } st_tree_t;
 
 int state_get_timestamp(st_tree_timespec_t *now);
 int st_tree_node_compare_timestamp(const st_tree_t *node, const st_tree_timespec_t *cutoff);
+/* a stamp as microseconds on its clock (rounded down), which is how
+ * the protocols carry them (LIST VAR ... SINCE, DUMPALL SINCE), and back */
+uintmax_t state_timestamp_token(const st_tree_timespec_t *ts);
+void state_token_timestamp(uintmax_t token, st_tree_timespec_t *ts);
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val);
+int state_setinfo_double(st_tree_t **nptr, const char *var, double val, int precision);
+int state_setinfo_long(st_tree_t **nptr, const char *var, long val);
 int state_addenum(st_tree_t *root, const char *var, const char *val);
 int state_addrange(st_tree_t *root, const char *var, const int min, const int max);
 int state_setaux(st_tree_t *root, const char *var, const char *auxs);
@@ -80,13 +128,32 @@ const range_t *state_getrangelist(st_tree_t *root, const char *var);
 void state_setflags(st_tree_t *root, const char *var, size_t numflags, char **flags);
 int state_addcmd(cmdlist_t **list, const char *cmd);
 void state_infofree(st_tree_t *node);
+size_t state_tree_bytes(const st_tree_t *node);
+size_t state_shared_bytes(void);
+void state_slabs_free(void);
 void state_cmdfree(cmdlist_t *list);
 int state_delcmd(cmdlist_t **list, const char *cmd);
 int state_delinfo(st_tree_t **root, const char *var);
 int state_delinfo_olderthan(st_tree_t **root, const char *var, const st_tree_timespec_t *cutoff);
 int state_delenum(st_tree_t *root, const char *var, const char *val);
 int state_delrange(st_tree_t *root, const char *var, const int min, const int max);
+int state_setenums(st_tree_t *root, const char *var, st_list_t *list);
+int state_setranges(st_tree_t *root, const char *var, st_list_t *list);
 st_tree_t *state_tree_find(st_tree_t *node, const char *var);
+st_tree_t *state_tree_next(st_tree_t *node, const st_name_t *name);
+
+const st_name_t *state_name_intern(const char *var);
+const st_name_t *state_name_find(const char *var);	/* NULL if never interned */
+const st_name_t *state_name_byid(size_t id);
+void state_names_free(void);
+
+/* lists built one value at a time (e.g. by upsd from the ENUMLIST and
+ * RANGELIST lines of a driver), for state_setenums() and such; the id
+ * is unique for the life of the process, and changes with the values */
+int state_list_addenum(st_list_t **list, const char *val);
+int state_list_addrange(st_list_t **list, const int min, const int max);
+size_t state_list_id(const st_list_t *list);
+void state_list_free(st_list_t *list);
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
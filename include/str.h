@@ -130,6 +130,25 @@ int	str_to_ulong_strict(const char *string, unsigned long *number, const int bas
 int	str_to_double(const char *string, double *number, const int base);
 int	str_to_double_strict(const char *string, double *number, const int base);
 
+/* Locale-independent conversions of plain decimal numbers for the hot
+ * paths of drivers, without the allocations and errno juggling of the
+ * functions above (nor the format parsing of snprintf()).
+ * - str_scan_long() and str_scan_double() read a number at the start of
+ *   *string* like strtol(, 10) and strtod() do (leading spaces, a sign,
+ *   digits, for double also a period and decimals), returning how many
+ *   characters they used, or 0 (with *number* being 0) if none were a
+ *   number; what they can not do exactly themselves (exponents, long or
+ *   hexadecimal numbers) is still handed to strtol() or strtod(), so the
+ *   results are always the same, except that the radix character is
+ *   always a period;
+ * - str_from_long() and str_from_double() write *number* into *buf* like
+ *   snprintf(buf, buflen, "%ld") and "%.*f" with *precision* do in the C
+ *   locale, with the same return value. */
+size_t	str_scan_long(const char *string, long *number);
+size_t	str_scan_double(const char *string, double *number);
+int	str_from_long(char *buf, const size_t buflen, const long number);
+int	str_from_double(char *buf, const size_t buflen, const double number, const int precision);
+
 /* Return non-zero if string s ends exactly with suff
  * Note: s=NULL always fails the test; otherwise suff=NULL always matches
  */
@@ -39,6 +39,11 @@ void do_upsconf_args(char *upsname, char *var, char *val);
  */
 int read_upsconf(int fatal_errors);
 
+/* the same, but only calls back for the global settings and those of
+ * section (e.g. of a driver), which it takes from a cache of ups.conf in
+ * the state path if that is up to date, rather than parsing all of it */
+int read_upsconf_section(const char *section, int fatal_errors);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -0,0 +1,58 @@
+dnl Check for LIBZ compiler flags. On success, set nut_have_libz="yes"
+dnl and set LIBZ_CFLAGS and LIBZ_LIBS. On failure, set
+dnl nut_have_libz="no". This macro can be run multiple times, but will
+dnl do the checking only once.
+
+AC_DEFUN([NUT_CHECK_LIBZ],
+[
+if test -z "${nut_have_libz_seen}"; then
+	nut_have_libz_seen=yes
+	AC_REQUIRE([NUT_CHECK_PKGCONFIG])
+
+	dnl save CFLAGS and LIBS
+	CFLAGS_ORIG="${CFLAGS}"
+	LIBS_ORIG="${LIBS}"
+	CFLAGS=""
+	LIBS=""
+	depCFLAGS=""
+	depLIBS=""
+
+	AS_IF([test x"$have_PKG_CONFIG" = xyes],
+		[AC_MSG_CHECKING(for zlib version via pkg-config)
+		 ZLIB_VERSION="`$PKG_CONFIG --silence-errors --modversion zlib 2>/dev/null`"
+		 if test "$?" != "0" -o -z "${ZLIB_VERSION}"; then
+		    ZLIB_VERSION="none"
+		 fi
+		 AC_MSG_RESULT(${ZLIB_VERSION} found)
+		],
+		[ZLIB_VERSION="none"
+		 AC_MSG_NOTICE([can not check zlib settings via pkg-config])
+		]
+	)
+
+	AS_IF([test x"${ZLIB_VERSION}" != xnone],
+		[depCFLAGS="`$PKG_CONFIG --silence-errors --cflags zlib 2>/dev/null`"
+		 depLIBS="`$PKG_CONFIG --silence-errors --libs zlib 2>/dev/null`"
+		],
+		[depLIBS="-lz"]
+	)
+
+	dnl check if zlib is usable
+	CFLAGS="${CFLAGS_ORIG} ${depCFLAGS}"
+	LIBS="${LIBS_ORIG} ${depLIBS}"
+	AC_CHECK_HEADERS(zlib.h, [nut_have_libz=yes], [nut_have_libz=no], [AC_INCLUDES_DEFAULT])
+	AC_CHECK_FUNCS(deflateInit2_ inflateInit2_, [], [nut_have_libz=no])
+
+	if test "${nut_have_libz}" = "yes"; then
+		LIBZ_CFLAGS="${depCFLAGS}"
+		LIBZ_LIBS="${depLIBS}"
+	fi
+
+	unset depCFLAGS
+	unset depLIBS
+
+	dnl restore original CFLAGS and LIBS
+	CFLAGS="${CFLAGS_ORIG}"
+	LIBS="${LIBS_ORIG}"
+fi
+])
@@ -54,6 +54,8 @@ let ups_fields   = "driver"
                  | "desc"
                  | "nolock"
                  | "ignorelb"
+                 | "nocapcache"
+                 | "sharedstate"
                  | "maxstartdelay"
                  | "synchronous"
                  | "user"
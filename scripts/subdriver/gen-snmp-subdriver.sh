@@ -220,7 +220,7 @@ generate_C() {
 	 */
 
 	/* ${UDRIVER} Snmp2NUT lookup table */
-	static snmp_info_t ${LDRIVER}_mib[] = {
+	static const snmp_info_t ${LDRIVER}_mib[] = {
 
 		/* Data format:
 		 * snmp_info_default(info_type, info_flags, info_len, OID, dfl, flags, oid2info),
@@ -472,9 +472,9 @@ Done.
 For C-style integration, do not forget to:
 * bump DRIVER_VERSION in snmp-ups.c (add "0.01")
 * copy "${HFILE}" and "${CFILE}" to "../../drivers"
-* add #include "${HFILE}" to drivers/snmp-ups.c
-* add &${LDRIVER} to drivers/snmp-ups.c:mib2nut[] list,
-* add ${LDRIVER}-mib.c to snmp_ups_SOURCES in drivers/Makefile.am
+* add #include "${HFILE}" to drivers/snmp-ups-mibs.c
+* add &${LDRIVER} to drivers/snmp-ups-mibs.c:mib2nut_builtin[] list,
+* add ${LDRIVER}-mib.c to SNMP_UPS_MIB_SOURCES in drivers/Makefile.am
 * add ${LDRIVER}-mib.h to dist_noinst_HEADERS in drivers/Makefile.am
 * "./autogen.sh && ./configure && make" from the top level directory
 EOF
@@ -237,7 +237,7 @@ static usage_tables_t ${LDRIVER}_utab[] = {
 /* HID2NUT lookup table                                            */
 /* --------------------------------------------------------------- */
 
-static hid_info_t ${LDRIVER}_hid2nut[] = {
+static const hid_info_t ${LDRIVER}_hid2nut[] = {
 
 /* Please revise values discovered by data walk for mappings to
  * docs/nut-names.txt and group the rest under the ifdef below:
@@ -0,0 +1,166 @@
+#!/bin/sh
+
+# Latency of each hop of a power event through NUT, measured with bpftrace
+# from the USDT probes of a build configured `--with-usdt` (see the
+# include/nut_usdt.h file in the sources, and README.adoc next to this one).
+#
+# For each UPS which goes on battery (OB) or low on battery (LB), this
+# prints when the driver set the status, and how long it then took for:
+#	upsd to store it (the driver socket and upsd main loop),
+#	upsmon to see it (its poll interval, mostly),
+#	upsmon to act on it (ONBATT or LOWBATT handling),
+#	upsmon to start the shutdown (after a LB which made it critical),
+# and histograms of each of these (in microseconds) upon Ctrl+C.
+#
+# Usage: nut-power-latency.sh -d /path/to/driver [-u /path/to/upsd]
+#	[-m /path/to/upsmon] [-n] [bpftrace options...]
+# The programs default to the ones in SBINDIR, and -n prints the bpftrace
+# program instead of running it. Needs to be run as root (or with the
+# capabilities which bpftrace needs); the daemons may already be running.
+#
+# Design note: written with dumbed-down POSIX shell syntax, like NIT, as
+# bpftrace takes the programs to attach to in the probe names, not as
+# arguments of the script.
+#
+# License: GPLv2+
+
+[ -n "${SBINDIR-}" ] || SBINDIR="/usr/sbin"
+[ -n "${BPFTRACE-}" ] || BPFTRACE="bpftrace"
+
+DRIVER=""
+UPSD="$SBINDIR/upsd"
+UPSMON="$SBINDIR/upsmon"
+PRINT_ONLY=no
+
+die() {
+	echo "FATAL: $*" >&2
+	exit 1
+}
+
+while [ $# -gt 0 ] ; do
+	case "$1" in
+		-d) DRIVER="$2" ; shift ;;
+		-u) UPSD="$2" ; shift ;;
+		-m) UPSMON="$2" ; shift ;;
+		-n) PRINT_ONLY=yes ;;
+		-h|--help)
+			sed -n '3,/^# License/p' "$0" | sed 's/^# \{0,1\}//'
+			exit 0 ;;
+		*) break ;;
+	esac
+	shift
+done
+
+[ -n "$DRIVER" ] || die "Which driver? See $0 -h"
+for P in "$DRIVER" "$UPSD" "$UPSMON" ; do
+	[ -x "$P" ] || die "$P is not a program"
+done
+
+# One status probe: stage number, and the name of what happened there;
+# the flags are NUT_USDT_OB (2) and NUT_USDT_LB (4), also used as keys
+status_probe() {
+	PROG="$1"
+	PROBE="$2"
+	STAGE="$3"
+	WHAT="$4"
+
+	cat << EOF
+usdt:$PROG:nut:$PROBE
+{
+	\$ups = str(arg0);
+EOF
+	for FLAG in 2 4 ; do
+		if [ "$FLAG" = 2 ] ; then EV="OB" ; else EV="LB" ; fi
+		cat << EOF
+	if ((arg2 & $FLAG) && !(@prev$STAGE[\$ups] & $FLAG)) {
+		@t[\$ups, $FLAG, $STAGE] = nsecs;
+EOF
+		if [ "$STAGE" = 0 ] ; then
+			cat << EOF
+		printf("%-16s $EV  %-28s [%s]\\n", \$ups, "$WHAT", str(arg1));
+EOF
+		else
+			hop "$FLAG" "$EV" "$STAGE" "$WHAT" "	"
+		fi
+		echo "	}"
+	done
+	cat << EOF
+	@prev$STAGE[\$ups] = arg2;
+}
+
+EOF
+}
+
+# The time since the previous stage (and since the driver), if it was seen
+hop() {
+	PREV="`expr $3 - 1`"
+	cat << EOF
+$5	if (@t[\$ups, $1, $PREV]) {
+$5		\$d = nsecs - @t[\$ups, $1, $PREV];
+$5		\$all = nsecs - @t[\$ups, $1, 0];
+$5		printf("%-16s $2  %-28s +%6d.%03d ms  (%d.%03d ms since the driver)\\n",
+$5			\$ups, "$4", \$d / 1000000, (\$d / 1000) % 1000,
+$5			\$all / 1000000, (\$all / 1000) % 1000);
+$5		@hop_us["$2 $3: $4"] = hist(\$d / 1000);
+$5	}
+EOF
+}
+
+program() {
+	cat << EOF
+BEGIN
+{
+	printf("Tracing power events through NUT, Ctrl+C to stop\\n");
+}
+
+EOF
+	status_probe "$DRIVER" driver_status 0 "driver set the status"
+	status_probe "$UPSD" upsd_status 1 "upsd stored the status"
+	status_probe "$UPSMON" upsmon_status 2 "upsmon saw the status"
+
+	cat << EOF
+usdt:$UPSMON:nut:upsmon_onbatt
+{
+	\$ups = str(arg0);
+	@t[\$ups, 2, 3] = nsecs;
+EOF
+	hop 2 OB 3 "upsmon handled on battery" ""
+	cat << EOF
+}
+
+usdt:$UPSMON:nut:upsmon_lowbatt
+{
+	\$ups = str(arg0);
+	@t[\$ups, 4, 3] = nsecs;
+	@lowbatt = \$ups;
+EOF
+	hop 4 LB 3 "upsmon handled low battery" ""
+	cat << EOF
+}
+
+usdt:$UPSMON:nut:upsmon_shutdown
+{
+	\$ups = @lowbatt;
+EOF
+	hop 4 LB 4 "upsmon started the shutdown" ""
+	cat << EOF
+}
+
+END
+{
+	clear(@t);
+	clear(@prev0);
+	clear(@prev1);
+	clear(@prev2);
+	clear(@lowbatt);
+	printf("\\nLatency of each hop, in microseconds:\\n");
+}
+EOF
+}
+
+if [ "$PRINT_ONLY" = yes ] ; then
+	program
+	exit 0
+fi
+
+exec "$BPFTRACE" "$@" -e "`program`"
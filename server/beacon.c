@@ -0,0 +1,355 @@
+/* beacon.c - UDP status beacons of upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Hundreds of upsmon polling the same upsd every few seconds each keep
+ * it (and the network) busy just to be told that nothing happened.  With
+ * BEACON in upsd.conf, the status of all devices goes out in one signed
+ * datagram (see nutbeacon.h) as soon as one of them changes, and every
+ * BEACONINTERVAL seconds otherwise; to a multicast group or a broadcast
+ * address, it reaches them all at once.  The changes are noticed where
+ * upsd learns of them (sstate.c, the stale checks and FSD), and only
+ * make the beacon timer due: all those of one pass of the main loop go
+ * out together. */
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "timer.h"
+#include "nutstatus.h"
+#include "nuthmac.h"
+#include "nutbeacon.h"
+
+#include "beacon.h"
+
+#ifndef WIN32
+# include <netdb.h>
+#endif
+
+unsigned int	beacon_interval = BEACON_INTERVAL_DEFAULT;
+
+#ifndef WIN32
+
+typedef struct beacon_target_s {
+	char	*addr;
+	char	*port;
+	int	fd;		/* -1 until the first beacon */
+	struct sockaddr_storage	sa;
+	socklen_t	salen;
+	int	failing;	/* complained about it already */
+	struct beacon_target_s	*next;
+} beacon_target_t;
+
+static beacon_target_t	*beacon_targets = NULL;
+static char	*beacon_key = NULL;
+static uint32_t	beacon_id = 0, beacon_seq = 0;
+
+static void beacon_send_all(upsd_timer_t *timer, time_t now);
+static upsd_timer_t	beacon_timer = { 0, 0, beacon_send_all, NULL };
+
+static void put_be16(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 8);
+	p[1] = (unsigned char)v;
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+void beacon_add(const char *addr, const char *port)
+{
+	beacon_target_t	*t, **last;
+
+	/* a reload names them again */
+	for (last = &beacon_targets; *last; last = &(*last)->next) {
+		if (!strcmp((*last)->addr, addr) && !strcmp((*last)->port, port)) {
+			return;
+		}
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->addr = xstrdup(addr);
+	t->port = xstrdup(port);
+	t->fd = -1;
+	*last = t;
+
+	upsdebugx(3, "%s: added %s port %s", __func__, addr, port);
+
+	if (!beacon_id) {
+		/* tells the receivers that upsd was restarted, so the
+		 * sequence numbers start over */
+		beacon_id = ((uint32_t)time(NULL) * 2654435761U) ^ ((uint32_t)getpid() << 16);
+		if (!beacon_id) {
+			beacon_id = 1;
+		}
+	}
+
+	timer_set(&beacon_timer, 0);
+}
+
+void beacon_set_key(const char *key)
+{
+	free(beacon_key);
+	beacon_key = xstrdup(key);
+}
+
+/* what a beacon tells of ups */
+static void beacon_state(const upstype_t *ups, uint32_t *status, int *flags)
+{
+	const char	*val;
+
+	*status = 0;
+	*flags = 0;
+
+	if (INVALID_FD(ups->sock_fd) || ups->stale
+	||  (val = sstate_getinfo(ups, "ups.status")) == NULL
+	) {
+		*flags = NUT_BEACON_STALE;
+		return;
+	}
+
+	*status = nut_status_parse(val);
+	if (ups->fsd) {
+		*status |= NUT_STATUS_FSD;
+	}
+}
+
+void beacon_changed(upstype_t *ups)
+{
+	uint32_t	status;
+	int	flags;
+
+	if (!beacon_targets) {
+		return;
+	}
+
+	beacon_state(ups, &status, &flags);
+
+	if (status == ups->beacon_status && flags == ups->beacon_flags) {
+		return;
+	}
+
+	upsdebugx(3, "%s: UPS [%s]: status bits 0x%08x, flags 0x%02x",
+		__func__, ups->name, (unsigned int)status, (unsigned int)flags);
+
+	ups->beacon_status = status;
+	ups->beacon_flags = flags;
+
+	/* at the next pass, along with the other changes until then */
+	timer_set(&beacon_timer, 0);
+}
+
+/* resolve the address and get a socket for it; 0 if that failed */
+static int beacon_open(beacon_target_t *t)
+{
+	struct addrinfo	hints, *res;
+	int	ret, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	if ((ret = getaddrinfo(t->addr, t->port, &hints, &res)) != 0) {
+		if (!t->failing) {
+			upslogx(LOG_WARNING, "BEACON %s port %s: %s",
+				t->addr, t->port, gai_strerror(ret));
+			t->failing = 1;
+		}
+		return 0;
+	}
+
+	t->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (t->fd < 0) {
+		upslog_with_errno(LOG_WARNING, "BEACON %s port %s: socket", t->addr, t->port);
+		freeaddrinfo(res);
+		return 0;
+	}
+
+	/* to a broadcast address too; multicast goes to the local network
+	 * only, unless the system was told otherwise */
+	if (res->ai_family == AF_INET
+	&&  setsockopt(t->fd, SOL_SOCKET, SO_BROADCAST, (void *)&one, sizeof(one)) != 0
+	) {
+		upsdebug_with_errno(1, "%s: %s: SO_BROADCAST", __func__, t->addr);
+	}
+
+	fcntl(t->fd, F_SETFD, FD_CLOEXEC);
+	fcntl(t->fd, F_SETFL, fcntl(t->fd, F_GETFL) | O_NONBLOCK);
+
+	memcpy(&t->sa, res->ai_addr, res->ai_addrlen);
+	t->salen = (socklen_t)res->ai_addrlen;
+	freeaddrinfo(res);
+
+	return 1;
+}
+
+/* sign the datagram of len bytes in buf (with room for the MAC), and
+ * send it to all targets */
+static void beacon_send(unsigned char *buf, size_t len, size_t count)
+{
+	unsigned char	mac[NUT_SHA256_LEN];
+	beacon_target_t	*t;
+
+	put_be16(buf + 24, (uint32_t)count);
+
+	nut_hmac_sha256(beacon_key, strlen(beacon_key), buf, len, mac);
+	memcpy(buf + len, mac, NUT_BEACON_MACLEN);
+	len += NUT_BEACON_MACLEN;
+
+	for (t = beacon_targets; t; t = t->next) {
+		if (t->fd < 0 && !beacon_open(t)) {
+			continue;
+		}
+
+		if (sendto(t->fd, (void *)buf, len, 0, (struct sockaddr *)&t->sa, t->salen) < 0) {
+			if (!t->failing) {
+				upslog_with_errno(LOG_WARNING, "BEACON %s port %s: sendto",
+					t->addr, t->port);
+				t->failing = 1;
+			}
+			continue;
+		}
+
+		if (t->failing) {
+			upslogx(LOG_NOTICE, "BEACON %s port %s: sending again", t->addr, t->port);
+			t->failing = 0;
+		}
+	}
+}
+
+/* the header of the next datagram; returns its length */
+static size_t beacon_header(unsigned char *buf, time_t now)
+{
+	uint64_t	when = (uint64_t)now;
+
+	memcpy(buf, NUT_BEACON_MAGIC, 4);
+	buf[4] = NUT_BEACON_VERSION;
+	buf[5] = 0;
+	put_be16(buf + 6, beacon_interval > 0xffff ? 0xffff : beacon_interval);
+	put_be32(buf + 8, beacon_id);
+	put_be32(buf + 12, ++beacon_seq);
+	put_be32(buf + 16, (uint32_t)(when >> 32));
+	put_be32(buf + 20, (uint32_t)when);
+	put_be16(buf + 24, 0);
+
+	return NUT_BEACON_HDRLEN;
+}
+
+static void beacon_send_all(upsd_timer_t *timer, time_t now)
+{
+	unsigned char	buf[NUT_BEACON_MAXLEN];
+	upstype_t	*ups;
+	size_t	len, count = 0, namelen;
+
+	if (!beacon_targets) {
+		return;
+	}
+
+	if (!beacon_key) {
+		static int	warned = 0;
+
+		if (!warned) {
+			upslogx(LOG_WARNING, "BEACON without BEACONKEY in upsd.conf, no beacons sent");
+			warned = 1;
+		}
+		return;
+	}
+
+	len = beacon_header(buf, now);
+
+	for (ups = firstups; ups; ups = ups->next) {
+		namelen = strlen(ups->name);
+		if (namelen > 255) {
+			continue;
+		}
+
+		/* refresh what beacon_changed() may not have been told of */
+		beacon_state(ups, &ups->beacon_status, &ups->beacon_flags);
+
+		if (len + 1 + namelen + 1 + 4 + NUT_BEACON_MACLEN > sizeof(buf)) {
+			beacon_send(buf, len, count);
+			len = beacon_header(buf, now);
+			count = 0;
+		}
+
+		buf[len++] = (unsigned char)namelen;
+		memcpy(buf + len, ups->name, namelen);
+		len += namelen;
+		buf[len++] = (unsigned char)ups->beacon_flags;
+		put_be32(buf + len, ups->beacon_status);
+		len += 4;
+		count++;
+	}
+
+	/* even with no device: upsd is still there */
+	beacon_send(buf, len, count);
+
+	timer_set(timer, now + (time_t)beacon_interval);
+}
+
+void beacon_free(void)
+{
+	beacon_target_t	*t, *next;
+
+	timer_cancel(&beacon_timer);
+
+	for (t = beacon_targets; t; t = next) {
+		next = t->next;
+		if (t->fd >= 0) {
+			close(t->fd);
+		}
+		free(t->addr);
+		free(t->port);
+		free(t);
+	}
+	beacon_targets = NULL;
+
+	free(beacon_key);
+	beacon_key = NULL;
+}
+
+#else	/* WIN32 */
+
+void beacon_add(const char *addr, const char *port)
+{
+	NUT_UNUSED_VARIABLE(addr);
+	NUT_UNUSED_VARIABLE(port);
+
+	upslogx(LOG_WARNING, "BEACON is not supported on this platform, ignored");
+}
+
+void beacon_set_key(const char *key)
+{
+	NUT_UNUSED_VARIABLE(key);
+}
+
+void beacon_changed(upstype_t *ups)
+{
+	NUT_UNUSED_VARIABLE(ups);
+}
+
+void beacon_free(void)
+{
+}
+
+#endif	/* WIN32 */
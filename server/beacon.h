@@ -0,0 +1,51 @@
+/* beacon.h - UDP status beacons of upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_BEACON_H_SEEN
+#define NUT_BEACON_H_SEEN 1
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* seconds between beacons when nothing changes (BEACONINTERVAL) */
+#define BEACON_INTERVAL_DEFAULT	5
+
+extern unsigned int	beacon_interval;
+
+/* BEACON <address> [<port>]: send the beacons there too */
+void beacon_add(const char *addr, const char *port);
+
+/* BEACONKEY <secret>: what they are signed with (none are sent without) */
+void beacon_set_key(const char *key);
+
+/* the status of ups may have changed: if it did, a beacon goes out
+ * at the next pass of the main loop */
+void beacon_changed(upstype_t *ups);
+
+/* stop sending beacons, and forget where to */
+void beacon_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_BEACON_H_SEEN */
@@ -21,12 +21,22 @@
 #include "conf.h"
 #include "upsconf.h"
 #include "sstate.h"
+#include "snapshot.h"
 #include "user.h"
 #include "netssl.h"
+#include "netmetrics.h"
+#include "history.h"
+#include "beacon.h"
+#include "nutbeacon.h"
+#include "netrelay.h"
 #include "nut_stdint.h"
 #include <ctype.h>
 
 static ups_t	*upstable = NULL;
+
+/* RELAY lines of upsd.conf (upsname, and the source as port), added
+ * after ups.conf by relayconf_add() */
+static ups_t	*relaytable = NULL;
 int	num_ups = 0;
 
 /* Users can pass a -D[...] option to enable debugging.
@@ -41,22 +51,22 @@ int	nut_debug_level_global = -1;
  */
 int nut_debug_level_args = 0;
 
-/* add another UPS for monitoring from ups.conf */
-static void ups_create(const char *fn, const char *name, const char *desc)
+/* add another UPS for monitoring from ups.conf (or RELAY of upsd.conf) */
+static void ups_create(const char *fn, const char *name, const char *desc, int relay)
 {
 	upstype_t	*temp;
 
-	for (temp = firstups; temp != NULL; temp = temp->next) {
-		if (!strcasecmp(temp->name, name)) {
-			upslogx(LOG_ERR, "UPS name [%s] is already in use!", name);
-			return;
-		}
+	if (get_ups_ptr(name)) {
+		upslogx(LOG_ERR, "UPS name [%s] is already in use!", name);
+		return;
 	}
 
 	/* grab some memory and add the info */
 	temp = xcalloc(1, sizeof(*temp));
 	temp->fn = xstrdup(fn);
 	temp->name = xstrdup(name);
+	temp->relay = relay;
+	temp->connect_fd = ERROR_FD;
 
 	if (desc) {
 		temp->desc = xstrdup(desc);
@@ -64,6 +74,8 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 
 	temp->stale = 1;
 	temp->retain = 1;
+	state_get_timestamp(&temp->lastdel);
+	metrics_invalidate();
 #ifdef WIN32
 	memset(&temp->read_overlapped,0,sizeof(temp->read_overlapped));
 	memset(temp->buf,0,sizeof(temp->buf));
@@ -76,7 +88,19 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 			name);
 		return;
 	}
+
+	/* manual-reset, as GetOverlappedResult() waits for it */
+	memset(&temp->write_overlapped, 0, sizeof(temp->write_overlapped));
+	temp->write_overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (temp->write_overlapped.hEvent == NULL) {
+		upslogx(LOG_ERR, "Can't create event for UPS [%s]",
+			name);
+		return;
+	}
 #endif
+	/* what it had before a restart, if anything */
+	snapshot_restore(temp);
+
 	temp->sock_fd = sstate_connect(temp);
 
 	/* preload this to the current time to avoid false staleness */
@@ -84,11 +108,13 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 
 	temp->next = firstups;
 	firstups = temp;
+	ups_index_add(temp);
+	ups_check_soon(temp);
 	num_ups++;
 }
 
 /* change the configuration of an existing UPS (used during reloads) */
-static void ups_update(const char *fn, const char *name, const char *desc)
+static void ups_update(const char *fn, const char *name, const char *desc, int relay)
 {
 	upstype_t	*temp;
 
@@ -108,7 +134,7 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 	}
 
 	/* when the filename changes, force a reconnect */
-	if (strcmp(temp->fn, fn) != 0) {
+	if (strcmp(temp->fn, fn) != 0 || temp->relay != relay) {
 
 		upslogx(LOG_NOTICE, "Redefined UPS [%s]", name);
 
@@ -117,6 +143,8 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 		sstate_cmdfree(temp);
 		pconf_finish(&temp->sock_ctx);
 
+		sstate_connect_cancel(temp);
+		evloop_driver_del(temp->sock_fd);
 #ifndef WIN32
 		close(temp->sock_fd);
 #else
@@ -128,6 +156,7 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 		/* now redefine the filename and wrap up */
 		free(temp->fn);
 		temp->fn = xstrdup(fn);
+		temp->relay = relay;
 	}
 
 	/* update the description */
@@ -190,6 +219,49 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		}
 	}
 
+	/* HISTORY <var> [<var>...] */
+	if (!strcmp(arg[0], "HISTORY")) {
+		size_t	i;
+
+		for (i = 1; i < numargs; i++) {
+			history_add_var(arg[i]);
+		}
+		return 1;
+	}
+
+	/* HISTORYSIZE <bytes> */
+	if (!strcmp(arg[0], "HISTORYSIZE")) {
+		if (isdigit((size_t)arg[1][0])) {
+			history_size = (size_t)strtoul(arg[1], NULL, 10);
+			if (history_size < HISTORY_SIZE_MIN) {
+				history_size = HISTORY_SIZE_MIN;
+			}
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "HISTORYSIZE has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* BEACONKEY <secret> */
+	if (!strcmp(arg[0], "BEACONKEY")) {
+		beacon_set_key(arg[1]);
+		return 1;
+	}
+
+	/* BEACONINTERVAL <seconds> */
+	if (!strcmp(arg[0], "BEACONINTERVAL")) {
+		if (isdigit((size_t)arg[1][0]) && atoi(arg[1]) > 0) {
+			beacon_interval = (unsigned int)atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "BEACONINTERVAL has non numeric or zero value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
 	/* TRACKINGDELAY <seconds> */
 	if (!strcmp(arg[0], "TRACKINGDELAY")) {
 		if (isdigit((size_t)arg[1][0])) {
@@ -241,6 +313,67 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		}
 	}
 
+	/* MAXCONNRATE <connections per second> */
+	if (!strcmp(arg[0], "MAXCONNRATE")) {
+		if (isdigit((size_t)arg[1][0])) {
+			maxconnrate = (unsigned int)strtoul(arg[1], NULL, 10);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "MAXCONNRATE has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* LOWMEM <bool> */
+	if (!strcmp(arg[0], "LOWMEM")) {
+		if (parse_boolean(arg[1], &lowmem))
+			return 1;
+
+		upslogx(LOG_ERR, "LOWMEM has non boolean value (%s)!", arg[1]);
+		return 0;
+	}
+
+	/* MAXCLIENTQUEUE <bytes> */
+	if (!strcmp(arg[0], "MAXCLIENTQUEUE")) {
+		if (isdigit((size_t)arg[1][0])) {
+			maxclientqueue = (size_t)strtoul(arg[1], NULL, 10);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "MAXCLIENTQUEUE has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* WORKERS <processes> */
+	if (!strcmp(arg[0], "WORKERS")) {
+		if (isdigit((size_t)arg[1][0])) {
+#ifdef UPSD_WORKERS
+			upsd_workers = (size_t)strtoul(arg[1], NULL, 10);
+#else
+			upslogx(LOG_WARNING, "WORKERS is not supported on this platform, ignored");
+#endif
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "WORKERS has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
+	/* CLIENT_INACTIVITY_DELAY <seconds> */
+	if (!strcmp(arg[0], "CLIENT_INACTIVITY_DELAY")) {
+		if (isdigit((size_t)arg[1][0])) {
+			client_inactivity_delay = atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "CLIENT_INACTIVITY_DELAY has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
 	/* STATEPATH <dir> */
 	if (!strcmp(arg[0], "STATEPATH")) {
 		const char *sp = getenv("NUT_STATEPATH");
@@ -301,6 +434,18 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		upslogx(LOG_ERR, "DISABLE_WEAK_SSL has non boolean value (%s)!", arg[1]);
 		return 0;
 	}
+
+	/* SSL_HANDSHAKE_WORKERS <count> */
+	if (!strcmp(arg[0], "SSL_HANDSHAKE_WORKERS")) {
+		if (isdigit((size_t)arg[1][0])) {
+			ssl_handshake_workers = atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "SSL_HANDSHAKE_WORKERS has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
 #endif /* WITH_OPENSSL | WITH_NSS */
 
 	/* ACCEPT <aclname> [<aclname>...] */
@@ -324,6 +469,24 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* METRICS <address> [<port>] */
+	if (!strcmp(arg[0], "METRICS")) {
+		if (numargs < 3)
+			listen_add_metrics(arg[1], METRICS_PORT);
+		else
+			listen_add_metrics(arg[1], arg[2]);
+		return 1;
+	}
+
+	/* BEACON <address> [<port>] */
+	if (!strcmp(arg[0], "BEACON")) {
+		if (numargs < 3)
+			beacon_add(arg[1], NUT_BEACON_PORT);
+		else
+			beacon_add(arg[1], arg[2]);
+		return 1;
+	}
+
 	/* everything below here uses up through arg[2] */
 	if (numargs < 3)
 		return 0;
@@ -334,6 +497,33 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* RELAY <name> <ups>@<host>[:<port>] */
+	if (!strcmp(arg[0], "RELAY")) {
+#ifndef WIN32
+		char	upsname[SMALLBUF], host[SMALLBUF], port[SMALLBUF];
+		ups_t	*temp, **last;
+
+		if (!relay_split(arg[2], upsname, sizeof(upsname), host, sizeof(host), port, sizeof(port))) {
+			upslogx(LOG_ERR, "RELAY %s: not <ups>@<host>[:<port>] (%s)", arg[1], arg[2]);
+			return 0;
+		}
+
+		temp = xcalloc(1, sizeof(*temp));
+		temp->upsname = xstrdup(arg[1]);
+		temp->port = xstrdup(arg[2]);
+
+		/* in the order of the file */
+		last = &relaytable;
+		while (*last) {
+			last = &(*last)->next;
+		}
+		*last = temp;
+#else
+		upslogx(LOG_WARNING, "RELAY is not supported on this platform, ignored");
+#endif
+		return 1;
+	}
+
 #ifdef WITH_NSS
 	/* CERTIDENT <name> <passwd> */
 	if (!strcmp(arg[0], "CERTIDENT")) {
@@ -525,9 +715,9 @@ void upsconf_add(int reloading)
 
 			/* if a UPS exists, update it, else add it as new */
 			if ((reloading) && (get_ups_ptr(tmp->upsname) != NULL))
-				ups_update(statefn, tmp->upsname, tmp->desc);
+				ups_update(statefn, tmp->upsname, tmp->desc, 0);
 			else
-				ups_create(statefn, tmp->upsname, tmp->desc);
+				ups_create(statefn, tmp->upsname, tmp->desc, 0);
 		}
 
 		/* free tmp's resources */
@@ -545,6 +735,33 @@ void upsconf_add(int reloading)
 	upstable = NULL;
 }
 
+/* add the RELAY devices of upsd.conf, once those of ups.conf are known */
+void relayconf_add(int reloading)
+{
+	ups_t	*tmp, *next;
+	upstype_t	*ups;
+
+	for (tmp = relaytable; tmp; tmp = next) {
+		next = tmp->next;
+
+		ups = get_ups_ptr(tmp->upsname);
+
+		if (reloading && ups && (ups->relay || !ups->retain)) {
+			/* still relayed, or no longer in ups.conf */
+			ups_update(tmp->port, tmp->upsname, NULL, 1);
+		} else {
+			/* complains if ups.conf has it */
+			ups_create(tmp->port, tmp->upsname, NULL, 1);
+		}
+
+		free(tmp->port);
+		free(tmp->upsname);
+		free(tmp);
+	}
+
+	relaytable = NULL;
+}
+
 /* remove a UPS from the linked list */
 static void delete_ups(upstype_t *target)
 {
@@ -568,17 +785,25 @@ static void delete_ups(upstype_t *target)
 			else
 				last->next = ptr->next;
 
-			if (VALID_FD(ptr->sock_fd))
+			ups_index_del(ptr);
+			relay_gone(ptr);
+			timer_cancel(&ptr->check_timer);
+			sstate_connect_cancel(ptr);
+
+			if (VALID_FD(ptr->sock_fd)) {
+				evloop_driver_del(ptr->sock_fd);
 #ifndef WIN32
 				close(ptr->sock_fd);
 #else
 				CloseHandle(ptr->sock_fd);
 #endif
+			}
 
 			/* release memory */
 			sstate_infofree(ptr);
 			sstate_cmdfree(ptr);
 			pconf_finish(&ptr->sock_ctx);
+			history_free(ptr->history);
 
 			free(ptr->fn);
 			free(ptr->name);
@@ -639,6 +864,7 @@ void conf_reload(void)
 
 	/* now reread upsd.conf */
 	load_upsdconf(1);		/* 1 = reloading */
+	relayconf_add(1);
 
 	/* now delete all UPS entries that didn't get reloaded */
 
@@ -35,6 +35,9 @@ void load_upsdconf(int reloading);
 /* add valid UPSes from ups.conf to the internal structures */
 void upsconf_add(int reloading);
 
+/* and then the RELAY devices of upsd.conf */
+void relayconf_add(int reloading);
+
 /* flush existing config, then reread everything */
 void conf_reload(void);
 
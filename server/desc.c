@@ -20,6 +20,7 @@
 #include "config.h"  /* must be the first header */
 
 #include <string.h>
+#include <ctype.h>
 
 #include "common.h"
 #include "parseconf.h"
@@ -28,62 +29,137 @@
 
 extern const char *datapath;
 
+/* cmdvartab has some hundred entries, and GUIs ask for the description
+ * of every variable on each refresh: they are found by a hash of the
+ * name (case-insensitive, as they are compared), with a chain of the
+ * entries which share a bucket */
 typedef struct dlist_s {
 	char	*name;
-	char	*desc;
+	char	*desc;	/* as it goes on the wire, see desc_add() */
 	struct dlist_s	*next;
 } dlist_t;
 
-static dlist_t	*cmd_list = NULL, *var_list = NULL;
+typedef struct {
+	dlist_t	**buckets;
+	size_t	size;	/* a power of two, 0 until the first entry */
+	size_t	count;
+} dtable_t;
 
-static void list_free(dlist_t *ptr)
+static dtable_t	cmd_table, var_table;
+
+/* see desc_load_lazy() */
+static int	desc_pending = 0;
+
+/* FNV-1a, of the name in lower case */
+static size_t desc_hash(const char *name)
 {
-	dlist_t	*next;
+	size_t	hash = 2166136261U;
+
+	for (; *name; name++) {
+		hash ^= (size_t)tolower((unsigned char)*name);
+		hash *= 16777619U;
+	}
 
-	while (ptr) {
-		next = ptr->next;
+	return hash;
+}
 
-		free(ptr->name);
-		free(ptr->desc);
-		free(ptr);
+static void table_free(dtable_t *table)
+{
+	dlist_t	*ptr, *next;
+	size_t	i;
 
-		ptr = next;
+	for (i = 0; i < table->size; i++) {
+		for (ptr = table->buckets[i]; ptr; ptr = next) {
+			next = ptr->next;
+
+			free(ptr->name);
+			free(ptr->desc);
+			free(ptr);
+		}
 	}
+
+	free(table->buckets);
+	memset(table, 0, sizeof(*table));
 }
 
-static const char *list_get(const dlist_t *list, const char *name)
+static size_t table_bytes(const dtable_t *table)
 {
-	const dlist_t	*temp;
+	const dlist_t	*ptr;
+	size_t	bytes = table->size * sizeof(*table->buckets), i;
+
+	for (i = 0; i < table->size; i++) {
+		for (ptr = table->buckets[i]; ptr; ptr = ptr->next) {
+			bytes += sizeof(*ptr) + strlen(ptr->name) + 1 + strlen(ptr->desc) + 1;
+		}
+	}
+
+	return bytes;
+}
 
-	for (temp = list; temp != NULL; temp = temp->next) {
+static dlist_t *table_find(const dtable_t *table, const char *name)
+{
+	dlist_t	*ptr;
 
-		if (!strcasecmp(temp->name, name)) {
-			return temp->desc;
+	if (!table->size) {
+		return NULL;
+	}
+
+	for (ptr = table->buckets[desc_hash(name) & (table->size - 1)]; ptr; ptr = ptr->next) {
+		if (!strcasecmp(ptr->name, name)) {
+			return ptr;
 		}
 	}
 
 	return NULL;
 }
 
-static void desc_add(dlist_t **list, const char *name, const char *desc)
+/* twice as many buckets, to keep the chains short */
+static void table_grow(dtable_t *table)
 {
-	dlist_t	*temp;
-
-	for (temp = *list; temp != NULL; temp = temp->next) {
-		if (!strcasecmp(temp->name, name)) {
-			break;
+	dlist_t	**old = table->buckets, *ptr, *next;
+	size_t	oldsize = table->size, i, j;
+
+	table->size = (oldsize ? oldsize * 2 : 64);
+	table->buckets = xcalloc(table->size, sizeof(*table->buckets));
+
+	for (i = 0; i < oldsize; i++) {
+		for (ptr = old[i]; ptr; ptr = next) {
+			next = ptr->next;
+			j = desc_hash(ptr->name) & (table->size - 1);
+			ptr->next = table->buckets[j];
+			table->buckets[j] = ptr;
 		}
 	}
 
+	free(old);
+}
+
+static void desc_add(dtable_t *table, const char *name, const char *desc)
+{
+	dlist_t	*temp = table_find(table, name);
+	size_t	len = strlen(desc), i;
+
 	if (temp == NULL) {
+		if (table->count >= table->size) {
+			table_grow(table);
+		}
+
+		i = desc_hash(name) & (table->size - 1);
+
 		temp = xcalloc(1, sizeof(*temp));
 		temp->name = xstrdup(name);
-		temp->next = *list;
-		*list = temp;
+		temp->next = table->buckets[i];
+		table->buckets[i] = temp;
+		table->count++;
 	}
 
+	/* escaped once here rather than for each GET DESC, so that quotes
+	 * or backslashes in cmdvartab do not break the reply */
+	len += pconf_encode_count(desc, len) + 1;
+
 	free(temp->desc);
-	temp->desc = xstrdup(desc);
+	temp->desc = xmalloc(len);
+	pconf_encode(desc, temp->desc, len);
 }
 
 static void desc_file_err(const char *errmsg)
@@ -98,6 +174,8 @@ void desc_load(void)
 	char	fn[SMALLBUF];
 	PCONF_CTX_t	ctx;
 
+	desc_pending = 0;
+
 	snprintf(fn, sizeof(fn), "%s/cmdvartab", datapath);
 
 	pconf_init(&ctx, desc_file_err);
@@ -120,12 +198,12 @@ void desc_load(void)
 		}
 
 		if (!strcmp(ctx.arglist[0], "CMDDESC")) {
-			desc_add(&cmd_list, ctx.arglist[1], ctx.arglist[2]);
+			desc_add(&cmd_table, ctx.arglist[1], ctx.arglist[2]);
 			continue;
 		}
 
 		if (!strcmp(ctx.arglist[0], "VARDESC")) {
-			desc_add(&var_list, ctx.arglist[1], ctx.arglist[2]);
+			desc_add(&var_table, ctx.arglist[1], ctx.arglist[2]);
 			continue;
 		}
 
@@ -135,20 +213,45 @@ void desc_load(void)
 	pconf_finish(&ctx);
 }
 
+void desc_load_lazy(void)
+{
+	desc_pending = 1;
+}
+
 void desc_free(void)
 {
-	list_free(cmd_list);
-	list_free(var_list);
+	table_free(&cmd_table);
+	table_free(&var_table);
+	desc_pending = 0;
+}
 
-	cmd_list = var_list = NULL;
+size_t desc_bytes(void)
+{
+	return table_bytes(&cmd_table) + table_bytes(&var_table);
 }
 
 const char *desc_get_cmd(const char *name)
 {
-	return list_get(cmd_list, name);
+	const dlist_t	*temp;
+
+	if (desc_pending) {
+		desc_load();
+	}
+
+	temp = table_find(&cmd_table, name);
+
+	return (temp ? temp->desc : NULL);
 }
 
 const char *desc_get_var(const char *name)
 {
-	return list_get(var_list, name);
+	const dlist_t	*temp;
+
+	if (desc_pending) {
+		desc_load();
+	}
+
+	temp = table_find(&var_table, name);
+
+	return (temp ? temp->desc : NULL);
 }
@@ -32,6 +32,13 @@ extern "C" {
 
 void desc_load(void);
 void desc_free(void);
+
+/* like desc_load(), but only once a description is asked for (LOWMEM) */
+void desc_load_lazy(void);
+
+/* the memory the descriptions take, as allocated; 0 until loaded */
+size_t desc_bytes(void);
+
 const char *desc_get_cmd(const char *name);
 const char *desc_get_var(const char *name);
 
@@ -0,0 +1,392 @@
+/* history.c - recent values of chosen variables, for LIST HIST
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* What a device went through before an incident could only be known by
+ * a client polling upsd all the time.  Every change of the variables
+ * already goes through sstate.c: for those named by HISTORY in upsd.conf
+ * it is also kept here, in a ring of HISTORYSIZE bytes per variable of
+ * each device, dropping the oldest ones as it fills, so LIST HIST can
+ * tell what they were (e.g. the last hour of ups.status) at no more cost
+ * than the updates themselves.
+ *
+ * A change takes a few bytes: the milliseconds since the previous one
+ * as a varint (7 bits a byte), then a kind byte, then for a number (up
+ * to 6 decimals, written back the same) the difference with the previous
+ * one as a zigzag varint, or else the text with its length.  As each one
+ * depends on the previous, the ring also keeps what the oldest one is
+ * relative to. */
+
+#include "common.h"
+
+#include "extstate.h"
+#include "history.h"
+
+size_t	history_size = HISTORY_SIZE_DEFAULT;
+
+/* the variables named by HISTORY */
+static char	**history_vars = NULL;
+static size_t	history_nvars = 0;
+
+/* the kind byte of a change */
+#define HIST_TEXT	0x00	/* then the length and the text */
+#define HIST_NUM	0x10	/* | decimals, then the number */
+#define HIST_DELTA	0x20	/* | decimals, then the difference */
+#define HIST_DEC_MAX	6
+
+/* what a change is relative to */
+typedef struct {
+	int64_t	msec;
+	int64_t	num;
+	int	dec;		/* of num; -1 if not a number */
+} hist_pos_t;
+
+struct history_s {
+	char	*var;
+	unsigned char	*buf;	/* the ring */
+	size_t	size, head, len;	/* the changes are at head, for len bytes */
+	hist_pos_t	base;	/* what the one at head is relative to */
+	hist_pos_t	last;	/* what the next one will be */
+	struct history_s	*next;
+};
+
+void history_add_var(const char *var)
+{
+	/* a reload names them again */
+	if (history_wanted(var)) {
+		return;
+	}
+
+	history_vars = xrealloc(history_vars, (history_nvars + 1) * sizeof(*history_vars));
+	history_vars[history_nvars++] = xstrdup(var);
+}
+
+void history_vars_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < history_nvars; i++) {
+		free(history_vars[i]);
+	}
+
+	free(history_vars);
+	history_vars = NULL;
+	history_nvars = 0;
+}
+
+int history_wanted(const char *var)
+{
+	size_t	i;
+
+	for (i = 0; i < history_nvars; i++) {
+		if (!strcmp(history_vars[i], var)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+	size_t	n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char)v;
+
+	return n;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v < 0 ? -1 : 0);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static const int64_t	hist_pow10[HIST_DEC_MAX + 1] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+/* val as an integer and its decimals, if it is written back the same */
+static int hist_number(const char *val, int64_t *num, int *dec)
+{
+	const char	*p = val;
+	int	neg = 0, digits = 0;
+	int64_t	n = 0;
+
+	if (*p == '-') {
+		neg = 1;
+		p++;
+	}
+
+	/* no leading zeros, nor ".5": they would not be written back */
+	if (*p < '0' || *p > '9' || (p[0] == '0' && p[1] >= '0' && p[1] <= '9')) {
+		return 0;
+	}
+
+	*dec = -1;
+	for (; *p; p++) {
+		if (*p == '.' && *dec < 0) {
+			*dec = 0;
+			continue;
+		}
+
+		if (*p < '0' || *p > '9' || ++digits > 17) {
+			return 0;
+		}
+
+		n = n * 10 + (*p - '0');
+		if (*dec >= 0 && ++*dec > HIST_DEC_MAX) {
+			return 0;
+		}
+	}
+
+	/* "", "-", "1." and "-0" are text */
+	if (!digits || *dec == 0 || (neg && n == 0)) {
+		return 0;
+	}
+
+	if (*dec < 0) {
+		*dec = 0;
+	}
+
+	*num = neg ? -n : n;
+
+	return 1;
+}
+
+static void hist_format(char *buf, size_t bufsize, int64_t num, int dec)
+{
+	uint64_t	a = (num < 0) ? (uint64_t)0 - (uint64_t)num : (uint64_t)num;
+
+	if (dec == 0) {
+		snprintf(buf, bufsize, "%s%" PRIu64, (num < 0) ? "-" : "", a);
+		return;
+	}
+
+	snprintf(buf, bufsize, "%s%" PRIu64 ".%0*" PRIu64, (num < 0) ? "-" : "",
+		a / (uint64_t)hist_pow10[dec], dec, a % (uint64_t)hist_pow10[dec]);
+}
+
+static unsigned char hist_byte(const history_t *h, size_t off)
+{
+	return h->buf[(h->head + off) % h->size];
+}
+
+static uint64_t hist_varint(const history_t *h, size_t *off)
+{
+	uint64_t	v = 0;
+	unsigned	shift = 0;
+	unsigned char	c;
+
+	do {
+		c = hist_byte(h, (*off)++);
+		if (shift < 64) {
+			v |= (uint64_t)(c & 0x7f) << shift;
+		}
+		shift += 7;
+	} while (c & 0x80);
+
+	return v;
+}
+
+/* The change at off, relative to pos: pos becomes it, and its value goes
+ * to val (unless NULL); returns its length */
+static size_t hist_decode(const history_t *h, size_t off, hist_pos_t *pos, char *val, size_t valsize)
+{
+	size_t	start = off, len, i;
+	unsigned char	kind;
+
+	pos->msec += (int64_t)hist_varint(h, &off);
+	kind = hist_byte(h, off++);
+
+	if (kind == HIST_TEXT) {
+		len = (size_t)hist_varint(h, &off);
+		if (val) {
+			for (i = 0; i < len && i + 1 < valsize; i++) {
+				val[i] = (char)hist_byte(h, off + i);
+			}
+			val[i] = '\0';
+		}
+		pos->dec = -1;
+		return off + len - start;
+	}
+
+	if ((kind & 0xf0) == HIST_DELTA) {
+		pos->num += unzigzag(hist_varint(h, &off));
+	} else {
+		pos->num = unzigzag(hist_varint(h, &off));
+	}
+	pos->dec = kind & 0x0f;
+
+	if (val) {
+		hist_format(val, valsize, pos->num, pos->dec);
+	}
+
+	return off - start;
+}
+
+static history_t *history_new(const char *var)
+{
+	history_t	*h = xcalloc(1, sizeof(*h));
+
+	h->var = xstrdup(var);
+	h->size = history_size;
+	h->buf = xmalloc(h->size);
+	h->base.dec = h->last.dec = -1;
+
+	return h;
+}
+
+void history_record(history_t **list, const char *var, const char *val,
+	const struct timeval *when)
+{
+	unsigned char	rec[ST_MAX_VALUE_LEN + 32];
+	struct timeval	now;
+	history_t	*h;
+	int64_t	msec, num;
+	int	dec;
+	size_t	n = 0, len, i;
+
+	if (!history_nvars || !history_wanted(var)) {
+		return;
+	}
+
+	for (h = *list; h && strcmp(h->var, var); h = h->next);
+
+	if (!h) {
+		h = history_new(var);
+		h->next = *list;
+		*list = h;
+	}
+
+	if (!when) {
+		gettimeofday(&now, NULL);
+		when = &now;
+	}
+
+	/* the clock going back does not make older ones newer */
+	msec = (int64_t)when->tv_sec * 1000 + when->tv_usec / 1000;
+	if (msec < h->last.msec) {
+		msec = h->last.msec;
+	}
+
+	n += put_varint(rec + n, (uint64_t)(msec - h->last.msec));
+
+	if (hist_number(val, &num, &dec)) {
+		if (h->last.dec == dec) {
+			rec[n++] = (unsigned char)(HIST_DELTA | dec);
+			n += put_varint(rec + n, zigzag(num - h->last.num));
+		} else {
+			rec[n++] = (unsigned char)(HIST_NUM | dec);
+			n += put_varint(rec + n, zigzag(num));
+		}
+		h->last.num = num;
+		h->last.dec = dec;
+	} else {
+		len = strlen(val);
+		if (len > ST_MAX_VALUE_LEN) {
+			len = ST_MAX_VALUE_LEN;
+		}
+		rec[n++] = HIST_TEXT;
+		n += put_varint(rec + n, (uint64_t)len);
+		memcpy(rec + n, val, len);
+		n += len;
+		h->last.dec = -1;
+	}
+	h->last.msec = msec;
+
+	/* make room: the oldest go, and what they were is the new base */
+	while (h->len + n > h->size) {
+		len = hist_decode(h, 0, &h->base, NULL, 0);
+		h->head = (h->head + len) % h->size;
+		h->len -= len;
+	}
+
+	for (i = 0; i < n; i++) {
+		h->buf[(h->head + h->len + i) % h->size] = rec[i];
+	}
+	h->len += n;
+}
+
+const history_t *history_find(const history_t *list, const char *var)
+{
+	for (; list; list = list->next) {
+		if (!strcmp(list->var, var)) {
+			return list;
+		}
+	}
+
+	return NULL;
+}
+
+size_t history_walk(const history_t *h, int64_t since_msec,
+	int (*fn)(void *arg, int64_t msec, const char *val), void *arg)
+{
+	hist_pos_t	pos;
+	char	val[ST_MAX_VALUE_LEN + 1];
+	size_t	off = 0, count = 0;
+
+	if (!h) {
+		return 0;
+	}
+
+	pos = h->base;
+	while (off < h->len) {
+		off += hist_decode(h, off, &pos, val, sizeof(val));
+
+		if (pos.msec <= since_msec) {
+			continue;
+		}
+
+		count++;
+		if (!fn(arg, pos.msec, val)) {
+			break;
+		}
+	}
+
+	return count;
+}
+
+size_t history_bytes(const history_t *list)
+{
+	size_t	bytes = 0;
+
+	for (; list; list = list->next) {
+		bytes += sizeof(*list) + strlen(list->var) + 1 + list->size;
+	}
+
+	return bytes;
+}
+
+void history_free(history_t *list)
+{
+	history_t	*next;
+
+	for (; list; list = next) {
+		next = list->next;
+		free(list->var);
+		free(list->buf);
+		free(list);
+	}
+}
@@ -0,0 +1,70 @@
+/* history.h - recent values of chosen variables, for LIST HIST
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_HISTORY_H_SEEN
+#define NUT_HISTORY_H_SEEN 1
+
+#include "timehead.h"
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* bytes kept per variable of each device (HISTORYSIZE in upsd.conf) */
+#define HISTORY_SIZE_DEFAULT	16384
+#define HISTORY_SIZE_MIN	1024
+
+extern size_t	history_size;
+
+typedef struct history_s history_t;
+
+/* HISTORY <var>: keep the changes of var, for each device */
+void history_add_var(const char *var);
+void history_vars_free(void);
+
+/* var of a device (list) changed to val at when (NULL: now): keep it,
+ * if var is one of those named by HISTORY */
+void history_record(history_t **list, const char *var, const char *val,
+	const struct timeval *when);
+
+/* the history of var in list; NULL if it was never recorded */
+const history_t *history_find(const history_t *list, const char *var);
+
+/* 1 if var is one of those named by HISTORY */
+int history_wanted(const char *var);
+
+/* Call fn for each value kept in h, oldest first, from those which came
+ * after since_msec (milliseconds since the epoch) on, until it returns
+ * 0; returns how many it was called for */
+size_t history_walk(const history_t *h, int64_t since_msec,
+	int (*fn)(void *arg, int64_t msec, const char *val), void *arg);
+
+/* the memory the histories of a device take, as allocated */
+size_t history_bytes(const history_t *list);
+
+void history_free(history_t *list);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_HISTORY_H_SEEN */
@@ -0,0 +1,294 @@
+/* netagg.c - aggregates of numeric variables for upsd (GET AGG)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include <ctype.h>
+
+#include "upsd.h"
+#include "state.h"
+#include "neterr.h"
+#include "netagg.h"
+
+/* What the variables of one device matching a pattern add up to: all
+ * the functions are made from these, so one walk serves any of them.
+ * It is kept until the generation of the device changes (see sstate.c),
+ * so a dashboard asking for the same sums every few seconds only costs
+ * the devices whose driver reported something meanwhile. */
+typedef struct agg_part_s {
+	char		*pattern;
+	uint64_t	generation;
+	time_t		used;		/* last asked for */
+	size_t		count;		/* of numeric values */
+	double		sum, min, max;
+	struct agg_part_s	*next;
+} agg_part_t;
+
+/* '*' matches any run of characters (dots included), '?' any one;
+ * case insensitive, as names are compared */
+static int agg_match(const char *pattern, const char *name)
+{
+	for (; *pattern; pattern++, name++) {
+		if (*pattern == '*') {
+			while (*pattern == '*') {
+				pattern++;
+			}
+
+			if (!*pattern) {
+				return 1;
+			}
+
+			for (; *name; name++) {
+				if (agg_match(pattern, name)) {
+					return 1;
+				}
+			}
+
+			return 0;
+		}
+
+		if (!*name) {
+			return 0;
+		}
+
+		if (*pattern != '?'
+		 && tolower((unsigned char)*pattern) != tolower((unsigned char)*name)
+		) {
+			return 0;
+		}
+	}
+
+	return !*name;
+}
+
+/* the value as a number, if it is one */
+static int agg_value(const st_tree_t *node, double *val)
+{
+	char	*end = NULL;
+
+	switch (node->numtype) {
+	case ST_NUM_DOUBLE:
+		*val = node->numdouble;
+		return 1;
+
+	case ST_NUM_LONG:
+		*val = (double)node->numlong;
+		return 1;
+
+	default:
+		break;
+	}
+
+	/* plain decimal numbers only: no "nan", "inf" or hexadecimal */
+	if (!*node->raw || node->raw[strspn(node->raw, "+-.0123456789eE")]) {
+		return 0;
+	}
+
+	*val = strtod(node->raw, &end);
+
+	return (end != node->raw && end && *end == '\0');
+}
+
+static void agg_add(agg_part_t *part, size_t count, double sum,
+	double min, double max)
+{
+	if (!count) {
+		return;
+	}
+
+	if (!part->count || min < part->min) {
+		part->min = min;
+	}
+	if (!part->count || max > part->max) {
+		part->max = max;
+	}
+	part->sum += sum;
+	part->count += count;
+}
+
+/* plen: the letters before the first wildcard, which all matching names
+ * start with; as the tree is sorted by name, only the subtrees which may
+ * hold such names are visited */
+static void agg_walk(const st_tree_t *node, const char *pattern, size_t plen,
+	agg_part_t *part)
+{
+	int	cmp;
+	double	val;
+
+	while (node) {
+		cmp = (plen ? strncasecmp(node->var, pattern, plen) : 0);
+
+		if (cmp >= 0) {
+			agg_walk(node->left, pattern, plen, part);
+		}
+
+		if (cmp > 0) {
+			return;
+		}
+
+		if (cmp == 0 && agg_match(pattern, node->var)
+		 && agg_value(node, &val)
+		) {
+			agg_add(part, 1, val, val, val);
+		}
+
+		node = node->right;
+	}
+}
+
+/* the part of ups for pattern, walked again if the device changed */
+static const agg_part_t *agg_part(upstype_t *ups, const char *pattern, time_t now)
+{
+	agg_part_t	*part, *oldest = NULL, **pp;
+	size_t	kept = 0;
+
+	for (part = ups->aggparts; part; part = part->next) {
+		if (!strcasecmp(part->pattern, pattern)) {
+			break;
+		}
+
+		if (!oldest || part->used < oldest->used) {
+			oldest = part;
+		}
+		kept++;
+	}
+
+	if (!part) {
+		if (kept >= AGG_MAX_KEPT) {
+			/* reuse the one nobody asked for the longest */
+			for (pp = &ups->aggparts; *pp != oldest; pp = &(*pp)->next)
+				;
+			*pp = oldest->next;
+			free(oldest->pattern);
+			free(oldest);
+		}
+
+		part = xcalloc(1, sizeof(*part));
+		part->pattern = xstrdup(pattern);
+		part->generation = ups->generation - 1;	/* not walked yet */
+		part->next = ups->aggparts;
+		ups->aggparts = part;
+	}
+
+	part->used = now;
+
+	if (part->generation != ups->generation) {
+		size_t	plen = strcspn(pattern, "*?");
+
+		part->count = 0;
+		part->sum = part->min = part->max = 0;
+		agg_walk(ups->inforoot, pattern, plen, part);
+		part->generation = ups->generation;
+	}
+
+	return part;
+}
+
+void get_agg(nut_ctype_t *client, const char *func, const char *upsname,
+	const char *pattern)
+{
+	upstype_t	*ups;
+	const	agg_part_t	*part;
+	agg_part_t	total;
+	const	char	*p;
+	double	val;
+	time_t	now;
+
+	/* it is echoed in the answer unquoted, as names are */
+	for (p = pattern; *p; p++) {
+		if (!isalnum((unsigned char)*p) && !strchr("._-*?", *p)) {
+			break;
+		}
+	}
+
+	if (!*pattern || *p) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (strcasecmp(func, "SUM") && strcasecmp(func, "MIN")
+	 && strcasecmp(func, "MAX") && strcasecmp(func, "AVG")
+	 && strcasecmp(func, "COUNT")
+	) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	memset(&total, 0, sizeof(total));
+	time(&now);
+
+	if (!strcmp(upsname, "*")) {
+		/* like LIST VAR *, devices without fresh data are left out */
+		for (ups = firstups; ups; ups = ups->next) {
+			if (INVALID_FD(ups->sock_fd) || ups->stale) {
+				continue;
+			}
+
+			part = agg_part(ups, pattern, now);
+			agg_add(&total, part->count, part->sum, part->min, part->max);
+		}
+	} else {
+		ups = get_ups_ptr(upsname);
+
+		if (!ups) {
+			send_err(client, NUT_ERR_UNKNOWN_UPS);
+			return;
+		}
+
+		if (!ups_available(ups, client)) {
+			return;
+		}
+
+		part = agg_part(ups, pattern, now);
+		agg_add(&total, part->count, part->sum, part->min, part->max);
+	}
+
+	if (!strcasecmp(func, "COUNT")) {
+		sendback(client, "AGG %s %s %s \"%" PRIuSIZE "\"\n",
+			func, upsname, pattern, total.count);
+		return;
+	}
+
+	if (!strcasecmp(func, "SUM")) {
+		val = total.sum;
+	} else if (!total.count) {
+		/* no minimum, maximum nor average of nothing */
+		send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+		return;
+	} else if (!strcasecmp(func, "MIN")) {
+		val = total.min;
+	} else if (!strcasecmp(func, "MAX")) {
+		val = total.max;
+	} else {
+		val = total.sum / (double)total.count;
+	}
+
+	sendback(client, "AGG %s %s %s \"%.15g\"\n", func, upsname, pattern, val);
+}
+
+void agg_free(upstype_t *ups)
+{
+	agg_part_t	*part, *next;
+
+	for (part = ups->aggparts; part; part = next) {
+		next = part->next;
+		free(part->pattern);
+		free(part);
+	}
+
+	ups->aggparts = NULL;
+}
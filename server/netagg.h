@@ -0,0 +1,47 @@
+/* netagg.h - aggregates of numeric variables for upsd (GET AGG)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETAGG_H_SEEN
+#define NUT_NETAGG_H_SEEN 1
+
+#include "nut_ctype.h"
+#include "upstype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* patterns whose results are kept per device (the least recently asked
+ * for is forgotten first) */
+#define AGG_MAX_KEPT	32
+
+/* GET AGG <function> <ups|*> <pattern> */
+void get_agg(nut_ctype_t *client, const char *func, const char *upsname,
+	const char *pattern);
+
+/* forget what was kept for ups */
+void agg_free(upstype_t *ups);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETAGG_H_SEEN */
@@ -0,0 +1,220 @@
+/* netbinary.c - binary framing of GET VAR and LIST VAR replies for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "upsd.h"
+#include "neterr.h"
+#include "binframe.h"
+
+#include "netbinary.h"
+
+/* ids handed out to one client before it is told to forget them all */
+#define BINARY_MAX_NAMES	65536
+
+/* a "<ups> <var>" which the client knows by its id */
+struct binary_name_s {
+	char	*name;
+	uint32_t	id;
+	struct binary_name_s	*next;
+};
+
+struct binary_s {
+	struct binary_name_s	**index;
+	size_t	size;		/* buckets, a power of two */
+	uint32_t	count;	/* ids 1..count are taken */
+};
+
+/* FNV-1a */
+static size_t binary_hash(const char *name)
+{
+	const unsigned char	*p;
+	uint32_t	h = 2166136261U;
+
+	for (p = (const unsigned char *)name; *p; p++) {
+		h ^= (uint32_t)*p;
+		h *= 16777619U;
+	}
+
+	return (size_t)h;
+}
+
+static void binary_clear(struct binary_s *bin)
+{
+	struct binary_name_s	*n, *nnext;
+	size_t	i;
+
+	for (i = 0; i < bin->size; i++) {
+		for (n = bin->index[i]; n; n = nnext) {
+			nnext = n->next;
+			free(n->name);
+			free(n);
+		}
+		bin->index[i] = NULL;
+	}
+
+	bin->count = 0;
+}
+
+static void binary_grow(struct binary_s *bin)
+{
+	struct binary_name_s	**index, *n, *nnext;
+	size_t	i, size = bin->size * 2, slot;
+
+	index = xcalloc(size, sizeof(*index));
+
+	for (i = 0; i < bin->size; i++) {
+		for (n = bin->index[i]; n; n = nnext) {
+			nnext = n->next;
+			slot = binary_hash(n->name) & (size - 1);
+			n->next = index[slot];
+			index[slot] = n;
+		}
+	}
+
+	free(bin->index);
+	bin->index = index;
+	bin->size = size;
+}
+
+/* FRAMING BINARY|TEXT */
+void net_framing(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	if (numarg != 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!strcasecmp(arg[0], "BINARY")) {
+		if (!client->binary) {
+			client->binary = xcalloc(1, sizeof(*client->binary));
+			client->binary->size = 64;
+			client->binary->index = xcalloc(client->binary->size,
+				sizeof(*client->binary->index));
+		}
+	} else if (!strcasecmp(arg[0], "TEXT")) {
+		binary_free(client);
+	} else {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	upsdebugx(1, "%s: %s framing for client %s", __func__,
+		(client->binary ? "binary" : "text"), client->addr);
+
+	sendback(client, "OK\n");
+}
+
+void binary_free(nut_ctype_t *client)
+{
+	if (!client->binary) {
+		return;
+	}
+
+	binary_clear(client->binary);
+	free(client->binary->index);
+	free(client->binary);
+	client->binary = NULL;
+}
+
+int binary_send_text(nut_ctype_t *client, unsigned int type, const char *text)
+{
+	unsigned char	rec[BINFRAME_HEADER_LEN + NUT_NET_ANSWER_MAX];
+	size_t	len = strlen(text);
+
+	if (len > NUT_NET_ANSWER_MAX) {
+		len = NUT_NET_ANSWER_MAX;
+	}
+
+	binframe_header(rec, type, len);
+	memcpy(rec + BINFRAME_HEADER_LEN, text, len);
+
+	upsdebugx(3, "write: [destfd=%d] [record %u] [%s]",
+		client->sock_fd, type, text);
+
+	return sendback_raw(client, rec, BINFRAME_HEADER_LEN + len);
+}
+
+/* the value record for a variable, behind a NAME record if the client
+ * did not see that variable yet; val is the raw (not escaped) value */
+int binary_send_var(nut_ctype_t *client, const char *ups, const char *var,
+	const char *val)
+{
+	struct binary_s	*bin = client->binary;
+	struct binary_name_s	*n;
+	unsigned char	rec[3 * BINFRAME_HEADER_LEN + 2 * (BINFRAME_ID_LEN + LARGEBUF)];
+	char	name[LARGEBUF];
+	size_t	len = 0, vlen, slot;
+	int64_t	mantissa;
+	unsigned int	decimals;
+
+	snprintf(name, sizeof(name), "%s %s", ups, var);
+	slot = binary_hash(name) & (bin->size - 1);
+
+	for (n = bin->index[slot]; n; n = n->next) {
+		if (!strcmp(n->name, name)) {
+			break;
+		}
+	}
+
+	if (!n) {
+		if (bin->count >= BINARY_MAX_NAMES) {
+			/* start over, rather than keep growing */
+			len += binframe_header(rec + len, BINFRAME_RESET, 0);
+			binary_clear(bin);
+			slot = binary_hash(name) & (bin->size - 1);
+		} else if (bin->count >= bin->size) {
+			binary_grow(bin);
+			slot = binary_hash(name) & (bin->size - 1);
+		}
+
+		n = xcalloc(1, sizeof(*n));
+		n->name = xstrdup(name);
+		n->id = ++bin->count;
+		n->next = bin->index[slot];
+		bin->index[slot] = n;
+
+		vlen = strlen(name);
+		len += binframe_header(rec + len, BINFRAME_NAME, BINFRAME_ID_LEN + vlen);
+		binframe_put_u32(rec + len, n->id);
+		memcpy(rec + len + BINFRAME_ID_LEN, name, vlen);
+		len += BINFRAME_ID_LEN + vlen;
+	}
+
+	if (binframe_num_parse(val, &mantissa, &decimals)) {
+		len += binframe_header(rec + len, BINFRAME_NUM, BINFRAME_NUM_LEN);
+		binframe_put_u32(rec + len, n->id);
+		rec[len + BINFRAME_ID_LEN] = (unsigned char)decimals;
+		binframe_put_i64(rec + len + BINFRAME_ID_LEN + 1, mantissa);
+		len += BINFRAME_NUM_LEN;
+	} else {
+		vlen = strlen(val);
+		if (vlen > LARGEBUF) {
+			vlen = LARGEBUF;
+		}
+
+		len += binframe_header(rec + len, BINFRAME_STR, BINFRAME_ID_LEN + vlen);
+		binframe_put_u32(rec + len, n->id);
+		memcpy(rec + len + BINFRAME_ID_LEN, val, vlen);
+		len += BINFRAME_ID_LEN + vlen;
+	}
+
+	upsdebugx(3, "write: [destfd=%d] [record %lu] [%s] [%s]",
+		client->sock_fd, (unsigned long)n->id, name, val);
+
+	return sendback_raw(client, rec, len);
+}
@@ -0,0 +1,44 @@
+/* netbinary.h - binary framing of GET VAR and LIST VAR replies for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETBINARY_H_SEEN
+#define NUT_NETBINARY_H_SEEN 1
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* FRAMING BINARY|TEXT; client->binary is non-NULL while it is on */
+void net_framing(nut_ctype_t *client, size_t numarg, const char **arg);
+
+/* forget the ids given to a client (upon disconnect) */
+void binary_free(nut_ctype_t *client);
+
+/* records of the reply, see binframe.h */
+int binary_send_text(nut_ctype_t *client, unsigned int type, const char *text);
+int binary_send_var(nut_ctype_t *client, const char *ups, const char *var,
+	const char *val);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETBINARY_H_SEEN */
@@ -34,8 +34,13 @@
 #include "netmisc.h"
 #include "netuser.h"
 #include "netinstcmd.h"
+#include "netwatch.h"
+#include "netbinary.h"
+#include "netzip.h"
+#include "netrelay.h"
 
 #define FLAG_USER	0x0001		/* username and password must be set */
+#define FLAG_OWNER	0x0002		/* not served by WORKERS, see worker_serves() */
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -52,26 +57,31 @@ static struct {
 	{ "NETVER",	net_netver,	0		},
 	{ "PROTVER",	net_netver,	0		},	/* aliased since NUT 2.8.0 */
 	{ "HELP",	net_help,	0		},
-	{ "STARTTLS",	net_starttls,	0		},
+	{ "STARTTLS",	net_starttls,	FLAG_OWNER	},
+	{ "COMPRESS",	net_compress,	FLAG_OWNER	},
 
 	{ "GET",	net_get,	0		},
 	{ "LIST",	net_list,	0		},
+	{ "WATCH",	net_watch,	0		},
+	{ "UNWATCH",	net_unwatch,	0		},
+	{ "FRAMING",	net_framing,	0		},
+	{ "RELAY",	net_relay,	FLAG_OWNER	},
 
 	{ "USERNAME",	net_username,	0		},
 	{ "PASSWORD",	net_password,	0		},
 
-	{ "LOGIN",	net_login,	FLAG_USER	},
+	{ "LOGIN",	net_login,	FLAG_USER | FLAG_OWNER	},
 	{ "LOGOUT", 	net_logout,	0		},
 	/* NOTE: Protocol in NUT 2.8.0 allows to handle
 	 * master/primary to rename/alias the routine.
 	 */
-	{ "PRIMARY",	net_primary,	FLAG_USER	},
-	{ "MASTER",	net_master,	FLAG_USER	},
+	{ "PRIMARY",	net_primary,	FLAG_USER | FLAG_OWNER	},
+	{ "MASTER",	net_master,	FLAG_USER | FLAG_OWNER	},
 
-	{ "FSD",	net_fsd,	FLAG_USER	},
+	{ "FSD",	net_fsd,	FLAG_USER | FLAG_OWNER	},
 
-	{ "SET",	net_set,	FLAG_USER	},
-	{ "INSTCMD",	net_instcmd,	FLAG_USER	},
+	{ "SET",	net_set,	FLAG_USER | FLAG_OWNER	},
+	{ "INSTCMD",	net_instcmd,	FLAG_USER | FLAG_OWNER	},
 
 	{ NULL,		(void(*)(struct nut_ctype_s *, size_t,  const char **))(NULL), 0		}
 };
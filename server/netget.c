@@ -25,7 +25,31 @@
 #include "desc.h"
 #include "neterr.h"
 
+#include "netbinary.h"
 #include "netget.h"
+#include "netagg.h"
+
+/* GET TRACKING <id> <id>...: TRACKING <status> <status>... in one line,
+ * each status as for one id but without "ERR " (e.g. INVALID-ARGUMENT) */
+static void get_trackings(nut_ctype_t *client, size_t numid, const char **id)
+{
+	size_t	i;
+	const char	*status;
+
+	sendback_cork(client);
+	sendback(client, "TRACKING");
+
+	for (i = 0; i < numid; i++) {
+		status = tracking_get(id[i]);
+		if (!strncmp(status, "ERR ", 4)) {
+			status += 4;
+		}
+		sendback(client, " %s", status);
+	}
+
+	sendback(client, "\n");
+	sendback_uncork(client);
+}
 
 static void get_numlogins(nut_ctype_t *client, const char *upsname)
 {
@@ -178,42 +202,52 @@ static void get_var_server(nut_ctype_t *client, const char *upsname, const char
 #pragma clang diagnostic ignored "-Wunreachable-code"
 #endif
 	int	pkgurlHasNutOrg = PACKAGE_URL ? (strstr(PACKAGE_URL, "networkupstools.org") != NULL) : 0;
+	const	char	*name;
+	char	val[SMALLBUF];
 
 	if (!strcasecmp(var, "server.info")) {
+		name = "server.info";
 		/* NOTE: Some compilers deduce that macro-based decisions about
 		 * NUT_VERSION_IS_RELEASE make one of codepaths unreachable in
 		 * a particular build. So we pragmatically handwave this away.
 		 */
-		sendback(client, "VAR %s server.info "
-			"\"Network UPS Tools upsd %s - "
-			"%s%s%s\"\n",
-			upsname, UPS_VERSION,
+		snprintf(val, sizeof(val), "Network UPS Tools upsd %s - "
+			"%s%s%s",
+			UPS_VERSION,
 			PACKAGE_URL ? PACKAGE_URL : "",
 			(PACKAGE_URL && !pkgurlHasNutOrg) ? " or " : "",
 			pkgurlHasNutOrg ? "" : "https://www.networkupstools.org/"
 			);
+	}
+	else if (!strcasecmp(var, "server.version")) {
+		name = "server.version";
+		snprintf(val, sizeof(val), "%s", UPS_VERSION);
+	}
+	else {
+		send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+		return;
+	}
+
+	if (client->binary) {
+		binary_send_var(client, upsname, name, val);
 		return;
 	}
+
+	sendback(client, "VAR %s %s \"%s\"\n", upsname, name, val);
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
 #pragma GCC diagnostic pop
 #endif
-
-	if (!strcasecmp(var, "server.version")) {
-		sendback(client, "VAR %s server.version \"%s\"\n",
-			upsname, UPS_VERSION);
-		return;
-	}
-
-	send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
 }
 
 static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
 {
 	const	upstype_t	*ups;
+	const	st_tree_t	*node;
 	const	char	*val;
+	char	buf[ST_MAX_VALUE_LEN + 4];
 
 	/* ignore upsname for server.* variables */
 	if (!strncasecmp(var, "server.", 7)) {
@@ -238,6 +272,20 @@ static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
 		return;
 	}
 
+	if (client->binary) {
+		/* the raw value, the records need no escaping */
+		node = sstate_getnode(ups, var);
+		val = node->raw;
+
+		if ((!strcasecmp(var, "ups.status")) && (ups->fsd)) {
+			snprintf(buf, sizeof(buf), "FSD %s", val);
+			val = buf;
+		}
+
+		binary_send_var(client, upsname, var, val);
+		return;
+	}
+
 	/* handle special case for status */
 	if ((!strcasecmp(var, "ups.status")) && (ups->fsd))
 		sendback(client, "VAR %s %s \"FSD %s\"\n", upsname, var, val);
@@ -252,16 +300,19 @@ void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
-	/* GET TRACKING [ID] */
+	/* GET TRACKING [ID [ID...]] */
 	if (!strcasecmp(arg[0], "TRACKING")) {
 		if (numarg < 2) {
 			sendback(client, "%s\n", (client->tracking) ? "ON" : "OFF");
 		}
+		else if (!client->tracking) {
+			send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		}
+		else if (numarg == 2) {
+			sendback(client, "%s\n", tracking_get(arg[1]));
+		}
 		else {
-			if (client->tracking)
-				sendback(client, "%s\n", tracking_get(arg[1]));
-			else
-				send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+			get_trackings(client, numarg - 1, &arg[1]);
 		}
 		return;
 	}
@@ -312,6 +363,17 @@ void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* GET AGG FUNCTION UPS|* PATTERN */
+	if (!strcasecmp(arg[0], "AGG")) {
+		if (numarg < 4) {
+			send_err(client, NUT_ERR_INVALID_ARGUMENT);
+			return;
+		}
+
+		get_agg(client, arg[1], arg[2], arg[3]);
+		return;
+	}
+
 	send_err(client, NUT_ERR_INVALID_ARGUMENT);
 	return;
 }
@@ -65,7 +65,8 @@ static void send_instcmd(nut_ctype_t *client, const char *upsname,
 	}
 
 	/* see if this user is allowed to do this command */
-	if (!user_checkinstcmd(client->username, client->password, cmdname)) {
+	if (!user_checkinstcmd(client->username, client->password, cmdname,
+		&client->auth)) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
@@ -21,69 +21,342 @@
 
 #include "common.h"
 
+#include <ctype.h>
+
 #include "upsd.h"
 #include "sstate.h"
 #include "state.h"
 #include "neterr.h"
 
+#include "netbinary.h"
 #include "netlist.h"
+#include "netstats.h"
+#include "history.h"
+#include "binframe.h"
 
 extern	upstype_t	*firstups;	/* for list_ups */
 extern	nut_ctype_t *firstclient;	/* for list_clients */
 
+/* BEGIN LIST / END LIST of VAR lists, or the records for binary framing */
+static int list_frame(nut_ctype_t *client, unsigned int type, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 3, 4)));
+
+static int list_frame(nut_ctype_t *client, unsigned int type, const char *fmt, ...)
+{
+	char	buf[NUT_NET_ANSWER_MAX];
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (client->binary)
+		return binary_send_text(client, type, buf);
+
+	return sendback(client, "%s LIST %s\n",
+		(type == BINFRAME_BEGIN ? "BEGIN" : "END"), buf);
+}
+
+/* One "<type> <ups> <var> "[FSD ]<val>"" line of a list into ans (of
+ * NUT_NET_ANSWER_MAX + 1 bytes): put together from the lengths known, as
+ * the escaped value of the node (which most of a list is) need not be
+ * formatted or measured again; returns the length */
+static size_t var_line(char *ans, const char *type, const char *ups,
+	const st_tree_t *node, int fsd)
+{
+	size_t	typelen = strlen(type), upslen = strlen(ups),
+		varlen = strlen(node->var), len = 0;
+
+	if (typelen + upslen + varlen + node->vallen + 12 > NUT_NET_ANSWER_MAX + 1) {
+		/* cut, as sendback() cuts */
+		snprintf(ans, NUT_NET_ANSWER_MAX + 1, "%s %s %s \"%s%s\"\n",
+			type, ups, node->var, (fsd ? "FSD " : ""), node->val);
+		return strlen(ans);
+	}
+
+	memcpy(ans, type, typelen);
+	len += typelen;
+	ans[len++] = ' ';
+	memcpy(ans + len, ups, upslen);
+	len += upslen;
+	ans[len++] = ' ';
+	memcpy(ans + len, node->var, varlen);
+	len += varlen;
+	ans[len++] = ' ';
+	ans[len++] = '"';
+	if (fsd) {
+		memcpy(ans + len, "FSD ", 4);
+		len += 4;
+	}
+	memcpy(ans + len, node->val, node->vallen);
+	len += node->vallen;
+	ans[len++] = '"';
+	ans[len++] = '\n';
+
+	return len;
+}
+
+static int send_var_line(nut_ctype_t *client, const char *type,
+	const char *ups, const st_tree_t *node, int fsd)
+{
+	char	ans[NUT_NET_ANSWER_MAX + 1];
+	size_t	len = var_line(ans, type, ups, node, fsd);
+
+	upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%.*s]",
+		client->sock_fd, len, (int)len - 1, ans);
+
+	return sendback_raw(client, ans, len);
+}
+
+/* since: only report nodes changed at or after this point (NULL = all)
+ * prefix: only report nodes whose names start with it (NULL = all); as
+ * the tree is sorted by name, these are together and only the subtrees
+ * which may hold some of them are visited */
 static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
-	int rw, int fsd)
+	int rw, int fsd, const st_tree_timespec_t *since, const char *prefix)
 {
-	int	ret;
+	int	ret, cmp = 0;
 
 	if (!node)
 		return 1;	/* not an error */
 
-	if (node->left) {
-		ret = tree_dump(node->left, client, ups, rw, fsd);
+	if (prefix)
+		cmp = strncasecmp(node->var, prefix, strlen(prefix));
+
+	if (node->left && cmp >= 0) {
+		ret = tree_dump(node->left, client, ups, rw, fsd, since, prefix);
 
 		if (!ret)
 			return 0;		/* write failed in child */
 	}
 
-	if (rw) {
+	if (cmp != 0) {
+
+		/* out of range */
+		ret = 1;
+
+	} else if (since && st_tree_node_compare_timestamp(node, since) < 0) {
+
+		/* not changed */
+		ret = 1;
+
+	} else if (rw) {
 
 		/* only send this back if it's been flagged RW */
 		if (node->flags & ST_FLAG_RW) {
-			ret = sendback(client, "RW %s %s \"%s\"\n",
-				ups, node->var, node->val);
+			ret = send_var_line(client, "RW", ups, node, 0);
 
 		} else {
 			ret = 1;	/* dummy */
 		}
 
+	} else if (client->binary) {
+
+		/* the raw value, the records need no escaping */
+		if ((fsd == 1) && (!strcasecmp(node->var, "ups.status"))) {
+			char	buf[ST_MAX_VALUE_LEN + 4];
+
+			snprintf(buf, sizeof(buf), "FSD %s", node->raw);
+			ret = binary_send_var(client, ups, node->var, buf);
+
+		} else {
+			ret = binary_send_var(client, ups, node->var, node->raw);
+		}
+
 	} else {
 
 		/* normal variable list only */
 
 		/* status is always a special case */
-		if ((fsd == 1) && (!strcasecmp(node->var, "ups.status"))) {
-			ret = sendback(client, "VAR %s %s \"FSD %s\"\n",
-				ups, node->var, node->val);
+		ret = send_var_line(client, "VAR", ups, node,
+			(fsd == 1) && (!strcasecmp(node->var, "ups.status")));
+	}
+
+	if (ret != 1)
+		return 0;
+
+	if (node->right && cmp <= 0)
+		return tree_dump(node->right, client, ups, rw, fsd, since, prefix);
+
+	return 1;
+}
+
+/* The text responses of LIST VAR, RW, CMD and ENUM, from BEGIN to END,
+ * kept per device until its generation (see sstate.c) or FSD changes:
+ * the clients which poll the same lists between two updates from the
+ * driver are then sent a copy of the same bytes.  Responses in binary
+ * framing, or to a device name spelled differently, are made as before */
+typedef enum {
+	LIST_CACHE_VAR = 0,
+	LIST_CACHE_RW,
+	LIST_CACHE_CMD,
+	LIST_CACHE_ENUM
+} list_cache_kind_t;
+
+typedef struct list_cache_s {
+	list_cache_kind_t	kind;
+	char		*var;		/* of LIST ENUM, NULL otherwise */
+	uint64_t	generation;
+	int		fsd;
+	char		*buf;		/* NULL until made */
+	size_t		len;
+	size_t		size;
+	struct list_cache_s	*next;
+} list_cache_t;
+
+static void list_cache_append(list_cache_t *cache, const char *line, size_t len)
+{
+	if (cache->len + len > cache->size) {
+		while (cache->len + len > cache->size) {
+			cache->size = (cache->size ? cache->size * 2 : 1024);
+		}
+		cache->buf = xrealloc(cache->buf, cache->size);
+	}
+
+	memcpy(cache->buf + cache->len, line, len);
+	cache->len += len;
+}
+
+static void list_cache_printf(list_cache_t *cache, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 2, 3)));
+
+static void list_cache_printf(list_cache_t *cache, const char *fmt, ...)
+{
+	char	ans[NUT_NET_ANSWER_MAX + 1];
+	va_list	ap;
+
+	/* cut, as sendback() cuts */
+	va_start(ap, fmt);
+	vsnprintf(ans, sizeof(ans), fmt, ap);
+	va_end(ap);
+
+	list_cache_append(cache, ans, strlen(ans));
+}
+
+/* what tree_dump() sends without "since" nor binary framing */
+static void list_cache_tree(list_cache_t *cache, const st_tree_t *node,
+	const char *ups, int rw, int fsd)
+{
+	char	ans[NUT_NET_ANSWER_MAX + 1];
+
+	for (; node; node = node->right) {
+		list_cache_tree(cache, node->left, ups, rw, fsd);
 
+		if (rw) {
+			if (node->flags & ST_FLAG_RW) {
+				list_cache_append(cache, ans,
+					var_line(ans, "RW", ups, node, 0));
+			}
 		} else {
-			ret = sendback(client, "VAR %s %s \"%s\"\n",
-				ups, node->var, node->val);
+			list_cache_append(cache, ans, var_line(ans, "VAR", ups, node,
+				(fsd == 1) && (!strcasecmp(node->var, "ups.status"))));
 		}
 	}
+}
 
-	if (ret != 1)
+static void list_cache_make(list_cache_t *cache, const upstype_t *ups)
+{
+	const	st_tree_t	*node;
+	const	cmdlist_t	*ctmp;
+	const	enum_t	*etmp;
+
+	cache->len = 0;
+
+	switch (cache->kind) {
+	case LIST_CACHE_VAR:
+	case LIST_CACHE_RW:
+		list_cache_printf(cache, "BEGIN LIST %s %s\n",
+			(cache->kind == LIST_CACHE_RW ? "RW" : "VAR"), ups->name);
+		list_cache_tree(cache, ups->inforoot, ups->name,
+			(cache->kind == LIST_CACHE_RW), ups->fsd);
+		list_cache_printf(cache, "END LIST %s %s\n",
+			(cache->kind == LIST_CACHE_RW ? "RW" : "VAR"), ups->name);
+		break;
+
+	case LIST_CACHE_CMD:
+		list_cache_printf(cache, "BEGIN LIST CMD %s\n", ups->name);
+		for (ctmp = ups->cmdlist; ctmp != NULL; ctmp = ctmp->next) {
+			list_cache_printf(cache, "CMD %s %s\n", ups->name, ctmp->name);
+		}
+		list_cache_printf(cache, "END LIST CMD %s\n", ups->name);
+		break;
+
+	case LIST_CACHE_ENUM:
+		/* the node is there, see list_enum() */
+		node = sstate_getnode(ups, cache->var);
+		list_cache_printf(cache, "BEGIN LIST ENUM %s %s\n", ups->name, cache->var);
+		for (etmp = (node ? node->enum_list : NULL); etmp != NULL; etmp = etmp->next) {
+			list_cache_printf(cache, "ENUM %s %s \"%s\"\n",
+				ups->name, cache->var, etmp->val);
+		}
+		list_cache_printf(cache, "END LIST ENUM %s %s\n", ups->name, cache->var);
+		break;
+
+	default:
+		break;
+	}
+
+	cache->generation = ups->generation;
+	cache->fsd = ups->fsd;
+}
+
+/* send the kept response, made again first if the device changed since;
+ * returns 0 if the caller has to make it the usual way */
+static int list_cache_send(nut_ctype_t *client, upstype_t *ups,
+	const char *upsname, list_cache_kind_t kind, const char *var)
+{
+	list_cache_t	*cache;
+
+	if (client->binary || strcmp(upsname, ups->name)) {
 		return 0;
+	}
+
+	for (cache = ups->listcache; cache; cache = cache->next) {
+		if (cache->kind == kind
+		 && (!var || !strcmp(cache->var, var))
+		) {
+			break;
+		}
+	}
+
+	if (!cache) {
+		cache = xcalloc(1, sizeof(*cache));
+		cache->kind = kind;
+		cache->var = (var ? xstrdup(var) : NULL);
+		cache->next = ups->listcache;
+		ups->listcache = cache;
+	}
+
+	if (!cache->buf || cache->generation != ups->generation
+	 || cache->fsd != ups->fsd
+	) {
+		list_cache_make(cache, ups);
+	}
 
-	if (node->right)
-		return tree_dump(node->right, client, ups, rw, fsd);
+	upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [LIST %s, as kept]",
+		client->sock_fd, cache->len, upsname);
 
+	sendback_raw(client, cache->buf, cache->len);
 	return 1;
 }
 
+void list_cache_free(upstype_t *ups)
+{
+	list_cache_t	*cache, *next;
+
+	for (cache = ups->listcache; cache; cache = next) {
+		next = cache->next;
+		free(cache->var);
+		free(cache->buf);
+		free(cache);
+	}
+
+	ups->listcache = NULL;
+}
+
 static void list_rw(nut_ctype_t *client, const char *upsname)
 {
-	const   upstype_t *ups;
+	upstype_t	*ups;
 
 	ups = get_ups_ptr(upsname);
 
@@ -95,18 +368,177 @@ static void list_rw(nut_ctype_t *client, const char *upsname)
 	if (!ups_available(ups, client))
 		return;
 
+	if (list_cache_send(client, ups, upsname, LIST_CACHE_RW, NULL))
+		return;
+
 	if (!sendback(client, "BEGIN LIST RW %s\n", upsname))
 		return;
 
-	if (!tree_dump(ups->inforoot, client, upsname, 1, ups->fsd))
+	if (!tree_dump(ups->inforoot, client, upsname, 1, ups->fsd, NULL, NULL))
 		return;
 
 	sendback(client, "END LIST RW %s\n", upsname);
 }
 
 static void list_var(nut_ctype_t *client, const char *upsname)
+{
+	upstype_t	*ups;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	if (list_cache_send(client, ups, upsname, LIST_CACHE_VAR, NULL))
+		return;
+
+	if (!list_frame(client, BINFRAME_BEGIN, "VAR %s", upsname))
+		return;
+
+	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd, NULL, NULL))
+		return;
+
+	list_frame(client, BINFRAME_END, "VAR %s", upsname);
+}
+
+/* LIST VAR <ups1> <ups2> ... or LIST VAR *: the variables of several
+ * devices (or all of them) in one response, framed by the names as they
+ * were asked for; devices whose driver is not connected or stale are
+ * left out instead of failing the whole list */
+static void list_var_multi(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	const   upstype_t *ups;
+	char	*names;
+	size_t	i, len = 0;
+	int	all = (numarg == 1 && !strcmp(arg[0], "*"));
+
+	for (i = 0; i < numarg; i++) {
+		if (!all && !get_ups_ptr(arg[i])) {
+			send_err(client, NUT_ERR_UNKNOWN_UPS);
+			return;
+		}
+
+		len += strlen(arg[i]) + 1;
+	}
+
+	/* the names must fit in the BEGIN and END lines */
+	if (len + strlen("BEGIN LIST VAR \n") > NUT_NET_ANSWER_MAX) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	names = xcalloc(len, 1);
+	for (i = 0; i < numarg; i++) {
+		if (i)
+			strcat(names, " ");
+		strcat(names, arg[i]);
+	}
+
+	if (!list_frame(client, BINFRAME_BEGIN, "VAR %s", names))
+		goto out;
+
+	if (all) {
+		for (ups = firstups; ups != NULL; ups = ups->next) {
+			if (INVALID_FD(ups->sock_fd) || ups->stale)
+				continue;
+
+			if (!tree_dump(ups->inforoot, client, ups->name, 0, ups->fsd, NULL, NULL))
+				goto out;
+		}
+	} else {
+		for (i = 0; i < numarg; i++) {
+			ups = get_ups_ptr(arg[i]);
+
+			if (INVALID_FD(ups->sock_fd) || ups->stale)
+				continue;
+
+			if (!tree_dump(ups->inforoot, client, arg[i], 0, ups->fsd, NULL, NULL))
+				goto out;
+		}
+	}
+
+	list_frame(client, BINFRAME_END, "VAR %s", names);
+
+out:
+	free(names);
+}
+
+/* LIST VAR <ups> SINCE <token>: only the variables changed since the
+ * (earlier) token, or all of them with a FULL flag if some might have
+ * been removed meanwhile; the next token to use is in the END line.
+ * Tokens are those of state_timestamp_token() (monotonic where available,
+ * so they only make sense to the same upsd instance); clients should treat
+ * them as opaque strings, and "0" asks for everything */
+static void list_var_since(nut_ctype_t *client, const char *upsname, const char *token)
+{
+	const   upstype_t *ups;
+	uintmax_t	since, now_token;
+	st_tree_timespec_t	now, cutoff;
+	char	*end = NULL;
+	int	full;
+
+	errno = 0;
+	since = strtoumax(token, &end, 10);
+	if (!*token || !end || *end || errno) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	/* Changes later than this are reported next time */
+	state_get_timestamp(&now);
+	now_token = state_timestamp_token(&now);
+
+	/* A token from the future was not issued by this upsd instance */
+	full = (since == 0 || since > now_token
+		|| since <= state_timestamp_token(&ups->lastdel));
+	state_token_timestamp(since, &cutoff);
+
+	if (!list_frame(client, BINFRAME_BEGIN, "VAR %s SINCE %s", upsname, token))
+		return;
+
+	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd,
+		(full ? NULL : &cutoff), NULL)
+	) {
+		return;
+	}
+
+	list_frame(client, BINFRAME_END, "VAR %s SINCE %" PRIuMAX "%s",
+		upsname, now_token, (full ? " FULL" : ""));
+}
+
+/* LIST VAR <ups> PREFIX <prefix>: only the variables whose names start
+ * with the prefix (e.g. "battery." or "outlet.12."), case insensitively
+ * like the names are compared */
+static void list_var_prefix(nut_ctype_t *client, const char *upsname, const char *prefix)
 {
 	const   upstype_t *ups;
+	const	char	*p;
+
+	/* it is echoed in the BEGIN and END lines unquoted, as names are */
+	for (p = prefix; *p; p++) {
+		if (!isalnum((unsigned char)*p) && !strchr("._-", *p))
+			break;
+	}
+
+	if (!*prefix || *p) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
 
 	ups = get_ups_ptr(upsname);
 
@@ -118,18 +550,18 @@ static void list_var(nut_ctype_t *client, const char *upsname)
 	if (!ups_available(ups, client))
 		return;
 
-	if (!sendback(client, "BEGIN LIST VAR %s\n", upsname))
+	if (!list_frame(client, BINFRAME_BEGIN, "VAR %s PREFIX %s", upsname, prefix))
 		return;
 
-	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd))
+	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd, NULL, prefix))
 		return;
 
-	sendback(client, "END LIST VAR %s\n", upsname);
+	list_frame(client, BINFRAME_END, "VAR %s PREFIX %s", upsname, prefix);
 }
 
 static void list_cmd(nut_ctype_t *client, const char *upsname)
 {
-	const   upstype_t *ups;
+	upstype_t	*ups;
 	cmdlist_t	*ctmp;
 
 	ups = get_ups_ptr(upsname);
@@ -142,6 +574,9 @@ static void list_cmd(nut_ctype_t *client, const char *upsname)
 	if (!ups_available(ups, client))
 		return;
 
+	if (list_cache_send(client, ups, upsname, LIST_CACHE_CMD, NULL))
+		return;
+
 	if (!sendback(client, "BEGIN LIST CMD %s\n", upsname))
 		return;
 
@@ -155,7 +590,7 @@ static void list_cmd(nut_ctype_t *client, const char *upsname)
 
 static void list_enum(nut_ctype_t *client, const char *upsname, const char *var)
 {
-	const   upstype_t *ups;
+	upstype_t	*ups;
 	const	st_tree_t	*node;
 	const	enum_t	*etmp;
 
@@ -176,6 +611,9 @@ static void list_enum(nut_ctype_t *client, const char *upsname, const char *var)
 		return;
 	}
 
+	if (list_cache_send(client, ups, upsname, LIST_CACHE_ENUM, var))
+		return;
+
 	if (!sendback(client, "BEGIN LIST ENUM %s %s\n", upsname, var))
 		return;
 
@@ -223,6 +661,74 @@ static void list_range(nut_ctype_t *client, const char *upsname, const char *var
 	sendback(client, "END LIST RANGE %s %s\n", upsname, var);
 }
 
+/* what list_hist() sends each kept value with */
+typedef struct {
+	nut_ctype_t	*client;
+	const char	*upsname, *var;
+	int	ok;
+} list_hist_t;
+
+static int list_hist_one(void *arg, int64_t msec, const char *val)
+{
+	list_hist_t	*lh = arg;
+	char	esc[ST_MAX_VALUE_LEN * 2 + 1];
+
+	pconf_encode(val, esc, sizeof(esc));
+	lh->ok = sendback(lh->client, "HIST %s %s %" PRId64 ".%03d \"%s\"\n",
+		lh->upsname, lh->var, msec / 1000, (int)(msec % 1000), esc);
+
+	return lh->ok;
+}
+
+/* LIST HIST <ups> <var> [<since>]: the values var had (see history.c),
+ * oldest first, with the time (in seconds since the epoch) each came in;
+ * only those after <since> (in the same seconds) if given.  Also served
+ * while the driver is away, as this is what it is there for. */
+static void list_hist(nut_ctype_t *client, const char *upsname, const char *var, const char *since)
+{
+	const	upstype_t	*ups;
+	list_hist_t	lh;
+	int64_t	since_msec = -1;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!history_wanted(var)) {
+		send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+		return;
+	}
+
+	if (since) {
+		char	*end = NULL;
+		double	sec;
+
+		errno = 0;
+		sec = strtod(since, &end);
+		if (!*since || !end || *end || errno || sec < 0) {
+			send_err(client, NUT_ERR_INVALID_ARGUMENT);
+			return;
+		}
+		since_msec = (int64_t)(sec * 1000);
+	}
+
+	if (!sendback(client, "BEGIN LIST HIST %s %s\n", upsname, var))
+		return;
+
+	lh.client = client;
+	lh.upsname = upsname;
+	lh.var = var;
+	lh.ok = 1;
+
+	history_walk(history_find(ups->history, var), since_msec, list_hist_one, &lh);
+
+	if (lh.ok)
+		sendback(client, "END LIST HIST %s %s\n", upsname, var);
+}
+
 static void list_ups(nut_ctype_t *client)
 {
 	upstype_t	*utmp;
@@ -285,7 +791,7 @@ static void list_clients(nut_ctype_t *client, const char *upsname)
 	sendback(client, "END LIST CLIENT %s\n", upsname);
 }
 
-void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
+static void list_dispatch(nut_ctype_t *client, size_t numarg, const char **arg)
 {
 	if (numarg < 1) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
@@ -298,13 +804,43 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST STATS */
+	if (!strcasecmp(arg[0], "STATS")) {
+		netstats_list(client);
+		return;
+	}
+
 	if (numarg < 2) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
 		return;
 	}
 
-	/* LIST VAR UPS */
+	/* LIST VAR UPS [SINCE TOKEN | PREFIX PREFIX] | LIST VAR UPS1 UPS2 ...
+	 * | LIST VAR * */
 	if (!strcasecmp(arg[0], "VAR")) {
+		if (numarg > 2 && !strcasecmp(arg[2], "SINCE")) {
+			if (numarg > 3) {
+				list_var_since(client, arg[1], arg[3]);
+			} else {
+				list_var(client, arg[1]);
+			}
+			return;
+		}
+
+		if (numarg > 2 && !strcasecmp(arg[2], "PREFIX")) {
+			if (numarg > 3) {
+				list_var_prefix(client, arg[1], arg[3]);
+			} else {
+				list_var(client, arg[1]);
+			}
+			return;
+		}
+
+		if (numarg > 2 || !strcmp(arg[1], "*")) {
+			list_var_multi(client, numarg - 1, &arg[1]);
+			return;
+		}
+
 		list_var(client, arg[1]);
 		return;
 	}
@@ -344,5 +880,19 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST HIST UPS VARNAME [SINCE] */
+	if (!strcasecmp(arg[0], "HIST")) {
+		list_hist(client, arg[1], arg[2], (numarg > 3) ? arg[3] : NULL);
+		return;
+	}
+
 	send_err(client, NUT_ERR_INVALID_ARGUMENT);
 }
+
+void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	/* BEGIN..END goes out in one piece rather than a write per line */
+	sendback_cork(client);
+	list_dispatch(client, numarg, arg);
+	sendback_uncork(client);
+}
@@ -33,6 +33,9 @@ extern "C" {
 
 void net_list(nut_ctype_t *client, size_t numarg, const char **arg);
 
+/* drop the LIST responses kept for ups */
+void list_cache_free(upstype_t *ups);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -0,0 +1,431 @@
+/* netmetrics.c - HTTP listener of upsd for Prometheus/OpenMetrics scrapes,
+   rendering the numeric variables of all devices from upsd's own state
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include <ctype.h>
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+
+#include "netmetrics.h"
+
+/* requests (with all their headers) larger than this are refused */
+#define METRICS_MAX_REQUEST	8192
+
+#define METRICS_TYPE_OPENMETRICS	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+#define METRICS_TYPE_TEXT	"text/plain; version=0.0.4; charset=utf-8"
+
+/* what was read of the HTTP request of a client so far */
+struct metrics_req_s {
+	char	request[SMALLBUF];	/* the request line */
+	char	header[SMALLBUF];	/* the header line being read */
+	size_t	len;		/* of the line being read (may be truncated) */
+	size_t	total;		/* bytes of the request */
+	int	lines;		/* complete lines (the request line is first) */
+	int	openmetrics;	/* "Accept: application/openmetrics-text" */
+};
+
+/* one sample of the page */
+struct metrics_entry_s {
+	char	*name;
+	const char	*var;
+	const char	*ups;
+	const char	*val;
+	size_t	order;	/* of the device, to keep it stable within a family */
+};
+
+/* the page as last rendered; valid until a driver reports a change */
+static char	*metrics_page = NULL;
+static size_t	metrics_pagelen = 0, metrics_pagesize = 0;
+static int	metrics_valid = 0;
+
+static struct metrics_entry_s	*metrics_entries = NULL;
+static size_t	metrics_numentries = 0, metrics_entriessize = 0;
+
+void metrics_invalidate(void)
+{
+	metrics_valid = 0;
+}
+
+static void metrics_append(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
+static void metrics_append(const char *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	for (;;) {
+		va_start(ap, fmt);
+		ret = vsnprintf(metrics_page + metrics_pagelen,
+			metrics_pagesize - metrics_pagelen, fmt, ap);
+		va_end(ap);
+
+		if (ret < 0) {
+			return;
+		}
+
+		if (metrics_pagelen + (size_t)ret < metrics_pagesize) {
+			metrics_pagelen += (size_t)ret;
+			return;
+		}
+
+		metrics_pagesize = (metrics_pagesize ? metrics_pagesize * 2 : 4 * LARGEBUF);
+		while (metrics_pagesize <= metrics_pagelen + (size_t)ret) {
+			metrics_pagesize *= 2;
+		}
+		metrics_page = xrealloc(metrics_page, metrics_pagesize);
+	}
+}
+
+/* label values are device names, but those are not ours to trust */
+static void metrics_append_label(const char *val)
+{
+	const char	*p;
+
+	for (p = val; *p; p++) {
+		switch (*p)
+		{
+		case '\\':
+			metrics_append("\\\\");
+			break;
+		case '"':
+			metrics_append("\\\"");
+			break;
+		case '\n':
+			metrics_append("\\n");
+			break;
+		default:
+			metrics_append("%c", *p);
+			break;
+		}
+	}
+}
+
+/* decimal numbers as drivers report them, e.g. "230.0", "-5" or "1e3";
+ * not hex, "inf" or "nan" which strtod() would also take */
+static int metrics_is_number(const char *val)
+{
+	const unsigned char	*p = (const unsigned char *)val;
+	size_t	digits = 0;
+
+	if (*p == '-' || *p == '+') {
+		p++;
+	}
+
+	for (; isdigit(*p); p++) {
+		digits++;
+	}
+
+	if (*p == '.') {
+		for (p++; isdigit(*p); p++) {
+			digits++;
+		}
+	}
+
+	if (!digits) {
+		return 0;
+	}
+
+	if (*p == 'e' || *p == 'E') {
+		p++;
+		if (*p == '-' || *p == '+') {
+			p++;
+		}
+		if (!isdigit(*p)) {
+			return 0;
+		}
+		while (isdigit(*p)) {
+			p++;
+		}
+	}
+
+	return (*p == '\0');
+}
+
+/* "battery.charge" is sampled as nut_battery_charge */
+static char *metrics_name(const char *var)
+{
+	char	*name = xmalloc(strlen(var) + 5), *p;
+
+	snprintf(name, strlen(var) + 5, "nut_%s", var);
+
+	for (p = name + 4; *p; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '_') {
+			*p = '_';
+		}
+	}
+
+	return name;
+}
+
+static void metrics_collect(const st_tree_t *node, const upstype_t *ups, size_t order)
+{
+	struct metrics_entry_s	*e;
+
+	if (!node) {
+		return;
+	}
+
+	metrics_collect(node->left, ups, order);
+
+	if (metrics_is_number(node->raw)) {
+		if (metrics_numentries == metrics_entriessize) {
+			metrics_entriessize = (metrics_entriessize ? metrics_entriessize * 2 : 64);
+			metrics_entries = xrealloc(metrics_entries,
+				metrics_entriessize * sizeof(*metrics_entries));
+		}
+
+		e = &metrics_entries[metrics_numentries++];
+		e->name = metrics_name(node->var);
+		e->var = node->var;
+		e->ups = ups->name;
+		e->val = node->raw;
+		e->order = order;
+	}
+
+	metrics_collect(node->right, ups, order);
+}
+
+static int metrics_entry_cmp(const void *a, const void *b)
+{
+	const struct metrics_entry_s	*ea = (const struct metrics_entry_s *)a;
+	const struct metrics_entry_s	*eb = (const struct metrics_entry_s *)b;
+	int	ret = strcmp(ea->name, eb->name);
+
+	if (ret) {
+		return ret;
+	}
+
+	return (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+/* all samples of one family must be listed together, so the values of
+ * all devices are sorted by metric name before they are written out */
+static void metrics_render(void)
+{
+	const upstype_t	*ups;
+	size_t	i, order = 0;
+	const char	*family = "";
+
+	metrics_pagelen = 0;
+	metrics_append("# HELP nut_up Whether upsd has fresh data from the driver.\n"
+		"# TYPE nut_up gauge\n");
+
+	for (ups = firstups; ups; ups = ups->next, order++) {
+		int	up = (VALID_FD(ups->sock_fd) && !ups->stale);
+
+		metrics_append("nut_up{ups=\"");
+		metrics_append_label(ups->name);
+		metrics_append("\"} %d\n", up);
+
+		if (up) {
+			metrics_collect(ups->inforoot, ups, order);
+		}
+	}
+
+	qsort(metrics_entries, metrics_numentries, sizeof(*metrics_entries),
+		metrics_entry_cmp);
+
+	for (i = 0; i < metrics_numentries; i++) {
+		struct metrics_entry_s	*e = &metrics_entries[i];
+
+		if (strcmp(e->name, family)) {
+			metrics_append("# HELP %s %s\n# TYPE %s gauge\n",
+				e->name, e->var, e->name);
+		}
+
+		metrics_append("%s{ups=\"", e->name);
+		metrics_append_label(e->ups);
+		metrics_append("\"} %s\n", e->val);
+
+		family = e->name;
+	}
+
+	metrics_append("# EOF\n");
+
+	upsdebugx(2, "%s: %" PRIuSIZE " bytes for %" PRIuSIZE " values",
+		__func__, metrics_pagelen, metrics_numentries);
+
+	for (i = 0; i < metrics_numentries; i++) {
+		free(metrics_entries[i].name);
+	}
+
+	metrics_numentries = 0;
+	metrics_valid = 1;
+}
+
+static void metrics_reply(nut_ctype_t *client, const char *status,
+	const char *type, const char *extra, const char *body, size_t len,
+	int head)
+{
+	char	hdr[LARGEBUF];
+
+	snprintf(hdr, sizeof(hdr),
+		"HTTP/1.1 %s\r\n"
+		"Server: upsd/%s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %" PRIuSIZE "\r\n"
+		"%s"
+		"Connection: close\r\n"
+		"\r\n",
+		status, UPS_VERSION, type, len, extra);
+
+	upsdebugx(2, "%s: %s to %s", __func__, status, client->addr);
+
+	sendback_cork(client);
+	sendback_raw(client, hdr, strlen(hdr));
+	if (!head && len > 0) {
+		sendback_raw(client, body, len);
+	}
+	sendback_uncork(client);
+}
+
+static void metrics_error(nut_ctype_t *client, const char *status, const char *extra)
+{
+	char	body[SMALLBUF];
+
+	snprintf(body, sizeof(body), "%s\n", status);
+	metrics_reply(client, status, "text/plain; charset=utf-8", extra,
+		body, strlen(body), 0);
+}
+
+/* the request line and headers are in, answer it */
+static void metrics_serve(nut_ctype_t *client)
+{
+	struct metrics_req_s	*req = client->metrics;
+	char	*method = req->request, *path, *p;
+	int	head;
+
+	path = strchr(method, ' ');
+	if (!path) {
+		metrics_error(client, "400 Bad Request", "");
+		return;
+	}
+	*path++ = '\0';
+
+	p = strpbrk(path, " ?");
+	if (p) {
+		*p = '\0';
+	}
+
+	upsdebugx(3, "%s: %s %s from %s", __func__, method, path, client->addr);
+
+	head = !strcmp(method, "HEAD");
+	if (!head && strcmp(method, "GET")) {
+		metrics_error(client, "405 Method Not Allowed", "Allow: GET, HEAD\r\n");
+		return;
+	}
+
+	if (strcmp(path, "/metrics")) {
+		metrics_error(client, "404 Not Found", "");
+		return;
+	}
+
+	if (!metrics_valid) {
+		metrics_render();
+	}
+
+	metrics_reply(client, "200 OK",
+		req->openmetrics ? METRICS_TYPE_OPENMETRICS : METRICS_TYPE_TEXT, "",
+		metrics_page, metrics_pagelen, head);
+}
+
+/* a line of the request is complete */
+static int metrics_line(nut_ctype_t *client)
+{
+	struct metrics_req_s	*req = client->metrics;
+	char	*line = (req->lines == 0) ? req->request : req->header;
+
+	line[req->len] = '\0';
+	if (req->len > 0 && line[req->len - 1] == '\r') {
+		line[req->len - 1] = '\0';
+	}
+
+	req->lines++;
+	req->len = 0;
+
+	if (req->lines == 1) {
+		return 0;
+	}
+
+	if (line[0] == '\0') {
+		return 1;	/* end of the headers */
+	}
+
+	if (!strncasecmp(line, "Accept:", 7)
+	 && strstr(line, "application/openmetrics-text")
+	) {
+		req->openmetrics = 1;
+	}
+
+	return 0;
+}
+
+int metrics_feed(nut_ctype_t *client, const char *buf, size_t len)
+{
+	struct metrics_req_s	*req = client->metrics;
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		if (++req->total > METRICS_MAX_REQUEST) {
+			metrics_error(client, "431 Request Header Fields Too Large", "");
+			return 1;
+		}
+
+		if (buf[i] == '\n') {
+			if (metrics_line(client)) {
+				metrics_serve(client);
+				return 1;
+			}
+			continue;
+		}
+
+		/* longer lines are cut, nothing we care for is in there */
+		if (req->len < SMALLBUF - 1) {
+			((req->lines == 0) ? req->request : req->header)[req->len++] = buf[i];
+		}
+	}
+
+	return 0;
+}
+
+void metrics_client_init(nut_ctype_t *client)
+{
+	client->metrics = xcalloc(1, sizeof(*client->metrics));
+}
+
+void metrics_client_free(nut_ctype_t *client)
+{
+	free(client->metrics);
+	client->metrics = NULL;
+}
+
+void metrics_free(void)
+{
+	free(metrics_page);
+	metrics_page = NULL;
+	metrics_pagelen = metrics_pagesize = 0;
+	metrics_valid = 0;
+
+	free(metrics_entries);
+	metrics_entries = NULL;
+	metrics_entriessize = 0;
+}
@@ -0,0 +1,49 @@
+/* netmetrics.h - HTTP listener of upsd for Prometheus/OpenMetrics scrapes
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETMETRICS_H_SEEN
+#define NUT_NETMETRICS_H_SEEN 1
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* for METRICS lines without a port, as registered for NUT exporters */
+#define METRICS_PORT	"9199"
+
+/* a client connected to a METRICS listener */
+void metrics_client_init(nut_ctype_t *client);
+void metrics_client_free(nut_ctype_t *client);
+
+/* take what the client sent; returns 1 once the reply is queued and the
+ * connection should be closed after it, 0 if the request is incomplete */
+int metrics_feed(nut_ctype_t *client, const char *buf, size_t len);
+
+/* a driver reported a change: render the page again for the next scrape */
+void metrics_invalidate(void);
+
+void metrics_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETMETRICS_H_SEEN */
@@ -28,6 +28,8 @@
 #include "neterr.h"
 
 #include "netmisc.h"
+#include "netwatch.h"
+#include "beacon.h"
 
 void net_ver(nut_ctype_t *client, size_t numarg, const char **arg)
 {
@@ -93,7 +95,8 @@ void net_help(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	sendback(client, "Commands: HELP VER PROTVER GET LIST SET INSTCMD"
-		" LOGIN LOGOUT USERNAME PASSWORD STARTTLS\n");
+		" LOGIN LOGOUT USERNAME PASSWORD STARTTLS WATCH UNWATCH FRAMING"
+		" COMPRESS RELAY\n");
 	/* Not exposed: PRIMARY/MASTER FSD */
 }
 
@@ -114,7 +117,8 @@ void net_fsd(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	/* make sure this user is allowed to do FSD */
-	if (!user_checkaction(client->username, client->password, "FSD")) {
+	if (!user_checkaction(client->username, client->password, "FSD",
+		&client->auth)) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
@@ -123,6 +127,11 @@ void net_fsd(nut_ctype_t *client, size_t numarg, const char **arg)
 		client->username, client->addr, ups->name);
 
 	ups->fsd = 1;
+	/* ups.status is reported differently now */
+	state_get_timestamp(&ups->lastdel);
 	sendback(client, "OK FSD-SET\n");
+	watch_notify_setinfo(ups, "ups.status");
+	beacon_changed(ups);
+	workers_fsd(ups);
 }
 
@@ -0,0 +1,379 @@
+/* netrelay.c - RELAY of devices from one upsd to another
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* A site with an upsd per row and one for all of them used to run a
+ * dummy-ups repeater for each device of the rows on the central one,
+ * each listing all the variables again every few seconds.  Instead, the
+ * central upsd connects for each RELAY of its upsd.conf to the upsd of
+ * the row, as it would to a driver (see sstate.c), and says RELAY <ups>:
+ * from then on that upsd talks like the driver of the device.  It sends
+ * what it has (SETINFO, SETFLAGS, ADDENUM... DATAOK or DATASTALE and
+ * DUMPDONE), then the changes in the order it learns of them, and
+ * answers PING with PONG; a row of rows works the same way.
+ *
+ * The feed is read-only: the instant commands are not relayed, and RW
+ * is left out of the flags, so that the central upsd refuses INSTCMD and
+ * SET of the device rather than pretend it did them. */
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+#include "neterr.h"
+
+#include "netrelay.h"
+
+/* feeds of all clients, to not bother when there are none */
+static size_t	relay_total = 0;
+
+/* the value of node as it goes on the feed, like LIST VAR has it */
+static void relay_send_value(nut_ctype_t *client, const upstype_t *ups, const st_tree_t *node)
+{
+	if (ups->fsd == 1 && !strcasecmp(node->var, "ups.status")) {
+		sendback(client, "SETINFO %s \"FSD %s\"\n", node->var, node->val);
+	} else {
+		sendback(client, "SETINFO %s \"%s\"\n", node->var, node->val);
+	}
+}
+
+/* the flags of node (but RW); nothing if it has none */
+static void relay_send_flags(nut_ctype_t *client, const st_tree_t *node)
+{
+	char	flags[SMALLBUF];
+
+	flags[0] = '\0';
+
+	if (node->flags & ST_FLAG_STRING) {
+		snprintfcat(flags, sizeof(flags), " STRING");
+	}
+	if (node->flags & ST_FLAG_NUMBER) {
+		snprintfcat(flags, sizeof(flags), " NUMBER");
+	}
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		snprintfcat(flags, sizeof(flags), " IMMUTABLE");
+	}
+
+	if (flags[0]) {
+		sendback(client, "SETFLAGS %s%s\n", node->var, flags);
+	}
+}
+
+static void relay_send_enums(nut_ctype_t *client, const st_tree_t *node)
+{
+	const enum_t	*etmp;
+
+	/* kept the way they go on the wire, see state_addenum() */
+	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+		sendback(client, "ADDENUM %s \"%s\"\n", node->var, etmp->val);
+	}
+}
+
+static void relay_send_ranges(nut_ctype_t *client, const st_tree_t *node)
+{
+	const range_t	*rtmp;
+
+	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+		sendback(client, "ADDRANGE %s %d %d\n", node->var, rtmp->min, rtmp->max);
+	}
+}
+
+/* DATASTALE or DATAOK, if it was told otherwise (or force) */
+static void relay_send_stale(nut_ctype_t *client, const upstype_t *ups, int force)
+{
+	int	stale = (INVALID_FD(ups->sock_fd) || ups->stale);
+
+	if (!force && stale == client->relaystale) {
+		return;
+	}
+
+	client->relaystale = stale;
+	sendback(client, "%s\n", stale ? "DATASTALE" : "DATAOK");
+}
+
+/* RELAY <ups> */
+void net_relay(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	const upstype_t	*ups;
+	const st_tree_t	*node;
+
+	if (numarg != 1 || client->relay) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		/* the other upsd reconnects later, as if the driver was not
+		 * there; until then this one is of no use */
+		client_expire(client);
+		return;
+	}
+
+	client->relay = xstrdup(ups->name);
+	relay_total++;
+
+	upslogx(LOG_INFO, "Relaying UPS [%s] to %s", ups->name, client->addr);
+
+	/* what we have now, then the changes */
+	sendback_cork(client);
+
+	for (node = state_tree_next(ups->inforoot, NULL); node;
+		node = state_tree_next(ups->inforoot, node->name)
+	) {
+		relay_send_value(client, ups, node);
+		relay_send_flags(client, node);
+		if (node->aux) {
+			sendback(client, "SETAUX %s %ld\n", node->var, node->aux);
+		}
+		relay_send_enums(client, node);
+		relay_send_ranges(client, node);
+	}
+
+	relay_send_stale(client, ups, 1);
+	sendback(client, "DUMPDONE\n");
+
+	sendback_uncork(client);
+}
+
+void relay_input(nut_ctype_t *client)
+{
+	if (!strcasecmp(client->ctx->arglist[0], "PING")) {
+		sendback(client, "PONG\n");
+		return;
+	}
+
+	/* INSTCMD and SET do not get here: nothing is offered for them */
+	upsdebugx(2, "%s: ignoring %s from %s, relaying UPS [%s]",
+		__func__, client->ctx->arglist[0], client->addr, client->relay);
+}
+
+/* the next client with a feed of ups, after client (NULL: the first) */
+static nut_ctype_t *relay_next(const upstype_t *ups, nut_ctype_t *client)
+{
+	for (client = (client ? client->next : firstclient); client; client = client->next) {
+		if (client->relay && !strcasecmp(client->relay, ups->name)) {
+			return client;
+		}
+	}
+
+	return NULL;
+}
+
+void relay_setinfo(const upstype_t *ups, const char *var)
+{
+	nut_ctype_t	*client;
+	const st_tree_t	*node;
+
+	if (!relay_total) {
+		return;
+	}
+
+	node = sstate_getnode(ups, var);
+
+	if (!node) {
+		return;
+	}
+
+	for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+		relay_send_value(client, ups, node);
+	}
+}
+
+void relay_delinfo(const upstype_t *ups, const char *var)
+{
+	nut_ctype_t	*client;
+
+	if (!relay_total) {
+		return;
+	}
+
+	for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+		sendback(client, "DELINFO %s\n", var);
+	}
+}
+
+void relay_forward(const upstype_t *ups, size_t numargs, char **arg)
+{
+	nut_ctype_t	*client;
+	const st_tree_t	*node;
+	char	esc[ST_MAX_VALUE_LEN];
+	int	flags, aux, enums, ranges;
+
+	if (!relay_total || numargs < 2) {
+		return;
+	}
+
+	/* the values come by relay_setinfo(), the commands not at all */
+	if (!strcasecmp(arg[0], "ADDENUM") || !strcasecmp(arg[0], "DELENUM")) {
+		pconf_encode(arg[2], esc, sizeof(esc));
+		for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+			sendback(client, "%s %s \"%s\"\n", arg[0], arg[1], esc);
+		}
+		return;
+	}
+
+	if (!strcasecmp(arg[0], "ADDRANGE") || !strcasecmp(arg[0], "DELRANGE")) {
+		for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+			sendback(client, "%s %s %d %d\n", arg[0], arg[1], atoi(arg[2]), atoi(arg[3]));
+		}
+		return;
+	}
+
+	/* the rest is sent as it is now, after the line was taken */
+	flags = !strcasecmp(arg[0], "SETFLAGS");
+	aux = !strcasecmp(arg[0], "SETAUX");
+	enums = !strcasecmp(arg[0], "SETENUMS");
+	ranges = !strcasecmp(arg[0], "SETRANGES");
+
+	if (!flags && !aux && !enums && !ranges) {
+		return;
+	}
+
+	node = sstate_getnode(ups, arg[1]);
+
+	if (!node) {
+		return;
+	}
+
+	for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+		if (flags) {
+			relay_send_flags(client, node);
+		} else if (aux) {
+			sendback(client, "SETAUX %s %ld\n", node->var, node->aux);
+		} else if (enums) {
+			/* all of them again: a shared list of the driver
+			 * means nothing on this connection */
+			sendback(client, "SETENUMS %s 0\n", node->var);
+			relay_send_enums(client, node);
+		} else {
+			sendback(client, "SETRANGES %s 0\n", node->var);
+			relay_send_ranges(client, node);
+		}
+	}
+}
+
+void relay_stale(const upstype_t *ups)
+{
+	nut_ctype_t	*client;
+
+	if (!relay_total) {
+		return;
+	}
+
+	for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+		relay_send_stale(client, ups, 0);
+	}
+}
+
+void relay_reset(const upstype_t *ups)
+{
+	nut_ctype_t	*client;
+	const st_tree_t	*node;
+
+	if (!relay_total) {
+		return;
+	}
+
+	for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+		sendback_cork(client);
+
+		for (node = state_tree_next(ups->inforoot, NULL); node;
+			node = state_tree_next(ups->inforoot, node->name)
+		) {
+			sendback(client, "DELINFO %s\n", node->var);
+		}
+
+		sendback_uncork(client);
+	}
+}
+
+void relay_gone(const upstype_t *ups)
+{
+	nut_ctype_t	*client;
+
+	if (!relay_total) {
+		return;
+	}
+
+	for (client = relay_next(ups, NULL); client; client = relay_next(ups, client)) {
+		client_expire(client);
+	}
+}
+
+void relay_free(nut_ctype_t *client)
+{
+	if (!client->relay) {
+		return;
+	}
+
+	free(client->relay);
+	client->relay = NULL;
+	relay_total--;
+}
+
+int relay_split(const char *source, char *ups, size_t upslen,
+	char *host, size_t hostlen, char *port, size_t portlen)
+{
+	const char	*at, *start, *end, *colon;
+
+	at = strchr(source, '@');
+
+	if (!at || at == source || (size_t)(at - source) >= upslen) {
+		return 0;
+	}
+
+	snprintf(ups, upslen, "%.*s", (int)(at - source), source);
+
+	/* [<IPv6 address>]:<port>, or <host>:<port> */
+	if (at[1] == '[') {
+		start = at + 2;
+		if ((end = strchr(start, ']')) == NULL) {
+			return 0;
+		}
+		colon = (end[1] == ':' ? end + 1 : NULL);
+		if (end[1] && !colon) {
+			return 0;
+		}
+	} else {
+		start = at + 1;
+		colon = strchr(start, ':');
+		end = (colon ? colon : start + strlen(start));
+	}
+
+	if (end == start || (size_t)(end - start) >= hostlen) {
+		return 0;
+	}
+
+	snprintf(host, hostlen, "%.*s", (int)(end - start), start);
+
+	if (!colon) {
+		snprintf(port, portlen, "%s", string_const(PORT));
+		return 1;
+	}
+
+	if (!colon[1] || strlen(colon + 1) >= portlen
+	 || strspn(colon + 1, "0123456789") != strlen(colon + 1)
+	) {
+		return 0;
+	}
+
+	snprintf(port, portlen, "%s", colon + 1);
+	return 1;
+}
@@ -0,0 +1,62 @@
+/* netrelay.h - RELAY of devices from one upsd to another
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETRELAY_H_SEEN
+#define NUT_NETRELAY_H_SEEN 1
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* RELAY <ups>: the connection becomes a feed of the device, in the
+ * language of the drivers; client->relay is its name from then on */
+void net_relay(nut_ctype_t *client, size_t numarg, const char **arg);
+
+/* what the downstream upsd sends on the feed (PING) */
+void relay_input(nut_ctype_t *client);
+
+/* the changes of a device, for its feeds: the value of var changed or
+ * it was deleted (see watch_notify_setinfo()), the driver sent a line
+ * about its flags, enums or ranges (see sstate.c), it may have gone
+ * stale or back (the driver disconnected, or was done with its dump, see
+ * also ups_data_stale()), and it lost all of its variables */
+void relay_setinfo(const upstype_t *ups, const char *var);
+void relay_delinfo(const upstype_t *ups, const char *var);
+void relay_forward(const upstype_t *ups, size_t numargs, char **arg);
+void relay_stale(const upstype_t *ups);
+void relay_reset(const upstype_t *ups);
+
+/* the device is gone (reload): drop its feeds */
+void relay_gone(const upstype_t *ups);
+
+/* forget the feed of a client (upon disconnect) */
+void relay_free(nut_ctype_t *client);
+
+/* split RELAY <name> <ups>@<host>[:<port>] of upsd.conf (see conf.c) into
+ * its parts, the default port if there is none; 0 if it is not like that */
+int relay_split(const char *source, char *ups, size_t upslen,
+	char *host, size_t hostlen, char *port, size_t portlen);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETRELAY_H_SEEN */
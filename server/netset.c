@@ -48,7 +48,8 @@ static void set_var(nut_ctype_t *client, const char *upsname, const char *var,
 		return;
 
 	/* make sure this user is allowed to do SET */
-	if (!user_checkaction(client->username, client->password, "SET")) {
+	if (!user_checkaction(client->username, client->password, "SET",
+		&client->auth)) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return;
 	}
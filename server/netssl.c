@@ -37,8 +37,16 @@
 #include "upsd.h"
 #include "neterr.h"
 #include "netssl.h"
+#include "netstats.h"
 #include "nut_stdint.h"
 
+#ifdef NETSSL_HANDSHAKE_WORKERS
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#endif
+
 #ifdef WITH_NSS
 #	include <pk11pub.h>
 #	include <prinit.h>
@@ -70,6 +78,9 @@ int	disable_weak_ssl = 0;
 int certrequest = 0;
 #endif /* WITH_CLIENT_CERTIFICATE_VALIDATION */
 
+/* see SSL_HANDSHAKE_WORKERS in upsd.conf; 0 = inline in net_starttls() */
+int	ssl_handshake_workers = NETSSL_HANDSHAKE_WORKERS_DEFAULT;
+
 static int	ssl_initialized = 0;
 
 #ifndef WITH_SSL
@@ -274,14 +285,340 @@ static void HandshakeCallback(PRFileDesc *fd, nut_ctype_t *client_data)
 
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+/* Complete the handshake of a connection set up by net_starttls(),
+ * returns 1 once it is secured.  This may run in a worker thread
+ * (see below), so it must not touch more of the client than that.
+ */
+static int ssl_handshake(nut_ctype_t *client)
 {
 #ifdef WITH_OPENSSL
-	int ret;
+	int	ret = SSL_accept(client->ssl);
+
+	switch (ret)
+	{
+	case 1:
+		upsdebugx(3, "SSL connected (%s%s)", SSL_get_version(client->ssl),
+			SSL_session_reused(client->ssl) ? ", session resumed" : "");
+		return 1;
+
+	case 0:
+		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
+		ssl_error(client->ssl, ret);
+		break;
+
+	case -1:
+		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
+		ssl_error(client->ssl, ret);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
+	/* Note: this call can generate memory leaks not resolvable
+	 * by any release function.
+	 * Probably SSL session key object allocation. */
+	SECStatus	status = SSL_ForceHandshake(client->ssl);
+
+	if (status != SECSuccess) {
+		PRErrorCode code = PR_GetError();
+		if (code==SSL_ERROR_NO_CERTIFICATE) {
+			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
+				client->addr);
+		} else {
+			nss_error("net_starttls / SSL_ForceHandshake");
+			/* TODO : Close the connection. */
+			return 0;
+		}
+	}
+
+	return 1;
+#endif /* WITH_OPENSSL | WITH_NSS */
+}
+
+#ifdef NETSSL_HANDSHAKE_WORKERS
+/* A handshake costs some milliseconds of CPU for the key exchange and
+ * a few round trips with the peer.  When many clients (re)connect at
+ * once, e.g. after a network outage or an upsd restart, doing them in
+ * net_starttls() one after another stalls the main loop for everyone
+ * (drivers included).  So they are queued for a few worker threads,
+ * and mainloop() leaves such clients alone (see ssl_handshaking) until
+ * ssl_handshake_collect() hands them back.  Replies queued for them
+ * meanwhile, like WATCH notifications, wait in the client's outbuf.
+ */
+typedef struct handshake_s {
+	nut_ctype_t	*client;
+	int	connected;
+	double	seconds;	/* it took, for netstats_handshake() */
+	struct handshake_s	*next;
+} handshake_t;
+
+static pthread_mutex_t	hs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	hs_cond = PTHREAD_COND_INITIALIZER;
+static handshake_t	*hs_todo = NULL, **hs_todo_tail = &hs_todo;
+static handshake_t	*hs_busy = NULL;	/* in a worker right now */
+static handshake_t	*hs_done = NULL;	/* for ssl_handshake_collect() */
+static pthread_t	*hs_threads = NULL;
+static size_t	hs_numthreads = 0;
+static int	hs_stop = 0;
+static int	hs_pipe[2] = { -1, -1 };	/* wakes up mainloop() */
+
+/* the sockets are blocking by now: do not let a silent peer keep a
+ * worker forever (0 seconds restores the default, no timeout) */
+static void ssl_handshake_timeout(nut_ctype_t *client, time_t seconds)
+{
+	struct timeval	tv;
+
+	tv.tv_sec = seconds;
+	tv.tv_usec = 0;
+
+	if (setsockopt(client->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+	 || setsockopt(client->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0
+	) {
+		upsdebug_with_errno(3, "%s: setsockopt for %s", __func__, client->addr);
+	}
+}
+
+static void *ssl_handshake_worker(void *arg)
+{
+	handshake_t	*hs, **hp;
+	struct timeval	start, end;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	pthread_mutex_lock(&hs_lock);
+
+	while (!hs_stop) {
+		if (!hs_todo) {
+			pthread_cond_wait(&hs_cond, &hs_lock);
+			continue;
+		}
+
+		hs = hs_todo;
+		if (!(hs_todo = hs->next)) {
+			hs_todo_tail = &hs_todo;
+		}
+		hs->next = hs_busy;
+		hs_busy = hs;
+
+		pthread_mutex_unlock(&hs_lock);
+		gettimeofday(&start, NULL);
+		hs->connected = ssl_handshake(hs->client);
+		gettimeofday(&end, NULL);
+		hs->seconds = difftimeval(end, start);
+		pthread_mutex_lock(&hs_lock);
+
+		for (hp = &hs_busy; *hp != hs; hp = &(*hp)->next)
+			;
+		*hp = hs->next;
+		hs->next = hs_done;
+		hs_done = hs;
+
+		/* a full pipe is readable already, that is fine too */
+		if (write(hs_pipe[1], "", 1) < 0) {
+			upsdebug_with_errno(6, "%s: write", __func__);
+		}
+	}
+
+	pthread_mutex_unlock(&hs_lock);
+	return NULL;
+}
+
+static int ssl_handshake_pipe(void)
+{
+	int	i, v;
+
+	if (pipe(hs_pipe) != 0) {
+		upslog_with_errno(LOG_WARNING, "%s: pipe", __func__);
+		hs_pipe[0] = hs_pipe[1] = -1;
+		return 0;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if ((v = fcntl(hs_pipe[i], F_GETFL, 0)) == -1
+		 || fcntl(hs_pipe[i], F_SETFL, v | O_NONBLOCK) == -1
+		 || fcntl(hs_pipe[i], F_SETFD, FD_CLOEXEC) == -1
+		) {
+			upslog_with_errno(LOG_WARNING, "%s: fcntl", __func__);
+			close(hs_pipe[0]);
+			close(hs_pipe[1]);
+			hs_pipe[0] = hs_pipe[1] = -1;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* called by ssl_init(), so after background() */
+static void ssl_handshake_start(void)
+{
+	sigset_t	all, old;
+	size_t	i, n;
+	int	err;
+
+	if (ssl_handshake_workers < 1 || hs_numthreads > 0) {
+		return;
+	}
+
+	if (!ssl_handshake_pipe()) {
+		upslogx(LOG_WARNING, "TLS handshakes will be done in the main loop");
+		return;
+	}
+
+	n = (size_t)ssl_handshake_workers;
+	if (n > NETSSL_HANDSHAKE_WORKERS_MAX) {
+		n = NETSSL_HANDSHAKE_WORKERS_MAX;
+	}
+	hs_threads = xcalloc(n, sizeof(*hs_threads));
+	hs_stop = 0;
+
+	/* signals are for the main thread to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	for (i = 0; i < n; i++) {
+		if ((err = pthread_create(&hs_threads[i], NULL, ssl_handshake_worker, NULL)) != 0) {
+			upslogx(LOG_WARNING, "%s: pthread_create: %s", __func__, strerror(err));
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	hs_numthreads = i;
+	if (hs_numthreads == 0) {
+		free(hs_threads);
+		hs_threads = NULL;
+		close(hs_pipe[0]);
+		close(hs_pipe[1]);
+		hs_pipe[0] = hs_pipe[1] = -1;
+		upslogx(LOG_WARNING, "TLS handshakes will be done in the main loop");
+		return;
+	}
+
+	upsdebugx(1, "%s: %" PRIuSIZE " threads for TLS handshakes", __func__, hs_numthreads);
+}
+
+static void ssl_handshake_stop(void)
+{
+	handshake_t	*hs, *hnext;
+	size_t	i;
+
+	if (hs_numthreads == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&hs_lock);
+	hs_stop = 1;
+	/* do not wait for the peers of handshakes in progress */
+	for (hs = hs_busy; hs; hs = hs->next) {
+		shutdown(hs->client->sock_fd, SHUT_RDWR);
+	}
+	pthread_cond_broadcast(&hs_cond);
+	pthread_mutex_unlock(&hs_lock);
+
+	for (i = 0; i < hs_numthreads; i++) {
+		pthread_join(hs_threads[i], NULL);
+	}
+
+	/* let client_free() get rid of the clients which were left */
+	for (hs = hs_todo; hs; hs = hnext) {
+		hnext = hs->next;
+		hs->client->ssl_handshaking = 0;
+		free(hs);
+	}
+	for (hs = hs_done; hs; hs = hnext) {
+		hnext = hs->next;
+		hs->client->ssl_handshaking = 0;
+		free(hs);
+	}
+	hs_todo = hs_done = NULL;
+	hs_todo_tail = &hs_todo;
+
+	free(hs_threads);
+	hs_threads = NULL;
+	hs_numthreads = 0;
+
+	close(hs_pipe[0]);
+	close(hs_pipe[1]);
+	hs_pipe[0] = hs_pipe[1] = -1;
+}
+
+/* returns 1 if a worker got the handshake, 0 to do it inline */
+static int ssl_handshake_queue(nut_ctype_t *client)
+{
+	handshake_t	*hs;
+
+	if (hs_numthreads == 0) {
+		return 0;
+	}
+
+	hs = xcalloc(1, sizeof(*hs));
+	hs->client = client;
+
+	ssl_handshake_timeout(client, NETSSL_HANDSHAKE_TIMEOUT);
+	client->ssl_handshaking = 1;
+	client->corked = 1;
+
+	pthread_mutex_lock(&hs_lock);
+	*hs_todo_tail = hs;
+	hs_todo_tail = &hs->next;
+	pthread_cond_signal(&hs_cond);
+	pthread_mutex_unlock(&hs_lock);
+
+	upsdebugx(3, "%s: TLS handshake with %s queued", __func__, client->addr);
+	return 1;
+}
+
+int ssl_handshake_fd(void)
+{
+	return hs_pipe[0];
+}
+
+nut_ctype_t *ssl_handshake_collect(void)
+{
+	handshake_t	*hs;
+	nut_ctype_t	*client;
+	char	buf[SMALLBUF];
+
+	if (hs_numthreads == 0) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&hs_lock);
+
+	if (!(hs = hs_done)) {
+		/* all handed back: drain the wakeups */
+		while (read(hs_pipe[0], buf, sizeof(buf)) > 0)
+			;
+		pthread_mutex_unlock(&hs_lock);
+		return NULL;
+	}
+
+	hs_done = hs->next;
+	pthread_mutex_unlock(&hs_lock);
+
+	client = hs->client;
+	client->ssl_connected = hs->connected;
+	client->ssl_handshaking = 0;
+	netstats_handshake(hs->connected, hs->seconds);
+	free(hs);
+
+	ssl_handshake_timeout(client, 0);
+	return client;
+}
+#endif /* NETSSL_HANDSHAKE_WORKERS */
+
+void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	struct timeval	start, end;
+#ifdef WITH_NSS
 	SECStatus	status;
 	PRFileDesc	*socket;
-#endif /* WITH_OPENSSL | WITH_NSS */
+#endif /* WITH_NSS */
 
 	NUT_UNUSED_VARIABLE(numarg);
 	NUT_UNUSED_VARIABLE(arg);
@@ -291,6 +628,12 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	if (client->zip) {
+		/* TLS goes under COMPRESS, not the other way around */
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
 	client->ssl_connected = 0;
 
 	if ((!certfile) || (!ssl_initialized)) {
@@ -313,6 +656,12 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* The handshake and later ssl_read()/ssl_write() work on the socket
+	 * directly, so leave the non-blocking reply queue behind for good */
+	if (!client_output_drain(client)) {
+		return;
+	}
+
 #ifdef WITH_OPENSSL
 
 	client->ssl = SSL_new(ssl_ctx);
@@ -329,27 +678,6 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
-	ret = SSL_accept(client->ssl);
-	switch (ret)
-	{
-	case 1:
-		client->ssl_connected = 1;
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
-		break;
-
-	case 0:
-		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
-		ssl_error(client->ssl, ret);
-		break;
-
-	case -1:
-		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
-		ssl_error(client->ssl, ret);
-		break;
-	default:
-		break;
-	}
-
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
 	socket = PR_ImportTCPSocket(client->sock_fd);
@@ -417,23 +745,19 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
-	/* Note: this call can generate memory leaks not resolvable
-	 * by any release function.
-	 * Probably SSL session key object allocation. */
-	status = SSL_ForceHandshake(client->ssl);
-	if (status != SECSuccess) {
-		PRErrorCode code = PR_GetError();
-		if (code==SSL_ERROR_NO_CERTIFICATE) {
-			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
-				client->addr);
-		} else {
-			nss_error("net_starttls / SSL_ForceHandshake");
-			/* TODO : Close the connection. */
-			return;
-		}
-	}
-	client->ssl_connected = 1;
 #endif /* WITH_OPENSSL | WITH_NSS */
+
+#ifdef NETSSL_HANDSHAKE_WORKERS
+	if (ssl_handshake_queue(client)) {
+		/* mainloop() picks it up from ssl_handshake_collect() */
+		return;
+	}
+#endif
+
+	gettimeofday(&start, NULL);
+	client->ssl_connected = ssl_handshake(client);
+	gettimeofday(&end, NULL);
+	netstats_handshake(client->ssl_connected, difftimeval(end, start));
 }
 
 void ssl_init(void)
@@ -509,6 +833,15 @@ void ssl_init(void)
 
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
+	/* Let reconnecting clients resume their session (by ID, or with
+	 * a ticket which OpenSSL issues by default) instead of doing the
+	 * full key exchange again */
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+	if (SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *)"upsd", 4) != 1) {
+		ssl_debug();
+	}
+	SSL_CTX_set_timeout(ssl_ctx, NETSSL_SESSION_TIMEOUT);
+
 	ssl_initialized = 1;
 
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
@@ -548,6 +881,14 @@ void ssl_init(void)
 		return;
 	}
 
+#ifdef SSL_ENABLE_SESSION_TICKETS
+	/* resumption without keeping state for each client here */
+	status = SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS, PR_TRUE);
+	if (status != SECSuccess) {
+		nss_error("ssl_init / SSL_OptionSetDefault(SSL_ENABLE_SESSION_TICKETS)");
+	}
+#endif
+
 	if (!disable_weak_ssl) {
 		status = SSL_OptionSetDefault(SSL_ENABLE_SSL3, PR_TRUE);
 		if (status != SECSuccess) {
@@ -645,6 +986,12 @@ void ssl_init(void)
 #else /* WITH_OPENSSL | WITH_NSS */
 	upslogx(LOG_ERR, "ssl_init called but SSL wasn't compiled in");
 #endif /* WITH_OPENSSL | WITH_NSS */
+
+#ifdef NETSSL_HANDSHAKE_WORKERS
+	if (ssl_initialized) {
+		ssl_handshake_start();
+	}
+#endif
 }
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP_BESIDEFUNC) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS_BESIDEFUNC) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE_BESIDEFUNC) )
@@ -744,6 +1091,10 @@ void ssl_finish(nut_ctype_t *client)
 
 void ssl_cleanup(void)
 {
+#ifdef NETSSL_HANDSHAKE_WORKERS
+	ssl_handshake_stop();
+#endif
+
 #ifdef WITH_OPENSSL
 	if (ssl_ctx) {
 		SSL_CTX_free(ssl_ctx);
@@ -764,3 +1115,16 @@ void ssl_cleanup(void)
 }
 
 #endif /* WITH_SSL */
+
+#ifndef NETSSL_HANDSHAKE_WORKERS
+/* handshakes are always done inline by net_starttls() */
+int ssl_handshake_fd(void)
+{
+	return -1;
+}
+
+nut_ctype_t *ssl_handshake_collect(void)
+{
+	return NULL;
+}
+#endif /* !NETSSL_HANDSHAKE_WORKERS */
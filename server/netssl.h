@@ -44,6 +44,20 @@ extern int certrequest;
 /* Required (cnx failed if no certificate or invalid CA chain) */
 #define NETSSL_CERTREQ_REQUIRE	2
 
+/* STARTTLS handshakes can be done by worker threads, so that they do
+ * not hold up the main loop; see SSL_HANDSHAKE_WORKERS in upsd.conf */
+#if (defined WITH_SSL) && (defined HAVE_PTHREAD) && !(defined WIN32)
+# define NETSSL_HANDSHAKE_WORKERS	1
+#endif
+#define NETSSL_HANDSHAKE_WORKERS_DEFAULT	4
+#define NETSSL_HANDSHAKE_WORKERS_MAX	64
+/* seconds a handshake may wait for the peer before it fails */
+#define NETSSL_HANDSHAKE_TIMEOUT	10
+/* seconds a session can be resumed by a reconnecting client */
+#define NETSSL_SESSION_TIMEOUT	3600
+
+extern int	ssl_handshake_workers;
+
 
 void ssl_init(void);
 void ssl_finish(nut_ctype_t *client);
@@ -54,6 +68,11 @@ ssize_t ssl_write(nut_ctype_t *client, const char *buf, size_t buflen);
 
 void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg);
 
+/* for mainloop(): readable when handshakes finished, and the clients
+ * whose handshake is done (one per call, NULL when there are no more) */
+int ssl_handshake_fd(void);
+nut_ctype_t *ssl_handshake_collect(void);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
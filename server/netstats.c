@@ -0,0 +1,203 @@
+/* netstats.c - counters of upsd's own load, and LIST STATS
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include <ctype.h>
+
+#include "upsd.h"
+#include "state.h"
+#include "desc.h"
+#include "history.h"
+#include "netcmds.h"
+#include "netstats.h"
+
+netstats_t	netstats;
+
+/* time spent in the handler of each command (indexed like netcmds[]) */
+static struct {
+	uint64_t	count;
+	double	seconds, max;
+} netstats_cmds[sizeof(netcmds) / sizeof(netcmds[0])];
+
+static uint64_t	tls_handshakes = 0, tls_failed = 0;
+static double	tls_seconds = 0, tls_max = 0;
+
+void netstats_init(void)
+{
+	memset(&netstats, 0, sizeof(netstats));
+	memset(netstats_cmds, 0, sizeof(netstats_cmds));
+	tls_handshakes = tls_failed = 0;
+	tls_seconds = tls_max = 0;
+
+	time(&netstats.started);
+}
+
+void netstats_command(size_t cmdnum, const struct timeval *start)
+{
+	struct timeval	now;
+	double	seconds;
+
+	gettimeofday(&now, NULL);
+	seconds = difftimeval(now, *start);
+
+	netstats_cmds[cmdnum].count++;
+	netstats_cmds[cmdnum].seconds += seconds;
+	if (seconds > netstats_cmds[cmdnum].max) {
+		netstats_cmds[cmdnum].max = seconds;
+	}
+}
+
+void netstats_handshake(int ok, double seconds)
+{
+	tls_handshakes++;
+	if (!ok) {
+		tls_failed++;
+	}
+
+	tls_seconds += seconds;
+	if (seconds > tls_max) {
+		tls_max = seconds;
+	}
+}
+
+static double netstats_avg(double total, uint64_t count)
+{
+	return count ? total / (double)count : 0;
+}
+
+void netstats_list(nut_ctype_t *client)
+{
+	const nut_ctype_t	*c;
+	const upstype_t	*ups;
+	uint64_t	connected = 0, bytes_out = netstats.bytes_out;
+	size_t	clientmem = 0, buffermem = 0;
+	time_t	now;
+	size_t	i;
+
+	time(&now);
+
+	/* what the clients still here were sent is counted upon disconnect */
+	for (c = firstclient; c; c = c->next) {
+		connected++;
+		bytes_out += c->outbytes;
+
+		clientmem += sizeof(*c);
+		clientmem += (c->addr ? strlen(c->addr) + 1 : 0);
+		clientmem += (c->loginups ? strlen(c->loginups) + 1 : 0);
+		clientmem += (c->password ? strlen(c->password) + 1 : 0);
+		clientmem += (c->username ? strlen(c->username) + 1 : 0);
+		buffermem += c->outsize;
+	}
+
+	if (!sendback(client, "BEGIN LIST STATS\n"))
+		return;
+
+#define STAT(name, fmt, val)	\
+	if (!sendback(client, "STATS " name " \"" fmt "\"\n", val))	\
+		return
+
+	STAT("server.pid", "%" PRIdMAX, (intmax_t)getpid());
+	STAT("server.uptime", "%.0f", difftime(now, netstats.started));
+
+	STAT("clients.connected", "%" PRIu64, connected);
+	STAT("clients.accepted", "%" PRIu64, netstats.accepted);
+	STAT("clients.disconnected", "%" PRIu64, netstats.disconnected);
+	STAT("clients.rejected", "%" PRIu64, netstats.rejected);
+	STAT("clients.ratelimited", "%" PRIu64, netstats.ratelimited);
+	STAT("clients.peak", "%" PRIuSIZE, netstats.peak);
+	STAT("clients.max", "%" PRIdMAX, (intmax_t)maxconn);
+
+	STAT("net.bytes.in", "%" PRIu64, netstats.bytes_in);
+	STAT("net.bytes.out", "%" PRIu64, bytes_out);
+
+	STAT("loop.wakeups", "%" PRIu64, netstats.wakeups);
+	STAT("loop.ready.avg", "%.2f", netstats_avg((double)netstats.ready, netstats.wakeups));
+
+	STAT("tls.handshakes", "%" PRIu64, tls_handshakes);
+	STAT("tls.handshakes.failed", "%" PRIu64, tls_failed);
+	STAT("tls.handshake.time.avg", "%.6f", netstats_avg(tls_seconds, tls_handshakes));
+	STAT("tls.handshake.time.max", "%.6f", tls_max);
+
+	/* what upsd allocated for these, as allocated (not what the TLS
+	 * and zlib libraries keep for a connection) */
+	STAT("memory.clients", "%" PRIuSIZE, clientmem);
+	STAT("memory.clients.buffers", "%" PRIuSIZE, buffermem);
+	STAT("memory.parsers", "%" PRIuSIZE, client_ctx_bytes(0));
+	STAT("memory.parser.shared", "%" PRIuSIZE, client_ctx_bytes(1));
+	STAT("memory.desc", "%" PRIuSIZE, desc_bytes());
+	STAT("memory.state.shared", "%" PRIuSIZE, state_shared_bytes());
+
+#undef STAT
+
+	for (i = 0; netcmds[i].name; i++) {
+		char	name[SMALLBUF];
+		size_t	j;
+
+		/* aliases (e.g. PROTVER) are counted on their own */
+		for (j = 0; netcmds[i].name[j] && j < sizeof(name) - 1; j++) {
+			name[j] = (char)tolower((unsigned char)netcmds[i].name[j]);
+		}
+		name[j] = '\0';
+
+		if (!sendback(client, "STATS commands.%s.count \"%" PRIu64 "\"\n"
+			"STATS commands.%s.time \"%.6f\"\n"
+			"STATS commands.%s.time.avg \"%.6f\"\n"
+			"STATS commands.%s.time.max \"%.6f\"\n",
+			name, netstats_cmds[i].count,
+			name, netstats_cmds[i].seconds,
+			name, netstats_avg(netstats_cmds[i].seconds, netstats_cmds[i].count),
+			name, netstats_cmds[i].max)
+		) {
+			return;
+		}
+	}
+
+	if (!sendback(client, "STATS commands.unknown.count \"%" PRIu64 "\"\n",
+		netstats.unknown)
+	) {
+		return;
+	}
+
+	for (ups = firstups; ups; ups = ups->next) {
+		double	elapsed = INVALID_FD(ups->sock_fd) ? 0 : difftime(now, ups->stat_connected);
+
+		if (!sendback(client, "STATS driver.%s.setinfo \"%" PRIu64 "\"\n"
+			"STATS driver.%s.setinfo.rate \"%.2f\"\n"
+			"STATS driver.%s.dumpall.time \"%.6f\"\n",
+			ups->name, ups->stat_setinfo,
+			ups->name, (elapsed > 0
+				? (double)(ups->stat_setinfo - ups->stat_setinfo_base) / elapsed
+				: 0),
+			ups->name, ups->stat_dumptime)
+		) {
+			return;
+		}
+	}
+
+	for (ups = firstups; ups; ups = ups->next) {
+		if (!sendback(client, "STATS memory.ups.%s.tree \"%" PRIuSIZE "\"\n"
+			"STATS memory.ups.%s.history \"%" PRIuSIZE "\"\n",
+			ups->name, state_tree_bytes(ups->inforoot),
+			ups->name, history_bytes(ups->history))
+		) {
+			return;
+		}
+	}
+
+	sendback(client, "END LIST STATS\n");
+}
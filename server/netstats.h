@@ -0,0 +1,67 @@
+/* netstats.h - counters of upsd's own load, for LIST STATS
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETSTATS_H_SEEN
+#define NUT_NETSTATS_H_SEEN 1
+
+#include "timehead.h"
+#include "nut_stdint.h"
+#include "nut_ctype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* Plain counters, bumped where things happen and only added up when
+ * asked for, so they are always on.  Each process (see WORKERS) keeps
+ * its own: they tell what the process serving the query did. */
+typedef struct {
+	time_t	started;
+	uint64_t	accepted;	/* connections from the listeners */
+	uint64_t	disconnected;
+	uint64_t	rejected;	/* closed at once: MAXCONN reached */
+	uint64_t	ratelimited;	/* closed at once: MAXCONNRATE exceeded */
+	size_t		peak;		/* most clients connected at a time */
+	uint64_t	bytes_in;	/* read from the clients */
+	uint64_t	bytes_out;	/* written to the clients gone so far */
+	uint64_t	wakeups;	/* returns from poll() or its equivalents */
+	uint64_t	ready;		/* descriptors they reported ready */
+	uint64_t	unknown;	/* commands not in netcmds[] */
+} netstats_t;
+
+extern netstats_t	netstats;
+
+void netstats_init(void);
+
+/* a command of netcmds[] was handled, since <start> */
+void netstats_command(size_t cmdnum, const struct timeval *start);
+
+/* a STARTTLS handshake took <seconds>, and succeeded or not */
+void netstats_handshake(int ok, double seconds);
+
+/* LIST STATS */
+void netstats_list(nut_ctype_t *client);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETSTATS_H_SEEN */
@@ -52,7 +52,8 @@ void net_login(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	/* make sure this is a valid user */
-	if (!user_checkaction(client->username, client->password, "LOGIN")) {
+	if (!user_checkaction(client->username, client->password, "LOGIN",
+		&client->auth)) {
 		upsdebugx(3, "%s: not a valid user: %s",
 			__func__, client->username);
 		send_err(client, NUT_ERR_ACCESS_DENIED);
@@ -82,7 +83,7 @@ void net_logout(nut_ctype_t *client, size_t numarg, const char **arg)
 
 	sendback(client, "OK Goodbye\n");
 
-	client->last_heard = 0;
+	client_expire(client);
 }
 
 /* NOTE: Protocol updated since NUT 2.8.0 to handle master/primary
@@ -105,8 +106,10 @@ static int do_net_primary(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	/* make sure this user is allowed to do PRIMARY or MASTER */
-	if (!user_checkaction(client->username, client->password, "PRIMARY")
-	&&  !user_checkaction(client->username, client->password, "MASTER")
+	if (!user_checkaction(client->username, client->password, "PRIMARY",
+		&client->auth)
+	&&  !user_checkaction(client->username, client->password, "MASTER",
+		&client->auth)
 	) {
 		send_err(client, NUT_ERR_ACCESS_DENIED);
 		return -1;
@@ -0,0 +1,247 @@
+/* netwatch.c - WATCH handlers for upsd, pushing variable changes
+   reported by the drivers to the clients which subscribed to them
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+#include "neterr.h"
+#include "netrelay.h"
+
+#include "netwatch.h"
+
+/* each change reported by a driver is matched against these */
+#define WATCH_MAX_PER_CLIENT	32
+
+/* one subscription: a device, and variable name prefix ("" for all) */
+struct watch_s {
+	char	*ups;
+	char	*prefix;
+	size_t	prefixlen;
+	struct watch_s	*next;
+};
+
+/* subscriptions of all clients, to not bother when nobody watches */
+static size_t	watch_total = 0;
+
+static struct watch_s *watch_find(nut_ctype_t *client, const char *ups, const char *prefix)
+{
+	struct watch_s	*w;
+
+	for (w = client->watches; w; w = w->next) {
+		if (!strcasecmp(w->ups, ups) && !strcasecmp(w->prefix, prefix)) {
+			return w;
+		}
+	}
+
+	return NULL;
+}
+
+static void watch_del(nut_ctype_t *client, struct watch_s *target)
+{
+	struct watch_s	**wptr;
+
+	for (wptr = &client->watches; *wptr; wptr = &(*wptr)->next) {
+		if (*wptr != target) {
+			continue;
+		}
+
+		*wptr = target->next;
+
+		free(target->ups);
+		free(target->prefix);
+		free(target);
+
+		client->numwatches--;
+		watch_total--;
+		return;
+	}
+}
+
+/* does any subscription of this client cover the variable? */
+static int watch_match(const nut_ctype_t *client, const upstype_t *ups, const char *var)
+{
+	const struct watch_s	*w;
+
+	for (w = client->watches; w; w = w->next) {
+		if (strcasecmp(w->ups, ups->name)) {
+			continue;
+		}
+
+		if (!strncasecmp(w->prefix, var, w->prefixlen)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* WATCH <ups> [<varprefix>] */
+void net_watch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	const upstype_t	*ups;
+	const char	*prefix;
+	struct watch_s	*w;
+
+	if (numarg < 1 || numarg > 2) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	prefix = (numarg > 1 ? arg[1] : "");
+
+	if (watch_find(client, ups->name, prefix)) {
+		/* nothing new */
+		sendback(client, "OK\n");
+		return;
+	}
+
+	if (client->numwatches >= WATCH_MAX_PER_CLIENT) {
+		upsdebugx(2, "%s: client %s has too many subscriptions",
+			__func__, client->addr);
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	w = xcalloc(1, sizeof(*w));
+	w->ups = xstrdup(ups->name);
+	w->prefix = xstrdup(prefix);
+	w->prefixlen = strlen(prefix);
+	w->next = client->watches;
+
+	client->watches = w;
+	client->numwatches++;
+	watch_total++;
+
+	upsdebugx(3, "%s: client %s watches UPS [%s] variables [%s*]",
+		__func__, client->addr, ups->name, prefix);
+
+	sendback(client, "OK\n");
+}
+
+/* the WATCH commands which subscribe another connection the same way,
+ * appended to buf (see worker_handoff()); 0 if they did not fit */
+int watch_encode(const nut_ctype_t *client, char *buf, size_t bufsize)
+{
+	const struct watch_s	*w;
+	char	eups[SMALLBUF], eprefix[SMALLBUF];
+
+	for (w = client->watches; w; w = w->next) {
+		snprintfcat(buf, bufsize, "WATCH \"%s\" \"%s\"\n",
+			pconf_encode(w->ups, eups, sizeof(eups)),
+			pconf_encode(w->prefix, eprefix, sizeof(eprefix)));
+	}
+
+	return (strlen(buf) + 1 < bufsize);
+}
+
+/* UNWATCH [<ups> [<varprefix>]] */
+void net_unwatch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	struct watch_s	*w;
+
+	if (numarg > 2) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (numarg == 0) {
+		watch_free(client);
+		sendback(client, "OK\n");
+		return;
+	}
+
+	w = watch_find(client, arg[0], (numarg > 1 ? arg[1] : ""));
+
+	if (!w) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	watch_del(client, w);
+
+	sendback(client, "OK\n");
+}
+
+void watch_notify_setinfo(const upstype_t *ups, const char *var)
+{
+	nut_ctype_t	*client;
+	const char	*val;
+
+	/* the other upsd fed with the device wants all of them */
+	relay_setinfo(ups, var);
+
+	if (!watch_total) {
+		return;
+	}
+
+	val = state_getinfo(ups->inforoot, var);
+
+	if (!val) {
+		return;
+	}
+
+	for (client = firstclient; client; client = client->next) {
+		if (!client->watches || !watch_match(client, ups, var)) {
+			continue;
+		}
+
+		/* status is always a special case, like in LIST VAR */
+		if ((ups->fsd == 1) && (!strcasecmp(var, "ups.status"))) {
+			sendback(client, "NOTIFY VAR %s %s \"FSD %s\"\n",
+				ups->name, var, val);
+		} else {
+			sendback(client, "NOTIFY VAR %s %s \"%s\"\n",
+				ups->name, var, val);
+		}
+	}
+}
+
+void watch_notify_delinfo(const upstype_t *ups, const char *var)
+{
+	nut_ctype_t	*client;
+
+	relay_delinfo(ups, var);
+
+	if (!watch_total) {
+		return;
+	}
+
+	for (client = firstclient; client; client = client->next) {
+		if (!client->watches || !watch_match(client, ups, var)) {
+			continue;
+		}
+
+		sendback(client, "NOTIFY DELVAR %s %s\n", ups->name, var);
+	}
+}
+
+void watch_free(nut_ctype_t *client)
+{
+	while (client->watches) {
+		watch_del(client, client->watches);
+	}
+}
@@ -0,0 +1,223 @@
+/* netzip.c - COMPRESS DEFLATE of client connections for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* A client polling a few UPSes over a slow or metered link gets the same
+ * LIST VAR answers again and again, which deflate shrinks to a fraction:
+ * after COMPRESS DEFLATE both directions are one raw deflate stream
+ * (RFC 1951) each, for the rest of the connection.  The streams are kept
+ * for the connection, so a reply is also compressed against the previous
+ * ones; each reply (and each command of the client) ends with a sync
+ * flush, so it can be read as soon as it arrives. */
+
+#include "common.h"
+
+#include "upsd.h"
+#include "neterr.h"
+
+#include "netzip.h"
+
+#ifdef WITH_ZLIB
+# include <zlib.h>
+
+/* what we compress with: a 16 KiB window and smaller hash tables than
+ * the defaults, about 100 KiB per client instead of 256 KiB (the client
+ * may use any window, up to 32 KiB, for what it sends) */
+# define ZIP_WINDOW_BITS	14
+# define ZIP_MEM_LEVEL	6
+
+struct zip_s {
+	z_stream	out;	/* deflate, to the client */
+	z_stream	in;	/* inflate, from the client */
+};
+
+/* COMPRESS DEFLATE */
+void net_compress(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	struct zip_s	*zip;
+
+	if (numarg != 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (strcasecmp(arg[0], "DEFLATE")) {
+		send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
+		return;
+	}
+
+	if (client->zip) {
+		/* nothing to change */
+		sendback(client, "OK COMPRESS DEFLATE\n");
+		return;
+	}
+
+	zip = xcalloc(1, sizeof(*zip));
+
+	if (deflateInit2(&zip->out, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		-ZIP_WINDOW_BITS, ZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK
+	) {
+		upslogx(LOG_ERR, "%s: can't set up deflate for %s", __func__, client->addr);
+		free(zip);
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		return;
+	}
+
+	if (inflateInit2(&zip->in, -MAX_WBITS) != Z_OK) {
+		upslogx(LOG_ERR, "%s: can't set up inflate for %s", __func__, client->addr);
+		deflateEnd(&zip->out);
+		free(zip);
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		return;
+	}
+
+	/* the last words in the clear */
+	if (!sendback(client, "OK COMPRESS DEFLATE\n")) {
+		deflateEnd(&zip->out);
+		inflateEnd(&zip->in);
+		free(zip);
+		return;
+	}
+
+	client->zip = zip;
+
+	upsdebugx(1, "%s: compressing the connection of %s", __func__, client->addr);
+}
+
+void zip_free(nut_ctype_t *client)
+{
+	if (!client->zip) {
+		return;
+	}
+
+	upsdebugx(2, "%s: %s: sent %lu bytes as %lu, read %lu as %lu", __func__,
+		client->addr, client->zip->out.total_in, client->zip->out.total_out,
+		client->zip->in.total_out, client->zip->in.total_in);
+
+	deflateEnd(&client->zip->out);
+	inflateEnd(&client->zip->in);
+	free(client->zip);
+	client->zip = NULL;
+}
+
+int zip_deflate(nut_ctype_t *client, const void *buf, size_t len, int flush,
+	int (*send)(nut_ctype_t *client, const void *buf, size_t len))
+{
+	z_stream	*z = &client->zip->out;
+	unsigned char	out[LARGEBUF];
+	size_t	have;
+	int	ret;
+
+	z->next_in = (Bytef *)buf;
+	z->avail_in = (uInt)len;
+
+	/* until the input is taken, and (as the output buffer was not
+	 * filled up) nothing more is pending in the stream */
+	do {
+		z->next_out = out;
+		z->avail_out = sizeof(out);
+
+		ret = deflate(z, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR) {
+			upslogx(LOG_ERR, "%s: deflate failed for %s", __func__, client->addr);
+			client_expire(client);
+			return 0;
+		}
+
+		have = sizeof(out) - z->avail_out;
+		if (have > 0 && !send(client, out, have)) {
+			return 0;
+		}
+	} while (z->avail_out == 0);
+
+	return 1;
+}
+
+int zip_inflate(nut_ctype_t *client, const void *buf, size_t len,
+	void (*feed)(nut_ctype_t *client, const char *buf, size_t len))
+{
+	z_stream	*z = &client->zip->in;
+	char	out[SMALLBUF];
+	size_t	have;
+	int	ret;
+
+	z->next_in = (Bytef *)buf;
+	z->avail_in = (uInt)len;
+
+	do {
+		z->next_out = (Bytef *)out;
+		z->avail_out = sizeof(out);
+
+		ret = inflate(z, Z_SYNC_FLUSH);
+		if (ret == Z_BUF_ERROR) {
+			/* all taken, nothing more to give */
+			break;
+		}
+
+		if (ret != Z_OK) {
+			/* Z_STREAM_END too: the client may not end it */
+			upslogx(LOG_NOTICE, "Bad compressed data from %s: %s",
+				client->addr, z->msg ? z->msg : "end of stream");
+			return 0;
+		}
+
+		have = sizeof(out) - z->avail_out;
+		if (have > 0) {
+			feed(client, out, have);
+		}
+
+		if (client->outoverflow) {
+			/* do not bother with the rest */
+			break;
+		}
+	} while (z->avail_in > 0 || z->avail_out == 0);
+
+	return 1;
+}
+
+#else	/* !WITH_ZLIB */
+
+/* stubs for builds without zlib */
+void net_compress(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	NUT_UNUSED_VARIABLE(numarg);
+	NUT_UNUSED_VARIABLE(arg);
+
+	send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
+}
+
+void zip_free(nut_ctype_t *client)
+{
+	NUT_UNUSED_VARIABLE(client);
+}
+
+int zip_deflate(nut_ctype_t *client, const void *buf, size_t len, int flush,
+	int (*send)(nut_ctype_t *client, const void *buf, size_t len))
+{
+	NUT_UNUSED_VARIABLE(flush);
+
+	return send(client, buf, len);
+}
+
+int zip_inflate(nut_ctype_t *client, const void *buf, size_t len,
+	void (*feed)(nut_ctype_t *client, const char *buf, size_t len))
+{
+	feed(client, (const char *)buf, len);
+
+	return 1;
+}
+
+#endif	/* WITH_ZLIB */
@@ -0,0 +1,51 @@
+/* netzip.h - COMPRESS DEFLATE of client connections for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETZIP_H_SEEN
+#define NUT_NETZIP_H_SEEN 1
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* COMPRESS DEFLATE; client->zip is non-NULL while it is on */
+void net_compress(nut_ctype_t *client, size_t numarg, const char **arg);
+
+/* end the compression of a client (upon disconnect) */
+void zip_free(nut_ctype_t *client);
+
+/* Compress len bytes of buf for the client, and hand what comes out to
+ * send(); flush: the reply is complete, all of it must go out now (else
+ * more is expected, as while corked).  Returns what send() did, 0 if it
+ * failed, 1 otherwise */
+int zip_deflate(nut_ctype_t *client, const void *buf, size_t len, int flush,
+	int (*send)(nut_ctype_t *client, const void *buf, size_t len));
+
+/* Decompress len bytes which the client sent, and hand the text to
+ * feed(); returns 0 if they are not a deflate stream, 1 otherwise */
+int zip_inflate(nut_ctype_t *client, const void *buf, size_t len,
+	void (*feed)(nut_ctype_t *client, const char *buf, size_t len));
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETZIP_H_SEEN */
@@ -38,6 +38,8 @@
 #endif
 
 #include "parseconf.h"
+#include "timer.h"
+#include "user.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -50,9 +52,11 @@ typedef struct nut_ctype_s {
 	char	*addr;
 	TYPE_FD_SOCK	sock_fd;
 	time_t	last_heard;
+	upsd_timer_t	idle_timer;	/* see client_idle() */
 	char	*loginups;
 	char	*password;
 	char	*username;
+	user_auth_t	auth;	/* see user_checkaction() */
 	/* per client status info for commands and settings
 	 * (disabled by default) */
 	int	tracking;
@@ -65,8 +69,53 @@ typedef struct nut_ctype_s {
 	void *ssl;
 #endif
 	int	ssl_connected;
+	int	ssl_handshaking;	/* left to a worker thread, see netssl.c */
+	int	ssl_dropped;	/* disconnect once the handshake is back */
 
-	PCONF_CTX_t	ctx;
+	/* the parser of its commands: its own, or with LOWMEM the one
+	 * shared by the clients between lines, see client_ctx_take() */
+	PCONF_CTX_t	*ctx;
+
+	/* what it sent beyond the commands handled in one pass of
+	 * mainloop(), see client_feed() */
+	char	inpend[SMALLBUF];
+	size_t	inpendlen;
+
+	/* replies which the socket did not accept yet, see sendback() */
+	char	*outbuf;
+	size_t	outsize;	/* allocated size of outbuf */
+	size_t	outhead;	/* offset of the first unsent byte */
+	size_t	outlen;		/* amount of unsent bytes */
+	size_t	outstalls;	/* times the peer was too slow to keep up */
+	int	outoverflow;	/* MAXCLIENTQUEUE exceeded, disconnect pending */
+	int	corked;		/* collect replies, see sendback_cork() */
+
+	/* totals for the connection, to see what each command costs */
+	size_t	outbytes;	/* bytes accepted by the socket */
+	size_t	outwrites;	/* write()/ssl_write() calls made */
+
+	/* WATCH subscriptions, see netwatch.c */
+	struct watch_s	*watches;
+	size_t	numwatches;
+
+	/* FRAMING BINARY of replies, see netbinary.c */
+	struct binary_s	*binary;
+
+	/* COMPRESS DEFLATE of both directions, see netzip.c */
+	struct zip_s	*zip;
+
+	/* RELAY: the device it is fed, see netrelay.c */
+	char	*relay;
+	int	relaystale;	/* DATASTALE was the last it was told */
+
+	/* HTTP request of a METRICS client, see netmetrics.c */
+	struct metrics_req_s	*metrics;
+	int	closing;	/* disconnect once the output is flushed */
+
+	/* WORKERS, see worker_handoff() */
+	int	handoff;	/* the command is for the main process */
+	int	handedoff;	/* the socket is not ours to shut down */
+	int	muted;		/* replaying its settings, replies are dropped */
 
 	/* doubly linked list */
 	struct nut_ctype_s	*prev;
@@ -0,0 +1,401 @@
+/* snapshot.c - what upsd knew of the drivers, kept over a restart
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "binframe.h"
+#include "snapshot.h"
+
+/* The file is SNAPSHOT_MAGIC, then records framed like binframe.h's:
+ * type (1 byte), length of the payload (2 bytes), payload:
+ *   CLOCK:	time() (8 bytes) and our stamp token (8 bytes) when saved
+ *   UPS:	STAMP of the driver (8 bytes), name; the records up to the
+ *		next UPS are about this one
+ *   VAR:	flags (4 bytes), aux (8 bytes), name, NUL, raw value
+ *   ENUM:	name, NUL, value
+ *   RANGE:	min (4 bytes), max (4 bytes), name
+ *   CMD:	name
+ * Anything it does not understand makes the whole file ignored. */
+#define SNAPSHOT_MAGIC		"NUTSNAP1"
+#define SNAPSHOT_MAGIC_LEN	8
+
+#define SNAP_CLOCK	0x01
+#define SNAP_UPS	0x02
+#define SNAP_VAR	0x03
+#define SNAP_ENUM	0x04
+#define SNAP_RANGE	0x05
+#define SNAP_CMD	0x06
+
+/* the clocks may differ this much (seconds) over the restart before
+ * we take it for a reboot, which the stamps of the drivers do not
+ * survive (they are those of a monotonic clock) */
+#define SNAPSHOT_CLOCK_SLACK	5
+
+typedef struct snapshot_ups_s {
+	char	*name;
+	uintmax_t	stamp;
+	st_tree_t	*inforoot;
+	cmdlist_t	*cmdlist;
+	struct snapshot_ups_s	*next;
+} snapshot_ups_t;
+
+static snapshot_ups_t	*snapshot_list = NULL;
+
+static void snapshot_path(char *buf, size_t bufsize, const char *suffix)
+{
+	snprintf(buf, bufsize, "%s/%s%s", statepath, SNAPSHOT_FILE, suffix);
+}
+
+static void snapshot_ups_free(snapshot_ups_t *snap)
+{
+	state_infofree(snap->inforoot);
+	state_cmdfree(snap->cmdlist);
+	free(snap->name);
+	free(snap);
+}
+
+void snapshot_free(void)
+{
+	snapshot_ups_t	*snap, *next;
+
+	for (snap = snapshot_list; snap; snap = next) {
+		next = snap->next;
+		upsdebugx(2, "%s: UPS [%s] is gone, dropping its snapshot", __func__, snap->name);
+		snapshot_ups_free(snap);
+	}
+
+	snapshot_list = NULL;
+}
+
+/* a NUL-terminated string at the start of buf (of len bytes), or NULL */
+static const char *snapshot_str(const unsigned char *buf, size_t len, size_t *used)
+{
+	const unsigned char	*nul = memchr(buf, '\0', len);
+
+	if (!nul) {
+		return NULL;
+	}
+
+	*used = (size_t)(nul - buf) + 1;
+	return (const char *)buf;
+}
+
+/* one record of the file into the list; 0 if it makes no sense.
+ * newclock is -1 until the CLOCK record (which comes first) is read,
+ * then 1 if the system restarted since the file was written, else 0 */
+static int snapshot_record(unsigned int type, unsigned char *rec, size_t len,
+	int *newclock)
+{
+	snapshot_ups_t	*snap = snapshot_list;
+	const char	*name;
+	size_t	used;
+
+	/* the payloads of strings are not NUL-terminated in the file */
+	rec[len] = '\0';
+
+	if (type == SNAP_CLOCK) {
+		st_tree_timespec_t	now;
+		int64_t	wall, mono;
+		double	skew;
+
+		if (len != 16 || *newclock >= 0) {
+			return 0;
+		}
+
+		wall = binframe_get_i64(rec);
+		mono = binframe_get_i64(rec + 8);
+		state_get_timestamp(&now);
+
+		if (difftime(time(NULL), (time_t)wall) > SNAPSHOT_MAX_AGE) {
+			upsdebugx(1, "%s: the snapshot is too old", __func__);
+			return 0;
+		}
+
+		skew = difftime(time(NULL), (time_t)wall)
+			- ((double)state_timestamp_token(&now) - (double)mono) / 1000000.0;
+		*newclock = (skew > SNAPSHOT_CLOCK_SLACK || skew < -SNAPSHOT_CLOCK_SLACK);
+		return 1;
+	}
+
+	if (*newclock < 0) {
+		return 0;
+	}
+
+	if (type == SNAP_UPS) {
+		if (len < 9 || !(name = snapshot_str(rec + 8, len - 8, &used))) {
+			return 0;
+		}
+
+		snap = (snapshot_ups_t *)xcalloc(1, sizeof(*snap));
+		snap->name = xstrdup(name);
+		/* stamps from before a reboot mean nothing to the drivers */
+		snap->stamp = *newclock ? 0 : (uintmax_t)binframe_get_i64(rec);
+		snap->next = snapshot_list;
+		snapshot_list = snap;
+		return 1;
+	}
+
+	if (!snap) {
+		return 0;
+	}
+
+	switch (type)
+	{
+	case SNAP_VAR:
+		{
+			st_tree_t	*node;
+
+			if (len < 13 || !(name = snapshot_str(rec + 12, len - 12, &used))) {
+				return 0;
+			}
+
+			if (state_setinfo(&snap->inforoot, name, (char *)rec + 12 + used) < 0
+			 || !(node = state_tree_find(snap->inforoot, name))
+			) {
+				return 0;
+			}
+
+			node->flags = (int)binframe_get_u32(rec);
+			node->aux = (long)binframe_get_i64(rec + 4);
+			return 1;
+		}
+
+	case SNAP_ENUM:
+		if (!(name = snapshot_str(rec, len, &used))) {
+			return 0;
+		}
+
+		return state_addenum(snap->inforoot, name, (char *)rec + used) >= 0;
+
+	case SNAP_RANGE:
+		if (len < 9) {
+			return 0;
+		}
+
+		return state_addrange(snap->inforoot, (char *)rec + 8,
+			(int)binframe_get_u32(rec), (int)binframe_get_u32(rec + 4)) >= 0;
+
+	case SNAP_CMD:
+		return state_addcmd(&snap->cmdlist, (char *)rec) >= 0;
+
+	default:
+		return 0;
+	}
+}
+
+void snapshot_load(void)
+{
+	char	fn[SMALLBUF];
+	unsigned char	hdr[BINFRAME_HEADER_LEN], *rec;
+	FILE	*f;
+	int	ok = 1, newclock = -1;
+
+	snapshot_free();
+	snapshot_path(fn, sizeof(fn), "");
+
+	if ((f = fopen(fn, "rb")) == NULL) {
+		if (errno != ENOENT) {
+			upslog_with_errno(LOG_WARNING, "Can't open %s", fn);
+		}
+		return;
+	}
+
+	/* whatever comes of it, it is only good for this start */
+	unlink(fn);
+
+	rec = (unsigned char *)xmalloc(BINFRAME_MAX_LEN + 1);
+
+	if (fread(rec, 1, SNAPSHOT_MAGIC_LEN, f) != SNAPSHOT_MAGIC_LEN
+	 || memcmp(rec, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN)
+	) {
+		ok = 0;
+	}
+
+	while (ok && fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr)) {
+		size_t	len = ((size_t)hdr[1] << 8) | hdr[2];
+
+		ok = (fread(rec, 1, len, f) == len)
+			&& snapshot_record(hdr[0], rec, len, &newclock);
+	}
+
+	if (ok && ferror(f)) {
+		ok = 0;
+	}
+
+	fclose(f);
+	free(rec);
+
+	if (!ok) {
+		snapshot_free();
+		upslogx(LOG_WARNING, "Snapshot of the drivers in %s is unusable, not loaded", fn);
+		return;
+	}
+
+	upslogx(LOG_INFO, "Loaded the snapshot of the drivers from %s%s", fn,
+		newclock > 0 ? " (the system restarted since, so the drivers dump everything)" : "");
+}
+
+void snapshot_restore(upstype_t *ups)
+{
+	snapshot_ups_t	**pp, *snap;
+
+	for (pp = &snapshot_list; (snap = *pp) != NULL; pp = &snap->next) {
+		if (!strcmp(snap->name, ups->name)) {
+			break;
+		}
+	}
+
+	if (!snap) {
+		return;
+	}
+
+	*pp = snap->next;
+
+	state_infofree(ups->inforoot);
+	ups->inforoot = snap->inforoot;
+	snap->inforoot = NULL;
+	sstate_cmdfree(ups);
+	ups->cmdlist = snap->cmdlist;
+	snap->cmdlist = NULL;
+
+	ups->stamp = snap->stamp;
+	ups->provisional = 1;
+
+	upsdebugx(1, "%s: UPS [%s] starts with the data of the snapshot (stamp %" PRIuMAX ")",
+		__func__, ups->name, ups->stamp);
+
+	snapshot_ups_free(snap);
+}
+
+/* a record of the fixed head, then name (if any), then NUL and val (if any) */
+static int snapshot_put(FILE *f, unsigned int type, const unsigned char *head, size_t headlen,
+	const char *name, const char *val)
+{
+	unsigned char	hdr[BINFRAME_HEADER_LEN];
+	size_t	namelen = name ? strlen(name) : 0, vallen = val ? strlen(val) + 1 : 0;
+
+	if (headlen + namelen + vallen > BINFRAME_MAX_LEN) {
+		/* nothing that long is worth breaking the file for */
+		upsdebugx(1, "%s: %s is too long to be saved", __func__, name);
+		return 1;
+	}
+
+	binframe_header(hdr, type, headlen + namelen + vallen);
+
+	if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+	 || (headlen && fwrite(head, 1, headlen, f) != headlen)
+	 || (namelen && fwrite(name, 1, namelen, f) != namelen)
+	) {
+		return 0;
+	}
+
+	return !val || (fputc('\0', f) != EOF
+		&& (vallen == 1 || fwrite(val, 1, vallen - 1, f) == vallen - 1));
+}
+
+static int snapshot_save_ups(FILE *f, const upstype_t *ups)
+{
+	unsigned char	head[16];
+	const st_tree_t	*node;
+	const cmdlist_t	*cmd;
+
+	binframe_put_i64(head, (int64_t)ups->stamp);
+	if (!snapshot_put(f, SNAP_UPS, head, 8, ups->name, "")) {
+		return 0;
+	}
+
+	for (node = state_tree_next(ups->inforoot, NULL); node;
+		node = state_tree_next(ups->inforoot, node->name)
+	) {
+		const enum_t	*etmp;
+		const range_t	*rtmp;
+
+		binframe_put_u32(head, (uint32_t)node->flags);
+		binframe_put_i64(head + 4, (int64_t)node->aux);
+		if (!snapshot_put(f, SNAP_VAR, head, 12, node->var, node->raw)) {
+			return 0;
+		}
+
+		for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+			if (!snapshot_put(f, SNAP_ENUM, head, 0, node->var, etmp->val)) {
+				return 0;
+			}
+		}
+
+		for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+			binframe_put_u32(head, (uint32_t)rtmp->min);
+			binframe_put_u32(head + 4, (uint32_t)rtmp->max);
+			if (!snapshot_put(f, SNAP_RANGE, head, 8, node->var, NULL)) {
+				return 0;
+			}
+		}
+	}
+
+	for (cmd = ups->cmdlist; cmd; cmd = cmd->next) {
+		if (!snapshot_put(f, SNAP_CMD, head, 0, cmd->name, NULL)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+void snapshot_save(void)
+{
+	char	fn[SMALLBUF], tmpfn[SMALLBUF];
+	unsigned char	head[16];
+	st_tree_timespec_t	now;
+	const upstype_t	*ups;
+	FILE	*f;
+	int	ok, count = 0;
+
+	snapshot_path(fn, sizeof(fn), "");
+	snapshot_path(tmpfn, sizeof(tmpfn), ".tmp");
+
+	if ((f = fopen(tmpfn, "wb")) == NULL) {
+		upslog_with_errno(LOG_WARNING, "Can't write the snapshot of the drivers to %s", tmpfn);
+		return;
+	}
+
+	state_get_timestamp(&now);
+	binframe_put_i64(head, (int64_t)time(NULL));
+	binframe_put_i64(head + 8, (int64_t)state_timestamp_token(&now));
+	ok = fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LEN, f) == SNAPSHOT_MAGIC_LEN
+		&& snapshot_put(f, SNAP_CLOCK, head, 16, NULL, NULL);
+
+	for (ups = firstups; ok && ups; ups = ups->next) {
+		/* only what a driver told us, all of it */
+		if (INVALID_FD(ups->sock_fd) || !ups->dumpdone || !ups->inforoot) {
+			continue;
+		}
+
+		ok = snapshot_save_ups(f, ups);
+		count++;
+	}
+
+	if (fclose(f) || !ok || !count || rename(tmpfn, fn)) {
+		if (count) {
+			upslog_with_errno(LOG_WARNING, "Can't write the snapshot of the drivers to %s", tmpfn);
+		}
+		unlink(tmpfn);
+		return;
+	}
+
+	upsdebugx(1, "%s: saved %d UPS in %s", __func__, count, fn);
+}
@@ -0,0 +1,57 @@
+/* snapshot.h - what upsd knew of the drivers, kept over a restart
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_SNAPSHOT_H_SEEN
+#define NUT_SNAPSHOT_H_SEEN 1
+
+#include "upstype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* A clean exit saves the variables and commands of each driver in
+ * SNAPSHOT_FILE (in the state path), with the last STAMP the driver
+ * gave.  The next start loads them as provisional data, served until
+ * the first dump of the driver (only what changed since the STAMP,
+ * if the driver can tell) brings them up to date; see sstate.c. */
+#define SNAPSHOT_FILE	"upsd.snapshot"
+
+/* a snapshot older than this is not loaded (seconds) */
+#define SNAPSHOT_MAX_AGE	600
+
+/* read (and remove) the snapshot, before ups.conf is */
+void snapshot_load(void);
+
+/* give ups what the snapshot had for it, before it connects */
+void snapshot_restore(upstype_t *ups);
+
+/* forget what was not restored */
+void snapshot_free(void);
+
+/* write the snapshot of all the drivers, upon a clean exit */
+void snapshot_save(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_SNAPSHOT_H_SEEN */
@@ -27,7 +27,16 @@
 #include "sstate.h"
 #include "upsd.h"
 #include "upstype.h"
+#include "netwatch.h"
+#include "netmetrics.h"
+#include "netlist.h"
+#include "netagg.h"
+#include "history.h"
+#include "beacon.h"
+#include "netrelay.h"
 #include "nut_stdint.h"
+#include "nuttrace.h"
+#include "nut_usdt.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -37,8 +46,146 @@
 #ifndef WIN32
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netdb.h>
 #endif
 
+/* The first dump after a warm restart is done: a full one leaves out
+ * what the driver no longer has, and the commands are those it sent */
+static void sstate_provisional_done(upstype_t *ups)
+{
+	st_tree_t	*node, *next;
+	size_t	dropped = 0;
+
+	if (!ups->dumpdelta) {
+		for (node = state_tree_next(ups->inforoot, NULL); node; node = next) {
+			next = state_tree_next(ups->inforoot, node->name);
+
+			if (st_tree_node_compare_timestamp(node, &ups->dumpfrom) >= 0) {
+				continue;
+			}
+
+			/* the (interned) name outlives the node */
+			if (state_delinfo(&ups->inforoot, node->var) == 1) {
+				watch_notify_delinfo(ups, node->var);
+				dropped++;
+			}
+		}
+
+		if (dropped) {
+			state_get_timestamp(&ups->lastdel);
+			metrics_invalidate();
+		}
+	}
+
+	state_cmdfree(ups->cmdlist);
+	ups->cmdlist = ups->dumpcmds;
+	ups->dumpcmds = NULL;
+	ups->provisional = 0;
+	ups->generation++;
+
+	upslogx(LOG_INFO, "UPS [%s]: data restored from the snapshot is current now "
+		"(%s dump, %" PRIuSIZE " variables dropped)",
+		ups->name, ups->dumpdelta ? "changes only" : "full", dropped);
+}
+
+/* the shared list the driver numbered id, a new (empty) one if add */
+static st_list_t **sstate_list(upstype_t *ups, size_t id, int add)
+{
+	size_t	lo = 0, hi = ups->numlists, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ups->lists[mid].id == id) {
+			return &ups->lists[mid].list;
+		}
+		if (ups->lists[mid].id < id) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (!add) {
+		return NULL;
+	}
+
+	if (ups->numlists == ups->maxlists) {
+		ups->maxlists = (ups->maxlists ? ups->maxlists * 2 : 16);
+		ups->lists = xrealloc(ups->lists, ups->maxlists * sizeof(*ups->lists));
+	}
+
+	memmove(&ups->lists[lo + 1], &ups->lists[lo],
+		(ups->numlists - lo) * sizeof(*ups->lists));
+	ups->lists[lo].id = id;
+	ups->lists[lo].list = NULL;
+	ups->numlists++;
+
+	return &ups->lists[lo].list;
+}
+
+static void sstate_lists_free(upstype_t *ups)
+{
+	size_t	i;
+
+	for (i = 0; i < ups->numlists; i++) {
+		state_list_free(ups->lists[i].list);
+	}
+
+	free(ups->lists);
+	ups->lists = NULL;
+	ups->numlists = 0;
+	ups->maxlists = 0;
+}
+
+/* ENUMLIST <id> <enumval>..., RANGELIST <id> <min> <max>... */
+static int parse_list(upstype_t *ups, size_t numargs, char **arg, int ranges)
+{
+	st_list_t	**list;
+	unsigned long	id;
+	size_t	i;
+
+	if (!str_to_ulong_strict(arg[1], &id, 10) || id == 0)
+		return 0;
+
+	list = sstate_list(ups, (size_t)id, 1);
+
+	if (!ranges) {
+		for (i = 2; i < numargs; i++) {
+			state_list_addenum(list, arg[i]);
+		}
+		return 1;
+	}
+
+	for (i = 2; i + 1 < numargs; i += 2) {
+		state_list_addrange(list, atoi(arg[i]), atoi(arg[i + 1]));
+	}
+	return 1;
+}
+
+/* SETENUMS <varname> <id>, SETRANGES <varname> <id> */
+static int parse_setlist(upstype_t *ups, char **arg, int ranges)
+{
+	st_list_t	**list;
+	unsigned long	id;
+
+	if (!str_to_ulong_strict(arg[2], &id, 10))
+		return 0;
+
+	list = (id ? sstate_list(ups, (size_t)id, 0) : NULL);
+	if (id && !list) {
+		upslogx(LOG_WARNING, "UPS [%s]: %s of %s refers to list %lu, "
+			"which the driver did not send", ups->name, arg[0], arg[1], id);
+		return 1;
+	}
+
+	if ((ranges ? state_setranges : state_setenums)(ups->inforoot, arg[1],
+		list ? *list : NULL) == 1
+	) {
+		ups->generation++;
+	}
+	return 1;
+}
+
 static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 {
 	if (numargs < 1)
@@ -50,20 +197,49 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 	}
 
 	if (!strcasecmp(arg[0], "DUMPDONE")) {
-		upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
+		struct timeval	now;
+
+		gettimeofday(&now, NULL);
+		ups->stat_dumptime = difftimeval(now, ups->dumpstart);
+		upsdebugx(3, "%s: UPS [%s]: dump is done (%" PRIuSIZE " lines in %.3f sec)",
+			__func__, ups->name, ups->dumplines, ups->stat_dumptime);
 		ups->dumpdone = 1;
+		/* an upsd of a RELAY took it (see sstate_disconnect()) */
+		ups->reconnect_delay = 0;
+
+		if (ups->provisional) {
+			sstate_provisional_done(ups);
+		}
+		relay_stale(ups);
+
+		ups_check_soon(ups);
+		return 1;
+	}
+
+	if (!strcasecmp(arg[0], "DUMPDELTA")) {
+		upsdebugx(3, "%s: UPS [%s]: only the changes are dumped", __func__, ups->name);
+		ups->dumpdelta = 1;
 		return 1;
 	}
 
 	if (!strcasecmp(arg[0], "DATASTALE")) {
 		upsdebugx(3, "%s: UPS [%s]: data is STALE now", __func__, ups->name);
 		ups->data_ok = 0;
+		ups_check_soon(ups);
 		return 1;
 	}
 
 	if (!strcasecmp(arg[0], "DATAOK")) {
 		upsdebugx(3, "%s: UPS [%s]: data is NOT STALE now", __func__, ups->name);
 		ups->data_ok = 1;
+		ups_check_soon(ups);
+		return 1;
+	}
+
+	/* ERR <reason>: the upsd of a RELAY did not take it (and hangs up) */
+	if (!strcasecmp(arg[0], "ERR")) {
+		upslogx(LOG_WARNING, "UPS [%s]: %s refused the RELAY: %s",
+			ups->name, ups->fn, numargs > 1 ? arg[1] : "?");
 		return 1;
 	}
 
@@ -74,18 +250,46 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 	/* ADDCMD <cmdname> */
 	if (!strcasecmp(arg[0], "ADDCMD")) {
 		state_addcmd(&ups->cmdlist, arg[1]);
+		ups->generation++;
+		if (ups->provisional) {
+			state_addcmd(&ups->dumpcmds, arg[1]);
+		}
+		return 1;
+	}
+
+	/* STAMP <token> */
+	if (!strcasecmp(arg[0], "STAMP")) {
+		uintmax_t	stamp;
+		char	*end = NULL;
+
+		errno = 0;
+		stamp = strtoumax(arg[1], &end, 10);
+		if (!end || *end || errno)
+			return 0;
+
+		ups->stamp = stamp;
 		return 1;
 	}
 
 	/* DELCMD <cmdname> */
 	if (!strcasecmp(arg[0], "DELCMD")) {
 		state_delcmd(&ups->cmdlist, arg[1]);
+		ups->generation++;
 		return 1;
 	}
 
 	/* DELINFO <var> */
 	if (!strcasecmp(arg[0], "DELINFO")) {
-		state_delinfo(&ups->inforoot, arg[1]);
+		if (state_delinfo(&ups->inforoot, arg[1]) == 1) {
+			state_get_timestamp(&ups->lastdel);
+			ups->generation++;
+			watch_notify_delinfo(ups, arg[1]);
+			metrics_invalidate();
+
+			if (!strcmp(arg[1], "ups.status")) {
+				beacon_changed(ups);
+			}
+		}
 		return 1;
 	}
 
@@ -95,24 +299,101 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 	/* SETFLAGS <varname> <flags>... */
 	if (!strcasecmp(arg[0], "SETFLAGS")) {
 		state_setflags(ups->inforoot, arg[1], numargs - 2, &arg[2]);
+		ups->generation++;
 		return 1;
 	}
 
 	/* SETINFO <varname> <value> */
 	if (!strcasecmp(arg[0], "SETINFO")) {
-		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+		ups->stat_setinfo++;
+		if (state_setinfo(&ups->inforoot, arg[1], arg[2]) == 1) {
+			ups->generation++;
+			watch_notify_setinfo(ups, arg[1]);
+			metrics_invalidate();
+			history_record(&ups->history, arg[1], arg[2], NULL);
+
+			if (!strcmp(arg[1], "ups.status")) {
+				beacon_changed(ups);
+			}
+
+			if (NUT_USDT_ON && !strcmp(arg[1], "ups.status")) {
+				NUT_USDT_STATUS(upsd_status, ups->name, arg[2]);
+			}
+		}
 		return 1;
 	}
 
+	/* SHMSET <varname> <slot> */
+	if (!strcasecmp(arg[0], "SHMSET")) {
+		char	val[ST_MAX_VALUE_LEN], cmd[SMALLBUF];
+		long	slot;
+
+		if (!str_to_long(arg[2], &slot, 10))
+			return 0;
+
+		ups->stat_setinfo++;
+
+		switch (shmstate_get(ups->shm, slot, arg[1], val, sizeof(val)))
+		{
+		case 1:
+			if (state_setinfo(&ups->inforoot, arg[1], val) == 1) {
+				ups->generation++;
+				watch_notify_setinfo(ups, arg[1]);
+				metrics_invalidate();
+				history_record(&ups->history, arg[1], val, NULL);
+
+				if (!strcmp(arg[1], "ups.status")) {
+					beacon_changed(ups);
+				}
+
+				if (NUT_USDT_ON && !strcmp(arg[1], "ups.status")) {
+					NUT_USDT_STATUS(upsd_status, ups->name, val);
+				}
+			}
+			break;
+
+		case 0:
+			/* slot got reused: the variable was deleted meanwhile,
+			 * and its DELINFO is right behind this line */
+			upsdebugx(3, "%s: UPS [%s]: %s is no longer in slot %ld",
+				__func__, ups->name, arg[1], slot);
+			break;
+
+		default:
+			/* the driver kept rewriting it - ask for it as text */
+			snprintf(cmd, sizeof(cmd), "DUMPVALUE %s\n", arg[1]);
+			sstate_sendline(ups, cmd);
+			break;
+		}
+		return 1;
+	}
+
+	/* ENUMLIST <id> <enumval>... */
+	if (!strcasecmp(arg[0], "ENUMLIST")) {
+		return parse_list(ups, numargs, arg, 0);
+	}
+
+	/* SETENUMS <varname> <id> */
+	if (!strcasecmp(arg[0], "SETENUMS")) {
+		return parse_setlist(ups, arg, 0);
+	}
+
+	/* SETRANGES <varname> <id> */
+	if (!strcasecmp(arg[0], "SETRANGES")) {
+		return parse_setlist(ups, arg, 1);
+	}
+
 	/* ADDENUM <varname> <enumval> */
 	if (!strcasecmp(arg[0], "ADDENUM")) {
 		state_addenum(ups->inforoot, arg[1], arg[2]);
+		ups->generation++;
 		return 1;
 	}
 
 	/* DELENUM <varname> <enumval> */
 	if (!strcasecmp(arg[0], "DELENUM")) {
 		state_delenum(ups->inforoot, arg[1], arg[2]);
+		ups->generation++;
 		return 1;
 	}
 
@@ -137,6 +418,11 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 	if (numargs < 4)
 		return 0;
 
+	/* RANGELIST <id> <minvalue> <maxvalue>... */
+	if (!strcasecmp(arg[0], "RANGELIST")) {
+		return parse_list(ups, numargs, arg, 1);
+	}
+
 	/* ADDRANGE <varname> <minvalue> <maxvalue> */
 	if (!strcasecmp(arg[0], "ADDRANGE")) {
 		state_addrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
@@ -152,6 +438,26 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 	return 0;
 }
 
+#ifdef WIN32
+/* write to the pipe of a driver, which is opened for overlapped I/O (so
+ * WriteFile() may not be called without an OVERLAPPED), waiting for it
+ * to take it all; returns the number of bytes written, or -1 */
+static ssize_t sstate_write_pipe(upstype_t *ups, HANDLE fd, const char *buf, size_t buflen)
+{
+	DWORD	bytesWritten = 0;
+
+	if (!WriteFile(fd, buf, (DWORD)buflen, &bytesWritten, &ups->write_overlapped)) {
+		if (GetLastError() != ERROR_IO_PENDING
+		 || !GetOverlappedResult(fd, &ups->write_overlapped, &bytesWritten, TRUE)
+		) {
+			return -1;
+		}
+	}
+
+	return (ssize_t)bytesWritten;
+}
+#endif
+
 /* nothing fancy - just make the driver say something back to us */
 static void sendping(upstype_t *ups)
 {
@@ -168,17 +474,7 @@ static void sendping(upstype_t *ups)
 #ifndef WIN32
 	ret = write(ups->sock_fd, cmd, cmdlen);
 #else
-	DWORD bytesWritten = 0;
-	BOOL  result = FALSE;
-
-	result = WriteFile (ups->sock_fd, cmd, cmdlen, &bytesWritten, NULL);
-	if( result == 0 ) {
-		/* Write failed */
-		ret = 0;
-	}
-	else  {
-		ret = (ssize_t)bytesWritten;
-	}
+	ret = sstate_write_pipe(ups, ups->sock_fd, cmd, cmdlen);
 #endif
 
 	if ((ret < 1) || (ret != (ssize_t)cmdlen))  {
@@ -190,49 +486,122 @@ static void sendping(upstype_t *ups)
 	time(&ups->last_ping);
 }
 
-/* interface */
-
-TYPE_FD sstate_connect(upstype_t *ups)
+/* the driver took the connection on fd: get ready for its dump */
+static TYPE_FD sstate_connected(upstype_t *ups, TYPE_FD fd)
 {
-	TYPE_FD	fd;
+	pconf_init(&ups->sock_ctx, NULL);
+
+	ups->dumpdone = 0;
+	ups->dumplines = 0;
+	gettimeofday(&ups->dumpstart, NULL);
+	ups->stat_setinfo_base = ups->stat_setinfo;
+	time(&ups->stat_connected);
+	ups->stale = 0;
+	metrics_invalidate();
+
+	ups->dumpdelta = 0;
+	state_get_timestamp(&ups->dumpfrom);
+	state_cmdfree(ups->dumpcmds);
+	ups->dumpcmds = NULL;
+	sstate_lists_free(ups);
+
+	/* now is the last time we heard something from the driver */
+	time(&ups->last_heard);
+
+	/* set ups.status to "WAIT" while waiting for the driver response to dumpcmd,
+	 * unless the snapshot told what it was */
+	if (!ups->provisional) {
+		state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+	}
+
+	upslogx(LOG_INFO, "Connected to UPS [%s]: %s", ups->name, ups->fn);
+	if (!ups->relay) {
+		ups->reconnect_delay = 0;
+	}
+
+	evloop_driver_add(fd, ups);
+
+	return fd;
+}
+
 #ifndef WIN32
-	const char	*dumpcmd = "DUMPALL\n";
-	size_t	dumpcmdlen = strlen(dumpcmd);
+/* rate-limit complaints - don't spam the syslog */
+static void sstate_connfail(upstype_t *ups)
+{
+	time_t	now;
+	int	err = errno;
+
+	time(&now);
+	if (difftime(now, ups->last_connfail) < SS_CONNFAIL_INT)
+		return;
+
+	ups->last_connfail = now;
+	errno = err;
+	upslog_with_errno(LOG_ERR, "Can't connect to UPS [%s] (%s)",
+		ups->name, ups->fn);
+}
+
+/* ask the driver connected on fd for a dump */
+static TYPE_FD sstate_askdump(upstype_t *ups, TYPE_FD fd)
+{
+	char	dumpcmd[SMALLBUF];
+	size_t	dumpcmdlen;
 	ssize_t	ret;
-	struct sockaddr_un	sa;
 
-	upsdebugx(2, "%s: preparing UNIX socket %s", __func__, NUT_STRARG(ups->fn));
-	check_unix_socket_filename(ups->fn);
+	if (ups->relay) {
+		/* the other upsd sends the dump, then the changes */
+		char	upsname[SMALLBUF], host[SMALLBUF], port[SMALLBUF], eups[SMALLBUF];
 
-	memset(&sa, '\0', sizeof(sa));
-	sa.sun_family = AF_UNIX;
-	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", ups->fn);
+		relay_split(ups->fn, upsname, sizeof(upsname), host, sizeof(host), port, sizeof(port));
+		snprintf(dumpcmd, sizeof(dumpcmd), "RELAY \"%s\"\n",
+			pconf_encode(upsname, eups, sizeof(eups)));
+	} else {
+		/* a driver exporting its values next to the socket will
+		 * only send their slots if we ask first; see shmstate.h */
+		char	shmfn[SMALLBUF];
 
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		shmstate_close(ups->shm);
 
-	if (INVALID_FD(fd)) {
-		upslog_with_errno(LOG_ERR, "Can't create socket for UPS [%s]", ups->name);
-		return ERROR_FD;
-	}
+		snprintf(shmfn, sizeof(shmfn), "%s%s", ups->fn, SHMSTATE_SUFFIX);
+		if ((ups->shm = shmstate_open(shmfn)) != NULL) {
+			upsdebugx(2, "%s: UPS [%s] exports its values in %s",
+				__func__, ups->name, shmfn);
+		}
 
-	ret = connect(fd, (struct sockaddr *) &sa, sizeof(sa));
+		/* after a warm restart, only what changed since the snapshot */
+		snprintf(dumpcmd, sizeof(dumpcmd), "%sDUMPALL", ups->shm ? "SHMSTATE\n" : "");
+		if (ups->provisional && ups->stamp) {
+			snprintfcat(dumpcmd, sizeof(dumpcmd), " SINCE %" PRIuMAX, ups->stamp);
+		}
+		/* each list of enums or ranges once, rather than for every
+		 * variable with it (older drivers ignore this) */
+		snprintfcat(dumpcmd, sizeof(dumpcmd), " SHAREDLISTS\n");
+	}
+	dumpcmdlen = strlen(dumpcmd);
 
-	if (ret < 0) {
-		time_t	now;
+	/* get a dump started so we have a fresh set of data */
+	ret = write(fd, dumpcmd, dumpcmdlen);
 
-		upsdebugx(2, "%s: failed to connect() UNIX socket %s (%s)",
-			__func__, NUT_STRARG(ups->fn), sa.sun_path);
+	if ((ret < 1) || (ret != (ssize_t)dumpcmdlen))  {
+		upslog_with_errno(LOG_ERR, "Initial write to UPS [%s] failed", ups->name);
 		close(fd);
+		return ERROR_FD;
+	}
 
-		/* rate-limit complaints - don't spam the syslog */
-		time(&now);
-		if (difftime(now, ups->last_connfail) < SS_CONNFAIL_INT)
-			return ERROR_FD;
+	return sstate_connected(ups, fd);
+}
+
+/* connect() a new non-blocking socket to sa: returns it once connected,
+ * else ERROR_FD, with ups->connect_fd set if it is still going on */
+static TYPE_FD sstate_connect_sa(upstype_t *ups, const struct sockaddr *sa, socklen_t salen)
+{
+	TYPE_FD	fd;
+	ssize_t	ret;
 
-		ups->last_connfail = now;
-		upslog_with_errno(LOG_ERR, "Can't connect to UPS [%s] (%s)",
-			ups->name, ups->fn);
+	fd = socket(sa->sa_family, SOCK_STREAM, 0);
 
+	if (INVALID_FD(fd)) {
+		upslog_with_errno(LOG_ERR, "Can't create socket for UPS [%s]", ups->name);
 		return ERROR_FD;
 	}
 
@@ -252,15 +621,112 @@ TYPE_FD sstate_connect(upstype_t *ups)
 		return ERROR_FD;
 	}
 
-	/* get a dump started so we have a fresh set of data */
-	ret = write(fd, dumpcmd, dumpcmdlen);
+	ret = connect(fd, sa, salen);
 
-	if ((ret < 1) || (ret != (ssize_t)dumpcmdlen))  {
-		upslog_with_errno(LOG_ERR, "Initial write to UPS [%s] failed", ups->name);
+	if (ret < 0 && errno == EINPROGRESS) {
+		upsdebugx(2, "%s: UPS [%s] did not take the connection yet, "
+			"going on meanwhile", __func__, ups->name);
+
+		ups->connect_fd = fd;
+		time(&ups->connect_start);
+		evloop_driver_connecting(fd, ups);
+
+		return ERROR_FD;
+	}
+
+	if (ret < 0) {
+		/* EAGAIN: the listen() backlog of the driver is full */
+		upsdebug_with_errno(2, "%s: failed to connect() to UPS [%s] (%s)",
+			__func__, ups->name, NUT_STRARG(ups->fn));
 		close(fd);
 		return ERROR_FD;
 	}
 
+	return fd;
+}
+
+/* the same for the upsd of a RELAY, over TCP */
+static TYPE_FD sstate_relay_connect(upstype_t *ups)
+{
+	char	upsname[SMALLBUF], host[SMALLBUF], port[SMALLBUF];
+	struct addrinfo	hints, *res, *ai;
+	TYPE_FD	fd = ERROR_FD;
+	int	ret;
+
+	if (!relay_split(ups->fn, upsname, sizeof(upsname), host, sizeof(host), port, sizeof(port))) {
+		/* conf.c did not let it through */
+		return ERROR_FD;
+	}
+
+	upsdebugx(2, "%s: UPS [%s] is relayed by %s port %s", __func__, ups->name, host, port);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	if ((ret = getaddrinfo(host, port, &hints, &res)) != 0) {
+		time_t	now;
+
+		time(&now);
+		if (difftime(now, ups->last_connfail) >= SS_CONNFAIL_INT) {
+			ups->last_connfail = now;
+			upslogx(LOG_ERR, "Can't connect to UPS [%s] (%s): %s",
+				ups->name, ups->fn, gai_strerror(ret));
+		}
+		return ERROR_FD;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = sstate_connect_sa(ups, ai->ai_addr, (socklen_t)ai->ai_addrlen);
+		if (VALID_FD(fd) || VALID_FD(ups->connect_fd)) {
+			break;
+		}
+	}
+
+	if (INVALID_FD(fd) && INVALID_FD(ups->connect_fd)) {
+		sstate_connfail(ups);
+	}
+
+	freeaddrinfo(res);
+
+	return (VALID_FD(fd) ? sstate_askdump(ups, fd) : ERROR_FD);
+}
+#endif
+
+/* interface */
+
+/* Returns the socket of the driver once it is connected. On POSIX systems
+ * the connect() does not wait for a driver which is busy with its device
+ * and has not accepted yet: then ERROR_FD is returned with ups->connect_fd
+ * set, and the event loop calls sstate_connect_done() when it goes on. */
+TYPE_FD sstate_connect(upstype_t *ups)
+{
+	TYPE_FD	fd;
+#ifndef WIN32
+	struct sockaddr_un	sa;
+
+	if (ups->relay) {
+		return sstate_relay_connect(ups);
+	}
+
+	upsdebugx(2, "%s: preparing UNIX socket %s", __func__, NUT_STRARG(ups->fn));
+	check_unix_socket_filename(ups->fn);
+
+	memset(&sa, '\0', sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", ups->fn);
+
+	fd = sstate_connect_sa(ups, (struct sockaddr *)&sa, sizeof(sa));
+
+	if (INVALID_FD(fd)) {
+		if (INVALID_FD(ups->connect_fd)) {
+			sstate_connfail(ups);
+		}
+		return ERROR_FD;
+	}
+
+	return sstate_askdump(ups, fd);
 #else
 	char pipename[SMALLBUF];
 	const char	*dumpcmd = "DUMPALL\n";
@@ -293,37 +759,78 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	}
 
 	/* get a dump started so we have a fresh set of data */
-	DWORD bytesWritten = 0;
-
-	result = WriteFile (fd,dumpcmd,strlen(dumpcmd),&bytesWritten,NULL);
-	if (result == 0 || bytesWritten != strlen(dumpcmd)) {
+	if (sstate_write_pipe(ups, fd, dumpcmd, strlen(dumpcmd)) != (ssize_t)strlen(dumpcmd)) {
 		upslog_with_errno(LOG_ERR, "Initial write to UPS [%s] failed", ups->name);
 		CloseHandle(fd);
 		return ERROR_FD;
 	}
 
-	/* Start a read IO so we could wait on the event associated with it */
-	ReadFile(fd, ups->buf,
+	/* Start a read IO so we could wait on the event associated with it
+	 * (which is signaled as well if it completes right away) */
+	if (!ReadFile(fd, ups->buf,
 		sizeof(ups->buf) - 1, /*-1 to be sure to have a trailling 0 */
-		NULL, &(ups->read_overlapped));
+		NULL, &(ups->read_overlapped))
+	 && GetLastError() != ERROR_IO_PENDING
+	) {
+		upslogx(LOG_ERR, "Initial read from UPS [%s] failed: %d",
+			ups->name, (int)GetLastError());
+		CloseHandle(fd);
+		return ERROR_FD;
+	}
 #endif
 
-	/* sstate_connect() continued for both platforms: */
+	return sstate_connected(ups, fd);
+}
 
-	pconf_init(&ups->sock_ctx, NULL);
+#ifndef WIN32
+/* see sstate_connect(); called when the socket it left connecting is
+ * writable or in error, i.e. the driver accepted or refused it */
+void sstate_connect_done(upstype_t *ups)
+{
+	TYPE_FD	fd = ups->connect_fd;
+	int	err = 0;
+	socklen_t	errlen = sizeof(err);
 
-	ups->dumpdone = 0;
-	ups->stale = 0;
+	if (INVALID_FD(fd)) {
+		return;
+	}
 
-	/* now is the last time we heard something from the driver */
-	time(&ups->last_heard);
+	evloop_driver_del(fd);
+	ups->connect_fd = ERROR_FD;
 
-	/* set ups.status to "WAIT" while waiting for the driver response to dumpcmd */
-	state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0) {
+		err = errno;
+	}
 
-	upslogx(LOG_INFO, "Connected to UPS [%s]: %s", ups->name, ups->fn);
+	if (err) {
+		close(fd);
+		errno = err;
+		sstate_connfail(ups);
+		ups_connect_failed(ups);
+		return;
+	}
 
-	return fd;
+	ups->sock_fd = sstate_askdump(ups, fd);
+	if (INVALID_FD(ups->sock_fd)) {
+		ups_connect_failed(ups);
+		return;
+	}
+
+	ups_check_soon(ups);
+}
+#endif
+
+/* give up on a connection sstate_connect() left in progress, if any */
+void sstate_connect_cancel(upstype_t *ups)
+{
+#ifndef WIN32
+	if (VALID_FD(ups->connect_fd)) {
+		evloop_driver_del(ups->connect_fd);
+		close(ups->connect_fd);
+	}
+#endif
+
+	ups->connect_fd = ERROR_FD;
 }
 
 void sstate_disconnect(upstype_t *ups)
@@ -337,6 +844,7 @@ void sstate_disconnect(upstype_t *ups)
 
 	pconf_finish(&ups->sock_ctx);
 
+	evloop_driver_del(ups->sock_fd);
 #ifndef WIN32
 	close(ups->sock_fd);
 #else
@@ -344,71 +852,165 @@ void sstate_disconnect(upstype_t *ups)
 #endif
 
 	ups->sock_fd = ERROR_FD;
+	beacon_changed(ups);
+	relay_stale(ups);
+
+	/* an upsd which did not take our RELAY is not asked again right
+	 * away; otherwise try to reconnect at the next mainloop() pass */
+	if (ups->relay && !ups->dumpdone) {
+		ups_connect_failed(ups);
+		return;
+	}
+
+	ups_check_soon(ups);
+}
+
+/* parse what was read from the driver of ups; returns 0 on a parse error */
+static int sstate_feed(upstype_t *ups, const char *buf, ssize_t ret)
+{
+	ssize_t	i;
+	size_t	used;
+
+	for (i = 0; i < ret; i += (ssize_t)used) {
+
+		switch (pconf_feed(&ups->sock_ctx, buf + i, (size_t)(ret - i), &used))
+		{
+		case 1:
+			NUT_TRACE2(NUT_TRACE_SSTATE_LINE, (long)ups->sock_ctx.numargs, 0,
+				(ups->sock_ctx.numargs > 0 ? ups->sock_ctx.arglist[0] : NULL),
+				(ups->sock_ctx.numargs > 1 ? ups->sock_ctx.arglist[1] : NULL));
+
+			/* set the 'last heard' time to now for later staleness checks */
+			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
+				time(&ups->last_heard);
+				relay_forward(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist);
+
+				/* drivers send a long dump a bit at a time,
+				 * in between their other work */
+				if (!ups->dumpdone) {
+					ups->dumplines++;
+					if (ups->dumplines % 1000 == 0) {
+						upsdebugx(4, "%s: UPS [%s]: %" PRIuSIZE " lines of the dump so far",
+							__func__, ups->name, ups->dumplines);
+					}
+				}
+				if (ups->stale) {
+					/* it may be back to life */
+					ups_check_soon(ups);
+				}
+			}
+			continue;
+
+		case 0:
+			continue;	/* haven't gotten a line yet */
+
+		default:
+			/* parse error */
+			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
+			return 0;
+		}
+	}
+
+	return 1;
 }
 
 void sstate_readline(upstype_t *ups)
 {
-	ssize_t	i, ret;
+	ssize_t	ret;
 
 #ifndef WIN32
 	char	buf[SMALLBUF];
+	int	reads;
 
-	if ((!ups) || INVALID_FD(ups->sock_fd)) {
-		return;
-	}
+	/* take what a busy driver has for us (up to SS_DRAIN_READS buffers)
+	 * at once, before mainloop() goes on with the clients */
+	for (reads = 0; reads < SS_DRAIN_READS; reads++) {
+		if ((!ups) || INVALID_FD(ups->sock_fd)) {
+			return;
+		}
 
-	ret = read(ups->sock_fd, buf, sizeof(buf));
+		ret = read(ups->sock_fd, buf, sizeof(buf));
+		NUT_TRACE(NUT_TRACE_SSTATE_READ, (long)ups->sock_fd, (int64_t)ret, ups->name);
 
-	if (ret < 0) {
-		switch(errno)
-		{
-		case EINTR:
-		case EAGAIN:
-			return;
+		if (ret < 0) {
+			switch(errno)
+			{
+			case EINTR:
+			case EAGAIN:
+				return;
 
-		default:
-			upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
+			default:
+				upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
+				sstate_disconnect(ups);
+				return;
+			}
+		}
+
+		if (ret == 0) {
+			/* a driver going away is usually seen as POLLHUP, an
+			 * upsd (RELAY) closing the TCP connection is not */
+			upslogx(LOG_NOTICE, "UPS [%s] closed the connection", ups->name);
 			sstate_disconnect(ups);
 			return;
 		}
+
+		if (!sstate_feed(ups, buf, ret) || (size_t)ret < sizeof(buf)) {
+			return;
+		}
 	}
 #else
+	DWORD	bytesRead = 0;
+	int	rounds;
+
 	if ((!ups) || INVALID_FD(ups->sock_fd)) {
 		return;
 	}
 
-	/* FIXME? I do not see either buf filled below */
-	char *buf = ups->buf;
-	DWORD bytesRead;
-	GetOverlappedResult(ups->sock_fd, &ups->read_overlapped, &bytesRead, FALSE);
-	ret = bytesRead;
-#endif
-
-	for (i = 0; i < ret; i++) {
+	if (!GetOverlappedResult(ups->sock_fd, &ups->read_overlapped, &bytesRead, FALSE)) {
+		if (GetLastError() == ERROR_IO_INCOMPLETE) {
+			return;
+		}
 
-		switch (pconf_char(&ups->sock_ctx, buf[i]))
-		{
-		case 1:
-			/* set the 'last heard' time to now for later staleness checks */
-			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
-				time(&ups->last_heard);
-			}
-			continue;
+		upslogx(LOG_WARNING, "Read from UPS [%s] failed: %d",
+			ups->name, (int)GetLastError());
+		sstate_disconnect(ups);
+		return;
+	}
 
-		case 0:
-			continue;	/* haven't gotten a line yet */
+	/* a driver sending a dump fills the pipe faster than one piece per
+	 * pass of the main loop: take what is there already right away */
+	for (rounds = 1; ; rounds++) {
+		ret = (ssize_t)bytesRead;
+		NUT_TRACE(NUT_TRACE_SSTATE_READ, (long)(intptr_t)ups->sock_fd, (int64_t)ret, ups->name);
 
-		default:
-			/* parse error */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
+		/* after a parse error the rest of the piece is dropped, as
+		 * with read() above, but the pipe is still read from */
+		sstate_feed(ups, ups->buf, ret);
+		if (INVALID_FD(ups->sock_fd)) {
 			return;
 		}
-	}
 
-#ifdef WIN32
-	/* Restart async read */
-	memset(ups->buf,0,sizeof(ups->buf));
-	ReadFile( ups->sock_fd, ups->buf, sizeof(ups->buf)-1,NULL, &(ups->read_overlapped)); /* -1 to be sure to have a trailing 0 */
+		/* Restart async read; if it completes now, its event is
+		 * signaled as well, for the next pass after UPS_PIPE_READ_ROUNDS */
+		memset(ups->buf, 0, sizeof(ups->buf));
+		if (ReadFile(ups->sock_fd, ups->buf, sizeof(ups->buf) - 1, /* -1 to be sure to have a trailing 0 */
+			NULL, &(ups->read_overlapped))
+		) {
+			if (rounds < UPS_PIPE_READ_ROUNDS
+			 && GetOverlappedResult(ups->sock_fd, &ups->read_overlapped, &bytesRead, FALSE)
+			) {
+				continue;
+			}
+			break;
+		}
+
+		if (GetLastError() != ERROR_IO_PENDING) {
+			upslogx(LOG_WARNING, "Read from UPS [%s] failed: %d",
+				ups->name, (int)GetLastError());
+			sstate_disconnect(ups);
+		}
+		break;
+	}
 #endif
 }
 
@@ -481,9 +1083,38 @@ int sstate_dead(upstype_t *ups, int arg_maxage)
 /* release all info(tree) data used by <ups> */
 void sstate_infofree(upstype_t *ups)
 {
+	/* the feeds of the device lose them too */
+	relay_reset(ups);
+
 	state_infofree(ups->inforoot);
 
 	ups->inforoot = NULL;
+
+	/* a reconnected (maybe restarted) driver gets mapped again */
+	shmstate_close(ups->shm);
+	ups->shm = NULL;
+
+	/* and has nothing of a snapshot any more */
+	ups->provisional = 0;
+	ups->stamp = 0;
+	state_cmdfree(ups->dumpcmds);
+	ups->dumpcmds = NULL;
+	sstate_lists_free(ups);
+
+	state_get_timestamp(&ups->lastdel);
+	metrics_invalidate();
+
+	ups->generation++;
+	list_cache_free(ups);
+	agg_free(ups);
+}
+
+/* ask the driver for a STAMP to save in a snapshot, if it gives them */
+void sstate_getstamp(upstype_t *ups)
+{
+	if (ups->stamp && ups->dumpdone) {
+		sstate_sendline(ups, "GETSTAMP\n");
+	}
 }
 
 void sstate_cmdfree(upstype_t *ups)
@@ -491,6 +1122,7 @@ void sstate_cmdfree(upstype_t *ups)
 	state_cmdfree(ups->cmdlist);
 
 	ups->cmdlist = NULL;
+	ups->generation++;
 }
 
 int sstate_sendline(upstype_t *ups, const char *buf)
@@ -512,17 +1144,7 @@ int sstate_sendline(upstype_t *ups, const char *buf)
 #ifndef WIN32
 	ret = write(ups->sock_fd, buf, buflen);
 #else
-	DWORD bytesWritten = 0;
-	BOOL  result = FALSE;
-
-	result = WriteFile (ups->sock_fd, buf, buflen, &bytesWritten, NULL);
-
-	if (result == 0) {
-		ret = 0;
-	}
-	else {
-		ret = (ssize_t)bytesWritten;
-	}
+	ret = sstate_write_pipe(ups, ups->sock_fd, buf, buflen);
 #endif
 
 	if (ret == (ssize_t)buflen) {
@@ -29,6 +29,7 @@
 
 #define SS_CONNFAIL_INT 300	/* complain about a dead driver every 5 mins */
 #define SS_MAX_READ 256		/* don't let drivers tie us up in read()     */
+#define SS_DRAIN_READS 8	/* reads of a busy driver per mainloop() pass */
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -37,6 +38,10 @@ extern "C" {
 #endif
 
 TYPE_FD sstate_connect(upstype_t *ups);
+#ifndef WIN32
+void sstate_connect_done(upstype_t *ups);
+#endif
+void sstate_connect_cancel(upstype_t *ups);
 void sstate_disconnect(upstype_t *ups);
 void sstate_readline(upstype_t *ups);
 const char *sstate_getinfo(const upstype_t *ups, const char *var);
@@ -52,6 +57,7 @@ int sstate_dead(upstype_t *ups, int maxage);
 void sstate_infofree(upstype_t *ups);
 void sstate_cmdfree(upstype_t *ups);
 int sstate_sendline(upstype_t *ups, const char *buf);
+void sstate_getstamp(upstype_t *ups);
 const st_tree_t *sstate_getnode(const upstype_t *ups, const char *varname);
 
 #ifdef __cplusplus
@@ -45,6 +45,7 @@ typedef struct stype_s {
 	char	*addr;
 	char	*port;
 	TYPE_FD_SOCK	sock_fd;
+	int	metrics;	/* HTTP for scrapes (METRICS), not NUT */
 #ifdef WIN32
 	HANDLE  Event;
 #endif
@@ -0,0 +1,157 @@
+/* timer.c - deadlines for the upsd main loop, see timer.h
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "timer.h"
+
+static upsd_timer_t	**heap = NULL;
+static size_t	heap_len = 0, heap_size = 0;
+
+static void heap_place(upsd_timer_t *timer, size_t i)
+{
+	heap[i] = timer;
+	timer->slot = i + 1;
+}
+
+static void heap_up(size_t i)
+{
+	upsd_timer_t	*timer = heap[i];
+
+	while (i > 0 && heap[(i - 1) / 2]->when > timer->when) {
+		heap_place(heap[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+
+	heap_place(timer, i);
+}
+
+static void heap_down(size_t i)
+{
+	upsd_timer_t	*timer = heap[i];
+	size_t	child;
+
+	while ((child = 2 * i + 1) < heap_len) {
+		if (child + 1 < heap_len && heap[child + 1]->when < heap[child]->when) {
+			child++;
+		}
+
+		if (heap[child]->when >= timer->when) {
+			break;
+		}
+
+		heap_place(heap[child], i);
+		i = child;
+	}
+
+	heap_place(timer, i);
+}
+
+void timer_init(upsd_timer_t *timer, upsd_timer_fn_t fn, void *data)
+{
+	timer->when = 0;
+	timer->slot = 0;
+	timer->fn = fn;
+	timer->data = data;
+}
+
+void timer_set(upsd_timer_t *timer, time_t when)
+{
+	timer->when = when;
+
+	if (timer->slot) {
+		heap_up(timer->slot - 1);
+		heap_down(timer->slot - 1);
+		return;
+	}
+
+	if (heap_len >= heap_size) {
+		heap_size = (heap_size ? heap_size * 2 : 64);
+		heap = xrealloc(heap, heap_size * sizeof(*heap));
+	}
+
+	heap_place(timer, heap_len++);
+	heap_up(heap_len - 1);
+}
+
+void timer_cancel(upsd_timer_t *timer)
+{
+	upsd_timer_t	*last;
+	size_t	i;
+
+	if (!timer->slot) {
+		return;
+	}
+
+	i = timer->slot - 1;
+	timer->slot = 0;
+
+	last = heap[--heap_len];
+	if (i < heap_len) {
+		heap_place(last, i);
+		heap_up(i);
+		heap_down(last->slot - 1);
+	}
+}
+
+void timer_run(time_t now)
+{
+	upsd_timer_t	*timer;
+	/* callbacks which reschedule for <now> again wait for the next pass */
+	size_t	n = heap_len;
+
+	while (n-- > 0 && heap_len > 0 && heap[0]->when <= now) {
+		timer = heap[0];
+		timer_cancel(timer);
+		timer->fn(timer, now);
+	}
+}
+
+int timer_timeout(time_t now, int maxms)
+{
+	double	wait;
+
+	if (heap_len == 0) {
+		return maxms;
+	}
+
+	/* whole seconds: <now> was truncated, so we wake up a bit late
+	 * rather than early */
+	wait = difftime(heap[0]->when, now);
+	if (wait <= 0) {
+		return 0;
+	}
+
+	if (wait * 1000 >= maxms) {
+		return maxms;
+	}
+
+	return (int)(wait * 1000);
+}
+
+void timer_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < heap_len; i++) {
+		heap[i]->slot = 0;
+	}
+
+	free(heap);
+	heap = NULL;
+	heap_len = heap_size = 0;
+}
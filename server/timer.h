@@ -0,0 +1,70 @@
+/* timer.h - deadlines for the upsd main loop
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_TIMER_H_SEEN
+#define NUT_TIMER_H_SEEN 1
+
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* Whatever upsd must do at some time (shed an idle client, expire a
+ * tracking entry, ping a quiet driver...) is a timer embedded in the
+ * structure concerned.  Pending timers are kept in a binary min-heap,
+ * so mainloop() only visits those which are due and can sleep exactly
+ * until the next one.  A timer is not rescheduled when its deadline
+ * moves later (e.g. upon each command of a client): its callback checks
+ * the real state and sets the timer again if it fired early.
+ */
+typedef struct upsd_timer_s upsd_timer_t;
+
+typedef void (*upsd_timer_fn_t)(upsd_timer_t *timer, time_t now);
+
+struct upsd_timer_s {
+	time_t	when;
+	size_t	slot;		/* position in the heap + 1, 0 when not pending */
+	upsd_timer_fn_t	fn;
+	void	*data;
+};
+
+void timer_init(upsd_timer_t *timer, upsd_timer_fn_t fn, void *data);
+
+/* (re)schedule, a time in the past means at the next timer_run() */
+void timer_set(upsd_timer_t *timer, time_t when);
+void timer_cancel(upsd_timer_t *timer);
+
+/* call back the timers due at <now>, each of them is cancelled first */
+void timer_run(time_t now);
+
+/* milliseconds until the next timer is due, at most <maxms> */
+int timer_timeout(time_t now, int maxms);
+
+/* forget all pending timers */
+void timer_free(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_TIMER_H_SEEN */
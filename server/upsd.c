@@ -31,10 +31,13 @@
 #include "netcmds.h"
 #include "upsconf.h"
 
+#include <ctype.h>
+
 #ifndef WIN32
 # include <sys/un.h>
 # include <sys/socket.h>
 # include <netdb.h>
+# include <sys/wait.h>
 
 # ifdef HAVE_SYS_SIGNAL_H
 #  include <sys/signal.h>
@@ -63,6 +66,28 @@
 #include "sstate.h"
 #include "desc.h"
 #include "neterr.h"
+#include "netmetrics.h"
+#include "history.h"
+#include "beacon.h"
+#include "netstats.h"
+#include "snapshot.h"
+#include "state.h"
+#include "binframe.h"
+#include "nuttrace.h"
+
+#ifndef WIN32
+# if (defined HAVE_SYS_EPOLL_H) && (defined HAVE_EPOLL_CREATE1) && HAVE_EPOLL_CREATE1
+#  include <sys/epoll.h>
+#  define UPSD_EVLOOP_EPOLL 1
+# elif (defined HAVE_SYS_EVENT_H) && (defined HAVE_KQUEUE) && HAVE_KQUEUE
+#  include <sys/types.h>
+#  include <sys/event.h>
+#  define UPSD_EVLOOP_KQUEUE 1
+# endif
+# if (defined UPSD_EVLOOP_EPOLL) || (defined UPSD_EVLOOP_KQUEUE)
+#  define UPSD_EVLOOP 1
+# endif
+#endif
 
 #ifdef HAVE_WRAP
 #include <tcpd.h>
@@ -95,6 +120,26 @@ int allow_not_all_listeners = 0;
 /* preloaded to {OPEN_MAX} in main, can be overridden via upsd.conf */
 nfds_t	maxconn = 0;
 
+/* default to 1MB of replies queued for a slow client before dropping it,
+ * can be overridden via upsd.conf (0 = unlimited) */
+size_t	maxclientqueue = 1048576;
+
+/* default to disconnect clients after 1 minute of silence,
+ * can be overridden via upsd.conf */
+int	client_inactivity_delay = 60;
+
+/* default to let each address connect as often as it likes,
+ * can be limited via upsd.conf (new connections per second) */
+unsigned int	maxconnrate = 0;
+
+/* default to serve all clients from this process,
+ * can be changed via upsd.conf (upon restart) */
+size_t	upsd_workers = 0;
+
+/* default to keep memory for speed rather than give it back, can be
+ * changed via upsd.conf (or by building with -DUPSD_LOWMEM_DEFAULT=1) */
+int	lowmem = UPSD_LOWMEM_DEFAULT;
+
 /* preloaded to STATEPATH in main, can be overridden via upsd.conf */
 char	*statepath = NULL;
 
@@ -106,16 +151,55 @@ static const char	*progname;
 
 nut_ctype_t	*firstclient = NULL;
 /* static nut_ctype_t	*lastclient = NULL; */
+static size_t	numclients = 0;
 
 /* default is to listen on all local interfaces */
 static stype_t	*firstaddr = NULL;
 
 static int 	opt_af = AF_UNSPEC;
 
+/* with LOWMEM, the parser of all clients not in the middle of a line */
+static PCONF_CTX_t	client_shared_ctx;
+static int	client_shared_ready = 0;
+
+/* mainloop() sleeps until the next timer is due, but at most this long
+ * (milliseconds), so that e.g. a service watchdog still hears from us */
+#define UPSD_WAIT_MAX	10000
+
+/* commands of one client handled per pass of mainloop(): the rest of what
+ * it sent waits for the next pass, after the drivers (see client_feed()) */
+#define UPSD_CLIENT_LINES_MAX	16
+
+/* bytes written to one client per pass of mainloop() upon POLLOUT */
+#define UPSD_CLIENT_WRITE_MAX	65536
+
+/* connections taken from one listener per wakeup: enough to drain a
+ * reconnect storm quickly, not so many that the others starve meanwhile */
+#define UPSD_ACCEPT_BATCH	64
+
+/* remembered addresses for MAXCONNRATE (a power of two) */
+#define UPSD_RATE_SLOTS	256
+
+/* seconds between warnings of connections being rejected */
+#define UPSD_REJECT_LOG_DELAY	60
+
+/* seconds between attempts to reach a driver which is not connected,
+ * doubled after each failure up to UPS_RECONNECT_MAX */
+#define UPS_RECONNECT_DELAY	2
+#define UPS_RECONNECT_MAX	32
+
+/* seconds for a driver to accept the connection (see sstate_connect()) */
+#define UPS_CONNECT_TIMEOUT	10
+
 typedef enum {
 	DRIVER = 1,
+	DRIVER_CONNECT,	/* see sstate_connect_done() */
 	CLIENT,
-	SERVER
+	SERVER,
+	HANDSHAKE	/* see ssl_handshake_collect() */
+#ifdef UPSD_WORKERS
+	,WORKER		/* see worker_event() */
+#endif
 #ifdef WIN32
 	,NAMED_PIPE
 #endif
@@ -125,6 +209,7 @@ typedef enum {
 typedef struct {
 	handler_type_t	type;
 	void		*data;
+	int		want_write;	/* evloop: POLLOUT interest registered */
 } handler_t;
 
 /* Commands and settings status tracking */
@@ -140,12 +225,21 @@ typedef struct tracking_s {
 	char	*id;
 	int	status;
 	time_t	request_time; /* for cleanup */
-	/* doubly linked list */
+	/* doubly linked list, newest first */
 	struct tracking_s	*prev;
 	struct tracking_s	*next;
+	struct tracking_s	*hnext;	/* chain in tracking_index */
 } tracking_t;
 
 static tracking_t	*tracking_list = NULL;
+static tracking_t	*tracking_oldest = NULL;	/* the end of tracking_list */
+
+/* tracking_list entries by id, like ups_index (see get_ups_ptr()) */
+static tracking_t	**tracking_index = NULL;
+static size_t	tracking_index_size = 0, tracking_count = 0;
+
+static void tracking_expire(upsd_timer_t *timer, time_t now);
+static upsd_timer_t	tracking_timer = { 0, 0, tracking_expire, NULL };
 
 #ifndef WIN32
 	/* pollfd  */
@@ -156,11 +250,87 @@ static HANDLE		mutex = INVALID_HANDLE_VALUE;
 #endif
 static handler_t	*handler = NULL;
 
+#ifdef UPSD_EVLOOP
+/* Persistent event-loop registration (epoll or kqueue): descriptors are
+ * added and removed as drivers, clients and listeners come and go, so
+ * mainloop() only has to visit those which have something to say.
+ * If the kernel queue can not be set up (or breaks later), we fall back
+ * to rebuilding the poll() array on every iteration as before - the
+ * linked lists of drivers, clients and listeners remain authoritative.
+ */
+# define EVLOOP_BATCH	64
+static int	evloop_fd = -1;
+static int	evloop_failed = 0;
+	/* handler per file descriptor, type==0 for unused slots */
+static handler_t	*evloop_handler = NULL;
+static size_t	evloop_handler_size = 0;
+	/* amount of currently registered descriptors */
+static nfds_t	evloop_nfds = 0;
+# ifdef UPSD_EVLOOP_EPOLL
+static struct epoll_event	evloop_events[EVLOOP_BATCH];
+# else
+static struct kevent	evloop_events[EVLOOP_BATCH];
+# endif
+	/* events returned by the current wait, still being dispatched */
+static int	evloop_nevents = 0;
+#endif	/* UPSD_EVLOOP */
+
+#ifdef UPSD_WORKERS
+/* WORKERS: forked copies of upsd, each with its own listening sockets on
+ * the same addresses (SO_REUSEPORT) and its own connections to the drivers,
+ * so that reading clients are spread over several processes.  What only
+ * the main process can do (SET, INSTCMD, FSD, LOGIN...) is handed over to
+ * it with the client socket, see worker_handoff() and client_adopt().
+ */
+# define UPSD_WORKERS_MAX	64
+	/* a handover: the client settings to replay (as commands), a NUL,
+	 * then the command which needs the main process and what followed */
+# define WORKER_MSG_MAX	65536
+
+typedef struct {
+	pid_t	pid;		/* -1 once it is gone */
+	int	fd;		/* our end of the channel to it */
+	stype_t	*listeners;	/* its own sockets, until it is forked */
+} upsd_worker_t;
+
+	/* in the main process */
+static upsd_worker_t	*workers = NULL;
+static size_t	workers_num = 0;
+	/* in a worker: its end of the channel to the main process */
+static int	worker_fd = -1;
+#endif	/* UPSD_WORKERS */
+
+#ifdef UPSD_UPGRADE
+/* UPGRADE: upon SIGCMD_UPGRADE, we start upsd again (the same path and
+ * arguments, so a new binary if it was replaced) with a channel like
+ * the one of the WORKERS, named by UPGRADE_FD_ENV.  We send it our
+ * listening sockets right away, and once it is ready (has read its
+ * configuration and connected to the drivers) our plain text clients,
+ * with their settings to replay like worker_handoff() does; then we
+ * exit, and nobody saw a connection closed.  See upgrade_start().
+ */
+# define UPGRADE_FD_ENV	"NUT_UPSD_UPGRADE_FD"
+	/* how long we wait for the new upsd to be ready (seconds) */
+# define UPGRADE_TIMEOUT	60
+
+	/* how we were started, to do it again; NULL if we can not */
+static char	**upgrade_argv = NULL;
+	/* in the new upsd: its end of the channel, until it took over */
+static int	upgrade_fd = -1;
+	/* and the listening sockets it got, until setuptcp() took them */
+static int	*upgrade_listeners = NULL;
+static size_t	upgrade_numlisteners = 0;
+	/* in the old one: all is handed over, just exit */
+static int	upgrade_done = 0;
+
+static TYPE_FD_SOCK upgrade_listener(const struct sockaddr *sa);
+#endif	/* UPSD_UPGRADE */
+
 	/* pid file */
 static char	pidfn[SMALLBUF];
 
 	/* set by signal handlers */
-static int	reload_flag = 0, exit_flag = 0;
+static int	reload_flag = 0, exit_flag = 0, upgrade_flag = 0;
 
 /* Minimalistic support for UUID v4 */
 /* Ref: RFC 4122 https://tools.ietf.org/html/rfc4122#section-4.1.2 */
@@ -186,6 +356,89 @@ static const char *inet_ntopW (struct sockaddr_storage *s)
 	}
 }
 
+/* Index of the firstups entries by (case-insensitive) name, so that
+ * looking up the UPS a command is about does not walk the whole list;
+ * the size of the bucket array is a power of two */
+static upstype_t	**ups_index = NULL;
+static size_t	ups_index_size = 0, ups_index_count = 0;
+
+static size_t name_hash(const char *name)
+{
+	/* FNV-1a */
+	uint32_t	h = 2166136261U;
+
+	for (; *name; name++) {
+		h ^= (uint32_t)tolower((unsigned char)*name);
+		h *= 16777619U;
+	}
+
+	return (size_t)h;
+}
+
+static void ups_index_resize(size_t newsize)
+{
+	upstype_t	**newindex, *tmp, *tnext;
+	size_t	i, pos;
+
+	newindex = xcalloc(newsize, sizeof(*newindex));
+
+	for (i = 0; i < ups_index_size; i++) {
+		for (tmp = ups_index[i]; tmp; tmp = tnext) {
+			tnext = tmp->hnext;
+			pos = name_hash(tmp->name) & (newsize - 1);
+			tmp->hnext = newindex[pos];
+			newindex[pos] = tmp;
+		}
+	}
+
+	free(ups_index);
+	ups_index = newindex;
+	ups_index_size = newsize;
+}
+
+void ups_index_add(upstype_t *ups)
+{
+	size_t	pos;
+
+	/* keep the chains short */
+	if (ups_index_count >= ups_index_size) {
+		ups_index_resize(ups_index_size ? ups_index_size * 2 : 64);
+	}
+
+	pos = name_hash(ups->name) & (ups_index_size - 1);
+	ups->hnext = ups_index[pos];
+	ups_index[pos] = ups;
+	ups_index_count++;
+}
+
+void ups_index_del(upstype_t *ups)
+{
+	upstype_t	**tptr;
+
+	if (!ups_index_size) {
+		return;
+	}
+
+	for (tptr = &ups_index[name_hash(ups->name) & (ups_index_size - 1)];
+		*tptr; tptr = &(*tptr)->hnext
+	) {
+		if (*tptr == ups) {
+			*tptr = ups->hnext;
+			ups->hnext = NULL;
+			ups_index_count--;
+			return;
+		}
+	}
+}
+
+static void ups_index_free(void)
+{
+	free(ups_index);
+	ups_index = NULL;
+	ups_index_size = 0;
+	ups_index_count = 0;
+}
+
 /* return a pointer to the named ups if possible */
 upstype_t *get_ups_ptr(const char *name)
 {
@@ -197,9 +450,11 @@ upstype_t *get_ups_ptr(const char *name)
 		return NULL;
 	}
 
-	for (tmp = firstups; tmp; tmp = tmp->next) {
-		if (!strcasecmp(tmp->name, name)) {
-			return tmp;
+	if (ups_index_size) {
+		for (tmp = ups_index[name_hash(name) & (ups_index_size - 1)]; tmp; tmp = tmp->hnext) {
+			if (!strcasecmp(tmp->name, name)) {
+				return tmp;
+			}
 		}
 	}
 
@@ -217,6 +472,9 @@ static void ups_data_stale(upstype_t *ups)
 	}
 
 	ups->stale = 1;
+	metrics_invalidate();
+	beacon_changed(ups);
+	relay_stale(ups);
 
 	upslogx(LOG_NOTICE, "Data for UPS [%s] is stale - check driver", ups->name);
 }
@@ -229,12 +487,403 @@ static void ups_data_ok(upstype_t *ups)
 	}
 
 	ups->stale = 0;
+	metrics_invalidate();
+	beacon_changed(ups);
+	relay_stale(ups);
 
 	upslogx(LOG_NOTICE, "UPS [%s] data is no longer stale", ups->name);
 }
 
+/* (re)connect to the driver, prod it when it is quiet and keep the
+ * stale flag up to date; runs whenever the next of these is due */
+static void ups_check(upsd_timer_t *timer, time_t now)
+{
+	upstype_t	*ups = (upstype_t *)timer->data;
+	time_t	next, prod;
+
+	/* still waiting for the driver to accept the connection */
+	if (VALID_FD(ups->connect_fd)) {
+		if (now < ups->connect_start + UPS_CONNECT_TIMEOUT) {
+			timer_set(timer, ups->connect_start + UPS_CONNECT_TIMEOUT);
+			return;
+		}
+
+		upslogx(LOG_WARNING, "UPS [%s] did not accept the connection "
+			"in %d seconds - check driver", ups->name, UPS_CONNECT_TIMEOUT);
+		sstate_connect_cancel(ups);
+		ups_connect_failed(ups);
+		return;
+	}
+
+	/* see if we need to (re)connect to the socket */
+	if (INVALID_FD(ups->sock_fd)) {
+		upsdebugx(1, "%s: UPS [%s] is not currently connected, "
+			"trying to reconnect",
+			__func__, ups->name);
+		ups->sock_fd = sstate_connect(ups);
+		if (VALID_FD(ups->connect_fd)) {
+			/* see sstate_connect_done() */
+			timer_set(timer, ups->connect_start + UPS_CONNECT_TIMEOUT);
+			return;
+		}
+
+		if (INVALID_FD(ups->sock_fd)) {
+			ups_connect_failed(ups);
+			upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d), "
+				"next try in %d seconds",
+				__func__, ups->name, ups->sock_fd,
+				(int)ups->reconnect_delay);
+			return;
+		}
+
+		upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
+			__func__, ups->name, ups->sock_fd);
+	}
+
+	/* throw some warnings if it's not feeding us data any more */
+	if (sstate_dead(ups, maxage)) {
+		ups_data_stale(ups);
+	} else {
+		ups_data_ok(ups);
+
+		/* keep what a snapshot would tell the driver recent */
+		sstate_getstamp(ups);
+	}
+
+	/* when sstate_dead() would ping it, or find it dead */
+	next = ups->last_heard + maxage + 1;
+	prod = (ups->last_ping > ups->last_heard ? ups->last_ping : ups->last_heard) + maxage / 3 + 1;
+	if (prod < next) {
+		next = prod;
+	}
+	if (next <= now) {
+		next = now + 1;
+	}
+
+	timer_set(timer, next);
+}
+
+void ups_check_soon(upstype_t *ups)
+{
+	/* the first call comes from ups_create() */
+	if (!ups->check_timer.fn) {
+		timer_init(&ups->check_timer, ups_check, ups);
+	}
+
+	timer_set(&ups->check_timer, 0);
+}
+
+void ups_connect_failed(upstype_t *ups)
+{
+	/* a driver restarting is usually back soon, one which is not
+	 * running (or not configured) does not need a try every pass */
+	if (ups->reconnect_delay < UPS_RECONNECT_DELAY) {
+		ups->reconnect_delay = UPS_RECONNECT_DELAY;
+	} else if (ups->reconnect_delay < UPS_RECONNECT_MAX) {
+		ups->reconnect_delay *= 2;
+	}
+
+	if (!ups->check_timer.fn) {
+		timer_init(&ups->check_timer, ups_check, ups);
+	}
+
+	timer_set(&ups->check_timer, time(NULL) + ups->reconnect_delay);
+}
+
+#ifdef UPSD_EVLOOP
+# ifdef UPSD_EVLOOP_EPOLL
+#  define UPSD_EVLOOP_NAME	"epoll"
+# else
+#  define UPSD_EVLOOP_NAME	"kqueue"
+# endif
+
+/* tear down the kernel queue, mainloop() would use poll() from now on */
+static void evloop_fallback(const char *why)
+{
+	upslog_with_errno(LOG_WARNING, "%s: %s failed, falling back to poll()",
+		__func__, why);
+
+	if (evloop_fd >= 0) {
+		close(evloop_fd);
+	}
+
+	evloop_fd = -1;
+	evloop_failed = 1;
+	evloop_nfds = 0;
+	evloop_nevents = 0;
+
+	free(evloop_handler);
+	evloop_handler = NULL;
+	evloop_handler_size = 0;
+}
+
+/* register a descriptor for POLLIN-like events (no-op until evloop_init()) */
+static void evloop_add(int fd, handler_type_t type, void *data)
+{
+	if (evloop_fd < 0 || fd < 0) {
+		return;
+	}
+
+	if ((size_t)fd >= evloop_handler_size) {
+		size_t	newsize = (evloop_handler_size ? evloop_handler_size : 64);
+
+		while (newsize <= (size_t)fd) {
+			newsize *= 2;
+		}
+
+		evloop_handler = xrealloc(evloop_handler, newsize * sizeof(*evloop_handler));
+		memset(evloop_handler + evloop_handler_size, 0,
+			(newsize - evloop_handler_size) * sizeof(*evloop_handler));
+		evloop_handler_size = newsize;
+	}
+
+	if (evloop_handler[fd].type) {
+		/* shouldn't happen, but keep the newest owner */
+		upsdebugx(1, "%s: FD %d was already registered", __func__, fd);
+		evloop_handler[fd].type = type;
+		evloop_handler[fd].data = data;
+		return;
+	}
+
+	{ /* scoping */
+# ifdef UPSD_EVLOOP_EPOLL
+		struct epoll_event	ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+
+		if (epoll_ctl(evloop_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			evloop_fallback("epoll_ctl(ADD)");
+			return;
+		}
+# else
+		struct kevent	kev;
+
+		EV_SET(&kev, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+
+		if (kevent(evloop_fd, &kev, 1, NULL, 0, NULL) < 0) {
+			evloop_fallback("kevent(EV_ADD)");
+			return;
+		}
+# endif
+	}
+
+	evloop_handler[fd].type = type;
+	evloop_handler[fd].data = data;
+	evloop_handler[fd].want_write = 0;
+	evloop_nfds++;
+
+	upsdebugx(5, "%s: FD %d registered (type %d), %" PRIdMAX " total",
+		__func__, fd, (int)type, (intmax_t)evloop_nfds);
+}
+
+/* unregister a descriptor, must be called before it is closed */
+static void evloop_del(int fd)
+{
+	int	i;
+
+	if (evloop_fd < 0 || fd < 0
+	 || (size_t)fd >= evloop_handler_size
+	 || !evloop_handler[fd].type
+	) {
+		return;
+	}
+
+	{ /* scoping */
+# ifdef UPSD_EVLOOP_EPOLL
+		struct epoll_event	ev;
+
+		/* Non-NULL event pointer for pre-2.6.9 kernels */
+		memset(&ev, 0, sizeof(ev));
+		if (epoll_ctl(evloop_fd, EPOLL_CTL_DEL, fd, &ev) < 0) {
+			upsdebug_with_errno(3, "%s: epoll_ctl(DEL) for FD %d", __func__, fd);
+		}
+# else
+		struct kevent	kev;
+
+		EV_SET(&kev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+		if (kevent(evloop_fd, &kev, 1, NULL, 0, NULL) < 0) {
+			upsdebug_with_errno(3, "%s: kevent(EV_DELETE) for FD %d", __func__, fd);
+		}
+		if (evloop_handler[fd].want_write) {
+			EV_SET(&kev, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+			if (kevent(evloop_fd, &kev, 1, NULL, 0, NULL) < 0) {
+				upsdebug_with_errno(3, "%s: kevent(EV_DELETE) for FD %d", __func__, fd);
+			}
+		}
+# endif
+	}
+
+	evloop_handler[fd].type = 0;
+	evloop_handler[fd].data = NULL;
+	evloop_handler[fd].want_write = 0;
+	evloop_nfds--;
+
+	/* Forget events about this descriptor still pending in the current
+	 * batch: the number may get reused by an accept() before we get to
+	 * them, and the handler (e.g. a client) is about to be freed. */
+	for (i = 0; i < evloop_nevents; i++) {
+# ifdef UPSD_EVLOOP_EPOLL
+		if (evloop_events[i].data.fd == fd)
+			evloop_events[i].data.fd = -1;
+# else
+		if ((int)evloop_events[i].ident == fd)
+			evloop_events[i].ident = (uintptr_t)-1;
+# endif
+	}
+}
+
+/* toggle interest in POLLOUT-like events for a registered descriptor,
+ * used while a client has replies queued (see sendback()) */
+static void evloop_want_write(int fd, int on)
+{
+	on = (on != 0);
+
+	if (evloop_fd < 0 || fd < 0
+	 || (size_t)fd >= evloop_handler_size
+	 || !evloop_handler[fd].type
+	 || evloop_handler[fd].want_write == on
+	) {
+		return;
+	}
+
+	{ /* scoping */
+# ifdef UPSD_EVLOOP_EPOLL
+		struct epoll_event	ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+		ev.data.fd = fd;
+
+		if (epoll_ctl(evloop_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+			evloop_fallback("epoll_ctl(MOD)");
+			return;
+		}
+# else
+		struct kevent	kev;
+
+		EV_SET(&kev, fd, EVFILT_WRITE, (on ? EV_ADD : EV_DELETE), 0, 0, NULL);
+
+		if (kevent(evloop_fd, &kev, 1, NULL, 0, NULL) < 0) {
+			evloop_fallback("kevent(EVFILT_WRITE)");
+			return;
+		}
+# endif
+	}
+
+	evloop_handler[fd].want_write = on;
+}
+
+/* set up the kernel queue and register whatever is already connected;
+ * called once we are done forking into background (kqueues do not
+ * survive a fork()) */
+static void evloop_init(void)
+{
+	upstype_t	*ups;
+	nut_ctype_t	*client;
+	stype_t		*server;
+
+	if (evloop_fd >= 0 || evloop_failed) {
+		return;
+	}
+
+# ifdef UPSD_EVLOOP_EPOLL
+	evloop_fd = epoll_create1(EPOLL_CLOEXEC);
+# else
+	evloop_fd = kqueue();
+# endif
+
+	if (evloop_fd < 0) {
+		evloop_fallback(UPSD_EVLOOP_NAME " setup");
+		return;
+	}
+
+	upsdebugx(1, "%s: using %s for the main loop", __func__, UPSD_EVLOOP_NAME);
+
+	for (ups = firstups; ups; ups = ups->next) {
+		evloop_add(ups->sock_fd, DRIVER, ups);
+
+		if (VALID_FD(ups->connect_fd)) {
+			evloop_driver_connecting(ups->connect_fd, ups);
+		}
+	}
+
+	for (client = firstclient; client; client = client->next) {
+		evloop_add(client->sock_fd, CLIENT, client);
+	}
+
+	for (server = firstaddr; server; server = server->next) {
+		evloop_add(server->sock_fd, SERVER, server);
+	}
+
+	if (ssl_handshake_fd() >= 0) {
+		evloop_add(ssl_handshake_fd(), HANDSHAKE, NULL);
+	}
+
+# ifdef UPSD_WORKERS
+	{ /* scoping */
+		size_t	i;
+
+		for (i = 0; i < workers_num; i++) {
+			evloop_add(workers[i].fd, WORKER, &workers[i]);
+		}
+
+		evloop_add(worker_fd, WORKER, NULL);
+	}
+# endif
+}
+
+static void evloop_free(void)
+{
+	if (evloop_fd >= 0) {
+		close(evloop_fd);
+		evloop_fd = -1;
+	}
+
+	free(evloop_handler);
+	evloop_handler = NULL;
+	evloop_handler_size = 0;
+	evloop_nfds = 0;
+}
+#endif	/* UPSD_EVLOOP */
+
+/* tell the event loop (if any) about a newly connected driver socket */
+void evloop_driver_add(TYPE_FD fd, upstype_t *ups)
+{
+#ifdef UPSD_EVLOOP
+	evloop_add(fd, DRIVER, ups);
+#else
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(ups);
+#endif
+}
+
+/* ...or about one which the driver did not accept yet (POSIX only):
+ * writable is when it did (or refused it) */
+void evloop_driver_connecting(TYPE_FD fd, upstype_t *ups)
+{
+#ifdef UPSD_EVLOOP
+	evloop_add(fd, DRIVER_CONNECT, ups);
+	evloop_want_write(fd, 1);
+#else
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(ups);
+#endif
+}
+
+/* tell the event loop (if any) that a driver socket is about to be closed */
+void evloop_driver_del(TYPE_FD fd)
+{
+#ifdef UPSD_EVLOOP
+	evloop_del(fd);
+#else
+	NUT_UNUSED_VARIABLE(fd);
+#endif
+}
+
 /* add another listening address */
-void listen_add(const char *addr, const char *port)
+static void listen_add_type(const char *addr, const char *port, int metrics)
 {
 	stype_t	*server;
 
@@ -248,6 +897,7 @@ void listen_add(const char *addr, const char *port)
 	server->addr = xstrdup(addr);
 	server->port = xstrdup(port);
 	server->sock_fd = ERROR_FD_SOCK;
+	server->metrics = metrics;
 	server->next = NULL;
 
 	if (firstaddr) {
@@ -258,7 +908,18 @@ void listen_add(const char *addr, const char *port)
 		firstaddr = server;
 	}
 
-	upsdebugx(3, "listen_add: added %s:%s", server->addr, server->port);
+	upsdebugx(3, "listen_add: added %s:%s%s", server->addr, server->port,
+		metrics ? " (metrics)" : "");
+}
+
+void listen_add(const char *addr, const char *port)
+{
+	listen_add_type(addr, port, 0);
+}
+
+void listen_add_metrics(const char *addr, const char *port)
+{
+	listen_add_type(addr, port, 1);
 }
 
 /* Close the connection if needed and free the allocated memory.
@@ -267,6 +928,9 @@ void listen_add(const char *addr, const char *port)
 static void stype_free(stype_t *server)
 {
 	if (VALID_FD_SOCK(server->sock_fd)) {
+#ifdef UPSD_EVLOOP
+		evloop_del(server->sock_fd);
+#endif
 		close(server->sock_fd);
 	}
 
@@ -334,6 +998,7 @@ static void setuptcp(stype_t *server)
 			serverAnyV4->addr = xstrdup("0.0.0.0");
 			serverAnyV4->port = xstrdup(server->port);
 			serverAnyV4->sock_fd = ERROR_FD_SOCK;
+			serverAnyV4->metrics = server->metrics;
 			serverAnyV4->next = NULL;
 		}
 
@@ -345,6 +1010,7 @@ static void setuptcp(stype_t *server)
 			serverAnyV6->addr = xstrdup("::0");
 			serverAnyV6->port = xstrdup(server->port);
 			serverAnyV6->sock_fd = ERROR_FD_SOCK;
+			serverAnyV6->metrics = server->metrics;
 			serverAnyV6->next = NULL;
 		}
 
@@ -454,7 +1120,18 @@ static void setuptcp(stype_t *server)
 	}
 
 	for (ai = res; ai; ai = ai->ai_next) {
-		TYPE_FD_SOCK sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		TYPE_FD_SOCK sock_fd;
+
+#ifdef UPSD_UPGRADE
+		/* the upsd we take over from listens there already */
+		sock_fd = upgrade_listener(ai->ai_addr);
+		if (VALID_FD_SOCK(sock_fd)) {
+			server->sock_fd = sock_fd;
+			break;
+		}
+#endif
+
+		sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
 
 		if (INVALID_FD_SOCK(sock_fd)) {
 			upsdebug_with_errno(3, "setuptcp: socket");
@@ -465,6 +1142,16 @@ static void setuptcp(stype_t *server)
 			fatal_with_errno(EXIT_FAILURE, "setuptcp: setsockopt");
 		}
 
+#ifdef UPSD_WORKERS
+		/* each of the WORKERS listens on the same address and
+		 * the system spreads the connections over all of us */
+		if (upsd_workers > 0
+		 && setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, (void *)&one, sizeof(one)) != 0
+		) {
+			fatal_with_errno(EXIT_FAILURE, "setuptcp: setsockopt SO_REUSEPORT");
+		}
+#endif
+
 #ifdef IPV6_V6ONLY
 		/* Ordinarily we request that IPv6 listeners handle only IPv6
 		 * and not IPv4 mapped addresses - if the OS would honour that.
@@ -563,6 +1250,76 @@ static void declogins(const char *upsname)
 	}
 }
 
+/* a parser for what the client sent: its own, or with LOWMEM the one
+ * shared by all clients, as most of them send a line at a time */
+static void client_ctx_take(nut_ctype_t *client)
+{
+	if (client->ctx) {
+		return;
+	}
+
+	if (!lowmem) {
+		client->ctx = xmalloc(sizeof(*client->ctx));
+		pconf_init(client->ctx, NULL);
+		return;
+	}
+
+	if (!client_shared_ready) {
+		pconf_init(&client_shared_ctx, NULL);
+		client_shared_ready = 1;
+	}
+
+	client->ctx = &client_shared_ctx;
+}
+
+/* done with what the client sent for now: a line left in the middle
+ * keeps the parser (the shared one is replaced for the others), else
+ * with LOWMEM the client does not need one until it sends again */
+static void client_ctx_release(nut_ctype_t *client)
+{
+	if (!client->ctx) {
+		return;
+	}
+
+	if (pconf_feed_pending(client->ctx)) {
+		if (client->ctx == &client_shared_ctx) {
+			client->ctx = xmalloc(sizeof(*client->ctx));
+			memcpy(client->ctx, &client_shared_ctx, sizeof(*client->ctx));
+			pconf_init(&client_shared_ctx, NULL);
+		}
+		return;
+	}
+
+	if (client->ctx == &client_shared_ctx) {
+		client->ctx = NULL;
+	} else if (lowmem) {
+		pconf_finish(client->ctx);
+		free(client->ctx);
+		client->ctx = NULL;
+	}
+}
+
+/* the memory the parsers of clients take: all of those of their own, or
+ * the shared one (LOWMEM), as allocated */
+size_t client_ctx_bytes(int shared)
+{
+	const nut_ctype_t	*client;
+	size_t	bytes = 0;
+
+	if (shared) {
+		return client_shared_ready
+			? sizeof(client_shared_ctx) + pconf_bytes(&client_shared_ctx) : 0;
+	}
+
+	for (client = firstclient; client; client = client->next) {
+		if (client->ctx && client->ctx != &client_shared_ctx) {
+			bytes += sizeof(*client->ctx) + pconf_bytes(client->ctx);
+		}
+	}
+
+	return bytes;
+}
+
 /* disconnect a client connection and free all related memory */
 static void client_disconnect(nut_ctype_t *client)
 {
@@ -570,9 +1327,26 @@ static void client_disconnect(nut_ctype_t *client)
 		return;
 	}
 
+	if (client->ssl_handshaking) {
+		/* a worker thread still has it, see handshake_done() */
+		client->ssl_dropped = 1;
+		return;
+	}
+
 	upsdebugx(2, "Disconnect from %s", client->addr);
 
-	shutdown(client->sock_fd, 2);
+	netstats.disconnected++;
+	netstats.bytes_out += client->outbytes;
+	numclients--;
+
+	timer_cancel(&client->idle_timer);
+
+#ifdef UPSD_EVLOOP
+	evloop_del(client->sock_fd);
+#endif
+	if (!client->handedoff) {
+		shutdown(client->sock_fd, 2);
+	}
 	close(client->sock_fd);
 
 #ifdef WIN32
@@ -585,7 +1359,16 @@ static void client_disconnect(nut_ctype_t *client)
 
 	ssl_finish(client);
 
-	pconf_finish(&client->ctx);
+	if (client->ctx && client->ctx != &client_shared_ctx) {
+		pconf_finish(client->ctx);
+		free(client->ctx);
+	}
+
+	watch_free(client);
+	relay_free(client);
+	binary_free(client);
+	zip_free(client);
+	metrics_client_free(client);
 
 	if (client->prev) {
 		client->prev->next = client->next;
@@ -605,294 +1388,1956 @@ static void client_disconnect(nut_ctype_t *client)
 	free(client->loginups);
 	free(client->password);
 	free(client->username);
+	free(client->outbuf);
 	free(client);
 
 	return;
 }
 
-/* send the buffer <sendbuf> of length <sendlen> to host <dest>
- * returns effectively a boolean: 0 = failed, 1 = sent ok
- */
-int sendback(nut_ctype_t *client, const char *fmt, ...)
+/* shed clients after CLIENT_INACTIVITY_DELAY seconds of silence,
+ * and those which client_expire() gave up on */
+static void client_idle(upsd_timer_t *timer, time_t now)
 {
-	ssize_t	res;
-	size_t	len;
-	char	ans[NUT_NET_ANSWER_MAX+1];
-	va_list	ap;
-
-	if (!client) {
-		return 0;
-	}
-
-	va_start(ap, fmt);
-	vsnprintf(ans, sizeof(ans), fmt, ap);
-	va_end(ap);
-
-	len = strlen(ans);
-
-	/* System write() and our ssl_write() have a loophole that they write a
-	 * size_t amount of bytes and upon success return that in ssize_t value
-	 */
-	assert(len < SSIZE_MAX);
+	nut_ctype_t	*client = (nut_ctype_t *)timer->data;
 
-#ifdef WITH_SSL
-	if (client->ssl) {
-		res = ssl_write(client, ans, len);
-	} else
-#endif /* WITH_SSL */
-	{
-		res = write(client->sock_fd, ans, len);
+	if (client->ssl_handshaking) {
+		/* see handshake_done() */
+		timer_set(timer, now + client_inactivity_delay);
+		return;
 	}
 
-	{ /* scoping */
-		char * s = str_rtrim(ans, '\n');
-		upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%s]", client->sock_fd, len, s);
+	if (client->outoverflow
+	 || difftime(now, client->last_heard) > client_inactivity_delay
+	) {
+		client_disconnect(client);
+		return;
 	}
 
-	if (res < 0 || len != (size_t)res) {
-		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
-		client->last_heard = 0;
-		return 0;	/* failed */
-	}
+	timer_set(timer, client->last_heard + client_inactivity_delay + 1);
+}
 
-	return 1;	/* OK */
+void client_expire(nut_ctype_t *client)
+{
+	client->last_heard = 0;
+	timer_set(&client->idle_timer, 0);
 }
 
-/* just a simple wrapper for now */
-int send_err(nut_ctype_t *client, const char *errtype)
+#ifndef WIN32
+# if (defined EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+#  define CLIENT_WOULDBLOCK(e)	((e) == EAGAIN || (e) == EWOULDBLOCK)
+# else
+#  define CLIENT_WOULDBLOCK(e)	((e) == EAGAIN)
+# endif
+#endif	/* !WIN32 */
+
+/* largest chunk handed to ssl_write() at once: one TLS record */
+#define SENDBACK_TLS_RECORD	16384
+
+/* the client has more than MAXCLIENTQUEUE bytes which it did not read
+ * yet if len more are queued: drop it then and return 0, 1 otherwise */
+static int client_outbuf_check(nut_ctype_t *client, size_t len)
 {
-	if (!client) {
-		return -1;
+	if (maxclientqueue == 0 || client->outlen + len <= maxclientqueue) {
+		return 1;
 	}
 
-	upsdebugx(4, "Sending error [%s] to client %s", errtype, client->addr);
+	upslogx(LOG_WARNING, "Client %s is not reading its replies "
+		"(%" PRIuSIZE " bytes queued, MAXCLIENTQUEUE is %" PRIuSIZE "), "
+		"disconnecting", client->addr, client->outlen + len,
+		maxclientqueue);
 
-	return sendback(client, "ERR %s\n", errtype);
+	free(client->outbuf);
+	client->outbuf = NULL;
+	client->outsize = client->outhead = client->outlen = 0;
+
+	/* Can not free it right here, the caller may still be using
+	 * the client; mainloop() will shed it on the next pass */
+	client->outoverflow = 1;
+	client_expire(client);
+	return 0;
 }
 
-/* disconnect anyone logged into this UPS */
-void kick_login_clients(const char *upsname)
+/* append data to the client's output buffer, growing it as needed */
+static void client_outbuf_append(nut_ctype_t *client, const char *buf, size_t len)
 {
-	nut_ctype_t	*client, *cnext;
-
-	for (client = firstclient; client; client = cnext) {
+	if (client->outhead + client->outlen + len > client->outsize) {
+		if (client->outhead > 0) {
+			memmove(client->outbuf, client->outbuf + client->outhead, client->outlen);
+			client->outhead = 0;
+		}
 
-		cnext = client->next;
+		if (client->outlen + len > client->outsize) {
+			size_t	newsize = (client->outsize ? client->outsize : 4 * NUT_NET_ANSWER_MAX);
 
-		/* if it's not logged in, don't check it */
-		if (!client->loginups) {
-			continue;
-		}
+			while (newsize < client->outlen + len) {
+				newsize *= 2;
+			}
 
-		if (!strcmp(client->loginups, upsname)) {
-			upslogx(LOG_INFO, "Kicking client %s (was on UPS [%s])\n", client->addr, upsname);
-			client_disconnect(client);
+			client->outbuf = xrealloc(client->outbuf, newsize);
+			client->outsize = newsize;
 		}
 	}
+
+	memcpy(client->outbuf + client->outhead + client->outlen, buf, len);
+	client->outlen += len;
 }
 
-/* make sure a UPS is sane - connected, with fresh data */
-int ups_available(const upstype_t *ups, nut_ctype_t *client)
+/* all that was queued went out: with LOWMEM, the buffer goes too, as
+ * most clients never need it again */
+static void client_outbuf_drained(nut_ctype_t *client)
 {
-	if (!ups) {
-		/* Should never happen, but handle this
-		 * just in case instead of segfaulting */
-		upsdebugx(1, "%s: ERROR, called with a NULL ups pointer", __func__);
-		send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
-		return 0;
+	client->outhead = 0;
+
+	if (lowmem && client->outbuf) {
+		free(client->outbuf);
+		client->outbuf = NULL;
+		client->outsize = 0;
 	}
+}
 
-	if (INVALID_FD(ups->sock_fd)) {
-		send_err(client, NUT_ERR_DRIVER_NOT_CONNECTED);
+#ifndef WIN32
+/* the socket did not take all we had, wait for POLLOUT to write the rest */
+static void client_stalled(nut_ctype_t *client)
+{
+	client->outstalls++;
+	upsdebugx(3, "%s: client %s is busy, queueing replies (stall #%" PRIuSIZE ")",
+		__func__, client->addr, client->outstalls);
+#ifdef UPSD_EVLOOP
+	evloop_want_write(client->sock_fd, 1);
+#endif
+}
+
+/* keep the tail of a reply which the socket did not accept right away,
+ * to be written out when the client is ready (POLLOUT) again;
+ * returns 0 if the client already has too much queued, 1 otherwise */
+static int client_enqueue(nut_ctype_t *client, const char *buf, size_t len)
+{
+	int	was_empty = (client->outlen == 0);
+
+	if (!client_outbuf_check(client, len)) {
 		return 0;
 	}
 
-	if (ups->stale) {
-		send_err(client, NUT_ERR_DATA_STALE);
-		return 0;
+	client_outbuf_append(client, buf, len);
+
+	if (was_empty) {
+		client_stalled(client);
 	}
 
-	/* must be OK */
 	return 1;
 }
 
-/* check flags and access for an incoming command from the network */
-static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
-	const char **arg)
+/* write out as much queued output as the socket takes;
+ * returns -1 on errors, 0 when the queue is empty, 1 if data remains */
+/* write out what is queued for client, or at most budget bytes of it
+ * if that is not 0; returns 1 if some is left (0 when done, -1 on error) */
+static int client_flush(nut_ctype_t *client, size_t budget)
 {
-	upsdebugx(6, "Entering %s: %s", __func__, numarg > 0 ? arg[0] : "<>");
+	ssize_t	res;
+	size_t	len, sent = 0;
+
+	while (client->outlen > 0) {
+		len = client->outlen;
+		if (budget) {
+			if (sent >= budget) {
+				/* the rest upon the next POLLOUT */
+				return 1;
+			}
+			if (len > budget - sent) {
+				len = budget - sent;
+			}
+		}
 
-	if (netcmds[cmdnum].flags & FLAG_USER) {
-		/* command requires previous authentication */
-#ifdef HAVE_WRAP
-		struct request_info	req;
-#endif	/* HAVE_WRAP */
+		res = write(client->sock_fd, client->outbuf + client->outhead, len);
+		client->outwrites++;
 
-		if (!client->username) {
-			upsdebugx(1, "%s: client not logged in yet", __func__);
-			send_err(client, NUT_ERR_USERNAME_REQUIRED);
-			return;
-		}
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
 
-		if (!client->password) {
-			upsdebugx(1, "%s: client not logged in yet", __func__);
-			send_err(client, NUT_ERR_PASSWORD_REQUIRED);
-			return;
+			if (CLIENT_WOULDBLOCK(errno)) {
+				return 1;
+			}
+
+			upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+			client_expire(client);
+			return -1;
 		}
 
-#ifdef HAVE_WRAP
-		request_init(&req, RQ_DAEMON, progname, RQ_FILE, client->sock_fd, RQ_USER, client->username, 0);
-		fromhost(&req);
+		upsdebugx(5, "%s: [destfd=%d] flushed %" PRIiSIZE " of %" PRIuSIZE " queued bytes",
+			__func__, client->sock_fd, res, client->outlen);
 
-		if (!hosts_access(&req)) {
-			upsdebugx(1,
-				"%s: while authenticating %s found that "
-				"tcp-wrappers says access should be denied",
-				__func__, client->username);
-			send_err(client, NUT_ERR_ACCESS_DENIED);
-			return;
-		}
-#endif	/* HAVE_WRAP */
+		client->outbytes += (size_t)res;
+		client->outhead += (size_t)res;
+		client->outlen -= (size_t)res;
+		sent += (size_t)res;
 	}
 
-	upsdebugx(6, "%s: Calling command handler for %s", __func__, numarg > 0 ? arg[0] : "<>");
+	client_outbuf_drained(client);
+#ifdef UPSD_EVLOOP
+	evloop_want_write(client->sock_fd, 0);
+#endif
+	return 0;
+}
+#endif	/* !WIN32 */
 
-	/* looks good - call the command */
-	netcmds[cmdnum].func(client, (numarg < 2) ? 0 : (numarg - 1), (numarg > 1) ? &arg[1] : NULL);
+static int client_send_wire(nut_ctype_t *client, const void *buf, size_t len);
+
+/* Collect the following sendback() replies in the client's output buffer
+ * instead of writing each line separately; sendback_uncork() sends them
+ * off with as few writes as possible (used for multi-line LIST answers).
+ * If replies are already queued for this client, new ones are appended
+ * behind them anyway, and go out together upon POLLOUT.
+ */
+void sendback_cork(nut_ctype_t *client)
+{
+	if (client && client->outlen == 0) {
+		client->corked = 1;
+	}
 }
 
-/* parse requests from the network */
-static void parse_net(nut_ctype_t *client)
+/* write out what was collected since sendback_cork() so far; with
+ * plain sockets, what the client does not take now stays queued
+ * returns effectively a boolean: 0 = failed, 1 = sent ok (or queued)
+ */
+static int client_cork_flush(nut_ctype_t *client)
 {
-	int	i;
+#ifdef WITH_SSL
+	if (client->ssl) {
+		ssize_t	res;
+		size_t	chunk;
 
-	/* shouldn't happen */
-	if (client->ctx.numargs < 1) {
-		send_err(client, NUT_ERR_UNKNOWN_COMMAND);
-		return;
+		while (client->outlen > 0) {
+			chunk = client->outlen;
+			if (chunk > SENDBACK_TLS_RECORD) {
+				chunk = SENDBACK_TLS_RECORD;
+			}
+
+			res = ssl_write(client, client->outbuf + client->outhead, chunk);
+			client->outwrites++;
+
+			if (res < 0 || chunk != (size_t)res) {
+				upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+				client->outhead = client->outlen = 0;
+				client_expire(client);
+				return 0;	/* failed */
+			}
+
+			client->outbytes += chunk;
+			client->outhead += chunk;
+			client->outlen -= chunk;
+		}
+
+		client_outbuf_drained(client);
+		return 1;
 	}
+#endif	/* WITH_SSL */
 
-	for (i = 0; netcmds[i].name; i++) {
-		if (!strcasecmp(netcmds[i].name, client->ctx.arglist[0])) {
-			check_command(i, client, client->ctx.numargs, (const char **) client->ctx.arglist);
-			return;
+#ifndef WIN32
+	if (client_flush(client, 0) < 0) {
+		return 0;	/* failed */
+	}
+#else
+	while (client->outlen > 0) {
+		ssize_t	res = write(client->sock_fd, client->outbuf + client->outhead, client->outlen);
+		client->outwrites++;
+
+		if (res <= 0) {
+			upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+			client->outhead = client->outlen = 0;
+			client_expire(client);
+			return 0;	/* failed */
 		}
+
+		client->outbytes += (size_t)res;
+		client->outhead += (size_t)res;
+		client->outlen -= (size_t)res;
 	}
 
-	/* fallthrough = not matched by any entry in netcmds */
+	client_outbuf_drained(client);
+#endif	/* !WIN32 */
 
-	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
+	return 1;	/* OK */
 }
 
-/* answer incoming tcp connections */
-static void client_connect(stype_t *server)
+/* write out what was collected since sendback_cork()
+ * returns effectively a boolean: 0 = failed, 1 = sent ok (or queued)
+ */
+int sendback_uncork(nut_ctype_t *client)
 {
-	struct	sockaddr_storage csock;
-#if defined(__hpux) && !defined(_XOPEN_SOURCE_EXTENDED)
-	int	clen;
-#else
-	socklen_t	clen;
-#endif
-	int		fd;
-	nut_ctype_t		*client;
-
-	clen = sizeof(csock);
-	fd = accept(server->sock_fd, (struct sockaddr *) &csock, &clen);
+	if (!client || !client->corked) {
+		return 0;
+	}
 
-	if (fd < 0) {
-		return;
+	/* the end of the compressed reply, behind the rest of it */
+	if (client->zip && !client->outoverflow
+	 && !zip_deflate(client, NULL, 0, 1, client_send_wire)
+	) {
+		client->corked = 0;
+		return 0;
 	}
 
-	client = xcalloc(1, sizeof(*client));
+	client->corked = 0;
 
-	client->sock_fd = fd;
+	if (client->outoverflow || !client_cork_flush(client)) {
+		return 0;
+	}
 
-	time(&client->last_heard);
+	/* only what the client did not take counts against MAXCLIENTQUEUE */
+	if (!client_outbuf_check(client, 0)) {
+		return 0;
+	}
 
-	client->addr = xstrdup(inet_ntopW(&csock));
+#ifndef WIN32
+	if (client->outlen > 0) {
+		client_stalled(client);
+	}
+#endif	/* !WIN32 */
 
-	client->tracking = 0;
+	return 1;	/* OK */
+}
 
-#ifdef WIN32
-	client->Event = CreateEvent(NULL, /* Security, */
-				FALSE,    /* auto-reset */
-				FALSE,    /* initial state */
-				NULL);    /* no name */
+/* Before a STARTTLS handshake, which reads and writes the socket itself,
+ * put the client back into blocking mode and write out what is queued.
+ * Returns effectively a boolean: 0 = failed (client will be dropped), 1 = ok
+ */
+int client_output_drain(nut_ctype_t *client)
+{
+#ifndef WIN32
+	int	v;
 
-	/* Associate socket event to the socket via its Event object */
-	WSAEventSelect( client->sock_fd, client->Event, FD_READ );
-#endif
+	if ((v = fcntl(client->sock_fd, F_GETFL, 0)) == -1
+	 || fcntl(client->sock_fd, F_SETFL, v & ~O_NDELAY) == -1
+	) {
+		upslog_with_errno(LOG_NOTICE, "fcntl() failed for %s", client->addr);
+		client_expire(client);
+		return 0;
+	}
 
-	pconf_init(&client->ctx, NULL);
+	if (client->outoverflow || client_flush(client, 0) != 0) {
+		return 0;
+	}
+#else
+	NUT_UNUSED_VARIABLE(client);
+#endif
+
+	return 1;
+}
+
+/* put <len> bytes from <buf> on the wire of the client (compressed
+ * already if it asked for COMPRESS), see sendback_raw()
+ * returns effectively a boolean: 0 = failed, 1 = sent ok (or queued)
+ */
+static int client_send_wire(nut_ctype_t *client, const void *buf, size_t len)
+{
+	ssize_t	res;
+	const char	*ans = (const char *)buf;
+
+	/* System write() and our ssl_write() have a loophole that they write a
+	 * size_t amount of bytes and upon success return that in ssize_t value
+	 */
+	assert(len < SSIZE_MAX);
+
+	if (client->corked) {
+		/* sent by sendback_uncork(), or as soon as there is a TLS
+		 * record worth of it, so a long answer is not all kept here;
+		 * only what the client did not take counts against
+		 * MAXCLIENTQUEUE then */
+		client_outbuf_append(client, ans, len);
+		if (client->outlen >= SENDBACK_TLS_RECORD && !client->ssl_handshaking
+		 && (!client_cork_flush(client) || !client_outbuf_check(client, 0))
+		) {
+			return 0;
+		}
+		res = (ssize_t)len;
+	} else
+#ifdef WITH_SSL
+	if (client->ssl) {
+		res = ssl_write(client, ans, len);
+		client->outwrites++;
+		if (res > 0) {
+			client->outbytes += (size_t)res;
+		}
+	} else
+#endif /* WITH_SSL */
+	{
+#ifndef WIN32
+		/* Plain sockets are non-blocking: whatever the client is not
+		 * ready to take now is queued (behind earlier leftovers, if
+		 * any) and written from mainloop() upon POLLOUT */
+		if (client->outlen > 0) {
+			res = 0;
+		} else {
+			res = write(client->sock_fd, ans, len);
+			client->outwrites++;
+			if (res < 0 && (errno == EINTR || CLIENT_WOULDBLOCK(errno))) {
+				res = 0;
+			}
+			if (res > 0) {
+				client->outbytes += (size_t)res;
+			}
+		}
+
+		if (res >= 0 && (size_t)res < len) {
+			if (!client_enqueue(client, ans + res, len - (size_t)res)) {
+				return 0;
+			}
+			res = (ssize_t)len;
+		}
+#else
+		res = write(client->sock_fd, ans, len);
+		client->outwrites++;
+		if (res > 0) {
+			client->outbytes += (size_t)res;
+		}
+#endif
+	}
+
+	if (res < 0 || len != (size_t)res) {
+		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+		client_expire(client);
+		return 0;	/* failed */
+	}
+
+	return 1;	/* OK */
+}
+
+/* send <len> bytes from <buf> to the client, as they are
+ * returns effectively a boolean: 0 = failed, 1 = sent ok (or queued)
+ */
+int sendback_raw(nut_ctype_t *client, const void *buf, size_t len)
+{
+	if (!client) {
+		return 0;
+	}
+
+	if (client->muted) {
+		/* the reply was already given, see client_adopt() */
+		return 1;
+	}
+
+	if (client->outoverflow) {
+		/* on its way out, see client_outbuf_check() */
+		return 0;
+	}
+
+	NUT_TRACE_BUF(NUT_TRACE_NET_SEND, (long)client->sock_fd, (const char *)buf, len);
+
+	if (client->zip) {
+		/* all of it goes out now, unless more is to come */
+		return zip_deflate(client, buf, len, !client->corked, client_send_wire);
+	}
+
+	return client_send_wire(client, buf, len);
+}
+
+/* send the formatted text to the client
+ * returns effectively a boolean: 0 = failed, 1 = sent ok (or queued)
+ */
+int sendback(nut_ctype_t *client, const char *fmt, ...)
+{
+	int	ret;
+	size_t	len;
+	char	ans[NUT_NET_ANSWER_MAX+1];
+	va_list	ap;
+
+	if (!client) {
+		return 0;
+	}
+
+	if (client->outoverflow) {
+		/* on its way out, see client_outbuf_check() */
+		return 0;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(ans, sizeof(ans), fmt, ap);
+	va_end(ap);
+
+	len = strlen(ans);
+	ret = sendback_raw(client, ans, len);
+
+	/* the line without its newline, only measured when it is logged */
+	upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%.*s]", client->sock_fd, len,
+		(int)(len > 0 && ans[len - 1] == '\n' ? len - 1 : len), ans);
+
+	return ret;
+}
+
+/* just a simple wrapper for now */
+int send_err(nut_ctype_t *client, const char *errtype)
+{
+	if (!client) {
+		return -1;
+	}
+
+	upsdebugx(4, "Sending error [%s] to client %s", errtype, client->addr);
+
+	return sendback(client, "ERR %s\n", errtype);
+}
+
+/* disconnect anyone logged into this UPS */
+void kick_login_clients(const char *upsname)
+{
+	nut_ctype_t	*client, *cnext;
+
+	for (client = firstclient; client; client = cnext) {
+
+		cnext = client->next;
+
+		/* if it's not logged in, don't check it */
+		if (!client->loginups) {
+			continue;
+		}
+
+		if (!strcmp(client->loginups, upsname)) {
+			upslogx(LOG_INFO, "Kicking client %s (was on UPS [%s])\n", client->addr, upsname);
+			client_disconnect(client);
+		}
+	}
+}
+
+/* make sure a UPS is sane - connected, with fresh data */
+int ups_available(const upstype_t *ups, nut_ctype_t *client)
+{
+	if (!ups) {
+		/* Should never happen, but handle this
+		 * just in case instead of segfaulting */
+		upsdebugx(1, "%s: ERROR, called with a NULL ups pointer", __func__);
+		send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
+		return 0;
+	}
+
+	if (INVALID_FD(ups->sock_fd)) {
+		send_err(client, NUT_ERR_DRIVER_NOT_CONNECTED);
+		return 0;
+	}
+
+	if (ups->stale) {
+		send_err(client, NUT_ERR_DATA_STALE);
+		return 0;
+	}
+
+	/* must be OK */
+	return 1;
+}
+
+/* check flags and access for an incoming command from the network */
+static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
+	const char **arg)
+{
+	upsdebugx(6, "Entering %s: %s", __func__, numarg > 0 ? arg[0] : "<>");
+
+	if (netcmds[cmdnum].flags & FLAG_USER) {
+		/* command requires previous authentication */
+#ifdef HAVE_WRAP
+		struct request_info	req;
+#endif	/* HAVE_WRAP */
+
+		if (!client->username) {
+			upsdebugx(1, "%s: client not logged in yet", __func__);
+			send_err(client, NUT_ERR_USERNAME_REQUIRED);
+			return;
+		}
+
+		if (!client->password) {
+			upsdebugx(1, "%s: client not logged in yet", __func__);
+			send_err(client, NUT_ERR_PASSWORD_REQUIRED);
+			return;
+		}
+
+#ifdef HAVE_WRAP
+		request_init(&req, RQ_DAEMON, progname, RQ_FILE, client->sock_fd, RQ_USER, client->username, 0);
+		fromhost(&req);
+
+		if (!hosts_access(&req)) {
+			upsdebugx(1,
+				"%s: while authenticating %s found that "
+				"tcp-wrappers says access should be denied",
+				__func__, client->username);
+			send_err(client, NUT_ERR_ACCESS_DENIED);
+			return;
+		}
+#endif	/* HAVE_WRAP */
+	}
+
+	upsdebugx(6, "%s: Calling command handler for %s", __func__, numarg > 0 ? arg[0] : "<>");
+
+	/* looks good - call the command */
+	netcmds[cmdnum].func(client, (numarg < 2) ? 0 : (numarg - 1), (numarg > 1) ? &arg[1] : NULL);
+}
+
+#ifdef UPSD_WORKERS
+/* may a worker answer this command itself? */
+static int worker_serves(int cmdnum, const nut_ctype_t *client)
+{
+	const char	*sub = (client->ctx->numargs > 1 ? client->ctx->arglist[1] : "");
+
+	if (netcmds[cmdnum].flags & FLAG_OWNER) {
+		return 0;
+	}
+
+	/* counters and lists only the main process keeps */
+	if (!strcasecmp(netcmds[cmdnum].name, "GET")) {
+		return (strcasecmp(sub, "NUMLOGINS") && strcasecmp(sub, "TRACKING"));
+	}
+
+	if (!strcasecmp(netcmds[cmdnum].name, "LIST")) {
+		return strcasecmp(sub, "CLIENT");
+	}
+
+	return 1;
+}
+#endif	/* UPSD_WORKERS */
+
+/* parse requests from the network */
+static void parse_net(nut_ctype_t *client)
+{
+	int	i;
+
+	/* shouldn't happen */
+	if (client->ctx->numargs < 1) {
+		send_err(client, NUT_ERR_UNKNOWN_COMMAND);
+		return;
+	}
+
+	NUT_TRACE2(NUT_TRACE_NET_CMD, (long)client->sock_fd, (int64_t)client->ctx->numargs,
+		client->ctx->arglist[0], (client->ctx->numargs > 1 ? client->ctx->arglist[1] : NULL));
+
+	/* a feed of a device talks like its driver from then on */
+	if (client->relay) {
+		relay_input(client);
+		return;
+	}
+
+	for (i = 0; netcmds[i].name; i++) {
+		if (!strcasecmp(netcmds[i].name, client->ctx->arglist[0])) {
+			size_t	outbytes = client->outbytes, outwrites = client->outwrites;
+			struct timeval	start;
+
+#ifdef UPSD_WORKERS
+			if (worker_fd >= 0 && !worker_serves(i, client)) {
+				/* see client_feed() */
+				client->handoff = 1;
+				return;
+			}
+#endif
+
+			gettimeofday(&start, NULL);
+			check_command(i, client, client->ctx->numargs, (const char **) client->ctx->arglist);
+			netstats_command((size_t)i, &start);
+
+			upsdebugx(3, "%s: %s from %s answered with %" PRIuSIZE
+				" bytes in %" PRIuSIZE " writes",
+				__func__, netcmds[i].name, client->addr,
+				client->outbytes - outbytes,
+				client->outwrites - outwrites);
+			return;
+		}
+	}
+
+	/* fallthrough = not matched by any entry in netcmds */
+
+	netstats.unknown++;
+	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
+}
+
+/* set up a client for a connected socket, NULL if it was refused */
+static nut_ctype_t *client_add(int fd, struct sockaddr_storage *csock, int metrics)
+{
+	nut_ctype_t		*client;
+
+	client = xcalloc(1, sizeof(*client));
+
+	client->sock_fd = fd;
+
+	time(&client->last_heard);
+	timer_init(&client->idle_timer, client_idle, client);
+	timer_set(&client->idle_timer, client->last_heard + client_inactivity_delay + 1);
+
+	client->addr = xstrdup(inet_ntopW(csock));
+
+	client->tracking = 0;
+
+	if (metrics) {
+		metrics_client_init(client);
+	}
+
+#ifndef WIN32
+	/* replies are queued rather than waited for, see sendback() */
+	{ /* scoping */
+		int	v;
+
+		if ((v = fcntl(fd, F_GETFL, 0)) == -1
+		 || fcntl(fd, F_SETFL, v | O_NDELAY) == -1
+		) {
+			upslog_with_errno(LOG_WARNING, "%s: fcntl() failed for %s",
+				__func__, client->addr);
+		}
+	}
+#endif
+
+#ifdef WIN32
+	client->Event = CreateEvent(NULL, /* Security, */
+				FALSE,    /* auto-reset */
+				FALSE,    /* initial state */
+				NULL);    /* no name */
+
+	/* Associate socket event to the socket via its Event object */
+	WSAEventSelect( client->sock_fd, client->Event, FD_READ );
+#endif
+
+	/* with LOWMEM, a parser only once it sends something */
+	client->ctx = NULL;
+	if (!lowmem) {
+		client_ctx_take(client);
+	}
+
+#ifdef UPSD_EVLOOP
+	evloop_add(client->sock_fd, CLIENT, client);
+#endif
+
+	if (firstclient) {
+		firstclient->prev = client;
+		client->next = firstclient;
+	}
+
+	firstclient = client;
+	numclients++;
+	if (numclients > netstats.peak) {
+		netstats.peak = numclients;
+	}
+
+/*
+	if (lastclient) {
+		client->prev = lastclient;
+		lastclient->next = client;
+	}
+
+	lastclient = client;
+ */
+	upsdebugx(2, "Connect from %s", client->addr);
+
+	return client;
+}
+
+/* what is left of MAXCONN for the clients: drivers and listeners (and
+ * a couple of internal channels) take their share first, see mainloop() */
+static size_t client_slots(void)
+{
+	upstype_t	*ups;
+	stype_t		*server;
+	size_t		used = 2;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		if (VALID_FD(ups->sock_fd)) {
+			used++;
+		}
+	}
+
+	for (server = firstaddr; server; server = server->next) {
+		if (server->sock_fd >= 0) {
+			used++;
+		}
+	}
+
+	return ((size_t)maxconn > used) ? (size_t)maxconn - used : 0;
+}
+
+/* token buckets of the addresses which connected lately, MAXCONNRATE
+ * tokens a second up to as many in reserve; two addresses sharing a slot
+ * just reset each other's bucket, which errs on the side of admitting */
+typedef struct {
+	int		family;
+	unsigned char	addr[16];
+	double		tokens;
+	struct timeval	last;
+} rate_slot_t;
+
+static rate_slot_t	rate_slots[UPSD_RATE_SLOTS];
+
+static int client_rate_ok(const struct sockaddr_storage *csock)
+{
+	const unsigned char	*addr;
+	size_t		len, i;
+	uint32_t	hash = 2166136261U;	/* FNV-1a */
+	rate_slot_t	*slot;
+	struct timeval	tv;
+
+	switch (csock->ss_family) {
+	case AF_INET:
+		addr = (const unsigned char *)&((const struct sockaddr_in *)csock)->sin_addr;
+		len = 4;
+		break;
+	case AF_INET6:
+		addr = (const unsigned char *)&((const struct sockaddr_in6 *)csock)->sin6_addr;
+		len = 16;
+		break;
+	default:
+		return 1;
+	}
+
+	/* the port changes with every connection, the address does not */
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ addr[i]) * 16777619U;
+	}
+
+	slot = &rate_slots[hash & (UPSD_RATE_SLOTS - 1)];
+	gettimeofday(&tv, NULL);
+
+	if (slot->family != csock->ss_family || memcmp(slot->addr, addr, len)) {
+		slot->family = csock->ss_family;
+		memset(slot->addr, 0, sizeof(slot->addr));
+		memcpy(slot->addr, addr, len);
+		slot->tokens = maxconnrate;
+	} else {
+		slot->tokens += difftimeval(tv, slot->last) * maxconnrate;
+		if (slot->tokens > maxconnrate) {
+			slot->tokens = maxconnrate;
+		}
+	}
+
+	slot->last = tv;
+
+	if (slot->tokens < 1) {
+		return 0;
+	}
+
+	slot->tokens -= 1;
+	return 1;
+}
+
+/* whether a new connection from csock may stay */
+static int client_admit(struct sockaddr_storage *csock)
+{
+	static time_t	lastlog = 0;
+	static uint64_t	lastcount = 0;
+	static int	nearing = 0;
+	size_t	slots = client_slots();
+	time_t	now;
+
+	if (numclients >= slots) {
+		/* refused outright: with poll() they would wait unserved
+		 * until others leave, and with the other loops be served
+		 * beyond what the administrator asked for */
+		netstats.rejected++;
+
+		time(&now);
+		if (difftime(now, lastlog) >= UPSD_REJECT_LOG_DELAY) {
+			upslogx(LOG_WARNING, "Rejecting connection from %s: "
+				"MAXCONN (%" PRIdMAX ") reached, %" PRIu64
+				" rejected since last warned",
+				NUT_STRARG(inet_ntopW(csock)), (intmax_t)maxconn,
+				netstats.rejected - lastcount);
+			lastlog = now;
+			lastcount = netstats.rejected;
+		}
+		return 0;
+	}
+
+	/* say so once, well before connections are lost; again only after
+	 * the crowd thinned out */
+	if (!nearing && numclients + 1 >= slots - slots / 10) {
+		upslogx(LOG_NOTICE, "%" PRIuSIZE " clients connected, "
+			"MAXCONN (%" PRIdMAX ") leaves room for %" PRIuSIZE,
+			numclients + 1, (intmax_t)maxconn, slots);
+		nearing = 1;
+	} else if (nearing && numclients < slots - slots / 5) {
+		nearing = 0;
+	}
+
+	if (maxconnrate > 0 && !client_rate_ok(csock)) {
+		netstats.ratelimited++;
+		upsdebugx(2, "Rejecting connection from %s: MAXCONNRATE (%u) exceeded",
+			NUT_STRARG(inet_ntopW(csock)), maxconnrate);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* answer incoming tcp connections */
+static void client_connect(stype_t *server)
+{
+	struct	sockaddr_storage csock;
+#if defined(__hpux) && !defined(_XOPEN_SOURCE_EXTENDED)
+	int	clen;
+#else
+	socklen_t	clen;
+#endif
+	int		fd, n;
+
+	/* take all that wait (the listener does not block), but leave the
+	 * rest of a storm to the next wakeup so that clients are served */
+	for (n = 0; n < UPSD_ACCEPT_BATCH; n++) {
+		clen = sizeof(csock);
+#ifdef HAVE_ACCEPT4
+		fd = accept4(server->sock_fd, (struct sockaddr *) &csock, &clen,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		fd = accept(server->sock_fd, (struct sockaddr *) &csock, &clen);
+#endif
+
+		if (fd < 0) {
+			/* nobody else waits, or e.g. out of descriptors:
+			 * either way the next wakeup tells */
+			return;
+		}
+
+		netstats.accepted++;
+
+		if (!client_admit(&csock)) {
+			close(fd);
+			continue;
+		}
+
+		client_add(fd, &csock, server->metrics);
+	}
+}
+
+static void client_feed(nut_ctype_t *client, const char *buf, size_t len, size_t budget);
+static void client_feed_all(nut_ctype_t *client, const char *buf, size_t len);
+#ifdef UPSD_WORKERS
+static void worker_handoff(nut_ctype_t *client, const char *rest, size_t restlen);
+#endif
+
+/* read tcp messages and handle them */
+static void client_readline(nut_ctype_t *client)
+{
+	char	buf[SMALLBUF];
+	ssize_t	ret;
+
+	if (client->inpendlen) {
+		/* the socket is read on once that is done, see clients_pending() */
+		return;
+	}
+
+#ifdef WITH_SSL
+	if (client->ssl) {
+		ret = ssl_read(client, buf, sizeof(buf));
+	} else
+#endif /* WITH_SSL */
+	{
+		ret = read(client->sock_fd, buf, sizeof(buf));
+	}
+
+	if (ret < 0) {
+#ifndef WIN32
+		if (!client->ssl && (errno == EINTR || CLIENT_WOULDBLOCK(errno))) {
+			/* spurious wakeup of a non-blocking socket */
+			return;
+		}
+#endif
+		upsdebug_with_errno(2, "Disconnect %s (read failure)", client->addr);
+		client_disconnect(client);
+		return;
+	}
+
+	if (ret == 0) {
+		upsdebugx(2, "Disconnect %s (no data available)", client->addr);
+		client_disconnect(client);
+		return;
+	}
+
+	netstats.bytes_in += (uint64_t)ret;
+
+	if (client->metrics) {
+		time(&client->last_heard);
+
+		if (!client->closing && metrics_feed(client, buf, (size_t)ret)) {
+			client->closing = 1;
+		}
+
+		/* HTTP/1.1 with "Connection: close": done once it is sent */
+		if (client->closing && client->outlen == 0) {
+			client_disconnect(client);
+		}
+		return;
+	}
+
+	if (client->zip) {
+		if (!zip_inflate(client, buf, (size_t)ret, client_feed_all)) {
+			client_disconnect(client);
+		}
+		return;
+	}
+
+#ifndef WIN32
+	client_feed(client, buf, (size_t)ret, UPSD_CLIENT_LINES_MAX);
+#else
+	client_feed(client, buf, (size_t)ret, 0);
+#endif
+}
+
+/* what a COMPRESS client sent, inflated piece by piece: the commands are
+ * handled right away, as there is nowhere to keep the rest (inpend) */
+static void client_feed_all(nut_ctype_t *client, const char *buf, size_t len)
+{
+	client_feed(client, buf, len, 0);
+}
+
+/* handle the commands in what the client sent, or only budget of them
+ * if that is not 0 (the rest is kept for clients_pending()) */
+static void client_feed(nut_ctype_t *client, const char *buf, size_t len, size_t budget)
+{
+	size_t	i, used, lines = 0;
+	int	zipped;
+
+	client_ctx_take(client);
+
+	/* fragment handling code */
+	for (i = 0; i < len; i += used) {
+
+		/* let the parser take as much as it needs for the next line */
+		switch (pconf_feed(client->ctx, buf + i, len - i, &used))
+		{
+		case 1:
+			time(&client->last_heard);	/* command received */
+			zipped = (client->zip != NULL);
+			parse_net(client);
+#ifdef UPSD_WORKERS
+			if (client->handoff) {
+				/* main process, take it from here */
+				worker_handoff(client, buf + i + used, len - i - used);
+				return;
+			}
+#endif
+			if (client->outoverflow) {
+				/* do not bother with the rest */
+				goto done;
+			}
+			if (client->ssl_handshaking) {
+				/* STARTTLS: the socket is a worker's for now */
+#ifdef UPSD_EVLOOP
+				evloop_del(client->sock_fd);
+#endif
+				goto done;
+			}
+			if (client->zip && !zipped) {
+				/* COMPRESS: what came along is compressed */
+				if (i + used < len
+				 && !zip_inflate(client, buf + i + used, len - i - used, client_feed_all)
+				) {
+					client_disconnect(client);
+					return;
+				}
+				goto done;
+			}
+			if (budget && ++lines >= budget && i + used < len
+			 && len - i - used <= sizeof(client->inpend)
+			) {
+				client->inpendlen = len - i - used;
+				memcpy(client->inpend, buf + i + used, client->inpendlen);
+				goto done;
+			}
+			continue;
+
+		case 0:
+			continue;	/* haven't gotten a line yet */
+
+		default:
+			/* parse error */
+			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx->errmsg);
+			goto done;
+		}
+	}
+
+done:
+	client_ctx_release(client);
+}
+
+#ifndef WIN32
+/* go on with what clients sent beyond the commands handled in the last
+ * pass (see client_feed()), once the drivers were heard; returns 1 if
+ * some still have more, so that mainloop() does not wait for them */
+static int clients_pending(void)
+{
+	nut_ctype_t	*client, *cnext;
+	char	buf[SMALLBUF];
+	size_t	len;
+
+	for (client = firstclient; client; client = cnext) {
+		cnext = client->next;
+
+		if (!client->inpendlen) {
+			continue;
+		}
+
+		len = client->inpendlen;
+		memcpy(buf, client->inpend, len);
+		client->inpendlen = 0;
+
+		client_feed(client, buf, len, UPSD_CLIENT_LINES_MAX);
+	}
+
+	for (client = firstclient; client; client = client->next) {
+		if (client->inpendlen) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef UPSD_WORKERS
+/* the settings of the client, as the commands which replay them in the
+ * process it is handed over to (see client_adopt()); USERNAME and
+ * PASSWORD are just stored, so not checked twice.  0 if they did not fit */
+static int client_encode(nut_ctype_t *client, char *buf, size_t bufsize)
+{
+	char	esc[SMALLBUF * 4];
+
+	buf[0] = '\0';
+	if (client->username) {
+		snprintfcat(buf, bufsize, "USERNAME \"%s\"\n",
+			pconf_encode(client->username, esc, sizeof(esc)));
+	}
+	if (client->password) {
+		snprintfcat(buf, bufsize, "PASSWORD \"%s\"\n",
+			pconf_encode(client->password, esc, sizeof(esc)));
+	}
+	if (client->loginups) {
+		snprintfcat(buf, bufsize, "LOGIN \"%s\"\n",
+			pconf_encode(client->loginups, esc, sizeof(esc)));
+	}
+	if (client->tracking) {
+		snprintfcat(buf, bufsize, "SET TRACKING ON\n");
+	}
+	if (client->binary) {
+		snprintfcat(buf, bufsize, "FRAMING BINARY\n");
+	}
+
+	return watch_encode(client, buf, bufsize) && strlen(buf) + 1 < bufsize;
+}
+
+/* send a message of the channel, with a descriptor if fd >= 0 */
+static int channel_send(int chan, const struct iovec *iov, size_t iovlen, int fd)
+{
+	struct msghdr	msg;
+	union {
+		struct cmsghdr	hdr;
+		char	buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr	*cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = iovlen;
+
+	if (fd >= 0) {
+		msg.msg_control = ctl.buf;
+		msg.msg_controllen = sizeof(ctl.buf);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return sendmsg(chan, &msg, 0) >= 0;
+}
+
+/* in a worker: give the client to the main process, for a command which
+ * only that can serve; rest is what the client sent after that command */
+static void worker_handoff(nut_ctype_t *client, const char *rest, size_t restlen)
+{
+	static char	prelude[WORKER_MSG_MAX / 2], cmd[WORKER_MSG_MAX / 4];
+	char	esc[SMALLBUF * 4];
+	size_t	k;
+	int	encoded;
+	struct iovec	iov[3];
+
+	client->handoff = 0;
+
+	/* what the main process should know of it */
+	encoded = client_encode(client, prelude, sizeof(prelude));
+
+	/* and the command itself, as it was parsed */
+	cmd[0] = '\0';
+	for (k = 0; k < client->ctx->numargs; k++) {
+		snprintfcat(cmd, sizeof(cmd), "%s\"%s\"", (k > 0 ? " " : ""),
+			pconf_encode(client->ctx->arglist[k], esc, sizeof(esc)));
+	}
+	snprintfcat(cmd, sizeof(cmd), "\n");
+
+	if (!encoded
+	 || strlen(cmd) + 1 >= sizeof(cmd)
+	 || restlen > WORKER_MSG_MAX / 4
+	) {
+		upslogx(LOG_WARNING, "%s: too much to hand over for %s",
+			__func__, client->addr);
+		client_disconnect(client);
+		return;
+	}
+
+	/* the ids it got from us mean nothing to the main process */
+	if (client->binary) {
+		binary_send_text(client, BINFRAME_RESET, "");
+	}
+
+	/* what we answered so far must arrive before the new replies */
+	if (!client_output_drain(client)) {
+		client_disconnect(client);
+		return;
+	}
+
+	iov[0].iov_base = prelude;
+	iov[0].iov_len = strlen(prelude) + 1;	/* with the NUL */
+	iov[1].iov_base = cmd;
+	iov[1].iov_len = strlen(cmd);
+	iov[2].iov_base = (void *)rest;
+	iov[2].iov_len = restlen;
+
+	if (!channel_send(worker_fd, iov, 3, client->sock_fd)) {
+		upslog_with_errno(LOG_WARNING, "%s: can't hand over %s",
+			__func__, client->addr);
+		client_disconnect(client);
+		return;
+	}
+
+	upsdebugx(2, "%s: %s handed over to the main process for %s",
+		__func__, client->addr, client->ctx->arglist[0]);
+
+	/* the socket is still the client's, just no longer ours */
+	client->handedoff = 1;
+	client_disconnect(client);
+}
+
+/* take over a client from another process (named by from): buf is the
+ * settings to replay (see client_encode()), a NUL, then what to feed it */
+static void client_adopt(const char *from, const char *buf, size_t len, int fd)
+{
+	struct	sockaddr_storage csock;
+#if defined(__hpux) && !defined(_XOPEN_SOURCE_EXTENDED)
+	int	clen;
+#else
+	socklen_t	clen;
+#endif
+	nut_ctype_t	*client;
+	const char	*nul = memchr(buf, '\0', len);
+	size_t	preludelen;
+
+	clen = sizeof(csock);
+	if (!nul || getpeername(fd, (struct sockaddr *) &csock, &clen) < 0) {
+		upsdebugx(1, "%s: dropping a client from %s", __func__, from);
+		close(fd);
+		return;
+	}
+
+	client = client_add(fd, &csock, 0);
+	if (!client) {
+		return;
+	}
+
+	upsdebugx(2, "%s: %s taken over from %s", __func__, client->addr, from);
+
+	/* the other process told the client OK to these already */
+	preludelen = (size_t)(nul - buf);
+	client->muted = 1;
+	client_feed(client, buf, preludelen, 0);
+	client->muted = 0;
+
+	client_feed(client, nul + 1, len - preludelen - 1, 0);
+}
+
+/* the channel of a worker (or, in a worker, to the main process) has
+ * something for us: a client, FSD for a UPS, or end of file */
+static void worker_event(upsd_worker_t *w)
+{
+	static char	buf[WORKER_MSG_MAX];
+	struct msghdr	msg;
+	struct iovec	iov;
+	union {
+		struct cmsghdr	hdr;
+		char	buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr	*cmsg;
+	ssize_t	ret;
+	int	fd = -1;
+
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf) - 1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	ret = recvmsg(w ? w->fd : worker_fd, &msg, 0);
+
+	if (ret < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); ret >= 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	if (!w) {
+		if (ret <= 0) {
+			upslogx(LOG_NOTICE, "%s: the main process is gone", __func__);
+			exit_flag = SIGTERM;
+			return;
+		}
+
+		buf[ret] = '\0';
+		if (!strncmp(buf, "FSD ", 4)) {
+			upstype_t	*ups = get_ups_ptr(buf + 4);
+
+			if (ups) {
+				upsdebugx(2, "%s: FSD set on UPS [%s]", __func__, ups->name);
+				ups->fsd = 1;
+				state_get_timestamp(&ups->lastdel);
+				watch_notify_setinfo(ups, "ups.status");
+			}
+		}
+
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	if (ret <= 0) {
+		int	status = 0;
+
+#ifdef UPSD_EVLOOP
+		evloop_del(w->fd);
+#endif
+		close(w->fd);
+		w->fd = -1;
+
+		if (waitpid(w->pid, &status, 0) < 0) {
+			status = 0;
+		}
+
+		upslogx(LOG_WARNING, "Worker PID %" PRIiMAX " is gone (status %d), "
+			"its share of the connections goes to the others",
+			(intmax_t)w->pid, status);
+		w->pid = -1;
+		return;
+	}
+
+	if (fd < 0) {
+		upsdebugx(1, "%s: worker PID %" PRIiMAX " sent no client",
+			__func__, (intmax_t)w->pid);
+		return;
+	}
+
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		upslogx(LOG_WARNING, "%s: incomplete handover from worker PID %" PRIiMAX,
+			__func__, (intmax_t)w->pid);
+		close(fd);
+		return;
+	}
+
+	{ /* scoping */
+		char	from[SMALLBUF];
+
+		snprintf(from, sizeof(from), "worker PID %" PRIiMAX, (intmax_t)w->pid);
+		client_adopt(from, buf, (size_t)ret, fd);
+	}
+}
+
+/* while still privileged, open the sockets of each worker next to the
+ * ones server_load() opened for us */
+static void workers_listen(void)
+{
+	stype_t	*server, *clone, **tail;
+	size_t	i;
+
+	if (upsd_workers == 0) {
+		return;
+	}
+
+	if (upsd_workers > UPSD_WORKERS_MAX) {
+		upslogx(LOG_WARNING, "WORKERS %" PRIuSIZE " is too many, using %d",
+			upsd_workers, UPSD_WORKERS_MAX);
+		upsd_workers = UPSD_WORKERS_MAX;
+	}
+
+	workers_num = upsd_workers;
+	workers = xcalloc(workers_num, sizeof(*workers));
+
+	for (i = 0; i < workers_num; i++) {
+		workers[i].pid = -1;
+		workers[i].fd = -1;
+		tail = &workers[i].listeners;
+
+		for (server = firstaddr; server; server = server->next) {
+			if (INVALID_FD_SOCK(server->sock_fd)) {
+				continue;
+			}
+
+			clone = xcalloc(1, sizeof(*clone));
+			clone->addr = xstrdup(server->addr);
+			clone->port = xstrdup(server->port);
+			clone->sock_fd = ERROR_FD_SOCK;
+			clone->metrics = server->metrics;
+
+			setuptcp(clone);
+			if (INVALID_FD_SOCK(clone->sock_fd)) {
+				fatalx(EXIT_FAILURE, "Fatal error: WORKERS could not "
+					"share %s port %s", clone->addr, clone->port);
+			}
+
+			*tail = clone;
+			tail = &clone->next;
+		}
+	}
+}
+
+static void workers_listeners_free(upsd_worker_t *w)
+{
+	stype_t	*server, *snext;
+
+	for (server = w->listeners; server; server = snext) {
+		snext = server->next;
+		stype_free(server);
+	}
+
+	w->listeners = NULL;
+}
+
+/* in the new worker i: keep only what is ours */
+static void worker_setup(size_t i, int fd)
+{
+	upstype_t	*ups;
+	size_t	j;
+
+	worker_fd = fd;
 
-	if (firstclient) {
-		firstclient->prev = client;
-		client->next = firstclient;
+	for (j = 0; j < workers_num; j++) {
+		if (workers[j].fd >= 0) {
+			close(workers[j].fd);
+		}
+		if (j != i) {
+			workers_listeners_free(&workers[j]);
+		}
 	}
 
-	firstclient = client;
+	server_free();
+	firstaddr = workers[i].listeners;
 
-/*
-	if (lastclient) {
-		client->prev = lastclient;
-		lastclient->next = client;
+	/* the beacons are the main process' job */
+	beacon_free();
+
+	free(workers);
+	workers = NULL;
+	workers_num = 0;
+
+	/* the PID file and the service manager are for the main process */
+	memset(pidfn, 0, sizeof(pidfn));
+	unsetenv("NOTIFY_SOCKET");
+
+#ifdef UPSD_UPGRADE
+	/* and so is an upgrade */
+	if (upgrade_fd >= 0) {
+		close(upgrade_fd);
+		upgrade_fd = -1;
 	}
+#endif
 
-	lastclient = client;
- */
-	upsdebugx(2, "Connect from %s", client->addr);
+	/* the driver connections we inherited are the main process' ones,
+	 * get our own (and our own copy of the data) */
+	for (ups = firstups; ups; ups = ups->next) {
+		sstate_disconnect(ups);
+	}
+
+	upslogx(LOG_INFO, "Worker %" PRIuSIZE " started", i + 1);
 }
 
-/* read tcp messages and handle them */
-static void client_readline(nut_ctype_t *client)
+/* fork the workers; called once we are done forking into background */
+static void workers_start(void)
 {
-	char	buf[SMALLBUF];
-	int	i;
+	size_t	i;
+	int	sv[2];
+	pid_t	pid;
+
+	for (i = 0; i < workers_num; i++) {
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "%s: socketpair", __func__);
+		}
+
+		if ((pid = fork()) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "%s: fork", __func__);
+		}
+
+		if (pid == 0) {
+			close(sv[0]);
+			worker_setup(i, sv[1]);
+			return;
+		}
+
+		close(sv[1]);
+		workers[i].pid = pid;
+		workers[i].fd = sv[0];
+
+		upsdebugx(1, "%s: worker %" PRIuSIZE " is PID %" PRIiMAX,
+			__func__, i + 1, (intmax_t)pid);
+	}
+
+	for (i = 0; i < workers_num; i++) {
+		workers_listeners_free(&workers[i]);
+	}
+}
+
+/* pass a signal on to the workers */
+static void workers_signal(int sig)
+{
+	size_t	i;
+
+	for (i = 0; i < workers_num; i++) {
+		if (workers[i].pid > 0) {
+			kill(workers[i].pid, sig);
+		}
+	}
+}
+
+static void workers_free(void)
+{
+	size_t	i;
+
+	workers_signal(SIGTERM);
+
+	for (i = 0; i < workers_num; i++) {
+		if (workers[i].fd >= 0) {
+#ifdef UPSD_EVLOOP
+			evloop_del(workers[i].fd);
+#endif
+			close(workers[i].fd);
+		}
+		if (workers[i].pid > 0) {
+			waitpid(workers[i].pid, NULL, 0);
+		}
+		workers_listeners_free(&workers[i]);
+	}
+
+	free(workers);
+	workers = NULL;
+	workers_num = 0;
+
+	if (worker_fd >= 0) {
+		close(worker_fd);
+		worker_fd = -1;
+	}
+}
+#endif	/* UPSD_WORKERS */
+
+#ifdef UPSD_UPGRADE
+/* wait up to timeout seconds for a message of the channel, into buf
+ * (NUL-terminated), with the descriptor which came along (or -1) into
+ * *fd; returns its length, or -1 upon timeout, error or end of file */
+static ssize_t channel_recv(int chan, char *buf, size_t bufsize, int *fd, int timeout)
+{
+	struct pollfd	pfd;
+	struct msghdr	msg;
+	struct iovec	iov;
+	union {
+		struct cmsghdr	hdr;
+		char	buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr	*cmsg;
 	ssize_t	ret;
 
-#ifdef WITH_SSL
-	if (client->ssl) {
-		ret = ssl_read(client, buf, sizeof(buf));
-	} else
-#endif /* WITH_SSL */
-	{
-		ret = read(client->sock_fd, buf, sizeof(buf));
+	*fd = -1;
+
+	pfd.fd = chan;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	do {
+		ret = poll(&pfd, 1, timeout * 1000);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		return -1;
 	}
 
-	if (ret < 0) {
-		upsdebug_with_errno(2, "Disconnect %s (read failure)", client->addr);
+	iov.iov_base = buf;
+	iov.iov_len = bufsize - 1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	do {
+		ret = recvmsg(chan, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); ret >= 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	if (ret <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+		return -1;
+	}
+
+	buf[ret] = '\0';
+	return ret;
+}
+
+static int channel_send_text(int chan, const char *text, int fd)
+{
+	struct iovec	iov;
+
+	iov.iov_base = (void *)text;
+	iov.iov_len = strlen(text);
+
+	return channel_send(chan, &iov, 1, fd);
+}
+
+/* how we were started (after the options were parsed), to do it again */
+static void upgrade_setup(int argc, char **argv)
+{
+	char	*path = NULL;
+	int	i;
+
+	upgrade_argv = xcalloc((size_t)argc + 1, sizeof(*upgrade_argv));
+
+	/* we chdir() to the state path later on */
+	if (argv[0][0] != '/' && strchr(argv[0], '/')) {
+		path = realpath(argv[0], NULL);
+	}
+	upgrade_argv[0] = xstrdup(path ? path : argv[0]);
+	free(path);
+
+	for (i = 1; i < argc; i++) {
+		upgrade_argv[i] = xstrdup(argv[i]);
+	}
+}
+
+static void upgrade_free(void)
+{
+	size_t	i;
+
+	for (i = 0; upgrade_argv && upgrade_argv[i]; i++) {
+		free(upgrade_argv[i]);
+	}
+
+	free(upgrade_argv);
+	upgrade_argv = NULL;
+}
+
+/* in the old upsd: everything to the new one on the channel; 0 if it
+ * did not take over (then it quits, seeing the channel closed) */
+static int upgrade_handover(int chan)
+{
+	static char	prelude[WORKER_MSG_MAX / 2];
+	char	buf[SMALLBUF];
+	stype_t	*server;
+	nut_ctype_t	*client, *cnext;
+	size_t	handed = 0, dropped = 0;
+	struct iovec	iov;
+	int	fd;
+
+	for (server = firstaddr; server; server = server->next) {
+		if (VALID_FD_SOCK(server->sock_fd)
+		 && !channel_send_text(chan, "LISTEN", server->sock_fd)
+		) {
+			return 0;
+		}
+	}
+
+	if (!channel_send_text(chan, "LISTENED", -1)) {
+		return 0;
+	}
+
+	/* it reads the configuration and connects to the drivers meanwhile,
+	 * and we leave the clients waiting, so that none is left behind */
+	if (channel_recv(chan, buf, sizeof(buf), &fd, UPGRADE_TIMEOUT) < 0
+	 || strcmp(buf, "READY")
+	) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return 0;
+	}
+
+	for (client = firstclient; client; client = cnext) {
+		cnext = client->next;
+
+		/* a TLS session, an HTTP request or a line half read can not
+		 * go on elsewhere; those clients see us exit, and reconnect */
+		if (client->ssl || client->ssl_handshaking || client->metrics
+		 || client->zip || pconf_feed_pending(client->ctx)
+		 || !client_encode(client, prelude, sizeof(prelude))
+		) {
+			dropped++;
+			continue;
+		}
+
+		/* the ids it got from us mean nothing to the new upsd */
+		if (client->binary) {
+			binary_send_text(client, BINFRAME_RESET, "");
+		}
+
+		iov.iov_base = prelude;
+		iov.iov_len = strlen(prelude) + 1;	/* with the NUL */
+
+		if (!client_output_drain(client) || !channel_send(chan, &iov, 1, client->sock_fd)) {
+			dropped++;
+			client_disconnect(client);
+			continue;
+		}
+
+		client->handedoff = 1;
 		client_disconnect(client);
+		handed++;
+	}
+
+	if (!channel_send_text(chan, "DONE", -1)) {
+		return 0;
+	}
+
+	upslogx(LOG_NOTICE, "Upgrade: %" PRIuSIZE " clients handed over, "
+		"%" PRIuSIZE " others have to reconnect", handed, dropped);
+	return 1;
+}
+
+/* in the old upsd, upon SIGCMD_UPGRADE: start the new one and hand
+ * everything over; exit_flag is set once it took over */
+static void upgrade_start(void)
+{
+	int	sv[2], fd;
+	long	maxfd;
+	pid_t	pid;
+	char	buf[SMALLBUF];
+
+	if (worker_fd >= 0) {
+		/* the main process does it for us all */
 		return;
 	}
 
-	if (ret == 0) {
-		upsdebugx(2, "Disconnect %s (no data available)", client->addr);
-		client_disconnect(client);
+	if (!upgrade_argv) {
+		upslogx(LOG_WARNING, "Upgrade: not possible for a chrooted upsd");
 		return;
 	}
 
-	/* fragment handling code */
-	for (i = 0; i < ret; i++) {
+	upslogx(LOG_NOTICE, "Upgrade: starting %s to take over", upgrade_argv[0]);
 
-		/* add to the receive queue one by one */
-		switch (pconf_char(&client->ctx, buf[i]))
-		{
-		case 1:
-			time(&client->last_heard);	/* command received */
-			parse_net(client);
-			continue;
+	/* it starts with the data we have */
+	snapshot_save();
 
-		case 0:
-			continue;	/* haven't gotten a line yet */
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+		upslog_with_errno(LOG_ERR, "%s: socketpair", __func__);
+		return;
+	}
 
-		default:
-			/* parse error */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
+	if ((pid = fork()) < 0) {
+		upslog_with_errno(LOG_ERR, "%s: fork", __func__);
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		/* nothing of ours but the channel: the clients which are not
+		 * handed over must see the connection closed when we exit */
+		if ((maxfd = sysconf(_SC_OPEN_MAX)) < 0) {
+			maxfd = 1024;
+		}
+		for (fd = 3; fd < maxfd; fd++) {
+			if (fd != sv[1]) {
+				close(fd);
+			}
+		}
+
+		snprintf(buf, sizeof(buf), "%d", sv[1]);
+		setenv(UPGRADE_FD_ENV, buf, 1);
+
+		execvp(upgrade_argv[0], upgrade_argv);
+		upslog_with_errno(LOG_ERR, "Upgrade: can't run %s", upgrade_argv[0]);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(sv[1]);
+
+	if (!upgrade_handover(sv[0])) {
+		upslogx(LOG_ERR, "Upgrade: the new upsd did not take over, going on");
+		close(sv[0]);
+		waitpid(pid, NULL, WNOHANG);
+
+		/* it may have written its PID into our file */
+		if (pidfn[0]) {
+			writepid(pidfn);
+		}
+		return;
+	}
+
+	close(sv[0]);
+
+	/* the PID file and the service manager are for the new upsd now */
+	memset(pidfn, 0, sizeof(pidfn));
+	upgrade_done = 1;
+	exit_flag = SIGCMD_UPGRADE;
+}
+
+static int sockaddr_same(const struct sockaddr *a, const struct sockaddr *b)
+{
+	if (a->sa_family != b->sa_family) {
+		return 0;
+	}
+
+	if (a->sa_family == AF_INET) {
+		const struct sockaddr_in	*a4 = (const struct sockaddr_in *)a,
+			*b4 = (const struct sockaddr_in *)b;
+
+		return a4->sin_port == b4->sin_port
+			&& a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	}
+
+	if (a->sa_family == AF_INET6) {
+		const struct sockaddr_in6	*a6 = (const struct sockaddr_in6 *)a,
+			*b6 = (const struct sockaddr_in6 *)b;
+
+		return a6->sin6_port == b6->sin6_port
+			&& !memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr));
+	}
+
+	return 0;
+}
+
+/* in the new upsd, before server_load(): the listening sockets of the old one */
+static void upgrade_listen(void)
+{
+	char	buf[SMALLBUF];
+	int	fd;
+
+	while (channel_recv(upgrade_fd, buf, sizeof(buf), &fd, UPGRADE_TIMEOUT) >= 0) {
+		if (fd >= 0) {
+			upgrade_listeners = xrealloc(upgrade_listeners,
+				(upgrade_numlisteners + 1) * sizeof(*upgrade_listeners));
+			upgrade_listeners[upgrade_numlisteners++] = fd;
+			continue;
+		}
+
+		if (!strcmp(buf, "LISTENED")) {
+			upsdebugx(1, "%s: got %" PRIuSIZE " listening sockets",
+				__func__, upgrade_numlisteners);
 			return;
 		}
 	}
 
-	return;
+	fatalx(EXIT_FAILURE, "Upgrade: the upsd to take over from is gone");
+}
+
+/* the one of them bound to sa, if any (see setuptcp()) */
+static TYPE_FD_SOCK upgrade_listener(const struct sockaddr *sa)
+{
+	struct sockaddr_storage	ss;
+#if defined(__hpux) && !defined(_XOPEN_SOURCE_EXTENDED)
+	int	sslen;
+#else
+	socklen_t	sslen;
+#endif
+	size_t	i;
+	int	fd;
+
+	for (i = 0; i < upgrade_numlisteners; i++) {
+		if ((fd = upgrade_listeners[i]) < 0) {
+			continue;
+		}
+
+		sslen = sizeof(ss);
+		if (getsockname(fd, (struct sockaddr *)&ss, &sslen) < 0
+		 || !sockaddr_same((struct sockaddr *)&ss, sa)
+		) {
+			continue;
+		}
+
+		upgrade_listeners[i] = -1;
+		return fd;
+	}
+
+	return ERROR_FD_SOCK;
+}
+
+/* after server_load(): what the configuration no longer has */
+static void upgrade_listeners_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < upgrade_numlisteners; i++) {
+		if (upgrade_listeners[i] >= 0) {
+			close(upgrade_listeners[i]);
+		}
+	}
+
+	free(upgrade_listeners);
+	upgrade_listeners = NULL;
+	upgrade_numlisteners = 0;
+}
+
+/* in the new upsd, once it is ready: take over the clients of the old one */
+static void upgrade_adopt(void)
+{
+	static char	buf[WORKER_MSG_MAX];
+	ssize_t	ret;
+	size_t	count = 0;
+	int	fd;
+
+	if (!channel_send_text(upgrade_fd, "READY", -1)) {
+		fatal_with_errno(EXIT_FAILURE, "Upgrade: the upsd to take over from is gone");
+	}
+
+	while ((ret = channel_recv(upgrade_fd, buf, sizeof(buf), &fd, UPGRADE_TIMEOUT)) >= 0) {
+		if (fd >= 0) {
+			client_adopt("the previous upsd", buf, (size_t)ret, fd);
+			count++;
+			continue;
+		}
+
+		if (!strcmp(buf, "DONE")) {
+			break;
+		}
+	}
+
+	if (ret < 0) {
+		fatalx(EXIT_FAILURE, "Upgrade: the upsd to take over from gave up");
+	}
+
+	close(upgrade_fd);
+	upgrade_fd = -1;
+
+	upslogx(LOG_NOTICE, "Upgrade: took over %" PRIuSIZE " clients", count);
+}
+#endif	/* UPSD_UPGRADE */
+
+void workers_fsd(const upstype_t *ups)
+{
+#ifdef UPSD_WORKERS
+	char	buf[SMALLBUF];
+	size_t	i;
+
+	snprintf(buf, sizeof(buf), "FSD %s", ups->name);
+
+	for (i = 0; i < workers_num; i++) {
+		if (workers[i].fd >= 0 && send(workers[i].fd, buf, strlen(buf), 0) < 0) {
+			upslog_with_errno(LOG_WARNING, "%s: can't tell worker PID %" PRIiMAX,
+				__func__, (intmax_t)workers[i].pid);
+		}
+	}
+#else
+	NUT_UNUSED_VARIABLE(ups);
+#endif
 }
 
 void server_load(void)
@@ -909,8 +3354,11 @@ void server_load(void)
 		listenersValidLocalhostIPv4 = 0,
 		listenersValidLocalhostIPv6 = 0;
 
-	/* default behaviour if no LISTEN address has been specified */
-	if (!firstaddr) {
+	/* default behaviour if no LISTEN address has been specified
+	 * (METRICS listeners do not count, they serve no NUT clients) */
+	for (server = firstaddr; server && server->metrics; server = server->next);
+
+	if (!server) {
 		/* Note: default opt_af==AF_UNSPEC so not constrained to only one protocol */
 		if (opt_af != AF_INET) {
 			upsdebugx(1, "%s: No LISTEN configuration provided, will try IPv6 localhost", __func__);
@@ -1072,8 +3520,12 @@ static void driver_free(void)
 
 		unext = ups->next;
 
+		timer_cancel(&ups->check_timer);
+		sstate_connect_cancel(ups);
+
 		if (VALID_FD(ups->sock_fd)) {
 #ifndef WIN32
+			evloop_driver_del(ups->sock_fd);
 			close(ups->sock_fd);
 #else
 			DisconnectNamedPipe(ups->sock_fd);
@@ -1086,12 +3538,16 @@ static void driver_free(void)
 		sstate_cmdfree(ups);
 
 		pconf_finish(&ups->sock_ctx);
+		history_free(ups->history);
 
 		free(ups->fn);
 		free(ups->name);
 		free(ups->desc);
 		free(ups);
 	}
+
+	firstups = NULL;
+	ups_index_free();
 }
 
 static void upsd_cleanup(void)
@@ -1107,10 +3563,20 @@ static void upsd_cleanup(void)
 	user_flush();
 	desc_free();
 
+#ifdef UPSD_WORKERS
+	workers_free();
+#endif
+#ifdef UPSD_UPGRADE
+	upgrade_free();
+#endif
 	server_free();
 	client_free();
 	driver_free();
 	tracking_free();
+	timer_free();
+	metrics_free();
+	history_vars_free();
+	beacon_free();
 
 	free(statepath);
 	free(datapath);
@@ -1120,6 +3586,9 @@ static void upsd_cleanup(void)
 
 	free(fds);
 	free(handler);
+#ifdef UPSD_EVLOOP
+	evloop_free();
+#endif
 
 #ifdef WIN32
 	if (mutex != INVALID_HANDLE_VALUE) {
@@ -1171,10 +3640,51 @@ static void poll_reload(void)
 
 /* instant command and setvar status tracking */
 
+static void tracking_index_resize(size_t newsize)
+{
+	tracking_t	**newindex, *item, *inext;
+	size_t	i, pos;
+
+	newindex = xcalloc(newsize, sizeof(*newindex));
+
+	for (i = 0; i < tracking_index_size; i++) {
+		for (item = tracking_index[i]; item; item = inext) {
+			inext = item->hnext;
+			pos = name_hash(item->id) & (newsize - 1);
+			item->hnext = newindex[pos];
+			newindex[pos] = item;
+		}
+	}
+
+	free(tracking_index);
+	tracking_index = newindex;
+	tracking_index_size = newsize;
+}
+
+static tracking_t *tracking_find(const char *id)
+{
+	tracking_t	*item;
+
+	if (!tracking_index_size || !id) {
+		return NULL;
+	}
+
+	for (item = tracking_index[name_hash(id) & (tracking_index_size - 1)];
+		item; item = item->hnext
+	) {
+		if (!strcasecmp(item->id, id)) {
+			return item;
+		}
+	}
+
+	return NULL;
+}
+
 /* allocate a new status tracking entry */
 int tracking_add(const char *id)
 {
 	tracking_t	*item;
+	size_t	pos;
 
 	if ((!tracking_enabled) || (!id))
 		return 0;
@@ -1188,39 +3698,79 @@ int tracking_add(const char *id)
 	if (tracking_list) {
 		tracking_list->prev = item;
 		item->next = tracking_list;
+	} else {
+		tracking_oldest = item;
 	}
 
 	tracking_list = item;
 
+	/* keep the chains short */
+	if (tracking_count >= tracking_index_size) {
+		tracking_index_resize(tracking_index_size ? tracking_index_size * 2 : 64);
+	}
+
+	pos = name_hash(item->id) & (tracking_index_size - 1);
+	item->hnext = tracking_index[pos];
+	tracking_index[pos] = item;
+	tracking_count++;
+
+	if (!tracking_timer.slot) {
+		timer_set(&tracking_timer, item->request_time + tracking_delay + 1);
+	}
+
 	return 1;
 }
 
 /* set status of a specific tracking entry */
 int tracking_set(const char *id, const char *value)
 {
-	tracking_t	*item, *next_item;
+	tracking_t	*item;
 
 	/* sanity checks */
 	if ((!tracking_list) || (!id) || (!value))
 		return 0;
 
-	for (item = tracking_list; item; item = next_item) {
+	if (!(item = tracking_find(id)))
+		return 0; /* id not found! */
 
-		next_item = item->next;
+	item->status = atoi(value);
+	return 1;
+}
 
-		if (!strcasecmp(item->id, id)) {
-			item->status = atoi(value);
-			return 1;
+static void tracking_unlink(tracking_t *item)
+{
+	tracking_t	**iptr;
+
+	for (iptr = &tracking_index[name_hash(item->id) & (tracking_index_size - 1)];
+		*iptr; iptr = &(*iptr)->hnext
+	) {
+		if (*iptr == item) {
+			*iptr = item->hnext;
+			tracking_count--;
+			break;
 		}
 	}
 
-	return 0; /* id not found! */
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		/* deleting first entry */
+		tracking_list = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		/* deleting the oldest entry */
+		tracking_oldest = item->prev;
+
+	free(item->id);
+	free(item);
 }
 
 /* free a specific tracking entry */
 int tracking_del(const char *id)
 {
-	tracking_t	*item, *next_item;
+	tracking_t	*item;
 
 	/* sanity check */
 	if ((!tracking_list) || (!id))
@@ -1228,30 +3778,11 @@ int tracking_del(const char *id)
 
 	upsdebugx(3, "%s: deleting id %s", __func__, id);
 
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (strcasecmp(item->id, id))
-			continue;
-
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			/* deleting first entry */
-			tracking_list = item->next;
-
-		if (item->next)
-			item->next->prev = item->prev;
-
-		free(item->id);
-		free(item);
-
-		return 1;
+	if (!(item = tracking_find(id)))
+		return 0; /* id not found! */
 
-	}
-
-	return 0; /* id not found! */
+	tracking_unlink(item);
+	return 1;
 }
 
 /* free all status tracking entries */
@@ -1267,133 +3798,403 @@ void tracking_free(void)
 
 	for (item = tracking_list; item; item = next_item) {
 		next_item = item->next;
-		tracking_del(item->id);
+		tracking_unlink(item);
 	}
+
+	free(tracking_index);
+	tracking_index = NULL;
+	tracking_index_size = 0;
+	tracking_count = 0;
+
+	timer_cancel(&tracking_timer);
 }
 
-/* cleanup status tracking entries according to their age and tracking_delay */
+/* cleanup status tracking entries according to their age and tracking_delay;
+ * new ones are added at the head of tracking_list, so start from its end */
 void tracking_cleanup(void)
 {
-	tracking_t	*item, *next_item;
 	time_t	now;
 
-	/* sanity check */
-	if (!tracking_list)
-		return;
-
 	time(&now);
 
 	upsdebugx(3, "%s", __func__);
 
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
+	while (tracking_oldest
+	 && difftime(now, tracking_oldest->request_time) > tracking_delay
+	) {
+		upsdebugx(3, "%s: deleting id %s", __func__, tracking_oldest->id);
+		tracking_unlink(tracking_oldest);
+	}
 
-		if (difftime(now, item->request_time) > tracking_delay) {
-			tracking_del(item->id);
-		}
+	if (tracking_oldest) {
+		timer_set(&tracking_timer, tracking_oldest->request_time + tracking_delay + 1);
+	} else {
+		timer_cancel(&tracking_timer);
 	}
 }
 
+static void tracking_expire(upsd_timer_t *timer, time_t now)
+{
+	NUT_UNUSED_VARIABLE(timer);
+	NUT_UNUSED_VARIABLE(now);
+
+	tracking_cleanup();
+}
+
 /* get status of a specific tracking entry */
 char *tracking_get(const char *id)
 {
-	tracking_t	*item, *next_item;
+	tracking_t	*item;
 
 	/* sanity checks */
 	if ((!tracking_list) || (!id))
 		return "ERR UNKNOWN";
 
-	for (item = tracking_list; item; item = next_item) {
+	if (!(item = tracking_find(id)))
+		return "ERR UNKNOWN"; /* id not found! */
 
-		next_item = item->next;
+	switch (item->status)
+	{
+	case STAT_PENDING:
+		return "PENDING";
+	case STAT_HANDLED:
+		return "SUCCESS";
+	case STAT_UNKNOWN:
+		return "ERR UNKNOWN";
+	case STAT_INVALID:
+		return "ERR INVALID-ARGUMENT";
+	case STAT_FAILED:
+		return "ERR FAILED";
+	default:
+		break;
+	}
+
+	return "ERR UNKNOWN";
+}
+
+/* enable general status tracking (tracking_enabled) and return its value (1). */
+int tracking_enable(void)
+{
+	tracking_enabled = 1;
+
+	return tracking_enabled;
+}
+
+/* disable general status tracking only if no client use it anymore.
+ * return the new value for tracking_enabled */
+int tracking_disable(void)
+{
+	nut_ctype_t		*client, *cnext;
+
+	for (client = firstclient; client; client = cnext) {
+		cnext = client->next;
+		if (client->tracking == 1)
+			return 1;
+	}
+	return 0;
+}
+
+/* return current general status of tracking (tracking_enabled). */
+int tracking_is_enabled(void)
+{
+	return tracking_enabled;
+}
+
+/* UUID v4 basic implementation
+ * Note: 'dest' must be at least `UUID4_LEN` long */
+int nut_uuid_v4(char *uuid_str)
+{
+	size_t		i;
+	uint8_t nut_uuid[UUID4_BYTESIZE];
+
+	if (!uuid_str)
+		return 0;
+
+	for (i = 0; i < UUID4_BYTESIZE; i++)
+		nut_uuid[i] = (uint8_t)rand() + (uint8_t)rand();
+
+	/* set variant and version */
+	nut_uuid[6] = (nut_uuid[6] & 0x0F) | 0x40;
+	nut_uuid[8] = (nut_uuid[8] & 0x3F) | 0x80;
+
+	return snprintf(uuid_str, UUID4_LEN,
+		"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+		nut_uuid[0], nut_uuid[1], nut_uuid[2], nut_uuid[3],
+		nut_uuid[4], nut_uuid[5], nut_uuid[6], nut_uuid[7],
+		nut_uuid[8], nut_uuid[9], nut_uuid[10], nut_uuid[11],
+		nut_uuid[12], nut_uuid[13], nut_uuid[14], nut_uuid[15]);
+}
+
+static void set_exit_flag(int sig)
+{
+	exit_flag = sig;
+}
+
+static void set_reload_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	reload_flag = 1;
+}
+
+#ifdef UPSD_UPGRADE
+static void set_upgrade_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	upgrade_flag = 1;
+}
+#endif
+
+#ifndef WIN32
+/* take back the clients whose STARTTLS handshake a worker thread did */
+static void handshake_done(void)
+{
+	nut_ctype_t	*client;
+
+	while ((client = ssl_handshake_collect()) != NULL) {
+		if (client->ssl_dropped || !client->ssl_connected) {
+			upsdebugx(2, "%s: TLS handshake with %s %s", __func__,
+				client->addr, (client->ssl_dropped ? "abandoned" : "failed"));
+			client_disconnect(client);
+			continue;
+		}
 
-		if (strcasecmp(item->id, id))
+		if (client->outoverflow) {
+			/* see client_enqueue() */
+			client_disconnect(client);
 			continue;
+		}
+
+		time(&client->last_heard);
+#ifdef UPSD_EVLOOP
+		evloop_add(client->sock_fd, CLIENT, client);
+#endif
+		/* whatever was queued for it meanwhile */
+		sendback_uncork(client);
+	}
+}
+
+/* act upon poll()-style revents reported for one of our descriptors */
+static void handler_event(const handler_t *h, int revents)
+{
+	if (h->type == DRIVER_CONNECT) {
+		/* accepted or refused, whichever revents it got */
+		sstate_connect_done((upstype_t *)h->data);
+		return;
+	}
+
+	if (revents & (POLLHUP|POLLERR|POLLNVAL)) {
+
+		switch(h->type)
+		{
+		case DRIVER:
+			sstate_disconnect((upstype_t *)h->data);
+			break;
+		case CLIENT:
+			client_disconnect((nut_ctype_t *)h->data);
+			break;
+		case SERVER:
+			upsdebugx(2, "%s: server disconnected", __func__);
+			break;
+#ifdef UPSD_WORKERS
+		case WORKER:
+			/* reads the end of file */
+			worker_event((upsd_worker_t *)h->data);
+			break;
+#endif
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcovered-switch-default"
+#pragma clang diagnostic ignored "-Wunreachable-code"
+#endif
+		/* All enum cases defined as of the time of coding
+		 * have been covered above. Handle later definitions,
+		 * memory corruptions and buggy inputs below...
+		 */
+		default:
+			upsdebugx(2, "%s: <unknown> disconnected", __func__);
+			break;
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
+
+		}
+
+		return;
+	}
+
+	if ((revents & POLLOUT) && h->type == CLIENT) {
+		nut_ctype_t	*client = (nut_ctype_t *)h->data;
+
+		if (client_flush(client, UPSD_CLIENT_WRITE_MAX) < 0
+		 || (client->closing && client->outlen == 0)
+		) {
+			client_disconnect(client);
+			return;
+		}
+	}
+
+	if (revents & POLLIN) {
 
-		switch (item->status)
+		switch(h->type)
 		{
-		case STAT_PENDING:
-			return "PENDING";
-		case STAT_HANDLED:
-			return "SUCCESS";
-		case STAT_UNKNOWN:
-			return "ERR UNKNOWN";
-		case STAT_INVALID:
-			return "ERR INVALID-ARGUMENT";
-		case STAT_FAILED:
-			return "ERR FAILED";
+		case DRIVER:
+			sstate_readline((upstype_t *)h->data);
+			break;
+		case CLIENT:
+			client_readline((nut_ctype_t *)h->data);
+			break;
+		case SERVER:
+			client_connect((stype_t *)h->data);
+			break;
+		case HANDSHAKE:
+			handshake_done();
+			break;
+#ifdef UPSD_WORKERS
+		case WORKER:
+			worker_event((upsd_worker_t *)h->data);
+			break;
+#endif
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcovered-switch-default"
+#pragma clang diagnostic ignored "-Wunreachable-code"
+#endif
+		/* All enum cases defined as of the time of coding
+		 * have been covered above. Handle later definitions,
+		 * memory corruptions and buggy inputs below...
+		 */
 		default:
+			upsdebugx(2, "%s: <unknown> has data available", __func__);
 			break;
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
 		}
 	}
-
-	return "ERR UNKNOWN"; /* id not found! */
 }
 
-/* enable general status tracking (tracking_enabled) and return its value (1). */
-int tracking_enable(void)
+#ifdef UPSD_EVLOOP
+/* wait for and dispatch the events from registered descriptors */
+static void evloop_wait(int timeout_ms)
 {
-	tracking_enabled = 1;
+	int	i, ret, pass;
+# ifdef UPSD_EVLOOP_KQUEUE
+	struct timespec	ts;
 
-	return tracking_enabled;
-}
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+# endif
 
-/* disable general status tracking only if no client use it anymore.
- * return the new value for tracking_enabled */
-int tracking_disable(void)
-{
-	nut_ctype_t		*client, *cnext;
+	upsdebugx(2, "%s: waiting on %" PRIdMAX " registered filedescriptors",
+		__func__, (intmax_t)evloop_nfds);
 
-	for (client = firstclient; client; client = cnext) {
-		cnext = client->next;
-		if (client->tracking == 1)
-			return 1;
-	}
-	return 0;
-}
+# ifdef UPSD_EVLOOP_EPOLL
+	ret = epoll_wait(evloop_fd, evloop_events, EVLOOP_BATCH, timeout_ms);
+# else
+	ret = kevent(evloop_fd, NULL, 0, evloop_events, EVLOOP_BATCH, &ts);
+# endif
 
-/* return current general status of tracking (tracking_enabled). */
-int tracking_is_enabled(void)
-{
-	return tracking_enabled;
-}
+	netstats.wakeups++;
 
-/* UUID v4 basic implementation
- * Note: 'dest' must be at least `UUID4_LEN` long */
-int nut_uuid_v4(char *uuid_str)
-{
-	size_t		i;
-	uint8_t nut_uuid[UUID4_BYTESIZE];
+	if (ret == 0) {
+		upsdebugx(2, "%s: no data available", __func__);
+		return;
+	}
 
-	if (!uuid_str)
-		return 0;
+	if (ret < 0) {
+		if (errno != EINTR) {
+			upslog_with_errno(LOG_ERR, "%s", __func__);
+		}
+		return;
+	}
 
-	for (i = 0; i < UUID4_BYTESIZE; i++)
-		nut_uuid[i] = (uint8_t)rand() + (uint8_t)rand();
+	evloop_nevents = ret;
+	netstats.ready += (uint64_t)ret;
+
+	/* Note: a handler may unregister descriptors (even fall back to
+	 * poll() and drop the whole queue) while we walk the batch.
+	 * The drivers go first, so what they report (e.g. a new ups.status)
+	 * is known before the clients asking for it get their answers. */
+	for (pass = 0; pass < 2; pass++)
+	for (i = 0; i < evloop_nevents && evloop_fd >= 0; i++) {
+		handler_t	h;
+		int	fd, revents = 0;
+
+# ifdef UPSD_EVLOOP_EPOLL
+		fd = evloop_events[i].data.fd;
+		if (evloop_events[i].events & EPOLLIN)
+			revents |= POLLIN;
+		if (evloop_events[i].events & EPOLLOUT)
+			revents |= POLLOUT;
+		if (evloop_events[i].events & EPOLLHUP)
+			revents |= POLLHUP;
+		if (evloop_events[i].events & EPOLLERR)
+			revents |= POLLERR;
+# else
+		fd = (int)evloop_events[i].ident;
+		if (evloop_events[i].flags & EV_ERROR) {
+			revents |= POLLERR;
+		} else if (evloop_events[i].filter == EVFILT_WRITE) {
+			/* EOF on the write side is reported by EVFILT_READ too */
+			revents |= POLLOUT;
+		} else if (evloop_events[i].data > 0) {
+			/* read out whatever is left, even if peer is gone */
+			revents |= POLLIN;
+		} else if (evloop_events[i].flags & EV_EOF) {
+			revents |= POLLHUP;
+		} else {
+			revents |= POLLIN;
+		}
+# endif
 
-	/* set variant and version */
-	nut_uuid[6] = (nut_uuid[6] & 0x0F) | 0x40;
-	nut_uuid[8] = (nut_uuid[8] & 0x3F) | 0x80;
+		if (fd < 0 || (size_t)fd >= evloop_handler_size
+		 || !evloop_handler[fd].type
+		) {
+			/* unregistered while handling an earlier event */
+			continue;
+		}
 
-	return snprintf(uuid_str, UUID4_LEN,
-		"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
-		nut_uuid[0], nut_uuid[1], nut_uuid[2], nut_uuid[3],
-		nut_uuid[4], nut_uuid[5], nut_uuid[6], nut_uuid[7],
-		nut_uuid[8], nut_uuid[9], nut_uuid[10], nut_uuid[11],
-		nut_uuid[12], nut_uuid[13], nut_uuid[14], nut_uuid[15]);
-}
+		/* copy: the slot may be reused by the handler */
+		h = evloop_handler[fd];
+		if ((pass == 0) != (h.type == DRIVER || h.type == DRIVER_CONNECT)) {
+			continue;
+		}
 
-static void set_exit_flag(int sig)
-{
-	exit_flag = sig;
-}
+		handler_event(&h, revents);
+	}
 
-static void set_reload_flag(int sig)
-{
-	NUT_UNUSED_VARIABLE(sig);
-	reload_flag = 1;
+	evloop_nevents = 0;
 }
+#endif	/* UPSD_EVLOOP */
+#endif	/* !WIN32 */
 
 /* service requests and check on new data */
 static void mainloop(void)
@@ -1408,9 +4209,14 @@ static void mainloop(void)
 
 	nfds_t	nfds = 0;
 	upstype_t	*ups;
-	nut_ctype_t		*client, *cnext;
+	nut_ctype_t		*client;
 	stype_t		*server;
 	time_t	now;
+#ifndef WIN32
+	/* clients have commands left over, see clients_pending() */
+	static int	clients_busy = 0;
+	int	wait_ms;
+#endif
 
 	upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
 
@@ -1418,40 +4224,65 @@ static void mainloop(void)
 
 	if (reload_flag) {
 		upsnotify(NOTIFY_STATE_RELOADING, NULL);
+#ifdef UPSD_WORKERS
+		workers_signal(SIGHUP);
+#endif
 		conf_reload();
 		poll_reload();
 		reload_flag = 0;
 		upsnotify(NOTIFY_STATE_READY, NULL);
 	}
 
-	/* cleanup instcmd/setvar status tracking entries if needed */
-	tracking_cleanup();
+#ifdef UPSD_UPGRADE
+	if (upgrade_flag) {
+		upgrade_flag = 0;
+		upgrade_start();
+		if (exit_flag) {
+			return;
+		}
+	}
+#endif
+
+	/* shed idle clients, expire tracking entries, check on the drivers */
+	timer_run(now);
+
+	/* before the flush, so where it went is logged right away */
+	nut_trace_dump_pending();
+
+	/* what was logged since the last wait, in one write */
+	upslog_flush();
 
 #ifndef WIN32
+	wait_ms = (clients_busy ? 0 : timer_timeout(now, UPSD_WAIT_MAX));
+
+# ifdef UPSD_EVLOOP
+	if (evloop_fd >= 0) {
+		/* everything is registered persistently, so only the
+		 * descriptors which have something to say are visited */
+		evloop_wait(wait_ms);
+		clients_busy = clients_pending();
+		return;
+	}
+# endif
+
 	/* scan through driver sockets */
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
 
-		/* see if we need to (re)connect to the socket */
-		if (INVALID_FD(ups->sock_fd)) {
-			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
-				"trying to reconnect",
-				__func__, ups->name);
-			ups->sock_fd = sstate_connect(ups);
-			if (INVALID_FD(ups->sock_fd)) {
-				upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d)",
-					__func__, ups->name, ups->sock_fd);
-			} else {
-				upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
-					__func__, ups->name, ups->sock_fd);
-			}
+		if (VALID_FD(ups->connect_fd)) {
+			/* see sstate_connect_done() */
+			fds[nfds].fd = ups->connect_fd;
+			fds[nfds].events = POLLOUT;
+
+			handler[nfds].type = DRIVER_CONNECT;
+			handler[nfds].data = ups;
+
+			nfds++;
 			continue;
 		}
 
-		/* throw some warnings if it's not feeding us data any more */
-		if (sstate_dead(ups, maxage)) {
-			ups_data_stale(ups);
-		} else {
-			ups_data_ok(ups);
+		if (INVALID_FD(ups->sock_fd)) {
+			/* see ups_check() */
+			continue;
 		}
 
 		fds[nfds].fd = ups->sock_fd;
@@ -1464,14 +4295,10 @@ static void mainloop(void)
 	}
 
 	/* scan through client sockets */
-	for (client = firstclient; client; client = cnext) {
-
-		cnext = client->next;
+	for (client = firstclient; client; client = client->next) {
 
-		if (difftime(now, client->last_heard) > 60) {
-			/* shed clients after 1 minute of inactivity */
-			/* FIXME: create an upsd.conf parameter (CLIENT_INACTIVITY_DELAY) */
-			client_disconnect(client);
+		if (client->ssl_handshaking) {
+			/* see handshake_done() */
 			continue;
 		}
 
@@ -1482,6 +4309,9 @@ static void mainloop(void)
 
 		fds[nfds].fd = client->sock_fd;
 		fds[nfds].events = POLLIN;
+		if (client->outlen > 0) {
+			fds[nfds].events |= POLLOUT;
+		}
 
 		handler[nfds].type = CLIENT;
 		handler[nfds].data = client;
@@ -1505,170 +4335,82 @@ static void mainloop(void)
 		nfds++;
 	}
 
-	upsdebugx(2, "%s: polling %" PRIdMAX " filedescriptors", __func__, (intmax_t)nfds);
+	if (ssl_handshake_fd() >= 0 && nfds < maxconn) {
+		fds[nfds].fd = ssl_handshake_fd();
+		fds[nfds].events = POLLIN;
 
-	ret = poll(fds, nfds, 2000);
+		handler[nfds].type = HANDSHAKE;
+		handler[nfds].data = NULL;
 
-	if (ret == 0) {
-		upsdebugx(2, "%s: no data available", __func__);
-		return;
+		nfds++;
 	}
 
-	if (ret < 0) {
-		upslog_with_errno(LOG_ERR, "%s", __func__);
-		return;
-	}
+# ifdef UPSD_WORKERS
+	/* channels between the main process and the workers */
+	for (i = 0; i < workers_num && nfds < maxconn; i++) {
+		if (workers[i].fd < 0) {
+			continue;
+		}
 
-	for (i = 0; i < nfds; i++) {
+		fds[nfds].fd = workers[i].fd;
+		fds[nfds].events = POLLIN;
 
-		if (fds[i].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+		handler[nfds].type = WORKER;
+		handler[nfds].data = &workers[i];
 
-			switch(handler[i].type)
-			{
-			case DRIVER:
-				sstate_disconnect((upstype_t *)handler[i].data);
-				break;
-			case CLIENT:
-				client_disconnect((nut_ctype_t *)handler[i].data);
-				break;
-			case SERVER:
-				upsdebugx(2, "%s: server disconnected", __func__);
-				break;
+		nfds++;
+	}
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcovered-switch-default"
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* All enum cases defined as of the time of coding
-			 * have been covered above. Handle later definitions,
-			 * memory corruptions and buggy inputs below...
-			 */
-			default:
-				upsdebugx(2, "%s: <unknown> disconnected", __func__);
-				break;
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
+	if (worker_fd >= 0 && nfds < maxconn) {
+		fds[nfds].fd = worker_fd;
+		fds[nfds].events = POLLIN;
 
-			}
+		handler[nfds].type = WORKER;
+		handler[nfds].data = NULL;
 
-			continue;
-		}
+		nfds++;
+	}
+# endif
 
-		if (fds[i].revents & POLLIN) {
+	upsdebugx(2, "%s: polling %" PRIdMAX " filedescriptors", __func__, (intmax_t)nfds);
 
-			switch(handler[i].type)
-			{
-			case DRIVER:
-				sstate_readline((upstype_t *)handler[i].data);
-				break;
-			case CLIENT:
-				client_readline((nut_ctype_t *)handler[i].data);
-				break;
-			case SERVER:
-				client_connect((stype_t *)handler[i].data);
-				break;
+	ret = poll(fds, nfds, wait_ms);
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcovered-switch-default"
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* All enum cases defined as of the time of coding
-			 * have been covered above. Handle later definitions,
-			 * memory corruptions and buggy inputs below...
-			 */
-			default:
-				upsdebugx(2, "%s: <unknown> has data available", __func__);
-				break;
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
-			}
+	netstats.wakeups++;
 
-			continue;
+	if (ret == 0) {
+		upsdebugx(2, "%s: no data available", __func__);
+	} else if (ret < 0) {
+		upslog_with_errno(LOG_ERR, "%s", __func__);
+	} else {
+		netstats.ready += (uint64_t)ret;
+
+		/* the drivers first, as they are first in the array */
+		for (i = 0; i < nfds; i++) {
+			handler_event(&handler[i], fds[i].revents);
 		}
 	}
+
+	clients_busy = clients_pending();
 #else
 	/* scan through driver sockets */
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
 
-		/* see if we need to (re)connect to the socket */
 		if (INVALID_FD(ups->sock_fd)) {
-			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
-				"trying to reconnect",
-				__func__, ups->name);
-			ups->sock_fd = sstate_connect(ups);
-			if (INVALID_FD(ups->sock_fd)) {
-				upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d)",
-					__func__, ups->name, ups->sock_fd);
-			} else {
-				upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
-					__func__, ups->name, ups->sock_fd);
-			}
+			/* see ups_check() */
 			continue;
 		}
 
-		/* throw some warnings if it's not feeding us data any more */
-		if (sstate_dead(ups, maxage)) {
-			ups_data_stale(ups);
-		} else {
-			ups_data_ok(ups);
-		}
-
-		/* FIXME: Is the conditional needed? We got here... */
-		if (VALID_FD(ups->sock_fd)) {
-			fds[nfds] = ups->read_overlapped.hEvent;
+		fds[nfds] = ups->read_overlapped.hEvent;
 
-			handler[nfds].type = DRIVER;
-			handler[nfds].data = ups;
+		handler[nfds].type = DRIVER;
+		handler[nfds].data = ups;
 
-			nfds++;
-		}
+		nfds++;
 	}
 
 	/* scan through client sockets */
-	for (client = firstclient; client; client = cnext) {
-
-		cnext = client->next;
-
-		if (difftime(now, client->last_heard) > 60) {
-			/* shed clients after 1 minute of inactivity */
-			client_disconnect(client);
-			continue;
-		}
-
-		if (nfds >= maxconn) {
-			/* ignore clients that we are unable to handle */
-			continue;
-		}
+	for (client = firstclient; client && (nfds < maxconn); client = client->next) {
 
 		fds[nfds] = client->Event;
 
@@ -1709,10 +4451,12 @@ static void mainloop(void)
 	upsdebugx(2, "%s: wait for %d filedescriptors", __func__, nfds);
 
 	/* https://docs.microsoft.com/en-us/windows/win32/api/synchapi/nf-synchapi-waitformultipleobjects */
-	ret = WaitForMultipleObjects(nfds,fds,FALSE,2000);
+	ret = WaitForMultipleObjects(nfds,fds,FALSE,(DWORD)timer_timeout(now, UPSD_WAIT_MAX));
 
 	upsdebugx(6, "%s: wait for filedescriptors done: %" PRIu64, __func__, ret);
 
+	netstats.wakeups++;
+
 	if (ret == WAIT_TIMEOUT) {
 		upsdebugx(2, "%s: no data available", __func__);
 		return;
@@ -1758,6 +4502,8 @@ static void mainloop(void)
 		return;
 	}
 
+	netstats.ready++;
+
 	upsdebugx(6, "%s: requesting handler[%" PRIu64 "]", __func__, ret);
 	upsdebugx(6, "%s: handler.type=%d handler.data=%p", __func__, handler[ret].type, handler[ret].data);
 
@@ -1822,6 +4568,9 @@ static void help(const char *arg_progname)
 	printf("		commands:\n");
 	printf("		 - reload: reread configuration files\n");
 	printf("		 - stop: stop process and exit\n");
+#ifdef UPSD_UPGRADE
+	printf("		 - upgrade: start upsd again, which takes over the clients\n");
+#endif
 #ifndef WIN32
 	printf("  -P <pid>	send the signal above to specified PID (bypassing PID file)\n");
 #endif
@@ -1873,6 +4622,18 @@ static void setup_signals(void)
 	/* handle reloading */
 	sa.sa_handler = set_reload_flag;
 	sigaction(SIGHUP, &sa, NULL);
+
+# ifdef UPSD_UPGRADE
+	/* handle upgrades, see upgrade_start() */
+	sa.sa_handler = set_upgrade_flag;
+	sigaction(SIGCMD_UPGRADE, &sa, NULL);
+# endif
+
+# ifdef SIGURG
+	/* dump the trace ring, see nuttrace.h */
+	sa.sa_handler = nut_trace_dump_request;
+	sigaction(SIGURG, &sa, NULL);
+# endif
 #else
 	pipe_create(UPSD_PIPE_NAME);
 #endif
@@ -1979,6 +4740,11 @@ int main(int argc, char **argv)
 				if (!strncmp(optarg, "stop", strlen(optarg))) {
 					cmd = SIGCMD_STOP;
 				}
+#ifdef UPSD_UPGRADE
+				if (!strncmp(optarg, "upgrade", strlen(optarg))) {
+					cmd = SIGCMD_UPGRADE;
+				}
+#endif
 
 				/* bad command given */
 				if (cmd == 0)
@@ -2022,6 +4788,24 @@ int main(int argc, char **argv)
 		}
 	}
 
+#ifdef UPSD_UPGRADE
+	{ /* scoping */
+		/* started by the upsd we take over from, see upgrade_start() */
+		char	*s = getenv(UPGRADE_FD_ENV);
+		int	fd;
+
+		if (s && !cmd && str_to_int(s, &fd, 10) && fd >= 0) {
+			upgrade_fd = fd;
+		}
+		unsetenv(UPGRADE_FD_ENV);
+
+		/* to do it again, unless chrooted (away from the binary) */
+		if (!cmd && !chroot_path) {
+			upgrade_setup(argc, argv);
+		}
+	}
+#endif
+
 	if (foreground < 0) {
 		if (nut_debug_level > 0) {
 			foreground = 1;
@@ -2090,6 +4874,12 @@ int main(int argc, char **argv)
 		if (cmd) {
 			upsdebugx(1, "Signaled old daemon OK");
 		} else {
+#ifdef UPSD_UPGRADE
+			if (upgrade_fd >= 0) {
+				/* that is the one we take over from */
+				break;
+			}
+#endif
 			printf("Fatal error: A previous upsd instance is already running!\n");
 			printf("Either stop the previous instance first, or use the 'reload' command.\n");
 			exit(EXIT_FAILURE);
@@ -2250,7 +5040,18 @@ int main(int argc, char **argv)
 	} /* scope */
 
 	/* start server */
+#ifdef UPSD_UPGRADE
+	if (upgrade_fd >= 0) {
+		upgrade_listen();
+	}
+#endif
 	server_load();
+#ifdef UPSD_UPGRADE
+	upgrade_listeners_free();
+#endif
+#ifdef UPSD_WORKERS
+	workers_listen();
+#endif
 
 	become_user(new_uid);
 #ifndef WIN32
@@ -2264,9 +5065,14 @@ int main(int argc, char **argv)
 	/* check statepath perms */
 	check_perms(statepath);
 
+	/* what the drivers told the upsd before this one, if it exited cleanly */
+	snapshot_load();
+
 	/* handle ups.conf */
 	read_upsconf(1);	/* 1 = may abort upon fundamental errors */
 	upsconf_add(0);		/* 0 = initial */
+	relayconf_add(0);
+	snapshot_free();
 	poll_reload();
 
 	if (num_ups == 0) {
@@ -2280,7 +5086,11 @@ int main(int argc, char **argv)
 	}
 
 	/* try to bring in the var/cmd descriptions */
-	desc_load();
+	if (lowmem) {
+		desc_load_lazy();
+	} else {
+		desc_load();
+	}
 
 	/* handle upsd.users */
 	user_load();
@@ -2298,9 +5108,36 @@ int main(int argc, char **argv)
 		}
 	}
 
+#ifdef UPSD_WORKERS
+	/* before anything which does not survive a fork() */
+	workers_start();
+#endif
+
 	/* initialize SSL (keyfile must be readable by nut user) */
 	ssl_init();
 
+#ifdef UPSD_EVLOOP
+	/* after background(), register what we have connected so far */
+	evloop_init();
+#endif
+
+	/* each process (after the forks above) batches the lines it logs
+	 * to stderr, written by mainloop() before it waits */
+	upslog_set_batch(LARGEBUF * 16);
+
+	/* and traces its own events, if NUT_TRACE asks for it */
+	nut_trace_init("upsd");
+
+	/* and counts what it serves, for LIST STATS */
+	netstats_init();
+
+#ifdef UPSD_UPGRADE
+	/* the clients of the upsd we take over from, now that we are ready */
+	if (upgrade_fd >= 0) {
+		upgrade_adopt();
+	}
+#endif
+
 	upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 
 	while (!exit_flag) {
@@ -2308,9 +5145,24 @@ int main(int argc, char **argv)
 		mainloop();
 	}
 
+#ifdef UPSD_UPGRADE
+	if (upgrade_done) {
+		/* the new upsd has it all, and tells the service manager */
+		upslogx(LOG_INFO, "Upgrade done: exiting");
+		ssl_cleanup();
+		return EXIT_SUCCESS;
+	}
+#endif
+
 	upslogx(LOG_INFO, "Signal %d: exiting", exit_flag);
 	upsnotify(NOTIFY_STATE_STOPPING, "Signal %d: exiting", exit_flag);
 
+	/* for the next start, from the main process only */
+#ifdef UPSD_WORKERS
+	if (worker_fd < 0)
+#endif
+		snapshot_save();
+
 	ssl_cleanup();
 	return EXIT_SUCCESS;
 }
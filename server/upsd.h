@@ -52,6 +52,24 @@ typedef unsigned long int nfds_t;
 
 #define NUT_NET_ANSWER_MAX SMALLBUF
 
+/* LOWMEM in upsd.conf, unless the build says otherwise */
+#ifndef UPSD_LOWMEM_DEFAULT
+#define UPSD_LOWMEM_DEFAULT 0
+#endif
+
+/* WORKERS: forked copies of upsd which share the listening addresses
+ * (SO_REUSEPORT) and hand the clients over to the main process for the
+ * commands they do not serve themselves (SCM_RIGHTS), see upsd.c */
+#if !(defined WIN32) && (defined SO_REUSEPORT) && (defined SCM_RIGHTS)
+# define UPSD_WORKERS 1
+#endif
+
+/* UPGRADE: a new upsd started by this one (upsd -c upgrade) takes over
+ * its listening sockets and clients, with the same handover */
+#ifdef UPSD_WORKERS
+# define UPSD_UPGRADE 1
+#endif
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -61,18 +79,46 @@ extern "C" {
 /* prototypes from upsd.c */
 
 upstype_t *get_ups_ptr(const char *upsname);
+/* name index behind get_ups_ptr(), kept up to date by conf.c */
+void ups_index_add(upstype_t *ups);
+void ups_index_del(upstype_t *ups);
 int ups_available(const upstype_t *ups, nut_ctype_t *client);
+/* have mainloop() (re)connect to, prod or check on its driver soon */
+void ups_check_soon(upstype_t *ups);
+/* ...or later, longer after each failed try in a row */
+void ups_connect_failed(upstype_t *ups);
 
 void listen_add(const char *addr, const char *port);
+void listen_add_metrics(const char *addr, const char *port);
 
 void kick_login_clients(const char *upsname);
+/* persistent event loop registration of driver sockets (no-op if unused) */
+void evloop_driver_add(TYPE_FD fd, upstype_t *ups);
+void evloop_driver_connecting(TYPE_FD fd, upstype_t *ups);
+void evloop_driver_del(TYPE_FD fd);
+
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 int send_err(nut_ctype_t *client, const char *errtype);
+/* the same for data which is not a text line, see netbinary.c */
+int sendback_raw(nut_ctype_t *client, const void *buf, size_t len);
+/* collect multi-line replies and send them with as few writes as possible */
+void sendback_cork(nut_ctype_t *client);
+int sendback_uncork(nut_ctype_t *client);
+/* write out queued replies and make the socket blocking again (for STARTTLS) */
+int client_output_drain(nut_ctype_t *client);
+/* have mainloop() disconnect the client at its next pass */
+void client_expire(nut_ctype_t *client);
+/* the memory taken by the parsers of the clients (0) or the shared one
+ * of LOWMEM (1), for LIST STATS */
+size_t client_ctx_bytes(int shared);
 
 void server_load(void);
 void server_free(void);
 
+/* let the WORKERS know that FSD was set for this UPS (no-op if unused) */
+void workers_fsd(const upstype_t *ups);
+
 void check_perms(const char *fn);
 
 /* return values for instcmd / setvar status tracking,
@@ -99,6 +145,11 @@ int tracking_is_enabled(void);
 /* declarations from upsd.c */
 extern int		maxage, tracking_delay, allow_no_device, allow_not_all_listeners;
 extern nfds_t		maxconn;
+extern size_t		maxclientqueue;
+extern int		client_inactivity_delay;
+extern unsigned int	maxconnrate;
+extern size_t		upsd_workers;
+extern int		lowmem;
 extern char		*statepath, *datapath;
 extern upstype_t	*firstups;
 extern nut_ctype_t	*firstclient;
@@ -107,6 +158,7 @@ extern nut_ctype_t	*firstclient;
 #ifndef WIN32
 #define SIGCMD_STOP	SIGTERM
 #define SIGCMD_RELOAD	SIGHUP
+#define SIGCMD_UPGRADE	SIGUSR2
 #else
 #define SIGCMD_STOP    COMMAND_STOP
 #define SIGCMD_RELOAD  COMMAND_RELOAD
@@ -24,6 +24,10 @@
 
 #include "parseconf.h"
 #include "common.h"
+#include "state.h"
+#include "shmstate.h"
+#include "timer.h"
+#include "nut_stdint.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -31,32 +35,95 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+#ifdef WIN32
+/* what is read from the pipe of a driver at once: a DUMPALL comes in
+ * pieces of up to this (see DSTATE_PIPE_BUF_LEN of the drivers) */
+#define UPS_PIPE_BUF_LEN	16384
+
+/* pieces read from the pipe of one driver before looking at the others */
+#define UPS_PIPE_READ_ROUNDS	8
+#endif
+
+/* a shared list of enums or ranges of the driver (ENUMLIST, RANGELIST) */
+typedef struct upstype_list_s {
+	size_t		id;		/* as the driver numbered it */
+	st_list_t	*list;
+} upstype_list_t;
+
 /* structure for the linked list of each UPS that we track */
 typedef struct upstype_s {
 	char			*name;
-	char			*fn;
+	char			*fn;		/* <ups>@<host>[:<port>] if relay */
 	char			*desc;
+	int			relay;		/* RELAY of upsd.conf, see netrelay.c */
 	TYPE_FD			sock_fd;
+	TYPE_FD			connect_fd;	/* not accepted yet, see sstate_connect() */
+	time_t			connect_start;
+	time_t			reconnect_delay;	/* doubled after each failure */
 #ifdef WIN32
-	char 			buf[SMALLBUF];
+	char 			buf[UPS_PIPE_BUF_LEN];
 	OVERLAPPED		read_overlapped;
+	OVERLAPPED		write_overlapped;
 #endif
 	int			stale;
 	int			dumpdone;
+	size_t			dumplines;	/* lines read since DUMPALL was sent */
+	struct timeval		dumpstart;
 	int			data_ok;
 	time_t			last_heard;
 	time_t			last_ping;
 	time_t			last_connfail;
+	upsd_timer_t		check_timer;	/* see ups_check() */
 	PCONF_CTX_t		sock_ctx;
 	struct st_tree_s	*inforoot;
 	struct cmdlist_s	*cmdlist;
 
+	/* values exported by a driver running with "sharedstate",
+	 * if it has one; announced by SHMSET lines (see sstate.c) */
+	shmstate_t	*shm;
+
+	/* when were variables last removed (or reported differently)
+	 * without their own lastset stamp being updated, e.g. the whole
+	 * tree dropped upon driver disconnect; LIST VAR ... SINCE needs
+	 * to send a full list for older tokens (see netlist.c) */
+	st_tree_timespec_t	lastdel;
+
+	/* a warm restart (see snapshot.c): the tree and commands loaded from
+	 * the snapshot are provisional until the first dump of the driver is
+	 * done, which only has the changes (DUMPDELTA) or else everything */
+	int	provisional;
+	int	dumpdelta;
+	st_tree_timespec_t	dumpfrom;	/* our stamp when it was asked for */
+	struct cmdlist_s	*dumpcmds;	/* ADDCMD lines of that dump */
+	uintmax_t	stamp;		/* last STAMP of the driver, 0 if none */
+
+	/* the shared lists the driver sent on this connection (DUMPALL
+	 * SHAREDLISTS), sorted by id */
+	upstype_list_t	*lists;
+	size_t	numlists, maxlists;
+
+	/* bumped whenever the variables or commands change, so that the
+	 * LIST responses kept in listcache know when to be made again */
+	uint64_t	generation;
+	struct list_cache_s	*listcache;	/* see netlist.c */
+	struct agg_part_s	*aggparts;	/* see netagg.c */
+	struct history_s	*history;	/* see history.c, kept over reconnects */
+	uint32_t	beacon_status;	/* what the last beacon told (see beacon.c) */
+	int	beacon_flags;
+
 	int	numlogins;
 	int	fsd;		/* forced shutdown in effect? */
 
+	/* for LIST STATS (see netstats.c) */
+	uint64_t	stat_setinfo;	/* SETINFO (and SHMSET) lines, ever */
+	uint64_t	stat_setinfo_base;	/* of them, before this connection */
+	time_t		stat_connected;	/* when this connection was made */
+	double		stat_dumptime;	/* seconds of the last DUMPALL */
+
 	int	retain;
 
 	struct upstype_s	*next;
+	struct upstype_s	*hnext;	/* chain in the name index (see get_ups_ptr()) */
 
 } upstype_t;
 
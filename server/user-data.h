@@ -34,6 +34,7 @@ extern "C" {
 typedef struct {
 	char	*cmd;
 	void	*next;
+	void	*hnext;		/* same bucket of the user's cmdindex */
 } instcmdlist_t;
 
 typedef struct {
@@ -47,6 +48,13 @@ typedef struct {
 	instcmdlist_t *firstcmd;
 	actionlist_t  *firstaction;
 	void	*next;
+
+	/* built by user_load() once the file is read, see user_index() */
+	void	*hnext;		/* same bucket of the user index */
+	instcmdlist_t **cmdindex;
+	size_t	cmdindex_size;
+	int	allcmds;	/* "instcmds = all" */
+	unsigned int	actionmask;	/* USER_ACTION_* */
 } ulist_t;
 
 #ifdef __cplusplus
@@ -19,6 +19,7 @@
 
 #include "config.h"  /* must be the first header */
 
+#include <ctype.h>
 #include <sys/types.h>
 #ifndef WIN32
 #include <sys/socket.h>
@@ -27,6 +28,7 @@
 #endif
 
 #include "common.h"
+#include "nut_stdint.h"
 #include "parseconf.h"
 
 #include "user.h"
@@ -36,6 +38,71 @@ static ulist_t	*users = NULL;
 
 static	ulist_t	*curr_user;
 
+/* hashed by username, rebuilt by user_load() */
+static ulist_t	**user_index = NULL;
+static size_t	user_index_size = 0;
+
+/* bumped whenever the users above change, see user_auth_t */
+static unsigned long	user_generation = 1;
+
+/* actions which upsd itself checks get a bit in ulist_t.actionmask */
+#define USER_ACTION_SET		0x01
+#define USER_ACTION_FSD		0x02
+#define USER_ACTION_LOGIN	0x04
+#define USER_ACTION_PRIMARY	0x08
+#define USER_ACTION_MASTER	0x10
+
+static const struct {
+	const char	*name;
+	unsigned int	bit;
+} user_actions[] = {
+	{ "SET",	USER_ACTION_SET },
+	{ "FSD",	USER_ACTION_FSD },
+	{ "LOGIN",	USER_ACTION_LOGIN },
+	{ "PRIMARY",	USER_ACTION_PRIMARY },
+	{ "MASTER",	USER_ACTION_MASTER },
+	{ NULL,	0 }
+};
+
+static unsigned int user_action_bit(const char *action)
+{
+	size_t	i;
+
+	for (i = 0; user_actions[i].name; i++) {
+		if (!strcasecmp(user_actions[i].name, action)) {
+			return user_actions[i].bit;
+		}
+	}
+
+	return 0;
+}
+
+/* FNV-1a; usernames are case sensitive, instcmd names are not */
+static size_t user_hash(const char *str, int nocase)
+{
+	const unsigned char	*p;
+	uint32_t	h = 2166136261U;
+
+	for (p = (const unsigned char *)str; *p; p++) {
+		h ^= (uint32_t)(nocase ? tolower(*p) : *p);
+		h *= 16777619U;
+	}
+
+	return (size_t)h;
+}
+
+/* smallest power of two which keeps the chains short */
+static size_t user_index_len(size_t count)
+{
+	size_t	len = 8;
+
+	while (len < count * 2) {
+		len <<= 1;
+	}
+
+	return len;
+}
+
 /* create a new user entry */
 static void user_add(const char *un)
 {
@@ -202,6 +269,7 @@ static void flushuser(ulist_t *ptr)
 	flushcmd(ptr->firstcmd);
 	flushaction(ptr->firstaction);
 
+	free(ptr->cmdindex);
 	free(ptr->username);
 	free(ptr->password);
 	free(ptr);
@@ -212,67 +280,164 @@ void user_flush(void)
 {
 	flushuser(users);
 	users = NULL;
+	curr_user = NULL;
+
+	free(user_index);
+	user_index = NULL;
+	user_index_size = 0;
+
+	user_generation++;
 }
 
-static int user_matchinstcmd(ulist_t *user, const char * cmd)
+/* hash the users and their instcmds, and sum up their actions */
+static void user_index_build(void)
 {
-	instcmdlist_t	*tmp;
+	ulist_t	*tmp;
+	instcmdlist_t	*cmd;
+	actionlist_t	*act;
+	size_t	count = 0, slot;
+
+	for (tmp = users; tmp != NULL; tmp = tmp->next) {
+		count++;
+	}
 
-	for (tmp = user->firstcmd; tmp != NULL; tmp = tmp->next) {
+	user_index_size = user_index_len(count);
+	user_index = xcalloc(user_index_size, sizeof(*user_index));
 
-		if (!strcasecmp(tmp->cmd, cmd)) {
-			return 1;	/* good */
+	for (tmp = users; tmp != NULL; tmp = tmp->next) {
+
+		slot = user_hash(tmp->username, 0) & (user_index_size - 1);
+		tmp->hnext = user_index[slot];
+		user_index[slot] = tmp;
+
+		for (count = 0, cmd = tmp->firstcmd; cmd != NULL; cmd = cmd->next) {
+			count++;
 		}
 
-		if (!strcasecmp(tmp->cmd, "all")) {
-			return 1;	/* good */
+		tmp->cmdindex_size = user_index_len(count);
+		tmp->cmdindex = xcalloc(tmp->cmdindex_size, sizeof(*tmp->cmdindex));
+
+		for (cmd = tmp->firstcmd; cmd != NULL; cmd = cmd->next) {
+
+			if (!strcasecmp(cmd->cmd, "all")) {
+				tmp->allcmds = 1;
+			}
+
+			slot = user_hash(cmd->cmd, 1) & (tmp->cmdindex_size - 1);
+			cmd->hnext = tmp->cmdindex[slot];
+			tmp->cmdindex[slot] = cmd;
+		}
+
+		for (act = tmp->firstaction; act != NULL; act = act->next) {
+			tmp->actionmask |= user_action_bit(act->action);
 		}
 	}
 
-	return 0;	/* fail */
+	user_generation++;
 }
 
-int user_checkinstcmd(const char *un, const char *pw, const char *cmd)
+static ulist_t *user_find(const char *un)
 {
 	ulist_t	*tmp;
 
-	if ((!un) || (!pw) || (!cmd)) {
-		return 0;	/* failed */
+	if (!user_index) {
+		return NULL;
 	}
 
-	for (tmp = users; tmp != NULL; tmp = tmp->next) {
-
-		/* let's be paranoid before we call strcmp */
+	tmp = user_index[user_hash(un, 0) & (user_index_size - 1)];
 
-		if ((!tmp->username) || (!tmp->password)) {
-			continue;
+	for (; tmp != NULL; tmp = tmp->hnext) {
+		if (!strcmp(tmp->username, un)) {
+			return tmp;
 		}
+	}
 
-		if (strcmp(tmp->username, un)) {
-			continue;
-		}
+	return NULL;
+}
 
+/* the user entry matching both un and pw, or NULL */
+static ulist_t *user_authenticate(const char *un, const char *pw,
+	user_auth_t *auth)
+{
+	ulist_t	*tmp;
 
-		if (strcmp(tmp->password, pw)) {
-			/* password mismatch */
-			return 0;	/* fail */
-		}
+	if (auth && auth->generation == user_generation) {
+		return (ulist_t *)auth->user;
+	}
 
-		if (!user_matchinstcmd(tmp, cmd)) {
-			return 0;		/* fail */
-		}
+	tmp = user_find(un);
+
+	/* let's be paranoid before we call strcmp */
+	if (tmp && !tmp->password) {
+		tmp = NULL;
+	}
+
+	if (tmp && strcmp(tmp->password, pw)) {
+		upsdebugx(2, "%s: password mismatch", __func__);
+		tmp = NULL;
+	}
+
+	/* username and password can not change for a client once set */
+	if (auth) {
+		auth->user = tmp;
+		auth->generation = user_generation;
+	}
+
+	return tmp;
+}
 
-		/* passed all checks */
+static int user_matchinstcmd(ulist_t *user, const char * cmd)
+{
+	instcmdlist_t	*tmp;
+
+	if (user->allcmds) {
 		return 1;	/* good */
 	}
 
-	/* username not found */
+	tmp = user->cmdindex[user_hash(cmd, 1) & (user->cmdindex_size - 1)];
+
+	for (; tmp != NULL; tmp = tmp->hnext) {
+
+		if (!strcasecmp(tmp->cmd, cmd)) {
+			return 1;	/* good */
+		}
+	}
+
 	return 0;	/* fail */
 }
 
+int user_checkinstcmd(const char *un, const char *pw, const char *cmd,
+	user_auth_t *auth)
+{
+	ulist_t	*tmp;
+
+	if ((!un) || (!pw) || (!cmd)) {
+		return 0;	/* failed */
+	}
+
+	tmp = user_authenticate(un, pw, auth);
+
+	if (!tmp) {
+		/* username not found or password mismatch */
+		return 0;	/* fail */
+	}
+
+	if (!user_matchinstcmd(tmp, cmd)) {
+		return 0;		/* fail */
+	}
+
+	/* passed all checks */
+	return 1;	/* good */
+}
+
 static int user_matchaction(ulist_t *user, const char *action)
 {
 	actionlist_t	*tmp;
+	unsigned int	bit = user_action_bit(action);
+
+	if (bit) {
+		return ((user->actionmask & bit) != 0);
+	}
 
 	for (tmp = user->firstaction; tmp != NULL; tmp = tmp->next) {
 
@@ -284,41 +449,28 @@ static int user_matchaction(ulist_t *user, const char *action)
 	return 0;	/* fail */
 }
 
-int user_checkaction(const char *un, const char *pw, const char *action)
+int user_checkaction(const char *un, const char *pw, const char *action,
+	user_auth_t *auth)
 {
 	ulist_t	*tmp;
 
 	if ((!un) || (!pw) || (!action))
 		return 0;	/* failed */
 
-	for (tmp = users; tmp != NULL; tmp = tmp->next) {
-
-		/* let's be paranoid before we call strcmp */
+	tmp = user_authenticate(un, pw, auth);
 
-		if ((!tmp->username) || (!tmp->password)) {
-			continue;
-		}
-
-		if (strcmp(tmp->username, un)) {
-			continue;
-		}
-
-		if (strcmp(tmp->password, pw)) {
-			upsdebugx(2, "user_checkaction: password mismatch");
-			return 0;	/* fail */
-		}
-
-		if (!user_matchaction(tmp, action)) {
-			upsdebugx(2, "user_matchaction: failed");
-			return 0;	/* fail */
-		}
+	if (!tmp) {
+		/* username not found or password mismatch */
+		return 0;	/* fail */
+	}
 
-		/* passed all checks */
-		return 1;	/* good */
+	if (!user_matchaction(tmp, action)) {
+		upsdebugx(2, "user_matchaction: failed");
+		return 0;	/* fail */
 	}
 
-	/* username not found */
-	return 0;	/* fail */
+	/* passed all checks */
+	return 1;	/* good */
 }
 
 /* handle "upsmon primary" and "upsmon secondary" for nicer configurations */
@@ -499,4 +651,6 @@ void user_load(void)
 	}
 
 	pconf_finish(&ctx);
+
+	user_index_build();
 }
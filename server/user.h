@@ -31,10 +31,21 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* Who a connection authenticated as, so that repeated checks skip the
+ * user lookup and password comparison; only valid for as long as the
+ * generation matches that of the loaded upsd.users (bumped on reload) */
+typedef struct {
+	const void	*user;	/* ulist_t, or NULL if authentication failed */
+	unsigned long	generation;	/* 0: nothing cached */
+} user_auth_t;
+
 void user_load(void);
 
-int user_checkinstcmd(const char *un, const char *pw, const char *cmd);
-int user_checkaction(const char *un, const char *pw, const char *action);
+/* auth may be NULL, otherwise it caches the result for that client */
+int user_checkinstcmd(const char *un, const char *pw, const char *cmd,
+	user_auth_t *auth);
+int user_checkaction(const char *un, const char *pw, const char *action,
+	user_auth_t *auth);
 
 void user_flush(void);
 
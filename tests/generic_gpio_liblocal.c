@@ -125,6 +125,17 @@ int gpiod_line_event_read(struct gpiod_line *line,
 	return 0;
 }
 
+int gpiod_line_event_get_fd(struct gpiod_line *line) {
+	NUT_UNUSED_VARIABLE(line);
+	return -1;
+}
+
+int gpiod_line_event_read_fd(int fd, struct gpiod_line_event *event) {
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(event);
+	return -1;
+}
+
 unsigned int gpiod_line_offset(struct gpiod_line *line) {
 	NUT_UNUSED_VARIABLE(line);
 	return 0;
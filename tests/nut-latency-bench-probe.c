@@ -0,0 +1,685 @@
+/*  nut-latency-bench-probe.c - simulated drivers which flip the status of
+ *  their UPS, and clients of upsd which time when they see it, for
+ *  nut-latency-bench.sh to measure the driver -> upsd -> client latency
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "timehead.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* One simulated driver: the socket upsd connects to, as for the driver
+ * named in ups.conf, and the status flips it sent */
+typedef struct {
+	char	name[SMALLBUF / 8];
+	char	path[SMALLBUF];
+	int	listen_fd;
+	int	fd;	/* upsd, once connected */
+	int	ready;	/* the DUMPALL was answered */
+	char	line[SMALLBUF];
+	size_t	len;
+	int	ob;	/* the latest status is OB, else OL */
+	unsigned long	gen;	/* flips so far */
+	uint64_t	sent;	/* when the latest one was sent, in usec */
+} probe_dev_t;
+
+/* One client of upsd, following the status of one of the devices either
+ * with GET VAR at an interval, or with WATCH */
+typedef struct {
+	int	fd;
+	int	watch;
+	size_t	dev;
+	unsigned long	seen;	/* the latest flip seen */
+	int	pending;	/* a GET VAR awaits its reply */
+	uint64_t	next_poll;
+	char	buf[LARGEBUF];
+	size_t	len;
+} probe_client_t;
+
+/* Latencies seen by one kind of client, in usec */
+typedef struct {
+	const char	*kind;
+	size_t	clients;
+	uint64_t	*samples;
+	size_t	count, size;
+	unsigned long	missed;	/* flips not seen before the next one */
+} probe_stats_t;
+
+static probe_dev_t	*devs = NULL;
+static size_t	ndevs = 1;
+static probe_client_t	*clients = NULL;
+static size_t	nclients = 0;
+static probe_stats_t	stats_poll = { "poll", 0, NULL, 0, 0, 0 };
+static probe_stats_t	stats_watch = { "watch", 0, NULL, 0, 0, 0 };
+
+static long	poll_ms = 100;
+static volatile sig_atomic_t	stop_flag = 0;
+
+static void set_stop_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	stop_flag = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Serve driver sockets for upsd, flip the status of their UPS\n");
+	printf("between OL and OB, and time when clients of upsd see it. Prints\n");
+	printf("the results as one JSON object on stdout.\n\n");
+	printf("Usage: %s [OPTIONS]\n\n", prog);
+	printf("  -s <path>	state path to serve the driver sockets in (required)\n");
+	printf("  -D <name>	driver of the devices in ups.conf (default dummy-ups)\n");
+	printf("  -n <prefix>	names of the devices, numbered from 1 (default bench-probe)\n");
+	printf("  -d <count>	devices (default 1)\n");
+	printf("  -p <port>	upsd port on 127.0.0.1 (default 3493)\n");
+	printf("  -c <count>	clients which poll with GET VAR (default 10)\n");
+	printf("  -w <count>	clients which subscribe with WATCH (default 10)\n");
+	printf("  -i <msec>	interval of the polls (default 100)\n");
+	printf("  -f <count>	status flips, over all the devices (default 200)\n");
+	printf("  -g <msec>	time between the flips (default 50)\n");
+	printf("  -P <file>	PID file of upsd, to measure its CPU time\n");
+	printf("  -t <sec>	time to wait for upsd to connect (default 30)\n");
+}
+
+static uint64_t now_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#else
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+#endif
+}
+
+/* CPU time of a process so far, in usec, or -1 where we can not tell:
+ * the scheduler statistics are exact, the rest counts in clock ticks */
+static double cpu_usec(pid_t pid)
+{
+	char	fn[SMALLBUF], buf[LARGEBUF], *p;
+	unsigned long long	ns, utime, stime;
+	FILE	*f;
+	int	ok;
+
+	if (pid <= 0)
+		return -1;
+
+	snprintf(fn, sizeof(fn), "/proc/%" PRIiMAX "/schedstat", (intmax_t)pid);
+	if ((f = fopen(fn, "r")) != NULL) {
+		ok = (fscanf(f, "%llu", &ns) == 1);
+		fclose(f);
+		if (ok)
+			return (double)ns / 1000;
+	}
+
+	snprintf(fn, sizeof(fn), "/proc/%" PRIiMAX "/stat", (intmax_t)pid);
+	if ((f = fopen(fn, "r")) == NULL)
+		return -1;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+
+	/* the fields after the command name, which may hold spaces */
+	if (!p || (p = strrchr(buf, ')')) == NULL)
+		return -1;
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		&utime, &stime) != 2
+	) {
+		return -1;
+	}
+
+	return (double)(utime + stime) * 1e6 / (double)sysconf(_SC_CLK_TCK);
+}
+
+static pid_t read_pidfile(const char *fn)
+{
+	FILE	*f;
+	long	pid = -1;
+
+	if (!fn || (f = fopen(fn, "r")) == NULL)
+		return -1;
+	if (fscanf(f, "%ld", &pid) != 1)
+		pid = -1;
+	fclose(f);
+
+	return (pid_t)pid;
+}
+
+static void send_line(int fd, const char *line)
+{
+	size_t	len = strlen(line);
+
+	if (write(fd, line, len) != (ssize_t)len)
+		upslog_with_errno(LOG_WARNING, "Short write of [%s]", line);
+}
+
+static void dev_listen(probe_dev_t *dev, const char *statepath, const char *driver)
+{
+	struct sockaddr_un	sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+
+	if (snprintf(dev->path, sizeof(dev->path), "%s/%s-%s", statepath, driver, dev->name)
+		>= (int)sizeof(sa.sun_path)
+	) {
+		fatalx(EXIT_FAILURE, "Socket path too long: %s", dev->path);
+	}
+	memcpy(sa.sun_path, dev->path, strlen(dev->path) + 1);
+	unlink(dev->path);
+
+	if ((dev->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		fatal_with_errno(EXIT_FAILURE, "socket");
+	if (bind(dev->listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		fatal_with_errno(EXIT_FAILURE, "bind %s", dev->path);
+	if (listen(dev->listen_fd, 4) < 0)
+		fatal_with_errno(EXIT_FAILURE, "listen %s", dev->path);
+
+	/* for upsd, when it runs as another user */
+	if (chmod(dev->path, 0666) < 0)
+		upslog_with_errno(LOG_WARNING, "chmod %s", dev->path);
+
+	dev->fd = -1;
+}
+
+/* what upsd asks of a driver: a dump of its data, and a sign of life */
+static void dev_line(probe_dev_t *dev, const char *line)
+{
+	char	buf[SMALLBUF];
+
+	if (!strcmp(line, "DUMPALL")) {
+		snprintf(buf, sizeof(buf),
+			"SETINFO device.model \"latency probe\"\n"
+			"SETINFO ups.status \"%s\"\n"
+			"DUMPDONE\n", dev->ob ? "OB" : "OL");
+		send_line(dev->fd, buf);
+		dev->ready = 1;
+		return;
+	}
+
+	if (!strcmp(line, "PING")) {
+		send_line(dev->fd, "PONG\n");
+		return;
+	}
+
+	/* anything else (e.g. NOBROADCAST) needs no reply here */
+}
+
+static void dev_read(probe_dev_t *dev)
+{
+	char	buf[SMALLBUF];
+	ssize_t	ret, i;
+
+	ret = read(dev->fd, buf, sizeof(buf));
+	if (ret <= 0) {
+		upslogx(LOG_WARNING, "upsd dropped the connection to %s", dev->name);
+		close(dev->fd);
+		dev->fd = -1;
+		dev->ready = 0;
+		dev->len = 0;
+		return;
+	}
+
+	for (i = 0; i < ret; i++) {
+		if (buf[i] == '\n') {
+			dev->line[dev->len] = '\0';
+			dev_line(dev, dev->line);
+			dev->len = 0;
+		} else if (dev->len < sizeof(dev->line) - 1) {
+			dev->line[dev->len++] = buf[i];
+		}
+	}
+}
+
+static void dev_flip(probe_dev_t *dev)
+{
+	char	buf[SMALLBUF];
+
+	dev->ob = !dev->ob;
+	dev->gen++;
+	snprintf(buf, sizeof(buf), "SETINFO ups.status \"%s\"\n", dev->ob ? "OB" : "OL");
+
+	dev->sent = now_usec();
+	send_line(dev->fd, buf);
+}
+
+static void stats_add(probe_stats_t *st, uint64_t usec)
+{
+	if (st->count == st->size) {
+		st->size = (st->size ? st->size * 2 : 1024);
+		st->samples = xrealloc(st->samples, st->size * sizeof(*st->samples));
+	}
+	st->samples[st->count++] = usec;
+}
+
+/* a status of the device of a client, from a reply or a notification */
+static void client_status(probe_client_t *cl, const char *value, uint64_t now)
+{
+	probe_dev_t	*dev = &devs[cl->dev];
+	probe_stats_t	*st = (cl->watch ? &stats_watch : &stats_poll);
+	int	ob = (strncmp(value, "OB", 2) == 0);
+
+	if (dev->gen <= cl->seen || ob != dev->ob)
+		return;
+
+	st->missed += dev->gen - cl->seen - 1;
+	cl->seen = dev->gen;
+	stats_add(st, now - dev->sent);
+}
+
+static void client_line(probe_client_t *cl, const char *line, uint64_t now)
+{
+	const char	*p;
+
+	/* VAR <ups> ups.status "<value>" (or NOTIFY VAR ...) */
+	if ((p = strstr(line, " ups.status \"")) != NULL
+	 && (!strncmp(line, "VAR ", 4) || !strncmp(line, "NOTIFY VAR ", 11))
+	) {
+		if (!cl->watch)
+			cl->pending = 0;
+		client_status(cl, p + 13, now);
+		return;
+	}
+
+	if (!strncmp(line, "ERR ", 4)) {
+		if (cl->watch)
+			fatalx(EXIT_FAILURE, "upsd refused WATCH: %s", line);
+		cl->pending = 0;
+	}
+
+	/* OK of WATCH, and the rest */
+}
+
+static void client_read(probe_client_t *cl, uint64_t now)
+{
+	ssize_t	ret;
+	char	*start, *nl;
+
+	ret = read(cl->fd, cl->buf + cl->len, sizeof(cl->buf) - cl->len - 1);
+	if (ret <= 0)
+		fatalx(EXIT_FAILURE, "upsd dropped a client connection");
+	cl->len += (size_t)ret;
+	cl->buf[cl->len] = '\0';
+
+	for (start = cl->buf; (nl = strchr(start, '\n')) != NULL; start = nl + 1) {
+		*nl = '\0';
+		client_line(cl, start, now);
+	}
+
+	cl->len -= (size_t)(start - cl->buf);
+	memmove(cl->buf, start, cl->len);
+
+	/* a line longer than the buffer is not one of ours */
+	if (cl->len == sizeof(cl->buf) - 1)
+		cl->len = 0;
+}
+
+static void client_connect(probe_client_t *cl, unsigned short port)
+{
+	struct sockaddr_in	sa;
+	char	buf[SMALLBUF];
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((cl->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		fatal_with_errno(EXIT_FAILURE, "socket");
+	if (connect(cl->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		fatal_with_errno(EXIT_FAILURE, "connect to upsd on port %u", port);
+
+	if (cl->watch) {
+		snprintf(buf, sizeof(buf), "WATCH %s ups.status\n", devs[cl->dev].name);
+		send_line(cl->fd, buf);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t	x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* nearest rank, in msec */
+static double percentile(const probe_stats_t *st, double q)
+{
+	size_t	rank;
+
+	if (st->count == 0)
+		return 0;
+
+	rank = (size_t)(q * (double)st->count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > st->count)
+		rank = st->count;
+
+	return (double)st->samples[rank - 1] / 1000;
+}
+
+static void stats_print(const probe_stats_t *st, unsigned long expected)
+{
+	qsort(st->samples, st->count, sizeof(*st->samples), cmp_u64);
+
+	printf("\"%s\":{\"clients\":%" PRIuSIZE ",\"samples\":%" PRIuSIZE
+		",\"missed\":%lu,\"expected\":%lu,"
+		"\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f}",
+		st->kind, st->clients, st->count, st->missed, expected,
+		percentile(st, 0.5), percentile(st, 0.99), percentile(st, 0.999),
+		percentile(st, 1.0));
+
+	if (st->clients) {
+		fprintf(stderr, "%-6s %8" PRIuSIZE " %8" PRIuSIZE " %8lu %10.3f %10.3f %10.3f %10.3f\n",
+			st->kind, st->clients, st->count, st->missed,
+			percentile(st, 0.5), percentile(st, 0.99), percentile(st, 0.999),
+			percentile(st, 1.0));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char	*statepath = NULL, *driver = "dummy-ups", *prefix = "bench-probe";
+	const char	*pidfile = NULL;
+	size_t	npoll = 10, nwatch = 10, i, nfds;
+	unsigned long	flips = 200, flipped = 0, expected_poll = 0, expected_watch = 0;
+	long	gap_ms = 50, wait_s = 30;
+	unsigned short	port = 3493;
+	uint64_t	now, deadline, next_flip = 0, started = 0, ended = 0;
+	double	cpu_start = -1, cpu_end = -1;
+	pid_t	upsd_pid = -1;
+	struct pollfd	*pfd;
+	struct sigaction	sa;
+	int	opt, timeout, phase = 0;
+
+	while ((opt = getopt(argc, argv, "s:D:n:d:p:c:w:i:f:g:P:t:h")) != -1) {
+		switch (opt) {
+			case 's':
+				statepath = optarg;
+				break;
+			case 'D':
+				driver = optarg;
+				break;
+			case 'n':
+				prefix = optarg;
+				break;
+			case 'd':
+				ndevs = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				port = (unsigned short)atoi(optarg);
+				break;
+			case 'c':
+				npoll = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				nwatch = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				poll_ms = atol(optarg);
+				break;
+			case 'f':
+				flips = strtoul(optarg, NULL, 10);
+				break;
+			case 'g':
+				gap_ms = atol(optarg);
+				break;
+			case 'P':
+				pidfile = optarg;
+				break;
+			case 't':
+				wait_s = atol(optarg);
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (!statepath || ndevs < 1 || npoll + nwatch < 1 || poll_ms < 1
+	 || flips < 1 || gap_ms < 0 || wait_s < 1
+	) {
+		fatalx(EXIT_FAILURE, "Invalid arguments, see -h");
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = set_stop_flag;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	devs = xcalloc(ndevs, sizeof(*devs));
+	for (i = 0; i < ndevs; i++) {
+		snprintf(devs[i].name, sizeof(devs[i].name), "%s%" PRIuSIZE, prefix, i + 1);
+		dev_listen(&devs[i], statepath, driver);
+	}
+
+	nclients = npoll + nwatch;
+	stats_poll.clients = npoll;
+	stats_watch.clients = nwatch;
+	clients = xcalloc(nclients, sizeof(*clients));
+	for (i = 0; i < nclients; i++) {
+		clients[i].fd = -1;
+		clients[i].watch = (i >= npoll);
+		clients[i].dev = i % ndevs;
+	}
+
+	pfd = xcalloc(ndevs * 2 + nclients, sizeof(*pfd));
+
+	/* the first line tells nut-latency-bench.sh to start upsd */
+	fprintf(stderr, "READY %" PRIuSIZE " driver sockets in %s\n", ndevs, statepath);
+
+	/* phase 0: upsd connects to all the devices and gets their dump,
+	 * phase 1: the clients connect and settle,
+	 * phase 2: the flips, and the time for the clients to see the last */
+	deadline = now_usec() + (uint64_t)wait_s * 1000000;
+
+	while (!stop_flag) {
+		now = now_usec();
+
+		switch (phase) {
+			case 0:
+				for (i = 0; i < ndevs && devs[i].ready; i++)
+					;
+				if (i == ndevs) {
+					for (i = 0; i < nclients; i++) {
+						client_connect(&clients[i], port);
+						clients[i].next_poll = now;
+					}
+					/* let the WATCH replies and the first polls in */
+					deadline = now + 500000;
+					phase = 1;
+				} else if (now > deadline) {
+					fatalx(EXIT_FAILURE, "upsd did not connect to all the driver sockets in %lds", wait_s);
+				}
+				break;
+
+			case 1:
+				if (now >= deadline) {
+					upsd_pid = read_pidfile(pidfile);
+					cpu_start = cpu_usec(upsd_pid);
+					started = now;
+					next_flip = now;
+					phase = 2;
+				}
+				break;
+
+			default:
+				if (flipped < flips && now >= next_flip) {
+					probe_dev_t	*dev = &devs[flipped % ndevs];
+
+					if (dev->fd < 0)
+						fatalx(EXIT_FAILURE, "upsd is no longer connected to %s", dev->name);
+					dev_flip(dev);
+					flipped++;
+					next_flip += (uint64_t)gap_ms * 1000;
+					if (flipped == flips)
+						deadline = now + (uint64_t)poll_ms * 2000 + 1000000;
+				}
+				break;
+		}
+
+		if (phase == 2 && flipped == flips) {
+			for (i = 0; i < nclients && clients[i].seen == devs[clients[i].dev].gen; i++)
+				;
+			if (i == nclients || now >= deadline)
+				break;
+		}
+
+		/* what to wait for, and until when */
+		nfds = 0;
+		for (i = 0; i < ndevs; i++) {
+			pfd[nfds].fd = (devs[i].fd < 0 ? devs[i].listen_fd : devs[i].fd);
+			pfd[nfds].events = POLLIN;
+			nfds++;
+		}
+
+		timeout = 100;
+		if (phase == 2 && flipped < flips)
+			timeout = (next_flip > now ? (int)((next_flip - now + 999) / 1000) : 0);
+
+		for (i = 0; i < nclients; i++) {
+			probe_client_t	*cl = &clients[i];
+
+			if (cl->fd < 0)
+				continue;
+
+			if (!cl->watch && !cl->pending && now >= cl->next_poll) {
+				char	buf[SMALLBUF];
+
+				snprintf(buf, sizeof(buf), "GET VAR %s ups.status\n", devs[cl->dev].name);
+				send_line(cl->fd, buf);
+				cl->pending = 1;
+				cl->next_poll += (uint64_t)poll_ms * 1000;
+				if (cl->next_poll < now)
+					cl->next_poll = now;
+			}
+			if (!cl->watch && !cl->pending) {
+				int	t = (int)((cl->next_poll - now + 999) / 1000);
+
+				if (t < timeout)
+					timeout = t;
+			}
+
+			pfd[nfds].fd = cl->fd;
+			pfd[nfds].events = POLLIN;
+			nfds++;
+		}
+
+		if (poll(pfd, (nfds_t)nfds, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		now = now_usec();
+		nfds = 0;
+		for (i = 0; i < ndevs; i++, nfds++) {
+			probe_dev_t	*dev = &devs[i];
+
+			if (!(pfd[nfds].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			if (dev->fd < 0) {
+				if ((dev->fd = accept(dev->listen_fd, NULL, NULL)) < 0)
+					upslog_with_errno(LOG_WARNING, "accept on %s", dev->path);
+				continue;
+			}
+			dev_read(dev);
+		}
+
+		for (i = 0; i < nclients; i++) {
+			if (clients[i].fd < 0)
+				continue;
+			if (pfd[nfds].revents & (POLLIN | POLLHUP | POLLERR))
+				client_read(&clients[i], now);
+			nfds++;
+		}
+	}
+
+	ended = now_usec();
+	cpu_end = cpu_usec(upsd_pid);
+
+	if (stop_flag || phase < 2)
+		fatalx(EXIT_FAILURE, "Interrupted");
+
+	/* each client could see all the flips of its device */
+	for (i = 0; i < nclients; i++) {
+		if (clients[i].watch)
+			expected_watch += devs[clients[i].dev].gen;
+		else
+			expected_poll += devs[clients[i].dev].gen;
+	}
+
+	fprintf(stderr, "%lu flips over %" PRIuSIZE " devices in %.3fs\n\n", flipped, ndevs,
+		(double)(ended - started) / 1e6);
+	fprintf(stderr, "%-6s %8s %8s %8s %10s %10s %10s %10s\n",
+		"CLIENT", "COUNT", "SAMPLES", "MISSED", "P50(ms)", "P99(ms)", "P999(ms)", "MAX(ms)");
+
+	printf("{\"devices\":%" PRIuSIZE ",\"flips\":%lu,\"gap_ms\":%ld,\"poll_ms\":%ld,\"seconds\":%.3f,",
+		ndevs, flipped, gap_ms, poll_ms, (double)(ended - started) / 1e6);
+	stats_print(&stats_poll, expected_poll);
+	printf(",");
+	stats_print(&stats_watch, expected_watch);
+	if (cpu_start >= 0 && cpu_end >= cpu_start) {
+		printf(",\"upsd_cpu_ms\":%.3f,\"upsd_cpu_us_per_flip\":%.1f}\n",
+			(cpu_end - cpu_start) / 1000, (cpu_end - cpu_start) / (double)flipped);
+		fprintf(stderr, "\nupsd CPU: %.3f ms, %.1f us per flip\n",
+			(cpu_end - cpu_start) / 1000, (cpu_end - cpu_start) / (double)flipped);
+	} else {
+		printf(",\"upsd_cpu_ms\":null,\"upsd_cpu_us_per_flip\":null}\n");
+	}
+
+	for (i = 0; i < ndevs; i++) {
+		if (devs[i].fd >= 0)
+			close(devs[i].fd);
+		close(devs[i].listen_fd);
+		unlink(devs[i].path);
+	}
+	for (i = 0; i < nclients; i++) {
+		if (clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+
+	free(pfd);
+	free(clients);
+	free(devs);
+	free(stats_poll.samples);
+	free(stats_watch.samples);
+
+	return EXIT_SUCCESS;
+}
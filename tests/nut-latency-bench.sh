@@ -0,0 +1,198 @@
+#!/bin/sh
+
+# Benchmark of how quickly a change at a driver becomes visible to the
+# clients of upsd: nut-latency-bench-probe serves the sockets of simulated
+# drivers, flips the ups.status of their devices between OL and OB, and
+# times when its clients of upsd see each flip, some of them polling with
+# GET VAR and others subscribed with WATCH. Meanwhile, dummy-ups drivers
+# in their dummy-bench mode load upsd with a stream of other updates.
+#
+# Reported: the p50/p99/p999/max latency from the driver to the clients
+# of each kind, the flips they missed, and the CPU time of upsd per flip
+# (with the load of the other drivers in it), as a table on stderr and
+# one JSON object on stdout (also appended to BENCH_OUTPUT, if set), so
+# that runs before and after a change can be compared.
+#
+# Run it with `make check-nut-latency-bench` in the tests directory, or
+# directly from there after building upsd, dummy-ups and
+# nut-latency-bench-probe. Caller can export envvars to change the setup:
+#	NUT_UPSD=...	the upsd program
+#	NUT_DUMMY_UPS=...	the dummy-ups program
+#	BENCH_PROBE=...	the nut-latency-bench-probe program
+#	BENCH_PORT=13494	port of upsd (on 127.0.0.1)
+#	BENCH_LOAD=4	dummy-ups drivers loading upsd
+#	BENCH_LOAD_RATE=200	SETINFO per second of each of them (0: no limit)
+#	BENCH_PROBES=2	devices whose status is flipped
+#	BENCH_POLL_CLIENTS=10	clients which poll with GET VAR
+#	BENCH_WATCH_CLIENTS=10	clients which subscribe with WATCH
+#	BENCH_POLL_MS=100	interval of their polls
+#	BENCH_FLIPS=200	status flips, over all the probe devices
+#	BENCH_GAP_MS=100	time between the flips (of the devices in turn;
+#			the polls miss flips of a device less apart)
+#	BENCH_OUTPUT=	file to append the JSON results to
+#
+# The clients run in one process, so their numbers are not meant to be
+# high enough to load upsd by themselves; BENCH_LOAD is for that.
+#
+# Design note: written with dumbed-down POSIX shell syntax, like NIT, which
+# this borrows its handling of the sandbox (and of running as root) from.
+#
+# License: GPLv2+
+
+[ -n "${NUT_UPSD-}" ] || NUT_UPSD="`pwd`/../server/upsd"
+[ -n "${NUT_DUMMY_UPS-}" ] || NUT_DUMMY_UPS="`pwd`/../drivers/dummy-ups"
+[ -n "${BENCH_PROBE-}" ] || BENCH_PROBE="`pwd`/nut-latency-bench-probe"
+[ -n "${BENCH_PORT-}" ] || BENCH_PORT=13494
+[ -n "${BENCH_LOAD-}" ] || BENCH_LOAD=4
+[ -n "${BENCH_LOAD_RATE-}" ] || BENCH_LOAD_RATE=200
+[ -n "${BENCH_PROBES-}" ] || BENCH_PROBES=2
+[ -n "${BENCH_POLL_CLIENTS-}" ] || BENCH_POLL_CLIENTS=10
+[ -n "${BENCH_WATCH_CLIENTS-}" ] || BENCH_WATCH_CLIENTS=10
+[ -n "${BENCH_POLL_MS-}" ] || BENCH_POLL_MS=100
+[ -n "${BENCH_FLIPS-}" ] || BENCH_FLIPS=200
+[ -n "${BENCH_GAP_MS-}" ] || BENCH_GAP_MS=100
+
+die() {
+	echo "FATAL: $*" >&2
+	exit 1
+}
+
+for P in "$NUT_UPSD" "$NUT_DUMMY_UPS" "$BENCH_PROBE" ; do
+	[ -x "$P" ] || die "$P is not built, see the comments in $0"
+done
+
+# Short, for the AF_UNIX socket names (see NIT)
+if [ -d /dev/shm ] && [ -w /dev/shm ] ; then BENCH_TMP=/dev/shm ; else BENCH_TMP="${TMPDIR:-/tmp}" ; fi
+BENCHDIR="`mktemp -d "$BENCH_TMP/nutlat.XXXXXX"`" \
+|| die "Can not create a temporary directory"
+
+PIDS=""
+cleanup() {
+	for P in $PIDS ; do
+		kill "$P" 2>/dev/null
+	done
+	for P in $PIDS ; do
+		wait "$P" 2>/dev/null
+	done
+	if [ -n "${BENCH_FAILED-}" ] ; then
+		for F in "$BENCHDIR"/*.log ; do
+			[ -s "$F" ] && sed "s|^|`basename "$F"`: |" < "$F" >&2
+		done
+	fi
+	rm -rf "$BENCHDIR"
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+NUT_CONFPATH="$BENCHDIR"
+NUT_STATEPATH="$BENCHDIR"
+NUT_ALTPIDPATH="$BENCHDIR"
+export NUT_CONFPATH NUT_STATEPATH NUT_ALTPIDPATH
+
+# Daemons started by root become an unprivileged user (see NIT)
+if [ "`id -u`" = 0 ] ; then
+	chmod 777 "$BENCHDIR"
+fi
+
+cat > "$BENCHDIR/upsd.conf" << EOF
+STATEPATH "$BENCHDIR"
+LISTEN 127.0.0.1 $BENCH_PORT
+MAXCONN 1024
+EOF
+
+cat > "$BENCHDIR/upsd.users" << EOF
+[admin]
+	password = bench
+	actions = SET
+	instcmds = ALL
+EOF
+
+# What the load drivers replay, with the numbers varied on each pass
+cat > "$BENCHDIR/load.seq" << EOF
+battery.charge: 100
+battery.runtime: 1800
+input.voltage: 230.0
+output.voltage: 230.0
+ups.load: 25
+ups.temperature: 30.0
+ups.status: OL
+TIMER 0.01
+EOF
+
+: > "$BENCHDIR/ups.conf"
+N=1
+while [ "$N" -le "$BENCH_LOAD" ] ; do
+	cat >> "$BENCHDIR/ups.conf" << EOF
+[bench-load$N]
+	driver = dummy-ups
+	port = load.seq
+	mode = dummy-bench
+	bench_rate = $BENCH_LOAD_RATE
+	bench_random = 6
+	pollinterval = 1
+
+EOF
+	N="`expr $N + 1`"
+done
+
+# Their driver sockets are served by the probe; the port is not used
+N=1
+while [ "$N" -le "$BENCH_PROBES" ] ; do
+	cat >> "$BENCHDIR/ups.conf" << EOF
+[bench-probe$N]
+	driver = dummy-ups
+	port = probe.dev
+
+EOF
+	N="`expr $N + 1`"
+done
+
+chmod 644 "$BENCHDIR"/*.conf "$BENCHDIR/upsd.users" "$BENCHDIR/load.seq"
+
+# The probe first, so upsd finds its sockets at once
+"$BENCH_PROBE" -s "$BENCHDIR" -d "$BENCH_PROBES" -p "$BENCH_PORT" \
+	-c "$BENCH_POLL_CLIENTS" -w "$BENCH_WATCH_CLIENTS" -i "$BENCH_POLL_MS" \
+	-f "$BENCH_FLIPS" -g "$BENCH_GAP_MS" -P "$BENCHDIR/upsd.pid" \
+	> "$BENCHDIR/probe.out" 2> "$BENCHDIR/probe.log" &
+PROBE_PID=$!
+PIDS="$PIDS $PROBE_PID"
+
+wait_for() {
+	COUNTDOWN=100
+	while ! eval "$1" ; do
+		if [ "$COUNTDOWN" -le 0 ] ; then
+			BENCH_FAILED=yes
+			die "$2"
+		fi
+		COUNTDOWN="`expr $COUNTDOWN - 1`"
+		sleep 0.1 2>/dev/null || sleep 1
+	done
+}
+
+wait_for 'grep "^READY" "$BENCHDIR/probe.log" >/dev/null 2>&1' "The probe did not start"
+
+N=1
+while [ "$N" -le "$BENCH_LOAD" ] ; do
+	"$NUT_DUMMY_UPS" -a "bench-load$N" -F > "$BENCHDIR/bench-load$N.log" 2>&1 &
+	PIDS="$PIDS $!"
+	wait_for '[ -S "$BENCHDIR/dummy-ups-bench-load$N" ]' "Driver bench-load$N did not start"
+	N="`expr $N + 1`"
+done
+
+"$NUT_UPSD" -FF > "$BENCHDIR/upsd.log" 2>&1 &
+PIDS="$PIDS $!"
+
+wait "$PROBE_PID"
+PROBE_RES=$?
+
+if [ "$PROBE_RES" != 0 ] ; then
+	BENCH_FAILED=yes
+	die "The probe failed with code $PROBE_RES"
+fi
+
+echo "$BENCH_LOAD load drivers at $BENCH_LOAD_RATE SETINFO/s each" >&2
+grep -v '^READY' "$BENCHDIR/probe.log" >&2
+cat "$BENCHDIR/probe.out"
+if [ -n "${BENCH_OUTPUT-}" ] ; then
+	cat "$BENCHDIR/probe.out" >> "$BENCH_OUTPUT"
+fi
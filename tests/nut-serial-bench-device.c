@@ -0,0 +1,568 @@
+/*  nut-serial-bench-device.c - a simulated serial UPS on a pseudo-terminal,
+ *  for nut-serial-bench.sh to time a serial driver against
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* The driver opens the other side of the pseudo-terminal as its port,
+ * with ser_open() and all, as it would a real one. What the device says
+ * comes from a model file, with a request and its answer on each line:
+ *
+ *	# comment
+ *	@baud 2400		line speed: the bytes take their time both ways
+ *	@walk Q1\r		the request a driver update starts with
+ *	@delay 20		msec before the answers of the lines below
+ *	@garbage 5 3		5% of the answers of the lines below come after
+ *				up to 3 random bytes
+ *	Q1\r<TAB>(215.0 195.0 230.0 014 49.0 2.27 30.0 00101000\r
+ *	QS\r<TAB>
+ *
+ * with \r, \n, \t, \\ and \xHH in the requests and answers. A request
+ * with no answer is left unanswered (the driver times out), as are the
+ * lines ending with \r or \n which match no request. A request listed
+ * several times gets its answers in turn, so a transcript of what a
+ * device said can be replayed as well.
+ *
+ * For each walk (from one walk request to the last byte exchanged
+ * before the next), the wall time, the bytes each way and the requests
+ * left unanswered are told on stderr, and the totals as one JSON object
+ * on stdout once the walks asked for are done. */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#define MODEL_MAXLEN	SMALLBUF
+
+typedef struct {
+	unsigned char	req[MODEL_MAXLEN];
+	size_t	reqlen;
+	unsigned char	ans[MODEL_MAXLEN];
+	size_t	anslen;
+	long	delay_ms;
+	int	garbage_pct;
+	int	garbage_max;
+	size_t	next;	/* the next line with the same request, in a ring */
+	size_t	first;	/* the first line with the same request, which keeps: */
+	size_t	last;	/* the last one of them */
+	size_t	turn;	/* the one answering next */
+} model_rule_t;
+
+typedef struct {
+	uint64_t	start, last;	/* usec */
+	size_t	bytes_in, bytes_out, requests, timeouts, garbage;
+} walk_t;
+
+static model_rule_t	*rules = NULL;
+static size_t	nrules = 0;
+static unsigned char	walk_req[MODEL_MAXLEN];
+static size_t	walk_reqlen = 0;
+static long	baud = 2400;
+
+static walk_t	*walks = NULL;
+static size_t	nwalks = 0, maxwalks = 0;
+static walk_t	pre;	/* what came before the first walk */
+
+static volatile sig_atomic_t	stop_flag = 0;
+
+static void set_stop_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	stop_flag = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Simulate a serial UPS on a pseudo-terminal, answering as told by\n");
+	printf("a model file (see the comments in the sources), until the walks\n");
+	printf("asked for are done or interrupted. The first line on stdout tells\n");
+	printf("the terminal for the driver to open.\n\n");
+	printf("Usage: %s [OPTIONS] -m <model>\n\n", prog);
+	printf("  -m <file>	the model of the device\n");
+	printf("  -l <path>	also make a symlink to the terminal there\n");
+	printf("  -b <baud>	line speed (default from the model, else 2400)\n");
+	printf("  -w <count>	walks to time (default 10)\n");
+	printf("  -s <seed>	seed of the garbage (default 1)\n");
+}
+
+static uint64_t now_usec(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+}
+
+/* each byte takes a start bit, 8 data bits and a stop bit */
+static uint64_t byte_usec(void)
+{
+	return (uint64_t)(10000000 / baud);
+}
+
+static void sleep_until(uint64_t when)
+{
+	uint64_t	now = now_usec();
+
+	if (when > now) {
+		usleep((useconds_t)(when - now));
+	}
+}
+
+/* \r, \n, \t, \\ and \xHH; the length of what came of s */
+static size_t unescape(const char *s, unsigned char *out, size_t outlen)
+{
+	size_t	n = 0;
+	unsigned int	c;
+
+	for (; *s && n < outlen; s++) {
+		if (*s != '\\' || !s[1]) {
+			out[n++] = (unsigned char)*s;
+			continue;
+		}
+
+		s++;
+		switch (*s) {
+		case 'r':
+			out[n++] = '\r';
+			break;
+		case 'n':
+			out[n++] = '\n';
+			break;
+		case 't':
+			out[n++] = '\t';
+			break;
+		case 'x':
+			if (sscanf(s + 1, "%2x", &c) == 1) {
+				out[n++] = (unsigned char)c;
+				s += 2;
+				break;
+			}
+			/* fall through */
+		default:
+			out[n++] = (unsigned char)*s;
+			break;
+		}
+	}
+
+	return n;
+}
+
+static void model_load(const char *fn)
+{
+	FILE	*f;
+	char	line[LARGEBUF], *tab;
+	long	delay_ms = 0;
+	int	garbage_pct = 0, garbage_max = 0;
+	size_t	maxrules = 0, i, lineno = 0;
+	model_rule_t	*r;
+
+	f = fopen(fn, "r");
+	if (!f) {
+		fatal_with_errno(EXIT_FAILURE, "Can not read %s", fn);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (!line[0] || line[0] == '#') {
+			continue;
+		}
+
+		if (line[0] == '@') {
+			if (!strncmp(line, "@baud ", 6)) {
+				baud = atol(line + 6);
+			} else if (!strncmp(line, "@walk ", 6)) {
+				walk_reqlen = unescape(line + 6, walk_req, sizeof(walk_req));
+			} else if (!strncmp(line, "@delay ", 7)) {
+				delay_ms = atol(line + 7);
+			} else if (sscanf(line, "@garbage %d %d", &garbage_pct, &garbage_max) < 1) {
+				fatalx(EXIT_FAILURE, "%s:%" PRIuSIZE ": unknown setting", fn, lineno);
+			}
+			continue;
+		}
+
+		if (nrules == maxrules) {
+			maxrules = maxrules ? 2 * maxrules : 64;
+			rules = xrealloc(rules, maxrules * sizeof(*rules));
+		}
+
+		r = &rules[nrules];
+		memset(r, 0, sizeof(*r));
+
+		tab = strchr(line, '\t');
+		if (tab) {
+			*tab++ = '\0';
+			r->anslen = unescape(tab, r->ans, sizeof(r->ans));
+		}
+
+		r->reqlen = unescape(line, r->req, sizeof(r->req));
+		if (!r->reqlen) {
+			fatalx(EXIT_FAILURE, "%s:%" PRIuSIZE ": no request", fn, lineno);
+		}
+
+		r->delay_ms = delay_ms;
+		r->garbage_pct = garbage_pct;
+		r->garbage_max = garbage_max > 0 ? garbage_max : 1;
+		r->next = r->first = r->last = r->turn = nrules;
+
+		/* chain the lines of the same request */
+		for (i = 0; i < nrules; i++) {
+			if (rules[i].reqlen == r->reqlen
+			 && !memcmp(rules[i].req, r->req, r->reqlen)
+			) {
+				r->first = r->next = i;
+				rules[rules[i].last].next = nrules;
+				rules[i].last = nrules;
+				break;
+			}
+		}
+
+		nrules++;
+	}
+
+	fclose(f);
+
+	if (!nrules) {
+		fatalx(EXIT_FAILURE, "%s: no requests", fn);
+	}
+
+	if (!walk_reqlen) {
+		walk_reqlen = rules[0].reqlen;
+		memcpy(walk_req, rules[0].req, walk_reqlen);
+	}
+}
+
+/* the line answering a request which buf ends with (the longest such
+ * request, in its turn), or NULL */
+static model_rule_t *model_match(const unsigned char *buf, size_t len)
+{
+	model_rule_t	*best = NULL, *r;
+	size_t	i;
+
+	for (i = 0; i < nrules; i++) {
+		r = &rules[i];
+
+		if (r->reqlen > len
+		 || (best && r->reqlen <= best->reqlen)
+		 || memcmp(buf + len - r->reqlen, r->req, r->reqlen)
+		) {
+			continue;
+		}
+
+		best = r;
+	}
+
+	if (!best) {
+		return NULL;
+	}
+
+	/* the lines of the request answer in turn */
+	best = &rules[best->first];
+	r = &rules[best->turn];
+	best->turn = r->next;
+
+	return r;
+}
+
+static walk_t *walk_current(void)
+{
+	return nwalks ? &walks[nwalks - 1] : &pre;
+}
+
+static void walk_begin(uint64_t now)
+{
+	walk_t	*w;
+
+	if (nwalks == maxwalks) {
+		maxwalks = maxwalks ? 2 * maxwalks : 64;
+		walks = xrealloc(walks, maxwalks * sizeof(*walks));
+	}
+
+	w = &walks[nwalks++];
+	memset(w, 0, sizeof(*w));
+	w->start = w->last = now;
+}
+
+static void walk_report(size_t i)
+{
+	const walk_t	*w = &walks[i];
+
+	fprintf(stderr, "walk %4" PRIuSIZE " %10.3f ms %6" PRIuSIZE " in %6" PRIuSIZE
+		" out %4" PRIuSIZE " requests %3" PRIuSIZE " timeouts %3" PRIuSIZE " garbage\n",
+		i + 1, (double)(w->last - w->start) / 1000, w->bytes_in, w->bytes_out,
+		w->requests, w->timeouts, w->garbage);
+}
+
+/* write what the device says, at the pace of the line */
+static void say(int fd, const unsigned char *data, size_t len, uint64_t *when)
+{
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		sleep_until(*when);
+		if (write(fd, data + i, 1) != 1) {
+			upsdebug_with_errno(1, "write");
+		}
+		*when += byte_usec();
+	}
+}
+
+static void answer(int fd, model_rule_t *r, uint64_t heard)
+{
+	walk_t	*w = walk_current();
+	uint64_t	when = heard + (uint64_t)r->delay_ms * 1000;
+	unsigned char	junk[MODEL_MAXLEN];
+	size_t	n, i;
+
+	w->requests++;
+
+	if (!r->anslen) {
+		w->timeouts++;
+		return;
+	}
+
+	if (r->garbage_pct > 0 && rand() % 100 < r->garbage_pct) {
+		n = 1 + (size_t)(rand() % r->garbage_max);
+		if (n > sizeof(junk)) {
+			n = sizeof(junk);
+		}
+		for (i = 0; i < n; i++) {
+			junk[i] = (unsigned char)(rand() & 0xff);
+		}
+		say(fd, junk, n, &when);
+		w->garbage += n;
+		w->bytes_out += n;
+	}
+
+	say(fd, r->ans, r->anslen, &when);
+	w->bytes_out += r->anslen;
+	w->last = when;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t	x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void summary(const char *model, size_t count)
+{
+	uint64_t	*ms;
+	size_t	i, in = 0, out = 0, requests = 0, timeouts = 0, garbage = 0;
+	double	sum = 0;
+
+	if (!count) {
+		printf("{\"model\":\"%s\",\"baud\":%ld,\"walks\":0}\n", model, baud);
+		return;
+	}
+
+	ms = xcalloc(count, sizeof(*ms));
+	for (i = 0; i < count; i++) {
+		ms[i] = walks[i].last - walks[i].start;
+		sum += (double)ms[i];
+		in += walks[i].bytes_in;
+		out += walks[i].bytes_out;
+		requests += walks[i].requests;
+		timeouts += walks[i].timeouts;
+		garbage += walks[i].garbage;
+	}
+	qsort(ms, count, sizeof(*ms), cmp_u64);
+
+	printf("{\"model\":\"%s\",\"baud\":%ld,\"walks\":%" PRIuSIZE
+		",\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"max_ms\":%.3f"
+		",\"bytes_in\":%" PRIuSIZE ",\"bytes_out\":%" PRIuSIZE
+		",\"requests\":%" PRIuSIZE ",\"timeouts\":%" PRIuSIZE
+		",\"garbage\":%" PRIuSIZE "}\n",
+		model, baud, count, sum / (double)count / 1000,
+		(double)ms[(count - 1) / 2] / 1000, (double)ms[count - 1] / 1000,
+		in, out, requests, timeouts, garbage);
+
+	free(ms);
+}
+
+int main(int argc, char **argv)
+{
+	const char	*model = NULL, *link = NULL;
+	long	baud_opt = 0;
+	size_t	want = 10, len = 0, reported = 0;
+	unsigned int	seed = 1;
+	unsigned char	buf[MODEL_MAXLEN], c;
+	uint64_t	heard = 0, now;
+	int	master, slave, opt;
+	char	*name;
+	struct termios	tio;
+	struct pollfd	pfd;
+	struct sigaction	sa;
+	model_rule_t	*r;
+	walk_t	*w;
+
+	while ((opt = getopt(argc, argv, "m:l:b:w:s:h")) != -1) {
+		switch (opt) {
+			case 'm':
+				model = optarg;
+				break;
+			case 'l':
+				link = optarg;
+				break;
+			case 'b':
+				baud_opt = atol(optarg);
+				break;
+			case 'w':
+				want = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				seed = (unsigned int)strtoul(optarg, NULL, 10);
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (!model || want < 1) {
+		fatalx(EXIT_FAILURE, "Invalid arguments, see -h");
+	}
+
+	model_load(model);
+	if (baud_opt > 0) {
+		baud = baud_opt;
+	}
+	if (baud < 50) {
+		fatalx(EXIT_FAILURE, "Invalid line speed %ld", baud);
+	}
+
+	srand(seed);
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)
+	 || !(name = ptsname(master))
+	) {
+		fatal_with_errno(EXIT_FAILURE, "Can not make a pseudo-terminal");
+	}
+
+	/* Held open, so the master does not see a hangup while the driver
+	 * has not opened it yet (or reconnects); raw until the driver sets
+	 * it up its way */
+	slave = open(name, O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &tio)) {
+		fatal_with_errno(EXIT_FAILURE, "Can not open %s", name);
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	/* for a driver which dropped its privileges */
+	chmod(name, 0666);
+
+	if (link) {
+		unlink(link);
+		if (symlink(name, link)) {
+			fatal_with_errno(EXIT_FAILURE, "Can not link %s to %s", link, name);
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = set_stop_flag;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(&pre, 0, sizeof(pre));
+
+	printf("READY %s\n", name);
+	fflush(stdout);
+
+	pfd.fd = master;
+	pfd.events = POLLIN;
+
+	while (!stop_flag && reported < want) {
+		if (poll(&pfd, 1, 100) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		if (!(pfd.revents & POLLIN) || read(master, &c, 1) != 1) {
+			continue;
+		}
+
+		/* the line delivers the byte one byte time after the last */
+		now = now_usec();
+		heard = (len && heard + byte_usec() > now) ? heard + byte_usec() : now;
+
+		buf[len++] = c;
+
+		if (len >= walk_reqlen
+		 && !memcmp(buf + len - walk_reqlen, walk_req, walk_reqlen)
+		) {
+			if (nwalks > reported) {
+				walk_report(reported++);
+			}
+			if (reported >= want) {
+				break;
+			}
+			walk_begin(heard - (walk_reqlen - 1) * byte_usec());
+		}
+
+		r = model_match(buf, len);
+		if (!r && c != '\r' && c != '\n' && len < sizeof(buf)) {
+			continue;
+		}
+
+		/* a whole request (of the walk it started) */
+		w = walk_current();
+		w->bytes_in += len;
+		if (heard > w->last) {
+			w->last = heard;
+		}
+		len = 0;
+
+		if (r) {
+			answer(master, r, heard);
+		} else {
+			/* nothing we know: the driver times out */
+			w->requests++;
+			w->timeouts++;
+		}
+	}
+
+	if (link) {
+		unlink(link);
+	}
+
+	fprintf(stderr, "before the first walk: %" PRIuSIZE " requests, %" PRIuSIZE
+		" timeouts\n", pre.requests, pre.timeouts);
+
+	summary(model, reported);
+
+	close(slave);
+	close(master);
+	free(rules);
+	free(walks);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#!/bin/sh
+
+# Benchmark of a serial driver without the hardware: nut-serial-bench-device
+# simulates the UPS on a pseudo-terminal, answering as its model file
+# tells (at the speed of the line, with delays and garbage if asked for),
+# and the driver opens the terminal as its port, through ser_open() and
+# the rest of drivers/serial.c as usual.
+#
+# Reported: for each walk (update) of the driver, its wall time, the bytes
+# exchanged and the requests the device left unanswered (which the driver
+# waited for in vain), as a table on stderr, and the totals as one JSON
+# object on stdout (also appended to BENCH_OUTPUT, if set), so that runs
+# before and after a change can be compared.
+#
+# Run it with `make check-nut-serial-bench` in the tests directory, or
+# directly from there after building the driver and
+# nut-serial-bench-device. Caller can export envvars to change the setup:
+#	NUT_SERIAL_DRIVER=...	the driver program (default blazer_ser)
+#	BENCH_DEVICE=...	the nut-serial-bench-device program
+#	BENCH_MODEL=...	the model of the device (default the Megatec one
+#			next to this script)
+#	BENCH_BAUD=	line speed (default as in the model)
+#	BENCH_WALKS=10	walks to time
+#	BENCH_POLLINTERVAL=1	of the driver, in seconds
+#	BENCH_SEED=1	seed of the garbage
+#	BENCH_DRIVER_OPTS=	more "name = value" lines for ups.conf, separated
+#			by ";" (e.g. "protocol = megatec")
+#	BENCH_OUTPUT=	file to append the JSON results to
+#
+# Design note: written with dumbed-down POSIX shell syntax, like NIT, which
+# this borrows its handling of the sandbox (and of running as root) from.
+#
+# License: GPLv2+
+
+SCRIPT_DIR="`dirname "$0"`"
+SCRIPT_DIR="`cd "$SCRIPT_DIR" && pwd`"
+
+[ -n "${NUT_SERIAL_DRIVER-}" ] || NUT_SERIAL_DRIVER="`pwd`/../drivers/blazer_ser"
+[ -n "${BENCH_DEVICE-}" ] || BENCH_DEVICE="`pwd`/nut-serial-bench-device"
+[ -n "${BENCH_MODEL-}" ] || BENCH_MODEL="$SCRIPT_DIR/nut-serial-bench-megatec.txt"
+[ -n "${BENCH_WALKS-}" ] || BENCH_WALKS=10
+[ -n "${BENCH_POLLINTERVAL-}" ] || BENCH_POLLINTERVAL=1
+[ -n "${BENCH_SEED-}" ] || BENCH_SEED=1
+
+die() {
+	echo "FATAL: $*" >&2
+	exit 1
+}
+
+for P in "$NUT_SERIAL_DRIVER" "$BENCH_DEVICE" ; do
+	[ -x "$P" ] || die "$P is not built, see the comments in $0"
+done
+[ -s "$BENCH_MODEL" ] || die "No model of the device in $BENCH_MODEL"
+
+# Short, for the AF_UNIX socket names (see NIT)
+if [ -d /dev/shm ] && [ -w /dev/shm ] ; then BENCH_TMP=/dev/shm ; else BENCH_TMP="${TMPDIR:-/tmp}" ; fi
+BENCHDIR="`mktemp -d "$BENCH_TMP/nutser.XXXXXX"`" \
+|| die "Can not create a temporary directory"
+
+PIDS=""
+cleanup() {
+	for P in $PIDS ; do
+		kill "$P" 2>/dev/null
+	done
+	for P in $PIDS ; do
+		wait "$P" 2>/dev/null
+	done
+	if [ -n "${BENCH_FAILED-}" ] ; then
+		for F in "$BENCHDIR"/*.log ; do
+			[ -s "$F" ] && sed "s|^|`basename "$F"`: |" < "$F" >&2
+		done
+	fi
+	rm -rf "$BENCHDIR"
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+NUT_CONFPATH="$BENCHDIR"
+NUT_STATEPATH="$BENCHDIR"
+NUT_ALTPIDPATH="$BENCHDIR"
+export NUT_CONFPATH NUT_STATEPATH NUT_ALTPIDPATH
+
+# Daemons started by root become an unprivileged user (see NIT)
+if [ "`id -u`" = 0 ] ; then
+	chmod 777 "$BENCHDIR"
+fi
+
+DRIVER_NAME="`basename "$NUT_SERIAL_DRIVER"`"
+cat > "$BENCHDIR/ups.conf" << EOF
+[bench]
+	driver = $DRIVER_NAME
+	port = $BENCHDIR/tty
+	pollinterval = $BENCH_POLLINTERVAL
+EOF
+if [ -n "${BENCH_DRIVER_OPTS-}" ] ; then
+	echo "$BENCH_DRIVER_OPTS" | tr ';' '\n' | sed 's/^[ 	]*/	/' >> "$BENCHDIR/ups.conf"
+fi
+chmod 644 "$BENCHDIR/ups.conf"
+
+DEVICE_ARGS="-m $BENCH_MODEL -l $BENCHDIR/tty -w $BENCH_WALKS -s $BENCH_SEED"
+if [ -n "${BENCH_BAUD-}" ] ; then
+	DEVICE_ARGS="$DEVICE_ARGS -b $BENCH_BAUD"
+fi
+
+"$BENCH_DEVICE" $DEVICE_ARGS > "$BENCHDIR/device.out" 2> "$BENCHDIR/device.log" &
+DEVICE_PID=$!
+PIDS="$PIDS $DEVICE_PID"
+
+wait_for() {
+	COUNTDOWN=100
+	while ! eval "$1" ; do
+		if [ "$COUNTDOWN" -le 0 ] ; then
+			BENCH_FAILED=yes
+			die "$2"
+		fi
+		COUNTDOWN="`expr $COUNTDOWN - 1`"
+		sleep 0.1 2>/dev/null || sleep 1
+	done
+}
+
+wait_for 'grep "^READY" "$BENCHDIR/device.out" >/dev/null 2>&1' "The device did not start"
+
+"$NUT_SERIAL_DRIVER" -a bench -F > "$BENCHDIR/driver.log" 2>&1 &
+PIDS="$PIDS $!"
+
+wait "$DEVICE_PID"
+DEVICE_RES=$?
+
+if [ "$DEVICE_RES" != 0 ] ; then
+	BENCH_FAILED=yes
+	die "The device failed with code $DEVICE_RES"
+fi
+
+echo "$DRIVER_NAME against `basename "$BENCH_MODEL"`" >&2
+cat "$BENCHDIR/device.log" >&2
+grep -v '^READY' "$BENCHDIR/device.out"
+if [ -n "${BENCH_OUTPUT-}" ] ; then
+	grep -v '^READY' "$BENCHDIR/device.out" >> "$BENCH_OUTPUT"
+fi
@@ -0,0 +1,1356 @@
+/*  nut-snmp-bench-agent.c - simulated SNMP agents answering from a walk of
+ *  a real one, for nut-snmp-bench.sh to time snmp-ups (or nut-scanner)
+ *  against many of them
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Sub-identifiers in an OID, as net-snmp allows */
+#define AGENT_MAXOID	128
+/* Largest datagram, and so message, there is */
+#define AGENT_MAXMSG	65507
+/* A logical line of the walk (strings may span lines) */
+#define AGENT_MAXLINE	16384
+
+/* PDU types, and the values of a varbind which are exceptions (v2c) */
+#define PDU_GET	0xA0
+#define PDU_GETNEXT	0xA1
+#define PDU_RESPONSE	0xA2
+#define PDU_SET	0xA3
+#define PDU_GETBULK	0xA5
+#define VAL_NOSUCHOBJECT	0x80
+#define VAL_NOSUCHINSTANCE	0x81
+#define VAL_ENDOFMIBVIEW	0x82
+
+/* error-status */
+#define ERR_TOOBIG	1
+#define ERR_NOSUCHNAME	2
+#define ERR_NOTWRITABLE	17
+
+/* What a request was, for the counts */
+#define REQ_GET	0
+#define REQ_GETNEXT	1
+#define REQ_GETBULK	2
+#define REQ_SET	3
+#define REQ_TYPES	4
+
+static const char	*req_names[REQ_TYPES] = { "get", "getnext", "getbulk", "set" };
+
+/* A variable of the walk: its OID (also BER-encoded, as it goes in the
+ * replies) and the contents of its value, of that BER type */
+typedef struct {
+	uint32_t	*oid;
+	size_t	oidlen;
+	unsigned char	*enc;
+	size_t	enclen;
+	unsigned char	type;
+	unsigned char	*val;
+	size_t	vallen;
+} agent_var_t;
+
+/* A table (or any subtree) answering slower than the rest */
+typedef struct {
+	uint32_t	oid[AGENT_MAXOID];
+	size_t	oidlen;
+	long	ms;
+} agent_slow_t;
+
+/* One simulated agent: an address and port, and how it was walked.
+ * Requests closer than the idle gap to the previous reply make a walk,
+ * which is what the client does in one update. */
+typedef struct {
+	int	fd;
+	struct sockaddr_in	sin;
+	size_t	requests[REQ_TYPES];
+	size_t	varbinds, lost, toobig;
+	int	in_walk;
+	struct timeval	walk_start, walk_end;
+	size_t	walk_requests;
+} agent_t;
+
+/* Replies held back for the simulated latency, in due order */
+typedef struct agent_reply_s {
+	struct timeval	due;
+	int	fd;
+	struct sockaddr_in	to;
+	size_t	len;
+	struct agent_reply_s	*next;
+	unsigned char	data[1];
+} agent_reply_t;
+
+static agent_var_t	*vars = NULL;
+static size_t	nvars = 0;
+static agent_slow_t	*slows = NULL;
+static size_t	nslows = 0;
+static agent_t	*agents = NULL;
+static size_t	nagents = 0;
+static agent_reply_t	*queue_head = NULL;
+
+static const char	*community = "public";
+static long	latency_ms = 0, gap_ms = 500;
+static int	loss = 0;
+static size_t	maxmsg = AGENT_MAXMSG;
+
+/* The walks done so far, all agents together */
+static double	*walk_ms = NULL;
+static size_t	nwalks = 0, maxwalks = 0, walk_requests = 0;
+static size_t	badcommunity = 0, unsupported = 0;
+
+/* The PID files of the clients (the drivers), and their CPU time when
+ * the counts started */
+static const char	*piddir = NULL;
+static double	cpu_start = 0;
+
+static volatile sig_atomic_t	stop_flag = 0, reset_flag = 0;
+
+static void set_stop_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	stop_flag = 1;
+}
+
+static void set_reset_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	reset_flag = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Serve simulated SNMP agents, all answering from the same walk of\n");
+	printf("a real one (as made by \"snmpwalk -On\"), on consecutive loopback\n");
+	printf("addresses or ports, until interrupted. SIGUSR1 restarts the counts.\n");
+	printf("The counts are then written as JSON on stdout.\n\n");
+	printf("Usage: %s -f <walk> [OPTIONS]\n\n", prog);
+	printf("  -f <file>	the walk to answer from; in it, %%i stands for the number\n");
+	printf("		of the unit (the line is repeated for each of them, see -c)\n");
+	printf("		and %%n for the count of units\n");
+	printf("  -n <count>	agents to serve (default 1)\n");
+	printf("  -a <address>	first IPv4 address (default 127.2.0.1)\n");
+	printf("  -p <port>	first port (default 161)\n");
+	printf("  -P		consecutive ports on that address, not addresses\n");
+	printf("  -C <name>	community (default public, others are not answered)\n");
+	printf("  -c <count>	units of a daisychain, for %%i and %%n (default 1)\n");
+	printf("  -l <msec>	latency of the replies (default 0)\n");
+	printf("  -S <oid:msec>	more latency for the requests about that subtree,\n");
+	printf("		as for a slow table (can be repeated)\n");
+	printf("  -L <percent>	requests left without a reply (default 0)\n");
+	printf("  -t <bytes>	largest reply: GETs of more get tooBig, GETBULKs\n");
+	printf("		get fewer rows (default %d)\n", AGENT_MAXMSG);
+	printf("  -g <msec>	idle time ending a walk, for the counts (default 500)\n");
+	printf("  -s <seed>	seed of the losses (default 1)\n");
+	printf("  -D <dir>	PID files of the clients (*.pid in there), to measure\n");
+	printf("		their CPU time\n");
+	printf("  -v		counts of each agent on stderr too\n");
+}
+
+static int oid_cmp(const uint32_t *a, size_t alen, const uint32_t *b, size_t blen)
+{
+	size_t	i;
+
+	for (i = 0; i < alen && i < blen; i++) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+
+	return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+static int var_cmp(const void *a, const void *b)
+{
+	const agent_var_t	*va = a, *vb = b;
+
+	return oid_cmp(va->oid, va->oidlen, vb->oid, vb->oidlen);
+}
+
+/* Numeric OID, with or without the leading dot; 0 if fine, with *end
+ * after it */
+static int oid_parse(const char *s, uint32_t *oid, size_t *len, const char **end)
+{
+	char	*p;
+	unsigned long	n;
+
+	*len = 0;
+	if (*s == '.')
+		s++;
+
+	while (isdigit((unsigned char)*s)) {
+		if (*len == AGENT_MAXOID)
+			return -1;
+		n = strtoul(s, &p, 10);
+		if (n > 0xFFFFFFFFUL)
+			return -1;
+		oid[(*len)++] = (uint32_t)n;
+		s = p;
+		if (*s != '.')
+			break;
+		s++;
+	}
+
+	if (end)
+		*end = s;
+
+	return *len < 2 ? -1 : 0;
+}
+
+/* BER contents of an OID, returning their size */
+static size_t oid_encode(const uint32_t *oid, size_t len, unsigned char *out)
+{
+	size_t	n = 0, i;
+	uint32_t	v;
+	int	shift;
+
+	for (i = 1; i < len; i++) {
+		v = (i == 1) ? oid[0] * 40 + oid[1] : oid[i];
+		for (shift = 28; shift > 0 && !(v >> shift); shift -= 7)
+			;
+		for (; shift > 0; shift -= 7)
+			out[n++] = (unsigned char)(0x80 | ((v >> shift) & 0x7F));
+		out[n++] = (unsigned char)(v & 0x7F);
+	}
+
+	return n;
+}
+
+/* And back; 0 if fine */
+static int oid_decode(const unsigned char *p, size_t len, uint32_t *oid, size_t *oidlen)
+{
+	size_t	i;
+	uint32_t	v = 0;
+
+	*oidlen = 0;
+	for (i = 0; i < len; i++) {
+		v = (v << 7) | (p[i] & 0x7F);
+		if (p[i] & 0x80)
+			continue;
+
+		if (*oidlen == 0) {
+			oid[0] = v < 80 ? v / 40 : 2;
+			oid[1] = v - oid[0] * 40;
+			*oidlen = 2;
+		} else if (*oidlen < AGENT_MAXOID) {
+			oid[(*oidlen)++] = v;
+		} else {
+			return -1;
+		}
+		v = 0;
+	}
+
+	return (*oidlen < 2 || (len > 0 && (p[len - 1] & 0x80))) ? -1 : 0;
+}
+
+/* BER contents of an INTEGER (signed) or of the unsigned types */
+static size_t int_encode(long long v, unsigned char *out)
+{
+	unsigned char	tmp[9];
+	size_t	n = 0, i;
+
+	do {
+		tmp[n++] = (unsigned char)(v & 0xFF);
+		v >>= 8;
+	} while (n < sizeof(tmp) && !((v == 0 && !(tmp[n - 1] & 0x80))
+		|| (v == -1 && (tmp[n - 1] & 0x80))));
+
+	for (i = 0; i < n; i++)
+		out[i] = tmp[n - 1 - i];
+
+	return n;
+}
+
+static size_t uint_encode(unsigned long long v, unsigned char *out)
+{
+	unsigned char	tmp[9];
+	size_t	n = 0, i;
+
+	do {
+		tmp[n++] = (unsigned char)(v & 0xFF);
+		v >>= 8;
+	} while (v);
+	if (tmp[n - 1] & 0x80)
+		tmp[n++] = 0;
+
+	for (i = 0; i < n; i++)
+		out[i] = tmp[n - 1 - i];
+
+	return n;
+}
+
+/* The number of a value: the one in parentheses if any (enumerations
+ * and timeticks are printed so), the first one otherwise */
+static const char *value_number(const char *s)
+{
+	const char	*p = strchr(s, '(');
+
+	if (p && isdigit((unsigned char)p[1]))
+		return p + 1;
+	if (p && p[1] == '-' && isdigit((unsigned char)p[2]))
+		return p + 1;
+
+	while (*s && !isdigit((unsigned char)*s) && *s != '-')
+		s++;
+
+	return s;
+}
+
+/* Add a variable from a line of the walk, "OID = TYPE: VALUE"; 0 if fine,
+ * -1 if there is nothing this knows of */
+static int var_add(const char *line)
+{
+	agent_var_t	*v;
+	uint32_t	oid[AGENT_MAXOID];
+	size_t	oidlen, n;
+	unsigned char	val[AGENT_MAXLINE], enc[AGENT_MAXOID * 5];
+	unsigned char	type;
+	const char	*p, *s;
+	char	tname[32];
+	uint32_t	valoid[AGENT_MAXOID];
+	size_t	valoidlen;
+	struct in_addr	ip;
+
+	if (oid_parse(line, oid, &oidlen, &p))
+		return -1;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p++ != '=')
+		return -1;
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	/* empty strings are printed without their type */
+	if (*p == '"') {
+		snprintf(tname, sizeof(tname), "STRING");
+	} else {
+		s = strchr(p, ':');
+		if (!s || (size_t)(s - p) >= sizeof(tname))
+			return -1;
+		snprintf(tname, sizeof(tname), "%.*s", (int)(s - p), p);
+		p = s + 1;
+		while (*p == ' ' || *p == '\t')
+			p++;
+	}
+
+	n = 0;
+	if (!strcmp(tname, "STRING")) {
+		type = 0x04;
+		if (*p == '"') {
+			/* up to the closing quote, unescaping */
+			for (p++; *p && *p != '"'; p++) {
+				if (*p == '\\' && p[1])
+					p++;
+				val[n++] = (unsigned char)*p;
+			}
+		} else {
+			n = strlen(p);
+			memcpy(val, p, n);
+		}
+	} else if (!strcmp(tname, "Hex-STRING") || !strcmp(tname, "BITS")) {
+		type = 0x04;
+		while (isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1])
+		 && (p[2] == ' ' || p[2] == '\0' || p[2] == '\n')
+		) {
+			val[n++] = (unsigned char)strtoul(p, NULL, 16);
+			p += 2;
+			while (*p == ' ' || *p == '\n')
+				p++;
+		}
+	} else if (!strcmp(tname, "OID")) {
+		type = 0x06;
+		if (oid_parse(p, valoid, &valoidlen, NULL))
+			return -1;
+		n = oid_encode(valoid, valoidlen, val);
+	} else if (!strcmp(tname, "INTEGER")) {
+		type = 0x02;
+		n = int_encode(strtoll(value_number(p), NULL, 10), val);
+	} else if (!strcmp(tname, "Gauge32") || !strcmp(tname, "Unsigned32")
+		|| !strcmp(tname, "Counter32") || !strcmp(tname, "Counter64")
+		|| !strcmp(tname, "Timeticks")
+	) {
+		type = (tname[0] == 'G' || tname[0] == 'U') ? 0x42
+			: (tname[0] == 'T' ? 0x43 : (tname[7] == '6' ? 0x46 : 0x41));
+		n = uint_encode(strtoull(value_number(p), NULL, 10), val);
+	} else if (!strcmp(tname, "IpAddress")) {
+		type = 0x40;
+		if (inet_pton(AF_INET, p, &ip) != 1)
+			return -1;
+		memcpy(val, &ip, 4);
+		n = 4;
+	} else {
+		return -1;
+	}
+
+	vars = xrealloc(vars, (nvars + 1) * sizeof(agent_var_t));
+	v = &vars[nvars++];
+	v->oidlen = oidlen;
+	v->oid = xcalloc(oidlen, sizeof(uint32_t));
+	memcpy(v->oid, oid, oidlen * sizeof(uint32_t));
+	v->enclen = oid_encode(oid, oidlen, enc);
+	v->enc = xcalloc(1, v->enclen);
+	memcpy(v->enc, enc, v->enclen);
+	v->type = type;
+	v->vallen = n;
+	v->val = xcalloc(1, n ? n : 1);
+	memcpy(v->val, val, n);
+
+	return 0;
+}
+
+/* A quoted string (after the type) which is not closed on its line */
+static int string_open(const char *line)
+{
+	const char	*p = strstr(line, "= ");
+	int	quoted = 0;
+
+	if (!p)
+		return 0;
+	p += 2;
+	if (!strncmp(p, "STRING: ", 8))
+		p += 8;
+	if (*p != '"')
+		return 0;
+
+	for (p++; *p; p++) {
+		if (*p == '\\' && p[1]) {
+			p++;
+		} else if (*p == '"') {
+			quoted = 1;
+			break;
+		}
+	}
+
+	return !quoted;
+}
+
+/* Copy line to out, with %i replaced by unit and %n by units */
+static void expand(char *out, size_t outlen, const char *line, size_t unit, size_t units)
+{
+	size_t	n = 0;
+	int	ret;
+
+	for (; *line && n + 1 < outlen; line++) {
+		if (line[0] == '%' && (line[1] == 'i' || line[1] == 'n')) {
+			ret = snprintf(out + n, outlen - n, "%" PRIuSIZE,
+				line[1] == 'i' ? unit : units);
+			if (ret < 0 || (size_t)ret >= outlen - n)
+				break;
+			n += (size_t)ret;
+			line++;
+		} else {
+			out[n++] = *line;
+		}
+	}
+	out[n] = '\0';
+}
+
+static void walk_load(const char *fn, size_t units)
+{
+	FILE	*f;
+	char	buf[AGENT_MAXLINE], line[AGENT_MAXLINE], exp[AGENT_MAXLINE];
+	size_t	len, unit, skipped = 0, i, n;
+	int	more;
+
+	if ((f = fopen(fn, "r")) == NULL)
+		fatal_with_errno(EXIT_FAILURE, "Can not read the walk %s", fn);
+
+	while (fgets(line, sizeof(line), f)) {
+		/* join the lines of a string spanning several */
+		len = strlen(line);
+		more = string_open(line);
+		while (more && len + 1 < sizeof(line) && fgets(buf, (int)(sizeof(line) - len), f)) {
+			memcpy(line + len, buf, strlen(buf) + 1);
+			len += strlen(buf);
+			more = string_open(line);
+		}
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		for (unit = 1; unit <= (strstr(line, "%i") ? units : 1); unit++) {
+			expand(exp, sizeof(exp), line, unit, units);
+			if (var_add(exp))
+				skipped++;
+		}
+	}
+
+	fclose(f);
+
+	if (nvars == 0)
+		fatalx(EXIT_FAILURE, "Nothing to answer with in %s", fn);
+
+	qsort(vars, nvars, sizeof(agent_var_t), var_cmp);
+
+	/* the first of the same OIDs stays */
+	for (i = 1, n = 1; i < nvars; i++) {
+		if (var_cmp(&vars[n - 1], &vars[i])) {
+			vars[n++] = vars[i];
+		} else {
+			free(vars[i].oid);
+			free(vars[i].enc);
+			free(vars[i].val);
+			skipped++;
+		}
+	}
+	nvars = n;
+
+	if (skipped)
+		upslogx(LOG_WARNING, "%" PRIuSIZE " lines of %s skipped (unknown types or repeated OIDs)",
+			skipped, fn);
+}
+
+/* The first variable at or after oid */
+static size_t var_find(const uint32_t *oid, size_t oidlen)
+{
+	size_t	lo = 0, hi = nvars, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (oid_cmp(vars[mid].oid, vars[mid].oidlen, oid, oidlen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* The extra latency for oid, if in a slow subtree */
+static long slow_ms(const uint32_t *oid, size_t oidlen)
+{
+	size_t	i;
+	long	ms = 0;
+
+	for (i = 0; i < nslows; i++) {
+		if (oidlen >= slows[i].oidlen && slows[i].ms > ms
+		 && !oid_cmp(oid, slows[i].oidlen, slows[i].oid, slows[i].oidlen)
+		)
+			ms = slows[i].ms;
+	}
+
+	return ms;
+}
+
+/* BER: the tag and length of the element at *pos, which then points at
+ * its contents; 0 if fine */
+static int ber_get(const unsigned char *p, size_t end, size_t *pos,
+	unsigned char *tag, size_t *len)
+{
+	size_t	n, i;
+
+	if (*pos + 2 > end)
+		return -1;
+
+	*tag = p[(*pos)++];
+	n = p[(*pos)++];
+	if (n & 0x80) {
+		i = n & 0x7F;
+		if (i < 1 || i > 2 || *pos + i > end)
+			return -1;
+		for (n = 0; i > 0; i--)
+			n = (n << 8) | p[(*pos)++];
+	}
+
+	if (*pos + n > end)
+		return -1;
+
+	*len = n;
+	return 0;
+}
+
+/* BER: an INTEGER element at *pos, moving past it; 0 if fine */
+static int ber_get_int(const unsigned char *p, size_t end, size_t *pos, long *val)
+{
+	unsigned char	tag;
+	size_t	len, i;
+
+	if (ber_get(p, end, pos, &tag, &len) || tag != 0x02 || len < 1 || len > 4)
+		return -1;
+
+	*val = (p[*pos] & 0x80) ? -1 : 0;
+	for (i = 0; i < len; i++)
+		*val = (long)(((unsigned long)*val << 8) | p[(*pos)++]);
+
+	return 0;
+}
+
+/* BER: the header of an element, returning its size */
+static size_t ber_head(unsigned char *out, unsigned char tag, size_t len)
+{
+	size_t	n = 0;
+
+	out[n++] = tag;
+	if (len < 0x80) {
+		out[n++] = (unsigned char)len;
+	} else if (len < 0x100) {
+		out[n++] = 0x81;
+		out[n++] = (unsigned char)len;
+	} else {
+		out[n++] = 0x82;
+		out[n++] = (unsigned char)(len >> 8);
+		out[n++] = (unsigned char)(len & 0xFF);
+	}
+
+	return n;
+}
+
+/* BER: the size of a whole element with len of contents */
+static size_t ber_size(size_t len)
+{
+	return 1 + (len < 0x80 ? 1 : (len < 0x100 ? 2 : 3)) + len;
+}
+
+/* BER: write a whole element, returning its size; val may be out (the
+ * contents are moved after the header) */
+static size_t ber_put(unsigned char *out, unsigned char tag, const unsigned char *val, size_t len)
+{
+	size_t	n = ber_size(len) - len;
+
+	if (len)
+		memmove(out + n, val, len);
+	ber_head(out, tag, len);
+
+	return n + len;
+}
+
+/* BER: a varbind, returning its size */
+static size_t varbind_put(unsigned char *out, const unsigned char *enc, size_t enclen,
+	unsigned char type, const unsigned char *val, size_t vallen)
+{
+	size_t	n;
+
+	n = ber_head(out, 0x30, ber_size(enclen) + ber_size(vallen));
+	n += ber_put(out + n, 0x06, enc, enclen);
+	n += ber_put(out + n, type, val, vallen);
+
+	return n;
+}
+
+static void queue_reply(int fd, const struct sockaddr_in *to, const unsigned char *data,
+	size_t len, long ms, struct timeval *due)
+{
+	agent_reply_t	*r, **pos;
+
+	gettimeofday(due, NULL);
+
+	if (ms <= 0) {
+		(void)sendto(fd, data, len, 0, (const struct sockaddr *)to, sizeof(*to));
+		return;
+	}
+
+	due->tv_sec += ms / 1000;
+	due->tv_usec += (ms % 1000) * 1000;
+	if (due->tv_usec >= 1000000) {
+		due->tv_sec++;
+		due->tv_usec -= 1000000;
+	}
+
+	r = xcalloc(1, sizeof(agent_reply_t) + len);
+	r->due = *due;
+	r->fd = fd;
+	r->to = *to;
+	r->len = len;
+	memcpy(r->data, data, len);
+
+	/* the slow tables make the order differ from the arrival one */
+	for (pos = &queue_head; *pos && difftimeval((*pos)->due, r->due) <= 0; pos = &(*pos)->next)
+		;
+	r->next = *pos;
+	*pos = r;
+}
+
+/* Send the replies which are due; the milliseconds until the next one
+ * is, or -1 if none is waiting */
+static int send_due(void)
+{
+	struct timeval	now;
+	agent_reply_t	*r;
+	double	wait;
+
+	gettimeofday(&now, NULL);
+
+	while ((r = queue_head) != NULL) {
+		wait = difftimeval(r->due, now);
+		if (wait > 0)
+			return (int)(wait * 1000.0) + 1;
+
+		(void)sendto(r->fd, r->data, r->len, 0, (const struct sockaddr *)&r->to, sizeof(r->to));
+		queue_head = r->next;
+		free(r);
+	}
+
+	return -1;
+}
+
+static void walk_close(agent_t *a)
+{
+	if (!a->in_walk)
+		return;
+
+	if (nwalks == maxwalks) {
+		maxwalks = maxwalks ? 2 * maxwalks : 1024;
+		walk_ms = xrealloc(walk_ms, maxwalks * sizeof(double));
+	}
+	walk_ms[nwalks++] = difftimeval(a->walk_end, a->walk_start) * 1000.0;
+	walk_requests += a->walk_requests;
+	a->in_walk = 0;
+}
+
+/* Account for a request which came now, and whose reply is due then */
+static void walk_account(agent_t *a, const struct timeval *now, const struct timeval *due)
+{
+	if (a->in_walk && difftimeval(*now, a->walk_end) * 1000.0 > (double)gap_ms)
+		walk_close(a);
+
+	if (!a->in_walk) {
+		a->in_walk = 1;
+		a->walk_start = *now;
+		a->walk_end = *now;
+		a->walk_requests = 0;
+	}
+
+	a->walk_requests++;
+	if (difftimeval(*due, a->walk_end) > 0)
+		a->walk_end = *due;
+}
+
+/* Answer a v1 or v2c GET, GETNEXT, GETBULK or SET */
+static void snmp_request(agent_t *a, const struct sockaddr_in *from,
+	const unsigned char *p, size_t end)
+{
+	/* room for one varbind more than fits, before that is found out */
+	static unsigned char	vb[AGENT_MAXMSG + AGENT_MAXLINE + 1024];
+	static unsigned char	msg[AGENT_MAXMSG + AGENT_MAXLINE + 1024];
+	size_t	pos = 0, len, vpos, vlen, cpos, clen, rpos, rlen, lpos, lend;
+	size_t	n = 0, overhead, nreq, i, row, idx, want, rep_start;
+	unsigned char	tag, pdu;
+	long	version, reqid, nonrep, maxrep, ms = 0, extra;
+	int	v1, status = 0, index = 0, all_end;
+	uint32_t	oid[AGENT_MAXOID];
+	size_t	oidlen, vbpos, vblen, opos, olen;
+	/* where the next of the repeaters is (GETBULK), by their number */
+	static size_t	next_var[AGENT_MAXMSG / 4];
+	struct timeval	now, due;
+
+	gettimeofday(&now, NULL);
+
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0x30)
+		return;
+	end = pos + len;
+
+	vpos = pos;
+	if (ber_get_int(p, end, &pos, &version))
+		return;
+	vlen = pos - vpos;
+	if (version != 0 && version != 1) {
+		unsupported++;
+		return;
+	}
+	v1 = (version == 0);
+
+	if (ber_get(p, end, &pos, &tag, &clen) || tag != 0x04)
+		return;
+	cpos = pos - 2;
+	if (clen != strlen(community) || memcmp(p + pos, community, clen)) {
+		badcommunity++;
+		return;
+	}
+	pos += clen;
+	clen = pos - cpos;
+
+	if (ber_get(p, end, &pos, &pdu, &len))
+		return;
+	if (pdu != PDU_GET && pdu != PDU_GETNEXT && pdu != PDU_SET
+	 && (pdu != PDU_GETBULK || v1)
+	) {
+		unsupported++;
+		return;
+	}
+
+	/* request-id (which goes back as it came), then error-status and
+	 * error-index, or non-repeaters and max-repetitions (GETBULK) */
+	rpos = pos;
+	if (ber_get_int(p, end, &pos, &reqid))
+		return;
+	rlen = pos - rpos;
+	if (ber_get_int(p, end, &pos, &nonrep)
+	 || ber_get_int(p, end, &pos, &maxrep)
+	)
+		return;
+
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0x30)
+		return;
+	lpos = pos;
+	lend = pos + len;
+
+	/* count the varbinds, checking them */
+	for (nreq = 0; pos < lend; nreq++) {
+		if (ber_get(p, lend, &pos, &tag, &len) || tag != 0x30)
+			return;
+		pos += len;
+	}
+
+	switch (pdu) {
+		case PDU_GET: a->requests[REQ_GET]++; break;
+		case PDU_GETNEXT: a->requests[REQ_GETNEXT]++; break;
+		case PDU_GETBULK: a->requests[REQ_GETBULK]++; break;
+		default: a->requests[REQ_SET]++; break;
+	}
+	a->varbinds += nreq;
+
+	if (loss > 0 && rand() % 100 < loss) {
+		a->lost++;
+		walk_account(a, &now, &now);
+		return;
+	}
+
+	/* the message without its varbinds, its headers as large as can be */
+	overhead = 4 + vlen + clen + 4 + rlen + 3 + 3 + 4;
+	NUT_UNUSED_VARIABLE(reqid);
+	want = maxmsg > overhead ? maxmsg - overhead : 0;
+
+	if (pdu == PDU_GETBULK) {
+		if (nonrep < 0)
+			nonrep = 0;
+		if ((size_t)nonrep > nreq)
+			nonrep = (long)nreq;
+		if (maxrep < 0)
+			maxrep = 0;
+		if (nreq - (size_t)nonrep > sizeof(next_var) / sizeof(next_var[0]))
+			return;
+	} else {
+		nonrep = (long)nreq;
+		maxrep = 0;
+	}
+
+	/* the varbinds answered once (or the non-repeaters) */
+	for (i = 0, pos = lpos; i < nreq; i++) {
+		ber_get(p, lend, &pos, &tag, &vblen);
+		vbpos = pos;
+		pos += vblen;
+		if (ber_get(p, pos, &vbpos, &tag, &olen) || tag != 0x06
+		 || oid_decode(p + vbpos, olen, oid, &oidlen)
+		)
+			return;
+		opos = vbpos;
+		extra = slow_ms(oid, oidlen);
+		if (extra > ms)
+			ms = extra;
+
+		idx = var_find(oid, oidlen);
+
+		if (pdu == PDU_SET) {
+			status = v1 ? ERR_NOSUCHNAME : ERR_NOTWRITABLE;
+			index = 1;
+			break;
+		}
+
+		if ((long)i >= nonrep) {
+			/* a repeater: first row below */
+			if (idx < nvars && !oid_cmp(vars[idx].oid, vars[idx].oidlen, oid, oidlen))
+				idx++;
+			next_var[i - (size_t)nonrep] = idx;
+			continue;
+		}
+
+		if (pdu == PDU_GET) {
+			if (idx < nvars && !oid_cmp(vars[idx].oid, vars[idx].oidlen, oid, oidlen)) {
+				n += varbind_put(vb + n, vars[idx].enc, vars[idx].enclen,
+					vars[idx].type, vars[idx].val, vars[idx].vallen);
+			} else if (v1) {
+				status = ERR_NOSUCHNAME;
+				index = (int)i + 1;
+				break;
+			} else {
+				/* an instance missing from a known object (a table
+				 * without that row, or not a scalar) */
+				tag = (idx < nvars && oidlen > 1
+					&& vars[idx].oidlen >= oidlen
+					&& !oid_cmp(vars[idx].oid, oidlen - 1, oid, oidlen - 1))
+					? VAL_NOSUCHINSTANCE : VAL_NOSUCHOBJECT;
+				n += varbind_put(vb + n, p + opos, olen, tag, NULL, 0);
+			}
+		} else {
+			if (idx < nvars && !oid_cmp(vars[idx].oid, vars[idx].oidlen, oid, oidlen))
+				idx++;
+			if (idx < nvars) {
+				n += varbind_put(vb + n, vars[idx].enc, vars[idx].enclen,
+					vars[idx].type, vars[idx].val, vars[idx].vallen);
+				extra = slow_ms(vars[idx].oid, vars[idx].oidlen);
+				if (extra > ms)
+					ms = extra;
+			} else if (v1) {
+				status = ERR_NOSUCHNAME;
+				index = (int)i + 1;
+				break;
+			} else {
+				n += varbind_put(vb + n, p + opos, olen, VAL_ENDOFMIBVIEW, NULL, 0);
+			}
+		}
+
+		if (n > want) {
+			status = ERR_TOOBIG;
+			index = 0;
+			break;
+		}
+	}
+
+	/* GETBULK: the rows of the repeaters, as many as fit */
+	rep_start = (size_t)nonrep;
+	for (row = 0; status == 0 && pdu == PDU_GETBULK && row < (size_t)maxrep && rep_start < nreq; row++) {
+		all_end = 1;
+		for (i = rep_start; i < nreq; i++) {
+			idx = next_var[i - rep_start];
+			if (idx < nvars) {
+				len = ber_size(ber_size(vars[idx].enclen) + ber_size(vars[idx].vallen));
+				if (n + len > want)
+					break;
+				n += varbind_put(vb + n, vars[idx].enc, vars[idx].enclen,
+					vars[idx].type, vars[idx].val, vars[idx].vallen);
+				extra = slow_ms(vars[idx].oid, vars[idx].oidlen);
+				if (extra > ms)
+					ms = extra;
+				next_var[i - rep_start]++;
+				all_end = 0;
+			} else {
+				/* endOfMibView, named as the request was */
+				for (idx = 0, pos = lpos; idx <= i; idx++) {
+					ber_get(p, lend, &pos, &tag, &vblen);
+					vbpos = pos;
+					pos += vblen;
+				}
+				ber_get(p, pos, &vbpos, &tag, &olen);
+				if (n + ber_size(ber_size(olen) + 2) > want)
+					break;
+				n += varbind_put(vb + n, p + vbpos, olen, VAL_ENDOFMIBVIEW, NULL, 0);
+			}
+		}
+		if (i < nreq) {
+			/* a partial row is allowed, but no answer at all is tooBig */
+			if (n == 0)
+				status = ERR_TOOBIG;
+			break;
+		}
+		if (all_end)
+			break;
+	}
+
+	if (status) {
+		if (status == ERR_TOOBIG)
+			a->toobig++;
+		/* errors come with the varbinds of the request (v2c tooBig: none) */
+		if (status == ERR_TOOBIG && !v1) {
+			n = 0;
+		} else {
+			n = lend - lpos;
+			memcpy(vb, p + lpos, n);
+		}
+	}
+
+	/* varbind list, then the GetResponse-PDU and the message around it */
+	n = ber_put(vb, 0x30, vb, n);
+	memcpy(msg, p + rpos, rlen);
+	len = rlen;
+	msg[len++] = 0x02;
+	msg[len++] = 0x01;
+	msg[len++] = (unsigned char)status;
+	msg[len++] = 0x02;
+	msg[len++] = 0x01;
+	msg[len++] = (unsigned char)index;
+	memcpy(msg + len, vb, n);
+	len += n;
+	n = ber_put(vb, PDU_RESPONSE, msg, len);
+
+	memcpy(msg, p + vpos, vlen);
+	len = vlen;
+	memcpy(msg + len, p + cpos, clen);
+	len += clen;
+	memcpy(msg + len, vb, n);
+	len += n;
+	n = ber_put(vb, 0x30, msg, len);
+
+	queue_reply(a->fd, from, vb, n, latency_ms + ms, &due);
+	walk_account(a, &now, &due);
+}
+
+static void udp_read(agent_t *a)
+{
+	static unsigned char	buf[AGENT_MAXMSG];
+	struct sockaddr_in	from;
+	socklen_t	fromlen = sizeof(from);
+	ssize_t	ret;
+
+	while ((ret = recvfrom(a->fd, buf, sizeof(buf), 0,
+		(struct sockaddr *)&from, &fromlen)) > 0
+	) {
+		snmp_request(a, &from, buf, (size_t)ret);
+		fromlen = sizeof(from);
+	}
+}
+
+static int dbl_cmp(const void *a, const void *b)
+{
+	double	da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+/* CPU time of a process so far, in usec, or -1 where we can not tell:
+ * the scheduler statistics are exact, the rest counts in clock ticks */
+static double cpu_usec(pid_t pid)
+{
+	char	fn[SMALLBUF], buf[LARGEBUF], *p;
+	unsigned long long	ns, utime, stime;
+	FILE	*f;
+	int	ok;
+
+	if (pid <= 0)
+		return -1;
+
+	snprintf(fn, sizeof(fn), "/proc/%" PRIiMAX "/schedstat", (intmax_t)pid);
+	if ((f = fopen(fn, "r")) != NULL) {
+		ok = (fscanf(f, "%llu", &ns) == 1);
+		fclose(f);
+		if (ok)
+			return (double)ns / 1000;
+	}
+
+	snprintf(fn, sizeof(fn), "/proc/%" PRIiMAX "/stat", (intmax_t)pid);
+	if ((f = fopen(fn, "r")) == NULL)
+		return -1;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+
+	/* the fields after the command name, which may hold spaces */
+	if (!p || (p = strrchr(buf, ')')) == NULL)
+		return -1;
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		&utime, &stime) != 2
+	) {
+		return -1;
+	}
+
+	return (double)(utime + stime) * 1e6 / (double)sysconf(_SC_CLK_TCK);
+}
+
+/* CPU time of all the clients with a PID file in piddir, in usec, or -1
+ * if there is none to tell */
+static double clients_cpu_usec(void)
+{
+	DIR	*dir;
+	struct dirent	*de;
+	char	fn[SMALLBUF];
+	size_t	len;
+	long	pid;
+	double	usec, total = -1;
+	FILE	*f;
+
+	if (!piddir || (dir = opendir(piddir)) == NULL)
+		return -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		len = strlen(de->d_name);
+		if (len < 5 || strcmp(de->d_name + len - 4, ".pid"))
+			continue;
+
+		snprintf(fn, sizeof(fn), "%s/%s", piddir, de->d_name);
+		if ((f = fopen(fn, "r")) == NULL)
+			continue;
+		if (fscanf(f, "%ld", &pid) != 1)
+			pid = -1;
+		fclose(f);
+
+		if ((usec = cpu_usec((pid_t)pid)) >= 0)
+			total = (total < 0 ? 0 : total) + usec;
+	}
+
+	closedir(dir);
+	return total;
+}
+
+static void stats_reset(void)
+{
+	size_t	i;
+
+	for (i = 0; i < nagents; i++) {
+		memset(agents[i].requests, 0, sizeof(agents[i].requests));
+		agents[i].varbinds = agents[i].lost = agents[i].toobig = 0;
+		agents[i].in_walk = 0;
+	}
+	nwalks = walk_requests = 0;
+	badcommunity = unsupported = 0;
+
+	if ((cpu_start = clients_cpu_usec()) < 0)
+		cpu_start = 0;
+}
+
+static void stats_print(int verbose)
+{
+	size_t	i, t, total[REQ_TYPES], varbinds = 0, lostn = 0, toobig = 0, requests = 0;
+	struct timeval	now;
+	double	sum = 0, cpu;
+	char	buf[SMALLBUF];
+
+	/* the walks still going on are cut short: left out */
+	gettimeofday(&now, NULL);
+	memset(total, 0, sizeof(total));
+	for (i = 0; i < nagents; i++) {
+		if (agents[i].in_walk && difftimeval(now, agents[i].walk_end) * 1000.0 > (double)gap_ms)
+			walk_close(&agents[i]);
+
+		for (t = 0; t < REQ_TYPES; t++) {
+			total[t] += agents[i].requests[t];
+			requests += agents[i].requests[t];
+		}
+		varbinds += agents[i].varbinds;
+		lostn += agents[i].lost;
+		toobig += agents[i].toobig;
+
+		if (verbose) {
+			fprintf(stderr, "%s:%u:", inet_ntop(AF_INET, &agents[i].sin.sin_addr, buf, sizeof(buf)),
+				(unsigned int)ntohs(agents[i].sin.sin_port));
+			for (t = 0; t < REQ_TYPES; t++)
+				fprintf(stderr, " %s %" PRIuSIZE, req_names[t], agents[i].requests[t]);
+			fprintf(stderr, " varbinds %" PRIuSIZE " lost %" PRIuSIZE " toobig %" PRIuSIZE "\n",
+				agents[i].varbinds, agents[i].lost, agents[i].toobig);
+		}
+	}
+
+	for (i = 0; i < nwalks; i++)
+		sum += walk_ms[i];
+	qsort(walk_ms, nwalks, sizeof(double), dbl_cmp);
+
+	printf("{\"agents\": %" PRIuSIZE ", \"variables\": %" PRIuSIZE ", \"requests\": %" PRIuSIZE,
+		nagents, nvars, requests);
+	for (t = 0; t < REQ_TYPES; t++)
+		printf(", \"%s\": %" PRIuSIZE, req_names[t], total[t]);
+	printf(", \"varbinds\": %" PRIuSIZE ", \"lost\": %" PRIuSIZE ", \"toobig\": %" PRIuSIZE,
+		varbinds, lostn, toobig);
+	printf(", \"badcommunity\": %" PRIuSIZE ", \"unsupported\": %" PRIuSIZE,
+		badcommunity, unsupported);
+	printf(", \"walks\": %" PRIuSIZE ", \"requests_per_walk\": %.2f", nwalks,
+		nwalks ? (double)walk_requests / (double)nwalks : 0.0);
+	printf(", \"walk_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"max\": %.3f}",
+		nwalks ? sum / (double)nwalks : 0.0,
+		nwalks ? walk_ms[nwalks / 2] : 0.0,
+		nwalks ? walk_ms[nwalks - 1] : 0.0);
+	if ((cpu = clients_cpu_usec()) >= 0) {
+		cpu -= cpu_start;
+		printf(", \"client_cpu_ms\": %.3f, \"client_cpu_ms_per_walk\": %.3f}\n",
+			cpu / 1000, nwalks ? cpu / 1000 / (double)nwalks : 0.0);
+	} else {
+		printf(", \"client_cpu_ms\": null, \"client_cpu_ms_per_walk\": null}\n");
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	size_t	count = 1, units = 1, i, n;
+	int	consecutive_ports = 0, verbose = 0, fd, on = 1, timeout, opt;
+	unsigned int	seed = 1;
+	unsigned short	port = 161;
+	struct in_addr	first;
+	const char	*walkfile = NULL, *end;
+	char	*p, buf[SMALLBUF];
+	struct pollfd	*pfd;
+	struct rlimit	nofile;
+	struct sigaction	sa;
+	agent_reply_t	*r;
+	agent_t	*a;
+
+	inet_pton(AF_INET, "127.2.0.1", &first);
+
+	while ((opt = getopt(argc, argv, "f:n:a:p:PC:c:l:S:L:t:g:s:D:vh")) != -1) {
+		switch (opt) {
+			case 'f':
+				walkfile = optarg;
+				break;
+			case 'n':
+				count = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'a':
+				if (inet_pton(AF_INET, optarg, &first) != 1)
+					fatalx(EXIT_FAILURE, "Invalid address: %s", optarg);
+				break;
+			case 'p':
+				port = (unsigned short)atoi(optarg);
+				break;
+			case 'P':
+				consecutive_ports = 1;
+				break;
+			case 'C':
+				community = optarg;
+				break;
+			case 'c':
+				units = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				latency_ms = atol(optarg);
+				break;
+			case 'S':
+				slows = xrealloc(slows, (nslows + 1) * sizeof(agent_slow_t));
+				if (oid_parse(optarg, slows[nslows].oid, &slows[nslows].oidlen, &end)
+				 || *end != ':'
+				)
+					fatalx(EXIT_FAILURE, "Invalid slow subtree (OID:msec): %s", optarg);
+				slows[nslows].ms = strtol(end + 1, &p, 10);
+				nslows++;
+				break;
+			case 'L':
+				loss = atoi(optarg);
+				break;
+			case 't':
+				maxmsg = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'g':
+				gap_ms = atol(optarg);
+				break;
+			case 's':
+				seed = (unsigned int)strtoul(optarg, NULL, 10);
+				break;
+			case 'D':
+				piddir = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (!walkfile || count < 1 || units < 1 || loss < 0 || loss > 100
+	 || maxmsg < 484 || maxmsg > AGENT_MAXMSG || latency_ms < 0 || gap_ms < 1
+	)
+		fatalx(EXIT_FAILURE, "Invalid arguments, see -h");
+
+	walk_load(walkfile, units);
+
+	if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+		nofile.rlim_cur = nofile.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &nofile);
+	}
+
+	srand(seed);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = set_stop_flag;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = set_reset_flag;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	agents = xcalloc(count, sizeof(agent_t));
+	for (i = 0; i < count; i++) {
+		a = &agents[nagents];
+		a->sin.sin_family = AF_INET;
+		if (consecutive_ports) {
+			a->sin.sin_addr = first;
+			a->sin.sin_port = htons((unsigned short)(port + i));
+		} else {
+			a->sin.sin_addr.s_addr = htonl(ntohl(first.s_addr) + (uint32_t)i);
+			a->sin.sin_port = htons(port);
+		}
+
+		if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+			fatal_with_errno(EXIT_FAILURE, "socket");
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on));
+		if (bind(fd, (struct sockaddr *)&a->sin, sizeof(a->sin)) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "Can not serve on %s:%u",
+				inet_ntop(AF_INET, &a->sin.sin_addr, buf, sizeof(buf)),
+				(unsigned int)ntohs(a->sin.sin_port));
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		a->fd = fd;
+		nagents++;
+	}
+
+	printf("AGENTS %" PRIuSIZE " %s:%u", nagents,
+		inet_ntop(AF_INET, &agents[0].sin.sin_addr, buf, sizeof(buf)),
+		(unsigned int)ntohs(agents[0].sin.sin_port));
+	printf(" %s:%u\n", inet_ntop(AF_INET, &agents[nagents - 1].sin.sin_addr, buf, sizeof(buf)),
+		(unsigned int)ntohs(agents[nagents - 1].sin.sin_port));
+	printf("VARIABLES %" PRIuSIZE "\n", nvars);
+	printf("READY\n");
+	fflush(stdout);
+
+	pfd = xcalloc(nagents, sizeof(struct pollfd));
+	for (i = 0; i < nagents; i++) {
+		pfd[i].fd = agents[i].fd;
+		pfd[i].events = POLLIN;
+	}
+
+	while (!stop_flag) {
+		if (reset_flag) {
+			reset_flag = 0;
+			stats_reset();
+		}
+
+		timeout = send_due();
+		if (timeout < 0 || timeout > 100)
+			timeout = 100;
+
+		if (poll(pfd, (nfds_t)nagents, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		for (i = 0; i < nagents; i++) {
+			if (pfd[i].revents)
+				udp_read(&agents[i]);
+		}
+	}
+
+	stats_print(verbose);
+
+	for (i = 0; i < nagents; i++)
+		close(agents[i].fd);
+	while ((r = queue_head) != NULL) {
+		queue_head = r->next;
+		free(r);
+	}
+	for (n = 0; n < nvars; n++) {
+		free(vars[n].oid);
+		free(vars[n].enc);
+		free(vars[n].val);
+	}
+	free(vars);
+	free(slows);
+	free(agents);
+	free(pfd);
+	free(walk_ms);
+
+	return EXIT_SUCCESS;
+}
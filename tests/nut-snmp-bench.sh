@@ -0,0 +1,188 @@
+#!/bin/sh
+
+# Benchmark of snmp-ups against many devices without the hardware:
+# nut-snmp-bench-agent serves simulated SNMP agents on consecutive ports
+# of 127.0.0.1, all answering from the same walk of a real device (with
+# latency, losses, a limit on the size of the replies, daisychained units
+# and slow tables, if asked for), and one snmp-ups driver polls each, as
+# a site with that many PDUs or UPSes would have them.
+#
+# Reported: for each count of devices (1, 10 and 100 by default), the
+# round trips of a driver per update, the wall time of an update (as the
+# agent sees it, from the first request to the last reply) and the CPU
+# time of the drivers per update, as a table on stderr and one JSON
+# object per count on stdout (also appended to BENCH_OUTPUT, if set), so
+# that runs before and after a change can be compared.
+#
+# Run it with `make check-nut-snmp-bench` in the tests directory, or
+# directly from there after building snmp-ups and nut-snmp-bench-agent.
+# Caller can export envvars to change the setup:
+#	NUT_SNMP_UPS=...	the snmp-ups program
+#	BENCH_AGENT=...	the nut-snmp-bench-agent program
+#	BENCH_WALK=...	the walk to answer from, as made by "snmpwalk -On"
+#			(default the RFC 1628 one next to this script)
+#	BENCH_MIBS=ietf	for the "mibs" option of the drivers
+#	BENCH_PDUS="1 10 100"	counts of devices to run with, in turn
+#	BENCH_PORT=16161	port of the first agent
+#	BENCH_WARMUP=5	seconds to let the drivers start before counting
+#	BENCH_SECONDS=20	seconds to count for, with each count of devices
+#	BENCH_POLLINTERVAL=2	of the drivers, in seconds
+#	BENCH_AGENT_OPTS=	more options of the agent (e.g. "-l 5 -L 1" for
+#			5 msec of latency and 1% of losses, "-t 1400" for
+#			replies no larger than that, "-c 4" for a daisychain
+#			of 4 units, "-S .1.3.6.1.2.1.33.1.4:50" for a slow
+#			table; see nut-snmp-bench-agent -h)
+#	BENCH_DRIVER_OPTS=	more "name = value" lines for ups.conf, separated
+#			by ";" (e.g. "getbatch = 1;maxrepetitions = 0")
+#	BENCH_OUTPUT=	file to append the JSON results to
+#
+# Design note: written with dumbed-down POSIX shell syntax, like NIT, which
+# this borrows its handling of the sandbox (and of running as root) from.
+#
+# License: GPLv2+
+
+SCRIPT_DIR="`dirname "$0"`"
+SCRIPT_DIR="`cd "$SCRIPT_DIR" && pwd`"
+
+[ -n "${NUT_SNMP_UPS-}" ] || NUT_SNMP_UPS="`pwd`/../drivers/snmp-ups"
+[ -n "${BENCH_AGENT-}" ] || BENCH_AGENT="`pwd`/nut-snmp-bench-agent"
+[ -n "${BENCH_WALK-}" ] || BENCH_WALK="$SCRIPT_DIR/nut-snmp-bench-ietf.walk"
+[ -n "${BENCH_MIBS-}" ] || BENCH_MIBS=ietf
+[ -n "${BENCH_PDUS-}" ] || BENCH_PDUS="1 10 100"
+[ -n "${BENCH_PORT-}" ] || BENCH_PORT=16161
+[ -n "${BENCH_WARMUP-}" ] || BENCH_WARMUP=5
+[ -n "${BENCH_SECONDS-}" ] || BENCH_SECONDS=20
+[ -n "${BENCH_POLLINTERVAL-}" ] || BENCH_POLLINTERVAL=2
+
+die() {
+	echo "FATAL: $*" >&2
+	exit 1
+}
+
+for P in "$NUT_SNMP_UPS" "$BENCH_AGENT" ; do
+	[ -x "$P" ] || die "$P is not built, see the comments in $0"
+done
+[ -s "$BENCH_WALK" ] || die "No walk to answer from in $BENCH_WALK"
+
+# Short, for the AF_UNIX socket names (see NIT)
+if [ -d /dev/shm ] && [ -w /dev/shm ] ; then BENCH_TMP=/dev/shm ; else BENCH_TMP="${TMPDIR:-/tmp}" ; fi
+BENCHDIR="`mktemp -d "$BENCH_TMP/nutsnmp.XXXXXX"`" \
+|| die "Can not create a temporary directory"
+
+PIDS=""
+stop_all() {
+	for P in $PIDS ; do
+		kill "$P" 2>/dev/null
+	done
+	for P in $PIDS ; do
+		wait "$P" 2>/dev/null
+	done
+	PIDS=""
+}
+
+cleanup() {
+	stop_all
+	if [ -n "${BENCH_FAILED-}" ] ; then
+		for F in "$BENCHDIR"/*/*.log ; do
+			[ -s "$F" ] && sed "s|^|`basename "$F"`: |" < "$F" >&2
+		done
+	fi
+	rm -rf "$BENCHDIR"
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+wait_for() {
+	COUNTDOWN=100
+	while ! eval "$1" ; do
+		if [ "$COUNTDOWN" -le 0 ] ; then
+			BENCH_FAILED=yes
+			die "$2"
+		fi
+		COUNTDOWN="`expr $COUNTDOWN - 1`"
+		sleep 0.1 2>/dev/null || sleep 1
+	done
+}
+
+# A number out of the JSON of the agent
+json_value() {
+	sed -n 's/.*"'"$1"'": \([0-9.]*\).*/\1/p' "$RUNDIR/agent.out"
+}
+
+echo "snmp-ups ($BENCH_MIBS) against `basename "$BENCH_WALK"`:" >&2
+printf "%8s %12s %12s %12s %12s %14s\n" "devices" "updates" "trips/upd" "upd ms p50" "upd ms max" "cpu ms/upd" >&2
+
+for N in $BENCH_PDUS ; do
+	RUNDIR="$BENCHDIR/$N"
+	mkdir "$RUNDIR" || die "Can not create $RUNDIR"
+
+	NUT_CONFPATH="$RUNDIR"
+	NUT_STATEPATH="$RUNDIR"
+	NUT_ALTPIDPATH="$RUNDIR"
+	export NUT_CONFPATH NUT_STATEPATH NUT_ALTPIDPATH
+
+	# Daemons started by root become an unprivileged user (see NIT)
+	if [ "`id -u`" = 0 ] ; then
+		chmod 777 "$RUNDIR"
+	fi
+
+	"$BENCH_AGENT" -f "$BENCH_WALK" -n "$N" -a 127.0.0.1 -p "$BENCH_PORT" -P \
+		-D "$RUNDIR" ${BENCH_AGENT_OPTS-} \
+		> "$RUNDIR/agent.out" 2> "$RUNDIR/agent.log" &
+	AGENT_PID=$!
+	PIDS="$PIDS $AGENT_PID"
+
+	wait_for 'grep "^READY" "$RUNDIR/agent.out" >/dev/null 2>&1' "The agents did not start"
+
+	I=1
+	: > "$RUNDIR/ups.conf"
+	while [ "$I" -le "$N" ] ; do
+		cat >> "$RUNDIR/ups.conf" << EOF
+[bench$I]
+	driver = snmp-ups
+	port = 127.0.0.1:`expr $BENCH_PORT + $I - 1`
+	mibs = $BENCH_MIBS
+	snmp_version = v2c
+	pollinterval = $BENCH_POLLINTERVAL
+EOF
+		if [ -n "${BENCH_DRIVER_OPTS-}" ] ; then
+			echo "$BENCH_DRIVER_OPTS" | tr ';' '\n' | sed 's/^[ 	]*/	/' >> "$RUNDIR/ups.conf"
+		fi
+		I="`expr $I + 1`"
+	done
+	chmod 644 "$RUNDIR/ups.conf"
+
+	# with their PID files (-FF), which the agent finds them by
+	I=1
+	while [ "$I" -le "$N" ] ; do
+		"$NUT_SNMP_UPS" -a "bench$I" -FF > "$RUNDIR/bench$I.log" 2>&1 &
+		PIDS="$PIDS $!"
+		I="`expr $I + 1`"
+	done
+
+	sleep "$BENCH_WARMUP"
+	kill -USR1 "$AGENT_PID"
+	sleep "$BENCH_SECONDS"
+
+	kill "$AGENT_PID"
+	wait "$AGENT_PID"
+	AGENT_RES=$?
+	stop_all
+
+	if [ "$AGENT_RES" != 0 ] || ! grep '^{' "$RUNDIR/agent.out" > /dev/null ; then
+		BENCH_FAILED=yes
+		die "The agents failed with code $AGENT_RES"
+	fi
+	if [ "`json_value walks`" = 0 ] ; then
+		BENCH_FAILED=yes
+		die "No driver updated from the agents in $BENCH_SECONDS seconds"
+	fi
+
+	printf "%8s %12s %12s %12s %12s %14s\n" "$N" "`json_value walks`" \
+		"`json_value requests_per_walk`" "`json_value p50`" "`json_value max`" \
+		"`json_value client_cpu_ms_per_walk`" >&2
+	grep '^{' "$RUNDIR/agent.out"
+	if [ -n "${BENCH_OUTPUT-}" ] ; then
+		grep '^{' "$RUNDIR/agent.out" >> "$BENCH_OUTPUT"
+	fi
+done
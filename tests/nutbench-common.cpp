@@ -0,0 +1,496 @@
+/*  nutbench-common.cpp - microbenchmarks of the core data structures of
+ *  libcommon: the state trees (common/state.c) which the drivers, upsd
+ *  and clients keep the variables of devices in, the parseconf tokenizer
+ *  which reads the driver and client protocols, pconf_encode(),
+ *  snprintfcat() and the number conversions of common/str.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "nutbench.h"
+
+#include "common.h"
+#include "state.h"
+#include "parseconf.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+/* the variables of a device: those of a small UPS, then as many outlets
+ * of a PDU as it takes (a "big" device) */
+const char *ups_vars[] = {
+	"battery.charge", "battery.charge.low", "battery.charge.warning",
+	"battery.runtime", "battery.runtime.low", "battery.type",
+	"battery.voltage", "battery.voltage.nominal", "battery.date",
+	"battery.mfr.date", "battery.temperature", "battery.packs",
+	"device.mfr", "device.model", "device.serial", "device.type",
+	"driver.name", "driver.parameter.pollfreq", "driver.parameter.pollinterval",
+	"driver.parameter.port", "driver.version", "driver.version.internal",
+	"input.frequency", "input.frequency.nominal", "input.sensitivity",
+	"input.transfer.high", "input.transfer.low", "input.transfer.reason",
+	"input.voltage", "input.voltage.nominal", "input.current",
+	"output.current", "output.frequency", "output.frequency.nominal",
+	"output.voltage", "output.voltage.nominal", "output.realpower",
+	"ups.beeper.status", "ups.delay.shutdown", "ups.delay.start",
+	"ups.firmware", "ups.load", "ups.mfr", "ups.model", "ups.power",
+	"ups.power.nominal", "ups.productid", "ups.realpower",
+	"ups.realpower.nominal", "ups.serial", "ups.status", "ups.temperature",
+	"ups.test.result", "ups.timer.shutdown", "ups.timer.start",
+	"ups.vendorid", "ambient.humidity", "ambient.temperature"
+};
+
+const char *outlet_vars[] = {
+	"current", "desc", "id", "power", "realpower", "status", "switchable",
+	"voltage"
+};
+
+/* sizes of the devices benchmarked */
+const size_t SMALL = 64, BIG = 1024;
+
+/* a random pattern (fixed, so runs compare) of this many lookups */
+const size_t PATTERN = 4096;
+
+struct Names
+{
+	std::vector<std::string> names;
+	std::vector<std::string> values;
+	std::vector<size_t> random;	/* indexes into names */
+
+	explicit Names(size_t count)
+	{
+		size_t nups = sizeof(ups_vars) / sizeof(ups_vars[0]);
+		size_t nout = sizeof(outlet_vars) / sizeof(outlet_vars[0]);
+		char buf[SMALLBUF];
+		uint32_t x = 2463534242U;
+
+		for (size_t i = 0; i < count; i++) {
+			if (i < nups) {
+				names.push_back(ups_vars[i]);
+			} else {
+				snprintf(buf, sizeof(buf), "outlet.%" PRIuSIZE ".%s",
+					(i - nups) / nout + 1, outlet_vars[(i - nups) % nout]);
+				names.push_back(buf);
+			}
+
+			snprintf(buf, sizeof(buf), "%" PRIuSIZE ".%" PRIuSIZE, i * 7 % 250, i % 10);
+			values.push_back(buf);
+		}
+
+		/* xorshift */
+		for (size_t i = 0; i < PATTERN; i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			random.push_back(x % count);
+		}
+	}
+};
+
+const Names& names_of(size_t count)
+{
+	static Names small(SMALL), big(BIG);
+
+	return (count == SMALL) ? small : big;
+}
+
+/* a tree with all the names, inserted in a random order */
+st_tree_t *build_tree(const Names& n)
+{
+	st_tree_t *root = nullptr;
+	std::vector<size_t> order;
+
+	for (size_t i = 0; i < n.names.size(); i++)
+		order.push_back((i * 7919) % n.names.size());
+	for (size_t i = 0; i < order.size(); i++)
+		state_setinfo(&root, n.names[order[i]].c_str(), n.values[order[i]].c_str());
+
+	return root;
+}
+
+/* the index of the i-th lookup in a pattern */
+inline size_t sequential(const Names& n, size_t i)
+{
+	return i % n.names.size();
+}
+
+inline size_t random_index(const Names& n, size_t i)
+{
+	return n.random[i % PATTERN];
+}
+
+typedef size_t (*Pattern)(const Names&, size_t);
+
+void bench_getinfo(nutbench::State& state, size_t count, Pattern pattern)
+{
+	const Names& n = names_of(count);
+	st_tree_t *root = build_tree(n);
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++)
+		nutbench::keep(state_getinfo(root, n.names[pattern(n, i)].c_str()));
+	state.stop();
+
+	state_infofree(root);
+}
+
+void bench_find(nutbench::State& state, size_t count, Pattern pattern)
+{
+	const Names& n = names_of(count);
+	st_tree_t *root = build_tree(n);
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++)
+		nutbench::keep(state_tree_find(root, n.names[pattern(n, i)].c_str()));
+	state.stop();
+
+	state_infofree(root);
+}
+
+/* what a driver does on each poll: set the value which it has anyway */
+void bench_setinfo_same(nutbench::State& state, size_t count, Pattern pattern)
+{
+	const Names& n = names_of(count);
+	st_tree_t *root = build_tree(n);
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		size_t j = pattern(n, i);
+		nutbench::keep(state_setinfo(&root, n.names[j].c_str(), n.values[j].c_str()));
+	}
+	state.stop();
+
+	state_infofree(root);
+}
+
+/* a value which changes on each call */
+void bench_setinfo_changed(nutbench::State& state, size_t count, Pattern pattern)
+{
+	const Names& n = names_of(count);
+	st_tree_t *root = build_tree(n);
+	const char *values[2] = { "229.5", "230.5" };
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		size_t j = pattern(n, i);
+		nutbench::keep(state_setinfo(&root, n.names[j].c_str(), values[(i / n.names.size()) % 2]));
+	}
+	state.stop();
+
+	state_infofree(root);
+}
+
+/* new trees, freed when they are full (as when a device is dropped) */
+void bench_setinfo_insert(nutbench::State& state, size_t count)
+{
+	const Names& n = names_of(count);
+	st_tree_t *root = nullptr;
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		/* each of the names once per tree, in a scattered order */
+		size_t j = ((i % count) * 7919) % count;
+
+		if (i % count == 0) {
+			state_infofree(root);
+			root = nullptr;
+		}
+		state_setinfo(&root, n.names[j].c_str(), n.values[j].c_str());
+	}
+	state.stop();
+
+	state_infofree(root);
+}
+
+/* what a driver sends upsd on its socket, and what upsd sends clients */
+std::string driver_stream(size_t lines)
+{
+	const Names& n = names_of(SMALL);
+	std::string s;
+
+	for (size_t i = 0; i < lines; i++) {
+		size_t j = sequential(n, i);
+
+		if (i % 16 == 15) {
+			s += "PONG\n";
+			continue;
+		}
+		s += "SETINFO " + n.names[j] + " \"" + n.values[j] + "\"\n";
+	}
+
+	return s;
+}
+
+std::vector<std::string> client_lines(size_t lines)
+{
+	const Names& n = names_of(SMALL);
+	std::vector<std::string> v;
+
+	for (size_t i = 0; i < lines; i++) {
+		size_t j = sequential(n, i);
+
+		if (n.names[j] == "device.model")
+			v.push_back("VAR myups device.model \"Smart-UPS 1500 \\\"RM\\\"\"");
+		else
+			v.push_back("VAR myups " + n.names[j] + " \"" + n.values[j] + "\"");
+	}
+
+	return v;
+}
+
+void ignore_errors(const char *msg)
+{
+	NUT_UNUSED_VARIABLE(msg);
+}
+
+} /* namespace */
+
+NUTBENCH(getinfo_seq_small, "state_getinfo/sequential/64")
+{
+	bench_getinfo(state, SMALL, sequential);
+}
+
+NUTBENCH(getinfo_rand_small, "state_getinfo/random/64")
+{
+	bench_getinfo(state, SMALL, random_index);
+}
+
+NUTBENCH(getinfo_seq_big, "state_getinfo/sequential/1024")
+{
+	bench_getinfo(state, BIG, sequential);
+}
+
+NUTBENCH(getinfo_rand_big, "state_getinfo/random/1024")
+{
+	bench_getinfo(state, BIG, random_index);
+}
+
+NUTBENCH(find_seq_small, "state_tree_find/sequential/64")
+{
+	bench_find(state, SMALL, sequential);
+}
+
+NUTBENCH(find_rand_small, "state_tree_find/random/64")
+{
+	bench_find(state, SMALL, random_index);
+}
+
+NUTBENCH(find_seq_big, "state_tree_find/sequential/1024")
+{
+	bench_find(state, BIG, sequential);
+}
+
+NUTBENCH(find_rand_big, "state_tree_find/random/1024")
+{
+	bench_find(state, BIG, random_index);
+}
+
+NUTBENCH(setinfo_same_seq, "state_setinfo/same/sequential/64")
+{
+	bench_setinfo_same(state, SMALL, sequential);
+}
+
+NUTBENCH(setinfo_same_rand, "state_setinfo/same/random/1024")
+{
+	bench_setinfo_same(state, BIG, random_index);
+}
+
+NUTBENCH(setinfo_changed_seq, "state_setinfo/changed/sequential/64")
+{
+	bench_setinfo_changed(state, SMALL, sequential);
+}
+
+NUTBENCH(setinfo_changed_rand, "state_setinfo/changed/random/1024")
+{
+	bench_setinfo_changed(state, BIG, random_index);
+}
+
+NUTBENCH(setinfo_insert_small, "state_setinfo/insert/64")
+{
+	bench_setinfo_insert(state, SMALL);
+}
+
+NUTBENCH(setinfo_insert_big, "state_setinfo/insert/1024")
+{
+	bench_setinfo_insert(state, BIG);
+}
+
+/* an op is a line, of the driver socket protocol */
+NUTBENCH(pconf_char_driver, "pconf_char/driver_stream")
+{
+	std::string s = driver_stream(SMALL);
+	PCONF_CTX_t ctx;
+	size_t lines = 0, bytes = 0;
+
+	pconf_init(&ctx, ignore_errors);
+
+	state.start();
+	while (lines < state.iterations()) {
+		for (size_t i = 0; i < s.size() && lines < state.iterations(); i++) {
+			bytes++;
+			if (pconf_char(&ctx, s[i]) == 1) {
+				nutbench::keep(ctx.arglist[0]);
+				lines++;
+			}
+		}
+	}
+	state.stop();
+
+	state.setBytes(bytes);
+	pconf_finish(&ctx);
+}
+
+NUTBENCH(pconf_feed_driver, "pconf_feed/driver_stream")
+{
+	std::string s = driver_stream(SMALL);
+	PCONF_CTX_t ctx;
+	size_t lines = 0, bytes = 0;
+
+	pconf_init(&ctx, ignore_errors);
+
+	state.start();
+	while (lines < state.iterations()) {
+		size_t i = 0, used;
+
+		while (i < s.size() && lines < state.iterations()) {
+			if (pconf_feed(&ctx, s.data() + i, s.size() - i, &used) == 1) {
+				nutbench::keep(ctx.arglist[0]);
+				lines++;
+			}
+			i += used;
+		}
+		bytes += i;
+	}
+	state.stop();
+
+	state.setBytes(bytes);
+	pconf_finish(&ctx);
+}
+
+/* an op is a line, of answers to clients */
+NUTBENCH(pconf_line_client, "pconf_line/client_stream")
+{
+	std::vector<std::string> v = client_lines(SMALL);
+	PCONF_CTX_t ctx;
+	size_t bytes = 0;
+
+	pconf_init(&ctx, ignore_errors);
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		const std::string& line = v[i % v.size()];
+
+		nutbench::keep(pconf_line(&ctx, line.c_str()));
+		bytes += line.size();
+	}
+	state.stop();
+
+	state.setBytes(bytes);
+	pconf_finish(&ctx);
+}
+
+NUTBENCH(pconf_encode_plain, "pconf_encode/plain")
+{
+	char buf[ST_SOCK_BUF_LEN];
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++)
+		nutbench::keep(pconf_encode("Smart-UPS 1500 RM", buf, sizeof(buf)));
+	state.stop();
+
+	state.setBytes(state.iterations() * strlen("Smart-UPS 1500 RM"));
+}
+
+NUTBENCH(pconf_encode_escaped, "pconf_encode/escaped")
+{
+	const char *val = "path \"C:\\nut\\etc\" and \"quotes\"";
+	char buf[ST_SOCK_BUF_LEN];
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++)
+		nutbench::keep(pconf_encode(val, buf, sizeof(buf)));
+	state.stop();
+
+	state.setBytes(state.iterations() * strlen(val));
+}
+
+/* an op is an append, to a buffer started over every 16 of them */
+NUTBENCH(snprintfcat, "snprintfcat/append")
+{
+	char buf[LARGEBUF];
+
+	buf[0] = '\0';
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		if (i % 16 == 0)
+			buf[0] = '\0';
+		nutbench::keep(snprintfcat(buf, sizeof(buf), " %s=%" PRIuSIZE, "outlet.current", i));
+	}
+	state.stop();
+}
+
+/* the numbers of drivers' values, as text and back */
+static const char *numbers[] = {
+	"230.4", "49.9", "100", "13.65", "27.0", "0.8", "1500", "5.25"
+};
+
+NUTBENCH(str_to_double, "str_to_double/values")
+{
+	double d;
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		str_to_double(numbers[i % 8], &d, 10);
+		nutbench::keep(d);
+	}
+	state.stop();
+}
+
+NUTBENCH(str_scan_double, "str_scan_double/values")
+{
+	double d;
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++) {
+		nutbench::keep(str_scan_double(numbers[i % 8], &d));
+		nutbench::keep(d);
+	}
+	state.stop();
+}
+
+NUTBENCH(snprintf_double, "snprintf/%.1f")
+{
+	char buf[SMALLBUF];
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++)
+		nutbench::keep(snprintf(buf, sizeof(buf), "%.1f", 200.0 + static_cast<double>(i % 64) * 0.7));
+	state.stop();
+}
+
+NUTBENCH(str_from_double, "str_from_double/1")
+{
+	char buf[SMALLBUF];
+
+	state.start();
+	for (size_t i = 0; i < state.iterations(); i++)
+		nutbench::keep(str_from_double(buf, sizeof(buf), 200.0 + static_cast<double>(i % 64) * 0.7, 1));
+	state.stop();
+}
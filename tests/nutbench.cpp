@@ -0,0 +1,261 @@
+/*  nutbench.cpp - runner of the microbenchmarks registered with NUTBENCH()
+ *  (see nutbench.h), which reports stable ns/op numbers and compares them
+ *  with those of an earlier run
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* Each benchmark is first calibrated: its iterations are doubled until
+ * a run takes a tenth of the target time, then scaled up to the target.
+ * It is then run a number of times with that many iterations, and the
+ * ns/op of the fastest run is what is reported (and compared), as the
+ * other processes of the machine can only make a run slower; the median
+ * and the spread of the runs tell how noisy the machine was. For numbers
+ * which repeat best, run it on an idle machine pinned to one CPU, e.g.
+ * "taskset -c 2 ./nutbench".
+ */
+
+#include "config.h"
+#include "nutbench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unistd.h>
+
+namespace nutbench {
+
+std::vector<Benchmark>& registry()
+{
+	static std::vector<Benchmark> benchmarks;
+	return benchmarks;
+}
+
+} /* namespace nutbench */
+
+namespace {
+
+struct Result
+{
+	size_t iterations;
+	double median_ns, min_ns, spread;	/* spread: (max - min) / median */
+	double mb_per_s;	/* 0 unless the benchmark counts bytes */
+};
+
+void usage(const char *prog)
+{
+	printf("Run the microbenchmarks of libcommon and report their ns/op.\n\n");
+	printf("Usage: %s [OPTIONS] [NAME...]\n\n", prog);
+	printf("  NAME...		run the benchmarks whose names start with one of these\n");
+	printf("  -l		list the benchmarks and exit\n");
+	printf("  -t <msec>	target time of each run (default 200)\n");
+	printf("  -r <count>	runs of each benchmark (default 5)\n");
+	printf("  -o <file>	save the results (ns/op), for a later -b\n");
+	printf("  -b <file>	compare with the results saved earlier\n");
+	printf("  -x <percent>	with -b: fail if a benchmark got slower by more (default 10)\n");
+}
+
+/* a run of the benchmark, in seconds (of what it timed) */
+double run_once(const nutbench::Benchmark& b, size_t iterations, size_t *bytes)
+{
+	nutbench::State state(iterations);
+	nutbench::Clock::time_point start = nutbench::Clock::now();
+
+	b.function(state);
+
+	if (!state.started()) {
+		state.stop();
+		*bytes = state.bytes();
+		return std::chrono::duration<double>(nutbench::Clock::now() - start).count();
+	}
+
+	*bytes = state.bytes();
+	return state.seconds();
+}
+
+Result run(const nutbench::Benchmark& b, double target, size_t runs)
+{
+	Result r;
+	std::vector<double> ns;
+	size_t iterations = 1, bytes = 0;
+	double t;
+
+	/* calibration, which also warms the caches up */
+	for (;;) {
+		t = run_once(b, iterations, &bytes);
+		if (t >= target / 10 || iterations >= (static_cast<size_t>(1) << 40))
+			break;
+		iterations *= 2;
+	}
+	if (t > 0 && t < target) {
+		iterations = static_cast<size_t>(static_cast<double>(iterations) * target / t);
+	}
+	if (iterations < 1)
+		iterations = 1;
+
+	for (size_t i = 0; i < runs; i++) {
+		t = run_once(b, iterations, &bytes);
+		ns.push_back(t * 1e9 / static_cast<double>(iterations));
+	}
+
+	std::sort(ns.begin(), ns.end());
+	r.iterations = iterations;
+	r.median_ns = (runs % 2) ? ns[runs / 2] : (ns[runs / 2 - 1] + ns[runs / 2]) / 2;
+	r.min_ns = ns.front();
+	r.spread = r.median_ns > 0 ? (ns.back() - ns.front()) / r.median_ns : 0;
+	r.mb_per_s = (bytes && r.min_ns > 0)
+		? static_cast<double>(bytes) / static_cast<double>(iterations) / r.min_ns * 1e3
+		: 0;
+
+	return r;
+}
+
+/* "name ns/op" lines, as saved with -o */
+bool load_baseline(const char *fn, std::map<std::string, double>& baseline)
+{
+	FILE *f = fopen(fn, "r");
+	char line[512], name[256];
+	double ns;
+
+	if (!f)
+		return false;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%255s %lf", name, &ns) == 2)
+			baseline[name] = ns;
+	}
+
+	fclose(f);
+	return true;
+}
+
+bool selected(const char *name, int argc, char **argv)
+{
+	if (argc < 1)
+		return true;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strncmp(name, argv[i], strlen(argv[i])))
+			return true;
+	}
+
+	return false;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	const char *save = nullptr, *base = nullptr;
+	double target_ms = 200, tolerance = 10;
+	size_t runs = 5;
+	bool list = false;
+	int opt, res = EXIT_SUCCESS;
+	std::map<std::string, double> baseline;
+	FILE *out = nullptr;
+
+	while ((opt = getopt(argc, argv, "lt:r:o:b:x:h")) != -1) {
+		switch (opt) {
+			case 'l':
+				list = true;
+				break;
+			case 't':
+				target_ms = atof(optarg);
+				break;
+			case 'r':
+				runs = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+				break;
+			case 'o':
+				save = optarg;
+				break;
+			case 'b':
+				base = optarg;
+				break;
+			case 'x':
+				tolerance = atof(optarg);
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (target_ms <= 0 || runs < 1 || tolerance < 0) {
+		fprintf(stderr, "Invalid arguments, see -h\n");
+		return EXIT_FAILURE;
+	}
+
+	if (list) {
+		for (const nutbench::Benchmark& b : nutbench::registry())
+			printf("%s\n", b.name);
+		return EXIT_SUCCESS;
+	}
+
+	if (base && !load_baseline(base, baseline)) {
+		fprintf(stderr, "Can not read %s\n", base);
+		return EXIT_FAILURE;
+	}
+
+	if (save && (out = fopen(save, "w")) == nullptr) {
+		fprintf(stderr, "Can not write %s\n", save);
+		return EXIT_FAILURE;
+	}
+	if (out)
+		fprintf(out, "# nutbench: name, ns/op of the fastest run\n");
+
+	printf("%-36s %12s %10s %10s %7s %9s%s\n", "BENCHMARK", "ITERATIONS",
+		"NS/OP", "MEDIAN", "SPREAD", "MB/S", base ? "   BASELINE" : "");
+
+	for (const nutbench::Benchmark& b : nutbench::registry()) {
+		if (!selected(b.name, argc - optind, argv + optind))
+			continue;
+
+		Result r = run(b, target_ms / 1e3, runs);
+
+		printf("%-36s %12zu %10.1f %10.1f %6.1f%%", b.name, r.iterations,
+			r.min_ns, r.median_ns, r.spread * 100);
+		if (r.mb_per_s > 0)
+			printf(" %9.1f", r.mb_per_s);
+		else
+			printf(" %9s", "-");
+
+		std::map<std::string, double>::const_iterator it = baseline.find(b.name);
+		if (it != baseline.end() && it->second > 0) {
+			double change = (r.min_ns - it->second) * 100 / it->second;
+			bool slower = change > tolerance;
+
+			printf("   %+6.1f%%%s", change, slower ? "  SLOWER" : "");
+			if (slower)
+				res = EXIT_FAILURE;
+		}
+		printf("\n");
+		fflush(stdout);
+
+		if (out)
+			fprintf(out, "%s %.3f\n", b.name, r.min_ns);
+	}
+
+	if (out)
+		fclose(out);
+
+	return res;
+}
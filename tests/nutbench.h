@@ -0,0 +1,109 @@
+/*  nutbench.h - registry and timing of the microbenchmarks which the
+ *  nutbench.cpp runner calls, in the manner of the CppUnit test suites
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef NUT_NUTBENCH_H_SEEN
+#define NUT_NUTBENCH_H_SEEN 1
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nutbench {
+
+typedef std::chrono::steady_clock Clock;
+
+/* One run of a benchmark: it does its setup, then the given number of
+ * iterations of what it measures between start() and stop() */
+class State
+{
+public:
+	explicit State(size_t iterations)
+		: m_iterations(iterations), m_bytes(0), m_started(false)
+	{}
+
+	size_t iterations() const { return m_iterations; }
+
+	void start()
+	{
+		m_started = true;
+		m_start = Clock::now();
+	}
+
+	void stop() { m_stop = Clock::now(); }
+
+	/* bytes handled by all the iterations, for a throughput */
+	void setBytes(size_t bytes) { m_bytes = bytes; }
+	size_t bytes() const { return m_bytes; }
+
+	bool started() const { return m_started; }
+	double seconds() const
+	{
+		return std::chrono::duration<double>(m_stop - m_start).count();
+	}
+
+private:
+	size_t m_iterations;
+	size_t m_bytes;
+	bool m_started;
+	Clock::time_point m_start, m_stop;
+};
+
+typedef void (*Function)(State&);
+
+struct Benchmark
+{
+	const char *name;
+	Function function;
+};
+
+/* all the benchmarks, as registered by NUTBENCH() */
+std::vector<Benchmark>& registry();
+
+struct Registrar
+{
+	Registrar(const char *name, Function function)
+	{
+		Benchmark b = { name, function };
+		registry().push_back(b);
+	}
+};
+
+/* keep the compiler from dropping a result which is not used */
+template<typename T>
+inline void keep(const T& value)
+{
+#if (defined __GNUC__) || (defined __clang__)
+	__asm__ __volatile__("" : : "r,m"(value) : "memory");
+#else
+	static volatile const T *sink;
+	sink = &value;
+#endif
+}
+
+} /* namespace nutbench */
+
+/* define and register a benchmark: NUTBENCH(id, "group/case") { ... } */
+#define NUTBENCH(id, name) \
+	static void nutbench_##id(nutbench::State& state); \
+	static nutbench::Registrar nutbench_registrar_##id(name, nutbench_##id); \
+	static void nutbench_##id(nutbench::State& state)
+
+#endif	/* NUT_NUTBENCH_H_SEEN */
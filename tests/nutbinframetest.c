@@ -0,0 +1,114 @@
+/*  nutbinframetest.c - check that common/binframe.c gives back exactly
+ *  the text of the values it accepts as NUM records
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "binframe.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* values which must come back unchanged from a NUM record */
+static const char *numbers[] = {
+	"0", "1", "100", "-5", "230.0", "0.05", "-0.5", "12.345",
+	"999999999999999999", "-999999999999999999", "0.00000000000000001",
+	NULL
+};
+
+/* values which must be sent as STR records instead */
+static const char *strings[] = {
+	"", "-", "-0", "-0.00", "007", "00", "+5", "1.", ".5", "1e3", "1.2.3",
+	" 1", "1 ", "OL", "1000000000000000000", "0x10", "12,5", "0.000000000000000001",
+	NULL
+};
+
+static int check_numbers(void)
+{
+	unsigned char	buf[8];
+	char	text[SMALLBUF];
+	int64_t	m;
+	unsigned int	d;
+	size_t	i;
+	int	res = 0;
+
+	for (i = 0; numbers[i]; i++) {
+		if (!binframe_num_parse(numbers[i], &m, &d)) {
+			printf("  \"%s\": not taken as a number (FAIL)\n", numbers[i]);
+			res++;
+			continue;
+		}
+
+		/* through the wire format, as upsd and the clients do */
+		binframe_put_i64(buf, m);
+
+		if (!binframe_num_format(binframe_get_i64(buf), d, text, sizeof(text))
+		 || strcmp(text, numbers[i])
+		) {
+			printf("  \"%s\": came back as \"%s\" (FAIL)\n", numbers[i], text);
+			res++;
+		}
+	}
+
+	for (i = 0; strings[i]; i++) {
+		if (binframe_num_parse(strings[i], &m, &d)) {
+			printf("  \"%s\": taken as a number (FAIL)\n", strings[i]);
+			res++;
+		}
+	}
+
+	return res;
+}
+
+static int check_limits(void)
+{
+	unsigned char	buf[8];
+	int	res = 0;
+
+	binframe_put_i64(buf, INT64_MIN);
+	if (binframe_get_i64(buf) != INT64_MIN) {
+		res++;
+	}
+
+	binframe_put_i64(buf, -1);
+	if (binframe_get_i64(buf) != -1 || buf[0] != 0xff || buf[7] != 0xff) {
+		res++;
+	}
+
+	binframe_put_u32(buf, 0x01020304U);
+	if (buf[0] != 1 || buf[3] != 4 || binframe_get_u32(buf) != 0x01020304U) {
+		res++;
+	}
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += check_numbers();
+	ret += check_limits();
+
+	if (ret != 0)
+		printf("nutbinframetest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
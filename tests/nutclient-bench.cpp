@@ -0,0 +1,206 @@
+/*  nutclient-bench.cpp - microbenchmark of the nutclient C++ API calls
+ *  which read device variables, over the in-memory MemClientStub
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "../clients/nutclientmem.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/* What a run of one API measured */
+struct Result
+{
+	size_t calls;
+	size_t variables;	/* values handed to the caller */
+	double seconds;
+};
+
+void usage(const char *prog)
+{
+	printf("Time the nutclient calls which read device variables, over\n");
+	printf("the in-memory stub: the cost of the client side alone.\n\n");
+	printf("Usage: %s [OPTIONS]\n\n", prog);
+	printf("  -d <count>	devices (default 50)\n");
+	printf("  -v <count>	variables of each device (default 100)\n");
+	printf("  -n <count>	polls of all the devices (default 200)\n");
+	printf("  -m <count>	variables changed between polls (default 100)\n");
+	printf("  -l <usec>	latency of each call (default 0)\n");
+	printf("  -x <nsec>	fail if a call costs more per variable (default: no limit)\n");
+}
+
+void report(const char *api, const Result& r, double max_ns, int& res)
+{
+	double per_call = r.calls ? r.seconds * 1e6 / static_cast<double>(r.calls) : 0;
+	double per_var = r.variables ? r.seconds * 1e9 / static_cast<double>(r.variables) : 0;
+	bool over = max_ns > 0 && per_var > max_ns;
+
+	printf("%-32s %10zu %12zu %10.1f %12.2f %10.1f%s\n", api, r.calls,
+		r.variables, r.seconds * 1e3, per_call, per_var, over ? "  OVER" : "");
+	if (over)
+		res = EXIT_FAILURE;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	size_t devices = 50, variables = 100, polls = 200, mutations = 100;
+	long latency_us = 0;
+	double max_ns = 0;
+	int opt, res = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "d:v:n:m:l:x:h")) != -1) {
+		switch (opt) {
+			case 'd':
+				devices = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+				break;
+			case 'v':
+				variables = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+				break;
+			case 'n':
+				polls = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+				break;
+			case 'm':
+				mutations = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+				break;
+			case 'l':
+				latency_us = atol(optarg);
+				break;
+			case 'x':
+				max_ns = atof(optarg);
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (devices < 1 || variables < 1 || polls < 1 || latency_us < 0) {
+		fprintf(stderr, "Invalid arguments, see -h\n");
+		return EXIT_FAILURE;
+	}
+
+	nut::MemClientStub client;
+	client.populate(devices, variables);
+	client.setLatency(std::chrono::microseconds(latency_us));
+
+	std::set<std::string> names;
+	for (size_t d = 0; d < devices; d++)
+		names.insert("dev" + std::to_string(d));
+
+	printf("%zu devices of %zu variables, %zu polls, %zu changes between polls, latency %ldus\n\n",
+		devices, variables, polls, mutations, latency_us);
+	printf("%-32s %10s %12s %10s %12s %10s\n",
+		"API", "CALLS", "VARIABLES", "TOTAL(ms)", "us/CALL", "ns/VAR");
+
+	/* Each run polls all the devices, with the same changes in between
+	 * (not timed) for all; the sum keeps the results from being unused */
+	size_t sum = 0;
+	Clock::duration elapsed;
+	Clock::time_point start;
+
+	/* One device at a time */
+	Result r = Result();
+	client.setSeed(1);
+	elapsed = Clock::duration::zero();
+	for (size_t n = 0; n < polls; n++) {
+		client.mutate(mutations);
+		start = Clock::now();
+		for (std::set<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+			nut::ListObject values = client.getDeviceVariableValues(*it);
+			r.variables += values.size();
+			r.calls++;
+		}
+		elapsed += Clock::now() - start;
+	}
+	r.seconds = std::chrono::duration<double>(elapsed).count();
+	report("getDeviceVariableValues()", r, max_ns, res);
+
+	/* All devices at once */
+	r = Result();
+	client.setSeed(1);
+	elapsed = Clock::duration::zero();
+	for (size_t n = 0; n < polls; n++) {
+		client.mutate(mutations);
+		start = Clock::now();
+		nut::ListDevice values = client.getDevicesVariableValues(names);
+		for (nut::ListDevice::const_iterator it = values.begin(); it != values.end(); ++it)
+			r.variables += it->second.size();
+		r.calls++;
+		elapsed += Clock::now() - start;
+	}
+	r.seconds = std::chrono::duration<double>(elapsed).count();
+	report("getDevicesVariableValues()", r, max_ns, res);
+
+	/* All devices at once, streamed to a visitor */
+	r = Result();
+	client.setSeed(1);
+	elapsed = Clock::duration::zero();
+	for (size_t n = 0; n < polls; n++) {
+		client.mutate(mutations);
+		start = Clock::now();
+		client.visitDevicesVariableValues(names,
+			[&r, &sum](const std::string& dev, const std::string& name, std::vector<std::string>& values)
+			{
+				NUT_UNUSED_VARIABLE(dev);
+				NUT_UNUSED_VARIABLE(name);
+				sum += values.size();
+				r.variables++;
+			});
+		r.calls++;
+		elapsed += Clock::now() - start;
+	}
+	r.seconds = std::chrono::duration<double>(elapsed).count();
+	report("visitDevicesVariableValues()", r, max_ns, res);
+
+	/* Changes only, one device at a time (the first poll gets all) */
+	std::vector<std::string> tokens(names.size(), "0");
+	r = Result();
+	client.setSeed(1);
+	elapsed = Clock::duration::zero();
+	for (size_t n = 0; n < polls; n++) {
+		client.mutate(mutations);
+		start = Clock::now();
+		size_t i = 0;
+		for (std::set<std::string>::const_iterator it = names.begin(); it != names.end(); ++it, ++i) {
+			bool full = false;
+			std::map<std::string, std::vector<std::string> > values =
+				client.getDeviceVariableValuesSince(*it, tokens[i], full);
+			r.variables += values.size();
+			sum += full;
+			r.calls++;
+		}
+		elapsed += Clock::now() - start;
+	}
+	r.seconds = std::chrono::duration<double>(elapsed).count();
+	report("getDeviceVariableValuesSince()", r, max_ns, res);
+
+	printf("\n(checksum %zu)\n", sum);
+
+	return res;
+}
@@ -77,6 +77,8 @@ class NutClientTest : public CppUnit::TestFixture
 		CPPUNIT_TEST( test_copy_assignment_var );
 
 		CPPUNIT_TEST( test_nutclientstub_dev );
+
+		CPPUNIT_TEST( test_typed_values );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -97,6 +99,8 @@ public:
 	void test_copy_assignment_var();
 
 	void test_nutclientstub_dev();
+
+	void test_typed_values();
 };
 
 // Registers the fixture into the 'registry'
@@ -386,6 +390,76 @@ void NutClientTest::test_nutclientstub_dev() {
 		CPPUNIT_ASSERT_MESSAGE(
 			"Failed stub tcp client: devices mono bad value",
 			devices["ups_1"]["name_multi_1"][1] == std::string("multi_2"));
+
+		// stream device values
+		size_t visited = 0;
+		c.visitDevicesVariableValues(devices_name,
+			[&visited](const std::string& dev, const std::string& name, ListValue& vals)
+			{
+				NUT_UNUSED_VARIABLE(name);
+				if (dev == "ups_1" && !vals.empty())
+					visited++;
+			});
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: visited wrong values number",
+			visited == 2);
+
+		// get changed values
+		std::string token = "0";
+		bool full = false;
+		objects = c.getDeviceVariableValuesSince("ups_1", token, full);
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: since 0 not full",
+			full && objects.size() == 2);
+		c.setDeviceVariable("ups_1", "name_1", "value_2");
+		objects = c.getDeviceVariableValuesSince("ups_1", token, full);
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: since wrong changes",
+			!full && objects.size() == 1 && objects["name_1"][0] == std::string("value_2"));
+		objects = c.getDeviceVariableValuesSince("ups_1", token, full);
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: since unexpected changes",
+			!full && objects.empty());
+
+		// get values by prefix
+		objects = c.getDeviceVariableValuesWithPrefix("ups_1", "name_m");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: prefix wrong values",
+			objects.size() == 1 && objects.count("name_multi_1") == 1);
+		objects = c.getDeviceVariableValuesWithPrefix("ups_1", "none.");
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: prefix unexpected values",
+			objects.empty());
+
+		// generated devices and changes
+		nut::MemClientStub gen;
+		gen.populate(3, 10);
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: populate wrong values",
+			gen.getDeviceVariableValues("dev2").size() == 10
+			&& gen.getDeviceVariableValue("dev0", "var9")[0] == std::string("0"));
+		token = "0";
+		gen.getDeviceVariableValuesSince("dev1", token, full);
+		gen.mutate(30);
+		size_t changed = 0;
+		for (const auto& dev : { "dev0", "dev1", "dev2" })
+		{
+			for (const auto& var : gen.getDeviceVariableValues(dev))
+			{
+				if (var.second[0] != std::string("0"))
+					changed++;
+			}
+		}
+		CPPUNIT_ASSERT_MESSAGE(
+			"Failed stub tcp client: mutate wrong changes",
+			changed > 0 && changed <= 30);
+		objects = gen.getDeviceVariableValuesSince("dev1", token, full);
+		for (const auto& var : objects)
+		{
+			CPPUNIT_ASSERT_MESSAGE(
+				"Failed stub tcp client: since reported an unchanged value",
+				var.second[0] != std::string("0"));
+		}
 	}
 	catch(nut::NutException& ex)
 	{
@@ -543,6 +617,83 @@ void NutClientTest::test_nutclientstub_dev() {
 		!noException);
 }
 
+static_assert(variableTypeHint("battery.charge") == VariableType::NUMBER, "battery.charge is a number");
+static_assert(variableTypeHint("ups.status") == VariableType::STATUS, "ups.status is a status");
+static_assert(variableTypeHint("ups.mfr") == VariableType::STRING, "ups.mfr is text");
+
+void NutClientTest::test_typed_values() {
+	StatusFlags status = StatusFlags::parse("OB  lb DISCHRG custom");
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to parse ups.status tokens",
+		status.has(StatusFlags::OB | StatusFlags::LB | StatusFlags::DISCHRG | StatusFlags::OTHER)
+		&& !status.any(StatusFlags::OL | StatusFlags::CHRG));
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to format ups.status tokens",
+		status.toString() == "OB LB DISCHRG");
+
+	double number = -1;
+	long integer = -1;
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to parse numbers",
+		parseVariableValue(" 230.5 ", number) && number == 230.5
+		&& parseVariableValue("1200", integer) && integer == 1200);
+	CPPUNIT_ASSERT_MESSAGE(
+		"Parsed what is not a number",
+		!parseVariableValue("", number) && !parseVariableValue("12V", number)
+		&& !parseVariableValue("12.5", integer) && number == 230.5 && integer == 1200);
+
+	nut::MemClientStub c;
+	c.setDeviceVariable("ups_1", "battery.charge", "87.5");
+	c.setDeviceVariable("ups_1", "battery.runtime", "1800");
+	c.setDeviceVariable("ups_1", "ups.status", "OL CHRG");
+	c.setDeviceVariable("ups_1", "ups.mfr", "Acme");
+
+	nut::Device d(&c, "ups_1");
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to get typed values of a device",
+		d.get<double>("battery.charge") == 87.5
+		&& d.get<long>("battery.runtime") == 1800
+		&& d.get<StatusFlags>("ups.status").has(StatusFlags::OL | StatusFlags::CHRG));
+
+	bool noException = true;
+	try {
+		d.get<double>("ups.mfr");
+	}
+	catch(nut::NutException& ex)
+	{
+		NUT_UNUSED_VARIABLE(ex);
+		noException = false;
+	}
+	CPPUNIT_ASSERT_MESSAGE(
+		"Got text as a number",
+		!noException);
+
+	DeviceSnapshot snap;
+	snap.update(d);
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to read a snapshot",
+		snap.size() == 4
+		&& snap.get<double>("battery.charge") == 87.5
+		&& snap.get<long>("battery.runtime") == 1800
+		&& snap.getStatus() == StatusFlags(StatusFlags::OL | StatusFlags::CHRG)
+		&& snap.getValue("ups.mfr") && *snap.getValue("ups.mfr") == "Acme"
+		&& snap.get<double>("ups.mfr", -1.0) == -1.0
+		&& snap.get<long>("none", 7L) == 7L
+		&& !snap.has("none"));
+
+	c.setDeviceVariable("ups_1", "battery.charge", "12");
+	c.setDeviceVariable("ups_1", "ups.status", "OB LB");
+	c.setDeviceVariable("ups_1", "ups.mfr", "99");
+	snap.update(c, "ups_1");
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to update a snapshot",
+		snap.size() == 4
+		&& snap.get<double>("battery.charge") == 12
+		&& snap.get<long>("battery.charge") == 12
+		&& snap.getStatus().has(StatusFlags::OB | StatusFlags::LB)
+		&& snap.get<double>("ups.mfr") == 99);
+}
+
 } // namespace nut {}
 
 #ifdef __clang__
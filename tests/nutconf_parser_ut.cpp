@@ -30,6 +30,10 @@ using namespace nut;
 
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
 using namespace std;
 
 extern "C" {
@@ -83,10 +87,13 @@ class NutConfTest : public CppUnit::TestFixture
 		CPPUNIT_TEST( testParseBoolIntStrict );
 		CPPUNIT_TEST( testParseToken );
 		CPPUNIT_TEST( testParseTokenWithoutColon );
+		CPPUNIT_TEST( testLexLine );
 		CPPUNIT_TEST( testGenericConfigParser );
+		CPPUNIT_TEST( testGenericConfigReload );
 		CPPUNIT_TEST( testUpsmonConfigParser );
 		CPPUNIT_TEST( testNutConfConfigParser );
 		CPPUNIT_TEST( testUpsdConfigParser );
+		CPPUNIT_TEST( testLargeConfig );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -100,11 +107,14 @@ public:
 	void testParseBoolIntStrict();
 	void testParseToken();
 	void testParseTokenWithoutColon();
+	void testLexLine();
 
 	void testGenericConfigParser();
+	void testGenericConfigReload();
 	void testUpsmonConfigParser();
 	void testNutConfConfigParser();
 	void testUpsdConfigParser();
+	void testLargeConfig();
 };
 
 // Registers the fixture into the 'registry'
@@ -588,6 +598,44 @@ void NutConfTest::testParseTokenWithoutColon()
 
 }
 
+void NutConfTest::testLexLine()
+{
+	/* The single-pass lexer must see the same tokens as parseToken() */
+	static const char* src =
+		"Bonjour monde\n"
+		"[ceci]# Plouf\r\n"
+		"titi = \"tata \\\"toto\\\" \\\\ x\"\n"
+		"esc\\ aped\\=str\\#ing\\\\ = val\\\"ue#no space\n"
+		"\t  NOTIFYFLAG LOWBATT SYSLOG+WALL  \n"
+		"::1 host:port \"un:closed\n"
+		"\\\n"
+		"bad\x01char \"bad\x02too\"\n"
+		"last";
+	static const unsigned int options[] = { 0, NutParser::OPTION_IGNORE_COLON };
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+		NutParser parse(src, options[i]), lex(src, strlen(src), options[i]);
+		size_t count = 0;
+
+		for (;;) {
+			const std::vector<NutParser::TokenView>& line = lex.lexLine();
+
+			for (size_t j = 0; j < line.size(); j++, count++) {
+				NutParser::Token tok = parse.parseToken();
+
+				CPPUNIT_ASSERT_EQUAL_MESSAGE("Token type differs", tok.type, line[j].type);
+				CPPUNIT_ASSERT_EQUAL_MESSAGE("Token text differs", tok.str, lex.tokenString(line[j]));
+			}
+
+			if (line.empty() || !line.back())
+				break;
+		}
+
+		CPPUNIT_ASSERT_MESSAGE("parseToken() has more tokens", !parse.parseToken());
+		CPPUNIT_ASSERT_MESSAGE("Too few tokens seen", count > 30);
+	}
+}
+
 void NutConfTest::testGenericConfigParser()
 {
 	static const char* src =
@@ -621,6 +669,62 @@ void NutConfTest::testGenericConfigParser()
 
 }
 
+void NutConfTest::testGenericConfigReload()
+{
+	static const char* src1 =
+		"glovar1 = toto\n"
+		"[same]\n"
+		"var1 = value\n"
+		"[changed]\n"
+		"kept = 1\n"
+		"edited = \"old value\"\n"
+		"dropped = yes\n"
+		"[removed]\n"
+		"var1 = value\n";
+	static const char* src2 =
+		"glovar1 = toto\n"
+		"[added]\n"
+		"var1 = value\n"
+		"[same]\n"
+		"var1 = value\n"
+		"[changed]\n"
+		"kept = 1\n"
+		"edited = \"new value\"\n"
+		"new = entry\n";
+
+	GenericConfiguration conf;
+	conf.parseFromString(src1);
+
+	const GenericConfigSection* same = &conf.sections["same"];
+	GenericConfigDiff changes;
+
+	conf.reloadFromString(src2, changes);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong added sections", static_cast<size_t>(1), changes.addedSections.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong added section", string("added"), changes.addedSections.front());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong removed sections", static_cast<size_t>(1), changes.removedSections.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong removed section", string("removed"), changes.removedSections.front());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong changed sections", static_cast<size_t>(1), changes.changedSections.size());
+
+	const GenericConfigDiff::SectionChange& change = changes.changedSections.front();
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong changed section", string("changed"), change.name);
+	CPPUNIT_ASSERT_MESSAGE("Wrong added entries", change.addedEntries == ConfigParamList(1, "new"));
+	CPPUNIT_ASSERT_MESSAGE("Wrong removed entries", change.removedEntries == ConfigParamList(1, "dropped"));
+	CPPUNIT_ASSERT_MESSAGE("Wrong changed entries", change.changedEntries == ConfigParamList(1, "edited"));
+
+	// Now the same as a full parse, with the unchanged sections left alone
+	GenericConfiguration fresh;
+	fresh.parseFromString(src2);
+
+	CPPUNIT_ASSERT_MESSAGE("Reloaded configuration differs from the parsed one", conf.diff(fresh).empty());
+	CPPUNIT_ASSERT_MESSAGE("Unchanged section was replaced", same == &conf.sections["same"]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Cannot find changed section's edited variable", string("new value"), conf.sections["changed"]["edited"].values.front());
+
+	// Nothing more the second time
+	conf.reloadFromString(src2, changes);
+	CPPUNIT_ASSERT_MESSAGE("Reload of the same contents has changes", changes.empty());
+}
+
 void NutConfTest::testUpsmonConfigParser()
 {
 	static const char* src =
@@ -721,6 +825,54 @@ void NutConfTest::testUpsdConfigParser()
 
 }
 
+void NutConfTest::testLargeConfig()
+{
+	/* A generated ups.conf much larger than real ones: the parsing time
+	 * should only grow with its size (see it with verbose) */
+	static const size_t counts[] = { 1000, 4000, 16000 };
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		std::ostringstream src;
+
+		for (size_t n = 0; n < counts[i]; n++) {
+			src << "[ups" << n << "]\n"
+				<< "\tdriver = usbhid-ups\n"
+				<< "\tport = auto\n"
+				<< "\tdesc = \"UPS number " << n << " in rack \\\"A\\\"\"\n"
+				<< "\tpollinterval = 5\n"
+				<< "\tserial = SN" << n << "  # comment\n"
+				<< "\toverride.battery.charge.low = 20\n"
+				<< "\n";
+		}
+
+		std::string data = src.str();
+		GenericConfiguration conf;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		conf.parseFromData(data.data(), data.size());
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		if (verbose)
+			std::cerr << "Parsed " << counts[i] << " sections (" << data.size()
+				<< " bytes) in "
+				<< std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()
+				<< " us" << std::endl;
+
+		/* No global section, it is empty */
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong number of sections", counts[i], conf.sections.size());
+
+		std::ostringstream last;
+		last << "ups" << (counts[i] - 1);
+		CPPUNIT_ASSERT_MESSAGE("Cannot find the last section", conf.sections.find(last.str()) != conf.sections.end());
+
+		GenericConfigSection& section = conf.sections[last.str()];
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong number of entries", static_cast<size_t>(6), section.entries.size());
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong desc", "UPS number " + last.str().substr(3) + " in rack \"A\"", section["desc"].values.front());
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong serial", "SN" + last.str().substr(3), section["serial"].values.front());
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("Wrong override", string("20"), section["override.battery.charge.low"].values.front());
+	}
+}
+
 #ifdef __clang__
 # pragma clang diagnostic pop
 #endif
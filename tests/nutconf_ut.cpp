@@ -77,6 +77,7 @@ class NutConfigUnitTest: public CppUnit::TestFixture {
 		CPPUNIT_TEST( testUpsdConfiguration );
 		CPPUNIT_TEST( testUpsConfiguration );
 		CPPUNIT_TEST( testUpsdUsersConfiguration );
+		CPPUNIT_TEST( testMappedLoad );
 	CPPUNIT_TEST_SUITE_END();
 
 	/**
@@ -84,8 +85,19 @@ class NutConfigUnitTest: public CppUnit::TestFixture {
 	 *
 	 *  \param  config     Configuration object
 	 *  \param  file_name  Configuration file name
+	 *  \param  mode       File access mode
 	 */
-	void load(nut::Serialisable * config, const std::string & file_name);
+	void load(nut::Serialisable * config, const std::string & file_name,
+		nut::NutFile::access_t mode = nut::NutFile::READ_ONLY);
+
+	/**
+	 *  \brief  Check that a mapped file parses as a copied one does
+	 *
+	 *  \param  copied     Configuration object (loaded with READ_ONLY)
+	 *  \param  mapped     Configuration object (loaded with READ_ONLY_MAPPED)
+	 *  \param  file_name  Configuration file name
+	 */
+	void checkMapped(nut::Serialisable * copied, nut::Serialisable * mapped, const std::string & file_name);
 
 	/**
 	 *  \brief  Check configuration serialization contents
@@ -123,6 +135,9 @@ class NutConfigUnitTest: public CppUnit::TestFixture {
 	/** upsd.users test */
 	void testUpsdUsersConfiguration();
 
+	/** READ_ONLY_MAPPED loading test */
+	void testMappedLoad();
+
 	inline void setUp() override {}
 	inline void tearDown() override {}
 
@@ -133,13 +148,29 @@ class NutConfigUnitTest: public CppUnit::TestFixture {
 CPPUNIT_TEST_SUITE_REGISTRATION(NutConfigUnitTest);
 
 
-void NutConfigUnitTest::load(nut::Serialisable * config, const std::string & file_name) {
-	nut::NutFile file(file_name, nut::NutFile::READ_ONLY);
+void NutConfigUnitTest::load(nut::Serialisable * config, const std::string & file_name,
+	nut::NutFile::access_t mode)
+{
+	nut::NutFile file(file_name, mode);
 
 	CPPUNIT_ASSERT(config->parseFrom(file));
 }
 
 
+void NutConfigUnitTest::checkMapped(nut::Serialisable * copied, nut::Serialisable * mapped, const std::string & file_name) {
+	load(copied, file_name, nut::NutFile::READ_ONLY);
+	load(mapped, file_name, nut::NutFile::READ_ONLY_MAPPED);
+
+	nut::NutMemory mem;
+	std::string str;
+
+	CPPUNIT_ASSERT(copied->writeTo(mem));
+	CPPUNIT_ASSERT(nut::NutStream::NUTS_OK == mem.getString(str));
+
+	check(mapped, str);
+}
+
+
 void NutConfigUnitTest::check(const nut::Serialisable * config, const std::string & content, const bool quote_sensitive) {
 	nut::NutMemory mem;
 
@@ -392,6 +423,30 @@ void NutConfigUnitTest::testUpsConfiguration() {
 	config3.parseFromString(input3);
 	config3.setOverrideDouble(my_ups, "battery.voltage.low", 12.4);
 	check(static_cast<nut::Serialisable *>(&config3), expected3);
+
+	// Pre-decoded device views, in the order of names
+	config3.setDriver("apc", "usbhid-ups");
+	config3.setSDOrder("apc", 2);
+	config3.setNolock("apc");
+
+	nut::UpsConfiguration::DeviceList devices = config3.devices();
+	CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), devices.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("apc"), devices[0].name);
+	CPPUNIT_ASSERT_EQUAL(std::string("usbhid-ups"), devices[0].driver);
+	CPPUNIT_ASSERT_EQUAL(static_cast<long long int>(2), devices[0].sdorder);
+	CPPUNIT_ASSERT(devices[0].noLock);
+
+	const nut::UpsConfiguration::Device * dev =
+		nut::UpsConfiguration::findDevice(devices, my_ups);
+	CPPUNIT_ASSERT(nullptr != dev);
+	CPPUNIT_ASSERT_EQUAL(config3.getDriver(my_ups), dev->driver);
+	CPPUNIT_ASSERT_EQUAL(config3.getPort(my_ups), dev->port);
+	CPPUNIT_ASSERT_EQUAL(config3.getDescription(my_ups), dev->desc);
+	CPPUNIT_ASSERT_EQUAL(static_cast<long long int>(0), dev->sdorder);
+	CPPUNIT_ASSERT(!dev->noLock);
+	CPPUNIT_ASSERT_EQUAL(std::string("28.3"), dev->get("default.battery.voltage.high"));
+	CPPUNIT_ASSERT(dev->get("nosuchkey").empty());
+	CPPUNIT_ASSERT(nullptr == nut::UpsConfiguration::findDevice(devices, "nosuchups"));
 }
 
 
@@ -418,6 +473,40 @@ void NutConfigUnitTest::testUpsdUsersConfiguration() {
 		"\tupsmon primary\n"
 		"\n"
 	);
+
+	nut::UpsdUsersConfiguration::UserList users = config.users();
+	CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), users.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("admin"), users[0].name);
+	CPPUNIT_ASSERT_EQUAL(std::string("qwerty=ui"), users[0].password);
+	CPPUNIT_ASSERT(nut::ConfigParamList(1, "SET") == users[0].actions);
+	CPPUNIT_ASSERT(nut::ConfigParamList(1, "ALL") == users[0].instcmds);
+	CPPUNIT_ASSERT_EQUAL(nut::UpsdUsersConfiguration::UPSMON_UNDEF, users[0].upsmonMode);
+	CPPUNIT_ASSERT_EQUAL(std::string("upsmon"), users[1].name);
+	CPPUNIT_ASSERT(users[1].actions.empty());
+	CPPUNIT_ASSERT_EQUAL(nut::UpsdUsersConfiguration::UPSMON_PRIMARY, users[1].upsmonMode);
+}
+
+void NutConfigUnitTest::testMappedLoad() {
+	{
+		nut::NutConfiguration copied, mapped;
+		checkMapped(&copied, &mapped, ABS_TOP_SRCDIR "/conf/nut.conf.sample");
+	}
+	{
+		nut::UpsmonConfiguration copied, mapped;
+		checkMapped(&copied, &mapped, ABS_TOP_BUILDDIR "/conf/upsmon.conf.sample");
+	}
+	{
+		nut::UpsdConfiguration copied, mapped;
+		checkMapped(&copied, &mapped, ABS_TOP_SRCDIR "/conf/upsd.conf.sample");
+	}
+	{
+		nut::UpsConfiguration copied, mapped;
+		checkMapped(&copied, &mapped, ABS_TOP_SRCDIR "/conf/ups.conf.sample");
+	}
+	{
+		nut::UpsdUsersConfiguration copied, mapped;
+		checkMapped(&copied, &mapped, ABS_TOP_SRCDIR "/conf/upsd.users.sample");
+	}
 }
 
 // Implement out of class declaration to avoid
@@ -0,0 +1,237 @@
+/*  nutcooptest.c - test the cooperative tasks of the drivers
+ *  (drivers/coop.c): tasks waiting for their fd or for a timeout go on
+ *  in the order these come, and waits outside of a task block
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "coop.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef WIN32
+#include <poll.h>
+
+/* what a reader task does, and what it found */
+typedef struct {
+	int	fd;
+	long	timeout;
+	int	ret;	/* of coop_wait() */
+	char	got;
+	int	order;	/* when it was done */
+} reader_t;
+
+static int	done_count = 0;
+
+static void nested(void *arg)
+{
+	*(int *)arg = coop_in_task();
+}
+
+static void reader(void *arg)
+{
+	reader_t	*r = arg;
+	int	in_task = 0;
+
+	/* a task started from a task is a plain call, in this one */
+	coop_run(NULL, nested, &in_task);
+	if (!in_task) {
+		r->ret = -2;
+		return;
+	}
+
+	r->ret = coop_wait(r->fd, r->timeout);
+	if (r->ret > 0 && read(r->fd, &r->got, 1) != 1) {
+		r->ret = -1;
+	}
+
+	r->order = ++done_count;
+}
+
+/* a little main loop, as the one of main.c for several devices */
+static int run_loop(coop_task_t **tasks, size_t count, int feedfd, size_t feedafter)
+{
+	size_t	i, loops = 0;
+	int	busy;
+
+	do {
+		struct pollfd	fds[4];
+		struct timeval	deadline, next, now;
+		int	fd, timeout;
+
+		busy = 0;
+		timerclear(&next);
+
+		for (i = 0; i < count; i++) {
+			fds[i].fd = -1;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+
+			if (!coop_waitfor(tasks[i], &fd, &deadline)) {
+				continue;
+			}
+
+			busy = 1;
+			fds[i].fd = fd;
+			if (!timerisset(&next) || timercmp(&deadline, &next, <)) {
+				next = deadline;
+			}
+		}
+
+		if (!busy) {
+			break;
+		}
+
+		/* data for one of them, once all wait */
+		if (++loops == feedafter && write(feedfd, "x", 1) != 1) {
+			return 1;
+		}
+
+		gettimeofday(&now, NULL);
+		timeout = timercmp(&next, &now, <) ? 0
+			: (int)((next.tv_sec - now.tv_sec) * 1000 + (next.tv_usec - now.tv_usec + 999) / 1000);
+
+		if (poll(fds, (nfds_t)count, timeout) < 0) {
+			return 1;
+		}
+
+		/* each checks for itself whether it may go on */
+		for (i = 0; i < count; i++) {
+			coop_resume(tasks[i]);
+		}
+	} while (loops < 1000);
+
+	return busy;
+}
+
+static int check_tasks(void)
+{
+	int	pipe1[2], pipe2[2], res = 0;
+	reader_t	r1, r2;
+	coop_task_t	*tasks[2];
+
+	tasks[0] = coop_new();
+	tasks[1] = coop_new();
+
+	if (!tasks[0] || !tasks[1]) {
+		printf("=== %s:\tSKIP: no tasks on this system\n", __func__);
+		coop_free(tasks[0]);
+		coop_free(tasks[1]);
+		return 0;
+	}
+
+	if (pipe(pipe1) || pipe(pipe2)) {
+		fatal_with_errno(EXIT_FAILURE, "pipe");
+	}
+
+	memset(&r1, 0, sizeof(r1));
+	memset(&r2, 0, sizeof(r2));
+	r1.fd = pipe1[0];
+	r1.timeout = 200;	/* nothing comes: times out */
+	r2.fd = pipe2[0];
+	r2.timeout = 5000;	/* data comes after the first loop */
+
+	if (coop_run(tasks[0], reader, &r1) != COOP_WAITING
+	 || coop_run(tasks[1], reader, &r2) != COOP_WAITING
+	) {
+		printf("  the tasks did not wait (FAIL)\n");
+		res++;
+	}
+
+	if (coop_in_task()) {
+		printf("  still in a task after it waits (FAIL)\n");
+		res++;
+	}
+
+	if (run_loop(tasks, 2, pipe2[1], 1)) {
+		printf("  the tasks did not end (FAIL)\n");
+		res++;
+	}
+
+	if (r2.ret != 1 || r2.got != 'x' || r2.order != 1) {
+		printf("  the task with data: ret=%d order=%d (FAIL)\n", r2.ret, r2.order);
+		res++;
+	}
+
+	if (r1.ret != 0 || r1.order != 2) {
+		printf("  the task timing out: ret=%d order=%d (FAIL)\n", r1.ret, r1.order);
+		res++;
+	}
+
+	/* a task may be run again once done */
+	r1.timeout = 0;
+	if (coop_run(tasks[0], reader, &r1) == COOP_WAITING) {
+		run_loop(tasks, 1, pipe1[1], 0);
+	}
+	if (r1.ret != 0 || r1.order != 3) {
+		printf("  the task run again: ret=%d order=%d (FAIL)\n", r1.ret, r1.order);
+		res++;
+	}
+
+	coop_free(tasks[0]);
+	coop_free(tasks[1]);
+	close(pipe1[0]);
+	close(pipe1[1]);
+	close(pipe2[0]);
+	close(pipe2[1]);
+
+	return res;
+}
+
+static int check_blocking(void)
+{
+	int	fds[2], res = 0;
+
+	if (pipe(fds)) {
+		fatal_with_errno(EXIT_FAILURE, "pipe");
+	}
+
+	/* outside of a task, coop_wait() is a poll() */
+	if (coop_in_task() || coop_wait(fds[0], 10) != 0) {
+		res++;
+	}
+
+	if (write(fds[1], "y", 1) != 1 || coop_wait(fds[0], 1000) != 1) {
+		res++;
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+
+	return res;
+}
+
+#endif	/* !WIN32 */
+
+int main(void)
+{
+	int	ret = 0;
+
+#ifndef WIN32
+	ret += check_tasks();
+	ret += check_blocking();
+#else
+	printf("=== %s:\tSKIP: no tasks on this system\n", __func__);
+#endif
+
+	if (ret != 0)
+		printf("nutcooptest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
@@ -0,0 +1,122 @@
+/*  nutdesctest.c - test the descriptions of upsd (server/desc.c): those
+ *  of cmdvartab are found by any case of their name, the last of a name
+ *  wins, and they come back escaped for the wire
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "desc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* where desc_load() looks for cmdvartab (see upsd.c) */
+const char	*datapath = NULL;
+
+/* more than fit in the first table, so that it grows */
+#define TEST_VARS	300
+
+static int check_one(const char *what, const char *got, const char *want)
+{
+	if (got == NULL && want == NULL) {
+		return 0;
+	}
+
+	if (got == NULL || want == NULL || strcmp(got, want)) {
+		printf("  %s: '%s', not '%s' (FAIL)\n", what,
+			got ? got : "(null)", want ? want : "(null)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_table(void)
+{
+	char	name[SMALLBUF], want[SMALLBUF];
+	size_t	i;
+	int	res = 0;
+
+	for (i = 0; i < TEST_VARS; i++) {
+		snprintf(name, sizeof(name), "TEST.Var.%" PRIuSIZE, i);
+		snprintf(want, sizeof(want), "Test variable %" PRIuSIZE, i);
+		res += check_one(name, desc_get_var(name), want);
+	}
+
+	res += check_one("ups.status", desc_get_var("UPS.STATUS"), "UPS status (again)");
+	res += check_one("load.off", desc_get_cmd("Load.Off"), "Turn off the load");
+	res += check_one("quoted", desc_get_var("test.quoted"), "a \\\"quoted\\\" back\\\\slash");
+	res += check_one("not a variable", desc_get_var("load.off"), NULL);
+	res += check_one("unknown", desc_get_cmd("no.such.command"), NULL);
+
+	return res;
+}
+
+int main(void)
+{
+	char	dir[] = "/tmp/nutdesctest.XXXXXX", fn[SMALLBUF];
+	FILE	*f;
+	size_t	i;
+	int	ret = 0;
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	snprintf(fn, sizeof(fn), "%s/cmdvartab", dir);
+	if ((f = fopen(fn, "w")) == NULL) {
+		perror(fn);
+		return 1;
+	}
+
+	fprintf(f, "# cmdvartab for nutdesctest\n");
+	fprintf(f, "VARDESC ups.status \"UPS status\"\n");
+	fprintf(f, "CMDDESC load.off \"Turn off the load\"\n");
+	for (i = 0; i < TEST_VARS; i++) {
+		fprintf(f, "VARDESC test.var.%" PRIuSIZE " \"Test variable %" PRIuSIZE "\"\n", i, i);
+	}
+	fprintf(f, "VARDESC test.quoted \"a \\\"quoted\\\" back\\\\slash\"\n");
+	fprintf(f, "VARDESC UPS.Status \"UPS status (again)\"\n");
+	fclose(f);
+
+	datapath = dir;
+
+	/* as with LOWMEM: only read once asked */
+	desc_load_lazy();
+	if (desc_bytes() != 0) {
+		printf("lazy load: loaded already (FAIL)\n");
+		ret++;
+	}
+
+	ret += check_table();
+
+	desc_free();
+	if (desc_bytes() != 0 || desc_get_var("ups.status") != NULL) {
+		printf("desc_free: still loaded (FAIL)\n");
+		ret++;
+	}
+
+	unlink(fn);
+	rmdir(dir);
+
+	if (ret != 0)
+		printf("nutdesctest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
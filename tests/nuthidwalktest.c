@@ -0,0 +1,328 @@
+/*  nuthidwalktest.c - test the polling walks of usbhid-ups (built as for
+ *  mge-shut, with drivers/mge-hid.c): the items whose report did not
+ *  change are skipped, but not those a lookup function computes from
+ *  other variables too
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+
+/* the driver itself, for its hid_ups_walk() and the state behind it */
+#include "usbhid-ups.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A device with two feature reports, as an Eaton one has them:
+ *   1: UPS.PowerSummary.PercentLoad (8 bits)
+ *   2: UPS.Flow.[4].ConfigApparentPower (16 bits)
+ * which mge-hid.c publishes as ups.load, ups.power.nominal, and (with
+ * eaton_compute_realpower_fun(), from both) ups.realpower */
+static unsigned char	test_desc[] = {
+	0x05, 0x84,		/* Usage Page (Power Device) */
+	0x09, 0x04,		/* Usage (UPS) */
+	0xa1, 0x01,		/* Collection (Application) */
+	0x09, 0x24,		/*  Usage (PowerSummary) */
+	0xa1, 0x00,		/*  Collection (Physical) */
+	0x85, 0x01,		/*   Report ID (1) */
+	0x09, 0x35,		/*   Usage (PercentLoad) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x25, 0x64,		/*   Logical Maximum (100) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+	0xc0,			/*  End Collection */
+	0x09, 0x1e,		/*  Usage (Flow) */
+	0xa1, 0x84,		/*  Collection (index 4) */
+	0x85, 0x02,		/*   Report ID (2) */
+	0x09, 0x43,		/*   Usage (ConfigApparentPower) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x27, 0xff, 0xff, 0x00, 0x00,	/*   Logical Maximum (65535) */
+	0x75, 0x10,		/*   Report Size (16) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+	0xc0,			/*  End Collection */
+	0xc0			/* End Collection */
+};
+
+static unsigned char	test_load = 20;
+static unsigned int	test_apparent = 1000;
+static int	test_gets[3];	/* by report ID */
+
+/* ---------------------------------------------------------------------
+ * the device, as libshut would talk to it
+ */
+
+static int test_get_report(usb_dev_handle upsfd, usb_ctrl_repindex ReportId,
+	usb_ctrl_charbuf raw_buf, usb_ctrl_charbufsize ReportSize)
+{
+	NUT_UNUSED_VARIABLE(upsfd);
+
+	if (ReportId < 1 || ReportId > 2 || ReportSize < (usb_ctrl_charbufsize)ReportId + 1) {
+		return -1;
+	}
+	test_gets[ReportId]++;
+
+	raw_buf[0] = (unsigned char)ReportId;
+	if (ReportId == 1) {
+		raw_buf[1] = test_load;
+		return 2;
+	}
+	raw_buf[1] = (unsigned char)(test_apparent & 0xff);
+	raw_buf[2] = (unsigned char)(test_apparent >> 8);
+	return 3;
+}
+
+shut_communication_subdriver_t	shut_subdriver = {
+	"test",
+	"0.01",
+	NULL,
+	NULL,
+	test_get_report,
+	NULL,
+	NULL,
+	NULL
+};
+
+upsdrv_info_t	comm_upsdrv_info = {
+	"test",
+	"0.01",
+	NULL,
+	0,
+	{ NULL }
+};
+
+void libshut_update_stats(void) {}
+
+/* ---------------------------------------------------------------------
+ * what the driver sees of main.c and dstate.c: a few variables, as text
+ */
+
+int	exit_flag = 0, handling_upsdrv_shutdown = 0;
+int	do_lock_port = 1, nut_debug_level_args = 0;
+time_t	poll_interval = 0;	/* each walk gets the reports anew */
+char	*device_path = NULL;
+const char	*upsname = "test";
+const char	*progname = "nuthidwalktest";
+size_t	hosted_devices = 1;
+TYPE_FD	upsfd = ERROR_FD;
+struct ups_handler	upsh;
+
+#define TEST_VARS	16
+
+static struct {
+	char	name[SMALLBUF];
+	char	value[SMALLBUF];
+} test_vars[TEST_VARS];
+
+static size_t test_find(const char *var, int add)
+{
+	size_t	i;
+
+	for (i = 0; i < TEST_VARS; i++) {
+		if (!strcmp(test_vars[i].name, var)) {
+			return i;
+		}
+	}
+
+	for (i = 0; add && i < TEST_VARS; i++) {
+		if (!test_vars[i].name[0]) {
+			snprintf(test_vars[i].name, sizeof(test_vars[i].name), "%s", var);
+			return i;
+		}
+	}
+
+	return TEST_VARS;
+}
+
+int dstate_setinfo(const char *var, const char *fmt, ...)
+{
+	size_t	i = test_find(var, 1);
+	va_list	ap;
+
+	if (i == TEST_VARS) {
+		fatalx(EXIT_FAILURE, "Too many variables");
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(test_vars[i].value, sizeof(test_vars[i].value), fmt, ap);
+	va_end(ap);
+
+	return 1;
+}
+
+int dstate_setinfo_double(const char *var, double value, int precision)
+{
+	return dstate_setinfo(var, "%.*f", precision, value);
+}
+
+const char *dstate_getinfo(const char *var)
+{
+	size_t	i = test_find(var, 0);
+
+	return (i == TEST_VARS) ? NULL : test_vars[i].value;
+}
+
+int dstate_delinfo(const char *var)
+{
+	size_t	i = test_find(var, 0);
+
+	if (i == TEST_VARS) {
+		return 0;
+	}
+	memset(&test_vars[i], 0, sizeof(test_vars[i]));
+
+	return 1;
+}
+
+void dstate_setflags(const char *var, int flags)
+{
+	NUT_UNUSED_VARIABLE(var);
+	NUT_UNUSED_VARIABLE(flags);
+}
+
+void dstate_setaux(const char *var, long aux)
+{
+	NUT_UNUSED_VARIABLE(var);
+	NUT_UNUSED_VARIABLE(aux);
+}
+
+int dstate_addenum(const char *var, const char *fmt, ...)
+{
+	NUT_UNUSED_VARIABLE(var);
+	NUT_UNUSED_VARIABLE(fmt);
+	return 1;
+}
+
+void dstate_addcmd(const char *cmdname)
+{
+	NUT_UNUSED_VARIABLE(cmdname);
+}
+
+void dstate_dataok(void) {}
+void dstate_datastale(void) {}
+void dstate_perf_io_begin(void) {}
+void dstate_perf_io_end(void) {}
+
+void status_init(void) {}
+void status_set(const char *buf) { NUT_UNUSED_VARIABLE(buf); }
+void status_commit(void) {}
+int status_get(const char *buf) { NUT_UNUSED_VARIABLE(buf); return 0; }
+void alarm_init(void) {}
+void alarm_set(const char *buf) { NUT_UNUSED_VARIABLE(buf); }
+void alarm_commit(void) {}
+
+char *getval(const char *var) { NUT_UNUSED_VARIABLE(var); return NULL; }
+int testvar(const char *var) { NUT_UNUSED_VARIABLE(var); return 0; }
+
+void addvar(int vartype, const char *name, const char *desc)
+{
+	NUT_UNUSED_VARIABLE(vartype);
+	NUT_UNUSED_VARIABLE(name);
+	NUT_UNUSED_VARIABLE(desc);
+}
+
+void set_exit_flag(int sig) { exit_flag = sig; }
+
+int do_loop_shutdown_commands(const char *sdcmds, char **cmdused)
+{
+	NUT_UNUSED_VARIABLE(sdcmds);
+	NUT_UNUSED_VARIABLE(cmdused);
+	return STAT_INSTCMD_UNKNOWN;
+}
+
+/* ---------------------------------------------------------------------
+ * the checks
+ */
+
+/* var is expected (NULL: not to be there) */
+static int expect(const char *var, const char *expected)
+{
+	const char	*val = dstate_getinfo(var);
+
+	if (expected == NULL ? val == NULL : (val != NULL && !strcmp(val, expected))) {
+		return 0;
+	}
+
+	printf("  %s is '%s', not '%s' (FAIL)\n", var, NUT_STRARG(val), NUT_STRARG(expected));
+
+	return 1;
+}
+
+static int check_walks(void)
+{
+	int	res = 0;
+
+	subdriver = &mge_subdriver;
+	pDesc = Parse_ReportDesc(test_desc, sizeof(test_desc));
+	if (pDesc == NULL) {
+		printf("  can't parse the report descriptor (FAIL)\n");
+		return 1;
+	}
+	reportbuf = new_report_buffer(pDesc);
+
+	hid_ups_walk(HU_WALKMODE_INIT);
+	res += expect("ups.load", "20");
+	res += expect("ups.power.nominal", "1000");
+	res += expect("ups.realpower", "160");
+
+	hid_ups_walk(HU_WALKMODE_FULL_UPDATE);
+	res += expect("ups.realpower", "160");
+
+	/* the load moves, the apparent power report stays the same */
+	test_load = 50;
+	memset(test_gets, 0, sizeof(test_gets));
+	hid_ups_walk(HU_WALKMODE_FULL_UPDATE);
+	res += expect("ups.load", "50");
+	res += expect("ups.realpower", "400");
+	if (test_gets[1] != 1 || test_gets[2] != 1) {
+		printf("  the walk got the reports %i and %i times, not once (FAIL)\n",
+			test_gets[1], test_gets[2]);
+		res++;
+	}
+
+	/* an item of a report which did not change is skipped: ups.load
+	 * set aside is not published again */
+	dstate_setinfo("ups.load", "%s", "-");
+	hid_ups_walk(HU_WALKMODE_FULL_UPDATE);
+	res += expect("ups.load", "-");
+
+	/* and published once it changed */
+	test_load = 30;
+	hid_ups_walk(HU_WALKMODE_FULL_UPDATE);
+	res += expect("ups.load", "30");
+	res += expect("ups.realpower", "240");
+
+	free_report_buffer(reportbuf);
+	reportbuf = NULL;
+	Free_ReportDesc(pDesc);
+	pDesc = NULL;
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += check_walks();
+
+	if (ret != 0)
+		printf("nuthidwalktest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
@@ -0,0 +1,180 @@
+/*  nuthisttest.c - test the history of variables kept by upsd
+ *  (server/history.c): the values come back as they went in, in order,
+ *  and the oldest go once the ring is full
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "history.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_MAX	4096
+
+/* what history_walk() gave */
+typedef struct {
+	size_t	count;
+	int64_t	msec[TEST_MAX];
+	char	val[TEST_MAX][32];
+} test_walk_t;
+
+static int test_collect(void *arg, int64_t msec, const char *val)
+{
+	test_walk_t	*w = arg;
+
+	if (w->count == TEST_MAX) {
+		return 0;
+	}
+
+	w->msec[w->count] = msec;
+	snprintf(w->val[w->count], sizeof(w->val[0]), "%s", val);
+	w->count++;
+
+	return 1;
+}
+
+static void test_at(struct timeval *tv, int64_t msec)
+{
+	tv->tv_sec = (time_t)(msec / 1000);
+	tv->tv_usec = (suseconds_t)(msec % 1000) * 1000;
+}
+
+static int check_values(void)
+{
+	/* numbers, and what only looks like one */
+	static const char	*values[] = {
+		"230.1", "232.5", "-12.345", "OL CHRG", "100", "98", "1.50",
+		"007", "-0", "1.", ".5", "12345678901234567890", "0", "0.0000001", ""
+	};
+	history_t	*list = NULL;
+	test_walk_t	w;
+	struct timeval	tv;
+	size_t	i;
+	int	res = 0;
+
+	memset(&w, 0, sizeof(w));
+
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		test_at(&tv, 1700000000000LL + (int64_t)i * 1500);
+		history_record(&list, "input.voltage", values[i], &tv);
+	}
+
+	/* not one of those to keep */
+	history_record(&list, "ups.load", "20", &tv);
+	if (history_find(list, "ups.load") != NULL) {
+		printf("  ups.load was kept (FAIL)\n");
+		res++;
+	}
+
+	history_walk(history_find(list, "input.voltage"), 0, test_collect, &w);
+
+	if (w.count != sizeof(values) / sizeof(values[0])) {
+		printf("  %" PRIuSIZE " values came back (FAIL)\n", w.count);
+		res++;
+	}
+
+	for (i = 0; i < w.count; i++) {
+		if (strcmp(w.val[i], values[i]) || w.msec[i] != 1700000000000LL + (int64_t)i * 1500) {
+			printf("  value %" PRIuSIZE ": '%s' at %" PRId64 " (FAIL)\n", i, w.val[i], w.msec[i]);
+			res++;
+		}
+	}
+
+	/* only those after a time */
+	memset(&w, 0, sizeof(w));
+	history_walk(history_find(list, "input.voltage"), 1700000000000LL + 3 * 1500, test_collect, &w);
+	if (w.count != sizeof(values) / sizeof(values[0]) - 4 || strcmp(w.val[0], "100")) {
+		printf("  the values since a time are wrong (FAIL)\n");
+		res++;
+	}
+
+	history_free(list);
+
+	return res;
+}
+
+static int check_ring(void)
+{
+	history_t	*list = NULL;
+	test_walk_t	w;
+	struct timeval	tv;
+	char	val[32];
+	size_t	i, n = 3000;
+	int	res = 0;
+
+	memset(&w, 0, sizeof(w));
+
+	/* more than the ring holds, with a status now and then */
+	for (i = 0; i < n; i++) {
+		test_at(&tv, 1700000000000LL + (int64_t)i * 2000);
+		if (i % 100 == 50) {
+			snprintf(val, sizeof(val), "OB DISCHRG");
+		} else {
+			snprintf(val, sizeof(val), "%d.%d", 220 + (int)(i * 7 % 25), (int)(i % 10));
+		}
+		history_record(&list, "input.voltage", val, &tv);
+	}
+
+	history_walk(history_find(list, "input.voltage"), 0, test_collect, &w);
+
+	/* only the last ones are left (a change takes a few bytes), and are right */
+	if (w.count == 0 || w.count >= n || w.count * 8 < history_size) {
+		printf("  %" PRIuSIZE " values left (FAIL)\n", w.count);
+		res++;
+	}
+
+	for (i = 0; i < w.count; i++) {
+		size_t	j = n - w.count + i;
+
+		if (j % 100 == 50) {
+			snprintf(val, sizeof(val), "OB DISCHRG");
+		} else {
+			snprintf(val, sizeof(val), "%d.%d", 220 + (int)(j * 7 % 25), (int)(j % 10));
+		}
+
+		if (strcmp(w.val[i], val) || w.msec[i] != 1700000000000LL + (int64_t)j * 2000) {
+			printf("  value %" PRIuSIZE ": '%s', not '%s' (FAIL)\n", j, w.val[i], val);
+			res++;
+			break;
+		}
+	}
+
+	history_free(list);
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	history_add_var("input.voltage");
+	history_add_var("ups.status");
+	history_add_var("input.voltage");
+	history_size = HISTORY_SIZE_MIN;
+
+	ret += check_values();
+	ret += check_ring();
+
+	history_vars_free();
+
+	if (ret != 0)
+		printf("nuthisttest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
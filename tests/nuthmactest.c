@@ -0,0 +1,152 @@
+/*  nuthmactest.c - check SHA-256 and HMAC-SHA256 of common/nuthmac.c
+ *  against the test vectors of FIPS 180-4 and RFC 4231
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "nuthmac.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void to_hex(const unsigned char *p, size_t len, char *hex)
+{
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		snprintf(hex + i * 2, 3, "%02x", p[i]);
+	}
+}
+
+static int check_sha256(void)
+{
+	static const struct {
+		const char	*data;
+		size_t	repeat;
+		const char	*digest;
+	} vectors[] = {
+		{ "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		/* a million times "a", through more than one update */
+		{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+			10000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+		{ NULL, 0, NULL }
+	};
+	unsigned char	digest[NUT_SHA256_LEN];
+	char	hex[NUT_SHA256_LEN * 2 + 1], *data;
+	size_t	i, j, len;
+	int	res = 0;
+
+	for (i = 0; vectors[i].data; i++) {
+		len = strlen(vectors[i].data);
+		data = xmalloc(len * vectors[i].repeat + 1);
+		for (j = 0; j < vectors[i].repeat; j++) {
+			memcpy(data + j * len, vectors[i].data, len);
+		}
+
+		nut_sha256(data, len * vectors[i].repeat, digest);
+		free(data);
+
+		to_hex(digest, sizeof(digest), hex);
+		if (strcmp(hex, vectors[i].digest)) {
+			printf("  vector %" PRIuSIZE ": %s (FAIL)\n", i, hex);
+			res++;
+		}
+	}
+
+	return res;
+}
+
+static int check_hmac(void)
+{
+	/* RFC 4231 test cases 1, 2, 4, 6 and 7 */
+	static const struct {
+		const char	*key;
+		size_t	keylen;	/* of key, or key[0] that many times */
+		const char	*data;
+		const char	*mac;
+	} vectors[] = {
+		{ "\x0b", 20, "Hi There",
+			"b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+		{ "Jefe", 0, "what do ya want for nothing?",
+			"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+		{ "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19", 0,
+			"\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd"
+			"\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd"
+			"\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd\xcd",
+			"82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b" },
+		{ "\xaa", 131, "Test Using Larger Than Block-Size Key - Hash Key First",
+			"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+		{ "\xaa", 131, "This is a test using a larger than block-size key and a larger than "
+			"block-size data. The key needs to be hashed before being used by the HMAC algorithm.",
+			"9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2" },
+		{ NULL, 0, NULL, NULL }
+	};
+	unsigned char	key[256], mac[NUT_SHA256_LEN], other[NUT_SHA256_LEN];
+	char	hex[NUT_SHA256_LEN * 2 + 1];
+	size_t	i, keylen;
+	int	res = 0;
+
+	for (i = 0; vectors[i].key; i++) {
+		if (vectors[i].keylen) {
+			keylen = vectors[i].keylen;
+			memset(key, vectors[i].key[0], keylen);
+		} else {
+			keylen = strlen(vectors[i].key);
+			memcpy(key, vectors[i].key, keylen);
+		}
+
+		nut_hmac_sha256(key, keylen, vectors[i].data, strlen(vectors[i].data), mac);
+
+		to_hex(mac, sizeof(mac), hex);
+		if (strcmp(hex, vectors[i].mac)) {
+			printf("  vector %" PRIuSIZE ": %s (FAIL)\n", i, hex);
+			res++;
+		}
+	}
+
+	/* the comparison */
+	memcpy(other, mac, sizeof(mac));
+	if (!nut_hmac_equal(mac, other, sizeof(mac))) {
+		printf("  the same MACs differ (FAIL)\n");
+		res++;
+	}
+
+	other[sizeof(other) - 1] ^= 0x01;
+	if (nut_hmac_equal(mac, other, sizeof(mac))) {
+		printf("  different MACs are the same (FAIL)\n");
+		res++;
+	}
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += check_sha256();
+	ret += check_hmac();
+
+	if (ret != 0)
+		printf("nuthmactest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
@@ -87,6 +87,7 @@ class NutIPCUnitTest: public CppUnit::TestFixture {
 		CPPUNIT_TEST( testSignalSend );
 		CPPUNIT_TEST( testSignalRecvQuick );
 		CPPUNIT_TEST( testSignalRecvStaggered );
+		CPPUNIT_TEST( testSignalRecvEventLoop );
 	CPPUNIT_TEST_SUITE_END();
 
 	/**
@@ -107,6 +108,7 @@ class NutIPCUnitTest: public CppUnit::TestFixture {
 	/** Signal receiving test */
 	void testSignalRecvQuick();
 	void testSignalRecvStaggered();
+	void testSignalRecvEventLoop();
 
 	inline void setUp() override {}
 	inline void tearDown() override {}
@@ -136,6 +138,48 @@ void NutIPCUnitTest::testExec() {
 	CPPUNIT_ASSERT(123 == child.wait());
 
 	CPPUNIT_ASSERT(0 == nut::Process::execute("test 'Hello world' = 'Hello world'"));
+
+	// Output capture (more than a pipe holds, read by wait())
+	args.clear();
+	args.push_back("-c");
+	args.push_back("i=0; while [ $i -lt 20000 ]; do echo 'Hello world'; i=$((i+1)); done; echo oops >&2; exit 3");
+
+	nut::Process::Execution captured(bin, args,
+		nut::Process::Execution::CAPTURE_STDOUT | nut::Process::Execution::CAPTURE_STDERR);
+
+	CPPUNIT_ASSERT(-1 != captured.outFd());
+	CPPUNIT_ASSERT(3 == captured.wait());
+	CPPUNIT_ASSERT(captured.output().size() == 20000 * 12);
+	CPPUNIT_ASSERT(captured.output().compare(0, 12, "Hello world\n") == 0);
+	CPPUNIT_ASSERT(captured.errors() == "oops\n");
+	CPPUNIT_ASSERT(-1 == captured.outFd());
+
+	// A command which can't be run: either it is not started
+	// at all, or it exits like the shell would tell
+	bool started = true;
+	try {
+		nut::Process::Execution missing("/nonexistent/nut-ipc-test-binary");
+		CPPUNIT_ASSERT(127 == missing.wait());
+	}
+	catch (const std::runtime_error &) {
+		started = false;
+	}
+	if (verbose)
+		std::cerr << "Missing binary was " << (started ? "" : "not ") << "started" << std::endl;
+
+	// Pool of at most 2 commands at once
+	nut::Process::ExecutionPool pool(2);
+
+	pool.run(nut::Process::Executor("sleep 1"));
+	pool.run(nut::Process::Executor("false"));
+	CPPUNIT_ASSERT(pool.running() <= 2);
+
+	// Waits for the first one to make room
+	pool.run(nut::Process::Executor("true"));
+	CPPUNIT_ASSERT(pool.running() <= 2);
+
+	CPPUNIT_ASSERT(0 == pool.reap(true));
+	CPPUNIT_ASSERT(1 == pool.failed());
 #endif	/* WIN32 */
 }
 
@@ -369,6 +413,68 @@ void NutIPCUnitTest::testSignalRecvStaggered() {
 #endif	/* WIN32 */
 }
 
+void NutIPCUnitTest::testSignalRecvEventLoop() {
+#ifdef WIN32
+	/* FIXME: Needs implementation for signals via pipes */
+	std::cout << "NutIPCUnitTest::testSignalRecvEventLoop(): skipped on this platform" << std::endl;
+#else
+	// Handle signals without a thread, as an event loop would
+	nut::Signal::List signals;
+	caught_signals.clear();
+
+	signals.push_back(nut::Signal::USER1);
+	signals.push_back(nut::Signal::USER2);
+
+	nut::Signal::HandlerThread<TestSignalHandler> sig_handler(signals, false);
+	TestSignalHandler handler;
+
+	// Nothing pending: no signal, and no blocking either
+	sig_handler.dispatch(handler);
+	CPPUNIT_ASSERT(caught_signals.empty());
+
+	pid_t my_pid = nut::Process::getPID();
+
+	/* Signals sent to self are delivered before kill() returns;
+	 * the repeated ones are still pending, so they coalesce */
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER2, my_pid));
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER1, my_pid));
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER2, my_pid));
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER2, my_pid));
+
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(sig_handler.fd(), &rfds);
+
+	struct timeval tv;
+	tv.tv_sec  = 1;
+	tv.tv_usec = 0;
+
+	CPPUNIT_ASSERT(1 == ::select(sig_handler.fd() + 1, &rfds, nullptr, nullptr, &tv));
+
+	sig_handler.dispatch(handler);
+
+	// Once each, in the order of signal numbers
+	CPPUNIT_ASSERT(caught_signals.size() == 2);
+	CPPUNIT_ASSERT(caught_signals.front() == nut::Signal::USER1);
+	CPPUNIT_ASSERT(caught_signals.back() == nut::Signal::USER2);
+
+	// And the channel is quiet again
+	FD_ZERO(&rfds);
+	FD_SET(sig_handler.fd(), &rfds);
+	tv.tv_sec  = 0;
+	tv.tv_usec = 0;
+
+	CPPUNIT_ASSERT(0 == ::select(sig_handler.fd() + 1, &rfds, nullptr, nullptr, &tv));
+
+	// A later one is handled again
+	CPPUNIT_ASSERT(0 == nut::Signal::send(nut::Signal::USER2, my_pid));
+	sig_handler.dispatch(handler);
+
+	CPPUNIT_ASSERT(caught_signals.size() == 3);
+	CPPUNIT_ASSERT(caught_signals.back() == nut::Signal::USER2);
+#endif	/* WIN32 */
+}
+
 // Implement out of class declaration to avoid
 //   error: 'SomeClass' has no out-of-line virtual method
 //   definitions; its vtable will be emitted in every translation unit
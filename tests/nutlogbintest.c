@@ -0,0 +1,206 @@
+/*  nutlogbintest.c - check that the binary logs of upslog give back the
+ *  records written into them
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "upslogbin.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NCOLS	4
+#define NRECS	150
+
+static char *names[NCOLS] = {
+	"battery.charge", "input.voltage", "ups.status", "ups.temperature"
+};
+
+static time_t	when_of[NRECS];
+static char	vals_of[NRECS][NCOLS][SMALLBUF];
+static int	have_of[NRECS][NCOLS];
+
+static size_t	seen_headers, seen_records;
+static int	res;
+
+/* numbers going up and down, a switch to a different count of decimals,
+ * strings, and values missing here and there */
+static void make_records(void)
+{
+	size_t	i;
+
+	for (i = 0; i < NRECS; i++) {
+		when_of[i] = (time_t)1700000000 + (time_t)(i * 2) - ((i == 70) ? 5 : 0);
+
+		snprintf(vals_of[i][0], SMALLBUF, "%d", 100 - (int)(i % 37));
+		have_of[i][0] = 1;
+
+		if (i < 100)
+			snprintf(vals_of[i][1], SMALLBUF, "%d.%d", 228 + (int)(i % 5), (int)(i % 10));
+		else
+			snprintf(vals_of[i][1], SMALLBUF, "%d.%02d", 228, (int)(i % 100));
+		have_of[i][1] = 1;
+
+		snprintf(vals_of[i][2], SMALLBUF, "%s", (i % 20 < 15) ? "OL" : "OB DISCHRG");
+		have_of[i][2] = 1;
+
+		snprintf(vals_of[i][3], SMALLBUF, "%s", (i % 7 == 3) ? "-0" : "-3.5");
+		have_of[i][3] = (i % 3 != 0);
+	}
+}
+
+static void header_cb(void *arg, const upslog_bin_header_t *hdr)
+{
+	size_t	i;
+	NUT_UNUSED_VARIABLE(arg);
+
+	seen_headers++;
+
+	if (strcmp(hdr->format, "%VAR battery.charge%") || strcmp(hdr->upsname, "su700")
+	 || hdr->pid != 1234 || hdr->ncols != NCOLS
+	) {
+		printf("  header %" PRIuSIZE ": not what was written (FAIL)\n", seen_headers);
+		res++;
+		return;
+	}
+
+	for (i = 0; i < NCOLS; i++) {
+		if (strcmp(hdr->names[i], names[i])) {
+			printf("  header %" PRIuSIZE ": column %" PRIuSIZE " is %s (FAIL)\n",
+				seen_headers, i, hdr->names[i]);
+			res++;
+		}
+	}
+}
+
+static void record_cb(void *arg, time_t when, char **vals)
+{
+	size_t	i, n = seen_records++;
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (n >= NRECS) {
+		printf("  record %" PRIuSIZE ": one too many (FAIL)\n", n);
+		res++;
+		return;
+	}
+
+	if (when != when_of[n]) {
+		printf("  record %" PRIuSIZE ": time %ld instead of %ld (FAIL)\n",
+			n, (long)when, (long)when_of[n]);
+		res++;
+	}
+
+	for (i = 0; i < NCOLS; i++) {
+		if ((vals[i] != NULL) != (have_of[n][i] != 0)
+		 || (vals[i] && strcmp(vals[i], vals_of[n][i]))
+		) {
+			printf("  record %" PRIuSIZE ": %s is \"%s\" instead of \"%s\" (FAIL)\n",
+				n, names[i], vals[i] ? vals[i] : "(none)",
+				have_of[n][i] ? vals_of[n][i] : "(none)");
+			res++;
+		}
+	}
+}
+
+static int check_roundtrip(void)
+{
+	upslog_bin_header_t	hdr;
+	upslog_bin_t	*bin;
+	char	*row[NCOLS];
+	FILE	*f;
+	long	size;
+	size_t	i, j;
+
+	res = 0;
+	seen_headers = seen_records = 0;
+
+	if ((f = tmpfile()) == NULL) {
+		printf("=== %s:\tSKIP: no temporary file\n", __func__);
+		return 0;
+	}
+
+	hdr.format = "%VAR battery.charge%";
+	hdr.upshost = "su700@localhost";
+	hdr.upsname = "su700";
+	hdr.hostname = "testhost";
+	hdr.pid = 1234;
+	hdr.ncols = NCOLS;
+	hdr.names = names;
+
+	bin = upslog_bin_open(f, &hdr);
+
+	for (i = 0; i < NRECS; i++) {
+		for (j = 0; j < NCOLS; j++)
+			row[j] = have_of[i][j] ? vals_of[i][j] : NULL;
+
+		upslog_bin_add(bin, when_of[i], row);
+
+		/* as when the log is reopened */
+		if (i == 90)
+			upslog_bin_restart(bin, f);
+	}
+
+	upslog_bin_close(bin);
+
+	size = ftell(f);
+	rewind(f);
+
+	if (upslog_bin_read(f, header_cb, record_cb, NULL) != 0) {
+		printf("  reading failed (FAIL)\n");
+		res++;
+	}
+
+	if (seen_headers != 2 || seen_records != NRECS) {
+		printf("  %" PRIuSIZE " headers and %" PRIuSIZE " records read (FAIL)\n",
+			seen_headers, seen_records);
+		res++;
+	}
+
+	printf("  %d records take %ld bytes\n", NRECS, size);
+
+	/* a file cut short gives what it has, and says so */
+	rewind(f);
+	if (ftruncate(fileno(f), size - 3) == 0) {
+		seen_headers = seen_records = 0;
+		if (upslog_bin_read(f, NULL, record_cb, NULL) != -1
+		 || seen_records == 0 || seen_records >= NRECS
+		) {
+			printf("  cut short: %" PRIuSIZE " records read (FAIL)\n", seen_records);
+			res++;
+		}
+	}
+
+	fclose(f);
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	make_records();
+	ret += check_roundtrip();
+
+	if (ret != 0)
+		printf("nutlogbintest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
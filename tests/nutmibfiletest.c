@@ -0,0 +1,277 @@
+/*  nutmibfiletest.c - test the compiled MIB-to-NUT mapping files of
+ *  snmp-ups (drivers/snmp-ups-mibfile.c): a mapping written out reads
+ *  back the same, and damaged files are refused
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "extstate.h"
+#include "snmp-ups-mibfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static info_lkp_t test_status_info[] = {
+	info_lkp_default(1, "OL"),
+	info_lkp_default(2, "OB"),
+	info_lkp_default(3, "OL BYPASS"),
+	info_lkp_sentinel
+};
+
+static info_lkp_t test_temperature_info[] = {
+	info_lkp_fun_vp2s(0, "dummy", su_temperature_read_fun),
+	info_lkp_sentinel
+};
+
+static snmp_info_t test_info[] = {
+	snmp_info_default("ups.mfr", ST_FLAG_STRING, SU_INFOSIZE, ".1.3.6.1.2.1.33.1.1.1.0", "Test", SU_FLAG_STATIC, NULL),
+	snmp_info_default("ups.status", ST_FLAG_STRING, SU_INFOSIZE, ".1.3.6.1.2.1.33.1.4.1.0", "", SU_STATUS_PWR, test_status_info),
+	snmp_info_default("ups.temperature", 0, 0.1, ".1.3.6.1.2.1.33.1.2.7.0", NULL, SU_FLAG_OK, test_temperature_info),
+	snmp_info_default("ups.status", ST_FLAG_STRING, SU_INFOSIZE, ".1.3.6.1.2.1.33.1.2.1.0", "", SU_STATUS_BATT, test_status_info),
+	snmp_info_default("outlet.%i.desc", ST_FLAG_RW | ST_FLAG_STRING, SU_INFOSIZE, ".1.3.6.1.4.1.99.1.%i", NULL, SU_OUTLET, NULL),
+	snmp_info_sentinel
+};
+
+static alarms_info_t test_alarms[] = {
+	{ ".1.3.6.1.2.1.33.1.6.3.1", "LB", "Low battery" },
+	{ ".1.3.6.1.2.1.33.1.6.3.2", NULL, "Depleted battery" },
+	{ NULL, NULL, NULL }
+};
+
+static mib2nut_info_t test_mib = {
+	"test", "0.1", ".1.3.6.1.2.1.33.1.4.1.0", ".1.3.6.1.2.1.33.1.1.1.0",
+	test_info, ".1.3.6.1.4.1.99", test_alarms
+};
+
+static mib2nut_info_t test_mib_noalarms = {
+	"test2", "0.2", NULL, NULL, test_info, NULL, NULL
+};
+
+static int same_str(const char *a, const char *b)
+{
+	return (a == NULL || b == NULL) ? (a == b) : !strcmp(a, b);
+}
+
+/* The lookups of a and b end with a sentinel: compare them up to it */
+static int same_lkp(const info_lkp_t *a, const info_lkp_t *b)
+{
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+
+	for (; ; a++, b++) {
+		if (a->oid_value != b->oid_value || !same_str(a->info_value, b->info_value)) {
+			return 0;
+		}
+#if WITH_SNMP_LKP_FUN
+		if (a->fun_vp2s != b->fun_vp2s || a->nuf_s2l != b->nuf_s2l) {
+			return 0;
+		}
+#endif
+		if (b->info_value == NULL) {
+			return 1;
+		}
+	}
+}
+
+static int same_mib(const mib2nut_info_t *a, const mib2nut_info_t *b)
+{
+	size_t	i;
+
+	if (!same_str(a->mib_name, b->mib_name)
+	 || !same_str(a->mib_version, b->mib_version)
+	 || !same_str(a->oid_pwr_status, b->oid_pwr_status)
+	 || !same_str(a->oid_auto_check, b->oid_auto_check)
+	 || !same_str(a->sysOID, b->sysOID)
+	 || a->snmp_info == NULL
+	) {
+		return 0;
+	}
+
+	for (i = 0; b->snmp_info[i].info_type != NULL; i++) {
+		const snmp_info_t	*x = &a->snmp_info[i], *y = &b->snmp_info[i];
+
+		if (!same_str(x->info_type, y->info_type)
+		 || x->info_flags != y->info_flags
+		 || x->info_len != y->info_len
+		 || !same_str(x->OID, y->OID)
+		 || !same_str(x->dfl, y->dfl)
+		 || x->flags != y->flags
+		 || !same_lkp(x->oid2info, y->oid2info)
+		) {
+			printf("  %s: entry %" PRIuSIZE " differs (FAIL)\n", b->mib_name, i);
+			return 0;
+		}
+	}
+
+	if (a->snmp_info[i].info_type != NULL) {
+		return 0;
+	}
+
+	/* a lookup shared by entries stays one table */
+	if (a->snmp_info[1].oid2info != a->snmp_info[3].oid2info) {
+		return 0;
+	}
+
+	if (b->alarms_info == NULL) {
+		return a->alarms_info == NULL;
+	}
+
+	for (i = 0; ; i++) {
+		if (a->alarms_info == NULL
+		 || !same_str(a->alarms_info[i].OID, b->alarms_info[i].OID)
+		 || !same_str(a->alarms_info[i].status_value, b->alarms_info[i].status_value)
+		 || !same_str(a->alarms_info[i].alarm_value, b->alarms_info[i].alarm_value)
+		) {
+			return 0;
+		}
+		if (b->alarms_info[i].OID == NULL) {
+			return 1;
+		}
+	}
+}
+
+static int check_roundtrip(const char *dir)
+{
+	char	fn[LARGEBUF];
+	mib2nut_info_t	**list;
+	int	res = 0;
+
+	/* the order of the names is the order of the mappings */
+	snprintf(fn, sizeof(fn), "%s/002-test2%s", dir, SU_MIBFILE_SUFFIX);
+	if (su_mibfile_write(&test_mib_noalarms, fn) < 0) {
+		res++;
+	}
+	snprintf(fn, sizeof(fn), "%s/001-test%s", dir, SU_MIBFILE_SUFFIX);
+	if (su_mibfile_write(&test_mib, fn) < 0) {
+		res++;
+	}
+
+	list = su_mibfile_load(dir);
+	if (res || list == NULL || list[0] == NULL || list[1] == NULL || list[2] != NULL) {
+		printf("  can't write and load the files (FAIL)\n");
+		su_mibfile_free(list);
+		return 1;
+	}
+
+	/* only the header is read until the tables are mapped */
+	if (strcmp(list[0]->mib_name, "test") || strcmp(list[1]->mib_name, "test2")
+	 || list[0]->snmp_info != NULL || list[0]->alarms_info != NULL
+	) {
+		printf("  wrong headers (FAIL)\n");
+		res++;
+	}
+
+	if (su_mibfile_map(list[0]) < 0 || !same_mib(list[0], &test_mib)
+	 || su_mibfile_map(list[1]) < 0 || !same_mib(list[1], &test_mib_noalarms)
+	) {
+		printf("  the mappings read back differ (FAIL)\n");
+		res++;
+	}
+
+	/* held twice, let go of twice */
+	if (su_mibfile_map(list[0]) < 0) {
+		res++;
+	}
+	su_mibfile_unmap(list[0]);
+	if (list[0]->snmp_info == NULL) {
+		printf("  unmapped while still held (FAIL)\n");
+		res++;
+	}
+	su_mibfile_unmap(list[0]);
+	if (list[0]->snmp_info != NULL || list[0]->alarms_info != NULL) {
+		printf("  still mapped (FAIL)\n");
+		res++;
+	}
+
+	su_mibfile_free(list);
+
+	return res;
+}
+
+/* Overwrite len bytes at off of file fn */
+static void patch(const char *fn, off_t off, const void *buf, size_t len)
+{
+	int	fd = open(fn, O_WRONLY);
+
+	if (fd < 0 || lseek(fd, off, SEEK_SET) != off
+	 || write(fd, buf, len) != (ssize_t)len
+	) {
+		fatal_with_errno(EXIT_FAILURE, "Can't patch %s", fn);
+	}
+	close(fd);
+}
+
+static int check_damaged(const char *dir)
+{
+	char	fn[LARGEBUF], fn2[LARGEBUF];
+	mib2nut_info_t	**list;
+	uint32_t	bad = 0x7fffffff, swapped = 0x04030201U;
+	int	res = 0;
+
+	snprintf(fn, sizeof(fn), "%s/001-test%s", dir, SU_MIBFILE_SUFFIX);
+	snprintf(fn2, sizeof(fn2), "%s/002-test2%s", dir, SU_MIBFILE_SUFFIX);
+
+	/* a header of another byte order is refused at once... */
+	patch(fn2, (off_t)offsetof(su_mibfile_hdr_t, byteorder), &swapped, sizeof(swapped));
+
+	/* ...a string out of the file only once the tables are mapped */
+	patch(fn, (off_t)(sizeof(su_mibfile_hdr_t) + 7) / 8 * 8, &bad, sizeof(bad));
+
+	list = su_mibfile_load(dir);
+	if (list == NULL || list[0] == NULL || list[1] != NULL) {
+		printf("  the damaged header is not refused (FAIL)\n");
+		res++;
+	} else if (su_mibfile_map(list[0]) == 0 || list[0]->snmp_info != NULL) {
+		printf("  the damaged table is not refused (FAIL)\n");
+		res++;
+	}
+	su_mibfile_free(list);
+
+	unlink(fn);
+	unlink(fn2);
+
+	/* no files: the driver keeps to its built-in mappings */
+	if (su_mibfile_load(dir) != NULL) {
+		res++;
+	}
+
+	return res;
+}
+
+int main(void)
+{
+	char	dir[] = "/tmp/nutmibfiletest.XXXXXX";
+	int	ret = 0;
+
+	if (mkdtemp(dir) == NULL) {
+		fatal_with_errno(EXIT_FAILURE, "Can't create a temporary directory");
+	}
+
+	ret += check_roundtrip(dir);
+	ret += check_damaged(dir);
+
+	rmdir(dir);
+
+	if (ret != 0)
+		printf("nutmibfiletest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
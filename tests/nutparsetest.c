@@ -0,0 +1,244 @@
+/*  nutparsetest.c - check that pconf_feed() in common/parseconf.c parses
+ *  socket input exactly like pconf_char() does, and compare their speed
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "parseconf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Input which exercises all the parser states, including the ones
+ * that pconf_feed() hands over to the state machine */
+static const char *testinput =
+	"SETINFO ups.status \"OL CHRG\"\n"
+	"SETINFO device.model \"Smart-UPS 1500\"   \n"
+	"  \tSETINFO ups.id   Embedded\\ space\\\\backslash\n"
+	"SETINFO ups.mfr \"Quoted \\\"escape\\\" inside\"\n"
+	"key=value key = value \"=\" ==\n"
+	"# a comment line with \"quotes\" and \\ escapes\n"
+	"SETINFO battery.charge 100 # trailing comment\n"
+	"SETINFO joined \"quoted \\\n"
+	"continued\" plain\\\n"
+	"continued\n"
+	"\n"
+	"word\"with\"quotes tab\tseparated\r\n"
+	"SETINFO toolong "
+	"0123456789012345678901234567890123456789012345678901234567890123"
+	"0123456789012345678901234567890123456789012345678901234567890123\n"
+	"1 2 3 4 5 6 7 8 9 10 11 12\n"
+	"SETINFO broken \"unbalanced # quote\n"
+	"DUMPDONE\n"
+	"PING";
+
+/* collect every parsed line as "numargs:arg|arg|...\n" */
+static void record_line(PCONF_CTX_t *ctx, int ret, char *out, size_t outsize)
+{
+	size_t	i, len = strlen(out);
+
+	if (ret < 0) {
+		snprintf(out + len, outsize - len, "ERROR:%s\n", ctx->errmsg);
+		return;
+	}
+
+	snprintf(out + len, outsize - len, "%" PRIuSIZE ":", ctx->numargs);
+	for (i = 0; i < ctx->numargs; i++) {
+		len = strlen(out);
+		snprintf(out + len, outsize - len, "%s%s",
+			(i ? "|" : ""), ctx->arglist[i]);
+	}
+	len = strlen(out);
+	snprintf(out + len, outsize - len, "\n");
+}
+
+static void setup_ctx(PCONF_CTX_t *ctx)
+{
+	pconf_init(ctx, NULL);
+
+	/* small limits, to cover cutting words and lines short */
+	ctx->arg_limit = 8;
+	ctx->wordlen_limit = 100;
+}
+
+static void parse_by_char(const char *input, char *out, size_t outsize)
+{
+	PCONF_CTX_t	ctx;
+	size_t	i, len = strlen(input);
+	int	ret;
+
+	setup_ctx(&ctx);
+	out[0] = '\0';
+
+	for (i = 0; i < len; i++) {
+		ret = pconf_char(&ctx, input[i]);
+		if (ret != 0)
+			record_line(&ctx, ret, out, outsize);
+	}
+
+	pconf_finish(&ctx);
+}
+
+static int parse_by_feed(const char *input, size_t chunk, char *out, size_t outsize)
+{
+	PCONF_CTX_t	ctx;
+	size_t	pos, i, used, n, len = strlen(input);
+	int	ret, res = 0;
+
+	setup_ctx(&ctx);
+	out[0] = '\0';
+
+	/* the way a socket reader would get it, in chunks of a given size */
+	for (pos = 0; pos < len; pos += n) {
+		n = (len - pos < chunk ? len - pos : chunk);
+
+		for (i = 0; i < n; i += used) {
+			ret = pconf_feed(&ctx, input + pos + i, n - i, &used);
+			if (ret != 0)
+				record_line(&ctx, ret, out, outsize);
+
+			if (used > n - i || (ret == 0 && used != n - i)) {
+				printf("  chunk %" PRIuSIZE ": used %" PRIuSIZE
+					" of %" PRIuSIZE " bytes (FAIL)\n",
+					chunk, used, n - i);
+				res++;
+				break;
+			}
+
+			if (ret != 0 && used == 0) {
+				printf("  chunk %" PRIuSIZE ": no progress (FAIL)\n",
+					chunk);
+				res++;
+				break;
+			}
+		}
+	}
+
+	pconf_finish(&ctx);
+	return res;
+}
+
+static int check_feed(void)
+{
+	char	expected[LARGEBUF * 2], actual[LARGEBUF * 2];
+	size_t	chunk;
+	int	res = 0;
+
+	parse_by_char(testinput, expected, sizeof(expected));
+
+	printf("=== %s: pconf_char() parsed the test input into:\n%s",
+		__func__, expected);
+
+	for (chunk = 1; chunk <= strlen(testinput); chunk++) {
+		res += parse_by_feed(testinput, chunk, actual, sizeof(actual));
+
+		if (strcmp(expected, actual)) {
+			printf("  pconf_feed() with %" PRIuSIZE
+				" byte chunks gave:\n%s(FAIL)\n", chunk, actual);
+			res++;
+		}
+	}
+
+	printf("=== %s: pconf_feed() with all chunk sizes: %s\n",
+		__func__, (res ? "FAIL" : "OK"));
+
+	return res;
+}
+
+/* A driver replaying its state to a freshly started upsd */
+static char *make_dumpall(size_t *len)
+{
+	char	*buf;
+	size_t	i, pos = 0, size = 200 * 10 * 64;
+
+	buf = xcalloc(size, 1);
+
+	for (i = 0; i < 200 * 10; i++) {
+		pos += (size_t)snprintf(buf + pos, size - pos,
+			"SETINFO outlet.%" PRIuSIZE ".desc \"Outlet %" PRIuSIZE "\"\n",
+			i / 10 + 1, i);
+	}
+	snprintf(buf + pos, size - pos, "DUMPDONE\n");
+
+	*len = strlen(buf);
+	return buf;
+}
+
+static int bench_feed(size_t rounds)
+{
+	PCONF_CTX_t	ctx;
+	char	*dump;
+	size_t	r, pos, i, n, used, len, lines_char = 0, lines_feed = 0;
+	clock_t	start;
+	double	t_char, t_feed;
+
+	dump = make_dumpall(&len);
+
+	pconf_init(&ctx, NULL);
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < len; i++)
+			lines_char += (pconf_char(&ctx, dump[i]) == 1);
+	t_char = (double)(clock() - start) / CLOCKS_PER_SEC;
+	pconf_finish(&ctx);
+
+	pconf_init(&ctx, NULL);
+	start = clock();
+	for (r = 0; r < rounds; r++) {
+		/* SMALLBUF sized reads, like sstate_readline() */
+		for (pos = 0; pos < len; pos += n) {
+			n = (len - pos < SMALLBUF ? len - pos : SMALLBUF);
+			for (i = 0; i < n; i += used)
+				lines_feed += (pconf_feed(&ctx, dump + pos + i, n - i, &used) == 1);
+		}
+	}
+	t_feed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	pconf_finish(&ctx);
+
+	free(dump);
+
+	printf("=== %s: %" PRIuSIZE " x %" PRIuSIZE " bytes:"
+		" pconf_char %.3fs, pconf_feed %.3fs\n",
+		__func__, rounds, len, t_char, t_feed);
+
+	if (lines_char != lines_feed || lines_char != rounds * 2001) {
+		printf("  parsed %" PRIuSIZE " and %" PRIuSIZE " lines (FAIL)\n",
+			lines_char, lines_feed);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int	ret = 0;
+	size_t	rounds = 10;
+
+	/* e.g. "nutparsetest 1000" for a more meaningful benchmark */
+	if (argc > 1)
+		rounds = (size_t)strtoul(argv[1], NULL, 10);
+
+	ret += check_feed();
+	ret += bench_feed(rounds);
+
+	return (ret != 0);
+}
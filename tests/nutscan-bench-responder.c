@@ -0,0 +1,670 @@
+/*  nutscan-bench-responder.c - simulated NUT, SNMP and NetXML devices on
+ *  loopback addresses, for nutscan-bench.sh to time nut-scanner against
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* One of these on each simulated device address: the NUT port (a TCP
+ * listener and its connections), SNMP (UDP 161) and NetXML (UDP 4679),
+ * at the ports nut-scanner uses */
+#define BENCH_NUT	0
+#define BENCH_SNMP	1
+#define BENCH_XML	2
+#define BENCH_TYPES	3
+
+static const char	*bench_type_names[BENCH_TYPES] = { "nut", "snmp", "xml" };
+
+typedef struct {
+	int	fd;
+	int	type;	/* BENCH_* */
+	int	conn;	/* a NUT connection, not a listener */
+	size_t	device;	/* number of the device, for its names */
+	char	line[SMALLBUF];	/* NUT connections: what came of the line */
+	size_t	len;
+} bench_sock_t;
+
+/* Replies held back for the simulated latency; with the same delay for
+ * all, the queue is in due order */
+typedef struct bench_reply_s {
+	struct timeval	due;
+	int	fd;
+	int	conn;
+	struct sockaddr_in	to;
+	size_t	len;
+	struct bench_reply_s	*next;
+	unsigned char	data[1];
+} bench_reply_t;
+
+static bench_sock_t	*socks = NULL;
+static size_t	nsocks = 0, maxsocks = 0;
+static bench_reply_t	*queue_head = NULL, *queue_tail = NULL;
+
+static long	latency_ms = 0;
+static int	loss = 0;
+static unsigned short	nut_port = 3493;
+
+static size_t	requests[BENCH_TYPES], answers[BENCH_TYPES];
+static volatile sig_atomic_t	stop_flag = 0;
+
+/* sysObjectID.0, the MGE UPS one to answer it with (as known to the
+ * nut-scanner SNMP table), and the model OID of that MIB */
+static const unsigned char	oid_sysoid[] = { 0x2b, 6, 1, 2, 1, 1, 2, 0 };
+static const unsigned char	oid_mge[] = { 0x2b, 6, 1, 4, 1, 0x85, 0x41, 1 };
+static const unsigned char	oid_mge_model[] = { 0x2b, 6, 1, 4, 1, 0x85, 0x41, 1, 1, 1, 0 };
+
+static void set_stop_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	stop_flag = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Serve simulated devices for nut-scanner on consecutive loopback\n");
+	printf("addresses, until interrupted. The first lines on stdout tell the\n");
+	printf("address range, the number of devices and the types served.\n\n");
+	printf("Usage: %s [OPTIONS]\n\n", prog);
+	printf("  -n <count>	addresses to serve (default 256)\n");
+	printf("  -a <address>	first IPv4 loopback address (default 127.1.0.1)\n");
+	printf("  -t <types>	comma-separated among nut, snmp, xml (default all)\n");
+	printf("  -p <port>	NUT port (default 3493, SNMP and NetXML are fixed)\n");
+	printf("  -d <percent>	addresses with a device on them (default 100)\n");
+	printf("  -l <msec>	latency of the replies (default 0)\n");
+	printf("  -L <percent>	requests left without a reply (default 0)\n");
+	printf("  -s <seed>	seed of the losses (default 1)\n");
+}
+
+static bench_sock_t * add_sock(int fd, int type, int conn, size_t device)
+{
+	bench_sock_t	*s;
+
+	if (nsocks == maxsocks) {
+		maxsocks = maxsocks ? 2 * maxsocks : 1024;
+		socks = xrealloc(socks, maxsocks * sizeof(bench_sock_t));
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	s = &socks[nsocks++];
+	memset(s, 0, sizeof(bench_sock_t));
+	s->fd = fd;
+	s->type = type;
+	s->conn = conn;
+	s->device = device;
+
+	return s;
+}
+
+static void close_conn(size_t i)
+{
+	bench_reply_t	**r, *tmp;
+
+	/* its replies still due would go to whatever gets the fd next */
+	for (r = &queue_head; *r != NULL; ) {
+		if ((*r)->conn && (*r)->fd == socks[i].fd) {
+			tmp = *r;
+			*r = tmp->next;
+			free(tmp);
+		} else {
+			r = &(*r)->next;
+		}
+	}
+	for (queue_tail = queue_head; queue_tail && queue_tail->next; queue_tail = queue_tail->next)
+		;
+
+	close(socks[i].fd);
+	socks[i] = socks[--nsocks];
+}
+
+static void send_now(int fd, int conn, const struct sockaddr_in *to,
+	const unsigned char *data, size_t len)
+{
+	if (conn)
+		(void)write(fd, data, len);
+	else
+		(void)sendto(fd, data, len, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static void reply(bench_sock_t *s, const struct sockaddr_in *to,
+	const unsigned char *data, size_t len)
+{
+	bench_reply_t	*r;
+
+	if (latency_ms <= 0) {
+		send_now(s->fd, s->conn, to, data, len);
+		return;
+	}
+
+	r = xcalloc(1, sizeof(bench_reply_t) + len);
+	gettimeofday(&r->due, NULL);
+	r->due.tv_sec += latency_ms / 1000;
+	r->due.tv_usec += (latency_ms % 1000) * 1000;
+	if (r->due.tv_usec >= 1000000) {
+		r->due.tv_sec++;
+		r->due.tv_usec -= 1000000;
+	}
+	r->fd = s->fd;
+	r->conn = s->conn;
+	if (to)
+		r->to = *to;
+	r->len = len;
+	memcpy(r->data, data, len);
+
+	if (queue_tail)
+		queue_tail->next = r;
+	else
+		queue_head = r;
+	queue_tail = r;
+}
+
+/* Send the replies which are due; the milliseconds until the next one
+ * is, or -1 if none is waiting */
+static int send_due(void)
+{
+	struct timeval	now;
+	bench_reply_t	*r;
+	double	wait;
+
+	gettimeofday(&now, NULL);
+
+	while ((r = queue_head) != NULL) {
+		wait = difftimeval(r->due, now);
+		if (wait > 0)
+			return (int)(wait * 1000.0) + 1;
+
+		send_now(r->fd, r->conn, &r->to, r->data, r->len);
+		queue_head = r->next;
+		if (!queue_head)
+			queue_tail = NULL;
+		free(r);
+	}
+
+	return -1;
+}
+
+static int lost(void)
+{
+	return loss > 0 && rand() % 100 < loss;
+}
+
+/* NUT: just enough of the protocol for nut-scanner to list the device */
+static void nut_line(bench_sock_t *s, const char *line)
+{
+	char	buf[SMALLBUF];
+
+	if (!strcmp(line, "LIST UPS")) {
+		requests[BENCH_NUT]++;
+		if (lost())
+			return;
+		answers[BENCH_NUT]++;
+		snprintf(buf, sizeof(buf),
+			"BEGIN LIST UPS\nUPS bench%" PRIuSIZE " \"Simulated device %" PRIuSIZE "\"\nEND LIST UPS\n",
+			s->device, s->device);
+	} else if (!strcmp(line, "STARTTLS")) {
+		snprintf(buf, sizeof(buf), "ERR FEATURE-NOT-CONFIGURED\n");
+	} else if (!strcmp(line, "LOGOUT")) {
+		snprintf(buf, sizeof(buf), "OK Goodbye\n");
+		send_now(s->fd, 1, NULL, (unsigned char *)buf, strlen(buf));
+		return;
+	} else {
+		snprintf(buf, sizeof(buf), "ERR UNKNOWN-COMMAND\n");
+	}
+
+	reply(s, NULL, (unsigned char *)buf, strlen(buf));
+}
+
+/* Read what came on a NUT connection; 0 once it is closed */
+static int nut_read(bench_sock_t *s)
+{
+	ssize_t	ret;
+	char	*eol;
+
+	ret = read(s->fd, s->line + s->len, sizeof(s->line) - 1 - s->len);
+	if (ret <= 0)
+		return (ret < 0 && errno == EAGAIN);
+
+	s->len += (size_t)ret;
+	s->line[s->len] = '\0';
+
+	while ((eol = strchr(s->line, '\n')) != NULL) {
+		*eol = '\0';
+		if (eol > s->line && eol[-1] == '\r')
+			eol[-1] = '\0';
+
+		if (!strcmp(s->line, "LOGOUT")) {
+			nut_line(s, s->line);
+			return 0;
+		}
+		nut_line(s, s->line);
+
+		s->len -= (size_t)(eol + 1 - s->line);
+		memmove(s->line, eol + 1, s->len + 1);
+	}
+
+	/* no client of ours sends such lines */
+	if (s->len >= sizeof(s->line) - 1)
+		return 0;
+
+	return 1;
+}
+
+/* BER: the tag and length of the element at *pos, which then points at
+ * its contents; 0 if fine */
+static int ber_get(const unsigned char *p, size_t end, size_t *pos,
+	unsigned char *tag, size_t *len)
+{
+	size_t	n, i;
+
+	if (*pos + 2 > end)
+		return -1;
+
+	*tag = p[(*pos)++];
+	n = p[(*pos)++];
+	if (n & 0x80) {
+		i = n & 0x7F;
+		if (i < 1 || i > 2 || *pos + i > end)
+			return -1;
+		for (n = 0; i > 0; i--)
+			n = (n << 8) | p[(*pos)++];
+	}
+
+	if (*pos + n > end)
+		return -1;
+
+	*len = n;
+	return 0;
+}
+
+/* BER: write a whole element, returning its size */
+static size_t ber_put(unsigned char *out, unsigned char tag, const unsigned char *val, size_t len)
+{
+	size_t	n = 0;
+
+	out[n++] = tag;
+	if (len < 0x80) {
+		out[n++] = (unsigned char)len;
+	} else if (len < 0x100) {
+		out[n++] = 0x81;
+		out[n++] = (unsigned char)len;
+	} else {
+		out[n++] = 0x82;
+		out[n++] = (unsigned char)(len >> 8);
+		out[n++] = (unsigned char)(len & 0xFF);
+	}
+
+	if (len)
+		memmove(out + n, val, len);
+
+	return n + len;
+}
+
+/* SNMP: answer a v1 or v2c GET of sysObjectID.0 (or of the model) */
+static void snmp_request(bench_sock_t *s, const struct sockaddr_in *from,
+	const unsigned char *p, size_t end)
+{
+	size_t	pos = 0, len, vpos, vlen, cpos, clen, rpos, rlen, opos, olen, n;
+	unsigned char	tag, val[SMALLBUF], vb[SMALLBUF], pdu[SMALLBUF], msg[LARGEBUF];
+	unsigned char	status[3] = { 0x02, 0x01, 0x00 }, index[3] = { 0x02, 0x01, 0x00 };
+	const char	*model = "Simulated device";
+
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0x30)
+		return;
+	end = pos + len;
+
+	if (ber_get(p, end, &pos, &tag, &vlen) || tag != 0x02)
+		return;
+	vpos = pos - 2;
+	pos += vlen;
+	vlen += 2;
+
+	if (ber_get(p, end, &pos, &tag, &clen) || tag != 0x04 || clen > 0x7F)
+		return;
+	cpos = pos - 2;
+	pos += clen;
+	clen += 2;
+
+	/* GetRequest-PDU, with one variable */
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0xA0)
+		return;
+
+	if (ber_get(p, end, &pos, &tag, &rlen) || tag != 0x02 || rlen > 0x7F)
+		return;
+	rpos = pos - 2;
+	pos += rlen;
+	rlen += 2;
+
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0x02)
+		return;
+	pos += len;
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0x02)
+		return;
+	pos += len;
+
+	if (ber_get(p, end, &pos, &tag, &len) || tag != 0x30
+	 || ber_get(p, end, &pos, &tag, &len) || tag != 0x30
+	 || ber_get(p, end, &pos, &tag, &olen) || tag != 0x06 || olen > 0x7F
+	)
+		return;
+	opos = pos;
+
+	requests[BENCH_SNMP]++;
+	if (lost())
+		return;
+	answers[BENCH_SNMP]++;
+
+	n = ber_put(vb, 0x06, p + opos, olen);
+	if (olen == sizeof(oid_sysoid) && !memcmp(p + opos, oid_sysoid, olen)) {
+		n += ber_put(vb + n, 0x06, oid_mge, sizeof(oid_mge));
+	} else if (olen == sizeof(oid_mge_model) && !memcmp(p + opos, oid_mge_model, olen)) {
+		n += ber_put(vb + n, 0x04, (const unsigned char *)model, strlen(model));
+	} else if (p[vpos + 2] == 0) {
+		/* v1: noSuchName */
+		n += ber_put(vb + n, 0x05, NULL, 0);
+		status[2] = 2;
+		index[2] = 1;
+	} else {
+		/* v2c: noSuchObject */
+		n += ber_put(vb + n, 0x80, NULL, 0);
+	}
+
+	/* varbind list, then the GetResponse-PDU around it */
+	len = ber_put(val, 0x30, vb, n);
+	n = ber_put(vb, 0x30, val, len);
+
+	memcpy(val, p + rpos, rlen);
+	len = rlen;
+	memcpy(val + len, status, 3);
+	len += 3;
+	memcpy(val + len, index, 3);
+	len += 3;
+	memcpy(val + len, vb, n);
+	len += n;
+	n = ber_put(pdu, 0xA2, val, len);
+
+	memcpy(msg, p + vpos, vlen);
+	len = vlen;
+	memcpy(msg + len, p + cpos, clen);
+	len += clen;
+	memcpy(msg + len, pdu, n);
+	len += n;
+	memcpy(pdu, msg, len);
+	n = ber_put(msg, 0x30, pdu, len);
+
+	reply(s, from, msg, n);
+}
+
+/* NetXML: the answer of a device to the scan request */
+static void xml_request(bench_sock_t *s, const struct sockaddr_in *from,
+	const unsigned char *p, size_t len)
+{
+	char	buf[SMALLBUF];
+
+	if (len < 14 || memcmp(p, "<SCAN_REQUEST", 13))
+		return;
+
+	requests[BENCH_XML]++;
+	if (lost())
+		return;
+	answers[BENCH_XML]++;
+
+	snprintf(buf, sizeof(buf),
+		"<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>"
+		"<SCAN_ANSWER><DEVICE name=\"bench%" PRIuSIZE "\" type=\"Simulated device\""
+		" version=\"3\"/></SCAN_ANSWER>", s->device);
+
+	reply(s, from, (unsigned char *)buf, strlen(buf));
+}
+
+static void udp_read(bench_sock_t *s)
+{
+	unsigned char	buf[LARGEBUF];
+	struct sockaddr_in	from;
+	socklen_t	fromlen = sizeof(from);
+	ssize_t	ret;
+
+	while ((ret = recvfrom(s->fd, buf, sizeof(buf), 0,
+		(struct sockaddr *)&from, &fromlen)) > 0
+	) {
+		if (s->type == BENCH_SNMP)
+			snmp_request(s, &from, buf, (size_t)ret);
+		else
+			xml_request(s, &from, buf, (size_t)ret);
+		fromlen = sizeof(from);
+	}
+}
+
+/* Bind a socket of that type on addr; -1 if that can not be done */
+static int bench_bind(int type, struct in_addr addr)
+{
+	struct sockaddr_in	sin;
+	int	fd, on = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr = addr;
+	sin.sin_port = htons(type == BENCH_NUT ? nut_port : (type == BENCH_SNMP ? 161 : 4679));
+
+	if ((fd = socket(AF_INET, type == BENCH_NUT ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on));
+
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0
+	 || (type == BENCH_NUT && listen(fd, 64) < 0)
+	) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	size_t	count = 256, devices = 0, i, n;
+	int	density = 100, types[BENCH_TYPES] = { 1, 1, 1 };
+	int	i_type, fd, timeout, opt;
+	unsigned int	seed = 1;
+	struct in_addr	first, addr;
+	char	*tok, *saveptr = NULL, buf[SMALLBUF];
+	struct pollfd	*pfd = NULL;
+	size_t	maxpfd = 0;
+	struct rlimit	nofile;
+	struct sigaction	sa;
+	bench_reply_t	*r;
+
+	inet_pton(AF_INET, "127.1.0.1", &first);
+
+	while ((opt = getopt(argc, argv, "n:a:t:p:d:l:L:s:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'a':
+				if (inet_pton(AF_INET, optarg, &first) != 1)
+					fatalx(EXIT_FAILURE, "Invalid address: %s", optarg);
+				break;
+			case 't':
+				memset(types, 0, sizeof(types));
+				snprintf(buf, sizeof(buf), "%s", optarg);
+				for (tok = strtok_r(buf, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+					for (i_type = 0; i_type < BENCH_TYPES; i_type++) {
+						if (!strcmp(tok, bench_type_names[i_type]))
+							break;
+					}
+					if (i_type == BENCH_TYPES)
+						fatalx(EXIT_FAILURE, "Unknown type: %s", tok);
+					types[i_type] = 1;
+				}
+				break;
+			case 'p':
+				nut_port = (unsigned short)atoi(optarg);
+				break;
+			case 'd':
+				density = atoi(optarg);
+				break;
+			case 'l':
+				latency_ms = atol(optarg);
+				break;
+			case 'L':
+				loss = atoi(optarg);
+				break;
+			case 's':
+				seed = (unsigned int)strtoul(optarg, NULL, 10);
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (count < 1 || density < 0 || density > 100 || loss < 0 || loss > 100)
+		fatalx(EXIT_FAILURE, "Invalid arguments, see -h");
+
+	/* up to one socket per type and address, and the connections */
+	if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+		nofile.rlim_cur = nofile.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &nofile);
+	}
+
+	srand(seed);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = set_stop_flag;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	for (i = 0; i < count; i++) {
+		/* spread the devices evenly over the addresses */
+		if (((i + 1) * (size_t)density) / 100 == (i * (size_t)density) / 100)
+			continue;
+
+		addr.s_addr = htonl(ntohl(first.s_addr) + (uint32_t)i);
+		devices++;
+
+		for (i_type = 0; i_type < BENCH_TYPES; i_type++) {
+			if (!types[i_type])
+				continue;
+
+			if ((fd = bench_bind(i_type, addr)) < 0) {
+				upslog_with_errno(LOG_WARNING, "Can not serve %s on %s, skipping that type",
+					bench_type_names[i_type], inet_ntop(AF_INET, &addr, buf, sizeof(buf)));
+				types[i_type] = 0;
+
+				/* drop what was set up for it already */
+				for (n = 0; n < nsocks; ) {
+					if (socks[n].type == i_type) {
+						close(socks[n].fd);
+						socks[n] = socks[--nsocks];
+					} else {
+						n++;
+					}
+				}
+				continue;
+			}
+
+			add_sock(fd, i_type, 0, i);
+		}
+	}
+
+	printf("RANGE %s", inet_ntop(AF_INET, &first, buf, sizeof(buf)));
+	addr.s_addr = htonl(ntohl(first.s_addr) + (uint32_t)(count - 1));
+	printf(" %s\n", inet_ntop(AF_INET, &addr, buf, sizeof(buf)));
+	printf("DEVICES %" PRIuSIZE "\n", devices);
+	printf("READY");
+	for (i_type = 0; i_type < BENCH_TYPES; i_type++) {
+		if (types[i_type])
+			printf(" %s", bench_type_names[i_type]);
+	}
+	printf("\n");
+	fflush(stdout);
+
+	while (!stop_flag) {
+		timeout = send_due();
+		if (timeout < 0 || timeout > 100)
+			timeout = 100;
+
+		if (maxpfd < nsocks) {
+			maxpfd = maxsocks;
+			pfd = xrealloc(pfd, maxpfd * sizeof(struct pollfd));
+		}
+		for (i = 0; i < nsocks; i++) {
+			pfd[i].fd = socks[i].fd;
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+
+		if (poll(pfd, (nfds_t)nsocks, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		/* backwards, as closed connections are replaced by the last */
+		for (n = nsocks; n > 0; n--) {
+			i = n - 1;
+			if (i >= nsocks || !pfd[i].revents || pfd[i].fd != socks[i].fd)
+				continue;
+
+			if (socks[i].conn) {
+				if (!nut_read(&socks[i]))
+					close_conn(i);
+			} else if (socks[i].type == BENCH_NUT) {
+				while ((fd = accept(socks[i].fd, NULL, NULL)) >= 0) {
+					add_sock(fd, BENCH_NUT, 1, socks[i].device);
+				}
+			} else {
+				udp_read(&socks[i]);
+			}
+		}
+	}
+
+	for (i_type = 0; i_type < BENCH_TYPES; i_type++) {
+		if (types[i_type]) {
+			fprintf(stderr, "%s: %" PRIuSIZE " requests, %" PRIuSIZE " answered\n",
+				bench_type_names[i_type], requests[i_type], answers[i_type]);
+		}
+	}
+
+	while (nsocks > 0)
+		close(socks[--nsocks].fd);
+	while ((r = queue_head) != NULL) {
+		queue_head = r->next;
+		free(r);
+	}
+	free(socks);
+	free(pfd);
+
+	return EXIT_SUCCESS;
+}
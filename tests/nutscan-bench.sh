@@ -0,0 +1,192 @@
+#!/bin/sh
+
+# Benchmark of nut-scanner against simulated devices: nutscan-bench-responder
+# serves NUT, SNMP and NetXML devices on a range of loopback addresses, and
+# each scan type is timed over that range in turn. Reported for each type:
+# addresses probed per second, the time to the first and to the last result,
+# how many of the devices were found, and the peak numbers of threads and
+# of open files of nut-scanner (sampled from /proc, where there is one).
+#
+# Run it with `make check-nutscan-bench` in the tests directory, or directly
+# from there after building nut-scanner and nutscan-bench-responder. Caller
+# can export envvars to change the setup, e.g.:
+#	NUT_SCANNER=...	the nut-scanner program to time
+#	BENCH_RESPONDER=...	the responder program
+#	BENCH_COUNT=1024	addresses in the range
+#	BENCH_DENSITY=10	percentage of them with a device
+#	BENCH_LATENCY=0	latency of the replies, in milliseconds
+#	BENCH_LOSS=0	percentage of the requests left without a reply
+#	BENCH_TYPES="nut snmp xml"	the scans to run; SNMP needs to bind the
+#			UDP port 161 (root), it is skipped when that fails
+#	BENCH_TIMEOUT=1	nut-scanner timeout (-t), in seconds
+#	BENCH_THREADS=	nut-scanner thread limit (-T), if not its default
+#	BENCH_PORT=13493	NUT port of the simulated devices
+#	BENCH_FIRST=127.1.0.1	first address of the range
+#
+# Any 127.x.y.z address can be used right away on Linux; other systems
+# may need them configured as loopback aliases first.
+#
+# Design note: written with dumbed-down POSIX shell syntax, like NIT; the
+# sub-second timings need a `date` which knows `%N` and a `sleep` which
+# takes fractions (GNU, busybox).
+#
+# License: GPLv2+
+
+[ -n "${NUT_SCANNER-}" ] || NUT_SCANNER="`pwd`/../tools/nut-scanner/nut-scanner"
+[ -n "${BENCH_RESPONDER-}" ] || BENCH_RESPONDER="`pwd`/nutscan-bench-responder"
+[ -n "${BENCH_COUNT-}" ] || BENCH_COUNT=1024
+[ -n "${BENCH_DENSITY-}" ] || BENCH_DENSITY=10
+[ -n "${BENCH_LATENCY-}" ] || BENCH_LATENCY=0
+[ -n "${BENCH_LOSS-}" ] || BENCH_LOSS=0
+[ -n "${BENCH_TYPES-}" ] || BENCH_TYPES="nut snmp xml"
+[ -n "${BENCH_TIMEOUT-}" ] || BENCH_TIMEOUT=1
+[ -n "${BENCH_PORT-}" ] || BENCH_PORT=13493
+[ -n "${BENCH_FIRST-}" ] || BENCH_FIRST=127.1.0.1
+
+die() {
+	echo "FATAL: $*" >&2
+	exit 1
+}
+
+for P in "$NUT_SCANNER" "$BENCH_RESPONDER" ; do
+	[ -x "$P" ] || die "$P is not built, see the comments in $0"
+done
+
+BENCHDIR="`mktemp -d "${TMPDIR:-/tmp}/nutscan-bench.XXXXXX"`" \
+|| die "Can not create a temporary directory"
+
+RESPONDER_PID=""
+cleanup() {
+	if [ -n "$RESPONDER_PID" ] ; then
+		kill "$RESPONDER_PID" 2>/dev/null
+		wait "$RESPONDER_PID" 2>/dev/null
+		sed 's/^/Responder: /' < "$BENCHDIR/responder.err"
+	fi
+	rm -rf "$BENCHDIR"
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+now() {
+	date +%s.%N | sed 's/\.N$//'
+}
+
+# Only those which are not zombies yet
+running() {
+	[ -r "/proc/$1/status" ] && ! grep '^State:.*Z' "/proc/$1/status" >/dev/null 2>&1
+}
+
+# Start the simulated devices and wait for them to be ready
+"$BENCH_RESPONDER" -n "$BENCH_COUNT" -a "$BENCH_FIRST" -p "$BENCH_PORT" \
+	-d "$BENCH_DENSITY" -l "$BENCH_LATENCY" -L "$BENCH_LOSS" \
+	-t "`echo $BENCH_TYPES | tr ' ' ','`" \
+	> "$BENCHDIR/responder.out" 2> "$BENCHDIR/responder.err" &
+RESPONDER_PID=$!
+
+COUNTDOWN=100
+while ! grep '^READY' "$BENCHDIR/responder.out" >/dev/null 2>&1 ; do
+	if ! kill -0 "$RESPONDER_PID" 2>/dev/null || [ "$COUNTDOWN" -le 0 ] ; then
+		cat "$BENCHDIR/responder.err" >&2
+		RESPONDER_PID=""
+		die "The responder did not start"
+	fi
+	COUNTDOWN="`expr $COUNTDOWN - 1`"
+	sleep 0.1 2>/dev/null || sleep 1
+done
+
+read X RANGE_FIRST RANGE_LAST < "$BENCHDIR/responder.out"
+DEVICES="`sed -n 's/^DEVICES //p' "$BENCHDIR/responder.out"`"
+SERVED="`sed -n 's/^READY *//p' "$BENCHDIR/responder.out"`"
+AVAILABLE="`"$NUT_SCANNER" -a 2>/dev/null | tr '\n' ' '`"
+
+echo "Scanning $BENCH_COUNT addresses ($RANGE_FIRST - $RANGE_LAST) with $DEVICES devices,"
+echo "latency ${BENCH_LATENCY}ms, loss ${BENCH_LOSS}%, timeout ${BENCH_TIMEOUT}s${BENCH_THREADS:+, $BENCH_THREADS threads}"
+echo ""
+printf '%-6s %8s %10s %10s %10s %12s %12s\n' \
+	"TYPE" "FOUND" "TOTAL(s)" "FIRST(s)" "PROBES/s" "PEAK_THREADS" "PEAK_FDS"
+
+RES=0
+for TYPE in $BENCH_TYPES ; do
+	case " $SERVED " in
+		*" $TYPE "*) ;;
+		*)	printf '%-6s %s\n' "$TYPE" "(skipped, the responder could not serve it)"
+			continue ;;
+	esac
+
+	case "$TYPE" in
+		nut)	SCAN="-O -p $BENCH_PORT" ; BUS="OLDNUT" ;;
+		snmp)	SCAN="-S" ; BUS="SNMP" ;;
+		xml)	SCAN="-M" ; BUS="XML" ;;
+		*)	die "Unknown scan type: $TYPE" ;;
+	esac
+
+	case " $AVAILABLE " in
+		*" $BUS "*) ;;
+		*)	printf '%-6s %s\n' "$TYPE" "(skipped, the library for it is not available to nut-scanner)"
+			continue ;;
+	esac
+
+	# Stream the results as JSON lines (one per device), noting when
+	# the first one comes
+	FIFO="$BENCHDIR/$TYPE.fifo"
+	rm -f "$FIFO" "$BENCHDIR/first" "$BENCHDIR/found"
+	mkfifo "$FIFO" || die "Can not create $FIFO"
+
+	( N=0
+	  while IFS= read -r LINE ; do
+		case "$LINE" in
+			"{"*) ;;
+			*) continue ;;
+		esac
+		[ "$N" -gt 0 ] || now > "$BENCHDIR/first"
+		N="`expr $N + 1`"
+	  done
+	  echo "$N" > "$BENCHDIR/found"
+	) < "$FIFO" &
+	READER_PID=$!
+
+	START="`now`"
+	# shellcheck disable=SC2086
+	"$NUT_SCANNER" $SCAN -s "$RANGE_FIRST" -e "$RANGE_LAST" -t "$BENCH_TIMEOUT" \
+		${BENCH_THREADS:+-T "$BENCH_THREADS"} -J -F -q \
+		> "$FIFO" 2> "$BENCHDIR/$TYPE.err" &
+	SCANNER_PID=$!
+
+	PEAK_THREADS=0
+	PEAK_FDS=0
+	while running "$SCANNER_PID" ; do
+		T="`sed -n 's/^Threads:[[:space:]]*//p' "/proc/$SCANNER_PID/status" 2>/dev/null`"
+		F="`ls "/proc/$SCANNER_PID/fd" 2>/dev/null | wc -l`"
+		[ -n "$T" ] && [ "$T" -gt "$PEAK_THREADS" ] && PEAK_THREADS="$T"
+		[ -n "$F" ] && [ "$F" -gt "$PEAK_FDS" ] && PEAK_FDS="$F"
+		sleep 0.05 2>/dev/null || sleep 1
+	done
+	[ -r "/proc/self/status" ] || { PEAK_THREADS="-" ; PEAK_FDS="-" ; }
+
+	wait "$SCANNER_PID"
+	SCANNER_RES=$?
+	END="`now`"
+	wait "$READER_PID"
+
+	if [ "$SCANNER_RES" != 0 ] ; then
+		printf '%-6s %s\n' "$TYPE" "(nut-scanner failed with code $SCANNER_RES)"
+		sed 's/^/    /' < "$BENCHDIR/$TYPE.err"
+		RES=1
+		continue
+	fi
+
+	FOUND="`cat "$BENCHDIR/found" 2>/dev/null`"
+	FIRST="-"
+	[ -s "$BENCHDIR/first" ] && FIRST="`cat "$BENCHDIR/first"`"
+
+	awk -v type="$TYPE" -v found="${FOUND:-0}/$DEVICES" -v start="$START" \
+		-v end="$END" -v first="$FIRST" -v count="$BENCH_COUNT" \
+		-v threads="$PEAK_THREADS" -v fds="$PEAK_FDS" 'BEGIN {
+		total = end - start
+		printf "%-6s %8s %10.3f %10s %10.0f %12s %12s\n", type, found, total,
+			(first == "-" ? "-" : sprintf("%.3f", first - start)),
+			(total > 0 ? count / total : 0), threads, fds
+	}'
+done
+
+exit $RES
@@ -0,0 +1,740 @@
+/*  nutstatetest.c - test the st_tree_t state store in common/state.c
+ *  (and its interned variable names),
+ *  and compare its lookup speed to a plain (unbalanced) binary tree;
+ *  also check the shared memory export of driver values (shmstate.c)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "state.h"
+#include "shmstate.h"
+#include "parseconf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A PDU with 200 outlets, 10 variables each, as a driver would add them */
+#define NUM_OUTLETS	200
+static const char *outlet_vars[] = {
+	"id", "desc", "status", "switchable", "current", "power",
+	"realpower", "voltage", "delay.shutdown", "delay.start",
+	NULL
+};
+
+static char	**names = NULL;
+static size_t	numnames = 0;
+
+static void make_names(void)
+{
+	size_t	i, j, n = 0;
+	char	buf[SMALLBUF];
+
+	for (j = 0; outlet_vars[j]; j++)
+		;
+
+	numnames = NUM_OUTLETS * j;
+	names = xcalloc(numnames, sizeof(*names));
+
+	for (i = 1; i <= NUM_OUTLETS; i++) {
+		for (j = 0; outlet_vars[j]; j++) {
+			snprintf(buf, sizeof(buf), "outlet.%" PRIuSIZE ".%s", i, outlet_vars[j]);
+			names[n++] = xstrdup(buf);
+		}
+	}
+}
+
+/* walk the tree in order, check sorting, heights and balance;
+ * returns the number of nodes or -1 on failure */
+static long check_node(const st_tree_t *node, const char **last, int *height)
+{
+	long	nl, nr;
+	int	hl = 0, hr = 0;
+
+	if (!node) {
+		*height = 0;
+		return 0;
+	}
+
+	if ((nl = check_node(node->left, last, &hl)) < 0)
+		return -1;
+
+	if (*last && strcasecmp(*last, node->var) >= 0) {
+		printf("  [%s] sorted after [%s] (FAIL)\n", node->var, *last);
+		return -1;
+	}
+	*last = node->var;
+
+	if ((nr = check_node(node->right, last, &hr)) < 0)
+		return -1;
+
+	*height = (hl > hr ? hl : hr) + 1;
+	if (node->height != *height || hl - hr > 1 || hr - hl > 1) {
+		printf("  [%s] height %d (expected %d), subtrees %d and %d (FAIL)\n",
+			node->var, node->height, *height, hl, hr);
+		return -1;
+	}
+
+	return nl + nr + 1;
+}
+
+static int check_tree(const st_tree_t *root, long expected)
+{
+	const char	*last = NULL;
+	int	height = 0;
+	long	n = check_node(root, &last, &height);
+
+	printf("  %ld nodes, height %d: ", n, height);
+	if (n != expected) {
+		printf("expected %ld nodes (FAIL)\n", expected);
+		return 1;
+	}
+
+	printf("OK\n");
+	return 0;
+}
+
+static int check_state_tree(st_tree_t **root)
+{
+	size_t	i;
+	long	n = 0;
+	int	res = 0;
+	char	buf[SMALLBUF];
+
+	printf("=== %s: adding %" PRIuSIZE " variables in driver order\n",
+		__func__, numnames);
+	for (i = 0; i < numnames; i++) {
+		snprintf(buf, sizeof(buf), "%" PRIuSIZE, i);
+		if (state_setinfo(root, names[i], buf) != 1) {
+			printf("  could not add [%s] (FAIL)\n", names[i]);
+			res++;
+		}
+	}
+	res += check_tree(*root, (long)numnames);
+
+	printf("=== %s: looking up and updating all variables\n", __func__);
+	for (i = 0; i < numnames; i++) {
+		const char	*val;
+
+		snprintf(buf, sizeof(buf), "%" PRIuSIZE, i);
+		val = state_getinfo(*root, names[i]);
+		if (!val || strcmp(val, buf)) {
+			printf("  [%s] is [%s], expected [%s] (FAIL)\n",
+				names[i], NUT_STRARG(val), buf);
+			res++;
+		}
+
+		/* same value: no change; other value: changed */
+		if (state_setinfo(root, names[i], buf) != 0
+		 || state_setinfo(root, names[i], "updated") != 1
+		) {
+			printf("  [%s] update not reported correctly (FAIL)\n", names[i]);
+			res++;
+		}
+	}
+	res += check_tree(*root, (long)numnames);
+
+	printf("=== %s: deleting every other variable\n", __func__);
+	for (i = 0; i < numnames; i += 2) {
+		if (state_delinfo(root, names[i]) != 1) {
+			printf("  could not delete [%s] (FAIL)\n", names[i]);
+			res++;
+		}
+	}
+	for (i = 0; i < numnames; i++) {
+		n += (state_tree_find(*root, names[i]) != NULL);
+		if ((state_tree_find(*root, names[i]) == NULL) != (i % 2 == 0)) {
+			printf("  [%s] wrongly %s (FAIL)\n", names[i],
+				(i % 2 ? "missing" : "present"));
+			res++;
+		}
+	}
+	res += check_tree(*root, n);
+
+	if (state_delinfo(root, "no.such.variable") != 0) {
+		printf("  deleting a missing variable succeeded (FAIL)\n");
+		res++;
+	}
+
+	return res;
+}
+
+/* The previous implementation: a binary tree without balancing,
+ * kept here only to compare against */
+typedef struct plain_tree_s {
+	const char	*var;
+	struct plain_tree_s	*left, *right;
+} plain_tree_t;
+
+static void plain_add(plain_tree_t **nptr, const char *var)
+{
+	while (*nptr) {
+		if (strcasecmp((*nptr)->var, var) > 0) {
+			nptr = &(*nptr)->left;
+			continue;
+		}
+		if (strcasecmp((*nptr)->var, var) < 0) {
+			nptr = &(*nptr)->right;
+			continue;
+		}
+		return;
+	}
+
+	*nptr = xcalloc(1, sizeof(**nptr));
+	(*nptr)->var = var;
+}
+
+static const plain_tree_t *plain_find(const plain_tree_t *node, const char *var)
+{
+	while (node) {
+		if (strcasecmp(node->var, var) > 0) {
+			node = node->left;
+			continue;
+		}
+		if (strcasecmp(node->var, var) < 0) {
+			node = node->right;
+			continue;
+		}
+		break;
+	}
+
+	return node;
+}
+
+static void plain_free(plain_tree_t *node)
+{
+	if (!node)
+		return;
+
+	plain_free(node->left);
+	plain_free(node->right);
+	free(node);
+}
+
+static int bench_lookups(st_tree_t *root, size_t rounds)
+{
+	plain_tree_t	*plain = NULL;
+	size_t	i, r, found_st = 0, found_plain = 0;
+	clock_t	start;
+	double	t_st, t_plain;
+
+	for (i = 0; i < numnames; i++)
+		plain_add(&plain, names[i]);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < numnames; i++)
+			found_st += (state_tree_find(root, names[i]) != NULL);
+	t_st = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < numnames; i++)
+			found_plain += (plain_find(plain, names[i]) != NULL);
+	t_plain = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	plain_free(plain);
+
+	printf("=== %s: %" PRIuSIZE " x %" PRIuSIZE " lookups:"
+		" balanced %.3fs, unbalanced %.3fs\n",
+		__func__, rounds, numnames, t_st, t_plain);
+
+	if (found_st != rounds * numnames || found_plain != rounds * numnames) {
+		printf("  not all variables were found (FAIL)\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the interned names: one per name whatever the case, with order keys
+ * sorting like the names (the tree checks above rely on that too) */
+static int check_names(void)
+{
+	const st_name_t	*a, *b, *prev = NULL;
+	size_t	id;
+	int	res = 0;
+
+	printf("=== %s: interning names\n", __func__);
+
+	a = state_name_intern("Outlet.1.Status");
+	b = state_name_find("outlet.1.status");
+	if (!a || a != b || state_name_byid(a->id) != a || strcmp(a->name, "outlet.1.status")) {
+		printf("  names differing in case are not one (FAIL)\n");
+		res++;
+	}
+
+	if (state_name_find("no.such.variable")) {
+		printf("  found a name never interned (FAIL)\n");
+		res++;
+	}
+
+	/* between two neighbours many times over, to run out of room */
+	for (id = 0; id < 100; id++) {
+		char	buf[SMALLBUF];
+
+		snprintf(buf, sizeof(buf), "outlet.1.statu%-*s", (int)(id + 1), "r");
+		state_name_intern(buf);
+	}
+
+	for (id = 0; (a = state_name_byid(id)) != NULL; id++) {
+		if (a->id != id) {
+			printf("  [%s] has id %" PRIuSIZE " (expected %" PRIuSIZE ") (FAIL)\n",
+				a->name, a->id, id);
+			res++;
+		}
+	}
+
+	/* walk the names in order of their keys by repeated minimum */
+	for (;;) {
+		const st_name_t	*next = NULL;
+
+		for (id = 0; (a = state_name_byid(id)) != NULL; id++) {
+			if ((!prev || a->order > prev->order) && (!next || a->order < next->order))
+				next = a;
+		}
+
+		if (!next)
+			break;
+
+		if (prev && strcasecmp(prev->name, next->name) >= 0) {
+			printf("  [%s] ordered after [%s] (FAIL)\n", next->name, prev->name);
+			res++;
+		}
+		prev = next;
+	}
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+}
+
+/* the typed setters, which skip formatting a number seen last time */
+static int check_typed_setters(void)
+{
+	st_tree_t	*root = NULL;
+	const char	*val;
+	int	res = 0;
+
+	printf("=== %s: setting numbers\n", __func__);
+
+	if (state_setinfo_double(&root, "input.voltage", 229.96, 1) != 1
+	 || !(val = state_getinfo(root, "input.voltage")) || strcmp(val, "230.0")
+	) {
+		printf("  new double not added as 230.0 (FAIL)\n");
+		res++;
+	}
+
+	/* same number; another one which formats the same; another one */
+	if (state_setinfo_double(&root, "input.voltage", 229.96, 1) != 0
+	 || state_setinfo_double(&root, "input.voltage", 230.04, 1) != 0
+	 || state_setinfo_double(&root, "input.voltage", 231.0, 1) != 1
+	 || strcmp(state_getinfo(root, "input.voltage"), "231.0")
+	) {
+		printf("  double updates not reported correctly (FAIL)\n");
+		res++;
+	}
+
+	/* same number at another precision is another value */
+	if (state_setinfo_double(&root, "input.voltage", 231.0, 0) != 1
+	 || strcmp(state_getinfo(root, "input.voltage"), "231")
+	) {
+		printf("  precision change not reported (FAIL)\n");
+		res++;
+	}
+
+	/* a plain setinfo in between must not leave the old number behind */
+	if (state_setinfo_long(&root, "ups.load", 42) != 1
+	 || state_setinfo_long(&root, "ups.load", 42) != 0
+	 || state_setinfo(&root, "ups.load", "17") != 1
+	 || state_setinfo_long(&root, "ups.load", 42) != 1
+	 || strcmp(state_getinfo(root, "ups.load"), "42")
+	) {
+		printf("  long updates not reported correctly (FAIL)\n");
+		res++;
+	}
+
+	state_infofree(root);
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+}
+
+/* values in place or in their own buffers, and the accounting of both */
+static int check_tree_bytes(void)
+{
+	st_tree_t	*root = NULL, *node;
+	char	longval[ST_MAX_VALUE_LEN];
+	size_t	empty, shortval;
+	int	res = 0;
+
+	printf("=== %s: accounting the memory of a tree\n", __func__);
+
+	state_setinfo(&root, "ups.status", "OL");
+	node = state_tree_find(root, "ups.status");
+	empty = state_tree_bytes(root);
+	if (!node || node->raw != node->rawbuf || empty < sizeof(st_tree_t)) {
+		printf("  short value not kept in the node, or %" PRIuSIZE " bytes (FAIL)\n", empty);
+		res++;
+	}
+
+	/* a long value moves out of the node, and back in a new one */
+	memset(longval, 'x', sizeof(longval) - 1);
+	longval[sizeof(longval) - 1] = '\0';
+	state_setinfo(&root, "ups.status", longval);
+	if (node->raw == node->rawbuf || state_tree_bytes(root) != empty + sizeof(longval)) {
+		printf("  long value accounted as %" PRIuSIZE " bytes (FAIL)\n",
+			state_tree_bytes(root));
+		res++;
+	}
+
+	state_setinfo(&root, "ups.status", "OB");
+	state_addenum(root, "ups.status", "OL");
+	state_addenum(root, "ups.status", longval);
+	state_addrange(root, "ups.status", 1, 2);
+	shortval = state_tree_bytes(root);
+
+	state_delenum(root, "ups.status", longval);
+	if (state_tree_bytes(root) >= shortval - sizeof(longval)) {
+		printf("  deleted enum still accounted (FAIL)\n");
+		res++;
+	}
+
+	state_delinfo(&root, "ups.status");
+	if (root || state_tree_bytes(root) != 0) {
+		printf("  empty tree is not 0 bytes (FAIL)\n");
+		res++;
+	}
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+}
+
+/* values escaped only when they need it, the same as pconf_encode()
+ * would, with the special characters anywhere in a word or after it */
+static int check_escape(void)
+{
+	static const char	*vals[] = {
+		"230.0", "OL CHRG", "", "#", "a\\b", "12345678\"",
+		"1234567\"", "\"quoted\" and #1 \\ more \"", "no special chars here at all"
+	};
+	st_tree_t	*root = NULL, *node;
+	char	enc[ST_MAX_VALUE_LEN], longval[ST_MAX_VALUE_LEN];
+	size_t	i;
+	int	res = 0;
+
+	printf("=== %s: escaping values\n", __func__);
+
+	for (i = 0; i < SIZEOF_ARRAY(vals); i++) {
+		state_setinfo(&root, "ups.test", vals[i]);
+		node = state_tree_find(root, "ups.test");
+		pconf_encode(vals[i], enc, sizeof(enc));
+
+		if (!node || strcmp(node->val, enc) || node->vallen != strlen(enc)
+		 || (!strcmp(vals[i], enc) && node->val != node->raw)
+		) {
+			printf("  [%s] escaped as [%s] (FAIL)\n", vals[i], node ? node->val : "(none)");
+			res++;
+		}
+	}
+
+	/* twice as long once escaped: cut as pconf_encode() cuts */
+	memset(longval, '"', sizeof(longval) - 1);
+	longval[sizeof(longval) - 1] = '\0';
+	state_setinfo(&root, "ups.test", longval);
+	node = state_tree_find(root, "ups.test");
+	pconf_encode(longval, enc, sizeof(enc));
+	if (!node || strcmp(node->val, enc) || node->vallen != strlen(enc)) {
+		printf("  long value escaped to %" PRIuSIZE " chars (FAIL)\n", node ? node->vallen : 0);
+		res++;
+	}
+
+	if (pconf_encode_count("1234567#1234567\\12345678\"", 25) != 3) {
+		printf("  special characters miscounted (FAIL)\n");
+		res++;
+	}
+
+	state_infofree(root);
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+}
+
+/* a walk resumed after the last node seen, with the tree changed in
+ * between (as a DUMPALL sent a few variables at a time sees it) */
+static int check_tree_next(void)
+{
+	st_tree_t	*root = NULL, *node;
+	const st_name_t	*last = NULL;
+	const char	*seen[8];
+	size_t	count = 0;
+	int	res = 0;
+
+	printf("=== %s: resuming a walk of a changing tree\n", __func__);
+
+	state_setinfo(&root, "b.two", "2");
+	state_setinfo(&root, "d.four", "4");
+	state_setinfo(&root, "f.six", "6");
+
+	while ((node = state_tree_next(root, last)) != NULL && count < 8) {
+		seen[count++] = node->var;
+		last = node->name;
+
+		if (count == 2) {
+			/* one before where we are, one after, and the next one gone */
+			state_setinfo(&root, "a.one", "1");
+			state_setinfo(&root, "e.five", "5");
+			state_delinfo(&root, "f.six");
+		}
+	}
+
+	if (count != 3 || strcmp(seen[0], "b.two") || strcmp(seen[1], "d.four")
+	 || strcmp(seen[2], "e.five")
+	) {
+		printf("  walked %" PRIuSIZE " nodes (FAIL)\n", count);
+		res++;
+	}
+
+	state_infofree(root);
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+}
+
+/* the same enums and ranges on each outlet are one list, which is
+ * copied when one of them changes, and shared again once it is back */
+static int check_shared_lists(void)
+{
+	st_tree_t	*root = NULL, *first, *node;
+	st_list_t	*list = NULL;
+	const enum_t	*etmp;
+	size_t	i, bytes;
+	char	var[SMALLBUF];
+	int	res = 0;
+
+	printf("=== %s: enum and range lists shared by %d outlets\n",
+		__func__, NUM_OUTLETS);
+
+	for (i = 1; i <= NUM_OUTLETS; i++) {
+		snprintf(var, sizeof(var), "outlet.%" PRIuSIZE ".status", i);
+		state_setinfo(&root, var, "on");
+		state_addenum(root, var, "on");
+		state_addenum(root, var, "off");
+		snprintf(var, sizeof(var), "outlet.%" PRIuSIZE ".delay.shutdown", i);
+		state_setinfo(&root, var, "-1");
+		state_addrange(root, var, -1, 7200);
+	}
+
+	first = state_tree_find(root, "outlet.1.status");
+	for (i = 2; i <= NUM_OUTLETS; i++) {
+		snprintf(var, sizeof(var), "outlet.%" PRIuSIZE ".status", i);
+		node = state_tree_find(root, var);
+		if (!node || node->enums != first->enums || node->enum_list != first->enum_list) {
+			printf("  %s has a list of its own (FAIL)\n", var);
+			res++;
+			break;
+		}
+	}
+
+	/* the list, and its items, once; the nodes and their values each */
+	bytes = state_tree_bytes(root);
+	state_delenum(root, "outlet.2.status", "off");
+	node = state_tree_find(root, "outlet.2.status");
+	if (node->enums == first->enums || !node->enum_list
+	 || strcmp(node->enum_list->val, "on") || node->enum_list->next
+	 || !first->enum_list->next
+	) {
+		printf("  changing one list changed the others (FAIL)\n");
+		res++;
+	}
+	if (state_tree_bytes(root) <= bytes) {
+		printf("  a list of its own is not accounted (FAIL)\n");
+		res++;
+	}
+
+	state_addenum(root, "outlet.2.status", "off");
+	if (node->enums != first->enums || state_tree_bytes(root) != bytes) {
+		printf("  the same list again is not shared (FAIL)\n");
+		res++;
+	}
+
+	/* built on its own (as upsd does from the lines of a driver),
+	 * in the same order as added one by one */
+	if (state_list_addenum(&list, "on") != 1 || state_list_addenum(&list, "off") != 1
+	 || state_list_addenum(&list, "on") != 0 || state_list_addrange(&list, 1, 2) != 0
+	 || list != first->enums || state_list_id(list) != state_list_id(first->enums)
+	) {
+		printf("  list built apart is not the pooled one (FAIL)\n");
+		res++;
+	}
+
+	state_setinfo(&root, "ups.beeper.status", "enabled");
+	if (state_setenums(root, "ups.beeper.status", list) != 1
+	 || state_setenums(root, "ups.beeper.status", list) != 0
+	 || state_setranges(root, "ups.beeper.status", list) != 0
+	) {
+		printf("  list given to a variable (FAIL)\n");
+		res++;
+	}
+	state_list_free(list);
+
+	for (i = 0, etmp = state_getenumlist(root, "ups.beeper.status"); etmp; etmp = etmp->next)
+		i++;
+	if (i != 2 || strcmp(state_getenumlist(root, "ups.beeper.status")->val, "off")) {
+		printf("  %" PRIuSIZE " enums given (FAIL)\n", i);
+		res++;
+	}
+
+	node = state_tree_find(root, "outlet.1.delay.shutdown");
+	if (!node->range_list || node->range_list->min != -1 || node->range_list->max != 7200
+	 || node->ranges != state_tree_find(root, "outlet.9.delay.shutdown")->ranges
+	) {
+		printf("  ranges are not shared (FAIL)\n");
+		res++;
+	}
+
+	state_infofree(root);
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+}
+
+/* the driver's shared memory export of values, as upsd reads it */
+static int check_shmstate(void)
+{
+#ifdef WITH_SHMSTATE
+	shmstate_t	*w, *r;
+	char	fn[SMALLBUF], buf[ST_MAX_VALUE_LEN];
+	long	slot, *slots;
+	size_t	i, round;
+	int	res = 0;
+
+	printf("=== %s: exporting %" PRIuSIZE " variables\n", __func__, numnames);
+
+	snprintf(fn, sizeof(fn), "nutstatetest-%ld%s", (long)getpid(), SHMSTATE_SUFFIX);
+	w = shmstate_create(fn, numnames);
+	r = shmstate_open(fn);
+	if (!w || !r) {
+		printf("  could not create or map %s (FAIL)\n", fn);
+		shmstate_close(r);
+		shmstate_close(w);
+		return 1;
+	}
+
+	slots = xcalloc(numnames, sizeof(*slots));
+
+	/* churn: delete and re-add half of them, so slots get reused
+	 * and the index fills with deleted entries and gets rebuilt */
+	for (round = 0; round < 5; round++) {
+		for (i = 0; i < numnames; i++) {
+			if (round > 0 && i % 2)
+				continue;
+
+			snprintf(buf, sizeof(buf), "%" PRIuSIZE ".%" PRIuSIZE, round, i);
+			slots[i] = shmstate_set(w, names[i], buf);
+			if (slots[i] < 0) {
+				printf("  no slot for [%s] (FAIL)\n", names[i]);
+				res++;
+			}
+		}
+
+		if (shmstate_set(w, "one.too.many", "x") >= 0) {
+			printf("  a full table took another variable (FAIL)\n");
+			res++;
+		}
+
+		for (i = 0; i < numnames; i += 2)
+			shmstate_del(w, names[i]);
+	}
+
+	for (i = 0; i < numnames; i++) {
+		char	expected[ST_MAX_VALUE_LEN];
+		int	ret = shmstate_get(r, slots[i], names[i], buf, sizeof(buf));
+
+		slot = shmstate_find(w, names[i]);
+		snprintf(expected, sizeof(expected), "0.%" PRIuSIZE, i);
+
+		if (i % 2 == 0) {
+			/* deleted: the slot is free or taken by another one */
+			if (slot >= 0 || ret != 0) {
+				printf("  deleted [%s] still found (FAIL)\n", names[i]);
+				res++;
+			}
+		} else if (slot != slots[i] || ret != 1 || strcmp(buf, expected)) {
+			printf("  [%s] in slot %ld (expected %ld) reads [%s] (FAIL)\n",
+				names[i], slot, slots[i], (ret == 1 ? buf : "<none>"));
+			res++;
+		}
+	}
+
+	free(slots);
+	shmstate_close(r);
+	shmstate_close(w);
+
+	if (access(fn, F_OK) == 0) {
+		printf("  %s was not removed (FAIL)\n", fn);
+		res++;
+	}
+
+	printf("  %s\n", (res ? "FAIL" : "OK"));
+	return res;
+#else
+	printf("=== %s: not supported on this platform, skipped\n", __func__);
+	return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	int	ret = 0;
+	size_t	i, rounds = 10;
+	st_tree_t	*root = NULL;
+
+	/* e.g. "nutstatetest 1000" for a more meaningful benchmark */
+	if (argc > 1)
+		rounds = (size_t)strtoul(argv[1], NULL, 10);
+
+	make_names();
+
+	ret += check_state_tree(&root);
+	state_infofree(root);
+	root = NULL;
+
+	for (i = 0; i < numnames; i++)
+		state_setinfo(&root, names[i], "1");
+	ret += bench_lookups(root, rounds);
+	state_infofree(root);
+
+	ret += check_names();
+	ret += check_typed_setters();
+	ret += check_tree_bytes();
+	ret += check_escape();
+	ret += check_tree_next();
+	ret += check_shared_lists();
+	ret += check_shmstate();
+
+	for (i = 0; i < numnames; i++)
+		free(names[i]);
+	free(names);
+	state_names_free();
+	state_slabs_free();
+
+	return (ret != 0);
+}
@@ -0,0 +1,242 @@
+/*  nutstatstest.c - test the rolling-window statistics of the drivers
+ *  (drivers/dstats.c): the minimum, maximum and average published for
+ *  each window are those of the samples still in it
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "dstate.h"
+#include "dstats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* what dstats.c sees of dstate.c: a few variables, as text */
+#define TEST_VARS	16
+
+static struct {
+	char	name[SMALLBUF];
+	char	value[SMALLBUF];
+} test_vars[TEST_VARS];
+
+static size_t test_find(const char *var, int add)
+{
+	size_t	i;
+
+	for (i = 0; i < TEST_VARS; i++) {
+		if (!strcmp(test_vars[i].name, var)) {
+			return i;
+		}
+	}
+
+	for (i = 0; add && i < TEST_VARS; i++) {
+		if (!test_vars[i].name[0]) {
+			snprintf(test_vars[i].name, sizeof(test_vars[i].name), "%s", var);
+			return i;
+		}
+	}
+
+	return TEST_VARS;
+}
+
+static void test_set(const char *var, const char *value)
+{
+	size_t	i = test_find(var, 1);
+
+	if (i == TEST_VARS) {
+		fatalx(EXIT_FAILURE, "Too many variables");
+	}
+	snprintf(test_vars[i].value, sizeof(test_vars[i].value), "%s", value);
+}
+
+const char *dstate_getinfo(const char *var)
+{
+	size_t	i = test_find(var, 0);
+
+	return (i == TEST_VARS) ? NULL : test_vars[i].value;
+}
+
+int dstate_setinfo_double(const char *var, double value, int precision)
+{
+	char	buf[SMALLBUF];
+
+	snprintf(buf, sizeof(buf), "%.*f", precision, value);
+	test_set(var, buf);
+
+	return 1;
+}
+
+int dstate_delinfo(const char *var)
+{
+	size_t	i = test_find(var, 0);
+
+	if (i == TEST_VARS) {
+		return 0;
+	}
+	memset(&test_vars[i], 0, sizeof(test_vars[i]));
+
+	return 1;
+}
+
+/* var is expected (NULL: not to be there) */
+static int expect(const char *var, const char *expected)
+{
+	const char	*val = dstate_getinfo(var);
+
+	if (expected == NULL ? val == NULL : (val != NULL && !strcmp(val, expected))) {
+		return 0;
+	}
+
+	printf("  %s is '%s', not '%s' (FAIL)\n", var, NUT_STRARG(val), NUT_STRARG(expected));
+
+	return 1;
+}
+
+static int check_windows(void)
+{
+	static const char	*samples[] = { "230.0", "228.5", "241.0", "229.0", "235.5" };
+	dstats_t	*stats = dstats_new("input.voltage, ups.load", "10,1m");
+	time_t	now = 1000;
+	size_t	i;
+	int	res = 0;
+
+	if (stats == NULL) {
+		printf("  can't make the windows (FAIL)\n");
+		return 1;
+	}
+
+	/* one sample every 3 seconds: the 10s window holds the last 4 */
+	for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++, now += 3) {
+		test_set("input.voltage", samples[i]);
+		dstats_sample(stats, now);
+	}
+
+	res += expect("input.voltage.10s.minimum", "228.5");
+	res += expect("input.voltage.10s.maximum", "241.0");
+	res += expect("input.voltage.10s.average", "233.50");
+	res += expect("input.voltage.1m.minimum", "228.5");
+	res += expect("input.voltage.1m.average", "232.80");
+
+	/* no value for it: nothing published */
+	res += expect("ups.load.10s.average", NULL);
+
+	/* the device stops saying it: the short window empties */
+	dstate_delinfo("input.voltage");
+	dstats_sample(stats, now + 20);
+	res += expect("input.voltage.10s.minimum", NULL);
+	res += expect("input.voltage.10s.average", NULL);
+	res += expect("input.voltage.1m.maximum", "241.0");
+
+	/* the maximum goes with the sample it was */
+	test_set("input.voltage", "231");
+	dstats_sample(stats, now + 60 - 6);
+	res += expect("input.voltage.1m.maximum", "235.5");
+	res += expect("input.voltage.1m.minimum", "231.0");
+	res += expect("input.voltage.10s.average", "231.00");
+
+	dstats_free(stats);
+
+	return res;
+}
+
+/* Many samples in a long window: the result is that of the last span,
+ * computed the long way */
+static int check_long(void)
+{
+	dstats_t	*stats = dstats_new("ups.load", "1h");
+	double	values[7200], min, max, sum, diff;
+	char	buf[SMALLBUF];
+	size_t	i, j;
+	int	res = 0;
+
+	srand(1);
+	for (i = 0; i < 7200; i++) {
+		values[i] = (double)(rand() % 1000) / 10;
+
+		snprintf(buf, sizeof(buf), "%.1f", values[i]);
+		test_set("ups.load", buf);
+		dstats_sample(stats, (time_t)(1000 + i));
+
+		if (i % 997 && i != 7199) {
+			continue;
+		}
+
+		min = max = values[i];
+		sum = 0;
+		for (j = (i >= 3599) ? i - 3599 : 0; j <= i; j++) {
+			if (values[j] < min) min = values[j];
+			if (values[j] > max) max = values[j];
+			sum += values[j];
+		}
+
+		snprintf(buf, sizeof(buf), "%.1f", min);
+		res += expect("ups.load.1h.minimum", buf);
+		snprintf(buf, sizeof(buf), "%.1f", max);
+		res += expect("ups.load.1h.maximum", buf);
+		/* the running sum may round off a bit differently */
+		sum /= (double)(i - ((i >= 3599) ? i - 3599 : 0) + 1);
+		diff = dstate_getinfo("ups.load.1h.average")
+			? atof(dstate_getinfo("ups.load.1h.average")) - sum : 1;
+		if (diff > 0.006 || diff < -0.006) {
+			printf("  ups.load.1h.average is not %.3f (FAIL)\n", sum);
+			res++;
+		}
+	}
+
+	dstats_free(stats);
+
+	return res;
+}
+
+static int check_config(void)
+{
+	int	res = 0;
+	dstats_t	*stats;
+
+	if ((stats = dstats_new("ups.load", "1x")) != NULL
+	 || (stats = dstats_new("ups.load", "0")) != NULL
+	 || (stats = dstats_new("", NULL)) != NULL
+	 || (stats = dstats_new("ups.load", "1,2,3,4,5")) != NULL
+	) {
+		printf("  a wrong setting is taken (FAIL)\n");
+		dstats_free(stats);
+		res++;
+	}
+
+	if ((stats = dstats_new("ups.load", NULL)) == NULL) {
+		printf("  the default windows are not taken (FAIL)\n");
+		res++;
+	}
+	dstats_free(stats);
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += check_windows();
+	ret += check_long();
+	ret += check_config();
+
+	if (ret != 0)
+		printf("nutstatstest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
@@ -0,0 +1,111 @@
+/*  nutstatustest.c - check the ups.status flags of common/nutstatus.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nutstatus.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* statuses, their flags, and how nut_status_format() writes those */
+static const struct {
+	const char	*status;
+	nut_status_t	flags;
+	const char	*text;
+} statuses[] = {
+	{ "", 0, "" },
+	{ "OL", NUT_STATUS_OL, "OL" },
+	{ "OB LB", NUT_STATUS_OB | NUT_STATUS_LB, "OB LB" },
+	{ "CHRG OL", NUT_STATUS_OL | NUT_STATUS_CHRG, "OL CHRG" },
+	{ "ALARM OL  BYPASS ", NUT_STATUS_OL | NUT_STATUS_BYPASS | NUT_STATUS_ALARM, "OL BYPASS ALARM" },
+	{ "FSD OB LB", NUT_STATUS_OB | NUT_STATUS_LB | NUT_STATUS_FSD, "OB LB FSD" },
+	{ "ol eco", NUT_STATUS_OL | NUT_STATUS_ECO, "OL ECO" },
+	/* parts of other tokens are not these */
+	{ "OLB", NUT_STATUS_OTHER, "" },
+	{ "OL COMMLOST", NUT_STATUS_OL | NUT_STATUS_OTHER, "OL" },
+	{ NULL, 0, NULL }
+};
+
+static int check_statuses(void)
+{
+	char	text[SMALLBUF];
+	nut_status_t	flags;
+	size_t	i;
+	int	res = 0;
+
+	for (i = 0; statuses[i].status; i++) {
+		flags = nut_status_parse(statuses[i].status);
+		if (flags != statuses[i].flags) {
+			printf("  \"%s\": flags 0x%08x, expected 0x%08x (FAIL)\n",
+				statuses[i].status, (unsigned int)flags,
+				(unsigned int)statuses[i].flags);
+			res++;
+		}
+
+		if (nut_status_format(text, sizeof(text), flags) != (int)strlen(statuses[i].text)
+		 || strcmp(text, statuses[i].text)
+		) {
+			printf("  \"%s\": written as \"%s\" (FAIL)\n",
+				statuses[i].status, text);
+			res++;
+		}
+	}
+
+	return res;
+}
+
+static int check_tokens(void)
+{
+	char	text[8];
+	int	res = 0;
+
+	if (nut_status_flag("DISCHRG", 7) != NUT_STATUS_DISCHRG
+	 || nut_status_flag("DISCHRGX", 7) != NUT_STATUS_DISCHRG
+	 || nut_status_flag("DISCH", 5) != 0
+	 || strcmp(nut_status_token(NUT_STATUS_TRIM), "TRIM")
+	 || nut_status_token(NUT_STATUS_OTHER) != NULL
+	 || nut_status_token(NUT_STATUS_OL | NUT_STATUS_OB) != NULL
+	) {
+		res++;
+	}
+
+	/* cut like snprintf() */
+	if (nut_status_format(text, sizeof(text), NUT_STATUS_OL | NUT_STATUS_BYPASS) != 9
+	 || strcmp(text, "OL BYPA")
+	) {
+		printf("  cut to \"%s\" (FAIL)\n", text);
+		res++;
+	}
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += check_statuses();
+	ret += check_tokens();
+
+	if (ret != 0)
+		printf("nutstatustest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
@@ -190,6 +190,116 @@ static bool writeTestData(nut::NutStream * stream) {
 }
 
 
+/**
+ *  \brief  Read and check test data lines from a stream
+ *
+ *  Reads just the lines of the test data, so that more may follow.
+ *
+ *  \param  stream  Input stream
+ *
+ *  \retval true  in case of success
+ *  \retval false in case of failure
+ */
+static bool readTestLines(nut::NutStream * stream) {
+	assert(nullptr != stream);
+
+	for (size_t pos = 0; pos < test_data.size(); ) {
+		size_t eol = test_data.find('\n', pos);
+		const std::string want = test_data.substr(pos, eol - pos);
+		std::string line;
+
+		nut::NutStream::status_t status = stream->getLine(line);
+
+		if (nut::NutStream::NUTS_OK != status) {
+			if (verbose)
+				std::cerr << "readTestLines(): status!=nut::NutStream::NUTS_OK: " << status << std::endl;
+			return false;
+		}
+
+		if (line != want) {
+			if (verbose)
+				std::cerr << "readTestLines(): unexpected line '"
+						<< line << "' at pos " << pos << ": want '"
+						<< want << "'" << std::endl;
+			return false;
+		}
+
+		pos = eol + 1;
+	}
+
+	return true;
+}
+
+
+/**
+ *  \brief  Read and check test data from a stream, in blocks
+ *
+ *  \param  stream  Input stream
+ *  \param  size    Block size
+ *
+ *  \retval true  in case of success
+ *  \retval false in case of failure
+ */
+static bool readTestBlocks(nut::NutStream * stream, size_t size) {
+	assert(nullptr != stream);
+
+	std::string data;
+
+	for (;;) {
+		std::string block;
+
+		nut::NutStream::status_t status = stream->getData(block, size);
+
+		if (nut::NutStream::NUTS_EOF == status)
+			break;
+
+		if (nut::NutStream::NUTS_OK != status) {
+			if (verbose)
+				std::cerr << "readTestBlocks(): status!=nut::NutStream::NUTS_OK: " << status << std::endl;
+			return false;
+		}
+
+		// Only the last block may be short
+		if (block.empty() || block.size() > size || data.size() % size) {
+			if (verbose)
+				std::cerr << "readTestBlocks(): unexpected block size "
+						<< block.size() << " at pos " << data.size() << std::endl;
+			return false;
+		}
+
+		data += block;
+	}
+
+	return data == test_data;
+}
+
+
+/**
+ *  \brief  Write test data lines to a stream, in one vectored write
+ *
+ *  \param  stream  Output stream
+ *
+ *  \retval true  in case of success
+ *  \retval false in case of failure
+ */
+static bool writeTestLines(nut::NutStream * stream) {
+	assert(nullptr != stream);
+
+	std::vector<std::string> lines;
+
+	for (size_t pos = 0; pos < test_data.size(); ) {
+		size_t eol = test_data.find('\n', pos);
+
+		lines.push_back(test_data.substr(pos, eol - pos));
+		lines.push_back("\n");
+
+		pos = eol + 1;
+	}
+
+	return nut::NutStream::NUTS_OK == stream->putData(lines);
+}
+
+
 /**
  *  \brief  NUT stream unit test suite (abstract)
  */
@@ -218,6 +328,34 @@ class NutStreamUnitTest: public CppUnit::TestFixture {
 		CPPUNIT_ASSERT(writeTestData(stream));
 	}
 
+	/**
+	 *  \brief  Read test data lines from stream
+	 *
+	 *  \param  stream  Input stream
+	 */
+	inline void readLinesx(nut::NutStream * stream) {
+		CPPUNIT_ASSERT(readTestLines(stream));
+	}
+
+	/**
+	 *  \brief  Read test data from stream, in blocks
+	 *
+	 *  \param  stream  Input stream
+	 *  \param  size    Block size
+	 */
+	inline void readBlocksx(nut::NutStream * stream, size_t size) {
+		CPPUNIT_ASSERT(readTestBlocks(stream, size));
+	}
+
+	/**
+	 *  \brief  Write test data lines to stream, in one vectored write
+	 *
+	 *  \param  stream  Output stream
+	 */
+	inline void writeLinesx(nut::NutStream * stream) {
+		CPPUNIT_ASSERT(writeTestLines(stream));
+	}
+
 	virtual ~NutStreamUnitTest() override;
 };  // end of class NutStreamUnitTest
 
@@ -249,6 +387,15 @@ void NutMemoryUnitTest::test() {
 	readx(&input_mstream);
 	writex(&output_mstream);
 	readx(&output_mstream);
+
+	nut::NutMemory lines_mstream(test_data);
+	nut::NutMemory blocks_mstream(test_data);
+	nut::NutMemory vector_mstream;
+
+	readLinesx(&lines_mstream);
+	readBlocksx(&blocks_mstream, 7);
+	writeLinesx(&vector_mstream);
+	readx(&vector_mstream);
 }
 
 
@@ -260,6 +407,7 @@ class NutFileUnitTest: public NutStreamUnitTest {
 
 	CPPUNIT_TEST_SUITE(NutFileUnitTest);
 		CPPUNIT_TEST(test);
+		CPPUNIT_TEST(testAtomic);
 	CPPUNIT_TEST_SUITE_END();
 
 	public:
@@ -268,6 +416,7 @@ class NutFileUnitTest: public NutStreamUnitTest {
 	inline void tearDown() override {}
 
 	virtual void test();
+	void testAtomic();
 
 };  // end of class NutFileUnitTest
 
@@ -281,6 +430,37 @@ void NutFileUnitTest::test() {
 }
 
 
+void NutFileUnitTest::testAtomic() {
+	std::stringstream name;
+	name << nut::NutFile::tmp_dir() << nut::NutFile::path_sep()
+		<< "nutstream_ut." << getpid();
+
+	nut::NutFile old_file(name.str(), nut::NutFile::WRITE_ONLY);
+	old_file.putString("Old contents\n");
+	old_file.closex();
+
+	// The file stays as it was until the replacement is closed
+	nut::NutFile new_file(name.str(), nut::NutFile::WRITE_ATOMIC);
+	writex(&new_file);
+	writeLinesx(&new_file);
+
+	nut::NutFile check_file(name.str(), nut::NutFile::READ_ONLY);
+	std::string contents;
+	CPPUNIT_ASSERT(nut::NutStream::NUTS_OK == check_file.getString(contents));
+	CPPUNIT_ASSERT(contents == "Old contents\n");
+	check_file.closex();
+
+	new_file.closex();
+
+	check_file.openx(nut::NutFile::READ_ONLY);
+	readLinesx(&check_file);
+	readx(&check_file);
+	check_file.closex();
+
+	check_file.removex();
+}
+
+
 /**
  *  \brief  NUT socket stream unit test suite
  */
@@ -399,6 +579,10 @@ bool NutSocketUnitTest::Writer::run() {
 	if (!conn_sock.connect(m_remote_address))
 		return false;
 
+	// The test data twice: as lines and as characters
+	if (!writeTestLines(&conn_sock))
+		return false;
+
 	if (!writeTestData(&conn_sock))
 		return false;
 
@@ -456,7 +640,8 @@ void NutSocketUnitTest::test() {
 	// Accept connection
 	nut::NutSocket conn_sock(nut::NutSocket::ACCEPT, listen_sock);
 
-	// Read the test data
+	// Read the test data (lines, then the rest char by char)
+	readLinesx(&conn_sock);
 	readx(&conn_sock);
 
 	// Wait for writer
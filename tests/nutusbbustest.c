@@ -0,0 +1,813 @@
+/*  nutusbbustest.c - test how drivers/libusb1.c (or libusb0.c, for the
+ *  libusb version NUT is built with) finds the devices of a USB driver
+ *  running several of them, on a fake bus: each gets its own device, the
+ *  devices of other IDs are not opened, and with libusb 1.0 the devices
+ *  share one enumeration of the bus and one reading of their strings
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+
+/* The bus: devices are plugged in up to test_bus_count */
+typedef struct {
+	unsigned short	VendorID;
+	const char	*Vendor;
+	const char	*Serial;
+	int	opens;
+} test_device_t;
+
+static test_device_t	test_bus[] = {
+	{ 0x1234, "Acme", "S4", 0 },
+	{ 0x1234, "Acme", "S3", 0 },
+	{ 0x4321, "Other", "S0", 0 },
+	{ 0x1234, "Acme", "S2", 0 },
+	{ 0x1234, "Acme", "S1", 0 },
+	{ 0x1234, "Acme", "S5", 0 }
+};
+#define TEST_BUS_SIZE	(sizeof(test_bus) / sizeof(test_bus[0]))
+
+static size_t	test_bus_count = TEST_BUS_SIZE - 1;	/* S5 comes later */
+static int	test_enumerations = 0, test_opens = 0, test_strings = 0;
+
+/* Answer a string descriptor request (index 0: the language IDs) */
+static int test_string(const test_device_t *t, int index, unsigned char *buf, int buflen)
+{
+	const char	*s;
+	int	len, i;
+
+	if (buflen < 4) {
+		return -1;
+	}
+
+	if (index == 0) {
+		buf[0] = 4;
+		buf[1] = 0x03;	/* USB_DT_STRING */
+		buf[2] = 0x09;	/* en_US */
+		buf[3] = 0x04;
+		return 4;
+	}
+
+	switch (index) {
+	case 1:
+		s = t->Vendor;
+		break;
+	case 2:
+		s = "UPS";
+		break;
+	case 3:
+		s = t->Serial;
+		break;
+	default:
+		return -1;
+	}
+	test_strings++;
+
+	/* UTF-16LE */
+	len = 2 + 2 * (int)strlen(s);
+	if (len > buflen) {
+		len = buflen;
+	}
+	buf[0] = (unsigned char)len;
+	buf[1] = 0x03;
+	for (i = 0; 2 + 2 * i + 1 < len; i++) {
+		buf[2 + 2 * i] = (unsigned char)s[i];
+		buf[3 + 2 * i] = 0;
+	}
+
+	return len;
+}
+
+#if WITH_LIBUSB_1_0
+/* ---------------------------------------------------------------------
+ * libusb 1.0: the calls of libusb1.c (and usb-common.c) go to the fakes
+ * below rather than to the library; some of the real ones are inline in
+ * libusb.h, and prototypes vary a bit with the libusb version
+ */
+
+# include <libusb.h>
+
+# define libusb_init	test_libusb_init
+# define libusb_exit	test_libusb_exit
+# define libusb_strerror	test_libusb_strerror
+# define libusb_get_version	test_libusb_get_version
+# define libusb_get_device_list	test_libusb_get_device_list
+# define libusb_free_device_list	test_libusb_free_device_list
+# define libusb_get_device	test_libusb_get_device
+# define libusb_get_device_descriptor	test_libusb_get_device_descriptor
+# define libusb_get_active_config_descriptor	test_libusb_get_active_config_descriptor
+# define libusb_get_config_descriptor	test_libusb_get_config_descriptor
+# define libusb_free_config_descriptor	test_libusb_free_config_descriptor
+# define libusb_get_bus_number	test_libusb_get_bus_number
+# define libusb_get_port_number	test_libusb_get_port_number
+# define libusb_get_device_address	test_libusb_get_device_address
+# define libusb_open	test_libusb_open
+# define libusb_close	test_libusb_close
+# define libusb_claim_interface	test_libusb_claim_interface
+# define libusb_release_interface	test_libusb_release_interface
+# define libusb_set_configuration	test_libusb_set_configuration
+# define libusb_set_interface_alt_setting	test_libusb_set_interface_alt_setting
+# define libusb_clear_halt	test_libusb_clear_halt
+# define libusb_kernel_driver_active	test_libusb_kernel_driver_active
+# define libusb_detach_kernel_driver	test_libusb_detach_kernel_driver
+# define libusb_detach_kernel_driver_np	test_libusb_detach_kernel_driver
+# define libusb_set_auto_detach_kernel_driver	test_libusb_set_auto_detach_kernel_driver
+# define libusb_control_transfer	test_libusb_control_transfer
+# define libusb_interrupt_transfer	test_libusb_interrupt_transfer
+# define libusb_get_string_descriptor	test_libusb_get_string_descriptor
+# define libusb_alloc_transfer	test_libusb_alloc_transfer
+# define libusb_free_transfer	test_libusb_free_transfer
+# define libusb_submit_transfer	test_libusb_submit_transfer
+# define libusb_cancel_transfer	test_libusb_cancel_transfer
+# define libusb_fill_interrupt_transfer	test_libusb_fill_interrupt_transfer
+# define libusb_handle_events_timeout_completed	test_libusb_handle_events_timeout_completed
+# define libusb_get_pollfds	test_libusb_get_pollfds
+# define libusb_free_pollfds	test_libusb_free_pollfds
+# define libusb_set_pollfd_notifiers	test_libusb_set_pollfd_notifiers
+# define libusb_pollfds_handle_timeouts	test_libusb_pollfds_handle_timeouts
+# define libusb_has_capability	test_libusb_has_capability
+# define libusb_hotplug_register_callback	test_libusb_hotplug_register_callback
+# define libusb_hotplug_deregister_callback	test_libusb_hotplug_deregister_callback
+
+struct libusb_device {
+	test_device_t	*t;
+	uint8_t	address;
+};
+
+struct libusb_device_handle {
+	libusb_device	*dev;
+};
+
+static libusb_device	test_devices[TEST_BUS_SIZE];
+
+static struct libusb_interface_descriptor	test_altsetting;
+static struct libusb_interface	test_interface = { &test_altsetting, 1 };
+static struct libusb_config_descriptor	test_config;
+
+int test_libusb_init(libusb_context **ctx)
+{
+	if (ctx) {
+		*ctx = NULL;
+	}
+	return LIBUSB_SUCCESS;
+}
+
+void test_libusb_exit(libusb_context *ctx)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+}
+
+const char *test_libusb_strerror(int errcode)
+{
+	return (errcode == LIBUSB_SUCCESS) ? "Success" : "Error";
+}
+
+const struct libusb_version *test_libusb_get_version(void)
+{
+	static struct libusb_version	v = { 1, 0, 0, 0, "", "" };
+
+	return &v;
+}
+
+ssize_t test_libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	size_t	i;
+
+	NUT_UNUSED_VARIABLE(ctx);
+	test_enumerations++;
+
+	*list = calloc(test_bus_count + 1, sizeof(**list));
+	if (*list == NULL) {
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	for (i = 0; i < test_bus_count; i++) {
+		test_devices[i].t = &test_bus[i];
+		test_devices[i].address = (uint8_t)(i + 2);
+		(*list)[i] = &test_devices[i];
+	}
+
+	return (ssize_t)test_bus_count;
+}
+
+void test_libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+	NUT_UNUSED_VARIABLE(unref_devices);
+	free(list);
+}
+
+libusb_device *test_libusb_get_device(libusb_device_handle *dev_handle)
+{
+	return dev_handle->dev;
+}
+
+int test_libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->idVendor = dev->t->VendorID;
+	desc->idProduct = 0x0001;
+	desc->iManufacturer = 1;
+	desc->iProduct = 2;
+	desc->iSerialNumber = 3;
+
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	test_config.bNumInterfaces = 1;
+	test_config.interface = &test_interface;
+	*config = &test_config;
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config)
+{
+	NUT_UNUSED_VARIABLE(config_index);
+	return test_libusb_get_active_config_descriptor(dev, config);
+}
+
+void test_libusb_free_config_descriptor(struct libusb_config_descriptor *config)
+{
+	NUT_UNUSED_VARIABLE(config);
+}
+
+uint8_t test_libusb_get_bus_number(libusb_device *dev)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	return 1;
+}
+
+uint8_t test_libusb_get_port_number(libusb_device *dev)
+{
+	return (uint8_t)(dev->address - 1);
+}
+
+uint8_t test_libusb_get_device_address(libusb_device *dev)
+{
+	return dev->address;
+}
+
+int test_libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+	*dev_handle = malloc(sizeof(**dev_handle));
+	if (*dev_handle == NULL) {
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	(*dev_handle)->dev = dev;
+	dev->t->opens++;
+	test_opens++;
+
+	return LIBUSB_SUCCESS;
+}
+
+void test_libusb_close(libusb_device_handle *dev_handle)
+{
+	free(dev_handle);
+}
+
+int test_libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(interface_number);
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_release_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(interface_number);
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_set_configuration(libusb_device_handle *dev_handle, int configuration)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(configuration);
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(interface_number);
+	NUT_UNUSED_VARIABLE(alternate_setting);
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(endpoint);
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_kernel_driver_active(libusb_device_handle *dev_handle, int interface_number)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(interface_number);
+	return 0;
+}
+
+int test_libusb_detach_kernel_driver(libusb_device_handle *dev_handle, int interface_number)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(interface_number);
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int test_libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(enable);
+	return LIBUSB_SUCCESS;
+}
+
+int test_libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(request_type);
+	NUT_UNUSED_VARIABLE(bRequest);
+	NUT_UNUSED_VARIABLE(wValue);
+	NUT_UNUSED_VARIABLE(wIndex);
+	NUT_UNUSED_VARIABLE(data);
+	NUT_UNUSED_VARIABLE(wLength);
+	NUT_UNUSED_VARIABLE(timeout);
+	return LIBUSB_ERROR_PIPE;
+}
+
+int test_libusb_get_string_descriptor(libusb_device_handle *dev_handle, uint8_t desc_index, uint16_t langid, unsigned char *data, int length)
+{
+	NUT_UNUSED_VARIABLE(langid);
+	return test_string(dev_handle->dev->t, desc_index, data, length);
+}
+
+int test_libusb_interrupt_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout)
+{
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(endpoint);
+	NUT_UNUSED_VARIABLE(data);
+	NUT_UNUSED_VARIABLE(length);
+	NUT_UNUSED_VARIABLE(actual_length);
+	NUT_UNUSED_VARIABLE(timeout);
+	return LIBUSB_ERROR_TIMEOUT;
+}
+
+struct libusb_transfer *test_libusb_alloc_transfer(int iso_packets)
+{
+	NUT_UNUSED_VARIABLE(iso_packets);
+	return NULL;
+}
+
+void test_libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	NUT_UNUSED_VARIABLE(transfer);
+}
+
+int test_libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	NUT_UNUSED_VARIABLE(transfer);
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int test_libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	NUT_UNUSED_VARIABLE(transfer);
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void test_libusb_fill_interrupt_transfer(struct libusb_transfer *transfer, libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *buffer, int length, libusb_transfer_cb_fn callback, void *user_data, unsigned int timeout)
+{
+	NUT_UNUSED_VARIABLE(transfer);
+	NUT_UNUSED_VARIABLE(dev_handle);
+	NUT_UNUSED_VARIABLE(endpoint);
+	NUT_UNUSED_VARIABLE(buffer);
+	NUT_UNUSED_VARIABLE(length);
+	NUT_UNUSED_VARIABLE(callback);
+	NUT_UNUSED_VARIABLE(user_data);
+	NUT_UNUSED_VARIABLE(timeout);
+}
+
+int test_libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(tv);
+	NUT_UNUSED_VARIABLE(completed);
+	return LIBUSB_SUCCESS;
+}
+
+const struct libusb_pollfd **test_libusb_get_pollfds(libusb_context *ctx)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	return NULL;
+}
+
+void test_libusb_free_pollfds(const struct libusb_pollfd **pollfds)
+{
+	NUT_UNUSED_VARIABLE(pollfds);
+}
+
+void test_libusb_set_pollfd_notifiers(libusb_context *ctx, libusb_pollfd_added_cb added_cb, libusb_pollfd_removed_cb removed_cb, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(added_cb);
+	NUT_UNUSED_VARIABLE(removed_cb);
+	NUT_UNUSED_VARIABLE(user_data);
+}
+
+int test_libusb_pollfds_handle_timeouts(libusb_context *ctx)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	return 0;
+}
+
+int test_libusb_has_capability(uint32_t capability)
+{
+	NUT_UNUSED_VARIABLE(capability);
+	return 0;
+}
+
+int test_libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(events);
+	NUT_UNUSED_VARIABLE(flags);
+	NUT_UNUSED_VARIABLE(vendor_id);
+	NUT_UNUSED_VARIABLE(product_id);
+	NUT_UNUSED_VARIABLE(dev_class);
+	NUT_UNUSED_VARIABLE(cb_fn);
+	NUT_UNUSED_VARIABLE(user_data);
+	NUT_UNUSED_VARIABLE(callback_handle);
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void test_libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
+{
+	NUT_UNUSED_VARIABLE(ctx);
+	NUT_UNUSED_VARIABLE(callback_handle);
+}
+
+# include "usb-common.c"
+# include "libusb1.c"
+
+typedef libusb_device_handle	test_handle_t;
+
+#else	/* WITH_LIBUSB_0_1 */
+/* ---------------------------------------------------------------------
+ * libusb 0.1: its API does not change any more, so the fakes simply
+ * stand for the library functions libusb0.c (and usb-common.c) use
+ */
+
+# include "usb-common.h"
+
+struct usb_dev_handle {
+	struct usb_device	*dev;
+};
+
+static struct usb_bus	test_usb_bus;
+static struct usb_device	test_usb_devices[TEST_BUS_SIZE];
+
+struct usb_bus	*usb_busses = NULL;
+
+void usb_init(void)
+{
+}
+
+int usb_find_busses(void)
+{
+	snprintf(test_usb_bus.dirname, sizeof(test_usb_bus.dirname), "%s", "001");
+	usb_busses = &test_usb_bus;
+	return 0;
+}
+
+int usb_find_devices(void)
+{
+	size_t	i;
+
+	test_enumerations++;
+
+	memset(test_usb_devices, 0, sizeof(test_usb_devices));
+	for (i = 0; i < test_bus_count; i++) {
+		struct usb_device	*dev = &test_usb_devices[i];
+
+		dev->next = (i + 1 < test_bus_count) ? &test_usb_devices[i + 1] : NULL;
+		dev->bus = &test_usb_bus;
+		snprintf(dev->filename, sizeof(dev->filename), "%03u", (unsigned int)(i + 2));
+		dev->descriptor.idVendor = test_bus[i].VendorID;
+		dev->descriptor.idProduct = 0x0001;
+		dev->descriptor.iManufacturer = 1;
+		dev->descriptor.iProduct = 2;
+		dev->descriptor.iSerialNumber = 3;
+	}
+	test_usb_bus.devices = test_bus_count ? &test_usb_devices[0] : NULL;
+
+	return 0;
+}
+
+struct usb_bus *usb_get_busses(void)
+{
+	return usb_busses;
+}
+
+usb_dev_handle *usb_open(struct usb_device *dev)
+{
+	usb_dev_handle	*udev = malloc(sizeof(*udev));
+
+	if (udev != NULL) {
+		udev->dev = dev;
+		test_bus[dev - test_usb_devices].opens++;
+		test_opens++;
+	}
+
+	return udev;
+}
+
+int usb_close(usb_dev_handle *dev)
+{
+	free(dev);
+	return 0;
+}
+
+int usb_get_string(usb_dev_handle *dev, int index, int langid, char *buf, size_t buflen)
+{
+	NUT_UNUSED_VARIABLE(langid);
+	return test_string(&test_bus[dev->dev - test_usb_devices], index,
+		(unsigned char *)buf, (int)buflen);
+}
+
+int usb_get_descriptor(usb_dev_handle *udev, unsigned char type, unsigned char index, void *buf, int size)
+{
+	NUT_UNUSED_VARIABLE(udev);
+	NUT_UNUSED_VARIABLE(type);
+	NUT_UNUSED_VARIABLE(index);
+	NUT_UNUSED_VARIABLE(buf);
+	NUT_UNUSED_VARIABLE(size);
+	return -1;
+}
+
+int usb_control_msg(usb_dev_handle *dev, int requesttype, int request, int value, int index, char *bytes, int size, int timeout)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(requesttype);
+	NUT_UNUSED_VARIABLE(request);
+	NUT_UNUSED_VARIABLE(value);
+	NUT_UNUSED_VARIABLE(index);
+	NUT_UNUSED_VARIABLE(bytes);
+	NUT_UNUSED_VARIABLE(size);
+	NUT_UNUSED_VARIABLE(timeout);
+	return -1;
+}
+
+int usb_interrupt_read(usb_dev_handle *dev, int ep, char *bytes, int size, int timeout)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(ep);
+	NUT_UNUSED_VARIABLE(bytes);
+	NUT_UNUSED_VARIABLE(size);
+	NUT_UNUSED_VARIABLE(timeout);
+	return -1;
+}
+
+int usb_set_configuration(usb_dev_handle *dev, int configuration)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(configuration);
+	return 0;
+}
+
+int usb_claim_interface(usb_dev_handle *dev, int interface)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(interface);
+	return 0;
+}
+
+int usb_release_interface(usb_dev_handle *dev, int interface)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(interface);
+	return 0;
+}
+
+int usb_set_altinterface(usb_dev_handle *dev, int alternate)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(alternate);
+	return 0;
+}
+
+int usb_clear_halt(usb_dev_handle *dev, unsigned int ep)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(ep);
+	return 0;
+}
+
+int usb_detach_kernel_driver_np(usb_dev_handle *dev, int interface)
+{
+	NUT_UNUSED_VARIABLE(dev);
+	NUT_UNUSED_VARIABLE(interface);
+	return -1;
+}
+
+char *usb_strerror(void)
+{
+	return "Error";
+}
+
+# include "usb-common.c"
+# include "libusb0.c"
+
+typedef usb_dev_handle	test_handle_t;
+
+#endif	/* WITH_LIBUSB_0_1 */
+
+/* ---------------------------------------------------------------------
+ * what the USB code sees of main.c and dstate.c
+ */
+
+size_t	hosted_devices = 3;
+
+void addvar(int vartype, const char *name, const char *desc)
+{
+	NUT_UNUSED_VARIABLE(vartype);
+	NUT_UNUSED_VARIABLE(name);
+	NUT_UNUSED_VARIABLE(desc);
+}
+
+char *getval(const char *var) { NUT_UNUSED_VARIABLE(var); return NULL; }
+int testvar(const char *var) { NUT_UNUSED_VARIABLE(var); return 0; }
+
+int dstate_setinfo(const char *var, const char *fmt, ...)
+{
+	NUT_UNUSED_VARIABLE(var);
+	NUT_UNUSED_VARIABLE(fmt);
+	return 1;
+}
+
+const char *dstate_getinfo(const char *var)
+{
+	NUT_UNUSED_VARIABLE(var);
+	return NULL;
+}
+
+int dstate_addevent(int fd, short events, dstate_event_handler_t handler, void *arg)
+{
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(events);
+	NUT_UNUSED_VARIABLE(handler);
+	NUT_UNUSED_VARIABLE(arg);
+	return -1;
+}
+
+void dstate_delevent(int fd)
+{
+	NUT_UNUSED_VARIABLE(fd);
+}
+
+/* ---------------------------------------------------------------------
+ * the checks
+ */
+
+/* Open the device of the Acme vendor ID with this serial number */
+static int test_open(const char *serial, test_handle_t **udev, USBDevice_t *dev)
+{
+	USBDeviceMatcher_t	*matcher = NULL;
+	char	*regex[USBMATCHER_REGEXP_ARRAY_LIMIT];
+	int	ret;
+
+	memset(regex, 0, sizeof(regex));
+	regex[0] = "1234";
+	regex[4] = (char *)serial;
+	if (USBNewRegexMatcher(&matcher, regex, REG_ICASE | REG_EXTENDED) != 0) {
+		fatalx(EXIT_FAILURE, "Can't make the matcher for %s", serial);
+	}
+
+	ret = usb_subdriver.open_dev(udev, dev, matcher, NULL);
+	USBFreeRegexMatcher(matcher);
+
+	return ret;
+}
+
+static int expect_open(const char *serial, int ret, const USBDevice_t *dev)
+{
+	if (ret >= 1 && dev->Serial && !strcmp(dev->Serial, serial)) {
+		return 0;
+	}
+
+	printf("  opening %s returned %i, device %s (FAIL)\n",
+		serial, ret, NUT_STRARG(dev->Serial));
+
+	return 1;
+}
+
+static int expect_count(const char *what, int count, int expected)
+{
+	if (count == expected) {
+		return 0;
+	}
+
+	printf("  %s %i times, not %i (FAIL)\n", what, count, expected);
+
+	return 1;
+}
+
+static int check_bus(void)
+{
+	int	res = 0, ret, i;
+	const char	*serials[] = { "S1", "S2", "S3", "S5" };
+	test_handle_t	*udev[4] = { NULL, NULL, NULL, NULL }, *none = NULL;
+	USBDevice_t	dev[5];
+
+	memset(dev, 0, sizeof(dev));
+
+	/* three devices of a group, one after the other */
+	for (i = 0; i < 3; i++) {
+		ret = test_open(serials[i], &udev[i], &dev[i]);
+		res += expect_open(serials[i], ret, &dev[i]);
+	}
+	res += expect_count("the other vendor's device was opened", test_bus[2].opens, 0);
+#if WITH_LIBUSB_1_0
+	/* S4, S3, S2 and S1 were each opened to read their strings, and
+	 * the other two once more when they were looked for */
+	res += expect_count("the bus was enumerated", test_enumerations, 1);
+	res += expect_count("devices were opened", test_opens, 6);
+	res += expect_count("strings were read", test_strings, 12);
+#endif
+
+	/* one plugged in since: found by enumerating the bus again */
+	test_bus_count = TEST_BUS_SIZE;
+	ret = test_open(serials[3], &udev[3], &dev[3]);
+	res += expect_open(serials[3], ret, &dev[3]);
+#if WITH_LIBUSB_1_0
+	res += expect_count("the bus was enumerated", test_enumerations, 2);
+	res += expect_count("devices were opened", test_opens, 7);
+#endif
+
+	/* the second one reconnects */
+	usb_subdriver.close_dev(udev[1]);
+	udev[1] = NULL;
+	test_opens = 0;
+	ret = test_open(serials[1], &udev[1], &dev[1]);
+	res += expect_open(serials[1], ret, &dev[1]);
+#if WITH_LIBUSB_1_0
+	res += expect_count("the bus was enumerated", test_enumerations, 2);
+	res += expect_count("devices were opened", test_opens, 1);
+#endif
+
+	/* not there at all */
+	test_opens = 0;
+	ret = test_open("S9", &none, &dev[4]);
+	if (ret >= 1) {
+		printf("  opening S9 returned %i (FAIL)\n", ret);
+		res++;
+	}
+#if WITH_LIBUSB_1_0
+	res += expect_count("devices were opened", test_opens, 0);
+#endif
+
+	for (i = 0; i < 4; i++) {
+		usb_subdriver.close_dev(udev[i]);
+	}
+	for (i = 0; i < 5; i++) {
+		free(dev[i].Vendor);
+		free(dev[i].Product);
+		free(dev[i].Serial);
+		free(dev[i].Bus);
+		free(dev[i].Device);
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+		free(dev[i].BusPort);
+#endif
+	}
+
+	return res;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += check_bus();
+
+	if (ret != 0)
+		printf("nutusbbustest collected %i errors\n", ret);
+
+	return (ret != 0);
+}
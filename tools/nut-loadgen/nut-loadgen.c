@@ -0,0 +1,948 @@
+/*  nut-loadgen.c - many concurrent clients of upsd, running a mix of
+ *  requests with think times, to tell how many clients a upsd can serve
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* Each client is a connection of libupsclient, opened (and optionally
+ * upgraded with STARTTLS) at a set rate, which then loops on: think for
+ * a while, pick a request by the weights of the mix, wait for its answer.
+ * All of them are driven from one poll() loop with the upscli_queue()
+ * API, so that thousands of clients cost little here, and the numbers
+ * are those of upsd. The requests:
+ *	get	GET VAR <ups> <var>
+ *	list	LIST VAR <ups>
+ *	login	a new connection with USERNAME, PASSWORD and LOGIN <ups>,
+ *		as upsmon makes (it stays in LIST CLIENT until it is closed)
+ *	instcmd	INSTCMD <ups> <cmd>, on connections which were given the
+ *		USERNAME and PASSWORD when they were opened
+ * and "connect" counts the opening of the connections themselves.
+ *
+ * The clients are measured once they all are connected, for the set
+ * duration; the report has the throughput, the latency percentiles and
+ * errors of each request, the connections dropped by upsd, and how many
+ * clients upsd had logged in for the UPS (LIST CLIENT) before, during
+ * and after the run, as a table on stderr and one JSON object on stdout.
+ *
+ * Keep the think times under CLIENT_INACTIVITY_DELAY of upsd.conf (60s
+ * by default), or raise it: upsd sheds the clients idle for longer,
+ * which then show up as drops here, and not as a limit of upsd.
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "timehead.h"
+#include "upsclient.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+/* kinds of requests (the mix), and of the connection opening */
+#define LG_GET		0
+#define LG_LIST		1
+#define LG_LOGIN	2
+#define LG_INSTCMD	3
+#define LG_CONNECT	4
+#define LG_KINDS	5
+
+static const char	*lg_names[LG_KINDS] = { "get", "list", "login", "instcmd", "connect" };
+
+/* what a client is doing */
+#define LG_DOWN		0	/* not connected, until next */
+#define LG_CONNECTING	1
+#define LG_BUSY		2	/* waiting for answers */
+#define LG_THINK	3	/* until next */
+
+/* errors which are not those of libupsclient */
+#define LG_ERR_TIMEOUT	(UPSCLI_ERR_MAX + 1)
+#define LG_ERR_COUNT	(UPSCLI_ERR_MAX + 2)
+
+typedef struct {
+	UPSCONN_t	ups;
+	int	state;
+	int	kind;	/* of the request (or opening) in progress */
+	int	failed;	/* the first error of its answers, else 0 */
+	size_t	steps;	/* answers it still waits for */
+	uint64_t	started, next;	/* in usec */
+	int	opened;	/* connected once, at least */
+} lg_client_t;
+
+/* latencies of one kind of request, in usec, and its errors */
+typedef struct {
+	unsigned long	weight;
+	uint32_t	*samples;
+	size_t	count, size;
+	unsigned long	errors;
+} lg_stats_t;
+
+static lg_client_t	*clients = NULL;
+static size_t	nclients = 100;
+static lg_stats_t	stats[LG_KINDS];
+static unsigned long	weights_total = 0;
+
+static unsigned long	errcount[LG_ERR_COUNT];
+static char	*errmsg[LG_ERR_COUNT];
+static unsigned long	drops = 0;
+
+static char	*host = NULL, *upsname = NULL;
+static const char	*varname = "ups.status", *cmdname = NULL;
+static const char	*username = NULL, *password = NULL;
+static uint16_t	port = 0;
+static int	flags = 0;
+static long	think_min = 1000, think_max = 1000, timeout_ms = 10000;
+
+static int	measuring = 0;
+static unsigned long	interval_ops = 0;
+
+/* the control connection, for LIST CLIENT */
+static UPSCONN_t	ctl;
+static int	ctl_state = LG_DOWN, ctl_pending = 0;
+static long	ctl_count = 0, ctl_first = -1, ctl_peak = -1, ctl_last = -1;
+
+static volatile sig_atomic_t	stop_flag = 0;
+
+static void set_stop_flag(int sig)
+{
+	NUT_UNUSED_VARIABLE(sig);
+	stop_flag = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Open many concurrent connections to upsd and run a mix of requests\n");
+	printf("on them with think times, to tell how many clients it can serve.\n");
+	printf("Prints the results as a table on stderr and one JSON object on stdout.\n\n");
+	printf("Usage: %s [OPTIONS] <ups>[@<host>[:<port>]]\n\n", prog);
+	printf("  -c <count>	concurrent connections (default 100)\n");
+	printf("  -r <count>	connections opened per second (default 1000)\n");
+	printf("  -d <sec>	duration of the measurement, once all are connected (default 30)\n");
+	printf("  -m <mix>	weights of the requests (default get=1), of:\n");
+	printf("		get, list, login, instcmd; e.g. get=80,list=15,login=5\n");
+	printf("  -t <ms>[-<ms>]	think time before each request, or its range (default 1000)\n");
+	printf("  -v <var>	variable for get (default ups.status)\n");
+	printf("  -i <cmd>	instant command for instcmd\n");
+	printf("  -u <user>	user for login and instcmd, from upsd.users\n");
+	printf("  -p <pass>	password of that user\n");
+	printf("  -s		use STARTTLS where upsd has it\n");
+	printf("  -S		use STARTTLS, or fail\n");
+	printf("  -C <path>	certificates to verify upsd with (implies -S)\n");
+	printf("  -T <ms>	time for an answer or connection, else an error (default 10000)\n");
+	printf("  -I <sec>	interval of the progress lines and LIST CLIENT (default 5)\n");
+	printf("  -D		raise the debugging level\n");
+}
+
+static uint64_t now_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#else
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+#endif
+}
+
+/* xorshift: the mix and think times need not be any better */
+static uint32_t lg_random(void)
+{
+	static uint32_t	x = 2463534242U;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return x;
+}
+
+static uint64_t think_usec(void)
+{
+	long	ms = think_min;
+
+	if (think_max > think_min)
+		ms += (long)(lg_random() % (uint32_t)(think_max - think_min + 1));
+
+	return (uint64_t)ms * 1000;
+}
+
+static void parse_mix(const char *mix)
+{
+	char	buf[SMALLBUF], *tok, *last = NULL, *eq;
+	int	i;
+
+	snprintf(buf, sizeof(buf), "%s", mix);
+
+	for (tok = strtok_r(buf, ",", &last); tok; tok = strtok_r(NULL, ",", &last)) {
+		if ((eq = strchr(tok, '=')) == NULL)
+			fatalx(EXIT_FAILURE, "Invalid mix entry [%s], see -h", tok);
+		*eq++ = '\0';
+
+		for (i = 0; i < LG_CONNECT; i++) {
+			if (!strcmp(tok, lg_names[i]))
+				break;
+		}
+		if (i == LG_CONNECT)
+			fatalx(EXIT_FAILURE, "Unknown request [%s] in the mix, see -h", tok);
+
+		stats[i].weight = strtoul(eq, NULL, 10);
+	}
+
+	weights_total = 0;
+	for (i = 0; i < LG_CONNECT; i++)
+		weights_total += stats[i].weight;
+}
+
+static int pick_kind(void)
+{
+	unsigned long	r = (unsigned long)lg_random() % weights_total;
+	int	i;
+
+	for (i = 0; i < LG_CONNECT - 1; i++) {
+		if (r < stats[i].weight)
+			break;
+		r -= stats[i].weight;
+	}
+
+	return i;
+}
+
+/* thousands of connections need as many descriptors */
+static void raise_nofile(size_t need)
+{
+	struct rlimit	rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+		return;
+
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)need) {
+		rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)need)
+			? (rlim_t)need : rl.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < (rlim_t)need) {
+			upslogx(LOG_WARNING, "Open files are limited to %lu, not enough for %" PRIuSIZE
+				" connections (see ulimit -n)", (unsigned long)rl.rlim_cur, nclients);
+		}
+	}
+}
+
+static void stats_add(lg_stats_t *st, uint64_t usec)
+{
+	if (st->count == st->size) {
+		st->size = (st->size ? st->size * 2 : 1024);
+		st->samples = xrealloc(st->samples, st->size * sizeof(*st->samples));
+	}
+	st->samples[st->count++] = (usec > UINT32_MAX) ? UINT32_MAX : (uint32_t)usec;
+}
+
+/* something went wrong: counted by kind, with the first message of each */
+static void lg_error(UPSCONN_t *ups, int upserror)
+{
+	if (upserror < 0 || upserror >= LG_ERR_COUNT)
+		upserror = UPSCLI_ERR_UNKNOWN;
+
+	errcount[upserror]++;
+
+	if (!errmsg[upserror]) {
+		if (upserror == LG_ERR_TIMEOUT) {
+			errmsg[upserror] = xstrdup("Timed out");
+		} else {
+			ups->upserror = upserror;
+			errmsg[upserror] = xstrdup(upscli_strerror(ups));
+		}
+	}
+}
+
+/* all the answers to a request (or opening) came */
+static void client_done(lg_client_t *cl, uint64_t now)
+{
+	lg_stats_t	*st = &stats[cl->kind];
+
+	if (measuring || cl->kind == LG_CONNECT) {
+		if (cl->failed) {
+			st->errors++;
+		} else {
+			stats_add(st, now - cl->started);
+		}
+		if (measuring)
+			interval_ops++;
+	}
+
+	cl->state = LG_THINK;
+	cl->next = now + think_usec();
+}
+
+static void client_reply(UPSCONN_t *ups, void *arg, int upserror, size_t numa, char **answer)
+{
+	lg_client_t	*cl = (lg_client_t *)arg;
+
+	NUT_UNUSED_VARIABLE(answer);
+
+	if (upserror != UPSCLI_ERR_NONE) {
+		if (!cl->failed) {
+			cl->failed = upserror;
+			lg_error(ups, upserror);
+		}
+	} else if (cl->kind == LG_LIST && numa > 0) {
+		/* a line of the list, its end comes with numa == 0 */
+		return;
+	}
+
+	if (cl->steps > 0 && --cl->steps == 0)
+		client_done(cl, now_usec());
+}
+
+static void client_queue(lg_client_t *cl, const char *cmd, size_t numq, const char **query)
+{
+	if (upscli_queue(&cl->ups, cmd, numq, query, client_reply, cl) < 0) {
+		if (!cl->failed) {
+			cl->failed = upscli_upserror(&cl->ups);
+			lg_error(&cl->ups, cl->failed);
+		}
+		return;
+	}
+
+	cl->steps++;
+}
+
+/* connected: logins and connections for instcmd send their credentials */
+static void client_connected(lg_client_t *cl, uint64_t now)
+{
+	const char	*query[1];
+
+	cl->state = LG_BUSY;
+	cl->steps = 0;
+
+	cl->opened = 1;
+
+	if (cl->kind == LG_LOGIN || (username && stats[LG_INSTCMD].weight)) {
+		query[0] = username;
+		client_queue(cl, "USERNAME", 1, query);
+		query[0] = password;
+		client_queue(cl, "PASSWORD", 1, query);
+	}
+
+	if (cl->kind == LG_LOGIN) {
+		query[0] = upsname;
+		client_queue(cl, "LOGIN", 1, query);
+	}
+
+	if (cl->steps == 0)
+		client_done(cl, now);
+}
+
+static void client_connect(lg_client_t *cl, int kind, uint64_t now)
+{
+	int	ret;
+
+	cl->kind = kind;
+	cl->failed = 0;
+	cl->steps = 0;
+	cl->started = now;
+
+	ret = upscli_connect_start(&cl->ups, host, port, flags);
+
+	if (ret < 0) {
+		cl->failed = upscli_upserror(&cl->ups);
+		lg_error(&cl->ups, cl->failed);
+		client_done(cl, now);
+		/* retry after a second, not after a think time */
+		cl->state = LG_DOWN;
+		cl->next = now + 1000000;
+		cl->opened = 1;
+		return;
+	}
+
+	if (ret > 0) {
+		cl->state = LG_CONNECTING;
+		return;
+	}
+
+	client_connected(cl, now);
+}
+
+/* the connection failed in a given state, its requests were told already */
+static void client_lost(lg_client_t *cl, int was, uint64_t now)
+{
+	if (was == LG_CONNECTING) {
+		cl->failed = upscli_upserror(&cl->ups);
+		lg_error(&cl->ups, cl->failed);
+		client_done(cl, now);
+		cl->opened = 1;
+	} else {
+		/* e.g. shed by upsd when idle, then no request was pending */
+		if (was == LG_THINK)
+			lg_error(&cl->ups, upscli_upserror(&cl->ups));
+		drops++;
+	}
+
+	upscli_disconnect(&cl->ups);
+	cl->state = LG_DOWN;
+	cl->next = now + 1000000;
+}
+
+static void client_start(lg_client_t *cl, uint64_t now)
+{
+	int	kind = pick_kind();
+	const char	*query[3];
+
+	if (kind == LG_LOGIN) {
+		upscli_disconnect(&cl->ups);
+		client_connect(cl, LG_LOGIN, now);
+		return;
+	}
+
+	cl->kind = kind;
+	cl->failed = 0;
+	cl->steps = 0;
+	cl->started = now;
+	cl->state = LG_BUSY;
+
+	switch (kind) {
+		case LG_GET:
+			query[0] = "VAR";
+			query[1] = upsname;
+			query[2] = varname;
+			client_queue(cl, "GET", 3, query);
+			break;
+
+		case LG_LIST:
+			query[0] = "VAR";
+			query[1] = upsname;
+			client_queue(cl, "LIST", 2, query);
+			break;
+
+		default:
+			query[0] = upsname;
+			query[1] = cmdname;
+			client_queue(cl, "INSTCMD", 2, query);
+			break;
+	}
+
+	if (cl->steps == 0) {
+		client_done(cl, now);
+		return;
+	}
+
+	/* send it now, rather than after the next poll() */
+	if (upscli_process(&cl->ups) < 0)
+		client_lost(cl, LG_BUSY, now);
+}
+
+static void ctl_reply(UPSCONN_t *ups, void *arg, int upserror, size_t numa, char **answer)
+{
+	NUT_UNUSED_VARIABLE(ups);
+	NUT_UNUSED_VARIABLE(arg);
+	NUT_UNUSED_VARIABLE(answer);
+
+	if (upserror != UPSCLI_ERR_NONE) {
+		upslogx(LOG_WARNING, "LIST CLIENT %s failed: %s", upsname, upscli_strerror(ups));
+		ctl_pending = 0;
+		ctl_count = 0;
+		return;
+	}
+
+	if (numa > 0) {
+		ctl_count++;
+		return;
+	}
+
+	ctl_last = ctl_count;
+	if (ctl_first < 0)
+		ctl_first = ctl_count;
+	if (ctl_count > ctl_peak)
+		ctl_peak = ctl_count;
+
+	ctl_count = 0;
+	ctl_pending = 0;
+}
+
+/* ask LIST CLIENT on the control connection, connecting it if needed */
+static void ctl_sample(void)
+{
+	const char	*query[2];
+	int	ret;
+
+	if (ctl_pending)
+		return;
+
+	if (ctl_state == LG_DOWN) {
+		ret = upscli_connect_start(&ctl, host, port, flags);
+		if (ret < 0) {
+			upslogx(LOG_WARNING, "Can not connect to upsd for LIST CLIENT: %s", upscli_strerror(&ctl));
+			return;
+		}
+		ctl_state = (ret > 0) ? LG_CONNECTING : LG_BUSY;
+	}
+
+	query[0] = "CLIENT";
+	query[1] = upsname;
+	if (upscli_queue(&ctl, "LIST", 2, query, ctl_reply, NULL) == 0)
+		ctl_pending = 1;
+}
+
+static void ctl_event(void)
+{
+	int	ret;
+
+	if (ctl_state == LG_CONNECTING) {
+		ret = upscli_connect_continue(&ctl);
+		if (ret > 0)
+			return;
+		ctl_state = (ret == 0) ? LG_BUSY : LG_DOWN;
+		if (ret < 0) {
+			ctl_pending = 0;
+			return;
+		}
+	}
+
+	if (upscli_process(&ctl) < 0) {
+		upscli_disconnect(&ctl);
+		ctl_state = LG_DOWN;
+		ctl_pending = 0;
+	}
+}
+
+static short poll_events(UPSCONN_t *ups)
+{
+	int	want = upscli_want(ups);
+	short	events = 0;
+
+	if (want & UPSCLI_WANT_READ)
+		events |= POLLIN;
+	if (want & UPSCLI_WANT_WRITE)
+		events |= POLLOUT;
+
+	return events;
+}
+
+/* the connections upgraded with STARTTLS */
+static unsigned long count_tls(void)
+{
+	unsigned long	n = 0;
+	size_t	i;
+
+	for (i = 0; i < nclients; i++) {
+		if (clients[i].state != LG_DOWN && upscli_ssl(&clients[i].ups) == 1)
+			n++;
+	}
+
+	return n;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t	x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* nearest rank, in msec */
+static double percentile(const lg_stats_t *st, double q)
+{
+	size_t	rank;
+
+	if (st->count == 0)
+		return 0;
+
+	rank = (size_t)(q * (double)st->count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > st->count)
+		rank = st->count;
+
+	return (double)st->samples[rank - 1] / 1000;
+}
+
+static void stats_print(const char *name, lg_stats_t *st, double seconds)
+{
+	qsort(st->samples, st->count, sizeof(*st->samples), cmp_u32);
+
+	printf(",\"%s\":{\"count\":%" PRIuSIZE ",\"errors\":%lu,\"per_s\":%.1f,"
+		"\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f}",
+		name, st->count, st->errors, seconds > 0 ? (double)st->count / seconds : 0,
+		percentile(st, 0.5), percentile(st, 0.9), percentile(st, 0.99),
+		percentile(st, 0.999), percentile(st, 1.0));
+
+	if (st->count || st->errors) {
+		fprintf(stderr, "%-8s %9" PRIuSIZE " %7lu %9.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+			name, st->count, st->errors, seconds > 0 ? (double)st->count / seconds : 0,
+			percentile(st, 0.5), percentile(st, 0.9), percentile(st, 0.99),
+			percentile(st, 0.999), percentile(st, 1.0));
+	}
+}
+
+/* the messages in the JSON, without what would need escaping */
+static void json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++)
+		putchar((*s == '"' || *s == '\\' || (unsigned char)*s < 0x20) ? '\'' : *s);
+	putchar('"');
+}
+
+int main(int argc, char **argv)
+{
+	char	*s;
+	size_t	i, nfds, connected, started_count = 0;
+	long	rate = 1000, duration = 30, interval = 5;
+	uint64_t	now, begun, t0 = 0, t_end = 0, next_sample = 0, next_report = 0, t_stop = 0;
+	unsigned long	ops = 0, errors = 0, tls = 0;
+	double	seconds;
+	struct pollfd	*pfd;
+	size_t	*pfd_client;
+	struct sigaction	sa;
+	int	opt, timeout, k, certverify = 0;
+	const char	*certpath = NULL, *mix = "get=1";
+
+	while ((opt = getopt(argc, argv, "c:r:d:m:t:v:i:u:p:sSC:T:I:Dh")) != -1) {
+		switch (opt) {
+			case 'c':
+				nclients = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				rate = atol(optarg);
+				break;
+			case 'd':
+				duration = atol(optarg);
+				break;
+			case 'm':
+				mix = optarg;
+				break;
+			case 't':
+				think_min = think_max = atol(optarg);
+				if ((s = strchr(optarg, '-')) != NULL)
+					think_max = atol(s + 1);
+				break;
+			case 'v':
+				varname = optarg;
+				break;
+			case 'i':
+				cmdname = optarg;
+				break;
+			case 'u':
+				username = optarg;
+				break;
+			case 'p':
+				password = optarg;
+				break;
+			case 's':
+				flags |= UPSCLI_CONN_TRYSSL;
+				break;
+			case 'S':
+				flags |= UPSCLI_CONN_TRYSSL | UPSCLI_CONN_REQSSL;
+				break;
+			case 'C':
+				certpath = optarg;
+				certverify = 1;
+				flags |= UPSCLI_CONN_TRYSSL | UPSCLI_CONN_REQSSL | UPSCLI_CONN_CERTVERIF;
+				break;
+			case 'T':
+				timeout_ms = atol(optarg);
+				break;
+			case 'I':
+				interval = atol(optarg);
+				break;
+			case 'D':
+				nut_debug_level++;
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (optind != argc - 1)
+		fatalx(EXIT_FAILURE, "Which UPS? See -h");
+
+	if (upscli_splitname(argv[optind], &upsname, &host, &port) != 0)
+		fatalx(EXIT_FAILURE, "Invalid UPS definition [%s]", argv[optind]);
+
+	parse_mix(mix);
+
+	if (nclients < 1 || rate < 1 || duration < 1 || interval < 1 || timeout_ms < 1
+	 || think_min < 0 || think_max < think_min || weights_total < 1
+	) {
+		fatalx(EXIT_FAILURE, "Invalid arguments, see -h");
+	}
+
+	if ((stats[LG_LOGIN].weight || stats[LG_INSTCMD].weight) && (!username || !password))
+		fatalx(EXIT_FAILURE, "The login and instcmd requests need -u and -p");
+
+	if (stats[LG_INSTCMD].weight && !cmdname)
+		fatalx(EXIT_FAILURE, "The instcmd requests need -i");
+
+	if (think_max >= 60000) {
+		upslogx(LOG_WARNING, "Think times of 60s or more get the clients shed by upsd, "
+			"unless its CLIENT_INACTIVITY_DELAY is longer");
+	}
+
+	if (flags & UPSCLI_CONN_TRYSSL) {
+		if (upscli_init(certverify, certpath, NULL, NULL) < 0)
+			fatalx(EXIT_FAILURE, "Can not initialize SSL");
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = set_stop_flag;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	raise_nofile(nclients + 64);
+
+	clients = xcalloc(nclients, sizeof(*clients));
+	for (i = 0; i < nclients; i++)
+		clients[i].state = LG_DOWN;
+
+	pfd = xcalloc(nclients + 1, sizeof(*pfd));
+	pfd_client = xcalloc(nclients + 1, sizeof(*pfd_client));
+
+	/* the count before the run */
+	begun = now_usec();
+	ctl_sample();
+	while (ctl_first < 0 && !stop_flag) {
+		if (ctl_state == LG_DOWN || now_usec() - begun > (uint64_t)timeout_ms * 1000)
+			fatalx(EXIT_FAILURE, "Can not LIST CLIENT %s at upsd on %s", upsname, host);
+		pfd[0].fd = upscli_fd(&ctl);
+		pfd[0].events = poll_events(&ctl);
+		if (poll(pfd, 1, 100) > 0)
+			ctl_event();
+	}
+
+	fprintf(stderr, "Opening %" PRIuSIZE " connections to %s:%" PRIu16 " at %ld per second%s\n",
+		nclients, host, port, rate,
+		(flags & UPSCLI_CONN_REQSSL) ? " with STARTTLS" : (flags & UPSCLI_CONN_TRYSSL) ? " with STARTTLS if possible" : "");
+
+	begun = now_usec();
+	next_sample = begun + (uint64_t)interval * 1000000;
+
+	while (!t_stop || ctl_pending) {
+		now = now_usec();
+
+		/* the end of the run, and then of the last LIST CLIENT */
+		if (!t_stop && (stop_flag || (measuring && now >= t_end))) {
+			t_stop = now;
+			measuring = 0;
+			ctl_sample();
+		}
+		if (t_stop && now - t_stop > (uint64_t)timeout_ms * 1000)
+			break;
+
+		/* the ramp up */
+		while (!t_stop && started_count < nclients
+		 && (started_count < (size_t)((now - begun) * (uint64_t)rate / 1000000) + 1)
+		) {
+			client_connect(&clients[started_count], LG_CONNECT, now);
+			started_count++;
+		}
+
+		if (!measuring && !t_stop && started_count == nclients) {
+			for (i = 0, connected = 0; i < nclients; i++) {
+				if (clients[i].opened)
+					connected++;
+			}
+			if (connected == nclients) {
+				measuring = 1;
+				t0 = now;
+				t_end = now + (uint64_t)duration * 1000000;
+				next_report = now + (uint64_t)interval * 1000000;
+				interval_ops = 0;
+				fprintf(stderr, "Connected in %.3fs, %lu with TLS; measuring for %lds\n",
+					(double)(now - begun) / 1e6, count_tls(), duration);
+			}
+		}
+
+		if (!t_stop && now >= next_sample) {
+			ctl_sample();
+			next_sample = now + (uint64_t)interval * 1000000;
+		}
+
+		if (measuring && now >= next_report) {
+			for (i = 0, connected = 0; i < nclients; i++) {
+				if (clients[i].state != LG_DOWN && clients[i].state != LG_CONNECTING)
+					connected++;
+			}
+			fprintf(stderr, "%6.1fs  %" PRIuSIZE " connected, %.1f requests/s, %lu dropped, LIST CLIENT %ld\n",
+				(double)(now - t0) / 1e6, connected, (double)interval_ops / (double)interval,
+				drops, ctl_last);
+			interval_ops = 0;
+			next_report += (uint64_t)interval * 1000000;
+		}
+
+		/* what to wait for, and until when */
+		timeout = 100;
+		nfds = 0;
+
+		for (i = 0; i < nclients; i++) {
+			lg_client_t	*cl = &clients[i];
+
+			if (i >= started_count)
+				break;
+
+			if ((cl->state == LG_CONNECTING || cl->state == LG_BUSY)
+			 && now - cl->started > (uint64_t)timeout_ms * 1000
+			) {
+				if (!cl->failed) {
+					cl->failed = LG_ERR_TIMEOUT;
+					lg_error(&cl->ups, LG_ERR_TIMEOUT);
+				}
+				cl->steps = 0;
+				client_done(cl, now);
+				cl->opened = 1;
+				/* what comes on the connection now is of no use */
+				upscli_disconnect(&cl->ups);
+				cl->state = LG_DOWN;
+				cl->next = now;
+			}
+
+			if (!t_stop && (cl->state == LG_DOWN || cl->state == LG_THINK) && now >= cl->next) {
+				if (cl->state == LG_DOWN)
+					client_connect(cl, LG_CONNECT, now);
+				else if (measuring)
+					client_start(cl, now);
+			}
+
+			if ((cl->state == LG_DOWN || cl->state == LG_THINK) && cl->next > now) {
+				uint64_t	t = (cl->next - now + 999) / 1000;
+
+				if (t < (uint64_t)timeout)
+					timeout = (int)t;
+			}
+
+			if (cl->state == LG_DOWN || upscli_fd(&cl->ups) < 0)
+				continue;
+
+			pfd[nfds].fd = upscli_fd(&cl->ups);
+			pfd[nfds].events = poll_events(&cl->ups);
+			pfd_client[nfds] = i;
+			nfds++;
+		}
+
+		if (ctl_state != LG_DOWN && upscli_fd(&ctl) >= 0) {
+			pfd[nfds].fd = upscli_fd(&ctl);
+			pfd[nfds].events = poll_events(&ctl);
+			pfd_client[nfds] = nclients;
+			nfds++;
+		}
+
+		if (poll(pfd, (nfds_t)nfds, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		}
+
+		now = now_usec();
+		for (i = 0; i < nfds; i++) {
+			lg_client_t	*cl;
+			int	ret, was;
+
+			if (!pfd[i].revents)
+				continue;
+
+			if (pfd_client[i] == nclients) {
+				ctl_event();
+				continue;
+			}
+
+			cl = &clients[pfd_client[i]];
+
+			if (cl->state == LG_CONNECTING) {
+				ret = upscli_connect_continue(&cl->ups);
+				if (ret == 0)
+					client_connected(cl, now);
+				else if (ret < 0)
+					client_lost(cl, LG_CONNECTING, now);
+				if (ret != 0 || cl->state != LG_BUSY)
+					continue;
+			}
+
+			was = cl->state;
+			if (upscli_process(&cl->ups) < 0)
+				client_lost(cl, was, now);
+		}
+	}
+
+	seconds = (double)((t_stop ? t_stop : now_usec()) - t0) / 1e6;
+	if (!t0)
+		seconds = 0;
+	tls = count_tls();
+
+	for (k = 0; k < LG_CONNECT; k++) {
+		ops += (unsigned long)stats[k].count;
+		errors += stats[k].errors;
+	}
+
+	fprintf(stderr, "\n%-8s %9s %7s %9s %9s %9s %9s %9s %9s\n",
+		"REQUEST", "COUNT", "ERRORS", "PER_S", "P50(ms)", "P90(ms)", "P99(ms)", "P999(ms)", "MAX(ms)");
+
+	printf("{\"ups\":");
+	json_string(upsname);
+	printf(",\"host\":");
+	json_string(host);
+	printf(",\"port\":%" PRIu16 ",\"connections\":%" PRIuSIZE ",\"tls\":%lu,\"seconds\":%.3f,"
+		"\"think_ms\":[%ld,%ld],\"requests\":%lu,\"requests_per_s\":%.1f,\"errors\":%lu,\"dropped\":%lu",
+		port, nclients, tls, seconds, think_min, think_max,
+		ops, seconds > 0 ? (double)ops / seconds : 0, errors, drops);
+
+	for (k = 0; k < LG_KINDS; k++)
+		stats_print(lg_names[k], &stats[k], k == LG_CONNECT ? 0 : seconds);
+
+	printf(",\"list_client\":{\"before\":%ld,\"peak\":%ld,\"after\":%ld}", ctl_first, ctl_peak, ctl_last);
+
+	fprintf(stderr, "\n%lu requests in %.3fs: %.1f per second, %lu errors, %lu connections dropped\n",
+		ops, seconds, seconds > 0 ? (double)ops / seconds : 0, errors, drops);
+	fprintf(stderr, "LIST CLIENT %s: %ld before, %ld at the most, %ld at the end\n",
+		upsname, ctl_first, ctl_peak, ctl_last);
+
+	printf(",\"error_kinds\":{");
+	for (k = 0, i = 0; k < LG_ERR_COUNT; k++) {
+		if (!errcount[k])
+			continue;
+		if (i++)
+			putchar(',');
+		json_string(errmsg[k]);
+		printf(":%lu", errcount[k]);
+		fprintf(stderr, "%9lu  %s\n", errcount[k], errmsg[k]);
+	}
+	printf("}}\n");
+
+	for (i = 0; i < nclients; i++)
+		upscli_disconnect(&clients[i].ups);
+	upscli_disconnect(&ctl);
+	if (flags & UPSCLI_CONN_TRYSSL)
+		upscli_cleanup();
+
+	for (k = 0; k < LG_KINDS; k++)
+		free(stats[k].samples);
+	for (k = 0; k < LG_ERR_COUNT; k++)
+		free(errmsg[k]);
+	free(pfd_client);
+	free(pfd);
+	free(clients);
+	free(upsname);
+	free(host);
+
+	return (stop_flag && !t0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -217,9 +217,25 @@ void nutscan_semaphore_set(sem_t *s);
 # endif
 #endif
 
+/* Shared pool of worker threads for the scans: submit one job per target
+ * to a batch (no more than "limit" of them at once, if not 0), then wait
+ * for all of them; the batch is freed by nutscan_pool_batch_wait().
+ * Without thread support, jobs run as they are submitted. */
+typedef struct nutscan_pool_batch_s nutscan_pool_batch_t;
+
+nutscan_pool_batch_t * nutscan_pool_batch_new(size_t limit);
+void nutscan_pool_submit(nutscan_pool_batch_t *batch, void *(*fn)(void *), void *arg);
+void nutscan_pool_batch_wait(nutscan_pool_batch_t *batch);
+
 /* Display functions */
 void nutscan_display_ups_conf(nutscan_device_t * device);
 void nutscan_display_parsable(nutscan_device_t * device);
+void nutscan_display_json(nutscan_device_t * device);
+
+/* Display just this one device of a list */
+void nutscan_display_ups_conf_device(nutscan_device_t * device);
+void nutscan_display_parsable_device(nutscan_device_t * device);
+void nutscan_display_json_device(nutscan_device_t * device);
 
 /* Display sanity-check concerns for various fields etc. (if any) */
 void nutscan_display_ups_conf_with_sanity_check(nutscan_device_t * device);
@@ -0,0 +1,709 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nut-scanner-cache.c
+    \brief discovery cache of nut-scanner, for incremental rescans
+
+    The cache is a text file, one record per line, with fields separated
+    by tabs (and backslash escapes for tabs, newlines and backslashes in
+    them):
+
+	DEVICE <type> <address or -> <first seen> <last seen> <driver> <port> [<option> <value>]...
+	PROBE <type> <address> <misses> <runs to skip>
+
+    Addresses with devices are probed first by incremental scans; PROBE
+    lines are kept for those which did not answer the last time(s).
+*/
+
+#include "common.h"	/* Must be first include to pull "config.h" */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nut_stdint.h"
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "nut-scanner-cache.h"
+
+#define CACHE_HASH	4096
+
+/* One address, as probed by one network scan type */
+typedef struct cache_addr_s {
+	nutscan_device_type_t	type;
+	char	*addr;
+	int	known;	/* has devices in the cache */
+	int	probed;	/* in this run */
+	int	found;	/* answered in this run */
+	unsigned int	misses;	/* runs in a row it did not answer */
+	unsigned int	skip;	/* runs it is still left out of */
+	struct cache_addr_s	*next;
+} cache_addr_t;
+
+typedef struct cache_dev_s {
+	nutscan_device_t	*device;	/* our own copy */
+	char	*key;
+	char	*addr;	/* NULL if not found on an address range */
+	long	first_seen;
+	long	last_seen;
+	int	loaded;	/* from the cache file */
+	int	found;	/* in this run */
+	struct cache_dev_s	*next;
+} cache_dev_t;
+
+static cache_addr_t	*cache_addrs[CACHE_HASH];
+static cache_dev_t	*cache_devs[CACHE_HASH];
+static long	cache_now;
+
+#ifdef HAVE_PTHREAD
+/* The device callback and the scan threads get here concurrently */
+static pthread_mutex_t	cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static size_t cache_hash(int type, const char *s)
+{
+	const unsigned char	*p;
+	size_t	h = 5381 + (size_t)type;
+
+	for (p = (const unsigned char *)s; *p; p++)
+		h = h * 33 + *p;
+
+	return h % CACHE_HASH;
+}
+
+static char *cache_strdup(const char *s)
+{
+	size_t	len = strlen(s) + 1;
+	char	*copy = xcalloc(1, len);
+
+	memcpy(copy, s, len);
+	return copy;
+}
+
+/* The network scans, whose devices have an address (and a miss count) */
+static int cache_is_ip_type(nutscan_device_type_t type)
+{
+	return (type == TYPE_SNMP || type == TYPE_XML
+		|| type == TYPE_NUT || type == TYPE_IPMI);
+}
+
+/* Addresses are kept without the brackets of IPv6 ones */
+static void strip_brackets(char *addr)
+{
+	size_t	len = strlen(addr);
+
+	if (len >= 2 && addr[0] == '[' && addr[len - 1] == ']') {
+		memmove(addr, addr + 1, len - 2);
+		addr[len - 2] = '\0';
+	}
+}
+
+/* The address a network scan found the device on, from its port:
+ * "addr" (SNMP), "http://addr" (XML), "ups@addr[:port]" (NUT) or
+ * "id@addr" (IPMI); NULL if there is none (caller frees the string) */
+static char *device_addr(nutscan_device_t *device)
+{
+	const char	*p, *q;
+	char	*addr;
+
+	if (!cache_is_ip_type(device->type) || device->port == NULL)
+		return NULL;
+
+	p = device->port;
+	if (device->type == TYPE_XML) {
+		if ((q = strstr(p, "://")) == NULL)
+			return NULL;
+		p = q + 3;
+	}
+	else if (device->type == TYPE_NUT || device->type == TYPE_IPMI) {
+		if ((q = strrchr(p, '@')) == NULL)
+			return NULL;
+		p = q + 1;
+	}
+
+	if (*p == '[') {
+		if ((q = strchr(p, ']')) == NULL)
+			return NULL;
+		p++;
+	}
+	else if ((q = strchr(p, ':')) == NULL || q != strrchr(p, ':')) {
+		/* no port, or a bare IPv6 address */
+		q = p + strcspn(p, "/");
+	}
+
+	if (q == p)
+		return NULL;
+
+	addr = xcalloc(1, (size_t)(q - p) + 1);
+	memcpy(addr, p, (size_t)(q - p));
+	return addr;
+}
+
+static cache_addr_t *cache_addr_get(nutscan_device_type_t type, const char *addr, int create)
+{
+	size_t	h = cache_hash((int)type, addr);
+	cache_addr_t	*entry;
+
+	for (entry = cache_addrs[h]; entry != NULL; entry = entry->next) {
+		if (entry->type == type && !strcmp(entry->addr, addr))
+			return entry;
+	}
+
+	if (!create)
+		return NULL;
+
+	entry = xcalloc(1, sizeof(*entry));
+	entry->type = type;
+	entry->addr = cache_strdup(addr);
+	entry->next = cache_addrs[h];
+	cache_addrs[h] = entry;
+
+	return entry;
+}
+
+static cache_dev_t *cache_dev_get(const char *key)
+{
+	cache_dev_t	*entry;
+
+	for (entry = cache_devs[cache_hash(0, key)]; entry != NULL; entry = entry->next) {
+		if (!strcmp(entry->key, key))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Takes over device and key */
+static cache_dev_t *cache_dev_add(nutscan_device_t *device, char *key)
+{
+	size_t	h = cache_hash(0, key);
+	cache_dev_t	*entry = xcalloc(1, sizeof(*entry));
+
+	entry->device = device;
+	entry->key = key;
+	entry->addr = device_addr(device);
+	entry->next = cache_devs[h];
+	cache_devs[h] = entry;
+
+	return entry;
+}
+
+static void cache_dev_free(cache_dev_t *entry)
+{
+	nutscan_free_device(entry->device);
+	free(entry->key);
+	free(entry->addr);
+	free(entry);
+}
+
+char * scan_device_key(nutscan_device_t * device)
+{
+	nutscan_options_t	*opt;
+	size_t	len = 32;
+	char	*key;
+
+	len += strlen(device->driver ? device->driver : "");
+	len += strlen(device->port ? device->port : "");
+	for (opt = device->opt; opt != NULL; opt = opt->next) {
+		len += strlen(opt->option ? opt->option : "") + 3;
+		len += strlen(opt->value ? opt->value : "");
+	}
+
+	key = xcalloc(1, len);
+	snprintf(key, len, "%d\n%s\n%s\n", (int)device->type,
+		device->driver ? device->driver : "",
+		device->port ? device->port : "");
+	for (opt = device->opt; opt != NULL; opt = opt->next) {
+		snprintfcat(key, len, "%s=%s\n",
+			opt->option ? opt->option : "",
+			opt->value ? opt->value : "");
+	}
+
+	return key;
+}
+
+static nutscan_device_type_t cache_type(const char *name)
+{
+	int	type;
+
+	for (type = TYPE_NONE + 1; type < TYPE_END; type++) {
+		if (!strcmp(name, nutscan_device_type_strings[type]))
+			return (nutscan_device_type_t)type;
+	}
+
+	return TYPE_NONE;
+}
+
+/* Read a whole line (without its newline) into *buf, growing it as
+ * needed; 0 at the end of the file */
+static int cache_read_line(FILE *f, char **buf, size_t *size)
+{
+	size_t	len = 0;
+
+	if (*buf == NULL) {
+		*size = LARGEBUF;
+		*buf = xcalloc(1, *size);
+	}
+
+	while (fgets(*buf + len, (int)(*size - len), f) != NULL) {
+		len += strlen(*buf + len);
+		if (len > 0 && (*buf)[len - 1] == '\n') {
+			(*buf)[--len] = '\0';
+			return 1;
+		}
+
+		if (len + 1 < *size)
+			return 1;	/* last line, without a newline */
+
+		*buf = realloc(*buf, *size * 2);
+		if (*buf == NULL)
+			fatal_with_errno(EXIT_FAILURE, "%s", __func__);
+		*size *= 2;
+	}
+
+	return len > 0;
+}
+
+/* Split a line at its tabs, undoing the escapes in each field */
+static size_t cache_split(char *line, char **fields, size_t max)
+{
+	size_t	n = 0;
+	char	*in = line, *out = line;
+
+	fields[n++] = out;
+	for (; *in; in++) {
+		if (*in == '\t') {
+			*out++ = '\0';
+			if (n == max)
+				return n;
+			fields[n++] = out;
+			continue;
+		}
+
+		if (*in == '\\' && in[1] != '\0') {
+			in++;
+			switch (*in) {
+				case 't':	*out++ = '\t'; break;
+				case 'n':	*out++ = '\n'; break;
+				case 'r':	*out++ = '\r'; break;
+				default:	*out++ = *in; break;
+			}
+			continue;
+		}
+
+		*out++ = *in;
+	}
+	*out = '\0';
+
+	return n;
+}
+
+static void cache_put(FILE *f, const char *s)
+{
+	fputc('\t', f);
+	for (; *s; s++) {
+		switch (*s) {
+			case '\t':	fputs("\\t", f); break;
+			case '\n':	fputs("\\n", f); break;
+			case '\r':	fputs("\\r", f); break;
+			case '\\':	fputs("\\\\", f); break;
+			default:	fputc(*s, f); break;
+		}
+	}
+}
+
+#define CACHE_FIELDS_MAX	256
+
+int scan_cache_load(const char * path)
+{
+	FILE	*f;
+	char	*line = NULL, *fields[CACHE_FIELDS_MAX];
+	size_t	size = 0, n, i;
+	unsigned int	lineno = 0;
+	nutscan_device_type_t	type;
+	nutscan_device_t	*device;
+	cache_dev_t	*dev;
+	cache_addr_t	*entry;
+	char	*key;
+
+	cache_now = (long)time(NULL);
+
+	if ((f = fopen(path, "r")) == NULL) {
+		if (errno == ENOENT) {
+			upsdebugx(1, "%s: no %s yet, starting an empty cache",
+				__func__, path);
+			return 0;
+		}
+		return -1;
+	}
+
+	while (cache_read_line(f, &line, &size)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+
+		n = cache_split(line, fields, CACHE_FIELDS_MAX);
+		type = (n > 2 ? cache_type(fields[1]) : TYPE_NONE);
+
+		if (!strcmp(fields[0], "DEVICE") && type != TYPE_NONE
+		 && n >= 7 && (n - 7) % 2 == 0
+		) {
+			device = nutscan_new_device();
+			if (device == NULL)
+				fatal_with_errno(EXIT_FAILURE, "%s", __func__);
+			device->type = type;
+			device->driver = cache_strdup(fields[5]);
+			device->port = cache_strdup(fields[6]);
+			for (i = 7; i < n; i += 2)
+				nutscan_add_option_to_device(device, fields[i], fields[i + 1]);
+
+			key = scan_device_key(device);
+			if (cache_dev_get(key) != NULL) {
+				nutscan_free_device(device);
+				free(key);
+				continue;
+			}
+
+			dev = cache_dev_add(device, key);
+			dev->loaded = 1;
+			dev->first_seen = strtol(fields[3], NULL, 10);
+			dev->last_seen = strtol(fields[4], NULL, 10);
+			if (dev->addr != NULL)
+				cache_addr_get(type, dev->addr, 1)->known = 1;
+			continue;
+		}
+
+		if (!strcmp(fields[0], "PROBE") && cache_is_ip_type(type) && n == 5) {
+			entry = cache_addr_get(type, fields[2], 1);
+			entry->misses = (unsigned int)strtoul(fields[3], NULL, 10);
+			entry->skip = (unsigned int)strtoul(fields[4], NULL, 10);
+			if (entry->skip > SCAN_CACHE_BACKOFF_MAX)
+				entry->skip = SCAN_CACHE_BACKOFF_MAX;
+			continue;
+		}
+
+		upsdebugx(1, "%s: %s:%u: skipping a line not understood",
+			__func__, path, lineno);
+	}
+
+	free(line);
+	fclose(f);
+	return 0;
+}
+
+int scan_cache_save(const char * path)
+{
+	FILE	*f;
+	char	*tmp, num[SMALLBUF];
+	size_t	len = strlen(path) + 5, h;
+	cache_dev_t	*dev;
+	cache_addr_t	*entry;
+	nutscan_options_t	*opt;
+	int	ret = 0;
+
+	tmp = xcalloc(1, len);
+	snprintf(tmp, len, "%s.new", path);
+
+	if ((f = fopen(tmp, "w")) == NULL) {
+		free(tmp);
+		return -1;
+	}
+
+	fprintf(f, "# Discovery cache of nut-scanner, rewritten by each run with it\n");
+
+	for (h = 0; h < CACHE_HASH; h++) {
+		for (dev = cache_devs[h]; dev != NULL; dev = dev->next) {
+			fputs("DEVICE", f);
+			cache_put(f, nutscan_device_type_strings[dev->device->type]);
+			cache_put(f, dev->addr ? dev->addr : "-");
+			snprintf(num, sizeof(num), "%ld", dev->first_seen);
+			cache_put(f, num);
+			snprintf(num, sizeof(num), "%ld", dev->last_seen);
+			cache_put(f, num);
+			cache_put(f, dev->device->driver ? dev->device->driver : "");
+			cache_put(f, dev->device->port ? dev->device->port : "");
+			for (opt = dev->device->opt; opt != NULL; opt = opt->next) {
+				cache_put(f, opt->option ? opt->option : "");
+				cache_put(f, opt->value ? opt->value : "");
+			}
+			fputc('\n', f);
+		}
+	}
+
+	for (h = 0; h < CACHE_HASH; h++) {
+		for (entry = cache_addrs[h]; entry != NULL; entry = entry->next) {
+			if (entry->misses == 0)
+				continue;
+
+			fputs("PROBE", f);
+			cache_put(f, nutscan_device_type_strings[entry->type]);
+			cache_put(f, entry->addr);
+			snprintf(num, sizeof(num), "%u", entry->misses);
+			cache_put(f, num);
+			snprintf(num, sizeof(num), "%u", entry->skip);
+			cache_put(f, num);
+			fputc('\n', f);
+		}
+	}
+
+	if (ferror(f))
+		ret = -1;
+	if (fclose(f) != 0)
+		ret = -1;
+
+	if (ret == 0) {
+#ifdef WIN32
+		/* rename() does not replace files there */
+		unlink(path);
+#endif
+		ret = rename(tmp, path);
+	}
+
+	if (ret != 0) {
+		int	err = errno;
+		unlink(tmp);
+		errno = err;
+	}
+
+	free(tmp);
+	return ret;
+}
+
+void scan_cache_free(void)
+{
+	cache_addr_t	*entry, *next_entry;
+	cache_dev_t	*dev, *next_dev;
+	size_t	h;
+
+	for (h = 0; h < CACHE_HASH; h++) {
+		for (entry = cache_addrs[h]; entry != NULL; entry = next_entry) {
+			next_entry = entry->next;
+			free(entry->addr);
+			free(entry);
+		}
+		cache_addrs[h] = NULL;
+
+		for (dev = cache_devs[h]; dev != NULL; dev = next_dev) {
+			next_dev = dev->next;
+			cache_dev_free(dev);
+		}
+		cache_devs[h] = NULL;
+	}
+}
+
+nutscan_ip_range_list_t * scan_cache_ranges(nutscan_device_type_t type,
+	const nutscan_ip_range_list_t * irl, int pass, int incremental)
+{
+	nutscan_ip_range_list_t	*list;
+	nutscan_ip_range_list_iter_t	iter;
+	nutscan_ip_range_t	*range = NULL;
+	char	*ip_str, *run_start = NULL, *run_end = NULL;
+	cache_addr_t	*entry;
+	int	take;
+	size_t	skipped = 0, taken = 0;
+
+	if (!incremental && pass > 0)
+		return NULL;
+
+	list = nutscan_init_ip_ranges(NULL);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&cache_mutex);
+#endif
+
+	for (ip_str = nutscan_ip_ranges_iter_init(&iter, irl);
+	     ip_str != NULL;
+	     ip_str = nutscan_ip_ranges_iter_inc(&iter)
+	) {
+		strip_brackets(ip_str);
+
+		/* consecutive addresses are passed on as one range, which
+		 * ends where one is left out or the next range begins */
+		if (iter.ip_ranges_iter != range && run_start != NULL) {
+			nutscan_add_ip_range(list, run_start, run_end);
+			run_start = run_end = NULL;
+		}
+		range = iter.ip_ranges_iter;
+
+		entry = cache_addr_get(type, ip_str, 0);
+		if (!incremental) {
+			take = 1;
+		} else if (pass == 0) {
+			take = (entry != NULL && entry->known);
+		} else if (entry != NULL && entry->known) {
+			take = 0;	/* was in pass 0 */
+		} else if (entry != NULL && entry->skip > 0) {
+			entry->skip--;
+			skipped++;
+			take = 0;
+		} else {
+			take = 1;
+		}
+
+		if (!take) {
+			if (run_start != NULL) {
+				nutscan_add_ip_range(list, run_start, run_end);
+				run_start = run_end = NULL;
+			}
+			free(ip_str);
+			continue;
+		}
+
+		if (entry == NULL)
+			entry = cache_addr_get(type, ip_str, 1);
+		entry->probed = 1;
+		taken++;
+
+		if (run_start == NULL) {
+			run_start = run_end = ip_str;
+		} else {
+			if (run_end != run_start)
+				free(run_end);
+			run_end = ip_str;
+		}
+	}
+
+	if (run_start != NULL)
+		nutscan_add_ip_range(list, run_start, run_end);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&cache_mutex);
+#endif
+
+	upsdebugx(1, "%s: %s pass %d: %" PRIuSIZE " address(es) to probe"
+		" in %" PRIuSIZE " range(s), %" PRIuSIZE " backed off",
+		__func__, nutscan_device_type_strings[type], pass,
+		taken, list->ip_ranges_count, skipped);
+
+	if (list->ip_ranges_count == 0) {
+		free(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+int scan_cache_found(nutscan_device_t * device, const char * key)
+{
+	cache_dev_t	*dev;
+	cache_addr_t	*entry;
+	nutscan_device_t	*copy;
+	nutscan_options_t	*opt;
+	int	ret = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&cache_mutex);
+#endif
+
+	if ((dev = cache_dev_get(key)) == NULL) {
+		copy = nutscan_new_device();
+		if (copy == NULL)
+			fatal_with_errno(EXIT_FAILURE, "%s", __func__);
+		copy->type = device->type;
+		copy->driver = cache_strdup(device->driver ? device->driver : "");
+		copy->port = cache_strdup(device->port ? device->port : "");
+		for (opt = device->opt; opt != NULL; opt = opt->next)
+			nutscan_add_option_to_device(copy, opt->option, opt->value);
+
+		dev = cache_dev_add(copy, cache_strdup(key));
+		dev->first_seen = cache_now;
+		ret = 1;
+	}
+
+	dev->found = 1;
+	dev->last_seen = cache_now;
+
+	if (dev->addr != NULL) {
+		entry = cache_addr_get(device->type, dev->addr, 1);
+		entry->found = 1;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&cache_mutex);
+#endif
+
+	return ret;
+}
+
+int scan_cache_is_new(const char * key)
+{
+	cache_dev_t	*dev = cache_dev_get(key);
+
+	return (dev != NULL && dev->found && !dev->loaded);
+}
+
+void scan_cache_update(const int * scanned, void (*gone)(nutscan_device_t * device))
+{
+	cache_addr_t	*entry;
+	cache_dev_t	**pdev, *dev;
+	size_t	h;
+	int	drop;
+
+	for (h = 0; h < CACHE_HASH; h++) {
+		for (entry = cache_addrs[h]; entry != NULL; entry = entry->next) {
+			if (!entry->probed)
+				continue;
+
+			if (entry->found) {
+				entry->misses = 0;
+				entry->skip = 0;
+			} else {
+				/* the first miss may be a fluke, then back
+				 * off exponentially: 1, 3, 7, ... runs */
+				entry->misses++;
+				if (entry->misses > 6)
+					entry->skip = SCAN_CACHE_BACKOFF_MAX;
+				else
+					entry->skip = (1U << (entry->misses - 1)) - 1;
+			}
+		}
+	}
+
+	for (h = 0; h < CACHE_HASH; h++) {
+		pdev = &cache_devs[h];
+		while ((dev = *pdev) != NULL) {
+			drop = 0;
+			if (dev->loaded && !dev->found && scanned[dev->device->type]) {
+				if (scanned[dev->device->type] == 1) {
+					drop = 1;
+				} else if (dev->addr != NULL) {
+					entry = cache_addr_get(dev->device->type, dev->addr, 0);
+					drop = (entry != NULL && entry->probed);
+				}
+			}
+
+			if (!drop) {
+				pdev = &dev->next;
+				continue;
+			}
+
+			upsdebugx(1, "%s: %s %s on %s is gone",
+				__func__, nutscan_device_type_strings[dev->device->type],
+				dev->device->driver, dev->device->port);
+			if (gone)
+				gone(dev->device);
+
+			*pdev = dev->next;
+			cache_dev_free(dev);
+		}
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nut-scanner-cache.h
+    \brief discovery cache of nut-scanner, for incremental rescans
+*/
+
+#ifndef NUT_SCANNER_CACHE_H_SEEN
+#define NUT_SCANNER_CACHE_H_SEEN 1
+
+#include "nut-scan.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* Most runs an address is left out of incremental scans for, after it
+ * stopped answering (1, 3, 7, ... runs after 2, 3, 4, ... misses) */
+#define SCAN_CACHE_BACKOFF_MAX	32
+
+/* What tells a device apart from another: all that would be displayed
+ * (caller frees the string) */
+char * scan_device_key(nutscan_device_t * device);
+
+/* Read the cache (a missing file is an empty cache): 0 if fine, or -1
+ * with errno set; and write it back after the scans, likewise */
+int scan_cache_load(const char * path);
+int scan_cache_save(const char * path);
+void scan_cache_free(void);
+
+/* The addresses of irl for one pass of a network scan of this type
+ * (caller frees the list). If incremental, pass 0 has those where the
+ * cache has devices and pass 1 the others, except for those still
+ * backed off; otherwise pass 0 has all. NULL if a pass has none. */
+nutscan_ip_range_list_t * scan_cache_ranges(nutscan_device_type_t type,
+	const nutscan_ip_range_list_t * irl, int pass, int incremental);
+
+/* Note a device found by this run: 1 if it was not in the cache */
+int scan_cache_found(nutscan_device_t * device, const char * key);
+
+/* Was the device with this key found by this run and not in the cache? */
+int scan_cache_is_new(const char * key);
+
+/* After the scans: scanned[type] is 0 for a type not scanned, 1 for a
+ * bus scanned as a whole, 2 for one scanned on the address ranges.
+ * Count the misses of the addresses probed, and drop (after passing
+ * them to gone, if not NULL) the cached devices not found again. */
+void scan_cache_update(const int * scanned, void (*gone)(nutscan_device_t * device));
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_SCANNER_CACHE_H_SEEN */
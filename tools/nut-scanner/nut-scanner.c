@@ -89,10 +89,11 @@
 #endif   /* HAVE_PTHREAD */
 
 #include "nut-scan.h"
+#include "nut-scanner-cache.h"
 
 #define ERR_BAD_OPTION	(-1)
 
-static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:QnNPqIVaD";
+static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:QnNPJFr:iqIVaD";
 
 #ifdef HAVE_GETOPT_LONG
 static const struct option longopts[] = {
@@ -125,6 +126,10 @@ static const struct option longopts[] = {
 	{ "disp_nut_conf_with_sanity_check", no_argument, NULL, 'Q' },
 	{ "disp_nut_conf", no_argument, NULL, 'N' },
 	{ "disp_parsable", no_argument, NULL, 'P' },
+	{ "disp_json", no_argument, NULL, 'J' },
+	{ "stream", no_argument, NULL, 'F' },
+	{ "cache", required_argument, NULL, 'r' },
+	{ "incremental", no_argument, NULL, 'i' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
@@ -138,6 +143,143 @@ static const struct option longopts[] = {
 
 static nutscan_device_t *dev[TYPE_END];
 
+/* With -F, each device is displayed by this as soon as a scan finds it
+ * (unless the same one was already displayed), not at the end */
+static void (*stream_func)(nutscan_device_t * device) = NULL;
+
+#define STREAM_SEEN_HASH	1024
+
+typedef struct stream_seen_s {
+	char	*key;
+	struct stream_seen_s	*next;
+} stream_seen_t;
+
+static stream_seen_t *stream_seen[STREAM_SEEN_HASH];
+
+/* With -r, the devices found are kept in this file for the next run,
+ * and with -i only the differences to it are displayed */
+static const char *cache_path = NULL;
+static int incremental = 0;
+
+/* Callback of the scans (they are serialized by libnutscan) */
+static void found_device(nutscan_device_t * device, void * arg)
+{
+	stream_seen_t	*seen;
+	char	*key = scan_device_key(device);
+	const unsigned char	*p;
+	size_t	h = 5381;
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (cache_path && !scan_cache_found(device, key) && incremental) {
+		upsdebugx(2, "%s: already in the cache: %s %s",
+			__func__, device->driver, device->port);
+		free(key);
+		return;
+	}
+
+	if (!stream_func) {
+		free(key);
+		return;
+	}
+
+	for (p = (const unsigned char *)key; *p; p++)
+		h = h * 33 + *p;
+	h %= STREAM_SEEN_HASH;
+
+	for (seen = stream_seen[h]; seen != NULL; seen = seen->next) {
+		if (!strcmp(seen->key, key)) {
+			upsdebugx(2, "%s: already displayed %s %s",
+				__func__, device->driver, device->port);
+			free(key);
+			return;
+		}
+	}
+
+	seen = xcalloc(1, sizeof(*seen));
+	seen->key = key;
+	seen->next = stream_seen[h];
+	stream_seen[h] = seen;
+
+	stream_func(device);
+	fflush(stdout);
+}
+
+static void stream_seen_free(void)
+{
+	stream_seen_t	*seen, *next;
+	size_t	i;
+
+	for (i = 0; i < STREAM_SEEN_HASH; i++) {
+		for (seen = stream_seen[i]; seen != NULL; seen = next) {
+			next = seen->next;
+			free(seen->key);
+			free(seen);
+		}
+		stream_seen[i] = NULL;
+	}
+}
+
+/* With -i and without -F, keep only the devices not in the cache */
+static nutscan_device_t *drop_known_devices(nutscan_device_t * device)
+{
+	nutscan_device_t	*next, *ret = NULL;
+	char	*key;
+
+	for (device = nutscan_rewind_device(device); device != NULL; device = next) {
+		next = device->next;
+		key = scan_device_key(device);
+		if (scan_cache_is_new(key)) {
+			ret = device;
+		} else {
+			if (device->prev)
+				device->prev->next = device->next;
+			if (device->next)
+				device->next->prev = device->prev;
+			device->prev = device->next = NULL;
+			nutscan_free_device(device);
+		}
+		free(key);
+	}
+
+	return ret;
+}
+
+/* With -i, cached devices not found again are listed after the new ones:
+ * as comments in the ups.conf and parsable formats, or flagged in JSON */
+static int gone_json = 0;
+
+static void display_gone_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", (unsigned int)(unsigned char)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void display_gone(nutscan_device_t * device)
+{
+	const char	*type = nutscan_device_type_strings[device->type];
+
+	if (gone_json) {
+		printf("{\"gone\":true,\"type\":");
+		display_gone_string(type);
+		printf(",\"driver\":");
+		display_gone_string(device->driver);
+		printf(",\"port\":");
+		display_gone_string(device->port);
+		printf("}\n");
+	} else {
+		printf("# Gone since the last scan: %s:driver=\"%s\",port=\"%s\"\n",
+			type, device->driver, device->port);
+	}
+}
+
 static useconds_t timeout = DEFAULT_NETWORK_TIMEOUT * 1000 * 1000; /* in usec */
 static char * port = NULL;
 static char * serial_ports = NULL;
@@ -146,6 +288,28 @@ static int cli_link_detail_level = -1;
 /* Track requested IP ranges (from CLI or auto-discovery) */
 static nutscan_ip_range_list_t ip_ranges_list;
 
+/* With -i, the network scans go over the addresses which answered them
+ * the last time first (pass 0), then over the others (pass 1) */
+#define SCAN_PASSES	2
+
+/* The addresses of one pass of a scan, NULL if it has none */
+static nutscan_ip_range_list_t *pass_ranges(nutscan_device_type_t type, int pass)
+{
+	/* without ranges, XML and IPMI scan for broadcast and local devices */
+	if (!cache_path || !ip_ranges_list.ip_ranges_count)
+		return (pass == 0 ? &ip_ranges_list : NULL);
+
+	return scan_cache_ranges(type, &ip_ranges_list, pass, incremental);
+}
+
+static void pass_ranges_free(nutscan_ip_range_list_t *irl)
+{
+	if (irl != &ip_ranges_list) {
+		nutscan_free_ip_ranges(irl);
+		free(irl);
+	}
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_t thread[TYPE_END];
 
@@ -207,11 +371,19 @@ static void * run_usb(void *arg)
 static void * run_snmp(void * arg)
 {
 	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
+	nutscan_ip_range_list_t * irl;
+	int pass;
 
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
 		__func__, ip_ranges_list.ip_ranges_count);
 
-	dev[TYPE_SNMP] = nutscan_scan_ip_range_snmp(&ip_ranges_list, timeout, sec);
+	for (pass = 0; pass < SCAN_PASSES; pass++) {
+		if ((irl = pass_ranges(TYPE_SNMP, pass)) == NULL)
+			continue;
+		dev[TYPE_SNMP] = nutscan_add_device_to_device(dev[TYPE_SNMP],
+			nutscan_scan_ip_range_snmp(irl, timeout, sec));
+		pass_ranges_free(irl);
+	}
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -220,11 +392,19 @@ static void * run_snmp(void * arg)
 static void * run_xml(void * arg)
 {
 	nutscan_xml_t * sec = (nutscan_xml_t *)arg;
+	nutscan_ip_range_list_t * irl;
+	int pass;
 
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
 		__func__, ip_ranges_list.ip_ranges_count);
 
-	dev[TYPE_XML] = nutscan_scan_ip_range_xml_http(&ip_ranges_list, timeout, sec);
+	for (pass = 0; pass < SCAN_PASSES; pass++) {
+		if ((irl = pass_ranges(TYPE_XML, pass)) == NULL)
+			continue;
+		dev[TYPE_XML] = nutscan_add_device_to_device(dev[TYPE_XML],
+			nutscan_scan_ip_range_xml_http(irl, timeout, sec));
+		pass_ranges_free(irl);
+	}
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -232,12 +412,21 @@ static void * run_xml(void * arg)
 
 static void * run_nut_old(void *arg)
 {
+	nutscan_ip_range_list_t * irl;
+	int pass;
+
 	NUT_UNUSED_VARIABLE(arg);
 
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
 		__func__, ip_ranges_list.ip_ranges_count);
 
-	dev[TYPE_NUT] = nutscan_scan_ip_range_nut(&ip_ranges_list, port, timeout);
+	for (pass = 0; pass < SCAN_PASSES; pass++) {
+		if ((irl = pass_ranges(TYPE_NUT, pass)) == NULL)
+			continue;
+		dev[TYPE_NUT] = nutscan_add_device_to_device(dev[TYPE_NUT],
+			nutscan_scan_ip_range_nut(irl, port, timeout));
+		pass_ranges_free(irl);
+	}
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -262,11 +451,19 @@ static void * run_avahi(void *arg)
 static void * run_ipmi(void * arg)
 {
 	nutscan_ipmi_t * sec = (nutscan_ipmi_t *)arg;
-	
+	nutscan_ip_range_list_t * irl;
+	int pass;
+
 	upsdebugx(2, "Entering %s for %" PRIuSIZE " IP address range(s)",
 		__func__, ip_ranges_list.ip_ranges_count);
 
-	dev[TYPE_IPMI] = nutscan_scan_ip_range_ipmi(&ip_ranges_list, sec);
+	for (pass = 0; pass < SCAN_PASSES; pass++) {
+		if ((irl = pass_ranges(TYPE_IPMI, pass)) == NULL)
+			continue;
+		dev[TYPE_IPMI] = nutscan_add_device_to_device(dev[TYPE_IPMI],
+			nutscan_scan_ip_range_ipmi(irl, sec));
+		pass_ranges_free(irl);
+	}
 
 	upsdebugx(2, "Finished %s loop", __func__);
 	return NULL;
@@ -1148,6 +1345,11 @@ static void show_usage(const char *arg_progname)
 	printf("  -Q, --disp_nut_conf_with_sanity_check: Display result in the ups.conf format with sanity-check warnings as comments (default)\n");
 	printf("  -N, --disp_nut_conf: Display result in the ups.conf format\n");
 	printf("  -P, --disp_parsable: Display result in a parsable format\n");
+	printf("  -J, --disp_json: Display result as one JSON object per device and line\n");
+	printf("  -F, --stream: Display each device as soon as it is found (without the sanity-check warnings of -Q)\n");
+	printf("\nIncremental scan options:\n");
+	printf("  -r, --cache <file>: Keep the devices found and the addresses which did not answer in this file, for the next run\n");
+	printf("  -i, --incremental: With -r, probe the addresses of known devices first, others less often while they do not answer, and display only the devices new or gone since the last run\n");
 	printf("\nMiscellaneous options:\n");
 	printf("  -h, --help: display this help text\n");
 	printf("  -V, --version: Display NUT version\n");
@@ -1179,6 +1381,8 @@ int main(int argc, char *argv[])
 	int quiet = 0; /* The debugging level for certain upsdebugx() progress messages; 0 = print always, quiet==1 is to require at least one -D */
 	void (*display_func)(nutscan_device_t * device);
 	int ret_code = EXIT_SUCCESS;
+	int scanned[TYPE_END];
+	size_t i;
 #ifdef HAVE_PTHREAD
 # if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
 	sem_t	*current_sem;
@@ -1542,6 +1746,18 @@ int main(int argc, char *argv[])
 			case 'P':
 				display_func = nutscan_display_parsable;
 				break;
+			case 'J':
+				display_func = nutscan_display_json;
+				break;
+			case 'F':
+				stream_func = nutscan_display_ups_conf_device;
+				break;
+			case 'r':
+				cache_path = optarg;
+				break;
+			case 'i':
+				incremental = 1;
+				break;
 			case 'q':
 				quiet = 1;
 				break;
@@ -1695,6 +1911,32 @@ display_help:
 		/* BEWARE: allow_all does not include allow_eaton_serial! */
 	}
 
+	if (stream_func) {
+		/* the same format as at the end, one device at a time */
+		if (display_func == nutscan_display_parsable)
+			stream_func = nutscan_display_parsable_device;
+		else if (display_func == nutscan_display_json)
+			stream_func = nutscan_display_json_device;
+		else
+			stream_func = nutscan_display_ups_conf_device;
+
+	}
+
+	if (incremental && !cache_path) {
+		fatalx(EXIT_FAILURE, "The -i (--incremental) option needs a -r (--cache) file");
+	}
+
+	if (cache_path) {
+		if (scan_cache_load(cache_path) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "Could not read the cache file %s", cache_path);
+		}
+		gone_json = (display_func == nutscan_display_json);
+	}
+
+	if (stream_func || cache_path) {
+		nutscan_set_device_callback(found_device, NULL);
+	}
+
 /* TODO/discuss : Should the #else...#endif code below for lack of pthreads
  * during build also serve as a fallback for pthread failure at runtime?
  */
@@ -1895,46 +2137,81 @@ display_help:
 
 	upsdebugx(1, "SCANS DONE: display results");
 
+	if (incremental && !stream_func) {
+		/* only what is new since the last run */
+		for (i = 0; i < TYPE_END; i++)
+			dev[i] = drop_known_devices(dev[i]);
+	}
+
 	upsdebugx(1, "SCANS DONE: display results: USB");
-	display_func(dev[TYPE_USB]);
+	if (!stream_func)
+		display_func(dev[TYPE_USB]);
 	upsdebugx(1, "SCANS DONE: free resources: USB");
 	nutscan_free_device(dev[TYPE_USB]);
 
 	upsdebugx(1, "SCANS DONE: display results: SNMP");
-	display_func(dev[TYPE_SNMP]);
+	if (!stream_func)
+		display_func(dev[TYPE_SNMP]);
 	upsdebugx(1, "SCANS DONE: free resources: SNMP");
 	nutscan_free_device(dev[TYPE_SNMP]);
 
 	upsdebugx(1, "SCANS DONE: display results: XML/HTTP");
-	display_func(dev[TYPE_XML]);
+	if (!stream_func)
+		display_func(dev[TYPE_XML]);
 	upsdebugx(1, "SCANS DONE: free resources: XML/HTTP");
 	nutscan_free_device(dev[TYPE_XML]);
 
 	upsdebugx(1, "SCANS DONE: display results: NUT bus (old)");
-	display_func(dev[TYPE_NUT]);
+	if (!stream_func)
+		display_func(dev[TYPE_NUT]);
 	upsdebugx(1, "SCANS DONE: free resources: NUT bus (old)");
 	nutscan_free_device(dev[TYPE_NUT]);
 
 	upsdebugx(1, "SCANS DONE: display results: NUT simulation devices");
-	display_func(dev[TYPE_NUT_SIMULATION]);
+	if (!stream_func)
+		display_func(dev[TYPE_NUT_SIMULATION]);
 	upsdebugx(1, "SCANS DONE: free resources: NUT simulation devices");
 	nutscan_free_device(dev[TYPE_NUT_SIMULATION]);
 
 	upsdebugx(1, "SCANS DONE: display results: NUT bus (avahi)");
-	display_func(dev[TYPE_AVAHI]);
+	if (!stream_func)
+		display_func(dev[TYPE_AVAHI]);
 	upsdebugx(1, "SCANS DONE: free resources: NUT bus (avahi)");
 	nutscan_free_device(dev[TYPE_AVAHI]);
 
 	upsdebugx(1, "SCANS DONE: display results: IPMI");
-	display_func(dev[TYPE_IPMI]);
+	if (!stream_func)
+		display_func(dev[TYPE_IPMI]);
 	upsdebugx(1, "SCANS DONE: free resources: IPMI");
 	nutscan_free_device(dev[TYPE_IPMI]);
 
 	upsdebugx(1, "SCANS DONE: display results: SERIAL");
-	display_func(dev[TYPE_EATON_SERIAL]);
+	if (!stream_func)
+		display_func(dev[TYPE_EATON_SERIAL]);
 	upsdebugx(1, "SCANS DONE: free resources: SERIAL");
 	nutscan_free_device(dev[TYPE_EATON_SERIAL]);
 
+	if (cache_path) {
+		upsdebugx(1, "SCANS DONE: update the cache");
+		memset(scanned, 0, sizeof(scanned));
+		scanned[TYPE_USB] = (allow_usb && nutscan_avail_usb);
+		scanned[TYPE_SNMP] = (allow_snmp && nutscan_avail_snmp) ? 2 : 0;
+		scanned[TYPE_XML] = (allow_xml && nutscan_avail_xml_http)
+			? (ip_ranges_list.ip_ranges_count ? 2 : 1) : 0;
+		scanned[TYPE_NUT] = (allow_oldnut && nutscan_avail_nut) ? 2 : 0;
+		scanned[TYPE_NUT_SIMULATION] = (allow_nut_simulation && nutscan_avail_nut_simulation);
+		scanned[TYPE_AVAHI] = (allow_avahi && nutscan_avail_avahi);
+		scanned[TYPE_IPMI] = (allow_ipmi && nutscan_avail_ipmi)
+			? (ip_ranges_list.ip_ranges_count ? 2 : 1) : 0;
+		scanned[TYPE_EATON_SERIAL] = allow_eaton_serial;
+
+		scan_cache_update(scanned, incremental ? display_gone : NULL);
+		if (scan_cache_save(cache_path) < 0) {
+			fatal_with_errno(EXIT_FAILURE, "Could not write the cache file %s", cache_path);
+		}
+		scan_cache_free();
+	}
+
 #ifdef HAVE_PTHREAD
 # ifdef HAVE_SEMAPHORE_UNNAMED
 	sem_destroy(nutscan_semaphore());
@@ -1948,6 +2225,8 @@ display_help:
 #endif
 
 	upsdebugx(1, "SCANS DONE: free common scanner resources");
+	nutscan_set_device_callback(NULL, NULL);
+	stream_seen_free();
 	nutscan_free_ip_ranges(&ip_ranges_list);
 	nutscan_free();
 
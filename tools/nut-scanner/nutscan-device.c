@@ -31,6 +31,10 @@
 #include <string.h>
 #include <assert.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 const char * nutscan_device_type_strings[TYPE_END] = {
 	"NONE", /* 0 */
 	"USB",
@@ -239,3 +243,37 @@ nutscan_device_t * nutscan_rewind_device(nutscan_device_t * device)
 
 	return device;
 }
+
+/* See nutscan_set_device_callback() */
+static nutscan_device_cb_t device_cb = NULL;
+static void * device_cb_arg = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t device_cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void nutscan_set_device_callback(nutscan_device_cb_t cb, void * arg)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&device_cb_mutex);
+#endif
+	device_cb = cb;
+	device_cb_arg = arg;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&device_cb_mutex);
+#endif
+}
+
+void nutscan_report_device(nutscan_device_t * device)
+{
+	if (device == NULL)
+		return;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&device_cb_mutex);
+#endif
+	if (device_cb != NULL)
+		device_cb(device, device_cb_arg);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&device_cb_mutex);
+#endif
+}
@@ -95,6 +95,21 @@ nutscan_device_t * nutscan_add_device_to_device(nutscan_device_t * first, nutsca
  */
 nutscan_device_t * nutscan_rewind_device(nutscan_device_t * device);
 
+/**
+ *  \brief  Callback for each device as soon as a scan has found it
+ *
+ *  Calls are serialized. The device is already part of the list the scan
+ *  will return, so the callback must only look at (not change or keep)
+ *  this one item, and not follow its prev/next links.
+ */
+typedef void (*nutscan_device_cb_t)(nutscan_device_t * device, void * arg);
+
+/* Set (or clear, with NULL) the callback for all the scans */
+void nutscan_set_device_callback(nutscan_device_cb_t cb, void * arg);
+
+/* Called by the scans with each new device, once it is complete */
+void nutscan_report_device(nutscan_device_t * device);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -59,14 +59,55 @@ void nutscan_display_ups_conf_with_sanity_check(nutscan_device_t * device)
 	nutscan_display_sanity_check(device);
 }
 
+/* Number of the next "nutdev-<type>" section of nutscan_display_ups_conf() */
+static size_t nutdev_num = 1;
+
+void nutscan_display_ups_conf_device(nutscan_device_t * device)
+{
+	nutscan_options_t * opt;
+
+	printf("[nutdev-%s%" PRIuSIZE "]\n\tdriver = \"%s\"",
+		nutscan_device_type_lstrings[device->type],
+		nutdev_num, device->driver);
+
+	if (device->alt_driver_names) {
+		printf("\t# alternately: %s",
+			device->alt_driver_names);
+	}
+
+	printf("\n\tport = \"%s\"\n",
+		device->port);
+
+	opt = device->opt;
+
+	while (NULL != opt) {
+		if (opt->option != NULL) {
+			printf("\t");
+			if (opt->comment_tag) {
+				if (opt->comment_tag[0] == '\0') {
+					printf("# ");
+				} else {
+					printf("###%s### ", opt->comment_tag);
+				}
+			}
+			printf("%s", opt->option);
+			if (opt->value != NULL) {
+				printf(" = \"%s\"", opt->value);
+			}
+			printf("\n");
+		}
+		opt = opt->next;
+	}
+
+	nutdev_num++;
+}
+
 void nutscan_display_ups_conf(nutscan_device_t * device)
 {
 	/* Note: while a single device is passed to the method, it is actually
 	 * used to locate the list of related device types and iterate it all.
 	 */
 	nutscan_device_t * current_dev = device;
-	nutscan_options_t * opt;
-	static size_t nutdev_num = 1;
 
 	upsdebugx(2, "%s: %s", __func__, device
 		? (device->type < TYPE_END ? nutscan_device_type_string[device->type] : "<UNKNOWN>")
@@ -83,46 +124,41 @@ void nutscan_display_ups_conf(nutscan_device_t * device)
 
 	/* Display each device */
 	do {
-		printf("[nutdev-%s%" PRIuSIZE "]\n\tdriver = \"%s\"",
-			nutscan_device_type_lstrings[current_dev->type],
-			nutdev_num, current_dev->driver);
+		nutscan_display_ups_conf_device(current_dev);
+		current_dev = current_dev->next;
+	}
+	while (current_dev != NULL);
 
-		if (current_dev->alt_driver_names) {
-			printf("\t# alternately: %s",
-				current_dev->alt_driver_names);
-		}
+	last_nutdev_num = nutdev_num;
+}
 
-		printf("\n\tport = \"%s\"\n",
-			current_dev->port);
+void nutscan_display_parsable_device(nutscan_device_t * device)
+{
+	nutscan_options_t * opt;
 
-		opt = current_dev->opt;
+	/* Do not separate by whitespace, in case someone already parses this */
+	printf("%s:driver=\"%s\",port=\"%s\"",
+		nutscan_device_type_string[device->type],
+		device->driver,
+		device->port);
 
-		while (NULL != opt) {
-			if (opt->option != NULL) {
-				printf("\t");
-				if (opt->comment_tag) {
-					if (opt->comment_tag[0] == '\0') {
-						printf("# ");
-					} else {
-						printf("###%s### ", opt->comment_tag);
-					}
-				}
-				printf("%s", opt->option);
-				if (opt->value != NULL) {
-					printf(" = \"%s\"", opt->value);
-				}
-				printf("\n");
+	opt = device->opt;
+
+	while (NULL != opt) {
+		if (opt->option != NULL && opt->comment_tag == NULL) {
+			/* Do not separate by whitespace, in case someone already parses this */
+			printf(",%s", opt->option);
+			if (opt->value != NULL) {
+				printf("=\"%s\"", opt->value);
 			}
-			opt = opt->next;
 		}
-
-		nutdev_num++;
-
-		current_dev = current_dev->next;
+		opt = opt->next;
 	}
-	while (current_dev != NULL);
 
-	last_nutdev_num = nutdev_num;
+	/* NOTE: Currently no handling for current_dev->alt_driver_names
+	 * here, since no driver options maps to this concept */
+
+	printf("\n");
 }
 
 void nutscan_display_parsable(nutscan_device_t * device)
@@ -131,7 +167,6 @@ void nutscan_display_parsable(nutscan_device_t * device)
 	 * used to locate the list of related device types and iterate it all.
 	 */
 	nutscan_device_t * current_dev = device;
-	nutscan_options_t * opt;
 
 	upsdebugx(2, "%s: %s", __func__, device
 		? (device->type < TYPE_END ? nutscan_device_type_string[device->type] : "<UNKNOWN>")
@@ -148,30 +183,104 @@ void nutscan_display_parsable(nutscan_device_t * device)
 
 	/* Display each device */
 	do {
-		/* Do not separate by whitespace, in case someone already parses this */
-		printf("%s:driver=\"%s\",port=\"%s\"",
-			nutscan_device_type_string[current_dev->type],
-			current_dev->driver,
-			current_dev->port);
-
-		opt = current_dev->opt;
+		nutscan_display_parsable_device(current_dev);
+		current_dev = current_dev->next;
+	}
+	while (current_dev != NULL);
+}
 
-		while (NULL != opt) {
-			if (opt->option != NULL && opt->comment_tag == NULL) {
-				/* Do not separate by whitespace, in case someone already parses this */
-				printf(",%s", opt->option);
-				if (opt->value != NULL) {
-					printf("=\"%s\"", opt->value);
-				}
-			}
-			opt = opt->next;
+static void display_json_string(const char * str)
+{
+	const unsigned char	*p;
+
+	putchar('"');
+	for (p = (const unsigned char *)(str ? str : ""); *p; p++) {
+		switch (*p) {
+			case '"':
+			case '\\':
+				printf("\\%c", *p);
+				break;
+			case '\n':
+				printf("\\n");
+				break;
+			case '\r':
+				printf("\\r");
+				break;
+			case '\t':
+				printf("\\t");
+				break;
+			default:
+				if (*p < 0x20)
+					printf("\\u%04x", *p);
+				else
+					putchar(*p);
 		}
+	}
+	putchar('"');
+}
+
+/* One JSON object per line ("JSON Lines"), so the output can be read
+ * as it comes when devices are displayed as they are found */
+void nutscan_display_json_device(nutscan_device_t * device)
+{
+	nutscan_options_t * opt;
+	int	first = 1;
+
+	printf("{\"type\":");
+	display_json_string(device->type < TYPE_END
+		? nutscan_device_type_strings[device->type] : "UNKNOWN");
+	printf(",\"driver\":");
+	display_json_string(device->driver);
+	printf(",\"port\":");
+	display_json_string(device->port);
+
+	if (device->alt_driver_names) {
+		printf(",\"alt_driver_names\":");
+		display_json_string(device->alt_driver_names);
+	}
+
+	printf(",\"options\":{");
+	for (opt = device->opt; opt != NULL; opt = opt->next) {
+		if (opt->option == NULL || opt->comment_tag != NULL)
+			continue;
+
+		if (!first)
+			putchar(',');
+		first = 0;
+
+		display_json_string(opt->option);
+		putchar(':');
+		if (opt->value != NULL)
+			display_json_string(opt->value);
+		else
+			printf("true");
+	}
+	printf("}}\n");
+}
 
-		/* NOTE: Currently no handling for current_dev->alt_driver_names
-		 * here, since no driver options maps to this concept */
+void nutscan_display_json(nutscan_device_t * device)
+{
+	/* Note: while a single device is passed to the method, it is actually
+	 * used to locate the list of related device types and iterate it all.
+	 */
+	nutscan_device_t * current_dev = device;
 
-		printf("\n");
+	upsdebugx(2, "%s: %s", __func__, device
+		? (device->type < TYPE_END ? nutscan_device_type_string[device->type] : "<UNKNOWN>")
+		: "<NULL>");
 
+	if (device == NULL) {
+		return;
+	}
+
+	/* Find start of the list */
+	while (current_dev->prev != NULL) {
+		current_dev = current_dev->prev;
+	}
+
+	/* Display each device */
+	do {
+		nutscan_display_json_device(current_dev);
 		current_dev = current_dev->next;
 	}
 	while (current_dev != NULL);
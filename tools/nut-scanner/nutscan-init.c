@@ -72,6 +72,7 @@ int nutscan_load_ipmi_library(const char *libname_path);
 int nutscan_unload_ipmi_library(void);
 int nutscan_load_upsclient_library(const char *libname_path);
 int nutscan_unload_upsclient_library(void);
+void nutscan_free_eaton_serial(void);
 
 #ifdef HAVE_PTHREAD
 # ifdef HAVE_SEMAPHORE_UNNAMED
@@ -137,6 +138,181 @@ size_t max_threads_ipmi = 0;	/* limits not yet known */
 
 #endif /* HAVE_PTHREAD */
 
+/* Worker threads shared by all the scans running at once: each scan puts
+ * one job per target in a common queue (through its own batch, to wait
+ * for them and to keep its own limit), and up to max_threads workers
+ * (started as needed, then kept until nutscan_free()) take them in turn.
+ * Without threads, jobs are run right when submitted.
+ */
+typedef struct nutscan_pool_job_s {
+	void	*(*fn)(void *);
+	void	*arg;
+	nutscan_pool_batch_t	*batch;
+	struct nutscan_pool_job_s	*next;
+} nutscan_pool_job_t;
+
+struct nutscan_pool_batch_s {
+	size_t	limit;	/* jobs of this batch queued or running at most, 0 = any */
+	size_t	pending;	/* jobs of this batch queued or running */
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	pool_work = PTHREAD_COND_INITIALIZER;	/* a job was queued */
+static pthread_cond_t	pool_done = PTHREAD_COND_INITIALIZER;	/* a job has ended */
+static nutscan_pool_job_t	*pool_head = NULL, *pool_tail = NULL;
+static size_t	pool_queued = 0, pool_idle = 0, pool_nthreads = 0;
+static pthread_t	*pool_threads = NULL;
+static int	pool_stopping = 0;
+
+static size_t nutscan_pool_size(void)
+{
+# if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
+	return (max_threads > 0) ? max_threads : 1;
+# else
+	return DEFAULT_THREAD;
+# endif
+}
+
+static void * nutscan_pool_worker(void *arg)
+{
+	nutscan_pool_job_t	*job;
+	NUT_UNUSED_VARIABLE(arg);
+
+	pthread_mutex_lock(&pool_mutex);
+
+	while (1) {
+		while (!pool_head && !pool_stopping) {
+			pool_idle++;
+			pthread_cond_wait(&pool_work, &pool_mutex);
+			pool_idle--;
+		}
+
+		if (!pool_head)
+			break;
+
+		job = pool_head;
+		pool_head = job->next;
+		if (!pool_head)
+			pool_tail = NULL;
+		pool_queued--;
+
+		pthread_mutex_unlock(&pool_mutex);
+		job->fn(job->arg);
+		pthread_mutex_lock(&pool_mutex);
+
+		job->batch->pending--;
+		pthread_cond_broadcast(&pool_done);
+		free(job);
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+	return NULL;
+}
+#endif	/* HAVE_PTHREAD */
+
+nutscan_pool_batch_t * nutscan_pool_batch_new(size_t limit)
+{
+	nutscan_pool_batch_t	*batch = xcalloc(1, sizeof(*batch));
+
+	batch->limit = limit;
+	return batch;
+}
+
+void nutscan_pool_submit(nutscan_pool_batch_t *batch, void *(*fn)(void *), void *arg)
+{
+#ifdef HAVE_PTHREAD
+	nutscan_pool_job_t	*job;
+	pthread_t	*threads;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	while (batch->limit > 0 && batch->pending >= batch->limit)
+		pthread_cond_wait(&pool_done, &pool_mutex);
+
+	/* one more worker, if all are busy and there is room for it */
+	if (pool_queued >= pool_idle && pool_nthreads < nutscan_pool_size()) {
+		threads = realloc(pool_threads, (pool_nthreads + 1) * sizeof(*threads));
+		if (threads) {
+			pool_threads = threads;
+			if (pthread_create(&pool_threads[pool_nthreads], NULL,
+				nutscan_pool_worker, NULL) == 0
+			) {
+				pool_nthreads++;
+			} else {
+				upsdebugx(1, "%s: pthread_create returned an error", __func__);
+			}
+		}
+	}
+
+	if (pool_nthreads == 0) {
+		/* no thread to hand it to */
+		pthread_mutex_unlock(&pool_mutex);
+		fn(arg);
+		return;
+	}
+
+	job = xcalloc(1, sizeof(*job));
+	job->fn = fn;
+	job->arg = arg;
+	job->batch = batch;
+
+	if (pool_tail)
+		pool_tail->next = job;
+	else
+		pool_head = job;
+	pool_tail = job;
+
+	pool_queued++;
+	batch->pending++;
+
+	pthread_cond_signal(&pool_work);
+	pthread_mutex_unlock(&pool_mutex);
+#else
+	NUT_UNUSED_VARIABLE(batch);
+	fn(arg);
+#endif	/* HAVE_PTHREAD */
+}
+
+void nutscan_pool_batch_wait(nutscan_pool_batch_t *batch)
+{
+	if (!batch)
+		return;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&pool_mutex);
+	while (batch->pending > 0)
+		pthread_cond_wait(&pool_done, &pool_mutex);
+	pthread_mutex_unlock(&pool_mutex);
+#endif
+
+	free(batch);
+}
+
+/* end the workers, once the jobs in the queue are done */
+static void nutscan_pool_stop(void)
+{
+#ifdef HAVE_PTHREAD
+	size_t	i, n;
+
+	pthread_mutex_lock(&pool_mutex);
+	pool_stopping = 1;
+	pthread_cond_broadcast(&pool_work);
+	n = pool_nthreads;
+	pthread_mutex_unlock(&pool_mutex);
+
+	for (i = 0; i < n; i++)
+		pthread_join(pool_threads[i], NULL);
+
+	pthread_mutex_lock(&pool_mutex);
+	free(pool_threads);
+	pool_threads = NULL;
+	pool_nthreads = 0;
+	pool_stopping = 0;
+	pthread_mutex_unlock(&pool_mutex);
+#endif	/* HAVE_PTHREAD */
+}
+
 #ifdef WIN32
 /* Stub for libupsclient */
 void do_upsconf_args(char *confupsname, char *var, char *val) {
@@ -693,12 +869,15 @@ end:
 
 void nutscan_free(void)
 {
+	nutscan_pool_stop();
+
 	nutscan_unload_usb_library();
 	nutscan_unload_snmp_library();
 	nutscan_unload_neon_library();
 	nutscan_unload_avahi_library();
 	nutscan_unload_ipmi_library();
 	nutscan_unload_upsclient_library();
+	nutscan_free_eaton_serial();
 
 #ifdef HAVE_PTHREAD
 /* TOTHINK: See comments near mutex/semaphore init code above */
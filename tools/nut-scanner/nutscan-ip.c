@@ -32,6 +32,10 @@
 #ifndef WIN32
 # include <sys/socket.h>
 # include <netdb.h>
+# include <poll.h>
+# ifdef HAVE_SYS_RESOURCE_H
+#  include <sys/resource.h> /* for getrlimit() and struct rlimit */
+# endif
 #else
 /* Those 2 files for support of getaddrinfo, getnameinfo and freeaddrinfo
    on Windows 2000 and older versions */
@@ -501,6 +505,257 @@ char * nutscan_ip_iter_inc(nutscan_ip_iter_t * ip)
 	}
 }
 
+/* The binary addresses of nutscan_ip_addr_iter_t are 128-bit big-endian
+ * numbers (IPv4 ones in the last 4 bytes), stepped through without any
+ * conversion to or from text */
+
+static void addr_add(unsigned char *a, size_t n)
+{
+	int	i;
+	unsigned int	sum;
+
+	for (i = 15; i >= 0 && n > 0; i--) {
+		sum = (unsigned int)a[i] + (unsigned int)(n & 0xFF);
+		a[i] = (unsigned char)(sum & 0xFF);
+		n = (n >> 8) + (sum >> 8);
+	}
+}
+
+/* b - a (with b >= a), or SIZE_MAX if that does not fit */
+static size_t addr_diff(const unsigned char *b, const unsigned char *a)
+{
+	unsigned char	d[16];
+	int	i, v, borrow = 0;
+	size_t	ret = 0;
+
+	for (i = 15; i >= 0; i--) {
+		v = (int)b[i] - (int)a[i] - borrow;
+		borrow = (v < 0);
+		d[i] = (unsigned char)(borrow ? v + 256 : v);
+	}
+
+	for (i = 0; i < 16; i++) {
+		if (i < 16 - (int)sizeof(size_t)) {
+			if (d[i])
+				return SIZE_MAX;
+			continue;
+		}
+		ret = (ret << 8) | d[i];
+	}
+
+	return ret;
+}
+
+/* Parse an address (or a host name, like nutscan_ip_iter_init() does)
+ * into family and a; 0 if fine */
+static int addr_parse(const char *str, int *family, unsigned char *a)
+{
+	struct addrinfo	hints, *res;
+	char	buf[SMALLBUF];
+	size_t	len;
+
+	/* accept bracketed IPv6 addresses too */
+	snprintf(buf, sizeof(buf), "%s", str);
+	len = strlen(buf);
+	if (len >= 2 && buf[0] == '[' && buf[len - 1] == ']') {
+		memmove(buf, buf + 1, len - 2);
+		buf[len - 2] = '\0';
+	}
+
+	memset(a, 0, 16);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+
+	if (getaddrinfo(buf, NULL, &hints, &res) == 0) {
+		struct sockaddr_in	s_in4;
+
+		/* copy for alignment, see nutscan_ip_iter_init() */
+		memcpy(&s_in4, res->ai_addr, sizeof(s_in4));
+		memcpy(a + 12, &s_in4.sin_addr, 4);
+		*family = AF_INET;
+		freeaddrinfo(res);
+		return 0;
+	}
+
+	hints.ai_family = AF_INET6;
+	if (getaddrinfo(buf, NULL, &hints, &res) == 0) {
+		struct sockaddr_in6	s_in6;
+
+		memcpy(&s_in6, res->ai_addr, sizeof(s_in6));
+		memcpy(a, &s_in6.sin6_addr, 16);
+		*family = AF_INET6;
+		freeaddrinfo(res);
+		return 0;
+	}
+
+	return -1;
+}
+
+/* Set up the bounds of the current range of iter; 0 if fine */
+static int addr_iter_load(nutscan_ip_addr_iter_t *iter)
+{
+	const char	*start = iter->range->start_ip, *slash;
+	char	buf[SMALLBUF];
+	int	family, hostbits, i;
+	long	prefix;
+	unsigned char	mask;
+
+	if (!start)
+		return -1;
+
+	if ((slash = strchr(start, '/')) != NULL) {
+		/* CIDR: the whole network, as nutscan_cidr_to_ip() does */
+		snprintf(buf, sizeof(buf), "%.*s", (int)(slash - start), start);
+		prefix = strtol(slash + 1, NULL, 10);
+
+		if (addr_parse(buf, &iter->family, iter->cur) != 0)
+			return -1;
+
+		hostbits = (iter->family == AF_INET ? 32 : 128);
+		if (prefix < 1 || prefix > hostbits)
+			return -1;
+		hostbits -= (int)prefix;
+
+		memcpy(iter->stop, iter->cur, 16);
+		for (i = 15; i >= 0 && hostbits > 0; i--, hostbits -= 8) {
+			mask = (hostbits >= 8) ? 0xFF : (unsigned char)((1U << hostbits) - 1);
+			iter->cur[i] &= (unsigned char)~mask;
+			iter->stop[i] |= mask;
+		}
+
+		return 0;
+	}
+
+	if (addr_parse(start, &iter->family, iter->cur) != 0)
+		return -1;
+
+	if (!iter->range->end_ip || iter->range->end_ip == start) {
+		memcpy(iter->stop, iter->cur, 16);
+		return 0;
+	}
+
+	if (addr_parse(iter->range->end_ip, &family, iter->stop) != 0
+	 || family != iter->family
+	)
+		return -1;
+
+	if (memcmp(iter->cur, iter->stop, 16) > 0) {
+		unsigned char	a[16];
+
+		memcpy(a, iter->cur, 16);
+		memcpy(iter->cur, iter->stop, 16);
+		memcpy(iter->stop, a, 16);
+	}
+
+	return 0;
+}
+
+/* Go to the first address of range, or of the next usable one after it;
+ * 0 if there is none */
+static int addr_iter_set_range(nutscan_ip_addr_iter_t *iter, nutscan_ip_range_t *range)
+{
+	for (; range != NULL; range = range->next) {
+		iter->range = range;
+		if (addr_iter_load(iter) == 0)
+			return 1;
+
+		upsdebugx(0, "WARNING: %s: skipping invalid IP range [%s .. %s]",
+			__func__, NUT_STRARG(range->start_ip), NUT_STRARG(range->end_ip));
+	}
+
+	iter->range = NULL;
+	return 0;
+}
+
+/* Step n addresses ahead, across ranges; 0 if that is past the end */
+static int addr_iter_advance(nutscan_ip_addr_iter_t *iter, size_t n)
+{
+	size_t	left;
+
+	while (iter->range != NULL) {
+		left = addr_diff(iter->stop, iter->cur);
+		if (n <= left) {
+			addr_add(iter->cur, n);
+			return 1;
+		}
+
+		n -= left + 1;
+		if (!addr_iter_set_range(iter, iter->range->next))
+			return 0;
+	}
+
+	return 0;
+}
+
+int nutscan_ip_addr_iter_init(nutscan_ip_addr_iter_t *iter, const nutscan_ip_range_list_t *irl,
+	size_t shard, size_t nshards)
+{
+	if (!iter || !irl || nshards < 1 || shard >= nshards) {
+		upsdebugx(5, "%s: skip, bad arguments", __func__);
+		return -1;
+	}
+
+	memset(iter, 0, sizeof(nutscan_ip_addr_iter_t));
+	iter->irl = irl;
+	iter->shard = shard;
+	iter->nshards = nshards;
+
+	addr_iter_set_range(iter, irl->ip_ranges);
+	return 0;
+}
+
+int nutscan_ip_addr_iter_next(nutscan_ip_addr_iter_t *iter, struct sockaddr_storage *addr,
+	socklen_t *addrlen)
+{
+	if (!iter || !iter->range || !addr)
+		return 0;
+
+	if (!addr_iter_advance(iter, iter->started ? iter->nshards : iter->shard))
+		return 0;
+	iter->started = 1;
+
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+	if (iter->family == AF_INET) {
+		struct sockaddr_in	*in4 = (struct sockaddr_in *)addr;
+
+		in4->sin_family = AF_INET;
+		memcpy(&in4->sin_addr, iter->cur + 12, 4);
+		if (addrlen)
+			*addrlen = (socklen_t)sizeof(struct sockaddr_in);
+	} else {
+		struct sockaddr_in6	*in6 = (struct sockaddr_in6 *)addr;
+
+		in6->sin6_family = AF_INET6;
+		memcpy(&in6->sin6_addr, iter->cur, 16);
+		if (addrlen)
+			*addrlen = (socklen_t)sizeof(struct sockaddr_in6);
+	}
+
+	return 1;
+}
+
+char * nutscan_ip_addr_str(const struct sockaddr *addr, char *buf, size_t buflen)
+{
+	socklen_t	len;
+
+	if (!addr || !buf)
+		return NULL;
+
+	if (addr->sa_family == AF_INET)
+		len = (socklen_t)sizeof(struct sockaddr_in);
+	else if (addr->sa_family == AF_INET6)
+		len = (socklen_t)sizeof(struct sockaddr_in6);
+	else
+		return NULL;
+
+	if (getnameinfo(addr, len, buf, (GETNAMEINFO_TYPE_ARG46)buflen,
+		NULL, 0, NI_NUMERICHOST) != 0
+	)
+		return NULL;
+
+	return buf;
+}
+
 int nutscan_cidr_to_ip(const char * cidr, char ** start_ip, char ** stop_ip)
 {
 	char * cidr_tok;
@@ -679,3 +934,224 @@ int nutscan_cidr_to_ip(const char * cidr, char ** start_ip, char ** stop_ip)
 	free(first_ip);
 	return 1;
 }
+
+#ifndef WIN32
+/* how many connections nutscan_probe_ip_ranges() tries at once at most
+ * (fewer if the limit of open files is lower, or when the system runs
+ * short of sockets) */
+#define NUTSCAN_PROBE_INFLIGHT	1024
+
+/* file descriptors left for the rest of the program */
+#define NUTSCAN_PROBE_RESERVE_FD	16
+
+typedef struct {
+	int	fd;
+	struct sockaddr_storage	addr;
+	socklen_t	addrlen;
+	struct timeval	start;
+} nutscan_probe_t;
+
+/* begin a non-blocking connect to addr; returns the socket, -1 if the
+ * address can't be used (or the host refused it right away), or -2 if the
+ * system is out of sockets for now */
+static int probe_start(const struct sockaddr *addr, socklen_t addrlen)
+{
+	int	fd, err;
+
+	if ((fd = socket(addr->sa_family, SOCK_STREAM, 0)) < 0) {
+		err = errno;
+		if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM)
+			return -2;
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	if (connect(fd, addr, addrlen) == 0 || errno == EINPROGRESS)
+		return fd;
+
+	err = errno;
+	close(fd);
+
+	if (err == EAGAIN || err == ENOBUFS)
+		return -2;
+	return -1;
+}
+
+nutscan_ip_range_list_t * nutscan_probe_ip_ranges(const nutscan_ip_range_list_t *irl,
+	const char *port, useconds_t usec_timeout)
+{
+	nutscan_ip_range_list_t	*found;
+	nutscan_ip_addr_iter_t	iter;
+	nutscan_probe_t	*probe;
+	struct pollfd	*pfd;
+	struct timeval	now;
+	struct sockaddr_storage	next;
+	socklen_t	nextlen = 0;
+	size_t	maxinflight = NUTSCAN_PROBE_INFLIGHT, limit, count = 0, i, tried = 0;
+	int	fd, ret, err, have_next = 0, more;
+	long	portnum;
+	uint16_t	nport;
+	char	*s, buf[SMALLBUF];
+	socklen_t	errlen;
+	double	timeout = (double)usec_timeout / 1000000.0;
+#ifdef HAVE_SYS_RESOURCE_H
+	struct rlimit	nofile_limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &nofile_limit) == 0
+	 && nofile_limit.rlim_cur != RLIM_INFINITY
+	 && (uintmax_t)nofile_limit.rlim_cur < (uintmax_t)maxinflight + 2 * NUTSCAN_PROBE_RESERVE_FD
+	) {
+		maxinflight = (nofile_limit.rlim_cur > 2 * NUTSCAN_PROBE_RESERVE_FD)
+			? (size_t)nofile_limit.rlim_cur - NUTSCAN_PROBE_RESERVE_FD
+			: NUTSCAN_PROBE_RESERVE_FD;
+	}
+#endif
+
+	if (!irl || !port)
+		return NULL;
+
+	/* the port is the same for all, set it once in each address */
+	portnum = strtol(port, &s, 10);
+	if (s == port || *s != '\0' || portnum < 1 || portnum > 65535) {
+		upsdebugx(0, "%s: invalid port number: %s", __func__, port);
+		return NULL;
+	}
+	nport = htons((uint16_t)portnum);
+
+	if (nutscan_ip_addr_iter_init(&iter, irl, 0, 1) != 0)
+		return NULL;
+
+	found = nutscan_init_ip_ranges(NULL);
+	probe = xcalloc(maxinflight, sizeof(*probe));
+	pfd = xcalloc(maxinflight, sizeof(*pfd));
+
+	/* start with a quarter of what may be in flight, then add one slot
+	 * per probe which is done with and halve it when out of sockets */
+	limit = (maxinflight > 4) ? maxinflight / 4 : 1;
+
+	more = 1;
+	while (more || have_next || count > 0) {
+		/* fill the free slots */
+		while (count < limit && (have_next || more)) {
+			if (!have_next) {
+				if (!nutscan_ip_addr_iter_next(&iter, &next, &nextlen)) {
+					more = 0;
+					break;
+				}
+				if (next.ss_family == AF_INET)
+					((struct sockaddr_in *)&next)->sin_port = nport;
+				else
+					((struct sockaddr_in6 *)&next)->sin6_port = nport;
+				have_next = 1;
+			}
+
+			fd = probe_start((struct sockaddr *)&next, nextlen);
+
+			if (fd == -2) {
+				/* keep that one for when some slots are freed */
+				limit = (count / 2 > 1) ? count / 2 : 1;
+				upsdebugx(3, "%s: out of sockets, now %" PRIuSIZE
+					" connections at once", __func__, limit);
+				break;
+			}
+
+			tried++;
+			have_next = 0;
+
+			if (fd < 0)
+				continue;
+
+			probe[count].fd = fd;
+			probe[count].addr = next;
+			probe[count].addrlen = nextlen;
+			gettimeofday(&probe[count].start, NULL);
+			count++;
+		}
+
+		if (count == 0) {
+			if (have_next) {
+				/* none in flight but none could be started */
+				upsdebugx(1, "%s: can't create sockets, giving up", __func__);
+				have_next = 0;
+				more = 0;
+			}
+			continue;
+		}
+
+		for (i = 0; i < count; i++) {
+			pfd[i].fd = probe[i].fd;
+			pfd[i].events = POLLOUT;
+			pfd[i].revents = 0;
+		}
+
+		/* at most until the oldest probe is due */
+		gettimeofday(&now, NULL);
+		ret = (int)((timeout - difftimeval(now, probe[0].start)) * 1000.0) + 1;
+		if (ret < 0)
+			ret = 0;
+
+		if (poll(pfd, (nfds_t)count, ret) < 0 && errno != EINTR) {
+			upsdebug_with_errno(1, "%s: poll", __func__);
+			break;
+		}
+
+		gettimeofday(&now, NULL);
+
+		/* sort out those done or due, keeping the rest in start order */
+		for (i = 0, ret = 0; i < count; i++) {
+			if (pfd[i].revents) {
+				err = 0;
+				errlen = sizeof(err);
+
+				if (getsockopt(probe[i].fd, SOL_SOCKET, SO_ERROR,
+					(void *)&err, &errlen) != 0
+				)
+					err = errno;
+
+				/* only the addresses which answer are made text */
+				if (err == 0 && nutscan_ip_addr_str(
+					(struct sockaddr *)&probe[i].addr, buf, sizeof(buf))
+				) {
+					upsdebugx(2, "%s: %s port %s accepts connections",
+						__func__, buf, port);
+					s = strdup(buf);
+					nutscan_add_ip_range(found, s, s);
+				}
+			} else if (difftimeval(now, probe[i].start) < timeout) {
+				probe[ret++] = probe[i];
+				continue;
+			}
+
+			if (limit < maxinflight)
+				limit++;
+
+			close(probe[i].fd);
+		}
+
+		count = (size_t)ret;
+	}
+
+	for (i = 0; i < count; i++)
+		close(probe[i].fd);
+
+	free(probe);
+	free(pfd);
+
+	upsdebugx(1, "%s: %" PRIuSIZE " of %" PRIuSIZE " addresses accept connections on port %s",
+		__func__, found->ip_ranges_count, tried, port);
+
+	return found;
+}
+#else	/* WIN32 */
+nutscan_ip_range_list_t * nutscan_probe_ip_ranges(const nutscan_ip_range_list_t *irl,
+	const char *port, useconds_t usec_timeout)
+{
+	NUT_UNUSED_VARIABLE(irl);
+	NUT_UNUSED_VARIABLE(port);
+	NUT_UNUSED_VARIABLE(usec_timeout);
+
+	/* not done there, the callers check every address themselves */
+	return NULL;
+}
+#endif	/* WIN32 */
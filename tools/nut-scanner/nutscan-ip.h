@@ -26,6 +26,8 @@
 #define SCAN_IP
 
 #ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #else
@@ -107,6 +109,44 @@ typedef struct nutscan_ip_range_list_iter_s {
 char * nutscan_ip_ranges_iter_init(nutscan_ip_range_list_iter_t *irliter, const nutscan_ip_range_list_t *irl);
 char * nutscan_ip_ranges_iter_inc(nutscan_ip_range_list_iter_t *irliter);
 
+/* Iterator over the same addresses as binary socket addresses, without
+ * a string (nor an allocation) for each of them; text is only needed to
+ * report the few which are of interest, see nutscan_ip_addr_str().
+ * A range may also be given as one "address/prefix" (CIDR) start_ip.
+ * With nshards > 1, the iterator only gets each nshards-th address of
+ * the whole list, from the shard-th one (0 <= shard < nshards), so that
+ * as many workers can share a list without overlap.
+ */
+typedef struct nutscan_ip_addr_iter_s {
+	const nutscan_ip_range_list_t * irl;	/* Structure with actual linked list of address-range entries */
+	nutscan_ip_range_t * range;	/* Currently iterated IP range */
+	int	family;			/* AF_INET or AF_INET6, of the current range */
+	unsigned char	cur[16];	/* Current address, big-endian (IPv4 in the last 4 bytes) */
+	unsigned char	stop[16];	/* Last address of the current range */
+	size_t	shard;
+	size_t	nshards;
+	int	started;
+} nutscan_ip_addr_iter_t;
+
+/* Return 0 if fine, -1 if the arguments are not */
+int nutscan_ip_addr_iter_init(nutscan_ip_addr_iter_t *iter, const nutscan_ip_range_list_t *irl,
+	size_t shard, size_t nshards);
+/* Store the next address (port 0) in addr; return 1, or 0 when done */
+int nutscan_ip_addr_iter_next(nutscan_ip_addr_iter_t *iter, struct sockaddr_storage *addr,
+	socklen_t *addrlen);
+/* Numeric text form of the address (IPv6 without brackets) in buf,
+ * or NULL if it can't be converted */
+char * nutscan_ip_addr_str(const struct sockaddr *addr, char *buf, size_t buflen);
+
+/* Try a TCP connection to port on each address of irl, many at once
+ * (without a thread for each), each given usec_timeout to complete.
+ * Returns a new list (to free with nutscan_free_ip_ranges() and free())
+ * of the addresses which accepted it, so a protocol scan only has to
+ * talk to those; or NULL if such probes can't be done here.
+ */
+nutscan_ip_range_list_t * nutscan_probe_ip_ranges(const nutscan_ip_range_list_t *irl,
+	const char *port, useconds_t usec_timeout);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -36,6 +36,7 @@ int nutscan_unload_avahi_library(void);
 #include <assert.h>
 #include <stdlib.h>
 #include "timehead.h"
+#include "nut_stdint.h"
 
 #include <avahi-client/client.h>
 #include <avahi-client/lookup.h>
@@ -250,6 +251,176 @@ static AvahiSimplePoll *simple_poll = NULL;
 static nutscan_device_t * dev_ret = NULL;
 static useconds_t avahi_usec_timeout = 0;
 
+/* The scan is over as soon as the browser said it found all there was
+ * (ALL_FOR_NOW) and the services are resolved, or once no service was
+ * found nor resolved for SCAN_AVAHI_QUIET_USEC, whichever comes first,
+ * rather than after the usec_timeout of the scan (which still bounds it).
+ * The quiet period only counts from the first service found: until then
+ * the mDNS queries may not have been answered yet (responders delay
+ * their answers, and ALL_FOR_NOW only comes after about a second).
+ * The services are resolved all at once, each as soon as it is found. */
+#define SCAN_AVAHI_QUIET_USEC	250000
+
+static size_t avahi_resolving = 0;	/* resolvers not done yet */
+static int avahi_browsed = 0;		/* ALL_FOR_NOW was seen */
+static AvahiTimeout *avahi_quiet = NULL;
+
+/* The upsd instances which did not publish their devices: asked for them
+ * all at once once the browsing is over (see avahi_probe_all()), rather
+ * than one by one from the resolver callbacks */
+typedef struct avahi_probe_s {
+	char	*host_name;
+	char	*ip;
+	uint16_t	port;
+	int	proto;
+	struct avahi_probe_s	*next;
+} avahi_probe_t;
+
+static avahi_probe_t *avahi_probes = NULL;
+
+static void avahi_timeval_in(struct timeval *tv, useconds_t usec)
+{
+	gettimeofday(tv, NULL);
+	tv->tv_sec += (time_t)(usec / 1000000);
+	tv->tv_usec += (suseconds_t)(usec % 1000000);
+	if (tv->tv_usec >= 1000000) {
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+}
+
+/* something happened: the quiet period starts over */
+static void avahi_activity(void)
+{
+	struct timeval tv;
+
+	if (!avahi_quiet) {
+		return;
+	}
+
+	avahi_timeval_in(&tv, SCAN_AVAHI_QUIET_USEC);
+	(*nut_avahi_simple_poll_get)(simple_poll)->timeout_update(avahi_quiet, &tv);
+}
+
+static void avahi_quiet_callback(AvahiTimeout *t, void *userdata)
+{
+	NUT_UNUSED_VARIABLE(t);
+	NUT_UNUSED_VARIABLE(userdata);
+
+	if (avahi_resolving) {
+		/* give them another while, within the deadline */
+		upsdebugx(2, "%s: quiet, but %" PRIuSIZE " service(s) still resolving",
+			__func__, avahi_resolving);
+		avahi_activity();
+		return;
+	}
+
+	upsdebugx(1, "%s: no new services for %u msec, done",
+		__func__, (unsigned int)(SCAN_AVAHI_QUIET_USEC / 1000));
+	(*nut_avahi_simple_poll_quit)(simple_poll);
+}
+
+static void avahi_deadline_callback(AvahiTimeout *t, void *userdata)
+{
+	NUT_UNUSED_VARIABLE(t);
+	NUT_UNUSED_VARIABLE(userdata);
+
+	upsdebugx(1, "%s: timed out, %" PRIuSIZE " service(s) not resolved",
+		__func__, avahi_resolving);
+	(*nut_avahi_simple_poll_quit)(simple_poll);
+}
+
+static void add_upsd_device(const char * host_name, uint16_t port, int proto);
+
+/* ask the upsd instances of avahi_probes for their devices, all at once
+ * for each port (see nutscan_scan_ip_range_nut()); those which did not
+ * answer are listed without a device, as they were found */
+static void avahi_probe_all(void)
+{
+	avahi_probe_t *p, *q, *next;
+	nutscan_ip_range_list_t irl;
+	nutscan_device_t *found, *d;
+	char buf[6];
+	int answered;
+
+	for (p = avahi_probes; p; p = p->next) {
+		/* done already with another of the same port */
+		if (!p->ip) {
+			continue;
+		}
+
+		nutscan_init_ip_ranges(&irl);
+		for (q = p; q; q = q->next) {
+			if (q->ip && q->port == p->port) {
+				nutscan_add_ip_range(&irl, xstrdup(q->ip), NULL);
+			}
+		}
+
+		snprintf(buf, sizeof(buf), "%" PRIu16, p->port);
+		found = nutscan_rewind_device(nutscan_scan_ip_range_nut(&irl, buf, avahi_usec_timeout));
+		nutscan_free_ip_ranges(&irl);
+
+		for (q = p; q; q = q->next) {
+			if (!q->ip || q->port != p->port) {
+				continue;
+			}
+
+			/* "ups@ip", "ups@ip:port" or "ups@[ip]..." */
+			answered = 0;
+			for (d = found; d && !answered; d = d->next) {
+				const char *at = d->port ? strchr(d->port, '@') : NULL;
+				size_t len;
+
+				if (!at) {
+					continue;
+				}
+				at += (at[1] == '[') ? 2 : 1;
+				len = strlen(q->ip);
+				answered = (!strncmp(at, q->ip, len)
+					&& (at[len] == '\0' || at[len] == ':' || at[len] == ']'));
+			}
+
+			if (!answered) {
+				add_upsd_device(q->host_name, q->port, q->proto);
+			}
+
+			free(q->ip);
+			q->ip = NULL;
+		}
+
+		if (found) {
+			dev_ret = nutscan_add_device_to_device(dev_ret, found);
+		}
+	}
+
+	for (p = avahi_probes; p; p = next) {
+		next = p->next;
+		free(p->host_name);
+		free(p->ip);
+		free(p);
+	}
+	avahi_probes = NULL;
+}
+
+static void add_probe(const char * host_name, const char *ip, uint16_t port, int proto)
+{
+	avahi_probe_t *p, **last;
+
+	/* the same service is found on each interface and protocol */
+	for (last = &avahi_probes; *last; last = &(*last)->next) {
+		if ((*last)->port == port && !strcmp((*last)->ip, ip)) {
+			return;
+		}
+	}
+
+	p = xcalloc(1, sizeof(*p));
+	p->host_name = xstrdup(host_name);
+	p->ip = xstrdup(ip);
+	p->port = port;
+	p->proto = proto;
+	*last = p;
+}
+
 static void update_device(const char * host_name, const char *ip, uint16_t port, char * text, int proto)
 {
 	nutscan_device_t * dev = NULL;
@@ -263,7 +434,6 @@ static void update_device(const char * host_name, const char *ip, uint16_t port,
 	char * device = NULL;
 	char * device_saveptr = NULL;
 	int device_found = 0;
-	char buf[6];
 	size_t buf_size;
 
 	if (text == NULL) {
@@ -329,6 +499,7 @@ static void update_device(const char * host_name, const char *ip, uint16_t port,
 			}
 			if (dev->port) {
 				dev_ret = nutscan_add_device_to_device(dev_ret, dev);
+				nutscan_report_device(dev);
 			}
 			else {
 				nutscan_free_device(dev);
@@ -341,45 +512,50 @@ static void update_device(const char * host_name, const char *ip, uint16_t port,
 	free(t);
 
 	/* If no device published in avahi data, try to get the device by
-	connecting directly to upsd */
+	connecting directly to upsd, along with the others (see avahi_probe_all()) */
 	if (!device_found) {
-		snprintf(buf, sizeof(buf), "%u", port);
-		dev = nutscan_scan_nut(ip, ip, buf, avahi_usec_timeout);
-		if (dev) {
-			dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-		}
-		/* add an upsd entry without associated device */
-		else {
-			dev = nutscan_new_device();
-			dev->type = TYPE_NUT;
-			dev->driver = strdup(SCAN_AVAHI_DRIVERNAME);
-			if (proto == AVAHI_PROTO_INET) {
-				nutscan_add_option_to_device(dev, "desc", "IPv4");
-			}
-			if (proto == AVAHI_PROTO_INET6) {
-				nutscan_add_option_to_device(dev, "desc", "IPv6");
-			}
-			if (port != PORT) {
-				/*+1+1 is for ':' character and terminating 0 */
-				/*buf is the string containing the port number*/
-				buf_size = strlen(host_name) + strlen(buf) + 1 + 1;
-				dev->port = malloc(buf_size);
-				if (dev->port) {
-					snprintf(dev->port, buf_size, "%s:%s",
-						host_name, buf);
-				}
-			}
-			else {
-				dev->port = strdup(host_name);
-			}
-			if (dev->port) {
-				dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-			}
-			else {
-				nutscan_free_device(dev);
-			}
+		add_probe(host_name, ip, port, proto);
+	}
+}
+
+/* an upsd entry without associated device */
+static void add_upsd_device(const char * host_name, uint16_t port, int proto)
+{
+	nutscan_device_t * dev = NULL;
+	char buf[6];
+	size_t buf_size;
+
+	snprintf(buf, sizeof(buf), "%u", port);
+
+	dev = nutscan_new_device();
+	dev->type = TYPE_NUT;
+	dev->driver = strdup(SCAN_AVAHI_DRIVERNAME);
+	if (proto == AVAHI_PROTO_INET) {
+		nutscan_add_option_to_device(dev, "desc", "IPv4");
+	}
+	if (proto == AVAHI_PROTO_INET6) {
+		nutscan_add_option_to_device(dev, "desc", "IPv6");
+	}
+	if (port != PORT) {
+		/*+1+1 is for ':' character and terminating 0 */
+		/*buf is the string containing the port number*/
+		buf_size = strlen(host_name) + strlen(buf) + 1 + 1;
+		dev->port = malloc(buf_size);
+		if (dev->port) {
+			snprintf(dev->port, buf_size, "%s:%s",
+				host_name, buf);
 		}
 	}
+	else {
+		dev->port = strdup(host_name);
+	}
+	if (dev->port) {
+		dev_ret = nutscan_add_device_to_device(dev_ret, dev);
+		nutscan_report_device(dev);
+	}
+	else {
+		nutscan_free_device(dev);
+	}
 }
 
 static void resolve_callback(
@@ -474,6 +650,16 @@ static void resolve_callback(
 	}
 
 	(*nut_avahi_service_resolver_free)(r);
+
+	if (avahi_resolving) {
+		avahi_resolving--;
+	}
+	avahi_activity();
+
+	if (avahi_browsed && !avahi_resolving) {
+		upsdebugx(1, "%s: all services resolved, done", __func__);
+		(*nut_avahi_simple_poll_quit)(simple_poll);
+	}
 }
 
 static void browse_callback(
@@ -529,7 +715,10 @@ static void browse_callback(
 					"Failed to resolve service '%s': %s",
 					__func__,
 					name, (*nut_avahi_strerror)((*nut_avahi_client_errno)(c)));
+			else
+				avahi_resolving++;
 
+			avahi_activity();
 			break;
 
 		case AVAHI_BROWSER_REMOVE:
@@ -537,7 +726,11 @@ static void browse_callback(
 			break;
 
 		case AVAHI_BROWSER_ALL_FOR_NOW:
-			(*nut_avahi_simple_poll_quit)(simple_poll);
+			/* done once those found are resolved too */
+			avahi_browsed = 1;
+			if (!avahi_resolving) {
+				(*nut_avahi_simple_poll_quit)(simple_poll);
+			}
 			goto fallthrough_AVAHI_BROWSER_CACHE_EXHAUSTED; /* be explicit */
 
 		case AVAHI_BROWSER_CACHE_EXHAUSTED:
@@ -612,6 +805,9 @@ nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout)
 	 */
 	AvahiClient *client = NULL;
 	AvahiServiceBrowser *sb = NULL;
+	AvahiTimeout *deadline = NULL;
+	const AvahiPoll *poll_api = NULL;
+	struct timeval tv;
 	int error;
 
 	if (!nutscan_avail_avahi) {
@@ -619,6 +815,8 @@ nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout)
 	}
 
 	avahi_usec_timeout = usec_timeout;
+	avahi_resolving = 0;
+	avahi_browsed = 0;
 
 	/* Allocate main loop object */
 	if (!(simple_poll = (*nut_avahi_simple_poll_new)())) {
@@ -658,12 +856,28 @@ nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout)
 		goto fail;
 	}
 
+	/* See SCAN_AVAHI_QUIET_USEC: set by avahi_activity() */
+	poll_api = (*nut_avahi_simple_poll_get)(simple_poll);
+	avahi_quiet = poll_api->timeout_new(poll_api, NULL, avahi_quiet_callback, NULL);
+	if (usec_timeout > 0) {
+		avahi_timeval_in(&tv, usec_timeout);
+		deadline = poll_api->timeout_new(poll_api, &tv, avahi_deadline_callback, NULL);
+	}
+
 	/* Run the main loop */
 	(*nut_avahi_simple_poll_loop)(simple_poll);
 
 fail:
 
 	/* Cleanup things */
+	if (avahi_quiet) {
+		poll_api->timeout_free(avahi_quiet);
+		avahi_quiet = NULL;
+	}
+
+	if (deadline)
+		poll_api->timeout_free(deadline);
+
 	if (sb)
 		(*nut_avahi_service_browser_free)(sb);
 
@@ -673,6 +887,9 @@ fail:
 	if (simple_poll)
 		(*nut_avahi_simple_poll_free)(simple_poll);
 
+	/* the upsd instances which did not tell their devices */
+	avahi_probe_all();
+
 	return nutscan_rewind_device(dev_ret);
 }
 
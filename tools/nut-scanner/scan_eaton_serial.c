@@ -95,6 +95,12 @@ TYPE_FD   upsfd;
 int   exit_flag = 0;
 int   do_lock_port;
 
+/* serial.c times the device I/O for the driver.perf.* variables */
+void dstate_perf_io_begin(void);
+void dstate_perf_io_end(void);
+void dstate_perf_io_begin(void) {}
+void dstate_perf_io_end(void) {}
+
 /* Functions extracted from drivers/bcmxcp.c, to avoid pulling too many things
  * lightweight function to calculate the 8-bit
  * two's complement checksum of buf, using XCP data length (including header)
@@ -187,6 +193,7 @@ static nutscan_device_t * nutscan_scan_eaton_serial_shut(const char* port_name)
 #ifdef HAVE_PTHREAD
 				pthread_mutex_unlock(&dev_mutex);
 #endif
+				nutscan_report_device(dev);
 			}
 		}
 		/* Close the device */
@@ -221,14 +228,6 @@ static nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
 	memset(sbuf, 0, 128);
 
 	if (VALID_FD_SER(devfd)) {
-#ifdef HAVE_PTHREAD
-		pthread_mutex_lock(&dev_mutex);
-#endif
-		upsfd = devfd;
-#ifdef HAVE_PTHREAD
-		pthread_mutex_unlock(&dev_mutex);
-#endif
-
 		for (i = 0; (pw_baud_rates[i].rate != 0) && (dev == NULL); i++)
 		{
 			memset(answer, 0, 256);
@@ -241,7 +240,15 @@ static nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
 				break;
 
 			usleep(90000);
-			send_write_command(BCMXCP_AUTHCMD, 4);
+
+			/* Send the auth command framed as send_write_command()
+			 * does, but to this port: that one writes to the global
+			 * upsfd, which the other ports' threads would share */
+			sbuf[0] = PW_COMMAND_START_BYTE;
+			sbuf[1] = (unsigned char)4;
+			memcpy(sbuf + 2, BCMXCP_AUTHCMD, 4);
+			sbuf[6] = calc_checksum(sbuf);
+			ser_send_buf(devfd, sbuf, 7);
 			usleep(500000);
 
 			/* Discovery with Baud Hunting (XCP protocol spec. §4.1.2)
@@ -277,6 +284,7 @@ static nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
 #ifdef HAVE_PTHREAD
 				pthread_mutex_unlock(&dev_mutex);
 #endif
+				nutscan_report_device(dev);
 				break;
 			}
 			usleep(100000);
@@ -365,6 +373,7 @@ static nutscan_device_t * nutscan_scan_eaton_serial_q1(const char* port_name)
 #ifdef HAVE_PTHREAD
 										pthread_mutex_unlock(&dev_mutex);
 #endif
+										nutscan_report_device(dev);
 										break;
 									}
 								}
@@ -380,9 +389,121 @@ static nutscan_device_t * nutscan_scan_eaton_serial_q1(const char* port_name)
 	return dev;
 }
 
+/*******************************************************************************
+ * Protocol order
+ ******************************************************************************/
+
+/* The protocols are tried in this order at first (TODO: UTalk?) ... */
+static const struct {
+	const char	*name;
+	nutscan_device_t *(*probe)(const char *port_name);
+} eaton_serial_protocols[] = {
+	{ "SHUT", nutscan_scan_eaton_serial_shut },
+	{ "XCP", nutscan_scan_eaton_serial_xcp },
+	{ "Q1", nutscan_scan_eaton_serial_q1 }
+};
+
+#define EATON_SERIAL_PROTOCOLS	\
+	(sizeof(eaton_serial_protocols) / sizeof(eaton_serial_protocols[0]))
+
+/* ... and then in the order learned from the earlier scans of this
+ * process: the protocol which a port answered last time first, then
+ * the others by how many ports answered them */
+typedef struct eaton_serial_known_s {
+	char	*port_name;
+	size_t	protocol;
+	struct eaton_serial_known_s	*next;
+} eaton_serial_known_t;
+
+static eaton_serial_known_t	*known_ports = NULL;
+static size_t	protocol_hits[EATON_SERIAL_PROTOCOLS];
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t known_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void eaton_serial_order(const char *port_name, size_t *order)
+{
+	eaton_serial_known_t	*known;
+	size_t	i, j, tmp, first = EATON_SERIAL_PROTOCOLS;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&known_mutex);
+#endif
+	for (known = known_ports; known != NULL; known = known->next) {
+		if (!strcmp(known->port_name, port_name)) {
+			first = known->protocol;
+			break;
+		}
+	}
+
+	/* stable insertion sort by hits, so ties keep the default order */
+	for (i = 0; i < EATON_SERIAL_PROTOCOLS; i++) {
+		order[i] = i;
+		for (j = i; j > 0 && protocol_hits[order[j]] > protocol_hits[order[j - 1]]; j--) {
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&known_mutex);
+#endif
+
+	if (first < EATON_SERIAL_PROTOCOLS) {
+		for (i = 0; order[i] != first; i++)
+			;
+		for (; i > 0; i--)
+			order[i] = order[i - 1];
+		order[0] = first;
+	}
+}
+
+static void eaton_serial_learn(const char *port_name, size_t protocol)
+{
+	eaton_serial_known_t	*known;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&known_mutex);
+#endif
+	protocol_hits[protocol]++;
+
+	for (known = known_ports; known != NULL; known = known->next) {
+		if (!strcmp(known->port_name, port_name))
+			break;
+	}
+
+	if (known == NULL) {
+		known = xcalloc(1, sizeof(eaton_serial_known_t));
+		known->port_name = strdup(port_name);
+		known->next = known_ports;
+		known_ports = known;
+	}
+	known->protocol = protocol;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&known_mutex);
+#endif
+}
+
+/* externally visible to nutscan-init */
+void nutscan_free_eaton_serial(void);
+void nutscan_free_eaton_serial(void)
+{
+	eaton_serial_known_t	*known;
+
+	while ((known = known_ports) != NULL) {
+		known_ports = known->next;
+		free(known->port_name);
+		free(known);
+	}
+
+	memset(protocol_hits, 0, sizeof(protocol_hits));
+}
+
 /* Wrap calls to actual implementations of nutscan_scan_eaton_serial_shut(),
  * nutscan_scan_eaton_serial_xcp() and/or nutscan_scan_eaton_serial_q1()
- * which implement the semantics of parallel-able scanning.
+ * (in the learned order) which implement the semantics of parallel-able
+ * scanning: each port is probed by a job of its own.
  * Returns the device entry, updates global dev_ret when a scan is successful.
  * DOES NOT FREE the caller's copy of "port_arg", unlike many similar methods
  * in other scanners.
@@ -391,17 +512,21 @@ static void * nutscan_scan_eaton_serial_device_thready(void * port_arg)
 {
 	nutscan_device_t * dev = NULL;
 	char* port_name = (char*) port_arg;
+	size_t	order[EATON_SERIAL_PROTOCOLS], i;
+
+	eaton_serial_order(port_name, order);
 
-	/* Try SHUT first */
-	if ((dev = nutscan_scan_eaton_serial_shut(port_name)) == NULL) {
-		usleep(100000);
-		/* Else, try XCP */
-		if ((dev = nutscan_scan_eaton_serial_xcp(port_name)) == NULL) {
-			/* Else, try Q1 */
+	for (i = 0; i < EATON_SERIAL_PROTOCOLS; i++) {
+		if (i > 0)
 			usleep(100000);
-			dev = nutscan_scan_eaton_serial_q1(port_name);
+
+		upsdebugx(3, "%s: trying %s on %s", __func__,
+			eaton_serial_protocols[order[i]].name, port_name);
+
+		if ((dev = eaton_serial_protocols[order[i]].probe(port_name)) != NULL) {
+			eaton_serial_learn(port_name, order[i]);
+			break;
 		}
-		/* Else try UTalk? */
 	}
 
 	return dev;
@@ -409,7 +534,6 @@ static void * nutscan_scan_eaton_serial_device_thready(void * port_arg)
 
 nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
 #ifndef WIN32
 	struct sigaction oldact;
 	int change_action_handler = 0;
@@ -417,19 +541,10 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 	char *current_port_name = NULL;
 	char **serial_ports_list;
 	int  current_port_nb;
+	nutscan_pool_batch_t * batch;
+	size_t i;
 
 #ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore = nutscan_semaphore();
-	/* TODO? Port semaphore_scantype / max_threads_scantype
-	 *  from sibling sources? We do not have that many serial
-	 *  ports to care much, usually... right?
-	 */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-	pthread_t thread;
-	nutscan_thread_t * thread_array = NULL;
-	size_t thread_count = 0, i;
-
 	pthread_mutex_init(&dev_mutex, NULL);
 #endif /* HAVE_PTHREAD */
 
@@ -456,208 +571,23 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 	}
 #endif
 
-	/* port(s) iterator */
+	/* port(s) iterator; we do not have that many serial ports
+	 * to need a limit of our own beyond the pool size */
+	batch = nutscan_pool_batch_new(0);
 	current_port_nb = 0;
 	while (serial_ports_list[current_port_nb] != NULL) {
-#ifdef HAVE_PTHREAD
-		/* NOTE: With many enough targets to scan, this can crash
-		 * by spawning too many children; add a limit and loop to
-		 * "reap" some already done with their work. And probably
-		 * account them in thread_array[] as something to not wait
-		 * for below in pthread_join()...
-		 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		/* Just wait for someone to free a semaphored slot,
-		 * if none are available, and then/otherwise grab one
-		 */
-		if (thread_array == NULL) {
-			/* Starting point, or after a wait to complete
-			 * all earlier runners */
-			sem_wait(semaphore);
-			pass = TRUE;
-		} else {
-			pass = (sem_trywait(semaphore) == 0);
-		}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-		/* A somewhat naive and brute-force solution for
-		 * systems without a semaphore.h. This may suffer
-		 * some off-by-one errors, using a few more threads
-		 * than intended (if we race a bit at the wrong time,
-		 * probably up to one per enabled scanner routine).
-		 */
-
-		/* TOTHINK: Should there be a threadcount_mutex when
-		 * we just read the value in if() and while() below?
-		 * At worst we would overflow the limit a bit due to
-		 * other protocol scanners...
-		 */
-		if (curr_threads >= max_threads) {
-			upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-				"(launched overall: %" PRIuSIZE "), "
-				"waiting until some would finish",
-				__func__, curr_threads, thread_count);
-
-			while (curr_threads >= max_threads) {
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-
-					if (!thread_array[i].active) continue;
-
-					pthread_mutex_lock(&threadcount_mutex);
-					upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-					ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-					switch (ret) {
-						case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-							upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-							break;
-						case 0:         /* thread exited */
-							if (curr_threads > 0) {
-								curr_threads --;
-								upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-							} else {
-								/* threadcount_mutex fault? */
-								upsdebugx(0, "WARNING: %s: Accounting of thread count "
-									"says we are already at 0", __func__);
-							}
-							thread_array[i].active = FALSE;
-							break;
-						case EBUSY:     /* actively running */
-							upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-								__func__, i, ret);
-							break;
-						case EDEADLK:   /* Errors with thread interactions... bail out? */
-						case EINVAL:    /* Errors with thread interactions... bail out? */
-						default:        /* new pthreads abilities? */
-							upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-								__func__, i, ret);
-							break;
-					}
-					pthread_mutex_unlock(&threadcount_mutex);
-				}
-
-				if (curr_threads >= max_threads) {
-					usleep (10000); /* microSec's, so 0.01s here */
-				}
-			}
-			upsdebugx(2, "%s: proceeding with scan", __func__);
-		}
-
-		/* NOTE: No change to default "pass" in this ifdef:
-		 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-
-		if (pass) {
-			current_port_name = serial_ports_list[current_port_nb];
-
-#ifdef HAVE_PTHREAD
-			if (pthread_create(&thread, NULL, nutscan_scan_eaton_serial_device_thready, (void*)current_port_name) == 0) {
-				nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-				thread_count++;
-				new_thread_array = realloc(thread_array,
-					thread_count * sizeof(nutscan_thread_t));
-				if (new_thread_array == NULL) {
-					upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-					break;
-				}
-				else {
-					thread_array = new_thread_array;
-				}
-				thread_array[thread_count - 1].thread = thread;
-				thread_array[thread_count - 1].active = TRUE;
+		current_port_name = serial_ports_list[current_port_nb];
 
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-			}
-#else   /* if not HAVE_PTHREAD */
-			nutscan_scan_eaton_serial_device_thready(current_port_name);
-#endif  /* if HAVE_PTHREAD */
+		nutscan_pool_submit(batch, nutscan_scan_eaton_serial_device_thready, (void*)current_port_name);
 
-			/* Prepare the next iteration */
-			current_port_nb++;
-		} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Wait for all current scans to complete */
-			if (thread_array != NULL) {
-				upsdebugx (2, "%s: Running too many scanning threads (%"
-					PRIuSIZE "), "
-					"waiting until older ones would finish",
-					__func__, thread_count);
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-					if (!thread_array[i].active) {
-						/* Probably should not get here,
-						 * but handle it just in case */
-						upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-							__func__, i);
-						sem_post(semaphore);
-						continue;
-					}
-					thread_array[i].active = FALSE;
-					ret = pthread_join(thread_array[i].thread, NULL);
-					if (ret != 0) {
-						upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-							__func__, ret);
-					}
-					sem_post(semaphore);
-				}
-				thread_count = 0;
-				free(thread_array);
-				thread_array = NULL;
-			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-		} /* if: could we "pass" or not? */
+		/* Prepare the next iteration */
+		current_port_nb++;
 	} /* while */
 
-#ifdef HAVE_PTHREAD
-	if (thread_array != NULL) {
-		upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-		for (i = 0; i < thread_count; i++) {
-			int ret;
-
-			if (!thread_array[i].active) continue;
+	upsdebugx(2, "%s: all planned scans queued, waiting for them to complete", __func__);
+	nutscan_pool_batch_wait(batch);
 
-			ret = pthread_join(thread_array[i].thread, NULL);
-			if (ret != 0) {
-				upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-					__func__, ret);
-			}
-			thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			sem_post(semaphore);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			pthread_mutex_lock(&threadcount_mutex);
-			if (curr_threads > 0) {
-				curr_threads --;
-				upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-					__func__, i);
-			} else {
-				upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-					"says we are already at 0", __func__);
-			}
-			pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		}
-		free(thread_array);
-		upsdebugx(2, "%s: all threads freed", __func__);
-	}
+#ifdef HAVE_PTHREAD
 	pthread_mutex_destroy(&dev_mutex);
 #endif /* HAVE_PTHREAD */
 
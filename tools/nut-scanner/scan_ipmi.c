@@ -27,6 +27,7 @@
 #include "common.h"
 #include "nut-scan.h"
 #include "nut_stdint.h"
+#include "nut-ipmi.h"	/* NUT_IPMI_SDR_CACHE_FMT */
 
 /* externally visible to nutscan-init */
 int nutscan_unload_ipmi_library(void);
@@ -119,6 +120,43 @@ static char * (*nut_ipmi_ctx_errormsg) (ipmi_ctx_t ctx);
 static int (*nut_ipmi_ctx_close) (ipmi_ctx_t ctx);
 static void (*nut_ipmi_ctx_destroy) (ipmi_ctx_t ctx);
 
+#ifdef HAVE_FREEIPMI_11X_12X
+/* Optional, to list the FRU devices of a BMC from its SDR rather than
+ * try every FRU device ID (see nutscan_ipmi_fru_ids()) */
+static int nut_ipmi_sdr_avail = 0;
+static ipmi_sdr_ctx_t (*nut_ipmi_sdr_ctx_create) (void);
+static int (*nut_ipmi_sdr_ctx_errnum) (ipmi_sdr_ctx_t ctx);
+static int (*nut_ipmi_sdr_cache_open) (ipmi_sdr_ctx_t ctx,
+                            ipmi_ctx_t ipmi_ctx,
+                            const char *filename);
+static int (*nut_ipmi_sdr_cache_create) (ipmi_sdr_ctx_t ctx,
+                            ipmi_ctx_t ipmi_ctx,
+                            const char *filename,
+                            int cache_create_flags,
+                            Ipmi_Sdr_Cache_Create_Callback create_callback,
+                            void *create_callback_data);
+static int (*nut_ipmi_sdr_cache_delete) (ipmi_sdr_ctx_t ctx, const char *filename);
+static int (*nut_ipmi_sdr_cache_record_count) (ipmi_sdr_ctx_t ctx, uint16_t *record_count);
+static int (*nut_ipmi_sdr_cache_next) (ipmi_sdr_ctx_t ctx);
+static int (*nut_ipmi_sdr_cache_record_read) (ipmi_sdr_ctx_t ctx,
+                            void *buf,
+                            unsigned int buflen);
+static int (*nut_ipmi_sdr_parse_record_id_and_type) (ipmi_sdr_ctx_t ctx,
+                            const void *sdr_record,
+                            unsigned int sdr_record_len,
+                            uint16_t *record_id,
+                            uint8_t *record_type);
+static int (*nut_ipmi_sdr_parse_fru_device_locator_parameters) (ipmi_sdr_ctx_t ctx,
+                            const void *sdr_record,
+                            unsigned int sdr_record_len,
+                            uint8_t *direct_access_address,
+                            uint8_t *logical_fru_device_device_slave_address,
+                            uint8_t *private_bus_id,
+                            uint8_t *lun_for_master_write_read_command,
+                            uint8_t *logical_physical_fru_device,
+                            uint8_t *channel_number);
+#endif /* HAVE_FREEIPMI_11X_12X */
+
 /* This variable collects device(s) from a sequential or parallel scan,
  * is returned to caller, and cleared to allow subsequent independent scans */
 static nutscan_device_t * dev_ret = NULL;
@@ -147,6 +185,22 @@ int nutscan_unload_ipmi_library(void)
 }
 
 /* Return 0 on error; visible externally */
+#ifdef HAVE_FREEIPMI_11X_12X
+/* a symbol we can do without: if missing, the FRU device IDs are tried */
+static void *nutscan_ipmi_dlsym_optional(const char *name)
+{
+	void *sym = lt_dlsym(dl_handle, name);
+
+	if (lt_dlerror() != NULL) {
+		upsdebugx(1, "%s: no %s in the IPMI library", __func__, name);
+		nut_ipmi_sdr_avail = 0;
+		return NULL;
+	}
+
+	return sym;
+}
+#endif /* HAVE_FREEIPMI_11X_12X */
+
 int nutscan_load_ipmi_library(const char *libname_path);
 int nutscan_load_ipmi_library(const char *libname_path)
 {
@@ -273,6 +327,20 @@ int nutscan_load_ipmi_library(const char *libname_path)
 			goto err;
 	}
 
+#ifdef HAVE_FREEIPMI_11X_12X
+	nut_ipmi_sdr_avail = 1;
+	*(void **) (&nut_ipmi_sdr_ctx_create) = nutscan_ipmi_dlsym_optional("ipmi_sdr_ctx_create");
+	*(void **) (&nut_ipmi_sdr_ctx_errnum) = nutscan_ipmi_dlsym_optional("ipmi_sdr_ctx_errnum");
+	*(void **) (&nut_ipmi_sdr_cache_open) = nutscan_ipmi_dlsym_optional("ipmi_sdr_cache_open");
+	*(void **) (&nut_ipmi_sdr_cache_create) = nutscan_ipmi_dlsym_optional("ipmi_sdr_cache_create");
+	*(void **) (&nut_ipmi_sdr_cache_delete) = nutscan_ipmi_dlsym_optional("ipmi_sdr_cache_delete");
+	*(void **) (&nut_ipmi_sdr_cache_record_count) = nutscan_ipmi_dlsym_optional("ipmi_sdr_cache_record_count");
+	*(void **) (&nut_ipmi_sdr_cache_next) = nutscan_ipmi_dlsym_optional("ipmi_sdr_cache_next");
+	*(void **) (&nut_ipmi_sdr_cache_record_read) = nutscan_ipmi_dlsym_optional("ipmi_sdr_cache_record_read");
+	*(void **) (&nut_ipmi_sdr_parse_record_id_and_type) = nutscan_ipmi_dlsym_optional("ipmi_sdr_parse_record_id_and_type");
+	*(void **) (&nut_ipmi_sdr_parse_fru_device_locator_parameters) = nutscan_ipmi_dlsym_optional("ipmi_sdr_parse_fru_device_locator_parameters");
+#endif /* HAVE_FREEIPMI_11X_12X */
+
 	if (dl_saved_libname)
 		free(dl_saved_libname);
 	dl_saved_libname = xstrdup(libname_path);
@@ -423,6 +491,113 @@ static int is_ipmi_device_supported(ipmi_ctx_t ipmi_ctx, int ipmi_id)
 	return 0;
 }
 
+#ifdef HAVE_FREEIPMI_11X_12X
+/* List the logical FRU devices of the BMC from the FRU device locators
+ * of its SDR (the driver needs one for a PSU anyway, to find its sensors),
+ * rather than asking the BMC for each of the 256 possible FRU device IDs.
+ * The SDR is cached in the state path like the driver does, and FreeIPMI
+ * only checks with the BMC that it is still current on the next scans.
+ * Returns how many IDs were put in ids, or -1 to try all of them. */
+static int nutscan_ipmi_fru_ids(ipmi_ctx_t ipmi_ctx, const char *IPaddr,
+	uint8_t *ids)
+{
+	char host[SMALLBUF], cache_file[LARGEBUF], *p;
+	uint8_t sdr_record[IPMI_SDR_MAX_RECORD_LENGTH];
+	uint8_t record_type, logical_physical_fru_device, slave_address;
+	uint8_t seen[IPMI_FRU_DEVICE_ID_MAX + 1];
+	uint16_t record_count, i;
+	ipmi_sdr_ctx_t sdr_ctx;
+	int sdr_record_len, errnum, count = 0;
+
+	if (!nut_ipmi_sdr_avail) {
+		return -1;
+	}
+
+	/* no colons of IPv6 addresses in file names */
+	snprintf(host, sizeof(host), "%s", IPaddr ? IPaddr : "localhost");
+	for (p = host; *p; p++) {
+		if (*p == ':' || *p == '/' || *p == '\\') {
+			*p = '_';
+		}
+	}
+	snprintf(cache_file, sizeof(cache_file), "%s/" NUT_IPMI_SDR_CACHE_FMT,
+		dflt_statepath(), host);
+
+	if (!(sdr_ctx = (*nut_ipmi_sdr_ctx_create) ())) {
+		return -1;
+	}
+
+	if ((*nut_ipmi_sdr_cache_open) (sdr_ctx, ipmi_ctx, cache_file) < 0) {
+		errnum = (*nut_ipmi_sdr_ctx_errnum) (sdr_ctx);
+
+		if (errnum == IPMI_SDR_ERR_CACHE_INVALID
+		 || errnum == IPMI_SDR_ERR_CACHE_OUT_OF_DATE
+		) {
+			upsdebugx(2, "%s: %s is out of date", __func__, cache_file);
+			(*nut_ipmi_sdr_cache_delete) (sdr_ctx, cache_file);
+		} else if (errnum != IPMI_SDR_ERR_CACHE_READ_CACHE_DOES_NOT_EXIST) {
+			goto fail;
+		}
+
+		if ((*nut_ipmi_sdr_cache_create) (sdr_ctx, ipmi_ctx, cache_file,
+				IPMI_SDR_CACHE_CREATE_FLAGS_DEFAULT, NULL, NULL) < 0
+		 || (*nut_ipmi_sdr_cache_open) (sdr_ctx, ipmi_ctx, cache_file) < 0
+		) {
+			goto fail;
+		}
+	}
+
+	if ((*nut_ipmi_sdr_cache_record_count) (sdr_ctx, &record_count) < 0) {
+		goto fail;
+	}
+
+	memset(seen, 0, sizeof(seen));
+
+	for (i = 0; i < record_count; i++, (*nut_ipmi_sdr_cache_next) (sdr_ctx)) {
+		if ((sdr_record_len = (*nut_ipmi_sdr_cache_record_read) (sdr_ctx,
+				sdr_record, sizeof(sdr_record))) < 0
+		) {
+			goto fail;
+		}
+
+		if ((*nut_ipmi_sdr_parse_record_id_and_type) (sdr_ctx,
+				sdr_record, (unsigned int)sdr_record_len,
+				NULL, &record_type) < 0
+		 || record_type != IPMI_SDR_FORMAT_FRU_DEVICE_LOCATOR_RECORD
+		) {
+			continue;
+		}
+
+		if ((*nut_ipmi_sdr_parse_fru_device_locator_parameters) (sdr_ctx,
+				sdr_record, (unsigned int)sdr_record_len,
+				NULL, &slave_address, NULL, NULL,
+				&logical_physical_fru_device, NULL) < 0
+		 || !logical_physical_fru_device
+		 || seen[slave_address]
+		) {
+			continue;
+		}
+
+		seen[slave_address] = 1;
+		ids[count++] = slave_address;
+	}
+
+	(*nut_ipmi_sdr_ctx_destroy) (sdr_ctx);
+
+	upsdebugx(2, "%s: %d FRU device(s) in the SDR of %s",
+		__func__, count, host);
+
+	return count;
+
+fail:
+	upsdebugx(2, "%s: can't use the SDR of %s (%s), trying all FRU device IDs",
+		__func__, host, cache_file);
+	(*nut_ipmi_sdr_ctx_destroy) (sdr_ctx);
+
+	return -1;
+}
+#endif /* HAVE_FREEIPMI_11X_12X */
+
 static ipmi_ctx_t wrap_nut_ipmi_ctx_create(void)
 {
 	return (*nut_ipmi_ctx_create) ();
@@ -438,6 +613,8 @@ nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t
 	int ret = -1;
 	int ipmi_id = 0;
 	char port_id[64];
+	uint8_t fru_ids[IPMI_FRU_DEVICE_ID_MAX + 1];
+	int fru_count = -1, f;
 
 	if (!nutscan_avail_ipmi) {
 		return NULL;
@@ -602,8 +779,21 @@ nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t
 		}
 	}
 
-	/* Loop through all possible components */
-	for (ipmi_id = 0 ; ipmi_id <= IPMI_FRU_DEVICE_ID_MAX ; ipmi_id++) {
+#ifdef HAVE_FREEIPMI_11X_12X
+	fru_count = nutscan_ipmi_fru_ids(ipmi_ctx, IPaddr, fru_ids);
+#endif
+
+	if (fru_count <= 0) {
+		/* No SDR (or no FRU device locator in it):
+		 * loop through all possible components */
+		for (f = 0 ; f <= IPMI_FRU_DEVICE_ID_MAX ; f++) {
+			fru_ids[f] = (uint8_t)f;
+		}
+		fru_count = IPMI_FRU_DEVICE_ID_MAX + 1;
+	}
+
+	for (f = 0 ; f < fru_count ; f++) {
+		ipmi_id = fru_ids[f];
 
 		if (is_ipmi_device_supported(ipmi_ctx, ipmi_id)) {
 
@@ -632,6 +822,7 @@ nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t
 			current_nut_dev = nutscan_add_device_to_device(
 							current_nut_dev,
 							nut_dev);
+			nutscan_report_device(nut_dev);
 
 			memset (port_id, 0, sizeof(port_id));
 		}
@@ -713,7 +904,6 @@ nutscan_device_t * nutscan_scan_ipmi(const char * start_ip, const char * stop_ip
  * Return NULL on error, or a valid nutscan_device_t otherwise */
 nutscan_device_t * nutscan_scan_ip_range_ipmi(nutscan_ip_range_list_t * irl, nutscan_ipmi_t * sec)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
 	nutscan_device_t * result = NULL;
 	nutscan_ipmi_t * tmp_sec = NULL;
 
@@ -734,22 +924,12 @@ nutscan_device_t * nutscan_scan_ip_range_ipmi(nutscan_ip_range_list_t * irl, nut
 		/* Iterate the one or a range of IPs to scan */
 		nutscan_ip_range_list_iter_t ip;
 		char * ip_str = NULL;
+		nutscan_pool_batch_t * batch;
+		size_t max_threads_scantype = 0;
 
 #ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		sem_t * semaphore = nutscan_semaphore();
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		sem_t   semaphore_scantype_inst;
-		sem_t * semaphore_scantype = &semaphore_scantype_inst;
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		sem_t * semaphore_scantype = NULL;
-#  endif
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		pthread_t thread;
-		nutscan_thread_t * thread_array = NULL;
-		size_t thread_count = 0, i;
 # if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		size_t  max_threads_scantype = max_threads_ipmi;
+		max_threads_scantype = max_threads_ipmi;
 # endif
 #endif	/* HAVE_PTHREAD */
 
@@ -766,309 +946,40 @@ nutscan_device_t * nutscan_scan_ip_range_ipmi(nutscan_ip_range_list_t * irl, nut
 
 #ifdef HAVE_PTHREAD
 		pthread_mutex_init(&dev_mutex, NULL);
+#endif	/* HAVE_PTHREAD */
 
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		if (max_threads_scantype > 0) {
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* Different platforms, different sizes, none fits all... */
-			if (SIZE_MAX > UINT_MAX && max_threads_scantype > UINT_MAX) {
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic pop
-#endif
-				upsdebugx(1,
-					"WARNING: %s: Limiting max_threads_scantype to range acceptable for " REPORT_SEM_INIT_METHOD "()",
-					__func__);
-				max_threads_scantype = UINT_MAX - 1;
-			}
-
-			upsdebugx(4, "%s: " REPORT_SEM_INIT_METHOD "() for %" PRIuSIZE " threads", __func__, max_threads_scantype);
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-			if (sem_init(semaphore_scantype, 0, (unsigned int)max_threads_scantype)) {
-				upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-				max_threads_scantype = 0;
-			}
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-			if (SEM_FAILED == (semaphore_scantype = sem_open(SEMNAME_IPMI, O_CREAT, 0644, (unsigned int)max_threads_scantype))) {
-				upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-				semaphore_scantype = NULL;
-				max_threads_scantype = 0;
-			}
-#  endif
-		}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-
-#endif /* HAVE_PTHREAD */
+		/* One job per address for the shared worker threads, no more
+		 * than max_threads_ipmi of them at once (if set) */
+		batch = nutscan_pool_batch_new(max_threads_scantype);
 
 		ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 		while (ip_str != NULL) {
-#ifdef HAVE_PTHREAD
-			/* NOTE: With many enough targets to scan, this can crash
-			 * by spawning too many children; add a limit and loop to
-			 * "reap" some already done with their work. And probably
-			 * account them in thread_array[] as something to not wait
-			 * for below in pthread_join()...
-			 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Just wait for someone to free a semaphored slot,
-			 * if none are available, and then/otherwise grab one
-			 */
-			if (thread_array == NULL) {
-				/* Starting point, or after a wait to complete
-				 * all earlier runners */
-				if (max_threads_scantype > 0)
-					sem_wait(semaphore_scantype);
-				sem_wait(semaphore);
-				pass = TRUE;
-			} else {
-				/* If successful (the lock was acquired),
-				 * sem_wait() and sem_trywait() will return 0.
-				 * Otherwise, -1 is returned and errno is set,
-				 * and the state of the semaphore is unchanged.
-				 */
-				int	stwST = sem_trywait(semaphore_scantype);
-				int	stwS  = sem_trywait(semaphore);
-				pass = ((max_threads_scantype == 0 || stwST == 0) && stwS == 0);
-				upsdebugx(4, "%s: max_threads_scantype=%" PRIuSIZE
-					" curr_threads=%" PRIuSIZE
-					" thread_count=%" PRIuSIZE
-					" stwST=%d stwS=%d pass=%d",
-					__func__, max_threads_scantype,
-					curr_threads, thread_count,
-					stwST, stwS, pass
-				);
-			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* A somewhat naive and brute-force solution for
-			 * systems without a semaphore.h. This may suffer
-			 * some off-by-one errors, using a few more threads
-			 * than intended (if we race a bit at the wrong time,
-			 * probably up to one per enabled scanner routine).
-			 */
-
-			/* TOTHINK: Should there be a threadcount_mutex when
-			 * we just read the value in if() and while() below?
-			 * At worst we would overflow the limit a bit due to
-			 * other protocol scanners...
-			 */
-			if (curr_threads >= max_threads
-			|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-			) {
-				upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-					"(launched overall: %" PRIuSIZE "), "
-					"waiting until some would finish",
-					__func__, curr_threads, thread_count);
-
-				while (curr_threads >= max_threads
-				   || (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-				) {
-					for (i = 0; i < thread_count ; i++) {
-						int ret;
-
-						if (!thread_array[i].active) continue;
-
-						pthread_mutex_lock(&threadcount_mutex);
-						upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-						ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-						switch (ret) {
-							case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-								upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-								break;
-							case 0:         /* thread exited */
-								if (curr_threads > 0) {
-									curr_threads --;
-									upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-								} else {
-									/* threadcount_mutex fault? */
-									upsdebugx(0, "WARNING: %s: Accounting of thread count "
-										"says we are already at 0", __func__);
-								}
-								thread_array[i].active = FALSE;
-								break;
-							case EBUSY:     /* actively running */
-								upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-									__func__, i, ret);
-								break;
-							case EDEADLK:   /* Errors with thread interactions... bail out? */
-							case EINVAL:    /* Errors with thread interactions... bail out? */
-							default:        /* new pthreads abilities? */
-								upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-									__func__, i, ret);
-								break;
-						}
-						pthread_mutex_unlock(&threadcount_mutex);
-					}
-
-					if (curr_threads >= max_threads
-					|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-					) {
-							usleep (10000); /* microSec's, so 0.01s here */
-					}
-				}
-				upsdebugx(2, "%s: proceeding with scan", __func__);
+			tmp_sec = malloc(sizeof(nutscan_ipmi_t));
+			if (tmp_sec == NULL) {
+				upsdebugx(0, "%s: Memory allocation error", __func__);
+				break;
 			}
 
-			/* NOTE: No change to default "pass" in this ifdef:
-			 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-
-			if (pass) {
-				tmp_sec = malloc(sizeof(nutscan_ipmi_t));
-				if (tmp_sec == NULL) {
-					upsdebugx(0, "%s: Memory allocation error", __func__);
-					break;
-				}
+			memcpy(tmp_sec, sec, sizeof(nutscan_ipmi_t));
+			tmp_sec->peername = ip_str;
 
-				memcpy(tmp_sec, sec, sizeof(nutscan_ipmi_t));
-				tmp_sec->peername = ip_str;
+			nutscan_pool_submit(batch, nutscan_scan_ipmi_device_thready, (void*)tmp_sec);
 
-#ifdef HAVE_PTHREAD
-				if (pthread_create(&thread, NULL, nutscan_scan_ipmi_device_thready, (void*)tmp_sec) == 0) {
-					nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-					pthread_mutex_lock(&threadcount_mutex);
-					curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-					thread_count++;
-					new_thread_array = realloc(thread_array,
-						thread_count * sizeof(nutscan_thread_t));
-					if (new_thread_array == NULL) {
-						upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-						break;
-					}
-					else {
-						thread_array = new_thread_array;
-					}
-					thread_array[thread_count - 1].thread = thread;
-					thread_array[thread_count - 1].active = TRUE;
-
-# ifdef HAVE_PTHREAD_TRYJOIN
-					pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-				}
-#else	/* if not HAVE_PTHREAD */
-				nutscan_scan_ipmi_device_thready(tmp_sec);
-#endif	/* if HAVE_PTHREAD */
-
-				/* Prepare the next iteration; note that
-				 * nutscan_scan_ipmi_device_thready()
-				 * takes care of freeing "tmp_sec" and its
-				 * reference (NOT strdup!) to "ip_str" as
-				 * peername.
-				 */
-				ip_str = nutscan_ip_ranges_iter_inc(&ip);
-			} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-				/* Wait for all current scans to complete */
-				if (thread_array != NULL) {
-					upsdebugx (2, "%s: Running too many scanning threads (%"
-						PRIuSIZE "), "
-						"waiting until older ones would finish",
-						__func__, thread_count);
-					for (i = 0; i < thread_count ; i++) {
-						int ret;
-						if (!thread_array[i].active) {
-							/* Probably should not get here,
-							 * but handle it just in case */
-							upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-								__func__, i);
-							sem_post(semaphore);
-							if (max_threads_scantype > 0)
-								sem_post(semaphore_scantype);
-							continue;
-						}
-						thread_array[i].active = FALSE;
-						ret = pthread_join(thread_array[i].thread, NULL);
-						if (ret != 0) {
-							upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-								__func__, ret);
-						}
-						sem_post(semaphore);
-						if (max_threads_scantype > 0)
-							sem_post(semaphore_scantype);
-					}
-					thread_count = 0;
-					free(thread_array);
-					thread_array = NULL;
-				}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-				/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-			} /* if: could we "pass" or not? */
+			/* Prepare the next iteration; note that
+			 * nutscan_scan_ipmi_device_thready()
+			 * takes care of freeing "tmp_sec" and its
+			 * reference (NOT strdup!) to "ip_str" as
+			 * peername.
+			 */
+			ip_str = nutscan_ip_ranges_iter_inc(&ip);
 		} /* while */
 
+		upsdebugx(2, "%s: all planned scans queued, waiting for them to complete", __func__);
+		nutscan_pool_batch_wait(batch);
+
 #ifdef HAVE_PTHREAD
-		if (thread_array != NULL) {
-			upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-			for (i = 0; i < thread_count; i++) {
-				int ret;
-
-				if (!thread_array[i].active) continue;
-
-				ret = pthread_join(thread_array[i].thread, NULL);
-				if (ret != 0) {
-					upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-						__func__, ret);
-				}
-				thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-				sem_post(semaphore);
-				if (max_threads_scantype > 0)
-					sem_post(semaphore_scantype);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				if (curr_threads > 0) {
-					curr_threads --;
-					upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-						__func__, i);
-				} else {
-					upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-						"says we are already at 0", __func__);
-				}
-				pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-			}
-			free(thread_array);
-			upsdebugx(2, "%s: all threads freed", __func__);
-		}
 		pthread_mutex_destroy(&dev_mutex);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		if (max_threads_scantype > 0) {
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-			sem_destroy(semaphore_scantype);
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-			if (semaphore_scantype) {
-				sem_unlink(SEMNAME_IPMI);
-				sem_close(semaphore_scantype);
-				semaphore_scantype = NULL;
-			}
-#  endif
-		}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 #endif /* HAVE_PTHREAD */
 	}	/* end of: scan range of 1+ IP address(es), maybe in parallel */
 
@@ -80,6 +80,7 @@ nutscan_device_t * nutscan_scan_nut_simulation(void)
 #ifdef HAVE_PTHREAD
 			pthread_mutex_unlock(&dev_mutex);
 #endif
+			nutscan_report_device(dev);
 		}
 	}
 	closedir(dp);
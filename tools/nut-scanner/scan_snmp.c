@@ -143,6 +143,10 @@ static int (*nut_snmp_sess_synch_response) (void *sessp, netsnmp_pdu *pdu,
 static int (*nut_snmp_oid_compare) (const oid *in_name1, size_t len1,
 			const oid *in_name2, size_t len2);
 static void (*nut_snmp_free_pdu) (netsnmp_pdu *pdu);
+static int (*nut_snmp_sess_async_send) (void *sessp, netsnmp_pdu *pdu,
+			netsnmp_callback callback, void *cb_data);
+static int (*nut_snmp_sess_read) (void *sessp, fd_set *fdset);
+static netsnmp_transport * (*nut_snmp_sess_transport) (void *sessp);
 
 /* NOTE: Net-SNMP headers just are weird like that, in the same release:
 net-snmp/types.h:              size_t securityAuthProtoLen;
@@ -187,6 +191,8 @@ static oid *nut_usmHMAC256SHA384AuthProtocol;
 static oid *nut_usmHMAC384SHA512AuthProtocol;
 #endif
 
+static void scan_sysoid_index_free(void);
+
 /* Return 0 on success, -1 on error e.g. "was not loaded";
  * other values may be possible if lt_dlclose() errors set them;
  * visible externally */
@@ -195,6 +201,8 @@ int nutscan_unload_library(int *avail, lt_dlhandle *pdl_handle, char **libpath);
 #endif
 int nutscan_unload_snmp_library(void)
 {
+	scan_sysoid_index_free();
+
 #ifdef WITH_SNMP_STATIC
 	return 0;
 #else
@@ -239,6 +247,11 @@ int nutscan_load_snmp_library(const char *libname_path)
 	*(void **) (&nut_snmp_oid_compare) =
 				snmp_oid_compare;
 	*(void **) (&nut_snmp_free_pdu) = snmp_free_pdu;
+	*(void **) (&nut_snmp_sess_async_send) =
+				snmp_sess_async_send;
+	*(void **) (&nut_snmp_sess_read) = snmp_sess_read;
+	*(void **) (&nut_snmp_sess_transport) =
+				snmp_sess_transport;
 	*(void **) (&nut_generate_Ku) = generate_Ku;
 	*(void **) (&nut_snmp_out_toggle_options) =
 				snmp_out_toggle_options;
@@ -384,6 +397,23 @@ int nutscan_load_snmp_library(const char *libname_path)
 		goto err;
 	}
 
+	*(void **) (&nut_snmp_sess_async_send) = lt_dlsym(dl_handle,
+							"snmp_sess_async_send");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_sess_read) = lt_dlsym(dl_handle, "snmp_sess_read");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_sess_transport) = lt_dlsym(dl_handle,
+							"snmp_sess_transport");
+	if ((dl_error = lt_dlerror()) != NULL) {
+		goto err;
+	}
+
 	*(void **) (&nut_generate_Ku) = lt_dlsym(dl_handle, "generate_Ku");
 	if ((dl_error = lt_dlerror()) != NULL) {
 		goto err;
@@ -580,6 +610,7 @@ static void scan_snmp_add_device(nutscan_snmp_t * sec, struct snmp_pdu *response
 	pthread_mutex_unlock(&dev_mutex);
 #endif
 
+	nutscan_report_device(dev);
 }
 
 static struct snmp_pdu * scan_snmp_get_oid(char* oid_str, void* handle)
@@ -670,6 +701,91 @@ static void try_all_oid(void * arg, const char * mib_found)
 	}
 }
 
+/* Making a key (Ku) from a pass phrase hashes a megabyte of it, and
+ * every address of a SNMPv3 scan needs the same one or two keys: these
+ * are made once per scan (and forgotten by scan_snmp_ku_free()) */
+typedef struct scan_snmp_ku_s {
+	const oid	*proto;
+	char	*pass;
+	u_char	key[USM_AUTH_KU_LEN];
+	size_t	keylen;
+	struct scan_snmp_ku_s	*next;
+} scan_snmp_ku_t;
+
+static scan_snmp_ku_t *scan_snmp_kus = NULL;
+
+static int scan_snmp_generate_Ku(const oid *proto, u_int protolen,
+	const char *pass, u_char *key, size_t *keylen)
+{
+	scan_snmp_ku_t	*ku;
+	int	ret;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&dev_mutex);
+#endif
+	for (ku = scan_snmp_kus; ku; ku = ku->next) {
+		if (ku->proto == proto && !strcmp(ku->pass, pass)
+		 && ku->keylen <= *keylen
+		) {
+			memcpy(key, ku->key, ku->keylen);
+			*keylen = ku->keylen;
+			break;
+		}
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&dev_mutex);
+#endif
+
+	if (ku) {
+		return SNMPERR_SUCCESS;
+	}
+
+	/* not under the lock: the other threads need not wait for it,
+	 * at worst a few of them make the same key at first */
+	ret = (*nut_generate_Ku)(proto, protolen,
+		(unsigned char *) pass, strlen(pass), key, keylen);
+
+	if (ret != SNMPERR_SUCCESS || *keylen > sizeof(ku->key)) {
+		return ret;
+	}
+
+	ku = calloc(1, sizeof(*ku));
+	if (ku == NULL || (ku->pass = strdup(pass)) == NULL) {
+		free(ku);
+		return ret;
+	}
+	ku->proto = proto;
+	memcpy(ku->key, key, *keylen);
+	ku->keylen = *keylen;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&dev_mutex);
+#endif
+	ku->next = scan_snmp_kus;
+	scan_snmp_kus = ku;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&dev_mutex);
+#endif
+
+	return ret;
+}
+
+static void scan_snmp_ku_free(void)
+{
+	scan_snmp_ku_t	*ku, *next;
+
+	for (ku = scan_snmp_kus; ku; ku = next) {
+		next = ku->next;
+		/* no copies of pass phrases left lying around */
+		memset(ku->key, 0, sizeof(ku->key));
+		memset(ku->pass, 0, strlen(ku->pass));
+		free(ku->pass);
+		free(ku);
+	}
+
+	scan_snmp_kus = NULL;
+}
+
 static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 {
 	(*nut_snmp_sess_init)(snmp_sess);
@@ -823,10 +939,9 @@ static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 				__func__, snmp_sess->securityAuthProtoLen);
 			return 0;
 		}
-		if ((*nut_generate_Ku)(snmp_sess->securityAuthProto,
+		if (scan_snmp_generate_Ku(snmp_sess->securityAuthProto,
 					(u_int)snmp_sess->securityAuthProtoLen,
-					(unsigned char *) sec->authPassword,
-					strlen(sec->authPassword),
+					sec->authPassword,
 					snmp_sess->securityAuthKey,
 					&snmp_sess->securityAuthKeyLen)
 					!= SNMPERR_SUCCESS
@@ -912,10 +1027,9 @@ static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 				__func__, snmp_sess->securityAuthProtoLen);
 			return 0;
 		}
-		if ((*nut_generate_Ku)(snmp_sess->securityAuthProto,
+		if (scan_snmp_generate_Ku(snmp_sess->securityAuthProto,
 					(u_int)snmp_sess->securityAuthProtoLen,
-					(unsigned char *) sec->privPassword,
-					strlen(sec->privPassword),
+					sec->privPassword,
 					snmp_sess->securityPrivKey,
 					&snmp_sess->securityPrivKeyLen)
 					!= SNMPERR_SUCCESS
@@ -938,26 +1052,145 @@ static void * wrap_nut_snmp_sess_open(struct snmp_session *session)
 	return (*nut_snmp_sess_open)(session); /* establish the session */
 }
 
-/* Performs a (parallel-able) SNMP protocol scan of one remote host.
- * Returns NULL, updates global dev_ret when a scan is successful.
- * FREES the caller's copy of "sec" and "peername" in it, if applicable.
- */
-static void * try_SysOID_thready(void * arg)
+/* The sysOIDs of snmp_device_table[] (the same mib2nut[] data as
+ * snmp-ups has), parsed and sorted (entries with the same sysOID in
+ * table order), to classify the devices which answered by */
+typedef struct {
+	oid	*name;
+	size_t	name_len;
+	int	index;	/* in snmp_device_table[] */
+} scan_sysoid_t;
+
+static scan_sysoid_t *sysoid_index = NULL;
+static size_t sysoid_index_count = 0;
+
+static int scan_sysoid_cmp(const void *a, const void *b)
 {
-	struct snmp_session snmp_sess;
-	void * handle;
-	struct snmp_pdu *pdu, *response = NULL, *resp = NULL;
-	oid name[MAX_OID_LEN];
-	size_t name_len = MAX_OID_LEN;
-	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
-	int index = 0;
+	const scan_sysoid_t	*sa = a, *sb = b;
+	int	ret = (*nut_snmp_oid_compare)(sa->name, sa->name_len, sb->name, sb->name_len);
+
+	return ret ? ret : sa->index - sb->index;
+}
+
+/* Called before any scanning job is started, once per library load */
+static void scan_sysoid_index_build(void)
+{
+	oid	name[MAX_OID_LEN];
+	size_t	name_len;
+	int	i;
+
+	if (sysoid_index != NULL)
+		return;
+
+	for (i = 0; snmp_device_table[i].mib != NULL; i++)
+		;
+	sysoid_index = xcalloc((size_t)i + 1, sizeof(*sysoid_index));
+
+	for (i = 0; snmp_device_table[i].mib != NULL; i++) {
+		if (snmp_device_table[i].sysoid == NULL)
+			continue;
+
+		name_len = MAX_OID_LEN;
+		if (!(*nut_snmp_parse_oid)(snmp_device_table[i].sysoid, name, &name_len))
+			continue;
+
+		sysoid_index[sysoid_index_count].name = xcalloc(name_len, sizeof(oid));
+		memcpy(sysoid_index[sysoid_index_count].name, name, name_len * sizeof(oid));
+		sysoid_index[sysoid_index_count].name_len = name_len;
+		sysoid_index[sysoid_index_count].index = i;
+		sysoid_index_count++;
+	}
+
+	qsort(sysoid_index, sysoid_index_count, sizeof(*sysoid_index), scan_sysoid_cmp);
+	upsdebugx(2, "%s: %" PRIuSIZE " sysOIDs indexed", __func__, sysoid_index_count);
+}
+
+static void scan_sysoid_index_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < sysoid_index_count; i++)
+		free(sysoid_index[i].name);
+
+	free(sysoid_index);
+	sysoid_index = NULL;
+	sysoid_index_count = 0;
+}
+
+/* Add the device which answered with this sysOID (none if objid is NULL)
+ * on the "handle" session, as each of the MIBs this sysOID is known for
+ * (after checking their complementary OID, if any), or else as any of
+ * the MIBs whose OID it has */
+static void try_SysOID_match(nutscan_snmp_t * sec, void * handle,
+	const oid * objid, size_t objid_len)
+{
+	struct snmp_pdu *resp = NULL;
 	char *mib_found = NULL;
+	size_t lo, hi, mid, j;
+	int index;
+
+	sec->handle = handle;
+
+	if (objid != NULL) {
+		lo = 0;
+		hi = sysoid_index_count;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if ((*nut_snmp_oid_compare)(
+				sysoid_index[mid].name, sysoid_index[mid].name_len,
+				objid, objid_len) < 0
+			)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
 
-	upsdebugx(2, "Entering %s for %s", __func__, sec->peername);
+		for (j = lo; j < sysoid_index_count; j++) {
+			if ((*nut_snmp_oid_compare)(
+				sysoid_index[j].name, sysoid_index[j].name_len,
+				objid, objid_len) != 0
+			)
+				break;
+
+			/* we have found a relevant sysoid */
+			index = sysoid_index[j].index;
+
+			/* add mib if no complementary oid is present */
+			/* FIXME: No desc defined when add device */
+			if (snmp_device_table[index].oid == NULL
+			||  snmp_device_table[index].oid[0] == '\0'
+			) {
+				scan_snmp_add_device(sec, NULL, snmp_device_table[index].mib);
+				mib_found = snmp_device_table[index].sysoid;
+			}
+			/* else test complementary oid before adding mib */
+			else {
+				resp = scan_snmp_get_oid(
+					snmp_device_table[index].oid,
+					handle);
+				if (resp != NULL) {
+					scan_snmp_add_device(sec, resp, snmp_device_table[index].mib);
+					mib_found = snmp_device_table[index].mib;
+					(*nut_snmp_free_pdu)(resp);
+				}
+			}
+		}
+	}
+
+	/* try a list of known OID, if no device was found otherwise */
+	if (mib_found == NULL)
+		try_all_oid(sec, mib_found);
+}
+
+/* Open a synchronous session to sec->peername; NULL on failure */
+static void * try_SysOID_open(nutscan_snmp_t * sec)
+{
+	struct snmp_session snmp_sess;
+	void * handle;
 
 	/* Initialize session */
 	if (!init_session(&snmp_sess, sec)) {
-		goto try_SysOID_free;
+		return NULL;
 	}
 
 	snmp_sess.retries = 0;
@@ -972,6 +1205,27 @@ static void * try_SysOID_thready(void * arg)
 		upsdebugx(2,
 			"Failed to open SNMP session for %s",
 			sec->peername);
+	}
+
+	return handle;
+}
+
+/* Performs a (parallel-able) SNMP protocol scan of one remote host.
+ * Returns NULL, updates global dev_ret when a scan is successful.
+ * FREES the caller's copy of "sec" and "peername" in it, if applicable.
+ */
+static void * try_SysOID_thready(void * arg)
+{
+	void * handle;
+	struct snmp_pdu *pdu, *response = NULL;
+	oid name[MAX_OID_LEN];
+	size_t name_len = MAX_OID_LEN;
+	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
+
+	upsdebugx(2, "Entering %s for %s", __func__, sec->peername);
+
+	handle = try_SysOID_open(sec);
+	if (handle == NULL) {
 		goto try_SysOID_free;
 	}
 
@@ -999,65 +1253,18 @@ static void * try_SysOID_thready(void * arg)
 			pdu, &response);
 
 	if (response) {
-		sec->handle = handle;
-
 		/* SNMP device found */
 		/* SysOID is supposed to give the required MIB. */
-
-		/* Check if the received OID match with a known sysOID */
 		if (response->variables != NULL &&
 				response->variables->val.objid != NULL
 		) {
-			while (snmp_device_table[index].mib != NULL) {
-				if (snmp_device_table[index].sysoid == NULL) {
-					index++;
-					continue;
-				}
-				name_len = MAX_OID_LEN;
-
-				if (!(*nut_snmp_parse_oid)(
-					snmp_device_table[index].sysoid,
-					name, &name_len)
-				) {
-					index++;
-					continue;
-				}
-
-				if ((*nut_snmp_oid_compare)(
-					response->variables->val.objid,
-					response->variables->val_len/sizeof(oid),
-					name, name_len) == 0
-				) {
-					/* we have found a relevant sysoid */
-
-					/* add mib if no complementary oid is present */
-					/* FIXME: No desc defined when add device */
-					if (snmp_device_table[index].oid == NULL
-					||  snmp_device_table[index].oid[0] == '\0'
-					) {
-						scan_snmp_add_device(sec, NULL, snmp_device_table[index].mib);
-						mib_found = snmp_device_table[index].sysoid;
-					}
-					/* else test complementary oid before adding mib */
-					else {
-						resp = scan_snmp_get_oid(
-							snmp_device_table[index].oid,
-							handle);
-						if (resp != NULL) {
-							scan_snmp_add_device(sec, resp, snmp_device_table[index].mib);
-							mib_found = snmp_device_table[index].mib;
-							(*nut_snmp_free_pdu)(resp);
-						}
-					}
-				}
-				index++;
-			}
+			try_SysOID_match(sec, handle,
+				response->variables->val.objid,
+				response->variables->val_len/sizeof(oid));
+		} else {
+			try_SysOID_match(sec, handle, NULL, 0);
 		}
 
-		/* try a list of known OID, if no device was found otherwise */
-		if (mib_found == NULL)
-			try_all_oid(sec, mib_found);
-
 		(*nut_snmp_free_pdu)(response);
 		response = NULL;
 	}
@@ -1073,6 +1280,239 @@ try_SysOID_free:
 	return NULL;
 }
 
+/* sysOID GETs in flight at once at most, in nutscan_scan_ip_range_snmp() */
+#define SNMP_PROBE_INFLIGHT	512
+
+/* One sysOID GET sent with its own asynchronous session */
+typedef struct {
+	nutscan_snmp_t	*sec;	/* with the peername */
+	void	*handle;
+	int	sock;
+	struct timeval	start;
+	int	state;	/* 0 while waiting, 1 replied, -1 no reply */
+	oid	sysoid[MAX_OID_LEN];
+	size_t	sysoid_len;	/* 0 if the reply had no sysOID */
+} snmp_probe_t;
+
+static int snmp_probe_cb(int op, netsnmp_session *session, int reqid,
+	netsnmp_pdu *pdu, void *magic)
+{
+	snmp_probe_t	*probe = (snmp_probe_t *)magic;
+	NUT_UNUSED_VARIABLE(session);
+	NUT_UNUSED_VARIABLE(reqid);
+
+	if (probe->state != 0)
+		return 1;
+
+	if (op != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE || pdu == NULL) {
+		probe->state = -1;
+		return 1;
+	}
+
+	probe->state = 1;
+	if (pdu->variables != NULL && pdu->variables->val.objid != NULL) {
+		probe->sysoid_len = pdu->variables->val_len / sizeof(oid);
+		if (probe->sysoid_len > MAX_OID_LEN)
+			probe->sysoid_len = MAX_OID_LEN;
+		memcpy(probe->sysoid, pdu->variables->val.objid,
+			probe->sysoid_len * sizeof(oid));
+	}
+
+	return 1;
+}
+
+/* Send the sysOID GET of this probe. Return 0 if it is sent, -2 if there
+ * is no socket left for it for now, -1 if it can't be done this way */
+static int snmp_probe_start(snmp_probe_t *probe)
+{
+	struct snmp_session	snmp_sess;
+	netsnmp_transport	*transport;
+	struct snmp_pdu	*pdu;
+	oid	name[MAX_OID_LEN];
+	size_t	name_len = MAX_OID_LEN;
+
+	if (!init_session(&snmp_sess, probe->sec))
+		return -1;
+
+	snmp_sess.retries = 0;
+	snmp_sess.timeout = (long)g_usec_timeout;
+
+	errno = 0;
+	probe->handle = wrap_nut_snmp_sess_open(&snmp_sess);
+	if (probe->handle == NULL) {
+		if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+			return -2;
+		return -1;
+	}
+
+	/* select() can only watch so many descriptors */
+	transport = (*nut_snmp_sess_transport)(probe->handle);
+	if (transport == NULL || transport->sock < 0 || transport->sock >= FD_SETSIZE) {
+		(*nut_snmp_sess_close)(probe->handle);
+		probe->handle = NULL;
+		return -1;
+	}
+	probe->sock = transport->sock;
+
+	if (!(*nut_snmp_parse_oid)(SysOID, name, &name_len)
+	 || (pdu = (*nut_snmp_pdu_create)(SNMP_MSG_GET)) == NULL
+	) {
+		(*nut_snmp_sess_close)(probe->handle);
+		probe->handle = NULL;
+		return -1;
+	}
+
+	(*nut_snmp_add_null_var)(pdu, name, name_len);
+
+	if (!(*nut_snmp_sess_async_send)(probe->handle, pdu, snmp_probe_cb, probe)) {
+		(*nut_snmp_free_pdu)(pdu);
+		(*nut_snmp_sess_close)(probe->handle);
+		probe->handle = NULL;
+		return -1;
+	}
+
+	gettimeofday(&probe->start, NULL);
+	return 0;
+}
+
+/* Classify a host which answered the sysOID GET of its probe, on a
+ * synchronous session of its own. FREES the probe with its "sec". */
+static void * try_SysOID_match_thready(void * arg)
+{
+	snmp_probe_t	*probe = (snmp_probe_t *)arg;
+	nutscan_snmp_t	*sec = probe->sec;
+	void	*handle;
+
+	upsdebugx(2, "Entering %s for %s", __func__, sec->peername);
+
+	handle = try_SysOID_open(sec);
+	if (handle != NULL) {
+		try_SysOID_match(sec, handle,
+			probe->sysoid_len ? probe->sysoid : NULL,
+			probe->sysoid_len);
+		(*nut_snmp_sess_close)(handle);
+	}
+
+	free(sec->peername);
+	free(sec);
+	free(probe);
+
+	return NULL;
+}
+
+/* Send the sysOID GETs to the addresses of "irl" (up to
+ * SNMP_PROBE_INFLIGHT at once, from this one thread), and hand the
+ * hosts which answered (and the addresses which can't be probed this
+ * way) to the worker threads of "batch". */
+static void scan_snmp_probe_range(nutscan_ip_range_list_t * irl,
+	nutscan_snmp_t * sec, nutscan_pool_batch_t * batch)
+{
+	snmp_probe_t	**probes, *probe = NULL;
+	size_t	nprobes = 0, window = SNMP_PROBE_INFLIGHT, i;
+	nutscan_ip_range_list_iter_t	ip;
+	char	*ip_str;
+	double	timeout = (double)g_usec_timeout / 1000000.0, left, wait;
+	struct timeval	now, tv;
+	useconds_t	usec;
+	fd_set	fdset;
+	int	maxfd, ret;
+
+	if (window > FD_SETSIZE / 2)
+		window = FD_SETSIZE / 2;
+	probes = xcalloc(window, sizeof(*probes));
+
+	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
+
+	while (ip_str != NULL || nprobes > 0) {
+		/* more requests out, while there is room for them */
+		while (ip_str != NULL && nprobes < window) {
+			if (probe == NULL) {
+				probe = xcalloc(1, sizeof(*probe));
+				probe->sec = xcalloc(1, sizeof(nutscan_snmp_t));
+				memcpy(probe->sec, sec, sizeof(nutscan_snmp_t));
+				probe->sec->peername = ip_str;
+			}
+
+			ret = snmp_probe_start(probe);
+			if (ret == -2 && nprobes > 0) {
+				/* retry this one when others are done */
+				upsdebugx(2, "%s: out of sockets, %" PRIuSIZE
+					" requests in flight at most now",
+					__func__, nprobes);
+				window = nprobes;
+				break;
+			}
+
+			if (ret == 0) {
+				probes[nprobes++] = probe;
+			} else {
+				/* the usual synchronous scan, by a worker */
+				nutscan_pool_submit(batch, try_SysOID_thready, (void*)probe->sec);
+				free(probe);
+			}
+
+			probe = NULL;
+			ip_str = nutscan_ip_ranges_iter_inc(&ip);
+		}
+
+		if (nprobes == 0)
+			continue;
+
+		/* wait for answers, until the oldest request times out */
+		FD_ZERO(&fdset);
+		maxfd = -1;
+		for (i = 0; i < nprobes; i++) {
+			FD_SET(probes[i]->sock, &fdset);
+			if (probes[i]->sock > maxfd)
+				maxfd = probes[i]->sock;
+		}
+
+		gettimeofday(&now, NULL);
+		wait = timeout;
+		for (i = 0; i < nprobes; i++) {
+			left = timeout - difftimeval(now, probes[i]->start);
+			if (left < wait)
+				wait = left;
+		}
+		if (wait < 0)
+			wait = 0;
+		usec = (useconds_t)(wait * 1000000.0);
+		tv.tv_sec = usec / 1000000;
+		tv.tv_usec = usec % 1000000;
+
+		ret = select(maxfd + 1, &fdset, NULL, NULL, &tv);
+		if (ret > 0) {
+			for (i = 0; i < nprobes; i++) {
+				if (FD_ISSET(probes[i]->sock, &fdset))
+					(*nut_snmp_sess_read)(probes[i]->handle, &fdset);
+			}
+		}
+
+		/* hand over those which are done */
+		gettimeofday(&now, NULL);
+		for (i = 0; i < nprobes; ) {
+			if (probes[i]->state == 0
+			 && difftimeval(now, probes[i]->start) < timeout
+			) {
+				i++;
+				continue;
+			}
+
+			(*nut_snmp_sess_close)(probes[i]->handle);
+			if (probes[i]->state > 0) {
+				nutscan_pool_submit(batch, try_SysOID_match_thready, (void*)probes[i]);
+			} else {
+				free(probes[i]->sec->peername);
+				free(probes[i]->sec);
+				free(probes[i]);
+			}
+			probes[i] = probes[--nprobes];
+		}
+	}
+
+	free(probes);
+}
+
 static void init_snmp_once(void)
 {
 	/* Initialize the SNMP library */
@@ -1104,73 +1544,19 @@ nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip
 nutscan_device_t * nutscan_scan_ip_range_snmp(nutscan_ip_range_list_t * irl,
                                      useconds_t usec_timeout, nutscan_snmp_t * sec)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
 	nutscan_device_t * result;
 	nutscan_snmp_t * tmp_sec;
 	nutscan_ip_range_list_iter_t ip;
 	char * ip_str = NULL;
+	nutscan_pool_batch_t * batch;
+	size_t max_threads_scantype = 0;
 
 #ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore = nutscan_semaphore();
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-	sem_t   semaphore_scantype_inst;
-	sem_t * semaphore_scantype = &semaphore_scantype_inst;
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-	sem_t * semaphore_scantype = NULL;
-#  endif
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-	pthread_t thread;
-	nutscan_thread_t * thread_array = NULL;
-	size_t thread_count = 0, i;
 # if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	size_t  max_threads_scantype = max_threads_netsnmp;
+	max_threads_scantype = max_threads_netsnmp;
 # endif
 
 	pthread_mutex_init(&dev_mutex, NULL);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	if (max_threads_scantype > 0) {
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-		/* Different platforms, different sizes, none fits all... */
-		if (SIZE_MAX > UINT_MAX && max_threads_scantype > UINT_MAX) {
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic pop
-#endif
-			upsdebugx(1,
-				"WARNING: %s: Limiting max_threads_scantype to range acceptable for " REPORT_SEM_INIT_METHOD "()",
-				__func__);
-			max_threads_scantype = UINT_MAX - 1;
-		}
-
-		upsdebugx(4, "%s: " REPORT_SEM_INIT_METHOD "() for %" PRIuSIZE " threads", __func__, max_threads_scantype);
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		if (sem_init(semaphore_scantype, 0, (unsigned int)max_threads_scantype)) {
-			upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-			max_threads_scantype = 0;
-		}
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		if (SEM_FAILED == (semaphore_scantype = sem_open(SEMNAME_SNMP, O_CREAT, 0644, (unsigned int)max_threads_scantype))) {
-			upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-			semaphore_scantype = NULL;
-			max_threads_scantype = 0;
-		}
-#  endif
-	}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-
 #endif /* HAVE_PTHREAD */
 
 	if (!nutscan_avail_snmp) {
@@ -1204,265 +1590,53 @@ nutscan_device_t * nutscan_scan_ip_range_snmp(nutscan_ip_range_list_t * irl,
 
 	/* Initialize the SNMP library */
 	init_snmp_once();
+	scan_sysoid_index_build();
+
+	/* Jobs for the shared worker threads, no more than
+	 * max_threads_netsnmp of them at once (if set) */
+	batch = nutscan_pool_batch_new(max_threads_scantype);
+
+	/* SNMPv1 GETs can all be sent from here at once, only the
+	 * devices which answer need a thread for the rest; SNMPv3
+	 * sessions discover their engine ID when they are opened
+	 * (synchronously), so these keep one job per address */
+	if ((sec->community != NULL || sec->secLevel == NULL)
+	 && irl->ip_ranges->start_ip != NULL
+	) {
+		scan_snmp_probe_range(irl, sec, batch);
+		goto wait;
+	}
 
 	ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 	while (ip_str != NULL) {
-#ifdef HAVE_PTHREAD
-		/* NOTE: With many enough targets to scan, this can crash
-		 * by spawning too many children; add a limit and loop to
-		 * "reap" some already done with their work. And probably
-		 * account them in thread_array[] as something to not wait
-		 * for below in pthread_join()...
-		 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		/* Just wait for someone to free a semaphored slot,
-		 * if none are available, and then/otherwise grab one
-		 */
-		if (thread_array == NULL) {
-			/* Starting point, or after a wait to complete
-			 * all earlier runners */
-			if (max_threads_scantype > 0)
-				sem_wait(semaphore_scantype);
-			sem_wait(semaphore);
-			pass = TRUE;
-		} else {
-			/* If successful (the lock was acquired),
-			 * sem_wait() and sem_trywait() will return 0.
-			 * Otherwise, -1 is returned and errno is set,
-			 * and the state of the semaphore is unchanged.
-			 */
-			int	stwST = sem_trywait(semaphore_scantype);
-			int	stwS  = sem_trywait(semaphore);
-			pass = ((max_threads_scantype == 0 || stwST == 0) && stwS == 0);
-			upsdebugx(4, "%s: max_threads_scantype=%" PRIuSIZE
-				" curr_threads=%" PRIuSIZE
-				" thread_count=%" PRIuSIZE
-				" stwST=%d stwS=%d pass=%d",
-				__func__, max_threads_scantype,
-				curr_threads, thread_count,
-				stwST, stwS, pass
-			);
-		}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-		/* A somewhat naive and brute-force solution for
-		 * systems without a semaphore.h. This may suffer
-		 * some off-by-one errors, using a few more threads
-		 * than intended (if we race a bit at the wrong time,
-		 * probably up to one per enabled scanner routine).
-		 */
-
-		/* TOTHINK: Should there be a threadcount_mutex when
-		 * we just read the value in if() and while() below?
-		 * At worst we would overflow the limit a bit due to
-		 * other protocol scanners...
-		 */
-		if (curr_threads >= max_threads
-		|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-		) {
-			upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-				"(launched overall: %" PRIuSIZE "), "
-				"waiting until some would finish",
-				__func__, curr_threads, thread_count);
-
-			while (curr_threads >= max_threads
-			   || (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-			) {
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-
-					if (!thread_array[i].active) continue;
-
-					pthread_mutex_lock(&threadcount_mutex);
-					upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-					ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-					switch (ret) {
-						case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-							upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-							break;
-						case 0:         /* thread exited */
-							if (curr_threads > 0) {
-								curr_threads --;
-								upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-							} else {
-								/* threadcount_mutex fault? */
-								upsdebugx(0, "WARNING: %s: Accounting of thread count "
-									"says we are already at 0", __func__);
-							}
-							thread_array[i].active = FALSE;
-							break;
-						case EBUSY:     /* actively running */
-							upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-								__func__, i, ret);
-							break;
-						case EDEADLK:   /* Errors with thread interactions... bail out? */
-						case EINVAL:    /* Errors with thread interactions... bail out? */
-						default:        /* new pthreads abilities? */
-							upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-								__func__, i, ret);
-							break;
-					}
-					pthread_mutex_unlock(&threadcount_mutex);
-				}
-
-				if (curr_threads >= max_threads
-				|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-				) {
-					usleep (10000); /* microSec's, so 0.01s here */
-				}
-			}
-			upsdebugx(2, "%s: proceeding with scan", __func__);
+		tmp_sec = malloc(sizeof(nutscan_snmp_t));
+		if (tmp_sec == NULL) {
+			upsdebugx(0, "%s: Memory allocation error", __func__);
+			break;
 		}
 
-		/* NOTE: No change to default "pass" in this ifdef:
-		 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
+		memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
+		tmp_sec->peername = ip_str;
 
-		if (pass) {
-			tmp_sec = malloc(sizeof(nutscan_snmp_t));
-			if (tmp_sec == NULL) {
-				upsdebugx(0, "%s: Memory allocation error", __func__);
-				break;
-			}
-
-			memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
-			tmp_sec->peername = ip_str;
-
-#ifdef HAVE_PTHREAD
-			if (pthread_create(&thread, NULL, try_SysOID_thready, (void*)tmp_sec) == 0) {
-				nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-				thread_count++;
-				new_thread_array = realloc(thread_array,
-					thread_count * sizeof(nutscan_thread_t));
-				if (new_thread_array == NULL) {
-					upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-					break;
-				}
-				else {
-					thread_array = new_thread_array;
-				}
-				thread_array[thread_count - 1].thread = thread;
-				thread_array[thread_count - 1].active = TRUE;
+		nutscan_pool_submit(batch, try_SysOID_thready, (void*)tmp_sec);
 
-# ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-			}
-#else   /* if not HAVE_PTHREAD */
-			try_SysOID_thready(tmp_sec);
-#endif  /* if HAVE_PTHREAD */
-
-			/* Prepare the next iteration; note that
-			 * try_SysOID_thready()
-			 * takes care of freeing "tmp_sec" and its
-			 * reference (NOT strdup!) to "ip_str" as
-			 * peername.
-			 */
-			ip_str = nutscan_ip_ranges_iter_inc(&ip);
-		} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Wait for all current scans to complete */
-			if (thread_array != NULL) {
-				upsdebugx (2, "%s: Running too many scanning threads (%"
-					PRIuSIZE "), "
-					"waiting until older ones would finish",
-					__func__, thread_count);
-				for (i = 0; i < thread_count ; i++) {
-					int ret;
-					if (!thread_array[i].active) {
-						/* Probably should not get here,
-						 * but handle it just in case */
-						upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-							__func__, i);
-						sem_post(semaphore);
-						if (max_threads_scantype > 0)
-							sem_post(semaphore_scantype);
-						continue;
-					}
-					thread_array[i].active = FALSE;
-					ret = pthread_join(thread_array[i].thread, NULL);
-					if (ret != 0) {
-						upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-							__func__, ret);
-					}
-					sem_post(semaphore);
-					if (max_threads_scantype > 0)
-						sem_post(semaphore_scantype);
-				}
-				thread_count = 0;
-				free(thread_array);
-				thread_array = NULL;
-			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-		} /* if: could we "pass" or not? */
+		/* Prepare the next iteration; note that
+		 * try_SysOID_thready()
+		 * takes care of freeing "tmp_sec" and its
+		 * reference (NOT strdup!) to "ip_str" as
+		 * peername.
+		 */
+		ip_str = nutscan_ip_ranges_iter_inc(&ip);
 	} /* while */
 
-#ifdef HAVE_PTHREAD
-	if (thread_array != NULL) {
-		upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-		for (i = 0; i < thread_count; i++) {
-			int ret;
-
-			if (!thread_array[i].active) continue;
+wait:
+	upsdebugx(2, "%s: all planned scans queued, waiting for them to complete", __func__);
+	nutscan_pool_batch_wait(batch);
+	scan_snmp_ku_free();
 
-			ret = pthread_join(thread_array[i].thread, NULL);
-			if (ret != 0) {
-				upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-					__func__, ret);
-			}
-			thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			sem_post(semaphore);
-			if (max_threads_scantype > 0)
-				sem_post(semaphore_scantype);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			pthread_mutex_lock(&threadcount_mutex);
-			if (curr_threads > 0) {
-				curr_threads --;
-				upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-					__func__, i);
-			} else {
-				upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-					"says we are already at 0", __func__);
-			}
-			pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		}
-		free(thread_array);
-		upsdebugx(2, "%s: all threads freed", __func__);
-	}
+#ifdef HAVE_PTHREAD
 	pthread_mutex_destroy(&dev_mutex);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-	if (max_threads_scantype > 0) {
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		sem_destroy(semaphore_scantype);
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		if (semaphore_scantype) {
-			sem_unlink(SEMNAME_SNMP);
-			sem_close(semaphore_scantype);
-			semaphore_scantype = NULL;
-		}
-#  endif
-	}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 #endif /* HAVE_PTHREAD */
 
 	result = nutscan_rewind_device(dev_ret);
@@ -36,6 +36,9 @@ int nutscan_unload_usb_library(void);
 #include <stdio.h>
 #include <string.h>
 #include <ltdl.h>
+#ifdef __linux__
+# include <dirent.h>
+#endif
 
 /* dynamic link library stuff */
 static lt_dlhandle dl_handle = NULL;
@@ -403,6 +406,111 @@ static int nut_usb_get_string(
 	return len;
 }
 
+#if WITH_LIBUSB_1_0 && (defined __linux__)
+/* The kernel keeps the strings of the device descriptors in sysfs, so
+ * most of the time there is no need to open (and bother) each device */
+#define SYSFS_USB_DEVICES	"/sys/bus/usb/devices"
+
+/* First line of a sysfs attribute file, NULL if there is none */
+static char * sysfs_usb_read(const char *dir, const char *name, char *buf, size_t buflen)
+{
+	char	path[SMALLBUF];
+	FILE	*f;
+	char	*ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "r")) == NULL)
+		return NULL;
+
+	ret = fgets(buf, (int)buflen, f);
+	fclose(f);
+
+	if (ret)
+		buf[strcspn(buf, "\n")] = '\0';
+
+	return ret;
+}
+
+/* A string as nut_usb_get_string() would get it from the device (with
+ * '?' for each non-ASCII character), NULL if there is none */
+static char * sysfs_usb_get_string(const char *dir, const char *name)
+{
+	char	buf[256], *p, *q;
+	unsigned char	c;
+
+	if (!sysfs_usb_read(dir, name, buf, sizeof(buf)))
+		return NULL;
+
+	for (p = q = buf; *p; p++) {
+		c = (unsigned char)*p;
+		if (c >= 0x80 && c < 0xC0)
+			continue;	/* rest of an UTF-8 sequence */
+		*q++ = (c >= 0x80) ? '?' : *p;
+	}
+	*q = '\0';
+
+	str_rtrim(buf, ' ');
+	if (!*buf)
+		return NULL;
+
+	return strdup(buf);
+}
+
+/* Get the strings of the device at bus_num/device_addr from sysfs:
+ * 0 if all those it has (non-zero index) were there, else -1 and
+ * the caller has to ask the device itself */
+static int sysfs_usb_get_strings(uint8_t bus_num, uint8_t device_addr,
+	uint8_t iManufacturer, uint8_t iProduct, uint8_t iSerialNumber,
+	char **vendor_name, char **device_name, char **serialnumber)
+{
+	DIR	*dp;
+	struct dirent	*dirp;
+	char	dir[SMALLBUF], buf[16];
+	int	found = 0;
+
+	if (device_addr == 0 || (dp = opendir(SYSFS_USB_DEVICES)) == NULL)
+		return -1;
+
+	while (!found && (dirp = readdir(dp)) != NULL) {
+		/* devices only, not their interfaces ("1-2:1.0") */
+		if (dirp->d_name[0] == '.' || strchr(dirp->d_name, ':'))
+			continue;
+
+		snprintf(dir, sizeof(dir), "%s/%s", SYSFS_USB_DEVICES, dirp->d_name);
+		if (sysfs_usb_read(dir, "busnum", buf, sizeof(buf))
+		 && atoi(buf) == bus_num
+		 && sysfs_usb_read(dir, "devnum", buf, sizeof(buf))
+		 && atoi(buf) == device_addr
+		)
+			found = 1;
+	}
+	closedir(dp);
+
+	if (!found)
+		return -1;
+
+	if (iManufacturer)
+		*vendor_name = sysfs_usb_get_string(dir, "manufacturer");
+	if (iProduct)
+		*device_name = sysfs_usb_get_string(dir, "product");
+	if (iSerialNumber)
+		*serialnumber = sysfs_usb_get_string(dir, "serial");
+
+	if ((iManufacturer && !*vendor_name)
+	 || (iProduct && !*device_name)
+	 || (iSerialNumber && !*serialnumber)
+	) {
+		free(*vendor_name);
+		free(*device_name);
+		free(*serialnumber);
+		*vendor_name = *device_name = *serialnumber = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+#endif	/* WITH_LIBUSB_1_0 && __linux__ */
+
 /* return NULL if error */
 nutscan_device_t * nutscan_scan_usb(nutscan_usb_t * scanopts)
 {
@@ -584,120 +692,133 @@ nutscan_device_t * nutscan_scan_usb(nutscan_usb_t * scanopts)
 				is_usb_device_supported(usb_device_table,
 					VendorID, ProductID, &alt_driver_names)) != NULL) {
 
-				/* open the device */
+				udev = NULL;
+#if WITH_LIBUSB_1_0 && (defined __linux__)
+				if (sysfs_usb_get_strings(bus_num,
+					(*nut_usb_get_device_address)(dev),
+					iManufacturer, iProduct, iSerialNumber,
+					&vendor_name, &device_name, &serialnumber) == 0
+				) {
+					upsdebugx(3, "%s: got the strings of bus '%s' device/port '%s' from sysfs",
+						__func__, busname, device_port);
+				} else
+#endif
+				{
+					/* open the device */
 #if WITH_LIBUSB_1_0
-				ret = (*nut_usb_open)(dev, &udev);
-				if (!udev || ret != LIBUSB_SUCCESS) {
-					upsdebugx(0, "WARNING: %s: "
-						"Failed to open device "
-						"bus '%s' device/port '%s' "
-						"bus/port '%s', skipping: %s",
-						__func__, busname,
-						device_port, bus_port,
-						(*nut_usb_strerror)(ret));
-
-					/* Note: closing is not applicable
-					 * it seems, and can even segfault
-					 * (even though an udev is not NULL
-					 * when e.g. permissions problem)
-					 */
+					ret = (*nut_usb_open)(dev, &udev);
+					if (!udev || ret != LIBUSB_SUCCESS) {
+						upsdebugx(0, "WARNING: %s: "
+							"Failed to open device "
+							"bus '%s' device/port '%s' "
+							"bus/port '%s', skipping: %s",
+							__func__, busname,
+							device_port, bus_port,
+							(*nut_usb_strerror)(ret));
+
+						/* Note: closing is not applicable
+						 * it seems, and can even segfault
+						 * (even though an udev is not NULL
+						 * when e.g. permissions problem)
+						 */
+
+						free(busname);
+						free(device_port);
+						if (bus_port != NULL) {
+							free(bus_port);
+							bus_port = NULL;
+						}
 
-					free(busname);
-					free(device_port);
-					if (bus_port != NULL) {
-						free(bus_port);
-						bus_port = NULL;
+						continue;
 					}
-
-					continue;
-				}
 #else  /* => WITH_LIBUSB_0_1 */
-				udev = (*nut_usb_open)(dev);
-				if (!udev) {
-					/* TOTHINK: any errno or similar to test? */
-					upsdebugx(0, "WARNING: %s: "
-						"Failed to open device "
-						"bus '%s' device/port '%s', skipping: %s",
-						__func__, busname, device_port,
-						(*nut_usb_strerror)());
-					continue;
-				}
+					udev = (*nut_usb_open)(dev);
+					if (!udev) {
+						/* TOTHINK: any errno or similar to test? */
+						upsdebugx(0, "WARNING: %s: "
+							"Failed to open device "
+							"bus '%s' device/port '%s', skipping: %s",
+							__func__, busname, device_port,
+							(*nut_usb_strerror)());
+						continue;
+					}
 #endif
 
-				/* get serial number */
-				if (iSerialNumber) {
-					ret = nut_usb_get_string(udev,
-						iSerialNumber, string, sizeof(string));
-					if (ret > 0) {
-						serialnumber = strdup(str_rtrim(string, ' '));
-						if (serialnumber == NULL) {
-							(*nut_usb_close)(udev);
+					/* get serial number */
+					if (iSerialNumber) {
+						ret = nut_usb_get_string(udev,
+							iSerialNumber, string, sizeof(string));
+						if (ret > 0) {
+							serialnumber = strdup(str_rtrim(string, ' '));
+							if (serialnumber == NULL) {
+								(*nut_usb_close)(udev);
 #if WITH_LIBUSB_1_0
-							free(busname);
-							free(device_port);
-							if (bus_port != NULL) {
-								free(bus_port);
-								bus_port = NULL;
-							}
-							(*nut_usb_free_device_list)(devlist, 1);
-							(*nut_usb_exit)(NULL);
+								free(busname);
+								free(device_port);
+								if (bus_port != NULL) {
+									free(bus_port);
+									bus_port = NULL;
+								}
+								(*nut_usb_free_device_list)(devlist, 1);
+								(*nut_usb_exit)(NULL);
 #endif	/* WITH_LIBUSB_1_0 */
-							upsdebug_with_errno(0, "%s: Out of memory", __func__);
-							/* nutscan_avail_usb = 0; */
-							return NULL;
+								upsdebug_with_errno(0, "%s: Out of memory", __func__);
+								/* nutscan_avail_usb = 0; */
+								return NULL;
+							}
 						}
 					}
-				}
 
-				/* get product name */
-				if (iProduct) {
-					ret = nut_usb_get_string(udev,
-						iProduct, string, sizeof(string));
-					if (ret > 0) {
-						device_name = strdup(str_rtrim(string, ' '));
-						if (device_name == NULL) {
-							free(serialnumber);
-							(*nut_usb_close)(udev);
+					/* get product name */
+					if (iProduct) {
+						ret = nut_usb_get_string(udev,
+							iProduct, string, sizeof(string));
+						if (ret > 0) {
+							device_name = strdup(str_rtrim(string, ' '));
+							if (device_name == NULL) {
+								free(serialnumber);
+								(*nut_usb_close)(udev);
 #if WITH_LIBUSB_1_0
-							free(busname);
-							free(device_port);
-							if (bus_port != NULL) {
-								free(bus_port);
-								bus_port = NULL;
-							}
-							(*nut_usb_free_device_list)(devlist, 1);
-							(*nut_usb_exit)(NULL);
+								free(busname);
+								free(device_port);
+								if (bus_port != NULL) {
+									free(bus_port);
+									bus_port = NULL;
+								}
+								(*nut_usb_free_device_list)(devlist, 1);
+								(*nut_usb_exit)(NULL);
 #endif	/* WITH_LIBUSB_1_0 */
-							upsdebug_with_errno(0, "%s: Out of memory", __func__);
-							/* nutscan_avail_usb = 0; */
-							return NULL;
+								upsdebug_with_errno(0, "%s: Out of memory", __func__);
+								/* nutscan_avail_usb = 0; */
+								return NULL;
+							}
 						}
 					}
-				}
 
-				/* get vendor name */
-				if (iManufacturer) {
-					ret = nut_usb_get_string(udev,
-						iManufacturer, string, sizeof(string));
-					if (ret > 0) {
-						vendor_name = strdup(str_rtrim(string, ' '));
-						if (vendor_name == NULL) {
-							free(serialnumber);
-							free(device_name);
-							(*nut_usb_close)(udev);
+					/* get vendor name */
+					if (iManufacturer) {
+						ret = nut_usb_get_string(udev,
+							iManufacturer, string, sizeof(string));
+						if (ret > 0) {
+							vendor_name = strdup(str_rtrim(string, ' '));
+							if (vendor_name == NULL) {
+								free(serialnumber);
+								free(device_name);
+								(*nut_usb_close)(udev);
 #if WITH_LIBUSB_1_0
-							free(busname);
-							free(device_port);
-							if (bus_port != NULL) {
-								free(bus_port);
-								bus_port = NULL;
-							}
-							(*nut_usb_free_device_list)(devlist, 1);
-							(*nut_usb_exit)(NULL);
+								free(busname);
+								free(device_port);
+								if (bus_port != NULL) {
+									free(bus_port);
+									bus_port = NULL;
+								}
+								(*nut_usb_free_device_list)(devlist, 1);
+								(*nut_usb_exit)(NULL);
 #endif	/* WITH_LIBUSB_1_0 */
-							upsdebug_with_errno(0, "%s: Out of memory", __func__);
-							/* nutscan_avail_usb = 0; */
-							return NULL;
+								upsdebug_with_errno(0, "%s: Out of memory", __func__);
+								/* nutscan_avail_usb = 0; */
+								return NULL;
+							}
 						}
 					}
 				}
@@ -709,7 +830,8 @@ nutscan_device_t * nutscan_scan_usb(nutscan_usb_t * scanopts)
 					free(serialnumber);
 					free(device_name);
 					free(vendor_name);
-					(*nut_usb_close)(udev);
+					if (udev)
+						(*nut_usb_close)(udev);
 #if WITH_LIBUSB_1_0
 					free(busname);
 					free(device_port);
@@ -853,10 +975,12 @@ nutscan_device_t * nutscan_scan_usb(nutscan_usb_t * scanopts)
 				current_nut_dev = nutscan_add_device_to_device(
 					current_nut_dev,
 					nut_dev);
+				nutscan_report_device(nut_dev);
 
 				memset (string, 0, sizeof(string));
 
-				(*nut_usb_close)(udev);
+				if (udev)
+					(*nut_usb_close)(udev);
 			}
 #if WITH_LIBUSB_0_1
 		}
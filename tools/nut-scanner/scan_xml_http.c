@@ -393,6 +393,7 @@ static void * nutscan_scan_xml_http_thready(void * arg)
 #ifdef HAVE_PTHREAD
 					pthread_mutex_unlock(&dev_mutex);
 #endif
+					nutscan_report_device(nut_dev);
 				}
 				else
 				{
@@ -483,7 +484,6 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 
 nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl, useconds_t usec_timeout, nutscan_xml_t * sec)
 {
-	bool_t pass = TRUE; /* Track that we may spawn a scanning thread */
 	nutscan_device_t * result = NULL;
 	nutscan_xml_t * tmp_sec = NULL;
 
@@ -503,22 +503,12 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 		/* Iterate the one or a range of IPs to scan */
 		nutscan_ip_range_list_iter_t ip;
 		char * ip_str = NULL;
+		nutscan_pool_batch_t * batch;
+		size_t max_threads_scantype = 0;
 
 #ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		sem_t * semaphore = nutscan_semaphore();
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-		sem_t   semaphore_scantype_inst;
-		sem_t * semaphore_scantype = &semaphore_scantype_inst;
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-		sem_t * semaphore_scantype = NULL;
-#  endif
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-		pthread_t thread;
-		nutscan_thread_t * thread_array = NULL;
-		size_t thread_count = 0, i;
 # if (defined HAVE_PTHREAD_TRYJOIN) || (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		size_t  max_threads_scantype = max_threads_netxml;
+		max_threads_scantype = max_threads_netxml;
 # endif
 #endif	/* HAVE_PTHREAD */
 
@@ -535,312 +525,43 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 
 #ifdef HAVE_PTHREAD
 		pthread_mutex_init(&dev_mutex, NULL);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		if (max_threads_scantype > 0) {
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunreachable-code"
-#endif
-			/* Different platforms, different sizes, none fits all... */
-			if (SIZE_MAX > UINT_MAX && max_threads_scantype > UINT_MAX) {
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-#ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-#pragma GCC diagnostic pop
-#endif
-				upsdebugx(1,
-					"WARNING: %s: Limiting max_threads_scantype to range acceptable for " REPORT_SEM_INIT_METHOD "()",
-					__func__);
-				max_threads_scantype = UINT_MAX - 1;
-			}
-
-			upsdebugx(4, "%s: " REPORT_SEM_INIT_METHOD "() for %" PRIuSIZE " threads", __func__, max_threads_scantype);
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-			if (sem_init(semaphore_scantype, 0, (unsigned int)max_threads_scantype)) {
-				upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-				max_threads_scantype = 0;
-			}
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-			if (SEM_FAILED == (semaphore_scantype = sem_open(SEMNAME_NETXML, O_CREAT, 0644, (unsigned int)max_threads_scantype))) {
-				upsdebug_with_errno(4, "%s: " REPORT_SEM_INIT_METHOD "() failed", __func__);
-				semaphore_scantype = NULL;
-				max_threads_scantype = 0;
-			}
-#  endif
-		}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-
 #endif /* HAVE_PTHREAD */
 
+		/* One job per address for the shared worker threads, no more
+		 * than max_threads_netxml of them at once (if set) */
+		batch = nutscan_pool_batch_new(max_threads_scantype);
+
 		ip_str = nutscan_ip_ranges_iter_init(&ip, irl);
 
 		while (ip_str != NULL) {
-#ifdef HAVE_PTHREAD
-			/* NOTE: With many enough targets to scan, this can crash
-			 * by spawning too many children; add a limit and loop to
-			 * "reap" some already done with their work. And probably
-			 * account them in thread_array[] as something to not wait
-			 * for below in pthread_join()...
-			 */
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-			/* Just wait for someone to free a semaphored slot,
-			 * if none are available, and then/otherwise grab one
-			 */
-			if (thread_array == NULL) {
-				/* Starting point, or after a wait to complete
-				 * all earlier runners */
-				if (max_threads_scantype > 0)
-					sem_wait(semaphore_scantype);
-				sem_wait(semaphore);
-				pass = TRUE;
-			} else {
-				/* If successful (the lock was acquired),
-				 * sem_wait() and sem_trywait() will return 0.
-				 * Otherwise, -1 is returned and errno is set,
-				 * and the state of the semaphore is unchanged.
-				 */
-				int	stwST = sem_trywait(semaphore_scantype);
-				int	stwS  = sem_trywait(semaphore);
-				pass = ((max_threads_scantype == 0 || stwST == 0) && stwS == 0);
-				upsdebugx(4, "%s: max_threads_scantype=%" PRIuSIZE
-					" curr_threads=%" PRIuSIZE
-					" thread_count=%" PRIuSIZE
-					" stwST=%d stwS=%d pass=%d",
-					__func__, max_threads_scantype,
-					curr_threads, thread_count,
-					stwST, stwS, pass
-				);
+			tmp_sec = malloc(sizeof(nutscan_xml_t));
+			if (tmp_sec == NULL) {
+				upsdebugx(0, "%s: Memory allocation error", __func__);
+				break;
 			}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-			/* A somewhat naive and brute-force solution for
-			 * systems without a semaphore.h. This may suffer
-			 * some off-by-one errors, using a few more threads
-			 * than intended (if we race a bit at the wrong time,
-			 * probably up to one per enabled scanner routine).
-			 */
 
-			/* TOTHINK: Should there be a threadcount_mutex when
-			 * we just read the value in if() and while() below?
-			 * At worst we would overflow the limit a bit due to
-			 * other protocol scanners...
-			 */
-			if (curr_threads >= max_threads
-			|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-			) {
-				upsdebugx(2, "%s: already running %" PRIuSIZE " scanning threads "
-					"(launched overall: %" PRIuSIZE "), "
-					"waiting until some would finish",
-					__func__, curr_threads, thread_count);
-
-				while (curr_threads >= max_threads
-				   || (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-				) {
-					for (i = 0; i < thread_count ; i++) {
-						int ret;
-
-						if (!thread_array[i].active) continue;
-
-						pthread_mutex_lock(&threadcount_mutex);
-						upsdebugx(3, "%s: Trying to join thread #%" PRIuSIZE "...", __func__, i);
-						ret = pthread_tryjoin_np(thread_array[i].thread, NULL);
-						switch (ret) {
-							case ESRCH:     /* No thread with the ID thread could be found - already "joined"? */
-								upsdebugx(5, "%s: Was thread #%" PRIuSIZE " joined earlier?", __func__, i);
-								break;
-							case 0:         /* thread exited */
-								if (curr_threads > 0) {
-									curr_threads --;
-									upsdebugx(4, "%s: Joined a finished thread #%" PRIuSIZE, __func__, i);
-								} else {
-									/* threadcount_mutex fault? */
-									upsdebugx(0, "WARNING: %s: Accounting of thread count "
-										"says we are already at 0", __func__);
-								}
-								thread_array[i].active = FALSE;
-								break;
-							case EBUSY:     /* actively running */
-								upsdebugx(6, "%s: thread #%" PRIuSIZE " still busy (%i)",
-									__func__, i, ret);
-								break;
-							case EDEADLK:   /* Errors with thread interactions... bail out? */
-							case EINVAL:    /* Errors with thread interactions... bail out? */
-							default:        /* new pthreads abilities? */
-								upsdebugx(5, "%s: thread #%" PRIuSIZE " reported code %i",
-									__func__, i, ret);
-								break;
-						}
-						pthread_mutex_unlock(&threadcount_mutex);
-					}
-
-					if (curr_threads >= max_threads
-					|| (curr_threads >= max_threads_scantype && max_threads_scantype > 0)
-					) {
-							usleep (10000); /* microSec's, so 0.01s here */
-					}
-				}
-				upsdebugx(2, "%s: proceeding with scan", __func__);
+			memcpy(tmp_sec, sec, sizeof(nutscan_xml_t));
+			tmp_sec->peername = ip_str;
+			if (tmp_sec->usec_timeout <= 0) {
+				tmp_sec->usec_timeout = usec_timeout;
 			}
 
-			/* NOTE: No change to default "pass" in this ifdef:
-			 * if we got to this line, we have a slot to use */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
+			nutscan_pool_submit(batch, nutscan_scan_xml_http_thready, (void*)tmp_sec);
 
-			if (pass) {
-				tmp_sec = malloc(sizeof(nutscan_xml_t));
-				if (tmp_sec == NULL) {
-					upsdebugx(0, "%s: Memory allocation error", __func__);
-					break;
-				}
-
-				memcpy(tmp_sec, sec, sizeof(nutscan_xml_t));
-				tmp_sec->peername = ip_str;
-				if (tmp_sec->usec_timeout <= 0) {
-					tmp_sec->usec_timeout = usec_timeout;
-				}
-
-#ifdef HAVE_PTHREAD
-				if (pthread_create(&thread, NULL, nutscan_scan_xml_http_thready, (void*)tmp_sec) == 0) {
-					nutscan_thread_t	*new_thread_array;
-# ifdef HAVE_PTHREAD_TRYJOIN
-					pthread_mutex_lock(&threadcount_mutex);
-					curr_threads++;
-# endif /* HAVE_PTHREAD_TRYJOIN */
-
-					thread_count++;
-					new_thread_array = realloc(thread_array,
-						thread_count * sizeof(nutscan_thread_t));
-					if (new_thread_array == NULL) {
-						upsdebugx(1, "%s: Failed to realloc thread array", __func__);
-						break;
-					}
-					else {
-						thread_array = new_thread_array;
-					}
-					thread_array[thread_count - 1].thread = thread;
-					thread_array[thread_count - 1].active = TRUE;
-
-# ifdef HAVE_PTHREAD_TRYJOIN
-					pthread_mutex_unlock(&threadcount_mutex);
-# endif /* HAVE_PTHREAD_TRYJOIN */
-				}
-#else	/* if not HAVE_PTHREAD */
-				nutscan_scan_xml_http_thready(tmp_sec);
-#endif	/* if HAVE_PTHREAD */
-
-				/* Prepare the next iteration; note that
-				 * nutscan_scan_xml_http_thready()
-				 * takes care of freeing "tmp_sec" and its
-				 * reference (NOT strdup!) to "ip_str" as
-				 * peername.
-				 */
-				ip_str = nutscan_ip_ranges_iter_inc(&ip);
-			} else { /* if not pass -- all slots busy */
-#ifdef HAVE_PTHREAD
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-				/* Wait for all current scans to complete */
-				if (thread_array != NULL) {
-					upsdebugx (2, "%s: Running too many scanning threads (%"
-						PRIuSIZE "), "
-						"waiting until older ones would finish",
-						__func__, thread_count);
-					for (i = 0; i < thread_count ; i++) {
-						int ret;
-						if (!thread_array[i].active) {
-							/* Probably should not get here,
-							 * but handle it just in case */
-							upsdebugx(0, "WARNING: %s: Midway clean-up: did not expect thread %" PRIuSIZE " to be not active",
-								__func__, i);
-							sem_post(semaphore);
-							if (max_threads_scantype > 0)
-								sem_post(semaphore_scantype);
-							continue;
-						}
-						thread_array[i].active = FALSE;
-						ret = pthread_join(thread_array[i].thread, NULL);
-						if (ret != 0) {
-							upsdebugx(0, "WARNING: %s: Midway clean-up: pthread_join() returned code %i",
-								__func__, ret);
-						}
-						sem_post(semaphore);
-						if (max_threads_scantype > 0)
-							sem_post(semaphore_scantype);
-					}
-					thread_count = 0;
-					free(thread_array);
-					thread_array = NULL;
-				}
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-				/* TODO: Move the wait-loop for TRYJOIN here? */
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif  /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-#endif   /* HAVE_PTHREAD */
-			} /* if: could we "pass" or not? */
+			/* Prepare the next iteration; note that
+			 * nutscan_scan_xml_http_thready()
+			 * takes care of freeing "tmp_sec" and its
+			 * reference (NOT strdup!) to "ip_str" as
+			 * peername.
+			 */
+			ip_str = nutscan_ip_ranges_iter_inc(&ip);
 		} /* while */
 
-#ifdef HAVE_PTHREAD
-		if (thread_array != NULL) {
-			upsdebugx(2, "%s: all planned scans launched, waiting for threads to complete", __func__);
-			for (i = 0; i < thread_count; i++) {
-				int ret;
-
-				if (!thread_array[i].active) continue;
+		upsdebugx(2, "%s: all planned scans queued, waiting for them to complete", __func__);
+		nutscan_pool_batch_wait(batch);
 
-				ret = pthread_join(thread_array[i].thread, NULL);
-				if (ret != 0) {
-					upsdebugx(0, "WARNING: %s: Clean-up: pthread_join() returned code %i",
-						__func__, ret);
-				}
-				thread_array[i].active = FALSE;
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-				sem_post(semaphore);
-				if (max_threads_scantype > 0)
-					sem_post(semaphore_scantype);
-# else
-#  ifdef HAVE_PTHREAD_TRYJOIN
-				pthread_mutex_lock(&threadcount_mutex);
-				if (curr_threads > 0) {
-					curr_threads --;
-					upsdebugx(5, "%s: Clean-up: Joined a finished thread #%" PRIuSIZE,
-						__func__, i);
-				} else {
-					upsdebugx(0, "WARNING: %s: Clean-up: Accounting of thread count "
-						"says we are already at 0", __func__);
-				}
-				pthread_mutex_unlock(&threadcount_mutex);
-#  endif /* HAVE_PTHREAD_TRYJOIN */
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
-			}
-			free(thread_array);
-			upsdebugx(2, "%s: all threads freed", __func__);
-		}
+#ifdef HAVE_PTHREAD
 		pthread_mutex_destroy(&dev_mutex);
-
-# if (defined HAVE_SEMAPHORE_UNNAMED) || (defined HAVE_SEMAPHORE_NAMED)
-		if (max_threads_scantype > 0) {
-#  if (defined HAVE_SEMAPHORE_UNNAMED)
-			sem_destroy(semaphore_scantype);
-#  elif (defined HAVE_SEMAPHORE_NAMED)
-			if (semaphore_scantype) {
-				sem_unlink(SEMNAME_NETXML);
-				sem_close(semaphore_scantype);
-				semaphore_scantype = NULL;
-			}
-#  endif
-		}
-# endif /* HAVE_SEMAPHORE_UNNAMED || HAVE_SEMAPHORE_NAMED */
 #endif /* HAVE_PTHREAD */
 
 		result = nutscan_rewind_device(dev_ret);
@@ -2000,7 +2000,8 @@ static bool source(nut::Serialisable * config, const std::string & file_name) {
 	if (!file.exists())
 		return false;
 
-	file.openx();
+	// Parsed in place where the file can be mapped to memory
+	file.openx(nut::NutFile::READ_ONLY_MAPPED);
 
 	bool parsed_ok = config->parseFrom(file);
 
@@ -2018,13 +2019,14 @@ static bool source(nut::Serialisable * config, const std::string & file_name) {
 /**
  *  \brief  Store configuration object to file
  *
- *  If the file exists, it's rewritten.
+ *  If the file exists, it's replaced as a whole (readers see either
+ *  the old or the new contents, and a failed write leaves it as it was).
  *
  *  \param  config     Configuration object
  *  \param  file_name  File name
  */
 static void store(nut::Serialisable * config, const std::string & file_name) {
-	nut::NutFile file(file_name, nut::NutFile::WRITE_ONLY);
+	nut::NutFile file(file_name, nut::NutFile::WRITE_ATOMIC);
 
 	bool written_ok = config->writeTo(file);
 
@@ -2053,7 +2055,7 @@ static bool isConfigured(const std::string & etc) {
 	if (!nut_conf_file.exists())
 		return false;
 
-	nut_conf_file.openx();
+	nut_conf_file.openx(nut::NutFile::READ_ONLY_MAPPED);
 
 	nut::NutConfiguration nut_conf;
 